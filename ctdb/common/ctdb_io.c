@@ -269,8 +269,15 @@ static void queue_dead(struct tevent_context *ev, struct tevent_immediate *im,
 }
 
 
+/* maximum number of queued packets handed to a single writev() */
+#define QUEUE_WRITE_MAX_IOV 64
+
 /*
   called when an incoming connection is writeable
+
+  Packets only get queued when the socket is full, so under load many
+  small packets pile up here. Write as many of them as possible with
+  a single system call.
 */
 static void queue_io_write(struct ctdb_queue *queue)
 {
@@ -280,7 +287,19 @@ static void queue_io_write(struct ctdb_queue *queue)
 		if (queue->ctdb->flags & CTDB_FLAG_TORTURE) {
 			n = write(queue->fd, pkt->data, 1);
 		} else {
-			n = write(queue->fd, pkt->data, pkt->length);
+			struct iovec iov[QUEUE_WRITE_MAX_IOV];
+			struct ctdb_queue_pkt *p;
+			int iovcnt = 0;
+
+			for (p = pkt;
+			     p != NULL && iovcnt < QUEUE_WRITE_MAX_IOV;
+			     p = p->next) {
+				iov[iovcnt].iov_base = p->data;
+				iov[iovcnt].iov_len = p->length;
+				iovcnt++;
+			}
+
+			n = writev(queue->fd, iov, iovcnt);
 		}
 
 		if (n == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
@@ -298,16 +317,22 @@ static void queue_io_write(struct ctdb_queue *queue)
 			return;
 		}
 		if (n <= 0) return;
-		
-		if (n != pkt->length) {
-			pkt->length -= n;
-			pkt->data += n;
-			return;
-		}
 
-		DLIST_REMOVE(queue->out_queue, pkt);
-		queue->out_queue_length--;
-		talloc_free(pkt);
+		while (n > 0) {
+			pkt = queue->out_queue;
+
+			if (n < pkt->length) {
+				pkt->length -= n;
+				pkt->data += n;
+				return;
+			}
+
+			n -= pkt->length;
+
+			DLIST_REMOVE(queue->out_queue, pkt);
+			queue->out_queue_length--;
+			talloc_free(pkt);
+		}
 	}
 
 	TEVENT_FD_NOT_WRITEABLE(queue->fde);
@@ -157,6 +157,10 @@ static struct {
 		offsetof(struct ctdb_tunable_list, ip_alloc_algorithm) },
 	{ "AllowMixedVersions", 0, false,
 		offsetof(struct ctdb_tunable_list, allow_mixed_versions) },
+	{ "VacuumChainsPerRun", 0, false,
+		offsetof(struct ctdb_tunable_list, vacuum_chains_per_run) },
+	{ "AutoStickyRecords", 0, false,
+		offsetof(struct ctdb_tunable_list, auto_sticky_records) },
 	{ .obsolete = true, }
 };
 
@@ -277,6 +277,7 @@ check_valid_tunable ()
 AllowClientDBAttach
 AllowMixedVersions
 AllowUnhealthyDBRead
+AutoStickyRecords
 ControlTimeout
 DBRecordCountWarn
 DBRecordSizeWarn
@@ -321,6 +322,7 @@ TDBMutexEnabled
 TakeoverTimeout
 TickleUpdateInterval
 TraverseTimeout
+VacuumChainsPerRun
 VacuumFastPathCount
 VacuumInterval
 VacuumLimit
@@ -27,6 +27,7 @@
 #include <talloc.h>
 #include <tevent.h>
 
+#include "lib/util/dlinklist.h"
 #include "lib/util/time.h"
 #include "lib/util/debug.h"
 
@@ -65,9 +66,11 @@ int ctdb_ibw_node_connect(struct ctdb_node *node)
 	if (rc) {
 		DEBUG(DEBUG_ERR, ("ctdb_ibw_node_connect/ibw_connect failed - retrying...\n"));
 		/* try again once a second */
-		tevent_add_timer(node->ctdb->ev, node,
-				 timeval_current_ofs(1, 0),
-				 ctdb_ibw_node_connect_event, node);
+		TALLOC_FREE(cn->connect_te);
+		cn->connect_te = tevent_add_timer(node->ctdb->ev, cn,
+						  timeval_current_ofs(1, 0),
+						  ctdb_ibw_node_connect_event,
+						  node);
 	}
 
 	/* continues at ibw_ctdb.c/IBWC_CONNECTED in good case */
@@ -79,10 +82,42 @@ void ctdb_ibw_node_connect_event(struct tevent_context *ev,
 				 struct timeval t, void *private_data)
 {
 	struct ctdb_node *node = talloc_get_type(private_data, struct ctdb_node);
+	struct ctdb_ibw_node *cn = talloc_get_type(node->private_data, struct ctdb_ibw_node);
 
+	cn->connect_te = NULL;
 	ctdb_ibw_node_connect(node);
 }
 
+/*
+ * Throw away the connection to a node together with anything still
+ * queued for it, and connect again after "delay" seconds.
+ */
+void ctdb_ibw_node_reconnect(struct ctdb_node *node, uint32_t delay)
+{
+	struct ctdb_ibw_node *cn = talloc_get_type(node->private_data, struct ctdb_ibw_node);
+	struct ibw_ctx *ictx = talloc_get_type(node->ctdb->private_data, struct ibw_ctx);
+
+	assert(cn!=NULL);
+	assert(ictx!=NULL);
+
+	TALLOC_FREE(cn->connect_te);
+
+	while (cn->queue != NULL) {
+		struct ctdb_ibw_msg *p = cn->queue;
+		DLIST_REMOVE(cn->queue, p);
+		talloc_free(p);
+	}
+	cn->queue_last = NULL;
+	cn->qcnt = 0;
+
+	talloc_free(cn->conn); /* internal queue content is destroyed */
+	cn->conn = ibw_conn_new(ictx, node);
+
+	cn->connect_te = tevent_add_timer(node->ctdb->ev, cn,
+					  timeval_current_ofs(delay, 0),
+					  ctdb_ibw_node_connect_event, node);
+}
+
 int ctdb_ibw_connstate_handler(struct ibw_ctx *ctx, struct ibw_conn *conn)
 {
 	if (ctx!=NULL) {
@@ -128,23 +163,24 @@ int ctdb_ibw_connstate_handler(struct ibw_ctx *ctx, struct ibw_conn *conn)
 		} break;
 		case IBWC_DISCONNECTED: { /* after ibw_disconnect */
 			struct ctdb_node *node = talloc_get_type(conn->conn_userdata, struct ctdb_node);
-			if (node!=NULL)
+			if (node!=NULL) {
+				struct ctdb_ibw_node *cn = talloc_get_type(node->private_data, struct ctdb_ibw_node);
+
+				/* this calls ctdb_ibw_restart unless the
+				 * node was already marked disconnected */
 				node->ctdb->upcalls->node_dead(node);
-			talloc_free(conn);
-			/* normal + intended disconnect => not reconnecting in this layer */
+				if (cn->conn == conn) {
+					ctdb_ibw_node_reconnect(node, 1);
+				}
+			} else {
+				talloc_free(conn);
+			}
 		} break;
 		case IBWC_ERROR: {
 			struct ctdb_node *node = talloc_get_type(conn->conn_userdata, struct ctdb_node);
 			if (node!=NULL) {
-				struct ctdb_ibw_node *cn = talloc_get_type(node->private_data, struct ctdb_ibw_node);
-				struct ibw_ctx *ictx = cn->conn->ctx;
-
 				DEBUG(DEBUG_DEBUG, ("IBWC_ERROR, reconnecting...\n"));
-				talloc_free(cn->conn); /* internal queue content is destroyed */
-				cn->conn = (void *)ibw_conn_new(ictx, node);
-				tevent_add_timer(node->ctdb->ev, node,
-						 timeval_current_ofs(1, 0),
-						 ctdb_ibw_node_connect_event, node);
+				ctdb_ibw_node_reconnect(node, 1);
 			}
 		} break;
 		default:
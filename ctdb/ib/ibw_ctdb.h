@@ -29,6 +29,7 @@ struct ctdb_ibw_msg {
 
 struct ctdb_ibw_node {
 	struct ibw_conn *conn;
+	struct tevent_timer *connect_te;
 
 	struct ctdb_ibw_msg *queue;
 	struct ctdb_ibw_msg *queue_last;
@@ -45,6 +46,7 @@ int ctdb_ibw_node_connect(struct ctdb_node *node);
 void ctdb_ibw_node_connect_event(struct tevent_context *ev,
 				 struct tevent_timer *te,
 				 struct timeval t, void *private_data);
+void ctdb_ibw_node_reconnect(struct ctdb_node *node, uint32_t delay);
 
 int ctdb_flush_cn_queue(struct ctdb_ibw_node *cn);
 
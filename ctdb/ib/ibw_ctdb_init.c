@@ -99,6 +99,21 @@ static int ctdb_ibw_initialise(struct ctdb_context *ctdb)
 }
 
 
+/*
+ * connect to a node, everything async here
+ */
+static int ctdb_ibw_connect_node(struct ctdb_node *node)
+{
+	struct ctdb_context *ctdb = node->ctdb;
+
+	/* we only need to connect to other nodes */
+	if (ctdb_same_address(ctdb->address, &node->address)) {
+		return 0;
+	}
+
+	return ctdb_ibw_node_connect(node);
+}
+
 /*
  * Start infiniband
  */
@@ -106,12 +121,11 @@ static int ctdb_ibw_start(struct ctdb_context *ctdb)
 {
 	int i;
 
-	/* everything async here */
 	for (i=0;i<ctdb->num_nodes;i++) {
-		struct ctdb_node *node = ctdb->nodes[i];
-		if (!ctdb_same_address(ctdb->address, &node->address)) {
-			ctdb_ibw_node_connect(node);
+		if (ctdb->nodes[i]->flags & NODE_FLAGS_DELETED) {
+			continue;
 		}
+		ctdb_ibw_connect_node(ctdb->nodes[i]);
 	}
 
 	return 0;
@@ -185,42 +199,65 @@ static int ctdb_ibw_queue_pkt(struct ctdb_node *node, uint8_t *data, uint32_t le
 	return rc;
 }
 
+/*
+ * shutdown and try to restart a connection to a node after it has been
+ * disconnected
+ */
 static void ctdb_ibw_restart(struct ctdb_node *node)
 {
-	/* TODO: implement this method for IB */
-	DEBUG(DEBUG_ALERT,("WARNING: method restart is not yet implemented for IB\n"));
+	DEBUG(DEBUG_NOTICE,("Tearing down connection to dead node :%d\n", node->pnn));
+
+	ctdb_ibw_node_reconnect(node, 0);
 }
 
 /*
- * transport packet allocator - allows transport to control memory for packets
+ * shutdown the transport
  */
-static void *ctdb_ibw_allocate_pkt(TALLOC_CTX *mem_ctx, size_t size)
+static void ctdb_ibw_shutdown(struct ctdb_context *ctdb)
 {
-	/* TODO: use ibw_alloc_send_buf instead... */
-	return talloc_size(mem_ctx, size);
-}
+	struct ibw_ctx *ictx = talloc_get_type(ctdb->private_data, struct ibw_ctx);
+	int i;
 
-#ifdef __NOTDEF__
+	if (ictx == NULL) {
+		return;
+	}
 
-static int ctdb_ibw_stop(struct ctdb_context *cctx)
-{
-	struct ibw_ctx *ictx = talloc_get_type(cctx->private_data, struct ibw_ctx);
+	/*
+	 * The connections are children of the nodes but unlink
+	 * themselves from the ibw_ctx, so they have to go first.
+	 */
+	for (i=0; i<ctdb->num_nodes; i++) {
+		struct ctdb_ibw_node *cn = talloc_get_type(
+			ctdb->nodes[i]->private_data, struct ctdb_ibw_node);
+		if (cn == NULL) {
+			continue;
+		}
+		TALLOC_FREE(cn->connect_te);
+		TALLOC_FREE(cn->conn);
+	}
 
-	assert(ictx!=NULL);
-	return ibw_stop(ictx);
+	talloc_free(ictx);
+	ctdb->private_data = NULL;
 }
 
-#endif /* __NOTDEF__ */
+/*
+ * transport packet allocator - allows transport to control memory for packets
+ */
+static void *ctdb_ibw_allocate_pkt(TALLOC_CTX *mem_ctx, size_t size)
+{
+	/* TODO: use ibw_alloc_send_buf instead... */
+	return talloc_size(mem_ctx, size);
+}
 
 static const struct ctdb_methods ctdb_ibw_methods = {
-	.initialise= ctdb_ibw_initialise,
-	.start     = ctdb_ibw_start,
-	.queue_pkt = ctdb_ibw_queue_pkt,
-	.add_node = ctdb_ibw_add_node,
+	.initialise   = ctdb_ibw_initialise,
+	.start        = ctdb_ibw_start,
+	.queue_pkt    = ctdb_ibw_queue_pkt,
+	.add_node     = ctdb_ibw_add_node,
+	.connect_node = ctdb_ibw_connect_node,
 	.allocate_pkt = ctdb_ibw_allocate_pkt,
+	.shutdown     = ctdb_ibw_shutdown,
 	.restart      = ctdb_ibw_restart,
-
-//	.stop = ctdb_ibw_stop
 };
 
 /*
@@ -656,6 +656,8 @@ struct ctdb_tunable_list {
 	uint32_t queue_buffer_size;
 	uint32_t ip_alloc_algorithm;
 	uint32_t allow_mixed_versions;
+	uint32_t vacuum_chains_per_run;
+	uint32_t auto_sticky_records;
 };
 
 struct ctdb_tickle_list {
@@ -828,6 +830,8 @@ struct ctdb_db_statistics {
 	} vacuum;
 	uint32_t db_ro_delegations;
 	uint32_t db_ro_revokes;
+	uint32_t db_sticky_records;
+	uint32_t db_sticky_pindowns;
 	uint32_t hop_count_bucket[MAX_COUNT_BUCKETS];
 	uint32_t num_hot_keys;
 	struct {
@@ -2560,7 +2560,9 @@ size_t ctdb_tunable_list_len(struct ctdb_tunable_list *in)
 		ctdb_uint32_len(&in->rec_buffer_size_limit) +
 		ctdb_uint32_len(&in->queue_buffer_size) +
 		ctdb_uint32_len(&in->ip_alloc_algorithm) +
-		ctdb_uint32_len(&in->allow_mixed_versions);
+		ctdb_uint32_len(&in->allow_mixed_versions) +
+		ctdb_uint32_len(&in->vacuum_chains_per_run) +
+		ctdb_uint32_len(&in->auto_sticky_records);
 }
 
 void ctdb_tunable_list_push(struct ctdb_tunable_list *in, uint8_t *buf,
@@ -2754,6 +2756,12 @@ void ctdb_tunable_list_push(struct ctdb_tunable_list *in, uint8_t *buf,
 	ctdb_uint32_push(&in->allow_mixed_versions, buf+offset, &np);
 	offset += np;
 
+	ctdb_uint32_push(&in->vacuum_chains_per_run, buf+offset, &np);
+	offset += np;
+
+	ctdb_uint32_push(&in->auto_sticky_records, buf+offset, &np);
+	offset += np;
+
 	*npush = offset;
 }
 
@@ -3199,6 +3207,20 @@ static int ctdb_tunable_list_pull_elems(uint8_t *buf, size_t buflen,
 	}
 	offset += np;
 
+	ret = ctdb_uint32_pull(buf+offset, buflen-offset,
+			       &out->vacuum_chains_per_run, &np);
+	if (ret != 0) {
+		return ret;
+	}
+	offset += np;
+
+	ret = ctdb_uint32_pull(buf+offset, buflen-offset,
+			       &out->auto_sticky_records, &np);
+	if (ret != 0) {
+		return ret;
+	}
+	offset += np;
+
 	*npull = offset;
 	return 0;
 }
@@ -4490,6 +4512,8 @@ size_t ctdb_db_statistics_len(struct ctdb_db_statistics *in)
 		ctdb_latency_counter_len(&in->vacuum.latency) +
 		ctdb_uint32_len(&in->db_ro_delegations) +
 		ctdb_uint32_len(&in->db_ro_revokes) +
+		ctdb_uint32_len(&in->db_sticky_records) +
+		ctdb_uint32_len(&in->db_sticky_pindowns) +
 		MAX_COUNT_BUCKETS *
 			ctdb_uint32_len(&in->hop_count_bucket[0]) +
 		ctdb_uint32_len(&in->num_hot_keys) +
@@ -4541,6 +4565,12 @@ void ctdb_db_statistics_push(struct ctdb_db_statistics *in, uint8_t *buf,
 	ctdb_uint32_push(&in->db_ro_revokes, buf+offset, &np);
 	offset += np;
 
+	ctdb_uint32_push(&in->db_sticky_records, buf+offset, &np);
+	offset += np;
+
+	ctdb_uint32_push(&in->db_sticky_pindowns, buf+offset, &np);
+	offset += np;
+
 	for (i=0; i<MAX_COUNT_BUCKETS; i++) {
 		ctdb_uint32_push(&in->hop_count_bucket[i], buf+offset, &np);
 		offset += np;
@@ -4645,6 +4675,20 @@ static int ctdb_db_statistics_pull_elems(uint8_t *buf, size_t buflen,
 	}
 	offset += np;
 
+	ret = ctdb_uint32_pull(buf+offset, buflen-offset,
+			       &out->db_sticky_records, &np);
+	if (ret != 0) {
+		return ret;
+	}
+	offset += np;
+
+	ret = ctdb_uint32_pull(buf+offset, buflen-offset,
+			       &out->db_sticky_pindowns, &np);
+	if (ret != 0) {
+		return ret;
+	}
+	offset += np;
+
 	for (i=0; i<MAX_COUNT_BUCKETS; i++) {
 		ret = ctdb_uint32_pull(buf+offset, buflen-offset,
 				       &out->hop_count_bucket[i], &np);
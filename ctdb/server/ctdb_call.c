@@ -43,10 +43,14 @@
 #include "common/logging.h"
 #include "common/hash_count.h"
 
+struct pinned_down_deferred_call;
+
 struct ctdb_sticky_record {
 	struct ctdb_context *ctdb;
 	struct ctdb_db_context *ctdb_db;
 	TDB_CONTEXT *pindown;
+	/* requests deferred during the pindown, oldest first */
+	struct pinned_down_deferred_call *deferred;
 };
 
 /*
@@ -278,6 +282,43 @@ static void ctdb_call_send_dmaster(struct ctdb_db_context *ctdb_db,
 	talloc_free(r);
 }
 
+/*
+  records of this database can be made sticky, either because the
+  database is marked STICKY or because AutoStickyRecords is set
+*/
+static bool ctdb_db_sticky_records(struct ctdb_context *ctdb,
+				   struct ctdb_db_context *ctdb_db)
+{
+	if (ctdb_db_sticky(ctdb_db)) {
+		return true;
+	}
+
+	if (ctdb->tunable.auto_sticky_records == 0 ||
+	    !ctdb_db_volatile(ctdb_db)) {
+		return false;
+	}
+
+	if (ctdb_db->sticky_records == NULL) {
+		ctdb_db->sticky_records = trbt_create(ctdb_db, 0);
+		if (ctdb_db->sticky_records == NULL) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void ctdb_sticky_pindown_release(struct ctdb_sticky_record *sr)
+{
+	/* requeue the deferred requests in the order they came in,
+	   each destructor unlinks its own entry */
+	while (sr->deferred != NULL) {
+		talloc_free(sr->deferred);
+	}
+
+	TALLOC_FREE(sr->pindown);
+}
+
 static void ctdb_sticky_pindown_timeout(struct tevent_context *ev,
 					struct tevent_timer *te,
 					struct timeval t, void *private_data)
@@ -286,10 +327,7 @@ static void ctdb_sticky_pindown_timeout(struct tevent_context *ev,
 						       struct ctdb_sticky_record);
 
 	DEBUG(DEBUG_ERR,("Pindown timeout db:%s  unstick record\n", sr->ctdb_db->db_name));
-	if (sr->pindown != NULL) {
-		talloc_free(sr->pindown);
-		sr->pindown = NULL;
-	}
+	ctdb_sticky_pindown_release(sr);
 }
 
 static int
@@ -321,6 +359,7 @@ ctdb_set_sticky_pindown(struct ctdb_context *ctdb, struct ctdb_db_context *ctdb_
 			DEBUG(DEBUG_ERR,("Failed to allocate pindown context for sticky record\n"));
 			return -1;
 		}
+		CTDB_INCREMENT_DB_STAT(ctdb_db, db_sticky_pindowns);
 		tevent_add_timer(ctdb->ev, sr->pindown,
 				 timeval_current_ofs(ctdb->tunable.sticky_pindown / 1000,
 						     (ctdb->tunable.sticky_pindown * 1000) % 1000000),
@@ -377,11 +416,11 @@ static void ctdb_become_dmaster(struct ctdb_db_context *ctdb_db,
 		return;
 	}
 
-	/* we just became DMASTER and this database is "sticky",
+	/* we just became DMASTER and this database has sticky records,
 	   see if the record is flagged as "hot" and set up a pin-down
 	   context to stop migrations for a little while if so
 	*/
-	if (ctdb_db_sticky(ctdb_db)) {
+	if (ctdb_db->sticky_records != NULL) {
 		ctdb_set_sticky_pindown(ctdb, ctdb_db, key);
 	}
 
@@ -683,6 +722,7 @@ static void ctdb_sticky_record_timeout(struct tevent_context *ev,
 {
 	struct ctdb_sticky_record *sr = talloc_get_type(private_data, 
 						       struct ctdb_sticky_record);
+	ctdb_sticky_pindown_release(sr);
 	talloc_free(sr);
 }
 
@@ -725,12 +765,14 @@ ctdb_make_record_sticky(struct ctdb_context *ctdb, struct ctdb_db_context *ctdb_
 	sr->ctdb    = ctdb;
 	sr->ctdb_db = ctdb_db;
 	sr->pindown = NULL;
+	sr->deferred = NULL;
 
 	DEBUG(DEBUG_ERR,("Make record sticky for %d seconds in db %s key:0x%08x.\n",
 			 ctdb->tunable.sticky_duration,
 			 ctdb_db->db_name, ctdb_hash(&key)));
 
 	trbt_insertarray32_callback(ctdb_db->sticky_records, k[0], &k[0], ctdb_make_sticky_record_callback, sr);
+	CTDB_INCREMENT_DB_STAT(ctdb_db, db_sticky_records);
 
 	tevent_add_timer(ctdb->ev, sr,
 			 timeval_current_ofs(ctdb->tunable.sticky_duration, 0),
@@ -746,6 +788,8 @@ struct pinned_down_requeue_handle {
 };
 
 struct pinned_down_deferred_call {
+	struct pinned_down_deferred_call *prev, *next;
+	struct ctdb_sticky_record *sr;
 	struct ctdb_context *ctdb;
 	struct ctdb_req_header *hdr;
 };
@@ -768,6 +812,8 @@ static int pinned_down_destructor(struct pinned_down_deferred_call *pinned_down)
 	struct ctdb_context *ctdb = pinned_down->ctdb;
 	struct pinned_down_requeue_handle *handle = talloc(ctdb, struct pinned_down_requeue_handle);
 
+	DLIST_REMOVE(pinned_down->sr->deferred, pinned_down);
+
 	handle->ctdb = pinned_down->ctdb;
 	handle->hdr  = pinned_down->hdr;
 	talloc_steal(handle, handle->hdr);
@@ -811,9 +857,12 @@ ctdb_defer_pinned_down_request(struct ctdb_context *ctdb, struct ctdb_db_context
 		return -1;
 	}
 
+	pinned_down->sr   = sr;
 	pinned_down->ctdb = ctdb;
 	pinned_down->hdr  = hdr;
 
+	DLIST_ADD_END(sr->deferred, pinned_down);
+
 	talloc_set_destructor(pinned_down, pinned_down_destructor);
 	talloc_steal(pinned_down, hdr);
 
@@ -929,7 +978,7 @@ void ctdb_request_call(struct ctdb_context *ctdb, struct ctdb_req_header *hdr)
 	/* If this record is pinned down we should defer the
 	   request until the pindown times out
 	*/
-	if (ctdb_db_sticky(ctdb_db)) {
+	if (ctdb_db->sticky_records != NULL) {
 		if (ctdb_defer_pinned_down_request(ctdb, ctdb_db, call->key, hdr) == 0) {
 			DEBUG(DEBUG_WARNING,
 			      ("Defer request for pinned down record in %s\n", ctdb_db->db_name));
@@ -1012,6 +1061,15 @@ void ctdb_request_call(struct ctdb_context *ctdb, struct ctdb_req_header *hdr)
 
 	if ( (!(c->flags & CTDB_WANT_READONLY))
 	&& (header.flags & (CTDB_REC_RO_HAVE_DELEGATIONS|CTDB_REC_RO_HAVE_READONLY)) ) {
+		/* A record that other nodes read and that is written
+		   as well is about to bounce between the nodes. Treat
+		   it as hot, just like one with a high hopcount, so
+		   that it is pinned down once we get it back.
+		*/
+		if (ctdb_db_sticky_records(ctdb, ctdb_db)) {
+			ctdb_make_record_sticky(ctdb, ctdb_db, call->key);
+		}
+
 		header.flags   |= CTDB_REC_RO_REVOKING_READONLY;
 		if (ctdb_ltdb_store(ctdb_db, call->key, &header, data) != 0) {
 			ctdb_fatal(ctdb, "Failed to store record with HAVE_DELEGATIONS set");
@@ -1105,8 +1163,8 @@ void ctdb_request_call(struct ctdb_context *ctdb, struct ctdb_req_header *hdr)
 	   hopcount is big. If it is it means the record is hot and we
 	   should make it sticky.
 	*/
-	if (ctdb_db_sticky(ctdb_db) &&
-	    c->hopcount >= ctdb->tunable.hopcount_make_sticky) {
+	if (c->hopcount >= ctdb->tunable.hopcount_make_sticky &&
+	    ctdb_db_sticky_records(ctdb, ctdb_db)) {
 		ctdb_make_record_sticky(ctdb, ctdb_db, call->key);
 	}
 
@@ -44,6 +44,10 @@
  * 4. If the child process cannot get locks within certain time,
  *    execute an external script to debug.
  *
+ * A record lock that has become free while the request was queued is
+ * taken by the daemon itself with a non-blocking chainlock, without
+ * creating a child process.
+ *
  * ctdb_lock_record()      - get a lock on a record
  * ctdb_lock_db()          - get a lock on a DB
  *
@@ -83,6 +87,9 @@ struct lock_context {
 	struct timeval start_time;
 	uint32_t key_hash;
 	bool can_schedule;
+	/* chainlock held by the daemon itself, see ctdb_lock_inline() */
+	bool inline_locked;
+	struct tevent_immediate *im;
 };
 
 /* lock_request is the client specific part for a lock request */
@@ -191,7 +198,13 @@ static int ctdb_lock_context_destructor(struct lock_context *lock_ctx)
 	if (lock_ctx->request) {
 		lock_ctx->request->lctx = NULL;
 	}
-	if (lock_ctx->child > 0) {
+	if (lock_ctx->im != NULL) {
+		/* Already off the lists, see ctdb_lock_inline() */
+		if (lock_ctx->inline_locked) {
+			tdb_chainunlock(lock_ctx->ctdb_db->ltdb->tdb,
+					lock_ctx->key);
+		}
+	} else if (lock_ctx->child > 0) {
 		ctdb_kill(lock_ctx->ctdb, lock_ctx->child, SIGTERM);
 		if (lock_ctx->type == LOCK_RECORD) {
 			DLIST_REMOVE(lock_ctx->ctdb_db->lock_current, lock_ctx);
@@ -709,6 +722,93 @@ static struct lock_context *ctdb_find_lock_context(struct ctdb_context *ctdb)
 	return NULL;
 }
 
+/*
+ * Hand a record lock taken by ctdb_lock_inline() to the requester
+ */
+static void ctdb_lock_inline_handler(struct tevent_context *ev,
+				     struct tevent_immediate *im,
+				     void *private_data)
+{
+	struct lock_context *lock_ctx = talloc_get_type_abort(
+		private_data, struct lock_context);
+	struct lock_request *request = lock_ctx->request;
+	double t;
+	int id;
+
+	t = timeval_elapsed(&lock_ctx->start_time);
+	id = lock_bucket_id(t);
+
+	CTDB_INCREMENT_STAT(lock_ctx->ctdb, locks.num_calls);
+	CTDB_INCREMENT_DB_STAT(lock_ctx->ctdb_db, locks.num_calls);
+	CTDB_INCREMENT_STAT(lock_ctx->ctdb, locks.buckets[id]);
+	CTDB_UPDATE_LATENCY(lock_ctx->ctdb, lock_ctx->ctdb_db,
+			    lock_type_str[lock_ctx->type], locks.latency,
+			    lock_ctx->start_time);
+	CTDB_UPDATE_DB_LATENCY(lock_ctx->ctdb_db,
+			       lock_type_str[lock_ctx->type],
+			       locks.latency, t);
+	CTDB_INCREMENT_DB_STAT(lock_ctx->ctdb_db, locks.buckets[id]);
+
+	/* Since request may be freed in the callback, unset it */
+	request->lctx = NULL;
+	lock_ctx->request = NULL;
+
+	request->callback(request->private_data, true);
+
+	/*
+	 * The callback takes its own (nested) chainlock if it needs the
+	 * record, drop ours. The destructor reschedules pending locks.
+	 */
+	talloc_free(lock_ctx);
+}
+
+/*
+ * The holder of a contended record lock is usually done long before
+ * a lock helper could be started, or by the time a queued request is
+ * scheduled. Try a non-blocking chainlock first and only create a
+ * child process if the record is still locked.
+ *
+ * The callback runs from an immediate event, callers of
+ * ctdb_lock_record() do not expect it to be called before they
+ * return.
+ */
+static bool ctdb_lock_inline(struct lock_context *lock_ctx)
+{
+	struct ctdb_context *ctdb = lock_ctx->ctdb;
+	struct ctdb_db_context *ctdb_db = lock_ctx->ctdb_db;
+	int ret;
+
+	if (lock_ctx->type != LOCK_RECORD || !lock_ctx->auto_mark) {
+		return false;
+	}
+
+	/* when torturing, ensure we test the lock helper */
+	if (ctdb->flags & CTDB_FLAG_TORTURE) {
+		return false;
+	}
+
+	lock_ctx->im = tevent_create_immediate(lock_ctx);
+	if (lock_ctx->im == NULL) {
+		return false;
+	}
+
+	ret = tdb_chainlock_nonblock(ctdb_db->ltdb->tdb, lock_ctx->key);
+	if (ret != 0) {
+		TALLOC_FREE(lock_ctx->im);
+		return false;
+	}
+	lock_ctx->inline_locked = true;
+
+	DLIST_REMOVE(ctdb_db->lock_pending, lock_ctx);
+	CTDB_DECREMENT_STAT(ctdb, locks.num_pending);
+	CTDB_DECREMENT_DB_STAT(ctdb_db, locks.num_pending);
+
+	tevent_schedule_immediate(lock_ctx->im, ctdb->ev,
+				  ctdb_lock_inline_handler, lock_ctx);
+
+	return true;
+}
+
 /*
  * Schedule a new lock child process
  * Set up callback handler and timeout handler
@@ -735,6 +835,10 @@ static void ctdb_lock_schedule(struct ctdb_context *ctdb)
 		return;
 	}
 
+	if (ctdb_lock_inline(lock_ctx)) {
+		return;
+	}
+
 	lock_ctx->child = -1;
 	ret = pipe(lock_ctx->fd);
 	if (ret != 0) {
@@ -1598,7 +1598,10 @@ int ctdb_set_db_sticky(struct ctdb_context *ctdb, struct ctdb_db_context *ctdb_d
 		return -1;
 	}
 
-	ctdb_db->sticky_records = trbt_create(ctdb_db, 0);
+	/* AutoStickyRecords may already have created the tree */
+	if (ctdb_db->sticky_records == NULL) {
+		ctdb_db->sticky_records = trbt_create(ctdb_db, 0);
+	}
 
 	ctdb_db_set_sticky(ctdb_db);
 
@@ -171,6 +171,12 @@ static int ctdb_persistent_state_destructor(struct ctdb_persistent_state *state)
 /*
  * Store a set of persistent records.
  * This is used to roll out a transaction to all nodes.
+ *
+ * Only one commit per database can be active. Clients already
+ * serialise their transactions on a database with a cluster-wide
+ * g_lock and check the database sequence number after the commit, so
+ * commits from different clients can't be merged into one update
+ * without changing the transaction semantics.
  */
 int32_t ctdb_control_trans3_commit(struct ctdb_context *ctdb,
 				   struct ctdb_req_control_old *c,
@@ -136,11 +136,6 @@ static const char *recdb_name(struct recdb_context *recdb)
 	return recdb->db_name;
 }
 
-static const char *recdb_path(struct recdb_context *recdb)
-{
-	return recdb->db_path;
-}
-
 static struct tdb_context *recdb_tdb(struct recdb_context *recdb)
 {
 	return recdb->db->tdb;
@@ -156,6 +151,20 @@ struct recdb_add_traverse_state {
 	int mypnn;
 };
 
+static int recdb_add_header_parser(TDB_DATA key, TDB_DATA data,
+				   void *private_data)
+{
+	struct ctdb_ltdb_header *prev_hdr =
+		(struct ctdb_ltdb_header *)private_data;
+
+	if (data.dsize < sizeof(struct ctdb_ltdb_header)) {
+		return -1;
+	}
+
+	*prev_hdr = *(struct ctdb_ltdb_header *)data.dptr;
+	return 0;
+}
+
 static int recdb_add_traverse(uint32_t reqid, struct ctdb_ltdb_header *header,
 			      TDB_DATA key, TDB_DATA data,
 			      void *private_data)
@@ -163,7 +172,7 @@ static int recdb_add_traverse(uint32_t reqid, struct ctdb_ltdb_header *header,
 	struct recdb_add_traverse_state *state =
 		(struct recdb_add_traverse_state *)private_data;
 	struct ctdb_ltdb_header *hdr;
-	TDB_DATA prev_data;
+	struct ctdb_ltdb_header prev_hdr;
 	int ret;
 
 	/* header is not marshalled separately in the pulldb control */
@@ -173,14 +182,11 @@ static int recdb_add_traverse(uint32_t reqid, struct ctdb_ltdb_header *header,
 
 	hdr = (struct ctdb_ltdb_header *)data.dptr;
 
-	/* fetch the existing record, if any */
-	prev_data = tdb_fetch(recdb_tdb(state->recdb), key);
-
-	if (prev_data.dptr != NULL) {
-		struct ctdb_ltdb_header prev_hdr;
+	/* look at the header of the existing record, if any */
+	ret = tdb_parse_record(recdb_tdb(state->recdb), key,
+			       recdb_add_header_parser, &prev_hdr);
 
-		prev_hdr = *(struct ctdb_ltdb_header *)prev_data.dptr;
-		free(prev_data.dptr);
+	if (ret == 0) {
 		if (hdr->rsn < prev_hdr.rsn ||
 		    (hdr->rsn == prev_hdr.rsn &&
 		     prev_hdr.dmaster != state->mypnn)) {
@@ -217,7 +223,7 @@ static int recbuf_filter_add(struct ctdb_rec_buffer *recbuf, bool persistent,
 			     uint32_t reqid, uint32_t dmaster,
 			     TDB_DATA key, TDB_DATA data)
 {
-	struct ctdb_ltdb_header *header;
+	struct ctdb_ltdb_header header;
 	int ret;
 
 	/* Skip empty records */
@@ -225,14 +231,21 @@ static int recbuf_filter_add(struct ctdb_rec_buffer *recbuf, bool persistent,
 		return 0;
 	}
 
+	/*
+	 * Work on a copy of the header, data may point into the
+	 * mmapped recdb
+	 */
+	header = *(struct ctdb_ltdb_header *)data.dptr;
+	data.dptr += sizeof(struct ctdb_ltdb_header);
+	data.dsize -= sizeof(struct ctdb_ltdb_header);
+
 	/* update the dmaster field to point to us */
-	header = (struct ctdb_ltdb_header *)data.dptr;
 	if (!persistent) {
-		header->dmaster = dmaster;
-		header->flags |= CTDB_REC_FLAG_MIGRATED_WITH_DATA;
+		header.dmaster = dmaster;
+		header.flags |= CTDB_REC_FLAG_MIGRATED_WITH_DATA;
 	}
 
-	ret = ctdb_rec_buffer_add(recbuf, recbuf, reqid, NULL, key, data);
+	ret = ctdb_rec_buffer_add(recbuf, recbuf, reqid, &header, key, data);
 	if (ret != 0) {
 		return ret;
 	}
@@ -294,25 +307,20 @@ static struct ctdb_rec_buffer *recdb_records(struct recdb_context *recdb,
 	return state.recbuf;
 }
 
-struct recdb_file_traverse_state {
+struct recdb_chunk_traverse_state {
 	struct ctdb_rec_buffer *recbuf;
-	struct recdb_context *recdb;
-	TALLOC_CTX *mem_ctx;
 	uint32_t dmaster;
 	uint32_t reqid;
 	bool persistent;
 	bool failed;
-	int fd;
-	int max_size;
-	int num_buffers;
 };
 
-static int recdb_file_traverse(struct tdb_context *tdb,
-			       TDB_DATA key, TDB_DATA data,
-			       void *private_data)
+static int recdb_chunk_traverse(struct tdb_context *tdb,
+				TDB_DATA key, TDB_DATA data,
+				void *private_data)
 {
-	struct recdb_file_traverse_state *state =
-		(struct recdb_file_traverse_state *)private_data;
+	struct recdb_chunk_traverse_state *state =
+		(struct recdb_chunk_traverse_state *)private_data;
 	int ret;
 
 	ret = recbuf_filter_add(state->recbuf, state->persistent,
@@ -322,68 +330,50 @@ static int recdb_file_traverse(struct tdb_context *tdb,
 		return ret;
 	}
 
-	if (ctdb_rec_buffer_len(state->recbuf) > state->max_size) {
-		ret = ctdb_rec_buffer_write(state->recbuf, state->fd);
-		if (ret != 0) {
-			D_ERR("Failed to collect recovery records for %s\n",
-			      recdb_name(state->recdb));
-			state->failed = true;
-			return ret;
-		}
-
-		state->num_buffers += 1;
-
-		TALLOC_FREE(state->recbuf);
-		state->recbuf = ctdb_rec_buffer_init(state->mem_ctx,
-						     recdb_id(state->recdb));
-		if (state->recbuf == NULL) {
-			state->failed = true;
-			return ENOMEM;
-		}
-	}
-
 	return 0;
 }
 
-static int recdb_file(struct recdb_context *recdb, TALLOC_CTX *mem_ctx,
-		      uint32_t dmaster, int fd, int max_size)
-{
-	struct recdb_file_traverse_state state;
+/*
+ * Marshall the records of the hash chains starting at *chain into a
+ * buffer, until the buffer grows beyond max_size or all chains have
+ * been walked. *chain is left at the first chain not yet marshalled,
+ * the recdb is complete when it equals the hash size.
+ *
+ * This allows the records to be pushed while the recdb is walked,
+ * without marshalling the whole database first.
+ */
+static struct ctdb_rec_buffer *recdb_chunk(struct recdb_context *recdb,
+					   TALLOC_CTX *mem_ctx,
+					   uint32_t dmaster,
+					   unsigned *chain,
+					   size_t max_size)
+{
+	struct recdb_chunk_traverse_state state;
+	unsigned hash_size = tdb_hash_size(recdb_tdb(recdb));
 	int ret;
 
 	state.recbuf = ctdb_rec_buffer_init(mem_ctx, recdb_id(recdb));
 	if (state.recbuf == NULL) {
-		return -1;
+		return NULL;
 	}
-	state.recdb = recdb;
-	state.mem_ctx = mem_ctx;
 	state.dmaster = dmaster;
 	state.reqid = 0;
 	state.persistent = recdb_persistent(recdb);
 	state.failed = false;
-	state.fd = fd;
-	state.max_size = max_size;
-	state.num_buffers = 0;
-
-	ret = tdb_traverse_read(recdb_tdb(recdb), recdb_file_traverse, &state);
-	if (ret == -1 || state.failed) {
-		TALLOC_FREE(state.recbuf);
-		return -1;
-	}
 
-	ret = ctdb_rec_buffer_write(state.recbuf, fd);
-	if (ret != 0) {
-		D_ERR("Failed to collect recovery records for %s\n",
-		      recdb_name(recdb));
-		TALLOC_FREE(state.recbuf);
-		return -1;
+	while (*chain < hash_size &&
+	       ctdb_rec_buffer_len(state.recbuf) <= max_size) {
+		ret = tdb_traverse_read_chunk(recdb_tdb(recdb), chain, 1,
+					      recdb_chunk_traverse, &state);
+		if (ret == -1 || state.failed) {
+			D_ERR("Failed to collect recovery records for %s\n",
+			      recdb_name(recdb));
+			TALLOC_FREE(state.recbuf);
+			return NULL;
+		}
 	}
-	state.num_buffers += 1;
 
-	D_DEBUG("Wrote %d buffers of recovery records for %s\n",
-		state.num_buffers, recdb_name(recdb));
-
-	return state.num_buffers;
+	return state.recbuf;
 }
 
 /*
@@ -771,8 +761,8 @@ struct push_database_new_state {
 	int count;
 	uint64_t srvid;
 	uint32_t dmaster;
-	int fd;
-	int num_buffers;
+	size_t max_size;
+	unsigned chain;
 	int num_buffers_sent;
 	int num_records;
 };
@@ -794,8 +784,6 @@ static struct tevent_req *push_database_new_send(
 	struct push_database_new_state *state;
 	struct ctdb_req_control request;
 	struct ctdb_pulldb_ext pulldb_ext;
-	char *filename;
-	off_t offset;
 
 	req = tevent_req_create(mem_ctx, &state,
 				struct push_database_new_state);
@@ -811,35 +799,11 @@ static struct tevent_req *push_database_new_send(
 
 	state->srvid = srvid_next();
 	state->dmaster = ctdb_client_pnn(client);
+	state->max_size = max_size;
+	state->chain = 0;
 	state->num_buffers_sent = 0;
 	state->num_records = 0;
 
-	filename = talloc_asprintf(state, "%s.dat", recdb_path(recdb));
-	if (tevent_req_nomem(filename, req)) {
-		return tevent_req_post(req, ev);
-	}
-
-	state->fd = open(filename, O_RDWR|O_CREAT, 0644);
-	if (state->fd == -1) {
-		tevent_req_error(req, errno);
-		return tevent_req_post(req, ev);
-	}
-	unlink(filename);
-	talloc_free(filename);
-
-	state->num_buffers = recdb_file(recdb, state, state->dmaster,
-					state->fd, max_size);
-	if (state->num_buffers == -1) {
-		tevent_req_error(req, ENOMEM);
-		return tevent_req_post(req, ev);
-	}
-
-	offset = lseek(state->fd, 0, SEEK_SET);
-	if (offset != 0) {
-		tevent_req_error(req, EIO);
-		return tevent_req_post(req, ev);
-	}
-
 	pulldb_ext.db_id = recdb_id(recdb);
 	pulldb_ext.srvid = state->srvid;
 
@@ -902,11 +866,26 @@ static void push_database_new_send_msg(struct tevent_req *req)
 	struct ctdb_req_message message;
 	TDB_DATA data;
 	size_t np;
-	int ret;
 
-	if (state->num_buffers_sent == state->num_buffers) {
+	recbuf = NULL;
+	if (state->chain < tdb_hash_size(recdb_tdb(state->recdb))) {
+		recbuf = recdb_chunk(state->recdb, state, state->dmaster,
+				     &state->chain, state->max_size);
+		if (tevent_req_nomem(recbuf, req)) {
+			return;
+		}
+		if (recbuf->count == 0) {
+			/* Only empty chains were left */
+			TALLOC_FREE(recbuf);
+		}
+	}
+
+	if (recbuf == NULL) {
 		struct ctdb_req_control request;
 
+		D_DEBUG("Pushed %d buffers of recovery records for %s\n",
+			state->num_buffers_sent, recdb_name(state->recdb));
+
 		ctdb_req_control_db_push_confirm(&request,
 						 recdb_id(state->recdb));
 		subreq = ctdb_client_control_multi_send(state, state->ev,
@@ -922,12 +901,6 @@ static void push_database_new_send_msg(struct tevent_req *req)
 		return;
 	}
 
-	ret = ctdb_rec_buffer_read(state->fd, state, &recbuf);
-	if (ret != 0) {
-		tevent_req_error(req, ret);
-		return;
-	}
-
 	data.dsize = ctdb_rec_buffer_len(recbuf);
 	data.dptr = talloc_size(state, data.dsize);
 	if (tevent_req_nomem(data.dptr, req)) {
@@ -1329,6 +1302,12 @@ static bool collect_highseqnum_db_recv(struct tevent_req *req, int *perr)
  * Collect all databases
  */
 
+/*
+ * Pull the database from all nodes in parallel. The records are merged
+ * into recdb as they arrive, keeping the copy with the highest RSN, so
+ * the order in which the nodes answer does not matter.
+ */
+
 struct collect_all_db_state {
 	struct tevent_context *ev;
 	struct ctdb_client_context *client;
@@ -1338,8 +1317,8 @@ struct collect_all_db_state {
 	uint32_t *ban_credits;
 	uint32_t db_id;
 	struct recdb_context *recdb;
-	struct ctdb_pulldb pulldb;
-	int index;
+	struct tevent_req **subreqs;
+	int num_pulled;
 };
 
 static void collect_all_db_pulldb_done(struct tevent_req *subreq);
@@ -1355,6 +1334,7 @@ static struct tevent_req *collect_all_db_send(
 	struct tevent_req *req, *subreq;
 	struct collect_all_db_state *state;
 	uint32_t pnn;
+	int i;
 
 	req = tevent_req_create(mem_ctx, &state,
 				struct collect_all_db_state);
@@ -1370,15 +1350,25 @@ static struct tevent_req *collect_all_db_send(
 	state->ban_credits = ban_credits;
 	state->db_id = db_id;
 	state->recdb = recdb;
-	state->index = 0;
-
-	pnn = state->pnn_list[state->index];
+	state->num_pulled = 0;
 
-	subreq = pull_database_send(state, ev, client, pnn, caps[pnn], recdb);
-	if (tevent_req_nomem(subreq, req)) {
+	state->subreqs = talloc_zero_array(state, struct tevent_req *, count);
+	if (tevent_req_nomem(state->subreqs, req)) {
 		return tevent_req_post(req, ev);
 	}
-	tevent_req_set_callback(subreq, collect_all_db_pulldb_done, req);
+
+	for (i=0; i<count; i++) {
+		pnn = state->pnn_list[i];
+
+		subreq = pull_database_send(state, ev, client, pnn, caps[pnn],
+					    recdb);
+		if (tevent_req_nomem(subreq, req)) {
+			return tevent_req_post(req, ev);
+		}
+		tevent_req_set_callback(subreq, collect_all_db_pulldb_done,
+					req);
+		state->subreqs[i] = subreq;
+	}
 
 	return req;
 }
@@ -1390,31 +1380,37 @@ static void collect_all_db_pulldb_done(struct tevent_req *subreq)
 	struct collect_all_db_state *state = tevent_req_data(
 		req, struct collect_all_db_state);
 	uint32_t pnn;
-	int ret;
+	int ret, i;
 	bool status;
 
+	for (i=0; i<state->count; i++) {
+		if (state->subreqs[i] == subreq) {
+			break;
+		}
+	}
+	if (i == state->count) {
+		D_ERR("Unknown DB_PULL request for %s\n",
+		      recdb_name(state->recdb));
+		TALLOC_FREE(subreq);
+		tevent_req_error(req, EIO);
+		return;
+	}
+	state->subreqs[i] = NULL;
+
 	status = pull_database_recv(subreq, &ret);
 	TALLOC_FREE(subreq);
 	if (! status) {
-		pnn = state->pnn_list[state->index];
+		pnn = state->pnn_list[i];
 		state->ban_credits[pnn] += 1;
 		tevent_req_error(req, ret);
 		return;
 	}
 
-	state->index += 1;
-	if (state->index == state->count) {
+	state->num_pulled += 1;
+	if (state->num_pulled == state->count) {
 		tevent_req_done(req);
 		return;
 	}
-
-	pnn = state->pnn_list[state->index];
-	subreq = pull_database_send(state, state->ev, state->client,
-				    pnn, state->caps[pnn], state->recdb);
-	if (tevent_req_nomem(subreq, req)) {
-		return;
-	}
-	tevent_req_set_callback(subreq, collect_all_db_pulldb_done, req);
 }
 
 static bool collect_all_db_recv(struct tevent_req *req, int *perr)
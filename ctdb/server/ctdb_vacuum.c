@@ -53,12 +53,15 @@ struct ctdb_vacuum_child_context {
 	pid_t child_pid;
 	enum vacuum_child_status status;
 	struct timeval start_time;
+	bool full_vacuum_run;
 };
 
 struct ctdb_vacuum_handle {
 	struct ctdb_db_context *ctdb_db;
 	struct ctdb_vacuum_child_context *child_ctx;
 	uint32_t fast_path_count;
+	/* hash chain the next full vacuuming run starts at */
+	unsigned full_vacuum_chain;
 };
 
 
@@ -615,13 +618,27 @@ static void ctdb_process_delete_queue(struct ctdb_db_context *ctdb_db,
  *
  * This is not done each time but only every tunable
  * VacuumFastPathCount times.
+ *
+ * With VacuumChainsPerRun set only that many hash chains are
+ * traversed, starting at first_chain, and only one chain is
+ * locked at a time.
  */
 static void ctdb_vacuum_traverse_db(struct ctdb_db_context *ctdb_db,
-				    struct vacuum_data *vdata)
+				    struct vacuum_data *vdata,
+				    unsigned first_chain)
 {
+	uint32_t num_chains = ctdb_db->ctdb->tunable.vacuum_chains_per_run;
+	unsigned chain = first_chain;
 	int ret;
 
-	ret = tdb_traverse_read(ctdb_db->ltdb->tdb, vacuum_traverse, vdata);
+	if (num_chains == 0) {
+		ret = tdb_traverse_read(ctdb_db->ltdb->tdb, vacuum_traverse,
+					vdata);
+	} else {
+		ret = tdb_traverse_read_chunk(ctdb_db->ltdb->tdb, &chain,
+					      num_chains, vacuum_traverse,
+					      vdata);
+	}
 	if (ret == -1 || vdata->traverse_error) {
 		DEBUG(DEBUG_ERR, (__location__ " Traverse error in vacuuming "
 				  "'%s'\n", ctdb_db->db_name));
@@ -633,11 +650,15 @@ static void ctdb_vacuum_traverse_db(struct ctdb_db_context *ctdb_db,
 		      (__location__
 		       " full vacuuming db traverse statistics: "
 		       "db[%s] "
+		       "chains[%u-%u] "
 		       "total[%u] "
 		       "skp[%u] "
 		       "err[%u] "
 		       "sched[%u]\n",
 		       ctdb_db->db_name,
+		       first_chain,
+		       num_chains == 0 ? (unsigned)tdb_hash_size(
+					ctdb_db->ltdb->tdb) : chain,
 		       (unsigned)vdata->count.db_traverse.total,
 		       (unsigned)vdata->count.db_traverse.skipped,
 		       (unsigned)vdata->count.db_traverse.error,
@@ -1021,7 +1042,8 @@ fail:
  * This executes in the child context.
  */
 static int ctdb_vacuum_db(struct ctdb_db_context *ctdb_db,
-			  bool full_vacuum_run)
+			  bool full_vacuum_run,
+			  unsigned full_vacuum_chain)
 {
 	struct ctdb_context *ctdb = ctdb_db->ctdb;
 	int ret, pnn;
@@ -1060,7 +1082,7 @@ static int ctdb_vacuum_db(struct ctdb_db_context *ctdb_db,
 	}
 
 	if (full_vacuum_run) {
-		ctdb_vacuum_traverse_db(ctdb_db, vdata);
+		ctdb_vacuum_traverse_db(ctdb_db, vdata, full_vacuum_chain);
 	}
 
 	ctdb_process_delete_queue(ctdb_db, vdata);
@@ -1082,14 +1104,15 @@ static int ctdb_vacuum_db(struct ctdb_db_context *ctdb_db,
  * called from the child context
  */
 static int ctdb_vacuum_and_repack_db(struct ctdb_db_context *ctdb_db,
-				     bool full_vacuum_run)
+				     bool full_vacuum_run,
+				     unsigned full_vacuum_chain)
 {
 	uint32_t repack_limit = ctdb_db->ctdb->tunable.repack_limit;
 	const char *name = ctdb_db->db_name;
 	int freelist_size = 0;
 	int ret;
 
-	if (ctdb_vacuum_db(ctdb_db, full_vacuum_run) != 0) {
+	if (ctdb_vacuum_db(ctdb_db, full_vacuum_run, full_vacuum_chain) != 0) {
 		DEBUG(DEBUG_ERR,(__location__ " Failed to vacuum '%s'\n", name));
 	}
 
@@ -1126,6 +1149,34 @@ static uint32_t get_vacuum_interval(struct ctdb_db_context *ctdb_db)
 	return interval;
 }
 
+/*
+ * After a successful full vacuuming run that only covered
+ * VacuumChainsPerRun hash chains, let the next one continue
+ * where this one stopped.
+ */
+static void vacuum_advance_full_vacuum_chain(
+	struct ctdb_vacuum_child_context *child_ctx)
+{
+	struct ctdb_vacuum_handle *vacuum_handle = child_ctx->vacuum_handle;
+	struct ctdb_db_context *ctdb_db = vacuum_handle->ctdb_db;
+	uint32_t num_chains = ctdb_db->ctdb->tunable.vacuum_chains_per_run;
+	unsigned hash_size;
+
+	if (!child_ctx->full_vacuum_run || child_ctx->status != VACUUM_OK) {
+		return;
+	}
+
+	hash_size = tdb_hash_size(ctdb_db->ltdb->tdb);
+
+	if (num_chains == 0 ||
+	    num_chains >= hash_size - vacuum_handle->full_vacuum_chain) {
+		vacuum_handle->full_vacuum_chain = 0;
+		return;
+	}
+
+	vacuum_handle->full_vacuum_chain += num_chains;
+}
+
 static int vacuum_child_destructor(struct ctdb_vacuum_child_context *child_ctx)
 {
 	double l = timeval_elapsed(&child_ctx->start_time);
@@ -1142,6 +1193,8 @@ static int vacuum_child_destructor(struct ctdb_vacuum_child_context *child_ctx)
 		child_ctx->vacuum_handle->fast_path_count++;
 	}
 
+	vacuum_advance_full_vacuum_chain(child_ctx);
+
 	DLIST_REMOVE(ctdb->vacuumers, child_ctx);
 
 	tevent_add_timer(ctdb->ev, child_ctx->vacuum_handle,
@@ -1255,6 +1308,12 @@ static void ctdb_vacuum_event(struct tevent_context *ev,
 		}
 		vacuum_handle->fast_path_count = 0;
 	}
+	child_ctx->full_vacuum_run = full_vacuum_run;
+
+	if (vacuum_handle->full_vacuum_chain >=
+	    (unsigned)tdb_hash_size(ctdb_db->ltdb->tdb)) {
+		vacuum_handle->full_vacuum_chain = 0;
+	}
 
 	child_ctx->child_pid = ctdb_fork(ctdb);
 	if (child_ctx->child_pid == (pid_t)-1) {
@@ -1280,7 +1339,8 @@ static void ctdb_vacuum_event(struct tevent_context *ev,
 			_exit(1);
 		}
 
-		cc = ctdb_vacuum_and_repack_db(ctdb_db, full_vacuum_run);
+		cc = ctdb_vacuum_and_repack_db(ctdb_db, full_vacuum_run,
+					       vacuum_handle->full_vacuum_chain);
 
 		sys_write(child_ctx->fd[1], &cc, 1);
 		_exit(0);
@@ -1349,6 +1409,7 @@ int ctdb_vacuum_init(struct ctdb_db_context *ctdb_db)
 
 	ctdb_db->vacuum_handle->ctdb_db         = ctdb_db;
 	ctdb_db->vacuum_handle->fast_path_count = 0;
+	ctdb_db->vacuum_handle->full_vacuum_chain = 0;
 
 	tevent_add_timer(ctdb_db->ctdb->ev, ctdb_db->vacuum_handle,
 			 timeval_current_ofs(get_vacuum_interval(ctdb_db), 0),
@@ -643,6 +643,8 @@ void fill_ctdb_tunable_list(TALLOC_CTX *mem_ctx, struct ctdb_tunable_list *p)
 	p->queue_buffer_size = rand32();
 	p->ip_alloc_algorithm = rand32();
 	p->allow_mixed_versions = rand32();
+	p->vacuum_chains_per_run = rand32();
+	p->auto_sticky_records = rand32();
 }
 
 void verify_ctdb_tunable_list(struct ctdb_tunable_list *p1,
@@ -710,6 +712,8 @@ void verify_ctdb_tunable_list(struct ctdb_tunable_list *p1,
 	assert(p1->queue_buffer_size == p2->queue_buffer_size);
 	assert(p1->ip_alloc_algorithm == p2->ip_alloc_algorithm);
 	assert(p1->allow_mixed_versions == p2->allow_mixed_versions);
+	assert(p1->vacuum_chains_per_run == p2->vacuum_chains_per_run);
+	assert(p1->auto_sticky_records == p2->auto_sticky_records);
 }
 
 void fill_ctdb_tickle_list(TALLOC_CTX *mem_ctx, struct ctdb_tickle_list *p)
@@ -1067,6 +1071,8 @@ void fill_ctdb_db_statistics(TALLOC_CTX *mem_ctx,
 
 	p->db_ro_delegations = rand32();
 	p->db_ro_revokes = rand32();
+	p->db_sticky_records = rand32();
+	p->db_sticky_pindowns = rand32();
 	for (i=0; i<MAX_COUNT_BUCKETS; i++) {
 		p->hop_count_bucket[i] = rand32();
 	}
@@ -1096,6 +1102,8 @@ void verify_ctdb_db_statistics(struct ctdb_db_statistics *p1,
 
 	assert(p1->db_ro_delegations == p2->db_ro_delegations);
 	assert(p1->db_ro_revokes == p2->db_ro_revokes);
+	assert(p1->db_sticky_records == p2->db_sticky_records);
+	assert(p1->db_sticky_pindowns == p2->db_sticky_pindowns);
 	for (i=0; i<MAX_COUNT_BUCKETS; i++) {
 		assert(p1->hop_count_bucket[i] == p2->hop_count_bucket[i]);
 	}
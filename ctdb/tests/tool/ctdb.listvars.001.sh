@@ -62,6 +62,8 @@ RecBufferSizeLimit         = 1000000
 QueueBufferSize            = 1024
 IPAllocAlgorithm           = 2
 AllowMixedVersions         = 0
+VacuumChainsPerRun         = 0
+AutoStickyRecords          = 0
 EOF
 
 simple_test
@@ -5573,6 +5573,8 @@ const struct {
 #define DBSTATISTICS_FIELD(n) { #n, offsetof(struct ctdb_db_statistics, n) }
 	DBSTATISTICS_FIELD(db_ro_delegations),
 	DBSTATISTICS_FIELD(db_ro_revokes),
+	DBSTATISTICS_FIELD(db_sticky_records),
+	DBSTATISTICS_FIELD(db_sticky_pindowns),
 	DBSTATISTICS_FIELD(locks.num_calls),
 	DBSTATISTICS_FIELD(locks.num_current),
 	DBSTATISTICS_FIELD(locks.num_pending),
@@ -150,6 +150,16 @@ static struct dirent *skel_readdir(vfs_handle_struct *handle,
 	return NULL;
 }
 
+static NTSTATUS skel_readdirplus(vfs_handle_struct *handle,
+				 DIR *dirp,
+				 TALLOC_CTX *mem_ctx,
+				 size_t max_entries,
+				 struct vfs_readdirplus_entry **pentries,
+				 size_t *pnum_entries)
+{
+	return NT_STATUS_NOT_IMPLEMENTED;
+}
+
 static void skel_seekdir(vfs_handle_struct *handle, DIR *dirp, long offset)
 {
 	;
@@ -1042,6 +1052,7 @@ static struct vfs_fn_pointers skel_opaque_fns = {
 	.opendir_fn = skel_opendir,
 	.fdopendir_fn = skel_fdopendir,
 	.readdir_fn = skel_readdir,
+	.readdirplus_fn = skel_readdirplus,
 	.seekdir_fn = skel_seekdir,
 	.telldir_fn = skel_telldir,
 	.rewind_dir_fn = skel_rewind_dir,
@@ -149,6 +149,17 @@ static struct dirent *skel_readdir(vfs_handle_struct *handle,
 	return SMB_VFS_NEXT_READDIR(handle, dirp, sbuf);
 }
 
+static NTSTATUS skel_readdirplus(vfs_handle_struct *handle,
+				 DIR *dirp,
+				 TALLOC_CTX *mem_ctx,
+				 size_t max_entries,
+				 struct vfs_readdirplus_entry **pentries,
+				 size_t *pnum_entries)
+{
+	return SMB_VFS_NEXT_READDIRPLUS(handle, dirp, mem_ctx, max_entries,
+					pentries, pnum_entries);
+}
+
 static void skel_seekdir(vfs_handle_struct *handle, DIR *dirp, long offset)
 {
 	SMB_VFS_NEXT_SEEKDIR(handle, dirp, offset);
@@ -1305,6 +1316,7 @@ static struct vfs_fn_pointers skel_transparent_fns = {
 	.opendir_fn = skel_opendir,
 	.fdopendir_fn = skel_fdopendir,
 	.readdir_fn = skel_readdir,
+	.readdirplus_fn = skel_readdirplus,
 	.seekdir_fn = skel_seekdir,
 	.telldir_fn = skel_telldir,
 	.rewind_dir_fn = skel_rewind_dir,
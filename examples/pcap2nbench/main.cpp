@@ -23,6 +23,7 @@
 #include <getopt.h>
 #include <stdint.h>
 #include <netinet/in.h>
+#include <string.h>
 
 #include "ethernet.hpp"
 #include "ip.hpp"
@@ -33,7 +34,12 @@
 #include "readandxrequest.hpp"
 #include "writeandxrequest.hpp"
 #include "closerequest.hpp"
+#include "smb2.hpp"
 
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
 #include <vector>
 #include <set>
 
@@ -546,9 +552,13 @@ const char *nt_status_to_string[] = {
 
 #define NT_STATUS(a) nt_status_to_string[a & 0x3FFFFFFF]
 
+/* client address and port, server address and port */
+typedef std::pair<uint64_t, uint64_t> Connection;
+
 struct Packet
 {
   size_t frame;
+  struct timeval ts;
   
   uint8_t magic[4];
 
@@ -556,7 +566,19 @@ struct Packet
     return !memcmp(smb_hdr.magic, magic, 4);
   }
 
-  Packet(const uint8_t *data, size_t size) : 
+  bool valid_smb2() {
+    return !smb2_cmds.empty();
+  }
+
+  Connection connection(bool response) const {
+    uint64_t src = ((uint64_t)ip_hdr.source << 16) | tcp_hdr.src_port;
+    uint64_t dst = ((uint64_t)ip_hdr.destination << 16) | tcp_hdr.dst_port;
+
+    return response ? Connection(dst, src) : Connection(src, dst);
+  }
+
+  Packet(const uint8_t *data, size_t size, const struct timeval &tv) : 
+    ts(tv),
     ip_hdr(data + 14, size - 14),
     tcp_hdr(data + 14 + ip_hdr.header_length,
 	    size - 14 - ip_hdr.header_length),
@@ -594,6 +616,13 @@ struct Packet
 	}
 	break;
       }
+    } else {
+      /* skip the NetBIOS session header */
+      size_t len = 14 + ip_hdr.header_length + tcp_hdr.length + 4;
+
+      if (size > len) {
+	smb2_cmds = parse_smb2(data + len, size - len);
+      }
     }
   }
 
@@ -606,8 +635,242 @@ struct Packet
   ReadAndXRequest read_req;
   WriteAndXRequest write_req;
   CloseRequest close_req;
+
+  std::vector<smb2> smb2_cmds;
+};
+
+/*
+ * Where the loadfile lines go: stdout, or with --per-connection one file
+ * per TCP connection so that each client replays its own connection.
+ */
+struct Output
+{
+  Output(const char *prefix, bool timestamps, const struct timeval &start)
+    : prefix(prefix), timestamps(timestamps), start(start) {}
+
+  ~Output() {
+    for (std::map<Connection, std::ofstream *>::iterator i = files.begin();
+	 i != files.end(); ++i) {
+      delete i->second;
+    }
+  }
+
+  std::ostream &line(const Connection &conn, const struct timeval &ts) {
+    std::ostream *out = &std::cout;
+
+    if (prefix != NULL) {
+      std::map<Connection, std::ofstream *>::iterator i = files.find(conn);
+
+      if (i == files.end()) {
+	std::ostringstream name;
+	name << prefix << (files.size() + 1) << ".txt";
+	out = files[conn] = new std::ofstream(name.str().c_str());
+      } else {
+	out = i->second;
+      }
+    }
+
+    if (timestamps) {
+      double t = (ts.tv_sec - start.tv_sec) +
+	(ts.tv_usec - start.tv_usec) / 1000000.0;
+      *out << std::fixed << std::setprecision(6) << t << " ";
+    }
+
+    return *out;
+  }
+
+  const char *prefix;
+  bool timestamps;
+  struct timeval start;
+  std::map<Connection, std::ofstream *> files;
 };
 
+static std::string smb2_status(uint32_t status)
+{
+  std::ostringstream s;
+  s << "0x" << std::hex << std::setw(8) << std::setfill('0') << status;
+  return s.str();
+}
+
+/* an SMB2 request and its final response */
+struct Smb2Op
+{
+  Connection conn;
+  struct timeval ts;
+  smb2 req;
+  smb2 resp;
+  bool answered;
+  /* the previous request in a related compound chain, or -1 */
+  ssize_t chain_prev;
+  /* FileId the request operates on, after resolving related chains */
+  std::pair<uint64_t, uint64_t> fid;
+};
+
+static void smb2_to_nbench(std::vector<Packet> &packets, Output &output,
+			   int drop_incomplete_sessions)
+{
+  typedef std::pair<uint64_t, uint64_t> FileId;
+  typedef std::pair<Connection, FileId> HandleKey;
+  const FileId related_fid(UINT64_MAX, UINT64_MAX);
+
+  std::vector<Smb2Op> ops;
+  std::map<std::pair<Connection, uint64_t>, size_t> pending;
+
+  /* match every request with its final response */
+  for (std::vector<Packet>::iterator i = packets.begin();
+       i != packets.end(); ++i) {
+    ssize_t chain_prev = -1;
+
+    for (std::vector<smb2>::iterator c = i->smb2_cmds.begin();
+	 c != i->smb2_cmds.end(); ++c) {
+      Connection conn = i->connection(c->is_response());
+      std::pair<Connection, uint64_t> key(conn, c->message_id);
+
+      if (!c->is_response()) {
+	Smb2Op op;
+
+	op.conn = conn;
+	op.ts = i->ts;
+	op.req = *c;
+	op.answered = false;
+	op.chain_prev = c->is_related() ? chain_prev : -1;
+	op.fid = FileId(c->fid_persistent, c->fid_volatile);
+
+	chain_prev = ops.size();
+	pending[key] = ops.size();
+	ops.push_back(op);
+	continue;
+      }
+
+      if (c->is_interim()) {
+	continue;
+      }
+
+      std::map<std::pair<Connection, uint64_t>, size_t>::iterator p =
+	pending.find(key);
+      if (p == pending.end()) {
+	continue;
+      }
+      ops[p->second].resp = *c;
+      ops[p->second].answered = true;
+      pending.erase(p);
+    }
+  }
+
+  std::map<HandleKey, int> handles;
+  std::map<HandleKey, std::string> names;
+  std::set<HandleKey> listed;
+  int next_handle = 1;
+
+  for (size_t n = 0; n < ops.size(); n++) {
+    Smb2Op &op = ops[n];
+
+    if (op.fid == related_fid && op.chain_prev != -1) {
+      /* related compound, use the handle of the previous request */
+      Smb2Op &prev = ops[op.chain_prev];
+
+      if (prev.req.command == smb2::CREATE) {
+	op.fid = FileId(prev.resp.fid_persistent, prev.resp.fid_volatile);
+      } else {
+	op.fid = prev.fid;
+      }
+    }
+
+    /* no response?  guess we can't display this command */
+    if (!op.answered) {
+      continue;
+    }
+
+    HandleKey hkey(op.conn, op.fid);
+    std::map<HandleKey, int>::iterator h = handles.find(hkey);
+    bool known = (h != handles.end());
+    int handle;
+
+    if (op.req.command == smb2::CREATE) {
+      handle = -1;
+
+      if (op.resp.status == 0) {
+	hkey.second = FileId(op.resp.fid_persistent, op.resp.fid_volatile);
+	handle = handles[hkey] = next_handle++;
+	names[hkey] = op.req.file_name;
+	listed.erase(hkey);
+      }
+
+      output.line(op.conn, op.ts)
+	<< "NTCreateX \"\\" << op.req.file_name << "\" "
+	<< op.req.create_options << " "
+	<< op.req.disposition << " "
+	<< handle << " "
+	<< smb2_status(op.resp.status) << std::endl;
+      continue;
+    }
+
+    if (!known) {
+      if (drop_incomplete_sessions) {
+	continue;
+      }
+      h = handles.insert(std::make_pair(hkey, next_handle++)).first;
+    }
+    handle = h->second;
+
+    switch (op.req.command) {
+    case smb2::CLOSE:
+      output.line(op.conn, op.ts)
+	<< "Close " << handle << " "
+	<< smb2_status(op.resp.status) << std::endl;
+      handles.erase(hkey);
+      names.erase(hkey);
+      listed.erase(hkey);
+      break;
+    case smb2::FLUSH:
+      output.line(op.conn, op.ts)
+	<< "Flush " << handle << " "
+	<< smb2_status(op.resp.status) << std::endl;
+      break;
+    case smb2::READ:
+      output.line(op.conn, op.ts)
+	<< "ReadX " << handle << " "
+	<< op.req.offset << " "
+	<< op.req.length << " " << op.resp.length << " "
+	<< smb2_status(op.resp.status) << std::endl;
+      break;
+    case smb2::WRITE:
+      output.line(op.conn, op.ts)
+	<< "WriteX " << handle << " "
+	<< op.req.offset << " "
+	<< op.req.length << " " << op.resp.length << " "
+	<< smb2_status(op.resp.status) << std::endl;
+      break;
+    case smb2::QUERY_DIRECTORY: {
+      /*
+       * A loadfile can only express a complete search, emit the first
+       * query on a handle and ignore the ones continuing it.
+       */
+      std::map<HandleKey, std::string>::iterator name = names.find(hkey);
+
+      if (op.req.find_flags & (smb2::FIND_RESTART_SCANS | smb2::FIND_REOPEN)) {
+	listed.erase(hkey);
+      }
+      if (name == names.end() || listed.count(hkey)) {
+	break;
+      }
+      listed.insert(hkey);
+
+      output.line(op.conn, op.ts)
+	<< "FIND_FIRST \"\\" << name->second
+	<< (name->second.empty() ? "" : "\\") << op.req.file_name << "\" "
+	<< 260 << " "
+	<< op.resp.num_entries << " " << op.resp.num_entries << " "
+	<< smb2_status(op.resp.status) << std::endl;
+      break;
+    }
+    default:
+      /* nothing in a loadfile for this, e.g. IOCTL */
+      break;
+    }
+  }
+}
+
 int main(int argc, char **argv)
 {
   char errbuf[PCAP_ERRBUF_SIZE];
@@ -618,13 +881,17 @@ int main(int argc, char **argv)
   static struct option long_opts[] = {
     { "show-files", 0, 0, 's' },
     { "drop-incomplete-sessions", 0, 0, 'i' },
+    { "timestamps", 0, 0, 't' },
+    { "per-connection", 1, 0, 'p' },
     { 0,            0, 0, 0   }
   };
-  const char *short_opts = "si";
+  const char *short_opts = "sitp:";
   int opt_ind;
   char ch;
   int show_files = 0;
   int drop_incomplete_sessions = 0;
+  bool timestamps = false;
+  const char *prefix = NULL;
 
   while ((ch = getopt_long(argc,argv,short_opts,long_opts,&opt_ind)) != -1) {
     switch (ch) {
@@ -634,6 +901,12 @@ int main(int argc, char **argv)
     case 'i':
       drop_incomplete_sessions = 1;
       break;
+    case 't':
+      timestamps = true;
+      break;
+    case 'p':
+      prefix = optarg;
+      break;
     default:
       break;
     }
@@ -655,20 +928,33 @@ int main(int argc, char **argv)
   std::vector<Packet> packets;
   size_t frame = 0;
   std::set<uint16_t> current_fids;
+  struct timeval start = { 0, 0 };
+  bool have_smb2 = false;
 
   while (1 == pcap_next_ex(cap, &pkt_hdr, &data)) {
-    Packet packet(data, pkt_hdr->len);
+    Packet packet(data, pkt_hdr->caplen, pkt_hdr->ts);
 
+    if (frame == 0) {
+      start = pkt_hdr->ts;
+    }
     ++frame;
 
-    if (packet.valid_smb()) {
+    if (packet.valid_smb() || packet.valid_smb2()) {
       packet.frame = frame;
       packets.push_back(packet);
+      have_smb2 |= packet.valid_smb2();
     }
   }
 
   pcap_close(cap);
 
+  Output output(prefix, timestamps, start);
+
+  if (have_smb2) {
+    smb2_to_nbench(packets, output, drop_incomplete_sessions);
+    return 0;
+  }
+
   for (std::vector<Packet>::iterator i = packets.begin();
        i != packets.end(); ++i) {
     if (!(i->smb_hdr.flags & 0x80)) {
@@ -691,10 +977,12 @@ int main(int argc, char **argv)
       if (j == packets.end()) continue;
 
       size_t len;
+      Connection conn = i->connection(false);
 
       switch (i->smb_hdr.command) {
       case NtCreateAndXRequest::COMMAND:
-	std::cout << "NTCreateX \"" << i->ntcreate_req.file_name << "\" "
+	output.line(conn, i->ts)
+		  << "NTCreateX \"" << i->ntcreate_req.file_name << "\" "
 		  << i->ntcreate_req.create_options << " "
 		  << i->ntcreate_req.disposition << " "
 		  << j->ntcreate_resp.fid << " "
@@ -706,7 +994,8 @@ int main(int argc, char **argv)
 	  i->read_req.max_count_low;
 
 	if (!drop_incomplete_sessions || current_fids.count(i->read_req.fid)) {
-	  std::cout << "ReadX " << i->read_req.fid << " "
+	  output.line(conn, i->ts)
+		    << "ReadX " << i->read_req.fid << " "
 		    << i->read_req.offset << " "
 		    << len << " " << len << " "
 		    << NT_STATUS(j->smb_hdr.nt_status) << std::endl;
@@ -717,7 +1006,8 @@ int main(int argc, char **argv)
 	  i->write_req.data_length_lo;
 
 	if (!drop_incomplete_sessions||current_fids.count(i->write_req.fid)) {
-	  std::cout << "WriteX " << i->write_req.fid << " "
+	  output.line(conn, i->ts)
+		    << "WriteX " << i->write_req.fid << " "
 		    << i->write_req.offset << " "
 		    << len << " " << len << " "
 		    << NT_STATUS(j->smb_hdr.nt_status) << std::endl;
@@ -725,7 +1015,8 @@ int main(int argc, char **argv)
 	break;
       case CloseRequest::COMMAND:
 	if (!drop_incomplete_sessions||current_fids.count(i->close_req.fid)) {
-	  std::cout << "Close " << i->close_req.fid << " "
+	  output.line(conn, i->ts)
+		    << "Close " << i->close_req.fid << " "
 		    << NT_STATUS(j->smb_hdr.nt_status) << std::endl;
 	}
 	current_fids.erase(i->close_req.fid);
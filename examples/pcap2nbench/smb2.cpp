@@ -0,0 +1,233 @@
+/*\
+ *  pcap2nbench - Converts libpcap network traces to nbench input
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, see <http://www.gnu.org/licenses/>.
+\*/
+
+#include <string.h>
+
+#include "smb2.hpp"
+
+#define SMB2_HDR_SIZE 64
+
+/* SMB2 is little endian on the wire, unlike the rest of the headers */
+static uint16_t le16(const uint8_t *p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+static uint32_t le32(const uint8_t *p)
+{
+  return le16(p) | ((uint32_t)le16(p + 2) << 16);
+}
+
+static uint64_t le64(const uint8_t *p)
+{
+  return le32(p) | ((uint64_t)le32(p + 4) << 32);
+}
+
+/*
+ * File names are UTF-16LE on the wire, nbench loadfiles are UTF-8
+ */
+static std::string utf16_to_utf8(const uint8_t *p, size_t len)
+{
+  std::string result;
+  size_t i;
+
+  for (i = 0; i + 1 < len; i += 2) {
+    uint32_t c = le16(p + i);
+
+    if (c >= 0xd800 && c < 0xdc00 && i + 3 < len) {
+      uint32_t c2 = le16(p + i + 2);
+      if (c2 >= 0xdc00 && c2 < 0xe000) {
+	c = 0x10000 + ((c - 0xd800) << 10) + (c2 - 0xdc00);
+	i += 2;
+      }
+    }
+
+    if (c < 0x80) {
+      result += (char)c;
+    } else if (c < 0x800) {
+      result += (char)(0xc0 | (c >> 6));
+      result += (char)(0x80 | (c & 0x3f));
+    } else if (c < 0x10000) {
+      result += (char)(0xe0 | (c >> 12));
+      result += (char)(0x80 | ((c >> 6) & 0x3f));
+      result += (char)(0x80 | (c & 0x3f));
+    } else {
+      result += (char)(0xf0 | (c >> 18));
+      result += (char)(0x80 | ((c >> 12) & 0x3f));
+      result += (char)(0x80 | ((c >> 6) & 0x3f));
+      result += (char)(0x80 | (c & 0x3f));
+    }
+  }
+
+  return result;
+}
+
+smb2::smb2(const uint8_t *data, size_t size)
+  : valid(false), command(0), status(0), flags(0), next_command(0),
+    message_id(0), fid_persistent(0), fid_volatile(0), create_options(0),
+    disposition(0), oplock_level(0), offset(0), length(0), find_flags(0),
+    num_entries(0), ctl_code(0)
+{
+  const uint8_t *body = data + SMB2_HDR_SIZE;
+  size_t body_len;
+
+  if (size < SMB2_HDR_SIZE ||
+      memcmp(data, "\xfe" "SMB", 4) != 0) {
+    return;
+  }
+
+  status = le32(data + 8);
+  command = le16(data + 12);
+  flags = le32(data + 16);
+  next_command = le32(data + 20);
+  message_id = le64(data + 24);
+
+  body_len = size - SMB2_HDR_SIZE;
+  if (next_command >= SMB2_HDR_SIZE && next_command < size) {
+    body_len = next_command - SMB2_HDR_SIZE;
+  }
+
+  valid = true;
+
+  if (is_response() && body_len >= 2 && le16(body) == 9) {
+    /* an error response, there's no command specific body */
+    return;
+  }
+
+  switch (command) {
+  case CREATE:
+    if (is_response()) {
+      if (body_len >= 80) {
+	fid_persistent = le64(body + 64);
+	fid_volatile = le64(body + 72);
+      }
+    } else if (body_len >= 56) {
+      uint16_t name_ofs = le16(body + 44);
+      uint16_t name_len = le16(body + 46);
+
+      oplock_level = body[3];
+      disposition = le32(body + 36);
+      create_options = le32(body + 40);
+      if (name_len != 0 && name_ofs + name_len <= size) {
+	file_name = utf16_to_utf8(data + name_ofs, name_len);
+      }
+    }
+    break;
+  case CLOSE:
+  case FLUSH:
+    if (!is_response() && body_len >= 24) {
+      fid_persistent = le64(body + 8);
+      fid_volatile = le64(body + 16);
+    }
+    break;
+  case READ:
+    if (is_response()) {
+      if (body_len >= 8) {
+	length = le32(body + 4);
+      }
+    } else if (body_len >= 32) {
+      length = le32(body + 4);
+      offset = le64(body + 8);
+      fid_persistent = le64(body + 16);
+      fid_volatile = le64(body + 24);
+    }
+    break;
+  case WRITE:
+    if (is_response()) {
+      if (body_len >= 8) {
+	length = le32(body + 4);
+      }
+    } else if (body_len >= 32) {
+      length = le32(body + 4);
+      offset = le64(body + 8);
+      fid_persistent = le64(body + 16);
+      fid_volatile = le64(body + 24);
+    }
+    break;
+  case QUERY_DIRECTORY:
+    if (is_response()) {
+      if (body_len >= 8) {
+	uint16_t buf_ofs = le16(body + 2);
+	uint32_t buf_len = le32(body + 4);
+	uint32_t ofs = 0;
+
+	/* count the entries we actually captured */
+	while (buf_len != 0 && buf_ofs + ofs + 4 <= size) {
+	  uint32_t next = le32(data + buf_ofs + ofs);
+	  num_entries++;
+	  if (next == 0 || ofs + next >= buf_len) {
+	    break;
+	  }
+	  ofs += next;
+	}
+      }
+    } else if (body_len >= 32) {
+      uint16_t name_ofs = le16(body + 24);
+      uint16_t name_len = le16(body + 26);
+
+      find_flags = body[3];
+      fid_persistent = le64(body + 8);
+      fid_volatile = le64(body + 16);
+      if (name_len != 0 && name_ofs + name_len <= size) {
+	file_name = utf16_to_utf8(data + name_ofs, name_len);
+      }
+    }
+    break;
+  case IOCTL:
+    if (!is_response() && body_len >= 24) {
+      ctl_code = le32(body + 4);
+      fid_persistent = le64(body + 8);
+      fid_volatile = le64(body + 16);
+    }
+    break;
+  }
+}
+
+std::vector<smb2> parse_smb2(const uint8_t *data, size_t length)
+{
+  std::vector<smb2> result;
+  size_t ofs = 0;
+
+  while (ofs + SMB2_HDR_SIZE <= length) {
+    smb2 cmd(data + ofs, length - ofs);
+
+    if (!cmd.valid) {
+      break;
+    }
+    result.push_back(cmd);
+
+    if (cmd.next_command == 0) {
+      break;
+    }
+    ofs += cmd.next_command;
+  }
+
+  return result;
+}
+
+std::ostream &operator<<(std::ostream &lhs, const smb2 &rhs)
+{
+  lhs << "Command: " << rhs.command << std::endl
+      << "NT Status: " << rhs.status << std::endl
+      << "Flags: " << rhs.flags << std::endl
+      << "Next Command: " << rhs.next_command << std::endl
+      << "Message Id: " << rhs.message_id << std::endl
+      << "File Id: " << rhs.fid_persistent << ":" << rhs.fid_volatile
+      << std::endl;
+
+  return lhs;
+}
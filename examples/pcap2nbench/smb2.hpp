@@ -0,0 +1,108 @@
+/*\
+ *  pcap2nbench - Converts libpcap network traces to nbench input
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, see <http://www.gnu.org/licenses/>.
+\*/
+
+#ifndef _SMB2_HPP
+#define _SMB2_HPP
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/*
+ * One SMB2 request or response, with the fields of the body that matter
+ * for a loadfile.  Compound requests are split into one smb2 per
+ * command by parse_smb2().
+ */
+struct smb2 {
+  enum {
+    CREATE          = 0x05,
+    CLOSE           = 0x06,
+    FLUSH           = 0x07,
+    READ            = 0x08,
+    WRITE           = 0x09,
+    IOCTL           = 0x0b,
+    QUERY_DIRECTORY = 0x0e
+  };
+
+  enum {
+    FLAGS_SERVER_TO_REDIR  = 0x01,
+    FLAGS_ASYNC_COMMAND    = 0x02,
+    FLAGS_RELATED          = 0x04
+  };
+
+  enum {
+    FIND_RESTART_SCANS = 0x01,
+    FIND_REOPEN        = 0x10
+  };
+
+  enum {
+    STATUS_PENDING = 0x00000103
+  };
+
+  enum {
+    OPLOCK_LEVEL_LEASE = 0xff
+  };
+
+  smb2() : valid(false) {}
+  smb2(const uint8_t *data, size_t size);
+
+  bool is_response() const { return flags & FLAGS_SERVER_TO_REDIR; }
+  bool is_related() const { return flags & FLAGS_RELATED; }
+  bool is_interim() const {
+    return is_response() && (flags & FLAGS_ASYNC_COMMAND) &&
+      status == STATUS_PENDING;
+  }
+
+  bool valid;
+
+  uint16_t command;
+  uint32_t status;
+  uint32_t flags;
+  uint32_t next_command;
+  uint64_t message_id;
+
+  /* file id of the request, or the one returned by a create */
+  uint64_t fid_persistent;
+  uint64_t fid_volatile;
+
+  /* CREATE request */
+  std::string file_name;
+  uint32_t create_options;
+  uint32_t disposition;
+  uint8_t oplock_level;
+
+  /* READ and WRITE requests, READ and WRITE responses */
+  uint64_t offset;
+  uint32_t length;
+
+  /* QUERY_DIRECTORY request and response */
+  uint8_t find_flags;
+  size_t num_entries;
+
+  /* IOCTL request */
+  uint32_t ctl_code;
+};
+
+/*
+ * data points behind the 4 byte NetBIOS session header
+ */
+std::vector<smb2> parse_smb2(const uint8_t *data, size_t length);
+
+std::ostream &operator<<(std::ostream &lhs, const smb2 &rhs);
+
+#endif
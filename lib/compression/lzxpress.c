@@ -57,6 +57,50 @@
 ))
 #endif
 
+/*
+ * Matches are found via hash chains over the first three bytes.
+ * The chains are walked from the nearest position to the most
+ * distant one, so the result is identical to an exhaustive
+ * search of the window, but we only compare positions that
+ * can actually produce a match.
+ */
+#define LZX_WINDOW_SIZE 0x2000
+#define LZX_WINDOW_MASK (LZX_WINDOW_SIZE - 1)
+#define LZX_HASH_BITS 12
+#define LZX_HASH_SIZE (1 << LZX_HASH_BITS)
+
+struct lzx_hash_chains {
+	uint32_t head[LZX_HASH_SIZE];
+	uint32_t prev[LZX_WINDOW_SIZE];
+};
+
+static inline uint32_t lzx_hash3(const uint8_t *p)
+{
+	uint32_t v = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+
+	return (v * 2654435761U) >> (32 - LZX_HASH_BITS);
+}
+
+/*
+ * Positions are stored incremented by one, so that 0 marks
+ * an empty slot.
+ */
+static inline void lzx_hash_insert(struct lzx_hash_chains *c,
+				   const uint8_t *uncompressed,
+				   uint32_t uncompressed_size,
+				   uint32_t pos)
+{
+	uint32_t h;
+
+	if (pos + 2 >= uncompressed_size) {
+		return;
+	}
+
+	h = lzx_hash3(&uncompressed[pos]);
+	c->prev[pos & LZX_WINDOW_MASK] = c->head[h];
+	c->head[h] = pos + 1;
+}
+
 ssize_t lzxpress_compress(const uint8_t *uncompressed,
 			  uint32_t uncompressed_size,
 			  uint8_t *compressed,
@@ -64,9 +108,11 @@ ssize_t lzxpress_compress(const uint8_t *uncompressed,
 {
 	uint32_t uncompressed_pos, compressed_pos, byte_left;
 	uint32_t max_offset, best_offset;
-	int32_t offset;
+	uint32_t offset;
 	uint32_t max_len, len, best_len;
 	const uint8_t *str1, *str2;
+	struct lzx_hash_chains *chains;
+	uint32_t cand;
 	uint32_t indic;
 	uint8_t *indic_pos;
 	uint32_t indic_bit, nibble_index;
@@ -79,6 +125,11 @@ ssize_t lzxpress_compress(const uint8_t *uncompressed,
 		return 0;
 	}
 
+	chains = calloc(1, sizeof(*chains));
+	if (chains == NULL) {
+		return -1;
+	}
+
 	uncompressed_pos = 0;
 	indic = 0;
 	*(uint32_t *)compressed = 0;
@@ -89,8 +140,10 @@ ssize_t lzxpress_compress(const uint8_t *uncompressed,
 	indic_bit = 0;
 	nibble_index = 0;
 
-	if (uncompressed_pos > XPRESS_BLOCK_SIZE)
+	if (uncompressed_pos > XPRESS_BLOCK_SIZE) {
+		free(chains);
 		return 0;
+	}
 
 	do {
 		bool found = false;
@@ -104,12 +157,20 @@ ssize_t lzxpress_compress(const uint8_t *uncompressed,
 
 		max_offset = MIN(0x1FFF, max_offset);
 
-		/* search for the longest match in the window for the lookahead buffer */
-		for (offset = 1; (uint32_t)offset <= max_offset; offset++) {
-			str2 = &str1[-offset];
+		/* maximum len we can encode into metadata */
+		max_len = MIN((255 + 15 + 7 + 3), byte_left);
 
-			/* maximum len we can encode into metadata */
-			max_len = MIN((255 + 15 + 7 + 3), byte_left);
+		/* search for the longest match in the window for the lookahead buffer */
+		cand = 0;
+		if (byte_left >= 3) {
+			cand = chains->head[lzx_hash3(str1)];
+		}
+		while (cand != 0) {
+			offset = uncompressed_pos - (cand - 1);
+			if (offset > max_offset) {
+				break;
+			}
+			str2 = &str1[-(ssize_t)offset];
 
 			for (len = 0; (len < max_len) && (str1[len] == str2[len]); len++);
 
@@ -121,7 +182,12 @@ ssize_t lzxpress_compress(const uint8_t *uncompressed,
 				found = true;
 				best_len = len;
 				best_offset = offset;
+				if (best_len == max_len) {
+					break;
+				}
 			}
+
+			cand = chains->prev[(cand - 1) & LZX_WINDOW_MASK];
 		}
 
 		if (found) {
@@ -191,9 +257,17 @@ ssize_t lzxpress_compress(const uint8_t *uncompressed,
 			}
 
 			compressed_pos += metadata_size;
+			for (len = 0; len < best_len; len++) {
+				lzx_hash_insert(chains, uncompressed,
+						uncompressed_size,
+						uncompressed_pos + len);
+			}
 			uncompressed_pos += best_len;
 			byte_left -= best_len;
 		} else {
+			lzx_hash_insert(chains, uncompressed,
+					uncompressed_size,
+					uncompressed_pos);
 			compressed[compressed_pos++] = uncompressed[uncompressed_pos++];
 			byte_left--;
 		}
@@ -230,6 +304,7 @@ ssize_t lzxpress_compress(const uint8_t *uncompressed,
 		compressed_pos += sizeof(uint32_t);
 	}
 
+	free(chains);
 	return compressed_pos;
 }
 
@@ -252,8 +327,15 @@ ssize_t lzxpress_decompress(const uint8_t *input,
 	offset = 0;
 	nibble_index = 0;
 
+	if (max_output_size == 0 || input_size == 0) {
+		return 0;
+	}
+
 	do {
 		if (indicator_bit == 0) {
+			if (input_index + sizeof(uint32_t) > input_size) {
+				return -1;
+			}
 			indicator = PULL_LE_UINT32(input, input_index);
 			input_index += sizeof(uint32_t);
 			indicator_bit = 32;
@@ -266,10 +348,16 @@ ssize_t lzxpress_decompress(const uint8_t *input,
 		 * check whether the 4th bit of the value in indicator is set
 		 */
 		if (((indicator >> indicator_bit) & 1) == 0) {
+			if (input_index >= input_size) {
+				return -1;
+			}
 			output[output_index] = input[input_index];
 			input_index += sizeof(uint8_t);
 			output_index += sizeof(uint8_t);
 		} else {
+			if (input_index + sizeof(uint16_t) > input_size) {
+				return -1;
+			}
 			length = PULL_LE_UINT16(input, input_index);
 			input_index += sizeof(uint16_t);
 			offset = length / 8;
@@ -277,6 +365,9 @@ ssize_t lzxpress_decompress(const uint8_t *input,
 
 			if (length == 7) {
 				if (nibble_index == 0) {
+					if (input_index >= input_size) {
+						return -1;
+					}
 					nibble_index = input_index;
 					length = input[input_index] % 16;
 					input_index += sizeof(uint8_t);
@@ -286,11 +377,20 @@ ssize_t lzxpress_decompress(const uint8_t *input,
 				}
 
 				if (length == 15) {
+					if (input_index >= input_size) {
+						return -1;
+					}
 					length = input[input_index];
 					input_index += sizeof(uint8_t);
 					if (length == 255) {
+						if (input_index + sizeof(uint16_t) > input_size) {
+							return -1;
+						}
 						length = PULL_LE_UINT16(input, input_index);
 						input_index += sizeof(uint16_t);
+						if (length < (15 + 7)) {
+							return -1;
+						}
 						length -= (15 + 7);
 					}
 					length += 15;
@@ -300,8 +400,15 @@ ssize_t lzxpress_decompress(const uint8_t *input,
 
 			length += 3;
 
+			if ((offset + 1) > output_index) {
+				/* the match would start before the output buffer */
+				return -1;
+			}
+
 			do {
-				if ((output_index >= max_output_size) || ((offset + 1) > output_index)) break;
+				if (output_index >= max_output_size) {
+					break;
+				}
 
 				output[output_index] = output[output_index - offset - 1];
 
@@ -64,12 +64,57 @@ static bool test_lzxpress(struct torture_context *test)
 	return true;
 }
 
+/*
+  test lzxpress on larger buffers and on truncated input
+ */
+static bool test_lzxpress_round_trip(struct torture_context *test)
+{
+	TALLOC_CTX *tmp_ctx = talloc_new(test);
+	const size_t plain_size = 0x10000;
+	uint8_t *plain, *comp, *out;
+	size_t max_comp_size = plain_size + (plain_size / 32 + 2) * 4;
+	ssize_t c_size, d_size;
+	size_t i;
+
+	plain = talloc_size(tmp_ctx, plain_size);
+	comp = talloc_size(tmp_ctx, max_comp_size);
+	out = talloc_size(tmp_ctx, plain_size);
+
+	for (i = 0; i < plain_size; i++) {
+		plain[i] = "Samba transport compression "[i % 28];
+		if ((i % 997) == 0) {
+			plain[i] = (uint8_t)i;
+		}
+	}
+
+	c_size = lzxpress_compress(plain, plain_size, comp, max_comp_size);
+	torture_assert(test, c_size > 0, "lzxpress_compress failed");
+	torture_assert(test, (size_t)c_size < plain_size,
+		       "lzxpress_compress did not compress");
+
+	d_size = lzxpress_decompress(comp, c_size, out, plain_size);
+	torture_assert_int_equal(test, d_size, plain_size,
+				 "lzxpress_decompress size");
+	torture_assert_mem_equal(test, out, plain, plain_size,
+				 "lzxpress_decompress data");
+
+	torture_comment(test, "lzxpress truncated decompression\n");
+	d_size = lzxpress_decompress(comp, c_size / 2, out, plain_size);
+	torture_assert(test, d_size < (ssize_t)plain_size,
+		       "lzxpress_decompress of truncated data succeeded");
+
+	talloc_free(tmp_ctx);
+	return true;
+}
+
 
 struct torture_suite *torture_local_compression(TALLOC_CTX *mem_ctx)
 {
 	struct torture_suite *suite = torture_suite_create(mem_ctx, "compression");
 
 	torture_suite_add_simple_test(suite, "lzxpress", test_lzxpress);
+	torture_suite_add_simple_test(suite, "lzxpress_round_trip",
+				      test_lzxpress_round_trip);
 
 	return suite;
 }
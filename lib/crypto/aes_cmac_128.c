@@ -40,6 +40,13 @@ void aes_cmac_128_init(struct aes_cmac_128_context *ctx,
 
 	AES_set_encrypt_key(K, 128, &ctx->aes_key);
 
+#ifdef HAVE_AES_X86_INTRINSICS
+	if (aes_x86_accel_available()) {
+		aes_x86_accel_set_key(K, ctx->accel_rk);
+		ctx->accel = true;
+	}
+#endif
+
 	/* step 1 - generate subkeys k1 and k2 */
 
 	AES_encrypt(const_Zero, ctx->L, &ctx->aes_key);
@@ -85,6 +92,17 @@ void aes_cmac_128_update(struct aes_cmac_128_context *ctx,
 	aes_block_xor(ctx->X, ctx->last, ctx->Y);
 	AES_encrypt(ctx->Y, ctx->X, &ctx->aes_key);
 
+#ifdef HAVE_AES_X86_INTRINSICS
+	if (ctx->accel && msg_len > AES_BLOCK_SIZE) {
+		/* keep the last block for aes_cmac_128_final() */
+		size_t num_blocks = (msg_len - 1) / AES_BLOCK_SIZE;
+
+		aes_x86_accel_cbc_mac(ctx->accel_rk, ctx->X, msg, num_blocks);
+		msg += num_blocks * AES_BLOCK_SIZE;
+		msg_len -= num_blocks * AES_BLOCK_SIZE;
+	}
+#endif
+
 	while (msg_len > AES_BLOCK_SIZE) {
 		aes_block_xor(ctx->X, msg, ctx->Y);
 		AES_encrypt(ctx->Y, ctx->X, &ctx->aes_key);
@@ -19,6 +19,8 @@
 #ifndef LIB_CRYPTO_AES_CMAC_128_H
 #define LIB_CRYPTO_AES_CMAC_128_H
 
+#include "../lib/crypto/aes_x86_accel.h"
+
 struct aes_cmac_128_context {
 	AES_KEY aes_key;
 
@@ -35,6 +37,13 @@ struct aes_cmac_128_context {
 
 	uint8_t last[AES_BLOCK_SIZE];
 	size_t last_len;
+
+	/*
+	 * Only used if accel is true,
+	 * see aes_x86_accel.c
+	 */
+	bool accel;
+	uint8_t accel_rk[AES_X86_ACCEL_NUM_RK][AES_BLOCK_SIZE];
 };
 
 void aes_cmac_128_init(struct aes_cmac_128_context *ctx,
@@ -25,7 +25,7 @@ bool torture_local_crypto_aes_cmac_128(struct torture_context *torture);
 /*
  This uses the test values from rfc 4493
 */
-bool torture_local_crypto_aes_cmac_128(struct torture_context *torture)
+static bool test_aes_cmac_128_testvectors(struct torture_context *torture)
 {
 	bool ret = true;
 	uint32_t i;
@@ -116,3 +116,22 @@ bool torture_local_crypto_aes_cmac_128(struct torture_context *torture)
 	talloc_free(tctx);
 	return ret;
 }
+
+bool torture_local_crypto_aes_cmac_128(struct torture_context *torture)
+{
+	bool ret;
+
+	ret = test_aes_cmac_128_testvectors(torture);
+#ifdef HAVE_AES_X86_INTRINSICS
+	/*
+	 * Also check the generic code,
+	 * if AES-NI is used by default.
+	 */
+	if (ret && aes_x86_accel_available()) {
+		aes_x86_accel_disable(true);
+		ret = test_aes_cmac_128_testvectors(torture);
+		aes_x86_accel_disable(false);
+	}
+#endif
+	return ret;
+}
@@ -66,6 +66,12 @@ static inline void aes_gcm_128_mul(const uint8_t x[AES_BLOCK_SIZE],
 static inline void aes_gcm_128_ghash_block(struct aes_gcm_128_context *ctx,
 					   const uint8_t in[AES_BLOCK_SIZE])
 {
+#ifdef HAVE_AES_X86_INTRINSICS
+	if (ctx->accel) {
+		aes_x86_accel_ghash(ctx->accel_H, ctx->Y, in, 1);
+		return;
+	}
+#endif
 	aes_block_xor(ctx->Y, in, ctx->y.block);
 	aes_gcm_128_mul(ctx->y.block, ctx->H, ctx->v.block, ctx->Y);
 }
@@ -83,6 +89,14 @@ void aes_gcm_128_init(struct aes_gcm_128_context *ctx,
 	 */
 	AES_encrypt(ctx->Y, ctx->H, &ctx->aes_key);
 
+#ifdef HAVE_AES_X86_INTRINSICS
+	if (aes_x86_accel_available()) {
+		aes_x86_accel_set_key(K, ctx->accel_rk);
+		aes_x86_accel_ghash_init(ctx->H, ctx->accel_H);
+		ctx->accel = true;
+	}
+#endif
+
 	/*
 	 * Step 2: generate J0
 	 */
@@ -116,6 +130,16 @@ static inline void aes_gcm_128_update_tmp(struct aes_gcm_128_context *ctx,
 		tmp->ofs = 0;
 	}
 
+#ifdef HAVE_AES_X86_INTRINSICS
+	if (ctx->accel && v_len >= AES_BLOCK_SIZE) {
+		size_t num_blocks = v_len / AES_BLOCK_SIZE;
+
+		aes_x86_accel_ghash(ctx->accel_H, ctx->Y, v, num_blocks);
+		v += num_blocks * AES_BLOCK_SIZE;
+		v_len -= num_blocks * AES_BLOCK_SIZE;
+	}
+#endif
+
 	while (v_len >= AES_BLOCK_SIZE) {
 		aes_gcm_128_ghash_block(ctx, v);
 		v += AES_BLOCK_SIZE;
@@ -161,6 +185,32 @@ static inline void aes_gcm_128_crypt_tmp(struct aes_gcm_128_context *ctx,
 			tmp->ofs = 0;
 		}
 
+#ifdef HAVE_AES_X86_INTRINSICS
+		if (ctx->accel && tmp->ofs == 0 && m_len >= 2*AES_BLOCK_SIZE) {
+			/*
+			 * tmp->block already has the key stream for
+			 * the current CB, then let
+			 * aes_x86_accel_ctr32() handle all remaining
+			 * full blocks.
+			 */
+			size_t num_blocks = m_len / AES_BLOCK_SIZE - 1;
+
+			aes_block_xor(m, tmp->block, m);
+			m += AES_BLOCK_SIZE;
+			m_len -= AES_BLOCK_SIZE;
+
+			aes_x86_accel_ctr32(ctx->accel_rk, ctx->CB,
+					    m, num_blocks);
+			m += num_blocks * AES_BLOCK_SIZE;
+			m_len -= num_blocks * AES_BLOCK_SIZE;
+
+			aes_gcm_128_inc32(ctx->CB);
+			aes_x86_accel_encrypt(ctx->accel_rk, ctx->CB,
+					      tmp->block);
+			continue;
+		}
+#endif
+
 		if (likely(tmp->ofs == 0 && m_len >= AES_BLOCK_SIZE)) {
 			aes_block_xor(m, tmp->block, m);
 			m += AES_BLOCK_SIZE;
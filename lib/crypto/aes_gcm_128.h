@@ -20,6 +20,8 @@
 #ifndef LIB_CRYPTO_AES_GCM_128_H
 #define LIB_CRYPTO_AES_GCM_128_H
 
+#include "../lib/crypto/aes_x86_accel.h"
+
 #define AES_GCM_128_IV_SIZE (12)
 
 struct aes_gcm_128_context {
@@ -38,6 +40,14 @@ struct aes_gcm_128_context {
 	uint8_t CB[AES_BLOCK_SIZE];
 	uint8_t Y[AES_BLOCK_SIZE];
 	uint8_t AC[AES_BLOCK_SIZE];
+
+	/*
+	 * Only used if accel is true,
+	 * see aes_x86_accel.c
+	 */
+	bool accel;
+	uint8_t accel_rk[AES_X86_ACCEL_NUM_RK][AES_BLOCK_SIZE];
+	uint8_t accel_H[AES_X86_ACCEL_NUM_H][AES_BLOCK_SIZE];
 };
 
 void aes_gcm_128_init(struct aes_gcm_128_context *ctx,
@@ -28,7 +28,7 @@ bool torture_local_crypto_aes_gcm_128(struct torture_context *tctx);
 /*
  This uses the test values from ...
 */
-bool torture_local_crypto_aes_gcm_128(struct torture_context *tctx)
+static bool test_aes_gcm_128_testvectors(struct torture_context *tctx)
 {
 	bool ret = true;
 	uint32_t i;
@@ -291,4 +291,23 @@ bool torture_local_crypto_aes_gcm_128(struct torture_context *tctx)
  fail:
 	return ret;
 }
+
+bool torture_local_crypto_aes_gcm_128(struct torture_context *tctx)
+{
+	bool ret;
+
+	ret = test_aes_gcm_128_testvectors(tctx);
+#ifdef HAVE_AES_X86_INTRINSICS
+	/*
+	 * Also check the generic code,
+	 * if AES-NI/PCLMUL is used by default.
+	 */
+	if (ret && aes_x86_accel_available()) {
+		aes_x86_accel_disable(true);
+		ret = test_aes_gcm_128_testvectors(tctx);
+		aes_x86_accel_disable(false);
+	}
+#endif
+	return ret;
+}
 #endif /* AES_GCM_128_ONLY_TESTVECTORS */
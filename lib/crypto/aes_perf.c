@@ -0,0 +1,108 @@
+/*
+   Simple throughput benchmark for AES-GCM-128, AES-CCM-128
+   and AES-CMAC-128
+
+   Copyright (C) Samba Team 2019
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "replace.h"
+#include "system/time.h"
+#include "../lib/crypto/crypto.h"
+
+#define AES_PERF_BUFSIZE (1024*1024)
+
+static double aes_perf_elapsed(const struct timespec *start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return (end.tv_sec - start->tv_sec) +
+	       (end.tv_nsec - start->tv_nsec) / 1000000000.0;
+}
+
+static void aes_perf_run(uint8_t *buf, int num)
+{
+	uint8_t K[AES_BLOCK_SIZE] = { 0x01, };
+	uint8_t N[AES_GCM_128_IV_SIZE] = { 0x02, };
+	uint8_t T[AES_BLOCK_SIZE];
+	struct timespec start;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < num; i++) {
+		struct aes_gcm_128_context ctx;
+
+		aes_gcm_128_init(&ctx, K, N);
+		aes_gcm_128_crypt(&ctx, buf, AES_PERF_BUFSIZE);
+		aes_gcm_128_updateC(&ctx, buf, AES_PERF_BUFSIZE);
+		aes_gcm_128_digest(&ctx, T);
+	}
+	printf("  aes_gcm_128:  %8.1f MiB/s\n", num / aes_perf_elapsed(&start));
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < num; i++) {
+		struct aes_ccm_128_context ctx;
+
+		aes_ccm_128_init(&ctx, K, N, 0, AES_PERF_BUFSIZE);
+		aes_ccm_128_update(&ctx, buf, AES_PERF_BUFSIZE);
+		aes_ccm_128_crypt(&ctx, buf, AES_PERF_BUFSIZE);
+		aes_ccm_128_digest(&ctx, T);
+	}
+	printf("  aes_ccm_128:  %8.1f MiB/s\n", num / aes_perf_elapsed(&start));
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < num; i++) {
+		struct aes_cmac_128_context ctx;
+
+		aes_cmac_128_init(&ctx, K);
+		aes_cmac_128_update(&ctx, buf, AES_PERF_BUFSIZE);
+		aes_cmac_128_final(&ctx, T);
+	}
+	printf("  aes_cmac_128: %8.1f MiB/s\n", num / aes_perf_elapsed(&start));
+}
+
+int main(int argc, const char *argv[])
+{
+	uint8_t *buf = NULL;
+	int num;
+
+	if (argc != 2) {
+		fprintf(stderr, "aes_perf <num MiB>\n");
+		exit(1);
+	}
+	num = atoi(argv[1]);
+
+	buf = calloc(1, AES_PERF_BUFSIZE);
+	if (buf == NULL) {
+		fprintf(stderr, "calloc failed\n");
+		exit(1);
+	}
+
+#ifdef HAVE_AES_X86_INTRINSICS
+	if (aes_x86_accel_available()) {
+		printf("AES-NI/PCLMUL:\n");
+		aes_perf_run(buf, num);
+		aes_x86_accel_disable(true);
+	}
+#endif
+
+	printf("generic:\n");
+	aes_perf_run(buf, num);
+
+	free(buf);
+	return 0;
+}
@@ -0,0 +1,408 @@
+/*
+   AES-NI/PCLMUL helpers for AES-GCM-128 and AES-CMAC-128
+
+   Copyright (C) Samba Team 2019
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "replace.h"
+#include "../lib/crypto/crypto.h"
+
+#ifdef HAVE_AES_X86_INTRINSICS
+
+#include <cpuid.h>
+#include <wmmintrin.h>
+#include <tmmintrin.h>
+
+/*
+ * All functions using the intrinsics need to be compiled
+ * for the extended instruction set, the callers only
+ * use them if aes_x86_accel_available() returned true.
+ */
+#define AES_X86_TARGET __attribute__((target("aes,pclmul,ssse3")))
+
+static bool aes_x86_accel_disabled;
+
+bool aes_x86_accel_available(void)
+{
+	static int available = -1;
+	unsigned int eax, ebx, ecx, edx;
+
+	if (aes_x86_accel_disabled) {
+		return false;
+	}
+
+	if (available != -1) {
+		return (bool)available;
+	}
+
+	available = 0;
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) == 0) {
+		return false;
+	}
+	if ((ecx & bit_AES) && (ecx & bit_PCLMUL) && (ecx & bit_SSSE3)) {
+		available = 1;
+	}
+
+	return (bool)available;
+}
+
+void aes_x86_accel_disable(bool disable)
+{
+	aes_x86_accel_disabled = disable;
+}
+
+/*
+ * GCM and GHASH use big endian blocks,
+ * byte swap them into the SSE registers.
+ */
+#define AES_X86_BSWAP_MASK \
+	_mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15)
+
+#define AES_X86_BSWAP_LOAD(p, mask) \
+	_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p)), (mask))
+#define AES_X86_BSWAP_STORE(p, v, mask) \
+	_mm_storeu_si128((__m128i *)(p), _mm_shuffle_epi8((v), (mask)))
+
+static inline AES_X86_TARGET __m128i aes_x86_key_step(__m128i key,
+						       __m128i kg)
+{
+	kg = _mm_shuffle_epi32(kg, 0xff);
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	return _mm_xor_si128(key, kg);
+}
+
+/* _mm_aeskeygenassist_si128() needs an immediate rcon value */
+#define AES_X86_KEY_STEP(k, rcon) \
+	aes_x86_key_step((k), _mm_aeskeygenassist_si128((k), (rcon)))
+
+AES_X86_TARGET
+void aes_x86_accel_set_key(const uint8_t K[AES_BLOCK_SIZE],
+			   uint8_t rk[AES_X86_ACCEL_NUM_RK][AES_BLOCK_SIZE])
+{
+	__m128i k[AES_X86_ACCEL_NUM_RK];
+	size_t i;
+
+	k[0] = _mm_loadu_si128((const __m128i *)K);
+	k[1] = AES_X86_KEY_STEP(k[0], 0x01);
+	k[2] = AES_X86_KEY_STEP(k[1], 0x02);
+	k[3] = AES_X86_KEY_STEP(k[2], 0x04);
+	k[4] = AES_X86_KEY_STEP(k[3], 0x08);
+	k[5] = AES_X86_KEY_STEP(k[4], 0x10);
+	k[6] = AES_X86_KEY_STEP(k[5], 0x20);
+	k[7] = AES_X86_KEY_STEP(k[6], 0x40);
+	k[8] = AES_X86_KEY_STEP(k[7], 0x80);
+	k[9] = AES_X86_KEY_STEP(k[8], 0x1b);
+	k[10] = AES_X86_KEY_STEP(k[9], 0x36);
+
+	for (i = 0; i < AES_X86_ACCEL_NUM_RK; i++) {
+		_mm_storeu_si128((__m128i *)rk[i], k[i]);
+	}
+}
+
+static inline AES_X86_TARGET void aes_x86_load_key(
+	const uint8_t rk[AES_X86_ACCEL_NUM_RK][AES_BLOCK_SIZE],
+	__m128i k[AES_X86_ACCEL_NUM_RK])
+{
+	size_t i;
+
+	for (i = 0; i < AES_X86_ACCEL_NUM_RK; i++) {
+		k[i] = _mm_loadu_si128((const __m128i *)rk[i]);
+	}
+}
+
+static inline AES_X86_TARGET __m128i aes_x86_encrypt_block(
+	const __m128i k[AES_X86_ACCEL_NUM_RK], __m128i b)
+{
+	size_t r;
+
+	b = _mm_xor_si128(b, k[0]);
+	for (r = 1; r < AES_X86_ACCEL_NUM_RK - 1; r++) {
+		b = _mm_aesenc_si128(b, k[r]);
+	}
+	return _mm_aesenclast_si128(b, k[AES_X86_ACCEL_NUM_RK - 1]);
+}
+
+AES_X86_TARGET
+void aes_x86_accel_encrypt(
+	const uint8_t rk[AES_X86_ACCEL_NUM_RK][AES_BLOCK_SIZE],
+	const uint8_t in[AES_BLOCK_SIZE],
+	uint8_t out[AES_BLOCK_SIZE])
+{
+	__m128i k[AES_X86_ACCEL_NUM_RK];
+	__m128i b;
+
+	aes_x86_load_key(rk, k);
+
+	b = _mm_loadu_si128((const __m128i *)in);
+	b = aes_x86_encrypt_block(k, b);
+	_mm_storeu_si128((__m128i *)out, b);
+}
+
+/*
+ * The AES rounds of independent blocks can be pipelined,
+ * so we encrypt AES_X86_CTR_BLOCKS counter blocks at once.
+ */
+#define AES_X86_CTR_BLOCKS 8
+
+AES_X86_TARGET
+void aes_x86_accel_ctr32(
+	const uint8_t rk[AES_X86_ACCEL_NUM_RK][AES_BLOCK_SIZE],
+	uint8_t CB[AES_BLOCK_SIZE],
+	uint8_t *m, size_t num_blocks)
+{
+	const __m128i bswap = AES_X86_BSWAP_MASK;
+	/*
+	 * After the byte swap the low 32 bits of CB
+	 * are in the lowest lane.
+	 */
+	const __m128i one = _mm_set_epi32(0, 0, 0, 1);
+	__m128i k[AES_X86_ACCEL_NUM_RK];
+	__m128i ctr;
+
+	aes_x86_load_key(rk, k);
+
+	ctr = AES_X86_BSWAP_LOAD(CB, bswap);
+
+	while (num_blocks >= AES_X86_CTR_BLOCKS) {
+		__m128i b[AES_X86_CTR_BLOCKS];
+		size_t i, r;
+
+		for (i = 0; i < AES_X86_CTR_BLOCKS; i++) {
+			ctr = _mm_add_epi32(ctr, one);
+			b[i] = _mm_shuffle_epi8(ctr, bswap);
+			b[i] = _mm_xor_si128(b[i], k[0]);
+		}
+		for (r = 1; r < AES_X86_ACCEL_NUM_RK - 1; r++) {
+			for (i = 0; i < AES_X86_CTR_BLOCKS; i++) {
+				b[i] = _mm_aesenc_si128(b[i], k[r]);
+			}
+		}
+		for (i = 0; i < AES_X86_CTR_BLOCKS; i++) {
+			__m128i *p = (__m128i *)(m + i * AES_BLOCK_SIZE);
+
+			b[i] = _mm_aesenclast_si128(b[i],
+					k[AES_X86_ACCEL_NUM_RK - 1]);
+			_mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p),
+							  b[i]));
+		}
+
+		m += AES_X86_CTR_BLOCKS * AES_BLOCK_SIZE;
+		num_blocks -= AES_X86_CTR_BLOCKS;
+	}
+
+	while (num_blocks > 0) {
+		__m128i *p = (__m128i *)m;
+		__m128i b;
+
+		ctr = _mm_add_epi32(ctr, one);
+		b = aes_x86_encrypt_block(k, _mm_shuffle_epi8(ctr, bswap));
+		_mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), b));
+
+		m += AES_BLOCK_SIZE;
+		num_blocks -= 1;
+	}
+
+	AES_X86_BSWAP_STORE(CB, ctr, bswap);
+}
+
+AES_X86_TARGET
+void aes_x86_accel_cbc_mac(
+	const uint8_t rk[AES_X86_ACCEL_NUM_RK][AES_BLOCK_SIZE],
+	uint8_t X[AES_BLOCK_SIZE],
+	const uint8_t *m, size_t num_blocks)
+{
+	__m128i k[AES_X86_ACCEL_NUM_RK];
+	__m128i x;
+
+	aes_x86_load_key(rk, k);
+
+	/*
+	 * CBC-MAC is serial by definition, but keeping the
+	 * key schedule and the state in registers is still
+	 * a lot faster than the table based implementation.
+	 */
+	x = _mm_loadu_si128((const __m128i *)X);
+	while (num_blocks > 0) {
+		__m128i b = _mm_loadu_si128((const __m128i *)m);
+
+		x = aes_x86_encrypt_block(k, _mm_xor_si128(x, b));
+
+		m += AES_BLOCK_SIZE;
+		num_blocks -= 1;
+	}
+	_mm_storeu_si128((__m128i *)X, x);
+}
+
+/*
+ * Carry-less multiplication of two byte swapped GHASH
+ * blocks, see the Intel white paper "Intel Carry-Less
+ * Multiplication Instruction and its Usage for Computing
+ * the GCM Mode" (Gueron, Kounavis).
+ *
+ * The 256-bit result is xor'ed unreduced into lo/hi,
+ * so that several products can be summed up before
+ * a single aes_x86_gf_reduce().
+ */
+static inline AES_X86_TARGET void aes_x86_gf_mul(__m128i a, __m128i b,
+						  __m128i *lo, __m128i *hi)
+{
+	__m128i t0, t1, t2, t3;
+
+	t0 = _mm_clmulepi64_si128(a, b, 0x00);
+	t1 = _mm_clmulepi64_si128(a, b, 0x10);
+	t2 = _mm_clmulepi64_si128(a, b, 0x01);
+	t3 = _mm_clmulepi64_si128(a, b, 0x11);
+
+	t1 = _mm_xor_si128(t1, t2);
+	*lo = _mm_xor_si128(*lo, _mm_xor_si128(t0, _mm_slli_si128(t1, 8)));
+	*hi = _mm_xor_si128(*hi, _mm_xor_si128(t3, _mm_srli_si128(t1, 8)));
+}
+
+static inline AES_X86_TARGET __m128i aes_x86_gf_reduce(__m128i lo,
+							__m128i hi)
+{
+	__m128i t2, t4, t5, t7, t8, t9;
+
+	/*
+	 * The blocks are bit reflected,
+	 * so shift the product left by one.
+	 */
+	t7 = _mm_srli_epi32(lo, 31);
+	t8 = _mm_srli_epi32(hi, 31);
+	lo = _mm_slli_epi32(lo, 1);
+	hi = _mm_slli_epi32(hi, 1);
+
+	t9 = _mm_srli_si128(t7, 12);
+	t8 = _mm_slli_si128(t8, 4);
+	t7 = _mm_slli_si128(t7, 4);
+	lo = _mm_or_si128(lo, t7);
+	hi = _mm_or_si128(hi, t8);
+	hi = _mm_or_si128(hi, t9);
+
+	/*
+	 * reduce modulo x^128 + x^7 + x^2 + x + 1
+	 */
+	t7 = _mm_slli_epi32(lo, 31);
+	t8 = _mm_slli_epi32(lo, 30);
+	t9 = _mm_slli_epi32(lo, 25);
+
+	t7 = _mm_xor_si128(t7, t8);
+	t7 = _mm_xor_si128(t7, t9);
+	t8 = _mm_srli_si128(t7, 4);
+	t7 = _mm_slli_si128(t7, 12);
+	lo = _mm_xor_si128(lo, t7);
+
+	t2 = _mm_srli_epi32(lo, 1);
+	t4 = _mm_srli_epi32(lo, 2);
+	t5 = _mm_srli_epi32(lo, 7);
+	t2 = _mm_xor_si128(t2, t4);
+	t2 = _mm_xor_si128(t2, t5);
+	t2 = _mm_xor_si128(t2, t8);
+	lo = _mm_xor_si128(lo, t2);
+
+	return _mm_xor_si128(hi, lo);
+}
+
+static inline AES_X86_TARGET __m128i aes_x86_gf_mul_reduce(__m128i a,
+							    __m128i b)
+{
+	__m128i lo = _mm_setzero_si128();
+	__m128i hi = _mm_setzero_si128();
+
+	aes_x86_gf_mul(a, b, &lo, &hi);
+	return aes_x86_gf_reduce(lo, hi);
+}
+
+AES_X86_TARGET
+void aes_x86_accel_ghash_init(const uint8_t H[AES_BLOCK_SIZE],
+			      uint8_t Htable[AES_X86_ACCEL_NUM_H][AES_BLOCK_SIZE])
+{
+	const __m128i bswap = AES_X86_BSWAP_MASK;
+	__m128i h, hn;
+	size_t i;
+
+	/*
+	 * Htable[i] is H^(i+1), stored byte swapped.
+	 */
+	h = AES_X86_BSWAP_LOAD(H, bswap);
+	hn = h;
+	_mm_storeu_si128((__m128i *)Htable[0], hn);
+	for (i = 1; i < AES_X86_ACCEL_NUM_H; i++) {
+		hn = aes_x86_gf_mul_reduce(hn, h);
+		_mm_storeu_si128((__m128i *)Htable[i], hn);
+	}
+}
+
+AES_X86_TARGET
+void aes_x86_accel_ghash(
+	const uint8_t Htable[AES_X86_ACCEL_NUM_H][AES_BLOCK_SIZE],
+	uint8_t Y[AES_BLOCK_SIZE],
+	const uint8_t *m, size_t num_blocks)
+{
+	const __m128i bswap = AES_X86_BSWAP_MASK;
+	__m128i h1, h2, h3, h4;
+	__m128i y;
+
+	h1 = _mm_loadu_si128((const __m128i *)Htable[0]);
+	h2 = _mm_loadu_si128((const __m128i *)Htable[1]);
+	h3 = _mm_loadu_si128((const __m128i *)Htable[2]);
+	h4 = _mm_loadu_si128((const __m128i *)Htable[3]);
+
+	y = AES_X86_BSWAP_LOAD(Y, bswap);
+
+	/*
+	 * Process 4 blocks with a single reduction:
+	 *
+	 * Y' = (Y ^ M1) * H^4 ^ M2 * H^3 ^ M3 * H^2 ^ M4 * H
+	 */
+	while (num_blocks >= AES_X86_ACCEL_NUM_H) {
+		__m128i lo = _mm_setzero_si128();
+		__m128i hi = _mm_setzero_si128();
+		__m128i x1, x2, x3, x4;
+
+		x1 = AES_X86_BSWAP_LOAD(m + 0 * AES_BLOCK_SIZE, bswap);
+		x2 = AES_X86_BSWAP_LOAD(m + 1 * AES_BLOCK_SIZE, bswap);
+		x3 = AES_X86_BSWAP_LOAD(m + 2 * AES_BLOCK_SIZE, bswap);
+		x4 = AES_X86_BSWAP_LOAD(m + 3 * AES_BLOCK_SIZE, bswap);
+
+		x1 = _mm_xor_si128(x1, y);
+
+		aes_x86_gf_mul(x1, h4, &lo, &hi);
+		aes_x86_gf_mul(x2, h3, &lo, &hi);
+		aes_x86_gf_mul(x3, h2, &lo, &hi);
+		aes_x86_gf_mul(x4, h1, &lo, &hi);
+
+		y = aes_x86_gf_reduce(lo, hi);
+
+		m += AES_X86_ACCEL_NUM_H * AES_BLOCK_SIZE;
+		num_blocks -= AES_X86_ACCEL_NUM_H;
+	}
+
+	while (num_blocks > 0) {
+		__m128i x = AES_X86_BSWAP_LOAD(m, bswap);
+
+		y = aes_x86_gf_mul_reduce(_mm_xor_si128(x, y), h1);
+
+		m += AES_BLOCK_SIZE;
+		num_blocks -= 1;
+	}
+
+	AES_X86_BSWAP_STORE(Y, y, bswap);
+}
+
+#endif /* HAVE_AES_X86_INTRINSICS */
@@ -0,0 +1,85 @@
+/*
+   AES-NI/PCLMUL helpers for AES-GCM-128 and AES-CMAC-128
+
+   Copyright (C) Samba Team 2019
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LIB_CRYPTO_AES_X86_ACCEL_H
+#define LIB_CRYPTO_AES_X86_ACCEL_H
+
+/*
+ * The number of AES-128 round keys.
+ */
+#define AES_X86_ACCEL_NUM_RK 11
+
+/*
+ * The number of powers of H used for the
+ * aggregated GHASH reduction.
+ */
+#define AES_X86_ACCEL_NUM_H 4
+
+#ifdef HAVE_AES_X86_INTRINSICS
+
+/*
+ * Returns true if the CPU supports the AES-NI, PCLMULQDQ
+ * and SSSE3 instructions, the result is cached.
+ */
+bool aes_x86_accel_available(void);
+
+/*
+ * For benchmarks and tests: make aes_x86_accel_available()
+ * return false for contexts initialized afterwards.
+ */
+void aes_x86_accel_disable(bool disable);
+
+void aes_x86_accel_set_key(const uint8_t K[AES_BLOCK_SIZE],
+			   uint8_t rk[AES_X86_ACCEL_NUM_RK][AES_BLOCK_SIZE]);
+void aes_x86_accel_encrypt(
+	const uint8_t rk[AES_X86_ACCEL_NUM_RK][AES_BLOCK_SIZE],
+	const uint8_t in[AES_BLOCK_SIZE],
+	uint8_t out[AES_BLOCK_SIZE]);
+
+/*
+ * For each of the num_blocks blocks in m: increment the
+ * low 32 bits of CB (big endian) and xor m with E(K, CB).
+ */
+void aes_x86_accel_ctr32(
+	const uint8_t rk[AES_X86_ACCEL_NUM_RK][AES_BLOCK_SIZE],
+	uint8_t CB[AES_BLOCK_SIZE],
+	uint8_t *m, size_t num_blocks);
+
+/*
+ * For each of the num_blocks blocks in m: X = E(K, X ^ m).
+ */
+void aes_x86_accel_cbc_mac(
+	const uint8_t rk[AES_X86_ACCEL_NUM_RK][AES_BLOCK_SIZE],
+	uint8_t X[AES_BLOCK_SIZE],
+	const uint8_t *m, size_t num_blocks);
+
+void aes_x86_accel_ghash_init(const uint8_t H[AES_BLOCK_SIZE],
+			      uint8_t Htable[AES_X86_ACCEL_NUM_H][AES_BLOCK_SIZE]);
+
+/*
+ * For each of the num_blocks blocks in m: Y = (Y ^ m) * H.
+ */
+void aes_x86_accel_ghash(
+	const uint8_t Htable[AES_X86_ACCEL_NUM_H][AES_BLOCK_SIZE],
+	uint8_t Y[AES_BLOCK_SIZE],
+	const uint8_t *m, size_t num_blocks);
+
+#endif /* HAVE_AES_X86_INTRINSICS */
+
+#endif /* LIB_CRYPTO_AES_X86_ACCEL_H */
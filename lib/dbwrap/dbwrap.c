@@ -27,6 +27,7 @@
 #include "dbwrap/dbwrap_private.h"
 #include "lib/util/util_tdb.h"
 #include "lib/util/tevent_ntstatus.h"
+#include "lib/util/usdt.h"
 
 /*
  * Fall back using fetch if no genuine exists operation is provided
@@ -218,7 +219,9 @@ static struct db_record *dbwrap_fetch_locked_internal(
 			return NULL;
 		}
 	}
+	SAMBA_USDT3(dbwrap_lock_start, db->name, key.dptr, key.dsize);
 	rec = db_fn(db, mem_ctx, key);
+	SAMBA_USDT2(dbwrap_lock_done, db->name, rec != NULL);
 	if (rec == NULL) {
 		TALLOC_FREE(lock_order);
 		return NULL;
@@ -386,6 +389,47 @@ NTSTATUS dbwrap_traverse_read(struct db_context *db,
 	return NT_STATUS_OK;
 }
 
+uint32_t dbwrap_traverse_num_chunks(struct db_context *db)
+{
+	if (db->traverse_read_chunk == NULL) {
+		return 1;
+	}
+	return db->traverse_num_chunks(db);
+}
+
+NTSTATUS dbwrap_traverse_read_chunk(struct db_context *db,
+				    uint32_t *chunk,
+				    uint32_t num_chunks,
+				    int (*f)(struct db_record*, void*),
+				    void *private_data,
+				    int *count)
+{
+	int ret = 0;
+
+	if (db->traverse_read_chunk != NULL) {
+		ret = db->traverse_read_chunk(db, chunk, num_chunks,
+					      f, private_data);
+	} else if ((*chunk == 0) && (num_chunks > 0)) {
+		/*
+		 * The whole database is a single chunk
+		 */
+		ret = db->traverse_read(db, f, private_data);
+		*chunk = 1;
+	} else if (*chunk > 1) {
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	if (ret < 0) {
+		return NT_STATUS_INTERNAL_DB_CORRUPTION;
+	}
+
+	if (count != NULL) {
+		*count = ret;
+	}
+
+	return NT_STATUS_OK;
+}
+
 static void dbwrap_null_parser(TDB_DATA key, TDB_DATA val, void* data)
 {
 	return;
@@ -527,7 +571,11 @@ NTSTATUS dbwrap_do_locked(struct db_context *db, TDB_DATA key,
 			dbwrap_lock_order_lock(db, &lockptr);
 		}
 
+		SAMBA_USDT3(dbwrap_do_locked_start, db->name,
+			    key.dptr, key.dsize);
 		status = db->do_locked(db, key, fn, private_data);
+		SAMBA_USDT2(dbwrap_do_locked_done, db->name,
+			    NT_STATUS_V(status));
 
 		if (db->lock_order != DBWRAP_LOCK_ORDER_NONE) {
 			dbwrap_lock_order_unlock(db, lockptr);
@@ -101,6 +101,27 @@ NTSTATUS dbwrap_traverse_read(struct db_context *db,
 			      int (*f)(struct db_record*, void*),
 			      void *private_data,
 			      int *count);
+
+/**
+ * Number of chunks dbwrap_traverse_read_chunk() splits the database
+ * into. Backends without support for chunked traverses have one.
+ */
+uint32_t dbwrap_traverse_num_chunks(struct db_context *db);
+
+/**
+ * Traverse up to num_chunks chunks of the database, starting at
+ * *chunk. Only the chunk currently walked is locked, so long scans
+ * do not block writers for a full pass. *chunk is advanced past the
+ * chunks walked, the traverse is done when it reaches
+ * dbwrap_traverse_num_chunks(). Disjoint ranges of chunks can be
+ * walked by different processes in parallel.
+ */
+NTSTATUS dbwrap_traverse_read_chunk(struct db_context *db,
+				    uint32_t *chunk,
+				    uint32_t num_chunks,
+				    int (*f)(struct db_record*, void*),
+				    void *private_data,
+				    int *count);
 NTSTATUS dbwrap_parse_record(struct db_context *db, TDB_DATA key,
 			     void (*parser)(TDB_DATA key, TDB_DATA data,
 					    void *private_data),
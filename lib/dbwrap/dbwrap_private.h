@@ -50,6 +50,12 @@ struct db_context {
 			     int (*f)(struct db_record *rec,
 				      void *private_data),
 			     void *private_data);
+	uint32_t (*traverse_num_chunks)(struct db_context *db);
+	int (*traverse_read_chunk)(struct db_context *db,
+				   uint32_t *chunk, uint32_t num_chunks,
+				   int (*f)(struct db_record *rec,
+					    void *private_data),
+				   void *private_data);
 	int (*get_seqnum)(struct db_context *db);
 	int (*transaction_start)(struct db_context *db);
 	NTSTATUS (*transaction_start_nonblock)(struct db_context *db);
@@ -0,0 +1,1452 @@
+/*
+   Unix SMB/CIFS implementation.
+   Database interface wrapper around a shared memory hash table
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * The file consists of a header, an array of reader slots, an array
+ * of hash buckets and a heap for the records.
+ *
+ * Buckets are an open addressing hash table with linear probing. A
+ * bucket's slot word holds the 32-bit key hash and the heap offset of
+ * the record in 16-byte units. Records are never modified once they
+ * are published in a slot: A store appends a new record to the heap
+ * and swaps the slot word, a delete puts a tombstone into the slot.
+ *
+ * Every bucket also has a seq word. Bit 0 is the writer lock for all
+ * keys hashing to that bucket as their home, so all writers of a key
+ * serialize on the same bucket no matter where the key ended up in
+ * the probe sequence. Bit 1 is set while a writer changes a slot word
+ * on behalf of that home bucket, after the change the counter above
+ * bit 1 is incremented. Unlocking increments the counter as well, so
+ * no two lock holders ever see the same seq value. Readers don't lock
+ * at all: They sample seq, walk the probe sequence and only if they
+ * don't find the key they check seq again to catch a change that
+ * happened under their feet.
+ *
+ * Replaced records are not reused immediately, readers might still
+ * look at them. Every process has a reader slot announcing the global
+ * epoch it read when it started looking at records. A retired record
+ * is tagged with the epoch at retirement and goes back to the free
+ * lists once no reader announces an epoch at or below that tag.
+ *
+ * Lock holders and readers that die are detected with kill(pid, 0).
+ */
+
+#include "includes.h"
+#include "system/filesys.h"
+#include "system/shmem.h"
+#include <sched.h>
+#include "dbwrap/dbwrap.h"
+#include "dbwrap/dbwrap_private.h"
+#include "dbwrap/dbwrap_shm.h"
+#include "tdb.h"
+
+#define DB_SHM_MAGIC (0x64627368) /* "dbsh" */
+#define DB_SHM_VERSION (1)
+
+#define DB_SHM_ALIGN64(_size_) (((_size_)+63)&~63)
+
+#define DB_SHM_NUM_CLASSES (28)
+#define DB_SHM_MIN_CLASS_SIZE (32)
+
+#define DB_SHM_UNIT_EMPTY (0)
+#define DB_SHM_UNIT_DELETED (1)
+
+#define DB_SHM_LOCKED (1)
+#define DB_SHM_CHANGING (2)
+#define DB_SHM_SEQ_INC (4)
+
+/*
+ * fcntl lock offsets: OPEN serializes initialization, ACTIVE is held
+ * shared by every process using the file, like TDB_CLEAR_IF_FIRST.
+ */
+#define DB_SHM_OPEN_LOCK (0)
+#define DB_SHM_ACTIVE_LOCK (1)
+
+struct db_shm_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t num_buckets;
+	uint32_t num_readers;
+	uint64_t heap_size;
+	uint64_t heap_used;
+	uint64_t epoch;
+	uint64_t seqnum;
+	uint64_t retired;
+	uint64_t overflow_readers;
+	uint64_t free_lists[DB_SHM_NUM_CLASSES];
+};
+
+struct db_shm_reader {
+	uint32_t pid;
+	uint32_t reserved;
+	uint64_t epoch;
+};
+
+struct db_shm_bucket {
+	uint64_t seq;
+	uint64_t slot;
+	uint32_t owner;
+	uint32_t reserved;
+};
+
+struct db_shm_rec {
+	uint64_t next;
+	uint64_t retire_epoch;
+	uint32_t alloc_class;
+	uint32_t hash;
+	uint32_t keylen;
+	uint32_t vallen;
+};
+
+struct db_shm_ctx {
+	int fd;
+	uint8_t *map;
+	size_t map_size;
+
+	struct db_shm_header *hdr;
+	struct db_shm_reader *readers;
+	struct db_shm_bucket *buckets;
+	uint8_t *heap;
+
+	uint32_t mask;
+	pid_t pid;
+	struct db_shm_reader *reader;
+	unsigned read_depth;
+	size_t traverse_read;
+
+	struct {
+		dev_t dev;
+		ino_t ino;
+	} id;
+};
+
+struct db_shm_rec_priv {
+	struct db_shm_ctx *ctx;
+	uint32_t hash;
+	uint32_t home;
+	uint32_t idx;
+	bool locked;
+};
+
+static NTSTATUS db_shm_storev(struct db_record *rec,
+			      const TDB_DATA *dbufs, int num_dbufs, int flag);
+static NTSTATUS db_shm_delete(struct db_record *rec);
+
+static uint64_t db_shm_load(const uint64_t *p)
+{
+	return *(const volatile uint64_t *)p;
+}
+
+static bool db_shm_pid_dead(uint32_t pid)
+{
+	int ret;
+
+	if (pid == 0) {
+		return false;
+	}
+	ret = kill((pid_t)pid, 0);
+	return ((ret == -1) && (errno == ESRCH));
+}
+
+static void db_shm_backoff(unsigned *count)
+{
+	if (*count < 100) {
+		sched_yield();
+	} else {
+		usleep(1000);
+	}
+	*count += 1;
+}
+
+static struct db_shm_rec *db_shm_unit2rec(struct db_shm_ctx *ctx,
+					  uint64_t unit)
+{
+	return (struct db_shm_rec *)(ctx->heap + (unit << 4));
+}
+
+static uint8_t *db_shm_rec_key(struct db_shm_rec *r)
+{
+	return ((uint8_t *)r) + sizeof(struct db_shm_rec);
+}
+
+static void db_shm_parse_rec(struct db_shm_rec *r,
+			     TDB_DATA *key, TDB_DATA *value)
+{
+	key->dptr = db_shm_rec_key(r);
+	key->dsize = r->keylen;
+	value->dptr = key->dptr + r->keylen;
+	value->dsize = r->vallen;
+}
+
+static uint32_t db_shm_hash(TDB_DATA key)
+{
+	return tdb_jenkins_hash(&key);
+}
+
+/*
+ * Reader slots. The fast path is a store of the global epoch into our
+ * own slot. Processes that did not get a slot fall back to a shared
+ * counter that blocks garbage collection completely while non-zero.
+ */
+
+static struct db_shm_reader *db_shm_reader_register(struct db_shm_ctx *ctx,
+						    pid_t pid)
+{
+	uint32_t i;
+
+	for (i=0; i<ctx->hdr->num_readers; i++) {
+		struct db_shm_reader *r = &ctx->readers[i];
+		uint32_t old = r->pid;
+
+		if ((old == 0) &&
+		    __sync_bool_compare_and_swap(&r->pid, 0, pid)) {
+			return r;
+		}
+	}
+
+	for (i=0; i<ctx->hdr->num_readers; i++) {
+		struct db_shm_reader *r = &ctx->readers[i];
+		uint32_t old = r->pid;
+
+		if (db_shm_pid_dead(old) &&
+		    __sync_bool_compare_and_swap(&r->pid, old, pid)) {
+			r->epoch = 0;
+			__sync_synchronize();
+			return r;
+		}
+	}
+
+	DBG_NOTICE("No free reader slot in %"PRIu32" slots\n",
+		   ctx->hdr->num_readers);
+	return NULL;
+}
+
+static bool db_shm_take_active_lock(int fd)
+{
+	struct flock fl = {
+		.l_type = F_RDLCK,
+		.l_whence = SEEK_SET,
+		.l_start = DB_SHM_ACTIVE_LOCK,
+		.l_len = 1,
+	};
+	int ret;
+
+	do {
+		ret = fcntl(fd, F_SETLKW, &fl);
+	} while ((ret == -1) && (errno == EINTR));
+
+	return (ret == 0);
+}
+
+/*
+ * fcntl locks and the reader slot are not inherited by a forked
+ * child, so take them again for the new pid.
+ */
+static void db_shm_check_fork(struct db_shm_ctx *ctx)
+{
+	pid_t pid = getpid();
+
+	if (pid == ctx->pid) {
+		return;
+	}
+	ctx->pid = pid;
+	ctx->reader = db_shm_reader_register(ctx, pid);
+
+	if (!db_shm_take_active_lock(ctx->fd)) {
+		DBG_WARNING("Could not take active lock: %s\n",
+			    strerror(errno));
+	}
+}
+
+static void db_shm_read_enter(struct db_shm_ctx *ctx)
+{
+	if (ctx->read_depth++ > 0) {
+		return;
+	}
+
+	db_shm_check_fork(ctx);
+
+	if (ctx->reader == NULL) {
+		__sync_fetch_and_add(&ctx->hdr->overflow_readers, 1);
+		return;
+	}
+
+	ctx->reader->epoch = db_shm_load(&ctx->hdr->epoch);
+	__sync_synchronize();
+}
+
+static void db_shm_read_leave(struct db_shm_ctx *ctx)
+{
+	SMB_ASSERT(ctx->read_depth > 0);
+
+	if (--ctx->read_depth > 0) {
+		return;
+	}
+
+	if (ctx->reader == NULL) {
+		__sync_fetch_and_sub(&ctx->hdr->overflow_readers, 1);
+		return;
+	}
+
+	__sync_synchronize();
+	ctx->reader->epoch = 0;
+}
+
+/*
+ * Heap management: Records come from per size class free lists or
+ * are appended at the end of the heap. Free list heads carry a
+ * generation count in the upper 32 bits against ABA.
+ */
+
+static int db_shm_size_class(size_t len)
+{
+	size_t size = DB_SHM_MIN_CLASS_SIZE;
+	int c = 0;
+
+	while (size < len) {
+		size <<= 1;
+		c += 1;
+		if (c == DB_SHM_NUM_CLASSES) {
+			return -1;
+		}
+	}
+	return c;
+}
+
+static void db_shm_push(struct db_shm_ctx *ctx, uint64_t *head,
+			uint64_t unit)
+{
+	struct db_shm_rec *r = db_shm_unit2rec(ctx, unit);
+	uint64_t old, new;
+
+	do {
+		old = db_shm_load(head);
+		r->next = old & UINT32_MAX;
+		new = (((old >> 32) + 1) << 32) | unit;
+	} while (!__sync_bool_compare_and_swap(head, old, new));
+}
+
+static uint64_t db_shm_pop(struct db_shm_ctx *ctx, uint64_t *head)
+{
+	uint64_t old, new, unit;
+
+	do {
+		struct db_shm_rec *r;
+
+		old = db_shm_load(head);
+		unit = old & UINT32_MAX;
+		if (unit == 0) {
+			return 0;
+		}
+		/*
+		 * r->next might be garbage if someone else popped r
+		 * in the meantime, the generation count makes the
+		 * compare and swap fail then.
+		 */
+		r = db_shm_unit2rec(ctx, unit);
+		new = (((old >> 32) + 1) << 32) | (r->next & UINT32_MAX);
+	} while (!__sync_bool_compare_and_swap(head, old, new));
+
+	return unit;
+}
+
+static void db_shm_retire(struct db_shm_ctx *ctx, uint64_t unit)
+{
+	struct db_shm_rec *r = db_shm_unit2rec(ctx, unit);
+	uint64_t *head = &ctx->hdr->retired;
+	uint64_t old;
+
+	r->retire_epoch = __sync_fetch_and_add(&ctx->hdr->epoch, 1);
+
+	/*
+	 * The retired list is only pushed to and taken as a whole,
+	 * so no ABA protection needed.
+	 */
+	do {
+		old = db_shm_load(head);
+		r->next = old;
+	} while (!__sync_bool_compare_and_swap(head, old, unit));
+}
+
+static uint64_t db_shm_min_epoch(struct db_shm_ctx *ctx)
+{
+	uint64_t min_epoch = UINT64_MAX;
+	uint32_t i;
+
+	for (i=0; i<ctx->hdr->num_readers; i++) {
+		struct db_shm_reader *r = &ctx->readers[i];
+		uint32_t pid = r->pid;
+		uint64_t epoch = db_shm_load(&r->epoch);
+
+		if (epoch == 0) {
+			continue;
+		}
+		if (db_shm_pid_dead(pid)) {
+			/*
+			 * Died while reading, release its slot
+			 */
+			if (__sync_bool_compare_and_swap(&r->pid, pid, 0)) {
+				r->epoch = 0;
+				__sync_synchronize();
+			}
+			continue;
+		}
+		min_epoch = MIN(min_epoch, epoch);
+	}
+
+	return min_epoch;
+}
+
+static void db_shm_gc(struct db_shm_ctx *ctx)
+{
+	uint64_t *head = &ctx->hdr->retired;
+	uint64_t unit, keep, keep_tail, old, min_epoch;
+
+	do {
+		unit = db_shm_load(head);
+		if (unit == 0) {
+			return;
+		}
+	} while (!__sync_bool_compare_and_swap(head, unit, 0));
+
+	min_epoch = db_shm_min_epoch(ctx);
+	if (db_shm_load(&ctx->hdr->overflow_readers) != 0) {
+		min_epoch = 0;
+	}
+
+	keep = keep_tail = 0;
+
+	while (unit != 0) {
+		struct db_shm_rec *r = db_shm_unit2rec(ctx, unit);
+		uint64_t next = r->next;
+
+		if (r->retire_epoch < min_epoch) {
+			db_shm_push(ctx, &ctx->hdr->free_lists[r->alloc_class],
+				    unit);
+		} else {
+			r->next = keep;
+			keep = unit;
+			if (keep_tail == 0) {
+				keep_tail = unit;
+			}
+		}
+		unit = next;
+	}
+
+	if (keep == 0) {
+		return;
+	}
+
+	do {
+		old = db_shm_load(head);
+		db_shm_unit2rec(ctx, keep_tail)->next = old;
+	} while (!__sync_bool_compare_and_swap(head, old, keep));
+}
+
+/*
+ * The heap is used up and the free list for class c is empty: Split a
+ * bigger free block and put the unused halves on the lower free lists.
+ * Blocks are never merged again, the stores into a volatile database
+ * tend to have the same few sizes.
+ */
+static uint64_t db_shm_alloc_split(struct db_shm_ctx *ctx, int c)
+{
+	struct db_shm_header *hdr = ctx->hdr;
+	uint64_t unit = 0;
+	int big;
+
+	for (big = c+1; big < DB_SHM_NUM_CLASSES; big++) {
+		unit = db_shm_pop(ctx, &hdr->free_lists[big]);
+		if (unit != 0) {
+			break;
+		}
+	}
+	if (unit == 0) {
+		return 0;
+	}
+
+	while (big > c) {
+		uint64_t half_units;
+		uint64_t buddy;
+
+		big -= 1;
+		half_units = ((uint64_t)DB_SHM_MIN_CLASS_SIZE << big) >> 4;
+		buddy = unit + half_units;
+
+		db_shm_unit2rec(ctx, buddy)->alloc_class = big;
+		db_shm_push(ctx, &hdr->free_lists[big], buddy);
+	}
+
+	return unit;
+}
+
+static uint64_t db_shm_alloc(struct db_shm_ctx *ctx, size_t len)
+{
+	struct db_shm_header *hdr = ctx->hdr;
+	struct db_shm_rec *r;
+	uint64_t unit, ofs, size;
+	int c;
+
+	c = db_shm_size_class(len);
+	if (c == -1) {
+		return 0;
+	}
+	size = (uint64_t)DB_SHM_MIN_CLASS_SIZE << c;
+
+	unit = db_shm_pop(ctx, &hdr->free_lists[c]);
+	if (unit != 0) {
+		goto done;
+	}
+
+	if (db_shm_load(&hdr->heap_used) + size <= hdr->heap_size) {
+		ofs = __sync_fetch_and_add(&hdr->heap_used, size);
+		if (ofs + size <= hdr->heap_size) {
+			unit = ofs >> 4;
+			goto done;
+		}
+	}
+
+	db_shm_gc(ctx);
+
+	unit = db_shm_pop(ctx, &hdr->free_lists[c]);
+	if (unit != 0) {
+		goto done;
+	}
+
+	unit = db_shm_alloc_split(ctx, c);
+	if (unit == 0) {
+		return 0;
+	}
+
+done:
+	r = db_shm_unit2rec(ctx, unit);
+	r->alloc_class = c;
+	return unit;
+}
+
+/*
+ * Per bucket locking
+ */
+
+/*
+ * We sampled seq with the lock bit set and owner from the bucket and
+ * found owner dead. Every unlock increments the counter in seq, so our
+ * compare and swap only succeeds if nobody unlocked since we sampled
+ * seq: owner really died holding the lock. Others might have sampled
+ * the same seq and owner and won the compare and swap before us,
+ * whoever takes over owner gets the lock.
+ */
+static bool db_shm_bucket_take_over(struct db_shm_ctx *ctx, uint32_t home,
+				    uint64_t seq, uint32_t owner)
+{
+	struct db_shm_bucket *b = &ctx->buckets[home];
+	uint64_t new = ((seq & ~DB_SHM_CHANGING) + DB_SHM_SEQ_INC) |
+		DB_SHM_LOCKED;
+
+	if (!__sync_bool_compare_and_swap(&b->seq, seq, new)) {
+		return false;
+	}
+	if (!__sync_bool_compare_and_swap(&b->owner, owner,
+					  (uint32_t)ctx->pid)) {
+		return false;
+	}
+
+	DBG_NOTICE("bucket %"PRIu32": owner %"PRIu32" died\n", home, owner);
+	__sync_synchronize();
+	return true;
+}
+
+static bool db_shm_bucket_lock(struct db_shm_ctx *ctx, uint32_t home,
+			       bool nonblock)
+{
+	struct db_shm_bucket *b = &ctx->buckets[home];
+	unsigned count = 0;
+
+	db_shm_check_fork(ctx);
+
+	while (true) {
+		uint64_t seq = db_shm_load(&b->seq);
+		uint32_t owner;
+
+		if ((seq & DB_SHM_LOCKED) == 0) {
+			if (__sync_bool_compare_and_swap(
+				    &b->seq, seq, seq | DB_SHM_LOCKED)) {
+				break;
+			}
+			continue;
+		}
+
+		owner = b->owner;
+
+		if (owner == (uint32_t)ctx->pid) {
+			DBG_ERR("bucket %"PRIu32" already locked by us\n",
+				home);
+			return false;
+		}
+
+		if (db_shm_pid_dead(owner)) {
+			if (db_shm_bucket_take_over(ctx, home, seq, owner)) {
+				return true;
+			}
+			continue;
+		}
+
+		if (nonblock) {
+			return false;
+		}
+		db_shm_backoff(&count);
+	}
+
+	b->owner = ctx->pid;
+	__sync_synchronize();
+	return true;
+}
+
+static void db_shm_bucket_unlock(struct db_shm_ctx *ctx, uint32_t home)
+{
+	struct db_shm_bucket *b = &ctx->buckets[home];
+
+	b->owner = 0;
+	__sync_fetch_and_add(&b->seq, DB_SHM_SEQ_INC - DB_SHM_LOCKED);
+}
+
+/*
+ * Change a slot word on behalf of a locked home bucket. The seqlock
+ * part of the home bucket's seq lets readers detect this.
+ */
+static bool db_shm_set_slot(struct db_shm_ctx *ctx, uint32_t home,
+			    uint32_t idx, uint64_t old, uint64_t new)
+{
+	struct db_shm_bucket *b = &ctx->buckets[home];
+	bool ok;
+
+	__sync_fetch_and_or(&b->seq, DB_SHM_CHANGING);
+	ok = __sync_bool_compare_and_swap(&ctx->buckets[idx].slot, old, new);
+	__sync_fetch_and_add(&b->seq, DB_SHM_SEQ_INC - DB_SHM_CHANGING);
+
+	if (ok) {
+		__sync_fetch_and_add(&ctx->hdr->seqnum, 1);
+	}
+	return ok;
+}
+
+/*
+ * Walk the probe sequence for key. Must be called inside
+ * db_shm_read_enter(), records we look at might be retired by other
+ * writers.
+ */
+static bool db_shm_find(struct db_shm_ctx *ctx, TDB_DATA key, uint32_t hash,
+			uint32_t *pidx, struct db_shm_rec **prec)
+{
+	uint32_t idx = hash & ctx->mask;
+	uint32_t i;
+
+	for (i=0; i<=ctx->mask; i++) {
+		uint64_t slot = db_shm_load(&ctx->buckets[idx].slot);
+		uint64_t unit = slot & UINT32_MAX;
+
+		if (unit == DB_SHM_UNIT_EMPTY) {
+			break;
+		}
+
+		if ((unit != DB_SHM_UNIT_DELETED) && ((slot >> 32) == hash)) {
+			struct db_shm_rec *r = db_shm_unit2rec(ctx, unit);
+
+			if ((r->keylen == key.dsize) &&
+			    (memcmp(db_shm_rec_key(r), key.dptr,
+				    key.dsize) == 0)) {
+				*pidx = idx;
+				*prec = r;
+				return true;
+			}
+		}
+
+		idx = (idx + 1) & ctx->mask;
+	}
+
+	return false;
+}
+
+/*
+ * Lock-free lookup for readers
+ */
+static struct db_shm_rec *db_shm_lookup(struct db_shm_ctx *ctx,
+					TDB_DATA key, uint32_t hash)
+{
+	struct db_shm_bucket *b = &ctx->buckets[hash & ctx->mask];
+	unsigned count = 0;
+
+	while (true) {
+		struct db_shm_rec *r = NULL;
+		uint64_t seq1, seq2;
+		uint32_t idx;
+
+		seq1 = db_shm_load(&b->seq);
+
+		if (seq1 & DB_SHM_CHANGING) {
+			uint32_t owner = b->owner;
+
+			if (db_shm_pid_dead(owner)) {
+				uint64_t new = (seq1 & ~DB_SHM_CHANGING) +
+					DB_SHM_SEQ_INC;
+				__sync_bool_compare_and_swap(
+					&b->seq, seq1, new);
+			}
+			db_shm_backoff(&count);
+			continue;
+		}
+
+		__sync_synchronize();
+
+		if (db_shm_find(ctx, key, hash, &idx, &r)) {
+			return r;
+		}
+
+		__sync_synchronize();
+		seq2 = db_shm_load(&b->seq);
+
+		if ((seq1 & ~DB_SHM_LOCKED) == (seq2 & ~DB_SHM_LOCKED)) {
+			return NULL;
+		}
+	}
+}
+
+static int db_shm_record_destr(struct db_record *rec)
+{
+	struct db_shm_rec_priv *priv = talloc_get_type_abort(
+		rec->private_data, struct db_shm_rec_priv);
+
+	if (priv->locked) {
+		db_shm_bucket_unlock(priv->ctx, priv->home);
+	}
+	return 0;
+}
+
+/*
+ * Copy key and value into a talloc'ed db_record. The caller holds the
+ * bucket lock and is inside db_shm_read_enter().
+ */
+static struct db_record *db_shm_make_record(struct db_context *db,
+					    TALLOC_CTX *mem_ctx,
+					    TDB_DATA key, uint32_t hash,
+					    uint32_t idx,
+					    struct db_shm_rec *r)
+{
+	struct db_shm_ctx *ctx = talloc_get_type_abort(
+		db->private_data, struct db_shm_ctx);
+	struct db_record *result;
+	struct db_shm_rec_priv *priv;
+	TDB_DATA value = { .dsize = 0 };
+	TDB_DATA rkey;
+
+	if (r != NULL) {
+		db_shm_parse_rec(r, &rkey, &value);
+	}
+
+	result = (struct db_record *)talloc_size(
+		mem_ctx, sizeof(struct db_record) + key.dsize + value.dsize);
+	if (result == NULL) {
+		return NULL;
+	}
+
+	priv = talloc(result, struct db_shm_rec_priv);
+	if (priv == NULL) {
+		TALLOC_FREE(result);
+		return NULL;
+	}
+	*priv = (struct db_shm_rec_priv) {
+		.ctx = ctx,
+		.hash = hash,
+		.home = hash & ctx->mask,
+		.idx = (r != NULL) ? idx : UINT32_MAX,
+	};
+
+	*result = (struct db_record) {
+		.db = db,
+		.storev = db_shm_storev,
+		.delete_rec = db_shm_delete,
+		.private_data = priv,
+	};
+
+	result->key.dsize = key.dsize;
+	result->key.dptr = ((uint8_t *)result) + sizeof(struct db_record);
+	memcpy(result->key.dptr, key.dptr, key.dsize);
+
+	result->value.dsize = value.dsize;
+	if (value.dsize > 0) {
+		result->value.dptr = result->key.dptr + key.dsize;
+		memcpy(result->value.dptr, value.dptr, value.dsize);
+	}
+
+	return result;
+}
+
+static struct db_record *db_shm_fetch_locked_internal(
+	struct db_context *db, TALLOC_CTX *mem_ctx, TDB_DATA key,
+	bool nonblock)
+{
+	struct db_shm_ctx *ctx = talloc_get_type_abort(
+		db->private_data, struct db_shm_ctx);
+	struct db_record *result;
+	struct db_shm_rec_priv *priv;
+	struct db_shm_rec *r = NULL;
+	uint32_t hash = db_shm_hash(key);
+	uint32_t home = hash & ctx->mask;
+	uint32_t idx = UINT32_MAX;
+
+	if (!db_shm_bucket_lock(ctx, home, nonblock)) {
+		DBG_DEBUG("Could not lock bucket %"PRIu32"\n", home);
+		return NULL;
+	}
+
+	db_shm_read_enter(ctx);
+	db_shm_find(ctx, key, hash, &idx, &r);
+	result = db_shm_make_record(db, mem_ctx, key, hash, idx, r);
+	db_shm_read_leave(ctx);
+
+	if (result == NULL) {
+		db_shm_bucket_unlock(ctx, home);
+		return NULL;
+	}
+
+	priv = talloc_get_type_abort(result->private_data,
+				     struct db_shm_rec_priv);
+	priv->locked = true;
+	talloc_set_destructor(result, db_shm_record_destr);
+
+	return result;
+}
+
+static struct db_record *db_shm_fetch_locked(struct db_context *db,
+					     TALLOC_CTX *mem_ctx,
+					     TDB_DATA key)
+{
+	return db_shm_fetch_locked_internal(db, mem_ctx, key, false);
+}
+
+static struct db_record *db_shm_try_fetch_locked(struct db_context *db,
+						 TALLOC_CTX *mem_ctx,
+						 TDB_DATA key)
+{
+	return db_shm_fetch_locked_internal(db, mem_ctx, key, true);
+}
+
+static NTSTATUS db_shm_storev(struct db_record *rec,
+			      const TDB_DATA *dbufs, int num_dbufs, int flag)
+{
+	struct db_shm_rec_priv *priv = talloc_get_type_abort(
+		rec->private_data, struct db_shm_rec_priv);
+	struct db_shm_ctx *ctx = priv->ctx;
+	struct db_shm_rec *r;
+	uint64_t unit, slot, old;
+	uint32_t idx, i;
+	size_t len, vallen;
+	uint8_t *p;
+	int j;
+
+	if (!priv->locked) {
+		return NT_STATUS_MEDIA_WRITE_PROTECTED;
+	}
+
+	if ((flag == TDB_INSERT) && (priv->idx != UINT32_MAX)) {
+		return NT_STATUS_OBJECT_NAME_COLLISION;
+	}
+	if ((flag == TDB_MODIFY) && (priv->idx == UINT32_MAX)) {
+		return NT_STATUS_NOT_FOUND;
+	}
+
+	vallen = 0;
+	for (j=0; j<num_dbufs; j++) {
+		vallen += dbufs[j].dsize;
+		if (vallen < dbufs[j].dsize) {
+			return NT_STATUS_INSUFFICIENT_RESOURCES;
+		}
+	}
+
+	len = sizeof(struct db_shm_rec) + rec->key.dsize + vallen;
+	if ((len < vallen) || (vallen > UINT32_MAX) ||
+	    (rec->key.dsize > UINT32_MAX)) {
+		return NT_STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	unit = db_shm_alloc(ctx, len);
+	if (unit == 0) {
+		DBG_WARNING("heap full\n");
+		return NT_STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	r = db_shm_unit2rec(ctx, unit);
+	r->hash = priv->hash;
+	r->keylen = rec->key.dsize;
+	r->vallen = vallen;
+
+	p = db_shm_rec_key(r);
+	memcpy(p, rec->key.dptr, rec->key.dsize);
+	p += rec->key.dsize;
+	for (j=0; j<num_dbufs; j++) {
+		if (dbufs[j].dsize == 0) {
+			continue;
+		}
+		memcpy(p, dbufs[j].dptr, dbufs[j].dsize);
+		p += dbufs[j].dsize;
+	}
+
+	slot = ((uint64_t)priv->hash << 32) | unit;
+
+	if (priv->idx != UINT32_MAX) {
+		/*
+		 * Only holders of our home bucket lock touch a live
+		 * slot of ours.
+		 */
+		old = db_shm_load(&ctx->buckets[priv->idx].slot);
+		if (!db_shm_set_slot(ctx, priv->home, priv->idx, old, slot)) {
+			smb_panic("dbwrap_shm: slot changed under lock");
+		}
+		db_shm_retire(ctx, old & UINT32_MAX);
+		return NT_STATUS_OK;
+	}
+
+	/*
+	 * New key: Take the first empty or deleted slot. Writers from
+	 * other home buckets compete for those, thus the compare and
+	 * swap.
+	 */
+	idx = priv->home;
+	for (i=0; i<=ctx->mask; i++) {
+		old = db_shm_load(&ctx->buckets[idx].slot);
+
+		if (((old & UINT32_MAX) == DB_SHM_UNIT_EMPTY) ||
+		    ((old & UINT32_MAX) == DB_SHM_UNIT_DELETED)) {
+			if (db_shm_set_slot(ctx, priv->home, idx, old, slot)) {
+				priv->idx = idx;
+				return NT_STATUS_OK;
+			}
+			continue;
+		}
+		idx = (idx + 1) & ctx->mask;
+	}
+
+	db_shm_push(ctx, &ctx->hdr->free_lists[r->alloc_class], unit);
+	DBG_WARNING("no free bucket\n");
+	return NT_STATUS_INSUFFICIENT_RESOURCES;
+}
+
+static NTSTATUS db_shm_delete(struct db_record *rec)
+{
+	struct db_shm_rec_priv *priv = talloc_get_type_abort(
+		rec->private_data, struct db_shm_rec_priv);
+	struct db_shm_ctx *ctx = priv->ctx;
+	uint64_t old;
+
+	if (!priv->locked) {
+		return NT_STATUS_MEDIA_WRITE_PROTECTED;
+	}
+
+	if (priv->idx == UINT32_MAX) {
+		return NT_STATUS_OK;
+	}
+
+	old = db_shm_load(&ctx->buckets[priv->idx].slot);
+	if (!db_shm_set_slot(ctx, priv->home, priv->idx, old,
+			     DB_SHM_UNIT_DELETED)) {
+		smb_panic("dbwrap_shm: slot changed under lock");
+	}
+	db_shm_retire(ctx, old & UINT32_MAX);
+	priv->idx = UINT32_MAX;
+
+	return NT_STATUS_OK;
+}
+
+static NTSTATUS db_shm_parse_record(struct db_context *db, TDB_DATA key,
+				    void (*parser)(TDB_DATA key, TDB_DATA data,
+						   void *private_data),
+				    void *private_data)
+{
+	struct db_shm_ctx *ctx = talloc_get_type_abort(
+		db->private_data, struct db_shm_ctx);
+	struct db_shm_rec *r;
+	TDB_DATA rkey, value;
+
+	db_shm_read_enter(ctx);
+
+	r = db_shm_lookup(ctx, key, db_shm_hash(key));
+	if (r == NULL) {
+		db_shm_read_leave(ctx);
+		return NT_STATUS_NOT_FOUND;
+	}
+
+	db_shm_parse_rec(r, &rkey, &value);
+	parser(rkey, value, private_data);
+
+	db_shm_read_leave(ctx);
+	return NT_STATUS_OK;
+}
+
+static int db_shm_exists(struct db_context *db, TDB_DATA key)
+{
+	struct db_shm_ctx *ctx = talloc_get_type_abort(
+		db->private_data, struct db_shm_ctx);
+	struct db_shm_rec *r;
+
+	db_shm_read_enter(ctx);
+	r = db_shm_lookup(ctx, key, db_shm_hash(key));
+	db_shm_read_leave(ctx);
+
+	return (r != NULL);
+}
+
+static NTSTATUS db_shm_storev_ro(struct db_record *rec,
+				 const TDB_DATA *dbufs, int num_dbufs,
+				 int flag)
+{
+	return NT_STATUS_MEDIA_WRITE_PROTECTED;
+}
+
+static NTSTATUS db_shm_delete_ro(struct db_record *rec)
+{
+	return NT_STATUS_MEDIA_WRITE_PROTECTED;
+}
+
+static int db_shm_traverse_read(struct db_context *db,
+				int (*f)(struct db_record *rec,
+					 void *private_data),
+				void *private_data)
+{
+	struct db_shm_ctx *ctx = talloc_get_type_abort(
+		db->private_data, struct db_shm_ctx);
+	uint32_t i, count = 0;
+	int ret = 0;
+
+	ctx->traverse_read++;
+	db_shm_read_enter(ctx);
+
+	for (i=0; i<=ctx->mask; i++) {
+		uint64_t slot = db_shm_load(&ctx->buckets[i].slot);
+		uint64_t unit = slot & UINT32_MAX;
+		struct db_record rec;
+
+		if ((unit == DB_SHM_UNIT_EMPTY) ||
+		    (unit == DB_SHM_UNIT_DELETED)) {
+			continue;
+		}
+
+		rec = (struct db_record) {
+			.db = db,
+			.storev = db_shm_storev_ro,
+			.delete_rec = db_shm_delete_ro,
+		};
+		db_shm_parse_rec(db_shm_unit2rec(ctx, unit),
+				 &rec.key, &rec.value);
+
+		ret = f(&rec, private_data);
+		count += 1;
+		if (ret != 0) {
+			break;
+		}
+	}
+
+	db_shm_read_leave(ctx);
+	ctx->traverse_read--;
+
+	if (ret != 0) {
+		return -1;
+	}
+	if (count > INT_MAX) {
+		return -1;
+	}
+	return count;
+}
+
+static int db_shm_traverse(struct db_context *db,
+			   int (*f)(struct db_record *rec,
+				    void *private_data),
+			   void *private_data)
+{
+	struct db_shm_ctx *ctx = talloc_get_type_abort(
+		db->private_data, struct db_shm_ctx);
+	uint32_t i, count = 0;
+	int ret = 0;
+
+	if (ctx->traverse_read > 0) {
+		return db_shm_traverse_read(db, f, private_data);
+	}
+
+	for (i=0; i<=ctx->mask; i++) {
+		uint64_t slot = db_shm_load(&ctx->buckets[i].slot);
+		uint64_t unit = slot & UINT32_MAX;
+		uint32_t hash = slot >> 32;
+		uint32_t home = hash & ctx->mask;
+		struct db_shm_rec_priv *priv;
+		struct db_shm_rec *r;
+		struct db_record *rec;
+		TALLOC_CTX *frame;
+		TDB_DATA key, value;
+
+		if ((unit == DB_SHM_UNIT_EMPTY) ||
+		    (unit == DB_SHM_UNIT_DELETED)) {
+			continue;
+		}
+
+		if (!db_shm_bucket_lock(ctx, home, false)) {
+			return -1;
+		}
+
+		/*
+		 * Re-read under the lock, the record might have been
+		 * replaced or deleted meanwhile.
+		 */
+		db_shm_read_enter(ctx);
+		slot = db_shm_load(&ctx->buckets[i].slot);
+		unit = slot & UINT32_MAX;
+
+		if ((unit == DB_SHM_UNIT_EMPTY) ||
+		    (unit == DB_SHM_UNIT_DELETED) ||
+		    ((slot >> 32) != hash)) {
+			db_shm_read_leave(ctx);
+			db_shm_bucket_unlock(ctx, home);
+			continue;
+		}
+
+		frame = talloc_stackframe();
+
+		r = db_shm_unit2rec(ctx, unit);
+		db_shm_parse_rec(r, &key, &value);
+		rec = db_shm_make_record(db, frame, key, hash, i, r);
+		db_shm_read_leave(ctx);
+
+		if (rec == NULL) {
+			TALLOC_FREE(frame);
+			db_shm_bucket_unlock(ctx, home);
+			return -1;
+		}
+
+		/*
+		 * No destructor, we unlock ourselves below
+		 */
+		priv = talloc_get_type_abort(rec->private_data,
+					     struct db_shm_rec_priv);
+		priv->locked = true;
+
+		ret = f(rec, private_data);
+		count += 1;
+
+		TALLOC_FREE(frame);
+		db_shm_bucket_unlock(ctx, home);
+
+		if (ret != 0) {
+			return -1;
+		}
+	}
+
+	if (count > INT_MAX) {
+		return -1;
+	}
+	return count;
+}
+
+static int db_shm_wipe_fn(struct db_record *rec, void *private_data)
+{
+	NTSTATUS status = db_shm_delete(rec);
+	return NT_STATUS_IS_OK(status) ? 0 : -1;
+}
+
+static int db_shm_wipe(struct db_context *db)
+{
+	int ret = db_shm_traverse(db, db_shm_wipe_fn, NULL);
+	return (ret < 0) ? -1 : 0;
+}
+
+static int db_shm_get_seqnum(struct db_context *db)
+{
+	struct db_shm_ctx *ctx = talloc_get_type_abort(
+		db->private_data, struct db_shm_ctx);
+	return (int)db_shm_load(&ctx->hdr->seqnum);
+}
+
+static int db_shm_trans_fail(struct db_context *db)
+{
+	/*
+	 * Only volatile databases live here, dbwrap_transaction_start()
+	 * already refuses those.
+	 */
+	return -1;
+}
+
+static size_t db_shm_id(struct db_context *db, uint8_t *id, size_t idlen)
+{
+	struct db_shm_ctx *ctx = talloc_get_type_abort(
+		db->private_data, struct db_shm_ctx);
+
+	if (idlen >= sizeof(ctx->id)) {
+		memcpy(id, &ctx->id, sizeof(ctx->id));
+	}
+
+	return sizeof(ctx->id);
+}
+
+static int db_shm_ctx_destructor(struct db_shm_ctx *ctx)
+{
+	if ((ctx->reader != NULL) && (ctx->pid == getpid())) {
+		ctx->reader->epoch = 0;
+		__sync_synchronize();
+		__sync_bool_compare_and_swap(&ctx->reader->pid, ctx->pid, 0);
+	}
+	if (ctx->map != NULL) {
+		munmap(ctx->map, ctx->map_size);
+	}
+	if (ctx->fd != -1) {
+		close(ctx->fd);
+	}
+	return 0;
+}
+
+static size_t db_shm_readers_ofs(void)
+{
+	return DB_SHM_ALIGN64(sizeof(struct db_shm_header));
+}
+
+static size_t db_shm_buckets_ofs(uint32_t num_readers)
+{
+	return db_shm_readers_ofs() +
+		DB_SHM_ALIGN64((size_t)num_readers *
+			       sizeof(struct db_shm_reader));
+}
+
+static size_t db_shm_heap_ofs(uint32_t num_readers, uint32_t num_buckets)
+{
+	return db_shm_buckets_ofs(num_readers) +
+		DB_SHM_ALIGN64((size_t)num_buckets *
+			       sizeof(struct db_shm_bucket));
+}
+
+static int db_shm_fcntl_lock(int fd, int type, off_t ofs, bool wait)
+{
+	struct flock fl = {
+		.l_type = type,
+		.l_whence = SEEK_SET,
+		.l_start = ofs,
+		.l_len = 1,
+	};
+	int ret;
+
+	do {
+		ret = fcntl(fd, wait ? F_SETLKW : F_SETLK, &fl);
+	} while ((ret == -1) && (errno == EINTR));
+
+	return ret;
+}
+
+/*
+ * Called with the OPEN lock held. If nobody else has the file open,
+ * throw away the old contents.
+ */
+static bool db_shm_init_file(int fd, uint32_t num_buckets,
+			     uint32_t num_readers, uint64_t heap_size)
+{
+	struct db_shm_header hdr = {
+		.magic = DB_SHM_MAGIC,
+		.version = DB_SHM_VERSION,
+		.num_buckets = num_buckets,
+		.num_readers = num_readers,
+		.heap_size = heap_size,
+		/*
+		 * Units 0 and 1 mean empty and deleted
+		 */
+		.heap_used = DB_SHM_MIN_CLASS_SIZE,
+		.epoch = 1,
+	};
+	size_t size;
+	ssize_t written;
+	int ret;
+
+	ret = db_shm_fcntl_lock(fd, F_WRLCK, DB_SHM_ACTIVE_LOCK, false);
+	if (ret == -1) {
+		/*
+		 * Someone else is using it
+		 */
+		return true;
+	}
+
+	size = db_shm_heap_ofs(num_readers, num_buckets) + heap_size;
+
+	ret = ftruncate(fd, 0);
+	if (ret == -1) {
+		DBG_WARNING("ftruncate failed: %s\n", strerror(errno));
+		return false;
+	}
+	ret = ftruncate(fd, size);
+	if (ret == -1) {
+		DBG_WARNING("ftruncate failed: %s\n", strerror(errno));
+		return false;
+	}
+
+	written = pwrite(fd, &hdr, sizeof(hdr), 0);
+	if (written != sizeof(hdr)) {
+		DBG_WARNING("pwrite failed: %s\n", strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+struct db_context *db_open_shm(TALLOC_CTX *mem_ctx,
+			       const char *name,
+			       uint32_t num_buckets,
+			       uint32_t num_readers,
+			       uint64_t heap_size,
+			       int open_flags, mode_t mode,
+			       enum dbwrap_lock_order lock_order,
+			       uint64_t dbwrap_flags)
+{
+	struct db_context *result = NULL;
+	struct db_shm_ctx *ctx;
+	struct db_shm_header hdr;
+	struct stat st;
+	ssize_t nread;
+	uint32_t n;
+	bool ok;
+	int ret;
+
+	if ((num_buckets == 0) || (num_buckets > (UINT32_C(1) << 31)) ||
+	    (heap_size > (UINT64_C(1) << 36))) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	n = 1;
+	while (n < num_buckets) {
+		n <<= 1;
+	}
+	num_buckets = n;
+
+	result = talloc_zero(mem_ctx, struct db_context);
+	if (result == NULL) {
+		DEBUG(0, ("talloc failed\n"));
+		goto fail;
+	}
+
+	result->private_data = ctx = talloc_zero(result, struct db_shm_ctx);
+	if (ctx == NULL) {
+		DEBUG(0, ("talloc failed\n"));
+		goto fail;
+	}
+	ctx->fd = -1;
+	talloc_set_destructor(ctx, db_shm_ctx_destructor);
+
+	result->lock_order = lock_order;
+
+	ctx->fd = open(name, open_flags, mode);
+	if (ctx->fd == -1) {
+		DEBUG(3, ("Could not open %s: %s\n", name, strerror(errno)));
+		goto fail;
+	}
+	set_close_on_exec(ctx->fd);
+
+	ret = db_shm_fcntl_lock(ctx->fd, F_WRLCK, DB_SHM_OPEN_LOCK, true);
+	if (ret == -1) {
+		DBG_WARNING("Could not take open lock: %s\n",
+			    strerror(errno));
+		goto fail;
+	}
+
+	ok = db_shm_init_file(ctx->fd, num_buckets, num_readers, heap_size);
+	if (ok) {
+		/*
+		 * Downgrades our write lock if we initialized
+		 */
+		ok = db_shm_take_active_lock(ctx->fd);
+	}
+
+	db_shm_fcntl_lock(ctx->fd, F_UNLCK, DB_SHM_OPEN_LOCK, false);
+
+	if (!ok) {
+		goto fail;
+	}
+
+	nread = pread(ctx->fd, &hdr, sizeof(hdr), 0);
+	if (nread != sizeof(hdr)) {
+		DBG_WARNING("Could not read header of %s\n", name);
+		errno = EIO;
+		goto fail;
+	}
+	if ((hdr.magic != DB_SHM_MAGIC) || (hdr.version != DB_SHM_VERSION)) {
+		DBG_WARNING("%s: invalid header\n", name);
+		errno = EINVAL;
+		goto fail;
+	}
+
+	if (fstat(ctx->fd, &st) == -1) {
+		DEBUG(3, ("fstat failed: %s\n", strerror(errno)));
+		goto fail;
+	}
+	ctx->id.dev = st.st_dev;
+	ctx->id.ino = st.st_ino;
+
+	ctx->map_size = db_shm_heap_ofs(hdr.num_readers, hdr.num_buckets) +
+		hdr.heap_size;
+	if ((off_t)ctx->map_size > st.st_size) {
+		DBG_WARNING("%s: file too small\n", name);
+		errno = EINVAL;
+		goto fail;
+	}
+
+	ctx->map = mmap(NULL, ctx->map_size, PROT_READ|PROT_WRITE,
+			MAP_SHARED|MAP_FILE, ctx->fd, 0);
+	if (ctx->map == MAP_FAILED) {
+		ctx->map = NULL;
+		DBG_WARNING("mmap failed: %s\n", strerror(errno));
+		goto fail;
+	}
+
+	ctx->hdr = (struct db_shm_header *)ctx->map;
+	ctx->readers = (struct db_shm_reader *)
+		(ctx->map + db_shm_readers_ofs());
+	ctx->buckets = (struct db_shm_bucket *)
+		(ctx->map + db_shm_buckets_ofs(hdr.num_readers));
+	ctx->heap = ctx->map + db_shm_heap_ofs(hdr.num_readers,
+					       hdr.num_buckets);
+	ctx->mask = hdr.num_buckets - 1;
+
+	ctx->pid = getpid();
+	ctx->reader = db_shm_reader_register(ctx, ctx->pid);
+
+	result->name = talloc_strdup(result, name);
+	if (result->name == NULL) {
+		DEBUG(0, ("talloc failed\n"));
+		goto fail;
+	}
+
+	result->fetch_locked = db_shm_fetch_locked;
+	result->try_fetch_locked = db_shm_try_fetch_locked;
+	result->traverse = db_shm_traverse;
+	result->traverse_read = db_shm_traverse_read;
+	result->parse_record = db_shm_parse_record;
+	result->get_seqnum = db_shm_get_seqnum;
+	result->persistent = false;
+	result->transaction_start = db_shm_trans_fail;
+	result->transaction_commit = db_shm_trans_fail;
+	result->transaction_cancel = db_shm_trans_fail;
+	result->exists = db_shm_exists;
+	result->wipe = db_shm_wipe;
+	result->id = db_shm_id;
+	return result;
+
+ fail:
+	TALLOC_FREE(result);
+	return NULL;
+}
@@ -0,0 +1,42 @@
+/*
+   Unix SMB/CIFS implementation.
+   Database interface wrapper around a shared memory hash table
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __DBWRAP_SHM_H__
+#define __DBWRAP_SHM_H__
+
+#include <talloc.h>
+#include "dbwrap/dbwrap.h"
+
+struct db_context;
+
+/*
+ * Open a volatile database in a shared memory file. The contents are
+ * wiped when the first process opens the file, like
+ * TDB_CLEAR_IF_FIRST. num_buckets is rounded up to a power of two,
+ * heap_size is the space available for records.
+ */
+struct db_context *db_open_shm(TALLOC_CTX *mem_ctx,
+			       const char *name,
+			       uint32_t num_buckets,
+			       uint32_t num_readers,
+			       uint64_t heap_size,
+			       int open_flags, mode_t mode,
+			       enum dbwrap_lock_order lock_order,
+			       uint64_t dbwrap_flags);
+
+#endif /* __DBWRAP_SHM_H__ */
@@ -400,6 +400,35 @@ static int db_tdb_traverse_read(struct db_context *db,
 	return tdb_traverse_read(db_ctx->wtdb->tdb, db_tdb_traverse_read_func, &ctx);
 }
 
+static uint32_t db_tdb_traverse_num_chunks(struct db_context *db)
+{
+	struct db_tdb_ctx *db_ctx =
+		talloc_get_type_abort(db->private_data, struct db_tdb_ctx);
+
+	return tdb_hash_size(db_ctx->wtdb->tdb);
+}
+
+static int db_tdb_traverse_read_chunk(struct db_context *db,
+				      uint32_t *chunk, uint32_t num_chunks,
+				      int (*f)(struct db_record *rec,
+					       void *private_data),
+				      void *private_data)
+{
+	struct db_tdb_ctx *db_ctx =
+		talloc_get_type_abort(db->private_data, struct db_tdb_ctx);
+	struct db_tdb_traverse_ctx ctx;
+	unsigned chain = *chunk;
+	int ret;
+
+	ctx.db = db;
+	ctx.f = f;
+	ctx.private_data = private_data;
+	ret = tdb_traverse_read_chunk(db_ctx->wtdb->tdb, &chain, num_chunks,
+				      db_tdb_traverse_read_func, &ctx);
+	*chunk = chain;
+	return ret;
+}
+
 static int db_tdb_get_seqnum(struct db_context *db)
 
 {
@@ -500,6 +529,8 @@ struct db_context *db_open_tdb(TALLOC_CTX *mem_ctx,
 	result->do_locked = db_tdb_do_locked;
 	result->traverse = db_tdb_traverse;
 	result->traverse_read = db_tdb_traverse_read;
+	result->traverse_num_chunks = db_tdb_traverse_num_chunks;
+	result->traverse_read_chunk = db_tdb_traverse_read_chunk;
 	result->parse_record = db_tdb_parse;
 	result->get_seqnum = db_tdb_get_seqnum;
 	result->persistent = ((tdb_flags & TDB_CLEAR_IF_FIRST) == 0);
@@ -233,6 +233,7 @@ int ldb_unpack_data_only_attr_list_flags(struct ldb_context *ldb,
 	unsigned int nelem = 0;
 	size_t len;
 	unsigned int found = 0;
+	bool partial = false;
 	struct ldb_val *ldb_val_single_array = NULL;
 
 	if (list == NULL) {
@@ -347,6 +348,16 @@ int ldb_unpack_data_only_attr_list_flags(struct ldb_context *ldb,
 		size_t attr_len;
 		struct ldb_message_element *element = NULL;
 
+		if (list_size != 0 && found == list_size) {
+			/*
+			 * We have every attribute that was asked for,
+			 * there is no point walking over the rest of
+			 * the record, which (for big objects) is most
+			 * of it.
+			 */
+			break;
+		}
+
 		if (remaining < 10) {
 			errno = EIO;
 			goto failed;
@@ -477,6 +488,9 @@ int ldb_unpack_data_only_attr_list_flags(struct ldb_context *ldb,
 		}
 		nelem++;
 	}
+	/* did we stop early, once all of list was found? */
+	partial = (i < message->num_elements);
+
 	/*
 	 * Adapt the number of elements to the real number of unpacked elements,
 	 * it means that we overallocated elements array.
@@ -491,7 +505,7 @@ int ldb_unpack_data_only_attr_list_flags(struct ldb_context *ldb,
 					   struct ldb_message_element,
 					   message->num_elements);
 
-	if (remaining != 0) {
+	if (remaining != 0 && !partial) {
 		ldb_debug(ldb, LDB_DEBUG_ERROR,
 			  "Error: %zu bytes unread in ldb_unpack_data_only_attr_list",
 			  remaining);
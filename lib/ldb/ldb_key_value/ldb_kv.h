@@ -64,6 +64,13 @@ struct ldb_kv_private {
 		bool attribute_indexes;
 		const char *GUID_index_attribute;
 		const char *GUID_index_dn_component;
+		/*
+		 * Observed index list sizes per attribute, used by
+		 * ldb_kv_index_dn_and() to order its terms.  These are
+		 * only hints, kept in memory and dropped with the cache.
+		 */
+		struct ldb_kv_index_stat *index_stats;
+		unsigned int num_index_stats;
 	} *cache;
 
 
@@ -116,6 +123,19 @@ struct ldb_kv_context {
 	const char * const *attrs;
 	struct tevent_timer *timeout_event;
 
+	/*
+	 * The attributes to decode from each candidate record, NULL
+	 * to decode all of them.  With unpack_match_only set the list
+	 * only covers the filter and a matching record is decoded
+	 * again in full before it is returned.
+	 */
+	const char **unpack_attrs;
+	unsigned int num_unpack_attrs;
+	bool unpack_match_only;
+
+	/* records looked at, to check the time limit every so often */
+	unsigned int num_records_walked;
+
 	/* error handling */
 	int error;
 };
@@ -222,6 +242,19 @@ int ldb_kv_search_key(struct ldb_module *module,
 		      const struct ldb_val ldb_key,
 		      struct ldb_message *msg,
 		      unsigned int unpack_flags);
+int ldb_kv_search_key_attrs(struct ldb_module *module,
+			    struct ldb_kv_private *ldb_kv,
+			    const struct ldb_val ldb_key,
+			    struct ldb_message *msg,
+			    unsigned int unpack_flags,
+			    const char * const *attrs,
+			    unsigned int num_attrs,
+			    struct ldb_val *packed);
+int ldb_kv_unpack_matched(struct ldb_kv_context *ac,
+			  const struct ldb_val *packed,
+			  struct ldb_message *msg,
+			  unsigned int unpack_flags);
+bool ldb_kv_search_time_exceeded(struct ldb_kv_context *ac);
 int ldb_kv_filter_attrs(TALLOC_CTX *mem_ctx,
 			const struct ldb_message *msg,
 			const char *const *attrs,
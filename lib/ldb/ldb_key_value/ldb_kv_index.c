@@ -164,6 +164,13 @@ struct dn_list {
 struct ldb_kv_idxptr {
 	struct tdb_context *itdb;
 	int error;
+	/* hash size of itdb, 0 for the default */
+	unsigned int itdb_hash_size;
+	/*
+	 * Set while ldb_kv_reindex() adds all records: GUID lists
+	 * are not kept sorted but sorted once at the end
+	 */
+	bool reindex;
 };
 
 enum key_truncation {
@@ -718,8 +725,13 @@ static int ldb_kv_dn_list_store(struct ldb_module *module,
 	}
 
 	if (ldb_kv->idxptr->itdb == NULL) {
+		unsigned int hash_size = ldb_kv->idxptr->itdb_hash_size;
+
+		if (hash_size == 0) {
+			hash_size = 1000;
+		}
 		ldb_kv->idxptr->itdb =
-		    tdb_open(NULL, 1000, TDB_INTERNAL, O_RDWR, 0);
+		    tdb_open(NULL, hash_size, TDB_INTERNAL, O_RDWR, 0);
 		if (ldb_kv->idxptr->itdb == NULL) {
 			return LDB_ERR_OPERATIONS_ERROR;
 		}
@@ -1099,6 +1111,131 @@ static bool ldb_kv_is_indexed(struct ldb_module *module,
                                we'll need a full search
  */
 
+/*
+  running totals of the index list sizes loaded for one attribute
+ */
+struct ldb_kv_index_stat {
+	const char *attr;
+	uint64_t loads;
+	uint64_t entries;
+};
+
+/* don't track more attributes than this */
+#define LDB_KV_INDEX_STATS_MAX 128
+
+/* estimated size of an index list there is no information about */
+#define LDB_KV_INDEX_COST_UNKNOWN UINT_MAX
+
+/*
+ * once an AND has been narrowed down to this many candidates, terms
+ * expected to be much larger are not worth loading, the candidates
+ * are checked against the full filter anyway
+ */
+#define LDB_KV_INDEX_AND_SMALL_LIST 16
+#define LDB_KV_INDEX_AND_SKIP_FACTOR 8
+
+static struct ldb_kv_index_stat *ldb_kv_index_stat_find(
+	struct ldb_kv_private *ldb_kv,
+	const char *attr)
+{
+	unsigned int i;
+
+	for (i = 0; i < ldb_kv->cache->num_index_stats; i++) {
+		struct ldb_kv_index_stat *stat =
+			&ldb_kv->cache->index_stats[i];
+		if (ldb_attr_cmp(stat->attr, attr) == 0) {
+			return stat;
+		}
+	}
+	return NULL;
+}
+
+/*
+  remember the size of an index list loaded for attr
+ */
+static void ldb_kv_index_stat_record(struct ldb_kv_private *ldb_kv,
+				     const char *attr,
+				     unsigned int count)
+{
+	struct ldb_kv_cache *cache = ldb_kv->cache;
+	struct ldb_kv_index_stat *stat = NULL;
+	struct ldb_kv_index_stat *stats = NULL;
+	const char *name = NULL;
+
+	stat = ldb_kv_index_stat_find(ldb_kv, attr);
+	if (stat == NULL) {
+		if (cache->num_index_stats >= LDB_KV_INDEX_STATS_MAX) {
+			return;
+		}
+		/*
+		 * These are only hints, so on allocation failure
+		 * we simply don't record anything.
+		 */
+		stats = talloc_realloc(cache,
+				       cache->index_stats,
+				       struct ldb_kv_index_stat,
+				       cache->num_index_stats + 1);
+		if (stats == NULL) {
+			return;
+		}
+		cache->index_stats = stats;
+		name = talloc_strdup(stats, attr);
+		if (name == NULL) {
+			return;
+		}
+		stat = &stats[cache->num_index_stats];
+		*stat = (struct ldb_kv_index_stat) { .attr = name };
+		cache->num_index_stats++;
+	}
+
+	stat->loads++;
+	stat->entries += count;
+}
+
+/*
+  estimate how many entries the index will return for a subtree of an
+  AND, without loading anything
+ */
+static unsigned int ldb_kv_index_estimate(struct ldb_kv_private *ldb_kv,
+					  const struct ldb_parse_tree *tree)
+{
+	struct ldb_kv_index_stat *stat = NULL;
+	const char *attr = NULL;
+	uint64_t estimate;
+
+	if (tree->operation != LDB_OP_EQUALITY) {
+		/*
+		 * Ranges, substrings, presence and nested
+		 * expressions either need several index records or
+		 * no index at all, try the simple terms first.
+		 */
+		return LDB_KV_INDEX_COST_UNKNOWN;
+	}
+
+	attr = tree->u.equality.attr;
+
+	if (ldb_attr_dn(attr) == 0) {
+		return 1;
+	}
+	if (ldb_kv->cache->GUID_index_attribute != NULL &&
+	    ldb_attr_cmp(attr, ldb_kv->cache->GUID_index_attribute) == 0) {
+		return 1;
+	}
+
+	stat = ldb_kv_index_stat_find(ldb_kv, attr);
+	if (stat == NULL || stat->loads == 0) {
+		/*
+		 * Sort unknown equality terms just before the
+		 * compound ones.
+		 */
+		return LDB_KV_INDEX_COST_UNKNOWN - 1;
+	}
+
+	/* round up, so a seen but empty index still beats unknown */
+	estimate = (stat->entries + stat->loads - 1) / stat->loads;
+	return MIN(estimate, LDB_KV_INDEX_COST_UNKNOWN - 2);
+}
+
 /*
   return a list of dn's that might match a simple indexed search (an
   equality search only)
@@ -1141,6 +1278,10 @@ static int ldb_kv_index_dn_simple(struct ldb_module *module,
 
 	ret = ldb_kv_dn_list_load(module, ldb_kv, dn, list);
 	talloc_free(dn);
+	if (ret == LDB_SUCCESS || ret == LDB_ERR_NO_SUCH_OBJECT) {
+		ldb_kv_index_stat_record(
+		    ldb_kv, tree->u.equality.attr, list->count);
+	}
 	return ret;
 }
 
@@ -1235,6 +1376,46 @@ static int ldb_kv_index_dn_leaf(struct ldb_module *module,
 }
 
 
+/*
+  find the first entry at or after start in a sorted GUID dn_list
+  that does not sort before v. The position is found by galloping
+  forward from start and then doing a binary search in the last step,
+  so walking a long list with the values of a short list costs about
+  short * log(long / short) comparisons instead of short * log(long).
+ */
+static unsigned int ldb_kv_dn_list_gallop(const struct dn_list *list,
+					  unsigned int start,
+					  const struct ldb_val *v)
+{
+	unsigned int lo = start;
+	unsigned int hi = start;
+	unsigned int step = 1;
+
+	while (hi < list->count &&
+	       ldb_val_equal_exact_ordered(list->dn[hi], v) < 0) {
+		lo = hi + 1;
+		if (list->count - hi <= step) {
+			hi = list->count;
+			break;
+		}
+		hi += step;
+		step *= 2;
+	}
+
+	/* now all of [start, lo) sort before v, and hi does not */
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if (ldb_val_equal_exact_ordered(list->dn[mid], v) < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
 /*
   list intersection
   list = list & list2
@@ -1306,12 +1487,34 @@ static bool list_intersect(struct ldb_context *ldb,
 	}
 	list3->count = 0;
 
-	for (i=0;i<short_list->count;i++) {
-		/* For the GUID index case, this is a binary search */
-		if (ldb_kv_dn_list_find_val(
-			ldb_kv, long_list, &short_list->dn[i]) != -1) {
-			list3->dn[list3->count] = short_list->dn[i];
-			list3->count++;
+	if (ldb_kv->cache->GUID_index_attribute != NULL) {
+		/*
+		 * Both lists are sorted in the GUID index case, so we
+		 * never need to look behind the last match again.
+		 */
+		unsigned int j = 0;
+
+		for (i=0; i<short_list->count && j<long_list->count; i++) {
+			const struct ldb_val *v = &short_list->dn[i];
+
+			j = ldb_kv_dn_list_gallop(long_list, j, v);
+			if (j == long_list->count) {
+				break;
+			}
+			if (ldb_val_equal_exact_ordered(
+				    long_list->dn[j], v) == 0) {
+				list3->dn[list3->count] = *v;
+				list3->count++;
+				j++;
+			}
+		}
+	} else {
+		for (i=0;i<short_list->count;i++) {
+			if (ldb_kv_dn_list_find_val(
+				ldb_kv, long_list, &short_list->dn[i]) != -1) {
+				list3->dn[list3->count] = short_list->dn[i];
+				list3->count++;
+			}
 		}
 	}
 
@@ -1509,6 +1712,25 @@ static bool ldb_kv_index_unique(struct ldb_context *ldb,
 	return false;
 }
 
+struct ldb_kv_index_and_term {
+	const struct ldb_parse_tree *tree;
+	unsigned int estimate;
+	unsigned int pos;
+};
+
+static int ldb_kv_index_and_term_cmp(const struct ldb_kv_index_and_term *t1,
+				     const struct ldb_kv_index_and_term *t2)
+{
+	if (t1->estimate != t2->estimate) {
+		return t1->estimate < t2->estimate ? -1 : 1;
+	}
+	/* keep the filter order for equal estimates */
+	if (t1->pos != t2->pos) {
+		return t1->pos < t2->pos ? -1 : 1;
+	}
+	return 0;
+}
+
 /*
   process an AND expression (intersection)
  */
@@ -1518,8 +1740,10 @@ static int ldb_kv_index_dn_and(struct ldb_module *module,
 			       struct dn_list *list)
 {
 	struct ldb_context *ldb;
+	struct ldb_kv_index_and_term *terms = NULL;
 	unsigned int i;
 	bool found;
+	int ret;
 
 	ldb = ldb_module_get_ctx(module);
 
@@ -1531,7 +1755,6 @@ static int ldb_kv_index_dn_and(struct ldb_module *module,
 	   at any others */
 	for (i=0; i<tree->u.list.num_elements; i++) {
 		const struct ldb_parse_tree *subtree = tree->u.list.elements[i];
-		int ret;
 
 		if (subtree->operation != LDB_OP_EQUALITY ||
 		    !ldb_kv_index_unique(
@@ -1553,17 +1776,51 @@ static int ldb_kv_index_dn_and(struct ldb_module *module,
 		}
 	}
 
-	/* now do a full intersection */
+	/*
+	 * now do a full intersection, starting with the terms
+	 * expected to return the fewest entries
+	 */
+	terms = talloc_array(list,
+			     struct ldb_kv_index_and_term,
+			     tree->u.list.num_elements);
+	if (terms == NULL) {
+		return ldb_module_oom(module);
+	}
+	for (i=0; i<tree->u.list.num_elements; i++) {
+		const struct ldb_parse_tree *subtree = tree->u.list.elements[i];
+		terms[i] = (struct ldb_kv_index_and_term) {
+			.tree = subtree,
+			.estimate = ldb_kv_index_estimate(ldb_kv, subtree),
+			.pos = i,
+		};
+	}
+	TYPESAFE_QSORT(terms,
+		       tree->u.list.num_elements,
+		       ldb_kv_index_and_term_cmp);
+
 	found = false;
 
 	for (i=0; i<tree->u.list.num_elements; i++) {
-		const struct ldb_parse_tree *subtree = tree->u.list.elements[i];
+		const struct ldb_parse_tree *subtree = terms[i].tree;
 		struct dn_list *list2;
-		int ret;
+
+		if (found &&
+		    list->count <= LDB_KV_INDEX_AND_SMALL_LIST &&
+		    terms[i].estimate < LDB_KV_INDEX_COST_UNKNOWN - 1 &&
+		    terms[i].estimate / LDB_KV_INDEX_AND_SKIP_FACTOR >=
+			list->count) {
+			/*
+			 * The rest of the terms are expected to be
+			 * much bigger than what we have, loading them
+			 * costs more than filtering the few candidates.
+			 */
+			break;
+		}
 
 		list2 = talloc_zero(list, struct dn_list);
 		if (list2 == NULL) {
-			return ldb_module_oom(module);
+			ret = ldb_module_oom(module);
+			goto done;
 		}
 
 		ret = ldb_kv_index_dn(module, ldb_kv, subtree, list2);
@@ -1573,7 +1830,7 @@ static int ldb_kv_index_dn_and(struct ldb_module *module,
 			list->dn = NULL;
 			list->count = 0;
 			talloc_free(list2);
-			return LDB_ERR_NO_SUCH_OBJECT;
+			goto done;
 		}
 
 		if (ret != LDB_SUCCESS) {
@@ -1589,26 +1846,32 @@ static int ldb_kv_index_dn_and(struct ldb_module *module,
 			found = true;
 		} else if (!list_intersect(ldb, ldb_kv, list, list2)) {
 			talloc_free(list2);
-			return LDB_ERR_OPERATIONS_ERROR;
+			ret = LDB_ERR_OPERATIONS_ERROR;
+			goto done;
 		}
 
 		if (list->count == 0) {
 			list->dn = NULL;
-			return LDB_ERR_NO_SUCH_OBJECT;
+			ret = LDB_ERR_NO_SUCH_OBJECT;
+			goto done;
 		}
 
 		if (list->count < 2) {
 			/* it isn't worth loading the next part of the tree */
-			return LDB_SUCCESS;
+			break;
 		}
 	}
 
 	if (!found) {
 		/* none of the attributes were indexed */
-		return LDB_ERR_OPERATIONS_ERROR;
+		ret = LDB_ERR_OPERATIONS_ERROR;
+		goto done;
 	}
 
-	return LDB_SUCCESS;
+	ret = LDB_SUCCESS;
+done:
+	TALLOC_FREE(terms);
+	return ret;
 }
 
 /*
@@ -1870,19 +2133,29 @@ static int ldb_kv_index_filter(struct ldb_kv_private *ldb_kv,
 	for (i = 0; i < num_keys; i++) {
 		int ret;
 		bool matched;
+		struct ldb_val packed;
+
+		if (ldb_kv_search_time_exceeded(ac)) {
+			talloc_free(keys);
+			return LDB_ERR_TIME_LIMIT_EXCEEDED;
+		}
+
 		msg = ldb_msg_new(ac);
 		if (!msg) {
 			talloc_free(keys);
 			return LDB_ERR_OPERATIONS_ERROR;
 		}
 
-		ret =
-		    ldb_kv_search_key(ac->module,
-				      ldb_kv,
-				      keys[i],
-				      msg,
-				      LDB_UNPACK_DATA_FLAG_NO_DATA_ALLOC |
-					  LDB_UNPACK_DATA_FLAG_NO_VALUES_ALLOC);
+		ret = ldb_kv_search_key_attrs(
+		    ac->module,
+		    ldb_kv,
+		    keys[i],
+		    msg,
+		    LDB_UNPACK_DATA_FLAG_NO_DATA_ALLOC |
+			LDB_UNPACK_DATA_FLAG_NO_VALUES_ALLOC,
+		    ac->unpack_attrs,
+		    ac->num_unpack_attrs,
+		    &packed);
 		if (ret == LDB_ERR_NO_SUCH_OBJECT) {
 			/*
 			 * the record has disappeared? yes, this can
@@ -1928,6 +2201,18 @@ static int ldb_kv_index_filter(struct ldb_kv_private *ldb_kv,
 			continue;
 		}
 
+		ret = ldb_kv_unpack_matched(
+		    ac,
+		    &packed,
+		    msg,
+		    LDB_UNPACK_DATA_FLAG_NO_DATA_ALLOC |
+			LDB_UNPACK_DATA_FLAG_NO_VALUES_ALLOC);
+		if (ret == -1) {
+			talloc_free(keys);
+			talloc_free(msg);
+			return LDB_ERR_OPERATIONS_ERROR;
+		}
+
 		/* filter the attributes that the user wants */
 		ret = ldb_kv_filter_attrs(ac, msg, ac->attrs, &filtered_msg);
 
@@ -2179,6 +2464,7 @@ static int ldb_kv_index_add1(struct ldb_module *module,
 	struct dn_list *list;
 	unsigned alloc_len;
 	enum key_truncation truncation = KEY_TRUNCATED;
+	bool reindex = (ldb_kv->idxptr != NULL && ldb_kv->idxptr->reindex);
 
 
 	ldb = ldb_module_get_ctx(module);
@@ -2359,10 +2645,24 @@ static int ldb_kv_index_add1(struct ldb_module *module,
 	/* overallocate the list a bit, to reduce the number of
 	 * realloc trigered copies */
 	alloc_len = ((list->count+1)+7) & ~7;
-	list->dn = talloc_realloc(list, list->dn, struct ldb_val, alloc_len);
-	if (list->dn == NULL) {
-		talloc_free(list);
-		return LDB_ERR_OPERATIONS_ERROR;
+	if (reindex) {
+		/*
+		 * A reindex appends to lists of up to every record in
+		 * the database, grow them exponentially
+		 */
+		alloc_len = MAX(alloc_len, list->count * 2);
+		if (list->dn != NULL &&
+		    talloc_array_length(list->dn) > list->count) {
+			alloc_len = 0;
+		}
+	}
+	if (alloc_len != 0) {
+		list->dn = talloc_realloc(list, list->dn, struct ldb_val,
+					  alloc_len);
+		if (list->dn == NULL) {
+			talloc_free(list);
+			return LDB_ERR_OPERATIONS_ERROR;
+		}
 	}
 
 	if (ldb_kv->cache->GUID_index_attribute == NULL) {
@@ -2389,6 +2689,12 @@ static int ldb_kv_index_add1(struct ldb_module *module,
 			return ldb_module_operr(module);
 		}
 
+		if (reindex) {
+			/* sorted by ldb_kv_reindex() at the end */
+			next = &list->dn[list->count];
+			goto add_key;
+		}
+
 		BINARY_ARRAY_SEARCH_GTE(list->dn, list->count,
 					*key_val, ldb_val_equal_exact_ordered,
 					exact, next);
@@ -2430,6 +2736,7 @@ static int ldb_kv_index_add1(struct ldb_module *module,
 			memmove(&next[1], next,
 				sizeof(*next) * (list->count - (next - list->dn)));
 		}
+add_key:
 		*next = ldb_val_dup(list->dn, key_val);
 		if (next->data == NULL) {
 			talloc_free(list);
@@ -3079,6 +3386,45 @@ static int re_index(struct ldb_kv_private *ldb_kv,
 	return 0;
 }
 
+/*
+  traversal function that counts the records for a re index
+*/
+static int count_records(struct ldb_kv_private *ldb_kv,
+			 struct ldb_val key,
+			 struct ldb_val val,
+			 void *state)
+{
+	unsigned int *count = (unsigned int *)state;
+	(*count)++;
+	return 0;
+}
+
+/*
+  traverse function sorting the GUID lists built during a re index
+*/
+static int ldb_kv_index_traverse_sort(struct tdb_context *tdb,
+				      TDB_DATA key,
+				      TDB_DATA data,
+				      void *state)
+{
+	struct ldb_module *module = state;
+	struct ldb_kv_private *ldb_kv = talloc_get_type(
+	    ldb_module_get_private(module), struct ldb_kv_private);
+	struct dn_list *list;
+
+	list = ldb_kv_index_idxptr(module, data, true);
+	if (list == NULL) {
+		ldb_kv->idxptr->error = LDB_ERR_OPERATIONS_ERROR;
+		return -1;
+	}
+
+	if (list->count > 1) {
+		TYPESAFE_QSORT(list->dn, list->count,
+			       ldb_val_equal_exact_for_qsort);
+	}
+	return 0;
+}
+
 /*
   force a complete reindex of the database
 */
@@ -3088,6 +3434,7 @@ int ldb_kv_reindex(struct ldb_module *module)
 	    ldb_module_get_private(module), struct ldb_kv_private);
 	int ret;
 	struct ldb_kv_reindex_context ctx;
+	unsigned int num_records = 0;
 
 	/*
 	 * Only triggered after a modification, but make clear we do
@@ -3113,6 +3460,20 @@ int ldb_kv_reindex(struct ldb_module *module)
 		return ret;
 	}
 
+	/*
+	 * Every record ends up in a number of index lists, size the
+	 * in-memory index cache to match instead of chaining millions
+	 * of index keys in the default number of hash buckets
+	 */
+	ret = ldb_kv->kv_ops->iterate(ldb_kv, count_records, &num_records);
+	if (ret < 0) {
+		struct ldb_context *ldb = ldb_module_get_ctx(module);
+		ldb_asprintf_errstring(ldb, "record count traverse failed: %s",
+				       ldb_errstring(ldb));
+		return LDB_ERR_OPERATIONS_ERROR;
+	}
+	ldb_kv->idxptr->itdb_hash_size = MAX(num_records, 1000);
+
 	/* first traverse the database deleting any @INDEX records by
 	 * putting NULL entries in the in-memory tdb
 	 */
@@ -3146,7 +3507,9 @@ int ldb_kv_reindex(struct ldb_module *module)
 	ctx.count = 0;
 
 	/* now traverse adding any indexes for normal LDB records */
+	ldb_kv->idxptr->reindex = true;
 	ret = ldb_kv->kv_ops->iterate(ldb_kv, re_index, &ctx);
+	ldb_kv->idxptr->reindex = false;
 	if (ret < 0) {
 		struct ldb_context *ldb = ldb_module_get_ctx(module);
 		ldb_asprintf_errstring(ldb, "reindexing traverse failed: %s",
@@ -3160,6 +3523,20 @@ int ldb_kv_reindex(struct ldb_module *module)
 		return ctx.error;
 	}
 
+	/*
+	 * The GUID lists were built by appending, bring them into the
+	 * sorted form the rest of the index code expects
+	 */
+	if (ldb_kv->cache->GUID_index_attribute != NULL &&
+	    ldb_kv->idxptr->itdb != NULL) {
+		tdb_traverse(ldb_kv->idxptr->itdb,
+			     ldb_kv_index_traverse_sort,
+			     module);
+		if (ldb_kv->idxptr->error != LDB_SUCCESS) {
+			return ldb_kv->idxptr->error;
+		}
+	}
+
 	if (ctx.count > 10000) {
 		ldb_debug(ldb_module_get_ctx(module),
 			  LDB_DEBUG_WARNING,
@@ -178,6 +178,9 @@ struct ldb_kv_parse_data_unpack_ctx {
 	struct ldb_message *msg;
 	struct ldb_module *module;
 	unsigned int unpack_flags;
+	const char * const *attrs;
+	unsigned int num_attrs;
+	struct ldb_val *packed;
 };
 
 static int ldb_kv_parse_data_unpack(struct ldb_val key,
@@ -211,7 +214,8 @@ static int ldb_kv_parse_data_unpack(struct ldb_val key,
 
 	ret = ldb_unpack_data_only_attr_list_flags(ldb, &data_parse,
 						   ctx->msg,
-						   NULL, 0,
+						   ctx->attrs,
+						   ctx->num_attrs,
 						   ctx->unpack_flags,
 						   &nb_elements_in_db);
 	if (ret == -1) {
@@ -223,6 +227,10 @@ static int ldb_kv_parse_data_unpack(struct ldb_val key,
 			  (int)key.length, (int)key.length, key.data);
 		return LDB_ERR_OPERATIONS_ERROR;
 	}
+
+	if (ctx->packed != NULL && data_parse.data != data.data) {
+		*ctx->packed = data_parse;
+	}
 	return ret;
 }
 
@@ -238,15 +246,51 @@ int ldb_kv_search_key(struct ldb_module *module,
 		      const struct ldb_val ldb_key,
 		      struct ldb_message *msg,
 		      unsigned int unpack_flags)
+{
+	return ldb_kv_search_key_attrs(module,
+				       ldb_kv,
+				       ldb_key,
+				       msg,
+				       unpack_flags,
+				       NULL,
+				       0,
+				       NULL);
+}
+
+/*
+  search the database for a single simple dn, returning only the given
+  attributes (all of them if attrs is NULL) in a single message
+
+  If packed is not NULL and LDB_UNPACK_DATA_FLAG_NO_DATA_ALLOC was
+  given, it is set to the copy of the packed record the message points
+  into, so the caller can unpack it again.
+
+  return LDB_ERR_NO_SUCH_OBJECT on record-not-found
+  and LDB_SUCCESS on success
+*/
+int ldb_kv_search_key_attrs(struct ldb_module *module,
+			    struct ldb_kv_private *ldb_kv,
+			    const struct ldb_val ldb_key,
+			    struct ldb_message *msg,
+			    unsigned int unpack_flags,
+			    const char * const *attrs,
+			    unsigned int num_attrs,
+			    struct ldb_val *packed)
 {
 	int ret;
 	struct ldb_kv_parse_data_unpack_ctx ctx = {
 		.msg = msg,
 		.module = module,
-		.unpack_flags = unpack_flags
+		.unpack_flags = unpack_flags,
+		.attrs = attrs,
+		.num_attrs = num_attrs,
+		.packed = packed,
 	};
 
 	memset(msg, 0, sizeof(*msg));
+	if (packed != NULL) {
+		*packed = (struct ldb_val) { .length = 0 };
+	}
 
 	msg->num_elements = 0;
 	msg->elements = NULL;
@@ -494,6 +538,201 @@ failed:
 	return -1;
 }
 
+struct ldb_kv_unpack_attrs_ctx {
+	TALLOC_CTX *mem_ctx;
+	const char **attrs;
+	unsigned int num_attrs;
+};
+
+static int ldb_kv_unpack_attrs_add(struct ldb_kv_unpack_attrs_ctx *ctx,
+				   const char *attr)
+{
+	const char **attrs = NULL;
+	unsigned int i;
+
+	for (i = 0; i < ctx->num_attrs; i++) {
+		if (ldb_attr_cmp(ctx->attrs[i], attr) == 0) {
+			return LDB_SUCCESS;
+		}
+	}
+
+	attrs = talloc_realloc(ctx->mem_ctx,
+			       ctx->attrs,
+			       const char *,
+			       ctx->num_attrs + 1);
+	if (attrs == NULL) {
+		return LDB_ERR_OPERATIONS_ERROR;
+	}
+	attrs[ctx->num_attrs] = attr;
+	ctx->attrs = attrs;
+	ctx->num_attrs++;
+	return LDB_SUCCESS;
+}
+
+/*
+  callback for ldb_parse_tree_walk(), collecting the attributes the
+  filter looks at
+ */
+static int ldb_kv_unpack_attrs_tree(struct ldb_parse_tree *tree,
+				    void *private_context)
+{
+	struct ldb_kv_unpack_attrs_ctx *ctx = private_context;
+
+	switch (tree->operation) {
+	case LDB_OP_EQUALITY:
+	case LDB_OP_GREATER:
+	case LDB_OP_LESS:
+	case LDB_OP_APPROX:
+		return ldb_kv_unpack_attrs_add(ctx, tree->u.equality.attr);
+	case LDB_OP_SUBSTRING:
+		return ldb_kv_unpack_attrs_add(ctx, tree->u.substring.attr);
+	case LDB_OP_PRESENT:
+		return ldb_kv_unpack_attrs_add(ctx, tree->u.present.attr);
+	case LDB_OP_EXTENDED:
+		/*
+		 * Extended match rules are registered by the
+		 * callers and may look at any part of the message.
+		 */
+		return LDB_ERR_UNWILLING_TO_PERFORM;
+	default:
+		break;
+	}
+	return LDB_SUCCESS;
+}
+
+/*
+  work out which attributes of each candidate record a search has to
+  decode.
+
+  Only the attributes named in the filter are needed to decide if a
+  record matches.  If specific attributes were asked for, those are
+  decoded along with them in one go, otherwise (for "*" or no list)
+  the record is decoded again in full once it matched.  Other
+  records' attributes, such as big replPropertyMetaData or
+  thumbnailPhoto values, are then just skipped over.
+ */
+static void ldb_kv_search_prepare_unpack(struct ldb_kv_context *ctx)
+{
+	struct ldb_kv_unpack_attrs_ctx attrs_ctx = {
+		.mem_ctx = ctx,
+	};
+	bool keep_all = false;
+	unsigned int i;
+	int ret;
+
+	ctx->unpack_attrs = NULL;
+	ctx->num_unpack_attrs = 0;
+	ctx->unpack_match_only = false;
+
+	ret = ldb_parse_tree_walk(discard_const_p(struct ldb_parse_tree,
+						  ctx->tree),
+				  ldb_kv_unpack_attrs_tree,
+				  &attrs_ctx);
+	if (ret != LDB_SUCCESS) {
+		goto all;
+	}
+
+	if (ctx->attrs == NULL) {
+		keep_all = true;
+	} else {
+		for (i = 0; ctx->attrs[i] != NULL; i++) {
+			if (strcmp(ctx->attrs[i], "*") == 0) {
+				keep_all = true;
+				break;
+			}
+		}
+	}
+
+	if (!keep_all) {
+		for (i = 0; ctx->attrs[i] != NULL; i++) {
+			ret = ldb_kv_unpack_attrs_add(&attrs_ctx,
+						      ctx->attrs[i]);
+			if (ret != LDB_SUCCESS) {
+				goto all;
+			}
+		}
+	}
+
+	if (attrs_ctx.num_attrs == 0) {
+		/*
+		 * A list of size 0 means all attributes to
+		 * ldb_unpack_data_only_attr_list_flags(), which is
+		 * what we want for (for example) "(dn=...)"
+		 * with "*" anyway.
+		 */
+		goto all;
+	}
+
+	ctx->unpack_attrs = attrs_ctx.attrs;
+	ctx->num_unpack_attrs = attrs_ctx.num_attrs;
+	ctx->unpack_match_only = keep_all;
+	return;
+
+all:
+	TALLOC_FREE(attrs_ctx.attrs);
+}
+
+/*
+  decode the rest of a record that matched the filter, if only the
+  filter attributes were unpacked so far.  packed is the buffer msg
+  was unpacked from with LDB_UNPACK_DATA_FLAG_NO_DATA_ALLOC.
+ */
+int ldb_kv_unpack_matched(struct ldb_kv_context *ac,
+			  const struct ldb_val *packed,
+			  struct ldb_message *msg,
+			  unsigned int unpack_flags)
+{
+	struct ldb_context *ldb = ldb_module_get_ctx(ac->module);
+	struct ldb_dn *dn = msg->dn;
+	int ret;
+
+	if (!ac->unpack_match_only) {
+		return 0;
+	}
+
+	TALLOC_FREE(msg->elements);
+	msg->num_elements = 0;
+
+	/* we already have the DN, don't parse it again */
+	ret = ldb_unpack_data_only_attr_list_flags(ldb,
+						   packed,
+						   msg,
+						   NULL,
+						   0,
+						   unpack_flags |
+						   LDB_UNPACK_DATA_FLAG_NO_DN,
+						   NULL);
+	msg->dn = dn;
+	return ret;
+}
+
+/*
+  check if a search has run past its time limit.
+
+  The search runs to completion from a single event, so the timeout
+  event set up by ldb_kv_handle_request() can only fire once it is
+  over.  Long searches therefore look at the clock themselves every
+  LDB_KV_SEARCH_TIME_CHECK records, so a huge unindexed search can't
+  hold up the rest of the process for longer than its time limit.
+ */
+#define LDB_KV_SEARCH_TIME_CHECK 1024
+
+bool ldb_kv_search_time_exceeded(struct ldb_kv_context *ac)
+{
+	struct ldb_request *req = ac->req;
+
+	if (req->timeout <= 0) {
+		return false;
+	}
+
+	ac->num_records_walked++;
+	if (ac->num_records_walked % LDB_KV_SEARCH_TIME_CHECK != 0) {
+		return false;
+	}
+
+	return time(NULL) >= req->starttime + req->timeout;
+}
+
 /*
   search function for a non-indexed search
  */
@@ -516,6 +755,11 @@ static int search_func(struct ldb_kv_private *ldb_kv,
 		return 0;
 	}
 
+	if (ldb_kv_search_time_exceeded(ac)) {
+		ac->error = LDB_ERR_TIME_LIMIT_EXCEEDED;
+		return -1;
+	}
+
 	msg = ldb_msg_new(ac);
 	if (!msg) {
 		ac->error = LDB_ERR_OPERATIONS_ERROR;
@@ -525,7 +769,8 @@ static int search_func(struct ldb_kv_private *ldb_kv,
 	/* unpack the record */
 	ret = ldb_unpack_data_only_attr_list_flags(ldb, &val,
 						   msg,
-						   NULL, 0,
+						   ac->unpack_attrs,
+						   ac->num_unpack_attrs,
 						   LDB_UNPACK_DATA_FLAG_NO_DATA_ALLOC|
 						   LDB_UNPACK_DATA_FLAG_NO_VALUES_ALLOC,
 						   &nb_elements_in_db);
@@ -558,6 +803,17 @@ static int search_func(struct ldb_kv_private *ldb_kv,
 		return 0;
 	}
 
+	ret = ldb_kv_unpack_matched(ac,
+				    &val,
+				    msg,
+				    LDB_UNPACK_DATA_FLAG_NO_DATA_ALLOC|
+				    LDB_UNPACK_DATA_FLAG_NO_VALUES_ALLOC);
+	if (ret == -1) {
+		talloc_free(msg);
+		ac->error = LDB_ERR_OPERATIONS_ERROR;
+		return -1;
+	}
+
 	/* filter the attributes that the user wants */
 	ret = ldb_kv_filter_attrs(ac, msg, ac->attrs, &filtered_msg);
 	talloc_free(msg);
@@ -594,6 +850,9 @@ static int ldb_kv_search_full(struct ldb_kv_context *ctx)
 	ret = ldb_kv->kv_ops->iterate(ldb_kv, search_func, ctx);
 
 	if (ret < 0) {
+		if (ctx->error == LDB_ERR_TIME_LIMIT_EXCEEDED) {
+			return ctx->error;
+		}
 		return LDB_ERR_OPERATIONS_ERROR;
 	}
 
@@ -738,6 +997,7 @@ int ldb_kv_search(struct ldb_kv_context *ctx)
 	ctx->scope = req->op.search.scope;
 	ctx->base = req->op.search.base;
 	ctx->attrs = req->op.search.attrs;
+	ldb_kv_search_prepare_unpack(ctx);
 
 	if ((req->op.search.base == NULL) || (ldb_dn_is_null(req->op.search.base) == true)) {
 
@@ -813,8 +1073,10 @@ int ldb_kv_search(struct ldb_kv_context *ctx)
 		}
 		/* Check if we got just a normal error.
 		 * In that case proceed to a full search unless we got a
-		 * callback error */
-		if (!ctx->request_terminated && ret != LDB_SUCCESS) {
+		 * callback error or ran out of time */
+		if (!ctx->request_terminated &&
+		    ret != LDB_SUCCESS &&
+		    ret != LDB_ERR_TIME_LIMIT_EXCEEDED) {
 			/* Not indexed, so we need to do a full scan */
 			if (ldb_kv->warn_unindexed ||
 			    ldb_kv->disable_full_db_scan) {
@@ -852,7 +1114,11 @@ int ldb_kv_search(struct ldb_kv_context *ctx)
 			}
 
 			ret = ldb_kv_search_full(ctx);
-			if (ret != LDB_SUCCESS) {
+			if (ret == LDB_ERR_TIME_LIMIT_EXCEEDED) {
+				ldb_set_errstring(ldb,
+						  "ldb FULL SEARCH time limit "
+						  "exceeded");
+			} else if (ret != LDB_SUCCESS) {
 				ldb_set_errstring(ldb, "Indexed and full searches both failed!\n");
 			}
 		}
@@ -33,6 +33,20 @@
 
 #define GIGABYTE (1024*1024*1024)
 
+struct mdb_env_wrap {
+	struct mdb_env_wrap *next, *prev;
+	dev_t device;
+	ino_t inode;
+	MDB_env *env;
+	pid_t pid;
+	/* top level transactions open on env in this process */
+	unsigned int num_txns;
+	/* a write ran out of map space, grow the map */
+	bool map_full;
+};
+
+static struct mdb_env_wrap *mdb_list;
+
 int ldb_mdb_err_map(int lmdb_err)
 {
 	switch (lmdb_err) {
@@ -130,6 +144,98 @@ static struct lmdb_trans *lmdb_private_trans_head(struct lmdb_private *lmdb)
 	return ltx;
 }
 
+/*
+ * Double the map size after a write failed with MDB_MAP_FULL.
+ *
+ * LMDB only allows this while no transaction is open on the
+ * environment in this process, so it is done before the next top level
+ * transaction starts. Other processes pick up the new size when their
+ * next transaction gets MDB_MAP_RESIZED.
+ */
+static void lmdb_grow_map(struct lmdb_private *lmdb)
+{
+	struct mdb_env_wrap *w = lmdb->env_wrap;
+	MDB_envinfo info;
+	size_t new_size;
+	int ret;
+
+	if (!w->map_full || w->num_txns != 0) {
+		return;
+	}
+
+	ret = mdb_env_info(lmdb->env, &info);
+	if (ret != MDB_SUCCESS) {
+		return;
+	}
+
+	new_size = info.me_mapsize * 2;
+	if (new_size < info.me_mapsize) {
+		return;
+	}
+
+	ret = mdb_env_set_mapsize(lmdb->env, new_size);
+	if (ret != MDB_SUCCESS) {
+		ldb_debug(lmdb->ldb,
+			  LDB_DEBUG_ERROR,
+			  "Could not grow MDB mmap() size to %zu: %s",
+			  new_size,
+			  mdb_strerror(ret));
+		return;
+	}
+
+	ldb_debug(lmdb->ldb,
+		  LDB_DEBUG_WARNING,
+		  "MDB mmap() size grown to %zu after the map was full",
+		  new_size);
+	w->map_full = false;
+}
+
+static void lmdb_check_map_full(struct lmdb_private *lmdb)
+{
+	if (lmdb->error == MDB_MAP_FULL) {
+		lmdb->env_wrap->map_full = true;
+	}
+}
+
+/*
+ * Begin a transaction, keeping track of the top level transactions
+ * open on the environment in this process.
+ */
+static int lmdb_txn_begin(struct lmdb_private *lmdb,
+			  MDB_txn *parent,
+			  unsigned int flags,
+			  MDB_txn **txn)
+{
+	struct mdb_env_wrap *w = lmdb->env_wrap;
+	int ret;
+
+	if (parent != NULL) {
+		return mdb_txn_begin(lmdb->env, parent, flags, txn);
+	}
+
+	lmdb_grow_map(lmdb);
+
+	ret = mdb_txn_begin(lmdb->env, NULL, flags, txn);
+	if (ret == MDB_MAP_RESIZED && w->num_txns == 0) {
+		/*
+		 * Another process grew the map, adopt the new size
+		 */
+		ret = mdb_env_set_mapsize(lmdb->env, 0);
+		if (ret == MDB_SUCCESS) {
+			ret = mdb_txn_begin(lmdb->env, NULL, flags, txn);
+		}
+	}
+	if (ret == MDB_SUCCESS) {
+		w->num_txns++;
+	}
+	return ret;
+}
+
+static void lmdb_txn_finished(struct lmdb_private *lmdb)
+{
+	lmdb->env_wrap->num_txns--;
+}
+
 
 static MDB_txn *get_current_txn(struct lmdb_private *lmdb)
 {
@@ -200,6 +306,7 @@ static int lmdb_store(struct ldb_kv_private *ldb_kv,
 
 	lmdb->error = mdb_put(txn, dbi, &mdb_key, &mdb_data, mdb_flags);
 	if (lmdb->error != MDB_SUCCESS) {
+		lmdb_check_map_full(lmdb);
 		return ldb_mdb_error(lmdb->ldb, lmdb->error);
 	}
 
@@ -438,10 +545,10 @@ static int lmdb_lock_read(struct ldb_module *module)
 	lmdb->error = MDB_SUCCESS;
 	if (lmdb_transaction_active(ldb_kv) == false &&
 	    ldb_kv->read_lock_count == 0) {
-		lmdb->error = mdb_txn_begin(lmdb->env,
-					    NULL,
-					    MDB_RDONLY,
-					    &lmdb->read_txn);
+		lmdb->error = lmdb_txn_begin(lmdb,
+					     NULL,
+					     MDB_RDONLY,
+					     &lmdb->read_txn);
 	}
 	if (lmdb->error != MDB_SUCCESS) {
 		return ldb_mdb_error(lmdb->ldb, lmdb->error);
@@ -462,6 +569,7 @@ static int lmdb_unlock_read(struct ldb_module *module)
 		struct lmdb_private *lmdb = ldb_kv->lmdb_private;
 		mdb_txn_commit(lmdb->read_txn);
 		lmdb->read_txn = NULL;
+		lmdb_txn_finished(lmdb);
 		ldb_kv->read_lock_count--;
 		return LDB_SUCCESS;
 	}
@@ -502,7 +610,7 @@ static int lmdb_transaction_start(struct ldb_kv_private *ldb_kv)
 
 	tx_parent = lmdb_trans_get_tx(ltx_head);
 
-	lmdb->error = mdb_txn_begin(lmdb->env, tx_parent, 0, &ltx->tx);
+	lmdb->error = lmdb_txn_begin(lmdb, tx_parent, 0, &ltx->tx);
 	if (lmdb->error != MDB_SUCCESS) {
 		return ldb_mdb_error(lmdb->ldb, lmdb->error);
 	}
@@ -524,6 +632,15 @@ static int lmdb_transaction_cancel(struct ldb_kv_private *ldb_kv)
 
 	mdb_txn_abort(ltx->tx);
 	trans_finished(lmdb, ltx);
+	if (lmdb->txlist == NULL) {
+		lmdb_txn_finished(lmdb);
+	}
+
+	/*
+	 * The cache may hold changes of the aborted transaction,
+	 * make lmdb_changed() force a reload
+	 */
+	lmdb->txnid = 0;
 	return LDB_SUCCESS;
 }
 
@@ -545,6 +662,10 @@ static int lmdb_transaction_commit(struct ldb_kv_private *ldb_kv)
 
 	lmdb->error = mdb_txn_commit(ltx->tx);
 	trans_finished(lmdb, ltx);
+	if (lmdb->txlist == NULL) {
+		lmdb_txn_finished(lmdb);
+	}
+	lmdb_check_map_full(lmdb);
 
 	return lmdb->error;
 }
@@ -566,14 +687,33 @@ static const char *lmdb_name(struct ldb_kv_private *ldb_kv)
 
 static bool lmdb_changed(struct ldb_kv_private *ldb_kv)
 {
+	struct lmdb_private *lmdb = ldb_kv->lmdb_private;
+	MDB_txn *txn = NULL;
+	size_t txnid;
+	bool has_changed;
+
 	/*
-	 * lmdb does no provide a quick way to determine if the database
-	 * has changed.  This function always returns true.
+	 * The id of a transaction is the id of the last commit it
+	 * sees (plus one for a write transaction), so it only moves
+	 * when the database has been changed.
 	 *
-	 * Note that tdb uses a sequence number that allows this function
-	 * to be implemented efficiently.
+	 * Without a transaction we can't tell, assume a change.
 	 */
-	return true;
+	txn = lmdb_trans_get_tx(lmdb_private_trans_head(lmdb));
+	if (txn == NULL) {
+		txn = lmdb->read_txn;
+	}
+	if (txn == NULL) {
+		lmdb->txnid = 0;
+		return true;
+	}
+
+	txnid = mdb_txn_id(txn);
+	has_changed = (lmdb->txnid == 0 || txnid != lmdb->txnid);
+
+	lmdb->txnid = txnid;
+
+	return has_changed;
 }
 
 static struct kv_db_ops lmdb_key_value_ops = {
@@ -640,6 +780,7 @@ static int lmdb_pvt_destructor(struct lmdb_private *lmdb)
 	 */
 	if (lmdb->read_txn != NULL) {
 		mdb_txn_abort(lmdb->read_txn);
+		lmdb_txn_finished(lmdb);
 	}
 
 	if (lmdb->env == NULL) {
@@ -650,6 +791,9 @@ static int lmdb_pvt_destructor(struct lmdb_private *lmdb)
 	 * Abort any currently active transactions
 	 */
 	ltx = lmdb_private_trans_head(lmdb);
+	if (ltx != NULL) {
+		lmdb_txn_finished(lmdb);
+	}
 	while (ltx != NULL) {
 		mdb_txn_abort(ltx->tx);
 		trans_finished(lmdb, ltx);
@@ -660,16 +804,6 @@ static int lmdb_pvt_destructor(struct lmdb_private *lmdb)
 	return 0;
 }
 
-struct mdb_env_wrap {
-	struct mdb_env_wrap *next, *prev;
-	dev_t device;
-	ino_t inode;
-	MDB_env *env;
-	pid_t pid;
-};
-
-static struct mdb_env_wrap *mdb_list;
-
 /* destroy the last connection to an mdb */
 static int mdb_env_wrap_destructor(struct mdb_env_wrap *w)
 {
@@ -680,12 +814,13 @@ static int mdb_env_wrap_destructor(struct mdb_env_wrap *w)
 
 static int lmdb_open_env(TALLOC_CTX *mem_ctx,
 			 MDB_env **env,
+			 struct mdb_env_wrap **_w,
 			 struct ldb_context *ldb,
 			 const char *path,
+			 size_t mmap_size,
 			 unsigned int flags)
 {
 	int ret;
-	const size_t mmap_size = 8LL * GIGABYTE;
 	unsigned int mdb_flags = MDB_NOSUBDIR|MDB_NOTLS;
 	/*
 	 * MDB_NOSUBDIR implies there is a separate file called path and a
@@ -710,12 +845,13 @@ static int lmdb_open_env(TALLOC_CTX *mem_ctx,
 					return ldb_oom(ldb);
 				}
 				*env = w->env;
+				*_w = w;
 				return LDB_SUCCESS;
 			}
 		}
 	}
 
-	w = talloc(mem_ctx, struct mdb_env_wrap);
+	w = talloc_zero(mem_ctx, struct mdb_env_wrap);
 	if (w == NULL) {
 		return ldb_oom(ldb);
 	}
@@ -731,8 +867,8 @@ static int lmdb_open_env(TALLOC_CTX *mem_ctx,
 	}
 
 	/*
-	 * Currently we set a 8Gb maximum database size
-	 * via the constant mmap_size above
+	 * The initial maximum database size, it is doubled whenever
+	 * a write runs out of space, see lmdb_grow_map()
 	 */
 	ret = mdb_env_set_mapsize(*env, mmap_size);
 	if (ret != 0) {
@@ -794,6 +930,7 @@ static int lmdb_open_env(TALLOC_CTX *mem_ctx,
 
 	DLIST_ADD(mdb_list, w);
 
+	*_w = w;
 	return LDB_SUCCESS;
 
 }
@@ -801,6 +938,7 @@ static int lmdb_open_env(TALLOC_CTX *mem_ctx,
 static int lmdb_pvt_open(struct lmdb_private *lmdb,
 			 struct ldb_context *ldb,
 			 const char *path,
+			 size_t mmap_size,
 			 unsigned int flags)
 {
 	int ret;
@@ -813,7 +951,8 @@ static int lmdb_pvt_open(struct lmdb_private *lmdb,
 		}
 	}
 
-	ret = lmdb_open_env(lmdb, &lmdb->env, ldb, path, flags);
+	ret = lmdb_open_env(lmdb, &lmdb->env, &lmdb->env_wrap, ldb, path,
+			    mmap_size, flags);
 	if (ret != 0) {
 		return ret;
 	}
@@ -843,6 +982,8 @@ int lmdb_connect(struct ldb_context *ldb,
 	const char *path = NULL;
 	struct lmdb_private *lmdb = NULL;
 	struct ldb_kv_private *ldb_kv = NULL;
+	size_t mmap_size = 8LL * GIGABYTE;
+	const char *env_size_str = NULL;
 	int ret;
 
 	/*
@@ -871,7 +1012,18 @@ int lmdb_connect(struct ldb_context *ldb,
 	lmdb->ldb = ldb;
 	ldb_kv->kv_ops = &lmdb_key_value_ops;
 
-	ret = lmdb_pvt_open(lmdb, ldb, path, flags);
+	/*
+	 * The initial map size, 8Gb unless given, it grows on demand
+	 */
+	env_size_str = ldb_options_find(ldb, options, "lmdb_env_size");
+	if (env_size_str != NULL) {
+		unsigned long long env_size = strtoull(env_size_str, NULL, 0);
+		if (env_size != 0) {
+			mmap_size = env_size;
+		}
+	}
+
+	ret = lmdb_pvt_open(lmdb, ldb, path, mmap_size, flags);
 	if (ret != LDB_SUCCESS) {
 		TALLOC_FREE(ldb_kv);
 		return ret;
@@ -28,9 +28,12 @@
 #include "ldb_private.h"
 #include <lmdb.h>
 
+struct mdb_env_wrap;
+
 struct lmdb_private {
 	struct ldb_context *ldb;
 	MDB_env *env;
+	struct mdb_env_wrap *env_wrap;
 
 	struct lmdb_trans *txlist;
 
@@ -41,6 +44,9 @@ struct lmdb_private {
 	int error;
 	MDB_txn *read_txn;
 
+	/* transaction id as last seen by lmdb_changed(), 0 if unknown */
+	size_t txnid;
+
 	pid_t pid;
 
 };
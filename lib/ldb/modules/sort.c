@@ -55,6 +55,7 @@ struct sort_context {
 	struct ldb_message **msgs;
 	char **referrals;
 	unsigned int num_msgs;
+	unsigned int msgs_allocated;
 	unsigned int num_refs;
 	const char *extra_sort_key;
 
@@ -104,10 +105,18 @@ static int build_response(void *mem_ctx, struct ldb_control ***ctrls, int result
 	return LDB_SUCCESS;
 }
 
-static int sort_compare(struct ldb_message **msg1, struct ldb_message **msg2, void *opaque)
+/*
+ * A message together with the value it is sorted by, looked up once
+ * before sorting rather than in every comparison.
+ */
+struct sort_key {
+	struct ldb_message *msg;
+	const struct ldb_val *val;
+};
+
+static int sort_compare(struct sort_key *key1, struct sort_key *key2, void *opaque)
 {
 	struct sort_context *ac = talloc_get_type(opaque, struct sort_context);
-	struct ldb_message_element *el1, *el2;
 	struct ldb_context *ldb;
 
 	ldb = ldb_module_get_ctx(ac->module);
@@ -118,29 +127,27 @@ static int sort_compare(struct ldb_message **msg1, struct ldb_message **msg2, vo
 		return 0;
 	}
 
-	el1 = ldb_msg_find_element(*msg1, ac->attributeName);
-	el2 = ldb_msg_find_element(*msg2, ac->attributeName);
-
-	if (!el1 && el2) {
+	if (!key1->val && key2->val) {
 		return 1;
 	}
-	if (el1 && !el2) {
+	if (key1->val && !key2->val) {
 		return -1;
 	}
-	if (!el1 && !el2) {
+	if (!key1->val && !key2->val) {
 		return 0;
 	}
 
 	if (ac->reverse)
-		return ac->a->syntax->comparison_fn(ldb, ac, &el2->values[0], &el1->values[0]);
+		return ac->a->syntax->comparison_fn(ldb, ac, key2->val, key1->val);
 
-	return ac->a->syntax->comparison_fn(ldb, ac, &el1->values[0], &el2->values[0]);
+	return ac->a->syntax->comparison_fn(ldb, ac, key1->val, key2->val);
 }
 
 static int server_sort_results(struct sort_context *ac)
 {
 	struct ldb_context *ldb;
 	struct ldb_reply *ares;
+	struct sort_key *keys = NULL;
 	unsigned int i;
 	int ret;
 
@@ -149,7 +156,23 @@ static int server_sort_results(struct sort_context *ac)
 	ac->a = ldb_schema_attribute_by_name(ldb, ac->attributeName);
 	ac->sort_result = 0;
 
-	LDB_TYPESAFE_QSORT(ac->msgs, ac->num_msgs, ac, sort_compare);
+	keys = talloc_array(ac, struct sort_key, ac->num_msgs);
+	if (keys == NULL) {
+		return LDB_ERR_OPERATIONS_ERROR;
+	}
+
+	for (i = 0; i < ac->num_msgs; i++) {
+		struct ldb_message_element *el;
+
+		el = ldb_msg_find_element(ac->msgs[i], ac->attributeName);
+		keys[i].msg = ac->msgs[i];
+		keys[i].val = NULL;
+		if (el != NULL && el->num_values > 0) {
+			keys[i].val = &el->values[0];
+		}
+	}
+
+	LDB_TYPESAFE_QSORT(keys, ac->num_msgs, ac, sort_compare);
 
 	if (ac->sort_result != LDB_SUCCESS) {
 		return ac->sort_result;
@@ -162,7 +185,7 @@ static int server_sort_results(struct sort_context *ac)
 		}
 
 		ares->type = LDB_REPLY_ENTRY;
-		ares->message = talloc_move(ares, &ac->msgs[i]);
+		ares->message = talloc_steal(ares, keys[i].msg);
 		if (ac->extra_sort_key) {
 			ldb_msg_remove_attr(ares->message, ac->extra_sort_key);
 		}
@@ -210,12 +233,19 @@ static int server_sort_search_callback(struct ldb_request *req, struct ldb_reply
 
 	switch (ares->type) {
 	case LDB_REPLY_ENTRY:
-		ac->msgs = talloc_realloc(ac, ac->msgs, struct ldb_message *, ac->num_msgs + 2);
-		if (! ac->msgs) {
-			talloc_free(ares);
-			ldb_oom(ldb);
-			return ldb_module_done(ac->req, NULL, NULL,
-						LDB_ERR_OPERATIONS_ERROR);
+		if (ac->num_msgs + 2 > ac->msgs_allocated) {
+			/* grow geometrically, large sorts get many entries */
+			unsigned int n = MAX(ac->msgs_allocated * 2, 16);
+
+			ac->msgs = talloc_realloc(ac, ac->msgs,
+						  struct ldb_message *, n);
+			if (! ac->msgs) {
+				talloc_free(ares);
+				ldb_oom(ldb);
+				return ldb_module_done(ac->req, NULL, NULL,
+							LDB_ERR_OPERATIONS_ERROR);
+			}
+			ac->msgs_allocated = n;
 		}
 
 		ac->msgs[ac->num_msgs] = talloc_steal(ac->msgs, ares->message);
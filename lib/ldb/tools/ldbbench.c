@@ -0,0 +1,845 @@
+/*
+   ldb database library
+
+   Copyright (C) Samba Team 2026
+
+     ** NOTE! The following LGPL license applies to the ldb
+     ** library. This does NOT imply that all of Samba is released
+     ** under the LGPL
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 3 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ *  Name: ldb
+ *
+ *  Component: ldbbench
+ *
+ *  Description: benchmark ldb backends with an AD shaped dataset
+ *
+ *  The database is filled with users and (nested) groups that carry
+ *  member links, indexed the way a Samba AD DC indexes its partitions.
+ *  Then indexed searches, membership expansion, modifies, changes to
+ *  a large group and transaction commits are timed.  Run it against
+ *  an empty tdb:// or mdb:// URL to compare the backends.
+ */
+
+#include "replace.h"
+#include "system/filesys.h"
+#include "system/time.h"
+#include "ldb.h"
+#include "tools/cmdline.h"
+
+static struct timespec tp1,tp2;
+static struct ldb_cmdline *options;
+
+struct bench_config {
+	unsigned int num_users;
+	unsigned int num_groups;
+	unsigned int nesting;
+	unsigned int large_group;
+	unsigned int num_searches;
+	unsigned int num_modifies;
+	unsigned int num_transactions;
+	unsigned int batch_size;
+	bool guid_index;
+	bool linked;
+};
+
+static void _start_timer(void)
+{
+	if (clock_gettime(CUSTOM_CLOCK_MONOTONIC, &tp1) != 0) {
+		clock_gettime(CLOCK_REALTIME, &tp1);
+	}
+}
+
+static double _end_timer(void)
+{
+	if (clock_gettime(CUSTOM_CLOCK_MONOTONIC, &tp2) != 0) {
+		clock_gettime(CLOCK_REALTIME, &tp2);
+	}
+	return((tp2.tv_sec - tp1.tv_sec) +
+	       (tp2.tv_nsec - tp1.tv_nsec)*1.0e-9);
+}
+
+static void report(const char *what, unsigned int count, double secs)
+{
+	printf("%-24s %9u ops %9.3f seconds %12.1f ops/sec\n",
+	       what, count, secs, secs > 0 ? count / secs : 0.0);
+	fflush(stdout);
+}
+
+static void check(struct ldb_context *ldb, int ret, const char *what,
+		  struct ldb_dn *dn)
+{
+	if (ret == LDB_SUCCESS) {
+		return;
+	}
+	printf("%s of %s failed - %s\n", what,
+	       dn != NULL ? ldb_dn_get_linearized(dn) : "(none)",
+	       ldb_errstring(ldb));
+	exit(LDB_ERR_OPERATIONS_ERROR);
+}
+
+static struct ldb_dn *users_dn(TALLOC_CTX *mem_ctx, struct ldb_dn *basedn)
+{
+	struct ldb_dn *dn = ldb_dn_copy(mem_ctx, basedn);
+
+	if (dn == NULL || !ldb_dn_add_child_fmt(dn, "CN=Users")) {
+		printf("Out of memory building DN\n");
+		exit(LDB_ERR_OPERATIONS_ERROR);
+	}
+	return dn;
+}
+
+static struct ldb_dn *user_dn(TALLOC_CTX *mem_ctx, struct ldb_dn *basedn,
+			      unsigned int i)
+{
+	struct ldb_dn *dn = users_dn(mem_ctx, basedn);
+
+	if (!ldb_dn_add_child_fmt(dn, "CN=user%u", i)) {
+		printf("Out of memory building DN\n");
+		exit(LDB_ERR_OPERATIONS_ERROR);
+	}
+	return dn;
+}
+
+static struct ldb_dn *group_dn(TALLOC_CTX *mem_ctx, struct ldb_dn *basedn,
+			       unsigned int i)
+{
+	struct ldb_dn *dn = users_dn(mem_ctx, basedn);
+
+	if (!ldb_dn_add_child_fmt(dn, "CN=group%u", i)) {
+		printf("Out of memory building DN\n");
+		exit(LDB_ERR_OPERATIONS_ERROR);
+	}
+	return dn;
+}
+
+static struct ldb_dn *large_group_dn(TALLOC_CTX *mem_ctx,
+				     struct ldb_dn *basedn)
+{
+	struct ldb_dn *dn = users_dn(mem_ctx, basedn);
+
+	if (!ldb_dn_add_child_fmt(dn, "CN=Large Group")) {
+		printf("Out of memory building DN\n");
+		exit(LDB_ERR_OPERATIONS_ERROR);
+	}
+	return dn;
+}
+
+/*
+ * A stable, unique 16 byte objectGUID: which kind of object and its
+ * number, so runs against different backends store identical data.
+ */
+static int add_guid(struct ldb_message *msg, uint32_t kind, uint32_t i)
+{
+	uint8_t guid[16] = { 0 };
+	struct ldb_val val;
+	unsigned int b;
+
+	for (b = 0; b < 4; b++) {
+		guid[b] = (kind >> (b * 8)) & 0xff;
+		guid[4 + b] = (i >> (b * 8)) & 0xff;
+	}
+	guid[8] = 0x5a;
+	guid[15] = 0xa5;
+
+	val.data = talloc_memdup(msg, guid, sizeof(guid));
+	if (val.data == NULL) {
+		return LDB_ERR_OPERATIONS_ERROR;
+	}
+	val.length = sizeof(guid);
+
+	return ldb_msg_add_steal_value(msg, "objectGUID", &val);
+}
+
+static int add_strings(struct ldb_message *msg, const char *attr,
+		       const char * const *values)
+{
+	unsigned int i;
+	int ret;
+
+	for (i = 0; values[i] != NULL; i++) {
+		ret = ldb_msg_add_string(msg, attr, values[i]);
+		if (ret != LDB_SUCCESS) {
+			return ret;
+		}
+	}
+	return LDB_SUCCESS;
+}
+
+static void add_indexes(struct ldb_context *ldb,
+			const struct bench_config *config)
+{
+	TALLOC_CTX *tmp_ctx = talloc_new(ldb);
+	struct ldb_message *msg;
+	int ret;
+
+	msg = ldb_msg_new(tmp_ctx);
+	if (msg == NULL) {
+		printf("ldb_msg_new failed\n");
+		exit(LDB_ERR_OPERATIONS_ERROR);
+	}
+	msg->dn = ldb_dn_new(msg, ldb, "@ATTRIBUTES");
+	ret = ldb_msg_add_string(msg, "sAMAccountName", "CASE_INSENSITIVE");
+	if (ret == LDB_SUCCESS) {
+		ret = ldb_add(ldb, msg);
+	}
+	check(ldb, ret, "Add", msg->dn);
+
+	msg = ldb_msg_new(tmp_ctx);
+	if (msg == NULL) {
+		printf("ldb_msg_new failed\n");
+		exit(LDB_ERR_OPERATIONS_ERROR);
+	}
+	msg->dn = ldb_dn_new(msg, ldb, "@INDEXLIST");
+	ret = add_strings(msg, "@IDXATTR",
+			  (const char * const []) {
+				  "sAMAccountName", "objectClass",
+				  "objectGUID", "member", "memberOf",
+				  NULL });
+	if (ret == LDB_SUCCESS) {
+		ret = ldb_msg_add_string(msg, "@IDXONE", "1");
+	}
+	if (ret == LDB_SUCCESS && config->guid_index) {
+		ret = ldb_msg_add_string(msg, "@IDXGUID", "objectGUID");
+	}
+	if (ret == LDB_SUCCESS && config->guid_index) {
+		ret = ldb_msg_add_string(msg, "@IDX_DN_GUID", "GUID");
+	}
+	if (ret == LDB_SUCCESS) {
+		ret = ldb_add(ldb, msg);
+	}
+	check(ldb, ret, "Add", msg->dn);
+
+	talloc_free(tmp_ctx);
+}
+
+static void add_containers(struct ldb_context *ldb, struct ldb_dn *basedn)
+{
+	TALLOC_CTX *tmp_ctx = talloc_new(ldb);
+	struct ldb_message *msg;
+	int ret;
+
+	msg = ldb_msg_new(tmp_ctx);
+	if (msg == NULL) {
+		printf("ldb_msg_new failed\n");
+		exit(LDB_ERR_OPERATIONS_ERROR);
+	}
+	msg->dn = basedn;
+	ret = add_strings(msg, "objectClass",
+			  (const char * const []) {
+				  "top", "domain", "domainDNS", NULL });
+	if (ret == LDB_SUCCESS) {
+		ret = add_guid(msg, 0, 0);
+	}
+	if (ret == LDB_SUCCESS) {
+		ret = ldb_add(ldb, msg);
+	}
+	check(ldb, ret, "Add", msg->dn);
+
+	msg = ldb_msg_new(tmp_ctx);
+	if (msg == NULL) {
+		printf("ldb_msg_new failed\n");
+		exit(LDB_ERR_OPERATIONS_ERROR);
+	}
+	msg->dn = users_dn(msg, basedn);
+	ret = add_strings(msg, "objectClass",
+			  (const char * const []) { "top", "container", NULL });
+	if (ret == LDB_SUCCESS) {
+		ret = ldb_msg_add_string(msg, "cn", "Users");
+	}
+	if (ret == LDB_SUCCESS) {
+		ret = add_guid(msg, 0, 1);
+	}
+	if (ret == LDB_SUCCESS) {
+		ret = ldb_add(ldb, msg);
+	}
+	check(ldb, ret, "Add", msg->dn);
+
+	talloc_free(tmp_ctx);
+}
+
+static void add_user(struct ldb_context *ldb, struct ldb_dn *basedn,
+		     const struct bench_config *config, unsigned int i)
+{
+	TALLOC_CTX *tmp_ctx = talloc_new(ldb);
+	struct ldb_message *msg;
+	char *name = talloc_asprintf(tmp_ctx, "user%u", i);
+	int ret;
+
+	msg = ldb_msg_new(tmp_ctx);
+	if (name == NULL || msg == NULL) {
+		printf("Out of memory adding user%u\n", i);
+		exit(LDB_ERR_OPERATIONS_ERROR);
+	}
+	msg->dn = user_dn(msg, basedn, i);
+
+	ret = add_strings(msg, "objectClass",
+			  (const char * const []) {
+				  "top", "person", "organizationalPerson",
+				  "user", NULL });
+	if (ret == LDB_SUCCESS) {
+		ret = ldb_msg_add_string(msg, "cn", name);
+	}
+	if (ret == LDB_SUCCESS) {
+		ret = ldb_msg_add_string(msg, "sAMAccountName", name);
+	}
+	if (ret == LDB_SUCCESS) {
+		ret = ldb_msg_add_fmt(msg, "userPrincipalName",
+				      "%s@example.com", name);
+	}
+	if (ret == LDB_SUCCESS) {
+		ret = ldb_msg_add_fmt(msg, "description",
+				      "Benchmark user number %u", i);
+	}
+	if (ret == LDB_SUCCESS) {
+		ret = ldb_msg_add_string(msg, "userAccountControl", "512");
+	}
+	if (ret == LDB_SUCCESS) {
+		ret = add_guid(msg, 1, i);
+	}
+	if (ret == LDB_SUCCESS && config->linked && config->num_groups > 0) {
+		struct ldb_dn *dn = group_dn(msg, basedn,
+					     i % config->num_groups);
+		ret = ldb_msg_add_linearized_dn(msg, "memberOf", dn);
+	}
+	if (ret == LDB_SUCCESS) {
+		ret = ldb_add(ldb, msg);
+	}
+	check(ldb, ret, "Add", msg->dn);
+
+	talloc_free(tmp_ctx);
+}
+
+/*
+ * group j holds the users with i % num_groups == j.  Groups are nested
+ * in chains of config->nesting: group j is a member of group j - 1
+ * unless j is a multiple of the nesting depth.
+ */
+static bool group_nested(const struct bench_config *config, unsigned int j)
+{
+	return config->nesting > 1 && (j % config->nesting) != 0;
+}
+
+static void add_group(struct ldb_context *ldb, struct ldb_dn *basedn,
+		      const struct bench_config *config, unsigned int j)
+{
+	TALLOC_CTX *tmp_ctx = talloc_new(ldb);
+	struct ldb_message *msg;
+	char *name = talloc_asprintf(tmp_ctx, "group%u", j);
+	unsigned int i;
+	int ret;
+
+	msg = ldb_msg_new(tmp_ctx);
+	if (name == NULL || msg == NULL) {
+		printf("Out of memory adding group%u\n", j);
+		exit(LDB_ERR_OPERATIONS_ERROR);
+	}
+	msg->dn = group_dn(msg, basedn, j);
+
+	ret = add_strings(msg, "objectClass",
+			  (const char * const []) { "top", "group", NULL });
+	if (ret == LDB_SUCCESS) {
+		ret = ldb_msg_add_string(msg, "cn", name);
+	}
+	if (ret == LDB_SUCCESS) {
+		ret = ldb_msg_add_string(msg, "sAMAccountName", name);
+	}
+	if (ret == LDB_SUCCESS) {
+		ret = ldb_msg_add_string(msg, "groupType", "-2147483646");
+	}
+	if (ret == LDB_SUCCESS) {
+		ret = add_guid(msg, 2, j);
+	}
+	for (i = j; ret == LDB_SUCCESS && i < config->num_users;
+	     i += config->num_groups) {
+		ret = ldb_msg_add_linearized_dn(msg, "member",
+						user_dn(msg, basedn, i));
+	}
+	if (ret == LDB_SUCCESS && j + 1 < config->num_groups &&
+	    group_nested(config, j + 1)) {
+		ret = ldb_msg_add_linearized_dn(msg, "member",
+						group_dn(msg, basedn, j + 1));
+	}
+	if (ret == LDB_SUCCESS && config->linked && group_nested(config, j)) {
+		ret = ldb_msg_add_linearized_dn(msg, "memberOf",
+						group_dn(msg, basedn, j - 1));
+	}
+	if (ret == LDB_SUCCESS) {
+		ret = ldb_add(ldb, msg);
+	}
+	check(ldb, ret, "Add", msg->dn);
+
+	talloc_free(tmp_ctx);
+}
+
+static void populate(struct ldb_context *ldb, struct ldb_dn *basedn,
+		     const struct bench_config *config)
+{
+	unsigned int count = config->num_users + config->num_groups;
+	unsigned int i;
+	double secs;
+
+	check(ldb, ldb_transaction_start(ldb), "Transaction start", NULL);
+	add_indexes(ldb, config);
+	add_containers(ldb, basedn);
+	check(ldb, ldb_transaction_commit(ldb), "Transaction commit", NULL);
+
+	_start_timer();
+	for (i = 0; i < count; i++) {
+		if (i % config->batch_size == 0) {
+			check(ldb, ldb_transaction_start(ldb),
+			      "Transaction start", NULL);
+		}
+		if (i < config->num_users) {
+			add_user(ldb, basedn, config, i);
+		} else {
+			add_group(ldb, basedn, config,
+				  i - config->num_users);
+		}
+		if ((i + 1) % config->batch_size == 0 || i + 1 == count) {
+			check(ldb, ldb_transaction_commit(ldb),
+			      "Transaction commit", NULL);
+		}
+	}
+	secs = _end_timer();
+	report("add", count, secs);
+}
+
+static void search_accounts(struct ldb_context *ldb, struct ldb_dn *basedn,
+			    const struct bench_config *config)
+{
+	const char *attrs[] = { "objectGUID", "userAccountControl", NULL };
+	unsigned int i;
+	double secs;
+
+	_start_timer();
+	for (i = 0; i < config->num_searches; i++) {
+		unsigned int u = random() % config->num_users;
+		struct ldb_result *res = NULL;
+		int ret;
+
+		ret = ldb_search(ldb, ldb, &res, basedn, LDB_SCOPE_SUBTREE,
+				 attrs, "(sAMAccountName=USER%u)", u);
+		if (ret != LDB_SUCCESS || res->count != 1) {
+			printf("Failed to find user%u - %s\n", u,
+			       ldb_errstring(ldb));
+			exit(LDB_ERR_OPERATIONS_ERROR);
+		}
+		talloc_free(res);
+	}
+	secs = _end_timer();
+	report("search sAMAccountName", config->num_searches, secs);
+}
+
+/*
+ * What a token group expansion does without memberOf: walk the member
+ * index upwards from a user until no more (nested) groups turn up.
+ */
+static void expand_memberships(struct ldb_context *ldb, struct ldb_dn *basedn,
+			       const struct bench_config *config)
+{
+	const char *attrs[] = { "objectGUID", NULL };
+	unsigned int searches = 0;
+	unsigned int i;
+	double secs;
+
+	if (config->num_groups == 0) {
+		return;
+	}
+
+	_start_timer();
+	for (i = 0; i < config->num_searches; i++) {
+		TALLOC_CTX *tmp_ctx = talloc_new(ldb);
+		unsigned int u = random() % config->num_users;
+		struct ldb_dn *dn = user_dn(tmp_ctx, basedn, u);
+		unsigned int depth = 0;
+
+		while (dn != NULL && depth <= MAX(config->nesting, 1)) {
+			struct ldb_result *res = NULL;
+			char *member;
+			int ret;
+
+			member = ldb_binary_encode_string(
+				tmp_ctx, ldb_dn_get_linearized(dn));
+			ret = ldb_search(ldb, tmp_ctx, &res, basedn,
+					 LDB_SCOPE_SUBTREE, attrs,
+					 "(member=%s)", member);
+			searches++;
+			if (ret != LDB_SUCCESS || res->count > 1) {
+				printf("Failed to expand groups of user%u - "
+				       "%s\n", u, ldb_errstring(ldb));
+				exit(LDB_ERR_OPERATIONS_ERROR);
+			}
+			dn = res->count == 1 ? res->msgs[0]->dn : NULL;
+			depth++;
+		}
+		if (depth == 0 || dn != NULL) {
+			printf("Unexpected group nesting for user%u\n", u);
+			exit(LDB_ERR_OPERATIONS_ERROR);
+		}
+		talloc_free(tmp_ctx);
+	}
+	secs = _end_timer();
+	report("expand memberships", config->num_searches, secs);
+	report("  member searches", searches, secs);
+}
+
+static void modify_users(struct ldb_context *ldb, struct ldb_dn *basedn,
+			 const struct bench_config *config)
+{
+	unsigned int i;
+	double secs;
+
+	_start_timer();
+	for (i = 0; i < config->num_modifies; i++) {
+		TALLOC_CTX *tmp_ctx = talloc_new(ldb);
+		unsigned int u = random() % config->num_users;
+		struct ldb_message *msg = ldb_msg_new(tmp_ctx);
+		int ret;
+
+		if (msg == NULL) {
+			printf("ldb_msg_new failed\n");
+			exit(LDB_ERR_OPERATIONS_ERROR);
+		}
+		msg->dn = user_dn(msg, basedn, u);
+		ret = ldb_msg_add_empty(msg, "description",
+					LDB_FLAG_MOD_REPLACE, NULL);
+		if (ret == LDB_SUCCESS) {
+			ret = ldb_msg_add_fmt(msg, "description",
+					      "Modified %u times", i);
+		}
+		if (ret == LDB_SUCCESS) {
+			ret = ldb_modify(ldb, msg);
+		}
+		check(ldb, ret, "Modify", msg->dn);
+		talloc_free(tmp_ctx);
+	}
+	secs = _end_timer();
+	report("modify", config->num_modifies, secs);
+}
+
+static int change_link(struct ldb_context *ldb, struct ldb_dn *basedn,
+		       struct ldb_dn *group, unsigned int u,
+		       unsigned int flags, const struct bench_config *config)
+{
+	TALLOC_CTX *tmp_ctx = talloc_new(ldb);
+	struct ldb_dn *user = user_dn(tmp_ctx, basedn, u);
+	struct ldb_message *msg;
+	int ret;
+
+	msg = ldb_msg_new(tmp_ctx);
+	if (msg == NULL) {
+		talloc_free(tmp_ctx);
+		return LDB_ERR_OPERATIONS_ERROR;
+	}
+	msg->dn = group;
+	ret = ldb_msg_add_empty(msg, "member", flags, NULL);
+	if (ret == LDB_SUCCESS) {
+		ret = ldb_msg_add_linearized_dn(msg, "member", user);
+	}
+	if (ret == LDB_SUCCESS) {
+		ret = ldb_modify(ldb, msg);
+	}
+	if (ret != LDB_SUCCESS || !config->linked) {
+		talloc_free(tmp_ctx);
+		return ret;
+	}
+
+	/* the backlink, as the linked attribute code would store it */
+	msg = ldb_msg_new(tmp_ctx);
+	if (msg == NULL) {
+		talloc_free(tmp_ctx);
+		return LDB_ERR_OPERATIONS_ERROR;
+	}
+	msg->dn = user;
+	ret = ldb_msg_add_empty(msg, "memberOf", flags, NULL);
+	if (ret == LDB_SUCCESS) {
+		ret = ldb_msg_add_linearized_dn(msg, "memberOf", group);
+	}
+	if (ret == LDB_SUCCESS) {
+		ret = ldb_modify(ldb, msg);
+	}
+	talloc_free(tmp_ctx);
+	return ret;
+}
+
+/*
+ * Grow one group to config->large_group members a link at a time and
+ * shrink it again, each change in its own transaction.  The record is
+ * rewritten every time, so the cost per change grows with the group.
+ */
+static void large_group(struct ldb_context *ldb, struct ldb_dn *basedn,
+			const struct bench_config *config)
+{
+	TALLOC_CTX *tmp_ctx = talloc_new(ldb);
+	struct ldb_dn *group = large_group_dn(tmp_ctx, basedn);
+	struct ldb_message *msg;
+	unsigned int quarter = config->large_group / 4;
+	unsigned int i;
+	double secs;
+	int ret;
+
+	if (config->large_group == 0) {
+		talloc_free(tmp_ctx);
+		return;
+	}
+
+	msg = ldb_msg_new(tmp_ctx);
+	if (msg == NULL) {
+		printf("ldb_msg_new failed\n");
+		exit(LDB_ERR_OPERATIONS_ERROR);
+	}
+	msg->dn = group;
+	ret = add_strings(msg, "objectClass",
+			  (const char * const []) { "top", "group", NULL });
+	if (ret == LDB_SUCCESS) {
+		ret = ldb_msg_add_string(msg, "sAMAccountName", "Large Group");
+	}
+	if (ret == LDB_SUCCESS) {
+		ret = add_guid(msg, 3, 0);
+	}
+	if (ret == LDB_SUCCESS) {
+		ret = ldb_add(ldb, msg);
+	}
+	check(ldb, ret, "Add", group);
+
+	_start_timer();
+	for (i = 0; i < config->large_group; i++) {
+		check(ldb, ldb_transaction_start(ldb),
+		      "Transaction start", NULL);
+		ret = change_link(ldb, basedn, group, i,
+				  LDB_FLAG_MOD_ADD, config);
+		check(ldb, ret, "Member add", group);
+		check(ldb, ldb_transaction_commit(ldb),
+		      "Transaction commit", NULL);
+
+		if (quarter > 0 && (i + 1) % quarter == 0 &&
+		    i + 1 != config->large_group) {
+			printf("  %u members after %.3f seconds\n",
+			       i + 1, _end_timer());
+		}
+	}
+	secs = _end_timer();
+	report("large group member add", config->large_group, secs);
+
+	_start_timer();
+	for (i = 0; i < config->large_group; i++) {
+		unsigned int u = config->large_group - 1 - i;
+
+		check(ldb, ldb_transaction_start(ldb),
+		      "Transaction start", NULL);
+		ret = change_link(ldb, basedn, group, u,
+				  LDB_FLAG_MOD_DELETE, config);
+		check(ldb, ret, "Member delete", group);
+		check(ldb, ldb_transaction_commit(ldb),
+		      "Transaction commit", NULL);
+	}
+	secs = _end_timer();
+	report("large group member del", config->large_group, secs);
+
+	check(ldb, ldb_delete(ldb, group), "Delete", group);
+
+	talloc_free(tmp_ctx);
+}
+
+static void transactions(struct ldb_context *ldb, struct ldb_dn *basedn,
+			 const struct bench_config *config)
+{
+	unsigned int i, j;
+	double secs;
+
+	_start_timer();
+	for (i = 0; i < config->num_transactions; i++) {
+		check(ldb, ldb_transaction_start(ldb),
+		      "Transaction start", NULL);
+		for (j = 0; j < config->batch_size; j++) {
+			TALLOC_CTX *tmp_ctx = talloc_new(ldb);
+			unsigned int u = random() % config->num_users;
+			struct ldb_message *msg = ldb_msg_new(tmp_ctx);
+			int ret;
+
+			if (msg == NULL) {
+				printf("ldb_msg_new failed\n");
+				exit(LDB_ERR_OPERATIONS_ERROR);
+			}
+			msg->dn = user_dn(msg, basedn, u);
+			ret = ldb_msg_add_empty(msg, "userAccountControl",
+						LDB_FLAG_MOD_REPLACE, NULL);
+			if (ret == LDB_SUCCESS) {
+				ret = ldb_msg_add_fmt(msg,
+						      "userAccountControl",
+						      "%u", (i & 1) ? 514 : 512);
+			}
+			if (ret == LDB_SUCCESS) {
+				ret = ldb_modify(ldb, msg);
+			}
+			check(ldb, ret, "Modify", msg->dn);
+			talloc_free(tmp_ctx);
+		}
+		check(ldb, ldb_transaction_commit(ldb),
+		      "Transaction commit", NULL);
+	}
+	secs = _end_timer();
+	report("transaction commit", config->num_transactions, secs);
+}
+
+static void parse_config(struct bench_config *config)
+{
+	int i;
+
+	config->num_users = options->num_records > 0 ?
+		options->num_records : 10000;
+	config->num_searches = options->num_searches > 0 ?
+		options->num_searches : 10000;
+	config->num_groups = config->num_users / 20;
+	config->nesting = 3;
+	config->large_group = MIN(config->num_users, 2000);
+	config->num_modifies = config->num_searches;
+	config->num_transactions = 1000;
+	config->batch_size = 100;
+	config->guid_index = true;
+	config->linked = true;
+
+	for (i = 0; i < options->argc; i++) {
+		const char *arg = options->argv[i];
+		const char *eq = strchr(arg, '=');
+		unsigned long val;
+		char *end = NULL;
+
+		if (eq == NULL) {
+			printf("Invalid argument %s, expected name=value\n",
+			       arg);
+			exit(LDB_ERR_OPERATIONS_ERROR);
+		}
+		val = strtoul(eq + 1, &end, 10);
+		if (end == eq + 1 || *end != '\0' || val > UINT_MAX) {
+			printf("Invalid value in %s\n", arg);
+			exit(LDB_ERR_OPERATIONS_ERROR);
+		}
+
+#define BENCH_ARG(_name, _field) \
+		if (strncmp(arg, _name "=", eq - arg + 1) == 0) { \
+			config->_field = val; \
+			continue; \
+		}
+		BENCH_ARG("groups", num_groups);
+		BENCH_ARG("nesting", nesting);
+		BENCH_ARG("largegroup", large_group);
+		BENCH_ARG("modifies", num_modifies);
+		BENCH_ARG("transactions", num_transactions);
+		BENCH_ARG("batch", batch_size);
+		BENCH_ARG("guidindex", guid_index);
+		BENCH_ARG("linked", linked);
+#undef BENCH_ARG
+
+		printf("Unknown argument %s\n", arg);
+		exit(LDB_ERR_OPERATIONS_ERROR);
+	}
+
+	if (config->large_group > config->num_users) {
+		config->large_group = config->num_users;
+	}
+	if (config->batch_size == 0) {
+		config->batch_size = 1;
+	}
+}
+
+static void usage(struct ldb_context *ldb)
+{
+	printf("Usage: ldbbench <options> [name=value ...]\n");
+	printf("Options:\n");
+	printf("  -H ldb_url       choose the database (or $LDB_URL)\n");
+	printf("  --num-records  nusers        number of users (10000)\n");
+	printf("  --num-searches nsearches     number of searches (10000)\n");
+	printf("  --nosync                     non-synchronous transactions\n");
+	printf("Dataset and test sizes:\n");
+	printf("  groups=N         number of groups (nusers / 20)\n");
+	printf("  nesting=N        length of the group nesting chains (3)\n");
+	printf("  largegroup=N     members of the large group (2000)\n");
+	printf("  modifies=N       single record modifies (nsearches)\n");
+	printf("  transactions=N   transactions to commit (1000)\n");
+	printf("  batch=N          records per transaction (100)\n");
+	printf("  guidindex=0|1    use the GUID index like AD (1)\n");
+	printf("  linked=0|1       maintain memberOf backlinks (1)\n");
+	printf("\n");
+	printf("benchmarks an empty ldb with an AD shaped dataset\n\n");
+	exit(LDB_ERR_OPERATIONS_ERROR);
+}
+
+int main(int argc, const char **argv)
+{
+	TALLOC_CTX *mem_ctx = talloc_new(NULL);
+	struct ldb_context *ldb;
+	struct bench_config config;
+	struct ldb_dn *basedn;
+	struct ldb_result *res = NULL;
+	int ret;
+
+	ldb = ldb_init(mem_ctx, NULL);
+	if (ldb == NULL) {
+		return LDB_ERR_OPERATIONS_ERROR;
+	}
+
+	options = ldb_cmdline_process(ldb, argc, argv, usage);
+
+	talloc_steal(mem_ctx, options);
+
+	if (options->basedn == NULL) {
+		options->basedn = "DC=bench,DC=example,DC=com";
+	}
+
+	parse_config(&config);
+
+	basedn = ldb_dn_new(ldb, ldb, options->basedn);
+	if ( ! ldb_dn_validate(basedn)) {
+		printf("Invalid base DN format\n");
+		exit(LDB_ERR_INVALID_DN_SYNTAX);
+	}
+
+	ret = ldb_search(ldb, ldb, &res, basedn, LDB_SCOPE_BASE, NULL, NULL);
+	if (ret == LDB_SUCCESS && res->count > 0) {
+		printf("%s already exists in %s, "
+		       "ldbbench needs an empty database\n",
+		       options->basedn, options->url);
+		exit(LDB_ERR_ENTRY_ALREADY_EXISTS);
+	}
+	if (ret != LDB_SUCCESS && ret != LDB_ERR_NO_SUCH_OBJECT) {
+		printf("Search of %s failed - %s\n",
+		       options->basedn, ldb_errstring(ldb));
+		exit(LDB_ERR_OPERATIONS_ERROR);
+	}
+	TALLOC_FREE(res);
+
+	srandom(1);
+
+	printf("Benchmarking %s with users=%u groups=%u nesting=%u "
+	       "largegroup=%u guidindex=%d linked=%d\n",
+	       options->url, config.num_users, config.num_groups,
+	       config.nesting, config.large_group,
+	       config.guid_index, config.linked);
+
+	populate(ldb, basedn, &config);
+	search_accounts(ldb, basedn, &config);
+	expand_memberships(ldb, basedn, &config);
+	modify_users(ldb, basedn, &config);
+	large_group(ldb, basedn, &config);
+	transactions(ldb, basedn, &config);
+
+	talloc_free(mem_ctx);
+
+	return LDB_SUCCESS;
+}
@@ -277,6 +277,9 @@ enum mangled_names_options {MANGLED_NAMES_NO, MANGLED_NAMES_YES, MANGLED_NAMES_I
 	char *szService;						\
 	struct parmlist_entry *param_opt;				\
 	struct bitmap *copymap;						\
+	uint32_t load_generation;					\
+	uint64_t section_hash;						\
+	bool section_hash_valid;					\
 	char dummy[3];		/* for alignment */
 
 #include "lib/param/param_local.h"
@@ -37,6 +37,17 @@ struct pthreadpool_job {
 	void *private_data;
 };
 
+/*
+ * FIFO of jobs, a ring buffer
+ */
+struct pthreadpool_queue {
+	size_t jobs_array_len;
+	struct pthreadpool_job *jobs;
+
+	size_t head;
+	size_t num_jobs;
+};
+
 struct pthreadpool {
 	/*
 	 * List pthreadpools for fork safety
@@ -54,14 +65,17 @@ struct pthreadpool {
 	pthread_cond_t condvar;
 
 	/*
-	 * Array of jobs
+	 * One queue per enum pthreadpool_prio, num_jobs is the sum of
+	 * all of them
 	 */
-	size_t jobs_array_len;
-	struct pthreadpool_job *jobs;
-
-	size_t head;
+	struct pthreadpool_queue queues[PTHREADPOOL_NUM_PRIOS];
 	size_t num_jobs;
 
+	/*
+	 * High priority jobs taken while normal ones were waiting
+	 */
+	unsigned num_high_in_row;
+
 	/*
 	 * Indicate job completion
 	 */
@@ -121,6 +135,16 @@ static pthread_once_t pthreadpool_atfork_initialized = PTHREAD_ONCE_INIT;
 
 static void pthreadpool_prep_atfork(void);
 
+static void pthreadpool_free_queues(struct pthreadpool *pool)
+{
+	size_t i;
+
+	for (i=0; i<PTHREADPOOL_NUM_PRIOS; i++) {
+		free(pool->queues[i].jobs);
+		pool->queues[i].jobs = NULL;
+	}
+}
+
 /*
  * Initialize a thread pool
  */
@@ -133,6 +157,7 @@ int pthreadpool_init(unsigned max_threads, struct pthreadpool **presult,
 		     void *signal_fn_private_data)
 {
 	struct pthreadpool *pool;
+	size_t i;
 	int ret;
 
 	pool = (struct pthreadpool *)malloc(sizeof(struct pthreadpool));
@@ -142,20 +167,29 @@ int pthreadpool_init(unsigned max_threads, struct pthreadpool **presult,
 	pool->signal_fn = signal_fn;
 	pool->signal_fn_private_data = signal_fn_private_data;
 
-	pool->jobs_array_len = 4;
-	pool->jobs = calloc(
-		pool->jobs_array_len, sizeof(struct pthreadpool_job));
+	for (i=0; i<PTHREADPOOL_NUM_PRIOS; i++) {
+		struct pthreadpool_queue *q = &pool->queues[i];
 
-	if (pool->jobs == NULL) {
-		free(pool);
-		return ENOMEM;
+		q->jobs_array_len = 4;
+		q->jobs = calloc(
+			q->jobs_array_len, sizeof(struct pthreadpool_job));
+		q->head = q->num_jobs = 0;
+	}
+
+	for (i=0; i<PTHREADPOOL_NUM_PRIOS; i++) {
+		if (pool->queues[i].jobs == NULL) {
+			pthreadpool_free_queues(pool);
+			free(pool);
+			return ENOMEM;
+		}
 	}
 
-	pool->head = pool->num_jobs = 0;
+	pool->num_jobs = 0;
+	pool->num_high_in_row = 0;
 
 	ret = pthread_mutex_init(&pool->mutex, NULL);
 	if (ret != 0) {
-		free(pool->jobs);
+		pthreadpool_free_queues(pool);
 		free(pool);
 		return ret;
 	}
@@ -163,7 +197,7 @@ int pthreadpool_init(unsigned max_threads, struct pthreadpool **presult,
 	ret = pthread_cond_init(&pool->condvar, NULL);
 	if (ret != 0) {
 		pthread_mutex_destroy(&pool->mutex);
-		free(pool->jobs);
+		pthreadpool_free_queues(pool);
 		free(pool);
 		return ret;
 	}
@@ -172,7 +206,7 @@ int pthreadpool_init(unsigned max_threads, struct pthreadpool **presult,
 	if (ret != 0) {
 		pthread_cond_destroy(&pool->condvar);
 		pthread_mutex_destroy(&pool->mutex);
-		free(pool->jobs);
+		pthreadpool_free_queues(pool);
 		free(pool);
 		return ret;
 	}
@@ -189,7 +223,7 @@ int pthreadpool_init(unsigned max_threads, struct pthreadpool **presult,
 		pthread_mutex_destroy(&pool->fork_mutex);
 		pthread_cond_destroy(&pool->condvar);
 		pthread_mutex_destroy(&pool->mutex);
-		free(pool->jobs);
+		pthreadpool_free_queues(pool);
 		free(pool);
 		return ret;
 	}
@@ -338,10 +372,16 @@ static void pthreadpool_child(void)
 	     pool != NULL;
 	     pool = DLIST_PREV(pool)) {
 
+		size_t i;
+
 		pool->num_threads = 0;
 		pool->num_idle = 0;
-		pool->head = 0;
+		for (i=0; i<PTHREADPOOL_NUM_PRIOS; i++) {
+			pool->queues[i].head = 0;
+			pool->queues[i].num_jobs = 0;
+		}
 		pool->num_jobs = 0;
+		pool->num_high_in_row = 0;
 		pool->stopped = true;
 
 		ret = pthread_cond_init(&pool->condvar, NULL);
@@ -395,7 +435,7 @@ static int pthreadpool_free(struct pthreadpool *pool)
 		return ret2;
 	}
 
-	free(pool->jobs);
+	pthreadpool_free_queues(pool);
 	free(pool);
 
 	return 0;
@@ -503,9 +543,18 @@ static void pthreadpool_server_exit(struct pthreadpool *pool)
 	}
 }
 
+/*
+ * Take the next job, preferring high priority ones. Normal priority
+ * jobs still get a turn every PTHREADPOOL_MAX_HIGH_IN_ROW jobs.
+ */
+
 static bool pthreadpool_get_job(struct pthreadpool *p,
 				struct pthreadpool_job *job)
 {
+	struct pthreadpool_queue *high = &p->queues[PTHREADPOOL_PRIO_HIGH];
+	struct pthreadpool_queue *normal = &p->queues[PTHREADPOOL_PRIO_NORMAL];
+	struct pthreadpool_queue *q;
+
 	if (p->stopped) {
 		return false;
 	}
@@ -513,29 +562,49 @@ static bool pthreadpool_get_job(struct pthreadpool *p,
 	if (p->num_jobs == 0) {
 		return false;
 	}
-	*job = p->jobs[p->head];
-	p->head = (p->head+1) % p->jobs_array_len;
+
+	if (high->num_jobs == 0) {
+		q = normal;
+	} else if (normal->num_jobs == 0) {
+		q = high;
+	} else if (p->num_high_in_row >= PTHREADPOOL_MAX_HIGH_IN_ROW) {
+		q = normal;
+	} else {
+		q = high;
+	}
+
+	if ((q == high) && (normal->num_jobs != 0)) {
+		p->num_high_in_row += 1;
+	} else {
+		p->num_high_in_row = 0;
+	}
+
+	*job = q->jobs[q->head];
+	q->head = (q->head+1) % q->jobs_array_len;
+	q->num_jobs -= 1;
 	p->num_jobs -= 1;
 	return true;
 }
 
 static bool pthreadpool_put_job(struct pthreadpool *p,
+				enum pthreadpool_prio prio,
 				int id,
 				void (*fn)(void *private_data),
 				void *private_data)
 {
+	struct pthreadpool_queue *q = &p->queues[prio];
 	struct pthreadpool_job *job;
 
-	if (p->num_jobs == p->jobs_array_len) {
+	if (q->num_jobs == q->jobs_array_len) {
 		struct pthreadpool_job *tmp;
-		size_t new_len = p->jobs_array_len * 2;
+		size_t new_len = q->jobs_array_len * 2;
 
 		tmp = realloc(
-			p->jobs, sizeof(struct pthreadpool_job) * new_len);
+			q->jobs, sizeof(struct pthreadpool_job) * new_len);
 		if (tmp == NULL) {
 			return false;
 		}
-		p->jobs = tmp;
+		q->jobs = tmp;
 
 		/*
 		 * We just doubled the jobs array. The array implements a FIFO
@@ -546,24 +615,27 @@ static bool pthreadpool_put_job(struct pthreadpool *p,
 		 * copy everything before the current head job into the new
 		 * area.
 		 */
-		memcpy(&p->jobs[p->jobs_array_len], p->jobs,
-		       sizeof(struct pthreadpool_job) * p->head);
+		memcpy(&q->jobs[q->jobs_array_len], q->jobs,
+		       sizeof(struct pthreadpool_job) * q->head);
 
-		p->jobs_array_len = new_len;
+		q->jobs_array_len = new_len;
 	}
 
-	job = &p->jobs[(p->head + p->num_jobs) % p->jobs_array_len];
+	job = &q->jobs[(q->head + q->num_jobs) % q->jobs_array_len];
 	job->id = id;
 	job->fn = fn;
 	job->private_data = private_data;
 
+	q->num_jobs += 1;
 	p->num_jobs += 1;
 
 	return true;
 }
 
-static void pthreadpool_undo_put_job(struct pthreadpool *p)
+static void pthreadpool_undo_put_job(struct pthreadpool *p,
+				     enum pthreadpool_prio prio)
 {
+	p->queues[prio].num_jobs -= 1;
 	p->num_jobs -= 1;
 }
 
@@ -724,12 +796,25 @@ static int pthreadpool_create_thread(struct pthreadpool *pool)
 
 int pthreadpool_add_job(struct pthreadpool *pool, int job_id,
 			void (*fn)(void *private_data), void *private_data)
+{
+	return pthreadpool_add_job_prio(pool, job_id, PTHREADPOOL_PRIO_NORMAL,
+					fn, private_data);
+}
+
+int pthreadpool_add_job_prio(struct pthreadpool *pool, int job_id,
+			     enum pthreadpool_prio prio,
+			     void (*fn)(void *private_data),
+			     void *private_data)
 {
 	int res;
 	int unlock_res;
 
 	assert(!pool->destroyed);
 
+	if ((unsigned)prio >= PTHREADPOOL_NUM_PRIOS) {
+		return EINVAL;
+	}
+
 	res = pthread_mutex_lock(&pool->mutex);
 	if (res != 0) {
 		return res;
@@ -761,7 +846,7 @@ int pthreadpool_add_job(struct pthreadpool *pool, int job_id,
 	/*
 	 * Add job to the end of the queue
 	 */
-	if (!pthreadpool_put_job(pool, job_id, fn, private_data)) {
+	if (!pthreadpool_put_job(pool, prio, job_id, fn, private_data)) {
 		unlock_res = pthread_mutex_unlock(&pool->mutex);
 		assert(unlock_res == 0);
 		return ENOMEM;
@@ -773,7 +858,7 @@ int pthreadpool_add_job(struct pthreadpool *pool, int job_id,
 		 */
 		res = pthread_cond_signal(&pool->condvar);
 		if (res != 0) {
-			pthreadpool_undo_put_job(pool);
+			pthreadpool_undo_put_job(pool, prio);
 		}
 		unlock_res = pthread_mutex_unlock(&pool->mutex);
 		assert(unlock_res == 0);
@@ -810,7 +895,7 @@ int pthreadpool_add_job(struct pthreadpool *pool, int job_id,
 	 * No thread could be created to run job, fallback to sync
 	 * call.
 	 */
-	pthreadpool_undo_put_job(pool);
+	pthreadpool_undo_put_job(pool, prio);
 
 	unlock_res = pthread_mutex_unlock(&pool->mutex);
 	assert(unlock_res == 0);
@@ -822,7 +907,7 @@ size_t pthreadpool_cancel_job(struct pthreadpool *pool, int job_id,
 			      void (*fn)(void *private_data), void *private_data)
 {
 	int res;
-	size_t i, j;
+	size_t prio, i, j;
 	size_t num = 0;
 
 	assert(!pool->destroyed);
@@ -832,30 +917,39 @@ size_t pthreadpool_cancel_job(struct pthreadpool *pool, int job_id,
 		return res;
 	}
 
-	for (i = 0, j = 0; i < pool->num_jobs; i++) {
-		size_t idx = (pool->head + i) % pool->jobs_array_len;
-		size_t new_idx = (pool->head + j) % pool->jobs_array_len;
-		struct pthreadpool_job *job = &pool->jobs[idx];
+	for (prio = 0; prio < PTHREADPOOL_NUM_PRIOS; prio++) {
+		struct pthreadpool_queue *q = &pool->queues[prio];
+		size_t q_num = 0;
+
+		for (i = 0, j = 0; i < q->num_jobs; i++) {
+			size_t idx = (q->head + i) % q->jobs_array_len;
+			size_t new_idx = (q->head + j) % q->jobs_array_len;
+			struct pthreadpool_job *job = &q->jobs[idx];
+
+			if ((job->private_data == private_data) &&
+			    (job->id == job_id) &&
+			    (job->fn == fn))
+			{
+				/*
+				 * Just skip the entry.
+				 */
+				q_num++;
+				continue;
+			}
 
-		if ((job->private_data == private_data) &&
-		    (job->id == job_id) &&
-		    (job->fn == fn))
-		{
 			/*
-			 * Just skip the entry.
+			 * If we already removed one or more jobs (so j will
+			 * be smaller then i), we need to fill possible gaps
+			 * in the logical list.
 			 */
-			num++;
-			continue;
+			if (j < i) {
+				q->jobs[new_idx] = *job;
+			}
+			j++;
 		}
 
-		/*
-		 * If we already removed one or more jobs (so j will be smaller
-		 * then i), we need to fill possible gaps in the logical list.
-		 */
-		if (j < i) {
-			pool->jobs[new_idx] = *job;
-		}
-		j++;
+		q->num_jobs -= q_num;
+		num += q_num;
 	}
 
 	pool->num_jobs -= num;
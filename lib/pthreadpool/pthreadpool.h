@@ -127,6 +127,43 @@ int pthreadpool_destroy(struct pthreadpool *pool);
 int pthreadpool_add_job(struct pthreadpool *pool, int job_id,
 			void (*fn)(void *private_data), void *private_data);
 
+/**
+ * @brief Job priorities for pthreadpool_add_job_prio()
+ *
+ * Idle threads pick PTHREADPOOL_PRIO_HIGH jobs first. This is meant
+ * for short metadata operations that should not queue behind large
+ * reads and writes. To avoid starving normal jobs, every
+ * PTHREADPOOL_MAX_HIGH_IN_ROW high priority jobs a pending normal
+ * job is run.
+ */
+enum pthreadpool_prio {
+	PTHREADPOOL_PRIO_NORMAL = 0,
+	PTHREADPOOL_PRIO_HIGH = 1,
+};
+
+#define PTHREADPOOL_NUM_PRIOS 2
+#define PTHREADPOOL_MAX_HIGH_IN_ROW 8
+
+/**
+ * @brief Add a job with a priority to a pthreadpool
+ *
+ * pthreadpool_add_job() is the same as pthreadpool_add_job_prio()
+ * with PTHREADPOOL_PRIO_NORMAL.
+ *
+ * @param[in]	pool		The pool to run the job on
+ * @param[in]	job_id		A custom identifier
+ * @param[in]	prio		The job's priority
+ * @param[in]	fn		The function to run asynchronously
+ * @param[in]	private_data	Pointer passed to fn
+ * @return			success: 0, failure: errno
+ *
+ * @see pthreadpool_add_job()
+ */
+int pthreadpool_add_job_prio(struct pthreadpool *pool, int job_id,
+			     enum pthreadpool_prio prio,
+			     void (*fn)(void *private_data),
+			     void *private_data);
+
 /**
  * @brief Try to cancel a job in a pthreadpool
  *
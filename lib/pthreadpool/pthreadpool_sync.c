@@ -78,6 +78,14 @@ int pthreadpool_add_job(struct pthreadpool *pool, int job_id,
 			       pool->signal_fn_private_data);
 }
 
+int pthreadpool_add_job_prio(struct pthreadpool *pool, int job_id,
+			     enum pthreadpool_prio prio,
+			     void (*fn)(void *private_data),
+			     void *private_data)
+{
+	return pthreadpool_add_job(pool, job_id, fn, private_data);
+}
+
 size_t pthreadpool_cancel_job(struct pthreadpool *pool, int job_id,
 			      void (*fn)(void *private_data), void *private_data)
 {
@@ -291,6 +291,15 @@ struct tevent_req *pthreadpool_tevent_job_send(
 	TALLOC_CTX *mem_ctx, struct tevent_context *ev,
 	struct pthreadpool_tevent *pool,
 	void (*fn)(void *private_data), void *private_data)
+{
+	return pthreadpool_tevent_job_send_prio(
+		mem_ctx, ev, pool, PTHREADPOOL_PRIO_NORMAL, fn, private_data);
+}
+
+struct tevent_req *pthreadpool_tevent_job_send_prio(
+	TALLOC_CTX *mem_ctx, struct tevent_context *ev,
+	struct pthreadpool_tevent *pool, enum pthreadpool_prio prio,
+	void (*fn)(void *private_data), void *private_data)
 {
 	struct tevent_req *req;
 	struct pthreadpool_tevent_job_state *state;
@@ -326,9 +335,9 @@ struct tevent_req *pthreadpool_tevent_job_send(
 		return tevent_req_post(req, ev);
 	}
 
-	ret = pthreadpool_add_job(pool->pool, 0,
-				  pthreadpool_tevent_job_fn,
-				  state);
+	ret = pthreadpool_add_job_prio(pool->pool, 0, prio,
+				       pthreadpool_tevent_job_fn,
+				       state);
 	if (tevent_req_error(req, ret)) {
 		return tevent_req_post(req, ev);
 	}
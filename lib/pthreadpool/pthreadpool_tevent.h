@@ -21,6 +21,7 @@
 #define __PTHREADPOOL_TEVENT_H__
 
 #include <tevent.h>
+#include "pthreadpool.h"
 
 struct pthreadpool_tevent;
 
@@ -35,6 +36,11 @@ struct tevent_req *pthreadpool_tevent_job_send(
 	struct pthreadpool_tevent *pool,
 	void (*fn)(void *private_data), void *private_data);
 
+struct tevent_req *pthreadpool_tevent_job_send_prio(
+	TALLOC_CTX *mem_ctx, struct tevent_context *ev,
+	struct pthreadpool_tevent *pool, enum pthreadpool_prio prio,
+	void (*fn)(void *private_data), void *private_data);
+
 int pthreadpool_tevent_job_recv(struct tevent_req *req);
 
 #endif
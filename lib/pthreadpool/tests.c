@@ -106,6 +106,172 @@ static int test_jobs(int num_threads, int num_jobs)
 	return 0;
 }
 
+struct test_prio_state {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int num_done;
+	int order[64];
+	int num_order;
+	int fds[2];
+};
+
+static struct test_prio_state test_prio_state = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+static void test_prio_block(void *private_data)
+{
+	struct test_prio_state *state = &test_prio_state;
+	char c;
+
+	pthread_mutex_lock(&state->mutex);
+	state->num_done = -1;
+	pthread_cond_signal(&state->cond);
+	pthread_mutex_unlock(&state->mutex);
+
+	(void)read(state->fds[0], &c, 1);
+}
+
+static void test_prio_job(void *private_data)
+{
+	struct test_prio_state *state = &test_prio_state;
+
+	/*
+	 * Single worker thread, no locking needed
+	 */
+	state->order[state->num_order++] = *(int *)private_data;
+}
+
+static int test_prio_signal(int jobid, void (*job_fn)(void *private_data),
+			    void *job_private_data, void *private_data)
+{
+	struct test_prio_state *state = &test_prio_state;
+
+	pthread_mutex_lock(&state->mutex);
+	state->num_done += 1;
+	pthread_cond_signal(&state->cond);
+	pthread_mutex_unlock(&state->mutex);
+	return 0;
+}
+
+static int test_prio(void)
+{
+	struct test_prio_state *state = &test_prio_state;
+	struct pthreadpool *pool;
+	int ids[30];
+	int expected[30];
+	int i, n, ret;
+
+	ret = pipe(state->fds);
+	if (ret != 0) {
+		perror("pipe");
+		return -1;
+	}
+
+	ret = pthreadpool_init(1, &pool, test_prio_signal, NULL);
+	if (ret != 0) {
+		fprintf(stderr, "pthreadpool_init failed: %s\n",
+			strerror(ret));
+		return -1;
+	}
+
+	/*
+	 * Occupy the only thread until everything is queued
+	 */
+	state->num_done = 0;
+	ret = pthreadpool_add_job(pool, 0, test_prio_block, NULL);
+	if (ret != 0) {
+		fprintf(stderr, "pthreadpool_add_job failed: %s\n",
+			strerror(ret));
+		return -1;
+	}
+	pthread_mutex_lock(&state->mutex);
+	while (state->num_done != -1) {
+		pthread_cond_wait(&state->cond, &state->mutex);
+	}
+	pthread_mutex_unlock(&state->mutex);
+
+	for (i=0; i<30; i++) {
+		enum pthreadpool_prio prio = PTHREADPOOL_PRIO_NORMAL;
+
+		ids[i] = i;
+		if (i >= 10) {
+			prio = PTHREADPOOL_PRIO_HIGH;
+		}
+		ret = pthreadpool_add_job_prio(pool, 0, prio, test_prio_job,
+					       &ids[i]);
+		if (ret != 0) {
+			fprintf(stderr, "pthreadpool_add_job_prio failed: "
+				"%s\n", strerror(ret));
+			return -1;
+		}
+	}
+
+	if (pthreadpool_queued_jobs(pool) != 30) {
+		fprintf(stderr, "queued_jobs = %zu\n",
+			pthreadpool_queued_jobs(pool));
+		return -1;
+	}
+
+	/*
+	 * Cancelling must find jobs in both queues
+	 */
+	if ((pthreadpool_cancel_job(pool, 0, test_prio_job, &ids[9]) != 1) ||
+	    (pthreadpool_cancel_job(pool, 0, test_prio_job, &ids[29]) != 1)) {
+		fprintf(stderr, "pthreadpool_cancel_job failed\n");
+		return -1;
+	}
+
+	/*
+	 * High priority jobs first, but every
+	 * PTHREADPOOL_MAX_HIGH_IN_ROW jobs a normal one runs
+	 */
+	n = 0;
+	for (i=10; i<29; i++) {
+		expected[n++] = i;
+		if ((i-10) % PTHREADPOOL_MAX_HIGH_IN_ROW ==
+		    PTHREADPOOL_MAX_HIGH_IN_ROW - 1) {
+			expected[n++] = (i-10) / PTHREADPOOL_MAX_HIGH_IN_ROW;
+		}
+	}
+	for (i=(n-19); i<9; i++) {
+		expected[n++] = i;
+	}
+
+	(void)write(state->fds[1], "", 1);
+
+	pthread_mutex_lock(&state->mutex);
+	while (state->num_done < 28) {
+		pthread_cond_wait(&state->cond, &state->mutex);
+	}
+	pthread_mutex_unlock(&state->mutex);
+
+	if (state->num_order != n) {
+		fprintf(stderr, "ran %d jobs, expected %d\n",
+			state->num_order, n);
+		return -1;
+	}
+	for (i=0; i<n; i++) {
+		if (state->order[i] != expected[i]) {
+			fprintf(stderr, "job %d: got %d, expected %d\n",
+				i, state->order[i], expected[i]);
+			return -1;
+		}
+	}
+
+	ret = pthreadpool_destroy(pool);
+	if (ret != 0) {
+		fprintf(stderr, "pthreadpool_destroy failed: %s\n",
+			strerror(ret));
+		return -1;
+	}
+
+	close(state->fds[0]);
+	close(state->fds[1]);
+	return 0;
+}
+
 static int test_busydestroy(void)
 {
 	struct pthreadpool_pipe *p;
@@ -488,6 +654,12 @@ int main(void)
 		return 1;
 	}
 
+	ret = test_prio();
+	if (ret != 0) {
+		fprintf(stderr, "test_prio failed\n");
+		return 1;
+	}
+
 	ret = test_busydestroy();
 	if (ret != 0) {
 		fprintf(stderr, "test_busydestroy failed\n");
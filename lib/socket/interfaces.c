@@ -168,6 +168,49 @@ static void query_iface_speed_from_name(const char *name, uint64_t *speed)
 	}
 	*speed = ((uint64_t)ethtool_cmd_speed(&ecmd)) * 1000 * 1000;
 
+done:
+	(void)close(fd);
+}
+
+/*
+ * A NIC with more than one receive queue spreads incoming
+ * connections across CPUs, which is what "RSS capable" means
+ * to an SMB3 multichannel client.
+ */
+static void query_iface_rx_queues_from_name(const char *name,
+					    uint32_t *capability)
+{
+	int ret = 0;
+	struct ethtool_channels channels;
+	struct ifreq ifr;
+	int fd;
+
+	fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+	if (fd == -1) {
+		DBG_ERR("Failed to open socket.");
+		return;
+	}
+
+	if (strlen(name) >= IF_NAMESIZE) {
+		DBG_ERR("Interface name too long.");
+		goto done;
+	}
+
+	ZERO_STRUCT(ifr);
+	strlcpy(ifr.ifr_name, name, IF_NAMESIZE);
+
+	ZERO_STRUCT(channels);
+	channels.cmd = ETHTOOL_GCHANNELS;
+	ifr.ifr_data = (void *)&channels;
+	ret = ioctl(fd, SIOCETHTOOL, &ifr);
+	if (ret == -1) {
+		goto done;
+	}
+
+	if ((channels.rx_count + channels.combined_count) > 1) {
+		*capability |= FSCTL_NET_IFACE_RSS_CAPABLE;
+	}
+
 done:
 	(void)close(fd);
 }
@@ -215,6 +258,7 @@ static int _get_interfaces(TALLOC_CTX *mem_ctx, struct iface_struct **pifaces)
 	/* Loop through interfaces, looking for given IP address */
 	for (ifptr = iflist; ifptr != NULL; ifptr = ifptr->ifa_next) {
 		uint64_t if_speed = 1000 * 1000 * 1000; /* 1Gbps */
+		uint32_t if_capability = FSCTL_NET_IFACE_NONE_CAPABLE;
 
 		if (!ifptr->ifa_addr || !ifptr->ifa_netmask) {
 			continue;
@@ -276,9 +320,11 @@ static int _get_interfaces(TALLOC_CTX *mem_ctx, struct iface_struct **pifaces)
 
 #ifdef HAVE_ETHTOOL
 		query_iface_speed_from_name(ifptr->ifa_name, &if_speed);
+		query_iface_rx_queues_from_name(ifptr->ifa_name,
+						&if_capability);
 #endif
 		ifaces[total].linkspeed = if_speed;
-		ifaces[total].capability = FSCTL_NET_IFACE_NONE_CAPABLE;
+		ifaces[total].capability = if_capability;
 
 		if (strlcpy(ifaces[total].name, ifptr->ifa_name,
 			sizeof(ifaces[total].name)) >=
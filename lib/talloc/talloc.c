@@ -603,12 +603,18 @@ _PUBLIC_ const char *talloc_parent_name(const void *ptr)
   The object count is not put into "struct talloc_chunk" because it is only
   relevant for talloc pools and the alignment to 16 bytes would increase the
   memory footprint of each talloc chunk by those 16 bytes.
+
+  A talloc slab is a pool with slot_size != 0. Its memory is cut into
+  slots of TC_ALIGN16(TC_HDR_SIZE + slot_size) bytes, freed slots are
+  chained via their tc->next pointer in free_slots.
 */
 
 struct talloc_pool_hdr {
 	void *end;
 	unsigned int object_count;
 	size_t poolsize;
+	size_t slot_size;
+	struct talloc_chunk *free_slots;
 };
 
 #define TP_HDR_SIZE TC_ALIGN16(sizeof(struct talloc_pool_hdr))
@@ -660,6 +666,64 @@ static inline void tc_invalidate_pool(struct talloc_pool_hdr *pool_hdr)
 #endif
 }
 
+/*
+  Allocate a slot from a slab
+*/
+
+static inline struct talloc_chunk *tc_alloc_slab(struct talloc_chunk *parent,
+						 struct talloc_pool_hdr *pool_hdr,
+						 size_t size, size_t prefix_len)
+{
+	struct talloc_chunk *result;
+	size_t chunk_size = TC_ALIGN16(TC_HDR_SIZE + pool_hdr->slot_size);
+
+	/*
+	 * Only direct children of the slab go into slots, everything
+	 * else would waste a slot or not fit.
+	 */
+	if (parent != talloc_chunk_from_pool(pool_hdr)) {
+		return NULL;
+	}
+	if ((prefix_len != 0) || (size > TC_HDR_SIZE + pool_hdr->slot_size)) {
+		return NULL;
+	}
+
+	if (pool_hdr->free_slots != NULL) {
+		result = pool_hdr->free_slots;
+		pool_hdr->free_slots = result->next;
+	} else if (tc_pool_space_left(pool_hdr) >= chunk_size) {
+		result = (struct talloc_chunk *)pool_hdr->end;
+		pool_hdr->end = (void *)((char *)pool_hdr->end + chunk_size);
+	} else {
+		return NULL;
+	}
+
+#if defined(DEVELOPER) && defined(VALGRIND_MAKE_MEM_UNDEFINED)
+	VALGRIND_MAKE_MEM_UNDEFINED(result, chunk_size);
+#endif
+
+	result->flags = talloc_magic | TALLOC_FLAG_POOLMEM;
+	result->pool = pool_hdr;
+
+	pool_hdr->object_count++;
+
+	return result;
+}
+
+/*
+  Put a freed chunk back onto the free list of its slab
+*/
+
+static inline void tc_free_slab_slot(struct talloc_pool_hdr *pool_hdr,
+				     struct talloc_chunk *tc)
+{
+#if defined(DEVELOPER) && defined(VALGRIND_MAKE_MEM_UNDEFINED)
+	VALGRIND_MAKE_MEM_UNDEFINED(&tc->next, sizeof(tc->next));
+#endif
+	tc->next = pool_hdr->free_slots;
+	pool_hdr->free_slots = tc;
+}
+
 /*
   Allocate from a pool
 */
@@ -687,6 +751,10 @@ static inline struct talloc_chunk *tc_alloc_pool(struct talloc_chunk *parent,
 		return NULL;
 	}
 
+	if (unlikely(pool_hdr->slot_size != 0)) {
+		return tc_alloc_slab(parent, pool_hdr, size, prefix_len);
+	}
+
 	space_left = tc_pool_space_left(pool_hdr);
 
 	/*
@@ -828,6 +896,8 @@ static inline void *_talloc_pool(const void *context, size_t size)
 	pool_hdr->object_count = 1;
 	pool_hdr->end = result;
 	pool_hdr->poolsize = size;
+	pool_hdr->slot_size = 0;
+	pool_hdr->free_slots = NULL;
 
 	tc_invalidate_pool(pool_hdr);
 
@@ -905,6 +975,42 @@ overflow:
 	return NULL;
 }
 
+/*
+ * Create a talloc slab with num_objects slots of object_size bytes
+ */
+
+_PUBLIC_ void *talloc_slab(const void *context, size_t object_size,
+			   unsigned num_objects)
+{
+	size_t slot_chunk_size, poolsize;
+	struct talloc_pool_hdr *pool_hdr;
+	void *result;
+
+	if ((object_size >= MAX_TALLOC_SIZE) || (num_objects == 0)) {
+		return NULL;
+	}
+
+	slot_chunk_size = TC_ALIGN16(TC_HDR_SIZE + object_size);
+	if (slot_chunk_size < object_size) {
+		return NULL;
+	}
+
+	poolsize = slot_chunk_size * num_objects;
+	if (poolsize / num_objects != slot_chunk_size) {
+		return NULL;
+	}
+
+	result = _talloc_pool(context, poolsize);
+	if (result == NULL) {
+		return NULL;
+	}
+
+	pool_hdr = talloc_pool_from_chunk(talloc_chunk_from_ptr(result));
+	pool_hdr->slot_size = object_size;
+
+	return result;
+}
+
 /*
   setup a destructor to be called on free of a pointer
   the destructor should return 0 on success, or -1 on failure.
@@ -1033,6 +1139,7 @@ static inline void _tc_free_poolmem(struct talloc_chunk *tc,
 		 * again.
 		 */
 		pool->end = tc_pool_first_chunk(pool);
+		pool->free_slots = NULL;
 		tc_invalidate_pool(pool);
 		return;
 	}
@@ -1061,6 +1168,11 @@ static inline void _tc_free_poolmem(struct talloc_chunk *tc,
 		return;
 	}
 
+	if (pool->slot_size != 0) {
+		tc_free_slab_slot(pool, tc);
+		return;
+	}
+
 	if (pool->end == next_tc) {
 		/*
 		 * if pool->pool still points to end of
@@ -1177,6 +1289,13 @@ static inline int _tc_free_internal(struct talloc_chunk *tc,
 		pool->object_count--;
 
 		if (likely(pool->object_count != 0)) {
+			/*
+			 * The memory stays around until the last
+			 * object in the pool is freed, but the pool
+			 * leaves its hierarchy and the memory limit
+			 * it was accounted to might go away before.
+			 */
+			tc_memlimit_update_on_free(tc);
 			return 0;
 		}
 
@@ -1238,7 +1357,7 @@ static inline size_t _talloc_total_limit_size(const void *ptr,
 */
 static void *_talloc_steal_internal(const void *new_ctx, const void *ptr)
 {
-	struct talloc_chunk *tc, *new_tc;
+	struct talloc_chunk *tc, *new_tc = NULL;
 	size_t ctx_size = 0;
 
 	if (unlikely(!ptr)) {
@@ -1251,17 +1370,30 @@ static void *_talloc_steal_internal(const void *new_ctx, const void *ptr)
 
 	tc = talloc_chunk_from_ptr(ptr);
 
-	if (tc->limit != NULL) {
+	if (new_ctx != NULL) {
+		new_tc = talloc_chunk_from_ptr(new_ctx);
 
-		ctx_size = _talloc_total_limit_size(ptr, NULL, NULL);
+		if (unlikely(tc == new_tc || tc->parent == new_tc)) {
+			return discard_const_p(void, ptr);
+		}
+	}
 
-		/* Decrement the memory limit from the source .. */
-		talloc_memlimit_shrink(tc->limit->upper, ctx_size);
+	if (tc->limit != NULL) {
+		struct talloc_memlimit *old_limit = tc->limit;
 
-		if (tc->limit->parent == tc) {
-			tc->limit->upper = NULL;
+		/* Decrement the memory limit from the source .. */
+		if (old_limit->parent == tc) {
+			ctx_size = _talloc_total_limit_size(ptr, NULL, NULL);
+			talloc_memlimit_shrink(old_limit->upper, ctx_size);
+			old_limit->upper = NULL;
 		} else {
-			tc->limit = NULL;
+			/*
+			 * This also detaches the children of tc from
+			 * old_limit.
+			 */
+			ctx_size = _talloc_total_limit_size(ptr, old_limit,
+							    NULL);
+			talloc_memlimit_shrink(old_limit, ctx_size);
 		}
 	}
 
@@ -1280,12 +1412,6 @@ static void *_talloc_steal_internal(const void *new_ctx, const void *ptr)
 		return discard_const_p(void, ptr);
 	}
 
-	new_tc = talloc_chunk_from_ptr(new_ctx);
-
-	if (unlikely(tc == new_tc || tc->parent == new_tc)) {
-		return discard_const_p(void, ptr);
-	}
-
 	if (tc->parent) {
 		_TLIST_REMOVE(tc->parent->child, tc);
 		if (tc->parent->child) {
@@ -1301,13 +1427,15 @@ static void *_talloc_steal_internal(const void *new_ctx, const void *ptr)
 	if (new_tc->child) new_tc->child->parent = NULL;
 	_TLIST_ADD(new_tc->child, tc);
 
-	if (tc->limit || new_tc->limit) {
-		ctx_size = _talloc_total_limit_size(ptr, tc->limit,
+	/* .. and increment it in the destination. */
+	if (tc->limit != NULL && tc->limit->parent == tc) {
+		/* tc keeps its own limit below the new one */
+		tc->limit->upper = new_tc->limit;
+		talloc_memlimit_grow(new_tc->limit, tc->limit->cur_size);
+	} else if (new_tc->limit != NULL) {
+		ctx_size = _talloc_total_limit_size(ptr, NULL,
 						    new_tc->limit);
-		/* .. and increment it in the destination. */
-		if (new_tc->limit) {
-			talloc_memlimit_grow(new_tc->limit, ctx_size);
-		}
+		talloc_memlimit_grow(new_tc->limit, ctx_size);
 	}
 
 	return discard_const_p(void, ptr);
@@ -1823,6 +1951,35 @@ _PUBLIC_ void *_talloc_realloc(const void *context, void *ptr, size_t size, cons
 		pool_hdr = tc->pool;
 	}
 
+	/*
+	 * A slab slot can't move within the slab, it either still
+	 * fits or the chunk needs to be moved to malloc'ed memory.
+	 */
+	if (unlikely((pool_hdr != NULL) && (pool_hdr->slot_size != 0))) {
+		if (size <= pool_hdr->slot_size) {
+			if (size > tc->size) {
+				TC_UNDEFINE_GROW_CHUNK(tc, size);
+			} else {
+				TC_INVALIDATE_SHRINK_CHUNK(tc, size);
+			}
+			tc->size = size;
+			return ptr;
+		}
+
+		_talloc_chunk_set_free(tc, NULL);
+
+		new_ptr = malloc(TC_HDR_SIZE+size);
+		malloced = true;
+		/* Pool members are not accounted, the new chunk is */
+		new_size = TC_HDR_SIZE+size;
+
+		if (new_ptr) {
+			memcpy(new_ptr, tc, tc->size + TC_HDR_SIZE);
+			_tc_free_poolmem(tc, __location__ "_talloc_realloc");
+		}
+		goto got_new_ptr;
+	}
+
 #if (ALWAYS_REALLOC == 0)
 	/* don't shrink if we have less than 1k to gain */
 	if (size < tc->size && tc->limit == NULL) {
@@ -1884,7 +2041,7 @@ _PUBLIC_ void *_talloc_realloc(const void *context, void *ptr, size_t size, cons
 		if (new_ptr == NULL) {
 			new_ptr = malloc(TC_HDR_SIZE+size);
 			malloced = true;
-			new_size = size;
+			new_size = TC_HDR_SIZE+size;
 		}
 
 		if (new_ptr) {
@@ -2000,7 +2157,7 @@ _PUBLIC_ void *_talloc_realloc(const void *context, void *ptr, size_t size, cons
 		if (new_ptr == NULL) {
 			new_ptr = malloc(TC_HDR_SIZE+size);
 			malloced = true;
-			new_size = size;
+			new_size = TC_HDR_SIZE+size;
 		}
 
 		if (new_ptr) {
@@ -2015,8 +2172,8 @@ _PUBLIC_ void *_talloc_realloc(const void *context, void *ptr, size_t size, cons
 		new_size = size;
 		new_ptr = realloc(tc, size + TC_HDR_SIZE);
 	}
-got_new_ptr:
 #endif
+got_new_ptr:
 	if (unlikely(!new_ptr)) {
 		/*
 		 * Ok, this is a strange spot.  We have to put back
@@ -2136,28 +2293,30 @@ static inline size_t _talloc_total_mem_internal(const void *ptr,
 		total++;
 		break;
 	case TOTAL_MEM_LIMIT:
-		if (likely(tc->name != TALLOC_MAGIC_REFERENCE)) {
-			/*
-			 * Don't count memory allocated from a pool
-			 * when calculating limits. Only count the
-			 * pool itself.
-			 */
-			if (!(tc->flags & TALLOC_FLAG_POOLMEM)) {
-				if (tc->flags & TALLOC_FLAG_POOL) {
-					/*
-					 * If this is a pool, the allocated
-					 * size is in the pool header, and
-					 * remember to add in the prefix
-					 * length.
-					 */
-					struct talloc_pool_hdr *pool_hdr
-							= talloc_pool_from_chunk(tc);
-					total = pool_hdr->poolsize +
-							TC_HDR_SIZE +
-							TP_HDR_SIZE;
-				} else {
-					total = tc->size + TC_HDR_SIZE;
-				}
+		/*
+		 * Unlike for the size reported to the caller,
+		 * reference handles count here: they were malloc'ed
+		 * and are accounted when they are freed.
+		 *
+		 * Don't count memory allocated from a pool
+		 * when calculating limits. Only count the
+		 * pool itself.
+		 */
+		if (!(tc->flags & TALLOC_FLAG_POOLMEM)) {
+			if (tc->flags & TALLOC_FLAG_POOL) {
+				/*
+				 * If this is a pool, the allocated
+				 * size is in the pool header, and
+				 * remember to add in the prefix
+				 * length.
+				 */
+				struct talloc_pool_hdr *pool_hdr
+						= talloc_pool_from_chunk(tc);
+				total = pool_hdr->poolsize +
+						TC_HDR_SIZE +
+						TP_HDR_SIZE;
+			} else {
+				total = tc->size + TC_HDR_SIZE;
 			}
 		}
 		break;
@@ -2950,10 +3109,16 @@ static void tc_memlimit_update_on_free(struct talloc_chunk *tc)
 	/*
 	 * If we're deallocating a pool, take into
 	 * account the prefix size added for the pool.
+	 * tc->size of a pool does not cover the pool
+	 * memory, so use the size the pool was
+	 * accounted with.
 	 */
 
 	if (tc->flags & TALLOC_FLAG_POOL) {
-		limit_shrink_size += TP_HDR_SIZE;
+		struct talloc_pool_hdr *pool_hdr = talloc_pool_from_chunk(tc);
+
+		limit_shrink_size = pool_hdr->poolsize + TC_HDR_SIZE +
+			TP_HDR_SIZE;
 	}
 
 	talloc_memlimit_shrink(tc->limit, limit_shrink_size);
@@ -3000,16 +3165,12 @@ static void talloc_memlimit_shrink(struct talloc_memlimit *limit,
 	}
 }
 
-_PUBLIC_ int talloc_set_memlimit(const void *ctx, size_t max_size)
+static int tc_memlimit_create(const void *ctx, size_t max_size)
 {
 	struct talloc_chunk *tc = talloc_chunk_from_ptr(ctx);
 	struct talloc_memlimit *orig_limit;
 	struct talloc_memlimit *limit = NULL;
 
-	if (tc->limit && tc->limit->parent == tc) {
-		tc->limit->max_size = max_size;
-		return 0;
-	}
 	orig_limit = tc->limit;
 
 	limit = malloc(sizeof(struct talloc_memlimit));
@@ -3028,3 +3189,38 @@ _PUBLIC_ int talloc_set_memlimit(const void *ctx, size_t max_size)
 
 	return 0;
 }
+
+_PUBLIC_ int talloc_set_memlimit(const void *ctx, size_t max_size)
+{
+	struct talloc_chunk *tc = talloc_chunk_from_ptr(ctx);
+
+	if (tc->limit && tc->limit->parent == tc) {
+		tc->limit->max_size = max_size;
+		return 0;
+	}
+
+	return tc_memlimit_create(ctx, max_size);
+}
+
+_PUBLIC_ int talloc_set_accounting(const void *ctx)
+{
+	struct talloc_chunk *tc = talloc_chunk_from_ptr(ctx);
+
+	if (tc->limit && tc->limit->parent == tc) {
+		return 0;
+	}
+
+	/* A max_size of 0 only accounts, it does not limit */
+	return tc_memlimit_create(ctx, 0);
+}
+
+_PUBLIC_ size_t talloc_accounted_size(const void *ctx)
+{
+	struct talloc_chunk *tc = talloc_chunk_from_ptr(ctx);
+
+	if (tc->limit == NULL || tc->limit->parent != tc) {
+		return 0;
+	}
+
+	return tc->limit->cur_size;
+}
@@ -899,6 +899,37 @@ void *_talloc_pooled_object(const void *ctx,
 			    size_t total_subobjects_size);
 #endif
 
+/**
+ * @brief Allocate a talloc slab for objects of a fixed size.
+ *
+ * A talloc slab is a talloc pool that is cut into num_objects slots of
+ * object_size bytes each. Direct children of the slab that fit into a slot
+ * are taken from a free list of slots instead of calling malloc(3). When
+ * such a child is talloc_free()ed, its slot goes back onto the free list
+ * and is reused by the next allocation, no matter how the pool would have
+ * been fragmented otherwise.
+ *
+ * This is meant for hot objects of the same type that are allocated and
+ * freed per request: Allocate the object as a child of the slab and
+ * talloc_steal() it to the parent it belongs to. The object behaves like any
+ * other talloc chunk, destructors and children work as usual. Grandchildren
+ * of the slab, larger objects and allocations when all slots are in use are
+ * done with malloc(3).
+ *
+ * Like with talloc_pool(), the slab memory is only free(3)'ed when the slab
+ * and all objects allocated from it have been talloc_free()ed.
+ *
+ * @param[in]  context     The talloc context to hang the result off.
+ *
+ * @param[in]  object_size The maximum size of the objects in the slab.
+ *
+ * @param[in]  num_objects The number of slots in the slab.
+ *
+ * @return                 The allocated talloc slab, NULL on error.
+ */
+void *talloc_slab(const void *context, size_t object_size,
+		  unsigned num_objects);
+
 /**
  * @brief Free a talloc chunk and NULL out the pointer.
  *
@@ -1923,6 +1954,41 @@ void talloc_set_log_stderr(void);
  */
 int talloc_set_memlimit(const void *ctx, size_t max_size) _DEPRECATED_;
 
+/**
+ * @brief Account the memory used by a talloc hierarchy.
+ *
+ * This uses the bookkeeping of talloc_set_memlimit() without a limit: From
+ * now on every allocation, free, realloc and steal into or out of the
+ * hierarchy below ctx updates a byte counter that talloc_accounted_size()
+ * returns without walking the hierarchy. Children of talloc pools are not
+ * counted individually, the pool counts with its full size.
+ *
+ * Accounting contexts can be nested, the memory of a nested context is also
+ * accounted to all accounting contexts above it. Calling this on a context
+ * that already has a memory limit set does not change the limit. The
+ * accounting ends when ctx is freed.
+ *
+ * @param[in]	ctx		The talloc context to account.
+ *
+ * @return			0 on success, 1 if we are out of memory.
+ *
+ * @see talloc_accounted_size()
+ */
+int talloc_set_accounting(const void *ctx);
+
+/**
+ * @brief Get the memory accounted to a talloc context.
+ *
+ * @param[in]	ctx		The talloc context, set up with
+ *				talloc_set_accounting() or
+ *				talloc_set_memlimit().
+ *
+ * @return			The number of bytes allocated in the
+ *				hierarchy below and including ctx,
+ *				0 if ctx is not an accounting context.
+ */
+size_t talloc_accounted_size(const void *ctx);
+
 /* @} ******************************************************************/
 
 #if TALLOC_DEPRECATED
@@ -1499,6 +1499,80 @@ static bool test_pooled_object(void)
 	return true;
 }
 
+static int slab_destructor_called;
+
+static int slab_destructor(struct pooled *p)
+{
+	slab_destructor_called += 1;
+	return 0;
+}
+
+static bool test_slab(void)
+{
+	void *slab, *parent;
+	struct pooled *p1, *p2, *p3, *p4;
+	char *s;
+
+	printf("test: slab\n# TALLOC SLAB\n");
+
+	parent = talloc_new(NULL);
+	torture_assert("slab", parent != NULL, "talloc_new failed");
+
+	slab = talloc_slab(NULL, sizeof(struct pooled), 2);
+	torture_assert("slab", slab != NULL, "talloc_slab failed");
+
+	p1 = talloc_zero(slab, struct pooled);
+	torture_assert("slab", p1 != NULL, "alloc p1 failed");
+	p2 = talloc_zero(slab, struct pooled);
+	torture_assert("slab", p2 != NULL, "alloc p2 failed");
+	torture_assert("slab", p1 != p2, "slots must differ");
+
+	/* The slab is full, this comes from malloc */
+	p3 = talloc_zero(slab, struct pooled);
+	torture_assert("slab", p3 != NULL, "alloc p3 failed");
+
+	/* Grandchildren are not put into the slab */
+	p1->s1 = talloc_strdup(p1, "hello");
+	torture_assert("slab", p1->s1 != NULL, "strdup failed");
+
+	talloc_steal(parent, p1);
+	talloc_steal(parent, p2);
+	talloc_set_destructor(p1, slab_destructor);
+
+	/* A freed slot is reused for the next object */
+	slab_destructor_called = 0;
+	TALLOC_FREE(p3);
+	talloc_free(p1);
+	torture_assert("slab", slab_destructor_called == 1,
+		       "destructor not called");
+	p4 = talloc_zero(slab, struct pooled);
+	torture_assert("slab", p4 == p1, "freed slot not reused");
+
+	/* Growing beyond the slot size moves out of the slab */
+	TALLOC_FREE(p4);
+	s = talloc_size(slab, 4);
+	torture_assert("slab", s == (char *)p1, "freed slot not reused");
+	s = talloc_realloc(slab, s, char, sizeof(struct pooled));
+	torture_assert("slab", s == (char *)p1, "realloc moved slot");
+	s = talloc_realloc(slab, s, char, sizeof(struct pooled) + 1000);
+	torture_assert("slab", s != NULL, "realloc failed");
+	torture_assert("slab", s != (char *)p1, "realloc did not move");
+	torture_assert("slab",
+		       talloc_get_size(s) == sizeof(struct pooled) + 1000,
+		       "wrong size");
+	p4 = talloc_zero(slab, struct pooled);
+	torture_assert("slab", p4 == p1, "slot not reused after realloc");
+
+	/* The slab memory stays valid for objects stolen out of it */
+	talloc_free(slab);
+	torture_assert("slab", talloc_total_blocks(parent) == 2,
+		       "wrong number of blocks");
+	talloc_free(parent);
+
+	printf("success: slab\n");
+	return true;
+}
+
 static bool test_free_ref_null_context(void)
 {
 	void *p1, *p2, *p3;
@@ -1786,6 +1860,115 @@ static bool test_memlimit(void)
 	return true;
 }
 
+static bool test_accounting(void)
+{
+	void *root, *child, *pool, *other, *p;
+	size_t root_base, base, child_base;
+
+	printf("test: accounting\n# TALLOC ACCOUNTING\n");
+
+	root = talloc_named_const(NULL, 0, "root");
+	other = talloc_named_const(NULL, 0, "other");
+
+	torture_assert("accounting", talloc_accounted_size(root) == 0,
+		       "not an accounting context");
+	torture_assert("accounting", talloc_set_accounting(root) == 0,
+		       "talloc_set_accounting failed");
+	base = talloc_accounted_size(root);
+	torture_assert("accounting", base > 0, "root not accounted");
+	torture_assert("accounting", talloc_set_accounting(root) == 0,
+		       "second talloc_set_accounting failed");
+	torture_assert("accounting", talloc_accounted_size(root) == base,
+		       "second talloc_set_accounting changed the size");
+
+	p = talloc_size(root, 100);
+	torture_assert("accounting", talloc_accounted_size(root) >= base + 100,
+		       "allocation not accounted");
+	p = talloc_realloc_size(root, p, 5000);
+	torture_assert("accounting",
+		       talloc_accounted_size(root) >= base + 5000,
+		       "realloc not accounted");
+	talloc_free(p);
+	torture_assert("accounting", talloc_accounted_size(root) == base,
+		       "free not accounted");
+
+	/* Moving memory in and out of the hierarchy */
+	p = talloc_size(other, 1000);
+	talloc_steal(root, p);
+	torture_assert("accounting",
+		       talloc_accounted_size(root) >= base + 1000,
+		       "steal into the hierarchy not accounted");
+	talloc_steal(other, p);
+	torture_assert("accounting", talloc_accounted_size(root) == base,
+		       "steal out of the hierarchy not accounted");
+
+	/* Nested accounting contexts */
+	root_base = base;
+	child = talloc_named_const(root, 0, "child");
+	torture_assert("accounting", talloc_set_accounting(child) == 0,
+		       "talloc_set_accounting failed");
+	base = talloc_accounted_size(root);
+	child_base = talloc_accounted_size(child);
+	p = talloc_size(child, 200);
+	torture_assert("accounting",
+		       talloc_accounted_size(child) >= child_base + 200,
+		       "nested allocation not accounted");
+	torture_assert("accounting",
+		       talloc_accounted_size(root) - base ==
+		       talloc_accounted_size(child) - child_base,
+		       "nested allocation not accounted in the parent");
+
+	/* Moving within the hierarchy only changes the nested context */
+	talloc_steal(root, p);
+	torture_assert("accounting", talloc_accounted_size(child) == child_base,
+		       "steal out of the nested context not accounted");
+	torture_assert("accounting",
+		       talloc_accounted_size(root) >= base + 200,
+		       "steal within the hierarchy changed the parent");
+	talloc_steal(child, p);
+	torture_assert("accounting",
+		       talloc_accounted_size(root) - base ==
+		       talloc_accounted_size(child) - child_base,
+		       "steal into the nested context not accounted");
+
+	/* Pools count as a whole */
+	pool = talloc_pool(child, 4096);
+	torture_assert("accounting",
+		       talloc_accounted_size(child) >= child_base + 200 + 4096,
+		       "pool not accounted");
+	child_base = talloc_accounted_size(child);
+	p = talloc_size(pool, 100);
+	torture_assert("accounting", talloc_accounted_size(child) == child_base,
+		       "pool member accounted");
+
+	/* Keeps the pool memory around after the accounting is gone */
+	talloc_steal(other, p);
+
+	/* Nested accounting contexts keep their own accounting when moved */
+	base = talloc_accounted_size(root);
+	talloc_steal(other, child);
+	torture_assert("accounting", talloc_accounted_size(child) == child_base,
+		       "moved context lost its accounting");
+	torture_assert("accounting",
+		       talloc_accounted_size(root) == base - child_base,
+		       "moving a nested context out not accounted");
+	talloc_steal(root, child);
+	torture_assert("accounting", talloc_accounted_size(child) == child_base,
+		       "moved context lost its accounting");
+	torture_assert("accounting", talloc_accounted_size(root) == base,
+		       "moving a nested context in not accounted");
+
+	talloc_free(child);
+	torture_assert("accounting", talloc_accounted_size(root) == root_base,
+		       "freeing a nested context not accounted");
+
+	talloc_free(other);
+	talloc_free(root);
+
+	printf("success: accounting\n");
+	return true;
+}
+
 #ifdef HAVE_PTHREAD
 
 #define NUM_THREADS 100
@@ -2091,6 +2274,8 @@ bool torture_local_talloc(struct torture_context *tctx)
 	test_reset();
 	ret &= test_pool_nest();
 	test_reset();
+	ret &= test_slab();
+	test_reset();
 	ret &= test_ref1();
 	test_reset();
 	ret &= test_ref2();
@@ -2144,6 +2329,8 @@ bool torture_local_talloc(struct torture_context *tctx)
 	ret &= test_free_children();
 	test_reset();
 	ret &= test_memlimit();
+	test_reset();
+	ret &= test_accounting();
 #ifdef HAVE_PTHREAD
 	test_reset();
 	ret &= test_pthread_talloc_passing();
@@ -398,6 +398,17 @@ _PUBLIC_ int tdb_check(struct tdb_context *tdb,
 			record_offset(hashes[h], off);
 	}
 
+	/* The size class freelists share the bitmap of the freelist. */
+	if (tdb_have_freelist_bins(tdb)) {
+		for (h = 0; h < TDB_NUM_FREELIST_BINS; h++) {
+			if (tdb_ofs_read(tdb, TDB_FREELIST_BIN_OFS(h),
+					 &off) == -1)
+				goto free;
+			if (off)
+				record_offset(hashes[0], off);
+		}
+	}
+
 	/* For each record, read it in and check it's ok. */
 	for (off = TDB_DATA_START(tdb->hash_size);
 	     off < tdb->map_size;
@@ -109,41 +109,43 @@ _PUBLIC_ int tdb_printfreelist(struct tdb_context *tdb)
 	long total_free = 0;
 	tdb_off_t offset, rec_ptr;
 	struct tdb_record rec;
+	uint32_t i;
 
-	if ((ret = tdb_lock(tdb, -1, F_WRLCK)) != 0)
+	if ((ret = tdb_freelist_lock_all(tdb, F_WRLCK)) != 0)
 		return ret;
 
-	offset = FREELIST_TOP;
-
-	/* read in the freelist top */
-	if (tdb_ofs_read(tdb, offset, &rec_ptr) == -1) {
-		tdb_unlock(tdb, -1, F_WRLCK);
-		return 0;
-	}
+	for (i = 0; i < tdb_num_freelists(tdb); i++) {
+		offset = tdb_freelist_top(tdb, i);
 
-	printf("freelist top=[0x%08x]\n", rec_ptr );
-	while (rec_ptr) {
-		if (tdb->methods->tdb_read(tdb, rec_ptr, (char *)&rec,
-					   sizeof(rec), DOCONV()) == -1) {
-			tdb_unlock(tdb, -1, F_WRLCK);
-			return -1;
+		/* read in the freelist top */
+		if (tdb_ofs_read(tdb, offset, &rec_ptr) == -1) {
+			tdb_freelist_unlock_all(tdb, F_WRLCK);
+			return 0;
 		}
 
-		if (rec.magic != TDB_FREE_MAGIC) {
-			printf("bad magic 0x%08x in free list\n", rec.magic);
-			tdb_unlock(tdb, -1, F_WRLCK);
-			return -1;
+		printf("freelist top=[0x%08x]\n", rec_ptr );
+		while (rec_ptr) {
+			if (tdb->methods->tdb_read(tdb, rec_ptr, (char *)&rec,
+						   sizeof(rec), DOCONV()) == -1) {
+				tdb_freelist_unlock_all(tdb, F_WRLCK);
+				return -1;
+			}
+
+			if (rec.magic != TDB_FREE_MAGIC) {
+				printf("bad magic 0x%08x in free list\n", rec.magic);
+				tdb_freelist_unlock_all(tdb, F_WRLCK);
+				return -1;
+			}
+
+			printf("entry offset=[0x%08x], rec.rec_len = [0x%08x (%u)] (end = 0x%08x)\n",
+			       rec_ptr, rec.rec_len, rec.rec_len, rec_ptr + rec.rec_len);
+			total_free += rec.rec_len;
+
+			/* move to the next record */
+			rec_ptr = rec.next;
 		}
-
-		printf("entry offset=[0x%08x], rec.rec_len = [0x%08x (%u)] (end = 0x%08x)\n",
-		       rec_ptr, rec.rec_len, rec.rec_len, rec_ptr + rec.rec_len);
-		total_free += rec.rec_len;
-
-		/* move to the next record */
-		rec_ptr = rec.next;
 	}
 	printf("total rec_len = [0x%08lx (%lu)]\n", total_free, total_free);
 
-	return tdb_unlock(tdb, -1, F_WRLCK);
+	return tdb_freelist_unlock_all(tdb, F_WRLCK);
 }
-
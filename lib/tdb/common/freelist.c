@@ -263,6 +263,207 @@ static int check_merge_ptr_with_left_record(struct tdb_context *tdb,
 	return 1;
 }
 
+/*
+ * With TDB_FEATURE_FLAG_FREELIST_BINS there is no single freelist at
+ * FREELIST_TOP. Free records are kept in TDB_NUM_FREELIST_BINS lists
+ * by size class, the list heads live in the header. Bin 0 holds records
+ * below 128 bytes, bin n records from 64<<n bytes, the last bin
+ * everything larger. Every bin has its own lock, so allocators of
+ * different sizes don't serialize, and an allocation only looks at
+ * the first few records of its own bin: every record in a larger bin
+ * is big enough.
+ *
+ * A free record remembers its bin in the otherwise unused full_hash
+ * field. tdb_free() merges with a free left neighbour under the lock
+ * of the neighbour's bin. The merged record stays in that bin, so a
+ * bin only guarantees a minimum size. tdb_freelist_merge_adjacent()
+ * moves grown records to their real bin, the allocator calls it
+ * before it expands the file.
+ *
+ * Only one bin lock is held at a time, except by
+ * tdb_freelist_lock_all() which takes all of them in ascending order.
+ * tdb_expand() takes the bin lock with the old freelist lock held.
+ */
+
+#define TDB_FREELIST_BIN_SHIFT 6
+#define TDB_FREELIST_BIN_SCAN 16
+
+static int tdb_freelist_merge_adjacent(struct tdb_context *tdb,
+				       int *count_records, int *count_merged);
+
+bool tdb_have_freelist_bins(struct tdb_context *tdb)
+{
+	return ((tdb->feature_flags & TDB_FEATURE_FLAG_FREELIST_BINS) != 0);
+}
+
+uint32_t tdb_num_freelists(struct tdb_context *tdb)
+{
+	return tdb_have_freelist_bins(tdb) ? TDB_NUM_FREELIST_BINS : 1;
+}
+
+/* offset of the head of the i-th freelist */
+tdb_off_t tdb_freelist_top(struct tdb_context *tdb, uint32_t i)
+{
+	return tdb_have_freelist_bins(tdb) ? TDB_FREELIST_BIN_OFS(i) :
+		FREELIST_TOP;
+}
+
+static uint32_t tdb_freelist_bin(tdb_len_t rec_len)
+{
+	uint32_t bin = 0;
+
+	rec_len >>= TDB_FREELIST_BIN_SHIFT + 1;
+
+	while ((rec_len != 0) && (bin < TDB_NUM_FREELIST_BINS-1)) {
+		rec_len >>= 1;
+		bin += 1;
+	}
+
+	return bin;
+}
+
+static int tdb_freelist_bin_lock(struct tdb_context *tdb, uint32_t bin,
+				 int ltype)
+{
+	if (tdb->allrecord_lock.count) {
+		/* Nobody else can allocate */
+		return 0;
+	}
+	return tdb_nest_lock(tdb, FREELIST_BIN_LOCK(bin), ltype,
+			     TDB_LOCK_WAIT);
+}
+
+static int tdb_freelist_bin_unlock(struct tdb_context *tdb, uint32_t bin,
+				   int ltype)
+{
+	if (tdb->allrecord_lock.count) {
+		return 0;
+	}
+	return tdb_nest_unlock(tdb, FREELIST_BIN_LOCK(bin), ltype, false);
+}
+
+/* lock all freelists */
+int tdb_freelist_lock_all(struct tdb_context *tdb, int ltype)
+{
+	uint32_t bin;
+
+	if (!tdb_have_freelist_bins(tdb)) {
+		return tdb_lock(tdb, -1, ltype);
+	}
+
+	for (bin = 0; bin < TDB_NUM_FREELIST_BINS; bin++) {
+		int ret;
+
+		ret = tdb_freelist_bin_lock(tdb, bin, ltype);
+		if (ret != 0) {
+			while (bin > 0) {
+				bin -= 1;
+				tdb_freelist_bin_unlock(tdb, bin, ltype);
+			}
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int tdb_freelist_unlock_all(struct tdb_context *tdb, int ltype)
+{
+	uint32_t bin;
+	int ret = 0;
+
+	if (!tdb_have_freelist_bins(tdb)) {
+		return tdb_unlock(tdb, -1, ltype);
+	}
+
+	for (bin = TDB_NUM_FREELIST_BINS; bin > 0; bin--) {
+		if (tdb_freelist_bin_unlock(tdb, bin-1, ltype) != 0) {
+			ret = -1;
+		}
+	}
+	return ret;
+}
+
+/*
+ * Put a free record that is not on any list at the head of a bin,
+ * the bin must be locked.
+ */
+static int tdb_freelist_bin_push(struct tdb_context *tdb, uint32_t bin,
+				 tdb_off_t rec_ptr)
+{
+	tdb_off_t head;
+
+	if (tdb_ofs_read(tdb, TDB_FREELIST_BIN_OFS(bin), &head) == -1 ||
+	    tdb_ofs_write(tdb, rec_ptr + offsetof(struct tdb_record, next),
+			  &head) == -1 ||
+	    tdb_ofs_write(tdb, TDB_FREELIST_BIN_OFS(bin), &rec_ptr) == -1) {
+		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_freelist_bin_push: "
+			 "failed to add %u to bin %u\n", rec_ptr, bin));
+		return -1;
+	}
+	return 0;
+}
+
+static int tdb_free_bins(struct tdb_context *tdb, tdb_off_t offset,
+			 struct tdb_record *rec)
+{
+	tdb_off_t left_ptr;
+	struct tdb_record left_rec;
+	uint32_t bin;
+	int ret;
+
+	/* set an initial tailer, so if we fail we don't leave a bogus record */
+	if (update_tailer(tdb, offset, rec) != 0) {
+		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_free: update_tailer failed!\n"));
+		return -1;
+	}
+
+	ret = read_record_on_left(tdb, offset, &left_ptr, &left_rec);
+	if ((ret == 0) && (left_rec.magic == TDB_FREE_MAGIC) &&
+	    (left_rec.full_hash < TDB_NUM_FREELIST_BINS)) {
+
+		bin = left_rec.full_hash;
+
+		if (tdb_freelist_bin_lock(tdb, bin, F_WRLCK) != 0) {
+			return -1;
+		}
+
+		/*
+		 * Without the bin lock someone might have allocated or
+		 * moved our neighbour, look again.
+		 */
+		ret = read_record_on_left(tdb, offset, &left_ptr, &left_rec);
+		if ((ret == 0) && (left_rec.magic == TDB_FREE_MAGIC) &&
+		    (left_rec.full_hash == bin) &&
+		    (left_ptr + sizeof(left_rec) + left_rec.rec_len == offset)) {
+			ret = merge_with_left_record(tdb, left_ptr, &left_rec,
+						     rec);
+			tdb_freelist_bin_unlock(tdb, bin, F_WRLCK);
+			return ret;
+		}
+
+		tdb_freelist_bin_unlock(tdb, bin, F_WRLCK);
+	}
+
+	/* Nothing to merge, prepend to our bin */
+
+	bin = tdb_freelist_bin(rec->rec_len);
+
+	if (tdb_freelist_bin_lock(tdb, bin, F_WRLCK) != 0) {
+		return -1;
+	}
+
+	rec->magic = TDB_FREE_MAGIC;
+	rec->full_hash = bin;
+
+	ret = tdb_rec_write(tdb, offset, rec);
+	if (ret == 0) {
+		ret = tdb_freelist_bin_push(tdb, bin, offset);
+	}
+
+	tdb_freelist_bin_unlock(tdb, bin, F_WRLCK);
+	return ret;
+}
+
 /**
  * Add an element into the freelist.
  *
@@ -278,6 +479,10 @@ int tdb_free(struct tdb_context *tdb, tdb_off_t offset, struct tdb_record *rec)
 {
 	int ret;
 
+	if (tdb_have_freelist_bins(tdb)) {
+		return tdb_free_bins(tdb, offset, rec);
+	}
+
 	/* Allocation and tailer lock */
 	if (tdb_lock(tdb, -1, F_WRLCK) != 0)
 		return -1;
@@ -538,6 +743,131 @@ static tdb_off_t tdb_allocate_from_freelist(
 	return 0;
 }
 
+/*
+ * tdb_allocate_from_freelist() for TDB_FEATURE_FLAG_FREELIST_BINS, no
+ * locks must be held on the bins.
+ */
+static tdb_off_t tdb_allocate_from_bins(
+	struct tdb_context *tdb, tdb_len_t length, struct tdb_record *rec)
+{
+	bool merged = false;
+	uint32_t bin;
+
+	/* over-allocate to reduce fragmentation */
+	length *= 1.25;
+
+	/* Extra bytes required for tailer */
+	length += sizeof(tdb_off_t);
+	length = TDB_ALIGN(length, TDB_ALIGNMENT);
+
+ again:
+	for (bin = tdb_freelist_bin(length);
+	     bin < TDB_NUM_FREELIST_BINS;
+	     bin++) {
+		tdb_off_t rec_ptr, last_ptr, next_ptr, newrec_ptr;
+		tdb_len_t left_len;
+		uint32_t left_bin;
+		int i;
+
+		if (tdb_freelist_bin_lock(tdb, bin, F_WRLCK) != 0) {
+			return 0;
+		}
+
+		last_ptr = TDB_FREELIST_BIN_OFS(bin);
+		if (tdb_ofs_read(tdb, last_ptr, &rec_ptr) == -1) {
+			goto fail;
+		}
+
+		/*
+		 * First fit: Only records in our own bin and the last
+		 * one can be too small.
+		 */
+		for (i = 0; (rec_ptr != 0) && (i < TDB_FREELIST_BIN_SCAN); i++) {
+			if (tdb_rec_free_read(tdb, rec_ptr, rec) == -1) {
+				goto fail;
+			}
+			if (rec->rec_len >= length) {
+				break;
+			}
+			last_ptr = rec_ptr;
+			rec_ptr = rec->next;
+		}
+
+		if ((rec_ptr == 0) || (i == TDB_FREELIST_BIN_SCAN)) {
+			tdb_freelist_bin_unlock(tdb, bin, F_WRLCK);
+			continue;
+		}
+
+		next_ptr = rec->next;
+		left_len = rec->rec_len - (length + sizeof(*rec));
+
+		newrec_ptr = tdb_allocate_ofs(tdb, length, rec_ptr, rec,
+					      last_ptr);
+		if (newrec_ptr == 0) {
+			goto fail;
+		}
+
+		left_bin = tdb_freelist_bin(left_len);
+
+		if ((newrec_ptr == rec_ptr) || (left_bin == bin)) {
+			tdb_freelist_bin_unlock(tdb, bin, F_WRLCK);
+			return newrec_ptr;
+		}
+
+		/*
+		 * What is left of the record is too small for this
+		 * bin. Take it off the list and mark it for its new bin,
+		 * tdb_free() of a right neighbour would look there.
+		 */
+		if (tdb_ofs_write(tdb, last_ptr, &next_ptr) == -1 ||
+		    tdb_ofs_write(tdb,
+				  rec_ptr + offsetof(struct tdb_record,
+						     full_hash),
+				  &left_bin) == -1) {
+			goto fail;
+		}
+		tdb_freelist_bin_unlock(tdb, bin, F_WRLCK);
+
+		if (tdb_freelist_bin_lock(tdb, left_bin, F_WRLCK) != 0) {
+			/* We lose the rest, but our record is fine */
+			return newrec_ptr;
+		}
+		tdb_freelist_bin_push(tdb, left_bin, rec_ptr);
+		tdb_freelist_bin_unlock(tdb, left_bin, F_WRLCK);
+
+		return newrec_ptr;
+
+	fail:
+		tdb_freelist_bin_unlock(tdb, bin, F_WRLCK);
+		return 0;
+	}
+
+	if (!merged) {
+		int count = 0;
+
+		/*
+		 * Records grown by tdb_free() might sit in a bin that is
+		 * too small, give them a chance before we expand.
+		 */
+		merged = true;
+
+		if (tdb_freelist_merge_adjacent(tdb, NULL, &count) == 0 &&
+		    count > 0) {
+			goto again;
+		}
+	}
+
+	/* we didn't find enough space. See if we can expand the
+	   database and if we can then try again */
+	if (tdb_expand(tdb, length + sizeof(*rec)) == 0) {
+		/* tdb_free() might have merged the new space */
+		merged = false;
+		goto again;
+	}
+
+	return 0;
+}
+
 static bool tdb_alloc_dead(
 	struct tdb_context *tdb, int hash, tdb_len_t length,
 	tdb_off_t *rec_ptr, struct tdb_record *rec)
@@ -576,6 +906,15 @@ tdb_off_t tdb_allocate(struct tdb_context *tdb, int hash, tdb_len_t length,
 	tdb_off_t ret;
 	uint32_t i;
 
+	if (tdb_have_freelist_bins(tdb)) {
+		/*
+		 * There is no freelist lock to avoid waiting for, the
+		 * bins are locked one by one.
+		 */
+		tdb_purge_dead(tdb, hash);
+		return tdb_allocate_from_bins(tdb, length, rec);
+	}
+
 	if (tdb->max_dead_records == 0) {
 		/*
 		 * No dead records to expect anywhere. Do the blocking
@@ -641,6 +980,51 @@ blocking_freelist_allocate:
 	return ret;
 }
 
+/**
+ * Move the records of a freelist bin that have grown out of it to
+ * their bin. All bins must be locked.
+ */
+static int tdb_freelist_rebin(struct tdb_context *tdb, uint32_t bin,
+			      int *count_moved)
+{
+	tdb_off_t cur, next;
+	struct tdb_record rec;
+	int ret;
+
+	cur = TDB_FREELIST_BIN_OFS(bin);
+	while (tdb_ofs_read(tdb, cur, &next) == 0 && next != 0) {
+		uint32_t new_bin;
+
+		ret = tdb_rec_free_read(tdb, next, &rec);
+		if (ret == -1) {
+			return -1;
+		}
+
+		new_bin = tdb_freelist_bin(rec.rec_len);
+		if (new_bin == bin) {
+			cur = next;
+			continue;
+		}
+
+		ret = tdb_ofs_write(tdb, cur, &rec.next);
+		if (ret == -1) {
+			return -1;
+		}
+		rec.full_hash = new_bin;
+		ret = tdb_rec_write(tdb, next, &rec);
+		if (ret == -1) {
+			return -1;
+		}
+		ret = tdb_freelist_bin_push(tdb, new_bin, next);
+		if (ret == -1) {
+			return -1;
+		}
+		*count_moved += 1;
+	}
+
+	return 0;
+}
+
 /**
  * Merge adjacent records in the freelist.
  */
@@ -650,39 +1034,60 @@ static int tdb_freelist_merge_adjacent(struct tdb_context *tdb,
 	tdb_off_t cur, next;
 	int count = 0;
 	int merged = 0;
+	uint32_t i;
+	int ltype = F_RDLCK;
 	int ret;
 
-	ret = tdb_lock(tdb, -1, F_RDLCK);
+	if (tdb_have_freelist_bins(tdb)) {
+		/* Others allocate from the bins while we change them */
+		ltype = F_WRLCK;
+	}
+
+	ret = tdb_freelist_lock_all(tdb, ltype);
 	if (ret == -1) {
 		return -1;
 	}
 
-	cur = FREELIST_TOP;
-	while (tdb_ofs_read(tdb, cur, &next) == 0 && next != 0) {
-		tdb_off_t next2;
-
-		count++;
+	for (i = 0; i < tdb_num_freelists(tdb); i++) {
+		cur = tdb_freelist_top(tdb, i);
+		while (tdb_ofs_read(tdb, cur, &next) == 0 && next != 0) {
+			tdb_off_t next2;
 
-		ret = check_merge_ptr_with_left_record(tdb, next, &next2);
-		if (ret == -1) {
-			goto done;
-		}
-		if (ret == 1) {
-			/*
-			 * merged:
-			 * now let cur->next point to next2 instead of next
-			 */
+			count++;
 
-			ret = tdb_ofs_write(tdb, cur, &next2);
-			if (ret != 0) {
+			ret = check_merge_ptr_with_left_record(tdb, next,
+							       &next2);
+			if (ret == -1) {
 				goto done;
 			}
+			if (ret == 1) {
+				/*
+				 * merged:
+				 * now let cur->next point to next2 instead
+				 * of next, and look at next2 from cur
+				 */
+
+				ret = tdb_ofs_write(tdb, cur, &next2);
+				if (ret != 0) {
+					goto done;
+				}
+
+				count--;
+				merged++;
+				continue;
+			}
 
-			next = next2;
-			merged++;
+			cur = next;
 		}
+	}
 
-		cur = next;
+	if (tdb_have_freelist_bins(tdb)) {
+		for (i = 0; i < TDB_NUM_FREELIST_BINS; i++) {
+			ret = tdb_freelist_rebin(tdb, i, &merged);
+			if (ret == -1) {
+				goto done;
+			}
+		}
 	}
 
 	if (count_records != NULL) {
@@ -696,7 +1101,7 @@ static int tdb_freelist_merge_adjacent(struct tdb_context *tdb,
 	ret = 0;
 
 done:
-	tdb_unlock(tdb, -1, F_RDLCK);
+	tdb_freelist_unlock_all(tdb, ltype);
 	return ret;
 }
 
@@ -707,17 +1112,20 @@ static int tdb_freelist_size_no_merge(struct tdb_context *tdb)
 {
 	tdb_off_t ptr;
 	int count=0;
+	uint32_t i;
 
-	if (tdb_lock(tdb, -1, F_RDLCK) == -1) {
+	if (tdb_freelist_lock_all(tdb, F_RDLCK) == -1) {
 		return -1;
 	}
 
-	ptr = FREELIST_TOP;
-	while (tdb_ofs_read(tdb, ptr, &ptr) == 0 && ptr != 0) {
-		count++;
+	for (i = 0; i < tdb_num_freelists(tdb); i++) {
+		ptr = tdb_freelist_top(tdb, i);
+		while (tdb_ofs_read(tdb, ptr, &ptr) == 0 && ptr != 0) {
+			count++;
+		}
 	}
 
-	tdb_unlock(tdb, -1, F_RDLCK);
+	tdb_freelist_unlock_all(tdb, F_RDLCK);
 	return count;
 }
 
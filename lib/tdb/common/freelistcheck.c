@@ -47,6 +47,7 @@ _PUBLIC_ int tdb_validate_freelist(struct tdb_context *tdb, int *pnum_entries)
 	struct tdb_context *mem_tdb = NULL;
 	struct tdb_record rec;
 	tdb_off_t rec_ptr, last_ptr;
+	uint32_t i;
 	int ret = -1;
 
 	*pnum_entries = 0;
@@ -57,45 +58,48 @@ _PUBLIC_ int tdb_validate_freelist(struct tdb_context *tdb, int *pnum_entries)
 		return -1;
 	}
 
-	if (tdb_lock(tdb, -1, F_WRLCK) == -1) {
+	if (tdb_freelist_lock_all(tdb, F_WRLCK) == -1) {
 		tdb_close(mem_tdb);
 		return 0;
 	}
 
-	last_ptr = FREELIST_TOP;
+	for (i = 0; i < tdb_num_freelists(tdb); i++) {
 
-	/* Store the FREELIST_TOP record. */
-	if (seen_insert(mem_tdb, last_ptr) == -1) {
-		tdb->ecode = TDB_ERR_CORRUPT;
-		ret = -1;
-		goto fail;
-	}
-
-	/* read in the freelist top */
-	if (tdb_ofs_read(tdb, FREELIST_TOP, &rec_ptr) == -1) {
-		goto fail;
-	}
-
-	while (rec_ptr) {
-
-		/* If we can't store this record (we've seen it
-		   before) then the free list has a loop and must
-		   be corrupt. */
+		last_ptr = tdb_freelist_top(tdb, i);
 
-		if (seen_insert(mem_tdb, rec_ptr)) {
+		/* Store the freelist top record. */
+		if (seen_insert(mem_tdb, last_ptr) == -1) {
 			tdb->ecode = TDB_ERR_CORRUPT;
 			ret = -1;
 			goto fail;
 		}
 
-		if (tdb_rec_free_read(tdb, rec_ptr, &rec) == -1) {
+		/* read in the freelist top */
+		if (tdb_ofs_read(tdb, last_ptr, &rec_ptr) == -1) {
 			goto fail;
 		}
 
-		/* move to the next record */
-		last_ptr = rec_ptr;
-		rec_ptr = rec.next;
-		*pnum_entries += 1;
+		while (rec_ptr) {
+
+			/* If we can't store this record (we've seen it
+			   before) then the free list has a loop and must
+			   be corrupt. */
+
+			if (seen_insert(mem_tdb, rec_ptr)) {
+				tdb->ecode = TDB_ERR_CORRUPT;
+				ret = -1;
+				goto fail;
+			}
+
+			if (tdb_rec_free_read(tdb, rec_ptr, &rec) == -1) {
+				goto fail;
+			}
+
+			/* move to the next record */
+			last_ptr = rec_ptr;
+			rec_ptr = rec.next;
+			*pnum_entries += 1;
+		}
 	}
 
 	ret = 0;
@@ -103,6 +107,6 @@ _PUBLIC_ int tdb_validate_freelist(struct tdb_context *tdb, int *pnum_entries)
   fail:
 
 	tdb_close(mem_tdb);
-	tdb_unlock(tdb, -1, F_WRLCK);
+	tdb_freelist_unlock_all(tdb, F_WRLCK);
 	return ret;
 }
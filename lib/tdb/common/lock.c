@@ -350,13 +350,14 @@ int tdb_nest_lock(struct tdb_context *tdb, uint32_t offset, int ltype,
 	new_lck = find_nestlock(tdb, offset);
 	if (new_lck) {
 		if ((new_lck->ltype == F_RDLCK) && (ltype == F_WRLCK)) {
-			if (!tdb_have_mutexes(tdb)) {
+			if (!tdb_have_mutexes(tdb) ||
+			    tdb_have_mutex_readers(tdb)) {
 				int ret;
 				/*
-				 * Upgrade the underlying fcntl
-				 * lock. Mutexes don't do readlocks,
-				 * so this only applies to fcntl
-				 * locking.
+				 * Upgrade the underlying lock. Plain
+				 * mutexes don't do readlocks, so this
+				 * only applies to fcntl locking and
+				 * shared chain mutexes.
 				 */
 				ret = tdb_brlock(tdb, ltype, offset, 1, flags);
 				if (ret != 0) {
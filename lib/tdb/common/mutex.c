@@ -53,8 +53,42 @@
  * have overlapping mmap areas, the mutex area is mmapped once and not
  * changed, the tdb data area's mmap is constantly changed but does not
  * overlap.
+ *
+ * With TDB_FEATURE_FLAG_MUTEX_READERS the chain mutexes are followed by
+ * an array of reader slots, one cache line per chain. A reader takes
+ * the chain mutex only long enough to enter its pid into a free slot
+ * and drops it again, so readers of the same chain don't serialize.
+ * A writer takes the chain mutex, which keeps new readers out, and then
+ * waits for the registered readers to go away. Slots of readers that
+ * died are cleared by the writer. If all slots of a chain are in use a
+ * reader falls back to keeping the chain mutex, just like without
+ * TDB_FEATURE_FLAG_MUTEX_READERS.
+ *
+ * A reader upgrading to a write lock marks its slot with
+ * TDB_MUTEX_READER_UPGRADE before it queues on the chain mutex. A
+ * writer waiting for readers that sees this mark has to step back,
+ * otherwise we would deadlock. Two readers upgrading the same chain
+ * can't both win, one of them gets EDEADLK, just like with fcntl
+ * locks.
+ *
+ * With TDB_FEATURE_FLAG_FREELIST_BINS the bin locks are mutexes as
+ * well, they come last in the mutex area. Like the freelist mutex they
+ * are independent of the allrecord lock.
  */
 
+#if defined(HAVE___SYNC_FETCH_AND_ADD)
+#define TDB_MUTEX_HAVE_READERS 1
+#endif
+
+#define TDB_MUTEX_READER_SLOTS 16
+#define TDB_MUTEX_READER_UPGRADE 0x80000000U
+#define TDB_MUTEX_READERS_ALIGN 64
+
+struct tdb_chain_readers {
+	/* 0: free, otherwise the pid of the reader */
+	volatile uint32_t slots[TDB_MUTEX_READER_SLOTS];
+};
+
 struct tdb_mutexes {
 	struct tdb_header hdr;
 
@@ -80,6 +114,21 @@ bool tdb_have_mutexes(struct tdb_context *tdb)
 	return ((tdb->feature_flags & TDB_FEATURE_FLAG_MUTEX) != 0);
 }
 
+bool tdb_have_mutex_readers(struct tdb_context *tdb)
+{
+	uint32_t flags = TDB_FEATURE_FLAG_MUTEX|TDB_FEATURE_FLAG_MUTEX_READERS;
+	return ((tdb->feature_flags & flags) == flags);
+}
+
+bool tdb_mutex_readers_supported(void)
+{
+#ifdef TDB_MUTEX_HAVE_READERS
+	return true;
+#else
+	return false;
+#endif
+}
+
 size_t tdb_mutex_size(struct tdb_context *tdb)
 {
 	size_t mutex_size;
@@ -91,6 +140,17 @@ size_t tdb_mutex_size(struct tdb_context *tdb)
 	mutex_size = sizeof(struct tdb_mutexes);
 	mutex_size += tdb->hash_size * sizeof(pthread_mutex_t);
 
+	if (tdb_have_mutex_readers(tdb)) {
+		mutex_size += TDB_MUTEX_READERS_ALIGN;
+		mutex_size += (tdb->hash_size + 1) *
+			sizeof(struct tdb_chain_readers);
+	}
+
+	if (tdb_have_freelist_bins(tdb)) {
+		mutex_size += TDB_MUTEX_READERS_ALIGN;
+		mutex_size += TDB_NUM_FREELIST_BINS * sizeof(pthread_mutex_t);
+	}
+
 	return TDB_ALIGN(mutex_size, tdb->page_size);
 }
 
@@ -193,6 +253,283 @@ static int chain_mutex_lock(pthread_mutex_t *m, bool waitflag)
 	return pthread_mutex_consistent(m);
 }
 
+static struct tdb_chain_readers *tdb_chain_readers_array(
+	struct tdb_context *tdb)
+{
+	uintptr_t ptr;
+
+	ptr = (uintptr_t)&tdb->mutexes->hashchains[tdb->hash_size+1];
+	ptr = TDB_ALIGN(ptr, TDB_MUTEX_READERS_ALIGN);
+
+	return (struct tdb_chain_readers *)ptr;
+}
+
+static pthread_mutex_t *tdb_freelist_bin_mutexes(struct tdb_context *tdb)
+{
+	uintptr_t ptr;
+
+	ptr = (uintptr_t)&tdb->mutexes->hashchains[tdb->hash_size+1];
+	if (tdb_have_mutex_readers(tdb)) {
+		ptr = (uintptr_t)&tdb_chain_readers_array(tdb)[tdb->hash_size+1];
+	}
+	ptr = TDB_ALIGN(ptr, TDB_MUTEX_READERS_ALIGN);
+
+	return (pthread_mutex_t *)ptr;
+}
+
+/*
+ * Get the mutex for a freelist bin lock, see FREELIST_BIN_LOCK()
+ */
+static pthread_mutex_t *tdb_freelist_bin_mutex(struct tdb_context *tdb,
+						off_t off, off_t len)
+{
+	if (!tdb_have_mutexes(tdb) || !tdb_have_freelist_bins(tdb)) {
+		return NULL;
+	}
+	if ((len != 1) || (tdb->mutexes == NULL)) {
+		return NULL;
+	}
+	if ((off < FREELIST_BIN_LOCK(0)) ||
+	    (off > FREELIST_BIN_LOCK(TDB_NUM_FREELIST_BINS-1))) {
+		return NULL;
+	}
+
+	off -= FREELIST_BIN_LOCK(0);
+	off /= sizeof(tdb_off_t);
+
+	return &tdb_freelist_bin_mutexes(tdb)[off];
+}
+
+/*
+ * Get the reader slots for a chain mutex, NULL if the tdb does not
+ * do shared chain locks. The freelist is always exclusive.
+ */
+static struct tdb_chain_readers *tdb_chain_readers(struct tdb_context *tdb,
+						   unsigned idx)
+{
+	if (!tdb_have_mutex_readers(tdb)) {
+		return NULL;
+	}
+	if (idx == 0) {
+		return NULL;
+	}
+	return &tdb_chain_readers_array(tdb)[idx];
+}
+
+#ifdef TDB_MUTEX_HAVE_READERS
+
+static int chain_reader_find(struct tdb_chain_readers *r, uint32_t pid)
+{
+	int i;
+
+	for (i=0; i<TDB_MUTEX_READER_SLOTS; i++) {
+		uint32_t val = r->slots[i] & ~TDB_MUTEX_READER_UPGRADE;
+		if (val == pid) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Called with the chain mutex held, so we're the only one adding
+ * slots. Writers clearing dead readers' slots are still around, thus
+ * the compare and swap.
+ */
+static bool chain_reader_register(struct tdb_chain_readers *r, uint32_t pid)
+{
+	int i;
+
+	for (i=0; i<TDB_MUTEX_READER_SLOTS; i++) {
+		if ((r->slots[i] == 0) &&
+		    __sync_bool_compare_and_swap(&r->slots[i], 0, pid)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void chain_reader_release(struct tdb_chain_readers *r, int slot)
+{
+	__sync_lock_release(&r->slots[slot]);
+}
+
+static void chain_readers_backoff(unsigned *count)
+{
+	if (*count < 100) {
+		sched_yield();
+	} else {
+		usleep(1000);
+	}
+	*count += 1;
+}
+
+/*
+ * Wait for all readers of a chain except "self" to go away, called
+ * with the chain mutex held. Returns EBUSY if one of the readers
+ * waits to upgrade its lock: It queues behind us on the chain mutex,
+ * so we have to give up the mutex.
+ */
+static int chain_readers_wait(struct tdb_chain_readers *r, int self,
+			      bool waitflag)
+{
+	unsigned count = 0;
+
+	while (true) {
+		bool busy = false;
+		int i;
+
+		for (i=0; i<TDB_MUTEX_READER_SLOTS; i++) {
+			uint32_t val = r->slots[i];
+			pid_t pid = val & ~TDB_MUTEX_READER_UPGRADE;
+			int ret;
+
+			if ((val == 0) || (i == self)) {
+				continue;
+			}
+			if (val & TDB_MUTEX_READER_UPGRADE) {
+				return EBUSY;
+			}
+
+			ret = kill(pid, 0);
+			if ((ret == -1) && (errno == ESRCH)) {
+				/*
+				 * The reader died without unlocking
+				 */
+				__sync_bool_compare_and_swap(
+					&r->slots[i], val, 0);
+				continue;
+			}
+			busy = true;
+		}
+
+		if (!busy) {
+			/*
+			 * Order our data access after the readers'
+			 * release of their slots.
+			 */
+			__sync_synchronize();
+			return 0;
+		}
+		if (!waitflag) {
+			return EAGAIN;
+		}
+		chain_readers_backoff(&count);
+	}
+}
+
+/*
+ * Take the chain mutex exclusively, waiting for readers. Used for
+ * the allrecord lock, which walks all chains.
+ */
+static int chain_mutex_lock_exclusive(struct tdb_context *tdb, unsigned idx,
+				      bool waitflag)
+{
+	pthread_mutex_t *chain = &tdb->mutexes->hashchains[idx];
+	struct tdb_chain_readers *r = tdb_chain_readers(tdb, idx);
+	unsigned count = 0;
+	int ret;
+
+again:
+	ret = chain_mutex_lock(chain, waitflag);
+	if ((ret != 0) || (r == NULL)) {
+		return ret;
+	}
+
+	ret = chain_readers_wait(r, -1, waitflag);
+	if (ret == 0) {
+		return 0;
+	}
+
+	pthread_mutex_unlock(chain);
+
+	if ((ret == EBUSY) && waitflag) {
+		chain_readers_backoff(&count);
+		goto again;
+	}
+	return EAGAIN;
+}
+
+/*
+ * Upgrade a shared chain lock in reader slot "self"
+ */
+static int chain_mutex_upgrade(struct tdb_context *tdb, unsigned idx,
+			       int self, bool waitflag)
+{
+	pthread_mutex_t *chain = &tdb->mutexes->hashchains[idx];
+	struct tdb_chain_readers *r = tdb_chain_readers(tdb, idx);
+	int ret;
+
+	__sync_fetch_and_or(&r->slots[self], TDB_MUTEX_READER_UPGRADE);
+
+	ret = chain_mutex_lock(chain, waitflag);
+	if (ret == EBUSY) {
+		ret = EAGAIN;
+	}
+	if (ret != 0) {
+		__sync_fetch_and_and(&r->slots[self],
+				     ~TDB_MUTEX_READER_UPGRADE);
+		return ret;
+	}
+
+	ret = chain_readers_wait(r, self, waitflag);
+	if (ret != 0) {
+		pthread_mutex_unlock(chain);
+		__sync_fetch_and_and(&r->slots[self],
+				     ~TDB_MUTEX_READER_UPGRADE);
+		return (ret == EBUSY) ? EDEADLK : ret;
+	}
+
+	/*
+	 * We have the chain mutex now, our reader slot is not needed
+	 * anymore.
+	 */
+	chain_reader_release(r, self);
+	return 0;
+}
+
+#else /* TDB_MUTEX_HAVE_READERS */
+
+static int chain_reader_find(struct tdb_chain_readers *r, uint32_t pid)
+{
+	return -1;
+}
+
+static bool chain_reader_register(struct tdb_chain_readers *r, uint32_t pid)
+{
+	return false;
+}
+
+static void chain_reader_release(struct tdb_chain_readers *r, int slot)
+{
+	return;
+}
+
+static void chain_readers_backoff(unsigned *count)
+{
+	return;
+}
+
+static int chain_readers_wait(struct tdb_chain_readers *r, int self,
+			      bool waitflag)
+{
+	return 0;
+}
+
+static int chain_mutex_lock_exclusive(struct tdb_context *tdb, unsigned idx,
+				      bool waitflag)
+{
+	return chain_mutex_lock(&tdb->mutexes->hashchains[idx], waitflag);
+}
+
+static int chain_mutex_upgrade(struct tdb_context *tdb, unsigned idx,
+			       int self, bool waitflag)
+{
+	return ENOSYS;
+}
+
+#endif /* TDB_MUTEX_HAVE_READERS */
+
 static int allrecord_mutex_lock(struct tdb_mutexes *m, bool waitflag)
 {
 	int ret;
@@ -221,20 +558,70 @@ bool tdb_mutex_lock(struct tdb_context *tdb, int rw, off_t off, off_t len,
 {
 	struct tdb_mutexes *m = tdb->mutexes;
 	pthread_mutex_t *chain;
+	struct tdb_chain_readers *r;
+	unsigned count = 0;
 	int ret;
 	unsigned idx;
 	bool allrecord_ok;
 
+	chain = tdb_freelist_bin_mutex(tdb, off, len);
+	if (chain != NULL) {
+		ret = chain_mutex_lock(chain, waitflag);
+		if (ret == EBUSY) {
+			ret = EAGAIN;
+		}
+		if (ret != 0) {
+			errno = ret;
+			goto fail;
+		}
+		*pret = 0;
+		return true;
+	}
+
 	if (!tdb_mutex_index(tdb, off, len, &idx)) {
 		return false;
 	}
 	chain = &m->hashchains[idx];
+	r = tdb_chain_readers(tdb, idx);
+
+	if ((r != NULL) && (rw == F_WRLCK)) {
+		int self = chain_reader_find(r, getpid());
+		if (self != -1) {
+			/*
+			 * tdb_nest_lock() upgrading our shared lock
+			 */
+			ret = chain_mutex_upgrade(tdb, idx, self, waitflag);
+			if (ret != 0) {
+				errno = ret;
+				goto fail;
+			}
+			*pret = 0;
+			return true;
+		}
+	}
 
 again:
 	ret = chain_mutex_lock(chain, waitflag);
 	if (ret == EBUSY) {
 		ret = EAGAIN;
 	}
+	if ((ret == EDEADLK) && (r != NULL) && (rw == F_WRLCK)) {
+		/*
+		 * We hold the chain mutex already, our read lock did
+		 * not find a free reader slot. Upgrade by waiting for
+		 * the other readers.
+		 */
+		ret = chain_readers_wait(r, -1, waitflag);
+		if (ret == EBUSY) {
+			ret = EDEADLK;
+		}
+		if (ret != 0) {
+			errno = ret;
+			goto fail;
+		}
+		*pret = 0;
+		return true;
+	}
 	if (ret != 0) {
 		errno = ret;
 		goto fail;
@@ -268,8 +655,7 @@ again:
 		 * chain lock.
 		 */
 
-		*pret = 0;
-		return true;
+		goto locked;
 	}
 
 	/*
@@ -293,8 +679,7 @@ again:
 	}
 
 	if (allrecord_ok) {
-		*pret = 0;
-		return true;
+		goto locked;
 	}
 
 	ret = pthread_mutex_unlock(chain);
@@ -326,6 +711,46 @@ again:
 	}
 	goto again;
 
+locked:
+	if (r == NULL) {
+		*pret = 0;
+		return true;
+	}
+
+	if (rw == F_RDLCK) {
+		if (chain_reader_register(r, getpid())) {
+			ret = pthread_mutex_unlock(chain);
+			if (ret != 0) {
+				TDB_LOG((tdb, TDB_DEBUG_FATAL,
+					 "pthread_mutex_unlock"
+					 "(chain_mutex) failed: %s\n",
+					 strerror(ret)));
+			}
+		}
+		/*
+		 * Without a free slot we keep the chain mutex
+		 */
+		*pret = 0;
+		return true;
+	}
+
+	ret = chain_readers_wait(r, -1, waitflag);
+	if (ret == 0) {
+		*pret = 0;
+		return true;
+	}
+
+	pthread_mutex_unlock(chain);
+
+	if ((ret == EBUSY) && waitflag) {
+		/*
+		 * Let a reader upgrading its lock go first
+		 */
+		chain_readers_backoff(&count);
+		goto again;
+	}
+	errno = EAGAIN;
+
 fail:
 	*pret = -1;
 	return true;
@@ -336,14 +761,35 @@ bool tdb_mutex_unlock(struct tdb_context *tdb, int rw, off_t off, off_t len,
 {
 	struct tdb_mutexes *m = tdb->mutexes;
 	pthread_mutex_t *chain;
+	struct tdb_chain_readers *r;
 	int ret;
 	unsigned idx;
 
+	chain = tdb_freelist_bin_mutex(tdb, off, len);
+	if (chain != NULL) {
+		goto unlock;
+	}
+
 	if (!tdb_mutex_index(tdb, off, len, &idx)) {
 		return false;
 	}
 	chain = &m->hashchains[idx];
+	r = tdb_chain_readers(tdb, idx);
 
+	if (r != NULL) {
+		/*
+		 * Don't look at rw: An upgraded lock is unlocked as
+		 * F_RDLCK, and a reader might not have found a slot.
+		 */
+		int self = chain_reader_find(r, getpid());
+		if (self != -1) {
+			chain_reader_release(r, self);
+			*pret = 0;
+			return true;
+		}
+	}
+
+unlock:
 	ret = pthread_mutex_unlock(chain);
 	if (ret == 0) {
 		*pret = 0;
@@ -399,8 +845,12 @@ int tdb_mutex_allrecord_lock(struct tdb_context *tdb, int ltype,
 		/* ignore hashchains[0], the freelist */
 		pthread_mutex_t *chain = &m->hashchains[i+1];
 
-		ret = chain_mutex_lock(chain, waitflag);
-		if (!waitflag && (ret == EBUSY)) {
+		if (ltype == F_RDLCK) {
+			ret = chain_mutex_lock(chain, waitflag);
+		} else {
+			ret = chain_mutex_lock_exclusive(tdb, i+1, waitflag);
+		}
+		if (!waitflag && ((ret == EBUSY) || (ret == EAGAIN))) {
 			errno = EAGAIN;
 			goto fail_unroll_allrecord_lock;
 		}
@@ -473,7 +923,7 @@ int tdb_mutex_allrecord_upgrade(struct tdb_context *tdb)
 		/* ignore hashchains[0], the freelist */
 		pthread_mutex_t *chain = &m->hashchains[i+1];
 
-		ret = chain_mutex_lock(chain, true);
+		ret = chain_mutex_lock_exclusive(tdb, i+1, true);
 		if (ret != 0) {
 			TDB_LOG((tdb, TDB_DEBUG_FATAL, "pthread_mutex_lock"
 				 "(chainlock) failed: %s\n", strerror(ret)));
@@ -595,6 +1045,22 @@ int tdb_mutex_init(struct tdb_context *tdb)
 
 	m->allrecord_lock = F_UNLCK;
 
+	if (tdb_have_mutex_readers(tdb)) {
+		struct tdb_chain_readers *r = tdb_chain_readers_array(tdb);
+		memset((void *)r, 0, (tdb->hash_size+1) * sizeof(*r));
+	}
+
+	if (tdb_have_freelist_bins(tdb)) {
+		pthread_mutex_t *bins = tdb_freelist_bin_mutexes(tdb);
+
+		for (i=0; i<TDB_NUM_FREELIST_BINS; i++) {
+			ret = pthread_mutex_init(&bins[i], &ma);
+			if (ret != 0) {
+				goto fail;
+			}
+		}
+	}
+
 	ret = pthread_mutex_init(&m->allrecord_mutex, &ma);
 	if (ret != 0) {
 		goto fail;
@@ -1028,6 +1494,16 @@ bool tdb_have_mutexes(struct tdb_context *tdb)
 	return false;
 }
 
+bool tdb_have_mutex_readers(struct tdb_context *tdb)
+{
+	return false;
+}
+
+bool tdb_mutex_readers_supported(void)
+{
+	return false;
+}
+
 int tdb_mutex_allrecord_lock(struct tdb_context *tdb, int ltype,
 			     enum tdb_lock_flags flags)
 {
@@ -83,6 +83,17 @@ static int tdb_new_database(struct tdb_context *tdb, struct tdb_header *header,
 	 */
 	if (tdb->flags & TDB_MUTEX_LOCKING) {
 		newdb->feature_flags |= TDB_FEATURE_FLAG_MUTEX;
+		if (tdb_mutex_readers_supported()) {
+			newdb->feature_flags |= TDB_FEATURE_FLAG_MUTEX_READERS;
+		}
+	}
+
+	if (tdb->flags & TDB_FREELIST_BINS) {
+		newdb->feature_flags |= TDB_FEATURE_FLAG_FREELIST_BINS;
+	}
+
+	if (tdb->flags & TDB_RECOVERY_CHECKSUM) {
+		newdb->feature_flags |= TDB_FEATURE_FLAG_RECOVERY_CHECKSUM;
 	}
 
 	/*
@@ -169,6 +180,91 @@ static int tdb_new_database(struct tdb_context *tdb, struct tdb_header *header,
 
 
 
+/*
+ * TDB_AUTO_HASH_SIZE: Chains longer than TDB_AUTO_HASH_MAX_CHAIN in the
+ * previous incarnation of a CLEAR_IF_FIRST tdb let us grow the hash
+ * size, so that the longest chain would have had about
+ * TDB_AUTO_HASH_TARGET_CHAIN records.
+ *
+ * The hash table can't grow online: it sits right behind the header,
+ * the mutex area and the fcntl lock offsets depend on it and every
+ * process caches the hash size. When the first opener wipes the file
+ * nobody else can see the old layout anymore.
+ */
+#define TDB_AUTO_HASH_MAX_CHAIN 16
+#define TDB_AUTO_HASH_TARGET_CHAIN 8
+#define TDB_AUTO_HASH_SIZE_MAX 1048573
+
+static bool tdb_is_prime(uint32_t n)
+{
+	uint32_t i;
+
+	for (i=3; i <= n/i; i+=2) {
+		if ((n % i) == 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static uint32_t tdb_auto_hash_size(struct tdb_context *tdb,
+				   uint32_t hash_size)
+{
+	struct tdb_header hdr;
+	uint64_t new_size;
+	ssize_t nread;
+
+	nread = pread(tdb->fd, &hdr, sizeof(hdr), 0);
+	if ((nread != sizeof(hdr)) ||
+	    (strcmp(hdr.magic_food, TDB_MAGIC_FOOD) != 0) ||
+	    (hdr.version != TDB_VERSION)) {
+		return hash_size;
+	}
+
+	if (hdr.feature_flags & TDB_FEATURE_FLAG_MUTEX) {
+		/*
+		 * The live header is the one behind the mutexes
+		 */
+		nread = pread(tdb->fd, &hdr, sizeof(hdr), hdr.mutex_size);
+		if (nread != sizeof(hdr)) {
+			return hash_size;
+		}
+	}
+
+	/*
+	 * Don't shrink back to what the caller asked for, the next
+	 * incarnation will most likely see the same load.
+	 */
+	new_size = MAX(hash_size, hdr.hash_size);
+
+	if (hdr.chain_hwm > TDB_AUTO_HASH_MAX_CHAIN) {
+		uint64_t grown = (uint64_t)hdr.hash_size * hdr.chain_hwm /
+			TDB_AUTO_HASH_TARGET_CHAIN;
+		new_size = MAX(new_size, grown);
+	}
+
+	if (new_size <= hash_size) {
+		return hash_size;
+	}
+
+	if (new_size == hdr.hash_size) {
+		return new_size;
+	}
+
+	new_size = MIN(new_size, TDB_AUTO_HASH_SIZE_MAX);
+	new_size |= 1;
+	while (!tdb_is_prime(new_size)) {
+		new_size += 2;
+	}
+
+	TDB_LOG((tdb, TDB_DEBUG_WARNING, "tdb_open_ex: %s: longest chain "
+		 "was %"PRIu32" with hash size %"PRIu32", using hash size "
+		 "%"PRIu64"\n", tdb->name, (uint32_t)hdr.chain_hwm,
+		 hdr.hash_size, new_size));
+
+	return new_size;
+}
+
 static int tdb_already_open(dev_t device,
 			    ino_t ino)
 {
@@ -246,6 +342,13 @@ static bool tdb_mutex_open_ok(struct tdb_context *tdb,
 		return false;
 	}
 
+	if (tdb_have_mutex_readers(tdb) && !tdb_mutex_readers_supported()) {
+		TDB_LOG((tdb, TDB_DEBUG_ERROR, "tdb_mutex_open_ok[%s]: "
+			 "Shared chain mutexes not supported\n",
+			 tdb->name));
+		return false;
+	}
+
 	if (tdb_mutex_size(tdb) != header->mutex_size) {
 		TDB_LOG((tdb, TDB_DEBUG_ERROR, "tdb_mutex_open_ok[%s]: "
 			 "Mutex size changed from %"PRIu32" to %zu\n.",
@@ -486,6 +589,9 @@ _PUBLIC_ struct tdb_context *tdb_open_ex(const char *name, int hash_size, int td
 					 name, strerror(errno)));
 				goto fail;
 			}
+			if (tdb_flags & TDB_AUTO_HASH_SIZE) {
+				hash_size = tdb_auto_hash_size(tdb, hash_size);
+			}
 			ret = tdb_new_database(tdb, &header, hash_size);
 			if (ret == -1) {
 				TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_open_ex: "
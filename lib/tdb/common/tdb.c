@@ -108,6 +108,37 @@ bool tdb_chainwalk_check(struct tdb_context *tdb,
 	return true;
 }
 
+/*
+ * With TDB_AUTO_HASH_SIZE remember the longest chain anyone had to
+ * walk in the header, so the next wipe of the tdb can pick a bigger
+ * hash size. This is only a hint: It is written without a lock, we
+ * just don't want to write the header for every lookup.
+ */
+static void tdb_note_chain_len(struct tdb_context *tdb, uint32_t len)
+{
+	tdb_off_t hwm;
+
+	if (len <= tdb->chain_hwm) {
+		return;
+	}
+	tdb->chain_hwm = len;
+
+	if (!(tdb->flags & TDB_AUTO_HASH_SIZE) || tdb->read_only ||
+	    (tdb->transaction != NULL) || (tdb->flags & TDB_INTERNAL)) {
+		return;
+	}
+
+	if (tdb_ofs_read(tdb, TDB_CHAIN_HWM_OFS, &hwm) == -1) {
+		return;
+	}
+	if (hwm >= len) {
+		tdb->chain_hwm = hwm;
+		return;
+	}
+	hwm = len;
+	tdb_ofs_write(tdb, TDB_CHAIN_HWM_OFS, &hwm);
+}
+
 /* Returns 0 on fail.  On success, return offset of record, and fills
    in rec */
 static tdb_off_t tdb_find(struct tdb_context *tdb, TDB_DATA key, uint32_t hash,
@@ -115,6 +146,7 @@ static tdb_off_t tdb_find(struct tdb_context *tdb, TDB_DATA key, uint32_t hash,
 {
 	tdb_off_t rec_ptr;
 	struct tdb_chainwalk_ctx chainwalk;
+	uint32_t chain_len = 0;
 
 	/* read in the hash top */
 	if (tdb_ofs_read(tdb, TDB_HASH_TOP(hash), &rec_ptr) == -1)
@@ -129,11 +161,14 @@ static tdb_off_t tdb_find(struct tdb_context *tdb, TDB_DATA key, uint32_t hash,
 		if (tdb_rec_read(tdb, rec_ptr, r) == -1)
 			return 0;
 
+		chain_len += 1;
+
 		if (!TDB_DEAD(r) && hash==r->full_hash
 		    && key.dsize==r->key_len
 		    && tdb_parse_data(tdb, key, rec_ptr + sizeof(*r),
 				      r->key_len, tdb_key_compare,
 				      NULL) == 0) {
+			tdb_note_chain_len(tdb, chain_len);
 			return rec_ptr;
 		}
 		rec_ptr = r->next;
@@ -143,6 +178,7 @@ static tdb_off_t tdb_find(struct tdb_context *tdb, TDB_DATA key, uint32_t hash,
 			return 0;
 		}
 	}
+	tdb_note_chain_len(tdb, chain_len);
 	tdb->ecode = TDB_ERR_NOEXIST;
 	return 0;
 }
@@ -438,10 +474,12 @@ int tdb_trim_dead(struct tdb_context *tdb, uint32_t hash)
 
 			if (num_dead > tdb->max_dead_records) {
 
-				if (!locked_freelist) {
+				if (!locked_freelist &&
+				    !tdb_have_freelist_bins(tdb)) {
 					/*
 					 * Lock the freelist only if
-					 * it's really required.
+					 * it's really required. The
+					 * bins are locked by tdb_free().
 					 */
 					ret = tdb_lock(tdb, -1, F_WRLCK);
 					if (ret == -1) {
@@ -986,9 +1024,11 @@ _PUBLIC_ int tdb_wipe_all(struct tdb_context *tdb)
 	}
 
 	/* wipe the freelist */
-	if (tdb_ofs_write(tdb, FREELIST_TOP, &offset) == -1) {
-		TDB_LOG((tdb, TDB_DEBUG_FATAL,"tdb_wipe_all: failed to write freelist\n"));
-		goto failed;
+	for (i=0;i<tdb_num_freelists(tdb);i++) {
+		if (tdb_ofs_write(tdb, tdb_freelist_top(tdb, i), &offset) == -1) {
+			TDB_LOG((tdb, TDB_DEBUG_FATAL,"tdb_wipe_all: failed to write freelist\n"));
+			goto failed;
+		}
 	}
 
 	/* add all the rest of the file to the freelist, possibly leaving a gap
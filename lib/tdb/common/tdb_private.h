@@ -56,6 +56,7 @@ typedef uint32_t tdb_off_t;
 #define TDB_FEATURE_FLAG_MAGIC (0xbad1a52U)
 #define TDB_ALIGNMENT 4
 #define DEFAULT_HASH_SIZE 131
+#define TDB_NUM_FREELIST_BINS 16
 #define FREELIST_TOP (sizeof(struct tdb_header))
 #define TDB_ALIGN(x,a) (((x) + (a)-1) & ~((a)-1))
 #define TDB_BYTEREV(x) (((((x)&0xff)<<24)|((x)&0xFF00)<<8)|(((x)>>8)&0xFF00)|((x)>>24))
@@ -66,13 +67,23 @@ typedef uint32_t tdb_off_t;
 #define TDB_DATA_START(hash_size) (TDB_HASH_TOP(hash_size-1) + sizeof(tdb_off_t))
 #define TDB_RECOVERY_HEAD offsetof(struct tdb_header, recovery_start)
 #define TDB_SEQNUM_OFS    offsetof(struct tdb_header, sequence_number)
+#define TDB_CHAIN_HWM_OFS offsetof(struct tdb_header, chain_hwm)
+#define TDB_FREELIST_BIN_OFS(bin) \
+	(offsetof(struct tdb_header, freelist_bins) + (bin)*sizeof(tdb_off_t))
 #define TDB_PAD_BYTE 0x42
 #define TDB_PAD_U32  0x42424242
 
 #define TDB_FEATURE_FLAG_MUTEX 0x00000001
+#define TDB_FEATURE_FLAG_MUTEX_READERS 0x00000002 /* shared chain locks */
+#define TDB_FEATURE_FLAG_FREELIST_BINS 0x00000004 /* size class freelists */
+#define TDB_FEATURE_FLAG_RECOVERY_CHECKSUM 0x00000008 /* rec.full_hash of the
+							  recovery record */
 
 #define TDB_SUPPORTED_FEATURE_FLAGS ( \
 	TDB_FEATURE_FLAG_MUTEX | \
+	TDB_FEATURE_FLAG_MUTEX_READERS | \
+	TDB_FEATURE_FLAG_FREELIST_BINS | \
+	TDB_FEATURE_FLAG_RECOVERY_CHECKSUM | \
 	0)
 
 /* NB assumes there is a local variable called "tdb" that is the
@@ -120,6 +131,7 @@ void tdb_trace_2rec_retrec(struct tdb_context *tdb, const char *op,
 #define OPEN_LOCK        0
 #define ACTIVE_LOCK      4
 #define TRANSACTION_LOCK 8
+#define FREELIST_BIN_LOCK(bin) (12 + 4*(bin)) /* TDB_FEATURE_FLAG_FREELIST_BINS */
 
 /* free memory if the pointer is valid and zero the pointer */
 #ifndef SAFE_FREE
@@ -182,7 +194,9 @@ struct tdb_header {
 	uint32_t magic2_hash; /* hash of TDB_MAGIC. */
 	uint32_t feature_flags;
 	tdb_len_t mutex_size; /* set if TDB_FEATURE_FLAG_MUTEX is set */
-	tdb_off_t reserved[25];
+	tdb_off_t chain_hwm; /* longest chain walked, with TDB_AUTO_HASH_SIZE */
+	tdb_off_t freelist_bins[TDB_NUM_FREELIST_BINS]; /* with FREELIST_BINS */
+	tdb_off_t reserved[24-TDB_NUM_FREELIST_BINS];
 };
 
 struct tdb_lock_type {
@@ -259,6 +273,7 @@ struct tdb_context {
 	struct tdb_transaction *transaction;
 	int page_size;
 	int max_dead_records;
+	uint32_t chain_hwm; /* last known header.chain_hwm */
 #ifdef TDB_TRACE
 	int tracefd;
 #endif
@@ -304,6 +319,11 @@ void *tdb_convert(void *buf, uint32_t size);
 int tdb_free(struct tdb_context *tdb, tdb_off_t offset, struct tdb_record *rec);
 tdb_off_t tdb_allocate(struct tdb_context *tdb, int hash, tdb_len_t length,
 		       struct tdb_record *rec);
+bool tdb_have_freelist_bins(struct tdb_context *tdb);
+uint32_t tdb_num_freelists(struct tdb_context *tdb);
+tdb_off_t tdb_freelist_top(struct tdb_context *tdb, uint32_t i);
+int tdb_freelist_lock_all(struct tdb_context *tdb, int ltype);
+int tdb_freelist_unlock_all(struct tdb_context *tdb, int ltype);
 int tdb_ofs_read(struct tdb_context *tdb, tdb_off_t offset, tdb_off_t *d);
 int tdb_ofs_write(struct tdb_context *tdb, tdb_off_t offset, tdb_off_t *d);
 int tdb_lock_record(struct tdb_context *tdb, tdb_off_t off);
@@ -341,6 +361,8 @@ bool tdb_add_off_t(tdb_off_t a, tdb_off_t b, tdb_off_t *pret);
 
 size_t tdb_mutex_size(struct tdb_context *tdb);
 bool tdb_have_mutexes(struct tdb_context *tdb);
+bool tdb_have_mutex_readers(struct tdb_context *tdb);
+bool tdb_mutex_readers_supported(void);
 int tdb_mutex_init(struct tdb_context *tdb);
 int tdb_mutex_mmap(struct tdb_context *tdb);
 int tdb_mutex_munmap(struct tdb_context *tdb);
@@ -75,6 +75,13 @@
     needed per commit to prevent race conditions. It might be possible
     to reduce this to 3 or even 2 with some more work.
 
+  - tdbs created with TDB_RECOVERY_CHECKSUM store a checksum of the
+    recovery data in the recovery record and write the magic together
+    with the data, saving one of the 4 syncs. A crash can then leave a
+    valid magic in front of torn recovery data, which recovery detects
+    by the checksum. As the database itself is only modified after the
+    recovery data has been synced, such a record is simply dropped.
+
   - check for a valid recovery record on open of the tdb, while the
     open lock is held. Automatically recover from the transaction
     recovery area if needed, then continue with the open as
@@ -919,6 +926,21 @@ static int transaction_setup_recovery(struct tdb_context *tdb,
 		tdb_convert(p, 4);
 	}
 
+	if (tdb->feature_flags & TDB_FEATURE_FLAG_RECOVERY_CHECKSUM) {
+		TDB_DATA blob = {
+			.dptr = data + sizeof(*rec), .dsize = recovery_size
+		};
+
+		rec->full_hash = tdb_jenkins_hash(&blob);
+		CONVERT(rec->full_hash);
+		rec->magic = TDB_RECOVERY_MAGIC;
+		CONVERT(rec->magic);
+
+		/* make a cancel remove the magic if the write fails */
+		*magic_offset = recovery_offset +
+			offsetof(struct tdb_record, magic);
+	}
+
 	/* write the recovery data to the recovery area */
 	if (methods->tdb_write(tdb, recovery_offset, data, sizeof(*rec) + recovery_size) == -1) {
 		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_transaction_setup_recovery: failed to write recovery data\n"));
@@ -943,11 +965,16 @@ static int transaction_setup_recovery(struct tdb_context *tdb,
 
 	free(data);
 
+	*magic_offset = recovery_offset + offsetof(struct tdb_record, magic);
+
+	if (tdb->feature_flags & TDB_FEATURE_FLAG_RECOVERY_CHECKSUM) {
+		/* the magic went to disk with the recovery data */
+		return 0;
+	}
+
 	magic = TDB_RECOVERY_MAGIC;
 	CONVERT(magic);
 
-	*magic_offset = recovery_offset + offsetof(struct tdb_record, magic);
-
 	if (methods->tdb_write(tdb, *magic_offset, &magic, sizeof(magic)) == -1) {
 		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_transaction_setup_recovery: failed to write recovery magic\n"));
 		tdb->ecode = TDB_ERR_IO;
@@ -1085,17 +1112,20 @@ static bool repack_worthwhile(struct tdb_context *tdb)
 	tdb_off_t ptr;
 	struct tdb_record rec;
 	tdb_len_t total = 0, largest = 0;
+	uint32_t i;
 
-	if (tdb_ofs_read(tdb, FREELIST_TOP, &ptr) == -1) {
-		return false;
-	}
+	for (i = 0; i < tdb_num_freelists(tdb); i++) {
+		if (tdb_ofs_read(tdb, tdb_freelist_top(tdb, i), &ptr) == -1) {
+			return false;
+		}
 
-	while (ptr != 0 && tdb_rec_free_read(tdb, ptr, &rec) == 0) {
-		total += rec.rec_len;
-		if (rec.rec_len > largest) {
-			largest = rec.rec_len;
+		while (ptr != 0 && tdb_rec_free_read(tdb, ptr, &rec) == 0) {
+			total += rec.rec_len;
+			if (rec.rec_len > largest) {
+				largest = rec.rec_len;
+			}
+			ptr = rec.next;
 		}
-		ptr = rec.next;
 	}
 
 	return total > largest * 2;
@@ -1216,6 +1246,34 @@ _PUBLIC_ int tdb_transaction_commit(struct tdb_context *tdb)
 }
 
 
+/*
+  drop a recovery record that was torn by a crash while it was
+  written, see TDB_RECOVERY_CHECKSUM above
+*/
+static int tdb_recovery_drop_torn(struct tdb_context *tdb,
+				  tdb_off_t recovery_head)
+{
+	uint32_t zero = 0;
+
+	TDB_LOG((tdb, TDB_DEBUG_ERROR, "tdb_transaction_recover: "
+		 "dropping incomplete recovery data\n"));
+
+	if (tdb_ofs_write(tdb, recovery_head + offsetof(struct tdb_record, magic),
+			  &zero) == -1) {
+		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_transaction_recover: failed to remove recovery magic\n"));
+		tdb->ecode = TDB_ERR_IO;
+		return -1;
+	}
+
+	if (transaction_sync(tdb, recovery_head, sizeof(struct tdb_record)) == -1) {
+		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_transaction_recover: failed to sync recovery\n"));
+		tdb->ecode = TDB_ERR_IO;
+		return -1;
+	}
+
+	return 0;
+}
+
 /*
   recover from an aborted transaction. Must be called with exclusive
   database write access already established (including the open
@@ -1261,6 +1319,11 @@ int tdb_transaction_recover(struct tdb_context *tdb)
 
 	recovery_eof = rec.key_len;
 
+	if ((tdb->feature_flags & TDB_FEATURE_FLAG_RECOVERY_CHECKSUM) &&
+	    (rec.data_len > rec.rec_len)) {
+		return tdb_recovery_drop_torn(tdb, recovery_head);
+	}
+
 	data = (unsigned char *)malloc(rec.data_len);
 	if (data == NULL) {
 		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_transaction_recover: failed to allocate recovery data\n"));
@@ -1276,6 +1339,15 @@ int tdb_transaction_recover(struct tdb_context *tdb)
 		return -1;
 	}
 
+	if (tdb->feature_flags & TDB_FEATURE_FLAG_RECOVERY_CHECKSUM) {
+		TDB_DATA blob = { .dptr = data, .dsize = rec.data_len };
+
+		if (tdb_jenkins_hash(&blob) != rec.full_hash) {
+			free(data);
+			return tdb_recovery_drop_torn(tdb, recovery_head);
+		}
+	}
+
 	/* recover the file data */
 	p = data;
 	while (p+8 < data + rec.data_len) {
@@ -495,6 +495,72 @@ fail:
 	return -1;
 }
 
+struct tdb_traverse_chunk_state {
+	tdb_traverse_func fn;
+	void *private_data;
+	bool stopped;
+};
+
+static int tdb_traverse_chunk_fn(struct tdb_context *tdb,
+				 TDB_DATA key, TDB_DATA data,
+				 void *private_data)
+{
+	struct tdb_traverse_chunk_state *state = private_data;
+	int ret;
+
+	ret = state->fn(tdb, key, data, state->private_data);
+	if (ret != 0) {
+		state->stopped = true;
+	}
+	return ret;
+}
+
+/*
+  Walk num_chains chains starting at *chain, one chain lock at a
+  time. *chain is left at the first chain not yet looked at, so the
+  caller can drop out, let writers in and resume later.
+*/
+_PUBLIC_ int tdb_traverse_read_chunk(struct tdb_context *tdb,
+				     unsigned *chain,
+				     unsigned num_chains,
+				     tdb_traverse_func fn,
+				     void *private_data)
+{
+	struct tdb_traverse_chunk_state state = {
+		.fn = fn, .private_data = private_data,
+	};
+	unsigned end;
+	int count = 0;
+
+	if (*chain > tdb->hash_size) {
+		tdb->ecode = TDB_ERR_EINVAL;
+		return -1;
+	}
+
+	end = tdb->hash_size;
+	if (num_chains < end - *chain) {
+		end = *chain + num_chains;
+	}
+
+	while (*chain < end) {
+		int ret;
+
+		ret = tdb_traverse_chain(tdb, *chain, tdb_traverse_chunk_fn,
+					 &state);
+		if (ret == -1) {
+			return -1;
+		}
+		count += ret;
+		*chain += 1;
+
+		if (state.stopped) {
+			break;
+		}
+	}
+
+	return count;
+}
+
 _PUBLIC_ int tdb_traverse_key_chain(struct tdb_context *tdb,
 				    TDB_DATA key,
 				    tdb_traverse_func fn,
@@ -84,6 +84,14 @@ extern "C" {
 #define TDB_MUTEX_LOCKING 4096 /** optimized locking using robust mutexes if supported,
                                    only with tdb >= 1.3.0 and TDB_CLEAR_IF_FIRST
                                    after checking tdb_runtime_check_for_robust_mutexes() */
+#define TDB_AUTO_HASH_SIZE 8192 /** with TDB_CLEAR_IF_FIRST: grow the hash size when the
+                                    tdb is wiped, if the chains have become too long,
+                                    only with tdb >= 1.3.18 */
+#define TDB_FREELIST_BINS 16384 /** create the tdb with one freelist per size class,
+                                    can't be opened by tdb < 1.3.18 */
+#define TDB_RECOVERY_CHECKSUM 32768 /** create the tdb with checksummed transaction recovery
+                                        data, commits need one fsync less,
+                                        can't be opened by tdb < 1.3.18 */
 
 /** The tdb error codes */
 enum TDB_ERROR {TDB_SUCCESS=0, TDB_ERR_CORRUPT, TDB_ERR_IO, TDB_ERR_LOCK, 
@@ -516,6 +524,48 @@ int tdb_traverse_chain(struct tdb_context *tdb,
 		       tdb_traverse_func fn,
 		       void *private_data);
 
+/**
+ * @brief Incrementally traverse a range of hash chains
+ *
+ * Walk the chains starting at *chain, at most num_chains of them,
+ * using tdb_traverse_chain() for each. Only one chain is locked at a
+ * time, and only while it is walked, so writers are never blocked for
+ * longer than the walk of a single chain. No database modification is
+ * possible in the callback.
+ *
+ * On return *chain is the first chain that has not been walked, pass
+ * it to the next call to resume the traverse. The traverse is
+ * complete when *chain equals tdb_hash_size(). If fn returns non-zero
+ * the traverse stops after the current chain, the remaining records
+ * of that chain are skipped.
+ *
+ * As chains are independent, several processes can walk disjoint
+ * ranges of a database in parallel. A tdb_context must not be shared
+ * between threads, each worker needs its own open of the database.
+ *
+ * Records stored or deleted while the traverse is paused show up
+ * according to the state of their chain at the time it is walked.
+ *
+ * @param[in]  tdb      The database to traverse.
+ *
+ * @param[in,out] chain The chain to start at, 0 for a new traverse.
+ *
+ * @param[in]  num_chains The maximum number of chains to walk.
+ *
+ * @param[in]  fn       The function to call on each entry.
+ *
+ * @param[in]  private_data The private data which should be passed to the
+ *                          traversing function.
+ *
+ * @return              The record count traversed, -1 on error.
+ */
+
+int tdb_traverse_read_chunk(struct tdb_context *tdb,
+			    unsigned *chain,
+			    unsigned num_chains,
+			    tdb_traverse_func fn,
+			    void *private_data);
+
 /**
  * @brief Traverse a single hash chain
  *
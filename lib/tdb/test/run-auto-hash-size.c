@@ -0,0 +1,72 @@
+#include "../common/tdb_private.h"
+#include "../common/io.c"
+#include "../common/tdb.c"
+#include "../common/lock.c"
+#include "../common/freelist.c"
+#include "../common/traverse.c"
+#include "../common/transaction.c"
+#include "../common/error.c"
+#include "../common/open.c"
+#include "../common/check.c"
+#include "../common/hash.c"
+#include "../common/mutex.c"
+#include "tap-interface.h"
+#include <stdlib.h>
+#include "logging.h"
+
+static void fill(struct tdb_context *tdb, int num)
+{
+	int i;
+
+	for (i=0; i<num; i++) {
+		TDB_DATA key = { .dptr = (uint8_t *)&i, .dsize = sizeof(i) };
+		tdb_store(tdb, key, key, TDB_INSERT);
+	}
+	for (i=0; i<num; i++) {
+		TDB_DATA key = { .dptr = (uint8_t *)&i, .dsize = sizeof(i) };
+		tdb_exists(tdb, key);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct tdb_context *tdb;
+	int flags = TDB_CLEAR_IF_FIRST | TDB_AUTO_HASH_SIZE;
+	int hash_size;
+
+	plan_tests(7);
+
+	unlink("run-auto-hash-size.tdb");
+
+	tdb = tdb_open_ex("run-auto-hash-size.tdb", 3, flags,
+			  O_CREAT|O_RDWR, 0600, &taplogctx, NULL);
+	ok1(tdb);
+	ok1(tdb_hash_size(tdb) == 3);
+
+	/* About 100 records per chain */
+	fill(tdb, 300);
+	tdb_close(tdb);
+
+	tdb = tdb_open_ex("run-auto-hash-size.tdb", 3, flags,
+			  O_CREAT|O_RDWR, 0600, &taplogctx, NULL);
+	ok1(tdb);
+	hash_size = tdb_hash_size(tdb);
+	ok1(hash_size > 3*TDB_AUTO_HASH_MAX_CHAIN/TDB_AUTO_HASH_TARGET_CHAIN);
+
+	/* Short chains this time, the size must not shrink again */
+	tdb_close(tdb);
+
+	tdb = tdb_open_ex("run-auto-hash-size.tdb", 3, flags,
+			  O_CREAT|O_RDWR, 0600, &taplogctx, NULL);
+	ok1(tdb);
+	ok1(tdb_hash_size(tdb) == hash_size);
+	tdb_close(tdb);
+
+	/* Without the flag the caller's hash size is used */
+	tdb = tdb_open_ex("run-auto-hash-size.tdb", 3, TDB_CLEAR_IF_FIRST,
+			  O_CREAT|O_RDWR, 0600, &taplogctx, NULL);
+	ok1(tdb_hash_size(tdb) == 3);
+	tdb_close(tdb);
+
+	return exit_status();
+}
@@ -0,0 +1,133 @@
+#include "../common/tdb_private.h"
+#include "../common/io.c"
+#include "../common/tdb.c"
+#include "../common/lock.c"
+#include "../common/freelist.c"
+#include "../common/freelistcheck.c"
+#include "../common/traverse.c"
+#include "../common/transaction.c"
+#include "../common/error.c"
+#include "../common/open.c"
+#include "../common/check.c"
+#include "../common/hash.c"
+#include "../common/mutex.c"
+#include "tap-interface.h"
+#include <stdlib.h>
+#include "logging.h"
+
+static bool store_and_delete(struct tdb_context *tdb, int num)
+{
+	unsigned char buf[3000];
+	int i;
+
+	memset(buf, 'x', sizeof(buf));
+
+	for (i=0; i<num; i++) {
+		TDB_DATA key = { .dptr = (uint8_t *)&i, .dsize = sizeof(i) };
+		TDB_DATA data = { .dptr = buf, .dsize = (i*37) % sizeof(buf) };
+
+		if (tdb_store(tdb, key, data, TDB_REPLACE) != 0) {
+			return false;
+		}
+	}
+	for (i=0; i<num; i+=2) {
+		TDB_DATA key = { .dptr = (uint8_t *)&i, .dsize = sizeof(i) };
+
+		if (tdb_delete(tdb, key) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* All free records must be at least as large as their bin */
+static bool bins_ok(struct tdb_context *tdb, bool exact)
+{
+	uint32_t bin;
+
+	for (bin=0; bin<TDB_NUM_FREELIST_BINS; bin++) {
+		struct tdb_record rec;
+		tdb_off_t ptr;
+
+		if (tdb_ofs_read(tdb, TDB_FREELIST_BIN_OFS(bin), &ptr) != 0) {
+			return false;
+		}
+		while (ptr != 0) {
+			uint32_t rec_bin;
+
+			if (tdb_rec_free_read(tdb, ptr, &rec) != 0) {
+				return false;
+			}
+			rec_bin = tdb_freelist_bin(rec.rec_len);
+			if ((rec.full_hash != bin) || (rec_bin < bin)) {
+				return false;
+			}
+			if (exact && (rec_bin != bin)) {
+				return false;
+			}
+			ptr = rec.next;
+		}
+	}
+	return true;
+}
+
+static void test_bins(int tdb_flags)
+{
+	struct tdb_context *tdb;
+	tdb_len_t size;
+	int num_free, i;
+
+	unlink("run-freelist-bins.tdb");
+
+	tdb = tdb_open_ex("run-freelist-bins.tdb", 131,
+			  tdb_flags|TDB_CLEAR_IF_FIRST|TDB_FREELIST_BINS,
+			  O_CREAT|O_RDWR, 0600, &taplogctx, NULL);
+	ok1(tdb);
+	ok1(tdb_have_freelist_bins(tdb));
+
+	ok1(store_and_delete(tdb, 2000));
+	ok1(tdb_check(tdb, NULL, NULL) == 0);
+	ok1(tdb_validate_freelist(tdb, &num_free) == 0 && num_free > 0);
+	ok1(bins_ok(tdb, false));
+
+	/* Reusing the free space must not grow the file much */
+	size = tdb->map_size;
+	for (i=0; i<10; i++) {
+		store_and_delete(tdb, 2000);
+	}
+	ok1(tdb->map_size < size * 2);
+
+	/* Merging puts all records into their real bin */
+	ok1(tdb_freelist_size(tdb) > 0);
+	ok1(bins_ok(tdb, true));
+	ok1(tdb_check(tdb, NULL, NULL) == 0);
+
+	ok1(tdb_wipe_all(tdb) == 0);
+	ok1(tdb_freelist_size(tdb) >= 1);
+	ok1(tdb_check(tdb, NULL, NULL) == 0);
+
+	tdb_close(tdb);
+}
+
+int main(int argc, char *argv[])
+{
+	struct tdb_context *tdb;
+
+	plan_tests(2*13 + 1);
+
+	test_bins(0);
+
+	/* The flag only matters when the tdb is created */
+	tdb = tdb_open_ex("run-freelist-bins.tdb", 131, TDB_DEFAULT,
+			  O_CREAT|O_RDWR, 0600, &taplogctx, NULL);
+	ok1(tdb_have_freelist_bins(tdb));
+	tdb_close(tdb);
+
+	if (tdb_runtime_check_for_robust_mutexes()) {
+		test_bins(TDB_MUTEX_LOCKING);
+	} else {
+		skip(13, "No robust mutex support");
+	}
+
+	return exit_status();
+}
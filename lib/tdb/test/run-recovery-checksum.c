@@ -0,0 +1,174 @@
+#include "../common/tdb_private.h"
+static int fdatasync_count(int fd);
+static int fsync_count(int fd);
+
+#define fdatasync fdatasync_count
+#define fsync fsync_count
+
+#include "../common/io.c"
+#include "../common/tdb.c"
+#include "../common/lock.c"
+#include "../common/freelist.c"
+#include "../common/traverse.c"
+#include "../common/transaction.c"
+#include "../common/error.c"
+#include "../common/open.c"
+#include "../common/check.c"
+#include "../common/hash.c"
+#include "../common/mutex.c"
+#include "tap-interface.h"
+#include <stdlib.h>
+#include "logging.h"
+
+#undef fdatasync
+#undef fsync
+
+#define TEST_DBNAME "run-recovery-checksum.tdb"
+
+static int num_syncs;
+
+static int fdatasync_count(int fd)
+{
+	num_syncs += 1;
+	return fdatasync(fd);
+}
+
+static int fsync_count(int fd)
+{
+	num_syncs += 1;
+	return fsync(fd);
+}
+
+static struct tdb_context *open_test_tdb(int tdb_flags, int open_flags)
+{
+	return tdb_open_ex(TEST_DBNAME, 131, tdb_flags, open_flags, 0600,
+			   &taplogctx, NULL);
+}
+
+static int store_in_transaction(struct tdb_context *tdb, int i)
+{
+	TDB_DATA key = { .dptr = (uint8_t *)&i, .dsize = sizeof(i) };
+
+	if (tdb_transaction_start(tdb) != 0) {
+		return -1;
+	}
+	if (tdb_store(tdb, key, key, TDB_REPLACE) != 0) {
+		tdb_transaction_cancel(tdb);
+		return -1;
+	}
+	num_syncs = 0;
+	if (tdb_transaction_commit(tdb) != 0) {
+		return -1;
+	}
+	return num_syncs;
+}
+
+/*
+ * Have a child prepare a commit and die. With corrupt_ofs != 0 the
+ * child garbles the database as if it died while writing the data,
+ * otherwise the recovery data is garbled as if the write of the
+ * recovery record was torn.
+ */
+static bool die_during_commit(int tdb_flags, int i, tdb_off_t corrupt_ofs)
+{
+	pid_t child;
+	int status;
+
+	child = fork();
+	if (child == -1) {
+		return false;
+	}
+	if (child == 0) {
+		struct tdb_context *tdb;
+		TDB_DATA key = { .dptr = (uint8_t *)&i, .dsize = sizeof(i) };
+		tdb_off_t recovery_head;
+		uint8_t garbage[64];
+
+		tdb = open_test_tdb(tdb_flags, O_RDWR);
+		if (tdb == NULL) {
+			_exit(1);
+		}
+		if ((tdb_transaction_start(tdb) != 0) ||
+		    (tdb_store(tdb, key, key, TDB_REPLACE) != 0) ||
+		    (tdb_transaction_prepare_commit(tdb) != 0)) {
+			_exit(2);
+		}
+		if (tdb->transaction->io_methods->tdb_read(
+			    tdb, TDB_RECOVERY_HEAD, &recovery_head,
+			    sizeof(recovery_head), DOCONV()) != 0) {
+			_exit(3);
+		}
+		memset(garbage, 0xff, sizeof(garbage));
+		if (corrupt_ofs == 0) {
+			corrupt_ofs = recovery_head + sizeof(struct tdb_record);
+		}
+		if (pwrite(tdb->fd, garbage, sizeof(garbage),
+			   corrupt_ofs) != sizeof(garbage)) {
+			_exit(4);
+		}
+		_exit(0);
+	}
+	if (waitpid(child, &status, 0) != child) {
+		return false;
+	}
+	return WIFEXITED(status) && (WEXITSTATUS(status) == 0);
+}
+
+static bool check_after_death(int tdb_flags, int i, bool exists)
+{
+	struct tdb_context *tdb;
+	TDB_DATA key = { .dptr = (uint8_t *)&i, .dsize = sizeof(i) };
+	bool ret;
+
+	tdb = open_test_tdb(tdb_flags, O_RDWR);
+	if (tdb == NULL) {
+		return false;
+	}
+	ret = !tdb_needs_recovery(tdb) &&
+		(tdb_check(tdb, NULL, NULL) == 0) &&
+		(tdb_exists(tdb, key) == exists);
+	tdb_close(tdb);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	struct tdb_context *tdb;
+	int plain_syncs, csum_syncs;
+
+	plan_tests(10);
+
+	unlink(TEST_DBNAME);
+	tdb = open_test_tdb(TDB_NOMMAP, O_CREAT|O_RDWR);
+	ok1(tdb);
+	store_in_transaction(tdb, 0);
+	plain_syncs = store_in_transaction(tdb, 1);
+	tdb_close(tdb);
+
+	unlink(TEST_DBNAME);
+	tdb = open_test_tdb(TDB_NOMMAP|TDB_RECOVERY_CHECKSUM, O_CREAT|O_RDWR);
+	ok1(tdb);
+	ok1(tdb->feature_flags & TDB_FEATURE_FLAG_RECOVERY_CHECKSUM);
+	store_in_transaction(tdb, 0);
+	csum_syncs = store_in_transaction(tdb, 1);
+	ok1(csum_syncs == plain_syncs - 1);
+	tdb_close(tdb);
+
+	/* The feature is recorded in the file */
+	tdb = open_test_tdb(TDB_NOMMAP, O_RDWR);
+	ok1(tdb->feature_flags & TDB_FEATURE_FLAG_RECOVERY_CHECKSUM);
+	tdb_close(tdb);
+
+	/* A torn recovery record is dropped, nothing was written yet */
+	ok1(die_during_commit(TDB_NOMMAP, 2, 0));
+	ok1(check_after_death(TDB_NOMMAP, 2, false));
+
+	/* Intact recovery data is still used to undo a partial commit */
+	ok1(die_during_commit(TDB_NOMMAP, 3, sizeof(struct tdb_header)));
+	ok1(check_after_death(TDB_NOMMAP, 3, false));
+	ok1(check_after_death(TDB_NOMMAP, 1, true));
+
+	unlink(TEST_DBNAME);
+
+	return exit_status();
+}
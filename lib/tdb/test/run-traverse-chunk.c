@@ -0,0 +1,110 @@
+#include "../common/tdb_private.h"
+#include "../common/io.c"
+#include "../common/tdb.c"
+#include "../common/lock.c"
+#include "../common/freelist.c"
+#include "../common/traverse.c"
+#include "../common/transaction.c"
+#include "../common/error.c"
+#include "../common/open.c"
+#include "../common/check.c"
+#include "../common/hash.c"
+#include "../common/mutex.c"
+#include "tap-interface.h"
+#include <stdlib.h>
+#include "logging.h"
+
+#define NUM_RECORDS 1000
+
+static int mark_fn(struct tdb_context *tdb, TDB_DATA key, TDB_DATA data,
+		   void *private_data)
+{
+	int *seen = private_data;
+	int i;
+
+	memcpy(&i, key.dptr, sizeof(i));
+	seen[i] += 1;
+	return 0;
+}
+
+static int stop_fn(struct tdb_context *tdb, TDB_DATA key, TDB_DATA data,
+		   void *private_data)
+{
+	return 1;
+}
+
+static bool all_seen_once(const int *seen)
+{
+	int i;
+
+	for (i=0; i<NUM_RECORDS; i++) {
+		if (seen[i] != 1) {
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	struct tdb_context *tdb;
+	int seen[NUM_RECORDS];
+	unsigned chain, half;
+	int i, count, calls;
+
+	plan_tests(11);
+
+	tdb = tdb_open_ex("run-traverse-chunk.tdb", 131,
+			  TDB_CLEAR_IF_FIRST, O_CREAT|O_RDWR, 0600,
+			  &taplogctx, NULL);
+	ok1(tdb);
+
+	for (i=0; i<NUM_RECORDS; i++) {
+		TDB_DATA key = { .dptr = (uint8_t *)&i, .dsize = sizeof(i) };
+		tdb_store(tdb, key, key, TDB_INSERT);
+	}
+
+	/* Walk everything in small steps */
+	memset(seen, 0, sizeof(seen));
+	chain = 0;
+	count = 0;
+	calls = 0;
+	while (chain < tdb_hash_size(tdb)) {
+		int ret = tdb_traverse_read_chunk(tdb, &chain, 10,
+						  mark_fn, seen);
+		if (ret == -1) {
+			break;
+		}
+		count += ret;
+		calls += 1;
+	}
+	ok1(chain == tdb_hash_size(tdb));
+	ok1(count == NUM_RECORDS);
+	ok1(calls == 14);
+	ok1(all_seen_once(seen));
+
+	/* A finished traverse stays finished */
+	ok1(tdb_traverse_read_chunk(tdb, &chain, 10, mark_fn, seen) == 0);
+
+	/* Two disjoint ranges cover the database */
+	memset(seen, 0, sizeof(seen));
+	half = tdb_hash_size(tdb) / 2;
+	chain = 0;
+	count = tdb_traverse_read_chunk(tdb, &chain, half, mark_fn, seen);
+	ok1(chain == half);
+	count += tdb_traverse_read_chunk(tdb, &chain, UINT_MAX,
+					 mark_fn, seen);
+	ok1(count == NUM_RECORDS && all_seen_once(seen));
+
+	/* Stopping moves on to the next chain */
+	chain = 0;
+	ok1(tdb_traverse_read_chunk(tdb, &chain, 10, stop_fn, NULL) == 1);
+	ok1(chain == 1);
+
+	chain = tdb_hash_size(tdb) + 1;
+	ok1(tdb_traverse_read_chunk(tdb, &chain, 1, mark_fn, seen) == -1);
+
+	tdb_close(tdb);
+
+	return exit_status();
+}
@@ -697,6 +697,150 @@ static bool test_event_fd2(struct torture_context *tctx,
 	return true;
 }
 
+struct test_event_fd_exclusive_state {
+	int fd;
+	int num_read;
+	int num_write;
+	uint16_t last_flags;
+	bool timed_out;
+};
+
+static void test_event_fd_exclusive_handler(struct tevent_context *ev_ctx,
+					    struct tevent_fd *fde,
+					    uint16_t flags,
+					    void *private_data)
+{
+	struct test_event_fd_exclusive_state *state =
+		(struct test_event_fd_exclusive_state *)private_data;
+	uint8_t c;
+
+	state->last_flags = flags;
+
+	if (flags & TEVENT_FD_READ) {
+		do_read(state->fd, &c, 1);
+		state->num_read++;
+	}
+	if (flags & TEVENT_FD_WRITE) {
+		state->num_write++;
+		tevent_fd_set_flags(fde, TEVENT_FD_READ|TEVENT_FD_EXCLUSIVE);
+	}
+}
+
+static void test_event_fd_exclusive_timeout(struct tevent_context *ev_ctx,
+					    struct tevent_timer *te,
+					    struct timeval tval,
+					    void *private_data)
+{
+	struct test_event_fd_exclusive_state *state =
+		(struct test_event_fd_exclusive_state *)private_data;
+
+	state->timed_out = true;
+}
+
+/*
+ * poll_mt may return from tevent_loop_once() for its internal wakeup
+ * after a flag change, so loop until the event we wait for arrived.
+ */
+static bool test_event_fd_exclusive_wait(struct tevent_context *ev,
+					 struct test_event_fd_exclusive_state *state,
+					 const int *counter,
+					 int expected)
+{
+	while (*counter < expected) {
+		if (state->timed_out) {
+			return false;
+		}
+		if (tevent_loop_once(ev) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool test_event_fd_exclusive(struct torture_context *tctx,
+				    const void *test_data)
+{
+	const char *backend = (const char *)test_data;
+	struct test_event_fd_exclusive_state state = { .fd = -1 };
+	struct tevent_context *ev = NULL;
+	struct tevent_timer *te = NULL;
+	struct tevent_fd *fde = NULL;
+	int sock[2];
+	uint8_t c = 0;
+	bool ok = true;
+	int ret;
+
+	ev = tevent_context_init_byname(tctx, backend);
+	if (ev == NULL) {
+		torture_skip(tctx, talloc_asprintf(tctx,
+			     "event backend '%s' not supported\n",
+			     backend));
+		return true;
+	}
+
+	tevent_set_debug_stderr(ev);
+	torture_comment(tctx, "backend '%s' - %s\n",
+			backend, __FUNCTION__);
+
+	/*
+	 * TEVENT_FD_EXCLUSIVE only changes how epoll registers the
+	 * fd, all backends have to accept it and deliver READ and
+	 * WRITE as usual, also when switching into and out of
+	 * waiting for TEVENT_FD_WRITE.
+	 */
+	ret = socketpair(AF_UNIX, SOCK_STREAM, 0, sock);
+	torture_assert_int_equal(tctx, ret, 0, "socketpair failed");
+	state.fd = sock[0];
+
+	te = tevent_add_timer(ev, ev, timeval_current_ofs(10, 0),
+			      test_event_fd_exclusive_timeout, &state);
+	torture_assert_goto(tctx, te != NULL, ok, done,
+			    "tevent_add_timer failed\n");
+
+	fde = tevent_add_fd(ev, ev, sock[0],
+			    TEVENT_FD_READ|TEVENT_FD_EXCLUSIVE,
+			    test_event_fd_exclusive_handler, &state);
+	torture_assert_goto(tctx, fde != NULL, ok, done,
+			    "tevent_add_fd failed\n");
+	tevent_fd_set_auto_close(fde);
+
+	torture_assert_int_equal_goto(tctx, tevent_fd_get_flags(fde),
+				      TEVENT_FD_READ|TEVENT_FD_EXCLUSIVE,
+				      ok, done, "wrong fd flags\n");
+
+	do_write(sock[1], &c, 1);
+	torture_assert_goto(tctx,
+			    test_event_fd_exclusive_wait(ev, &state,
+							 &state.num_read, 1),
+			    ok, done, "no read event\n");
+	torture_assert_int_equal_goto(tctx, state.last_flags,
+				      TEVENT_FD_READ, ok, done,
+				      "wrong handler flags\n");
+
+	tevent_fd_set_flags(fde,
+			    TEVENT_FD_READ|TEVENT_FD_WRITE|TEVENT_FD_EXCLUSIVE);
+	torture_assert_goto(tctx,
+			    test_event_fd_exclusive_wait(ev, &state,
+							 &state.num_write, 1),
+			    ok, done, "no write event\n");
+	torture_assert_int_equal_goto(tctx, state.last_flags,
+				      TEVENT_FD_WRITE, ok, done,
+				      "wrong handler flags\n");
+
+	do_write(sock[1], &c, 1);
+	torture_assert_goto(tctx,
+			    test_event_fd_exclusive_wait(ev, &state,
+							 &state.num_read, 2),
+			    ok, done, "no read event after flag change\n");
+	torture_assert_int_equal_goto(tctx, state.num_write, 1, ok, done,
+				      "unexpected write event\n");
+
+done:
+	close(sock[1]);
+	TALLOC_FREE(ev);
+	return ok;
+}
+
 struct test_wrapper_state {
 	struct torture_context *tctx;
 	int num_events;
@@ -1202,6 +1346,108 @@ done:
 	return ok;
 }
 
+struct test_timer_order_state {
+	struct timeval when[64];
+	int order[64];
+	int num_fired;
+};
+
+struct test_timer_order_timer {
+	struct test_timer_order_state *state;
+	int idx;
+};
+
+static void test_timer_order_handler(struct tevent_context *ev,
+				     struct tevent_timer *te,
+				     struct timeval current_time,
+				     void *private_data)
+{
+	struct test_timer_order_timer *t = private_data;
+
+	t->state->order[t->state->num_fired++] = t->idx;
+}
+
+/*
+ * Timers with a few distinct timeouts, some due at the same time, some
+ * of them changed or freed. They have to fire in time order, and the
+ * ones due at the same time in the order they were added.
+ */
+static bool test_event_timer_order(struct torture_context *test,
+				   const void *test_data)
+{
+	struct tevent_context *ev_ctx;
+	const char *backend = (const char *)test_data;
+	struct test_timer_order_state state = { .num_fired = 0 };
+	struct test_timer_order_timer timers[64];
+	struct tevent_timer *te[64];
+	struct timeval now;
+	int i, expected_fired = 0;
+
+	ev_ctx = tevent_context_init_byname(test, backend);
+	if (ev_ctx == NULL) {
+		torture_comment(test, "event backend '%s' not supported\n",
+				backend);
+		return true;
+	}
+
+	now = tevent_timeval_current();
+
+	for (i=0; i<64; i++) {
+		uint32_t usecs = (i % 4) * 20000 + (i / 8) * 1000;
+
+		timers[i] = (struct test_timer_order_timer) {
+			.state = &state, .idx = i
+		};
+		state.when[i] = tevent_timeval_add(&now, 0, usecs);
+		te[i] = tevent_add_timer(ev_ctx, ev_ctx, state.when[i],
+					 test_timer_order_handler,
+					 &timers[i]);
+		torture_assert(test, te[i] != NULL, "tevent_add_timer failed");
+	}
+
+	for (i=0; i<64; i+=7) {
+		TALLOC_FREE(te[i]);
+	}
+	for (i=3; i<64; i+=11) {
+		if (te[i] == NULL) {
+			continue;
+		}
+		state.when[i] = tevent_timeval_add(&now, 0, 5000);
+		tevent_update_timer(te[i], state.when[i]);
+	}
+	for (i=0; i<64; i++) {
+		if (te[i] != NULL) {
+			expected_fired += 1;
+		}
+	}
+
+	while (state.num_fired < expected_fired) {
+		torture_assert(test, tevent_loop_once(ev_ctx) == 0,
+			       "tevent_loop_once failed");
+	}
+
+	for (i=1; i<state.num_fired; i++) {
+		int prev = state.order[i-1];
+		int cur = state.order[i];
+		int cmp = tevent_timeval_compare(&state.when[prev],
+						 &state.when[cur]);
+
+		torture_assert(test, cmp <= 0, "timers fired out of order");
+		if (cmp == 0) {
+			bool prev_updated = ((prev % 11) == 3);
+			bool cur_updated = ((cur % 11) == 3);
+
+			if (prev_updated == cur_updated) {
+				torture_assert(test, prev < cur,
+					       "equal timers fired out of order");
+			}
+		}
+	}
+
+	talloc_free(ev_ctx);
+	return true;
+}
+
 #ifdef HAVE_PTHREAD
 
 static pthread_mutex_t threaded_mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -1786,6 +2032,10 @@ struct torture_suite *torture_local_event(TALLOC_CTX *mem_ctx)
 					       "fd2",
 					       test_event_fd2,
 					       (const void *)list[i]);
+		torture_suite_add_simple_tcase_const(backend_suite,
+					       "fd_exclusive",
+					       test_event_fd_exclusive,
+					       (const void *)list[i]);
 		torture_suite_add_simple_tcase_const(backend_suite,
 					       "wrapper",
 					       test_wrapper,
@@ -1794,6 +2044,10 @@ struct torture_suite *torture_local_event(TALLOC_CTX *mem_ctx)
 					       "free_wrapper",
 					       test_free_wrapper,
 					       (const void *)list[i]);
+		torture_suite_add_simple_tcase_const(backend_suite,
+					       "timer_order",
+					       test_event_timer_order,
+					       (const void *)list[i]);
 
 		torture_suite_add_suite(suite, backend_suite);
 	}
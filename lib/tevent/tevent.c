@@ -369,6 +369,7 @@ int tevent_common_context_destructor(struct tevent_context *ev)
 	}
 
 	ev->last_zero_timer = NULL;
+	memset(ev->timer_hints, 0, sizeof(ev->timer_hints));
 	for (te = ev->timer_events; te; te = tn) {
 		tn = te->next;
 		te->wrapper = NULL;
@@ -490,6 +490,15 @@ void tevent_set_abort_fn(void (*abort_fn)(const char *reason));
  * Monitor a file descriptor for writeability
  */
 #define TEVENT_FD_WRITE 2
+/**
+ * Together with #TEVENT_FD_READ: If several processes wait for the
+ * same fd, for example a listening socket shared by prefork workers,
+ * only wake up one of them. Only the epoll backend supports this,
+ * it's ignored elsewhere.
+ *
+ * @note Available as of tevent 0.9.39
+ */
+#define TEVENT_FD_EXCLUSIVE 4
 
 /**
  * Convenience function for declaring a tevent_fd writable
@@ -50,6 +50,7 @@ struct epoll_event_context {
 #define EPOLL_ADDITIONAL_FD_FLAG_REPORT_ERROR	(1<<1)
 #define EPOLL_ADDITIONAL_FD_FLAG_GOT_ERROR	(1<<2)
 #define EPOLL_ADDITIONAL_FD_FLAG_HAS_MPX	(1<<3)
+#define EPOLL_ADDITIONAL_FD_FLAG_EXCLUSIVE	(1<<4)
 
 #ifdef TEST_PANIC_FALLBACK
 
@@ -179,6 +180,93 @@ static uint32_t epoll_map_flags(uint16_t flags)
 	return ret;
 }
 
+/*
+  EPOLLEXCLUSIVE is only used for fdes that just want to read. We can't
+  use it for multiplexed fdes, they share one epoll registration.
+*/
+static bool epoll_want_exclusive(struct tevent_fd *fde,
+				 struct tevent_fd *mpx_fde)
+{
+	if (mpx_fde != NULL) {
+		return false;
+	}
+	if (!(fde->flags & TEVENT_FD_EXCLUSIVE)) {
+		return false;
+	}
+	return ((fde->flags & TEVENT_FD_WRITE) == 0);
+}
+
+/*
+  EPOLL_CTL_ADD, with EPOLLEXCLUSIVE if wanted and supported
+*/
+static int epoll_ctl_add(struct epoll_event_context *epoll_ev,
+			 struct tevent_fd *fde,
+			 struct epoll_event *event,
+			 bool exclusive)
+{
+#ifdef EPOLLEXCLUSIVE
+	if (exclusive) {
+		struct epoll_event ex_event = *event;
+		int ret;
+
+		ex_event.events |= EPOLLEXCLUSIVE;
+		ret = epoll_ctl(epoll_ev->epoll_fd, EPOLL_CTL_ADD, fde->fd,
+				&ex_event);
+		if (ret == 0) {
+			fde->additional_flags |=
+				EPOLL_ADDITIONAL_FD_FLAG_EXCLUSIVE;
+			return 0;
+		}
+		if (errno != EINVAL) {
+			return ret;
+		}
+		/*
+		 * Kernel too old, fall back to a normal registration
+		 */
+	}
+#endif
+	return epoll_ctl(epoll_ev->epoll_fd, EPOLL_CTL_ADD, fde->fd, event);
+}
+
+/*
+  EPOLL_CTL_MOD. An fd registered with EPOLLEXCLUSIVE can't be
+  modified, and EPOLLEXCLUSIVE can't be added by EPOLL_CTL_MOD, so in
+  these cases we have to remove and re-add the fd.
+*/
+static int epoll_ctl_mod(struct epoll_event_context *epoll_ev,
+			 struct tevent_fd *fde,
+			 struct tevent_fd *mpx_fde,
+			 struct epoll_event *event)
+{
+	bool was_exclusive, exclusive;
+	int ret;
+
+	was_exclusive = (fde->additional_flags &
+			 EPOLL_ADDITIONAL_FD_FLAG_EXCLUSIVE);
+	if (mpx_fde != NULL) {
+		was_exclusive |= (mpx_fde->additional_flags &
+				  EPOLL_ADDITIONAL_FD_FLAG_EXCLUSIVE);
+	}
+	exclusive = epoll_want_exclusive(fde, mpx_fde);
+
+	if (!was_exclusive && !exclusive) {
+		return epoll_ctl(epoll_ev->epoll_fd, EPOLL_CTL_MOD, fde->fd,
+				 event);
+	}
+
+	ret = epoll_ctl(epoll_ev->epoll_fd, EPOLL_CTL_DEL, fde->fd, event);
+	if (ret != 0) {
+		return ret;
+	}
+	fde->additional_flags &= ~EPOLL_ADDITIONAL_FD_FLAG_EXCLUSIVE;
+	if (mpx_fde != NULL) {
+		mpx_fde->additional_flags &=
+			~EPOLL_ADDITIONAL_FD_FLAG_EXCLUSIVE;
+	}
+
+	return epoll_ctl_add(epoll_ev, fde, event, exclusive);
+}
+
 /*
  free the epoll fd
 */
@@ -245,6 +333,7 @@ static void epoll_check_reopen(struct epoll_event_context *epoll_ev)
 	epoll_ev->panic_state = &panic_triggered;
 	for (fde=epoll_ev->ev->fd_events;fde;fde=fde->next) {
 		fde->additional_flags &= ~EPOLL_ADDITIONAL_FD_FLAG_HAS_EVENT;
+		fde->additional_flags &= ~EPOLL_ADDITIONAL_FD_FLAG_EXCLUSIVE;
 		epoll_update_event(epoll_ev, fde);
 
 		if (panic_triggered) {
@@ -316,7 +405,7 @@ static int epoll_add_multiplex_fd(struct epoll_event_context *epoll_ev,
 	event.events = epoll_map_flags(mpx_fde->flags);
 	event.events |= epoll_map_flags(add_fde->flags);
 	event.data.ptr = mpx_fde;
-	ret = epoll_ctl(epoll_ev->epoll_fd, EPOLL_CTL_MOD, mpx_fde->fd, &event);
+	ret = epoll_ctl_mod(epoll_ev, mpx_fde, add_fde, &event);
 	if (ret != 0 && errno == EBADF) {
 		tevent_debug(epoll_ev->ev, TEVENT_DEBUG_ERROR,
 			     "EPOLL_CTL_MOD EBADF for "
@@ -363,6 +452,7 @@ static void epoll_add_event(struct epoll_event_context *epoll_ev, struct tevent_
 
 	fde->additional_flags &= ~EPOLL_ADDITIONAL_FD_FLAG_HAS_EVENT;
 	fde->additional_flags &= ~EPOLL_ADDITIONAL_FD_FLAG_REPORT_ERROR;
+	fde->additional_flags &= ~EPOLL_ADDITIONAL_FD_FLAG_EXCLUSIVE;
 
 	if (fde->additional_flags & EPOLL_ADDITIONAL_FD_FLAG_HAS_MPX) {
 		/*
@@ -382,7 +472,8 @@ static void epoll_add_event(struct epoll_event_context *epoll_ev, struct tevent_
 		event.events |= epoll_map_flags(mpx_fde->flags);
 	}
 	event.data.ptr = fde;
-	ret = epoll_ctl(epoll_ev->epoll_fd, EPOLL_CTL_ADD, fde->fd, &event);
+	ret = epoll_ctl_add(epoll_ev, fde, &event,
+			    epoll_want_exclusive(fde, mpx_fde));
 	if (ret != 0 && errno == EBADF) {
 		tevent_debug(epoll_ev->ev, TEVENT_DEBUG_ERROR,
 			     "EPOLL_CTL_ADD EBADF for "
@@ -437,6 +528,7 @@ static void epoll_del_event(struct epoll_event_context *epoll_ev, struct tevent_
 
 	fde->additional_flags &= ~EPOLL_ADDITIONAL_FD_FLAG_HAS_EVENT;
 	fde->additional_flags &= ~EPOLL_ADDITIONAL_FD_FLAG_REPORT_ERROR;
+	fde->additional_flags &= ~EPOLL_ADDITIONAL_FD_FLAG_EXCLUSIVE;
 
 	if (fde->additional_flags & EPOLL_ADDITIONAL_FD_FLAG_HAS_MPX) {
 		/*
@@ -447,6 +539,7 @@ static void epoll_del_event(struct epoll_event_context *epoll_ev, struct tevent_
 
 		mpx_fde->additional_flags &= ~EPOLL_ADDITIONAL_FD_FLAG_HAS_EVENT;
 		mpx_fde->additional_flags &= ~EPOLL_ADDITIONAL_FD_FLAG_REPORT_ERROR;
+		mpx_fde->additional_flags &= ~EPOLL_ADDITIONAL_FD_FLAG_EXCLUSIVE;
 	}
 
 	ZERO_STRUCT(event);
@@ -510,7 +603,7 @@ static void epoll_mod_event(struct epoll_event_context *epoll_ev, struct tevent_
 		event.events |= epoll_map_flags(mpx_fde->flags);
 	}
 	event.data.ptr = fde;
-	ret = epoll_ctl(epoll_ev->epoll_fd, EPOLL_CTL_MOD, fde->fd, &event);
+	ret = epoll_ctl_mod(epoll_ev, fde, mpx_fde, &event);
 	if (ret != 0 && errno == EBADF) {
 		tevent_debug(epoll_ev->ev, TEVENT_DEBUG_ERROR,
 			     "EPOLL_CTL_MOD EBADF for "
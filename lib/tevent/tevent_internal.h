@@ -281,6 +281,8 @@ void tevent_abort(struct tevent_context *ev, const char *reason);
 
 void tevent_common_check_double_free(TALLOC_CTX *ptr, const char *reason);
 
+#define TEVENT_NUM_TIMER_HINTS 8
+
 struct tevent_context {
 	/* the specific events implementation */
 	const struct tevent_ops *ops;
@@ -359,6 +361,16 @@ struct tevent_context {
 #ifdef HAVE_PTHREAD
 	struct tevent_context *prev, *next;
 #endif
+
+	/*
+	 * Recently inserted timers, starting points to find the
+	 * position of new timers in timer_events. Most timers are
+	 * "now + timeout" with few distinct timeouts, so a new timer
+	 * goes right behind one of these. Only used via
+	 * tevent_common_add_timer_v2() and tevent_update_timer().
+	 */
+	struct tevent_timer *timer_hints[TEVENT_NUM_TIMER_HINTS];
+	unsigned next_timer_hint;
 };
 
 const struct tevent_ops *tevent_find_ops_byname(const char *name);
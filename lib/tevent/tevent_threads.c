@@ -474,6 +474,7 @@ void _tevent_threaded_schedule_immediate(struct tevent_threaded_context *tctx,
 	const char *create_location = im->create_location;
 	struct tevent_context *main_ev = NULL;
 	struct tevent_wrapper_glue *glue = NULL;
+	bool need_wakeup;
 	int ret, wakeup_fd;
 
 	ret = pthread_mutex_lock(&tctx->event_ctx_mutex);
@@ -529,6 +530,16 @@ void _tevent_threaded_schedule_immediate(struct tevent_threaded_context *tctx,
 		abort();
 	}
 
+	/*
+	 * Only the first immediate on an empty list needs to wake up
+	 * the main thread. It has not yet run
+	 * tevent_common_threaded_activate_immediate() for it, which
+	 * will pick up all immediates added until then. This saves
+	 * the wakeup syscall for everything but the first of a burst
+	 * of completions.
+	 */
+	need_wakeup = (main_ev->scheduled_immediates == NULL);
+
 	DLIST_ADD_END(main_ev->scheduled_immediates, im);
 	wakeup_fd = main_ev->wakeup_fd;
 
@@ -552,7 +563,9 @@ void _tevent_threaded_schedule_immediate(struct tevent_threaded_context *tctx,
 	 * than a noncontended one. So I'd opt for the lower footprint
 	 * initially. Maybe we have to change that later.
 	 */
-	tevent_common_wakeup_fd(wakeup_fd);
+	if (need_wakeup) {
+		tevent_common_wakeup_fd(wakeup_fd);
+	}
 #else
 	/*
 	 * tevent_threaded_context_create() returned NULL with ENOSYS...
@@ -129,6 +129,27 @@ struct timeval tevent_timeval_current_ofs(uint32_t secs, uint32_t usecs)
 	return tevent_timeval_add(&tv, secs, usecs);
 }
 
+/*
+  remove a timer from ev->timer_events, keeping the optimization
+  pointers valid
+*/
+static void tevent_common_remove_timer(struct tevent_context *ev,
+				       struct tevent_timer *te)
+{
+	struct tevent_timer *prev_te = DLIST_PREV(te);
+	unsigned i;
+
+	if (ev->last_zero_timer == te) {
+		ev->last_zero_timer = prev_te;
+	}
+	for (i=0; i<TEVENT_NUM_TIMER_HINTS; i++) {
+		if (ev->timer_hints[i] == te) {
+			ev->timer_hints[i] = prev_te;
+		}
+	}
+	DLIST_REMOVE(ev->timer_events, te);
+}
+
 /*
   destroy a timed event
 */
@@ -148,10 +169,7 @@ static int tevent_common_timed_destructor(struct tevent_timer *te)
 		     "Destroying timer event %p \"%s\"\n",
 		     te, te->handler_name);
 
-	if (te->event_ctx->last_zero_timer == te) {
-		te->event_ctx->last_zero_timer = DLIST_PREV(te);
-	}
-	DLIST_REMOVE(te->event_ctx->timer_events, te);
+	tevent_common_remove_timer(te->event_ctx, te);
 
 	te->event_ctx = NULL;
 done:
@@ -163,9 +181,76 @@ done:
 	return 0;
 }
 
+/*
+  find the timer a new timer has to be inserted after using
+  ev->timer_hints. Returns false if the hints don't help.
+*/
+static bool tevent_common_find_timer_hint(struct tevent_context *ev,
+					  struct tevent_timer *te,
+					  struct tevent_timer **pprev_te)
+{
+	struct tevent_timer *best = NULL;
+	struct tevent_timer *cur_te;
+	bool have_hints = false;
+	unsigned i;
+
+	for (i=0; i<TEVENT_NUM_TIMER_HINTS; i++) {
+		struct tevent_timer *hint = ev->timer_hints[i];
+
+		if (hint == NULL) {
+			continue;
+		}
+		have_hints = true;
+
+		if (tevent_timeval_compare(&hint->next_event,
+					   &te->next_event) > 0) {
+			continue;
+		}
+		if ((best == NULL) ||
+		    (tevent_timeval_compare(&hint->next_event,
+					    &best->next_event) > 0)) {
+			best = hint;
+		}
+	}
+
+	if (!have_hints) {
+		return false;
+	}
+
+	if (best == NULL) {
+		/*
+		 * The new timer comes before all hints, search from
+		 * the start of the list
+		 */
+		cur_te = ev->timer_events;
+		if ((cur_te == NULL) ||
+		    (tevent_timeval_compare(&te->next_event,
+					    &cur_te->next_event) < 0)) {
+			*pprev_te = NULL;
+			return true;
+		}
+		best = cur_te;
+	}
+
+	/*
+	 * Go behind all timers due at the same time to keep them
+	 * in the order they were added
+	 */
+	cur_te = best;
+	while ((cur_te->next != NULL) &&
+	       (tevent_timeval_compare(&cur_te->next->next_event,
+				       &te->next_event) <= 0)) {
+		cur_te = cur_te->next;
+	}
+
+	*pprev_te = cur_te;
+	return true;
+}
+
 static void tevent_common_insert_timer(struct tevent_context *ev,
 				       struct tevent_timer *te,
-				       bool optimize_zero)
+				       bool optimize_zero,
+				       bool use_hints)
 {
 	struct tevent_timer *prev_te = NULL;
 
@@ -186,6 +271,11 @@ static void tevent_common_insert_timer(struct tevent_context *ev,
 		 */
 		prev_te = ev->last_zero_timer;
 		ev->last_zero_timer = te;
+	} else if (use_hints &&
+		   tevent_common_find_timer_hint(ev, te, &prev_te)) {
+		/*
+		 * prev_te is set
+		 */
 	} else {
 		struct tevent_timer *cur_te;
 
@@ -217,6 +307,12 @@ static void tevent_common_insert_timer(struct tevent_context *ev,
 	}
 
 	DLIST_ADD_AFTER(ev->timer_events, te, prev_te);
+
+	if (use_hints && !tevent_timeval_is_zero(&te->next_event)) {
+		ev->timer_hints[ev->next_timer_hint] = te;
+		ev->next_timer_hint =
+			(ev->next_timer_hint + 1) % TEVENT_NUM_TIMER_HINTS;
+	}
 }
 
 /*
@@ -249,9 +345,10 @@ static struct tevent_timer *tevent_common_add_timer_internal(
 
 	if (ev->timer_events == NULL) {
 		ev->last_zero_timer = NULL;
+		memset(ev->timer_hints, 0, sizeof(ev->timer_hints));
 	}
 
-	tevent_common_insert_timer(ev, te, optimize_zero);
+	tevent_common_insert_timer(ev, te, optimize_zero, optimize_zero);
 
 	talloc_set_destructor(te, tevent_common_timed_destructor);
 
@@ -303,10 +400,7 @@ void tevent_update_timer(struct tevent_timer *te, struct timeval next_event)
 {
 	struct tevent_context *ev = te->event_ctx;
 
-	if (ev->last_zero_timer == te) {
-		te->event_ctx->last_zero_timer = DLIST_PREV(te);
-	}
-	DLIST_REMOVE(ev->timer_events, te);
+	tevent_common_remove_timer(ev, te);
 
 	te->next_event = next_event;
 
@@ -314,7 +408,7 @@ void tevent_update_timer(struct tevent_timer *te, struct timeval next_event)
 	 * Not doing the zero_timer optimization. This is for new code
 	 * that should know about immediates.
 	 */
-	tevent_common_insert_timer(ev, te, false);
+	tevent_common_insert_timer(ev, te, false, true);
 }
 
 int tevent_common_invoke_timer_handler(struct tevent_timer *te,
@@ -336,10 +430,7 @@ int tevent_common_invoke_timer_handler(struct tevent_timer *te,
 	 * handler because in a semi-async inner event loop called from the
 	 * handler we don't want to come across this event again -- vl
 	 */
-	if (te->event_ctx->last_zero_timer == te) {
-		te->event_ctx->last_zero_timer = DLIST_PREV(te);
-	}
-	DLIST_REMOVE(te->event_ctx->timer_events, te);
+	tevent_common_remove_timer(te->event_ctx, te);
 
 	tevent_debug(te->event_ctx, TEVENT_DEBUG_TRACE,
 		     "Running timer event %p \"%s\"\n",
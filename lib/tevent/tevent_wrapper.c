@@ -295,6 +295,12 @@ static int tevent_wrapper_context_destructor(struct tevent_context *wrap_ev)
 		DLIST_REMOVE(main_ev->timer_events, te);
 	}
 
+	/*
+	 * The hints might point to removed timers, they are just an
+	 * optimization, so forget them all
+	 */
+	memset(main_ev->timer_hints, 0, sizeof(main_ev->timer_hints));
+
 	for (ie = main_ev->immediate_events; ie; ie = in) {
 		in = ie->next;
 
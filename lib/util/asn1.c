@@ -33,8 +33,10 @@ struct nesting {
 struct asn1_data {
 	uint8_t *data;
 	size_t length;
+	size_t allocated;	/* size of data, when writing */
 	off_t ofs;
 	struct nesting *nesting;
+	struct nesting *free_nesting; /* popped tags, to be reused */
 	bool has_error;
 };
 
@@ -84,14 +86,25 @@ bool asn1_write(struct asn1_data *data, const void *p, int len)
 		return false;
 	}
 
-	if (data->length < data->ofs+len) {
+	if (data->allocated < data->ofs+len) {
+		/*
+		 * Grow the buffer geometrically, a PDU is written in lots
+		 * of small pieces and growing it by each of them means a
+		 * realloc (and often a copy) for every one.
+		 */
+		size_t newsize = MAX(data->ofs+len, data->allocated*2);
 		uint8_t *newp;
-		newp = talloc_realloc(data, data->data, uint8_t, data->ofs+len);
+
+		newsize = MAX(newsize, 64);
+		newp = talloc_realloc(data, data->data, uint8_t, newsize);
 		if (!newp) {
 			data->has_error = true;
 			return false;
 		}
 		data->data = newp;
+		data->allocated = newsize;
+	}
+	if (data->length < data->ofs+len) {
 		data->length = data->ofs+len;
 	}
 	memcpy(data->data + data->ofs, p, len);
@@ -105,6 +118,24 @@ bool asn1_write_uint8(struct asn1_data *data, uint8_t v)
 	return asn1_write(data, &v, 1);
 }
 
+static struct nesting *asn1_nesting_get(struct asn1_data *data)
+{
+	struct nesting *nesting = data->free_nesting;
+
+	if (nesting != NULL) {
+		data->free_nesting = nesting->next;
+		return nesting;
+	}
+
+	return talloc(data, struct nesting);
+}
+
+static void asn1_nesting_put(struct asn1_data *data, struct nesting *nesting)
+{
+	nesting->next = data->free_nesting;
+	data->free_nesting = nesting;
+}
+
 /* push a tag onto the asn1 data buffer. Used for nested structures */
 bool asn1_push_tag(struct asn1_data *data, uint8_t tag)
 {
@@ -113,7 +144,7 @@ bool asn1_push_tag(struct asn1_data *data, uint8_t tag)
 	if (!asn1_write_uint8(data, tag)) {
 		return false;
 	}
-	nesting = talloc(data, struct nesting);
+	nesting = asn1_nesting_get(data);
 	if (!nesting) {
 		data->has_error = true;
 		return false;
@@ -182,7 +213,7 @@ bool asn1_pop_tag(struct asn1_data *data)
 	}
 
 	data->nesting = nesting->next;
-	talloc_free(nesting);
+	asn1_nesting_put(data, nesting);
 	return true;
 }
 
@@ -480,6 +511,7 @@ bool asn1_load(struct asn1_data *data, DATA_BLOB blob)
 		return false;
 	}
 	data->length = blob.length;
+	data->allocated = blob.length;
 	return true;
 }
 
@@ -637,7 +669,7 @@ bool asn1_start_tag(struct asn1_data *data, uint8_t tag)
 		data->has_error = true;
 		return false;
 	}
-	nesting = talloc(data, struct nesting);
+	nesting = asn1_nesting_get(data);
 	if (!nesting) {
 		data->has_error = true;
 		return false;
@@ -700,7 +732,7 @@ bool asn1_end_tag(struct asn1_data *data)
 	}
 
 	data->nesting = nesting->next;
-	talloc_free(nesting);
+	asn1_nesting_put(data, nesting);
 	return true;
 }
 
@@ -1080,6 +1112,17 @@ bool asn1_extract_blob(struct asn1_data *asn1, TALLOC_CTX *mem_ctx,
 		return false;
 	}
 
+	if (asn1->allocated > blob.length && blob.length > 0) {
+		/* give back what asn1_write() allocated ahead */
+		uint8_t *data = talloc_realloc(asn1, blob.data,
+					       uint8_t, blob.length);
+		if (data != NULL) {
+			blob.data = data;
+			asn1->data = data;
+			asn1->allocated = blob.length;
+		}
+	}
+
 	*pblob = (DATA_BLOB) { .length = blob.length };
 	pblob->data = talloc_move(mem_ctx, &blob.data);
 
@@ -1099,6 +1142,7 @@ void asn1_load_nocopy(struct asn1_data *data, uint8_t *buf, size_t len)
 	ZERO_STRUCTP(data);
 	data->data = buf;
 	data->length = len;
+	data->allocated = len;
 }
 
 int asn1_peek_full_tag(DATA_BLOB blob, uint8_t tag, size_t *packet_size)
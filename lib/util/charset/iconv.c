@@ -640,6 +640,19 @@ static size_t iconv_copy(void *cd, const char **inbuf, size_t *inbytesleft,
 	return 0;
 }
 
+/*
+  Masks for finding runs of ASCII, used via memcpy() so they work in
+  either byte order. Most names and paths are plain ASCII, so the
+  UTF8 conversions check and copy them 8 bytes at a time before
+  falling back to the per character code.
+ */
+static const uint8_t utf8_ascii_mask[8] = {
+	0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80
+};
+static const uint8_t utf16_ascii_mask[8] = {
+	0x80, 0xff, 0x80, 0xff, 0x80, 0xff, 0x80, 0xff
+};
+
 /*
   this takes a UTF8 sequence and produces a UTF16 sequence
  */
@@ -649,8 +662,32 @@ static size_t utf8_pull(void *cd, const char **inbuf, size_t *inbytesleft,
 	size_t in_left=*inbytesleft, out_left=*outbytesleft;
 	const uint8_t *c = (const uint8_t *)*inbuf;
 	uint8_t *uc = (uint8_t *)*outbuf;
+	uint64_t mask;
+
+	memcpy(&mask, utf8_ascii_mask, sizeof(mask));
 
 	while (in_left >= 1 && out_left >= 2) {
+		while (in_left >= 8 && out_left >= 16) {
+			uint64_t v;
+			size_t i;
+
+			memcpy(&v, c, sizeof(v));
+			if ((v & mask) != 0) {
+				break;
+			}
+			for (i = 0; i < 8; i++) {
+				uc[2*i] = c[i];
+				uc[2*i+1] = 0;
+			}
+			c  += 8;
+			in_left  -= 8;
+			out_left -= 16;
+			uc += 16;
+		}
+		if (in_left < 1 || out_left < 2) {
+			break;
+		}
+
 		if ((c[0] & 0x80) == 0) {
 			uc[0] = c[0];
 			uc[1] = 0;
@@ -770,10 +807,33 @@ static size_t utf8_push(void *cd, const char **inbuf, size_t *inbytesleft,
 	size_t in_left=*inbytesleft, out_left=*outbytesleft;
 	uint8_t *c = (uint8_t *)*outbuf;
 	const uint8_t *uc = (const uint8_t *)*inbuf;
+	uint64_t mask;
+
+	memcpy(&mask, utf16_ascii_mask, sizeof(mask));
 
 	while (in_left >= 2 && out_left >= 1) {
 		unsigned int codepoint;
 
+		while (in_left >= 8 && out_left >= 4) {
+			uint64_t v;
+
+			memcpy(&v, uc, sizeof(v));
+			if ((v & mask) != 0) {
+				break;
+			}
+			c[0] = uc[0];
+			c[1] = uc[2];
+			c[2] = uc[4];
+			c[3] = uc[6];
+			in_left  -= 8;
+			out_left -= 4;
+			uc += 8;
+			c  += 4;
+		}
+		if (in_left < 2 || out_left < 1) {
+			break;
+		}
+
 		if (uc[1] == 0 && !(uc[0] & 0x80)) {
 			/* simplest case */
 			c[0] = uc[0];
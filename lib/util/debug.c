@@ -203,10 +203,45 @@ static int debug_level_to_priority(int level)
  * all active backends.
  */
 
+/*
+ * The header and the lines of one DEBUG() statement are collected here
+ * and written with a single write() at the end of the dbgtext() call.
+ * This saves a syscall per line and keeps messages from concurrent
+ * processes from interleaving line by line.
+ */
+static struct {
+	int fd;
+	size_t len;
+	char buf[FORMAT_BUFR_SIZE * 4];
+} debug_file_buf = {
+	.fd = -1,
+};
+
+static void debug_file_write(int fd, const char *msg, size_t len)
+{
+	ssize_t ret;
+
+	do {
+		ret = write(fd, msg, len);
+	} while (ret == -1 && errno == EINTR);
+}
+
+static void debug_file_flush(void)
+{
+	if (debug_file_buf.len == 0) {
+		return;
+	}
+
+	debug_file_write(debug_file_buf.fd,
+			 debug_file_buf.buf,
+			 debug_file_buf.len);
+	debug_file_buf.len = 0;
+}
+
 static void debug_file_log(int msg_level,
 			   const char *msg, const char *msg_no_nl)
 {
-	ssize_t ret;
+	size_t len = strlen(msg);
 	int fd;
 
 	check_log_size();
@@ -217,9 +252,19 @@ static void debug_file_log(int msg_level,
 		fd = dbgc_config[DBGC_ALL].fd;
 	}
 
-	do {
-		ret = write(fd, msg, strlen(msg));
-	} while (ret == -1 && errno == EINTR);
+	if (fd != debug_file_buf.fd ||
+	    len > sizeof(debug_file_buf.buf) - debug_file_buf.len) {
+		debug_file_flush();
+	}
+
+	if (len > sizeof(debug_file_buf.buf)) {
+		debug_file_write(fd, msg, len);
+		return;
+	}
+
+	memcpy(debug_file_buf.buf + debug_file_buf.len, msg, len);
+	debug_file_buf.len += len;
+	debug_file_buf.fd = fd;
 }
 
 #ifdef WITH_SYSLOG
@@ -590,6 +635,25 @@ static void debug_backends_log(const char *msg, int msg_level)
 */
 bool    override_logfile;
 
+int debuglevel_max = 0;
+
+/*
+ * Recompute debuglevel_max after any class level changed, the DEBUG
+ * macros use it to skip disabled messages cheaply.
+ */
+static void debuglevel_max_update(void)
+{
+	size_t num_classes = MAX(debug_num_classes, DBGC_ALL + 1);
+	int max = dbgc_config[DBGC_ALL].loglevel;
+	size_t i;
+
+	for (i = DBGC_ALL + 1; i < num_classes; i++) {
+		max = MAX(max, dbgc_config[i].loglevel);
+	}
+
+	debuglevel_max = max;
+}
+
 int debuglevel_get_class(size_t idx)
 {
 	return dbgc_config[idx].loglevel;
@@ -598,6 +662,7 @@ int debuglevel_get_class(size_t idx)
 void debuglevel_set_class(size_t idx, int level)
 {
 	dbgc_config[idx].loglevel = level;
+	debuglevel_max_update();
 }
 
 
@@ -652,6 +717,8 @@ void gfree_debugsyms(void)
 {
 	unsigned i;
 
+	debug_file_flush();
+
 	TALLOC_FREE(classname_table);
 
 	if ( dbgc_config != debug_class_list_initial ) {
@@ -661,6 +728,7 @@ void gfree_debugsyms(void)
 	}
 
 	debug_num_classes = 0;
+	debuglevel_max_update();
 
 	state.initialized = false;
 
@@ -836,6 +904,7 @@ static bool debug_parse_param(char *param)
 	}
 
 	dbgc_config[ndx].loglevel = atoi(class_level);
+	debuglevel_max_update();
 
 	if (class_file == NULL) {
 		return true;
@@ -888,6 +957,7 @@ bool debug_parse_levels(const char *params_str)
 		dbgc_config[i].loglevel = dbgc_config[DBGC_ALL].loglevel;
 		TALLOC_FREE(dbgc_config[i].logfile);
 	}
+	debuglevel_max_update();
 
 	while (tok != NULL) {
 		bool ok;
@@ -1118,6 +1188,9 @@ bool reopen_logs_internal(void)
 		return true;
 	}
 
+	/* Don't write buffered messages to a closed or reused fd */
+	debug_file_flush();
+
 	/* Now clear the SIGHUP induced flag */
 	state.schedule_reopen_logs = false;
 
@@ -1331,6 +1404,9 @@ void check_log_size( void )
 
 	maxlog = state.settings.max_log_size * 1024;
 
+	/* The log may be rotated below */
+	debug_file_flush();
+
 	if (state.schedule_reopen_logs) {
 		(void)reopen_logs_internal();
 	}
@@ -1477,6 +1553,37 @@ static void format_debug_text( const char *msg )
 void dbgflush( void )
 {
 	bufr_print();
+	debug_file_flush();
+}
+
+/*
+ * Format the header timestamp. localtime() is expensive enough to show
+ * up with a high log level, so only call it once per second.
+ */
+static void debug_timestamp(const struct timeval *tv,
+			    struct timeval_buf *dst)
+{
+	static struct {
+		time_t sec;
+		struct timeval_buf buf;
+	} cache = {
+		.sec = (time_t)-1,
+	};
+
+	if (tv->tv_sec != cache.sec) {
+		struct timeval sec = { .tv_sec = tv->tv_sec };
+
+		timeval_str_buf(&sec, false, false, &cache.buf);
+		cache.sec = tv->tv_sec;
+	}
+
+	if (!state.settings.debug_hires_timestamp) {
+		*dst = cache.buf;
+		return;
+	}
+
+	snprintf(dst->buf, sizeof(dst->buf), "%s.%06ld",
+		 cache.buf.buf, (long)tv->tv_usec);
 }
 
 /***************************************************************************
@@ -1543,8 +1650,7 @@ bool dbghdrclass(int level, int cls, const char *location, const char *func)
 	}
 
 	GetTimeOfDay(&tv);
-	timeval_str_buf(&tv, false, state.settings.debug_hires_timestamp,
-			&tvbuf);
+	debug_timestamp(&tv, &tvbuf);
 
 	hs_len = snprintf(header_str, sizeof(header_str), "[%s, %2d",
 			  tvbuf.buf, level);
@@ -1637,6 +1743,7 @@ static inline bool __dbgtext_va(const char *format_str, va_list ap)
 		ret = false;
 	}
 	SAFE_FREE(msgbuf);
+	debug_file_flush();
 	return ret;
 }
 
@@ -176,13 +176,23 @@ bool dbghdr( int level, const char *location, const char *func);
 int debuglevel_get_class(size_t idx);
 void debuglevel_set_class(size_t idx, int level);
 
-#define CHECK_DEBUGLVL( level ) \
+/*
+ * The highest level of any debug class. Checking it first means a
+ * disabled message costs a load and a compare in the caller instead of a
+ * call to debuglevel_get_class().
+ */
+extern int debuglevel_max;
+
+#define DEBUGLVL_ENABLED(dbgc_class, level) \
   ( ((level) <= MAX_DEBUG_LEVEL) && \
-    unlikely(debuglevel_get_class(DBGC_CLASS) >= (level)))
+    unlikely(debuglevel_max >= (level)) && \
+    (debuglevel_get_class(dbgc_class) >= (level)) )
+
+#define CHECK_DEBUGLVL( level ) \
+  DEBUGLVL_ENABLED(DBGC_CLASS, level)
 
 #define CHECK_DEBUGLVLC( dbgc_class, level ) \
-  ( ((level) <= MAX_DEBUG_LEVEL) && \
-    unlikely(debuglevel_get_class(dbgc_class) >= (level)))
+  DEBUGLVL_ENABLED(dbgc_class, level)
 
 #define DEBUGLVL( level ) \
   ( CHECK_DEBUGLVL(level) \
@@ -193,25 +203,21 @@ void debuglevel_set_class(size_t idx, int level);
    && dbghdrclass( level, dbgc_class, __location__, __FUNCTION__ ) )
 
 #define DEBUG( level, body ) \
-  (void)( ((level) <= MAX_DEBUG_LEVEL) && \
-       unlikely(debuglevel_get_class(DBGC_CLASS) >= (level))             \
+  (void)( DEBUGLVL_ENABLED(DBGC_CLASS, level)                          \
        && (dbghdrclass( level, DBGC_CLASS, __location__, __FUNCTION__ )) \
        && (dbgtext body) )
 
 #define DEBUGC( dbgc_class, level, body ) \
-  (void)( ((level) <= MAX_DEBUG_LEVEL) && \
-       unlikely(debuglevel_get_class(dbgc_class) >= (level))             \
+  (void)( DEBUGLVL_ENABLED(dbgc_class, level)                          \
        && (dbghdrclass( level, DBGC_CLASS, __location__, __FUNCTION__ )) \
        && (dbgtext body) )
 
 #define DEBUGADD( level, body ) \
-  (void)( ((level) <= MAX_DEBUG_LEVEL) && \
-	  unlikely(debuglevel_get_class(DBGC_CLASS) >= (level))	\
+  (void)( DEBUGLVL_ENABLED(DBGC_CLASS, level) \
        && (dbgtext body) )
 
 #define DEBUGADDC( dbgc_class, level, body ) \
-  (void)( ((level) <= MAX_DEBUG_LEVEL) && \
-          unlikely((debuglevel_get_class(dbgc_class) >= (level))) \
+  (void)( DEBUGLVL_ENABLED(dbgc_class, level) \
        && (dbgtext body) )
 
 /* Print a separator to the debug log. */
@@ -220,16 +226,14 @@ void debuglevel_set_class(size_t idx, int level);
 
 /* Prefix messages with the function name */
 #define DBG_PREFIX(level, body ) \
-	(void)( ((level) <= MAX_DEBUG_LEVEL) &&			\
-		unlikely(debuglevel_get_class(DBGC_CLASS) >= (level))	\
+	(void)( DEBUGLVL_ENABLED(DBGC_CLASS, level)			\
 		&& (dbghdrclass(level, DBGC_CLASS, __location__, __func__ )) \
 		&& (dbgtext("%s: ", __func__))				\
 		&& (dbgtext body) )
 
 /* Prefix messages with the function name - class specific */
 #define DBGC_PREFIX(dbgc_class, level, body ) \
-	(void)( ((level) <= MAX_DEBUG_LEVEL) &&			\
-		unlikely(debuglevel_get_class(dbgc_class) >= (level))	\
+	(void)( DEBUGLVL_ENABLED(dbgc_class, level)			\
 		&& (dbghdrclass(level, dbgc_class, __location__, __func__ )) \
 		&& (dbgtext("%s: ", __func__))				\
 		&& (dbgtext body) )
@@ -34,6 +34,8 @@ static int (*gpfs_set_winattrs_fn)(int fd, int flags,
 static int (*gpfs_get_winattrs_path_fn)(char *pathname,
 					struct gpfs_winattr *attrs);
 static int (*gpfs_get_winattrs_fn)(int fd, struct gpfs_winattr *attrs);
+static int (*gpfs_stat_x_fn)(const char *pathname, unsigned int *litemask,
+			     gpfs_iattr64_t *iattr, size_t len);
 static int (*gpfs_prealloc_fn)(int fd, gpfs_off64_t start, gpfs_off64_t bytes);
 static int (*gpfs_ftruncate_fn)(int fd, gpfs_off64_t length);
 static int (*gpfs_lib_init_fn)(int flags);
@@ -68,6 +70,7 @@ int gpfswrap_init(void)
 	gpfs_set_winattrs_fn	      = dlsym(l, "gpfs_set_winattrs");
 	gpfs_get_winattrs_path_fn     = dlsym(l, "gpfs_get_winattrs_path");
 	gpfs_get_winattrs_fn	      = dlsym(l, "gpfs_get_winattrs");
+	gpfs_stat_x_fn		      = dlsym(l, "gpfs_stat_x");
 	gpfs_prealloc_fn	      = dlsym(l, "gpfs_prealloc");
 	gpfs_ftruncate_fn	      = dlsym(l, "gpfs_ftruncate");
 	gpfs_lib_init_fn	      = dlsym(l, "gpfs_lib_init");
@@ -173,6 +176,17 @@ int gpfswrap_get_winattrs(int fd, struct gpfs_winattr *attrs)
 	return gpfs_get_winattrs_fn(fd, attrs);
 }
 
+int gpfswrap_stat_x(char *pathname, unsigned int *litemask,
+		    gpfs_iattr64_t *iattr, size_t len)
+{
+	if (gpfs_stat_x_fn == NULL) {
+		errno = ENOSYS;
+		return -1;
+	}
+
+	return gpfs_stat_x_fn(pathname, litemask, iattr, len);
+}
+
 int gpfswrap_prealloc(int fd, gpfs_off64_t start, gpfs_off64_t bytes)
 {
 	if (gpfs_prealloc_fn == NULL) {
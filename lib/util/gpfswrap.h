@@ -37,6 +37,8 @@ int gpfswrap_set_winattrs_path(char *pathname, int flags,
 int gpfswrap_set_winattrs(int fd, int flags, struct gpfs_winattr *attrs);
 int gpfswrap_get_winattrs_path(char *pathname, struct gpfs_winattr *attrs);
 int gpfswrap_get_winattrs(int fd, struct gpfs_winattr *attrs);
+int gpfswrap_stat_x(char *pathname, unsigned int *litemask,
+		    gpfs_iattr64_t *iattr, size_t len);
 int gpfswrap_prealloc(int fd, gpfs_off64_t start, gpfs_off64_t bytes);
 int gpfswrap_ftruncate(int fd, gpfs_off64_t length);
 int gpfswrap_lib_init(int flags);
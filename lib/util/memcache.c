@@ -56,6 +56,9 @@ static bool memcache_is_talloc(enum memcache_number n)
 	case SHARE_MODE_LOCK_CACHE:
 	case GETWD_CACHE:
 	case VIRUSFILTER_SCAN_RESULTS_CACHE_TALLOC:
+	case NT_ACL_CACHE_TALLOC:
+	case PAC_SESSION_INFO_CACHE_TALLOC:
+	case POSIX_ACL_SD_CACHE_TALLOC:
 		result = true;
 		break;
 	default:
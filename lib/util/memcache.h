@@ -47,6 +47,15 @@ enum memcache_number {
 	SHARE_MODE_LOCK_CACHE,	/* talloc */
 	VIRUSFILTER_SCAN_RESULTS_CACHE_TALLOC, /* talloc */
 	DFREE_CACHE,
+	NT_ACL_CACHE_TALLOC,	/* talloc */
+	FRUIT_FINDER_INFO_CACHE,
+	IDMAP_SID2XID_CACHE,
+	IDMAP_XID2SID_CACHE,
+	PAC_SESSION_INFO_CACHE_TALLOC, /* talloc */
+	DOS_ATTRIBUTE_CACHE,
+	POSIX_ACL_SD_CACHE_TALLOC, /* talloc */
+	MSDFS_LINK_CACHE,
+	PRINTER_INFO_CACHE,
 };
 
 /*
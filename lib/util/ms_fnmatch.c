@@ -227,6 +227,202 @@ int ms_fnmatch_protocol(const char *pattern, const char *string, int protocol,
 }
 
 
+/*
+  A pattern prepared once for matching many names, e.g. all entries
+  of a directory listing. Patterns of the form "*", "prefix*",
+  "*suffix" or "prefix*suffix" are matched without going through
+  ms_fnmatch_core() when the name is plain ASCII.
+*/
+enum ms_fnmatch_type {
+	MS_FNMATCH_LITERAL,
+	MS_FNMATCH_ALL,
+	MS_FNMATCH_AFFIX,
+	MS_FNMATCH_GENERIC
+};
+
+struct ms_fnmatch_pattern {
+	enum ms_fnmatch_type type;
+	bool is_case_sensitive;
+	char *pattern;		/* translated for old protocols */
+	size_t num_max_n;
+	char *prefix;		/* upper case unless is_case_sensitive */
+	size_t prefix_len;
+	char *suffix;		/* upper case unless is_case_sensitive */
+	size_t suffix_len;
+};
+
+static bool ms_fnmatch_is_ascii(const char *s, size_t len)
+{
+	size_t i;
+
+	for (i=0; i<len; i++) {
+		if ((unsigned char)s[i] >= 0x80) {
+			return false;
+		}
+	}
+	return true;
+}
+
+struct ms_fnmatch_pattern *ms_fnmatch_compile(TALLOC_CTX *mem_ctx,
+					      const char *pattern,
+					      int protocol,
+					      bool is_case_sensitive)
+{
+	struct ms_fnmatch_pattern *pat;
+	const char *star;
+	size_t i, len;
+
+	pat = talloc_zero(mem_ctx, struct ms_fnmatch_pattern);
+	if (pat == NULL) {
+		return NULL;
+	}
+	pat->is_case_sensitive = is_case_sensitive;
+
+	pat->pattern = talloc_strdup(pat, pattern);
+	if (pat->pattern == NULL) {
+		TALLOC_FREE(pat);
+		return NULL;
+	}
+
+	if (strpbrk(pattern, "<>*?\"") == NULL) {
+		pat->type = MS_FNMATCH_LITERAL;
+		return pat;
+	}
+
+	if (protocol <= PROTOCOL_LANMAN2) {
+		char *p = pat->pattern;
+
+		/* see ms_fnmatch_protocol() */
+		for (i=0;p[i];i++) {
+			if (p[i] == '?') {
+				p[i] = '>';
+			} else if (p[i] == '.' &&
+				   (p[i+1] == '?' ||
+				    p[i+1] == '*' ||
+				    p[i+1] == 0)) {
+				p[i] = '"';
+			} else if (p[i] == '*' &&
+				   p[i+1] == '.') {
+				p[i] = '<';
+			}
+		}
+	}
+
+	for (i=0; pat->pattern[i]; i++) {
+		if (pat->pattern[i] == '*' || pat->pattern[i] == '<') {
+			pat->num_max_n++;
+		}
+	}
+	len = i;
+
+	if (strspn(pat->pattern, "*") == len) {
+		pat->type = MS_FNMATCH_ALL;
+		return pat;
+	}
+
+	pat->type = MS_FNMATCH_GENERIC;
+
+	star = strchr(pat->pattern, '*');
+	if ((pat->num_max_n != 1) || (star == NULL) ||
+	    (strpbrk(pat->pattern, "<>?\"") != NULL) ||
+	    !ms_fnmatch_is_ascii(pat->pattern, len)) {
+		return pat;
+	}
+
+	pat->prefix_len = star - pat->pattern;
+	pat->prefix = talloc_strndup(pat, pat->pattern, pat->prefix_len);
+	pat->suffix_len = len - pat->prefix_len - 1;
+	pat->suffix = talloc_strdup(pat, star + 1);
+	if ((pat->prefix == NULL) || (pat->suffix == NULL)) {
+		TALLOC_FREE(pat);
+		return NULL;
+	}
+
+	if (!is_case_sensitive) {
+		for (i=0; i<pat->prefix_len; i++) {
+			pat->prefix[i] = toupper_m((unsigned char)pat->prefix[i]);
+		}
+		for (i=0; i<pat->suffix_len; i++) {
+			pat->suffix[i] = toupper_m((unsigned char)pat->suffix[i]);
+		}
+	}
+
+	pat->type = MS_FNMATCH_AFFIX;
+	return pat;
+}
+
+static bool ms_fnmatch_affix_cmp(const char *s, const char *affix,
+				 size_t len, bool is_case_sensitive)
+{
+	size_t i;
+
+	if (is_case_sensitive) {
+		return memcmp(s, affix, len) == 0;
+	}
+	for (i=0; i<len; i++) {
+		if (toupper_m((unsigned char)s[i]) != (unsigned char)affix[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+int ms_fnmatch_compiled(const struct ms_fnmatch_pattern *pat,
+			const char *string)
+{
+	size_t len;
+
+	if (strcmp(string, "..") == 0) {
+		string = ".";
+	}
+
+	switch (pat->type) {
+	case MS_FNMATCH_LITERAL:
+		return strcasecmp_m(pat->pattern, string);
+	case MS_FNMATCH_ALL:
+		return 0;
+	case MS_FNMATCH_AFFIX:
+		len = strlen(string);
+		/*
+		 * Non-ASCII names might case fold to ASCII, leave
+		 * them to the full matcher.
+		 */
+		if (!ms_fnmatch_is_ascii(string, len)) {
+			break;
+		}
+		if (len < pat->prefix_len + pat->suffix_len) {
+			return -1;
+		}
+		if (!ms_fnmatch_affix_cmp(string, pat->prefix,
+					  pat->prefix_len,
+					  pat->is_case_sensitive)) {
+			return -1;
+		}
+		if (!ms_fnmatch_affix_cmp(string + len - pat->suffix_len,
+					  pat->suffix, pat->suffix_len,
+					  pat->is_case_sensitive)) {
+			return -1;
+		}
+		return 0;
+	case MS_FNMATCH_GENERIC:
+		break;
+	}
+
+	if (pat->num_max_n != 0) {
+		struct max_n max_n[pat->num_max_n];
+
+		memset(max_n, 0, sizeof(struct max_n) * pat->num_max_n);
+
+		return ms_fnmatch_core(pat->pattern, string, max_n,
+				       strrchr(string, '.'),
+				       pat->is_case_sensitive);
+	}
+
+	return ms_fnmatch_core(pat->pattern, string, NULL,
+			       strrchr(string, '.'),
+			       pat->is_case_sensitive);
+}
+
 /** a generic fnmatch function - uses for non-CIFS pattern matching */
 int gen_fnmatch(const char *pattern, const char *string)
 {
@@ -98,6 +98,42 @@ static void test_ms_fn_match_protocol_nt1_case_sensitive(void **state)
 	assert_int_equal(cmp, 0);
 }
 
+static void test_ms_fn_match_compiled(void **state)
+{
+	const char *patterns[] = {
+		"*", "**", "*.*", "*.dwg", "foo*", "FOO*.TXT", "f?o*",
+		"*.", "<.dwg", "foo\"", "foo>", "file.txt", "foo*bar*",
+	};
+	const char *strings[] = {
+		"", ".", "..", "foo", "FOO.TXT", "foo.txt", "x.DWG",
+		"foo.bar.txt", "foobar", "file.txt", "dwg", "fo.o",
+		"\xc3\xa4.dwg", "foo\xc3\xa4.txt",
+	};
+	int protocols[] = { PROTOCOL_COREPLUS, PROTOCOL_NT1 };
+	size_t p, s, i, cs;
+
+	for (p = 0; p < ARRAY_SIZE(patterns); p++) {
+	for (i = 0; i < ARRAY_SIZE(protocols); i++) {
+	for (cs = 0; cs < 2; cs++) {
+		struct ms_fnmatch_pattern *pat = NULL;
+
+		pat = ms_fnmatch_compile(NULL, patterns[p], protocols[i], cs);
+		assert_non_null(pat);
+
+		for (s = 0; s < ARRAY_SIZE(strings); s++) {
+			int cmp1, cmp2;
+
+			cmp1 = ms_fnmatch_protocol(patterns[p], strings[s],
+						   protocols[i], cs);
+			cmp2 = ms_fnmatch_compiled(pat, strings[s]);
+			assert_int_equal(cmp1 == 0, cmp2 == 0);
+		}
+		TALLOC_FREE(pat);
+	}
+	}
+	}
+}
+
 int main(void) {
 	const struct CMUnitTest tests[] = {
 		cmocka_unit_test(test_ms_fn_match_protocol_no_wildcard),
@@ -106,6 +142,7 @@ int main(void) {
 		cmocka_unit_test(test_ms_fn_match_protocol_mapped_char),
 		cmocka_unit_test(test_ms_fn_match_protocol_nt1_any_char),
 		cmocka_unit_test(test_ms_fn_match_protocol_nt1_case_sensitive),
+		cmocka_unit_test(test_ms_fn_match_compiled),
 	};
 
 	cmocka_set_message_output(CM_OUTPUT_SUBUNIT);
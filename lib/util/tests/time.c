@@ -82,6 +82,22 @@ static bool test_timestring(struct torture_context *tctx)
 	return true;
 }
 
+static bool test_timespec_too_recent(struct torture_context *tctx)
+{
+	struct timespec now = { .tv_sec = 1000, .tv_nsec = 500 };
+	struct timespec ts;
+
+	ts = now;
+	torture_assert(tctx, timespec_too_recent(&ts, &now), "now");
+	ts = (struct timespec) { .tv_sec = 999 };
+	torture_assert(tctx, timespec_too_recent(&ts, &now), "1 sec ago");
+	ts = (struct timespec) { .tv_sec = 998, .tv_nsec = 999999999 };
+	torture_assert(tctx, !timespec_too_recent(&ts, &now), "2 sec ago");
+	ts = (struct timespec) { .tv_sec = 1001 };
+	torture_assert(tctx, timespec_too_recent(&ts, &now), "future");
+	return true;
+}
+
 struct torture_suite *torture_local_util_time(TALLOC_CTX *mem_ctx)
 {
 	struct torture_suite *suite = torture_suite_create(mem_ctx, "time");
@@ -92,6 +108,8 @@ struct torture_suite *torture_local_util_time(TALLOC_CTX *mem_ctx)
 								  test_http_timestring);
 	torture_suite_add_simple_test(suite, "timestring", 
 								  test_timestring);
+	torture_suite_add_simple_test(suite, "timespec_too_recent",
+				      test_timespec_too_recent);
 
 	return suite;
 }
@@ -931,6 +931,19 @@ _PUBLIC_ int timespec_compare(const struct timespec *ts1, const struct timespec
 	return 0;
 }
 
+/****************************************************************************
+ Check whether a file timestamp seen at time "now" is too recent to key a
+ cache on. With coarse file system timestamps another change within the
+ same tick doesn't move it, so a cache entry for it could go stale without
+ anybody noticing.
+****************************************************************************/
+
+_PUBLIC_ bool timespec_too_recent(const struct timespec *ts,
+				  const struct timespec *now)
+{
+	return ts->tv_sec >= now->tv_sec - 1;
+}
+
 /****************************************************************************
  Round up a timespec if nsec > 500000000, round down if lower,
  then zero nsec.
@@ -326,6 +326,8 @@ struct timespec timespec_current(void);
 struct timespec timespec_min(const struct timespec *ts1,
 			     const struct timespec *ts2);
 int timespec_compare(const struct timespec *ts1, const struct timespec *ts2);
+bool timespec_too_recent(const struct timespec *ts,
+			 const struct timespec *now);
 void round_timespec_to_sec(struct timespec *ts);
 void round_timespec_to_usec(struct timespec *ts);
 NTTIME unix_timespec_to_nt_time(struct timespec ts);
@@ -0,0 +1,55 @@
+/*
+ * Unix SMB/CIFS implementation.
+ *
+ * Userspace statically defined tracepoints
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LIB_UTIL_USDT_H__
+#define __LIB_UTIL_USDT_H__
+
+/*
+ * With <sys/sdt.h> (systemtap-sdt-devel) available each probe compiles
+ * to a single nop plus an ELF note, so they can stay in hot paths.
+ * bpftrace, perf or systemtap attach to them at runtime, e.g.
+ *
+ *   bpftrace -e 'usdt:/usr/sbin/smbd:samba:smb2_request { ... }'
+ *
+ * The arguments are still evaluated, keep them to plain values that
+ * are at hand anyway.
+ */
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define SAMBA_USDT(name) DTRACE_PROBE(samba, name)
+#define SAMBA_USDT1(name, a1) DTRACE_PROBE1(samba, name, a1)
+#define SAMBA_USDT2(name, a1, a2) DTRACE_PROBE2(samba, name, a1, a2)
+#define SAMBA_USDT3(name, a1, a2, a3) \
+	DTRACE_PROBE3(samba, name, a1, a2, a3)
+#define SAMBA_USDT4(name, a1, a2, a3, a4) \
+	DTRACE_PROBE4(samba, name, a1, a2, a3, a4)
+
+#else
+
+#define SAMBA_USDT(name) do { } while (0)
+#define SAMBA_USDT1(name, a1) do { } while (0)
+#define SAMBA_USDT2(name, a1, a2) do { } while (0)
+#define SAMBA_USDT3(name, a1, a2, a3) do { } while (0)
+#define SAMBA_USDT4(name, a1, a2, a3, a4) do { } while (0)
+
+#endif
+
+#endif /* __LIB_UTIL_USDT_H__ */
@@ -60,6 +60,7 @@ struct netlogon_creds_cli_context {
 		bool try_validation6;
 		bool try_logon_ex;
 		bool try_logon_with;
+		bool warned_serialized;
 	} server;
 
 	struct {
@@ -2392,6 +2393,34 @@ static void netlogon_creds_cli_LogonSamLogon_start(struct tevent_req *req)
 	}
 
 	if (state->lk_creds == NULL) {
+		/*
+		 * From here on all logons of all processes using this
+		 * machine account queue behind the one credential chain,
+		 * the server only keeps a single chain per computer name,
+		 * so there is no way to have several of them in parallel.
+		 * Only netr_LogonSamLogonEx() over schannel avoids this,
+		 * tell the admin once why that is not used.
+		 */
+		if (!state->context->server.warned_serialized) {
+			const char *reason = NULL;
+
+			if (auth_type != DCERPC_AUTH_TYPE_SCHANNEL) {
+				reason = "the netlogon connection does not "
+					 "use schannel";
+			} else if (!state->context->server.try_logon_ex) {
+				reason = "the server does not support "
+					 "netr_LogonSamLogonEx";
+			}
+			if (reason != NULL) {
+				DBG_NOTICE("Logons via %s for %s are "
+					   "serialized, because %s\n",
+					   state->context->server.computer,
+					   state->context->client.account,
+					   reason);
+				state->context->server.warned_serialized = true;
+			}
+		}
+
 		subreq = netlogon_creds_cli_lock_send(state, state->ev,
 						      state->context);
 		if (tevent_req_nomem(subreq, req)) {
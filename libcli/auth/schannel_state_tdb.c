@@ -73,6 +73,50 @@ struct db_context *open_schannel_session_store(TALLOC_CTX *mem_ctx,
 	return db_sc;
 }
 
+/******************************************************************************
+ Return the schannel session store of this process, opening it only once.
+
+ Every ReqChallenge, ServerAuthenticate and authenticator check used to
+ open and close the tdb again, which is more expensive than the record
+ access itself. The cached handle is reopened after a fork, tdb handles
+ can't be shared between processes.
+*******************************************************************************/
+
+static struct db_context *schannel_session_store(
+	struct loadparm_context *lp_ctx)
+{
+	static struct db_context *db_sc;
+	static char *db_sc_path;
+	static pid_t db_sc_pid;
+	char *fname = NULL;
+
+	fname = lpcfg_private_db_path(NULL, lp_ctx, "schannel_store");
+	if (fname == NULL) {
+		return NULL;
+	}
+
+	if (db_sc != NULL &&
+	    db_sc_pid == getpid() &&
+	    strcmp(db_sc_path, fname) == 0) {
+		TALLOC_FREE(fname);
+		return db_sc;
+	}
+
+	/* db_sc_path is a child of db_sc */
+	TALLOC_FREE(db_sc);
+	db_sc_path = NULL;
+
+	db_sc = open_schannel_session_store(NULL, lp_ctx);
+	if (db_sc == NULL) {
+		TALLOC_FREE(fname);
+		return NULL;
+	}
+	db_sc_path = talloc_move(db_sc, &fname);
+	db_sc_pid = getpid();
+
+	return db_sc;
+}
+
 /********************************************************************
  ********************************************************************/
 
@@ -234,7 +278,7 @@ NTSTATUS schannel_get_creds_state(TALLOC_CTX *mem_ctx,
 		return NT_STATUS_NO_MEMORY;
 	}
 
-	db_sc = open_schannel_session_store(tmpctx, lp_ctx);
+	db_sc = schannel_session_store(lp_ctx);
 	if (!db_sc) {
 		return NT_STATUS_ACCESS_DENIED;
 	}
@@ -270,7 +314,7 @@ NTSTATUS schannel_save_creds_state(TALLOC_CTX *mem_ctx,
 		return NT_STATUS_NO_MEMORY;
 	}
 
-	db_sc = open_schannel_session_store(tmpctx, lp_ctx);
+	db_sc = schannel_session_store(lp_ctx);
 	if (!db_sc) {
 		status = NT_STATUS_ACCESS_DENIED;
 		goto fail;
@@ -464,7 +508,7 @@ NTSTATUS schannel_get_challenge(struct loadparm_context *lp_ctx,
 	struct db_context *db_sc;
 	NTSTATUS status;
 
-	db_sc = open_schannel_session_store(frame, lp_ctx);
+	db_sc = schannel_session_store(lp_ctx);
 	if (!db_sc) {
 		TALLOC_FREE(frame);
 		return NT_STATUS_ACCESS_DENIED;
@@ -494,7 +538,7 @@ NTSTATUS schannel_delete_challenge(struct loadparm_context *lp_ctx,
 	char *name_upper;
 	char keystr[16] = { 0, };
 
-	db_sc = open_schannel_session_store(frame, lp_ctx);
+	db_sc = schannel_session_store(lp_ctx);
 	if (!db_sc) {
 		TALLOC_FREE(frame);
 		return NT_STATUS_ACCESS_DENIED;
@@ -529,7 +573,7 @@ NTSTATUS schannel_save_challenge(struct loadparm_context *lp_ctx,
 	struct db_context *db_sc;
 	NTSTATUS status;
 
-	db_sc = open_schannel_session_store(frame, lp_ctx);
+	db_sc = schannel_session_store(lp_ctx);
 	if (!db_sc) {
 		TALLOC_FREE(frame);
 		return NT_STATUS_ACCESS_DENIED;
@@ -594,7 +638,7 @@ NTSTATUS schannel_check_creds_state(TALLOC_CTX *mem_ctx,
 
 	key = string_term_tdb_data(keystr);
 
-	db_sc = open_schannel_session_store(tmpctx, lp_ctx);
+	db_sc = schannel_session_store(lp_ctx);
 	if (!db_sc) {
 		status = NT_STATUS_ACCESS_DENIED;
 		goto done;
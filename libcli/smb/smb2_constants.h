@@ -37,6 +37,20 @@
 
 #define SMB2_TF_FLAGS_ENCRYPTED     0x0001
 
+/* offsets into SMB2_COMPRESSION_TRANSFORM header elements */
+#define SMB2_COMP_TF_PROTOCOL_ID	0x00 /*  4 bytes */
+#define SMB2_COMP_TF_ORIGINAL_SIZE	0x04 /*  4 bytes */
+#define SMB2_COMP_TF_ALGORITHM		0x08 /*  2 bytes */
+#define SMB2_COMP_TF_FLAGS		0x0A /*  2 bytes */
+#define SMB2_COMP_TF_OFFSET		0x0C /*  4 bytes */
+
+#define SMB2_COMP_TF_HDR_SIZE		0x10 /* 16 bytes */
+
+#define SMB2_COMP_TF_MAGIC 0x424D53FC /* 0xFC 'S' 'M' 'B' */
+
+#define SMB2_COMP_TF_FLAGS_NONE		0x0000
+#define SMB2_COMP_TF_FLAGS_CHAINED	0x0001
+
 /* offsets into header elements for a sync SMB2 request */
 #define SMB2_HDR_PROTOCOL_ID    0x00
 #define SMB2_HDR_LENGTH		0x04
@@ -131,6 +145,7 @@
 /* Types of SMB2 Negotiate Contexts - only in dialect >= 0x310 */
 #define SMB2_PREAUTH_INTEGRITY_CAPABILITIES 0x0001
 #define SMB2_ENCRYPTION_CAPABILITIES        0x0002
+#define SMB2_COMPRESSION_CAPABILITIES       0x0003
 
 /* Values for the SMB2_PREAUTH_INTEGRITY_CAPABILITIES Context (>= 0x310) */
 #define SMB2_PREAUTH_INTEGRITY_SHA512       0x0001
@@ -138,6 +153,13 @@
 /* Values for the SMB2_ENCRYPTION_CAPABILITIES Context (>= 0x310) */
 #define SMB2_ENCRYPTION_AES128_CCM         0x0001 /* only in dialect >= 0x224 */
 #define SMB2_ENCRYPTION_AES128_GCM         0x0002 /* only in dialect >= 0x310 */
+
+/* Values for the SMB2_COMPRESSION_CAPABILITIES Context (>= 0x311) */
+#define SMB2_COMPRESSION_NONE              0x0000
+#define SMB2_COMPRESSION_LZNT1             0x0001
+#define SMB2_COMPRESSION_LZ77              0x0002
+#define SMB2_COMPRESSION_LZ77_HUFFMAN      0x0003
+#define SMB2_COMPRESSION_PATTERN_V1        0x0004
 #define SMB2_NONCE_HIGH_MAX(nonce_len_bytes) ((uint64_t)(\
 	((nonce_len_bytes) >= 16) ? UINT64_MAX : \
 	((nonce_len_bytes) <= 8) ? 0 : \
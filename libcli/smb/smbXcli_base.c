@@ -141,6 +141,17 @@ struct smbXcli_conn {
 		bool force_channel_sequence;
 
 		uint8_t preauth_sha512[64];
+
+		/*
+		 * See smb2cli_conn_compound_start(), smb2cli_req_send()
+		 * collects requests here instead of sending them.
+		 */
+		struct {
+			struct tevent_req **reqs;
+			uint16_t num_reqs;
+			uint16_t max_reqs;
+			bool related;
+		} compound;
 	} smb2;
 
 	struct smbXcli_session *sessions;
@@ -3403,6 +3414,84 @@ void smb2cli_req_set_credit_charge(struct tevent_req *req, uint16_t charge)
 	state->smb2.credit_charge = charge;
 }
 
+/*
+ * Let the next num_reqs calls to smb2cli_req_send() (and so to all the
+ * smb2cli_*_send() functions) on conn build a single compound chain. The
+ * chain goes out in one PDU when the last request has been created.
+ *
+ * With related == true all but the first request are marked as
+ * SMB2_HDR_FLAG_CHAINED, so they can use UINT64_MAX as file id to refer
+ * to the handle opened by an earlier create in the chain.
+ *
+ * The requests must be created in a row without anything else sending
+ * on conn in between.
+ */
+NTSTATUS smb2cli_conn_compound_start(struct smbXcli_conn *conn,
+				     uint16_t num_reqs,
+				     bool related)
+{
+	if (conn->smb2.compound.reqs != NULL) {
+		return NT_STATUS_INVALID_PARAMETER_MIX;
+	}
+	if (num_reqs == 0) {
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+	if (conn->protocol < PROTOCOL_SMB2_02) {
+		return NT_STATUS_REVISION_MISMATCH;
+	}
+
+	conn->smb2.compound.reqs = talloc_zero_array(conn,
+						     struct tevent_req *,
+						     num_reqs);
+	if (conn->smb2.compound.reqs == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+	conn->smb2.compound.num_reqs = 0;
+	conn->smb2.compound.max_reqs = num_reqs;
+	conn->smb2.compound.related = related;
+
+	return NT_STATUS_OK;
+}
+
+static void smb2cli_conn_compound_reset(struct smbXcli_conn *conn)
+{
+	TALLOC_FREE(conn->smb2.compound.reqs);
+	conn->smb2.compound.num_reqs = 0;
+	conn->smb2.compound.max_reqs = 0;
+	conn->smb2.compound.related = false;
+}
+
+/*
+ * The requests collected so far for a compound chain were already handed
+ * to their callers, let them fail as well.
+ */
+static void smb2cli_conn_compound_fail(struct smbXcli_conn *conn,
+				       NTSTATUS status)
+{
+	uint16_t i;
+
+	for (i = 0; i < conn->smb2.compound.num_reqs; i++) {
+		struct tevent_req *req = conn->smb2.compound.reqs[i];
+		struct smbXcli_req_state *state =
+			tevent_req_data(req,
+			struct smbXcli_req_state);
+
+		tevent_req_defer_callback(req, state->ev);
+		tevent_req_nterror(req, status);
+	}
+	smb2cli_conn_compound_reset(conn);
+}
+
+/*
+ * Stop collecting requests for a compound chain, the requests collected
+ * so far fail with NT_STATUS_CANCELLED. This is a no-op if the chain was
+ * already sent.
+ */
+void smb2cli_conn_compound_cancel(struct smbXcli_conn *conn)
+{
+	smb2cli_conn_compound_fail(conn, NT_STATUS_CANCELLED);
+}
+
 struct tevent_req *smb2cli_req_send(TALLOC_CTX *mem_ctx,
 				    struct tevent_context *ev,
 				    struct smbXcli_conn *conn,
@@ -3419,8 +3508,14 @@ struct tevent_req *smb2cli_req_send(TALLOC_CTX *mem_ctx,
 				    uint32_t max_dyn_len)
 {
 	struct tevent_req *req;
+	struct tevent_req **reqs = &req;
+	uint16_t num_reqs = 1;
 	NTSTATUS status;
 
+	if (conn->smb2.compound.related && conn->smb2.compound.num_reqs > 0) {
+		additional_flags |= SMB2_HDR_FLAG_CHAINED;
+	}
+
 	req = smb2cli_req_create(mem_ctx, ev, conn, cmd,
 				 additional_flags, clear_flags,
 				 timeout_msec,
@@ -3429,12 +3524,39 @@ struct tevent_req *smb2cli_req_send(TALLOC_CTX *mem_ctx,
 				 dyn, dyn_len,
 				 max_dyn_len);
 	if (req == NULL) {
+		smb2cli_conn_compound_fail(conn, NT_STATUS_NO_MEMORY);
 		return NULL;
 	}
 	if (!tevent_req_is_in_progress(req)) {
+		if (!tevent_req_is_nterror(req, &status)) {
+			status = NT_STATUS_INTERNAL_ERROR;
+		}
+		smb2cli_conn_compound_fail(conn, status);
 		return tevent_req_post(req, ev);
 	}
-	status = smb2cli_req_compound_submit(&req, 1);
+
+	if (conn->smb2.compound.reqs != NULL) {
+		conn->smb2.compound.reqs[conn->smb2.compound.num_reqs] = req;
+		conn->smb2.compound.num_reqs += 1;
+
+		if (conn->smb2.compound.num_reqs <
+		    conn->smb2.compound.max_reqs) {
+			return req;
+		}
+
+		reqs = conn->smb2.compound.reqs;
+		num_reqs = conn->smb2.compound.num_reqs;
+	}
+
+	status = smb2cli_req_compound_submit(reqs, num_reqs);
+	if (reqs != &req) {
+		/* req itself is failed below */
+		conn->smb2.compound.num_reqs -= 1;
+		if (!NT_STATUS_IS_OK(status)) {
+			smb2cli_conn_compound_fail(conn, status);
+		}
+		smb2cli_conn_compound_reset(conn);
+	}
 	if (tevent_req_nterror(req, status)) {
 		return tevent_req_post(req, ev);
 	}
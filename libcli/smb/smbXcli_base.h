@@ -405,6 +405,10 @@ struct tevent_req *smb2cli_req_create(TALLOC_CTX *mem_ctx,
 void smb2cli_req_set_notify_async(struct tevent_req *req);
 NTSTATUS smb2cli_req_compound_submit(struct tevent_req **reqs,
 				     int num_reqs);
+NTSTATUS smb2cli_conn_compound_start(struct smbXcli_conn *conn,
+				     uint16_t num_reqs,
+				     bool related);
+void smb2cli_conn_compound_cancel(struct smbXcli_conn *conn);
 void smb2cli_req_set_credit_charge(struct tevent_req *req, uint16_t charge);
 
 struct smb2cli_req_expected_response {
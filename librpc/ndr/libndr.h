@@ -80,6 +80,14 @@ struct ndr_pull {
 	/* this is used to ensure we generate unique reference IDs
 	   between request and reply */
 	uint32_t ptr_count;
+
+	/*
+	 * Set by ndr_pull_struct_blob_all_borrowed(): the caller keeps
+	 * the blob alive and unmodified for as long as the result is
+	 * used, so DATA_BLOBs and plain ASCII strings point into it
+	 * instead of being copied.
+	 */
+	bool borrow_data;
 };
 
 /* structure passed to functions that generate NDR formatted data */
@@ -598,6 +606,10 @@ enum ndr_err_code ndr_pull_struct_blob(const DATA_BLOB *blob, TALLOC_CTX *mem_ct
 enum ndr_err_code ndr_pull_struct_blob_all(const DATA_BLOB *blob, TALLOC_CTX *mem_ctx, void *p, ndr_pull_flags_fn_t fn);
 enum ndr_err_code ndr_pull_struct_blob_all_noalloc(const DATA_BLOB *blob,
 						   void *p, ndr_pull_flags_fn_t fn);
+enum ndr_err_code ndr_pull_struct_blob_all_borrowed(const DATA_BLOB *blob,
+						    TALLOC_CTX *mem_ctx,
+						    void *p,
+						    ndr_pull_flags_fn_t fn);
 enum ndr_err_code ndr_pull_union_blob(const DATA_BLOB *blob, TALLOC_CTX *mem_ctx, void *p, uint32_t level, ndr_pull_flags_fn_t fn);
 enum ndr_err_code ndr_pull_union_blob_all(const DATA_BLOB *blob, TALLOC_CTX *mem_ctx, void *p, uint32_t level, ndr_pull_flags_fn_t fn);
 
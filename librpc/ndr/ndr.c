@@ -250,6 +250,8 @@ _PUBLIC_ DATA_BLOB ndr_push_blob(struct ndr_push *ndr)
 _PUBLIC_ enum ndr_err_code ndr_push_expand(struct ndr_push *ndr, uint32_t extra_size)
 {
 	uint32_t size = extra_size + ndr->offset;
+	uint32_t alloc_size;
+	uint8_t *data = NULL;
 
 	if (size < ndr->offset) {
 		/* extra_size overflowed the offset */
@@ -272,15 +274,27 @@ _PUBLIC_ enum ndr_err_code ndr_push_expand(struct ndr_push *ndr, uint32_t extra_
 		return NDR_ERR_SUCCESS;
 	}
 
-	ndr->alloc_size += NDR_BASE_MARSHALL_SIZE;
-	if (size+1 > ndr->alloc_size) {
-		ndr->alloc_size = size+1;
+	/*
+	 * Grow geometrically, so that marshalling a large structure
+	 * (e.g. a DRSUAPI GetNCChanges reply) does not copy the buffer
+	 * once for every NDR_BASE_MARSHALL_SIZE bytes pushed.
+	 */
+	alloc_size = MAX(ndr->alloc_size, NDR_BASE_MARSHALL_SIZE);
+	if (alloc_size > UINT32_MAX / 2) {
+		alloc_size = UINT32_MAX;
+	} else {
+		alloc_size *= 2;
 	}
-	ndr->data = talloc_realloc(ndr, ndr->data, uint8_t, ndr->alloc_size);
-	if (!ndr->data) {
+	if (size+1 > alloc_size) {
+		alloc_size = size+1;
+	}
+	data = talloc_realloc(ndr, ndr->data, uint8_t, alloc_size);
+	if (data == NULL) {
 		return ndr_push_error(ndr, NDR_ERR_ALLOC, "Failed to push_expand to %u",
-				      ndr->alloc_size);
+				      alloc_size);
 	}
+	ndr->data = data;
+	ndr->alloc_size = alloc_size;
 
 	return NDR_ERR_SUCCESS;
 }
@@ -775,6 +789,7 @@ _PUBLIC_ enum ndr_err_code ndr_pull_subcontext_start(struct ndr_pull *ndr,
 		subndr->data		= ndr->data;
 		subndr->offset		= ndr->offset;
 		subndr->data_size	= ndr->data_size;
+		subndr->borrow_data	= ndr->borrow_data;
 
 		*_subndr = subndr;
 		return NDR_ERR_SUCCESS;
@@ -794,6 +809,7 @@ _PUBLIC_ enum ndr_err_code ndr_pull_subcontext_start(struct ndr_pull *ndr,
 	subndr->data = ndr->data + ndr->offset;
 	subndr->offset = 0;
 	subndr->data_size = r_content_size;
+	subndr->borrow_data = ndr->borrow_data;
 
 	if (force_le) {
 		ndr_set_flags(&ndr->flags, LIBNDR_FLAG_LITTLE_ENDIAN);
@@ -1239,6 +1255,42 @@ _PUBLIC_ enum ndr_err_code ndr_pull_struct_blob_all(const DATA_BLOB *blob, TALLO
 	return NDR_ERR_SUCCESS;
 }
 
+/*
+  pull a struct from a blob using NDR - failing if all bytes are not consumed
+
+  DATA_BLOBs and strings that need no character conversion in the result
+  point into blob->data rather than being copied, so blob must outlive the
+  result and must not be changed while it is in use. Such members must
+  not be freed or modified by the caller either.
+*/
+_PUBLIC_ enum ndr_err_code ndr_pull_struct_blob_all_borrowed(const DATA_BLOB *blob,
+							     TALLOC_CTX *mem_ctx,
+							     void *p,
+							     ndr_pull_flags_fn_t fn)
+{
+	struct ndr_pull *ndr;
+	uint32_t highest_ofs;
+	ndr = ndr_pull_init_blob(blob, mem_ctx);
+	NDR_ERR_HAVE_NO_MEMORY(ndr);
+	ndr->borrow_data = true;
+	NDR_CHECK_FREE(fn(ndr, NDR_SCALARS|NDR_BUFFERS, p));
+	if (ndr->offset > ndr->relative_highest_offset) {
+		highest_ofs = ndr->offset;
+	} else {
+		highest_ofs = ndr->relative_highest_offset;
+	}
+	if (highest_ofs < ndr->data_size) {
+		enum ndr_err_code ret;
+		ret = ndr_pull_error(ndr, NDR_ERR_UNREAD_BYTES,
+				     "not all bytes consumed ofs[%u] size[%u]",
+				     highest_ofs, ndr->data_size);
+		talloc_free(ndr);
+		return ret;
+	}
+	talloc_free(ndr);
+	return NDR_ERR_SUCCESS;
+}
+
 /*
   pull a struct from a blob using NDR - failing if all bytes are not consumed
 
@@ -22,6 +22,33 @@
 #include "includes.h"
 #include "librpc/ndr/libndr.h"
 
+/**
+  with ndr->borrow_data, return a pointer into the buffer for a single
+  byte string that is plain ASCII and NULL terminated within len, as no
+  charset conversion would change it
+*/
+static bool ndr_pull_string_borrow(struct ndr_pull *ndr, size_t len,
+				   const char **s)
+{
+	const uint8_t *src = ndr->data + ndr->offset;
+	size_t i;
+
+	if (!ndr->borrow_data || len == 0) {
+		return false;
+	}
+	if (src[len-1] != '\0') {
+		return false;
+	}
+	for (i = 0; i < len-1; i++) {
+		if (src[i] == '\0' || src[i] >= 0x80) {
+			return false;
+		}
+	}
+
+	*s = (const char *)src;
+	return true;
+}
+
 /**
   pull a general string from the wire
 */
@@ -141,6 +168,10 @@ _PUBLIC_ enum ndr_err_code ndr_pull_string(struct ndr_pull *ndr, int ndr_flags,
 	}
 
 	NDR_PULL_NEED_BYTES(ndr, conv_src_len * byte_mul);
+	if (byte_mul == 1 && chset != CH_UTF16 && chset != CH_UTF16BE &&
+	    ndr_pull_string_borrow(ndr, conv_src_len, s)) {
+		return ndr_pull_advance(ndr, conv_src_len);
+	}
 	if (conv_src_len == 0) {
 		as = talloc_strdup(ndr->current_mem_ctx, "");
 		converted_size = 0;
@@ -593,6 +624,10 @@ _PUBLIC_ enum ndr_err_code ndr_pull_charset(struct ndr_pull *ndr, int ndr_flags,
 	}
 	NDR_PULL_NEED_BYTES(ndr, length*byte_mul);
 
+	if (byte_mul == 1 && ndr_pull_string_borrow(ndr, length, var)) {
+		return ndr_pull_advance(ndr, length);
+	}
+
 	if (!convert_string_talloc(ndr->current_mem_ctx, chset, CH_UNIX,
 				   ndr->data+ndr->offset, length*byte_mul,
 				   discard_const_p(void *, var),
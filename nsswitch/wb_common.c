@@ -25,7 +25,11 @@
 
 #include "replace.h"
 #include "system/select.h"
+#include "system/filesys.h"
+#include "system/shmem.h"
+#include "system/threads.h"
 #include "winbind_client.h"
+#include "winbind_nss_cache.h"
 
 #ifdef HAVE_PTHREAD_H
 #include <pthread.h>
@@ -858,3 +862,201 @@ void winbindd_ctx_free(struct winbindd_context *ctx)
 	winbind_close_sock(ctx);
 	free(ctx);
 }
+
+#ifdef HAVE_ATOMIC_THREAD_FENCE_SUPPORT
+
+static const struct winbind_nss_cache_header *wb_nss_cache;
+static time_t wb_nss_cache_last_try;
+
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t wb_nss_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/*
+ * Map the cache once per process. If winbindd has not published it
+ * (yet), try again at most every 10 seconds.
+ */
+static const struct winbind_nss_cache_header *winbindd_nss_cache_map(void)
+{
+	const struct winbind_nss_cache_header *cache = wb_nss_cache;
+	char path[PATH_MAX];
+	struct stat st;
+	time_t now;
+	void *ptr = NULL;
+	int fd;
+	int ret;
+
+	if (cache != NULL) {
+		atomic_thread_fence(memory_order_seq_cst);
+		return cache;
+	}
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&wb_nss_cache_mutex);
+#endif
+
+	now = time(NULL);
+	if (wb_nss_cache != NULL ||
+	    (now >= wb_nss_cache_last_try && now - wb_nss_cache_last_try < 10)) {
+		goto done;
+	}
+	wb_nss_cache_last_try = now;
+
+	ret = snprintf(path, sizeof(path), "%s/%s",
+		       winbindd_socket_dir(), WINBIND_NSS_CACHE_FILE);
+	if (ret < 0 || (size_t)ret >= sizeof(path)) {
+		goto done;
+	}
+
+	fd = open(path, O_RDONLY|O_CLOEXEC);
+	if (fd == -1) {
+		goto done;
+	}
+	ret = fstat(fd, &st);
+	if (ret == -1 || !S_ISREG(st.st_mode) ||
+	    !winbind_privileged_pipe_is_root(st.st_uid) ||
+	    (st.st_mode & (S_IWGRP|S_IWOTH)) ||
+	    st.st_size < (off_t)WINBIND_NSS_CACHE_SIZE) {
+		close(fd);
+		goto done;
+	}
+	ptr = mmap(NULL, WINBIND_NSS_CACHE_SIZE, PROT_READ, MAP_SHARED,
+		   fd, 0);
+	close(fd);
+	if (ptr == MAP_FAILED) {
+		goto done;
+	}
+	cache = (const struct winbind_nss_cache_header *)ptr;
+
+	if (cache->magic != WINBIND_NSS_CACHE_MAGIC ||
+	    cache->version != WINBIND_NSS_CACHE_VERSION ||
+	    cache->num_slots != WINBIND_NSS_CACHE_NUM_SLOTS ||
+	    cache->slot_size != sizeof(struct winbind_nss_cache_slot)) {
+		munmap(ptr, WINBIND_NSS_CACHE_SIZE);
+		goto done;
+	}
+
+	atomic_thread_fence(memory_order_seq_cst);
+	wb_nss_cache = cache;
+
+done:
+	cache = wb_nss_cache;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&wb_nss_cache_mutex);
+#endif
+	return cache;
+}
+
+/*
+ * Look up a GETPWNAM, GETPWUID, GETGRNAM or GETGRGID request in the
+ * cache winbindd publishes, without talking to winbindd. On success
+ * response is filled in as winbindd would have done, the caller
+ * frees it with winbindd_free_response().
+ */
+NSS_STATUS winbindd_nss_cache_lookup(int req_type,
+				     const char *name,
+				     uint32_t id,
+				     struct winbindd_response *response)
+{
+	const struct winbind_nss_cache_header *cache = NULL;
+	const struct winbind_nss_cache_slot *slot = NULL;
+	const volatile uint32_t *seqnum = NULL;
+	struct winbind_nss_cache_slot copy;
+	unsigned retries;
+	bool ok = false;
+
+	if (winbind_env_set()) {
+		return NSS_STATUS_NOTFOUND;
+	}
+
+	switch (req_type) {
+	case WINBINDD_GETPWNAM:
+	case WINBINDD_GETGRNAM:
+		if (name == NULL || strlen(name) >= sizeof(copy.name)) {
+			return NSS_STATUS_NOTFOUND;
+		}
+		break;
+	case WINBINDD_GETPWUID:
+	case WINBINDD_GETGRGID:
+		name = NULL;
+		break;
+	default:
+		return NSS_STATUS_NOTFOUND;
+	}
+
+	cache = winbindd_nss_cache_map();
+	if (cache == NULL) {
+		return NSS_STATUS_NOTFOUND;
+	}
+
+	slot = &cache->slots[winbind_nss_cache_hash(req_type, name, id) %
+			     WINBIND_NSS_CACHE_NUM_SLOTS];
+	seqnum = &slot->seqnum;
+
+	for (retries = 0; retries < 3; retries++) {
+		uint32_t seq1, seq2;
+
+		seq1 = *seqnum;
+		atomic_thread_fence(memory_order_seq_cst);
+		if ((seq1 & 1) != 0) {
+			continue;
+		}
+
+		memcpy(&copy, slot, sizeof(copy));
+
+		atomic_thread_fence(memory_order_seq_cst);
+		seq2 = *seqnum;
+
+		if (seq1 == seq2) {
+			ok = true;
+			break;
+		}
+	}
+	if (!ok) {
+		return NSS_STATUS_NOTFOUND;
+	}
+
+	copy.name[sizeof(copy.name) - 1] = '\0';
+	copy.gr_mem[sizeof(copy.gr_mem) - 1] = '\0';
+
+	if (copy.cmd != (uint32_t)req_type ||
+	    copy.expires <= (uint64_t)time(NULL)) {
+		return NSS_STATUS_NOTFOUND;
+	}
+	if (name != NULL ? strcmp(copy.name, name) != 0 : copy.id != id) {
+		return NSS_STATUS_NOTFOUND;
+	}
+
+	*response = (struct winbindd_response) {
+		.length = sizeof(struct winbindd_response),
+		.result = WINBINDD_OK,
+	};
+
+	if (req_type == WINBINDD_GETPWNAM || req_type == WINBINDD_GETPWUID) {
+		response->data.pw = copy.data.pw;
+		return NSS_STATUS_SUCCESS;
+	}
+
+	response->data.gr = copy.data.gr;
+	response->data.gr.gr_mem_ofs = 0;
+	if (response->data.gr.num_gr_mem != 0) {
+		response->extra_data.data = strdup(copy.gr_mem);
+		if (response->extra_data.data == NULL) {
+			return NSS_STATUS_NOTFOUND;
+		}
+	}
+
+	return NSS_STATUS_SUCCESS;
+}
+
+#else /* HAVE_ATOMIC_THREAD_FENCE_SUPPORT */
+
+NSS_STATUS winbindd_nss_cache_lookup(int req_type,
+				     const char *name,
+				     uint32_t id,
+				     struct winbindd_response *response)
+{
+	return NSS_STATUS_NOTFOUND;
+}
+
+#endif /* HAVE_ATOMIC_THREAD_FENCE_SUPPORT */
@@ -46,6 +46,11 @@ NSS_STATUS winbindd_priv_request_response(struct winbindd_context *ctx,
 
 void winbind_set_client_name(const char *name);
 
+NSS_STATUS winbindd_nss_cache_lookup(int req_type,
+				     const char *name,
+				     uint32_t id,
+				     struct winbindd_response *response);
+
 #define winbind_env_set() \
 	(strcmp(getenv(WINBINDD_DONT_ENV)?getenv(WINBINDD_DONT_ENV):"0","1") == 0)
 
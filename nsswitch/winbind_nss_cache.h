@@ -0,0 +1,95 @@
+/*
+   Unix SMB/CIFS implementation.
+
+   Layout of the passwd/group cache winbindd publishes for the NSS module
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 3 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _NSSWITCH_WINBIND_NSS_CACHE_H_
+#define _NSSWITCH_WINBIND_NSS_CACHE_H_
+
+#include "winbind_struct_protocol.h"
+
+/*
+ * winbindd keeps the answers to recent GETPWNAM, GETPWUID, GETGRNAM and
+ * GETGRGID requests in a file next to its socket. The file is a fixed
+ * size hash table mapped read-only by the NSS module, so a process can
+ * look up an entry winbindd already knows without any lock or socket
+ * round-trip.
+ *
+ * winbindd is the only writer. Each slot carries a sequence number that
+ * is odd while the slot is being changed, readers copy the slot and
+ * retry or give up if the number changed underneath them.
+ */
+
+#define WINBIND_NSS_CACHE_FILE "nss_cache"
+#define WINBIND_NSS_CACHE_MAGIC 0x574e5343 /* "WNSC" */
+#define WINBIND_NSS_CACHE_VERSION 1
+#define WINBIND_NSS_CACHE_NUM_SLOTS 2048
+
+/* Groups with a longer member list are not cached */
+#define WINBIND_NSS_CACHE_GR_MEM_SIZE 1024
+
+struct winbind_nss_cache_slot {
+	uint32_t seqnum;	/* odd while winbindd updates the slot */
+	uint32_t cmd;		/* enum winbindd_cmd, 0 if unused */
+	uint64_t expires;	/* time_t after which the entry is stale */
+	uint32_t id;		/* the uid or gid that was asked for */
+	fstring name;		/* the name that was asked for */
+	union {
+		struct winbindd_pw pw;
+		struct winbindd_gr gr;
+	} data;
+	char gr_mem[WINBIND_NSS_CACHE_GR_MEM_SIZE];
+};
+
+struct winbind_nss_cache_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t num_slots;
+	uint32_t slot_size;
+	struct winbind_nss_cache_slot slots[];
+};
+
+#define WINBIND_NSS_CACHE_SIZE \
+	(sizeof(struct winbind_nss_cache_header) + \
+	 WINBIND_NSS_CACHE_NUM_SLOTS * sizeof(struct winbind_nss_cache_slot))
+
+/*
+ * FNV-1a over the command and the name or id asked for
+ */
+static inline uint32_t winbind_nss_cache_hash(uint32_t cmd,
+					      const char *name,
+					      uint32_t id)
+{
+	uint32_t h = 2166136261U;
+	size_t i;
+
+	h = (h ^ cmd) * 16777619U;
+
+	if (name != NULL) {
+		for (i = 0; name[i] != '\0'; i++) {
+			h = (h ^ (uint8_t)name[i]) * 16777619U;
+		}
+		return h;
+	}
+
+	for (i = 0; i < sizeof(id); i++) {
+		h = (h ^ ((id >> (i * 8)) & 0xff)) * 16777619U;
+	}
+	return h;
+}
+
+#endif /* _NSSWITCH_WINBIND_NSS_CACHE_H_ */
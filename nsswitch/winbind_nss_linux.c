@@ -350,6 +350,61 @@ static NSS_STATUS fill_grent(struct group *result, struct winbindd_gr *gr,
 	return NSS_STATUS_SUCCESS;
 }
 
+/*
+ * Try to answer a passwd or group lookup from the cache winbindd
+ * publishes, without taking winbind_nss_mutex or talking to winbindd.
+ * Returns false if the entry is not cached, *pret is filled in
+ * otherwise.
+ */
+
+static bool winbind_nss_cache_getpw(int req_type, const char *name,
+				    uint32_t id, struct passwd *result,
+				    char *buffer, size_t buflen,
+				    int *errnop, NSS_STATUS *pret)
+{
+	struct winbindd_response response;
+	NSS_STATUS ret;
+
+	ret = winbindd_nss_cache_lookup(req_type, name, id, &response);
+	if (ret != NSS_STATUS_SUCCESS) {
+		return false;
+	}
+
+	ret = fill_pwent(result, &response.data.pw, &buffer, &buflen);
+	if (ret == NSS_STATUS_TRYAGAIN) {
+		*errnop = errno = ERANGE;
+	}
+	winbindd_free_response(&response);
+
+	*pret = ret;
+	return true;
+}
+
+static bool winbind_nss_cache_getgr(int req_type, const char *name,
+				    uint32_t id, struct group *result,
+				    char *buffer, size_t buflen,
+				    int *errnop, NSS_STATUS *pret)
+{
+	struct winbindd_response response;
+	NSS_STATUS ret;
+
+	ret = winbindd_nss_cache_lookup(req_type, name, id, &response);
+	if (ret != NSS_STATUS_SUCCESS) {
+		return false;
+	}
+
+	ret = fill_grent(result, &response.data.gr,
+			 (char *)response.extra_data.data,
+			 &buffer, &buflen);
+	if (ret == NSS_STATUS_TRYAGAIN) {
+		*errnop = errno = ERANGE;
+	}
+	winbindd_free_response(&response);
+
+	*pret = ret;
+	return true;
+}
+
 /*
  * NSS user functions
  */
@@ -535,6 +590,11 @@ _nss_winbind_getpwuid_r(uid_t uid, struct passwd *result, char *buffer,
 	fprintf(stderr, "[%5d]: getpwuid_r %d\n", getpid(), (unsigned int)uid);
 #endif
 
+	if (winbind_nss_cache_getpw(WINBINDD_GETPWUID, NULL, uid, result,
+				    buffer, buflen, errnop, &ret)) {
+		return ret;
+	}
+
 #ifdef HAVE_PTHREAD
 	pthread_mutex_lock(&winbind_nss_mutex);
 #endif
@@ -613,6 +673,11 @@ _nss_winbind_getpwnam_r(const char *name, struct passwd *result, char *buffer,
 	fprintf(stderr, "[%5d]: getpwnam_r %s\n", getpid(), name);
 #endif
 
+	if (winbind_nss_cache_getpw(WINBINDD_GETPWNAM, name, 0, result,
+				    buffer, buflen, errnop, &ret)) {
+		return ret;
+	}
+
 #ifdef HAVE_PTHREAD
 	pthread_mutex_lock(&winbind_nss_mutex);
 #endif
@@ -893,6 +958,11 @@ _nss_winbind_getgrnam_r(const char *name,
 	fprintf(stderr, "[%5d]: getgrnam %s\n", getpid(), name);
 #endif
 
+	if (winbind_nss_cache_getgr(WINBINDD_GETGRNAM, name, 0, result,
+				    buffer, buflen, errnop, &ret)) {
+		return ret;
+	}
+
 #ifdef HAVE_PTHREAD
 	pthread_mutex_lock(&winbind_nss_mutex);
 #endif
@@ -980,6 +1050,11 @@ _nss_winbind_getgrgid_r(gid_t gid,
 	fprintf(stderr, "[%5d]: getgrgid %d\n", getpid(), gid);
 #endif
 
+	if (winbind_nss_cache_getgr(WINBINDD_GETGRGID, NULL, gid, result,
+				    buffer, buflen, errnop, &ret)) {
+		return ret;
+	}
+
 #ifdef HAVE_PTHREAD
 	pthread_mutex_lock(&winbind_nss_mutex);
 #endif
@@ -229,9 +229,24 @@ class dbcheck(object):
             pass
 
     def check_database(self, DN=None, scope=ldb.SCOPE_SUBTREE, controls=None,
-                       attrs=None):
-        '''perform a database check, returning the number of errors found'''
-        res = self.samdb.search(base=DN, scope=scope, attrs=['dn'], controls=controls)
+                       attrs=None, changed_since_usn=None):
+        '''perform a database check, returning the number of errors found
+
+        If changed_since_usn is given, only objects with a uSNChanged
+        greater than it are checked.
+        '''
+        expression = None
+        if changed_since_usn is not None:
+            expression = "(uSNChanged>=%u)" % (changed_since_usn + 1)
+
+        # Read this before the search, so that a later run from this
+        # USN does not miss changes made while we are checking.
+        res = self.samdb.search(base="", scope=ldb.SCOPE_BASE,
+                                attrs=["highestCommittedUSN"])
+        highest_usn = int(res[0]["highestCommittedUSN"][0])
+
+        res = self.samdb.search(base=DN, scope=scope, attrs=['dn'],
+                                expression=expression, controls=controls)
         self.report('Checking %u objects' % len(res))
         error_count = 0
 
@@ -250,6 +265,10 @@ class dbcheck(object):
             self.report("Please use --fix to fix these errors")
 
         self.report('Checked %u objects (%u errors)' % (len(res), error_count))
+        if changed_since_usn is not None or self.verbose:
+            self.report('Highest committed USN before the check was %u, '
+                        'use --changed-since-usn=%u to check only objects '
+                        'changed after it' % (highest_usn, highest_usn))
         return error_count
 
     def check_deleted_objects_containers(self):
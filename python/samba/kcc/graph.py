@@ -31,6 +31,9 @@ from samba.kcc.debug import DEBUG, DEBUG_FN, WARN
 
 MAX_DWORD = 2 ** 32 - 1
 
+# number of bits set in each possible schedule byte
+_POPCOUNT = [bin(_i).count('1') for _i in range(256)]
+
 
 class ReplInfo(object):
     """Represents information about replication
@@ -67,12 +70,7 @@ def total_schedule(schedule):
     if schedule is None:
         return 84 * 8  # 84 bytes = 84 * 8 bits
 
-    total = 0
-    for byte in schedule:
-        while byte != 0:
-            total += byte & 1
-            byte >>= 1
-    return total
+    return sum(_POPCOUNT[byte] for byte in schedule)
 
 
 def convert_schedule_to_repltimes(schedule):
@@ -131,14 +129,21 @@ def combine_repl_info(info_a, info_b):
     info_c.interval = max(info_a.interval, info_b.interval)
     info_c.options = info_a.options & info_b.options
 
-    # schedule of None defaults to "always"
-    if info_a.schedule is None:
-        info_a.schedule = [0xFF] * 84
-    if info_b.schedule is None:
-        info_b.schedule = [0xFF] * 84
-
-    info_c.schedule = [a & b for a, b in zip(info_a.schedule, info_b.schedule)]
-    info_c.duration = total_schedule(info_c.schedule)
+    # schedule of None defaults to "always", so the intersection is
+    # just the other schedule (and its duration).
+    if info_a.schedule is None and info_b.schedule is None:
+        info_c.schedule = [0xFF] * 84
+        info_c.duration = 84 * 8
+    elif info_a.schedule is None:
+        info_c.schedule = list(info_b.schedule)
+        info_c.duration = total_schedule(info_c.schedule)
+    elif info_b.schedule is None:
+        info_c.schedule = list(info_a.schedule)
+        info_c.duration = total_schedule(info_c.schedule)
+    else:
+        info_c.schedule = [a & b for a, b in zip(info_a.schedule,
+                                                 info_b.schedule)]
+        info_c.duration = total_schedule(info_c.schedule)
 
     info_c.cost = min(info_a.cost + info_b.cost, MAX_DWORD)
     return info_c
@@ -492,7 +497,8 @@ def process_edge(graph, examine, internal_edges):
         # Append a 4-tuple of color, repl cost, guid and vertex
         vertices.append((v.color, v.repl_info.cost, v.ndrpacked_guid, v))
     # Sort by color, lower
-    DEBUG("vertices is %s" % vertices)
+    # let the logger format this only if it is going to be shown
+    DEBUG("vertices is %s", vertices)
     vertices.sort()
 
     color, cost, guid, bestv = vertices[0]
@@ -576,8 +582,10 @@ def kruskal(graph, edges):
     components = set([x for x in graph.vertices if not x.is_white()])
     edges = list(edges)
 
-    # Sorted based on internal comparison function of internal edge
-    edges.sort()
+    # Sorted in the order of the internal comparison function of
+    # internal edge, but with a key so that the comparison isn't done
+    # in Python for each pair.
+    edges.sort(key=internal_edge_sort_key)
 
     # XXX expected_num_tree_edges is never used
     expected_num_tree_edges = 0  # TODO this value makes little sense
@@ -600,6 +608,20 @@ def kruskal(graph, edges):
     return output_edges, len(components)
 
 
+def internal_edge_sort_key(e):
+    """Return a key sorting internal edges like InternalEdge.__lt__
+
+    :param e: an InternalEdge
+    :return: a tuple, lower is better
+    """
+    return (not e.red_red,
+            e.repl_info.cost,
+            -e.repl_info.duration,
+            e.v1.ndrpacked_guid,
+            e.v2.ndrpacked_guid,
+            e.e_type)
+
+
 def find_component(vertex):
     """Kruskal helper to find the component a vertex belongs to.
 
@@ -77,6 +77,10 @@ class cmd_dbcheck(Command):
                      "but speeds up dbcheck dramatically for domains with "
                      "large groups"),
                default=False, action="store_true"),
+        Option("--changed-since-usn", dest="changed_since_usn",
+               help=("Only check objects changed after this USN, "
+                     "as reported by an earlier dbcheck run"),
+               type=int, metavar="USN", default=None),
         Option("-H", "--URL", help="LDB URL for database or target server (defaults to local SAM database)",
                type=str, metavar="URL", dest="H"),
     ]
@@ -85,7 +89,7 @@ class cmd_dbcheck(Command):
             cross_ncs=False, quiet=False,
             scope="SUB", credopts=None, sambaopts=None, versionopts=None,
             attrs=None, reindex=False, force_modules=False,
-            quick_membership_checks=False,
+            quick_membership_checks=False, changed_since_usn=None,
             reset_well_known_acls=False, yes_rules=[]):
 
         lp = sambaopts.get_loadparm()
@@ -161,7 +165,8 @@ class cmd_dbcheck(Command):
 
             else:
                 error_count = chk.check_database(DN=DN, scope=search_scope,
-                                                 controls=controls, attrs=attrs)
+                                                 controls=controls, attrs=attrs,
+                                                 changed_since_usn=changed_since_usn)
         except:
             if started_transaction:
                 samdb.transaction_cancel()
@@ -3903,22 +3903,18 @@ This command expunges tombstones from the database."""
         else:
             ncs = list(ncs)
 
-        started_transaction = False
+        # garbage_collect_tombstones() commits in batches of
+        # "dsdb:tombstone expunge batch size" itself, wrapping it into
+        # one transaction here would block all writers until the end
         try:
-            samdb.transaction_start()
-            started_transaction = True
             (removed_objects,
              removed_links) = samdb.garbage_collect_tombstones(ncs,
                                                                current_time=current_time,
                                                                tombstone_lifetime=tombstone_lifetime)
 
         except Exception as err:
-            if started_transaction:
-                samdb.transaction_cancel()
             raise CommandError("Failed to expunge / garbage collect tombstones", err)
 
-        samdb.transaction_commit()
-
         self.outf.write("Removed %d objects and %d links successfully\n"
                         % (removed_objects, removed_links))
 
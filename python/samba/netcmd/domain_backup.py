@@ -114,15 +114,32 @@ def get_timestamp():
     return datetime.datetime.now().isoformat().replace(':', '-')
 
 
-def backup_filepath(targetdir, name, time_str):
-    filename = 'samba-backup-%s-%s.tar.bz2' % (name, time_str)
+# The tarfile mode and file extension for each --compression choice. The
+# restore auto-detects the compression used.
+backup_compression = {
+    "bz2": ("w:bz2", ".tar.bz2"),
+    "gz": ("w:gz", ".tar.gz"),
+    "none": ("w", ".tar"),
+}
+
+
+def compression_option():
+    return Option("--compression", type="choice", metavar="COMPRESSION",
+                  choices=sorted(backup_compression.keys()), default="bz2",
+                  help="Compression used for the backup file: bz2 "
+                  "(the default), or the faster gz or none")
+
+
+def backup_filepath(targetdir, name, time_str, compression="bz2"):
+    ext = backup_compression[compression][1]
+    filename = 'samba-backup-%s-%s%s' % (name, time_str, ext)
     return os.path.join(targetdir, filename)
 
 
-def create_backup_tar(logger, tmpdir, backup_filepath):
+def create_backup_tar(logger, tmpdir, backup_filepath, compression="bz2"):
     # Adds everything in the tmpdir into a new tar file
     logger.info("Creating backup file %s..." % backup_filepath)
-    tf = tarfile.open(backup_filepath, 'w:bz2')
+    tf = tarfile.open(backup_filepath, backup_compression[compression][0])
     tf.add(tmpdir, arcname='./')
     tf.close()
 
@@ -223,10 +240,11 @@ class cmd_domain_backup_online(samba.netcmd.Command):
                choices=["tdb", "mdb"],
                help="Specify the database backend to be used "
                "(default is %s)" % get_default_backend_store()),
+        compression_option(),
     ]
 
     def run(self, sambaopts=None, credopts=None, server=None, targetdir=None,
-            no_secrets=False, backend_store=None):
+            no_secrets=False, backend_store=None, compression="bz2"):
         logger = self.get_logger()
         logger.setLevel(logging.DEBUG)
 
@@ -279,9 +297,9 @@ class cmd_domain_backup_online(samba.netcmd.Command):
             set_admin_password(logger, samdb)
 
         # Add everything in the tmpdir to the backup tar file
-        backup_file = backup_filepath(targetdir, realm, time_str)
+        backup_file = backup_filepath(targetdir, realm, time_str, compression)
         create_log_file(tmpdir, lp, "online", server, include_secrets)
-        create_backup_tar(logger, tmpdir, backup_file)
+        create_backup_tar(logger, tmpdir, backup_file, compression)
 
         shutil.rmtree(tmpdir)
 
@@ -684,6 +702,7 @@ class cmd_domain_backup_rename(samba.netcmd.Command):
                choices=["tdb", "mdb"],
                help="Specify the database backend to be used "
                "(default is %s)" % get_default_backend_store()),
+        compression_option(),
     ]
 
     takes_args = ["new_domain_name", "new_dns_realm"]
@@ -782,7 +801,7 @@ class cmd_domain_backup_rename(samba.netcmd.Command):
 
     def run(self, new_domain_name, new_dns_realm, sambaopts=None,
             credopts=None, server=None, targetdir=None, keep_dns_realm=False,
-            no_secrets=False, backend_store=None):
+            no_secrets=False, backend_store=None, compression="bz2"):
         logger = self.get_logger()
         logger.setLevel(logging.INFO)
 
@@ -876,11 +895,12 @@ class cmd_domain_backup_rename(samba.netcmd.Command):
             set_admin_password(logger, samdb)
 
         # Add everything in the tmpdir to the backup tar file
-        backup_file = backup_filepath(targetdir, new_dns_realm, time_str)
+        backup_file = backup_filepath(targetdir, new_dns_realm, time_str,
+                                      compression)
         create_log_file(tmpdir, lp, "rename", server, include_secrets,
                         "Original domain %s (NetBIOS), %s (DNS realm)" %
                         (old_domain, old_realm))
-        create_backup_tar(logger, tmpdir, backup_file)
+        create_backup_tar(logger, tmpdir, backup_file, compression)
 
         shutil.rmtree(tmpdir)
 
@@ -908,6 +928,7 @@ class cmd_domain_backup_offline(samba.netcmd.Command):
         Option("--targetdir",
                help="Output directory (required)",
                type=str),
+        compression_option(),
     ]
 
     backup_ext = '.bak-offline'
@@ -998,7 +1019,7 @@ class cmd_domain_backup_offline(samba.netcmd.Command):
 
         return arc_path
 
-    def run(self, sambaopts=None, targetdir=None):
+    def run(self, sambaopts=None, targetdir=None, compression="bz2"):
 
         logger = logging.getLogger()
         logger.setLevel(logging.DEBUG)
@@ -1082,8 +1103,9 @@ class cmd_domain_backup_offline(samba.netcmd.Command):
         # backed up files and any other files to it.
         temp_tar_dir = tempfile.mkdtemp(dir=targetdir,
                                         prefix='INCOMPLETEsambabackupfile')
-        temp_tar_name = os.path.join(temp_tar_dir, "samba-backup.tar.bz2")
-        tar = tarfile.open(temp_tar_name, 'w:bz2')
+        mode, ext = backup_compression[compression]
+        temp_tar_name = os.path.join(temp_tar_dir, "samba-backup" + ext)
+        tar = tarfile.open(temp_tar_name, mode)
 
         logger.info('running offline ntacl backup of sysvol')
         sysvol_tar_fn = 'sysvol.tar.gz'
@@ -1115,7 +1137,7 @@ class cmd_domain_backup_offline(samba.netcmd.Command):
         tar.close()
         os.rename(temp_tar_name,
                   os.path.join(targetdir,
-                               'samba-backup-{0}.tar.bz2'.format(time_str)))
+                               'samba-backup-{0}{1}'.format(time_str, ext)))
         os.rmdir(temp_tar_dir)
         logger.info('Backup succeeded.')
 
@@ -167,6 +167,19 @@ class DomainBackupBase(BlackboxTestCase):
         lp = self.check_restored_smbconf()
         self.check_restored_database(lp)
 
+    def _test_backup_restore_compression(self, compression, suffix, mode):
+        """Does a backup/restore with the given --compression option"""
+        backup_file = self.create_backup(
+            extra_args=["--compression=" + compression], suffix=suffix)
+
+        # check the file really is compressed as expected
+        with tarfile.open(backup_file, mode) as tf:
+            self.assertIn("./backup.txt", tf.getnames())
+
+        self.restore_backup(backup_file)
+        lp = self.check_restored_smbconf()
+        self.check_restored_database(lp)
+
     def _test_backup_restore_no_secrets(self):
         """Does a backup/restore with secrets excluded from the resulting DB"""
 
@@ -385,7 +398,7 @@ class DomainBackupBase(BlackboxTestCase):
             self.fail("Error calling samba-tool: %s" % e)
         print(out)
 
-    def create_backup(self, extra_args=None):
+    def create_backup(self, extra_args=None, suffix=".tar.bz2"):
         """Runs the backup cmd to produce a backup file for the testenv DC"""
         # Run the backup command and check we got one backup tar file
         args = self.base_cmd + ["--targetdir=" + self.tempdir]
@@ -397,7 +410,7 @@ class DomainBackupBase(BlackboxTestCase):
         # find the filename of the backup-file generated
         tar_files = []
         for fn in os.listdir(self.tempdir):
-            if (fn.startswith("samba-backup-") and fn.endswith(".tar.bz2")):
+            if (fn.startswith("samba-backup-") and fn.endswith(suffix)):
                 tar_files.append(fn)
 
         self.assertTrue(len(tar_files) == 1,
@@ -453,6 +466,12 @@ class DomainBackupOnline(DomainBackupBase):
         self.use_backend("mdb")
         self._test_backup_restore_into_site()
 
+    def test_backup_restore_gz(self):
+        self._test_backup_restore_compression("gz", ".tar.gz", "r:gz")
+
+    def test_backup_restore_no_compression(self):
+        self._test_backup_restore_compression("none", ".tar", "r:")
+
 
 class DomainBackupRename(DomainBackupBase):
 
@@ -619,3 +638,9 @@ class DomainBackupOffline(DomainBackupBase):
 
     def test_backup_restore_into_site(self):
         self._test_backup_restore_into_site()
+
+    def test_backup_restore_gz(self):
+        self._test_backup_restore_compression("gz", ".tar.gz", "r:gz")
+
+    def test_backup_restore_no_compression(self):
+        self._test_backup_restore_compression("none", ".tar", "r:")
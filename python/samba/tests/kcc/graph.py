@@ -22,6 +22,7 @@
 import samba
 import samba.tests
 from samba.kcc.graph import total_schedule, convert_schedule_to_repltimes
+from samba.kcc.graph import ReplInfo, combine_repl_info
 
 def ntdsconn_schedule(times):
     if times is None:
@@ -65,3 +66,25 @@ class GraphFunctionTests(samba.tests.TestCase):
             schedule = ntdsconn_schedule(ntdsconn_times)
             self.assertEquals(convert_schedule_to_repltimes(schedule),
                               repltimes)
+
+    def test_combine_repl_info(self):
+        for a, b, expected in (
+                (None, None, [0xff] * 84),
+                (None, [0x81] * 84, [0x81] * 84),
+                ([0x03, 0x33] * 42, None, [0x03, 0x33] * 42),
+                ([0x0f] * 84, [0x3c] * 84, [0x0c] * 84)):
+            info_a = ReplInfo()
+            info_a.schedule = a
+            info_a.duration = total_schedule(a)
+            info_a.cost = 3
+            info_b = ReplInfo()
+            info_b.schedule = b
+            info_b.duration = total_schedule(b)
+            info_b.cost = 2 ** 32 - 2
+            info_c = combine_repl_info(info_a, info_b)
+            self.assertEquals(info_c.schedule, expected)
+            self.assertEquals(info_c.duration, total_schedule(expected))
+            self.assertEquals(info_c.cost, 2 ** 32 - 1)
+            # the inputs are left alone
+            self.assertEquals(info_a.schedule, a)
+            self.assertEquals(info_b.schedule, b)
@@ -824,6 +824,8 @@ sub provision_raw_step1($$)
 	samba kcc command = $ctx->{python} $ENV{SRCDIR_ABS}/source4/scripting/bin/samba_kcc
 	dreplsrv:periodic_startup_interval = 0
 	dsdb:schema update allowed = yes
+	# The tests check logonCount and lastLogon right after a logon
+	auth:logon accounting delay = 0
 
         vfs objects = dfs_samba4 acl_xattr fake_acls xattr_tdb streams_depot
 
@@ -36,6 +36,101 @@
 #include "auth/credentials/credentials.h"
 #include "lib/param/loadparm.h"
 #include "librpc/gen_ndr/dcerpc.h"
+#include "lib/util/memcache.h"
+#include "auth/auth_util.h"
+
+/*
+ * A client often presents the same ticket in several session setups of
+ * one connection (reauthentication, channel binding, multiple sessions
+ * of the same user). The PAC has been verified by the time we get here,
+ * so an identical PAC for the same principal from the same host maps to
+ * the same session info. Remember the result for a short while, this
+ * saves the winbind round-trips for the PAC, the user lookup and the
+ * token's SID to gid mapping.
+ */
+#define AUTH3_PAC_SESSION_INFO_CACHE_TIME 60
+
+struct auth3_pac_session_info_cache {
+	time_t expires;
+	char *username;
+	struct auth_session_info *session_info;
+};
+
+static DATA_BLOB auth3_pac_session_info_cache_key(TALLOC_CTX *mem_ctx,
+						  const DATA_BLOB *pac_blob,
+						  const char *princ_name,
+						  const char *rhost)
+{
+	size_t princ_len = strlen(princ_name) + 1;
+	size_t rhost_len = strlen(rhost) + 1;
+	DATA_BLOB key;
+
+	key = data_blob_talloc(mem_ctx, NULL,
+			       pac_blob->length + princ_len + rhost_len);
+	if (key.data == NULL) {
+		return data_blob_null;
+	}
+
+	memcpy(key.data, pac_blob->data, pac_blob->length);
+	memcpy(key.data + pac_blob->length, princ_name, princ_len);
+	memcpy(key.data + pac_blob->length + princ_len, rhost, rhost_len);
+
+	return key;
+}
+
+static const struct auth3_pac_session_info_cache *
+auth3_pac_session_info_cache_get(DATA_BLOB key)
+{
+	struct auth3_pac_session_info_cache *cache = NULL;
+
+	if (key.length == 0) {
+		return NULL;
+	}
+
+	cache = memcache_lookup_talloc(NULL,
+				       PAC_SESSION_INFO_CACHE_TALLOC,
+				       key);
+	if (cache == NULL) {
+		return NULL;
+	}
+
+	if (time(NULL) >= cache->expires) {
+		memcache_delete(NULL, PAC_SESSION_INFO_CACHE_TALLOC, key);
+		return NULL;
+	}
+
+	return cache;
+}
+
+static void auth3_pac_session_info_cache_set(
+	DATA_BLOB key,
+	const char *username,
+	const struct auth_session_info *session_info)
+{
+	struct auth3_pac_session_info_cache *cache = NULL;
+
+	if (key.length == 0) {
+		return;
+	}
+
+	cache = talloc_zero(NULL, struct auth3_pac_session_info_cache);
+	if (cache == NULL) {
+		return;
+	}
+
+	cache->expires = time(NULL) + AUTH3_PAC_SESSION_INFO_CACHE_TIME;
+	cache->username = talloc_strdup(cache, username);
+	cache->session_info = copy_session_info(cache, session_info);
+	if (cache->username == NULL || cache->session_info == NULL) {
+		TALLOC_FREE(cache);
+		return;
+	}
+
+	/* The caller fills in the session key */
+	data_blob_clear_free(&cache->session_info->session_key);
+
+	memcache_add_talloc(NULL, PAC_SESSION_INFO_CACHE_TALLOC, key, &cache);
+}
 
 static NTSTATUS auth3_generate_session_info_pac(struct auth4_context *auth_ctx,
 						TALLOC_CTX *mem_ctx,
@@ -47,6 +142,7 @@ static NTSTATUS auth3_generate_session_info_pac(struct auth4_context *auth_ctx,
 						struct auth_session_info **session_info)
 {
 	TALLOC_CTX *tmp_ctx;
+	DATA_BLOB cache_key = data_blob_null;
 	struct PAC_LOGON_INFO *logon_info = NULL;
 	struct netr_SamInfo3 *info3_copy = NULL;
 	bool is_mapped;
@@ -64,6 +160,53 @@ static NTSTATUS auth3_generate_session_info_pac(struct auth4_context *auth_ctx,
 		return NT_STATUS_NO_MEMORY;
 	}
 
+	rc = get_remote_hostname(remote_address,
+				 &rhost,
+				 tmp_ctx);
+	if (rc < 0) {
+		status = NT_STATUS_NO_MEMORY;
+		goto done;
+	}
+	if (strequal(rhost, "UNKNOWN")) {
+		rhost = tsocket_address_inet_addr_string(remote_address,
+							 tmp_ctx);
+		if (rhost == NULL) {
+			status = NT_STATUS_NO_MEMORY;
+			goto done;
+		}
+	}
+
+	if (pac_blob) {
+		const struct auth3_pac_session_info_cache *cache = NULL;
+
+		cache_key = auth3_pac_session_info_cache_key(tmp_ctx,
+							     pac_blob,
+							     princ_name,
+							     rhost);
+		cache = auth3_pac_session_info_cache_get(cache_key);
+		if (cache != NULL) {
+			struct auth_session_info *cached = NULL;
+
+			cached = copy_session_info(mem_ctx,
+						   cache->session_info);
+			if (cached == NULL) {
+				status = NT_STATUS_NO_MEMORY;
+				goto done;
+			}
+			cached->unique_session_token = GUID_random();
+
+			sub_set_smb_name(cache->username);
+			lp_load_with_shares(get_dyn_CONFIGFILE());
+
+			DBG_DEBUG("Using cached session info for %s "
+				  "client: %s\n", princ_name, rhost);
+
+			*session_info = cached;
+			status = NT_STATUS_OK;
+			goto done;
+		}
+	}
+
 	if (pac_blob) {
 #ifdef HAVE_KRB5
 		struct wbcAuthUserParams params = {};
@@ -121,22 +264,6 @@ static NTSTATUS auth3_generate_session_info_pac(struct auth4_context *auth_ctx,
 		}
 	}
 
-	rc = get_remote_hostname(remote_address,
-				 &rhost,
-				 tmp_ctx);
-	if (rc < 0) {
-		status = NT_STATUS_NO_MEMORY;
-		goto done;
-	}
-	if (strequal(rhost, "UNKNOWN")) {
-		rhost = tsocket_address_inet_addr_string(remote_address,
-							 tmp_ctx);
-		if (rhost == NULL) {
-			status = NT_STATUS_NO_MEMORY;
-			goto done;
-		}
-	}
-
 	status = get_user_from_kerberos_info(tmp_ctx, rhost,
 					     princ_name, logon_info,
 					     &is_mapped, &is_guest,
@@ -176,6 +303,11 @@ static NTSTATUS auth3_generate_session_info_pac(struct auth4_context *auth_ctx,
 		goto done;
 	}
 
+	if (!is_guest) {
+		auth3_pac_session_info_cache_set(cache_key, username,
+						 *session_info);
+	}
+
 	DEBUG(5, (__location__ "OK: user: %s domain: %s client: %s\n",
 		  ntuser, ntdomain, rhost));
 
@@ -0,0 +1,122 @@
+/*
+   Unix SMB/CIFS implementation.
+   Live smbd statistics in per process shared memory segments
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _LIVE_STATS_H_
+#define _LIVE_STATS_H_
+
+#include "replace.h"
+#include "system/threads.h"
+
+/*
+ * Every smbd child process with "smbd live statistics = yes" maps
+ * the file live_stats/<pid> in the lock directory and keeps the
+ * following structure in it up to date. Readers mmap the files
+ * read only, they never take a lock and never wait for smbd.
+ *
+ * The only writer is the main thread of the smbd process owning
+ * the segment. It makes seqnum odd while it changes the values
+ * and even again afterwards, readers retry until they saw the
+ * same even seqnum before and after copying the values, see
+ * live_stats_read().
+ */
+
+#define LIVE_STATS_MAGIC 0x5354534c41424d53ULL /* "SMBALSTS" */
+#define LIVE_STATS_VERSION 2
+
+struct live_stats_values {
+	uint64_t connections;		/* client transport connections */
+	uint64_t open_files;		/* files_struct's in use */
+	uint64_t requests_inflight;	/* SMB2 requests not yet sent */
+	uint64_t send_queue_len;	/* SMB2 pdus waiting for the socket */
+	uint64_t requests_total;	/* SMB2 requests received */
+	uint64_t bytes_received;	/* bytes read from client sockets */
+	uint64_t bytes_sent;		/* bytes written to client sockets */
+	uint64_t client_bytes;		/* talloc memory of the smbXsrv_client */
+	uint64_t connection_bytes;	/* talloc memory of its connections */
+};
+
+struct live_stats_segment {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t pid;
+	uint64_t seqnum;
+	struct live_stats_values values;
+};
+
+#ifdef HAVE_ATOMIC_THREAD_FENCE_SUPPORT
+
+extern struct live_stats_segment *live_stats_segment;
+
+static inline void live_stats_write_begin(struct live_stats_segment *seg)
+{
+	seg->seqnum += 1;
+	atomic_thread_fence(memory_order_seq_cst);
+}
+
+static inline void live_stats_write_end(struct live_stats_segment *seg)
+{
+	atomic_thread_fence(memory_order_seq_cst);
+	seg->seqnum += 1;
+}
+
+#define LIVE_STATS_ADD(_field, _v) do { \
+	struct live_stats_segment *_seg = live_stats_segment; \
+	if (unlikely(_seg != NULL)) { \
+		live_stats_write_begin(_seg); \
+		_seg->values._field += (_v); \
+		live_stats_write_end(_seg); \
+	} \
+} while(0)
+
+#define LIVE_STATS_SUB(_field, _v) do { \
+	struct live_stats_segment *_seg = live_stats_segment; \
+	if (unlikely(_seg != NULL)) { \
+		live_stats_write_begin(_seg); \
+		_seg->values._field -= (_v); \
+		live_stats_write_end(_seg); \
+	} \
+} while(0)
+
+#define LIVE_STATS_SET(_field, _v) do { \
+	struct live_stats_segment *_seg = live_stats_segment; \
+	if (unlikely(_seg != NULL)) { \
+		live_stats_write_begin(_seg); \
+		_seg->values._field = (_v); \
+		live_stats_write_end(_seg); \
+	} \
+} while(0)
+
+#else /* HAVE_ATOMIC_THREAD_FENCE_SUPPORT */
+
+#define LIVE_STATS_ADD(_field, _v)
+#define LIVE_STATS_SUB(_field, _v)
+#define LIVE_STATS_SET(_field, _v)
+
+#endif /* HAVE_ATOMIC_THREAD_FENCE_SUPPORT */
+
+bool live_stats_setup(void);
+void live_stats_cleanup(pid_t pid);
+
+bool live_stats_read(const struct live_stats_segment *seg,
+		     struct live_stats_values *values);
+int live_stats_traverse(int (*fn)(pid_t pid,
+				  const struct live_stats_values *values,
+				  void *private_data),
+			void *private_data);
+
+#endif /* _LIVE_STATS_H_ */
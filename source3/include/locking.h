@@ -81,6 +81,7 @@ struct blocking_lock_record {
 	enum brl_type lock_type;
 	struct smb_request *req;
 	void *blr_private; /* Implementation specific. */
+	struct tevent_req *watch_req; /* Waits for brlock.tdb changes. */
 };
 
 struct smbd_lock_element {
@@ -815,6 +815,9 @@ bool lp_loaded(void);
 void lp_killunused(struct smbd_server_connection *sconn,
 		   bool (*snumused) (struct smbd_server_connection *, int));
 void lp_kill_all_services(void);
+bool lp_reload_with_shares(const char *file_name,
+			   struct smbd_server_connection *sconn,
+			   bool (*snumused) (struct smbd_server_connection *, int));
 void lp_killservice(int iServiceIn);
 const char* server_role_str(uint32_t role);
 enum usershare_err parse_usershare_file(TALLOC_CTX *ctx,
@@ -35,6 +35,8 @@ struct tevent_context;
 	SMBPROFILE_STATS_TIME(cpu_user) \
 	SMBPROFILE_STATS_TIME(cpu_system) \
 	SMBPROFILE_STATS_COUNT(request) \
+	SMBPROFILE_STATS_COUNT(smb2_credits_grow) \
+	SMBPROFILE_STATS_COUNT(smb2_credits_shrink) \
 	SMBPROFILE_STATS_BASIC(push_sec_ctx) \
 	SMBPROFILE_STATS_BASIC(set_sec_ctx) \
 	SMBPROFILE_STATS_BASIC(set_root_sec_ctx) \
@@ -306,12 +308,38 @@ struct smbprofile_stats_bytes_async {
 	struct smbprofile_stats_bytes *stats;
 };
 
+/*
+ * log2 bucketed latencies in microseconds: bucket 0 counts
+ * events that took less than 2 usec, bucket i events that
+ * took [2^i, 2^(i+1)) usec and the last bucket everything
+ * taking 2^(SMBPROFILE_STATS_HISTOGRAM_BUCKETS-1) usec or more.
+ */
+#define SMBPROFILE_STATS_HISTOGRAM_BUCKETS 24
+
+struct smbprofile_stats_histogram {
+	uint64_t buckets[SMBPROFILE_STATS_HISTOGRAM_BUCKETS];
+};
+
+static inline void smbprofile_histogram_add(
+	struct smbprofile_stats_histogram *h, uint64_t usec)
+{
+	size_t b = 0;
+
+	while ((usec > 1) && (b < SMBPROFILE_STATS_HISTOGRAM_BUCKETS - 1)) {
+		usec >>= 1;
+		b += 1;
+	}
+
+	h->buckets[b] += 1;
+}
+
 struct smbprofile_stats_iobytes {
 	uint64_t count;		/* number of events */
 	uint64_t time;		/* microseconds */
 	uint64_t idle;		/* idle time compared to 'time' microseconds */
 	uint64_t inbytes;	/* bytes read */
 	uint64_t outbytes;	/* bytes written */
+	struct smbprofile_stats_histogram latency; /* including idle time */
 };
 
 struct smbprofile_stats_iobytes_async {
@@ -319,6 +347,25 @@ struct smbprofile_stats_iobytes_async {
 	uint64_t idle_start;
 	uint64_t idle_time;
 	struct smbprofile_stats_iobytes *stats;
+	struct smbprofile_stats_histogram *share_latency;
+};
+
+/*
+ * The per share latencies are stored in the profile tdb
+ * under SMBPROFILE_SHARE_KEY_PREFIX + share name,
+ * accumulated over all processes.
+ */
+#define SMBPROFILE_SHARE_KEY_PREFIX "SHARE/"
+
+/*
+ * Same for the VFS operation latencies recorded
+ * by vfs_time_audit, keyed by operation name.
+ */
+#define SMBPROFILE_VFS_KEY_PREFIX "VFS/"
+
+struct smbprofile_share_stats {
+	uint64_t magic;
+	struct smbprofile_stats_histogram latency;
 };
 
 struct profile_stats {
@@ -457,8 +504,20 @@ struct profile_stats {
 
 #define SMBPROFILE_IOBYTES_ASYNC_STATE(_async_name) \
 	struct smbprofile_stats_iobytes_async _async_name;
+/*
+ * SMBPROFILE_IOBYTES_ASYNC_SET_SHARE() has to be called before
+ * SMBPROFILE_IOBYTES_ASYNC_START(), which keeps the share.
+ */
+#define SMBPROFILE_IOBYTES_ASYNC_SET_SHARE(_async, _share) do { \
+	(_async).share_latency = NULL; \
+	if (smbprofile_state.config.do_times && (_share) != NULL) { \
+		(_async).share_latency = smbprofile_share_latency(_share); \
+	} \
+} while(0)
 #define _SMBPROFILE_IOBYTES_ASYNC_START(_stats, _area, _async, _inbytes) do { \
-	(_async) = (struct smbprofile_stats_iobytes_async) {}; \
+	(_async) = (struct smbprofile_stats_iobytes_async) { \
+		.share_latency = (_async).share_latency, \
+	}; \
 	if (smbprofile_state.config.do_count) { \
 		_SMBPROFILE_TIMER_ASYNC_START(_stats, _area, _async); \
 		(_area)->values._stats.count += 1; \
@@ -475,6 +534,15 @@ struct profile_stats {
 #define SMBPROFILE_IOBYTES_ASYNC_END(_async, _outbytes) do { \
 	if ((_async).stats != NULL) { \
 		(_async).stats->outbytes += (_outbytes); \
+		if ((_async).start != 0) { \
+			uint64_t _latency = profile_timestamp() - (_async).start; \
+			smbprofile_histogram_add(&(_async).stats->latency, \
+						 _latency); \
+			if ((_async).share_latency != NULL) { \
+				smbprofile_histogram_add( \
+					(_async).share_latency, _latency); \
+			} \
+		} \
 		_SMBPROFILE_TIMER_ASYNC_END(_async); \
 		(_async) = (struct smbprofile_stats_iobytes_async) {}; \
 		smbprofile_dump_schedule(); \
@@ -483,11 +551,14 @@ struct profile_stats {
 
 extern struct profile_stats *profile_p;
 
+struct smbprofile_share;
+
 struct smbprofile_global_state {
 	struct {
 		struct tdb_wrap *db;
 		struct tevent_context *ev;
 		struct tevent_timer *te;
+		struct smbprofile_share *shares;
 	} internal;
 
 	struct {
@@ -534,6 +605,21 @@ void smbprofile_stats_accumulate(struct profile_stats *acc,
 				 const struct profile_stats *add);
 void smbprofile_collect(struct profile_stats *stats);
 
+struct smbprofile_stats_histogram *smbprofile_share_latency(const char *share);
+struct smbprofile_stats_histogram *smbprofile_vfs_latency(const char *op);
+void smbprofile_histogram_accumulate(struct smbprofile_stats_histogram *acc,
+				     const struct smbprofile_stats_histogram *add);
+void smbprofile_collect_shares(
+	void (*fn)(const char *share,
+		   const struct smbprofile_stats_histogram *latency,
+		   void *private_data),
+	void *private_data);
+void smbprofile_collect_vfs(
+	void (*fn)(const char *op,
+		   const struct smbprofile_stats_histogram *latency,
+		   void *private_data),
+	void *private_data);
+
 static inline uint64_t profile_timestamp(void)
 {
 	struct timespec ts;
@@ -582,6 +668,7 @@ static inline uint64_t profile_timestamp(void)
 #define SMBPROFILE_BYTES_ASYNC_END(_async)
 
 #define SMBPROFILE_IOBYTES_ASYNC_STATE(_async_name)
+#define SMBPROFILE_IOBYTES_ASYNC_SET_SHARE(_async, _share)
 #define SMBPROFILE_IOBYTES_ASYNC_START(_name, _area, _async, _inbytes)
 #define SMBPROFILE_IOBYTES_ASYNC_SET_IDLE(_async)
 #define SMBPROFILE_IOBYTES_ASYNC_SET_BUSY(_async)
@@ -259,8 +259,12 @@
 /* Bump to version 40, Samba 4.10 will ship with that */
 /* Version 40 - Add SMB_VFS_GETXATTRAT_SEND/RECV */
 /* Version 40 - Add SMB_VFS_GET_DOS_ATTRIBUTES_SEND/RECV */
+/* Version 41 - Add file_id_entry to files_struct, fsp->file_id must
+		be changed with fsp_set_file_id() */
+/* Version 41 - Add qinfo_cache to files_struct */
+/* Version 41 - Add SMB_VFS_READDIRPLUS() */
 
-#define SMB_VFS_INTERFACE_VERSION 40
+#define SMB_VFS_INTERFACE_VERSION 41
 
 /*
     All intercepted VFS operations must be declared as static functions inside module source
@@ -317,7 +321,8 @@ typedef struct files_struct {
 	struct connection_struct *conn;
 	struct fd_handle *fh;
 	unsigned int num_smb_operations;
-	struct file_id file_id;
+	struct file_id file_id; /* change with fsp_set_file_id() */
+	struct fsp_file_id_entry *file_id_entry;
 	uint64_t initial_allocation_size; /* Faked up initial allocation on disk. */
 	uint16_t file_pid;
 	uint64_t vuid; /* SMB2 compat */
@@ -389,6 +394,12 @@ typedef struct files_struct {
 	 * possibly the simplest approach. Thanks, Jeremy for the idea.
 	 */
 	struct tevent_req *deferred_close;
+
+	/*
+	 * Cached QUERY_INFO parts, only valid while the handle has read
+	 * caching granted. Thrown away when the oplock or lease breaks.
+	 */
+	struct fsp_qinfo_cache *qinfo_cache;
 } files_struct;
 
 #define FSP_POSIX_FLAGS_OPEN		0x01
@@ -607,6 +618,25 @@ struct vfs_aio_state {
 	uint64_t duration;
 };
 
+/*
+ * A directory entry returned by SMB_VFS_READDIRPLUS(), with what the
+ * backend got together with the name. st follows the rules of the
+ * SMB_VFS_READDIR() stat buffer: It's only VALID_STAT() if it is what
+ * SMB_VFS_STAT() would return. dosmode is what
+ * SMB_VFS_GET_DOS_ATTRIBUTES() would return, with the create time it
+ * would set already in st. file_id is what SMB_VFS_FILE_ID_CREATE()
+ * would return for st.
+ */
+struct vfs_readdirplus_entry {
+	char *name;
+	long offset;		/* SMB_VFS_TELLDIR() after this entry */
+	SMB_STRUCT_STAT st;
+	bool have_dosmode;
+	uint32_t dosmode;
+	bool have_file_id;
+	struct file_id file_id;
+};
+
 /*
     Available VFS operations. These values must be in sync with vfs_ops struct
     (struct vfs_fn_pointers and struct vfs_handle_pointers inside of struct vfs_ops).
@@ -654,6 +684,12 @@ struct vfs_fn_pointers {
 	struct dirent *(*readdir_fn)(struct vfs_handle_struct *handle,
 					 DIR *dirp,
 					 SMB_STRUCT_STAT *sbuf);
+	NTSTATUS (*readdirplus_fn)(struct vfs_handle_struct *handle,
+				   DIR *dirp,
+				   TALLOC_CTX *mem_ctx,
+				   size_t max_entries,
+				   struct vfs_readdirplus_entry **pentries,
+				   size_t *pnum_entries);
 	void (*seekdir_fn)(struct vfs_handle_struct *handle, DIR *dirp, long offset);
 	long (*telldir_fn)(struct vfs_handle_struct *handle, DIR *dirp);
 	void (*rewind_dir_fn)(struct vfs_handle_struct *handle, DIR *dirp);
@@ -1154,6 +1190,12 @@ DIR *smb_vfs_call_fdopendir(struct vfs_handle_struct *handle,
 struct dirent *smb_vfs_call_readdir(struct vfs_handle_struct *handle,
 					DIR *dirp,
 					SMB_STRUCT_STAT *sbuf);
+NTSTATUS smb_vfs_call_readdirplus(struct vfs_handle_struct *handle,
+				  DIR *dirp,
+				  TALLOC_CTX *mem_ctx,
+				  size_t max_entries,
+				  struct vfs_readdirplus_entry **pentries,
+				  size_t *pnum_entries);
 void smb_vfs_call_seekdir(struct vfs_handle_struct *handle,
 			  DIR *dirp, long offset);
 long smb_vfs_call_telldir(struct vfs_handle_struct *handle,
@@ -1599,6 +1641,12 @@ DIR *vfs_not_implemented_fdopendir(vfs_handle_struct *handle, files_struct *fsp,
 				   const char *mask, uint32_t attr);
 struct dirent *vfs_not_implemented_readdir(vfs_handle_struct *handle,
 					   DIR *dirp, SMB_STRUCT_STAT *sbuf);
+NTSTATUS vfs_not_implemented_readdirplus(vfs_handle_struct *handle,
+					 DIR *dirp,
+					 TALLOC_CTX *mem_ctx,
+					 size_t max_entries,
+					 struct vfs_readdirplus_entry **pentries,
+					 size_t *pnum_entries);
 void vfs_not_implemented_seekdir(vfs_handle_struct *handle, DIR *dirp, long offset);
 long vfs_not_implemented_telldir(vfs_handle_struct *handle, DIR *dirp);
 void vfs_not_implemented_rewind_dir(vfs_handle_struct *handle, DIR *dirp);
@@ -94,6 +94,11 @@
 #define SMB_VFS_NEXT_READDIR(handle, dirp, sbuf) \
 	smb_vfs_call_readdir((handle)->next, (dirp), (sbuf))
 
+#define SMB_VFS_READDIRPLUS(conn, dirp, mem_ctx, max_entries, pentries, pnum_entries) \
+	smb_vfs_call_readdirplus((conn)->vfs_handles, (dirp), (mem_ctx), (max_entries), (pentries), (pnum_entries))
+#define SMB_VFS_NEXT_READDIRPLUS(handle, dirp, mem_ctx, max_entries, pentries, pnum_entries) \
+	smb_vfs_call_readdirplus((handle)->next, (dirp), (mem_ctx), (max_entries), (pentries), (pnum_entries))
+
 #define SMB_VFS_SEEKDIR(conn, dirp, offset) \
 	smb_vfs_call_seekdir((conn)->vfs_handles, (dirp), (offset))
 #define SMB_VFS_NEXT_SEEKDIR(handle, dirp, offset) \
@@ -24,6 +24,7 @@
 #include "dbwrap/dbwrap_open.h"
 #include "dbwrap/dbwrap_tdb.h"
 #include "dbwrap/dbwrap_ctdb.h"
+#include "dbwrap/dbwrap_shm.h"
 #include "lib/param/param.h"
 #include "lib/cluster_support.h"
 #include "lib/messages_ctdb.h"
@@ -126,6 +127,51 @@ struct db_context *db_open(TALLOC_CTX *mem_ctx,
 		}
 	}
 
+	if (tdb_flags & TDB_CLEAR_IF_FIRST) {
+		bool auto_hash = true;
+
+		auto_hash = lp_parm_bool(-1, "dbwrap_tdb_auto_hash_size",
+					 "*", auto_hash);
+		auto_hash = lp_parm_bool(-1, "dbwrap_tdb_auto_hash_size",
+					 base, auto_hash);
+
+		if (auto_hash) {
+			tdb_flags |= TDB_AUTO_HASH_SIZE;
+		}
+	}
+
+	if (tdb_flags & TDB_CLEAR_IF_FIRST) {
+		bool freelist_bins = true;
+
+		freelist_bins = lp_parm_bool(-1, "dbwrap_tdb_freelist_bins",
+					     "*", freelist_bins);
+		freelist_bins = lp_parm_bool(-1, "dbwrap_tdb_freelist_bins",
+					     base, freelist_bins);
+
+		if (freelist_bins) {
+			tdb_flags |= TDB_FREELIST_BINS;
+		}
+	}
+
+	if ((tdb_flags & TDB_CLEAR_IF_FIRST) == 0) {
+		bool recovery_checksum = false;
+
+		/*
+		 * Only affects newly created files, which older
+		 * Samba versions can't open anymore.
+		 */
+		recovery_checksum = lp_parm_bool(
+			-1, "dbwrap_tdb_recovery_checksum", "*",
+			recovery_checksum);
+		recovery_checksum = lp_parm_bool(
+			-1, "dbwrap_tdb_recovery_checksum", base,
+			recovery_checksum);
+
+		if (recovery_checksum) {
+			tdb_flags |= TDB_RECOVERY_CHECKSUM;
+		}
+	}
+
 	if (lp_clustering()) {
 		const char *sockname;
 
@@ -165,6 +211,45 @@ struct db_context *db_open(TALLOC_CTX *mem_ctx,
 		}
 	}
 
+	if (tdb_flags & TDB_CLEAR_IF_FIRST) {
+		bool try_shm = false;
+
+		try_shm = lp_parm_bool(-1, "dbwrap_shm", "*", try_shm);
+		try_shm = lp_parm_bool(-1, "dbwrap_shm", base, try_shm);
+
+		if (try_shm) {
+			uint32_t num_buckets, num_readers;
+			uint64_t heap_size;
+			char *shm_name;
+
+			num_buckets = lp_parm_ulong(
+				-1, "dbwrap_shm_buckets", base, 65536);
+			num_readers = lp_parm_ulong(
+				-1, "dbwrap_shm_readers", base, 16384);
+			heap_size = lp_parm_ulonglong(
+				-1, "dbwrap_shm_heap_size", base,
+				64 * 1024 * 1024);
+
+			/*
+			 * Don't clobber a tdb file still in use by
+			 * processes that run without dbwrap_shm
+			 */
+			shm_name = talloc_asprintf(talloc_tos(), "%s.shm",
+						   name);
+			if (shm_name == NULL) {
+				errno = ENOMEM;
+				return NULL;
+			}
+
+			result = db_open_shm(mem_ctx, shm_name, num_buckets,
+					     num_readers, heap_size,
+					     open_flags, mode, lock_order,
+					     dbwrap_flags);
+			TALLOC_FREE(shm_name);
+			return result;
+		}
+	}
+
 	lp_ctx = loadparm_init_s3(mem_ctx, loadparm_s3_helpers());
 
 	if (hash_size == 0) {
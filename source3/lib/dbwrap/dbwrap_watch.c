@@ -103,11 +103,18 @@ static bool dbwrap_record_watchers_key_parse(
  * If this header is absent then this is a
  * fresh record of length zero (no watchers).
  *
+ * Watches are one-shot: A modification of the
+ * record alerts all watchers and removes them from
+ * the watcher array in the same store. This way
+ * every watcher gets exactly one message, no matter
+ * how many modifications happen before it gets
+ * around to looking at the record again, and the
+ * watcher does not have to lock the record just to
+ * remove itself.
+ *
  * Note that a record can be deleted with
- * watchers present. If so the deleted bit
- * is set and the watcher server_id's are
- * woken to allow them to remove themselves
- * from the watcher array. The record is left
+ * watchers present that could not be alerted. If
+ * so the deleted bit is set. The record is left
  * present marked with the deleted bit until all
  * watchers are removed, then the record itself
  * is deleted.
@@ -387,7 +394,13 @@ static void dbwrap_watched_wakeup(struct db_record *rec,
 				  server_id_str_buf(watcher, &tmp),
 				  nt_errstr(status));
 		}
-		if (NT_STATUS_EQUAL(status, NT_STATUS_OBJECT_NAME_NOT_FOUND)) {
+		if (NT_STATUS_IS_OK(status) ||
+		    NT_STATUS_EQUAL(status, NT_STATUS_OBJECT_NAME_NOT_FOUND)) {
+			/*
+			 * Alerted or dead, either way this watch is
+			 * done. Don't alert it again on subsequent
+			 * modifications.
+			 */
 			dbwrap_watch_rec_del_watcher(wrec, i);
 			continue;
 		}
@@ -563,6 +576,34 @@ static int dbwrap_watched_traverse_read(struct db_context *db,
 	return ret;
 }
 
+static uint32_t dbwrap_watched_traverse_num_chunks(struct db_context *db)
+{
+	struct db_watched_ctx *ctx = talloc_get_type_abort(
+		db->private_data, struct db_watched_ctx);
+	return dbwrap_traverse_num_chunks(ctx->backend);
+}
+
+static int dbwrap_watched_traverse_read_chunk(
+	struct db_context *db, uint32_t *chunk, uint32_t num_chunks,
+	int (*fn)(struct db_record *rec, void *private_data),
+	void *private_data)
+{
+	struct db_watched_ctx *ctx = talloc_get_type_abort(
+		db->private_data, struct db_watched_ctx);
+	struct dbwrap_watched_traverse_state state = {
+		.fn = fn, .private_data = private_data };
+	NTSTATUS status;
+	int ret;
+
+	status = dbwrap_traverse_read_chunk(
+		ctx->backend, chunk, num_chunks,
+		dbwrap_watched_traverse_fn, &state, &ret);
+	if (!NT_STATUS_IS_OK(status)) {
+		return -1;
+	}
+	return ret;
+}
+
 static int dbwrap_watched_get_seqnum(struct db_context *db)
 {
 	struct db_watched_ctx *ctx = talloc_get_type_abort(
@@ -765,6 +806,8 @@ struct db_context *db_open_watched(TALLOC_CTX *mem_ctx,
 	db->do_locked = dbwrap_watched_do_locked;
 	db->traverse = dbwrap_watched_traverse;
 	db->traverse_read = dbwrap_watched_traverse_read;
+	db->traverse_num_chunks = dbwrap_watched_traverse_num_chunks;
+	db->traverse_read_chunk = dbwrap_watched_traverse_read_chunk;
 	db->get_seqnum = dbwrap_watched_get_seqnum;
 	db->transaction_start = dbwrap_watched_transaction_start;
 	db->transaction_commit = dbwrap_watched_transaction_commit;
@@ -785,6 +828,7 @@ struct dbwrap_watched_watch_state {
 	TDB_DATA w_key;
 	struct server_id blocker;
 	bool blockerdead;
+	bool alerted;
 };
 
 static bool dbwrap_watched_msg_filter(struct messaging_rec *rec,
@@ -917,8 +961,8 @@ static bool dbwrap_watched_remove_waiter(struct dbwrap_watch_rec *wrec,
 
 	if (i == wrec->num_watchers) {
 		struct server_id_buf buf;
-		DBG_WARNING("Did not find %s in state->watchers\n",
-			    server_id_str_buf(id, &buf));
+		DBG_DEBUG("Did not find %s in state->watchers\n",
+			  server_id_str_buf(id, &buf));
 		return false;
 	}
 
@@ -934,6 +978,14 @@ static int dbwrap_watched_watch_state_destructor(
 	TDB_DATA key;
 	bool ok;
 
+	if (state->alerted) {
+		/*
+		 * The modifier already removed us from the
+		 * watchers array when alerting us.
+		 */
+		return 0;
+	}
+
 	ok = dbwrap_record_watchers_key_parse(state->w_key, NULL, NULL, &key);
 	if (!ok) {
 		DBG_WARNING("dbwrap_record_watchers_key_parse failed\n");
@@ -990,6 +1042,8 @@ static void dbwrap_watched_watch_done(struct tevent_req *subreq)
 {
 	struct tevent_req *req = tevent_req_callback_data(
 		subreq, struct tevent_req);
+	struct dbwrap_watched_watch_state *state = tevent_req_data(
+		req, struct dbwrap_watched_watch_state);
 	struct messaging_rec *rec;
 	int ret;
 
@@ -999,6 +1053,7 @@ static void dbwrap_watched_watch_done(struct tevent_req *subreq)
 		tevent_req_nterror(req, map_nt_error_from_unix(ret));
 		return;
 	}
+	state->alerted = true;
 	tevent_req_done(req);
 }
 
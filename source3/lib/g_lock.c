@@ -28,6 +28,7 @@
 #include "../lib/util/tevent_ntstatus.h"
 #include "messages.h"
 #include "serverid.h"
+#include "server_id_watch.h"
 
 struct g_lock_ctx {
 	struct db_context *db;
@@ -38,21 +39,34 @@ struct g_lock_ctx {
  * The "g_lock.tdb" file contains records, indexed by the 0-terminated
  * lockname. The record contains an array of "struct g_lock_rec"
  * structures.
+ *
+ * Processes waiting for a lock are queued in the same array, in
+ * arrival order, with G_LOCK_WAITING set in the lock type byte. An
+ * unlock directly wakes the head of the queue (or the leading run of
+ * readers) with MSG_DBWRAP_G_LOCK_RETRY instead of every waiter
+ * retrying on each change to the record. New lockers don't overtake
+ * conflicting waiters, so lock grants are FIFO.
  */
 
 #define G_LOCK_REC_LENGTH (SERVER_ID_BUF_LENGTH+1)
+#define G_LOCK_WAITING 0x80
 
 static void g_lock_rec_put(uint8_t buf[G_LOCK_REC_LENGTH],
-			   const struct g_lock_rec rec)
+			   const struct g_lock_rec rec,
+			   bool waiting)
 {
-	SCVAL(buf, 0, rec.lock_type);
+	SCVAL(buf, 0, rec.lock_type | (waiting ? G_LOCK_WAITING : 0));
 	server_id_put(buf+1, rec.pid);
 }
 
 static void g_lock_rec_get(struct g_lock_rec *rec,
+			   bool *waiting,
 			   const uint8_t buf[G_LOCK_REC_LENGTH])
 {
-	rec->lock_type = CVAL(buf, 0);
+	uint8_t type = CVAL(buf, 0);
+
+	rec->lock_type = type & ~G_LOCK_WAITING;
+	*waiting = ((type & G_LOCK_WAITING) != 0);
 	server_id_get(&rec->pid, buf+1);
 }
 
@@ -90,13 +104,19 @@ static bool g_lock_parse(uint8_t *buf, size_t buflen, struct g_lock *lck)
 	return true;
 }
 
-static void g_lock_get_rec(struct g_lock *lck, size_t i,
+/*
+ * Returns true if entry i is a queued waiter, not a lock holder
+ */
+static bool g_lock_get_rec(struct g_lock *lck, size_t i,
 			   struct g_lock_rec *rec)
 {
+	bool waiting;
+
 	if (i >= lck->num_recs) {
 		abort();
 	}
-	g_lock_rec_get(rec, lck->recsbuf + i*G_LOCK_REC_LENGTH);
+	g_lock_rec_get(rec, &waiting, lck->recsbuf + i*G_LOCK_REC_LENGTH);
+	return waiting;
 }
 
 static void g_lock_rec_del(struct g_lock *lck, size_t i)
@@ -106,28 +126,34 @@ static void g_lock_rec_del(struct g_lock *lck, size_t i)
 	}
 	lck->num_recs -= 1;
 	if (i < lck->num_recs) {
+		/*
+		 * Keep the order, it's the waiter queue order
+		 */
 		uint8_t *recptr = lck->recsbuf + i*G_LOCK_REC_LENGTH;
-		memcpy(recptr, lck->recsbuf + lck->num_recs*G_LOCK_REC_LENGTH,
-		       G_LOCK_REC_LENGTH);
+		memmove(recptr, recptr + G_LOCK_REC_LENGTH,
+			(lck->num_recs - i) * G_LOCK_REC_LENGTH);
 	}
 }
 
 static NTSTATUS g_lock_store(struct db_record *rec, struct g_lock *lck,
-			     struct g_lock_rec *add)
+			     struct g_lock_rec *add,
+			     struct g_lock_rec *add_waiter)
 {
 	uint8_t sizebuf[4];
 	uint8_t addbuf[G_LOCK_REC_LENGTH];
+	uint8_t waiterbuf[G_LOCK_REC_LENGTH];
 
 	struct TDB_DATA dbufs[] = {
 		{ .dptr = sizebuf, .dsize = sizeof(sizebuf) },
 		{ .dptr = lck->recsbuf,
 		  .dsize = lck->num_recs * G_LOCK_REC_LENGTH },
 		{ 0 },
+		{ 0 },
 		{ .dptr = lck->data, .dsize = lck->datalen }
 	};
 
 	if (add != NULL) {
-		g_lock_rec_put(addbuf, *add);
+		g_lock_rec_put(addbuf, *add, false);
 
 		dbufs[2] = (TDB_DATA) {
 			.dptr = addbuf, .dsize = G_LOCK_REC_LENGTH
@@ -136,6 +162,16 @@ static NTSTATUS g_lock_store(struct db_record *rec, struct g_lock *lck,
 		lck->num_recs += 1;
 	}
 
+	if (add_waiter != NULL) {
+		g_lock_rec_put(waiterbuf, *add_waiter, true);
+
+		dbufs[3] = (TDB_DATA) {
+			.dptr = waiterbuf, .dsize = G_LOCK_REC_LENGTH
+		};
+
+		lck->num_recs += 1;
+	}
+
 	SIVAL(sizebuf, 0, lck->num_recs);
 
 	return dbwrap_record_storev(rec, dbufs, ARRAY_SIZE(dbufs), 0);
@@ -193,16 +229,110 @@ static bool g_lock_conflicts(enum g_lock_type l1, enum g_lock_type l2)
 	return true;
 }
 
+static bool g_lock_pid_exists(struct server_id pid)
+{
+	/*
+	 * As the serverid_exists might recurse into the g_lock code,
+	 * we use SERVERID_UNIQUE_ID_NOT_TO_VERIFY to avoid the loop
+	 */
+	pid.unique_id = SERVERID_UNIQUE_ID_NOT_TO_VERIFY;
+	return serverid_exists(&pid);
+}
+
+/*
+ * Tell the waiters at the head of the queue that they can retry:
+ * The first waiter and if that is a reader all readers directly
+ * behind it, as long as they don't conflict with a remaining
+ * holder. Waiters that died are removed from the queue, returns
+ * true if that happened.
+ */
+static bool g_lock_wake_waiters(struct g_lock_ctx *ctx, TDB_DATA key,
+				struct g_lock *lck)
+{
+	bool have_write_holder = false;
+	bool have_holder = false;
+	bool modified = false;
+	size_t i;
+
+	for (i=0; i<lck->num_recs; i++) {
+		struct g_lock_rec lock;
+		bool waiting;
+
+		waiting = g_lock_get_rec(lck, i, &lock);
+		if (waiting) {
+			continue;
+		}
+		have_holder = true;
+		if (lock.lock_type == G_LOCK_WRITE) {
+			have_write_holder = true;
+		}
+	}
+
+	if (have_write_holder) {
+		return false;
+	}
+
+	i = 0;
+
+	while (i < lck->num_recs) {
+		struct g_lock_rec lock;
+		bool waiting;
+		NTSTATUS status;
+
+		waiting = g_lock_get_rec(lck, i, &lock);
+		if (!waiting) {
+			i++;
+			continue;
+		}
+
+		if ((lock.lock_type == G_LOCK_WRITE) && have_holder) {
+			break;
+		}
+
+		if (!g_lock_pid_exists(lock.pid)) {
+			g_lock_rec_del(lck, i);
+			modified = true;
+			continue;
+		}
+
+		status = messaging_send_buf(ctx->msg, lock.pid,
+					    MSG_DBWRAP_G_LOCK_RETRY,
+					    key.dptr, key.dsize);
+		if (!NT_STATUS_IS_OK(status)) {
+			struct server_id_buf tmp;
+			DBG_DEBUG("messaging_send_buf to %s failed: %s\n",
+				  server_id_str_buf(lock.pid, &tmp),
+				  nt_errstr(status));
+		}
+
+		if (lock.lock_type == G_LOCK_WRITE) {
+			break;
+		}
+
+		/*
+		 * The readers we wake will hold the lock together
+		 */
+		have_holder = true;
+		i++;
+	}
+
+	return modified;
+}
+
 static NTSTATUS g_lock_trylock(struct db_record *rec, struct server_id self,
 			       enum g_lock_type type,
-			       struct server_id *blocker)
+			       struct server_id *blocker,
+			       bool *queued)
 {
 	TDB_DATA data;
 	size_t i;
 	struct g_lock lck;
 	struct g_lock_rec mylock = {0};
+	struct g_lock_rec mywait = {0};
 	NTSTATUS status;
+	size_t mypos = SIZE_MAX;
 	bool modified = false;
+	bool skip_waiters = false;
 	bool ok;
 
 	data = dbwrap_record_get_value(rec);
@@ -214,6 +344,7 @@ static NTSTATUS g_lock_trylock(struct db_record *rec, struct server_id self,
 
 	if ((type == G_LOCK_READ) && (lck.num_recs > 0)) {
 		struct g_lock_rec check_rec;
+		bool waiting;
 
 		/*
 		 * Read locks can stay around forever if the process
@@ -223,9 +354,10 @@ static NTSTATUS g_lock_trylock(struct db_record *rec, struct server_id self,
 		 */
 		i = generate_random() % lck.num_recs;
 
-		g_lock_get_rec(&lck, i, &check_rec);
+		waiting = g_lock_get_rec(&lck, i, &check_rec);
 
-		if ((check_rec.lock_type == G_LOCK_READ) &&
+		if (!waiting &&
+		    (check_rec.lock_type == G_LOCK_READ) &&
 		    !serverid_exists(&check_rec.pid)) {
 			g_lock_rec_del(&lck, i);
 			modified = true;
@@ -240,10 +372,11 @@ static NTSTATUS g_lock_trylock(struct db_record *rec, struct server_id self,
 
 	for (i=0; i<lck.num_recs; i++) {
 		struct g_lock_rec lock;
+		bool waiting;
 
-		g_lock_get_rec(&lck, i, &lock);
+		waiting = g_lock_get_rec(&lck, i, &lock);
 
-		if (serverid_equal(&self, &lock.pid)) {
+		if (!waiting && serverid_equal(&self, &lock.pid)) {
 			if (lock.lock_type == type) {
 				status = NT_STATUS_WAS_LOCKED;
 				goto done;
@@ -252,6 +385,7 @@ static NTSTATUS g_lock_trylock(struct db_record *rec, struct server_id self,
 			mylock = lock;
 			g_lock_rec_del(&lck, i);
 			modified = true;
+			skip_waiters = true;
 			break;
 		}
 	}
@@ -260,26 +394,38 @@ static NTSTATUS g_lock_trylock(struct db_record *rec, struct server_id self,
 	 * Check for conflicts with everybody else. Not a for-loop
 	 * because we remove stale entries in the meantime,
 	 * decrementing lck.num_recs.
+	 *
+	 * Waiters queued in front of us block us as well, we must
+	 * not overtake them. Upgrading or downgrading holders skip
+	 * the queue, the waiters might wait for them.
 	 */
 
 	i = 0;
 
 	while (i < lck.num_recs) {
 		struct g_lock_rec lock;
+		bool waiting;
 
-		g_lock_get_rec(&lck, i, &lock);
-
-		if (g_lock_conflicts(type, lock.lock_type)) {
-			struct server_id pid = lock.pid;
+		waiting = g_lock_get_rec(&lck, i, &lock);
 
+		if (waiting && serverid_equal(&self, &lock.pid)) {
 			/*
-			 * As the serverid_exists might recurse into
-			 * the g_lock code, we use
-			 * SERVERID_UNIQUE_ID_NOT_TO_VERIFY to avoid the loop
+			 * Everybody behind us in the queue is
+			 * irrelevant, only check the holders.
 			 */
-			pid.unique_id = SERVERID_UNIQUE_ID_NOT_TO_VERIFY;
+			mypos = i;
+			skip_waiters = true;
+			i++;
+			continue;
+		}
+
+		if (waiting && skip_waiters) {
+			i++;
+			continue;
+		}
 
-			if (serverid_exists(&pid)) {
+		if (g_lock_conflicts(type, lock.lock_type)) {
+			if (g_lock_pid_exists(lock.pid)) {
 				status = NT_STATUS_LOCK_NOT_GRANTED;
 				*blocker = lock.pid;
 				goto done;
@@ -295,6 +441,11 @@ static NTSTATUS g_lock_trylock(struct db_record *rec, struct server_id self,
 		i++;
 	}
 
+	if (mypos != SIZE_MAX) {
+		g_lock_rec_del(&lck, mypos);
+	}
+	*queued = false;
+
 	modified = true;
 
 	mylock = (struct g_lock_rec) {
@@ -304,6 +455,30 @@ static NTSTATUS g_lock_trylock(struct db_record *rec, struct server_id self,
 
 	status = NT_STATUS_OK;
 done:
+	if (NT_STATUS_EQUAL(status, NT_STATUS_LOCK_NOT_GRANTED)) {
+		/*
+		 * Keep our place in the queue or queue up at the end
+		 */
+		size_t j;
+
+		for (j=i; (mypos == SIZE_MAX) && (j<lck.num_recs); j++) {
+			struct g_lock_rec lock;
+			bool waiting;
+
+			waiting = g_lock_get_rec(&lck, j, &lock);
+			if (waiting && serverid_equal(&self, &lock.pid)) {
+				mypos = j;
+			}
+		}
+		if (mypos == SIZE_MAX) {
+			mywait = (struct g_lock_rec) {
+				.pid = self, .lock_type = type
+			};
+			modified = true;
+		}
+		*queued = true;
+	}
+
 	if (modified) {
 		NTSTATUS store_status;
 
@@ -315,47 +490,169 @@ done:
 		store_status = g_lock_store(
 			rec,
 			&lck,
-			mylock.pid.pid != 0 ? &mylock : NULL);
+			mylock.pid.pid != 0 ? &mylock : NULL,
+			mywait.pid.pid != 0 ? &mywait : NULL);
 
 		if (!NT_STATUS_IS_OK(store_status)) {
 			DBG_WARNING("g_lock_record_store failed: %s\n",
 				    nt_errstr(store_status));
+			*queued = false;
 			status = store_status;
 		}
 	}
 	return status;
 }
 
+struct g_lock_wait_state {
+	TDB_DATA key;
+};
+
+static bool g_lock_wait_filter(struct messaging_rec *rec, void *private_data);
+static void g_lock_wait_retry(struct tevent_req *subreq);
+static void g_lock_wait_blocker_gone(struct tevent_req *subreq);
+
+/*
+ * Wait for an unlocker to hand the lock to us or the blocker to
+ * die, whatever happens first.
+ */
+static struct tevent_req *g_lock_wait_send(TALLOC_CTX *mem_ctx,
+					   struct tevent_context *ev,
+					   struct g_lock_ctx *ctx,
+					   TDB_DATA key,
+					   struct server_id blocker)
+{
+	struct tevent_req *req, *subreq;
+	struct g_lock_wait_state *state;
+
+	req = tevent_req_create(mem_ctx, &state, struct g_lock_wait_state);
+	if (req == NULL) {
+		return NULL;
+	}
+	state->key = key;
+
+	subreq = messaging_filtered_read_send(
+		state, ev, ctx->msg, g_lock_wait_filter, state);
+	if (tevent_req_nomem(subreq, req)) {
+		return tevent_req_post(req, ev);
+	}
+	tevent_req_set_callback(subreq, g_lock_wait_retry, req);
+
+	blocker.unique_id = SERVERID_UNIQUE_ID_NOT_TO_VERIFY;
+
+	subreq = server_id_watch_send(state, ev, ctx->msg, blocker);
+	if (tevent_req_nomem(subreq, req)) {
+		return tevent_req_post(req, ev);
+	}
+	tevent_req_set_callback(subreq, g_lock_wait_blocker_gone, req);
+
+	return req;
+}
+
+static bool g_lock_wait_filter(struct messaging_rec *rec, void *private_data)
+{
+	struct g_lock_wait_state *state = talloc_get_type_abort(
+		private_data, struct g_lock_wait_state);
+
+	if (rec->msg_type != MSG_DBWRAP_G_LOCK_RETRY) {
+		return false;
+	}
+	if (rec->num_fds != 0) {
+		return false;
+	}
+	if (rec->buf.length != state->key.dsize) {
+		return false;
+	}
+	return (memcmp(rec->buf.data, state->key.dptr, rec->buf.length) == 0);
+}
+
+static void g_lock_wait_retry(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	int ret;
+
+	ret = messaging_filtered_read_recv(subreq, NULL, NULL);
+	TALLOC_FREE(subreq);
+	if (ret != 0) {
+		tevent_req_nterror(req, map_nt_error_from_unix(ret));
+		return;
+	}
+	tevent_req_done(req);
+}
+
+static void g_lock_wait_blocker_gone(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	int ret;
+
+	ret = server_id_watch_recv(subreq, NULL);
+	TALLOC_FREE(subreq);
+	if (ret != 0) {
+		tevent_req_nterror(req, map_nt_error_from_unix(ret));
+		return;
+	}
+	tevent_req_done(req);
+}
+
+static NTSTATUS g_lock_wait_recv(struct tevent_req *req)
+{
+	return tevent_req_simple_recv_ntstatus(req);
+}
+
 struct g_lock_lock_state {
 	struct tevent_context *ev;
 	struct g_lock_ctx *ctx;
 	TDB_DATA key;
 	enum g_lock_type type;
+	bool queued;
 };
 
 static void g_lock_lock_retry(struct tevent_req *subreq);
+static void g_lock_lock_cleanup(struct tevent_req *req,
+				enum tevent_req_state req_state);
 
 struct g_lock_lock_fn_state {
 	struct g_lock_lock_state *state;
 	struct server_id self;
 
-	struct tevent_req *watch_req;
+	struct server_id blocker;
 	NTSTATUS status;
 };
 
 static void g_lock_lock_fn(struct db_record *rec, void *private_data)
 {
 	struct g_lock_lock_fn_state *state = private_data;
-	struct server_id blocker;
 
 	state->status = g_lock_trylock(rec, state->self, state->state->type,
-				       &blocker);
-	if (!NT_STATUS_EQUAL(state->status, NT_STATUS_LOCK_NOT_GRANTED)) {
-		return;
+				       &state->blocker,
+				       &state->state->queued);
+}
+
+static bool g_lock_lock_wait(struct tevent_req *req,
+			     struct g_lock_lock_state *state,
+			     struct server_id blocker)
+{
+	struct tevent_req *subreq;
+
+	subreq = g_lock_wait_send(state, state->ev, state->ctx, state->key,
+				  blocker);
+	if (tevent_req_nomem(subreq, req)) {
+		return false;
 	}
 
-	state->watch_req = dbwrap_watched_watch_send(
-		state->state, state->state->ev, rec, blocker);
+	/*
+	 * Retry now and then anyway, a waker might have died before
+	 * sending us the message.
+	 */
+	if (!tevent_req_set_endtime(
+		    subreq, state->ev,
+		    timeval_current_ofs(5 + sys_random() % 5, 0))) {
+		tevent_req_oom(req);
+		return false;
+	}
+	tevent_req_set_callback(subreq, g_lock_lock_retry, req);
+	return true;
 }
 
 struct tevent_req *g_lock_lock_send(TALLOC_CTX *mem_ctx,
@@ -378,6 +675,8 @@ struct tevent_req *g_lock_lock_send(TALLOC_CTX *mem_ctx,
 	state->key = key;
 	state->type = type;
 
+	tevent_req_set_cleanup_fn(req, g_lock_lock_cleanup);
+
 	fn_state = (struct g_lock_lock_fn_state) {
 		.state = state, .self = messaging_server_id(ctx->msg)
 	};
@@ -398,16 +697,9 @@ struct tevent_req *g_lock_lock_send(TALLOC_CTX *mem_ctx,
 		return tevent_req_post(req, ev);
 	}
 
-	if (tevent_req_nomem(fn_state.watch_req, req)) {
-		return tevent_req_post(req, ev);
-	}
-
-	if (!tevent_req_set_endtime(
-		    fn_state.watch_req, state->ev,
-		    timeval_current_ofs(5 + sys_random() % 5, 0))) {
+	if (!g_lock_lock_wait(req, state, fn_state.blocker)) {
 		return tevent_req_post(req, ev);
 	}
-	tevent_req_set_callback(fn_state.watch_req, g_lock_lock_retry, req);
 	return req;
 }
 
@@ -420,8 +712,8 @@ static void g_lock_lock_retry(struct tevent_req *subreq)
 	struct g_lock_lock_fn_state fn_state;
 	NTSTATUS status;
 
-	status = dbwrap_watched_watch_recv(subreq, NULL, NULL);
-	DBG_DEBUG("watch_recv returned %s\n", nt_errstr(status));
+	status = g_lock_wait_recv(subreq);
+	DBG_DEBUG("g_lock_wait_recv returned %s\n", nt_errstr(status));
 	TALLOC_FREE(subreq);
 
 	if (!NT_STATUS_IS_OK(status) &&
@@ -451,16 +743,89 @@ static void g_lock_lock_retry(struct tevent_req *subreq)
 		return;
 	}
 
-	if (tevent_req_nomem(fn_state.watch_req, req)) {
+	g_lock_lock_wait(req, state, fn_state.blocker);
+}
+
+struct g_lock_dequeue_state {
+	struct g_lock_ctx *ctx;
+	TDB_DATA key;
+	struct server_id self;
+};
+
+static void g_lock_dequeue_fn(struct db_record *rec, void *private_data)
+{
+	struct g_lock_dequeue_state *state = private_data;
+	TDB_DATA value;
+	struct g_lock lck;
+	size_t i;
+	NTSTATUS status;
+	bool ok;
+
+	value = dbwrap_record_get_value(rec);
+
+	ok = g_lock_parse(value.dptr, value.dsize, &lck);
+	if (!ok) {
 		return;
 	}
 
-	if (!tevent_req_set_endtime(
-		    fn_state.watch_req, state->ev,
-		    timeval_current_ofs(5 + sys_random() % 5, 0))) {
+	for (i=0; i<lck.num_recs; i++) {
+		struct g_lock_rec lock;
+		bool waiting;
+
+		waiting = g_lock_get_rec(&lck, i, &lock);
+		if (waiting && serverid_equal(&state->self, &lock.pid)) {
+			break;
+		}
+	}
+	if (i == lck.num_recs) {
 		return;
 	}
-	tevent_req_set_callback(fn_state.watch_req, g_lock_lock_retry, req);
+
+	g_lock_rec_del(&lck, i);
+
+	/*
+	 * We might have been woken before we gave up, pass it on.
+	 */
+	g_lock_wake_waiters(state->ctx, state->key, &lck);
+
+	if ((lck.num_recs == 0) && (lck.datalen == 0)) {
+		status = dbwrap_record_delete(rec);
+	} else {
+		status = g_lock_store(rec, &lck, NULL, NULL);
+	}
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_WARNING("Could not dequeue: %s\n", nt_errstr(status));
+	}
+}
+
+/*
+ * Remove ourselves from the waiter queue when we give up,
+ * typically due to a timeout.
+ */
+static void g_lock_lock_cleanup(struct tevent_req *req,
+				enum tevent_req_state req_state)
+{
+	struct g_lock_lock_state *state = tevent_req_data(
+		req, struct g_lock_lock_state);
+	struct g_lock_dequeue_state dequeue_state;
+	NTSTATUS status;
+
+	if (!state->queued) {
+		return;
+	}
+	state->queued = false;
+
+	dequeue_state = (struct g_lock_dequeue_state) {
+		.ctx = state->ctx, .key = state->key,
+		.self = messaging_server_id(state->ctx->msg)
+	};
+
+	status = dbwrap_do_locked(state->ctx->db, state->key,
+				  g_lock_dequeue_fn, &dequeue_state);
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_DEBUG("dbwrap_do_locked failed: %s\n",
+			  nt_errstr(status));
+	}
 }
 
 NTSTATUS g_lock_lock_recv(struct tevent_req *req)
@@ -499,6 +864,7 @@ NTSTATUS g_lock_lock(struct g_lock_ctx *ctx, TDB_DATA key,
 }
 
 struct g_lock_unlock_state {
+	struct g_lock_ctx *ctx;
 	TDB_DATA key;
 	struct server_id self;
 	NTSTATUS status;
@@ -526,8 +892,10 @@ static void g_lock_unlock_fn(struct db_record *rec,
 	}
 	for (i=0; i<lck.num_recs; i++) {
 		struct g_lock_rec lockrec;
-		g_lock_get_rec(&lck, i, &lockrec);
-		if (serverid_equal(&state->self, &lockrec.pid)) {
+		bool waiting;
+
+		waiting = g_lock_get_rec(&lck, i, &lockrec);
+		if (!waiting && serverid_equal(&state->self, &lockrec.pid)) {
 			break;
 		}
 	}
@@ -539,17 +907,19 @@ static void g_lock_unlock_fn(struct db_record *rec,
 
 	g_lock_rec_del(&lck, i);
 
+	g_lock_wake_waiters(state->ctx, state->key, &lck);
+
 	if ((lck.num_recs == 0) && (lck.datalen == 0)) {
 		state->status = dbwrap_record_delete(rec);
 		return;
 	}
-	state->status = g_lock_store(rec, &lck, NULL);
+	state->status = g_lock_store(rec, &lck, NULL, NULL);
 }
 
 NTSTATUS g_lock_unlock(struct g_lock_ctx *ctx, TDB_DATA key)
 {
 	struct g_lock_unlock_state state = {
-		.self = messaging_server_id(ctx->msg), .key = key
+		.ctx = ctx, .self = messaging_server_id(ctx->msg), .key = key
 	};
 	NTSTATUS status;
 
@@ -598,8 +968,11 @@ static void g_lock_write_data_fn(struct db_record *rec,
 	}
 	for (i=0; i<lck.num_recs; i++) {
 		struct g_lock_rec lockrec;
-		g_lock_get_rec(&lck, i, &lockrec);
-		if ((lockrec.lock_type == G_LOCK_WRITE) &&
+		bool waiting;
+
+		waiting = g_lock_get_rec(&lck, i, &lockrec);
+		if (!waiting &&
+		    (lockrec.lock_type == G_LOCK_WRITE) &&
 		    serverid_equal(&state->self, &lockrec.pid)) {
 			break;
 		}
@@ -612,7 +985,7 @@ static void g_lock_write_data_fn(struct db_record *rec,
 
 	lck.data = discard_const_p(uint8_t, state->data);
 	lck.datalen = state->datalen;
-	state->status = g_lock_store(rec, &lck, NULL);
+	state->status = g_lock_store(rec, &lck, NULL, NULL);
 }
 
 NTSTATUS g_lock_write_data(struct g_lock_ctx *ctx, TDB_DATA key,
@@ -690,7 +1063,7 @@ static void g_lock_dump_fn(TDB_DATA key, TDB_DATA data,
 	struct g_lock_dump_state *state = private_data;
 	struct g_lock_rec *recs;
 	struct g_lock lck;
-	size_t i;
+	size_t i, num_locks;
 	bool ok;
 
 	ok = g_lock_parse(data.dptr, data.dsize, &lck);
@@ -710,11 +1083,21 @@ static void g_lock_dump_fn(TDB_DATA key, TDB_DATA data,
 		return;
 	}
 
+	/*
+	 * Only report the holders, not the queued waiters
+	 */
+	num_locks = 0;
+
 	for (i=0; i<lck.num_recs; i++) {
-		g_lock_get_rec(&lck, i, &recs[i]);
+		bool waiting;
+
+		waiting = g_lock_get_rec(&lck, i, &recs[num_locks]);
+		if (!waiting) {
+			num_locks += 1;
+		}
 	}
 
-	state->fn(recs, lck.num_recs, lck.data, lck.datalen,
+	state->fn(recs, num_locks, lck.data, lck.datalen,
 		  state->private_data);
 
 	TALLOC_FREE(recs);
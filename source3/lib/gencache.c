@@ -177,6 +177,63 @@ static void gencache_prune_expired(struct tdb_context *tdb,
 	TALLOC_FREE(state.keys);
 }
 
+/*
+ * Callers like the idmap and name caches store the same value again
+ * on every lookup that went to the source, just moving the timeout.
+ * That rewrite is skipped if it would only extend the lifetime by a
+ * small part of the requested one, saving the tdb store and the
+ * chain prune in gencache_set_data_blob.
+ */
+#define GENCACHE_SET_MAX_SLACK 60
+
+struct gencache_set_unchanged_state {
+	DATA_BLOB blob;
+	time_t timeout;
+	time_t slack;
+	bool unchanged;
+};
+
+static int gencache_set_unchanged_fn(TDB_DATA key, TDB_DATA data,
+				     void *private_data)
+{
+	struct gencache_set_unchanged_state *state = private_data;
+	DATA_BLOB payload;
+	time_t timeout;
+	bool ok;
+
+	ok = gencache_pull_timeout(key, data, &timeout, &payload);
+	if (!ok) {
+		return 0;
+	}
+
+	state->unchanged =
+		(timeout <= state->timeout) &&
+		(state->timeout - timeout <= state->slack) &&
+		(data_blob_cmp(&payload, &state->blob) == 0);
+
+	return 0;
+}
+
+static bool gencache_set_unchanged(struct tdb_context *tdb, TDB_DATA key,
+				   DATA_BLOB blob, time_t timeout)
+{
+	struct gencache_set_unchanged_state state = {
+		.blob = blob, .timeout = timeout,
+	};
+	time_t now = time(NULL);
+
+	if (timeout <= now) {
+		return false;
+	}
+	state.slack = MIN((timeout - now) / 10, GENCACHE_SET_MAX_SLACK);
+	if (state.slack == 0) {
+		return false;
+	}
+
+	tdb_parse_record(tdb, key, gencache_set_unchanged_fn, &state);
+	return state.unchanged;
+}
+
 /**
  * Set an entry in the cache file. If there's no such
  * one, then add it.
@@ -232,6 +289,12 @@ bool gencache_set_data_blob(const char *keystr, DATA_BLOB blob,
 		return false;
 	}
 
+	if (gencache_set_unchanged(cache->tdb, key, blob, timeout)) {
+		DBG_DEBUG("Entry for key [%s] unchanged\n", keystr);
+		tdb_chainunlock(cache->tdb, key);
+		return true;
+	}
+
 	gencache_prune_expired(cache->tdb, key);
 
 	ret = tdb_storev(cache->tdb, key, dbufs, ARRAY_SIZE(dbufs), 0);
@@ -22,6 +22,55 @@
 #include "../libcli/security/security.h"
 #include "../librpc/gen_ndr/idmap.h"
 #include "lib/gencache.h"
+#include "../lib/util/memcache.h"
+
+/*
+ * Processes with a global memcache (smbd) keep recently used mappings
+ * in memory, in front of gencache. An entry is used for at most
+ * IDMAP_CACHE_MEMCACHE_TIME seconds, so mappings changed by other
+ * processes are picked up soon even without an ID_CACHE_DELETE
+ * message.
+ */
+#define IDMAP_CACHE_MEMCACHE_TIME 10
+
+struct idmap_cache_sid2xid_mem {
+	struct unixid id;
+	time_t valid_until;
+};
+
+struct idmap_cache_xid2sid_mem {
+	struct dom_sid sid;
+	time_t valid_until;
+};
+
+struct idmap_cache_xid_key {
+	char type;
+	uint32_t id;
+};
+
+static DATA_BLOB idmap_cache_xid_key(struct idmap_cache_xid_key *key,
+				     char type, uint32_t id)
+{
+	/* memcache compares the raw bytes, padding included */
+	ZERO_STRUCTP(key);
+	key->type = type;
+	key->id = id;
+	return data_blob_const(key, sizeof(*key));
+}
+
+static void idmap_cache_memcache_del_sid(const char *sidstr)
+{
+	memcache_delete(NULL, IDMAP_SID2XID_CACHE,
+			data_blob_string_const(sidstr));
+}
+
+static void idmap_cache_memcache_del_xid(char type, uint32_t id)
+{
+	struct idmap_cache_xid_key key;
+
+	memcache_delete(NULL, IDMAP_XID2SID_CACHE,
+			idmap_cache_xid_key(&key, type, id));
+}
 
 /**
  * Find a sid2xid mapping
@@ -43,9 +92,24 @@ bool idmap_cache_find_sid2unixid(const struct dom_sid *sid, struct unixid *id,
 	time_t timeout;
 	bool ret;
 	struct unixid tmp_id;
+	struct idmap_cache_sid2xid_mem mem;
+	DATA_BLOB memval;
+	time_t now = time(NULL);
+
+	dom_sid_str_buf(sid, &sidstr);
+
+	if (memcache_lookup(NULL, IDMAP_SID2XID_CACHE,
+			    data_blob_string_const(sidstr.buf), &memval) &&
+	    memval.length == sizeof(mem)) {
+		memcpy(&mem, memval.data, sizeof(mem));
+		if (mem.valid_until > now) {
+			*id = mem.id;
+			*expired = false;
+			return true;
+		}
+	}
 
-	key = talloc_asprintf(talloc_tos(), "IDMAP/SID2XID/%s",
-			      dom_sid_str_buf(sid, &sidstr));
+	key = talloc_asprintf(talloc_tos(), "IDMAP/SID2XID/%s", sidstr.buf);
 	if (key == NULL) {
 		return false;
 	}
@@ -120,7 +184,18 @@ bool idmap_cache_find_sid2unixid(const struct dom_sid *sid, struct unixid *id,
 		}
 
 		*id = tmp_id;
-		*expired = (timeout <= time(NULL));
+		*expired = (timeout <= now);
+
+		if (!*expired) {
+			mem = (struct idmap_cache_sid2xid_mem) {
+				.id = tmp_id,
+				.valid_until = MIN(timeout,
+					now + IDMAP_CACHE_MEMCACHE_TIME),
+			};
+			memcache_add(NULL, IDMAP_SID2XID_CACHE,
+				     data_blob_string_const(sidstr.buf),
+				     data_blob_const(&mem, sizeof(mem)));
+		}
 	} else {
 		DEBUG(0, ("FAILED to parse value for key [%s] (value=[%s]): "
 			  "colon missing after id=[%llu]\n",
@@ -195,6 +270,9 @@ struct idmap_cache_xid2sid_state {
 	bool ret;
 };
 
+static bool idmap_cache_find_xid2sid(char type, uint32_t xid,
+				     struct dom_sid *sid, bool *expired);
+
 static void idmap_cache_xid2sid_parser(const struct gencache_timeout *timeout,
 				       DATA_BLOB blob,
 				       void *private_data)
@@ -235,17 +313,7 @@ static void idmap_cache_xid2sid_parser(const struct gencache_timeout *timeout,
 
 bool idmap_cache_find_uid2sid(uid_t uid, struct dom_sid *sid, bool *expired)
 {
-	fstring key;
-	struct idmap_cache_xid2sid_state state;
-
-	fstr_sprintf(key, "IDMAP/UID2SID/%d", (int)uid);
-
-	state.sid = sid;
-	state.expired = expired;
-	state.ret = false;
-
-	gencache_parse(key, idmap_cache_xid2sid_parser, &state);
-	return state.ret;
+	return idmap_cache_find_xid2sid('U', uid, sid, expired);
 }
 
 /**
@@ -259,17 +327,50 @@ bool idmap_cache_find_uid2sid(uid_t uid, struct dom_sid *sid, bool *expired)
  */
 
 bool idmap_cache_find_gid2sid(gid_t gid, struct dom_sid *sid, bool *expired)
+{
+	return idmap_cache_find_xid2sid('G', gid, sid, expired);
+}
+
+static bool idmap_cache_find_xid2sid(char type, uint32_t xid,
+				     struct dom_sid *sid, bool *expired)
 {
 	fstring key;
 	struct idmap_cache_xid2sid_state state;
+	struct idmap_cache_xid2sid_mem mem;
+	struct idmap_cache_xid_key memkey;
+	DATA_BLOB memval;
+	time_t now = time(NULL);
+
+	if (memcache_lookup(NULL, IDMAP_XID2SID_CACHE,
+			    idmap_cache_xid_key(&memkey, type, xid),
+			    &memval) &&
+	    memval.length == sizeof(mem)) {
+		memcpy(&mem, memval.data, sizeof(mem));
+		if (mem.valid_until > now) {
+			sid_copy(sid, &mem.sid);
+			*expired = false;
+			return true;
+		}
+	}
 
-	fstr_sprintf(key, "IDMAP/GID2SID/%d", (int)gid);
+	fstr_sprintf(key, "IDMAP/%cID2SID/%d", type, (int)xid);
 
 	state.sid = sid;
 	state.expired = expired;
 	state.ret = false;
 
 	gencache_parse(key, idmap_cache_xid2sid_parser, &state);
+
+	if (state.ret && !*expired) {
+		mem = (struct idmap_cache_xid2sid_mem) {
+			.valid_until = now + IDMAP_CACHE_MEMCACHE_TIME,
+		};
+		sid_copy(&mem.sid, sid);
+		memcache_add(NULL, IDMAP_XID2SID_CACHE,
+			     idmap_cache_xid_key(&memkey, type, xid),
+			     data_blob_const(&mem, sizeof(mem)));
+	}
+
 	return state.ret;
 }
 
@@ -315,8 +416,12 @@ void idmap_cache_set_sid2unixid(const struct dom_sid *sid, struct unixid *unix_i
 			? lp_idmap_negative_cache_time()
 			: lp_idmap_cache_time();
 		gencache_set(key, value, now + timeout);
+		idmap_cache_memcache_del_sid(sidstr.buf);
 	}
 	if (unix_id->id != -1) {
+		idmap_cache_memcache_del_xid('U', unix_id->id);
+		idmap_cache_memcache_del_xid('G', unix_id->id);
+
 		if (is_null_sid(sid)) {
 			/* negative xid mapping */
 			fstrcpy(value, "-");
@@ -371,6 +476,8 @@ static bool idmap_cache_del_xid(char t, int xid)
 	time_t timeout;
 	bool ret = true;
 
+	idmap_cache_memcache_del_xid(t, xid);
+
 	if (!gencache_get(key, mem_ctx, &sid_str, &timeout)) {
 		DEBUG(3, ("no entry: %s\n", key));
 		ret = false;
@@ -379,6 +486,8 @@ static bool idmap_cache_del_xid(char t, int xid)
 
 	if (sid_str[0] != '-') {
 		const char* sid_key = key_sid2xid_str(mem_ctx, sid_str);
+
+		idmap_cache_memcache_del_sid(sid_str);
 		if (!gencache_del(sid_key)) {
 			DEBUG(2, ("failed to delete: %s\n", sid_key));
 			ret = false;
@@ -439,7 +548,9 @@ bool idmap_cache_del_sid(const struct dom_sid *sid)
 		}
 	}
 
-	sid_key = key_sid2xid_str(mem_ctx, dom_sid_str_buf(sid, &sidbuf));
+	idmap_cache_memcache_del_sid(dom_sid_str_buf(sid, &sidbuf));
+
+	sid_key = key_sid2xid_str(mem_ctx, sidbuf.buf);
 	if (sid_key == NULL) {
 		return false;
 	}
@@ -0,0 +1,296 @@
+/*
+   Unix SMB/CIFS implementation.
+   Live smbd statistics in per process shared memory segments
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "includes.h"
+#include "system/filesys.h"
+#include "system/shmem.h"
+#include "live_stats.h"
+
+#define LIVE_STATS_DIR "live_stats"
+
+#ifdef HAVE_ATOMIC_THREAD_FENCE_SUPPORT
+
+struct live_stats_segment *live_stats_segment;
+
+static char *live_stats_path(TALLOC_CTX *mem_ctx, pid_t pid)
+{
+	char *dir = NULL;
+	char *path = NULL;
+
+	dir = lock_path(mem_ctx, LIVE_STATS_DIR);
+	if (dir == NULL) {
+		return NULL;
+	}
+	path = talloc_asprintf(mem_ctx, "%s/%d", dir, (int)pid);
+	TALLOC_FREE(dir);
+	return path;
+}
+
+/*
+ * Called in every smbd child, the segment lives until the process
+ * exits, smbd_cleanupd calls live_stats_cleanup() afterwards.
+ */
+bool live_stats_setup(void)
+{
+	TALLOC_CTX *frame = NULL;
+	struct live_stats_segment *seg = NULL;
+	char *dir = NULL;
+	char *path = NULL;
+	pid_t pid = getpid();
+	void *ptr = NULL;
+	int fd;
+	int ret;
+	bool ok;
+
+	if (live_stats_segment != NULL) {
+		/*
+		 * We're a new process, don't touch
+		 * the segment of our parent.
+		 */
+		if (live_stats_segment->pid == pid) {
+			return true;
+		}
+		munmap(live_stats_segment, sizeof(*live_stats_segment));
+		live_stats_segment = NULL;
+	}
+
+	frame = talloc_stackframe();
+
+	dir = lock_path(frame, LIVE_STATS_DIR);
+	if (dir == NULL) {
+		TALLOC_FREE(frame);
+		return false;
+	}
+	ok = directory_create_or_exist(dir, 0755);
+	if (!ok) {
+		DBG_WARNING("Could not create %s: %s\n",
+			    dir, strerror(errno));
+		TALLOC_FREE(frame);
+		return false;
+	}
+
+	path = live_stats_path(frame, pid);
+	if (path == NULL) {
+		TALLOC_FREE(frame);
+		return false;
+	}
+
+	fd = open(path, O_RDWR|O_CREAT|O_TRUNC, 0644);
+	if (fd == -1) {
+		DBG_WARNING("Could not open %s: %s\n", path, strerror(errno));
+		TALLOC_FREE(frame);
+		return false;
+	}
+
+	ret = ftruncate(fd, sizeof(*seg));
+	if (ret == -1) {
+		DBG_WARNING("ftruncate(%s) failed: %s\n",
+			    path, strerror(errno));
+		close(fd);
+		unlink(path);
+		TALLOC_FREE(frame);
+		return false;
+	}
+
+	ptr = mmap(NULL, sizeof(*seg), PROT_READ|PROT_WRITE, MAP_SHARED,
+		   fd, 0);
+	close(fd);
+	if (ptr == MAP_FAILED) {
+		DBG_WARNING("mmap(%s) failed: %s\n", path, strerror(errno));
+		unlink(path);
+		TALLOC_FREE(frame);
+		return false;
+	}
+	seg = (struct live_stats_segment *)ptr;
+
+	seg->version = LIVE_STATS_VERSION;
+	seg->pid = pid;
+	seg->seqnum = 0;
+	seg->values = (struct live_stats_values) { 0 };
+	atomic_thread_fence(memory_order_seq_cst);
+	seg->magic = LIVE_STATS_MAGIC;
+
+	live_stats_segment = seg;
+
+	TALLOC_FREE(frame);
+	return true;
+}
+
+void live_stats_cleanup(pid_t pid)
+{
+	char *path = NULL;
+	int ret;
+
+	path = live_stats_path(talloc_tos(), pid);
+	if (path == NULL) {
+		return;
+	}
+
+	ret = unlink(path);
+	if ((ret == -1) && (errno != ENOENT)) {
+		DBG_DEBUG("unlink(%s) failed: %s\n", path, strerror(errno));
+	}
+	TALLOC_FREE(path);
+}
+
+/*
+ * Take a consistent snapshot of the values, retrying
+ * while the owning smbd is in the middle of an update.
+ */
+bool live_stats_read(const struct live_stats_segment *seg,
+		     struct live_stats_values *values)
+{
+	const volatile uint64_t *seqnum = &seg->seqnum;
+	unsigned retries;
+
+	if (seg->magic != LIVE_STATS_MAGIC) {
+		return false;
+	}
+	if (seg->version != LIVE_STATS_VERSION) {
+		return false;
+	}
+
+	for (retries = 0; retries < 1000; retries++) {
+		uint64_t seq1, seq2;
+
+		seq1 = *seqnum;
+		atomic_thread_fence(memory_order_seq_cst);
+		if ((seq1 & 1) != 0) {
+			continue;
+		}
+
+		*values = seg->values;
+
+		atomic_thread_fence(memory_order_seq_cst);
+		seq2 = *seqnum;
+
+		if (seq1 == seq2) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+int live_stats_traverse(int (*fn)(pid_t pid,
+				  const struct live_stats_values *values,
+				  void *private_data),
+			void *private_data)
+{
+	TALLOC_CTX *frame = talloc_stackframe();
+	char *dir = NULL;
+	DIR *d = NULL;
+	struct dirent *de = NULL;
+	int count = 0;
+
+	dir = lock_path(frame, LIVE_STATS_DIR);
+	if (dir == NULL) {
+		TALLOC_FREE(frame);
+		return -1;
+	}
+
+	d = opendir(dir);
+	if (d == NULL) {
+		TALLOC_FREE(frame);
+		return (errno == ENOENT) ? 0 : -1;
+	}
+
+	while ((de = readdir(d)) != NULL) {
+		struct live_stats_values values;
+		const struct live_stats_segment *seg = NULL;
+		char *path = NULL;
+		void *ptr = NULL;
+		struct stat st;
+		int fd;
+		int ret;
+		bool ok;
+
+		if (ISDOT(de->d_name) || ISDOTDOT(de->d_name)) {
+			continue;
+		}
+
+		path = talloc_asprintf(frame, "%s/%s", dir, de->d_name);
+		if (path == NULL) {
+			break;
+		}
+
+		fd = open(path, O_RDONLY);
+		TALLOC_FREE(path);
+		if (fd == -1) {
+			continue;
+		}
+
+		ret = fstat(fd, &st);
+		if ((ret == -1) || (st.st_size < sizeof(*seg))) {
+			close(fd);
+			continue;
+		}
+
+		ptr = mmap(NULL, sizeof(*seg), PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if (ptr == MAP_FAILED) {
+			continue;
+		}
+		seg = (const struct live_stats_segment *)ptr;
+
+		ok = live_stats_read(seg, &values);
+		if (ok) {
+			count += 1;
+			ret = fn(seg->pid, &values, private_data);
+		}
+
+		munmap(ptr, sizeof(*seg));
+
+		if (ok && (ret != 0)) {
+			break;
+		}
+	}
+
+	closedir(d);
+	TALLOC_FREE(frame);
+	return count;
+}
+
+#else /* HAVE_ATOMIC_THREAD_FENCE_SUPPORT */
+
+bool live_stats_setup(void)
+{
+	DBG_WARNING("Live statistics are not supported on this platform\n");
+	return false;
+}
+
+void live_stats_cleanup(pid_t pid)
+{
+	return;
+}
+
+bool live_stats_read(const struct live_stats_segment *seg,
+		     struct live_stats_values *values)
+{
+	return false;
+}
+
+int live_stats_traverse(int (*fn)(pid_t pid,
+				  const struct live_stats_values *values,
+				  void *private_data),
+			void *private_data)
+{
+	return 0;
+}
+
+#endif /* HAVE_ATOMIC_THREAD_FENCE_SUPPORT */
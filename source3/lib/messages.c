@@ -876,51 +876,57 @@ NTSTATUS messaging_send_iov(struct messaging_context *msg_ctx,
 }
 
 struct send_all_state {
-	struct messaging_context *msg_ctx;
-	int msg_type;
-	const void *buf;
-	size_t len;
+	pid_t *pids;
+	size_t num_pids;
+	bool oom;
 };
 
 static int send_all_fn(pid_t pid, void *private_data)
 {
 	struct send_all_state *state = private_data;
-	NTSTATUS status;
+	size_t num_pids = talloc_array_length(state->pids);
 
 	if (pid == getpid()) {
 		DBG_DEBUG("Skip ourselves in messaging_send_all\n");
 		return 0;
 	}
 
-	status = messaging_send_buf(state->msg_ctx, pid_to_procid(pid),
-				    state->msg_type, state->buf, state->len);
-	if (!NT_STATUS_IS_OK(status)) {
-		DBG_WARNING("messaging_send_buf to %ju failed: %s\n",
-			    (uintmax_t)pid, nt_errstr(status));
+	if (state->num_pids == num_pids) {
+		pid_t *tmp;
+
+		tmp = talloc_realloc(NULL, state->pids, pid_t,
+				     MAX(num_pids * 2, 64));
+		if (tmp == NULL) {
+			state->oom = true;
+			return 1;
+		}
+		state->pids = tmp;
 	}
 
+	state->pids[state->num_pids] = pid;
+	state->num_pids += 1;
+
 	return 0;
 }
 
 void messaging_send_all(struct messaging_context *msg_ctx,
 			int msg_type, const void *buf, size_t len)
 {
-	struct send_all_state state = {
-		.msg_ctx = msg_ctx, .msg_type = msg_type,
-		.buf = buf, .len = len
+	struct send_all_state state = { .pids = NULL };
+	uint8_t msghdr[MESSAGE_HDR_LENGTH];
+	struct iovec iov[] = {
+		{ .iov_base = msghdr,
+		  .iov_len = sizeof(msghdr) },
+		{ .iov_base = discard_const_p(void, buf),
+		  .iov_len = len }
 	};
+	int *errors = NULL;
+	size_t i;
 	int ret;
 
 #ifdef CLUSTER_SUPPORT
 	if (lp_clustering()) {
 		struct ctdbd_connection *conn = messaging_ctdb_connection();
-		uint8_t msghdr[MESSAGE_HDR_LENGTH];
-		struct iovec iov[] = {
-			{ .iov_base = msghdr,
-			  .iov_len = sizeof(msghdr) },
-			{ .iov_base = discard_const_p(void, buf),
-			  .iov_len = len }
-		};
 
 		message_hdr_put(msghdr, msg_type, messaging_server_id(msg_ctx),
 				(struct server_id) {0});
@@ -942,7 +948,65 @@ void messaging_send_all(struct messaging_context *msg_ctx,
 	if (ret != 0) {
 		DBG_WARNING("messaging_dgm_forall failed: %s\n",
 			    strerror(ret));
+		goto done;
+	}
+	if (state.oom) {
+		DBG_WARNING("talloc_realloc failed\n");
+		goto done;
+	}
+	if (state.num_pids == 0) {
+		goto done;
+	}
+
+	errors = talloc_array(state.pids, int, state.num_pids);
+	if (errors == NULL) {
+		DBG_WARNING("talloc_array failed\n");
+		goto done;
+	}
+
+	/*
+	 * As for the clustered broadcast above, the receivers don't
+	 * look at the destination, so all of them get the same
+	 * header. This saves looking up the unique id of every
+	 * process.
+	 */
+	message_hdr_put(msghdr, msg_type, messaging_server_id(msg_ctx),
+			(struct server_id) {0});
+
+	ret = messaging_dgm_send_many(state.pids, state.num_pids,
+				      iov, ARRAY_SIZE(iov), errors);
+	if (ret != 0) {
+		DBG_WARNING("messaging_dgm_send_many failed: %s\n",
+			    strerror(ret));
+		goto done;
 	}
+
+	for (i=0; i<state.num_pids; i++) {
+		pid_t pid = state.pids[i];
+		NTSTATUS status;
+
+		if ((errors[i] == 0) ||
+		    (errors[i] == ENOENT) || (errors[i] == ECONNREFUSED)) {
+			/*
+			 * Sent, or the process has just exited
+			 */
+			continue;
+		}
+
+		/*
+		 * Full receive queue or we need to become root to
+		 * send, use the queueing single destination path.
+		 */
+		status = messaging_send_buf(msg_ctx, pid_to_procid(pid),
+					    msg_type, buf, len);
+		if (!NT_STATUS_IS_OK(status)) {
+			DBG_WARNING("messaging_send_buf to %ju failed: %s\n",
+				    (uintmax_t)pid, nt_errstr(status));
+		}
+	}
+
+done:
+	TALLOC_FREE(state.pids);
 }
 
 static struct messaging_rec *messaging_rec_dup(TALLOC_CTX *mem_ctx,
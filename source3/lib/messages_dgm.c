@@ -33,6 +33,7 @@
 #include "lib/util/tevent_unix.h"
 
 #define MESSAGING_DGM_FRAGMENT_LENGTH 1024
+#define MESSAGING_DGM_SEND_MANY_BATCH 64
 
 struct sun_path_buf {
 	/*
@@ -1454,6 +1455,185 @@ again:
 	return ret;
 }
 
+/*
+ * Send as many of the messages as possible in one
+ * syscall. Returns the number of messages sent, -1 with errno set
+ * if the first one failed.
+ */
+
+static int messaging_dgm_sendmmsg(int sock, struct msghdr *msgs,
+				  size_t num_msgs)
+{
+	int ret;
+#ifdef HAVE_SENDMMSG
+	struct mmsghdr mmsgs[num_msgs];
+	size_t i;
+
+	for (i=0; i<num_msgs; i++) {
+		mmsgs[i] = (struct mmsghdr) { .msg_hdr = msgs[i] };
+	}
+
+	do {
+		ret = sendmmsg(sock, mmsgs, num_msgs, 0);
+	} while ((ret == -1) && (errno == EINTR));
+#else
+	do {
+		ret = sendmsg(sock, &msgs[0], 0);
+	} while ((ret == -1) && (errno == EINTR));
+
+	if (ret != -1) {
+		ret = 1;
+	}
+#endif
+	return ret;
+}
+
+static void messaging_dgm_send_batch(struct messaging_dgm_context *ctx,
+				     int sock,
+				     const pid_t *pids, size_t num_pids,
+				     struct iovec *iov, int iovlen,
+				     int *errors)
+{
+	struct sockaddr_un addrs[num_pids];
+	struct msghdr msgs[num_pids];
+	size_t idx[num_pids];
+	size_t i, num_msgs, sent;
+
+	num_msgs = 0;
+
+	for (i=0; i<num_pids; i++) {
+		struct sockaddr_un *addr = &addrs[i];
+		int len;
+
+		*addr = (struct sockaddr_un) { .sun_family = AF_UNIX };
+
+		len = snprintf(addr->sun_path, sizeof(addr->sun_path),
+			       "%s/%u", ctx->socket_dir.buf,
+			       (unsigned)pids[i]);
+		if ((len < 0) || ((size_t)len >= sizeof(addr->sun_path))) {
+			errors[i] = ENAMETOOLONG;
+			continue;
+		}
+
+		errors[i] = 0;
+		idx[num_msgs] = i;
+		msgs[num_msgs] = (struct msghdr) {
+			.msg_name = addr,
+			.msg_namelen = sizeof(*addr),
+			.msg_iov = iov,
+			.msg_iovlen = iovlen
+		};
+		num_msgs += 1;
+	}
+
+	sent = 0;
+
+	while (sent < num_msgs) {
+		int ret;
+
+		ret = messaging_dgm_sendmmsg(sock, &msgs[sent],
+					     num_msgs - sent);
+		if (ret == -1) {
+			/*
+			 * Record the failure for the caller and
+			 * carry on with the next one.
+			 */
+			errors[idx[sent]] = errno;
+			sent += 1;
+			continue;
+		}
+		sent += ret;
+	}
+}
+
+/*
+ * Send the same message to a list of processes. Messages small enough
+ * not to need fragmenting are sent from a single unconnected socket,
+ * in batches of sendmmsg calls where available. This avoids creating
+ * and connecting a socket per destination and makes broadcasts to
+ * thousands of processes cheap.
+ *
+ * Sending never blocks. errors[i] is set to the result for pids[i],
+ * EWOULDBLOCK if the receiver's queue was full. The caller should
+ * fall back to messaging_dgm_send() for those.
+ */
+
+int messaging_dgm_send_many(const pid_t *pids, size_t num_pids,
+			    const struct iovec *iov, int iovlen,
+			    int *errors)
+{
+	struct messaging_dgm_context *ctx = global_dgm_context;
+	uint64_t cookie = 0;
+	struct iovec iov_copy[iovlen+1];
+	ssize_t msglen;
+	size_t i;
+	int sock, ret;
+
+	if (ctx == NULL) {
+		return ENOTCONN;
+	}
+	if (iovlen < 0) {
+		return EINVAL;
+	}
+
+	messaging_dgm_validate(ctx);
+
+	msglen = iov_buflen(iov, iovlen);
+	if (msglen == -1) {
+		return EMSGSIZE;
+	}
+
+	if ((size_t)msglen >
+	    (MESSAGING_DGM_FRAGMENT_LENGTH - sizeof(cookie))) {
+		/*
+		 * Fragments need a connected socket per destination
+		 */
+		for (i=0; i<num_pids; i++) {
+			errors[i] = messaging_dgm_send(
+				pids[i], iov, iovlen, NULL, 0);
+		}
+		return 0;
+	}
+
+	iov_copy[0].iov_base = &cookie;
+	iov_copy[0].iov_len = sizeof(cookie);
+	if (iovlen > 0) {
+		memcpy(&iov_copy[1], iov, sizeof(struct iovec) * iovlen);
+	}
+
+	sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if (sock == -1) {
+		return errno;
+	}
+
+	ret = set_blocking(sock, false);
+	if (ret == -1) {
+		ret = errno;
+		close(sock);
+		return ret;
+	}
+
+	for (i=0; i<num_pids; i += MESSAGING_DGM_SEND_MANY_BATCH) {
+		size_t num = MIN(num_pids - i, MESSAGING_DGM_SEND_MANY_BATCH);
+
+		DEBUG(10, ("%s: Sending message to %zu processes\n",
+			   __func__, num));
+
+		messaging_dgm_send_batch(ctx, sock, &pids[i], num,
+					 iov_copy, iovlen+1, &errors[i]);
+	}
+
+	close(sock);
+
+	for (i=0; i<num_pids; i++) {
+		if ((errors[i] == EAGAIN) || (errors[i] == ENOBUFS)) {
+			errors[i] = EWOULDBLOCK;
+		}
+	}
+
+	return 0;
+}
+
 static int messaging_dgm_read_unique(int fd, uint64_t *punique)
 {
 	char buf[25];
@@ -548,7 +548,10 @@ struct tevent_req *prefork_listen_send(TALLOC_CTX *mem_ctx,
 		return tevent_req_post(req, ev);
 	}
 
-	/* race on accept */
+	/*
+	 * race on accept, TEVENT_FD_EXCLUSIVE avoids waking up all
+	 * idle children for one connection
+	 */
 	for (i = 0; i < state->listen_fd_size; i++) {
 		ctx = talloc(fde_ctx, struct pf_listen_ctx);
 		if (tevent_req_nomem(ctx, req)) {
@@ -559,7 +562,8 @@ struct tevent_req *prefork_listen_send(TALLOC_CTX *mem_ctx,
 		ctx->listen_fd = state->listen_fds[i];
 
 		fde = tevent_add_fd(state->ev, fde_ctx,
-				    ctx->listen_fd, TEVENT_FD_READ,
+				    ctx->listen_fd,
+				    TEVENT_FD_READ|TEVENT_FD_EXCLUSIVE,
 				    prefork_listen_accept_handler, ctx);
 		if (tevent_req_nomem(fde, req)) {
 			return tevent_req_post(req, ev);
@@ -34,6 +34,26 @@
 #undef DBGC_CLASS
 #define DBGC_CLASS DBGC_VFS
 
+/*
+ * Every attribute is stored in its own record, keyed by the 16 byte
+ * dev/inode followed by the NUL terminated attribute name. Setting
+ * one attribute then doesn't rewrite the others, which matters when
+ * streams, DOS attributes and NT ACLs of a file all live here.
+ *
+ * The names of the attributes of a file are listed in an index record
+ * keyed by the dev/inode followed by a single NUL, in the format
+ * listxattr() returns. An attribute record and the index are changed
+ * together in one transaction: dbwrap doesn't allow holding two record
+ * locks of one database at the same time.
+ *
+ * Databases written by older versions keep all attributes of a file
+ * in one tdb_xattrs record keyed by the plain dev/inode. Such a record
+ * is still read, and is converted the first time the attributes of
+ * the file are changed.
+ */
+
+#define XATTR_TDB_ID_LEN 16
+
 /*
  * unmarshall tdb_xattrs
  */
@@ -72,31 +92,49 @@ static NTSTATUS xattr_tdb_pull_attrs(TALLOC_CTX *mem_ctx,
 }
 
 /*
- * marshall tdb_xattrs
+ * Keys for the three kinds of records
  */
 
-static NTSTATUS xattr_tdb_push_attrs(TALLOC_CTX *mem_ctx,
-				     const struct tdb_xattrs *attribs,
-				     TDB_DATA *data)
+static TDB_DATA xattr_tdb_legacy_key(uint8_t buf[XATTR_TDB_ID_LEN],
+				     const struct file_id *id)
 {
-	DATA_BLOB blob;
-	enum ndr_err_code ndr_err;
+	/* For backwards compatibility only store the dev/inode. */
+	push_file_id_16((char *)buf, id);
+	return make_tdb_data(buf, XATTR_TDB_ID_LEN);
+}
 
-	ndr_err = ndr_push_struct_blob(&blob, mem_ctx, attribs,
-		(ndr_push_flags_fn_t)ndr_push_tdb_xattrs);
+static TDB_DATA xattr_tdb_index_key(uint8_t buf[XATTR_TDB_ID_LEN + 1],
+				    const struct file_id *id)
+{
+	push_file_id_16((char *)buf, id);
+	buf[XATTR_TDB_ID_LEN] = '\0';
+	return make_tdb_data(buf, XATTR_TDB_ID_LEN + 1);
+}
 
-	if (!NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
-		DEBUG(0, ("ndr_push_tdb_xattrs failed: %s\n",
-			  ndr_errstr(ndr_err)));
-		return ndr_map_error2ntstatus(ndr_err);
+static TDB_DATA xattr_tdb_attr_key(TALLOC_CTX *mem_ctx,
+				   const struct file_id *id,
+				   const char *name)
+{
+	size_t namelen = strlen(name) + 1;
+	uint8_t *buf = NULL;
+
+	if (namelen == 1) {
+		/* This would be the index key */
+		return tdb_null;
 	}
 
-	*data = make_tdb_data(blob.data, blob.length);
-	return NT_STATUS_OK;
+	buf = talloc_array(mem_ctx, uint8_t, XATTR_TDB_ID_LEN + namelen);
+	if (buf == NULL) {
+		return tdb_null;
+	}
+	push_file_id_16((char *)buf, id);
+	memcpy(buf + XATTR_TDB_ID_LEN, name, namelen);
+
+	return make_tdb_data(buf, XATTR_TDB_ID_LEN + namelen);
 }
 
 /*
- * Load tdb_xattrs for a file from the tdb
+ * Load the legacy tdb_xattrs record for a file
  */
 
 static NTSTATUS xattr_tdb_load_attrs(TALLOC_CTX *mem_ctx,
@@ -104,15 +142,12 @@ static NTSTATUS xattr_tdb_load_attrs(TALLOC_CTX *mem_ctx,
 				     const struct file_id *id,
 				     struct tdb_xattrs **presult)
 {
-	uint8_t id_buf[16];
+	uint8_t id_buf[XATTR_TDB_ID_LEN];
 	NTSTATUS status;
 	TDB_DATA data;
 
-	/* For backwards compatibility only store the dev/inode. */
-	push_file_id_16((char *)id_buf, id);
-
 	status = dbwrap_fetch(db_ctx, mem_ctx,
-			      make_tdb_data(id_buf, sizeof(id_buf)),
+			      xattr_tdb_legacy_key(id_buf, id),
 			      &data);
 	if (!NT_STATUS_IS_OK(status)) {
 		if (NT_STATUS_EQUAL(status, NT_STATUS_NOT_FOUND)) {
@@ -127,43 +162,192 @@ static NTSTATUS xattr_tdb_load_attrs(TALLOC_CTX *mem_ctx,
 }
 
 /*
- * fetch_lock the tdb_ea record for a file
+ * Helpers for the list of names in the index record
  */
 
-static struct db_record *xattr_tdb_lock_attrs(TALLOC_CTX *mem_ctx,
-					      struct db_context *db_ctx,
-					      const struct file_id *id)
+static bool xattr_tdb_index_find(const DATA_BLOB *names, const char *name,
+				 size_t *pofs)
 {
-	uint8_t id_buf[16];
+	size_t ofs = 0;
 
-	/* For backwards compatibility only store the dev/inode. */
-	push_file_id_16((char *)id_buf, id);
-	return dbwrap_fetch_locked(db_ctx, mem_ctx,
-				   make_tdb_data(id_buf, sizeof(id_buf)));
+	while (ofs < names->length) {
+		const char *n = (const char *)names->data + ofs;
+		size_t len = strnlen(n, names->length - ofs);
+
+		if ((ofs + len < names->length) && (strcmp(n, name) == 0)) {
+			if (pofs != NULL) {
+				*pofs = ofs;
+			}
+			return true;
+		}
+		ofs += len + 1;
+	}
+
+	return false;
+}
+
+static bool xattr_tdb_index_add(TALLOC_CTX *mem_ctx, DATA_BLOB *names,
+				const char *name)
+{
+	size_t len = strlen(name) + 1;
+	uint8_t *tmp = NULL;
+
+	if (names->length + len < names->length) {
+		return false;
+	}
+
+	tmp = talloc_realloc(mem_ctx, names->data, uint8_t,
+			     names->length + len);
+	if (tmp == NULL) {
+		return false;
+	}
+	memcpy(tmp + names->length, name, len);
+
+	names->data = tmp;
+	names->length += len;
+	return true;
+}
+
+static void xattr_tdb_index_del(DATA_BLOB *names, size_t ofs)
+{
+	size_t len = strnlen((const char *)names->data + ofs,
+			     names->length - ofs) + 1;
+
+	len = MIN(len, names->length - ofs);
+
+	memmove(names->data + ofs, names->data + ofs + len,
+		names->length - ofs - len);
+	names->length -= len;
 }
 
 /*
- * Save tdb_xattrs to a previously fetch_locked record
+ * Add a name to or remove it from the index record of a file
  */
 
-static NTSTATUS xattr_tdb_save_attrs(struct db_record *rec,
-				     const struct tdb_xattrs *attribs)
+static NTSTATUS xattr_tdb_update_index(struct db_context *db_ctx,
+				       const struct file_id *id,
+				       const char *name, bool add)
 {
-	TDB_DATA data = tdb_null;
+	uint8_t id_buf[XATTR_TDB_ID_LEN + 1];
+	struct db_record *rec;
+	TDB_DATA value;
+	DATA_BLOB names;
 	NTSTATUS status;
+	size_t ofs;
+	bool found;
+
+	rec = dbwrap_fetch_locked(db_ctx, talloc_tos(),
+				  xattr_tdb_index_key(id_buf, id));
+	if (rec == NULL) {
+		DEBUG(0, ("xattr_tdb_update_index: fetch_lock failed\n"));
+		return NT_STATUS_INTERNAL_DB_CORRUPTION;
+	}
+
+	value = dbwrap_record_get_value(rec);
+	found = xattr_tdb_index_find(
+		&(DATA_BLOB) { .data = value.dptr, .length = value.dsize },
+		name, &ofs);
+
+	if (found == add) {
+		TALLOC_FREE(rec);
+		return NT_STATUS_OK;
+	}
+
+	names = data_blob_talloc(rec, value.dptr, value.dsize);
+	if ((value.dsize != 0) && (names.data == NULL)) {
+		TALLOC_FREE(rec);
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	if (add) {
+		if (!xattr_tdb_index_add(rec, &names, name)) {
+			TALLOC_FREE(rec);
+			return NT_STATUS_NO_MEMORY;
+		}
+		status = dbwrap_record_store(
+			rec, make_tdb_data(names.data, names.length), 0);
+	} else {
+		xattr_tdb_index_del(&names, ofs);
+		if (names.length == 0) {
+			status = dbwrap_record_delete(rec);
+		} else {
+			status = dbwrap_record_store(
+				rec, make_tdb_data(names.data, names.length),
+				0);
+		}
+	}
+
+	TALLOC_FREE(rec);
+	return status;
+}
+
+/*
+ * Convert the legacy record of a file into individual records. This
+ * happens once per file, the caller holds a transaction so that no
+ * other process can see or change the attributes half way through.
+ */
 
-	status = xattr_tdb_push_attrs(talloc_tos(), attribs, &data);
+static NTSTATUS xattr_tdb_migrate(struct db_context *db_ctx,
+				  const struct file_id *id)
+{
+	uint8_t id_buf[XATTR_TDB_ID_LEN + 1];
+	struct tdb_xattrs *attribs = NULL;
+	DATA_BLOB names = data_blob_null;
+	NTSTATUS status;
+	uint32_t i;
+	TALLOC_CTX *frame = talloc_stackframe();
 
+	status = xattr_tdb_load_attrs(frame, db_ctx, id, &attribs);
+	if (NT_STATUS_EQUAL(status, NT_STATUS_NOT_FOUND)) {
+		TALLOC_FREE(frame);
+		return NT_STATUS_OK;
+	}
 	if (!NT_STATUS_IS_OK(status)) {
-		DEBUG(0, ("xattr_tdb_push_attrs failed: %s\n",
-			  nt_errstr(status)));
-		return status;
+		goto fail;
 	}
 
-	status = dbwrap_record_store(rec, data, 0);
+	DBG_DEBUG("Converting %"PRIu32" xattrs of %s\n",
+		  attribs->num_eas, file_id_string_tos(id));
 
-	TALLOC_FREE(data.dptr);
+	for (i=0; i<attribs->num_eas; i++) {
+		const char *name = attribs->eas[i].name;
+		DATA_BLOB *value = &attribs->eas[i].value;
+		TDB_DATA key;
+
+		key = xattr_tdb_attr_key(frame, id, name);
+		if (key.dptr == NULL) {
+			/* An empty name can't be stored, drop it */
+			continue;
+		}
+
+		status = dbwrap_store(db_ctx, key,
+				      make_tdb_data(value->data,
+						    value->length),
+				      0);
+		if (!NT_STATUS_IS_OK(status)) {
+			goto fail;
+		}
+
+		if (!xattr_tdb_index_find(&names, name, NULL) &&
+		    !xattr_tdb_index_add(frame, &names, name)) {
+			status = NT_STATUS_NO_MEMORY;
+			goto fail;
+		}
+	}
 
+	if (names.length != 0) {
+		status = dbwrap_store(db_ctx, xattr_tdb_index_key(id_buf, id),
+				      make_tdb_data(names.data, names.length),
+				      0);
+		if (!NT_STATUS_IS_OK(status)) {
+			goto fail;
+		}
+	}
+
+	status = dbwrap_delete(db_ctx, xattr_tdb_legacy_key(id_buf, id));
+
+fail:
+	TALLOC_FREE(frame);
 	return status;
 }
 
@@ -180,13 +364,46 @@ ssize_t xattr_tdb_getattr(struct db_context *db_ctx,
 	uint32_t i;
 	ssize_t result = -1;
 	NTSTATUS status;
+	TDB_DATA key;
+	TDB_DATA data;
 	TALLOC_CTX *frame = talloc_stackframe();
 
 	DEBUG(10, ("xattr_tdb_getattr called for file %s, name %s\n",
 		   file_id_string(frame, id), name));
 
+	if (name[0] == '\0') {
+		TALLOC_FREE(frame);
+		errno = ENOATTR;
+		return -1;
+	}
+
+	key = xattr_tdb_attr_key(frame, id, name);
+	if (key.dptr == NULL) {
+		TALLOC_FREE(frame);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	status = dbwrap_fetch(db_ctx, mem_ctx, key, &data);
+	if (NT_STATUS_IS_OK(status)) {
+		*blob = data_blob_const(data.dptr, data.dsize);
+		TALLOC_FREE(frame);
+		return data.dsize;
+	}
+	if (!NT_STATUS_EQUAL(status, NT_STATUS_NOT_FOUND)) {
+		DEBUG(10, ("dbwrap_fetch failed: %s\n", nt_errstr(status)));
+		TALLOC_FREE(frame);
+		errno = EINVAL;
+		return -1;
+	}
+
 	status = xattr_tdb_load_attrs(frame, db_ctx, id, &attribs);
 
+	if (NT_STATUS_EQUAL(status, NT_STATUS_NOT_FOUND)) {
+		TALLOC_FREE(frame);
+		errno = ENOATTR;
+		return -1;
+	}
 	if (!NT_STATUS_IS_OK(status)) {
 		DEBUG(10, ("xattr_tdb_fetch_attrs failed: %s\n",
 			   nt_errstr(status)));
@@ -219,88 +436,116 @@ ssize_t xattr_tdb_getattr(struct db_context *db_ctx,
  * Worker routine for setxattr and fsetxattr
  */
 
+struct xattr_tdb_setattr_state {
+	const void *value;
+	size_t size;
+	int flags;
+	bool existed;
+	int err;
+	NTSTATUS status;
+};
+
+static void xattr_tdb_setattr_fn(struct db_record *rec, void *private_data)
+{
+	struct xattr_tdb_setattr_state *state = private_data;
+	TDB_DATA value = dbwrap_record_get_value(rec);
+
+	state->existed = (value.dptr != NULL);
+
+	if (state->existed && (state->flags & XATTR_CREATE)) {
+		state->err = EEXIST;
+		return;
+	}
+	if (!state->existed && (state->flags & XATTR_REPLACE)) {
+		state->err = ENOATTR;
+		return;
+	}
+
+	state->status = dbwrap_record_store(
+		rec,
+		make_tdb_data(discard_const_p(uint8_t, state->value),
+			      state->size),
+		0);
+}
+
 int xattr_tdb_setattr(struct db_context *db_ctx,
 		      const struct file_id *id, const char *name,
 		      const void *value, size_t size, int flags)
 {
+	struct xattr_tdb_setattr_state state = {
+		.value = value, .size = size, .flags = flags,
+	};
 	NTSTATUS status;
-	struct db_record *rec;
-	struct tdb_xattrs *attribs;
-	uint32_t i;
-	TDB_DATA data;
+	TDB_DATA key;
+	int ret;
 	TALLOC_CTX *frame = talloc_stackframe();
 
 	DEBUG(10, ("xattr_tdb_setattr called for file %s, name %s\n",
 		   file_id_string(frame, id), name));
 
-	rec = xattr_tdb_lock_attrs(frame, db_ctx, id);
-
-	if (rec == NULL) {
-		DEBUG(0, ("xattr_tdb_lock_attrs failed\n"));
-		errno = EINVAL;
+	key = xattr_tdb_attr_key(frame, id, name);
+	if (key.dptr == NULL) {
+		TALLOC_FREE(frame);
+		errno = (name[0] == '\0') ? EINVAL : ENOMEM;
 		return -1;
 	}
 
-	data = dbwrap_record_get_value(rec);
-
-	status = xattr_tdb_pull_attrs(rec, &data, &attribs);
-
-	if (!NT_STATUS_IS_OK(status)) {
-		DEBUG(10, ("xattr_tdb_fetch_attrs failed: %s\n",
-			   nt_errstr(status)));
+	ret = dbwrap_transaction_start(db_ctx);
+	if (ret != 0) {
+		DEBUG(1, ("xattr_tdb_setattr: transaction_start failed\n"));
 		TALLOC_FREE(frame);
+		errno = EINVAL;
 		return -1;
 	}
 
-	for (i=0; i<attribs->num_eas; i++) {
-		if (strcmp(attribs->eas[i].name, name) == 0) {
-			if (flags & XATTR_CREATE) {
-				TALLOC_FREE(frame);
-				errno = EEXIST;
-				return -1;
-			}
-			break;
-		}
+	status = xattr_tdb_migrate(db_ctx, id);
+	if (!NT_STATUS_IS_OK(status)) {
+		DEBUG(1, ("xattr_tdb_migrate failed: %s\n",
+			  nt_errstr(status)));
+		state.err = EINVAL;
+		goto cancel;
 	}
 
-	if (i == attribs->num_eas) {
-		struct xattr_EA *tmp;
-
-		if (flags & XATTR_REPLACE) {
-			TALLOC_FREE(frame);
-			errno = ENOATTR;
-			return -1;
-		}
-
-		tmp = talloc_realloc(
-			attribs, attribs->eas, struct xattr_EA,
-			attribs->num_eas+ 1);
+	status = dbwrap_do_locked(db_ctx, key, xattr_tdb_setattr_fn, &state);
+	if (NT_STATUS_IS_OK(status)) {
+		status = state.status;
+	}
+	if (state.err != 0) {
+		goto cancel;
+	}
+	if (!NT_STATUS_IS_OK(status)) {
+		DEBUG(1, ("save failed: %s\n", nt_errstr(status)));
+		state.err = EINVAL;
+		goto cancel;
+	}
 
-		if (tmp == NULL) {
-			DEBUG(0, ("talloc_realloc failed\n"));
-			TALLOC_FREE(frame);
-			errno = ENOMEM;
-			return -1;
+	/* If the attribute existed, the index already lists the name */
+	if (!state.existed) {
+		status = xattr_tdb_update_index(db_ctx, id, name, true);
+		if (!NT_STATUS_IS_OK(status)) {
+			DEBUG(1, ("index update failed: %s\n",
+				  nt_errstr(status)));
+			state.err = EINVAL;
+			goto cancel;
 		}
-
-		attribs->eas = tmp;
-		attribs->num_eas += 1;
 	}
 
-	attribs->eas[i].name = name;
-	attribs->eas[i].value.data = discard_const_p(uint8_t, value);
-	attribs->eas[i].value.length = size;
-
-	status = xattr_tdb_save_attrs(rec, attribs);
-
 	TALLOC_FREE(frame);
 
-	if (!NT_STATUS_IS_OK(status)) {
-		DEBUG(1, ("save failed: %s\n", nt_errstr(status)));
+	ret = dbwrap_transaction_commit(db_ctx);
+	if (ret != 0) {
+		DEBUG(1, ("xattr_tdb_setattr: transaction_commit failed\n"));
+		errno = EINVAL;
 		return -1;
 	}
 
 	return 0;
+
+cancel:
+	TALLOC_FREE(frame);
+	dbwrap_transaction_cancel(db_ctx);
+	errno = state.err;
+	return -1;
 }
 
 /*
@@ -311,12 +556,42 @@ ssize_t xattr_tdb_listattr(struct db_context *db_ctx,
 			   const struct file_id *id, char *list,
 			   size_t size)
 {
+	uint8_t id_buf[XATTR_TDB_ID_LEN + 1];
 	NTSTATUS status;
 	struct tdb_xattrs *attribs;
 	uint32_t i;
 	size_t len = 0;
+	TDB_DATA names;
 	TALLOC_CTX *frame = talloc_stackframe();
 
+	status = dbwrap_fetch(db_ctx, frame,
+			      xattr_tdb_index_key(id_buf, id),
+			      &names);
+	if (NT_STATUS_IS_OK(status)) {
+		size_t ofs = 0;
+
+		/* Only hand out complete, NUL terminated names */
+		while (ofs < names.dsize) {
+			size_t namelen = strnlen((char *)names.dptr + ofs,
+						 names.dsize - ofs);
+
+			if (ofs + namelen == names.dsize) {
+				break;
+			}
+			ofs += namelen + 1;
+		}
+		len = ofs;
+
+		if (len > size) {
+			TALLOC_FREE(frame);
+			errno = ERANGE;
+			return len;
+		}
+		memcpy(list, names.dptr, len);
+		TALLOC_FREE(frame);
+		return len;
+	}
+
 	status = xattr_tdb_load_attrs(frame, db_ctx, id, &attribs);
 
 	if (!NT_STATUS_IS_OK(status) &&
@@ -383,66 +658,94 @@ ssize_t xattr_tdb_listattr(struct db_context *db_ctx,
  * Worker routine for removexattr and fremovexattr
  */
 
+struct xattr_tdb_removeattr_state {
+	int err;
+	NTSTATUS status;
+};
+
+static void xattr_tdb_removeattr_fn(struct db_record *rec,
+				    void *private_data)
+{
+	struct xattr_tdb_removeattr_state *state = private_data;
+	TDB_DATA value = dbwrap_record_get_value(rec);
+
+	if (value.dptr == NULL) {
+		state->err = ENOATTR;
+		return;
+	}
+
+	state->status = dbwrap_record_delete(rec);
+}
+
 int xattr_tdb_removeattr(struct db_context *db_ctx,
 			 const struct file_id *id, const char *name)
 {
+	struct xattr_tdb_removeattr_state state = { .err = 0 };
 	NTSTATUS status;
-	struct db_record *rec;
-	struct tdb_xattrs *attribs;
-	uint32_t i;
-	TDB_DATA value;
+	TDB_DATA key;
+	int ret;
+	TALLOC_CTX *frame = talloc_stackframe();
 
-	rec = xattr_tdb_lock_attrs(talloc_tos(), db_ctx, id);
+	key = xattr_tdb_attr_key(frame, id, name);
+	if (key.dptr == NULL) {
+		TALLOC_FREE(frame);
+		errno = (name[0] == '\0') ? ENOATTR : ENOMEM;
+		return -1;
+	}
 
-	if (rec == NULL) {
-		DEBUG(0, ("xattr_tdb_lock_attrs failed\n"));
+	ret = dbwrap_transaction_start(db_ctx);
+	if (ret != 0) {
+		DEBUG(1, ("xattr_tdb_removeattr: transaction_start failed\n"));
+		TALLOC_FREE(frame);
 		errno = EINVAL;
 		return -1;
 	}
 
-	value = dbwrap_record_get_value(rec);
-
-	status = xattr_tdb_pull_attrs(rec, &value, &attribs);
-
+	status = xattr_tdb_migrate(db_ctx, id);
 	if (!NT_STATUS_IS_OK(status)) {
-		DEBUG(10, ("xattr_tdb_fetch_attrs failed: %s\n",
-			   nt_errstr(status)));
-		TALLOC_FREE(rec);
-		return -1;
+		DEBUG(1, ("xattr_tdb_migrate failed: %s\n",
+			  nt_errstr(status)));
+		state.err = EINVAL;
+		goto cancel;
 	}
 
-	for (i=0; i<attribs->num_eas; i++) {
-		if (strcmp(attribs->eas[i].name, name) == 0) {
-			break;
-		}
+	status = dbwrap_do_locked(db_ctx, key, xattr_tdb_removeattr_fn,
+				  &state);
+	if (NT_STATUS_IS_OK(status)) {
+		status = state.status;
 	}
-
-	if (i == attribs->num_eas) {
-		TALLOC_FREE(rec);
-		errno = ENOATTR;
-		return -1;
+	if (state.err != 0) {
+		goto cancel;
 	}
-
-	attribs->eas[i] =
-		attribs->eas[attribs->num_eas-1];
-	attribs->num_eas -= 1;
-
-	if (attribs->num_eas == 0) {
-		dbwrap_record_delete(rec);
-		TALLOC_FREE(rec);
-		return 0;
+	if (!NT_STATUS_IS_OK(status)) {
+		DEBUG(1, ("delete failed: %s\n", nt_errstr(status)));
+		state.err = EINVAL;
+		goto cancel;
 	}
 
-	status = xattr_tdb_save_attrs(rec, attribs);
+	status = xattr_tdb_update_index(db_ctx, id, name, false);
+	if (!NT_STATUS_IS_OK(status)) {
+		DEBUG(1, ("index update failed: %s\n", nt_errstr(status)));
+		state.err = EINVAL;
+		goto cancel;
+	}
 
-	TALLOC_FREE(rec);
+	TALLOC_FREE(frame);
 
-	if (!NT_STATUS_IS_OK(status)) {
-		DEBUG(1, ("save failed: %s\n", nt_errstr(status)));
+	ret = dbwrap_transaction_commit(db_ctx);
+	if (ret != 0) {
+		DEBUG(1, ("xattr_tdb_removeattr: transaction_commit failed\n"));
+		errno = EINVAL;
 		return -1;
 	}
 
 	return 0;
+
+cancel:
+	TALLOC_FREE(frame);
+	dbwrap_transaction_cancel(db_ctx);
+	errno = state.err;
+	return -1;
 }
 
 /*
@@ -452,15 +755,74 @@ int xattr_tdb_removeattr(struct db_context *db_ctx,
 void xattr_tdb_remove_all_attrs(struct db_context *db_ctx,
 			       const struct file_id *id)
 {
+	uint8_t id_buf[XATTR_TDB_ID_LEN + 1];
 	struct db_record *rec;
-	rec = xattr_tdb_lock_attrs(talloc_tos(), db_ctx, id);
+	TDB_DATA value;
+	TDB_DATA names;
+	size_t ofs = 0;
+	int ret;
+	TALLOC_CTX *frame = NULL;
+
+	ret = dbwrap_transaction_start(db_ctx);
+	if (ret != 0) {
+		DEBUG(1, ("xattr_tdb_remove_all_attrs: "
+			  "transaction_start failed\n"));
+		return;
+	}
+
+	frame = talloc_stackframe();
+
+	rec = dbwrap_fetch_locked(db_ctx, frame,
+				  xattr_tdb_index_key(id_buf, id));
 
 	/*
 	 * If rec == NULL there's not much we can do about it
 	 */
 
-	if (rec != NULL) {
+	if (rec == NULL) {
+		TALLOC_FREE(frame);
+		dbwrap_transaction_cancel(db_ctx);
+		return;
+	}
+
+	value = dbwrap_record_get_value(rec);
+	names = (TDB_DATA) {
+		.dptr = talloc_memdup(frame, value.dptr, value.dsize),
+		.dsize = value.dsize,
+	};
+	if (names.dptr == NULL) {
+		names.dsize = 0;
+	}
+
+	if (value.dptr != NULL) {
 		dbwrap_record_delete(rec);
-		TALLOC_FREE(rec);
+	}
+	TALLOC_FREE(rec);
+
+	while (ofs < names.dsize) {
+		const char *name = (const char *)names.dptr + ofs;
+		size_t len = strnlen(name, names.dsize - ofs);
+		TDB_DATA key;
+
+		if (ofs + len == names.dsize) {
+			/* not NUL terminated */
+			break;
+		}
+		ofs += len + 1;
+
+		key = xattr_tdb_attr_key(frame, id, name);
+		if (key.dptr != NULL) {
+			dbwrap_delete(db_ctx, key);
+		}
+	}
+
+	dbwrap_delete(db_ctx, xattr_tdb_legacy_key(id_buf, id));
+
+	TALLOC_FREE(frame);
+
+	ret = dbwrap_transaction_commit(db_ctx);
+	if (ret != 0) {
+		DEBUG(1, ("xattr_tdb_remove_all_attrs: "
+			  "transaction_commit failed\n"));
 	}
 }
@@ -620,6 +620,18 @@ NTSTATUS cli_smb2_delete_on_close(struct cli_state *cli, uint16_t fnum, bool fla
 	return status;
 }
 
+static NTSTATUS cli_smb2_compound_path_once(struct cli_state *cli,
+				TALLOC_CTX *mem_ctx,
+				const char *name,
+				uint32_t desired_access,
+				uint32_t file_attributes,
+				uint32_t create_options,
+				uint8_t in_info_type,
+				uint8_t in_file_info_class,
+				const DATA_BLOB *in_set_data,
+				DATA_BLOB *out_data,
+				struct smb_create_returns *cr);
+
 /***************************************************************
  Small wrapper that allows SMB2 to create a directory
  Synchronous only.
@@ -667,7 +679,8 @@ NTSTATUS cli_smb2_mkdir(struct cli_state *cli, const char *dname)
 NTSTATUS cli_smb2_rmdir(struct cli_state *cli, const char *dname)
 {
 	NTSTATUS status;
-	uint16_t fnum;
+	uint8_t disposition = 1;
+	DATA_BLOB inbuf = data_blob_const(&disposition, 1);
 
 	if (smbXcli_conn_has_async_calls(cli->conn)) {
 		/*
@@ -680,16 +693,21 @@ NTSTATUS cli_smb2_rmdir(struct cli_state *cli, const char *dname)
 		return NT_STATUS_INVALID_PARAMETER;
 	}
 
-	status = cli_smb2_create_fnum(cli,
+	/*
+	 * setinfo on the opened handle with info_type SMB2_SETINFO_FILE (1),
+	 * level 13 (SMB_FILE_DISPOSITION_INFORMATION - 1000), chained
+	 * between the create and the close.
+	 */
+	status = cli_smb2_compound_path_once(cli,
+			talloc_tos(),
 			dname,
-			0,			/* create_flags */
-			SMB2_IMPERSONATION_IMPERSONATION,
 			DELETE_ACCESS,		/* desired_access */
 			FILE_ATTRIBUTE_DIRECTORY, /* file attributes */
-			FILE_SHARE_READ|FILE_SHARE_WRITE|FILE_SHARE_DELETE, /* share_access */
-			FILE_OPEN,		/* create_disposition */
 			FILE_DIRECTORY_FILE,	/* create_options */
-			&fnum,
+			1,			/* in_info_type */
+			SMB_FILE_DISPOSITION_INFORMATION - 1000,
+			&inbuf,			/* in_set_data */
+			NULL,			/* out_data */
 			NULL);
 
 	if (NT_STATUS_EQUAL(status, NT_STATUS_STOPPED_ON_SYMLINK)) {
@@ -699,32 +717,22 @@ NTSTATUS cli_smb2_rmdir(struct cli_state *cli, const char *dname)
 		 * component and try again. Eventually we will have to
 		 * deal with the returned path unprocessed component. JRA.
 		 */
-		status = cli_smb2_create_fnum(cli,
+		status = cli_smb2_compound_path_once(cli,
+			talloc_tos(),
 			dname,
-			0,			/* create_flags */
-			SMB2_IMPERSONATION_IMPERSONATION,
 			DELETE_ACCESS,		/* desired_access */
 			FILE_ATTRIBUTE_DIRECTORY, /* file attributes */
-			FILE_SHARE_READ|FILE_SHARE_WRITE|FILE_SHARE_DELETE, /* share_access */
-			FILE_OPEN,		/* create_disposition */
 			FILE_DIRECTORY_FILE|
 				FILE_DELETE_ON_CLOSE|
 				FILE_OPEN_REPARSE_POINT, /* create_options */
-			&fnum,
+			1,			/* in_info_type */
+			SMB_FILE_DISPOSITION_INFORMATION - 1000,
+			&inbuf,			/* in_set_data */
+			NULL,			/* out_data */
 			NULL);
 	}
 
-	if (!NT_STATUS_IS_OK(status)) {
-		return status;
-	}
-
-	status = cli_smb2_delete_on_close(cli, fnum, true);
-	if (!NT_STATUS_IS_OK(status)) {
-		cli_smb2_close_fnum(cli, fnum);
-		return status;
-	}
-
-	return cli_smb2_close_fnum(cli, fnum);
+	return status;
 }
 
 /***************************************************************
@@ -735,7 +743,6 @@ NTSTATUS cli_smb2_rmdir(struct cli_state *cli, const char *dname)
 NTSTATUS cli_smb2_unlink(struct cli_state *cli, const char *fname)
 {
 	NTSTATUS status;
-	uint16_t fnum;
 
 	if (smbXcli_conn_has_async_calls(cli->conn)) {
 		/*
@@ -748,16 +755,17 @@ NTSTATUS cli_smb2_unlink(struct cli_state *cli, const char *fname)
 		return NT_STATUS_INVALID_PARAMETER;
 	}
 
-	status = cli_smb2_create_fnum(cli,
+	/* The create and the close go out as one compound chain */
+	status = cli_smb2_compound_path_once(cli,
+			talloc_tos(),
 			fname,
-			0,			/* create_flags */
-			SMB2_IMPERSONATION_IMPERSONATION,
 			DELETE_ACCESS,		/* desired_access */
 			FILE_ATTRIBUTE_NORMAL, /* file attributes */
-			FILE_SHARE_READ|FILE_SHARE_WRITE|FILE_SHARE_DELETE, /* share_access */
-			FILE_OPEN,		/* create_disposition */
 			FILE_DELETE_ON_CLOSE,	/* create_options */
-			&fnum,
+			0,			/* in_info_type */
+			0,			/* in_file_info_class */
+			NULL,			/* in_set_data */
+			NULL,			/* out_data */
 			NULL);
 
 	if (NT_STATUS_EQUAL(status, NT_STATUS_STOPPED_ON_SYMLINK)) {
@@ -767,24 +775,21 @@ NTSTATUS cli_smb2_unlink(struct cli_state *cli, const char *fname)
 		 * component and try again. Eventually we will have to
 		 * deal with the returned path unprocessed component. JRA.
 		 */
-		status = cli_smb2_create_fnum(cli,
+		status = cli_smb2_compound_path_once(cli,
+			talloc_tos(),
 			fname,
-			0,			/* create_flags */
-			SMB2_IMPERSONATION_IMPERSONATION,
 			DELETE_ACCESS,		/* desired_access */
 			FILE_ATTRIBUTE_NORMAL, /* file attributes */
-			FILE_SHARE_READ|FILE_SHARE_WRITE|FILE_SHARE_DELETE, /* share_access */
-			FILE_OPEN,		/* create_disposition */
 			FILE_DELETE_ON_CLOSE|
 				FILE_OPEN_REPARSE_POINT, /* create_options */
-			&fnum,
+			0,			/* in_info_type */
+			0,			/* in_file_info_class */
+			NULL,			/* in_set_data */
+			NULL,			/* out_data */
 			NULL);
 	}
 
-	if (!NT_STATUS_IS_OK(status)) {
-		return status;
-	}
-	return cli_smb2_close_fnum(cli, fnum);
+	return status;
 }
 
 /***************************************************************
@@ -1229,7 +1234,8 @@ NTSTATUS cli_smb2_chkpath(struct cli_state *cli,
 static NTSTATUS get_fnum_from_path(struct cli_state *cli,
 				const char *name,
 				uint32_t desired_access,
-				uint16_t *pfnum)
+				uint16_t *pfnum,
+				struct smb_create_returns *cr)
 {
 	NTSTATUS status;
 	size_t namelen = strlen(name);
@@ -1259,7 +1265,7 @@ static NTSTATUS get_fnum_from_path(struct cli_state *cli,
 			FILE_OPEN,		/* create_disposition */
 			create_options,
 			pfnum,
-			NULL);
+			cr);
 
 	if (NT_STATUS_EQUAL(status, NT_STATUS_STOPPED_ON_SYMLINK)) {
 		/*
@@ -1279,7 +1285,7 @@ static NTSTATUS get_fnum_from_path(struct cli_state *cli,
 			FILE_OPEN,		/* create_disposition */
 			create_options,
 			pfnum,
-			NULL);
+			cr);
 	}
 
 	if (NT_STATUS_EQUAL(status, NT_STATUS_FILE_IS_A_DIRECTORY)) {
@@ -1294,7 +1300,7 @@ static NTSTATUS get_fnum_from_path(struct cli_state *cli,
 			FILE_OPEN,		/* create_disposition */
 			FILE_DIRECTORY_FILE,	/* create_options */
 			pfnum,
-			NULL);
+			cr);
 	}
 
   fail:
@@ -1303,6 +1309,293 @@ static NTSTATUS get_fnum_from_path(struct cli_state *cli,
 	return status;
 }
 
+/***************************************************************
+ Utility function to parse a SMB2_FILE_ALL_INFORMATION reply.
+***************************************************************/
+
+static NTSTATUS parse_file_all_information(const DATA_BLOB *outbuf,
+			uint16_t *mode,
+			off_t *size,
+			struct timespec *create_time,
+			struct timespec *access_time,
+			struct timespec *write_time,
+			struct timespec *change_time,
+			SMB_INO_T *ino)
+{
+	if (outbuf->length < 0x60) {
+		return NT_STATUS_INVALID_NETWORK_RESPONSE;
+	}
+
+	if (create_time) {
+		*create_time = interpret_long_date((const char *)outbuf->data + 0x0);
+	}
+	if (access_time) {
+		*access_time = interpret_long_date((const char *)outbuf->data + 0x8);
+	}
+	if (write_time) {
+		*write_time = interpret_long_date((const char *)outbuf->data + 0x10);
+	}
+	if (change_time) {
+		*change_time = interpret_long_date((const char *)outbuf->data + 0x18);
+	}
+	if (mode) {
+		uint32_t attr = IVAL(outbuf->data, 0x20);
+		*mode = (uint16_t)attr;
+	}
+	if (size) {
+		uint64_t file_size = BVAL(outbuf->data, 0x30);
+		*size = (off_t)file_size;
+	}
+	if (ino) {
+		uint64_t file_index = BVAL(outbuf->data, 0x40);
+		*ino = (SMB_INO_T)file_index;
+	}
+
+	return NT_STATUS_OK;
+}
+
+/***************************************************************
+ Helper function for pathname operations that need at most one
+ query or set info on the handle. The create, the info request
+ and the close go out as one related compound chain, so this
+ costs a single round trip.
+
+ Without an in_info_type this is just create and close, with
+ in_set_data a set info, otherwise a query info into out_data.
+***************************************************************/
+
+static NTSTATUS cli_smb2_compound_path_once(struct cli_state *cli,
+				TALLOC_CTX *mem_ctx,
+				const char *name,
+				uint32_t desired_access,
+				uint32_t file_attributes,
+				uint32_t create_options,
+				uint8_t in_info_type,
+				uint8_t in_file_info_class,
+				const DATA_BLOB *in_set_data,
+				DATA_BLOB *out_data,
+				struct smb_create_returns *cr)
+{
+	TALLOC_CTX *frame = talloc_stackframe();
+	struct tevent_context *ev = NULL;
+	struct tevent_req *create_req = NULL;
+	struct tevent_req *info_req = NULL;
+	struct tevent_req *close_req = NULL;
+	struct smb2_hnd *ph = NULL;
+	uint16_t fnum = 0xffff;
+	NTSTATUS status = NT_STATUS_NO_MEMORY;
+	NTSTATUS info_status = NT_STATUS_OK;
+	NTSTATUS close_status;
+
+	ev = samba_tevent_context_init(frame);
+	if (ev == NULL) {
+		goto fail;
+	}
+
+	status = smb2cli_conn_compound_start(cli->conn,
+					     in_info_type != 0 ? 3 : 2,
+					     true);
+	if (!NT_STATUS_IS_OK(status)) {
+		goto fail;
+	}
+
+	create_req = cli_smb2_create_fnum_send(frame,
+			ev,
+			cli,
+			name,
+			0,			/* create_flags */
+			SMB2_IMPERSONATION_IMPERSONATION,
+			desired_access,
+			file_attributes,
+			FILE_SHARE_READ|FILE_SHARE_WRITE|FILE_SHARE_DELETE, /* share_access */
+			FILE_OPEN,		/* create_disposition */
+			create_options);
+
+	/*
+	 * Stop adding to the chain as soon as a request fails without
+	 * being collected, the related requests refer to the handle
+	 * with UINT64_MAX.
+	 */
+	if (create_req == NULL || !tevent_req_is_in_progress(create_req)) {
+		goto cancel;
+	}
+
+	if (in_set_data != NULL) {
+		info_req = smb2cli_set_info_send(frame,
+					ev,
+					cli->conn,
+					cli->timeout,
+					cli->smb2.session,
+					cli->smb2.tcon,
+					in_info_type,
+					in_file_info_class,
+					in_set_data, /* in_input_buffer */
+					0, /* in_additional_info */
+					UINT64_MAX, /* fid_persistent */
+					UINT64_MAX); /* fid_volatile */
+	} else if (in_info_type != 0) {
+		info_req = smb2cli_query_info_send(frame,
+					ev,
+					cli->conn,
+					cli->timeout,
+					cli->smb2.session,
+					cli->smb2.tcon,
+					in_info_type,
+					in_file_info_class,
+					0xFFFF, /* in_max_output_length */
+					NULL, /* in_input_buffer */
+					0, /* in_additional_info */
+					0, /* in_flags */
+					UINT64_MAX, /* fid_persistent */
+					UINT64_MAX); /* fid_volatile */
+	}
+
+	if (in_info_type != 0 &&
+	    (info_req == NULL || !tevent_req_is_in_progress(info_req))) {
+		goto cancel;
+	}
+
+	close_req = smb2cli_close_send(frame,
+				ev,
+				cli->conn,
+				cli->timeout,
+				cli->smb2.session,
+				cli->smb2.tcon,
+				0, /* flags */
+				UINT64_MAX, /* fid_persistent */
+				UINT64_MAX); /* fid_volatile */
+
+  cancel:
+
+	/*
+	 * If one of the requests could not be created the chain was
+	 * never sent, this lets the ones already created fail.
+	 */
+	smb2cli_conn_compound_cancel(cli->conn);
+
+	if (close_req == NULL) {
+		status = NT_STATUS_NO_MEMORY;
+		if (create_req != NULL &&
+		    !tevent_req_is_in_progress(create_req)) {
+			status = cli_smb2_create_fnum_recv(create_req,
+							   &fnum,
+							   NULL);
+		}
+		goto fail;
+	}
+
+	if (!tevent_req_poll_ntstatus(close_req, ev, &status)) {
+		goto fail;
+	}
+	if (!tevent_req_poll_ntstatus(create_req, ev, &status)) {
+		goto fail;
+	}
+	if (info_req != NULL &&
+	    !tevent_req_poll_ntstatus(info_req, ev, &status)) {
+		goto fail;
+	}
+
+	status = cli_smb2_create_fnum_recv(create_req, &fnum, cr);
+	if (in_set_data != NULL) {
+		info_status = smb2cli_set_info_recv(info_req);
+	} else if (info_req != NULL) {
+		info_status = smb2cli_query_info_recv(info_req,
+						      mem_ctx,
+						      out_data);
+	}
+	close_status = smb2cli_close_recv(close_req);
+
+	if (NT_STATUS_IS_OK(status)) {
+		if (!NT_STATUS_IS_OK(info_status)) {
+			status = info_status;
+		} else {
+			status = close_status;
+		}
+	}
+
+  fail:
+
+	if (fnum != 0xffff) {
+		/* The chained close already got rid of the handle */
+		if (NT_STATUS_IS_OK(map_fnum_to_smb2_handle(cli,
+							    fnum,
+							    &ph))) {
+			delete_smb2_handle_mapping(cli, &ph, fnum);
+		}
+	}
+
+	TALLOC_FREE(frame);
+	return status;
+}
+
+/***************************************************************
+ Compound version of get_fnum_from_path() followed by a single
+ info request and close. See cli_smb2_compound_path_once().
+***************************************************************/
+
+static NTSTATUS cli_smb2_compound_path(struct cli_state *cli,
+				TALLOC_CTX *mem_ctx,
+				const char *name,
+				uint32_t desired_access,
+				uint32_t create_options,
+				uint8_t in_info_type,
+				uint8_t in_file_info_class,
+				const DATA_BLOB *in_set_data,
+				DATA_BLOB *out_data,
+				struct smb_create_returns *cr)
+{
+	NTSTATUS status;
+
+	status = cli_smb2_compound_path_once(cli,
+				mem_ctx,
+				name,
+				desired_access,
+				0, /* file attributes */
+				create_options,
+				in_info_type,
+				in_file_info_class,
+				in_set_data,
+				out_data,
+				cr);
+
+	if (NT_STATUS_EQUAL(status, NT_STATUS_STOPPED_ON_SYMLINK)) {
+		/*
+		 * Naive option to match our SMB1 code. Assume the
+		 * symlink path that tripped us up was the last
+		 * component and try again, as get_fnum_from_path()
+		 * does.
+		 */
+		create_options |= FILE_OPEN_REPARSE_POINT;
+		status = cli_smb2_compound_path_once(cli,
+				mem_ctx,
+				name,
+				desired_access,
+				0, /* file attributes */
+				create_options,
+				in_info_type,
+				in_file_info_class,
+				in_set_data,
+				out_data,
+				cr);
+	}
+
+	if (NT_STATUS_EQUAL(status, NT_STATUS_FILE_IS_A_DIRECTORY)) {
+		status = cli_smb2_compound_path_once(cli,
+				mem_ctx,
+				name,
+				desired_access,
+				FILE_ATTRIBUTE_DIRECTORY, /* file attributes */
+				FILE_DIRECTORY_FILE, /* create_options */
+				in_info_type,
+				in_file_info_class,
+				in_set_data,
+				out_data,
+				cr);
+	}
+
+	return status;
+}
+
 /***************************************************************
  Wrapper that allows SMB2 to query a path info (ALTNAME level).
  Synchronous only.
@@ -1335,7 +1628,8 @@ NTSTATUS cli_smb2_qpathinfo_alt_name(struct cli_state *cli,
 	status = get_fnum_from_path(cli,
 				name,
 				FILE_READ_ATTRIBUTES,
-				&fnum);
+				&fnum,
+				NULL);
 
 	if (!NT_STATUS_IS_OK(status)) {
 		goto fail;
@@ -1479,36 +1773,14 @@ NTSTATUS cli_smb2_qfileinfo_basic(struct cli_state *cli,
 		goto fail;
 	}
 
-	/* Parse the reply. */
-	if (outbuf.length < 0x60) {
-		status = NT_STATUS_INVALID_NETWORK_RESPONSE;
-		goto fail;
-	}
-
-	if (create_time) {
-		*create_time = interpret_long_date((const char *)outbuf.data + 0x0);
-	}
-	if (access_time) {
-		*access_time = interpret_long_date((const char *)outbuf.data + 0x8);
-	}
-	if (write_time) {
-		*write_time = interpret_long_date((const char *)outbuf.data + 0x10);
-	}
-	if (change_time) {
-		*change_time = interpret_long_date((const char *)outbuf.data + 0x18);
-	}
-	if (mode) {
-		uint32_t attr = IVAL(outbuf.data, 0x20);
-		*mode = (uint16_t)attr;
-	}
-	if (size) {
-		uint64_t file_size = BVAL(outbuf.data, 0x30);
-		*size = (off_t)file_size;
-	}
-	if (ino) {
-		uint64_t file_index = BVAL(outbuf.data, 0x40);
-		*ino = (SMB_INO_T)file_index;
-	}
+	status = parse_file_all_information(&outbuf,
+					mode,
+					size,
+					create_time,
+					access_time,
+					write_time,
+					change_time,
+					ino);
 
   fail:
 
@@ -1563,6 +1835,21 @@ NTSTATUS cli_smb2_getattrE(struct cli_state *cli,
 	return NT_STATUS_OK;
 }
 
+/*
+ * Convert a time from a create response the same way
+ * interpret_long_date() does for the query info replies.
+ */
+static struct timespec cli_smb2_create_time(NTTIME nt)
+{
+	if (nt == (uint64_t)-1) {
+		struct timespec ret;
+		ret.tv_sec = (time_t)-1;
+		ret.tv_nsec = 0;
+		return ret;
+	}
+	return nt_time_to_unix_timespec(nt);
+}
+
 /***************************************************************
  Wrapper that allows SMB2 to get pathname attributes.
  Synchronous only.
@@ -1575,8 +1862,7 @@ NTSTATUS cli_smb2_getatr(struct cli_state *cli,
 			time_t *write_time)
 {
 	NTSTATUS status;
-	uint16_t fnum = 0xffff;
-	struct smb2_hnd *ph = NULL;
+	struct smb_create_returns cr;
 	TALLOC_CTX *frame = talloc_stackframe();
 
 	if (smbXcli_conn_has_async_calls(cli->conn)) {
@@ -1592,38 +1878,38 @@ NTSTATUS cli_smb2_getatr(struct cli_state *cli,
 		goto fail;
 	}
 
-	status = get_fnum_from_path(cli,
+	/*
+	 * The create response already carries everything we need,
+	 * no need for another round trip to query the handle.
+	 */
+	status = cli_smb2_compound_path(cli,
+				frame,
 				name,
 				FILE_READ_ATTRIBUTES,
-				&fnum);
+				0, /* create_options */
+				0, /* in_info_type */
+				0, /* in_file_info_class */
+				NULL, /* in_set_data */
+				NULL, /* out_data */
+				&cr);
 
 	if (!NT_STATUS_IS_OK(status)) {
 		goto fail;
 	}
 
-	status = map_fnum_to_smb2_handle(cli,
-					fnum,
-					&ph);
-	if (!NT_STATUS_IS_OK(status)) {
-		goto fail;
+	if (attr) {
+		*attr = (uint16_t)cr.file_attributes;
 	}
-	status = cli_smb2_getattrE(cli,
-				fnum,
-				attr,
-				size,
-				NULL,
-				NULL,
-				write_time);
-	if (!NT_STATUS_IS_OK(status)) {
-		goto fail;
+	if (size) {
+		*size = (off_t)cr.end_of_file;
+	}
+	if (write_time) {
+		struct timespec ts = cli_smb2_create_time(cr.last_write_time);
+		*write_time = ts.tv_sec;
 	}
 
   fail:
 
-	if (fnum != 0xffff) {
-		cli_smb2_close_fnum(cli, fnum);
-	}
-
 	cli->raw_status = status;
 
 	TALLOC_FREE(frame);
@@ -1632,7 +1918,7 @@ NTSTATUS cli_smb2_getatr(struct cli_state *cli,
 
 /***************************************************************
  Wrapper that allows SMB2 to query a pathname info (basic level).
- Implement on top of cli_smb2_qfileinfo_basic().
+ Uses a single compound create/getinfo/close.
  Synchronous only.
 ***************************************************************/
 
@@ -1647,8 +1933,8 @@ NTSTATUS cli_smb2_qpathinfo2(struct cli_state *cli,
 			SMB_INO_T *ino)
 {
 	NTSTATUS status;
-	struct smb2_hnd *ph = NULL;
-	uint16_t fnum = 0xffff;
+	DATA_BLOB outbuf = data_blob_null;
+	struct smb_create_returns cr;
 	TALLOC_CTX *frame = talloc_stackframe();
 
 	if (smbXcli_conn_has_async_calls(cli->conn)) {
@@ -1664,24 +1950,28 @@ NTSTATUS cli_smb2_qpathinfo2(struct cli_state *cli,
 		goto fail;
 	}
 
-	status = get_fnum_from_path(cli,
+	if (ino != NULL) {
+		/*
+		 * Only the file index needs a query on the handle.
+		 * getinfo with info_type SMB2_GETINFO_FILE (1), level
+		 * SMB2_FILE_ALL_INFORMATION, chained between the create
+		 * and the close.
+		 */
+		status = cli_smb2_compound_path(cli,
+					frame,
 					name,
 					FILE_READ_ATTRIBUTES,
-					&fnum);
-
-	if (!NT_STATUS_IS_OK(status)) {
-		goto fail;
-	}
-
-	status = map_fnum_to_smb2_handle(cli,
-					fnum,
-					&ph);
-	if (!NT_STATUS_IS_OK(status)) {
-		goto fail;
-	}
+					0, /* create_options */
+					1, /* in_info_type */
+					(SMB_FILE_ALL_INFORMATION - 1000), /* in_file_info_class */
+					NULL, /* in_set_data */
+					&outbuf,
+					NULL);
+		if (!NT_STATUS_IS_OK(status)) {
+			goto fail;
+		}
 
-	status = cli_smb2_qfileinfo_basic(cli,
-					fnum,
+		status = parse_file_all_information(&outbuf,
 					mode,
 					size,
 					create_time,
@@ -1689,12 +1979,44 @@ NTSTATUS cli_smb2_qpathinfo2(struct cli_state *cli,
 					write_time,
 					change_time,
 					ino);
+		goto fail;
+	}
 
-  fail:
+	/* The rest comes with the create response. */
+	status = cli_smb2_compound_path(cli,
+				frame,
+				name,
+				FILE_READ_ATTRIBUTES,
+				0, /* create_options */
+				0, /* in_info_type */
+				0, /* in_file_info_class */
+				NULL, /* in_set_data */
+				NULL, /* out_data */
+				&cr);
+	if (!NT_STATUS_IS_OK(status)) {
+		goto fail;
+	}
 
-	if (fnum != 0xffff) {
-		cli_smb2_close_fnum(cli, fnum);
+	if (create_time) {
+		*create_time = cli_smb2_create_time(cr.creation_time);
+	}
+	if (access_time) {
+		*access_time = cli_smb2_create_time(cr.last_access_time);
+	}
+	if (write_time) {
+		*write_time = cli_smb2_create_time(cr.last_write_time);
+	}
+	if (change_time) {
+		*change_time = cli_smb2_create_time(cr.change_time);
+	}
+	if (size) {
+		*size = (off_t)cr.end_of_file;
 	}
+	if (mode) {
+		*mode = (uint16_t)cr.file_attributes;
+	}
+
+  fail:
 
 	cli->raw_status = status;
 
@@ -1735,7 +2057,8 @@ NTSTATUS cli_smb2_qpathinfo_streams(struct cli_state *cli,
 	status = get_fnum_from_path(cli,
 				name,
 				FILE_READ_ATTRIBUTES,
-				&fnum);
+				&fnum,
+				NULL);
 
 	if (!NT_STATUS_IS_OK(status)) {
 		goto fail;
@@ -1805,8 +2128,6 @@ NTSTATUS cli_smb2_setpathinfo(struct cli_state *cli,
 			const DATA_BLOB *p_in_data)
 {
 	NTSTATUS status;
-	uint16_t fnum = 0xffff;
-	struct smb2_hnd *ph = NULL;
 	TALLOC_CTX *frame = talloc_stackframe();
 
 	if (smbXcli_conn_has_async_calls(cli->conn)) {
@@ -1822,37 +2143,18 @@ NTSTATUS cli_smb2_setpathinfo(struct cli_state *cli,
 		goto fail;
 	}
 
-	status = get_fnum_from_path(cli,
+	status = cli_smb2_compound_path(cli,
+				frame,
 				name,
 				FILE_WRITE_ATTRIBUTES,
-				&fnum);
-
-	if (!NT_STATUS_IS_OK(status)) {
-		goto fail;
-	}
-
-	status = map_fnum_to_smb2_handle(cli,
-					fnum,
-					&ph);
-	if (!NT_STATUS_IS_OK(status)) {
-		goto fail;
-	}
-
-	status = smb2cli_set_info(cli->conn,
-				cli->timeout,
-				cli->smb2.session,
-				cli->smb2.tcon,
+				0, /* create_options */
 				in_info_type,
 				in_file_info_class,
-				p_in_data, /* in_input_buffer */
-				0, /* in_additional_info */
-				ph->fid_persistent,
-				ph->fid_volatile);
-  fail:
+				p_in_data, /* in_set_data */
+				NULL, /* out_data */
+				NULL);
 
-	if (fnum != 0xffff) {
-		cli_smb2_close_fnum(cli, fnum);
-	}
+  fail:
 
 	cli->raw_status = status;
 
@@ -2567,8 +2869,6 @@ NTSTATUS cli_smb2_rename(struct cli_state *cli,
 {
 	NTSTATUS status;
 	DATA_BLOB inbuf = data_blob_null;
-	uint16_t fnum = 0xffff;
-	struct smb2_hnd *ph = NULL;
 	smb_ucs2_t *converted_str = NULL;
 	size_t converted_size_bytes = 0;
 	size_t namelen = 0;
@@ -2587,22 +2887,6 @@ NTSTATUS cli_smb2_rename(struct cli_state *cli,
 		goto fail;
 	}
 
-	status = get_fnum_from_path(cli,
-				fname_src,
-				DELETE_ACCESS,
-				&fnum);
-
-	if (!NT_STATUS_IS_OK(status)) {
-		goto fail;
-	}
-
-	status = map_fnum_to_smb2_handle(cli,
-					fnum,
-					&ph);
-	if (!NT_STATUS_IS_OK(status)) {
-		goto fail;
-	}
-
 	/* SMB2 is pickier about pathnames. Ensure it doesn't
 	   start in a '\' */
 	if (*fname_dst == '\\') {
@@ -2650,26 +2934,22 @@ NTSTATUS cli_smb2_rename(struct cli_state *cli,
 	SIVAL(inbuf.data, 16, converted_size_bytes);
 	memcpy(inbuf.data + 20, converted_str, converted_size_bytes);
 
-	/* setinfo on the returned handle with info_type SMB2_GETINFO_FILE (1),
+	/* setinfo on the opened handle with info_type SMB2_GETINFO_FILE (1),
 	   level SMB2_FILE_RENAME_INFORMATION (SMB_FILE_RENAME_INFORMATION - 1000) */
 
-	status = smb2cli_set_info(cli->conn,
-				cli->timeout,
-				cli->smb2.session,
-				cli->smb2.tcon,
+	status = cli_smb2_compound_path(cli,
+				frame,
+				fname_src,
+				DELETE_ACCESS,
+				0, /* create_options */
 				1, /* in_info_type */
 				SMB_FILE_RENAME_INFORMATION - 1000, /* in_file_info_class */
-				&inbuf, /* in_input_buffer */
-				0, /* in_additional_info */
-				ph->fid_persistent,
-				ph->fid_volatile);
+				&inbuf, /* in_set_data */
+				NULL, /* out_data */
+				NULL);
 
   fail:
 
-	if (fnum != 0xffff) {
-		cli_smb2_close_fnum(cli, fnum);
-	}
-
 	cli->raw_status = status;
 
 	TALLOC_FREE(frame);
@@ -2801,7 +3081,8 @@ NTSTATUS cli_smb2_set_ea_path(struct cli_state *cli,
 	status = get_fnum_from_path(cli,
 				name,
 				FILE_WRITE_EA,
-				&fnum);
+				&fnum,
+				NULL);
 
 	if (!NT_STATUS_IS_OK(status)) {
 		goto fail;
@@ -2866,7 +3147,8 @@ NTSTATUS cli_smb2_get_ea_list_path(struct cli_state *cli,
 	status = get_fnum_from_path(cli,
 				name,
 				FILE_READ_EA,
-				&fnum);
+				&fnum,
+				NULL);
 
 	if (!NT_STATUS_IS_OK(status)) {
 		goto fail;
@@ -315,6 +315,23 @@ struct cli_pull_chunk {
 	bool done;
 };
 
+/*
+ * We use 16 MByte as default window size, but at least 16 requests
+ * in flight. With SMB2 servers allowing 8 MByte reads and writes a
+ * 16 MByte window would only keep two requests busy, which is not
+ * enough to fill a link with a high latency.
+ */
+static size_t cli_default_window_size(size_t chunk_size)
+{
+	size_t window_size = 16 * 1024 * 1024;
+
+	if (chunk_size <= window_size / 16) {
+		return window_size;
+	}
+
+	return chunk_size * 16;
+}
+
 static void cli_pull_setup_chunks(struct tevent_req *req);
 static void cli_pull_chunk_ship(struct cli_pull_chunk *chunk);
 static void cli_pull_chunk_done(struct tevent_req *subreq);
@@ -370,10 +387,7 @@ struct tevent_req *cli_pull_send(TALLOC_CTX *mem_ctx,
 	}
 
 	if (window_size == 0) {
-		/*
-		 * We use 16 MByte as default window size.
-		 */
-		window_size = 16 * 1024 * 1024;
+		window_size = cli_default_window_size(state->chunk_size);
 	}
 
 	tmp64 = window_size/state->chunk_size;
@@ -1513,10 +1527,7 @@ struct tevent_req *cli_push_send(TALLOC_CTX *mem_ctx, struct tevent_context *ev,
 	}
 
 	if (window_size == 0) {
-		/*
-		 * We use 16 MByte as default window size.
-		 */
-		window_size = 16 * 1024 * 1024;
+		window_size = cli_default_window_size(state->chunk_size);
 	}
 
 	tmp64 = window_size/state->chunk_size;
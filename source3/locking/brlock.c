@@ -31,6 +31,7 @@
 #include "smbd/globals.h"
 #include "dbwrap/dbwrap.h"
 #include "dbwrap/dbwrap_open.h"
+#include "source3/lib/dbwrap/dbwrap_watch.h"
 #include "serverid.h"
 #include "messages.h"
 #include "util_tdb.h"
@@ -44,13 +45,27 @@
 
 static struct db_context *brlock_db;
 
+/*
+ * lock_data is kept sorted by lock start, locks with the same start
+ * stay in the order they were added. This is also the on-disk format
+ * of a brlock.tdb record, followed by num_read_oplocks.
+ *
+ * max_last turns the sorted array into an implicit interval tree:
+ * The locks in [lo,hi) form a subtree rooted at mid=(lo+hi)/2, and
+ * max_last[mid] is the highest last byte covered by any lock in that
+ * subtree. It is built on demand by the conflict checks and thrown
+ * away when the set of ranges changes.
+ */
+
 struct byte_range_lock {
 	struct files_struct *fsp;
 	unsigned int num_locks;
 	bool modified;
 	uint32_t num_read_oplocks;
 	struct lock_struct *lock_data;
+	br_off *max_last;
 	struct db_record *record;
+	bool have_record;
 };
 
 /****************************************************************************
@@ -292,16 +307,278 @@ static bool brl_conflict_other(const struct lock_struct *lock,
 }
 
 /****************************************************************************
- Check if an unlock overlaps a pending lock.
+ Last byte covered by a lock. This is a conservative superset of what
+ brl_overlap() considers overlapping: Zero-sized locks cover their start,
+ ranges wrapping the 64-bit space extend to its end.
 ****************************************************************************/
 
-static bool brl_pending_overlap(const struct lock_struct *lock, const struct lock_struct *pend_lock)
+static br_off brl_last(const struct lock_struct *lock)
 {
-	if ((lock->start <= pend_lock->start) && (lock->start + lock->size > pend_lock->start))
-		return True;
-	if ((lock->start >= pend_lock->start) && (lock->start < pend_lock->start + pend_lock->size))
-		return True;
-	return False;
+	br_off last;
+
+	if (lock->size == 0) {
+		return lock->start;
+	}
+	last = lock->start + lock->size - 1;
+	if (last < lock->start) {
+		return UINT64_MAX;
+	}
+	return last;
+}
+
+static br_off brl_index_build(const struct lock_struct *locks,
+			      br_off *max_last,
+			      unsigned lo,
+			      unsigned hi)
+{
+	unsigned mid = lo + (hi - lo) / 2;
+	br_off result, sub;
+
+	if (lo >= hi) {
+		return 0;
+	}
+
+	result = brl_last(&locks[mid]);
+
+	sub = brl_index_build(locks, max_last, lo, mid);
+	result = MAX(result, sub);
+
+	sub = brl_index_build(locks, max_last, mid + 1, hi);
+	result = MAX(result, sub);
+
+	max_last[mid] = result;
+	return result;
+}
+
+static void brl_index_invalidate(struct byte_range_lock *br_lck)
+{
+	TALLOC_FREE(br_lck->max_last);
+}
+
+/*
+ * Find the first lock in [lo,hi) at index "from" or later that might
+ * overlap [start,last]. Returns hi if there is none.
+ */
+
+static unsigned brl_index_find(const struct lock_struct *locks,
+			       const br_off *max_last,
+			       unsigned lo,
+			       unsigned hi,
+			       unsigned from,
+			       br_off start,
+			       br_off last)
+{
+	unsigned mid, found;
+
+	/*
+	 * Loop instead of recursing into the right subtree, the left
+	 * one is where the recursion depth comes from.
+	 */
+	while ((lo < hi) && (from < hi)) {
+		mid = lo + (hi - lo) / 2;
+
+		if (max_last[mid] < start) {
+			/* Nothing in this subtree reaches start */
+			return hi;
+		}
+		if (locks[lo].start > last) {
+			/* Everything in this subtree starts after last */
+			return hi;
+		}
+
+		found = brl_index_find(locks, max_last, lo, mid, from,
+				       start, last);
+		if (found < mid) {
+			return found;
+		}
+
+		if (locks[mid].start > last) {
+			return hi;
+		}
+		if ((mid >= from) && (brl_last(&locks[mid]) >= start)) {
+			return mid;
+		}
+
+		lo = mid + 1;
+	}
+
+	return hi;
+}
+
+/****************************************************************************
+ Return the index of the next lock at or after "from" that might overlap
+ probe, or br_lck->num_locks if there is none. The caller still has to do
+ the exact brl_conflict*() check.
+****************************************************************************/
+
+static unsigned brl_next_candidate(struct byte_range_lock *br_lck,
+				   const struct lock_struct *probe,
+				   unsigned from)
+{
+	unsigned num_locks = br_lck->num_locks;
+
+	if (from >= num_locks) {
+		return num_locks;
+	}
+
+	if (br_lck->max_last == NULL) {
+		br_lck->max_last = talloc_array(br_lck, br_off, num_locks);
+		if (br_lck->max_last == NULL) {
+			/* Fall back to checking everything */
+			return from;
+		}
+		brl_index_build(br_lck->lock_data, br_lck->max_last,
+				0, num_locks);
+	}
+
+	return brl_index_find(br_lck->lock_data, br_lck->max_last,
+			      0, num_locks, from,
+			      probe->start, brl_last(probe));
+}
+
+/****************************************************************************
+ Index of the first lock with a start >= "start".
+****************************************************************************/
+
+static unsigned brl_lower_bound(const struct lock_struct *locks,
+				unsigned num_locks,
+				br_off start)
+{
+	unsigned lo = 0, hi = num_locks;
+
+	while (lo < hi) {
+		unsigned mid = lo + (hi - lo) / 2;
+
+		if (locks[mid].start < start) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+/****************************************************************************
+ Index of the first lock with a start > "start", where a new lock with that
+ start has to be inserted.
+****************************************************************************/
+
+static unsigned brl_upper_bound(const struct lock_struct *locks,
+				unsigned num_locks,
+				br_off start)
+{
+	unsigned lo = 0, hi = num_locks;
+
+	while (lo < hi) {
+		unsigned mid = lo + (hi - lo) / 2;
+
+		if (locks[mid].start <= start) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+/****************************************************************************
+ Restore the sort order after POSIX splits and merges. Only the few
+ entries that were split, merged or added are out of place, so a stable
+ insertion sort is close to linear here.
+****************************************************************************/
+
+static void brl_sort_locks(struct lock_struct *locks, unsigned num_locks)
+{
+	unsigned i, j;
+
+	for (i = 1; i < num_locks; i++) {
+		struct lock_struct tmp;
+
+		if (locks[i-1].start <= locks[i].start) {
+			continue;
+		}
+
+		tmp = locks[i];
+		j = brl_upper_bound(locks, i, tmp.start);
+		memmove(&locks[j+1], &locks[j], sizeof(*locks) * (i - j));
+		locks[j] = tmp;
+	}
+}
+
+/****************************************************************************
+ Consistency check for LOCAL-BRLOCK-INDEX. The locks have to be sorted by
+ start, and brl_next_candidate() must not skip any lock that a linear
+ brl_overlap()/brl_conflict*() scan finds for probe.
+****************************************************************************/
+
+bool brl_index_check(struct byte_range_lock *br_lck,
+		     const struct lock_struct *probe)
+{
+	const struct lock_struct *locks = br_lck->lock_data;
+	unsigned num_locks = br_lck->num_locks;
+	unsigned i, next;
+	bool *found = NULL;
+
+	for (i = 1; i < num_locks; i++) {
+		if (locks[i-1].start > locks[i].start) {
+			DBG_ERR("lock %u starts at %ju, lock %u at %ju\n",
+				i-1, (uintmax_t)locks[i-1].start,
+				i, (uintmax_t)locks[i].start);
+			return false;
+		}
+	}
+
+	if (num_locks == 0) {
+		return true;
+	}
+
+	found = talloc_zero_array(br_lck, bool, num_locks);
+	if (found == NULL) {
+		return false;
+	}
+
+	for (i = brl_next_candidate(br_lck, probe, 0);
+	     i < num_locks;
+	     i = next) {
+		found[i] = true;
+		next = brl_next_candidate(br_lck, probe, i+1);
+		if (next <= i) {
+			DBG_ERR("candidate %u after %u\n", next, i);
+			TALLOC_FREE(found);
+			return false;
+		}
+	}
+
+	for (i = 0; i < num_locks; i++) {
+		const struct lock_struct *lock = &locks[i];
+		bool hit;
+
+		if (found[i]) {
+			continue;
+		}
+
+		hit = brl_overlap(lock, probe) ||
+			brl_overlap(probe, lock) ||
+			brl_conflict(lock, probe) ||
+			brl_conflict_other(lock, probe);
+		if ((lock->lock_flav == POSIX_LOCK) &&
+		    (probe->lock_flav == POSIX_LOCK)) {
+			hit |= brl_conflict_posix(lock, probe);
+		}
+
+		if (hit) {
+			DBG_ERR("index skipped lock %u (%ju/%ju) for "
+				"probe %ju/%ju\n", i,
+				(uintmax_t)lock->start, (uintmax_t)lock->size,
+				(uintmax_t)probe->start,
+				(uintmax_t)probe->size);
+			TALLOC_FREE(found);
+			return false;
+		}
+	}
+
+	TALLOC_FREE(found);
+	return true;
 }
 
 /****************************************************************************
@@ -346,6 +623,7 @@ void brl_init(bool read_only)
 {
 	int tdb_flags;
 	char *db_path;
+	struct db_context *backend;
 
 	if (brlock_db) {
 		return;
@@ -368,17 +646,28 @@ void brl_init(bool read_only)
 		return;
 	}
 
-	brlock_db = db_open(NULL, db_path,
-			    SMB_OPEN_DATABASE_TDB_HASH_SIZE, tdb_flags,
-			    read_only?O_RDONLY:(O_RDWR|O_CREAT), 0644,
-			    DBWRAP_LOCK_ORDER_2, DBWRAP_FLAG_NONE);
-	if (!brlock_db) {
+	backend = db_open(NULL, db_path,
+			  SMB_OPEN_DATABASE_TDB_HASH_SIZE, tdb_flags,
+			  read_only?O_RDONLY:(O_RDWR|O_CREAT), 0644,
+			  DBWRAP_LOCK_ORDER_2, DBWRAP_FLAG_NONE);
+	if (!backend) {
 		DEBUG(0,("Failed to open byte range locking database %s\n",
 			 db_path));
 		TALLOC_FREE(db_path);
 		return;
 	}
 	TALLOC_FREE(db_path);
+
+	/*
+	 * Blocked lock requests watch the record of the file they
+	 * wait for, every change of the record wakes them up.
+	 */
+	brlock_db = db_open_watched(NULL, &backend, global_messaging_context());
+	if (brlock_db == NULL) {
+		DBG_ERR("db_open_watched failed\n");
+		TALLOC_FREE(backend);
+		return;
+	}
 }
 
 /****************************************************************************
@@ -390,6 +679,143 @@ void brl_shutdown(void)
 	TALLOC_FREE(brlock_db);
 }
 
+/****************************************************************************
+ Lockless presence map for brlock.tdb.
+
+ Every read and write with strict locking has to check the byte range
+ locks of the file. brl_get_locks_readonly() caches the record as long as
+ the brlock.tdb seqnum does not change, but any lock, unlock or read
+ oplock change on any file bumps it, so busy servers end up doing a tdb
+ lookup per I/O request even for files that were never range-locked.
+
+ Like the locking.tdb presence map in share_mode_lock.c, the parent smbd
+ allocates counters in anonymous shared memory. Each counter holds the
+ number of brlock.tdb records whose key hashes to it, maintained by the
+ writers under the record lock. A zero counter means the file has no
+ locks and no read oplocks, and we can skip brlock.tdb.
+****************************************************************************/
+
+#define BRL_PRESENCE_BUCKETS 65536
+
+#if defined(HAVE___SYNC_FETCH_AND_ADD)
+
+static uint32_t *brl_presence;
+
+static uint32_t *brl_presence_bucket(TDB_DATA key)
+{
+	uint32_t hash = tdb_jenkins_hash(&key);
+	return &brl_presence[hash % BRL_PRESENCE_BUCKETS];
+}
+
+static void brl_presence_inc(TDB_DATA key)
+{
+	if (brl_presence == NULL) {
+		return;
+	}
+	__sync_fetch_and_add(brl_presence_bucket(key), 1);
+}
+
+static void brl_presence_dec(TDB_DATA key)
+{
+	if (brl_presence == NULL) {
+		return;
+	}
+	__sync_fetch_and_sub(brl_presence_bucket(key), 1);
+}
+
+static bool brl_presence_absent(TDB_DATA key)
+{
+	const volatile uint32_t *bucket = NULL;
+
+	if (brl_presence == NULL) {
+		return false;
+	}
+	bucket = brl_presence_bucket(key);
+	return (*bucket == 0);
+}
+
+static int brl_presence_count_fn(struct db_record *rec, void *private_data)
+{
+	TDB_DATA key = dbwrap_record_get_key(rec);
+
+	if (key.dsize != sizeof(struct file_id)) {
+		return 0;
+	}
+	if (dbwrap_record_get_value(rec).dsize == 0) {
+		/*
+		 * Only watchers of a file without locks
+		 */
+		return 0;
+	}
+	brl_presence_inc(key);
+	return 0;
+}
+
+bool brl_presence_init(void)
+{
+	NTSTATUS status;
+
+	if (brl_presence != NULL) {
+		return true;
+	}
+	if (lp_clustering()) {
+		/*
+		 * Records are created on other nodes as well
+		 */
+		return false;
+	}
+	if (brlock_db == NULL) {
+		return false;
+	}
+
+	brl_presence = (uint32_t *)anonymous_shared_allocate(
+		BRL_PRESENCE_BUCKETS * sizeof(uint32_t));
+	if (brl_presence == NULL) {
+		DBG_WARNING("anonymous_shared_allocate failed\n");
+		return false;
+	}
+
+	/*
+	 * brlock.tdb is TDB_CLEAR_IF_FIRST, but we might not have
+	 * been the first to open it.
+	 */
+	status = dbwrap_traverse_read(
+		brlock_db, brl_presence_count_fn, NULL, NULL);
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_WARNING("dbwrap_traverse_read failed: %s\n",
+			    nt_errstr(status));
+		anonymous_shared_free(brl_presence);
+		brl_presence = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+#else /* HAVE___SYNC_FETCH_AND_ADD */
+
+bool brl_presence_init(void)
+{
+	return false;
+}
+
+static void brl_presence_inc(TDB_DATA key)
+{
+	return;
+}
+
+static void brl_presence_dec(TDB_DATA key)
+{
+	return;
+}
+
+static bool brl_presence_absent(TDB_DATA key)
+{
+	return false;
+}
+
+#endif /* HAVE___SYNC_FETCH_AND_ADD */
+
 #if ZERO_ZERO
 /****************************************************************************
  Compare two locks for sorting.
@@ -427,7 +853,9 @@ NTSTATUS brl_lock_windows_default(struct byte_range_lock *br_lck,
 		return NT_STATUS_INVALID_LOCK_RANGE;
 	}
 
-	for (i=0; i < br_lck->num_locks; i++) {
+	for (i = brl_next_candidate(br_lck, plock, 0);
+	     i < br_lck->num_locks;
+	     i = brl_next_candidate(br_lck, plock, i+1)) {
 		/* Do any Windows or POSIX locks conflict ? */
 		if (brl_conflict(&locks[i], plock)) {
 			if (!serverid_exists(&locks[i].context.pid)) {
@@ -487,10 +915,14 @@ NTSTATUS brl_lock_windows_default(struct byte_range_lock *br_lck,
 		goto fail;
 	}
 
-	memcpy(&locks[br_lck->num_locks], plock, sizeof(struct lock_struct));
+	i = brl_upper_bound(locks, br_lck->num_locks, plock->start);
+	memmove(&locks[i+1], &locks[i],
+		sizeof(struct lock_struct) * (br_lck->num_locks - i));
+	memcpy(&locks[i], plock, sizeof(struct lock_struct));
 	br_lck->num_locks += 1;
 	br_lck->lock_data = locks;
 	br_lck->modified = True;
+	brl_index_invalidate(br_lck);
 
 	return NT_STATUS_OK;
  fail:
@@ -801,7 +1233,6 @@ static NTSTATUS brl_lock_posix(struct messaging_context *msg_ctx,
 	unsigned int i, count, posix_count;
 	struct lock_struct *locks = br_lck->lock_data;
 	struct lock_struct *tp;
-	bool signal_pending_read = False;
 	bool break_oplocks = false;
 	NTSTATUS status;
 
@@ -829,13 +1260,6 @@ static NTSTATUS brl_lock_posix(struct messaging_context *msg_ctx,
 	for (i=0; i < br_lck->num_locks; i++) {
 		struct lock_struct *curr_lock = &locks[i];
 
-		/* If we have a pending read lock, a lock downgrade should
-		   trigger a lock re-evaluation. */
-		if (curr_lock->lock_type == PENDING_READ_LOCK &&
-				brl_pending_overlap(plock, curr_lock)) {
-			signal_pending_read = True;
-		}
-
 		if (curr_lock->lock_flav == WINDOWS_LOCK) {
 			/* Do any Windows flavour locks conflict ? */
 			if (brl_conflict(curr_lock, plock)) {
@@ -893,21 +1317,10 @@ static NTSTATUS brl_lock_posix(struct messaging_context *msg_ctx,
 					     LEVEL2_CONTEND_POSIX_BRL);
 	}
 
-	/* Try and add the lock in order, sorted by lock start. */
-	for (i=0; i < count; i++) {
-		struct lock_struct *curr_lock = &tp[i];
-
-		if (curr_lock->start <= plock->start) {
-			continue;
-		}
-	}
-
-	if (i < count) {
-		memmove(&tp[i+1], &tp[i],
-			(count - i)*sizeof(struct lock_struct));
-	}
-	memcpy(&tp[i], plock, sizeof(struct lock_struct));
+	/* Add the lock, keeping the array sorted by lock start. */
+	memcpy(&tp[count], plock, sizeof(struct lock_struct));
 	count++;
+	brl_sort_locks(tp, count);
 
 	/* We can get the POSIX lock, now see if it needs to
 	   be mapped into a lower level POSIX one, and if so can
@@ -957,34 +1370,7 @@ static NTSTATUS brl_lock_posix(struct messaging_context *msg_ctx,
 	br_lck->lock_data = tp;
 	locks = tp;
 	br_lck->modified = True;
-
-	/* A successful downgrade from write to read lock can trigger a lock
-	   re-evalutation where waiting readers can now proceed. */
-
-	if (signal_pending_read) {
-		/* Send unlock messages to any pending read waiters that overlap. */
-		for (i=0; i < br_lck->num_locks; i++) {
-			struct lock_struct *pend_lock = &locks[i];
-
-			/* Ignore non-pending locks. */
-			if (!IS_PENDING_LOCK(pend_lock->lock_type)) {
-				continue;
-			}
-
-			if (pend_lock->lock_type == PENDING_READ_LOCK &&
-					brl_pending_overlap(plock, pend_lock)) {
-				struct server_id_buf tmp;
-
-				DEBUG(10, ("brl_lock_posix: sending unlock "
-					   "message to pid %s\n",
-					   server_id_str_buf(pend_lock->context.pid,
-							     &tmp)));
-
-				messaging_send(msg_ctx, pend_lock->context.pid,
-					       MSG_SMB_UNLOCK, &data_blob_null);
-			}
-		}
-	}
+	brl_index_invalidate(br_lck);
 
 	return NT_STATUS_OK;
  fail:
@@ -1061,15 +1447,20 @@ NTSTATUS brl_lock(struct messaging_context *msg_ctx,
 	return ret;
 }
 
-static void brl_delete_lock_struct(struct lock_struct *locks,
-				   unsigned num_locks,
+static void brl_delete_lock_struct(struct byte_range_lock *br_lck,
 				   unsigned del_idx)
 {
+	struct lock_struct *locks = br_lck->lock_data;
+	unsigned num_locks = br_lck->num_locks;
+
 	if (del_idx >= num_locks) {
 		return;
 	}
 	memmove(&locks[del_idx], &locks[del_idx+1],
 		sizeof(*locks) * (num_locks - del_idx - 1));
+	br_lck->num_locks -= 1;
+	br_lck->modified = true;
+	brl_index_invalidate(br_lck);
 }
 
 /****************************************************************************
@@ -1080,7 +1471,7 @@ bool brl_unlock_windows_default(struct messaging_context *msg_ctx,
 			       struct byte_range_lock *br_lck,
 			       const struct lock_struct *plock)
 {
-	unsigned int i, j;
+	unsigned int i;
 	struct lock_struct *locks = br_lck->lock_data;
 	enum brl_type deleted_lock_type = READ_LOCK; /* shut the compiler up.... */
 
@@ -1112,7 +1503,9 @@ bool brl_unlock_windows_default(struct messaging_context *msg_ctx,
 	}
 #endif
 
-	for (i = 0; i < br_lck->num_locks; i++) {
+	for (i = brl_lower_bound(locks, br_lck->num_locks, plock->start);
+	     (i < br_lck->num_locks) && (locks[i].start == plock->start);
+	     i++) {
 		struct lock_struct *lock = &locks[i];
 
 		if (IS_PENDING_LOCK(lock->lock_type)) {
@@ -1130,7 +1523,7 @@ bool brl_unlock_windows_default(struct messaging_context *msg_ctx,
 		}
 	}
 
-	if (i == br_lck->num_locks) {
+	if ((i == br_lck->num_locks) || (locks[i].start != plock->start)) {
 		/* we didn't find it */
 		return False;
 	}
@@ -1139,9 +1532,7 @@ bool brl_unlock_windows_default(struct messaging_context *msg_ctx,
   unlock_continue:
 #endif
 
-	brl_delete_lock_struct(locks, br_lck->num_locks, i);
-	br_lck->num_locks -= 1;
-	br_lck->modified = True;
+	brl_delete_lock_struct(br_lck, i);
 
 	/* Unlock the underlying POSIX regions. */
 	if(lp_posix_locking(br_lck->fsp->conn->params)) {
@@ -1154,29 +1545,6 @@ bool brl_unlock_windows_default(struct messaging_context *msg_ctx,
 				br_lck->num_locks);
 	}
 
-	/* Send unlock messages to any pending waiters that overlap. */
-	for (j=0; j < br_lck->num_locks; j++) {
-		struct lock_struct *pend_lock = &locks[j];
-
-		/* Ignore non-pending locks. */
-		if (!IS_PENDING_LOCK(pend_lock->lock_type)) {
-			continue;
-		}
-
-		/* We could send specific lock info here... */
-		if (brl_pending_overlap(plock, pend_lock)) {
-			struct server_id_buf tmp;
-
-			DEBUG(10, ("brl_unlock: sending unlock message to "
-				   "pid %s\n",
-				   server_id_str_buf(pend_lock->context.pid,
-						     &tmp)));
-
-			messaging_send(msg_ctx, pend_lock->context.pid,
-				       MSG_SMB_UNLOCK, &data_blob_null);
-		}
-	}
-
 	contend_level2_oplocks_end(br_lck->fsp, LEVEL2_CONTEND_WINDOWS_BRL);
 	return True;
 }
@@ -1189,7 +1557,7 @@ static bool brl_unlock_posix(struct messaging_context *msg_ctx,
 			     struct byte_range_lock *br_lck,
 			     struct lock_struct *plock)
 {
-	unsigned int i, j, count;
+	unsigned int i, count;
 	struct lock_struct *tp;
 	struct lock_struct *locks = br_lck->lock_data;
 	bool overlap_found = False;
@@ -1282,6 +1650,9 @@ static bool brl_unlock_posix(struct messaging_context *msg_ctx,
 		return True;
 	}
 
+	/* The upper half of a split lock might be out of order now. */
+	brl_sort_locks(tp, count);
+
 	/* Unlock any POSIX regions. */
 	if(lp_posix_locking(br_lck->fsp->conn->params)) {
 		release_posix_lock_posix_flavour(br_lck->fsp,
@@ -1313,30 +1684,7 @@ static bool brl_unlock_posix(struct messaging_context *msg_ctx,
 	locks = tp;
 	br_lck->lock_data = tp;
 	br_lck->modified = True;
-
-	/* Send unlock messages to any pending waiters that overlap. */
-
-	for (j=0; j < br_lck->num_locks; j++) {
-		struct lock_struct *pend_lock = &locks[j];
-
-		/* Ignore non-pending locks. */
-		if (!IS_PENDING_LOCK(pend_lock->lock_type)) {
-			continue;
-		}
-
-		/* We could send specific lock info here... */
-		if (brl_pending_overlap(plock, pend_lock)) {
-			struct server_id_buf tmp;
-
-			DEBUG(10, ("brl_unlock: sending unlock message to "
-				   "pid %s\n",
-				   server_id_str_buf(pend_lock->context.pid,
-						     &tmp)));
-
-			messaging_send(msg_ctx, pend_lock->context.pid,
-				       MSG_SMB_UNLOCK, &data_blob_null);
-		}
-	}
+	brl_index_invalidate(br_lck);
 
 	return True;
 }
@@ -1396,7 +1744,9 @@ bool brl_locktest(struct byte_range_lock *br_lck,
 	files_struct *fsp = br_lck->fsp;
 
 	/* Make sure existing locks don't conflict */
-	for (i=0; i < br_lck->num_locks; i++) {
+	for (i = brl_next_candidate(br_lck, rw_probe, 0);
+	     i < br_lck->num_locks;
+	     i = brl_next_candidate(br_lck, rw_probe, i+1)) {
 		/*
 		 * Our own locks don't conflict.
 		 */
@@ -1474,7 +1824,9 @@ NTSTATUS brl_lockquery(struct byte_range_lock *br_lck,
 	lock.lock_flav = lock_flav;
 
 	/* Make sure existing locks don't conflict */
-	for (i=0; i < br_lck->num_locks; i++) {
+	for (i = brl_next_candidate(br_lck, &lock, 0);
+	     i < br_lck->num_locks;
+	     i = brl_next_candidate(br_lck, &lock, i+1)) {
 		const struct lock_struct *exlock = &locks[i];
 		bool conflict = False;
 
@@ -1565,7 +1917,9 @@ bool brl_lock_cancel_default(struct byte_range_lock *br_lck,
 
 	SMB_ASSERT(plock);
 
-	for (i = 0; i < br_lck->num_locks; i++) {
+	for (i = brl_lower_bound(locks, br_lck->num_locks, plock->start);
+	     (i < br_lck->num_locks) && (locks[i].start == plock->start);
+	     i++) {
 		struct lock_struct *lock = &locks[i];
 
 		/* For pending locks we *always* care about the fnum. */
@@ -1579,14 +1933,12 @@ bool brl_lock_cancel_default(struct byte_range_lock *br_lck,
 		}
 	}
 
-	if (i == br_lck->num_locks) {
+	if ((i == br_lck->num_locks) || (locks[i].start != plock->start)) {
 		/* Didn't find it. */
 		return False;
 	}
 
-	brl_delete_lock_struct(locks, br_lck->num_locks, i);
-	br_lck->num_locks -= 1;
-	br_lck->modified = True;
+	brl_delete_lock_struct(br_lck, i);
 	return True;
 }
 
@@ -1803,6 +2155,11 @@ static int brl_traverse_fn(struct db_record *rec, void *state)
 	dbkey = dbwrap_record_get_key(rec);
 	value = dbwrap_record_get_value(rec);
 
+	if (value.dsize == 0) {
+		/* Only watchers, no locks. */
+		return 0;
+	}
+
 	/* In a traverse function we must make a copy of
 	   dbuf before modifying it. */
 
@@ -1868,7 +2225,7 @@ int brl_forall(void (*fn)(struct file_id id, struct server_id pid,
 
 static void byte_range_lock_flush(struct byte_range_lock *br_lck)
 {
-	unsigned i;
+	unsigned i, num_locks;
 	struct lock_struct *locks = br_lck->lock_data;
 
 	if (!br_lck->modified) {
@@ -1876,19 +2233,26 @@ static void byte_range_lock_flush(struct byte_range_lock *br_lck)
 		goto done;
 	}
 
-	i = 0;
+	num_locks = 0;
 
-	while (i < br_lck->num_locks) {
+	for (i = 0; i < br_lck->num_locks; i++) {
 		if (locks[i].context.pid.pid == 0) {
 			/*
 			 * Autocleanup, the process conflicted and does not
 			 * exist anymore.
 			 */
-			locks[i] = locks[br_lck->num_locks-1];
-			br_lck->num_locks -= 1;
-		} else {
-			i += 1;
+			continue;
+		}
+		if (num_locks != i) {
+			/* Keep the sort order */
+			locks[num_locks] = locks[i];
 		}
+		num_locks += 1;
+	}
+
+	if (num_locks != br_lck->num_locks) {
+		br_lck->num_locks = num_locks;
+		brl_index_invalidate(br_lck);
 	}
 
 	if ((br_lck->num_locks == 0) && (br_lck->num_read_oplocks == 0)) {
@@ -1899,24 +2263,37 @@ static void byte_range_lock_flush(struct byte_range_lock *br_lck)
 				  nt_errstr(status)));
 			smb_panic("Could not delete byte range lock entry");
 		}
+		if (br_lck->have_record) {
+			brl_presence_dec(
+				dbwrap_record_get_key(br_lck->record));
+			br_lck->have_record = false;
+		}
 	} else {
-		size_t lock_len, data_len;
-		TDB_DATA data;
+		TDB_DATA dbufs[] = {
+			{ .dptr = (uint8_t *)br_lck->lock_data,
+			  .dsize = br_lck->num_locks *
+				   sizeof(struct lock_struct) },
+			{ .dptr = (uint8_t *)&br_lck->num_read_oplocks,
+			  .dsize = sizeof(br_lck->num_read_oplocks) },
+		};
 		NTSTATUS status;
 
-		lock_len = br_lck->num_locks * sizeof(struct lock_struct);
-		data_len = lock_len + sizeof(br_lck->num_read_oplocks);
-
-		data.dsize = data_len;
-		data.dptr = talloc_array(talloc_tos(), uint8_t, data_len);
-		SMB_ASSERT(data.dptr != NULL);
-
-		memcpy(data.dptr, br_lck->lock_data, lock_len);
-		memcpy(data.dptr + lock_len, &br_lck->num_read_oplocks,
-		       sizeof(br_lck->num_read_oplocks));
+		if (!br_lck->have_record) {
+			/*
+			 * Before the store, so that a concurrent
+			 * brl_presence_absent() can't miss it.
+			 */
+			brl_presence_inc(
+				dbwrap_record_get_key(br_lck->record));
+			br_lck->have_record = true;
+		}
 
-		status = dbwrap_record_store(br_lck->record, data, TDB_REPLACE);
-		TALLOC_FREE(data.dptr);
+		/*
+		 * The sorted array is stored as is, no need to marshall
+		 * it into a separate buffer first.
+		 */
+		status = dbwrap_record_storev(br_lck->record, dbufs,
+					      ARRAY_SIZE(dbufs), TDB_REPLACE);
 		if (!NT_STATUS_IS_OK(status)) {
 			DEBUG(0, ("store returned %s\n", nt_errstr(status)));
 			smb_panic("Could not store byte range mode entry");
@@ -1992,6 +2369,7 @@ struct byte_range_lock *brl_get_locks(TALLOC_CTX *mem_ctx, files_struct *fsp)
 	}
 
 	data = dbwrap_record_get_value(br_lck->record);
+	br_lck->have_record = (data.dsize != 0);
 
 	if (!brl_parse_data(br_lck, data)) {
 		TALLOC_FREE(br_lck);
@@ -2044,6 +2422,7 @@ struct byte_range_lock *brl_get_locks_readonly(files_struct *fsp)
 {
 	struct byte_range_lock *br_lock = NULL;
 	struct brl_get_locks_readonly_state state;
+	TDB_DATA key;
 	NTSTATUS status;
 
 	DEBUG(10, ("seqnum=%d, fsp->brlock_seqnum=%d\n",
@@ -2065,11 +2444,14 @@ struct byte_range_lock *brl_get_locks_readonly(files_struct *fsp)
 	state.mem_ctx = fsp;
 	state.br_lock = &br_lock;
 
-	status = dbwrap_parse_record(
-		brlock_db,
-		make_tdb_data((uint8_t *)&fsp->file_id,
-			      sizeof(fsp->file_id)),
-		brl_get_locks_readonly_parser, &state);
+	key = make_tdb_data((uint8_t *)&fsp->file_id, sizeof(fsp->file_id));
+
+	if (brl_presence_absent(key)) {
+		status = NT_STATUS_NOT_FOUND;
+	} else {
+		status = dbwrap_parse_record(
+			brlock_db, key, brl_get_locks_readonly_parser, &state);
+	}
 
 	if (NT_STATUS_EQUAL(status,NT_STATUS_NOT_FOUND)) {
 		/*
@@ -2083,6 +2465,7 @@ struct byte_range_lock *brl_get_locks_readonly(files_struct *fsp)
 		br_lock->num_read_oplocks = 0;
 		br_lock->num_locks = 0;
 		br_lock->lock_data = NULL;
+		br_lock->max_last = NULL;
 
 	} else if (!NT_STATUS_IS_OK(status)) {
 		DEBUG(3, ("Could not parse byte range lock record: "
@@ -2117,6 +2500,64 @@ struct byte_range_lock *brl_get_locks_readonly(files_struct *fsp)
 	return br_lock;
 }
 
+/*******************************************************************
+ Wait for a change of the byte range locks of a file.
+
+ Every store of the brlock.tdb record, and with it every lock, unlock
+ and cancel, completes the request. blocking_smblctx names the lock
+ context that blocked us. If its lock is still there, the process
+ holding it is watched as well, so that we can clean up after it when
+ it dies without unlocking.
+
+ Adding the watch does not wake up the other waiters of the file.
+********************************************************************/
+
+struct tevent_req *brl_watch_send(TALLOC_CTX *mem_ctx,
+				  struct tevent_context *ev,
+				  files_struct *fsp,
+				  uint64_t blocking_smblctx)
+{
+	struct byte_range_lock *br_lck = NULL;
+	struct server_id blocker = { .pid = 0 };
+	struct tevent_req *req = NULL;
+	unsigned int i;
+
+	br_lck = brl_get_locks(talloc_tos(), fsp);
+	if (br_lck == NULL) {
+		return NULL;
+	}
+
+	for (i = 0; i < br_lck->num_locks; i++) {
+		struct lock_struct *lock = &br_lck->lock_data[i];
+
+		if (blocking_smblctx == 0xFFFFFFFFFFFFFFFFLL) {
+			/* Blocked by a POSIX lock outside smbd. */
+			break;
+		}
+		if (IS_PENDING_LOCK(lock->lock_type)) {
+			continue;
+		}
+		if (lock->context.smblctx == blocking_smblctx) {
+			blocker = lock->context.pid;
+			break;
+		}
+	}
+
+	req = dbwrap_watched_watch_send(mem_ctx, ev, br_lck->record, blocker);
+
+	/*
+	 * Not modified, this just unlocks the record
+	 */
+	TALLOC_FREE(br_lck);
+
+	return req;
+}
+
+NTSTATUS brl_watch_recv(struct tevent_req *req, bool *blockerdead)
+{
+	return dbwrap_watched_watch_recv(req, blockerdead, NULL);
+}
+
 struct brl_revalidate_state {
 	ssize_t array_size;
 	uint32_t num_pids;
@@ -2277,6 +2718,7 @@ bool brl_cleanup_disconnected(struct file_id fid, uint64_t open_persistent_id)
 			  nt_errstr(status)));
 		goto done;
 	}
+	brl_presence_dec(key);
 
 	DEBUG(10, ("brl_cleanup_disconnected: "
 		   "file %s cleaned up %u entries from open %llu\n",
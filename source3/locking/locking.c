@@ -459,6 +459,62 @@ struct share_mode_lock *get_existing_share_mode_lock(TALLOC_CTX *mem_ctx,
 	return get_share_mode_lock(mem_ctx, id, NULL, NULL, NULL);
 }
 
+struct rename_share_filename_state {
+	struct share_mode_data *data;
+	struct messaging_context *msg_ctx;
+	struct server_id self;
+	uint32_t orig_name_hash;
+	uint32_t new_name_hash;
+	struct file_id id;
+	uint8_t *msg;
+	size_t msg_len;
+};
+
+static bool rename_share_filename_fn(
+	struct share_mode_entry *e,
+	bool *modified,
+	void *private_data)
+{
+	struct rename_share_filename_state *state = private_data;
+	struct share_mode_data *d = state->data;
+	struct server_id_buf tmp;
+
+	if (!is_valid_share_mode_entry(e)) {
+		return false;
+	}
+
+	/* If this is a hardlink to the inode
+	   with a different name, skip this. */
+	if (e->name_hash != state->orig_name_hash) {
+		return false;
+	}
+
+	e->name_hash = state->new_name_hash;
+	*modified = true;
+
+	/* But not to ourselves... */
+	if (serverid_equal(&e->pid, &state->self)) {
+		return false;
+	}
+
+	if (share_entry_stale_pid(e)) {
+		return false;
+	}
+
+	DEBUG(10,("rename_share_filename: sending rename message to "
+		  "pid %s file_id %s sharepath %s base_name %s "
+		  "stream_name %s\n",
+		  server_id_str_buf(e->pid, &tmp),
+		  file_id_string_tos(&state->id),
+		  d->servicepath, d->base_name,
+		  (d->stream_name != NULL) ? d->stream_name : ""));
+
+	messaging_send_buf(state->msg_ctx, e->pid, MSG_SMB_FILE_RENAME,
+			   state->msg, state->msg_len);
+
+	return false;
+}
+
 /*******************************************************************
  Sets the service name and filename for rename.
  At this point we emit "file renamed" messages to all
@@ -475,6 +531,14 @@ bool rename_share_filename(struct messaging_context *msg_ctx,
 			const struct smb_filename *smb_fname_dst)
 {
 	struct share_mode_data *d = lck->data;
+	struct rename_share_filename_state state = {
+		.data = d,
+		.msg_ctx = msg_ctx,
+		.self = messaging_server_id(msg_ctx),
+		.orig_name_hash = orig_name_hash,
+		.new_name_hash = new_name_hash,
+		.id = id,
+	};
 	size_t sp_len;
 	size_t bn_len;
 	size_t sn_len;
@@ -483,7 +547,7 @@ bool rename_share_filename(struct messaging_context *msg_ctx,
 	uint32_t i;
 	bool strip_two_chars = false;
 	bool has_stream = smb_fname_dst->stream_name != NULL;
-	struct server_id self_pid = messaging_server_id(msg_ctx);
+	bool ok;
 
 	DEBUG(10, ("rename_share_filename: servicepath %s newname %s\n",
 		   servicepath, smb_fname_dst->base_name));
@@ -539,41 +603,12 @@ bool rename_share_filename(struct messaging_context *msg_ctx,
 		sn_len+1);
 
 	/* Send the messages. */
-	for (i=0; i<d->num_share_modes; i++) {
-		struct share_mode_entry *se = &d->share_modes[i];
-		struct server_id_buf tmp;
-
-		if (!is_valid_share_mode_entry(se)) {
-			continue;
-		}
-
-		/* If this is a hardlink to the inode
-		   with a different name, skip this. */
-		if (se->name_hash != orig_name_hash) {
-			continue;
-		}
-
-		se->name_hash = new_name_hash;
-
-		/* But not to ourselves... */
-		if (serverid_equal(&se->pid, &self_pid)) {
-			continue;
-		}
-
-		if (share_mode_stale_pid(d, i)) {
-			continue;
-		}
-
-		DEBUG(10,("rename_share_filename: sending rename message to "
-			  "pid %s file_id %s sharepath %s base_name %s "
-			  "stream_name %s\n",
-			  server_id_str_buf(se->pid, &tmp),
-			  file_id_string_tos(&id),
-			  d->servicepath, d->base_name,
-			has_stream ? d->stream_name : ""));
+	state.msg = (uint8_t *)frm;
+	state.msg_len = msg_len;
 
-		messaging_send_buf(msg_ctx, se->pid, MSG_SMB_FILE_RENAME,
-				   (uint8_t *)frm, msg_len);
+	ok = share_mode_forall_entries(lck, rename_share_filename_fn, &state);
+	if (!ok) {
+		DBG_WARNING("share_mode_forall_entries failed\n");
 	}
 
 	for (i=0; i<d->num_leases; i++) {
@@ -653,102 +688,15 @@ bool is_valid_share_mode_entry(const struct share_mode_entry *e)
 }
 
 /*
- * See if we need to remove a lease being referred to by a
- * share mode that is being marked stale or deleted.
- */
-
-static void remove_share_mode_lease(struct share_mode_data *d,
-				    struct share_mode_entry *e)
-{
-	struct GUID client_guid;
-	struct smb2_lease_key lease_key;
-	uint16_t op_type;
-	uint32_t lease_idx;
-	uint32_t i;
-
-	op_type = e->op_type;
-	e->op_type = NO_OPLOCK;
-
-	d->modified = true;
-
-	if (op_type != LEASE_OPLOCK) {
-		return;
-	}
-
-	/*
-	 * This used to reference a lease. If there's no other one referencing
-	 * it, remove it.
-	 */
-
-	lease_idx = e->lease_idx;
-	e->lease_idx = UINT32_MAX;
-
-	for (i=0; i<d->num_share_modes; i++) {
-		if (d->share_modes[i].stale) {
-			continue;
-		}
-		if (e == &d->share_modes[i]) {
-			/* Not ourselves. */
-			continue;
-		}
-		if (d->share_modes[i].lease_idx == lease_idx) {
-			break;
-		}
-	}
-	if (i < d->num_share_modes) {
-		/*
-		 * Found another one
-		 */
-		return;
-	}
-
-	memcpy(&client_guid,
-		&d->leases[lease_idx].client_guid,
-		sizeof(client_guid));
-	lease_key = d->leases[lease_idx].lease_key;
-
-	d->num_leases -= 1;
-	d->leases[lease_idx] = d->leases[d->num_leases];
-
-	/*
-	 * We changed the lease array. Fix all references to it.
-	 */
-	for (i=0; i<d->num_share_modes; i++) {
-		if (d->share_modes[i].lease_idx == d->num_leases) {
-			d->share_modes[i].lease_idx = lease_idx;
-		}
-	}
-
-	{
-		NTSTATUS status;
-
-		status = leases_db_del(&client_guid,
-					&lease_key,
-					&d->id);
-
-		DEBUG(10, ("%s: leases_db_del returned %s\n", __func__,
-			   nt_errstr(status)));
-	}
-}
-
-/*
- * In case d->share_modes[i] conflicts with something or otherwise is
- * being used, we need to make sure the corresponding process still
- * exists.
+ * In case the entry conflicts with something or otherwise is being used, we
+ * need to make sure the corresponding process still exists. If it does not,
+ * the entry is marked stale, share_mode_forall_entries() and
+ * share_mode_entry_do() remove it and what it references.
  */
-bool share_mode_stale_pid(struct share_mode_data *d, uint32_t idx)
+bool share_entry_stale_pid(struct share_mode_entry *e)
 {
 	struct server_id_buf tmp;
-	struct share_mode_entry *e;
 
-	if (idx > d->num_share_modes) {
-		DBG_WARNING("Asking for index %"PRIu32", "
-			    "only %"PRIu32" around\n",
-			    idx,
-			    d->num_share_modes);
-		return false;
-	}
-	e = &d->share_modes[idx];
 	if (e->stale) {
 		/*
 		 * Checked before
@@ -756,154 +704,55 @@ bool share_mode_stale_pid(struct share_mode_data *d, uint32_t idx)
 		return true;
 	}
 	if (serverid_exists(&e->pid)) {
-		DBG_DEBUG("PID %s (index %"PRIu32" out of %"PRIu32") "
-			  "still exists\n",
-			  server_id_str_buf(e->pid, &tmp),
-			  idx,
-			  d->num_share_modes);
+		DBG_DEBUG("PID %s still exists\n",
+			  server_id_str_buf(e->pid, &tmp));
 		return false;
 	}
-	DBG_DEBUG("PID %s (index %"PRIu32" out of %"PRIu32") "
-		  "does not exist anymore\n",
-		  server_id_str_buf(e->pid, &tmp),
-		  idx,
-		  d->num_share_modes);
+	DBG_DEBUG("PID %s does not exist anymore\n",
+		  server_id_str_buf(e->pid, &tmp));
 
 	e->stale = true;
-
-	if (d->num_delete_tokens != 0) {
-		uint32_t i;
-
-		for (i=0; i<d->num_share_modes; i++) {
-			bool valid = !d->share_modes[i].stale;
-			if (valid) {
-				break;
-			}
-		}
-
-		if (i == d->num_share_modes) {
-			/*
-			 * No valid (non-stale) share mode found, all
-			 * who might have set the delete token are
-			 * gone.
-			 */
-			TALLOC_FREE(d->delete_tokens);
-			d->num_delete_tokens = 0;
-		}
-	}
-
-	remove_share_mode_lease(d, e);
-
-	d->modified = true;
 	return true;
 }
 
-void remove_stale_share_mode_entries(struct share_mode_data *d)
-{
-	uint32_t i;
+struct mark_share_mode_disconnected_state {
+	uint64_t open_persistent_id;
+	bool ok;
+};
 
-	i = 0;
-	while (i < d->num_share_modes) {
-		if (d->share_modes[i].stale) {
-			struct share_mode_entry *m = d->share_modes;
-			m[i] = m[d->num_share_modes-1];
-			d->num_share_modes -= 1;
-			continue;
-		}
-		i += 1;
-	}
-}
-
-bool set_share_mode(struct share_mode_lock *lck, struct files_struct *fsp,
-		    uid_t uid, uint64_t mid, uint16_t op_type,
-		    uint32_t lease_idx)
+static void mark_share_mode_disconnected_fn(struct share_mode_entry *e,
+					    size_t num_share_modes,
+					    bool *modified,
+					    void *private_data)
 {
-	struct share_mode_data *d = lck->data;
-	struct share_mode_entry *tmp, *e;
+	struct mark_share_mode_disconnected_state *state = private_data;
 
-	if ((lease_idx != UINT32_MAX) &&
-	    (lease_idx >= d->num_leases)) {
-		return false;
+	if (num_share_modes != 1) {
+		return;
 	}
-
-	tmp = talloc_realloc(d, d->share_modes, struct share_mode_entry,
-			     d->num_share_modes+1);
-	if (tmp == NULL) {
-		return false;
+	if (!is_valid_share_mode_entry(e)) {
+		return;
 	}
-	d->share_modes = tmp;
-	e = &d->share_modes[d->num_share_modes];
-	d->num_share_modes += 1;
-	d->modified = true;
-
-	ZERO_STRUCTP(e);
-	e->pid = messaging_server_id(fsp->conn->sconn->msg_ctx);
-	e->share_access = fsp->share_access;
-	e->private_options = fsp->fh->private_options;
-	e->access_mask = fsp->access_mask;
-	e->op_mid = mid;
-	e->op_type = op_type;
-	e->lease_idx = lease_idx;
-	e->time.tv_sec = fsp->open_time.tv_sec;
-	e->time.tv_usec = fsp->open_time.tv_usec;
-	e->share_file_id = fsp->fh->gen_id;
-	e->uid = (uint32_t)uid;
-	e->flags = (fsp->posix_flags & FSP_POSIX_FLAGS_OPEN) ?
-		SHARE_MODE_FLAG_POSIX_OPEN : 0;
-	e->name_hash = fsp->name_hash;
-
-	return true;
-}
-
-struct share_mode_entry *find_share_mode_entry(
-	struct share_mode_lock *lck, files_struct *fsp)
-{
-	struct share_mode_data *d = lck->data;
-	struct server_id pid;
-	uint32_t i;
-
-	pid = messaging_server_id(fsp->conn->sconn->msg_ctx);
 
-	for (i=0; i<d->num_share_modes; i++) {
-		struct share_mode_entry *e = &d->share_modes[i];
-
-		if (!is_valid_share_mode_entry(e)) {
-			continue;
-		}
-		if (!serverid_equal(&pid, &e->pid)) {
-			continue;
-		}
-		if (fsp->fh->gen_id != e->share_file_id) {
-			continue;
-		}
-		return e;
-	}
-	return NULL;
-}
+	DEBUG(10, ("Marking share mode entry disconnected for durable handle\n"));
 
-/*******************************************************************
- Del the share mode of a file for this process.
-********************************************************************/
+	server_id_set_disconnected(&e->pid);
 
-bool del_share_mode(struct share_mode_lock *lck, files_struct *fsp)
-{
-	struct share_mode_entry *e;
+	/*
+	 * On reopen the caller needs to check that
+	 * the client comes with the correct handle.
+	 */
+	e->share_file_id = state->open_persistent_id;
 
-	e = find_share_mode_entry(lck, fsp);
-	if (e == NULL) {
-		return False;
-	}
-	remove_share_mode_lease(lck->data, e);
-	*e = lck->data->share_modes[lck->data->num_share_modes-1];
-	lck->data->num_share_modes -= 1;
-	lck->data->modified = True;
-	return True;
+	*modified = true;
+	state->ok = true;
 }
 
 bool mark_share_mode_disconnected(struct share_mode_lock *lck,
 				  struct files_struct *fsp)
 {
-	struct share_mode_entry *e;
+	struct mark_share_mode_disconnected_state state = { .ok = false };
+	bool ok;
 
 	if (lck->data->num_share_modes != 1) {
 		return false;
@@ -916,60 +765,49 @@ bool mark_share_mode_disconnected(struct share_mode_lock *lck,
 		return false;
 	}
 
-	e = find_share_mode_entry(lck, fsp);
-	if (e == NULL) {
-		return false;
-	}
-
-	DEBUG(10, ("Marking share mode entry disconnected for durable handle\n"));
-
-	server_id_set_disconnected(&e->pid);
-
-	/*
-	 * On reopen the caller needs to check that
-	 * the client comes with the correct handle.
-	 */
-	e->share_file_id = fsp->op->global->open_persistent_id;
+	state.open_persistent_id = fsp->op->global->open_persistent_id;
 
-	lck->data->modified = true;
-	return true;
+	ok = share_mode_entry_do(
+		lck,
+		messaging_server_id(fsp->conn->sconn->msg_ctx),
+		fsp->fh->gen_id,
+		mark_share_mode_disconnected_fn,
+		&state);
+	return (ok && state.ok);
 }
 
 /*******************************************************************
- Remove an oplock mid and mode entry from a share mode.
+ Downgrade a oplock type from exclusive to level II.
 ********************************************************************/
 
-bool remove_share_oplock(struct share_mode_lock *lck, files_struct *fsp)
+static void downgrade_share_oplock_fn(struct share_mode_entry *e,
+				      size_t num_share_modes,
+				      bool *modified,
+				      void *private_data)
 {
-	struct share_mode_data *d = lck->data;
-	struct share_mode_entry *e;
+	bool *ok = private_data;
 
-	e = find_share_mode_entry(lck, fsp);
-	if (e == NULL) {
-		return False;
+	if (!is_valid_share_mode_entry(e)) {
+		return;
 	}
 
-	remove_share_mode_lease(d, e);
-	d->modified = True;
-	return true;
+	e->op_type = LEVEL_II_OPLOCK;
+	*modified = true;
+	*ok = true;
 }
 
-/*******************************************************************
- Downgrade a oplock type from exclusive to level II.
-********************************************************************/
-
 bool downgrade_share_oplock(struct share_mode_lock *lck, files_struct *fsp)
 {
-	struct share_mode_entry *e;
-
-	e = find_share_mode_entry(lck, fsp);
-	if (e == NULL) {
-		return False;
-	}
-
-	e->op_type = LEVEL_II_OPLOCK;
-	lck->data->modified = True;
-	return True;
+	bool found = false;
+	bool ok;
+
+	ok = share_mode_entry_do(
+		lck,
+		messaging_server_id(fsp->conn->sconn->msg_ctx),
+		fsp->fh->gen_id,
+		downgrade_share_oplock_fn,
+		&found);
+	return (ok && found);
 }
 
 /****************************************************************************
@@ -1037,6 +875,35 @@ void reset_delete_on_close_lck(files_struct *fsp,
  lck entry. This function is used when the lock is already granted.
 ****************************************************************************/
 
+struct set_delete_on_close_state {
+	struct messaging_context *msg_ctx;
+	DATA_BLOB blob;
+};
+
+static bool set_delete_on_close_fn(
+	struct share_mode_entry *e,
+	bool *modified,
+	void *private_data)
+{
+	struct set_delete_on_close_state *state = private_data;
+	NTSTATUS status;
+
+	status = messaging_send(
+		state->msg_ctx,
+		e->pid,
+		MSG_SMB_NOTIFY_CANCEL_DELETED,
+		&state->blob);
+
+	if (!NT_STATUS_IS_OK(status)) {
+		struct server_id_buf tmp;
+		DBG_DEBUG("messaging_send to %s returned %s\n",
+			  server_id_str_buf(e->pid, &tmp),
+			  nt_errstr(status));
+	}
+
+	return false;
+}
+
 void set_delete_on_close_lck(files_struct *fsp,
 			struct share_mode_lock *lck,
 			const struct security_token *nt_tok,
@@ -1044,9 +911,11 @@ void set_delete_on_close_lck(files_struct *fsp,
 {
 	struct messaging_context *msg_ctx = fsp->conn->sconn->msg_ctx;
 	struct share_mode_data *d = lck->data;
+	struct set_delete_on_close_state state = {
+		.msg_ctx = msg_ctx
+	};
 	uint32_t i;
 	bool ret;
-	DATA_BLOB fid_blob = {};
 	enum ndr_err_code ndr_err;
 
 	SMB_ASSERT(nt_tok != NULL);
@@ -1072,30 +941,19 @@ void set_delete_on_close_lck(files_struct *fsp,
 	ret = add_delete_on_close_token(lck->data, fsp->name_hash, nt_tok, tok);
 	SMB_ASSERT(ret);
 
-	ndr_err = ndr_push_struct_blob(&fid_blob, talloc_tos(), &fsp->file_id,
+	ndr_err = ndr_push_struct_blob(&state.blob, talloc_tos(), &fsp->file_id,
 				       (ndr_push_flags_fn_t)ndr_push_file_id);
 	if (!NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
 		DEBUG(10, ("ndr_push_file_id failed: %s\n",
 			   ndr_errstr(ndr_err)));
 	}
 
-	for (i=0; i<d->num_share_modes; i++) {
-		struct share_mode_entry *e = &d->share_modes[i];
-		NTSTATUS status;
-
-		status = messaging_send(
-			msg_ctx, e->pid, MSG_SMB_NOTIFY_CANCEL_DELETED,
-			&fid_blob);
-
-		if (!NT_STATUS_IS_OK(status)) {
-			struct server_id_buf tmp;
-			DEBUG(10, ("%s: messaging_send to %s returned %s\n",
-				   __func__, server_id_str_buf(e->pid, &tmp),
-				   nt_errstr(status)));
-		}
+	ret = share_mode_forall_entries(lck, set_delete_on_close_fn, &state);
+	if (!ret) {
+		DBG_DEBUG("share_mode_forall_entries failed\n");
 	}
 
-	TALLOC_FREE(fid_blob.data);
+	TALLOC_FREE(state.blob.data);
 }
 
 bool set_delete_on_close(files_struct *fsp, bool delete_on_close,
@@ -1235,33 +1093,43 @@ struct timespec get_share_mode_write_time(struct share_mode_lock *lck)
 	return d->old_write_time;
 }
 
+static bool file_has_open_streams_fn(
+	struct share_mode_entry *e,
+	bool *modified,
+	void *private_data)
+{
+	bool *found = private_data;
+
+	if (!(e->private_options & NTCREATEX_OPTIONS_PRIVATE_STREAM_BASEOPEN)) {
+		return false;
+	}
+
+	if (share_entry_stale_pid(e)) {
+		return false;
+	}
+
+	*found = true;
+	return true;
+}
+
 bool file_has_open_streams(files_struct *fsp)
 {
 	struct share_mode_lock *lock = NULL;
-	struct share_mode_data *d = NULL;
-	uint32_t i;
+	bool found = false;
+	bool ok;
 
 	lock = get_existing_share_mode_lock(talloc_tos(), fsp->file_id);
 	if (lock == NULL) {
 		return false;
 	}
-	d = lock->data;
 
-	for (i = 0; i < d->num_share_modes; i++) {
-		struct share_mode_entry *e = &d->share_modes[i];
-
-		if (share_mode_stale_pid(d, i)) {
-			continue;
-		}
+	ok = share_mode_forall_entries(lock, file_has_open_streams_fn, &found);
+	TALLOC_FREE(lock);
 
-		if (e->private_options &
-		    NTCREATEX_OPTIONS_PRIVATE_STREAM_BASEOPEN)
-		{
-			TALLOC_FREE(lock);
-			return true;
-		}
+	if (!ok) {
+		DBG_DEBUG("share_mode_forall_entries failed\n");
+		return false;
 	}
 
-	TALLOC_FREE(lock);
-	return false;
+	return found;
 }
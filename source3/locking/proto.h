@@ -27,12 +27,15 @@
 
 void brl_init(bool read_only);
 void brl_shutdown(void);
+bool brl_presence_init(void);
 
 unsigned int brl_num_locks(const struct byte_range_lock *brl);
 struct files_struct *brl_fsp(struct byte_range_lock *brl);
 uint32_t brl_num_read_oplocks(const struct byte_range_lock *brl);
 void brl_set_num_read_oplocks(struct byte_range_lock *brl,
 			      uint32_t num_read_oplocks);
+bool brl_index_check(struct byte_range_lock *br_lck,
+		     const struct lock_struct *probe);
 
 NTSTATUS brl_lock_windows_default(struct byte_range_lock *br_lck,
 		struct lock_struct *plock,
@@ -88,6 +91,11 @@ int brl_forall(void (*fn)(struct file_id id, struct server_id pid,
 struct byte_range_lock *brl_get_locks(TALLOC_CTX *mem_ctx,
 					files_struct *fsp);
 struct byte_range_lock *brl_get_locks_readonly(files_struct *fsp);
+struct tevent_req *brl_watch_send(TALLOC_CTX *mem_ctx,
+				  struct tevent_context *ev,
+				  files_struct *fsp,
+				  uint64_t blocking_smblctx);
+NTSTATUS brl_watch_recv(struct tevent_req *req, bool *blockerdead);
 void brl_revalidate(struct messaging_context *msg_ctx,
 		    void *private_data,
 		    uint32_t msg_type,
@@ -172,17 +180,9 @@ void get_file_infos(struct file_id id,
 		    bool *delete_on_close,
 		    struct timespec *write_time);
 bool is_valid_share_mode_entry(const struct share_mode_entry *e);
-bool share_mode_stale_pid(struct share_mode_data *d, uint32_t idx);
-bool set_share_mode(struct share_mode_lock *lck, struct files_struct *fsp,
-		    uid_t uid, uint64_t mid, uint16_t op_type,
-		    uint32_t lease_idx);
-struct share_mode_entry *find_share_mode_entry(struct share_mode_lock *lck,
-					       files_struct *fsp);
-void remove_stale_share_mode_entries(struct share_mode_data *d);
-bool del_share_mode(struct share_mode_lock *lck, files_struct *fsp);
+bool share_entry_stale_pid(struct share_mode_entry *e);
 bool mark_share_mode_disconnected(struct share_mode_lock *lck,
 				  struct files_struct *fsp);
-bool remove_share_oplock(struct share_mode_lock *lck, files_struct *fsp);
 bool downgrade_share_oplock(struct share_mode_lock *lck, files_struct *fsp);
 bool get_delete_on_close_token(struct share_mode_lock *lck,
 				uint32_t name_hash,
@@ -213,6 +213,29 @@ int share_entry_forall(int (*fn)(struct file_id fid,
 		      void *private_data);
 bool share_mode_cleanup_disconnected(struct file_id id,
 				     uint64_t open_persistent_id);
+bool share_mode_presence_init(void);
+bool share_mode_forall_entries(
+	struct share_mode_lock *lck,
+	bool (*fn)(struct share_mode_entry *e,
+		   bool *modified,
+		   void *private_data),
+	void *private_data);
+bool share_mode_entry_do(
+	struct share_mode_lock *lck,
+	struct server_id pid,
+	uint64_t share_file_id,
+	void (*fn)(struct share_mode_entry *e,
+		   size_t num_share_modes,
+		   bool *modified,
+		   void *private_data),
+	void *private_data);
+bool set_share_mode(struct share_mode_lock *lck, struct files_struct *fsp,
+		    uid_t uid, uint64_t mid, uint16_t op_type,
+		    uint32_t lease_idx);
+bool share_mode_entry_add(struct share_mode_lock *lck,
+			  const struct share_mode_entry *e);
+bool del_share_mode(struct share_mode_lock *lck, files_struct *fsp);
+bool remove_share_oplock(struct share_mode_lock *lck, files_struct *fsp);
 
 
 /* The following definitions come from locking/posix.c  */
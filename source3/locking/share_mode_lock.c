@@ -131,6 +131,737 @@ static TDB_DATA locking_key(const struct file_id *id)
 	return make_tdb_data((const uint8_t *)id, sizeof(*id));
 }
 
+/*******************************************************************
+ Lockless presence map for locking.tdb.
+
+ Looking up a record, even one that does not exist, takes the chain
+ mutex of its tdb hash chain. Directory listings and info queries of
+ hot files from many smbd processes then serialize on one mutex just
+ to find out that nobody has the file open.
+
+ The smbd parent allocates an array of counters in anonymous shared
+ memory that all children inherit. Each counter holds the number of
+ locking.tdb records whose key hashes to it. Writers hold the chain
+ lock: they increment before creating a record and decrement after
+ deleting one, so a crash can only leave a counter too high. Readers
+ only consult the counter without any lock; zero means no record
+ exists and the database is not touched at all. Otherwise they
+ fall back to the normal lookup.
+******************************************************************/
+
+#define SHARE_MODE_PRESENCE_BUCKETS 65536
+
+#if defined(HAVE___SYNC_FETCH_AND_ADD)
+
+static uint32_t *share_mode_presence;
+
+static uint32_t *share_mode_presence_bucket(TDB_DATA key)
+{
+	uint32_t hash = tdb_jenkins_hash(&key);
+	return &share_mode_presence[hash % SHARE_MODE_PRESENCE_BUCKETS];
+}
+
+static void share_mode_presence_inc(TDB_DATA key)
+{
+	if (share_mode_presence == NULL) {
+		return;
+	}
+	__sync_fetch_and_add(share_mode_presence_bucket(key), 1);
+}
+
+static void share_mode_presence_dec(TDB_DATA key)
+{
+	if (share_mode_presence == NULL) {
+		return;
+	}
+	__sync_fetch_and_sub(share_mode_presence_bucket(key), 1);
+}
+
+static bool share_mode_presence_absent(TDB_DATA key)
+{
+	const volatile uint32_t *bucket = NULL;
+
+	if (share_mode_presence == NULL) {
+		return false;
+	}
+	bucket = share_mode_presence_bucket(key);
+	return (*bucket == 0);
+}
+
+static int share_mode_presence_count_fn(struct db_record *rec,
+					void *private_data)
+{
+	TDB_DATA key = dbwrap_record_get_key(rec);
+
+	if (key.dsize != sizeof(struct file_id)) {
+		return 0;
+	}
+	share_mode_presence_inc(key);
+	return 0;
+}
+
+bool share_mode_presence_init(void)
+{
+	NTSTATUS status;
+
+	if (share_mode_presence != NULL) {
+		return true;
+	}
+	if (lp_clustering()) {
+		/*
+		 * Records are created on other nodes as well
+		 */
+		return false;
+	}
+	if (lock_db == NULL) {
+		return false;
+	}
+
+	share_mode_presence = (uint32_t *)anonymous_shared_allocate(
+		SHARE_MODE_PRESENCE_BUCKETS * sizeof(uint32_t));
+	if (share_mode_presence == NULL) {
+		DBG_WARNING("anonymous_shared_allocate failed\n");
+		return false;
+	}
+
+	/*
+	 * locking.tdb is TDB_CLEAR_IF_FIRST, but we might not have
+	 * been the first to open it.
+	 */
+	status = dbwrap_traverse_read(
+		lock_db, share_mode_presence_count_fn, NULL, NULL);
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_WARNING("dbwrap_traverse_read failed: %s\n",
+			    nt_errstr(status));
+		anonymous_shared_free(share_mode_presence);
+		share_mode_presence = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+#else /* HAVE___SYNC_FETCH_AND_ADD */
+
+bool share_mode_presence_init(void)
+{
+	return false;
+}
+
+static void share_mode_presence_inc(TDB_DATA key)
+{
+	return;
+}
+
+static void share_mode_presence_dec(TDB_DATA key)
+{
+	return;
+}
+
+static bool share_mode_presence_absent(TDB_DATA key)
+{
+	return false;
+}
+
+#endif /* HAVE___SYNC_FETCH_AND_ADD */
+
+/*******************************************************************
+ A locking.tdb record consists of a 4 byte length, the NDR marshalled
+ share_mode_data of that length and the share mode entries.
+
+ The entries are stored as an array of fixed size NDR blobs, sorted by
+ pid and share_file_id. This way an open or close can find, add,
+ modify or remove its entry without unmarshalling and marshalling the
+ entries of all other opens of the file.
+******************************************************************/
+
+#define SHARE_MODE_ENTRY_SIZE 88
+
+struct locking_tdb_data {
+	DATA_BLOB share_mode_data;
+	const uint8_t *share_entries;
+	size_t num_share_entries;
+};
+
+static bool locking_tdb_data_get(TDB_DATA data,
+				 struct locking_tdb_data *ltdb)
+{
+	uint32_t len;
+
+	if (data.dsize < 4) {
+		DBG_DEBUG("short record: %zu\n", data.dsize);
+		return false;
+	}
+	len = IVAL(data.dptr, 0);
+	if (len > data.dsize - 4) {
+		DBG_DEBUG("invalid share_mode_data length %"PRIu32" "
+			  "in %zu bytes\n", len, data.dsize);
+		return false;
+	}
+	data.dptr += 4;
+	data.dsize -= 4;
+
+	ltdb->share_mode_data = data_blob_const(data.dptr, len);
+	data.dptr += len;
+	data.dsize -= len;
+
+	if ((data.dsize % SHARE_MODE_ENTRY_SIZE) != 0) {
+		DBG_DEBUG("invalid share entries length %zu\n", data.dsize);
+		return false;
+	}
+	ltdb->share_entries = data.dptr;
+	ltdb->num_share_entries = data.dsize / SHARE_MODE_ENTRY_SIZE;
+
+	return true;
+}
+
+static bool share_mode_entry_get(const uint8_t *buf,
+				 struct share_mode_entry *e)
+{
+	struct ndr_pull ndr = {
+		.data = discard_const_p(uint8_t, buf),
+		.data_size = SHARE_MODE_ENTRY_SIZE,
+	};
+	enum ndr_err_code ndr_err;
+
+	*e = (struct share_mode_entry) { .stale = false };
+
+	ndr_err = ndr_pull_share_mode_entry(&ndr, NDR_SCALARS, e);
+	if (!NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
+		DBG_WARNING("ndr_pull_share_mode_entry failed: %s\n",
+			    ndr_errstr(ndr_err));
+		return false;
+	}
+	return true;
+}
+
+static bool share_mode_entry_put(const struct share_mode_entry *e,
+				 uint8_t *buf)
+{
+	struct ndr_push ndr = {
+		.data = buf,
+		.alloc_size = SHARE_MODE_ENTRY_SIZE,
+		.fixed_buf_size = true,
+	};
+	enum ndr_err_code ndr_err;
+
+	ndr_err = ndr_push_share_mode_entry(&ndr, NDR_SCALARS, e);
+	if (!NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
+		DBG_WARNING("ndr_push_share_mode_entry failed: %s\n",
+			    ndr_errstr(ndr_err));
+		return false;
+	}
+	if (ndr.offset != SHARE_MODE_ENTRY_SIZE) {
+		DBG_ERR("share_mode_entry is %"PRIu32" bytes, "
+			"expected %d\n", ndr.offset, SHARE_MODE_ENTRY_SIZE);
+		return false;
+	}
+	return true;
+}
+
+static int share_mode_entry_cmp(struct server_id pid1,
+				uint64_t share_file_id1,
+				struct server_id pid2,
+				uint64_t share_file_id2)
+{
+	if (pid1.vnn != pid2.vnn) {
+		return (pid1.vnn < pid2.vnn) ? -1 : 1;
+	}
+	if (pid1.pid != pid2.pid) {
+		return (pid1.pid < pid2.pid) ? -1 : 1;
+	}
+	if (pid1.task_id != pid2.task_id) {
+		return (pid1.task_id < pid2.task_id) ? -1 : 1;
+	}
+	if (pid1.unique_id != pid2.unique_id) {
+		return (pid1.unique_id < pid2.unique_id) ? -1 : 1;
+	}
+	if (share_file_id1 != share_file_id2) {
+		return (share_file_id1 < share_file_id2) ? -1 : 1;
+	}
+	return 0;
+}
+
+/*
+ * Binary search for an entry. Returns the index of the entry if
+ * found, otherwise the index where it has to be inserted.
+ */
+static size_t share_mode_entry_find(const struct share_mode_data *d,
+				    struct server_id pid,
+				    uint64_t share_file_id,
+				    bool *found)
+{
+	size_t left = 0;
+	size_t right = d->num_share_modes;
+
+	*found = false;
+
+	while (left < right) {
+		size_t middle = left + (right - left) / 2;
+		struct share_mode_entry e;
+		int cmp;
+		bool ok;
+
+		ok = share_mode_entry_get(
+			&d->share_entries[middle * SHARE_MODE_ENTRY_SIZE], &e);
+		if (!ok) {
+			return d->num_share_modes;
+		}
+
+		cmp = share_mode_entry_cmp(pid, share_file_id,
+					   e.pid, e.share_file_id);
+		if (cmp == 0) {
+			*found = true;
+			return middle;
+		}
+		if (cmp < 0) {
+			right = middle;
+		} else {
+			left = middle + 1;
+		}
+	}
+
+	return left;
+}
+
+static bool share_mode_entry_insert(struct share_mode_data *d,
+				    const struct share_mode_entry *e)
+{
+	uint8_t *entries = NULL;
+	size_t idx;
+	bool found;
+	bool ok;
+
+	if (d->num_share_modes == UINT32_MAX) {
+		return false;
+	}
+
+	idx = share_mode_entry_find(d, e->pid, e->share_file_id, &found);
+	if (found) {
+		struct server_id_buf tmp;
+		DBG_WARNING("Duplicate share mode entry for %s/%"PRIu64"\n",
+			    server_id_str_buf(e->pid, &tmp),
+			    e->share_file_id);
+		return false;
+	}
+
+	entries = talloc_realloc(d,
+				 d->share_entries,
+				 uint8_t,
+				 (d->num_share_modes + 1) *
+				 SHARE_MODE_ENTRY_SIZE);
+	if (entries == NULL) {
+		return false;
+	}
+	d->share_entries = entries;
+
+	memmove(&entries[(idx + 1) * SHARE_MODE_ENTRY_SIZE],
+		&entries[idx * SHARE_MODE_ENTRY_SIZE],
+		(d->num_share_modes - idx) * SHARE_MODE_ENTRY_SIZE);
+
+	ok = share_mode_entry_put(e, &entries[idx * SHARE_MODE_ENTRY_SIZE]);
+	if (!ok) {
+		memmove(&entries[idx * SHARE_MODE_ENTRY_SIZE],
+			&entries[(idx + 1) * SHARE_MODE_ENTRY_SIZE],
+			(d->num_share_modes - idx) * SHARE_MODE_ENTRY_SIZE);
+		return false;
+	}
+
+	d->num_share_modes += 1;
+	d->modified = true;
+	return true;
+}
+
+static void share_mode_entry_remove_idx(struct share_mode_data *d,
+					size_t idx)
+{
+	uint8_t *entries = d->share_entries;
+
+	SMB_ASSERT(idx < d->num_share_modes);
+
+	memmove(&entries[idx * SHARE_MODE_ENTRY_SIZE],
+		&entries[(idx + 1) * SHARE_MODE_ENTRY_SIZE],
+		(d->num_share_modes - idx - 1) * SHARE_MODE_ENTRY_SIZE);
+	d->num_share_modes -= 1;
+	d->modified = true;
+
+	if (d->num_share_modes == 0) {
+		TALLOC_FREE(d->share_entries);
+	}
+}
+
+static bool share_mode_entries_forall(
+	struct share_mode_data *d,
+	bool (*fn)(struct share_mode_entry *e,
+		   bool *modified,
+		   void *private_data),
+	void *private_data);
+
+/*
+ * Drop the reference of a share mode entry, which is removed or lost its
+ * lease, to d->leases[lease_idx]. If there's no other one referencing
+ * it, remove the lease.
+ */
+
+struct share_mode_lease_refs_state {
+	uint32_t lease_idx;
+	uint32_t moved_idx;
+	bool found;
+};
+
+static bool share_mode_lease_refs_fn(struct share_mode_entry *e,
+				     bool *modified,
+				     void *private_data)
+{
+	struct share_mode_lease_refs_state *state = private_data;
+
+	if (e->op_type != LEASE_OPLOCK) {
+		return false;
+	}
+	if (e->lease_idx == state->lease_idx) {
+		state->found = true;
+		return true;
+	}
+	return false;
+}
+
+static bool share_mode_lease_move_fn(struct share_mode_entry *e,
+				     bool *modified,
+				     void *private_data)
+{
+	struct share_mode_lease_refs_state *state = private_data;
+
+	if (e->lease_idx == state->moved_idx) {
+		e->lease_idx = state->lease_idx;
+		*modified = true;
+	}
+	return false;
+}
+
+static void share_mode_lease_unref(struct share_mode_data *d,
+				   uint32_t lease_idx)
+{
+	struct share_mode_lease_refs_state state = {
+		.lease_idx = lease_idx,
+	};
+	struct GUID client_guid;
+	struct smb2_lease_key lease_key;
+	NTSTATUS status;
+
+	if (lease_idx >= d->num_leases) {
+		DBG_WARNING("Invalid lease_idx %"PRIu32", only %"PRIu32" "
+			    "leases around\n", lease_idx, d->num_leases);
+		return;
+	}
+
+	share_mode_entries_forall(d, share_mode_lease_refs_fn, &state);
+	if (state.found) {
+		/*
+		 * Found another one
+		 */
+		return;
+	}
+
+	client_guid = d->leases[lease_idx].client_guid;
+	lease_key = d->leases[lease_idx].lease_key;
+
+	d->num_leases -= 1;
+	d->leases[lease_idx] = d->leases[d->num_leases];
+	d->modified = true;
+
+	/*
+	 * We changed the lease array. Fix all references to it.
+	 */
+	if (lease_idx != d->num_leases) {
+		state.moved_idx = d->num_leases;
+		share_mode_entries_forall(
+			d, share_mode_lease_move_fn, &state);
+	}
+
+	status = leases_db_del(&client_guid, &lease_key, &d->id);
+
+	DBG_DEBUG("leases_db_del returned %s\n", nt_errstr(status));
+}
+
+/*
+ * An entry was found to be stale or has
+ * been removed, clean up what it referenced.
+ */
+static void share_mode_entry_removed(struct share_mode_data *d,
+				     const struct share_mode_entry *e)
+{
+	if (e->stale && (d->num_share_modes == 0)) {
+		/*
+		 * No valid share mode left, all who might have set
+		 * the delete token are gone.
+		 */
+		TALLOC_FREE(d->delete_tokens);
+		d->num_delete_tokens = 0;
+	}
+
+	if (e->op_type == LEASE_OPLOCK) {
+		share_mode_lease_unref(d, e->lease_idx);
+	}
+}
+
+static bool share_mode_entries_forall(
+	struct share_mode_data *d,
+	bool (*fn)(struct share_mode_entry *e,
+		   bool *modified,
+		   void *private_data),
+	void *private_data)
+{
+	size_t i = 0;
+
+	while (i < d->num_share_modes) {
+		uint8_t *buf = &d->share_entries[i * SHARE_MODE_ENTRY_SIZE];
+		struct share_mode_entry e;
+		bool modified = false;
+		bool stop;
+		bool ok;
+
+		ok = share_mode_entry_get(buf, &e);
+		if (!ok) {
+			return false;
+		}
+
+		stop = fn(&e, &modified, private_data);
+
+		if (e.stale) {
+			share_mode_entry_remove_idx(d, i);
+			share_mode_entry_removed(d, &e);
+		} else {
+			if (modified) {
+				struct share_mode_entry orig;
+
+				share_mode_entry_get(buf, &orig);
+				if (share_mode_entry_cmp(
+					    orig.pid, orig.share_file_id,
+					    e.pid, e.share_file_id) != 0) {
+					smb_panic("share mode entry key "
+						  "changed in forall");
+				}
+				ok = share_mode_entry_put(&e, buf);
+				if (!ok) {
+					return false;
+				}
+				d->modified = true;
+			}
+			i += 1;
+		}
+
+		if (stop) {
+			break;
+		}
+	}
+
+	return true;
+}
+
+/*******************************************************************
+ Call fn for all share mode entries of a locked file. fn can modify
+ the entry and has to set *modified then, but must not change its pid
+ or share_file_id. Entries found to be stale by share_entry_stale_pid()
+ are removed. Returning true from fn stops the walk.
+********************************************************************/
+
+bool share_mode_forall_entries(
+	struct share_mode_lock *lck,
+	bool (*fn)(struct share_mode_entry *e,
+		   bool *modified,
+		   void *private_data),
+	void *private_data)
+{
+	return share_mode_entries_forall(lck->data, fn, private_data);
+}
+
+/*******************************************************************
+ Call fn for the share mode entry identified by pid and share_file_id.
+ Unlike share_mode_forall_entries() fn is allowed to change the pid
+ and share_file_id of the entry.
+********************************************************************/
+
+bool share_mode_entry_do(
+	struct share_mode_lock *lck,
+	struct server_id pid,
+	uint64_t share_file_id,
+	void (*fn)(struct share_mode_entry *e,
+		   size_t num_share_modes,
+		   bool *modified,
+		   void *private_data),
+	void *private_data)
+{
+	struct share_mode_data *d = lck->data;
+	struct share_mode_entry e;
+	size_t idx;
+	bool modified = false;
+	bool found;
+	bool ok;
+
+	idx = share_mode_entry_find(d, pid, share_file_id, &found);
+	if (!found) {
+		return false;
+	}
+
+	ok = share_mode_entry_get(
+		&d->share_entries[idx * SHARE_MODE_ENTRY_SIZE], &e);
+	if (!ok) {
+		return false;
+	}
+
+	fn(&e, d->num_share_modes, &modified, private_data);
+
+	if (e.stale) {
+		share_mode_entry_remove_idx(d, idx);
+		share_mode_entry_removed(d, &e);
+		return true;
+	}
+
+	if (!modified) {
+		return true;
+	}
+
+	if (share_mode_entry_cmp(pid, share_file_id,
+				 e.pid, e.share_file_id) == 0) {
+		ok = share_mode_entry_put(
+			&e, &d->share_entries[idx * SHARE_MODE_ENTRY_SIZE]);
+		if (!ok) {
+			return false;
+		}
+		d->modified = true;
+		return true;
+	}
+
+	/*
+	 * The key changed, keep the array sorted
+	 */
+	share_mode_entry_remove_idx(d, idx);
+	return share_mode_entry_insert(d, &e);
+}
+
+bool set_share_mode(struct share_mode_lock *lck, struct files_struct *fsp,
+		    uid_t uid, uint64_t mid, uint16_t op_type,
+		    uint32_t lease_idx)
+{
+	struct share_mode_data *d = lck->data;
+	struct share_mode_entry e = {
+		.pid = messaging_server_id(fsp->conn->sconn->msg_ctx),
+		.share_access = fsp->share_access,
+		.private_options = fsp->fh->private_options,
+		.access_mask = fsp->access_mask,
+		.op_mid = mid,
+		.op_type = op_type,
+		.lease_idx = lease_idx,
+		.time.tv_sec = fsp->open_time.tv_sec,
+		.time.tv_usec = fsp->open_time.tv_usec,
+		.share_file_id = fsp->fh->gen_id,
+		.uid = (uint32_t)uid,
+		.flags = (fsp->posix_flags & FSP_POSIX_FLAGS_OPEN) ?
+			SHARE_MODE_FLAG_POSIX_OPEN : 0,
+		.name_hash = fsp->name_hash,
+	};
+
+	if ((lease_idx != UINT32_MAX) &&
+	    (lease_idx >= d->num_leases)) {
+		return false;
+	}
+
+	return share_mode_entry_insert(d, &e);
+}
+
+/*******************************************************************
+ Add a raw share mode entry. Only used by smbtorture to construct
+ inconsistent share mode records.
+********************************************************************/
+
+bool share_mode_entry_add(struct share_mode_lock *lck,
+			  const struct share_mode_entry *e)
+{
+	return share_mode_entry_insert(lck->data, e);
+}
+
+/*******************************************************************
+ Del the share mode of a file for this process.
+********************************************************************/
+
+bool del_share_mode(struct share_mode_lock *lck, files_struct *fsp)
+{
+	struct share_mode_data *d = lck->data;
+	struct server_id pid = messaging_server_id(fsp->conn->sconn->msg_ctx);
+	struct share_mode_entry e;
+	size_t idx;
+	bool found;
+	bool ok;
+
+	idx = share_mode_entry_find(d, pid, fsp->fh->gen_id, &found);
+	if (!found) {
+		return false;
+	}
+
+	ok = share_mode_entry_get(
+		&d->share_entries[idx * SHARE_MODE_ENTRY_SIZE], &e);
+	if (!ok || !is_valid_share_mode_entry(&e)) {
+		return false;
+	}
+
+	share_mode_entry_remove_idx(d, idx);
+	share_mode_entry_removed(d, &e);
+	return true;
+}
+
+/*******************************************************************
+ Remove an oplock mid and mode entry from a share mode.
+********************************************************************/
+
+struct remove_share_oplock_state {
+	bool ok;
+	uint16_t op_type;
+	uint32_t lease_idx;
+};
+
+static void remove_share_oplock_fn(struct share_mode_entry *e,
+				   size_t num_share_modes,
+				   bool *modified,
+				   void *private_data)
+{
+	struct remove_share_oplock_state *state = private_data;
+
+	if (!is_valid_share_mode_entry(e)) {
+		return;
+	}
+
+	state->op_type = e->op_type;
+	state->lease_idx = e->lease_idx;
+
+	e->op_type = NO_OPLOCK;
+	if (state->op_type == LEASE_OPLOCK) {
+		e->lease_idx = UINT32_MAX;
+	}
+	*modified = true;
+	state->ok = true;
+}
+
+bool remove_share_oplock(struct share_mode_lock *lck, files_struct *fsp)
+{
+	struct remove_share_oplock_state state = { .ok = false };
+	bool ok;
+
+	ok = share_mode_entry_do(
+		lck,
+		messaging_server_id(fsp->conn->sconn->msg_ctx),
+		fsp->fh->gen_id,
+		remove_share_oplock_fn,
+		&state);
+	if (!ok || !state.ok) {
+		return false;
+	}
+
+	if (state.op_type == LEASE_OPLOCK) {
+		share_mode_lease_unref(lck->data, state.lease_idx);
+	}
+	return true;
+}
+
 /*******************************************************************
  Share mode cache utility functions that store/delete/retrieve
  entries from memcache.
@@ -291,16 +1022,40 @@ static struct share_mode_data *share_mode_memcache_fetch(TALLOC_CTX *mem_ctx,
  Get all share mode entries for a dev/inode pair.
 ********************************************************************/
 
+static void share_mode_data_print_debug(struct share_mode_data *d)
+{
+	size_t i;
+
+	NDR_PRINT_DEBUG(share_mode_data, d);
+
+	for (i=0; i<d->num_share_modes; i++) {
+		struct share_mode_entry e;
+		bool ok;
+
+		ok = share_mode_entry_get(
+			&d->share_entries[i * SHARE_MODE_ENTRY_SIZE], &e);
+		if (ok) {
+			NDR_PRINT_DEBUG(share_mode_entry, &e);
+		}
+	}
+}
+
 static struct share_mode_data *parse_share_modes(TALLOC_CTX *mem_ctx,
 						const TDB_DATA key,
 						const TDB_DATA dbuf)
 {
+	struct locking_tdb_data ltdb;
 	struct share_mode_data *d;
 	enum ndr_err_code ndr_err;
 	DATA_BLOB blob;
+	bool ok;
 
-	blob.data = dbuf.dptr;
-	blob.length = dbuf.dsize;
+	ok = locking_tdb_data_get(dbuf, &ltdb);
+	if (!ok) {
+		DBG_WARNING("Invalid locking.tdb record\n");
+		return NULL;
+	}
+	blob = ltdb.share_mode_data;
 
 	/* See if we already have a cached copy of this key. */
 	d = share_mode_memcache_fetch(mem_ctx, key, &blob);
@@ -322,9 +1077,22 @@ static struct share_mode_data *parse_share_modes(TALLOC_CTX *mem_ctx,
 		goto fail;
 	}
 
+	d->num_share_modes = ltdb.num_share_entries;
+	d->share_entries = NULL;
+	if (d->num_share_modes != 0) {
+		d->share_entries = talloc_memdup(
+			d,
+			ltdb.share_entries,
+			ltdb.num_share_entries * SHARE_MODE_ENTRY_SIZE);
+		if (d->share_entries == NULL) {
+			DEBUG(0, ("talloc failed\n"));
+			goto fail;
+		}
+	}
+
 	if (DEBUGLEVEL >= 10) {
 		DEBUG(10, ("parse_share_modes:\n"));
-		NDR_PRINT_DEBUG(share_mode_data, d);
+		share_mode_data_print_debug(d);
 	}
 
 	return d;
@@ -335,6 +1103,7 @@ fail:
 
 /*******************************************************************
  Create a storable data blob from a modified share_mode_data struct.
+ The share mode entries are stored as they are.
 ********************************************************************/
 
 static TDB_DATA unparse_share_modes(struct share_mode_data *d)
@@ -344,7 +1113,7 @@ static TDB_DATA unparse_share_modes(struct share_mode_data *d)
 
 	if (DEBUGLEVEL >= 10) {
 		DEBUG(10, ("unparse_share_modes:\n"));
-		NDR_PRINT_DEBUG(share_mode_data, d);
+		share_mode_data_print_debug(d);
 	}
 
 	share_mode_memcache_delete(d);
@@ -352,8 +1121,6 @@ static TDB_DATA unparse_share_modes(struct share_mode_data *d)
 	/* Update the sequence number. */
 	d->sequence_number += 1;
 
-	remove_stale_share_mode_entries(d);
-
 	if (d->num_share_modes == 0) {
 		DEBUG(10, ("No used share mode found\n"));
 		return make_tdb_data(NULL, 0);
@@ -376,6 +1143,7 @@ static int share_mode_data_destructor(struct share_mode_data *d)
 {
 	NTSTATUS status;
 	TDB_DATA data;
+	uint8_t len_buf[4];
 
 	if (!d->modified) {
 		return 0;
@@ -402,6 +1170,8 @@ static int share_mode_data_destructor(struct share_mode_data *d)
 				}
 				smb_panic(errmsg);
 			}
+			share_mode_presence_dec(dbwrap_record_get_key(
+							d->record));
 		}
 		/*
 		 * Nothing to store in cache - allow the normal
@@ -410,7 +1180,27 @@ static int share_mode_data_destructor(struct share_mode_data *d)
 		return 0;
 	}
 
-	status = dbwrap_record_store(d->record, data, TDB_REPLACE);
+	if (d->fresh) {
+		/*
+		 * Count before the record becomes visible, see
+		 * share_mode_presence_absent().
+		 */
+		share_mode_presence_inc(dbwrap_record_get_key(d->record));
+	}
+
+	SIVAL(len_buf, 0, data.dsize);
+
+	{
+		TDB_DATA dbufs[] = {
+			{ .dptr = len_buf, .dsize = sizeof(len_buf) },
+			data,
+			{ .dptr = d->share_entries,
+			  .dsize = d->num_share_modes *
+				   SHARE_MODE_ENTRY_SIZE },
+		};
+		status = dbwrap_record_storev(
+			d->record, dbufs, ARRAY_SIZE(dbufs), TDB_REPLACE);
+	}
 	if (!NT_STATUS_IS_OK(status)) {
 		char *errmsg;
 
@@ -635,6 +1425,10 @@ struct share_mode_lock *fetch_share_mode_unlocked(TALLOC_CTX *mem_ctx,
 	TDB_DATA key = locking_key(&id);
 	NTSTATUS status;
 
+	if (share_mode_presence_absent(key)) {
+		return NULL;
+	}
+
 	status = dbwrap_parse_record(
 		lock_db, key, fetch_share_mode_unlocked_parser, &state);
 	if (!NT_STATUS_IS_OK(status)) {
@@ -698,6 +1492,11 @@ struct tevent_req *fetch_share_mode_send(TALLOC_CTX *mem_ctx,
 	state->key = locking_key(&state->id);
 	state->parser_state.mem_ctx = state;
 
+	if (share_mode_presence_absent(state->key)) {
+		tevent_req_nterror(req, NT_STATUS_NOT_FOUND);
+		return tevent_req_post(req, ev);
+	}
+
 	subreq = dbwrap_parse_record_send(state,
 					  ev,
 					  lock_db,
@@ -774,13 +1573,14 @@ static int share_mode_traverse_fn(struct db_record *rec, void *_state)
 {
 	struct share_mode_forall_state *state =
 		(struct share_mode_forall_state *)_state;
+	struct locking_tdb_data ltdb;
 	TDB_DATA key;
 	TDB_DATA value;
-	DATA_BLOB blob;
 	enum ndr_err_code ndr_err;
 	struct share_mode_data *d;
 	struct file_id fid;
 	int ret;
+	bool ok;
 
 	key = dbwrap_record_get_key(rec);
 	value = dbwrap_record_get_value(rec);
@@ -791,24 +1591,42 @@ static int share_mode_traverse_fn(struct db_record *rec, void *_state)
 	}
 	memcpy(&fid, key.dptr, sizeof(fid));
 
+	ok = locking_tdb_data_get(value, &ltdb);
+	if (!ok) {
+		DEBUG(1, ("Invalid locking.tdb record\n"));
+		return 0;
+	}
+
 	d = talloc(talloc_tos(), struct share_mode_data);
 	if (d == NULL) {
 		return 0;
 	}
 
-	blob.data = value.dptr;
-	blob.length = value.dsize;
-
-	ndr_err = ndr_pull_struct_blob_all(
-		&blob, d, d, (ndr_pull_flags_fn_t)ndr_pull_share_mode_data);
+	/*
+	 * d is gone before the record is, so the strings don't need to
+	 * be copied.
+	 */
+	ndr_err = ndr_pull_struct_blob_all_borrowed(
+		&ltdb.share_mode_data,
+		d,
+		d,
+		(ndr_pull_flags_fn_t)ndr_pull_share_mode_data);
 	if (!NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
 		DEBUG(1, ("ndr_pull_share_mode_lock failed\n"));
+		TALLOC_FREE(d);
 		return 0;
 	}
 
+	/*
+	 * The entries are only valid during
+	 * the traverse, don't copy them.
+	 */
+	d->num_share_modes = ltdb.num_share_entries;
+	d->share_entries = discard_const_p(uint8_t, ltdb.share_entries);
+
 	if (DEBUGLEVEL > 10) {
 		DEBUG(11, ("parse_share_modes:\n"));
-		NDR_PRINT_DEBUG(share_mode_data, d);
+		share_mode_data_print_debug(d);
 	}
 
 	ret = state->fn(fid, d, state->private_data);
@@ -858,11 +1676,19 @@ static int share_entry_traverse_fn(struct file_id fid,
 	uint32_t i;
 
 	for (i=0; i<data->num_share_modes; i++) {
+		struct share_mode_entry e;
 		int ret;
+		bool ok;
+
+		ok = share_mode_entry_get(
+			&data->share_entries[i * SHARE_MODE_ENTRY_SIZE], &e);
+		if (!ok) {
+			return 0;
+		}
 
 		ret = state->fn(fid,
 				data,
-				&data->share_modes[i],
+				&e,
 				state->private_data);
 		if (ret != 0) {
 			return ret;
@@ -889,9 +1715,66 @@ int share_entry_forall(int (*fn)(struct file_id fid,
 	return share_mode_forall(share_entry_traverse_fn, &state);
 }
 
+struct cleanup_disconnected_state {
+	struct file_id fid;
+	uint64_t open_persistent_id;
+	const struct share_mode_data *data;
+	bool found_connected;
+};
+
+static bool cleanup_disconnected_fn(struct share_mode_entry *e,
+				    bool *modified,
+				    void *private_data)
+{
+	struct cleanup_disconnected_state *state = private_data;
+	const struct share_mode_data *data = state->data;
+
+	if (!server_id_is_disconnected(&e->pid)) {
+		struct server_id_buf tmp;
+		DEBUG(5, ("share_mode_cleanup_disconnected: "
+			  "file (file-id='%s', servicepath='%s', "
+			  "base_name='%s%s%s') "
+			  "is used by server %s ==> do not cleanup\n",
+			  file_id_string_tos(&state->fid),
+			  data->servicepath,
+			  data->base_name,
+			  (data->stream_name == NULL)
+			  ? "" : "', stream_name='",
+			  (data->stream_name == NULL)
+			  ? "" : data->stream_name,
+			  server_id_str_buf(e->pid, &tmp)));
+		state->found_connected = true;
+		return true;
+	}
+	if (state->open_persistent_id != e->share_file_id) {
+		DBG_INFO("entry for file "
+			 "(file-id='%s', servicepath='%s', "
+			 "base_name='%s%s%s') "
+			 "has share_file_id %"PRIu64" but expected "
+			 "%"PRIu64"==> do not cleanup\n",
+			 file_id_string_tos(&state->fid),
+			 data->servicepath,
+			 data->base_name,
+			 (data->stream_name == NULL)
+			 ? "" : "', stream_name='",
+			 (data->stream_name == NULL)
+			 ? "" : data->stream_name,
+			 e->share_file_id,
+			 state->open_persistent_id);
+		state->found_connected = true;
+		return true;
+	}
+
+	return false;
+}
+
 bool share_mode_cleanup_disconnected(struct file_id fid,
 				     uint64_t open_persistent_id)
 {
+	struct cleanup_disconnected_state state = {
+		.fid = fid,
+		.open_persistent_id = open_persistent_id,
+	};
 	bool ret = false;
 	TALLOC_CTX *frame = talloc_stackframe();
 	unsigned n;
@@ -907,43 +1790,15 @@ bool share_mode_cleanup_disconnected(struct file_id fid,
 		goto done;
 	}
 	data = lck->data;
+	state.data = data;
 
-	for (n=0; n < data->num_share_modes; n++) {
-		struct share_mode_entry *entry = &data->share_modes[n];
-
-		if (!server_id_is_disconnected(&entry->pid)) {
-			struct server_id_buf tmp;
-			DEBUG(5, ("share_mode_cleanup_disconnected: "
-				  "file (file-id='%s', servicepath='%s', "
-				  "base_name='%s%s%s') "
-				  "is used by server %s ==> do not cleanup\n",
-				  file_id_string(frame, &fid),
-				  data->servicepath,
-				  data->base_name,
-				  (data->stream_name == NULL)
-				  ? "" : "', stream_name='",
-				  (data->stream_name == NULL)
-				  ? "" : data->stream_name,
-				  server_id_str_buf(entry->pid, &tmp)));
-			goto done;
-		}
-		if (open_persistent_id != entry->share_file_id) {
-			DBG_INFO("entry for file "
-				 "(file-id='%s', servicepath='%s', "
-				 "base_name='%s%s%s') "
-				 "has share_file_id %"PRIu64" but expected "
-				 "%"PRIu64"==> do not cleanup\n",
-				 file_id_string(frame, &fid),
-				 data->servicepath,
-				 data->base_name,
-				 (data->stream_name == NULL)
-				 ? "" : "', stream_name='",
-				 (data->stream_name == NULL)
-				 ? "" : data->stream_name,
-				 entry->share_file_id,
-				 open_persistent_id);
-			goto done;
-		}
+	ok = share_mode_forall_entries(lck, cleanup_disconnected_fn, &state);
+	if (!ok) {
+		DBG_DEBUG("share_mode_forall_entries failed\n");
+		goto done;
+	}
+	if (state.found_connected) {
+		goto done;
 	}
 
 	for (n=0; n < data->num_leases; n++) {
@@ -988,6 +1843,7 @@ bool share_mode_cleanup_disconnected(struct file_id fid,
 		  open_persistent_id);
 
 	data->num_share_modes = 0;
+	TALLOC_FREE(data->share_entries);
 	data->num_leases = 0;
 	data->modified = true;
 
@@ -34,6 +34,34 @@ struct char_mappings {
 	smb_ucs2_t entry[MAP_SIZE][2];
 };
 
+/*
+ * string_replace_init_map() hands out a pointer to "tables", the
+ * rest is only used here.
+ *
+ * "reject" holds, per direction, all bytes >= 0x80 and the ASCII
+ * characters mapped in that direction as a string for strcspn(). A
+ * name without any of these bytes is plain ASCII with nothing to map
+ * and does not need the round trip through UCS2.
+ */
+struct string_replace_map {
+	struct char_mappings *tables[MAP_NUM];
+	bool prescan;
+	char reject[2][256];
+};
+
+static void add_reject(char *reject, long charval)
+{
+	size_t len = strlen(reject);
+
+	if ((charval <= 0) || (charval >= 0x80)) {
+		return;
+	}
+	if (memchr(reject, charval, len) != NULL) {
+		return;
+	}
+	reject[len] = charval;
+}
+
 static bool build_table(struct char_mappings **cmaps, int value)
 {
 	int i;
@@ -93,16 +121,31 @@ struct char_mappings **string_replace_init_map(const char **mappings)
 	char *tmp;
 	fstring mapping;
 	long unix_map, windows_map;
+	struct string_replace_map *map = NULL;
 	struct char_mappings **cmaps = NULL;
+	const char *unix_charset = lp_unix_charset();
 
 	if (mappings == NULL) {
 		return NULL;
 	}
 
-	cmaps = TALLOC_ZERO(NULL, MAP_NUM * sizeof(struct char_mappings *));
-	if (cmaps == NULL) {
+	map = talloc_zero(NULL, struct string_replace_map);
+	if (map == NULL) {
 		return NULL;
 	}
+	cmaps = map->tables;
+
+	/*
+	 * Only for UTF-8 plain ASCII is known to convert to UCS2
+	 * unchanged, other unix charsets always go through the full
+	 * translation.
+	 */
+	map->prescan = (strcasecmp_m(unix_charset, "UTF-8") == 0) ||
+		       (strcasecmp_m(unix_charset, "UTF8") == 0);
+	for (i = 0x80; i <= 0xFF; i++) {
+		map->reject[vfs_translate_to_unix][i - 0x80] = i;
+		map->reject[vfs_translate_to_windows][i - 0x80] = i;
+	}
 
 	/*
 	 * catia mappings are of the form :
@@ -128,6 +171,9 @@ struct char_mappings **string_replace_init_map(const char **mappings)
 			DEBUG(0, ("TABLE ERROR - CATIA MAPPINGS - %s\n", mapping));
 			continue;
 		}
+
+		add_reject(map->reject[vfs_translate_to_windows], unix_map);
+		add_reject(map->reject[vfs_translate_to_unix], windows_map);
 	}
 
 	return cmaps;
@@ -146,6 +192,30 @@ NTSTATUS string_replace_allocate(connection_struct *conn,
 	size_t converted_size;
 	bool ok;
 
+	if (cmaps != NULL) {
+		struct string_replace_map *replace_map =
+			(struct string_replace_map *)cmaps;
+
+		if (replace_map->prescan) {
+			const char *reject = replace_map->reject[direction];
+
+			/*
+			 * strcspn() is optimized in most C libraries,
+			 * this is much cheaper than the round trip
+			 * through UCS2 in the common case of a name
+			 * without anything to map.
+			 */
+			ok = (name_in[strcspn(name_in, reject)] == '\0');
+			if (ok) {
+				*mapped_name = talloc_strdup(mem_ctx, name_in);
+				if (*mapped_name == NULL) {
+					return NT_STATUS_NO_MEMORY;
+				}
+				return NT_STATUS_OK;
+			}
+		}
+	}
+
 	ok = push_ucs2_talloc(talloc_tos(), &tmpbuf, name_in,
 			      &converted_size);
 	if (!ok) {
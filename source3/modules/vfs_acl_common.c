@@ -30,6 +30,7 @@
 #include "../lib/util/bitmap.h"
 #include "lib/crypto/sha256.h"
 #include "passdb/lookup_sid.h"
+#include "lib/util/memcache.h"
 
 static NTSTATUS create_acl_blob(const struct security_descriptor *psd,
 			DATA_BLOB *pblob,
@@ -73,6 +74,123 @@ bool init_acl_common_config(vfs_handle_struct *handle,
 	return true;
 }
 
+/*
+ * Per process cache of security descriptors validated from an ACL blob.
+ *
+ * Entries are keyed by file_id and change time: every update of the
+ * blob xattr, the POSIX ACL or the owner changes the ctime of the
+ * file, so a stale entry can't be found by other smbd processes
+ * either. Only descriptors that came from the blob are cached, the
+ * file system mapped ones depend on the VFS stack and the share
+ * options.
+ */
+
+static struct memcache *acl_sd_cache;
+
+struct acl_sd_cache_key {
+	struct file_id id;
+	struct timespec ctime;
+	bool ignore_system_acls;
+};
+
+/*
+ * Rough per entry memcache overhead, used to turn the entry limit into
+ * a memcache size. The descriptors themselves are talloc objects and
+ * not accounted for by memcache.
+ */
+#define ACL_SD_CACHE_ENTRY_OVERHEAD 64
+
+bool init_acl_sd_cache(int max_entries)
+{
+	if (max_entries <= 0) {
+		return false;
+	}
+	if (acl_sd_cache != NULL) {
+		return true;
+	}
+
+	acl_sd_cache = memcache_init(NULL,
+				     (size_t)max_entries *
+				     (sizeof(struct acl_sd_cache_key) +
+				      sizeof(void *) +
+				      ACL_SD_CACHE_ENTRY_OVERHEAD));
+	if (acl_sd_cache == NULL) {
+		DBG_ERR("memcache_init failed\n");
+		return false;
+	}
+
+	return true;
+}
+
+static bool acl_sd_cache_key(vfs_handle_struct *handle,
+			     const SMB_STRUCT_STAT *sbuf,
+			     bool ignore_system_acls,
+			     struct acl_sd_cache_key *key)
+{
+	struct timespec now = timespec_current();
+
+	if (timespec_too_recent(&sbuf->st_ex_ctime, &now)) {
+		return false;
+	}
+
+	ZERO_STRUCTP(key);
+	key->id = vfs_file_id_from_sbuf(handle->conn, sbuf);
+	key->ctime = sbuf->st_ex_ctime;
+	key->ignore_system_acls = ignore_system_acls;
+
+	return true;
+}
+
+static struct security_descriptor *acl_sd_cache_fetch(
+	TALLOC_CTX *mem_ctx,
+	const struct acl_sd_cache_key *key)
+{
+	struct security_descriptor *cached = NULL;
+
+	cached = memcache_lookup_talloc(acl_sd_cache,
+					NT_ACL_CACHE_TALLOC,
+					data_blob_const(key, sizeof(*key)));
+	if (cached == NULL) {
+		return NULL;
+	}
+
+	return security_descriptor_copy(mem_ctx, cached);
+}
+
+static void acl_sd_cache_store(const struct acl_sd_cache_key *key,
+			       const struct security_descriptor *psd)
+{
+	struct security_descriptor *cached = NULL;
+
+	cached = security_descriptor_copy(NULL, psd);
+	if (cached == NULL) {
+		return;
+	}
+
+	memcache_add_talloc(acl_sd_cache,
+			    NT_ACL_CACHE_TALLOC,
+			    data_blob_const(key, sizeof(*key)),
+			    &cached);
+}
+
+static void acl_sd_cache_forget(vfs_handle_struct *handle,
+				files_struct *fsp,
+				bool ignore_system_acls)
+{
+	struct acl_sd_cache_key key;
+	bool ok;
+
+	ok = acl_sd_cache_key(handle, &fsp->fsp_name->st,
+			      ignore_system_acls, &key);
+	if (!ok) {
+		return;
+	}
+
+	memcache_delete(acl_sd_cache,
+			NT_ACL_CACHE_TALLOC,
+			data_blob_const(&key, sizeof(key)));
+}
+
 
 /*******************************************************************
  Hash a security descriptor.
@@ -654,6 +772,8 @@ NTSTATUS get_nt_acl_common(
 	const struct smb_filename *smb_fname = NULL;
 	bool psd_is_from_fs = false;
 	struct acl_common_config *config = NULL;
+	struct acl_sd_cache_key cache_key;
+	bool use_cache = false;
 
 	SMB_VFS_HANDLE_GET_DATA(handle, config,
 				struct acl_common_config,
@@ -667,8 +787,31 @@ NTSTATUS get_nt_acl_common(
 
 	DBG_DEBUG("name=%s\n", smb_fname->base_name);
 
-	status = get_acl_blob_fn(mem_ctx, handle, fsp, smb_fname, &blob);
-	if (NT_STATUS_IS_OK(status)) {
+	if (config->cache_sd) {
+		SMB_STRUCT_STAT sbuf;
+		SMB_STRUCT_STAT *psbuf = &sbuf;
+
+		status = stat_fsp_or_smb_fname(handle, fsp, smb_fname,
+					       &sbuf, &psbuf);
+		if (NT_STATUS_IS_OK(status)) {
+			use_cache = acl_sd_cache_key(
+				handle, psbuf, config->ignore_system_acls,
+				&cache_key);
+		}
+		if (use_cache) {
+			psd = acl_sd_cache_fetch(mem_ctx, &cache_key);
+		}
+		if (psd != NULL) {
+			DBG_DEBUG("using cached acl for %s\n",
+				  smb_fname->base_name);
+		}
+	}
+
+	if (psd == NULL) {
+		status = get_acl_blob_fn(mem_ctx, handle, fsp, smb_fname,
+					 &blob);
+	}
+	if (psd == NULL && NT_STATUS_IS_OK(status)) {
 		status = validate_nt_acl_blob(mem_ctx,
 					      handle,
 					      fsp,
@@ -682,6 +825,9 @@ NTSTATUS get_nt_acl_common(
 				  smb_fname->base_name);
 			goto fail;
 		}
+		if (use_cache && psd != NULL && !psd_is_from_fs) {
+			acl_sd_cache_store(&cache_key, psd);
+		}
 	}
 
 	if (psd == NULL) {
@@ -922,10 +1068,16 @@ NTSTATUS fset_nt_acl_common(
 	uint8_t sys_acl_hash[XATTR_SD_HASH_SIZE];
 	bool chown_needed = false;
 	char *sys_acl_description;
+	struct acl_common_config *config = NULL;
 	TALLOC_CTX *frame = talloc_stackframe();
 	bool ignore_file_system_acl = lp_parm_bool(
 	    SNUM(handle->conn), module_name, "ignore system acls", false);
 
+	SMB_VFS_HANDLE_GET_DATA(handle, config,
+				struct acl_common_config,
+				TALLOC_FREE(frame);
+				return NT_STATUS_UNSUCCESSFUL);
+
 	if (DEBUGLEVEL >= 10) {
 		DBG_DEBUG("incoming sd for file %s\n", fsp_str_dbg(fsp));
 		NDR_PRINT_DEBUG(security_descriptor,
@@ -943,6 +1095,14 @@ NTSTATUS fset_nt_acl_common(
 		return status;
 	}
 
+	if (config->cache_sd) {
+		/*
+		 * Storing the new ACL moves ctime anyway, this just
+		 * releases the memory early.
+		 */
+		acl_sd_cache_forget(handle, fsp, config->ignore_system_acls);
+	}
+
 	psd->revision = orig_psd->revision;
 	if (security_info_sent & SECINFO_DACL) {
 		psd->type = orig_psd->type;
@@ -27,10 +27,12 @@
 struct acl_common_config {
 	bool ignore_system_acls;
 	enum default_acl_style default_acl_style;
+	bool cache_sd;
 };
 
 bool init_acl_common_config(vfs_handle_struct *handle,
 			    const char *module_name);
+bool init_acl_sd_cache(int max_entries);
 
 int rmdir_acl_common(struct vfs_handle_struct *handle,
 		     const struct smb_filename *smb_fname);
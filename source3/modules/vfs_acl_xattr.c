@@ -240,6 +240,13 @@ static int connect_acl_xattr(struct vfs_handle_struct *handle,
 				struct acl_common_config,
 				return -1);
 
+	/*
+	 * The cache relies on every change of the blob moving the ctime
+	 * of the file, which is only true for the xattr backend.
+	 */
+	config->cache_sd = init_acl_sd_cache(
+		lp_parm_int(-1, ACL_MODULE_NAME, "sd cache entries", 0));
+
 	if (config->ignore_system_acls) {
 		mode_t create_mask = lp_create_mask(SNUM(handle->conn));
 		char *create_mask_str = NULL;
@@ -303,9 +303,10 @@ static int open_async(const files_struct *fsp,
 		return -1;
 	}
 
-	subreq = pthreadpool_tevent_job_send(opd,
+	subreq = pthreadpool_tevent_job_send_prio(opd,
 					     fsp->conn->sconn->ev_ctx,
 					     fsp->conn->sconn->pool,
+					     PTHREADPOOL_PRIO_HIGH,
 					     aio_open_worker, opd);
 	if (subreq == NULL) {
 		return -1;
@@ -35,6 +35,11 @@
 #include "lib/pthreadpool/pthreadpool_tevent.h"
 #include "librpc/gen_ndr/ndr_ioctl.h"
 #include "offload_token.h"
+#include "lib/util/usdt.h"
+
+#ifdef HAVE_DECL_FICLONERANGE
+#include <linux/fs.h>
+#endif
 
 #undef DBGC_CLASS
 #define DBGC_CLASS DBGC_VFS
@@ -141,6 +146,12 @@ static uint32_t vfswrap_fs_capabilities(struct vfs_handle_struct *handle,
 		caps = statbuf.FsCapabilities;
 	}
 
+#ifdef HAVE_DECL_FICLONERANGE
+	if (lp_smbd_block_cloning(SNUM(conn))) {
+		caps |= FILE_SUPPORTS_BLOCK_REFCOUNTING;
+	}
+#endif
+
 	*p_ts_res = TIMESTAMP_SET_SECONDS;
 
 	/* Work out what timestamp resolution we can
@@ -462,6 +473,53 @@ static struct dirent *vfswrap_readdir(vfs_handle_struct *handle,
 	return result;
 }
 
+/*
+ * Batch up SMB_VFS_READDIR() through the whole module stack, so modules
+ * that filter or sort directory entries still see them. Backends that
+ * get attributes together with the names implement this directly.
+ */
+
+static NTSTATUS vfswrap_readdirplus(vfs_handle_struct *handle,
+				    DIR *dirp,
+				    TALLOC_CTX *mem_ctx,
+				    size_t max_entries,
+				    struct vfs_readdirplus_entry **pentries,
+				    size_t *pnum_entries)
+{
+	struct vfs_readdirplus_entry *entries = NULL;
+	size_t num_entries = 0;
+
+	entries = talloc_array(mem_ctx, struct vfs_readdirplus_entry,
+			       max_entries);
+	if (entries == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	while (num_entries < max_entries) {
+		struct vfs_readdirplus_entry *e = &entries[num_entries];
+		struct dirent *de = NULL;
+
+		*e = (struct vfs_readdirplus_entry) { .name = NULL };
+
+		de = SMB_VFS_READDIR(handle->conn, dirp, &e->st);
+		if (de == NULL) {
+			break;
+		}
+
+		e->name = talloc_strdup(entries, de->d_name);
+		if (e->name == NULL) {
+			TALLOC_FREE(entries);
+			return NT_STATUS_NO_MEMORY;
+		}
+		e->offset = SMB_VFS_TELLDIR(handle->conn, dirp);
+		num_entries += 1;
+	}
+
+	*pentries = entries;
+	*pnum_entries = num_entries;
+	return NT_STATUS_OK;
+}
+
 static NTSTATUS vfswrap_readdir_attr(struct vfs_handle_struct *handle,
 				     const struct smb_filename *fname,
 				     TALLOC_CTX *mem_ctx,
@@ -685,6 +743,8 @@ static struct tevent_req *vfswrap_pread_send(struct vfs_handle_struct *handle,
 				     state->profile_bytes, n);
 	SMBPROFILE_BYTES_ASYNC_SET_IDLE(state->profile_bytes);
 
+	SAMBA_USDT3(vfs_pread_start, state->fd, n, offset);
+
 	subreq = pthreadpool_tevent_job_send(
 		state, ev, handle->conn->sconn->pool,
 		vfs_pread_do, state);
@@ -756,6 +816,9 @@ static void vfs_pread_done(struct tevent_req *subreq)
 		vfs_pread_do(state);
 	}
 
+	SAMBA_USDT3(vfs_pread_done, state->fd, state->ret,
+		    state->vfs_aio_state.duration);
+
 	tevent_req_done(req);
 }
 
@@ -813,6 +876,8 @@ static struct tevent_req *vfswrap_pwrite_send(struct vfs_handle_struct *handle,
 				     state->profile_bytes, n);
 	SMBPROFILE_BYTES_ASYNC_SET_IDLE(state->profile_bytes);
 
+	SAMBA_USDT3(vfs_pwrite_start, state->fd, n, offset);
+
 	subreq = pthreadpool_tevent_job_send(
 		state, ev, handle->conn->sconn->pool,
 		vfs_pwrite_do, state);
@@ -884,6 +949,9 @@ static void vfs_pwrite_done(struct tevent_req *subreq)
 		vfs_pwrite_do(state);
 	}
 
+	SAMBA_USDT3(vfs_pwrite_done, state->fd, state->ret,
+		    state->vfs_aio_state.duration);
+
 	tevent_req_done(req);
 }
 
@@ -1556,6 +1624,13 @@ static struct tevent_req *vfswrap_get_dos_attributes_send(
 		.smb_fname = smb_fname,
 	};
 
+	if (dos_attribute_cache_fetch(state->conn,
+				      smb_fname,
+				      &state->dosmode)) {
+		tevent_req_done(req);
+		return tevent_req_post(req, ev);
+	}
+
 	subreq = SMB_VFS_GETXATTRAT_SEND(state,
 					 ev,
 					 dir_fsp,
@@ -1630,6 +1705,10 @@ static void vfswrap_get_dos_attributes_getxattr_done(struct tevent_req *subreq)
 		return;
 	}
 
+	dos_attribute_cache_store(state->conn,
+				  state->smb_fname,
+				  state->dosmode);
+
 	tevent_req_done(req);
 	return;
 }
@@ -1714,7 +1793,17 @@ static struct tevent_req *vfswrap_offload_read_send(
 		return tevent_req_post(req, ev);
 	}
 
-	if (fsctl != FSCTL_SRV_REQUEST_RESUME_KEY) {
+	switch (fsctl) {
+	case FSCTL_SRV_REQUEST_RESUME_KEY:
+		break;
+	case FSCTL_DUP_EXTENTS_TO_FILE:
+		if (fsp->conn->fs_capabilities &
+		    FILE_SUPPORTS_BLOCK_REFCOUNTING)
+		{
+			break;
+		}
+		FALL_THROUGH;
+	default:
 		tevent_req_nterror(req, NT_STATUS_INVALID_DEVICE_REQUEST);
 		return tevent_req_post(req, ev);
 	}
@@ -1756,6 +1845,227 @@ static NTSTATUS vfswrap_offload_read_recv(struct tevent_req *req,
 	return NT_STATUS_OK;
 }
 
+/*
+ * Copy or clone a file range in the kernel, without passing the data
+ * through userspace. This uses the file descriptors directly, so it
+ * must only be used if they are real kernel file descriptors of the
+ * files, see vfswrap_offload_fsp_is_local().
+ */
+
+struct vfswrap_kernel_copy_state {
+	int src_fd;
+	off_t src_off;
+	int dst_fd;
+	off_t dst_off;
+	off_t count;
+	bool clone;
+
+	off_t copied;
+	struct vfs_aio_state vfs_aio_state;
+};
+
+static bool vfswrap_offload_fsp_is_local(struct files_struct *fsp)
+{
+	SMB_STRUCT_STAT sbuf;
+	int ret;
+
+	if (fsp->base_fsp != NULL) {
+		/*
+		 * Streams modules might hand out the fd of the base file.
+		 */
+		return false;
+	}
+	if (fsp->fh->fd == -1) {
+		return false;
+	}
+
+	/*
+	 * Modules like vfs_glusterfs and vfs_ceph use their own fd
+	 * numbers, they would not match the file here.
+	 */
+	ret = sys_fstat(fsp->fh->fd, &sbuf, false);
+	if (ret == -1) {
+		return false;
+	}
+	if ((sbuf.st_ex_dev != fsp->fsp_name->st.st_ex_dev) ||
+	    (sbuf.st_ex_ino != fsp->fsp_name->st.st_ex_ino))
+	{
+		return false;
+	}
+
+	return true;
+}
+
+static void vfswrap_kernel_copy_do(void *private_data);
+static void vfswrap_kernel_copy_done(struct tevent_req *subreq);
+static int vfswrap_kernel_copy_state_destructor(
+	struct vfswrap_kernel_copy_state *state);
+
+static struct tevent_req *vfswrap_kernel_copy_send(
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	struct files_struct *src_fsp,
+	off_t src_off,
+	struct files_struct *dst_fsp,
+	off_t dst_off,
+	off_t count,
+	bool clone)
+{
+	struct tevent_req *req = NULL;
+	struct tevent_req *subreq = NULL;
+	struct vfswrap_kernel_copy_state *state = NULL;
+
+	req = tevent_req_create(mem_ctx, &state,
+				struct vfswrap_kernel_copy_state);
+	if (req == NULL) {
+		return NULL;
+	}
+	*state = (struct vfswrap_kernel_copy_state) {
+		.src_fd = src_fsp->fh->fd,
+		.src_off = src_off,
+		.dst_fd = dst_fsp->fh->fd,
+		.dst_off = dst_off,
+		.count = count,
+		.clone = clone,
+	};
+
+	subreq = pthreadpool_tevent_job_send(
+		state, ev, dst_fsp->conn->sconn->pool,
+		vfswrap_kernel_copy_do, state);
+	if (tevent_req_nomem(subreq, req)) {
+		return tevent_req_post(req, ev);
+	}
+	tevent_req_set_callback(subreq, vfswrap_kernel_copy_done, req);
+
+	talloc_set_destructor(state, vfswrap_kernel_copy_state_destructor);
+
+	return req;
+}
+
+static void vfswrap_kernel_copy_do(void *private_data)
+{
+	struct vfswrap_kernel_copy_state *state = talloc_get_type_abort(
+		private_data, struct vfswrap_kernel_copy_state);
+	struct timespec start_time;
+	struct timespec end_time;
+
+	PROFILE_TIMESTAMP(&start_time);
+
+	state->vfs_aio_state.error = ENOSYS;
+
+	if (state->clone) {
+#ifdef HAVE_DECL_FICLONERANGE
+		struct file_clone_range range = {
+			.src_fd = state->src_fd,
+			.src_offset = state->src_off,
+			.src_length = state->count,
+			.dest_offset = state->dst_off,
+		};
+		int ret;
+
+		/*
+		 * A clone is all or nothing. Note that a length of
+		 * 0 would clone up to the end of the source file.
+		 */
+		SMB_ASSERT(state->count > 0);
+
+		ret = ioctl(state->dst_fd, FICLONERANGE, &range);
+		if (ret == 0) {
+			state->copied = state->count;
+			state->vfs_aio_state.error = 0;
+		} else {
+			state->vfs_aio_state.error = errno;
+		}
+#endif
+		goto done;
+	}
+
+#ifdef HAVE_COPY_FILE_RANGE
+	state->vfs_aio_state.error = 0;
+
+	while (state->copied < state->count) {
+		size_t len = MIN(state->count - state->copied, INT32_MAX);
+		ssize_t nwritten;
+
+		nwritten = copy_file_range(state->src_fd,
+					   &state->src_off,
+					   state->dst_fd,
+					   &state->dst_off,
+					   len,
+					   0);
+		if (nwritten == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			state->vfs_aio_state.error = errno;
+			break;
+		}
+		if (nwritten == 0) {
+			/*
+			 * The source file got truncated under us
+			 */
+			state->vfs_aio_state.error = ENODATA;
+			break;
+		}
+		state->copied += nwritten;
+	}
+#endif
+
+done:
+	PROFILE_TIMESTAMP(&end_time);
+
+	state->vfs_aio_state.duration = nsec_time_diff(&end_time, &start_time);
+}
+
+static int vfswrap_kernel_copy_state_destructor(
+	struct vfswrap_kernel_copy_state *state)
+{
+	return -1;
+}
+
+static void vfswrap_kernel_copy_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	struct vfswrap_kernel_copy_state *state = tevent_req_data(
+		req, struct vfswrap_kernel_copy_state);
+	int ret;
+
+	ret = pthreadpool_tevent_job_recv(subreq);
+	TALLOC_FREE(subreq);
+	talloc_set_destructor(state, NULL);
+	if (ret != 0) {
+		if (ret != EAGAIN) {
+			tevent_req_error(req, ret);
+			return;
+		}
+		/*
+		 * No thread available, fallback to sync processing.
+		 */
+		vfswrap_kernel_copy_do(state);
+	}
+
+	tevent_req_done(req);
+}
+
+/*
+ * Returns the number of bytes copied, which might be less than
+ * requested, even on error.
+ */
+static off_t vfswrap_kernel_copy_recv(struct tevent_req *req,
+				      struct vfs_aio_state *vfs_aio_state)
+{
+	struct vfswrap_kernel_copy_state *state = tevent_req_data(
+		req, struct vfswrap_kernel_copy_state);
+
+	if (tevent_req_is_unix_error(req, &vfs_aio_state->error)) {
+		return 0;
+	}
+
+	*vfs_aio_state = state->vfs_aio_state;
+	return state->copied;
+}
+
 struct vfswrap_offload_write_state {
 	uint8_t *buf;
 	bool read_lck_locked;
@@ -1770,6 +2080,7 @@ struct vfswrap_offload_write_state {
 	off_t to_copy;
 	off_t remaining;
 	size_t next_io_size;
+	bool clone;
 };
 
 static void vfswrap_offload_write_cleanup(struct tevent_req *req,
@@ -1789,6 +2100,7 @@ static void vfswrap_offload_write_cleanup(struct tevent_req *req,
 }
 
 static NTSTATUS vfswrap_offload_write_loop(struct tevent_req *req);
+static NTSTATUS vfswrap_offload_write_kernel(struct tevent_req *req);
 
 static struct tevent_req *vfswrap_offload_write_send(
 	struct vfs_handle_struct *handle,
@@ -1836,9 +2148,16 @@ static struct tevent_req *vfswrap_offload_write_send(
 		return tevent_req_post(req, ev);
 
 	case FSCTL_DUP_EXTENTS_TO_FILE:
-		DBG_DEBUG("COW clones not supported by vfs_default\n");
-		tevent_req_nterror(req, NT_STATUS_INVALID_PARAMETER);
-		return tevent_req_post(req, ev);
+		if ((dest_fsp->conn->fs_capabilities &
+		     FILE_SUPPORTS_BLOCK_REFCOUNTING) == 0)
+		{
+			DBG_DEBUG("COW clones not enabled on this share\n");
+			tevent_req_nterror(req, NT_STATUS_INVALID_PARAMETER);
+			return tevent_req_post(req, ev);
+		}
+		/* dup extents does not use locking */
+		state->clone = true;
+		break;
 
 	default:
 		tevent_req_nterror(req, NT_STATUS_INTERNAL_ERROR);
@@ -1846,7 +2165,7 @@ static struct tevent_req *vfswrap_offload_write_send(
 	}
 
 	/*
-	 * From here on we assume a copy-chunk fsctl
+	 * From here on we assume a copy-chunk or dup extents fsctl
 	 */
 
 	if (to_copy == 0) {
@@ -1877,11 +2196,6 @@ static struct tevent_req *vfswrap_offload_write_send(
 	state->src_ev = src_fsp->conn->sconn->ev_ctx;
 	state->src_fsp = src_fsp;
 
-	state->buf = talloc_array(state, uint8_t, num);
-	if (tevent_req_nomem(state->buf, req)) {
-		return tevent_req_post(req, ev);
-	}
-
 	status = vfs_stat_fsp(src_fsp);
 	if (tevent_req_nterror(req, status)) {
 		return tevent_req_post(req, ev);
@@ -1901,7 +2215,17 @@ static struct tevent_req *vfswrap_offload_write_send(
 		return tevent_req_post(req, ev);
 	}
 
-	status = vfswrap_offload_write_loop(req);
+	if (vfswrap_offload_fsp_is_local(src_fsp) &&
+	    vfswrap_offload_fsp_is_local(dest_fsp))
+	{
+		status = vfswrap_offload_write_kernel(req);
+	} else if (state->clone) {
+		DBG_DEBUG("Can't clone %s, no kernel file descriptor\n",
+			  fsp_str_dbg(src_fsp));
+		status = NT_STATUS_NOT_SUPPORTED;
+	} else {
+		status = vfswrap_offload_write_loop(req);
+	}
 	if (!NT_STATUS_IS_OK(status)) {
 		tevent_req_nterror(req, status);
 		return tevent_req_post(req, ev);
@@ -1910,6 +2234,144 @@ static struct tevent_req *vfswrap_offload_write_send(
 	return req;
 }
 
+static void vfswrap_offload_write_kernel_done(struct tevent_req *subreq);
+
+static NTSTATUS vfswrap_offload_write_kernel(struct tevent_req *req)
+{
+	struct vfswrap_offload_write_state *state = tevent_req_data(
+		req, struct vfswrap_offload_write_state);
+	struct tevent_req *subreq = NULL;
+	struct lock_struct read_lck;
+	struct lock_struct write_lck;
+	bool ok;
+
+	/*
+	 * This is called under the context of state->src_fsp.
+	 */
+
+	if (!state->clone) {
+		init_strict_lock_struct(state->src_fsp,
+				state->src_fsp->op->global->open_persistent_id,
+				state->src_off,
+				state->remaining,
+				READ_LOCK,
+				&read_lck);
+
+		ok = SMB_VFS_STRICT_LOCK_CHECK(state->src_fsp->conn,
+					       state->src_fsp,
+					       &read_lck);
+		if (!ok) {
+			return NT_STATUS_FILE_LOCK_CONFLICT;
+		}
+
+		ok = change_to_user_by_fsp(state->dst_fsp);
+		if (!ok) {
+			return NT_STATUS_INTERNAL_ERROR;
+		}
+
+		init_strict_lock_struct(state->dst_fsp,
+				state->dst_fsp->op->global->open_persistent_id,
+				state->dst_off,
+				state->remaining,
+				WRITE_LOCK,
+				&write_lck);
+
+		ok = SMB_VFS_STRICT_LOCK_CHECK(state->dst_fsp->conn,
+					       state->dst_fsp,
+					       &write_lck);
+		if (!ok) {
+			return NT_STATUS_FILE_LOCK_CONFLICT;
+		}
+	}
+
+	subreq = vfswrap_kernel_copy_send(state,
+					  state->dst_ev,
+					  state->src_fsp,
+					  state->src_off,
+					  state->dst_fsp,
+					  state->dst_off,
+					  state->remaining,
+					  state->clone);
+	if (subreq == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+	tevent_req_set_callback(subreq, vfswrap_offload_write_kernel_done, req);
+
+	return NT_STATUS_OK;
+}
+
+static void vfswrap_offload_write_kernel_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	struct vfswrap_offload_write_state *state = tevent_req_data(
+		req, struct vfswrap_offload_write_state);
+	struct vfs_aio_state aio_state = { 0 };
+	off_t copied;
+	NTSTATUS status;
+	bool ok;
+
+	copied = vfswrap_kernel_copy_recv(subreq, &aio_state);
+	TALLOC_FREE(subreq);
+
+	if (state->remaining < copied) {
+		/* Paranoia check */
+		tevent_req_nterror(req, NT_STATUS_INTERNAL_ERROR);
+		return;
+	}
+	state->src_off += copied;
+	state->dst_off += copied;
+	state->remaining -= copied;
+
+	if (state->remaining == 0) {
+		tevent_req_done(req);
+		return;
+	}
+
+	if (state->clone) {
+		DBG_INFO("FICLONERANGE failed: %s\n", strerror(aio_state.error));
+		tevent_req_nterror(req, map_nt_error_from_unix(aio_state.error));
+		return;
+	}
+
+	switch (aio_state.error) {
+	case ENOSYS:
+	case EOPNOTSUPP:
+	case EXDEV:
+	case EINVAL:
+	case EBADF:
+		/*
+		 * Not supported for this kind of file or filesystem,
+		 * copy the rest through userspace.
+		 */
+		DBG_DEBUG("copy_file_range failed: %s, falling back "
+			  "to read/write\n", strerror(aio_state.error));
+		break;
+	case ENODATA:
+		DBG_ERR("Short copy, %jd bytes left\n",
+			(intmax_t)state->remaining);
+		tevent_req_nterror(req, NT_STATUS_IO_DEVICE_ERROR);
+		return;
+	default:
+		DBG_ERR("copy_file_range failed: %s\n",
+			strerror(aio_state.error));
+		tevent_req_nterror(req, map_nt_error_from_unix(aio_state.error));
+		return;
+	}
+
+	ok = change_to_user_by_fsp(state->src_fsp);
+	if (!ok) {
+		tevent_req_nterror(req, NT_STATUS_INTERNAL_ERROR);
+		return;
+	}
+
+	status = vfswrap_offload_write_loop(req);
+	if (!NT_STATUS_IS_OK(status)) {
+		tevent_req_nterror(req, status);
+		return;
+	}
+}
+
 static void vfswrap_offload_write_read_done(struct tevent_req *subreq);
 
 static NTSTATUS vfswrap_offload_write_loop(struct tevent_req *req)
@@ -1924,6 +2386,15 @@ static NTSTATUS vfswrap_offload_write_loop(struct tevent_req *req)
 	 * This is called under the context of state->src_fsp.
 	 */
 
+	if (state->buf == NULL) {
+		size_t num = MIN(state->remaining, COPYCHUNK_MAX_TOTAL_LEN);
+
+		state->buf = talloc_array(state, uint8_t, num);
+		if (state->buf == NULL) {
+			return NT_STATUS_NO_MEMORY;
+		}
+	}
+
 	state->next_io_size = MIN(state->remaining, talloc_array_length(state->buf));
 
 	init_strict_lock_struct(state->src_fsp,
@@ -3057,10 +3528,11 @@ static struct tevent_req *vfswrap_getxattrat_send(
 
 	SMBPROFILE_BYTES_ASYNC_SET_IDLE(state->profile_bytes);
 
-	subreq = pthreadpool_tevent_job_send(
+	subreq = pthreadpool_tevent_job_send_prio(
 			state,
 			ev,
 			dir_fsp->conn->sconn->pool,
+			PTHREADPOOL_PRIO_HIGH,
 			vfswrap_getxattrat_do_async,
 			state);
 	if (tevent_req_nomem(subreq, req)) {
@@ -3376,6 +3848,7 @@ static struct vfs_fn_pointers vfs_default_fns = {
 	.opendir_fn = vfswrap_opendir,
 	.fdopendir_fn = vfswrap_fdopendir,
 	.readdir_fn = vfswrap_readdir,
+	.readdirplus_fn = vfswrap_readdirplus,
 	.readdir_attr_fn = vfswrap_readdir_attr,
 	.seekdir_fn = vfswrap_seekdir,
 	.telldir_fn = vfswrap_telldir,
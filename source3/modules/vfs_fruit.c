@@ -34,6 +34,7 @@
 #include "lib/util/tevent_unix.h"
 #include "offload_token.h"
 #include "string_replace.h"
+#include "lib/util/memcache.h"
 
 /*
  * Enhanced OS X and Netatalk compatibility
@@ -157,6 +158,107 @@ struct fruit_config_data {
 	bool readdir_attr_max_access;
 };
 
+/*
+ * Per process cache of the FinderInfo returned in SMB2 FIND responses.
+ *
+ * The key is taken from the stat info of whatever holds the metadata:
+ * the AFP_AfpInfo stream or, for netatalk metadata, the file carrying
+ * the xattr. Writing the metadata moves the ctime there, so entries
+ * of changed files are simply not found anymore.
+ */
+
+static struct memcache *fruit_finder_info_cache;
+
+struct fruit_finder_info_key {
+	uint64_t dev;
+	uint64_t ino;
+	struct timespec ctime;
+	off_t size;
+};
+
+/* Rough per entry overhead of memcache, see memcache_element_size() */
+#define FRUIT_FINDER_INFO_CACHE_ENTRY_OVERHEAD 64
+
+static void fruit_finder_info_cache_init(int max_entries)
+{
+	if (max_entries <= 0 || fruit_finder_info_cache != NULL) {
+		return;
+	}
+
+	fruit_finder_info_cache = memcache_init(
+		NULL,
+		(size_t)max_entries *
+		(sizeof(struct fruit_finder_info_key) + AFP_FinderSize +
+		 FRUIT_FINDER_INFO_CACHE_ENTRY_OVERHEAD));
+	if (fruit_finder_info_cache == NULL) {
+		DBG_ERR("memcache_init failed\n");
+	}
+}
+
+static bool fruit_finder_info_key(const SMB_STRUCT_STAT *st,
+				  struct fruit_finder_info_key *key)
+{
+	struct timespec now = timespec_current();
+
+	if (fruit_finder_info_cache == NULL || !VALID_STAT(*st)) {
+		return false;
+	}
+
+	if (timespec_too_recent(&st->st_ex_ctime, &now)) {
+		return false;
+	}
+
+	ZERO_STRUCTP(key);
+	key->dev = st->st_ex_dev;
+	key->ino = st->st_ex_ino;
+	key->ctime = st->st_ex_ctime;
+	key->size = st->st_ex_size;
+
+	return true;
+}
+
+static bool fruit_finder_info_cache_fetch(const SMB_STRUCT_STAT *st,
+					  AfpInfo *ai)
+{
+	struct fruit_finder_info_key key;
+	DATA_BLOB value;
+	bool ok;
+
+	ok = fruit_finder_info_key(st, &key);
+	if (!ok) {
+		return false;
+	}
+
+	ok = memcache_lookup(fruit_finder_info_cache,
+			     FRUIT_FINDER_INFO_CACHE,
+			     data_blob_const(&key, sizeof(key)),
+			     &value);
+	if (!ok || value.length != AFP_FinderSize) {
+		return false;
+	}
+
+	memcpy(&ai->afpi_FinderInfo[0], value.data, AFP_FinderSize);
+	return true;
+}
+
+static void fruit_finder_info_cache_store(const SMB_STRUCT_STAT *st,
+					  const AfpInfo *ai)
+{
+	struct fruit_finder_info_key key;
+	bool ok;
+
+	ok = fruit_finder_info_key(st, &key);
+	if (!ok) {
+		return;
+	}
+
+	memcache_add(fruit_finder_info_cache,
+		     FRUIT_FINDER_INFO_CACHE,
+		     data_blob_const(&key, sizeof(key)),
+		     data_blob_const(&ai->afpi_FinderInfo[0],
+				     AFP_FinderSize));
+}
+
 static const struct enum_list fruit_rsrc[] = {
 	{FRUIT_RSRC_STREAM, "stream"}, /* pass on to vfs_streams_xattr */
 	{FRUIT_RSRC_ADFILE, "file"}, /* ._ AppleDouble file */
@@ -2251,6 +2353,9 @@ static int init_fruit_config(vfs_handle_struct *handle)
 	config->readdir_attr_max_access = lp_parm_bool(
 		SNUM(handle->conn), "readdir_attr", "aapl_max_access", true);
 
+	fruit_finder_info_cache_init(lp_parm_int(
+		-1, "readdir_attr", "finder_info_cache_entries", 0));
+
 	config->model = lp_parm_const_string(
 		-1, FRUIT_PARAM_TYPE_NAME, "model", "MacSamba");
 
@@ -2980,6 +3085,11 @@ static bool readdir_attr_meta_finderi_stream(
 		return false;
 	}
 
+	if (fruit_finder_info_cache_fetch(&stream_name->st, ai)) {
+		TALLOC_FREE(stream_name);
+		return true;
+	}
+
 	status = SMB_VFS_CREATE_FILE(
 		handle->conn,                           /* conn */
 		NULL,                                   /* req */
@@ -3001,9 +3111,8 @@ static bool readdir_attr_meta_finderi_stream(
 		NULL,                                   /* pinfo */
 		NULL, NULL);				/* create context */
 
-	TALLOC_FREE(stream_name);
-
 	if (!NT_STATUS_IS_OK(status)) {
+		TALLOC_FREE(stream_name);
 		return false;
 	}
 
@@ -3018,12 +3127,15 @@ static bool readdir_attr_meta_finderi_stream(
 	memcpy(&ai->afpi_FinderInfo[0], &buf[AFP_OFF_FinderInfo],
 	       AFP_FinderSize);
 
+	fruit_finder_info_cache_store(&stream_name->st, ai);
+
 	ok = true;
 
 fail:
 	if (fsp != NULL) {
 		close_file(NULL, fsp, NORMAL_CLOSE);
 	}
+	TALLOC_FREE(stream_name);
 
 	return ok;
 }
@@ -3036,6 +3148,10 @@ static bool readdir_attr_meta_finderi_netatalk(
 	struct adouble *ad = NULL;
 	char *p = NULL;
 
+	if (fruit_finder_info_cache_fetch(&smb_fname->st, ai)) {
+		return true;
+	}
+
 	ad = ad_get(talloc_tos(), handle, smb_fname, ADOUBLE_META);
 	if (ad == NULL) {
 		return false;
@@ -3050,6 +3166,8 @@ static bool readdir_attr_meta_finderi_netatalk(
 
 	memcpy(&ai->afpi_FinderInfo[0], p, AFP_FinderSize);
 	TALLOC_FREE(ad);
+
+	fruit_finder_info_cache_store(&smb_fname->st, ai);
 	return true;
 }
 
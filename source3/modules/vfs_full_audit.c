@@ -70,6 +70,12 @@
 #include "libcli/security/sddl.h"
 #include "passdb/machine_sid.h"
 #include "lib/util/tevent_ntstatus.h"
+#include "lib/pthreadpool/pthreadpool_tevent.h"
+#include "smbd/globals.h"
+
+#ifdef WITH_PTHREADPOOL
+#include <pthread.h>
+#endif
 
 static int vfs_full_audit_debug_level = DBGC_VFS;
 
@@ -80,6 +86,7 @@ struct vfs_full_audit_private_data {
 	int syslog_priority;
 	bool log_secdesc;
 	bool do_syslog;
+	bool do_async;
 };
 
 #undef DBGC_CLASS
@@ -105,6 +112,7 @@ typedef enum _vfs_op_type {
 	SMB_VFS_OP_OPENDIR,
 	SMB_VFS_OP_FDOPENDIR,
 	SMB_VFS_OP_READDIR,
+	SMB_VFS_OP_READDIRPLUS,
 	SMB_VFS_OP_SEEKDIR,
 	SMB_VFS_OP_TELLDIR,
 	SMB_VFS_OP_REWINDDIR,
@@ -251,6 +259,7 @@ static struct {
 	{ SMB_VFS_OP_OPENDIR,	"opendir" },
 	{ SMB_VFS_OP_FDOPENDIR,	"fdopendir" },
 	{ SMB_VFS_OP_READDIR,	"readdir" },
+	{ SMB_VFS_OP_READDIRPLUS,	"readdirplus" },
 	{ SMB_VFS_OP_SEEKDIR,   "seekdir" },
 	{ SMB_VFS_OP_TELLDIR,   "telldir" },
 	{ SMB_VFS_OP_REWINDDIR, "rewinddir" },
@@ -595,6 +604,279 @@ static TALLOC_CTX *do_log_ctx(void)
         return tmp_do_log_ctx;
 }
 
+/*
+ * With "full_audit:async" the syslog lines are queued per process and
+ * handed to the thread pool in batches, so the audited VFS calls don't
+ * wait for syslog.
+ */
+
+#define AUDIT_QUEUE_BATCH 64
+#define AUDIT_QUEUE_FLUSH_MSEC 100
+
+struct audit_queue_line {
+	int priority;
+	char *msg;
+};
+
+struct audit_queue {
+	unsigned int ref_count;
+	struct pthreadpool_tevent *pool;
+	struct tevent_timer *te;
+	size_t max_lines;
+	uint64_t dropped;
+
+	struct audit_queue_line *pending;
+	size_t num_pending;
+
+	/*
+	 * Batch owned by the running job. "sent" is protected by
+	 * "mutex", so the last disconnect can tell whether the job
+	 * got to it.
+	 */
+	struct tevent_req *job;
+	struct audit_queue_line *sending;
+	size_t num_sending;
+	bool sent;
+#ifdef WITH_PTHREADPOOL
+	pthread_mutex_t mutex;
+#endif
+};
+
+/*
+ * Not freed on the last disconnect, a job still queued in the thread
+ * pool may look at it.
+ */
+static struct audit_queue *audit_queue;
+
+static void audit_queue_emit(struct audit_queue_line *lines, size_t num)
+{
+	size_t i;
+
+	for (i=0; i<num; i++) {
+		syslog(lines[i].priority, "%s", lines[i].msg);
+	}
+}
+
+static void audit_queue_lock(struct audit_queue *q)
+{
+#ifdef WITH_PTHREADPOOL
+	int ret = pthread_mutex_lock(&q->mutex);
+	SMB_ASSERT(ret == 0);
+#endif
+}
+
+static void audit_queue_unlock(struct audit_queue *q)
+{
+#ifdef WITH_PTHREADPOOL
+	int ret = pthread_mutex_unlock(&q->mutex);
+	SMB_ASSERT(ret == 0);
+#endif
+}
+
+static void audit_queue_do(void *private_data)
+{
+	struct audit_queue *q = talloc_get_type_abort(
+		private_data, struct audit_queue);
+
+	audit_queue_lock(q);
+	if (!q->sent) {
+		audit_queue_emit(q->sending, q->num_sending);
+		q->sent = true;
+	}
+	audit_queue_unlock(q);
+}
+
+static void audit_queue_done(struct tevent_req *subreq);
+
+static bool audit_queue_add(struct audit_queue *q, int priority,
+			    const char *fmt, ...) PRINTF_ATTRIBUTE(3, 4);
+
+static bool audit_queue_add(struct audit_queue *q, int priority,
+			    const char *fmt, ...)
+{
+	struct audit_queue_line *tmp = NULL;
+	va_list ap;
+	char *msg;
+
+	tmp = talloc_realloc(q, q->pending, struct audit_queue_line,
+			     q->num_pending + 1);
+	if (tmp == NULL) {
+		return false;
+	}
+	q->pending = tmp;
+
+	va_start(ap, fmt);
+	msg = talloc_vasprintf(q->pending, fmt, ap);
+	va_end(ap);
+	if (msg == NULL) {
+		return false;
+	}
+
+	q->pending[q->num_pending] = (struct audit_queue_line) {
+		.priority = priority, .msg = msg,
+	};
+	q->num_pending += 1;
+	return true;
+}
+
+static void audit_queue_send(struct audit_queue *q)
+{
+	TALLOC_FREE(q->te);
+
+	if ((q->job != NULL) || (q->num_pending == 0)) {
+		return;
+	}
+
+	q->sending = q->pending;
+	q->num_sending = q->num_pending;
+	q->pending = NULL;
+	q->num_pending = 0;
+	q->sent = false;
+
+	q->job = pthreadpool_tevent_job_send(q, global_event_context(),
+					     q->pool, audit_queue_do, q);
+	if (q->job == NULL) {
+		/* Better late than never */
+		audit_queue_emit(q->sending, q->num_sending);
+		TALLOC_FREE(q->sending);
+		q->num_sending = 0;
+		return;
+	}
+	tevent_req_set_callback(q->job, audit_queue_done, q);
+}
+
+static void audit_queue_done(struct tevent_req *subreq)
+{
+	struct audit_queue *q = tevent_req_callback_data(
+		subreq, struct audit_queue);
+	int ret;
+
+	ret = pthreadpool_tevent_job_recv(subreq);
+	TALLOC_FREE(subreq);
+	q->job = NULL;
+
+	if (ret != 0) {
+		/* Couldn't get a thread, do it ourselves */
+		audit_queue_do(q);
+	}
+
+	TALLOC_FREE(q->sending);
+	q->num_sending = 0;
+
+	audit_queue_send(q);
+}
+
+static void audit_queue_timer(struct tevent_context *ev,
+			      struct tevent_timer *te,
+			      struct timeval now,
+			      void *private_data)
+{
+	struct audit_queue *q = talloc_get_type_abort(
+		private_data, struct audit_queue);
+
+	q->te = NULL;
+	audit_queue_send(q);
+}
+
+static void audit_queue_log(struct audit_queue *q, int priority,
+			    const char *audit_pre, const char *op_name,
+			    const char *err_msg, const char *op_msg)
+{
+	if (q->num_pending >= q->max_lines) {
+		q->dropped += 1;
+		return;
+	}
+
+	if (q->dropped != 0) {
+		if (!audit_queue_add(q, priority,
+				     "full_audit: queue overflow, "
+				     "dropped %"PRIu64" messages",
+				     q->dropped)) {
+			return;
+		}
+		q->dropped = 0;
+	}
+
+	if (!audit_queue_add(q, priority, "%s|%s|%s|%s\n",
+			     audit_pre, op_name, err_msg, op_msg)) {
+		q->dropped += 1;
+		return;
+	}
+
+	if (q->num_pending >= AUDIT_QUEUE_BATCH) {
+		audit_queue_send(q);
+		return;
+	}
+
+	if (q->te == NULL) {
+		q->te = tevent_add_timer(
+			global_event_context(), q,
+			timeval_current_ofs_msec(AUDIT_QUEUE_FLUSH_MSEC),
+			audit_queue_timer, q);
+		if (q->te == NULL) {
+			audit_queue_send(q);
+		}
+	}
+}
+
+static bool audit_queue_get(vfs_handle_struct *handle)
+{
+	struct audit_queue *q = audit_queue;
+
+	if (q == NULL) {
+		q = talloc_zero(NULL, struct audit_queue);
+		if (q == NULL) {
+			return false;
+		}
+#ifdef WITH_PTHREADPOOL
+		if (pthread_mutex_init(&q->mutex, NULL) != 0) {
+			TALLOC_FREE(q);
+			return false;
+		}
+#endif
+		q->pool = handle->conn->sconn->pool;
+		audit_queue = q;
+	}
+
+	q->max_lines = MAX(q->max_lines,
+			   lp_parm_ulong(SNUM(handle->conn), "full_audit",
+					 "queue size", 10000));
+	q->ref_count += 1;
+	return true;
+}
+
+/*
+ * On the last disconnect log everything still queued before
+ * returning, the process might be about to exit.
+ */
+static void audit_queue_put(void)
+{
+	struct audit_queue *q = audit_queue;
+
+	q->ref_count -= 1;
+	if (q->ref_count != 0) {
+		return;
+	}
+
+	TALLOC_FREE(q->te);
+
+	audit_queue_lock(q);
+	if ((q->job != NULL) && !q->sent) {
+		audit_queue_emit(q->sending, q->num_sending);
+		q->sent = true;
+	}
+	audit_queue_unlock(q);
+
+	if (q->dropped != 0) {
+		syslog(LOG_WARNING, "full_audit: queue overflow, "
+		       "dropped %"PRIu64" messages", q->dropped);
+		q->dropped = 0;
+	}
+	audit_queue_emit(q->pending, q->num_pending);
+	TALLOC_FREE(q->pending);
+	q->num_pending = 0;
+}
+
 static void do_log(vfs_op_type op, bool success, vfs_handle_struct *handle,
 		   const char *format, ...) PRINTF_ATTRIBUTE(4, 5);
 
@@ -641,6 +923,13 @@ static void do_log(vfs_op_type op, bool success, vfs_handle_struct *handle,
 		 */
 		priority = pd->syslog_priority | pd->syslog_facility;
 
+		if (pd->do_async) {
+			audit_queue_log(audit_queue, priority,
+					audit_pre ? audit_pre : "",
+					audit_opname(op), err_msg, op_msg);
+			goto out;
+		}
+
 		syslog(priority, "%s|%s|%s|%s\n",
 		       audit_pre ? audit_pre : "",
 		       audit_opname(op), err_msg, op_msg);
@@ -753,6 +1042,11 @@ static int smb_full_audit_connect(vfs_handle_struct *handle,
 	}
 #endif
 
+	if (pd->do_syslog &&
+	    lp_parm_bool(SNUM(handle->conn), "full_audit", "async", false)) {
+		pd->do_async = audit_queue_get(handle);
+	}
+
 	pd->success_ops = init_bitmap(
 		pd, lp_parm_string_list(SNUM(handle->conn), "full_audit",
 					"success", none));
@@ -772,11 +1066,21 @@ static int smb_full_audit_connect(vfs_handle_struct *handle,
 
 static void smb_full_audit_disconnect(vfs_handle_struct *handle)
 {
+	struct vfs_full_audit_private_data *pd = NULL;
+
 	SMB_VFS_NEXT_DISCONNECT(handle);
 
 	do_log(SMB_VFS_OP_DISCONNECT, True, handle,
 	       "%s", lp_servicename(talloc_tos(), SNUM(handle->conn)));
 
+	SMB_VFS_HANDLE_GET_DATA(handle, pd,
+				struct vfs_full_audit_private_data,
+				return;);
+	if (pd->do_async) {
+		audit_queue_put();
+		pd->do_async = false;
+	}
+
 	/* The bitmaps will be disconnected when the private
 	   data is deleted. */
 }
@@ -968,6 +1272,23 @@ static struct dirent *smb_full_audit_readdir(vfs_handle_struct *handle,
 	return result;
 }
 
+static NTSTATUS smb_full_audit_readdirplus(vfs_handle_struct *handle,
+					   DIR *dirp,
+					   TALLOC_CTX *mem_ctx,
+					   size_t max_entries,
+					   struct vfs_readdirplus_entry **pentries,
+					   size_t *pnum_entries)
+{
+	NTSTATUS status;
+
+	status = SMB_VFS_NEXT_READDIRPLUS(handle, dirp, mem_ctx, max_entries,
+					  pentries, pnum_entries);
+
+	do_log(SMB_VFS_OP_READDIRPLUS, NT_STATUS_IS_OK(status), handle, "");
+
+	return status;
+}
+
 static void smb_full_audit_seekdir(vfs_handle_struct *handle,
 			DIR *dirp, long offset)
 {
@@ -2836,6 +3157,7 @@ static struct vfs_fn_pointers vfs_full_audit_fns = {
 	.opendir_fn = smb_full_audit_opendir,
 	.fdopendir_fn = smb_full_audit_fdopendir,
 	.readdir_fn = smb_full_audit_readdir,
+	.readdirplus_fn = smb_full_audit_readdirplus,
 	.seekdir_fn = smb_full_audit_seekdir,
 	.telldir_fn = smb_full_audit_telldir,
 	.rewind_dir_fn = smb_full_audit_rewinddir,
@@ -549,8 +549,19 @@ static struct dirent *vfs_gluster_readdir(struct vfs_handle_struct *handle,
 		return NULL;
 	}
 
+	/*
+	 * glfs_readdirplus_r() hands back the attributes of the entry
+	 * itself. That is what smbd wants for everything but symlinks:
+	 * the directory layer expects SMB_VFS_STAT() semantics, so leave
+	 * sbuf invalid for those and let the caller stat the target.
+	 * Also ignore entries gluster did not have attributes for.
+	 */
 	if (sbuf != NULL) {
-		smb_stat_ex_from_stat(sbuf, &stat);
+		if (stat.st_mode != 0 && !S_ISLNK(stat.st_mode)) {
+			smb_stat_ex_from_stat(sbuf, &stat);
+		} else {
+			SET_STAT_INVALID(*sbuf);
+		}
 	}
 
 	return dirent;
@@ -30,6 +30,7 @@
 #include "auth.h"
 #include "lib/util/tevent_unix.h"
 #include "lib/util/gpfswrap.h"
+#include "lib/util/dlinklist.h"
 
 #undef DBGC_CLASS
 #define DBGC_CLASS DBGC_VFS
@@ -38,6 +39,29 @@
 #define GPFS_GETACL_NATIVE 0x00000004
 #endif
 
+/*
+ * Directory handles opened with gpfs:readdir_stat, gpfs_stat_x needs
+ * the path of each entry.
+ */
+struct gpfs_readdir_dir {
+	struct gpfs_readdir_dir *prev, *next;
+	DIR *dirp;
+	const char *path;
+};
+
+/*
+ * The windows attributes gpfs_stat_x returned for the entry most
+ * recently read from a directory. smbd asks for the dosmode right
+ * after reading an entry, so one slot is enough.
+ */
+struct gpfs_readdir_winattrs {
+	bool valid;
+	dev_t dev;
+	ino_t ino;
+	struct timespec ctime;
+	unsigned int winflags;
+};
+
 struct gpfs_config_data {
 	struct smbacl4_vfs_params nfs4_params;
 	bool sharemodes;
@@ -52,6 +76,9 @@ struct gpfs_config_data {
 	bool acl;
 	bool settimes;
 	bool recalls;
+	bool readdir_stat;
+	struct gpfs_readdir_dir *dirs;
+	struct gpfs_readdir_winattrs last_entry;
 };
 
 struct gpfs_fsp_extension {
@@ -1523,6 +1550,32 @@ static uint32_t vfs_gpfs_winattrs_to_dosmode(unsigned int winattrs)
 	return dosmode;
 }
 
+static uint32_t vfs_gpfs_iwinflags_to_dosmode(unsigned int winflags)
+{
+	uint32_t dosmode = 0;
+
+	if (winflags & GPFS_IWINFLAG_ARCHIVE){
+		dosmode |= FILE_ATTRIBUTE_ARCHIVE;
+	}
+	if (winflags & GPFS_IWINFLAG_HIDDEN){
+		dosmode |= FILE_ATTRIBUTE_HIDDEN;
+	}
+	if (winflags & GPFS_IWINFLAG_SYSTEM){
+		dosmode |= FILE_ATTRIBUTE_SYSTEM;
+	}
+	if (winflags & GPFS_IWINFLAG_READONLY){
+		dosmode |= FILE_ATTRIBUTE_READONLY;
+	}
+	if (winflags & GPFS_IWINFLAG_SPARSE) {
+		dosmode |= FILE_ATTRIBUTE_SPARSE;
+	}
+	if (winflags & GPFS_IWINFLAG_OFFLINE) {
+		dosmode |= FILE_ATTRIBUTE_OFFLINE;
+	}
+
+	return dosmode;
+}
+
 static unsigned int vfs_gpfs_dosmode_to_winattrs(uint32_t dosmode)
 {
 	unsigned int winattrs = 0;
@@ -1549,6 +1602,196 @@ static unsigned int vfs_gpfs_dosmode_to_winattrs(uint32_t dosmode)
 	return winattrs;
 }
 
+static DIR *vfs_gpfs_readdir_add(struct vfs_handle_struct *handle,
+				 DIR *dirp, const char *path)
+{
+	struct gpfs_config_data *config;
+	struct gpfs_readdir_dir *dir;
+
+	SMB_VFS_HANDLE_GET_DATA(handle, config,
+				struct gpfs_config_data,
+				return dirp);
+
+	if (dirp == NULL || !config->readdir_stat) {
+		return dirp;
+	}
+
+	dir = talloc_zero(config, struct gpfs_readdir_dir);
+	if (dir == NULL) {
+		/* Just read entries without stat information */
+		return dirp;
+	}
+	dir->dirp = dirp;
+	dir->path = talloc_strdup(dir, path);
+	if (dir->path == NULL) {
+		TALLOC_FREE(dir);
+		return dirp;
+	}
+
+	DLIST_ADD(config->dirs, dir);
+	return dirp;
+}
+
+static DIR *vfs_gpfs_opendir(struct vfs_handle_struct *handle,
+			     const struct smb_filename *smb_fname,
+			     const char *mask,
+			     uint32_t attr)
+{
+	DIR *dirp = SMB_VFS_NEXT_OPENDIR(handle, smb_fname, mask, attr);
+
+	return vfs_gpfs_readdir_add(handle, dirp, smb_fname->base_name);
+}
+
+static DIR *vfs_gpfs_fdopendir(struct vfs_handle_struct *handle,
+			       files_struct *fsp,
+			       const char *mask,
+			       uint32_t attr)
+{
+	DIR *dirp = SMB_VFS_NEXT_FDOPENDIR(handle, fsp, mask, attr);
+
+	return vfs_gpfs_readdir_add(handle, dirp, fsp->fsp_name->base_name);
+}
+
+static void vfs_gpfs_iattr_to_stat_ex(const gpfs_iattr64_t *iattr,
+				      SMB_STRUCT_STAT *sbuf)
+{
+	*sbuf = (SMB_STRUCT_STAT) {
+		.st_ex_dev = iattr->ia_dev,
+		.st_ex_ino = iattr->ia_inode,
+		.st_ex_mode = iattr->ia_mode,
+		.st_ex_nlink = iattr->ia_nlink,
+		.st_ex_uid = iattr->ia_uid,
+		.st_ex_gid = iattr->ia_gid,
+		.st_ex_rdev = iattr->ia_rdev,
+		.st_ex_size = iattr->ia_size,
+		.st_ex_atime.tv_sec = iattr->ia_atime.tv_sec,
+		.st_ex_atime.tv_nsec = iattr->ia_atime.tv_nsec,
+		.st_ex_mtime.tv_sec = iattr->ia_mtime.tv_sec,
+		.st_ex_mtime.tv_nsec = iattr->ia_mtime.tv_nsec,
+		.st_ex_ctime.tv_sec = iattr->ia_ctime.tv_sec,
+		.st_ex_ctime.tv_nsec = iattr->ia_ctime.tv_nsec,
+		.st_ex_btime.tv_sec = iattr->ia_createtime.tv_sec,
+		.st_ex_btime.tv_nsec = iattr->ia_createtime.tv_nsec,
+		.st_ex_calculated_birthtime = false,
+		.st_ex_blksize = iattr->ia_blocksize,
+		.st_ex_blocks = iattr->ia_blocks,
+	};
+}
+
+/*
+ * With gpfs:readdir_stat one gpfs_stat_x call per entry returns the
+ * stat information, creation time and windows attributes. smbd then
+ * neither stats the entry nor calls gpfs_get_winattrs_path for it.
+ */
+static struct dirent *vfs_gpfs_readdir(struct vfs_handle_struct *handle,
+				       DIR *dirp,
+				       SMB_STRUCT_STAT *sbuf)
+{
+	struct gpfs_config_data *config;
+	struct gpfs_readdir_dir *dir;
+	struct dirent *result;
+	gpfs_iattr64_t iattr = { 0 };
+	unsigned int litemask = 0;
+	char *path;
+	int ret;
+
+	SMB_VFS_HANDLE_GET_DATA(handle, config,
+				struct gpfs_config_data,
+				return NULL);
+
+	result = SMB_VFS_NEXT_READDIR(handle, dirp, sbuf);
+	if (result == NULL || sbuf == NULL || !config->readdir_stat) {
+		return result;
+	}
+
+	for (dir = config->dirs; dir != NULL; dir = dir->next) {
+		if (dir->dirp == dirp) {
+			break;
+		}
+	}
+	if (dir == NULL) {
+		return result;
+	}
+
+	if (ISDOT(result->d_name) || ISDOTDOT(result->d_name)) {
+		/* .. can be outside of GPFS */
+		return result;
+	}
+
+	path = talloc_asprintf(talloc_tos(), "%s/%s",
+			       dir->path, result->d_name);
+	if (path == NULL) {
+		return result;
+	}
+
+	ret = gpfswrap_stat_x(path, &litemask, &iattr, sizeof(iattr));
+	TALLOC_FREE(path);
+	if (ret == -1) {
+		/* Let smbd stat the entry as usual */
+		DBG_DEBUG("gpfs_stat_x failed for %s: %s\n",
+			  result->d_name, strerror(errno));
+		return result;
+	}
+
+	vfs_gpfs_iattr_to_stat_ex(&iattr, sbuf);
+
+	config->last_entry = (struct gpfs_readdir_winattrs) {
+		.valid = true,
+		.dev = sbuf->st_ex_dev,
+		.ino = sbuf->st_ex_ino,
+		.ctime = sbuf->st_ex_ctime,
+		.winflags = iattr.ia_winflags,
+	};
+
+	return result;
+}
+
+static int vfs_gpfs_closedir(struct vfs_handle_struct *handle, DIR *dirp)
+{
+	struct gpfs_config_data *config;
+	struct gpfs_readdir_dir *dir;
+
+	SMB_VFS_HANDLE_GET_DATA(handle, config,
+				struct gpfs_config_data,
+				return -1);
+
+	for (dir = config->dirs; dir != NULL; dir = dir->next) {
+		if (dir->dirp == dirp) {
+			DLIST_REMOVE(config->dirs, dir);
+			TALLOC_FREE(dir);
+			break;
+		}
+	}
+
+	return SMB_VFS_NEXT_CLOSEDIR(handle, dirp);
+}
+
+/*
+ * Use the windows attributes vfs_gpfs_readdir got for the entry whose
+ * stat information smb_fname carries
+ */
+static bool vfs_gpfs_readdir_dosmode(struct gpfs_config_data *config,
+				     const struct smb_filename *smb_fname,
+				     uint32_t *dosmode)
+{
+	struct gpfs_readdir_winattrs *last = &config->last_entry;
+
+	if (!last->valid) {
+		return false;
+	}
+	last->valid = false;
+
+	if (smb_fname->st.st_ex_dev != last->dev ||
+	    smb_fname->st.st_ex_ino != last->ino ||
+	    timespec_compare(&smb_fname->st.st_ex_ctime, &last->ctime) != 0)
+	{
+		return false;
+	}
+
+	*dosmode |= vfs_gpfs_iwinflags_to_dosmode(last->winflags);
+	return true;
+}
+
 static int get_dos_attr_with_capability(struct smb_filename *smb_fname,
 					struct gpfs_winattr *attr)
 {
@@ -1607,6 +1850,10 @@ static NTSTATUS vfs_gpfs_get_dos_attributes(struct vfs_handle_struct *handle,
 						       smb_fname, dosmode);
 	}
 
+	if (vfs_gpfs_readdir_dosmode(config, smb_fname, dosmode)) {
+		return NT_STATUS_OK;
+	}
+
 	ret = gpfswrap_get_winattrs_path(smb_fname->base_name, &attrs);
 	if (ret == -1 && errno == ENOSYS) {
 		return SMB_VFS_NEXT_GET_DOS_ATTRIBUTES(handle, smb_fname,
@@ -1714,6 +1961,8 @@ static NTSTATUS vfs_gpfs_set_dos_attributes(struct vfs_handle_struct *handle,
 						       smb_fname, dosmode);
 	}
 
+	config->last_entry.valid = false;
+
 	attrs.winAttrs = vfs_gpfs_dosmode_to_winattrs(dosmode);
 	ret = gpfswrap_set_winattrs_path(smb_fname->base_name,
 					 GPFS_WINATTR_SET_ATTRS, &attrs);
@@ -1748,6 +1997,8 @@ static NTSTATUS vfs_gpfs_fset_dos_attributes(struct vfs_handle_struct *handle,
 		return SMB_VFS_NEXT_FSET_DOS_ATTRIBUTES(handle, fsp, dosmode);
 	}
 
+	config->last_entry.valid = false;
+
 	attrs.winAttrs = vfs_gpfs_dosmode_to_winattrs(dosmode);
 	ret = gpfswrap_set_winattrs(fsp->fh->fd,
 				    GPFS_WINATTR_SET_ATTRS, &attrs);
@@ -2162,6 +2413,9 @@ static int vfs_gpfs_connect(struct vfs_handle_struct *handle,
 	config->recalls = lp_parm_bool(SNUM(handle->conn), "gpfs",
 				       "recalls", true);
 
+	config->readdir_stat = lp_parm_bool(SNUM(handle->conn), "gpfs",
+					    "readdir_stat", false);
+
 	SMB_VFS_HANDLE_SET_DATA(handle, config,
 				NULL, struct gpfs_config_data,
 				return -1);
@@ -2594,6 +2848,10 @@ static struct vfs_fn_pointers vfs_gpfs_fns = {
 	.kernel_flock_fn = vfs_gpfs_kernel_flock,
 	.linux_setlease_fn = vfs_gpfs_setlease,
 	.get_real_filename_fn = vfs_gpfs_get_real_filename,
+	.opendir_fn = vfs_gpfs_opendir,
+	.fdopendir_fn = vfs_gpfs_fdopendir,
+	.readdir_fn = vfs_gpfs_readdir,
+	.closedir_fn = vfs_gpfs_closedir,
 	.get_dos_attributes_fn = vfs_gpfs_get_dos_attributes,
 	.get_dos_attributes_send_fn = vfs_not_implemented_get_dos_attributes_send,
 	.get_dos_attributes_recv_fn = vfs_not_implemented_get_dos_attributes_recv,
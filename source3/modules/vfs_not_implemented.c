@@ -146,6 +146,16 @@ struct dirent *vfs_not_implemented_readdir(vfs_handle_struct *handle,
 	return NULL;
 }
 
+NTSTATUS vfs_not_implemented_readdirplus(vfs_handle_struct *handle,
+					 DIR *dirp,
+					 TALLOC_CTX *mem_ctx,
+					 size_t max_entries,
+					 struct vfs_readdirplus_entry **pentries,
+					 size_t *pnum_entries)
+{
+	return NT_STATUS_NOT_IMPLEMENTED;
+}
+
 void vfs_not_implemented_seekdir(vfs_handle_struct *handle, DIR *dirp, long offset)
 {
 	;
@@ -1046,6 +1056,7 @@ static struct vfs_fn_pointers vfs_not_implemented_fns = {
 	.opendir_fn = vfs_not_implemented_opendir,
 	.fdopendir_fn = vfs_not_implemented_fdopendir,
 	.readdir_fn = vfs_not_implemented_readdir,
+	.readdirplus_fn = vfs_not_implemented_readdirplus,
 	.seekdir_fn = vfs_not_implemented_seekdir,
 	.telldir_fn = vfs_not_implemented_telldir,
 	.rewind_dir_fn = vfs_not_implemented_rewind_dir,
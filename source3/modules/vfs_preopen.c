@@ -21,24 +21,39 @@
 #include "includes.h"
 #include "system/filesys.h"
 #include "smbd/smbd.h"
-#include "lib/util/sys_rw.h"
-#include "lib/util/sys_rw_data.h"
+#include "smbd/globals.h"
+#include "dbwrap/dbwrap.h"
+#include "dbwrap/dbwrap_open.h"
+#include "util_tdb.h"
+#include "lib/pthreadpool/pthreadpool_tevent.h"
+
+/*
+ * Opens further apart than this are not taken as part of the same
+ * access sequence by "preopen:learn names".
+ */
+#define PREOPEN_LEARN_GAP 10
 
 struct preopen_state;
 
-struct preopen_helper {
+/*
+ * One file being opened and read in the thread pool. A job outlives
+ * its preopen_state if the share is disconnected while it runs.
+ */
+struct preopen_job {
+	struct preopen_job *prev, *next;
 	struct preopen_state *state;
-	struct tevent_fd *fde;
-	pid_t pid;
-	int fd;
-	bool busy;
+	char *fname;
+	void *buf;
+	size_t to_read;
 };
 
 struct preopen_state {
-	int num_helpers;
-	struct preopen_helper *helpers;
+	struct pthreadpool_tevent *pool;
+	int max_jobs;		/* How many numbered files in flight */
+	int num_jobs;
+	struct preopen_job *jobs;
 
-	size_t to_read;		/* How many bytes to read in children? */
+	size_t to_read;		/* How many bytes to read in threads? */
 	int queue_max;
 
 	char *template_fname;	/* Filename to be sent to children */
@@ -52,16 +67,101 @@ struct preopen_state {
 				 */
 
 	name_compare_entry *preopen_names;
+
+	name_compare_entry *learn_names;
+	char *learn_last_fname;	/* last open matching learn_names */
+	time_t learn_last_time;
+	char **learn_queued;	/* ring of recently prefetched names */
+	int learn_queued_next;
 };
 
-static void preopen_helper_destroy(struct preopen_helper *c)
+static unsigned int preopen_db_ref_count;
+static struct db_context *preopen_db;
+
+static void preopen_queue_run(struct preopen_state *state);
+
+static void preopen_job_do(void *private_data)
+{
+	struct preopen_job *job = talloc_get_type_abort(
+		private_data, struct preopen_job);
+	ssize_t nread;
+	int fd;
+
+	/*
+	 * This runs with the credentials the pool thread was created
+	 * with. Nothing read ends up with the client, this just primes
+	 * the file system cache.
+	 */
+	fd = open(job->fname, O_RDONLY);
+	if (fd == -1) {
+		return;
+	}
+	nread = read(fd, job->buf, job->to_read);
+	(void)nread;
+	close(fd);
+}
+
+static int preopen_job_destructor(struct preopen_job *job)
 {
-	int status;
-	close(c->fd);
-	c->fd = -1;
-	kill(c->pid, SIGKILL);
-	waitpid(c->pid, &status, 0);
-	c->busy = true;
+	if (job->state != NULL) {
+		DLIST_REMOVE(job->state->jobs, job);
+		job->state->num_jobs -= 1;
+		job->state = NULL;
+	}
+	return 0;
+}
+
+static void preopen_job_done(struct tevent_req *subreq)
+{
+	struct preopen_job *job = tevent_req_callback_data(
+		subreq, struct preopen_job);
+	struct preopen_state *state = job->state;
+	int ret;
+
+	ret = pthreadpool_tevent_job_recv(subreq);
+	if (ret != 0) {
+		DBG_DEBUG("prefetch of %s failed: %s\n",
+			  job->fname, strerror(ret));
+	}
+	TALLOC_FREE(job);
+
+	if (state != NULL) {
+		preopen_queue_run(state);
+	}
+}
+
+static bool preopen_queue_job(struct preopen_state *state,
+			      const char *fname)
+{
+	struct preopen_job *job = NULL;
+	struct tevent_req *subreq = NULL;
+
+	job = talloc_zero(NULL, struct preopen_job);
+	if (job == NULL) {
+		return false;
+	}
+	job->to_read = state->to_read;
+	job->fname = talloc_strdup(job, fname);
+	job->buf = talloc_size(job, MAX(job->to_read, 1));
+	if ((job->fname == NULL) || (job->buf == NULL)) {
+		TALLOC_FREE(job);
+		return false;
+	}
+
+	subreq = pthreadpool_tevent_job_send(job, global_event_context(),
+					     state->pool, preopen_job_do, job);
+	if (subreq == NULL) {
+		TALLOC_FREE(job);
+		return false;
+	}
+	tevent_req_set_callback(subreq, preopen_job_done, job);
+
+	job->state = state;
+	DLIST_ADD(state->jobs, job);
+	state->num_jobs += 1;
+	talloc_set_destructor(job, preopen_job_destructor);
+
+	return true;
 }
 
 static void preopen_queue_run(struct preopen_state *state)
@@ -69,23 +169,17 @@ static void preopen_queue_run(struct preopen_state *state)
 	char *pdelimiter;
 	char delimiter;
 
+	if (state->template_fname == NULL) {
+		return;
+	}
+
 	pdelimiter = state->template_fname + state->number_start
 		+ state->num_digits;
 	delimiter = *pdelimiter;
 
 	while (state->fnum_sent < state->fnum_queue_end) {
 
-		ssize_t written;
-		size_t to_write;
-		int helper;
-
-		for (helper=0; helper<state->num_helpers; helper++) {
-			if (state->helpers[helper].busy) {
-				continue;
-			}
-			break;
-		}
-		if (helper == state->num_helpers) {
+		if (state->num_jobs >= state->max_jobs) {
 			/* everyone is busy */
 			return;
 		}
@@ -96,203 +190,105 @@ static void preopen_queue_run(struct preopen_state *state)
 			 (long unsigned int)(state->fnum_sent + 1));
 		*pdelimiter = delimiter;
 
-		to_write = talloc_get_size(state->template_fname);
-		written = write_data(state->helpers[helper].fd,
-				     state->template_fname, to_write);
-		state->helpers[helper].busy = true;
+		preopen_queue_job(state, state->template_fname);
 
-		if (written != to_write) {
-			preopen_helper_destroy(&state->helpers[helper]);
-		}
 		state->fnum_sent += 1;
 	}
 }
 
-static void preopen_helper_readable(struct tevent_context *ev,
-				    struct tevent_fd *fde, uint16_t flags,
-				    void *priv)
+static int preopen_state_destructor(struct preopen_state *c)
 {
-	struct preopen_helper *helper = (struct preopen_helper *)priv;
-	struct preopen_state *state = helper->state;
-	ssize_t nread;
-	char c;
-
-	if ((flags & TEVENT_FD_READ) == 0) {
-		return;
-	}
+	struct preopen_job *job = NULL;
 
-	nread = read(helper->fd, &c, 1);
-	if (nread <= 0) {
-		preopen_helper_destroy(helper);
-		return;
+	while ((job = c->jobs) != NULL) {
+		DLIST_REMOVE(c->jobs, job);
+		job->state = NULL;
 	}
+	c->num_jobs = 0;
 
-	helper->busy = false;
-
-	preopen_queue_run(state);
-}
+	if (c->learn_names != NULL) {
+		free_namearray(c->learn_names);
+		c->learn_names = NULL;
 
-static int preopen_helpers_destructor(struct preopen_state *c)
-{
-	int i;
-
-	for (i=0; i<c->num_helpers; i++) {
-		if (c->helpers[i].fd == -1) {
-			continue;
+		preopen_db_ref_count -= 1;
+		if (preopen_db_ref_count == 0) {
+			TALLOC_FREE(preopen_db);
 		}
-		preopen_helper_destroy(&c->helpers[i]);
 	}
 
 	return 0;
 }
 
-static bool preopen_helper_open_one(int sock_fd, char **pnamebuf,
-				    size_t to_read, void *filebuf)
-{
-	char *namebuf = *pnamebuf;
-	ssize_t nread;
-	char c = 0;
-	int fd;
-
-	nread = 0;
-
-	do {
-		ssize_t thistime;
-
-		thistime = read(sock_fd, namebuf + nread,
-				talloc_get_size(namebuf) - nread);
-		if (thistime <= 0) {
-			return false;
-		}
-
-		nread += thistime;
-
-		if (nread == talloc_get_size(namebuf)) {
-			namebuf = talloc_realloc(
-				NULL, namebuf, char,
-				talloc_get_size(namebuf) * 2);
-			if (namebuf == NULL) {
-				return false;
-			}
-			*pnamebuf = namebuf;
-		}
-	} while (namebuf[nread - 1] != '\0');
-
-	fd = open(namebuf, O_RDONLY);
-	if (fd == -1) {
-		goto done;
-	}
-	nread = read(fd, filebuf, to_read);
-	close(fd);
-
- done:
-	sys_write_v(sock_fd, &c, 1);
-	return true;
-}
-
-static bool preopen_helper(int fd, size_t to_read)
+static NTSTATUS preopen_init_state(TALLOC_CTX *mem_ctx,
+				   struct pthreadpool_tevent *pool,
+				   size_t to_read, int max_jobs, int queue_max,
+				   struct preopen_state **presult)
 {
-	char *namebuf;
-	void *readbuf;
+	struct preopen_state *result;
 
-	namebuf = talloc_array(NULL, char, 1024);
-	if (namebuf == NULL) {
-		return false;
+	result = talloc_zero(mem_ctx, struct preopen_state);
+	if (result == NULL) {
+		return NT_STATUS_NO_MEMORY;
 	}
 
-	readbuf = talloc_size(NULL, to_read);
-	if (readbuf == NULL) {
-		TALLOC_FREE(namebuf);
-		return false;
-	}
+	result->pool = pool;
+	result->max_jobs = max_jobs;
+	result->to_read = to_read;
+	result->queue_max = queue_max;
+	result->template_fname = NULL;
+	result->fnum_sent = 0;
 
-	while (preopen_helper_open_one(fd, &namebuf, to_read, readbuf)) {
-		;
-	}
+	talloc_set_destructor(result, preopen_state_destructor);
 
-	TALLOC_FREE(readbuf);
-	TALLOC_FREE(namebuf);
-	return false;
+	*presult = result;
+	return NT_STATUS_OK;
 }
 
-static NTSTATUS preopen_init_helper(struct preopen_helper *h)
+static void preopen_free_state(void **ptr)
 {
-	int fdpair[2];
-	NTSTATUS status;
-
-	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fdpair) == -1) {
-		status = map_nt_error_from_unix(errno);
-		DEBUG(10, ("socketpair() failed: %s\n", strerror(errno)));
-		return status;
-	}
-
-	h->pid = fork();
-
-	if (h->pid == -1) {
-		return map_nt_error_from_unix(errno);
-	}
-
-	if (h->pid == 0) {
-		close(fdpair[0]);
-		preopen_helper(fdpair[1], h->state->to_read);
-		exit(0);
-	}
-	close(fdpair[1]);
-	h->fd = fdpair[0];
-	h->fde = tevent_add_fd(global_event_context(), h->state, h->fd,
-			      TEVENT_FD_READ, preopen_helper_readable, h);
-	if (h->fde == NULL) {
-		close(h->fd);
-		h->fd = -1;
-		return NT_STATUS_NO_MEMORY;
-	}
-	h->busy = false;
-	return NT_STATUS_OK;
+	TALLOC_FREE(*ptr);
 }
 
-static NTSTATUS preopen_init_helpers(TALLOC_CTX *mem_ctx, size_t to_read,
-				     int num_helpers, int queue_max,
-				     struct preopen_state **presult)
+/*
+ * The learned successors are shared by all smbds, so that one client
+ * starting an application teaches the sequence to the next one.
+ */
+static bool preopen_learn_init(struct preopen_state *state)
 {
-	struct preopen_state *result;
-	int i;
+	char *dbname;
 
-	result = talloc(mem_ctx, struct preopen_state);
-	if (result == NULL) {
-		return NT_STATUS_NO_MEMORY;
+	state->learn_queued = talloc_zero_array(state, char *,
+						state->queue_max * 2);
+	if (state->learn_queued == NULL) {
+		return false;
 	}
 
-	result->num_helpers = num_helpers;
-	result->helpers = talloc_array(result, struct preopen_helper,
-				       num_helpers);
-	if (result->helpers == NULL) {
-		TALLOC_FREE(result);
-		return NT_STATUS_NO_MEMORY;
+	if (preopen_db != NULL) {
+		preopen_db_ref_count += 1;
+		return true;
 	}
 
-	result->to_read = to_read;
-	result->queue_max = queue_max;
-	result->template_fname = NULL;
-	result->fnum_sent = 0;
-
-	for (i=0; i<num_helpers; i++) {
-		result->helpers[i].state = result;
-		result->helpers[i].fd = -1;
+	dbname = cache_path(talloc_tos(), "preopen.tdb");
+	if (dbname == NULL) {
+		return false;
 	}
 
-	talloc_set_destructor(result, preopen_helpers_destructor);
+	become_root();
+	preopen_db = db_open(NULL, dbname, 0, TDB_DEFAULT,
+			     O_RDWR|O_CREAT, 0600,
+			     DBWRAP_LOCK_ORDER_1, DBWRAP_FLAG_NONE);
+	unbecome_root();
 
-	for (i=0; i<num_helpers; i++) {
-		preopen_init_helper(&result->helpers[i]);
+	if (preopen_db == NULL) {
+		DBG_WARNING("Could not open %s: %s\n",
+			    dbname, strerror(errno));
+		TALLOC_FREE(dbname);
+		return false;
 	}
 
-	*presult = result;
-	return NT_STATUS_OK;
-}
-
-static void preopen_free_helpers(void **ptr)
-{
-	TALLOC_FREE(*ptr);
+	preopen_db_ref_count += 1;
+	TALLOC_FREE(dbname);
+	return true;
 }
 
 static struct preopen_state *preopen_state_get(vfs_handle_struct *handle)
@@ -300,6 +296,7 @@ static struct preopen_state *preopen_state_get(vfs_handle_struct *handle)
 	struct preopen_state *state;
 	NTSTATUS status;
 	const char *namelist;
+	const char *learnlist;
 
 	if (SMB_VFS_HANDLE_TEST_DATA(handle)) {
 		SMB_VFS_HANDLE_GET_DATA(handle, state, struct preopen_state,
@@ -309,13 +306,16 @@ static struct preopen_state *preopen_state_get(vfs_handle_struct *handle)
 
 	namelist = lp_parm_const_string(SNUM(handle->conn), "preopen", "names",
 					NULL);
+	learnlist = lp_parm_const_string(SNUM(handle->conn), "preopen",
+					 "learn names", NULL);
 
-	if (namelist == NULL) {
+	if ((namelist == NULL) && (learnlist == NULL)) {
 		return NULL;
 	}
 
-	status = preopen_init_helpers(
+	status = preopen_init_state(
 		NULL,
+		handle->conn->sconn->pool,
 		lp_parm_int(SNUM(handle->conn), "preopen", "num_bytes", 1),
 		lp_parm_int(SNUM(handle->conn), "preopen", "helpers", 1),
 		lp_parm_int(SNUM(handle->conn), "preopen", "queuelen", 10),
@@ -324,15 +324,35 @@ static struct preopen_state *preopen_state_get(vfs_handle_struct *handle)
 		return NULL;
 	}
 
-	set_namearray(&state->preopen_names, namelist);
+	if (namelist != NULL) {
+		set_namearray(&state->preopen_names, namelist);
 
-	if (state->preopen_names == NULL) {
-		TALLOC_FREE(state);
-		return NULL;
+		if (state->preopen_names == NULL) {
+			TALLOC_FREE(state);
+			return NULL;
+		}
+	}
+
+	if (learnlist != NULL) {
+		name_compare_entry *learn_names = NULL;
+
+		set_namearray(&learn_names, learnlist);
+
+		if (learn_names == NULL) {
+			TALLOC_FREE(state);
+			return NULL;
+		}
+
+		if (state->queue_max <= 0 || !preopen_learn_init(state)) {
+			free_namearray(learn_names);
+			TALLOC_FREE(state);
+			return NULL;
+		}
+		state->learn_names = learn_names;
 	}
 
 	if (!SMB_VFS_HANDLE_TEST_DATA(handle)) {
-		SMB_VFS_HANDLE_SET_DATA(handle, state, preopen_free_helpers,
+		SMB_VFS_HANDLE_SET_DATA(handle, state, preopen_free_state,
 					struct preopen_state, return NULL);
 	}
 
@@ -376,6 +396,104 @@ static bool preopen_parse_fname(const char *fname, unsigned long *pnum,
 	return true;
 }
 
+static char *preopen_learn_fetch(TALLOC_CTX *mem_ctx, const char *fname)
+{
+	TDB_DATA data;
+	NTSTATUS status;
+	char *result;
+
+	status = dbwrap_fetch_bystring(preopen_db, mem_ctx, fname, &data);
+	if (!NT_STATUS_IS_OK(status)) {
+		return NULL;
+	}
+	if ((data.dsize == 0) || (data.dptr[data.dsize-1] != '\0')) {
+		TALLOC_FREE(data.dptr);
+		return NULL;
+	}
+	result = (char *)data.dptr;
+	return result;
+}
+
+static bool preopen_learn_recently_queued(struct preopen_state *state,
+					  const char *fname)
+{
+	int i;
+
+	for (i=0; i<state->queue_max * 2; i++) {
+		if ((state->learn_queued[i] != NULL) &&
+		    (strcmp(state->learn_queued[i], fname) == 0)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void preopen_learn_queue(struct preopen_state *state,
+				const char *fname)
+{
+	int idx = state->learn_queued_next;
+
+	if (!preopen_queue_job(state, fname)) {
+		return;
+	}
+
+	TALLOC_FREE(state->learn_queued[idx]);
+	state->learn_queued[idx] = talloc_strdup(state->learn_queued, fname);
+	state->learn_queued_next = (idx + 1) % (state->queue_max * 2);
+}
+
+/*
+ * Remember that "fname" was opened right after the previous file
+ * matching "preopen:learn names", and prefetch the files that
+ * followed "fname" last time.
+ */
+static void preopen_learn(struct preopen_state *state, const char *fname)
+{
+	TALLOC_CTX *frame = talloc_stackframe();
+	time_t now = time(NULL);
+	const char *name = fname;
+	int i;
+
+	if ((state->learn_last_fname != NULL) &&
+	    (now - state->learn_last_time <= PREOPEN_LEARN_GAP) &&
+	    (strcmp(state->learn_last_fname, fname) != 0)) {
+		char *prev_next = preopen_learn_fetch(
+			frame, state->learn_last_fname);
+
+		if ((prev_next == NULL) || (strcmp(prev_next, fname) != 0)) {
+			NTSTATUS status;
+
+			status = dbwrap_store_bystring(
+				preopen_db, state->learn_last_fname,
+				string_term_tdb_data(fname), TDB_REPLACE);
+			if (!NT_STATUS_IS_OK(status)) {
+				DBG_DEBUG("storing successor of %s failed: "
+					  "%s\n", state->learn_last_fname,
+					  nt_errstr(status));
+			}
+		}
+	}
+
+	TALLOC_FREE(state->learn_last_fname);
+	state->learn_last_fname = talloc_strdup(state, fname);
+	state->learn_last_time = now;
+
+	for (i=0; i<state->queue_max; i++) {
+		char *next = preopen_learn_fetch(frame, name);
+
+		if ((next == NULL) || (strcmp(next, fname) == 0)) {
+			break;
+		}
+		if (!preopen_learn_recently_queued(state, next)) {
+			DBG_DEBUG("%s: prefetching %s\n", fname, next);
+			preopen_learn_queue(state, next);
+		}
+		name = next;
+	}
+
+	TALLOC_FREE(frame);
+}
+
 static int preopen_open(vfs_handle_struct *handle,
 			struct smb_filename *smb_fname, files_struct *fsp,
 			int flags, mode_t mode)
@@ -396,10 +514,21 @@ static int preopen_open(vfs_handle_struct *handle,
 		return -1;
 	}
 
-	if (flags != O_RDONLY) {
+	if ((flags & O_ACCMODE) != O_RDONLY) {
 		return res;
 	}
 
+	if (is_in_path(smb_fname->base_name, state->learn_names, true)) {
+		char *fname = talloc_asprintf(
+			talloc_tos(), "%s/%s",
+			fsp->conn->cwd_fname->base_name, smb_fname->base_name);
+
+		if (fname != NULL) {
+			preopen_learn(state, fname);
+			TALLOC_FREE(fname);
+		}
+	}
+
 	if (!is_in_path(smb_fname->base_name, state->preopen_names, true)) {
 		DEBUG(10, ("%s does not match the preopen:names list\n",
 			   smb_fname_str_dbg(smb_fname)));
@@ -423,9 +552,9 @@ static int preopen_open(vfs_handle_struct *handle,
 
 	if (num > state->fnum_sent) {
 		/*
-		 * Helpers were too slow, there's no point in reading
-		 * files in helpers that we already read in the
-		 * parent.
+		 * Threads were too slow, there's no point in reading
+		 * files in threads that we already read in the
+		 * main thread.
 		 */
 		state->fnum_sent = num;
 	}
@@ -18,6 +18,7 @@
 #include "includes.h"
 #include "system/filesys.h"
 #include "smbd/smbd.h"
+#include "lib/util/tevent_unix.h"
 
 #if defined(HAVE_LINUX_READAHEAD) && ! defined(HAVE_READAHEAD_DECL)
 ssize_t readahead(int fd, off_t offset, size_t count);
@@ -27,14 +28,176 @@ struct readahead_data {
 	off_t off_bound;
 	off_t len;
 	bool didmsg;
+	bool adaptive;
+	off_t max_len;
+};
+
+/*
+ * Per open file state for "readahead:adaptive".
+ */
+struct readahead_stream {
+	off_t last_offset;	/* offset of the previous read */
+	off_t max_end;		/* furthest point read in this stream */
+	off_t ra_end;		/* end of the range already prefetched */
+	off_t window;		/* current readahead window */
+	off_t stride;		/* distance between the last two reads */
+	bool strided;		/* stride seen twice in a row */
 };
 
 /* 
  * This module copes with Vista AIO read requests on Linux
  * by detecting the initial 0x80000 boundary reads and causing
  * the buffer cache to be filled in advance.
+ *
+ * With readahead:adaptive it instead follows the read pattern
+ * of each open file and prefetches ahead of sequential and
+ * constant stride streams, growing the window while the
+ * stream continues.
  */
 
+/*******************************************************************
+ Ask the kernel to fill the buffer cache for a range of a file.
+*******************************************************************/
+
+static void readahead_issue(struct readahead_data *rhd,
+			    files_struct *fsp,
+			    off_t offset,
+			    off_t len,
+			    const char *caller)
+{
+#if defined(HAVE_LINUX_READAHEAD)
+	int err = readahead(fsp->fh->fd, offset, (size_t)len);
+	DEBUG(10,("%s: readahead on fd %u, offset %llu, len %u returned %d\n",
+		caller,
+		(unsigned int)fsp->fh->fd,
+		(unsigned long long)offset,
+		(unsigned int)len,
+		err ));
+#elif defined(HAVE_POSIX_FADVISE)
+	int err = posix_fadvise(fsp->fh->fd, offset, len, POSIX_FADV_WILLNEED);
+	DEBUG(10,("%s: posix_fadvise on fd %u, offset %llu, len %u returned %d\n",
+		caller,
+		(unsigned int)fsp->fh->fd,
+		(unsigned long long)offset,
+		(unsigned int)len,
+		err ));
+#else
+	if (!rhd->didmsg) {
+		DEBUG(0,("%s: no readahead on this platform\n", caller));
+		rhd->didmsg = True;
+	}
+#endif
+}
+
+/*******************************************************************
+ Follow the read pattern on fsp and prefetch ahead of it.
+
+ Clients keep several reads in flight and may spread them over
+ multiple channels, so the reads of one sequential stream arrive
+ slightly out of order. A read counts as part of the stream if it
+ starts within one window of the furthest point read so far.
+*******************************************************************/
+
+static void readahead_adaptive(struct vfs_handle_struct *handle,
+			       struct readahead_data *rhd,
+			       files_struct *fsp,
+			       off_t offset,
+			       size_t count,
+			       const char *caller)
+{
+	struct readahead_stream *rs = NULL;
+	off_t end = offset + count;
+	off_t stride;
+
+	if (count == 0) {
+		return;
+	}
+
+	rs = (struct readahead_stream *)VFS_FETCH_FSP_EXTENSION(handle, fsp);
+	if (rs == NULL) {
+		rs = VFS_ADD_FSP_EXTENSION(handle, fsp,
+					   struct readahead_stream, NULL);
+		if (rs == NULL) {
+			return;
+		}
+		rs->window = rhd->len;
+	}
+
+	stride = offset - rs->last_offset;
+	rs->last_offset = offset;
+
+	if ((offset >= rs->max_end - rs->window - (off_t)count) &&
+	    (offset <= rs->max_end + rs->window))
+	{
+		rs->max_end = MAX(rs->max_end, end);
+		rs->strided = false;
+		rs->stride = 0;
+
+		/*
+		 * Only go back to the kernel once half the window
+		 * has been consumed, and double the window each
+		 * time the stream keeps up with it. The window is
+		 * kept at least one client read wide.
+		 */
+		if (rs->ra_end - rs->max_end >= rs->window / 2) {
+			return;
+		}
+		if (rs->ra_end > 0) {
+			rs->window = MIN(rs->window * 2, rhd->max_len);
+		}
+		rs->window = MAX(rs->window, (off_t)count);
+
+		offset = MAX(rs->ra_end, rs->max_end);
+		rs->ra_end = rs->max_end + rs->window;
+		readahead_issue(rhd, fsp, offset, rs->ra_end - offset, caller);
+		return;
+	}
+
+	/*
+	 * Not sequential, restart the stream here.
+	 */
+	rs->max_end = end;
+	rs->ra_end = 0;
+	rs->window = rhd->len;
+
+	if ((stride > 0) && (stride == rs->stride)) {
+		/*
+		 * Constant stride, e.g. a client pulling one
+		 * column out of a large record file.
+		 */
+		rs->strided = true;
+	} else {
+		rs->strided = false;
+		rs->stride = stride;
+	}
+
+	if (rs->strided) {
+		readahead_issue(rhd, fsp, offset + stride, count, caller);
+	}
+}
+
+/*******************************************************************
+ Look at one read and kick off readahead as configured.
+*******************************************************************/
+
+static void readahead_read(struct vfs_handle_struct *handle,
+			   files_struct *fsp,
+			   off_t offset,
+			   size_t count,
+			   const char *caller)
+{
+	struct readahead_data *rhd = (struct readahead_data *)handle->data;
+
+	if (rhd->adaptive) {
+		readahead_adaptive(handle, rhd, fsp, offset, count, caller);
+		return;
+	}
+
+	if ( offset % rhd->off_bound == 0) {
+		readahead_issue(rhd, fsp, offset, rhd->len, caller);
+	}
+}
+
 /*******************************************************************
  sendfile wrapper that does readahead/posix_fadvise.
 *******************************************************************/
@@ -46,30 +209,8 @@ static ssize_t readahead_sendfile(struct vfs_handle_struct *handle,
 					off_t offset,
 					size_t count)
 {
-	struct readahead_data *rhd = (struct readahead_data *)handle->data;
+	readahead_read(handle, fromfsp, offset, count, "readahead_sendfile");
 
-	if ( offset % rhd->off_bound == 0) {
-#if defined(HAVE_LINUX_READAHEAD)
-		int err = readahead(fromfsp->fh->fd, offset, (size_t)rhd->len);
-		DEBUG(10,("readahead_sendfile: readahead on fd %u, offset %llu, len %u returned %d\n",
-			(unsigned int)fromfsp->fh->fd,
-			(unsigned long long)offset,
-			(unsigned int)rhd->len,
-		        err ));
-#elif defined(HAVE_POSIX_FADVISE)
-		int err = posix_fadvise(fromfsp->fh->fd, offset, (off_t)rhd->len, POSIX_FADV_WILLNEED);
-		DEBUG(10,("readahead_sendfile: posix_fadvise on fd %u, offset %llu, len %u returned %d\n",
-			(unsigned int)fromfsp->fh->fd,
-			(unsigned long long)offset,
-			(unsigned int)rhd->len,
-			err ));
-#else
-		if (!rhd->didmsg) {
-			DEBUG(0,("readahead_sendfile: no readahead on this platform\n"));
-			rhd->didmsg = True;
-		}
-#endif
-	}
 	return SMB_VFS_NEXT_SENDFILE(handle,
 					tofd,
 					fromfsp,
@@ -88,31 +229,70 @@ static ssize_t readahead_pread(vfs_handle_struct *handle,
 				size_t count,
 				off_t offset)
 {
-	struct readahead_data *rhd = (struct readahead_data *)handle->data;
+	readahead_read(handle, fsp, offset, count, "readahead_pread");
 
-	if ( offset % rhd->off_bound == 0) {
-#if defined(HAVE_LINUX_READAHEAD)
-		int err = readahead(fsp->fh->fd, offset, (size_t)rhd->len);
-		DEBUG(10,("readahead_pread: readahead on fd %u, offset %llu, len %u returned %d\n",
-			(unsigned int)fsp->fh->fd,
-			(unsigned long long)offset,
-			(unsigned int)rhd->len,
-			err ));
-#elif defined(HAVE_POSIX_FADVISE)
-		int err = posix_fadvise(fsp->fh->fd, offset, (off_t)rhd->len, POSIX_FADV_WILLNEED);
-		DEBUG(10,("readahead_pread: posix_fadvise on fd %u, offset %llu, len %u returned %d\n",
-			(unsigned int)fsp->fh->fd,
-			(unsigned long long)offset,
-			(unsigned int)rhd->len,
-			err ));
-#else
-		if (!rhd->didmsg) {
-			DEBUG(0,("readahead_pread: no readahead on this platform\n"));
-			rhd->didmsg = True;
-		}
-#endif
-        }
-        return SMB_VFS_NEXT_PREAD(handle, fsp, data, count, offset);
+	return SMB_VFS_NEXT_PREAD(handle, fsp, data, count, offset);
+}
+
+/*******************************************************************
+ async pread wrapper that does readahead/posix_fadvise.
+*******************************************************************/
+
+struct readahead_pread_state {
+	ssize_t ret;
+	struct vfs_aio_state vfs_aio_state;
+};
+
+static void readahead_pread_done(struct tevent_req *subreq);
+
+static struct tevent_req *readahead_pread_send(
+	struct vfs_handle_struct *handle, TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev, struct files_struct *fsp,
+	void *data, size_t n, off_t offset)
+{
+	struct tevent_req *req, *subreq;
+	struct readahead_pread_state *state;
+
+	req = tevent_req_create(mem_ctx, &state,
+				struct readahead_pread_state);
+	if (req == NULL) {
+		return NULL;
+	}
+
+	readahead_read(handle, fsp, offset, n, "readahead_pread_send");
+
+	subreq = SMB_VFS_NEXT_PREAD_SEND(state, ev, handle, fsp, data,
+					 n, offset);
+	if (tevent_req_nomem(subreq, req)) {
+		return tevent_req_post(req, ev);
+	}
+	tevent_req_set_callback(subreq, readahead_pread_done, req);
+	return req;
+}
+
+static void readahead_pread_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	struct readahead_pread_state *state = tevent_req_data(
+		req, struct readahead_pread_state);
+
+	state->ret = SMB_VFS_PREAD_RECV(subreq, &state->vfs_aio_state);
+	TALLOC_FREE(subreq);
+	tevent_req_done(req);
+}
+
+static ssize_t readahead_pread_recv(struct tevent_req *req,
+				    struct vfs_aio_state *vfs_aio_state)
+{
+	struct readahead_pread_state *state = tevent_req_data(
+		req, struct readahead_pread_state);
+
+	if (tevent_req_is_unix_error(req, &vfs_aio_state->error)) {
+		return -1;
+	}
+	*vfs_aio_state = state->vfs_aio_state;
+	return state->ret;
 }
 
 /*******************************************************************
@@ -162,6 +342,20 @@ static int readahead_connect(struct vfs_handle_struct *handle,
 	if (rhd->len == 0) {
 		rhd->len = rhd->off_bound;
 	}
+	rhd->adaptive = lp_parm_bool(SNUM(handle->conn),
+				     "readahead",
+				     "adaptive",
+				     false);
+	rhd->max_len = conv_str_size(lp_parm_const_string(SNUM(handle->conn),
+						"readahead",
+						"max length",
+						NULL));
+	if (rhd->max_len == 0) {
+		rhd->max_len = MAX(rhd->len, 0x1000000);
+	}
+	if (rhd->max_len < rhd->len) {
+		rhd->max_len = rhd->len;
+	}
 
 	handle->data = (void *)rhd;
 	handle->free_data = free_readahead_data;
@@ -171,6 +365,8 @@ static int readahead_connect(struct vfs_handle_struct *handle,
 static struct vfs_fn_pointers vfs_readahead_fns = {
 	.sendfile_fn = readahead_sendfile,
 	.pread_fn = readahead_pread,
+	.pread_send_fn = readahead_pread_send,
+	.pread_recv_fn = readahead_pread_recv,
 	.connect_fn = readahead_connect
 };
 
@@ -38,6 +38,7 @@
 #include "lib/util_path.h"
 #include "libcli/security/security.h"
 #include "lib/util/tevent_unix.h"
+#include "lib/util/binsearch.h"
 
 struct shadow_copy2_config {
 	char *gmt_format;
@@ -53,20 +54,23 @@ struct shadow_copy2_config {
 	char *mount_point;
 	char *rel_connectpath; /* share root, relative to a snapshot root */
 	char *snapshot_basepath; /* the absolute version of snapdir */
+	int snaplist_cache_time; /* seconds to reuse a snaplist, 0 = never */
 };
 
 /* Data-structure to hold the list of snap entries */
 struct shadow_copy2_snapentry {
 	char *snapname;
 	char *time_fmt;
-	struct shadow_copy2_snapentry *next;
-	struct shadow_copy2_snapentry *prev;
 };
 
 struct shadow_copy2_snaplist_info {
-	struct shadow_copy2_snapentry *snaplist; /* snapshot list */
+	/* snapshot list, sorted by time_fmt */
+	struct shadow_copy2_snapentry *snaplist;
+	size_t num_snaps;
 	regex_t *regex; /* Regex to filter snaps */
 	time_t fetch_time; /* snaplist update time */
+	char *snapdir; /* directory the snaplist was read from */
+	struct timespec snapdir_mtime; /* mtime of snapdir when read */
 };
 
 
@@ -89,50 +93,10 @@ static int shadow_copy2_get_shadow_copy_data(
 	struct shadow_copy_data *shadow_copy2_data,
 	bool labels);
 
-/**
- *This function will create a new snapshot list entry and
- * return to the caller. This entry will also be added to
- * the global snapshot list.
- *
- * @param[in]   priv	shadow_copy2 specific data structure
- * @return	Newly   created snapshot entry or NULL on failure
- */
-static struct shadow_copy2_snapentry *shadow_copy2_create_snapentry(
-					struct shadow_copy2_private *priv)
-{
-	struct shadow_copy2_snapentry *tmpentry = NULL;
-
-	tmpentry = talloc_zero(priv->snaps, struct shadow_copy2_snapentry);
-	if (tmpentry == NULL) {
-		DBG_ERR("talloc_zero() failed\n");
-		errno = ENOMEM;
-		return NULL;
-	}
-
-	DLIST_ADD(priv->snaps->snaplist, tmpentry);
-
-	return tmpentry;
-}
-
-/**
- *This function will delete the entire snaplist and reset
- * priv->snaps->snaplist to NULL.
- *
- * @param[in] priv shadow_copye specific data structure
- */
-static void shadow_copy2_delete_snaplist(struct shadow_copy2_private *priv)
-{
-	struct shadow_copy2_snapentry *tmp = NULL;
-
-	while ((tmp = priv->snaps->snaplist) != NULL) {
-		DLIST_REMOVE(priv->snaps->snaplist, tmp);
-		talloc_free(tmp);
-	}
-}
-
 /**
  * Given a timestamp this function searches the global snapshot list
  * and returns the complete snapshot directory name saved in the entry.
+ * The list is sorted by time_fmt, so this is a binary search.
  *
  * @param[in]   priv		shadow_copy2 specific structure
  * @param[in]   timestamp	timestamp corresponding to one of the snapshot
@@ -156,12 +120,11 @@ static ssize_t shadow_copy2_saved_snapname(struct shadow_copy2_private *priv,
 
 	snaptime_len = -1;
 
-	for (entry = priv->snaps->snaplist; entry; entry = entry->next) {
-		if (strcmp(entry->time_fmt, snap_str) == 0) {
-			snaptime_len = snprintf(snap_str, len, "%s",
-						entry->snapname);
-			return snaptime_len;
-		}
+	BINARY_ARRAY_SEARCH(priv->snaps->snaplist, priv->snaps->num_snaps,
+			    time_fmt, snap_str, strcmp, entry);
+	if (entry != NULL) {
+		snaptime_len = snprintf(snap_str, len, "%s", entry->snapname);
+		return snaptime_len;
 	}
 
 	snap_str[0] = 0;
@@ -201,7 +164,7 @@ static bool shadow_copy2_update_snaplist(struct vfs_handle_struct *handle,
 	 * required snapshot time is greater than the last fetched snaplist
 	 * time.
 	 */
-	if (seconds > 0 || (priv->snaps->snaplist == NULL)) {
+	if (seconds > 0 || (priv->snaps->num_snaps == 0)) {
 		smb_fname.base_name = discard_const_p(char, ".");
 		fsp.fsp_name = &smb_fname;
 
@@ -2130,22 +2093,198 @@ static void shadow_copy2_sort_data(vfs_handle_struct *handle,
 	}
 }
 
+static int shadow_copy2_snapentry_cmp(const struct shadow_copy2_snapentry *e1,
+				      const struct shadow_copy2_snapentry *e2)
+{
+	return strcmp(e1->time_fmt, e2->time_fmt);
+}
+
+/**
+ * Check whether the cached snaplist can be handed out for snapdir instead
+ * of scanning it again. The list must have been read from the same
+ * directory less than "shadow:snaplist cache time" seconds ago, and the
+ * directory mtime must not have changed since.
+ *
+ * @param[in]   handle			VFS handle struct
+ * @param[in]   priv			shadow_copy2 specific structure
+ * @param[in]   snapdir_smb_fname	snapshot directory
+ *
+ * @return 	true if the cached snaplist is current
+ */
+static bool shadow_copy2_snaplist_valid(struct vfs_handle_struct *handle,
+				struct shadow_copy2_private *priv,
+				const struct smb_filename *snapdir_smb_fname)
+{
+	struct shadow_copy2_snaplist_info *snaps = priv->snaps;
+	struct smb_filename *smb_fname = NULL;
+	struct timespec fetch_ts;
+	time_t now;
+	bool valid;
+	int ret;
+
+	if (priv->config->snaplist_cache_time <= 0) {
+		return false;
+	}
+	if (snaps->snapdir == NULL ||
+	    strcmp(snaps->snapdir, snapdir_smb_fname->base_name) != 0) {
+		return false;
+	}
+
+	now = time(NULL);
+	if (now < snaps->fetch_time ||
+	    now - snaps->fetch_time >= priv->config->snaplist_cache_time) {
+		return false;
+	}
+
+	/*
+	 * A snapshot created right after we read the directory might
+	 * not have moved its mtime.
+	 */
+	fetch_ts = convert_time_t_to_timespec(snaps->fetch_time);
+	if (timespec_too_recent(&snaps->snapdir_mtime, &fetch_ts)) {
+		return false;
+	}
+
+	smb_fname = cp_smb_filename(talloc_tos(), snapdir_smb_fname);
+	if (smb_fname == NULL) {
+		return false;
+	}
+
+	ret = SMB_VFS_NEXT_STAT(handle, smb_fname);
+	valid = (ret == 0) &&
+		(timespec_compare(&smb_fname->st.st_ex_mtime,
+				  &snaps->snapdir_mtime) == 0);
+	TALLOC_FREE(smb_fname);
+
+	return valid;
+}
+
+/**
+ * Scan snapdir and replace the global snaplist with the snapshots found,
+ * sorted by their @GMT name.
+ *
+ * @param[in]   handle			VFS handle struct
+ * @param[in]   priv			shadow_copy2 specific structure
+ * @param[in]   snapdir_smb_fname	snapshot directory
+ *
+ * @return 	0 on success, -1 with errno set on failure
+ */
+static int shadow_copy2_read_snaplist(struct vfs_handle_struct *handle,
+				struct shadow_copy2_private *priv,
+				struct smb_filename *snapdir_smb_fname)
+{
+	struct shadow_copy2_snaplist_info *snaps = priv->snaps;
+	struct shadow_copy2_snapentry *snaplist = NULL;
+	size_t num_snaps = 0;
+	time_t fetch_time;
+	DIR *p;
+	struct dirent *d;
+	int ret;
+
+	/*
+	 * Record time and mtime before reading, so that anything created
+	 * while we scan makes the list look stale, not current.
+	 */
+	time(&fetch_time);
+
+	ret = SMB_VFS_NEXT_STAT(handle, snapdir_smb_fname);
+	if (ret != 0) {
+		DEBUG(2,("shadow_copy2: SMB_VFS_NEXT_STAT() failed for '%s'"
+			 " - %s\n", snapdir_smb_fname->base_name,
+			 strerror(errno)));
+		errno = ENOSYS;
+		return -1;
+	}
+
+	p = SMB_VFS_NEXT_OPENDIR(handle, snapdir_smb_fname, NULL, 0);
+
+	if (!p) {
+		DEBUG(2,("shadow_copy2: SMB_VFS_NEXT_OPENDIR() failed for '%s'"
+			 " - %s\n", snapdir_smb_fname->base_name,
+			 strerror(errno)));
+		errno = ENOSYS;
+		return -1;
+	}
+
+	while ((d = SMB_VFS_NEXT_READDIR(handle, p, NULL))) {
+		char snapshot[GMT_NAME_LEN+1];
+		struct shadow_copy2_snapentry *tmp = NULL;
+
+		/*
+		 * ignore names not of the right form in the snapshot
+		 * directory
+		 */
+		if (!shadow_copy2_snapshot_to_gmt(
+			    handle, d->d_name,
+			    snapshot, sizeof(snapshot))) {
+
+			DEBUG(6, ("shadow_copy2_read_snaplist: "
+				  "ignoring %s\n", d->d_name));
+			continue;
+		}
+		DEBUG(6,("shadow_copy2_read_snaplist: %s -> %s\n",
+			 d->d_name, snapshot));
+
+		tmp = talloc_realloc(snaps, snaplist,
+				     struct shadow_copy2_snapentry,
+				     num_snaps + 1);
+		if (tmp == NULL) {
+			goto nomem;
+		}
+		snaplist = tmp;
+
+		snaplist[num_snaps] = (struct shadow_copy2_snapentry) {
+			.snapname = talloc_strdup(snaplist, d->d_name),
+			.time_fmt = talloc_strdup(snaplist, snapshot),
+		};
+		if (snaplist[num_snaps].snapname == NULL ||
+		    snaplist[num_snaps].time_fmt == NULL) {
+			goto nomem;
+		}
+		num_snaps++;
+	}
+
+	SMB_VFS_NEXT_CLOSEDIR(handle, p);
+
+	TYPESAFE_QSORT(snaplist, num_snaps, shadow_copy2_snapentry_cmp);
+
+	TALLOC_FREE(snaps->snaplist);
+	TALLOC_FREE(snaps->snapdir);
+
+	snaps->snaplist = snaplist;
+	snaps->num_snaps = num_snaps;
+	snaps->fetch_time = fetch_time;
+	snaps->snapdir_mtime = snapdir_smb_fname->st.st_ex_mtime;
+	/* Without a snapdir the list is just never reused */
+	snaps->snapdir = talloc_strdup(snaps, snapdir_smb_fname->base_name);
+
+	return 0;
+
+nomem:
+	DEBUG(0,("shadow_copy2: out of memory\n"));
+	SMB_VFS_NEXT_CLOSEDIR(handle, p);
+	TALLOC_FREE(snaplist);
+	errno = ENOMEM;
+	return -1;
+}
+
 static int shadow_copy2_get_shadow_copy_data(
 	vfs_handle_struct *handle, files_struct *fsp,
 	struct shadow_copy_data *shadow_copy2_data,
 	bool labels)
 {
-	DIR *p;
 	const char *snapdir;
 	struct smb_filename *snapdir_smb_fname = NULL;
-	struct dirent *d;
 	TALLOC_CTX *tmp_ctx = talloc_stackframe();
 	struct shadow_copy2_private *priv = NULL;
-	struct shadow_copy2_snapentry *tmpentry = NULL;
-	bool get_snaplist = false;
+	struct shadow_copy2_snaplist_info *snaps = NULL;
 	bool access_granted = false;
+	size_t i;
 	int ret = -1;
 
+	SMB_VFS_HANDLE_GET_DATA(handle, priv, struct shadow_copy2_private,
+				goto done);
+
 	snapdir = shadow_copy2_find_snapdir(tmp_ctx, handle, fsp->fsp_name);
 	if (snapdir == NULL) {
 		DEBUG(0,("shadow:snapdir not found for %s in get_shadow_copy_data\n",
@@ -2171,103 +2310,65 @@ static int shadow_copy2_get_shadow_copy_data(
 		goto done;
 	}
 
-	p = SMB_VFS_NEXT_OPENDIR(handle, snapdir_smb_fname, NULL, 0);
-
-	if (!p) {
-		DEBUG(2,("shadow_copy2: SMB_VFS_NEXT_OPENDIR() failed for '%s'"
-			 " - %s\n", snapdir, strerror(errno)));
-		errno = ENOSYS;
-		goto done;
-	}
-
 	if (shadow_copy2_data != NULL) {
 		shadow_copy2_data->num_volumes = 0;
 		shadow_copy2_data->labels      = NULL;
 	}
 
-	SMB_VFS_HANDLE_GET_DATA(handle, priv, struct shadow_copy2_private,
-				goto done);
-
 	/*
-	 * Normally this function is called twice once with labels = false and
-	 * then with labels = true. When labels is false it will return the
-	 * number of volumes so that the caller can allocate memory for that
-	 * many labels. Therefore to eliminate snaplist both the times it is
-	 * good to check if labels is set or not.
+	 * Normally this function is called twice, once with labels = false
+	 * to count the volumes and then with labels = true. With
+	 * "shadow:snaplist cache time" the second call (and any
+	 * enumeration after it) is answered from the list read by the
+	 * first one.
 	 *
 	 * shadow_copy2_data is NULL when we only want to update the list and
-	 * don't want any labels.
+	 * don't want any labels, so that always rescans.
 	 */
-	if ((priv->snaps->regex != NULL) && (labels || shadow_copy2_data == NULL)) {
-		get_snaplist = true;
-		/* Reset the global snaplist */
-		shadow_copy2_delete_snaplist(priv);
-
-		/* Set the current time as snaplist update time */
-		time(&(priv->snaps->fetch_time));
-	}
-
-	while ((d = SMB_VFS_NEXT_READDIR(handle, p, NULL))) {
-		char snapshot[GMT_NAME_LEN+1];
-		SHADOW_COPY_LABEL *tlabels;
-
-		/*
-		 * ignore names not of the right form in the snapshot
-		 * directory
-		 */
-		if (!shadow_copy2_snapshot_to_gmt(
-			    handle, d->d_name,
-			    snapshot, sizeof(snapshot))) {
-
-			DEBUG(6, ("shadow_copy2_get_shadow_copy_data: "
-				  "ignoring %s\n", d->d_name));
-			continue;
+	if (shadow_copy2_data == NULL ||
+	    !shadow_copy2_snaplist_valid(handle, priv, snapdir_smb_fname))
+	{
+		ret = shadow_copy2_read_snaplist(handle, priv,
+						 snapdir_smb_fname);
+		if (ret != 0) {
+			goto done;
 		}
-		DEBUG(6,("shadow_copy2_get_shadow_copy_data: %s -> %s\n",
-			 d->d_name, snapshot));
+		ret = -1;
+	} else {
+		DBG_DEBUG("using cached snaplist for %s\n", snapdir);
+	}
 
-		if (get_snaplist) {
-			/*
-			 * Create a snap entry for each successful
-			 * pattern match.
-			 */
-			tmpentry = shadow_copy2_create_snapentry(priv);
-			if (tmpentry == NULL) {
-				DBG_ERR("talloc_zero() failed\n");
-				goto done;
-			}
-			tmpentry->snapname = talloc_strdup(tmpentry, d->d_name);
-			tmpentry->time_fmt = talloc_strdup(tmpentry, snapshot);
-		}
+	snaps = priv->snaps;
 
-		if (shadow_copy2_data == NULL) {
-			continue;
-		}
+	if (shadow_copy2_data == NULL) {
+		ret = 0;
+		goto done;
+	}
 
-		if (!labels) {
-			/* the caller doesn't want the labels */
-			shadow_copy2_data->num_volumes++;
-			continue;
-		}
+	if (!labels) {
+		/* the caller doesn't want the labels */
+		shadow_copy2_data->num_volumes = snaps->num_snaps;
+		ret = 0;
+		goto done;
+	}
 
-		tlabels = talloc_realloc(shadow_copy2_data,
-					 shadow_copy2_data->labels,
-					 SHADOW_COPY_LABEL,
-					 shadow_copy2_data->num_volumes+1);
-		if (tlabels == NULL) {
+	if (snaps->num_snaps > 0) {
+		shadow_copy2_data->labels = talloc_array(shadow_copy2_data,
+							 SHADOW_COPY_LABEL,
+							 snaps->num_snaps);
+		if (shadow_copy2_data->labels == NULL) {
 			DEBUG(0,("shadow_copy2: out of memory\n"));
-			SMB_VFS_NEXT_CLOSEDIR(handle, p);
+			errno = ENOMEM;
 			goto done;
 		}
-
-		strlcpy(tlabels[shadow_copy2_data->num_volumes], snapshot,
-			sizeof(*tlabels));
-
-		shadow_copy2_data->num_volumes++;
-		shadow_copy2_data->labels = tlabels;
 	}
 
-	SMB_VFS_NEXT_CLOSEDIR(handle,p);
+	for (i = 0; i < snaps->num_snaps; i++) {
+		strlcpy(shadow_copy2_data->labels[i],
+			snaps->snaplist[i].time_fmt,
+			sizeof(*shadow_copy2_data->labels));
+	}
+	shadow_copy2_data->num_volumes = snaps->num_snaps;
 
 	shadow_copy2_sort_data(handle, shadow_copy2_data);
 	ret = 0;
@@ -3178,6 +3279,11 @@ static int shadow_copy2_connect(struct vfs_handle_struct *handle,
 					 "shadow", "fixinodes",
 					 false);
 
+	config->snaplist_cache_time = lp_parm_int(SNUM(handle->conn),
+						  "shadow",
+						  "snaplist cache time",
+						  0);
+
 	sort_order = lp_parm_const_string(SNUM(handle->conn),
 					  "shadow", "sort", "desc");
 	config->sort_order = talloc_strdup(config, sort_order);
@@ -3353,6 +3459,7 @@ static int shadow_copy2_connect(struct vfs_handle_struct *handle,
 		   "  cross mountpoints: %s\n"
 		   "  fix inodes: %s\n"
 		   "  sort order: %s\n"
+		   "  snaplist cache time: %d\n"
 		   "",
 		   handle->conn->connectpath,
 		   config->mount_point,
@@ -3366,7 +3473,8 @@ static int shadow_copy2_connect(struct vfs_handle_struct *handle,
 		   config->snapdirseverywhere ? "yes" : "no",
 		   config->crossmountpoints ? "yes" : "no",
 		   config->fixinodes ? "yes" : "no",
-		   config->sort_order
+		   config->sort_order,
+		   config->snaplist_cache_time
 		   ));
 
 
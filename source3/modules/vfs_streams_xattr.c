@@ -78,26 +78,103 @@ static SMB_INO_T stream_inode(const SMB_STRUCT_STAT *sbuf, const char *sname)
 	return result;
 }
 
-static ssize_t get_xattr_size(connection_struct *conn,
-				const struct smb_filename *smb_fname,
-				const char *xattr_name)
+/*
+ * Return the length of the xattr value. This asks the VFS for the size
+ * only, so that we don't copy up to 64k of stream data just to find
+ * out how large it is. Backends that can't do a size-only query return
+ * ERANGE, for those fall back to reading the value.
+ */
+static ssize_t get_xattr_value_size(connection_struct *conn,
+				    const struct smb_filename *smb_fname,
+				    const char *xattr_name)
 {
 	NTSTATUS status;
 	struct ea_struct ea;
 	ssize_t result;
 
+	result = SMB_VFS_GETXATTR(conn, smb_fname, xattr_name, NULL, 0);
+	if (result != -1 || errno != ERANGE) {
+		return result;
+	}
+
 	status = get_ea_value(talloc_tos(), conn, NULL, smb_fname,
 			      xattr_name, &ea);
-
 	if (!NT_STATUS_IS_OK(status)) {
+		errno = map_errno_from_nt_status(status);
 		return -1;
 	}
 
-	result = ea.value.length-1;
+	result = ea.value.length;
 	TALLOC_FREE(ea.value.data);
 	return result;
 }
 
+/*
+ * Read the value of a stream xattr, starting with a buffer of size_hint
+ * bytes. Callers pass what they expect the stream to need, so that
+ * writing a stream in chunks doesn't do a 256 byte read followed by a
+ * 64k one per chunk as get_ea_value() does. If the value turns out to
+ * be larger, ask for its size and try again.
+ */
+static NTSTATUS streams_xattr_get_value(TALLOC_CTX *mem_ctx,
+					connection_struct *conn,
+					const struct smb_filename *smb_fname,
+					const char *xattr_name,
+					size_t size_hint,
+					DATA_BLOB *value)
+{
+	size_t attr_size = MIN(MAX(size_hint, 256), 65536);
+	uint8_t *val = NULL;
+	ssize_t sizeret;
+	int retries = 0;
+
+again:
+	val = talloc_realloc(mem_ctx, val, uint8_t, attr_size);
+	if (val == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	sizeret = SMB_VFS_GETXATTR(conn, smb_fname, xattr_name,
+				   val, attr_size);
+	if (sizeret == -1 && errno == ERANGE && retries++ < 3) {
+		sizeret = SMB_VFS_GETXATTR(conn, smb_fname, xattr_name,
+					   NULL, 0);
+		if (sizeret > (ssize_t)attr_size) {
+			attr_size = sizeret;
+			goto again;
+		}
+		if (attr_size < 65536) {
+			/* No size-only query, or the value shrank meanwhile */
+			attr_size = 65536;
+			goto again;
+		}
+		errno = ERANGE;
+		sizeret = -1;
+	}
+	if (sizeret == -1) {
+		NTSTATUS status = map_nt_error_from_unix(errno);
+		TALLOC_FREE(val);
+		return status;
+	}
+
+	*value = (DATA_BLOB) { .data = val, .length = sizeret };
+	return NT_STATUS_OK;
+}
+
+static ssize_t get_xattr_size(connection_struct *conn,
+				const struct smb_filename *smb_fname,
+				const char *xattr_name)
+{
+	ssize_t result;
+
+	result = get_xattr_value_size(conn, smb_fname, xattr_name);
+	if (result == -1) {
+		return -1;
+	}
+
+	return result-1;
+}
+
 /**
  * Given a stream name, populate xattr_name with the xattr name to use for
  * accessing the stream.
@@ -408,8 +485,8 @@ static int streams_xattr_open(vfs_handle_struct *handle,
 	NTSTATUS status;
 	struct streams_xattr_config *config = NULL;
 	struct stream_io *sio = NULL;
-	struct ea_struct ea;
 	char *xattr_name = NULL;
+	ssize_t xattr_size;
 	int pipe_fds[2];
 	int fakefd = -1;
 	bool set_empty_xattr = false;
@@ -446,12 +523,15 @@ static int streams_xattr_open(vfs_handle_struct *handle,
 		goto fail;
 	}
 
-	status = get_ea_value(talloc_tos(), handle->conn, NULL,
-			      smb_fname, xattr_name, &ea);
+	xattr_size = get_xattr_value_size(handle->conn, smb_fname,
+					  xattr_name);
+	if (xattr_size == -1) {
+		status = map_nt_error_from_unix(errno);
+	}
 
-	DEBUG(10, ("get_ea_value returned %s\n", nt_errstr(status)));
+	DEBUG(10, ("get_xattr_value_size returned %zd\n", xattr_size));
 
-	if (!NT_STATUS_IS_OK(status)) {
+	if (xattr_size == -1) {
 		if (!NT_STATUS_EQUAL(status, NT_STATUS_NOT_FOUND)) {
 			/*
 			 * The base file is not there. This is an error even if
@@ -718,8 +798,9 @@ static int streams_xattr_rename(vfs_handle_struct *handle,
 static NTSTATUS walk_xattr_streams(vfs_handle_struct *handle,
 				files_struct *fsp,
 				const struct smb_filename *smb_fname,
-				bool (*fn)(struct ea_struct *ea,
-					void *private_data),
+				bool (*fn)(const char *stream_name,
+					   size_t value_size,
+					   void *private_data),
 				void *private_data)
 {
 	NTSTATUS status;
@@ -741,7 +822,9 @@ static NTSTATUS walk_xattr_streams(vfs_handle_struct *handle,
 	}
 
 	for (i=0; i<num_names; i++) {
-		struct ea_struct ea;
+		char *stream_name = NULL;
+		ssize_t value_size;
+		bool ok;
 
 		/*
 		 * We want to check with samba_private_attr_name()
@@ -766,35 +849,32 @@ static NTSTATUS walk_xattr_streams(vfs_handle_struct *handle,
 			continue;
 		}
 
-		status = get_ea_value(names,
-					handle->conn,
-					NULL,
-					smb_fname,
-					names[i],
-					&ea);
-		if (!NT_STATUS_IS_OK(status)) {
+		value_size = get_xattr_value_size(handle->conn,
+						  smb_fname,
+						  names[i]);
+		if (value_size == -1) {
 			DEBUG(10, ("Could not get ea %s for file %s: %s\n",
 				names[i],
 				smb_fname->base_name,
-				nt_errstr(status)));
+				strerror(errno)));
 			continue;
 		}
 
-		ea.name = talloc_asprintf(
-			ea.value.data, ":%s%s",
+		stream_name = talloc_asprintf(
+			names, ":%s%s",
 			names[i] + config->prefix_len,
 			config->store_stream_type ? "" : ":$DATA");
-		if (ea.name == NULL) {
+		if (stream_name == NULL) {
 			DEBUG(0, ("talloc failed\n"));
 			continue;
 		}
 
-		if (!fn(&ea, private_data)) {
-			TALLOC_FREE(ea.value.data);
+		ok = fn(stream_name, value_size, private_data);
+		TALLOC_FREE(stream_name);
+		if (!ok) {
+			TALLOC_FREE(names);
 			return NT_STATUS_OK;
 		}
-
-		TALLOC_FREE(ea.value.data);
 	}
 
 	TALLOC_FREE(names);
@@ -835,16 +915,18 @@ struct streaminfo_state {
 	NTSTATUS status;
 };
 
-static bool collect_one_stream(struct ea_struct *ea, void *private_data)
+static bool collect_one_stream(const char *stream_name,
+			       size_t value_size,
+			       void *private_data)
 {
 	struct streaminfo_state *state =
 		(struct streaminfo_state *)private_data;
 
 	if (!add_one_stream(state->mem_ctx,
 			    &state->num_streams, &state->streams,
-			    ea->name, ea->value.length-1,
+			    stream_name, value_size-1,
 			    smb_roundup(state->handle->conn,
-					ea->value.length-1))) {
+					value_size-1))) {
 		state->status = NT_STATUS_NO_MEMORY;
 		return false;
 	}
@@ -966,7 +1048,7 @@ static ssize_t streams_xattr_pwrite(vfs_handle_struct *handle,
 {
         struct stream_io *sio =
 		(struct stream_io *)VFS_FETCH_FSP_EXTENSION(handle, fsp);
-	struct ea_struct ea;
+	DATA_BLOB value;
 	NTSTATUS status;
 	struct smb_filename *smb_fname_base = NULL;
 	int ret;
@@ -992,35 +1074,42 @@ static ssize_t streams_xattr_pwrite(vfs_handle_struct *handle,
 		return -1;
 	}
 
-	status = get_ea_value(talloc_tos(), handle->conn, NULL,
-			      smb_fname_base, sio->xattr_name, &ea);
+	status = streams_xattr_get_value(talloc_tos(), handle->conn,
+					 smb_fname_base, sio->xattr_name,
+					 offset + n + 1, &value);
 	if (!NT_STATUS_IS_OK(status)) {
+		errno = map_errno_from_nt_status(status);
 		return -1;
 	}
 
-        if ((offset + n) > ea.value.length-1) {
+        if ((offset + n) > value.length-1) {
 		uint8_t *tmp;
 
-		tmp = talloc_realloc(talloc_tos(), ea.value.data, uint8_t,
+		tmp = talloc_realloc(talloc_tos(), value.data, uint8_t,
 					   offset + n + 1);
 
 		if (tmp == NULL) {
-			TALLOC_FREE(ea.value.data);
+			TALLOC_FREE(value.data);
                         errno = ENOMEM;
                         return -1;
                 }
-		ea.value.data = tmp;
-		ea.value.length = offset + n + 1;
-		ea.value.data[offset+n] = 0;
+		/* Writing beyond the end leaves a hole of zeros */
+		if (offset > value.length-1) {
+			memset(&tmp[value.length-1], '\0',
+			       offset - (value.length-1));
+		}
+		value.data = tmp;
+		value.length = offset + n + 1;
+		value.data[offset+n] = 0;
         }
 
-        memcpy(ea.value.data + offset, data, n);
+        memcpy(value.data + offset, data, n);
 
 	ret = SMB_VFS_SETXATTR(fsp->conn,
 			       fsp->fsp_name,
 			       sio->xattr_name,
-			       ea.value.data, ea.value.length, 0);
-	TALLOC_FREE(ea.value.data);
+			       value.data, value.length, 0);
+	TALLOC_FREE(value.data);
 
 	if (ret == -1) {
 		return -1;
@@ -1035,7 +1124,7 @@ static ssize_t streams_xattr_pread(vfs_handle_struct *handle,
 {
         struct stream_io *sio =
 		(struct stream_io *)VFS_FETCH_FSP_EXTENSION(handle, fsp);
-	struct ea_struct ea;
+	DATA_BLOB value;
 	NTSTATUS status;
 	size_t length, overlap;
 	struct smb_filename *smb_fname_base = NULL;
@@ -1062,26 +1151,29 @@ static ssize_t streams_xattr_pread(vfs_handle_struct *handle,
 		return -1;
 	}
 
-	status = get_ea_value(talloc_tos(), handle->conn, NULL,
-			      smb_fname_base, sio->xattr_name, &ea);
+	status = streams_xattr_get_value(talloc_tos(), handle->conn,
+					 smb_fname_base, sio->xattr_name,
+					 offset + n + 1, &value);
 	if (!NT_STATUS_IS_OK(status)) {
+		errno = map_errno_from_nt_status(status);
 		return -1;
 	}
 
-	length = ea.value.length-1;
+	length = value.length-1;
 
-	DEBUG(10, ("streams_xattr_pread: get_ea_value returned %d bytes\n",
+	DEBUG(10, ("streams_xattr_pread: xattr has %d bytes\n",
 		   (int)length));
 
         /* Attempt to read past EOF. */
         if (length <= offset) {
+		TALLOC_FREE(value.data);
                 return 0;
         }
 
         overlap = (offset + n) > length ? (length - offset) : n;
-        memcpy(data, ea.value.data + offset, overlap);
+        memcpy(data, value.data + offset, overlap);
 
-	TALLOC_FREE(ea.value.data);
+	TALLOC_FREE(value.data);
         return overlap;
 }
 
@@ -1251,7 +1343,7 @@ static int streams_xattr_ftruncate(struct vfs_handle_struct *handle,
 {
 	int ret;
 	uint8_t *tmp;
-	struct ea_struct ea;
+	DATA_BLOB value;
 	NTSTATUS status;
         struct stream_io *sio =
 		(struct stream_io *)VFS_FETCH_FSP_EXTENSION(handle, fsp);
@@ -1279,36 +1371,38 @@ static int streams_xattr_ftruncate(struct vfs_handle_struct *handle,
 		return -1;
 	}
 
-	status = get_ea_value(talloc_tos(), handle->conn, NULL,
-			      smb_fname_base, sio->xattr_name, &ea);
+	status = streams_xattr_get_value(talloc_tos(), handle->conn,
+					 smb_fname_base, sio->xattr_name,
+					 offset + 1, &value);
 	if (!NT_STATUS_IS_OK(status)) {
+		errno = map_errno_from_nt_status(status);
 		return -1;
 	}
 
-	tmp = talloc_realloc(talloc_tos(), ea.value.data, uint8_t,
+	tmp = talloc_realloc(talloc_tos(), value.data, uint8_t,
 				   offset + 1);
 
 	if (tmp == NULL) {
-		TALLOC_FREE(ea.value.data);
+		TALLOC_FREE(value.data);
 		errno = ENOMEM;
 		return -1;
 	}
 
 	/* Did we expand ? */
-	if (ea.value.length < offset + 1) {
-		memset(&tmp[ea.value.length], '\0',
-			offset + 1 - ea.value.length);
+	if (value.length < offset + 1) {
+		memset(&tmp[value.length], '\0',
+			offset + 1 - value.length);
 	}
 
-	ea.value.data = tmp;
-	ea.value.length = offset + 1;
-	ea.value.data[offset] = 0;
+	value.data = tmp;
+	value.length = offset + 1;
+	value.data[offset] = 0;
 
 	ret = SMB_VFS_SETXATTR(fsp->conn,
 			       fsp->fsp_name,
 			       sio->xattr_name,
-			       ea.value.data, ea.value.length, 0);
-	TALLOC_FREE(ea.value.data);
+			       value.data, value.length, 0);
+	TALLOC_FREE(value.data);
 
 	if (ret == -1) {
 		return -1;
@@ -30,20 +30,172 @@
 #include "ntioctl.h"
 #include "lib/util/tevent_unix.h"
 #include "lib/util/tevent_ntstatus.h"
+#include "smbprofile.h"
 
 #undef DBGC_CLASS
 #define DBGC_CLASS DBGC_VFS
 
 static double audit_timeout;
+static bool audit_histogram;
+static bool audit_backtrace;
+
+/*
+ * The "time_audit:slowest" slowest calls of this process, sorted by
+ * elapsed time, slowest first.
+ */
+struct smb_time_audit_sample {
+	double elapsed;
+	const char *syscallname;
+	char *when;
+	char *msg;
+};
+
+static struct smb_time_audit_sample *audit_slowest;
+static size_t audit_max_slowest;
+static size_t audit_num_slowest;
+
+#ifdef WITH_PROFILE
+
+/*
+ * Maps the syscallname string constants to their smbprofile
+ * histograms, hashed by address so the hot path needs no strcmp.
+ */
+#define AUDIT_NUM_OP_SLOTS 256
+
+static struct {
+	const char *syscallname;
+	struct smbprofile_stats_histogram *latency;
+} audit_ops[AUDIT_NUM_OP_SLOTS];
+
+static void smb_time_audit_record(const char *syscallname, double elapsed)
+{
+	size_t i = ((uintptr_t)syscallname >> 3) % AUDIT_NUM_OP_SLOTS;
+	size_t n;
+
+	if (!smbprofile_state.config.do_times) {
+		return;
+	}
+
+	for (n = 0; n < AUDIT_NUM_OP_SLOTS; n++) {
+		if (audit_ops[i].syscallname == syscallname) {
+			break;
+		}
+		if (audit_ops[i].syscallname == NULL) {
+			audit_ops[i].syscallname = syscallname;
+			audit_ops[i].latency = smbprofile_vfs_latency(
+				syscallname);
+			break;
+		}
+		i = (i + 1) % AUDIT_NUM_OP_SLOTS;
+	}
+	if ((n == AUDIT_NUM_OP_SLOTS) || (audit_ops[i].latency == NULL)) {
+		return;
+	}
+
+	smbprofile_histogram_add(audit_ops[i].latency,
+				 (uint64_t)(elapsed * 1.0e6));
+	smbprofile_dump_schedule();
+}
+
+#endif /* WITH_PROFILE */
+
+/*
+ * Called for every timed call. Returns true if the call needs to be
+ * logged, either because it took longer than "time_audit:timeout" or
+ * because it is one of the slowest seen so far.
+ */
+static bool smb_time_audit_exceeded(const char *syscallname, double elapsed)
+{
+#ifdef WITH_PROFILE
+	if (audit_histogram) {
+		smb_time_audit_record(syscallname, elapsed);
+	}
+#endif
+
+	if (elapsed > audit_timeout) {
+		return true;
+	}
+	if (audit_max_slowest == 0) {
+		return false;
+	}
+	if (audit_num_slowest < audit_max_slowest) {
+		return true;
+	}
+	return elapsed > audit_slowest[audit_num_slowest - 1].elapsed;
+}
+
+static void smb_time_audit_sample(const char *syscallname, double elapsed,
+				  const char *msg)
+{
+	struct smb_time_audit_sample *s = NULL;
+	size_t i;
+
+	for (i = 0; i < audit_num_slowest; i++) {
+		if (elapsed > audit_slowest[i].elapsed) {
+			break;
+		}
+	}
+	if (i == audit_max_slowest) {
+		return;
+	}
+
+	if (audit_num_slowest == audit_max_slowest) {
+		s = &audit_slowest[audit_num_slowest - 1];
+		TALLOC_FREE(s->when);
+		TALLOC_FREE(s->msg);
+		audit_num_slowest -= 1;
+	}
+
+	memmove(&audit_slowest[i + 1], &audit_slowest[i],
+		sizeof(*audit_slowest) * (audit_num_slowest - i));
+	audit_num_slowest += 1;
+
+	audit_slowest[i] = (struct smb_time_audit_sample) {
+		.elapsed = elapsed,
+		.syscallname = syscallname,
+		.when = current_timestring(audit_slowest, true),
+		.msg = (msg != NULL) ? talloc_strdup(audit_slowest, msg) : NULL,
+	};
+}
+
+static void smb_time_audit_log_slowest(void)
+{
+	size_t i;
+
+	if (audit_num_slowest == 0) {
+		return;
+	}
+
+	DEBUG(1, ("Slowest VFS calls of this process:\n"));
+
+	for (i = 0; i < audit_num_slowest; i++) {
+		struct smb_time_audit_sample *s = &audit_slowest[i];
+
+		DEBUGADD(1, ("  %.6f seconds at %s: \"%s\" %s\n",
+			     s->elapsed,
+			     (s->when != NULL) ? s->when : "",
+			     s->syscallname,
+			     (s->msg != NULL) ? s->msg : ""));
+	}
+}
 
 static void smb_time_audit_log_msg(const char *syscallname, double elapsed,
 				    const char *msg)
 {
-	DEBUG(0, ("WARNING: VFS call \"%s\" took unexpectedly long "
-		  "(%.2f seconds) %s%s-- Validate that file and storage "
-		  "subsystems are operating normally\n", syscallname,
-		  elapsed, (msg != NULL) ? msg : "",
-		  (msg != NULL) ? " " : ""));
+	if (elapsed > audit_timeout) {
+		DEBUG(0, ("WARNING: VFS call \"%s\" took unexpectedly long "
+			  "(%.2f seconds) %s%s-- Validate that file and "
+			  "storage subsystems are operating normally\n",
+			  syscallname, elapsed, (msg != NULL) ? msg : "",
+			  (msg != NULL) ? " " : ""));
+		if (audit_backtrace) {
+			log_stack_trace();
+		}
+	}
+
+	if (audit_max_slowest != 0) {
+		smb_time_audit_sample(syscallname, elapsed, msg);
+	}
 }
 
 static void smb_time_audit_log(const char *syscallname, double elapsed)
@@ -152,7 +304,7 @@ static int smb_time_audit_connect(vfs_handle_struct *handle,
 	result = SMB_VFS_NEXT_CONNECT(handle, svc, user);
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("connect", timediff)) {
 		smb_time_audit_log_msg("connect", timediff, user);
 	}
 	return result;
@@ -168,9 +320,11 @@ static void smb_time_audit_disconnect(vfs_handle_struct *handle)
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("disconnect", timediff)) {
 		smb_time_audit_log("disconnect", timediff);
 	}
+
+	smb_time_audit_log_slowest();
 }
 
 static uint64_t smb_time_audit_disk_free(vfs_handle_struct *handle,
@@ -189,7 +343,7 @@ static uint64_t smb_time_audit_disk_free(vfs_handle_struct *handle,
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
 	/* Don't have a reasonable notion of failure here */
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("disk_free", timediff)) {
 		smb_time_audit_log_fname("disk_free",
 				timediff,
 				smb_fname->base_name);
@@ -213,7 +367,7 @@ static int smb_time_audit_get_quota(struct vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("get_quota", timediff)) {
 		smb_time_audit_log_fname("get_quota",
 				timediff,
 				smb_fname->base_name);
@@ -234,7 +388,7 @@ static int smb_time_audit_set_quota(struct vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("set_quota", timediff)) {
 		smb_time_audit_log("set_quota", timediff);
 	}
 
@@ -256,7 +410,7 @@ static int smb_time_audit_get_shadow_copy_data(struct vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("get_shadow_copy_data", timediff)) {
 		smb_time_audit_log_fsp("get_shadow_copy_data", timediff, fsp);
 	}
 
@@ -276,7 +430,7 @@ static int smb_time_audit_statvfs(struct vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("statvfs", timediff)) {
 		smb_time_audit_log_fname("statvfs", timediff,
 			smb_fname->base_name);
 	}
@@ -296,7 +450,7 @@ static uint32_t smb_time_audit_fs_capabilities(struct vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("fs_capabilities", timediff)) {
 		smb_time_audit_log("fs_capabilities", timediff);
 	}
 
@@ -316,7 +470,7 @@ static NTSTATUS smb_time_audit_get_dfs_referrals(
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("get_dfs_referrals", timediff)) {
 		smb_time_audit_log("get_dfs_referrals", timediff);
 	}
 
@@ -338,7 +492,7 @@ static NTSTATUS smb_time_audit_snap_check_path(struct vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2, &ts1) * 1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("snap_check_path", timediff)) {
 		smb_time_audit_log("snap_check_path", timediff);
 	}
 
@@ -363,7 +517,7 @@ static NTSTATUS smb_time_audit_snap_create(struct vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2 ,&ts1) * 1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("snap_create", timediff)) {
 		smb_time_audit_log("snap_create", timediff);
 	}
 
@@ -385,7 +539,7 @@ static NTSTATUS smb_time_audit_snap_delete(struct vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2, &ts1) * 1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("snap_delete", timediff)) {
 		smb_time_audit_log("snap_delete", timediff);
 	}
 
@@ -405,7 +559,7 @@ static DIR *smb_time_audit_opendir(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("opendir", timediff)) {
 		smb_time_audit_log_smb_fname("opendir", timediff, smb_fname);
 	}
 
@@ -425,7 +579,7 @@ static DIR *smb_time_audit_fdopendir(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("fdopendir", timediff)) {
 		smb_time_audit_log_fsp("fdopendir", timediff, fsp);
 	}
 
@@ -445,13 +599,37 @@ static struct dirent *smb_time_audit_readdir(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("readdir", timediff)) {
 		smb_time_audit_log("readdir", timediff);
 	}
 
 	return result;
 }
 
+static NTSTATUS smb_time_audit_readdirplus(vfs_handle_struct *handle,
+					   DIR *dirp,
+					   TALLOC_CTX *mem_ctx,
+					   size_t max_entries,
+					   struct vfs_readdirplus_entry **pentries,
+					   size_t *pnum_entries)
+{
+	NTSTATUS result;
+	struct timespec ts1,ts2;
+	double timediff;
+
+	clock_gettime_mono(&ts1);
+	result = SMB_VFS_NEXT_READDIRPLUS(handle, dirp, mem_ctx, max_entries,
+					  pentries, pnum_entries);
+	clock_gettime_mono(&ts2);
+	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
+
+	if (smb_time_audit_exceeded("readdirplus", timediff)) {
+		smb_time_audit_log("readdirplus", timediff);
+	}
+
+	return result;
+}
+
 static void smb_time_audit_seekdir(vfs_handle_struct *handle,
 				   DIR *dirp, long offset)
 {
@@ -463,7 +641,7 @@ static void smb_time_audit_seekdir(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("seekdir", timediff)) {
 		smb_time_audit_log("seekdir", timediff);
 	}
 
@@ -481,7 +659,7 @@ static long smb_time_audit_telldir(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("telldir", timediff)) {
 		smb_time_audit_log("telldir", timediff);
 	}
 
@@ -499,7 +677,7 @@ static void smb_time_audit_rewinddir(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("rewinddir", timediff)) {
 		smb_time_audit_log("rewinddir", timediff);
 	}
 
@@ -518,7 +696,7 @@ static int smb_time_audit_mkdir(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("mkdir", timediff)) {
 		smb_time_audit_log_smb_fname("mkdir",
 			timediff,
 			smb_fname);
@@ -539,7 +717,7 @@ static int smb_time_audit_rmdir(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("rmdir", timediff)) {
 		smb_time_audit_log_smb_fname("rmdir",
 			timediff,
 			smb_fname);
@@ -560,7 +738,7 @@ static int smb_time_audit_closedir(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("closedir", timediff)) {
 		smb_time_audit_log("closedir", timediff);
 	}
 
@@ -581,7 +759,7 @@ static int smb_time_audit_open(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("open", timediff)) {
 		smb_time_audit_log_fsp("open", timediff, fsp);
 	}
 
@@ -635,7 +813,7 @@ static NTSTATUS smb_time_audit_create_file(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("create_file", timediff)) {
 		/*
 		 * can't use result_fsp this time, may have
 		 * invalid content causing smbd crash
@@ -658,7 +836,7 @@ static int smb_time_audit_close(vfs_handle_struct *handle, files_struct *fsp)
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("close", timediff)) {
 		smb_time_audit_log_fsp("close", timediff, fsp);
 	}
 
@@ -678,7 +856,7 @@ static ssize_t smb_time_audit_pread(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("pread", timediff)) {
 		smb_time_audit_log_fsp("pread", timediff, fsp);
 	}
 
@@ -738,7 +916,7 @@ static ssize_t smb_time_audit_pread_recv(struct tevent_req *req,
 
 	timediff = state->vfs_aio_state.duration * 1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("async_pread", timediff)) {
 		smb_time_audit_log_fsp("async pread", timediff, state->fsp);
 	}
 
@@ -763,7 +941,7 @@ static ssize_t smb_time_audit_pwrite(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("pwrite", timediff)) {
 		smb_time_audit_log_fsp("pwrite", timediff, fsp);
 	}
 
@@ -823,7 +1001,7 @@ static ssize_t smb_time_audit_pwrite_recv(struct tevent_req *req,
 
 	timediff = state->vfs_aio_state.duration * 1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("async_pwrite", timediff)) {
 		smb_time_audit_log_fsp("async pwrite", timediff, state->fsp);
 	}
 
@@ -847,7 +1025,7 @@ static off_t smb_time_audit_lseek(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("lseek", timediff)) {
 		smb_time_audit_log_fsp("lseek", timediff, fsp);
 	}
 
@@ -868,7 +1046,7 @@ static ssize_t smb_time_audit_sendfile(vfs_handle_struct *handle, int tofd,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("sendfile", timediff)) {
 		smb_time_audit_log_fsp("sendfile", timediff, fromfsp);
 	}
 
@@ -889,7 +1067,7 @@ static ssize_t smb_time_audit_recvfile(vfs_handle_struct *handle, int fromfd,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("recvfile", timediff)) {
 		smb_time_audit_log_fsp("recvfile", timediff, tofsp);
 	}
 
@@ -909,7 +1087,7 @@ static int smb_time_audit_rename(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("rename", timediff)) {
 		smb_time_audit_log_smb_fname("rename", timediff, newname);
 	}
 
@@ -967,7 +1145,7 @@ static int smb_time_audit_fsync_recv(struct tevent_req *req,
 
 	timediff = state->vfs_aio_state.duration * 1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("async_fsync", timediff)) {
 		smb_time_audit_log_fsp("async fsync", timediff, state->fsp);
 	}
 
@@ -990,7 +1168,7 @@ static int smb_time_audit_stat(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("stat", timediff)) {
 		smb_time_audit_log_smb_fname("stat", timediff, fname);
 	}
 
@@ -1009,7 +1187,7 @@ static int smb_time_audit_fstat(vfs_handle_struct *handle, files_struct *fsp,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("fstat", timediff)) {
 		smb_time_audit_log_fsp("fstat", timediff, fsp);
 	}
 
@@ -1028,7 +1206,7 @@ static int smb_time_audit_lstat(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("lstat", timediff)) {
 		smb_time_audit_log_smb_fname("lstat", timediff, path);
 	}
 
@@ -1048,7 +1226,7 @@ static uint64_t smb_time_audit_get_alloc_size(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("get_alloc_size", timediff)) {
 		smb_time_audit_log_fsp("get_alloc_size", timediff, fsp);
 	}
 
@@ -1067,7 +1245,7 @@ static int smb_time_audit_unlink(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("unlink", timediff)) {
 		smb_time_audit_log_smb_fname("unlink", timediff, path);
 	}
 
@@ -1087,7 +1265,7 @@ static int smb_time_audit_chmod(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("chmod", timediff)) {
 		smb_time_audit_log_fname("chmod",
 			timediff,
 			smb_fname->base_name);
@@ -1108,7 +1286,7 @@ static int smb_time_audit_fchmod(vfs_handle_struct *handle, files_struct *fsp,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("fchmod", timediff)) {
 		smb_time_audit_log_fsp("fchmod", timediff, fsp);
 	}
 
@@ -1129,7 +1307,7 @@ static int smb_time_audit_chown(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("chown", timediff)) {
 		smb_time_audit_log_fname("chown",
 			timediff,
 			smb_fname->base_name);
@@ -1150,7 +1328,7 @@ static int smb_time_audit_fchown(vfs_handle_struct *handle, files_struct *fsp,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("fchown", timediff)) {
 		smb_time_audit_log_fsp("fchown", timediff, fsp);
 	}
 
@@ -1171,7 +1349,7 @@ static int smb_time_audit_lchown(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("lchown", timediff)) {
 		smb_time_audit_log_fname("lchown",
 			timediff,
 			smb_fname->base_name);
@@ -1192,7 +1370,7 @@ static int smb_time_audit_chdir(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("chdir", timediff)) {
 		smb_time_audit_log_fname("chdir",
 			timediff,
 			smb_fname->base_name);
@@ -1213,7 +1391,7 @@ static struct smb_filename *smb_time_audit_getwd(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("getwd", timediff)) {
 		smb_time_audit_log("getwd", timediff);
 	}
 
@@ -1233,7 +1411,7 @@ static int smb_time_audit_ntimes(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("ntimes", timediff)) {
 		smb_time_audit_log_smb_fname("ntimes", timediff, path);
 	}
 
@@ -1253,7 +1431,7 @@ static int smb_time_audit_ftruncate(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("ftruncate", timediff)) {
 		smb_time_audit_log_fsp("ftruncate", timediff, fsp);
 	}
 
@@ -1279,7 +1457,7 @@ static int smb_time_audit_fallocate(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("fallocate", timediff)) {
 		smb_time_audit_log_fsp("fallocate", timediff, fsp);
 	}
 	if (result == -1) {
@@ -1301,7 +1479,7 @@ static bool smb_time_audit_lock(vfs_handle_struct *handle, files_struct *fsp,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("lock", timediff)) {
 		smb_time_audit_log_fsp("lock", timediff, fsp);
 	}
 
@@ -1322,7 +1500,7 @@ static int smb_time_audit_kernel_flock(struct vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("kernel_flock", timediff)) {
 		smb_time_audit_log_fsp("kernel_flock", timediff, fsp);
 	}
 
@@ -1342,7 +1520,7 @@ static int smb_time_audit_linux_setlease(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("linux_setlease", timediff)) {
 		smb_time_audit_log_fsp("linux_setlease", timediff, fsp);
 	}
 
@@ -1364,7 +1542,7 @@ static bool smb_time_audit_getlock(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("getlock", timediff)) {
 		smb_time_audit_log_fsp("getlock", timediff, fsp);
 	}
 
@@ -1384,7 +1562,7 @@ static int smb_time_audit_symlink(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("symlink", timediff)) {
 		smb_time_audit_log_fname("symlink", timediff,
 			new_smb_fname->base_name);
 	}
@@ -1407,7 +1585,7 @@ static int smb_time_audit_readlink(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("readlink", timediff)) {
 		smb_time_audit_log_fname("readlink", timediff,
 				smb_fname->base_name);
 	}
@@ -1428,7 +1606,7 @@ static int smb_time_audit_link(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("link", timediff)) {
 		smb_time_audit_log_fname("link", timediff,
 			new_smb_fname->base_name);
 	}
@@ -1450,7 +1628,7 @@ static int smb_time_audit_mknod(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("mknod", timediff)) {
 		smb_time_audit_log_smb_fname("mknod", timediff, smb_fname);
 	}
 
@@ -1470,7 +1648,7 @@ static struct smb_filename *smb_time_audit_realpath(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("realpath", timediff)) {
 		smb_time_audit_log_fname("realpath", timediff,
 				smb_fname->base_name);
 	}
@@ -1491,7 +1669,7 @@ static int smb_time_audit_chflags(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("chflags", timediff)) {
 		smb_time_audit_log_smb_fname("chflags", timediff, smb_fname);
 	}
 
@@ -1513,7 +1691,7 @@ static struct file_id smb_time_audit_file_id_create(struct vfs_handle_struct *ha
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("file_id_create", timediff)) {
 		smb_time_audit_log("file_id_create", timediff);
 	}
 
@@ -1537,7 +1715,7 @@ static NTSTATUS smb_time_audit_streaminfo(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("streaminfo", timediff)) {
 		smb_time_audit_log_fsp("streaminfo", timediff, fsp);
 	}
 
@@ -1560,7 +1738,7 @@ static int smb_time_audit_get_real_filename(struct vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("get_real_filename", timediff)) {
 		smb_time_audit_log_fname("get_real_filename", timediff, path);
 	}
 
@@ -1579,7 +1757,7 @@ static const char *smb_time_audit_connectpath(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("connectpath", timediff)) {
 		smb_time_audit_log_fname("connectpath", timediff,
 			smb_fname->base_name);
 	}
@@ -1602,7 +1780,7 @@ static NTSTATUS smb_time_audit_brl_lock_windows(struct vfs_handle_struct *handle
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("brl_lock_windows", timediff)) {
 		smb_time_audit_log_fsp("brl_lock_windows", timediff,
 				       brl_fsp(br_lck));
 	}
@@ -1625,7 +1803,7 @@ static bool smb_time_audit_brl_unlock_windows(struct vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("brl_unlock_windows", timediff)) {
 		smb_time_audit_log_fsp("brl_unlock_windows", timediff,
 				       brl_fsp(br_lck));
 	}
@@ -1646,7 +1824,7 @@ static bool smb_time_audit_brl_cancel_windows(struct vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("brl_cancel_windows", timediff)) {
 		smb_time_audit_log_fsp("brl_cancel_windows", timediff,
 				       brl_fsp(br_lck));
 	}
@@ -1667,7 +1845,7 @@ static bool smb_time_audit_strict_lock_check(struct vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("strict_lock_check", timediff)) {
 		smb_time_audit_log_fsp("strict_lock_check", timediff, fsp);
 	}
 
@@ -1690,7 +1868,7 @@ static NTSTATUS smb_time_audit_translate_name(struct vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("translate_name", timediff)) {
 		smb_time_audit_log_fname("translate_name", timediff, name);
 	}
 
@@ -1726,7 +1904,7 @@ static NTSTATUS smb_time_audit_fsctl(struct vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("fsctl", timediff)) {
 		smb_time_audit_log_fsp("fsctl", timediff, fsp);
 	}
 
@@ -1748,7 +1926,7 @@ static NTSTATUS smb_time_get_dos_attributes(struct vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("get_dos_attributes", timediff)) {
 		smb_time_audit_log_fname("get_dos_attributes",
 				timediff,
 				smb_fname->base_name);
@@ -1836,7 +2014,7 @@ static NTSTATUS smb_time_audit_get_dos_attributes_recv(struct tevent_req *req,
 
 	timediff = state->aio_state.duration * 1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("async_get_dos_attributes", timediff)) {
 		smb_time_audit_log_at("async get_dos_attributes",
 				      timediff,
 				      state->dir_fsp,
@@ -1869,7 +2047,7 @@ static NTSTATUS smb_time_fget_dos_attributes(struct vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("fget_dos_attributes", timediff)) {
 		smb_time_audit_log_fsp("fget_dos_attributes", timediff, fsp);
 	}
 
@@ -1891,7 +2069,7 @@ static NTSTATUS smb_time_set_dos_attributes(struct vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("set_dos_attributes", timediff)) {
 		smb_time_audit_log_fname("set_dos_attributes",
 				timediff,
 				smb_fname->base_name);
@@ -1915,7 +2093,7 @@ static NTSTATUS smb_time_fset_dos_attributes(struct vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("fset_dos_attributes", timediff)) {
 		smb_time_audit_log_fsp("fset_dos_attributes", timediff, fsp);
 	}
 
@@ -1997,7 +2175,7 @@ static NTSTATUS smb_time_audit_offload_read_recv(
 
 	clock_gettime_mono(&ts_recv);
 	timediff = nsec_time_diff(&ts_recv, &state->ts_send) * 1.0e-9;
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("offload_read", timediff)) {
 		smb_time_audit_log("offload_read", timediff);
 	}
 
@@ -2083,7 +2261,7 @@ static NTSTATUS smb_time_audit_offload_write_recv(struct vfs_handle_struct *hand
 
 	clock_gettime_mono(&ts_recv);
 	timediff = nsec_time_diff(&ts_recv, &state->ts_send)*1.0e-9;
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("offload_write", timediff)) {
 		smb_time_audit_log("offload_write", timediff);
 	}
 
@@ -2113,7 +2291,7 @@ static NTSTATUS smb_time_audit_get_compression(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("get_compression", timediff)) {
 		if (fsp !=  NULL) {
 			smb_time_audit_log_fsp("get_compression",
 					       timediff, fsp);
@@ -2141,7 +2319,7 @@ static NTSTATUS smb_time_audit_set_compression(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("set_compression", timediff)) {
 		smb_time_audit_log_fsp("set_compression", timediff, fsp);
 	}
 
@@ -2162,7 +2340,7 @@ static NTSTATUS smb_time_audit_readdir_attr(struct vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("readdir_attr", timediff)) {
 		smb_time_audit_log_smb_fname("readdir_attr", timediff, fname);
 	}
 
@@ -2185,7 +2363,7 @@ static NTSTATUS smb_time_audit_fget_nt_acl(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("fget_nt_acl", timediff)) {
 		smb_time_audit_log_fsp("fget_nt_acl", timediff, fsp);
 	}
 
@@ -2208,7 +2386,7 @@ static NTSTATUS smb_time_audit_get_nt_acl(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("get_nt_acl", timediff)) {
 		smb_time_audit_log_fname("get_nt_acl",
 			timediff,
 			smb_fname->base_name);
@@ -2232,7 +2410,7 @@ static NTSTATUS smb_time_audit_fset_nt_acl(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("fset_nt_acl", timediff)) {
 		smb_time_audit_log_fsp("fset_nt_acl", timediff, fsp);
 	}
 
@@ -2258,7 +2436,7 @@ static NTSTATUS smb_time_audit_audit_file(struct vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("audit_file", timediff)) {
 		smb_time_audit_log_fname("audit_file",
 			timediff,
 			smb_fname->base_name);
@@ -2282,7 +2460,7 @@ static SMB_ACL_T smb_time_audit_sys_acl_get_file(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("sys_acl_get_file", timediff)) {
 		smb_time_audit_log_fname("sys_acl_get_file", timediff,
 			smb_fname->base_name);
 	}
@@ -2303,7 +2481,7 @@ static SMB_ACL_T smb_time_audit_sys_acl_get_fd(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("sys_acl_get_fd", timediff)) {
 		smb_time_audit_log_fsp("sys_acl_get_fd", timediff, fsp);
 	}
 
@@ -2327,7 +2505,7 @@ static int smb_time_audit_sys_acl_blob_get_file(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("sys_acl_blob_get_file", timediff)) {
 		smb_time_audit_log("sys_acl_blob_get_file", timediff);
 	}
 
@@ -2349,7 +2527,7 @@ static int smb_time_audit_sys_acl_blob_get_fd(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("sys_acl_blob_get_fd", timediff)) {
 		smb_time_audit_log("sys_acl_blob_get_fd", timediff);
 	}
 
@@ -2371,7 +2549,7 @@ static int smb_time_audit_sys_acl_set_file(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("sys_acl_set_file", timediff)) {
 		smb_time_audit_log_fname("sys_acl_set_file", timediff,
 			smb_fname->base_name);
 	}
@@ -2392,7 +2570,7 @@ static int smb_time_audit_sys_acl_set_fd(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("sys_acl_set_fd", timediff)) {
 		smb_time_audit_log_fsp("sys_acl_set_fd", timediff, fsp);
 	}
 
@@ -2411,7 +2589,7 @@ static int smb_time_audit_sys_acl_delete_def_file(vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("sys_acl_delete_def_file", timediff)) {
 		smb_time_audit_log_fname("sys_acl_delete_def_file", timediff,
 			smb_fname->base_name);
 	}
@@ -2434,7 +2612,7 @@ static ssize_t smb_time_audit_getxattr(struct vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("getxattr", timediff)) {
 		smb_time_audit_log_fname("getxattr", timediff,
 			smb_fname->base_name);
 	}
@@ -2524,7 +2702,7 @@ static ssize_t smb_time_audit_getxattrat_recv(struct tevent_req *req,
 
 	timediff = state->aio_state.duration * 1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("async_getxattrat", timediff)) {
 		smb_time_audit_log_at("async getxattrat",
 				      timediff,
 				      state->dir_fsp,
@@ -2560,7 +2738,7 @@ static ssize_t smb_time_audit_fgetxattr(struct vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("fgetxattr", timediff)) {
 		smb_time_audit_log_fsp("fgetxattr", timediff, fsp);
 	}
 
@@ -2581,7 +2759,7 @@ static ssize_t smb_time_audit_listxattr(struct vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("listxattr", timediff)) {
 		smb_time_audit_log_fname("listxattr", timediff,
 				smb_fname->base_name);
 	}
@@ -2602,7 +2780,7 @@ static ssize_t smb_time_audit_flistxattr(struct vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("flistxattr", timediff)) {
 		smb_time_audit_log_fsp("flistxattr", timediff, fsp);
 	}
 
@@ -2622,7 +2800,7 @@ static int smb_time_audit_removexattr(struct vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("removexattr", timediff)) {
 		smb_time_audit_log_fname("removexattr", timediff,
 			smb_fname->base_name);
 	}
@@ -2643,7 +2821,7 @@ static int smb_time_audit_fremovexattr(struct vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("fremovexattr", timediff)) {
 		smb_time_audit_log_fsp("fremovexattr", timediff, fsp);
 	}
 
@@ -2667,7 +2845,7 @@ static int smb_time_audit_setxattr(struct vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("setxattr", timediff)) {
 		smb_time_audit_log_fname("setxattr", timediff,
 				smb_fname->base_name);
 	}
@@ -2688,7 +2866,7 @@ static int smb_time_audit_fsetxattr(struct vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("fsetxattr", timediff)) {
 		smb_time_audit_log_fsp("fsetxattr", timediff, fsp);
 	}
 
@@ -2707,7 +2885,7 @@ static bool smb_time_audit_aio_force(struct vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("aio_force", timediff)) {
 		smb_time_audit_log_fsp("aio_force", timediff, fsp);
 	}
 
@@ -2728,7 +2906,7 @@ static NTSTATUS smb_time_audit_durable_cookie(struct vfs_handle_struct *handle,
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("durable_cookie", timediff)) {
 		smb_time_audit_log_fsp("durable_cookie", timediff, fsp);
 	}
 
@@ -2751,7 +2929,7 @@ static NTSTATUS smb_time_audit_durable_disconnect(struct vfs_handle_struct *hand
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("durable_disconnect", timediff)) {
 		smb_time_audit_log_fsp("durable_disconnect", timediff, fsp);
 	}
 
@@ -2776,7 +2954,7 @@ static NTSTATUS smb_time_audit_durable_reconnect(struct vfs_handle_struct *handl
 	clock_gettime_mono(&ts2);
 	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
 
-	if (timediff > audit_timeout) {
+	if (smb_time_audit_exceeded("durable_reconnect", timediff)) {
 		smb_time_audit_log("durable_reconnect", timediff);
 	}
 
@@ -2798,6 +2976,7 @@ static struct vfs_fn_pointers vfs_time_audit_fns = {
 	.opendir_fn = smb_time_audit_opendir,
 	.fdopendir_fn = smb_time_audit_fdopendir,
 	.readdir_fn = smb_time_audit_readdir,
+	.readdirplus_fn = smb_time_audit_readdirplus,
 	.seekdir_fn = smb_time_audit_seekdir,
 	.telldir_fn = smb_time_audit_telldir,
 	.rewind_dir_fn = smb_time_audit_rewinddir,
@@ -2905,6 +3084,18 @@ NTSTATUS vfs_time_audit_init(TALLOC_CTX *ctx)
 
 	audit_timeout = (double)lp_parm_int(-1, "time_audit", "timeout",
 					    10000) / 1000.0;
+	audit_histogram = lp_parm_bool(-1, "time_audit", "histogram", false);
+	audit_backtrace = lp_parm_bool(-1, "time_audit", "backtrace", false);
+
+	audit_max_slowest = lp_parm_ulong(-1, "time_audit", "slowest", 0);
+	if (audit_max_slowest != 0) {
+		audit_slowest = talloc_zero_array(NULL,
+					struct smb_time_audit_sample,
+					audit_max_slowest);
+		if (audit_slowest == NULL) {
+			audit_max_slowest = 0;
+		}
+	}
 	return smb_register_vfs(SMB_VFS_INTERFACE_VERSION, "time_audit",
 				&vfs_time_audit_fns);
 }
@@ -62,6 +62,10 @@ static const struct enum_list virusfilter_actions[] = {
 
 static int virusfilter_config_destructor(struct virusfilter_config *config)
 {
+	if (config->shared_cache) {
+		virusfilter_shared_cache_close();
+		config->shared_cache = false;
+	}
 	TALLOC_FREE(config->backend);
 	return 0;
 }
@@ -248,6 +252,9 @@ static int virusfilter_vfs_connect(
 	config->cache_time_limit = lp_parm_int(
 		snum, "virusfilter", "cache time limit", 10);
 
+	config->shared_cache_time_limit = lp_parm_int(
+		snum, "virusfilter", "shared cache time limit", 3600);
+
 	config->infected_file_action = lp_parm_enum(
 		snum, "virusfilter", "infected file action",
 		virusfilter_actions, VIRUSFILTER_ACTION_DO_NOTHING);
@@ -395,6 +402,14 @@ static int virusfilter_vfs_connect(
 		}
 	}
 
+	if (lp_parm_bool(snum, "virusfilter", "shared cache", false)) {
+		config->shared_cache = virusfilter_shared_cache_open();
+		if (!config->shared_cache) {
+			DBG_ERR("Initializing shared cache failed: "
+				"Shared cache disabled\n");
+		}
+	}
+
 	/*
 	 * Check quarantine directory now to save processing
 	 * and becoming root over and over.
@@ -995,10 +1010,16 @@ done:
 	TALLOC_FREE(command);
 }
 
+/*
+ * sbuf is the stat of the file as it is about to be opened. Only with
+ * it the shared cache can be used, after a close the file may have
+ * changed again.
+ */
 static virusfilter_result virusfilter_scan(
 	struct vfs_handle_struct *handle,
 	struct virusfilter_config *config,
-	const struct files_struct *fsp)
+	const struct files_struct *fsp,
+	const SMB_STRUCT_STAT *sbuf)
 {
 	virusfilter_result scan_result;
 	char *scan_report = NULL;
@@ -1008,6 +1029,8 @@ static virusfilter_result virusfilter_scan(
 	bool is_cache = false;
 	virusfilter_action file_action = VIRUSFILTER_ACTION_DO_NOTHING;
 	bool add_scan_cache = true;
+	bool use_shared_cache = config->shared_cache && (sbuf != NULL);
+	struct file_id id = { 0 };
 	bool ok = false;
 
 	if (config->cache) {
@@ -1025,6 +1048,22 @@ static virusfilter_result virusfilter_scan(
 		DBG_DEBUG("Cache entry not found\n");
 	}
 
+	if (use_shared_cache) {
+		id = vfs_file_id_from_sbuf(handle->conn, sbuf);
+		scan_cache_e = virusfilter_shared_cache_get(talloc_tos(), id,
+					sbuf, config->shared_cache_time_limit);
+		if (scan_cache_e != NULL) {
+			DBG_DEBUG("Shared cache entry found: %s: "
+				  "cached result: %d\n",
+				  file_id_string_tos(&id),
+				  scan_cache_e->result);
+			is_cache = true;
+			scan_result = scan_cache_e->result;
+			scan_report = scan_cache_e->report;
+			goto virusfilter_scan_result_eval;
+		}
+	}
+
 	if (config->backend->fns->scan_init != NULL) {
 		scan_result = config->backend->fns->scan_init(config);
 		if (scan_result != VIRUSFILTER_RESULT_OK) {
@@ -1108,6 +1147,15 @@ virusfilter_scan_result_eval:
 		break;
 	}
 
+	if (use_shared_cache && !is_cache && add_scan_cache) {
+		virusfilter_shared_cache_add(id, sbuf, scan_result,
+					     scan_report);
+	}
+
+	if (is_cache) {
+		virusfilter_cache_entry_free(scan_cache_e);
+	}
+
 	if (config->cache) {
 		if (!is_cache && add_scan_cache) {
 			DBG_DEBUG("Adding new cache entry: %s, %d\n", fname,
@@ -1120,8 +1168,6 @@ virusfilter_scan_result_eval:
 					"virusfilter_cache_entry_new failed");
 				goto virusfilter_scan_return;
 			}
-		} else if (is_cache) {
-			virusfilter_cache_entry_free(scan_cache_e);
 		}
 	}
 
@@ -1270,7 +1316,7 @@ static int virusfilter_vfs_open(
 		}
 	}
 
-	scan_result = virusfilter_scan(handle, config, fsp);
+	scan_result = virusfilter_scan(handle, config, fsp, &smb_fname->st);
 
 	switch (scan_result) {
 	case VIRUSFILTER_RESULT_CLEAN:
@@ -1329,6 +1375,10 @@ static int virusfilter_vfs_close(
 		close_errno = errno;
 	}
 
+	if (config->shared_cache && fsp->modified) {
+		virusfilter_shared_cache_remove(fsp->file_id);
+	}
+
 	/*
 	 * Return immediately if close_result == -1, and close_errno == EBADF.
 	 * If close failed, file likely doesn't exist, do not try to scan.
@@ -1395,7 +1445,7 @@ static int virusfilter_vfs_close(
 		return close_result;
 	}
 
-	scan_result = virusfilter_scan(handle, config, fsp);
+	scan_result = virusfilter_scan(handle, config, fsp, NULL);
 
 	switch (scan_result) {
 	case VIRUSFILTER_RESULT_CLEAN:
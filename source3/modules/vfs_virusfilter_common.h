@@ -87,6 +87,8 @@ struct virusfilter_config {
 	struct virusfilter_cache	*cache;
 	int				cache_entry_limit;
 	int				cache_time_limit;
+	bool				shared_cache;
+	int				shared_cache_time_limit;
 
 	/* Infected file options */
 	virusfilter_action		infected_file_action;
@@ -25,6 +25,9 @@ struct iovec;
 #include "lib/util/iov_buf.h"
 #include <tevent.h>
 #include "lib/tsocket/tsocket.h"
+#include "dbwrap/dbwrap.h"
+#include "dbwrap/dbwrap_open.h"
+#include "util_tdb.h"
 
 int virusfilter_debug_class = DBGC_VFS;
 
@@ -909,6 +912,172 @@ void virusfilter_cache_entry_free(struct virusfilter_cache_entry *cache_e)
 	TALLOC_FREE(cache_e);
 }
 
+/*
+ * Scan results shared by all smbd processes on this node, keyed by
+ * file_id. An entry is only used while mtime, ctime and size of the
+ * file still match the ones seen when it was scanned.
+ */
+
+struct virusfilter_shared_cache_rec {
+	struct timespec mtime;
+	struct timespec ctime;
+	uint64_t size;
+	time_t time;
+	uint32_t result;
+	/* followed by the NUL terminated report, if any */
+};
+
+static struct db_context *virusfilter_shared_db;
+static unsigned int virusfilter_shared_db_ref_count;
+
+bool virusfilter_shared_cache_open(void)
+{
+	char *db_path = NULL;
+
+	if (virusfilter_shared_db != NULL) {
+		virusfilter_shared_db_ref_count += 1;
+		return true;
+	}
+
+	/*
+	 * Not TDB_CLEAR_IF_FIRST, no process keeps the db open between
+	 * connections. Entries are checked against the file anyway.
+	 */
+	db_path = cache_path(talloc_tos(), "virusfilter.tdb");
+	if (db_path == NULL) {
+		return false;
+	}
+
+	become_root();
+	virusfilter_shared_db = db_open(NULL, db_path, 0,
+					TDB_DEFAULT|TDB_INCOMPATIBLE_HASH,
+					O_RDWR|O_CREAT, 0600,
+					DBWRAP_LOCK_ORDER_1,
+					DBWRAP_FLAG_NONE);
+	unbecome_root();
+
+	if (virusfilter_shared_db == NULL) {
+		DBG_ERR("Could not open %s: %s\n", db_path, strerror(errno));
+		TALLOC_FREE(db_path);
+		return false;
+	}
+
+	TALLOC_FREE(db_path);
+	virusfilter_shared_db_ref_count += 1;
+	return true;
+}
+
+void virusfilter_shared_cache_close(void)
+{
+	SMB_ASSERT(virusfilter_shared_db_ref_count > 0);
+
+	virusfilter_shared_db_ref_count -= 1;
+	if (virusfilter_shared_db_ref_count == 0) {
+		TALLOC_FREE(virusfilter_shared_db);
+	}
+}
+
+struct virusfilter_cache_entry *virusfilter_shared_cache_get(
+	TALLOC_CTX *ctx,
+	struct file_id id,
+	const SMB_STRUCT_STAT *sbuf,
+	time_t time_limit)
+{
+	struct virusfilter_shared_cache_rec rec;
+	struct virusfilter_cache_entry *cache_e = NULL;
+	TDB_DATA key = make_tdb_data((const uint8_t *)&id, sizeof(id));
+	TDB_DATA value;
+	NTSTATUS status;
+
+	status = dbwrap_fetch(virusfilter_shared_db, talloc_tos(), key,
+			      &value);
+	if (!NT_STATUS_IS_OK(status)) {
+		return NULL;
+	}
+	if (value.dsize < sizeof(rec)) {
+		goto remove;
+	}
+	memcpy(&rec, value.dptr, sizeof(rec));
+
+	if ((timespec_compare(&rec.mtime, &sbuf->st_ex_mtime) != 0) ||
+	    (timespec_compare(&rec.ctime, &sbuf->st_ex_ctime) != 0) ||
+	    (rec.size != sbuf->st_ex_size)) {
+		DBG_DEBUG("Shared cache entry is stale: %s\n",
+			  file_id_string_tos(&id));
+		goto remove;
+	}
+	if ((time_limit > 0) && (time(NULL) - rec.time > time_limit)) {
+		DBG_DEBUG("Shared cache entry is too old: %s\n",
+			  file_id_string_tos(&id));
+		goto remove;
+	}
+
+	cache_e = talloc_zero(ctx, struct virusfilter_cache_entry);
+	if (cache_e == NULL) {
+		TALLOC_FREE(value.dptr);
+		return NULL;
+	}
+	cache_e->time = rec.time;
+	cache_e->result = rec.result;
+	if (value.dsize > sizeof(rec)) {
+		cache_e->report = talloc_strndup(
+			cache_e, (const char *)value.dptr + sizeof(rec),
+			value.dsize - sizeof(rec));
+	}
+
+	TALLOC_FREE(value.dptr);
+	return cache_e;
+
+remove:
+	TALLOC_FREE(value.dptr);
+	virusfilter_shared_cache_remove(id);
+	return NULL;
+}
+
+bool virusfilter_shared_cache_add(
+	struct file_id id,
+	const SMB_STRUCT_STAT *sbuf,
+	virusfilter_result result,
+	const char *report)
+{
+	struct virusfilter_shared_cache_rec rec = {
+		.mtime = sbuf->st_ex_mtime,
+		.ctime = sbuf->st_ex_ctime,
+		.size = sbuf->st_ex_size,
+		.time = time(NULL),
+		.result = result,
+	};
+	TDB_DATA key = make_tdb_data((const uint8_t *)&id, sizeof(id));
+	size_t report_len = (report != NULL) ? strlen(report) + 1 : 0;
+	uint8_t *buf = NULL;
+	NTSTATUS status;
+
+	buf = talloc_array(talloc_tos(), uint8_t, sizeof(rec) + report_len);
+	if (buf == NULL) {
+		return false;
+	}
+	memcpy(buf, &rec, sizeof(rec));
+	if (report_len != 0) {
+		memcpy(buf + sizeof(rec), report, report_len);
+	}
+
+	status = dbwrap_store(virusfilter_shared_db, key,
+			      make_tdb_data(buf, sizeof(rec) + report_len), 0);
+	TALLOC_FREE(buf);
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_WARNING("dbwrap_store failed: %s\n", nt_errstr(status));
+		return false;
+	}
+	return true;
+}
+
+void virusfilter_shared_cache_remove(struct file_id id)
+{
+	TDB_DATA key = make_tdb_data((const uint8_t *)&id, sizeof(id));
+
+	dbwrap_delete(virusfilter_shared_db, key);
+}
+
 /* Shell scripting
  * ======================================================================
  */
@@ -157,6 +157,21 @@ void virusfilter_cache_remove(
 	const char *fname);
 void virusfilter_cache_purge(struct virusfilter_cache *cache);
 
+/* Scan result cache shared by all smbd processes */
+bool virusfilter_shared_cache_open(void);
+void virusfilter_shared_cache_close(void);
+struct virusfilter_cache_entry *virusfilter_shared_cache_get(
+	TALLOC_CTX *ctx,
+	struct file_id id,
+	const SMB_STRUCT_STAT *sbuf,
+	time_t time_limit);
+bool virusfilter_shared_cache_add(
+	struct file_id id,
+	const SMB_STRUCT_STAT *sbuf,
+	virusfilter_result result,
+	const char *report);
+void virusfilter_shared_cache_remove(struct file_id id);
+
 /* Shell scripting */
 int virusfilter_env_set(
 	TALLOC_CTX *mem_ctx,
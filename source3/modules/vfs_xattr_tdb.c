@@ -523,7 +523,7 @@ static int xattr_tdb_open(vfs_handle_struct *handle,
 			strerror(errno));
 		return -1;
 	}
-	fsp->file_id = SMB_VFS_FILE_ID_CREATE(fsp->conn, &smb_fname->st);
+	fsp_set_file_id(fsp, SMB_VFS_FILE_ID_CREATE(fsp->conn, &smb_fname->st));
 
 	frame = talloc_stackframe();
 	SMB_VFS_HANDLE_GET_DATA(handle, db, struct db_context,
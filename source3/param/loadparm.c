@@ -92,6 +92,13 @@ extern userdom_struct current_user_info;
 static bool in_client = false;		/* Not in the client by default */
 static struct smbconf_csn conf_last_csn;
 
+/*
+ * Canonical names of the shares in the registry, valid as long as
+ * the registry seqnum matches registry_share_names_csn.
+ */
+static struct db_context *registry_share_names;
+static struct smbconf_csn registry_share_names_csn;
+
 static int config_backend = CONFIG_BACKEND_FILE;
 
 /* some helpful bits */
@@ -262,11 +269,39 @@ static struct loadparm_service **ServicePtrs = NULL;
 static int iNumServices = 0;
 static int iServiceIndex = 0;
 static struct db_context *ServiceHash;
+static int iNumMacroServices = 0;
 static bool bInGlobalSection = true;
 static bool bGlobalOnly = false;
 static struct file_lists *file_lists = NULL;
 static unsigned int *flags_list = NULL;
 
+/*
+ * Incremental reloads, see lp_reload_with_shares(). While the config
+ * file is parsed, the parameters of each service section are hashed,
+ * starting with a hash of all global parameters parsed before the
+ * section. The parameters of a section whose service has been loaded
+ * with a valid hash before are buffered until the end of the section
+ * and only applied if the hash turns out to be different.
+ */
+static uint32_t lp_load_generation;
+static bool bIncrementalLoad = false;
+static bool bHashSections = false;
+static uint64_t lp_defaults_hash;
+static bool lp_defaults_unknown;
+static unsigned int lp_num_unchanged;
+static struct smbd_server_connection *lp_reload_sconn;
+static bool (*lp_reload_snumused)(struct smbd_server_connection *, int);
+
+static struct {
+	int snum;
+	struct loadparm_context *lp_ctx;
+	uint64_t hash;
+	bool hash_valid;
+	bool buffering;
+	char **params;	/* name/value pairs */
+	size_t num_params;
+} lp_pending = { .snum = -1 };
+
 static void set_allowed_client_auth(void);
 
 static bool lp_set_cmdline_helper(const char *pszParmName, const char *pszParmValue);
@@ -958,6 +993,7 @@ static void init_globals(struct loadparm_context *lp_ctx, bool reinit_globals)
 	Globals.prefork_children = 4;
 	Globals.prefork_backoff_increment = 10;
 	Globals.prefork_maximum_backoff = 120;
+	Globals.prefork_balance_connections = true;
 
 	/* Now put back the settings that were set with lp_set_cmdline() */
 	apply_lp_set_cmdline();
@@ -1402,6 +1438,10 @@ static void free_service_byindex(int idx)
 
 		dbwrap_delete_bystring(ServiceHash, canon_name );
 		TALLOC_FREE(canon_name);
+
+		if (strchr(ServicePtrs[idx]->szService, '%') != NULL) {
+			iNumMacroServices--;
+		}
 	}
 
 	free_service(ServicePtrs[idx]);
@@ -1422,6 +1462,7 @@ static int add_a_service(const struct loadparm_service *pservice, const char *na
 	if (name) {
 		i = getservicebyname(name, NULL);
 		if (i >= 0) {
+			ServicePtrs[i]->load_generation = lp_load_generation;
 			return (i);
 		}
 	}
@@ -1452,6 +1493,7 @@ static int add_a_service(const struct loadparm_service *pservice, const char *na
 	}
 
 	ServicePtrs[i]->valid = true;
+	ServicePtrs[i]->load_generation = lp_load_generation;
 
 	copy_service(ServicePtrs[i], pservice, NULL);
 	if (name)
@@ -1519,6 +1561,10 @@ static bool hash_a_service(const char *name, int idx)
 
 	TALLOC_FREE(canon_name);
 
+	if (strchr(name, '%') != NULL) {
+		iNumMacroServices++;
+	}
+
 	return true;
 }
 
@@ -2147,6 +2193,71 @@ static bool process_smbconf_service(struct smbconf_service *service)
 	return true;
 }
 
+/**
+ * Check whether the registry holds a share, using a table of the share
+ * names in memory. The table is rebuilt whenever the seqnum of the
+ * registry changes, so a tree connect to a share that is not loaded yet
+ * does not have to walk the registry keys to find out whether it exists.
+ */
+static bool lp_registry_share_exists(struct smbconf_ctx *conf_ctx,
+				     const char *service_name)
+{
+	TALLOC_CTX *frame = talloc_stackframe();
+	char **share_names = NULL;
+	uint32_t num_shares = 0;
+	uint32_t count;
+	char *canon_name;
+	bool ret;
+	sbcErr err;
+
+	if (smbconf_changed(conf_ctx, &registry_share_names_csn, NULL, NULL) ||
+	    registry_share_names == NULL)
+	{
+		TALLOC_FREE(registry_share_names);
+
+		err = smbconf_get_share_names(conf_ctx, frame, &num_shares,
+					      &share_names);
+		if (!SBC_ERROR_IS_OK(err)) {
+			goto fallback;
+		}
+
+		registry_share_names = db_open_rbt(NULL);
+		if (registry_share_names == NULL) {
+			goto fallback;
+		}
+
+		for (count = 0; count < num_shares; count++) {
+			canon_name = canonicalize_servicename(
+				frame, share_names[count]);
+			if (canon_name == NULL) {
+				TALLOC_FREE(registry_share_names);
+				goto fallback;
+			}
+			dbwrap_store_bystring(registry_share_names, canon_name,
+					      make_tdb_data(NULL, 0),
+					      TDB_REPLACE);
+		}
+
+		DEBUG(10, ("lp_registry_share_exists: cached %u share names "
+			   "for registry seqnum %llu\n", (unsigned)num_shares,
+			   (unsigned long long)registry_share_names_csn.csn));
+	}
+
+	canon_name = canonicalize_servicename(frame, service_name);
+	if (canon_name == NULL) {
+		goto fallback;
+	}
+
+	ret = dbwrap_exists(registry_share_names,
+			    string_term_tdb_data(canon_name));
+	TALLOC_FREE(frame);
+	return ret;
+
+fallback:
+	TALLOC_FREE(frame);
+	return smbconf_share_exists(conf_ctx, service_name);
+}
+
 /**
  * load a service from registry and activate it
  */
@@ -2164,7 +2275,7 @@ bool process_registry_service(const char *service_name)
 
 	DEBUG(5, ("process_registry_service: service name %s\n", service_name));
 
-	if (!smbconf_share_exists(conf_ctx, service_name)) {
+	if (!lp_registry_share_exists(conf_ctx, service_name)) {
 		/*
 		 * Registry does not contain data for this service (yet),
 		 * but make sure lp_load doesn't return false.
@@ -2700,6 +2811,216 @@ bool lp_set_cmdline(const char *pszParmName, const char *pszParmValue)
 	return ret;
 }
 
+/***************************************************************************
+ Section hashing for incremental reloads.
+***************************************************************************/
+
+#define LP_HASH_INIT 0xcbf29ce484222325ULL
+
+static uint64_t lp_hash_string(uint64_t hash, const char *str)
+{
+	const uint8_t *p = (const uint8_t *)str;
+
+	/* FNV-1a, the terminating 0 separates names and values */
+	do {
+		hash ^= *p;
+		hash *= 0x100000001b3ULL;
+	} while (*p++ != '\0');
+
+	return hash;
+}
+
+/*
+ * The result of these depends on more than the section's lines.
+ */
+static bool lp_param_is_include(const char *pszParmName)
+{
+	return (strwicmp(pszParmName, "include") == 0) ||
+		(strwicmp(pszParmName, "copy") == 0);
+}
+
+static void lp_pending_start(struct loadparm_context *lp_ctx, int snum,
+			     bool existed, bool duplicate)
+{
+	struct loadparm_service *service = ServicePtrs[snum];
+
+	if (!bHashSections) {
+		service->section_hash_valid = false;
+		free_param_opts(&service->param_opt);
+		return;
+	}
+
+	lp_pending.snum = snum;
+	lp_pending.lp_ctx = lp_ctx;
+	lp_pending.hash = lp_hash_string(lp_defaults_hash, service->szService);
+	lp_pending.hash_valid = !duplicate && !lp_defaults_unknown;
+	lp_pending.buffering = bIncrementalLoad &&
+		existed &&
+		lp_pending.hash_valid &&
+		service->section_hash_valid &&
+		!service->autoloaded &&
+		(service->usershare != USERSHARE_VALID);
+
+	if (!lp_pending.buffering) {
+		/* Clean all parametric options for service */
+		/* They will be added during parsing again */
+		free_param_opts(&service->param_opt);
+	}
+}
+
+/*
+ * The section has changed, apply the buffered parameters
+ */
+static bool lp_pending_apply(void)
+{
+	int snum = lp_pending.snum;
+	bool ok = true;
+	size_t i;
+
+	lp_pending.buffering = false;
+
+	if ((lp_reload_snumused == NULL) ||
+	    !lp_reload_snumused(lp_reload_sconn, snum)) {
+		/*
+		 * Start from the defaults like a full reload,
+		 * which would have removed the unused service
+		 * before.
+		 */
+		char *name = talloc_strdup(talloc_tos(),
+					   ServicePtrs[snum]->szService);
+		if (name == NULL) {
+			return false;
+		}
+		free_service_byindex(snum);
+		snum = add_a_service(&sDefault, name);
+		TALLOC_FREE(name);
+		if (snum < 0) {
+			lp_pending.snum = -1;
+			return false;
+		}
+		lp_pending.snum = snum;
+		iServiceIndex = snum;
+	}
+
+	free_param_opts(&ServicePtrs[snum]->param_opt);
+
+	for (i = 0; i < lp_pending.num_params; i++) {
+		const char *pszParmName = lp_pending.params[2*i];
+		const char *pszParmValue = lp_pending.params[2*i+1];
+
+		ok = lpcfg_do_service_parameter(lp_pending.lp_ctx,
+						ServicePtrs[snum],
+						pszParmName, pszParmValue);
+		if (!ok) {
+			break;
+		}
+	}
+
+	TALLOC_FREE(lp_pending.params);
+	lp_pending.num_params = 0;
+
+	return ok;
+}
+
+static bool lp_pending_param(const char *pszParmName,
+			     const char *pszParmValue)
+{
+	size_t n = lp_pending.num_params * 2;
+	char **tmp = NULL;
+
+	lp_pending.hash = lp_hash_string(lp_pending.hash, pszParmName);
+	lp_pending.hash = lp_hash_string(lp_pending.hash, pszParmValue);
+
+	if (lp_param_is_include(pszParmName)) {
+		lp_pending.hash_valid = false;
+		if (lp_pending.buffering && !lp_pending_apply()) {
+			return false;
+		}
+	}
+
+	if (!lp_pending.buffering) {
+		return lpcfg_do_service_parameter(lp_pending.lp_ctx,
+						  ServicePtrs[lp_pending.snum],
+						  pszParmName, pszParmValue);
+	}
+
+	tmp = talloc_realloc(NULL, lp_pending.params, char *, n + 2);
+	if (tmp == NULL) {
+		return false;
+	}
+	lp_pending.params = tmp;
+	tmp[n] = talloc_strdup(tmp, pszParmName);
+	tmp[n+1] = talloc_strdup(tmp, pszParmValue);
+	if ((tmp[n] == NULL) || (tmp[n+1] == NULL)) {
+		return false;
+	}
+	lp_pending.num_params += 1;
+
+	return true;
+}
+
+static bool lp_pending_finish(void)
+{
+	struct loadparm_service *service = NULL;
+	bool ok = true;
+
+	if (lp_pending.snum < 0) {
+		return true;
+	}
+
+	if (lp_pending.buffering) {
+		service = ServicePtrs[lp_pending.snum];
+
+		if (service->section_hash == lp_pending.hash) {
+			DEBUG(10, ("service [%s] unchanged\n",
+				   service->szService));
+			lp_num_unchanged += 1;
+			lp_pending.buffering = false;
+		} else {
+			ok = lp_pending_apply();
+		}
+	}
+
+	if (lp_pending.snum >= 0) {
+		service = ServicePtrs[lp_pending.snum];
+		service->section_hash = lp_pending.hash;
+		service->section_hash_valid = lp_pending.hash_valid;
+	}
+
+	TALLOC_FREE(lp_pending.params);
+	lp_pending.num_params = 0;
+	lp_pending.buffering = false;
+	lp_pending.snum = -1;
+
+	return ok;
+}
+
+/*
+ * Remove the services the config file does not define anymore
+ */
+static void lp_kill_stale_services(void)
+{
+	int i;
+
+	for (i = 0; i < iNumServices; i++) {
+		if (!VALID(i)) {
+			continue;
+		}
+		if (ServicePtrs[i]->load_generation == lp_load_generation) {
+			continue;
+		}
+		if (ServicePtrs[i]->autoloaded ||
+		    ServicePtrs[i]->usershare == USERSHARE_VALID) {
+			continue;
+		}
+		if ((lp_reload_snumused != NULL) &&
+		    lp_reload_snumused(lp_reload_sconn, i)) {
+			continue;
+		}
+		free_service_byindex(i);
+	}
+}
+
 /***************************************************************************
  Process a parameter.
 ***************************************************************************/
@@ -2713,7 +3034,20 @@ static bool do_parameter(const char *pszParmName, const char *pszParmValue,
 	DEBUGADD(4, ("doing parameter %s = %s\n", pszParmName, pszParmValue));
 
 	if (bInGlobalSection) {
+		if (bHashSections) {
+			lp_defaults_hash = lp_hash_string(lp_defaults_hash,
+							  pszParmName);
+			lp_defaults_hash = lp_hash_string(lp_defaults_hash,
+							  pszParmValue);
+			if (lp_param_is_include(pszParmName) &&
+			    strequal(pszParmValue, INCLUDE_REGISTRY_NAME)) {
+				/* registry globals are not hashed */
+				lp_defaults_unknown = true;
+			}
+		}
 		return lpcfg_do_global_parameter(userdata, pszParmName, pszParmValue);
+	} else if (lp_pending.snum >= 0 && lp_pending.snum == iServiceIndex) {
+		return lp_pending_param(pszParmName, pszParmValue);
 	} else {
 		return lpcfg_do_service_parameter(userdata, ServicePtrs[iServiceIndex],
 						  pszParmName, pszParmValue);
@@ -2769,6 +3103,16 @@ bool lp_do_section(const char *pszSectionName, void *userdata)
 	bool bRetval;
 	bool isglobal = ((strwicmp(pszSectionName, GLOBAL_NAME) == 0) ||
 			 (strwicmp(pszSectionName, GLOBAL_NAME2) == 0));
+	bool existed = false;
+	bool duplicate = false;
+	int snum;
+
+	/* the previous section is complete */
+	bRetval = lp_pending_finish();
+	if (!bRetval) {
+		return false;
+	}
+
 	bRetval = false;
 
 	/* if we were in a global section then do the local inits */
@@ -2802,14 +3146,19 @@ bool lp_do_section(const char *pszSectionName, void *userdata)
 		/* issued by the post-processing of a previous section. */
 		DEBUG(2, ("Processing section \"[%s]\"\n", pszSectionName));
 
+		snum = getservicebyname(pszSectionName, NULL);
+		if (snum >= 0 && LP_SNUM_OK(snum)) {
+			existed = true;
+			duplicate = (ServicePtrs[snum]->load_generation ==
+				     lp_load_generation);
+		}
+
 		iServiceIndex = add_a_service(&sDefault, pszSectionName);
 		if (iServiceIndex < 0) {
 			DEBUG(0, ("Failed to add a new service\n"));
 			return false;
 		}
-		/* Clean all parametric options for service */
-		/* They will be added during parsing again */
-		free_param_opts(&ServicePtrs[iServiceIndex]->param_opt);
+		lp_pending_start(lp_ctx, iServiceIndex, existed, duplicate);
 	}
 
 	return bRetval;
@@ -3876,6 +4225,11 @@ static bool lp_load_ex(const char *pszFname,
 	bAllowIncludeRegistry = allow_include_registry;
 	sDefault = _sDefault;
 
+	lp_load_generation += 1;
+	lp_defaults_hash = LP_HASH_INIT;
+	lp_defaults_unknown = false;
+	lp_num_unchanged = 0;
+
 	lp_ctx = setup_lp_context(talloc_tos());
 
 	init_globals(lp_ctx, reinit_globals);
@@ -3907,17 +4261,29 @@ static bool lp_load_ex(const char *pszFname,
 
 		add_to_file_list(NULL, &file_lists, pszFname, n2);
 
+		bHashSections = !global_only;
 		bRetval = pm_process(n2, lp_do_section, do_parameter, lp_ctx);
 		TALLOC_FREE(n2);
 
 		/* finish up the last section */
 		DEBUG(4, ("pm_process() returned %s\n", BOOLSTR(bRetval)));
+		if (!lp_pending_finish()) {
+			bRetval = false;
+		}
+		bHashSections = false;
 		if (bRetval) {
 			if (iServiceIndex >= 0) {
 				bRetval = lpcfg_service_ok(ServicePtrs[iServiceIndex]);
 			}
 		}
 
+		if (bIncrementalLoad) {
+			lp_kill_stale_services();
+			bIncrementalLoad = false;
+			DEBUG(3, ("lp_load_ex: %u services unchanged\n",
+				  lp_num_unchanged));
+		}
+
 		if (lp_config_backend_is_registry()) {
 			bool ok;
 			/* config backend changed to registry in config file */
@@ -4065,6 +4431,37 @@ bool lp_load_with_shares(const char *file_name)
 		       true);  /* reinit_globals */
 }
 
+/**
+ * Reload globals and shares like lp_killunused() followed by
+ * lp_load_with_shares(), but keep the services whose section in the
+ * config file has not changed. This makes a reload of a config file
+ * with thousands of shares cheap for a process that only has a few of
+ * them in use.
+ */
+bool lp_reload_with_shares(const char *file_name,
+			   struct smbd_server_connection *sconn,
+			   bool (*snumused) (struct smbd_server_connection *, int))
+{
+	bool ret;
+
+	if (!bLoaded || !lp_config_backend_is_file()) {
+		lp_killunused(sconn, snumused);
+		return lp_load_with_shares(file_name);
+	}
+
+	lp_reload_sconn = sconn;
+	lp_reload_snumused = snumused;
+	bIncrementalLoad = true;
+
+	ret = lp_load_with_shares(file_name);
+
+	bIncrementalLoad = false;
+	lp_reload_sconn = NULL;
+	lp_reload_snumused = NULL;
+
+	return ret;
+}
+
 /**
  * lp_load wrapper, especially for clients
  */
@@ -4192,8 +4589,22 @@ int lp_servicenumber(const char *pszServiceName)
         	return GLOBAL_SECTION_SNUM;
 	}
 
-	for (iService = iNumServices - 1; iService >= 0; iService--) {
-		if (VALID(iService) && ServicePtrs[iService]->szService) {
+	if (iNumMacroServices == 0) {
+		/*
+		 * No service name needs substitution, the hash of the
+		 * canonical names finds the service without walking
+		 * through all of them.
+		 */
+		iService = getservicebyname(pszServiceName, NULL);
+		if (!LP_SNUM_OK(iService)) {
+			iService = -1;
+		}
+	} else {
+		for (iService = iNumServices - 1; iService >= 0; iService--) {
+			if (!VALID(iService) ||
+			    ServicePtrs[iService]->szService == NULL) {
+				continue;
+			}
 			/*
 			 * The substitution here is used to support %U in
 			 * service names
@@ -23,6 +23,7 @@
 #include "rpc_client/rpc_client.h"
 #include "../librpc/gen_ndr/ndr_spoolss_c.h"
 #include "rpc_server/rpc_ncacn_np.h"
+#include "smbd/smbd.h"
 #include "smbd/globals.h"
 #include "../libcli/security/security.h"
 
@@ -221,7 +222,8 @@ NTSTATUS print_spool_open(files_struct *fsp,
 		goto done;
 	}
 
-	fsp->file_id = vfs_file_id_from_sbuf(fsp->conn, &fsp->fsp_name->st);
+	fsp_set_file_id(fsp,
+			vfs_file_id_from_sbuf(fsp->conn, &fsp->fsp_name->st));
 	fsp->fh->fd = fd;
 
 	fsp->vuid = current_vuid;
@@ -26,6 +26,7 @@
 #include "messages.h"
 #include "smbprofile.h"
 #include "lib/tdb_wrap/tdb_wrap.h"
+#include "util_tdb.h"
 #include <tevent.h>
 #include "../lib/crypto/crypto.h"
 
@@ -36,6 +37,27 @@
 struct profile_stats *profile_p;
 struct smbprofile_global_state smbprofile_state;
 
+/*
+ * Latency histograms stored under "<prefix><name>", for shares
+ * (SMBPROFILE_SHARE_KEY_PREFIX) and VFS operations
+ * (SMBPROFILE_VFS_KEY_PREFIX).
+ */
+struct smbprofile_share {
+	struct smbprofile_share *prev, *next;
+	const char *prefix;
+	char *name;
+	struct smbprofile_stats_histogram latency;
+};
+
+static void smbprofile_shares_reset(void)
+{
+	struct smbprofile_share *s = NULL;
+
+	for (s = smbprofile_state.internal.shares; s != NULL; s = s->next) {
+		ZERO_STRUCT(s->latency);
+	}
+}
+
 /****************************************************************************
 Set a profiling level.
 ****************************************************************************/
@@ -64,6 +86,7 @@ void set_profile_level(int level, const struct server_id *src)
 		break;
 	case 3:		/* reset profile values */
 		ZERO_STRUCT(profile_p->values);
+		smbprofile_shares_reset();
 		tdb_wipe_all(smbprofile_state.internal.db->tdb);
 		DEBUG(1,("INFO: Profiling values cleared from pid %d\n",
 			 (int)procid_to_pid(src)));
@@ -184,6 +207,7 @@ bool profile_setup(struct messaging_context *msg_ctx, bool rdonly)
 	__UPDATE(#name "+idle"); \
 	__UPDATE(#name "+inbytes"); \
 	__UPDATE(#name "+outbytes"); \
+	__UPDATE(#name "+latency"); \
 } while(0);
 #define SMBPROFILE_STATS_SECTION_END
 #define SMBPROFILE_STATS_END
@@ -259,6 +283,125 @@ static int profile_stats_parser(TDB_DATA key, TDB_DATA value,
 	return 0;
 }
 
+static struct smbprofile_stats_histogram *smbprofile_named_latency(
+	const char *prefix, const char *name)
+{
+	struct smbprofile_share *s = NULL;
+
+	for (s = smbprofile_state.internal.shares; s != NULL; s = s->next) {
+		if ((s->prefix == prefix) && (strcmp(s->name, name) == 0)) {
+			return &s->latency;
+		}
+	}
+
+	s = talloc_zero(NULL, struct smbprofile_share);
+	if (s == NULL) {
+		return NULL;
+	}
+	s->prefix = prefix;
+	s->name = talloc_strdup(s, name);
+	if (s->name == NULL) {
+		TALLOC_FREE(s);
+		return NULL;
+	}
+	DLIST_ADD(smbprofile_state.internal.shares, s);
+
+	return &s->latency;
+}
+
+struct smbprofile_stats_histogram *smbprofile_share_latency(const char *share)
+{
+	return smbprofile_named_latency(SMBPROFILE_SHARE_KEY_PREFIX, share);
+}
+
+struct smbprofile_stats_histogram *smbprofile_vfs_latency(const char *op)
+{
+	return smbprofile_named_latency(SMBPROFILE_VFS_KEY_PREFIX, op);
+}
+
+void smbprofile_histogram_accumulate(struct smbprofile_stats_histogram *acc,
+				     const struct smbprofile_stats_histogram *add)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(acc->buckets); i++) {
+		acc->buckets[i] += add->buckets[i];
+	}
+}
+
+static int profile_share_stats_parser(TDB_DATA key, TDB_DATA value,
+				      void *private_data)
+{
+	struct smbprofile_share_stats *s = private_data;
+
+	if (value.dsize != sizeof(struct smbprofile_share_stats)) {
+		*s = (struct smbprofile_share_stats) {};
+		return 0;
+	}
+
+	memcpy(s, value.dptr, value.dsize);
+	if (s->magic != profile_p->magic) {
+		*s = (struct smbprofile_share_stats) {};
+		return 0;
+	}
+
+	return 0;
+}
+
+static void smbprofile_dump_share(struct smbprofile_share *share)
+{
+	static const struct smbprofile_stats_histogram empty;
+	struct smbprofile_share_stats s = {};
+	char *keystr = NULL;
+	TDB_DATA key;
+	int ret;
+
+	if (memcmp(&share->latency, &empty, sizeof(empty)) == 0) {
+		return;
+	}
+
+	keystr = talloc_asprintf(talloc_tos(), "%s%s",
+				 share->prefix,
+				 share->name);
+	if (keystr == NULL) {
+		return;
+	}
+	key = string_tdb_data(keystr);
+
+	ret = tdb_chainlock(smbprofile_state.internal.db->tdb, key);
+	if (ret != 0) {
+		TALLOC_FREE(keystr);
+		return;
+	}
+
+	tdb_parse_record(smbprofile_state.internal.db->tdb,
+			 key, profile_share_stats_parser, &s);
+
+	s.magic = profile_p->magic;
+	smbprofile_histogram_accumulate(&s.latency, &share->latency);
+
+	tdb_store(smbprofile_state.internal.db->tdb, key,
+		  (TDB_DATA) {
+			.dptr = (uint8_t *)&s,
+			.dsize = sizeof(s)
+		  },
+		  0);
+
+	tdb_chainunlock(smbprofile_state.internal.db->tdb, key);
+	TALLOC_FREE(keystr);
+
+	ZERO_STRUCT(share->latency);
+}
+
+static void smbprofile_dump_shares(void)
+{
+	struct smbprofile_share *s = NULL;
+
+	for (s = smbprofile_state.internal.shares; s != NULL; s = s->next) {
+		smbprofile_dump_share(s);
+	}
+}
+
 void smbprofile_dump(void)
 {
 	pid_t pid = getpid();
@@ -314,6 +457,8 @@ void smbprofile_dump(void)
 	tdb_chainunlock(smbprofile_state.internal.db->tdb, key);
 	ZERO_STRUCT(profile_p->values);
 
+	smbprofile_dump_shares();
+
 	return;
 }
 
@@ -395,6 +540,8 @@ void smbprofile_stats_accumulate(struct profile_stats *acc,
 	acc->values.name##_stats.idle += add->values.name##_stats.idle; \
 	acc->values.name##_stats.inbytes += add->values.name##_stats.inbytes; \
 	acc->values.name##_stats.outbytes += add->values.name##_stats.outbytes; \
+	smbprofile_histogram_accumulate(&acc->values.name##_stats.latency, \
+					&add->values.name##_stats.latency); \
 } while(0);
 #define SMBPROFILE_STATS_SECTION_END
 #define SMBPROFILE_STATS_END
@@ -410,6 +557,93 @@ void smbprofile_stats_accumulate(struct profile_stats *acc,
 #undef SMBPROFILE_STATS_END
 }
 
+struct smbprofile_collect_shares_state {
+	const char *prefix;
+	void (*fn)(const char *share,
+		   const struct smbprofile_stats_histogram *latency,
+		   void *private_data);
+	void *private_data;
+};
+
+static int smbprofile_collect_shares_fn(struct tdb_context *tdb,
+					TDB_DATA key, TDB_DATA value,
+					void *private_data)
+{
+	struct smbprofile_collect_shares_state *state = private_data;
+	size_t prefix_len = strlen(state->prefix);
+	const struct smbprofile_share_stats *v = NULL;
+	char *name = NULL;
+
+	if (value.dsize != sizeof(struct smbprofile_share_stats)) {
+		return 0;
+	}
+	if (key.dsize <= prefix_len) {
+		return 0;
+	}
+	if (memcmp(key.dptr, state->prefix, prefix_len) != 0) {
+		return 0;
+	}
+
+	v = (const struct smbprofile_share_stats *)value.dptr;
+
+	if (v->magic != profile_p->magic) {
+		return 0;
+	}
+
+	name = talloc_strndup(talloc_tos(),
+			      (const char *)key.dptr + prefix_len,
+			      key.dsize - prefix_len);
+	if (name == NULL) {
+		return 0;
+	}
+
+	state->fn(name, &v->latency, state->private_data);
+
+	TALLOC_FREE(name);
+	return 0;
+}
+
+static void smbprofile_collect_latencies(
+	const char *prefix,
+	void (*fn)(const char *name,
+		   const struct smbprofile_stats_histogram *latency,
+		   void *private_data),
+	void *private_data)
+{
+	struct smbprofile_collect_shares_state state = {
+		.prefix = prefix,
+		.fn = fn,
+		.private_data = private_data,
+	};
+
+	if (smbprofile_state.internal.db == NULL) {
+		return;
+	}
+
+	tdb_traverse_read(smbprofile_state.internal.db->tdb,
+			  smbprofile_collect_shares_fn, &state);
+}
+
+void smbprofile_collect_shares(
+	void (*fn)(const char *share,
+		   const struct smbprofile_stats_histogram *latency,
+		   void *private_data),
+	void *private_data)
+{
+	smbprofile_collect_latencies(SMBPROFILE_SHARE_KEY_PREFIX,
+				     fn, private_data);
+}
+
+void smbprofile_collect_vfs(
+	void (*fn)(const char *op,
+		   const struct smbprofile_stats_histogram *latency,
+		   void *private_data),
+	void *private_data)
+{
+	smbprofile_collect_latencies(SMBPROFILE_VFS_KEY_PREFIX,
+				     fn, private_data);
+}
+
 static int smbprofile_collect_fn(struct tdb_context *tdb,
 				 TDB_DATA key, TDB_DATA value,
 				 void *private_data)
@@ -27,31 +27,12 @@
 #include "lib/dbwrap/dbwrap_rbt.h"
 #include "libcli/security/dom_sid.h"
 #include "mdssvc.h"
-#include "rpc_server/mdssvc/sparql_parser.tab.h"
+#include "mdssvc_tracker.h"
+#include "mdssvc_noindex.h"
 
 #undef DBGC_CLASS
 #define DBGC_CLASS DBGC_RPC_SRV
 
-#define SLQ_DEBUG(lvl, _slq, state) do { if (CHECK_DEBUGLVL(lvl)) {	\
-	const struct sl_query *__slq = _slq;				\
-	struct timeval_buf start_buf;					\
-	const char *start;						\
-	struct timeval_buf last_used_buf;				\
-	const char *last_used;						\
-	struct timeval_buf expire_buf;					\
-	const char *expire;						\
-	start = timeval_str_buf(&__slq->start_time, false,		\
-				true, &start_buf);			\
-	last_used = timeval_str_buf(&__slq->last_used, false,		\
-				    true, &last_used_buf);		\
-	expire = timeval_str_buf(&__slq->expire_time, false,		\
-				 true, &expire_buf);			\
-	DEBUG(lvl,("%s slq[0x%jx,0x%jx], start: %s, last_used: %s, "	\
-		   "expires: %s, query: '%s'\n", state,			\
-		   (uintmax_t)__slq->ctx1, (uintmax_t)__slq->ctx2,	\
-		   start, last_used, expire, __slq->query_string));	\
-}} while(0)
-
 struct slrpc_cmd {
 	const char *name;
 	bool (*function)(struct mds_ctx *mds_ctx,
@@ -59,11 +40,6 @@ struct slrpc_cmd {
 			 DALLOC_CTX *reply);
 };
 
-struct slq_destroy_state {
-	struct tevent_context *ev;
-	struct sl_query *slq;
-};
-
 /*
  * If these functions return an error, they hit something like a non
  * recoverable talloc error. Most errors are dealt with by returning
@@ -84,29 +60,6 @@ static bool slrpc_fetch_attributes(struct mds_ctx *mds_ctx,
 static bool slrpc_close_query(struct mds_ctx *mds_ctx,
 			      const DALLOC_CTX *query, DALLOC_CTX *reply);
 
-static struct tevent_req *slq_destroy_send(TALLOC_CTX *mem_ctx,
-					   struct tevent_context *ev,
-					   struct sl_query **slq)
-{
-	struct tevent_req *req;
-	struct slq_destroy_state *state;
-
-	req = tevent_req_create(mem_ctx, &state,
-				struct slq_destroy_state);
-	if (req == NULL) {
-		return NULL;
-	}
-	state->slq = talloc_move(state, slq);
-	tevent_req_done(req);
-
-	return tevent_req_post(req, ev);
-}
-
-static void slq_destroy_recv(struct tevent_req *req)
-{
-	tevent_req_received(req);
-}
-
 /************************************************
  * Misc utility functions
  ************************************************/
@@ -278,33 +231,6 @@ char *mds_dalloc_dump(DALLOC_CTX *dd, int nestinglevel)
 	return logstring;
 }
 
-static char *tracker_to_unix_path(TALLOC_CTX *mem_ctx, const char *uri)
-{
-	GFile *f;
-	char *path;
-	char *talloc_path;
-
-	f = g_file_new_for_uri(uri);
-	if (f == NULL) {
-		return NULL;
-	}
-
-	path = g_file_get_path(f);
-	g_object_unref(f);
-
-	if (path == NULL) {
-		return NULL;
-	}
-
-	talloc_path = talloc_strdup(mem_ctx, path);
-	g_free(path);
-	if (talloc_path == NULL) {
-		return NULL;
-	}
-
-	return talloc_path;
-}
-
 /**
  * Add requested metadata for a query result element
  *
@@ -492,13 +418,25 @@ static bool create_result_handle(struct sl_query *slq)
 	return true;
 }
 
+/**
+ * Hand out the oldest queued batch of results, or the batch that is
+ * currently being filled if there are no full ones queued
+ **/
 static bool add_results(sl_array_t *array, struct sl_query *slq)
 {
+	struct sl_rslts *results = slq->pending_results;
 	sl_filemeta_t *fm;
 	uint64_t status = 0;
 	int result;
 	bool ok;
 
+	if (results != NULL) {
+		DLIST_REMOVE(slq->pending_results, results);
+		slq->num_pending_results--;
+	} else {
+		results = slq->query_results;
+	}
+
 	/* FileMeta */
 	fm = dalloc_zero(array, sl_filemeta_t);
 	if (fm == NULL) {
@@ -509,12 +447,12 @@ static bool add_results(sl_array_t *array, struct sl_query *slq)
 	if (result != 0) {
 		return false;
 	}
-	result = dalloc_add(array, slq->query_results->cnids, sl_cnids_t);
+	result = dalloc_add(array, results->cnids, sl_cnids_t);
 	if (result != 0) {
 		return false;
 	}
-	if (slq->query_results->num_results > 0) {
-		result = dalloc_add(fm, slq->query_results->fm_array, sl_array_t);
+	if (results->num_results > 0) {
+		result = dalloc_add(fm, results->fm_array, sl_array_t);
 		if (result != 0) {
 			return false;
 		}
@@ -525,6 +463,10 @@ static bool add_results(sl_array_t *array, struct sl_query *slq)
 	}
 
 	/* This ensure the results get clean up after been sent to the client */
+	if (results != slq->query_results) {
+		talloc_steal(array, results);
+		return true;
+	}
 	talloc_move(array, &slq->query_results);
 
 	ok = create_result_handle(slq);
@@ -537,6 +479,29 @@ static bool add_results(sl_array_t *array, struct sl_query *slq)
 	return true;
 }
 
+/**
+ * Queue a full batch of results and start a new one, so that Tracker
+ * can keep on delivering results while the client is fetching
+ **/
+static bool queue_results(struct sl_query *slq)
+{
+	struct sl_rslts *results = slq->query_results;
+	bool ok;
+
+	slq->query_results = NULL;
+	ok = create_result_handle(slq);
+	if (!ok) {
+		DEBUG(1, ("couldn't add result handle\n"));
+		slq->query_results = results;
+		return false;
+	}
+
+	DLIST_ADD_END(slq->pending_results, results);
+	slq->num_pending_results++;
+
+	return true;
+}
+
 static const struct slrpc_cmd *slrpc_cmd_by_name(const char *rpccmd)
 {
 	size_t i;
@@ -593,17 +558,6 @@ static int slq_destructor_cb(struct sl_query *slq)
 		slq->mds_ctx = NULL;
 	}
 
-	if (slq->tracker_cursor != NULL) {
-		g_object_unref(slq->tracker_cursor);
-		slq->tracker_cursor = NULL;
-	}
-
-	if (slq->gcancellable != NULL) {
-		g_cancellable_cancel(slq->gcancellable);
-		g_object_unref(slq->gcancellable);
-		slq->gcancellable = NULL;
-	}
-
 	return 0;
 }
 
@@ -711,104 +665,20 @@ static bool inode_map_add(struct sl_query *slq, uint64_t ino, const char *path)
 	return true;
 }
 
-/************************************************
- * Tracker async callbacks
- ************************************************/
-
-static void tracker_con_cb(GObject *object,
-			   GAsyncResult *res,
-			   gpointer user_data)
-{
-	struct mds_ctx *mds_ctx = talloc_get_type_abort(user_data, struct mds_ctx);
-	GError *error = NULL;
-
-	mds_ctx->tracker_con = tracker_sparql_connection_get_finish(res,
-								    &error);
-	if (error) {
-		DEBUG(1, ("Could not connect to Tracker: %s\n",
-			  error->message));
-		g_error_free(error);
-	}
-
-	DEBUG(10, ("connected to Tracker\n"));
-	g_main_loop_quit(mds_ctx->gmainloop);
-}
-
-static void tracker_cursor_cb_destroy_done(struct tevent_req *subreq);
-
-static void tracker_cursor_cb(GObject *object,
-			      GAsyncResult *res,
-			      gpointer user_data)
+/**
+ * Check a path returned by Tracker or the result cache and add it to
+ * the current batch of results
+ *
+ * Returns false on errors that should abort the query, paths the user
+ * can't access or that are not in the requested set of CNIDs are
+ * silently skipped.
+ **/
+static bool slq_add_result(struct sl_query *slq, const char *path)
 {
-	GError *error = NULL;
-	struct sl_query *slq = talloc_get_type_abort(user_data, struct sl_query);
-	gboolean more_results;
-	const gchar *uri;
-	char *path;
-	int result;
 	struct stat_ex sb;
 	uint64_t ino64;
+	int result;
 	bool ok;
-	struct tevent_req *req;
-
-	SLQ_DEBUG(10, slq, "tracker_cursor_cb");
-
-	more_results = tracker_sparql_cursor_next_finish(slq->tracker_cursor,
-							 res,
-							 &error);
-
-	if (slq->state == SLQ_STATE_DONE) {
-		/*
-		 * The query was closed in slrpc_close_query(), so we
-		 * don't care for results or errors from
-		 * tracker_sparql_cursor_next_finish(), we just go
-		 * ahead and schedule deallocation of the slq handle.
-		 *
-		 * We have to shedule the deallocation via tevent,
-		 * because we have to unref the cursor glib object and
-		 * we can't do it here, because it's still used after
-		 * we return.
-		 */
-		SLQ_DEBUG(10, slq, "closed");
-		g_main_loop_quit(slq->mds_ctx->gmainloop);
-
-		req = slq_destroy_send(slq, global_event_context(), &slq);
-		if (req == NULL) {
-			slq->state = SLQ_STATE_ERROR;
-			return;
-		}
-		tevent_req_set_callback(req, tracker_cursor_cb_destroy_done, NULL);
-		return;
-	}
-
-	if (error) {
-		DEBUG(1, ("Tracker cursor: %s\n", error->message));
-		g_error_free(error);
-		slq->state = SLQ_STATE_ERROR;
-		g_main_loop_quit(slq->mds_ctx->gmainloop);
-		return;
-	}
-
-	if (!more_results) {
-		slq->state = SLQ_STATE_DONE;
-		g_main_loop_quit(slq->mds_ctx->gmainloop);
-		return;
-	}
-
-	uri = tracker_sparql_cursor_get_string(slq->tracker_cursor, 0, NULL);
-	if (uri == NULL) {
-		DEBUG(1, ("error fetching Tracker URI\n"));
-		slq->state = SLQ_STATE_ERROR;
-		g_main_loop_quit(slq->mds_ctx->gmainloop);
-		return;
-	}
-	path = tracker_to_unix_path(slq->query_results, uri);
-	if (path == NULL) {
-		DEBUG(1, ("error converting Tracker URI to path: %s\n", uri));
-		slq->state = SLQ_STATE_ERROR;
-		g_main_loop_quit(slq->mds_ctx->gmainloop);
-		return;
-	}
 
 	if (geteuid() != slq->mds_ctx->uid) {
 		DEBUG(0, ("uid mismatch: %d/%d\n", geteuid(), slq->mds_ctx->uid));
@@ -817,11 +687,11 @@ static void tracker_cursor_cb(GObject *object,
 
 	result = sys_stat(path, &sb, false);
 	if (result != 0) {
-		goto done;
+		return true;
 	}
 	result = access(path, R_OK);
 	if (result != 0) {
-		goto done;
+		return true;
 	}
 
 	ino64 = sb.st_ex_ino;
@@ -834,7 +704,7 @@ static void tracker_cursor_cb(GObject *object,
 		ok = bsearch(&ino64, slq->cnids, slq->cnids_num,
 			     sizeof(uint64_t), cnid_comp_fn);
 		if (!ok) {
-			goto done;
+			return true;
 		}
 	}
 
@@ -846,87 +716,239 @@ static void tracker_cursor_cb(GObject *object,
 				 &ino64, uint64_t);
 	if (result != 0) {
 		DEBUG(1, ("dalloc error\n"));
-		slq->state = SLQ_STATE_ERROR;
-		g_main_loop_quit(slq->mds_ctx->gmainloop);
-		return;
+		return false;
 	}
 	ok = add_filemeta(slq->reqinfo, slq->query_results->fm_array,
 			  path, &sb);
 	if (!ok) {
 		DEBUG(1, ("add_filemeta error\n"));
-		slq->state = SLQ_STATE_ERROR;
-		g_main_loop_quit(slq->mds_ctx->gmainloop);
-		return;
+		return false;
 	}
 
 	ok = inode_map_add(slq, ino64, path);
 	if (!ok) {
 		DEBUG(1, ("inode_map_add error\n"));
-		slq->state = SLQ_STATE_ERROR;
-		g_main_loop_quit(slq->mds_ctx->gmainloop);
-		return;
+		return false;
 	}
 
 	slq->query_results->num_results++;
+	return true;
+}
 
-done:
-	if (slq->query_results->num_results >= MAX_SL_RESULTS) {
-		slq->state = SLQ_STATE_FULL;
-		SLQ_DEBUG(10, slq, "full");
-		g_main_loop_quit(slq->mds_ctx->gmainloop);
-		return;
-	}
+/************************************************
+ * Query result cache
+ ************************************************/
 
-	slq->state = SLQ_STATE_RESULTS;
-	SLQ_DEBUG(10, slq, "cursor next");
-	tracker_sparql_cursor_next_async(slq->tracker_cursor,
-					 slq->gcancellable,
-					 tracker_cursor_cb,
-					 slq);
+static void mds_result_cache_remove(struct mds_ctx *mds_ctx,
+				    struct mds_result_cache *entry)
+{
+	DLIST_REMOVE(mds_ctx->result_cache, entry);
+	mds_ctx->num_result_cache--;
+
+	/*
+	 * Queries replaying the entry hold a reference
+	 */
+	talloc_unlink(mds_ctx, entry);
 }
 
-static void tracker_cursor_cb_destroy_done(struct tevent_req *req)
+static struct mds_result_cache *mds_result_cache_lookup(
+	struct mds_ctx *mds_ctx, const struct sl_query *slq)
 {
-	slq_destroy_recv(req);
-	TALLOC_FREE(req);
+	struct mds_result_cache *entry = NULL;
+	struct mds_result_cache *next = NULL;
+	struct timeval now = timeval_current();
 
-	DEBUG(10, ("%s\n", __func__));
+	for (entry = mds_ctx->result_cache; entry != NULL; entry = next) {
+		next = entry->next;
+
+		if (timeval_compare(&entry->expire_time, &now) <= 0) {
+			mds_result_cache_remove(mds_ctx, entry);
+			continue;
+		}
+		if (strcmp(entry->query_string, slq->query_string) == 0 &&
+		    strcmp(entry->path_scope, slq->path_scope) == 0)
+		{
+			DLIST_PROMOTE(mds_ctx->result_cache, entry);
+			return entry;
+		}
+	}
+
+	return NULL;
 }
 
-static void tracker_query_cb(GObject *object,
-			     GAsyncResult *res,
-			     gpointer user_data)
+/**
+ * Remember a path the backend returned for the result cache. The paths
+ * are collected before access checks so the cache can be shared by all
+ * queries on the share handle.
+ **/
+static void slq_cache_path(struct sl_query *slq, const char *path)
 {
-	GError *error = NULL;
-	struct sl_query *slq = talloc_get_type_abort(user_data, struct sl_query);
+	size_t alloc;
+	char **paths = NULL;
 
-	SLQ_DEBUG(10, slq, "tracker_query_cb");
+	if (slq->cache_overflow) {
+		return;
+	}
+	if (slq->num_cache_paths >= MAX_SL_CACHED_PATHS) {
+		TALLOC_FREE(slq->cache_paths);
+		slq->num_cache_paths = 0;
+		slq->cache_overflow = true;
+		return;
+	}
 
-	slq->tracker_cursor = tracker_sparql_connection_query_finish(
-		TRACKER_SPARQL_CONNECTION(object),
-		res,
-		&error);
-	if (error) {
-		slq->state = SLQ_STATE_ERROR;
-		DEBUG(1, ("Tracker query error: %s\n", error->message));
-		g_error_free(error);
-		g_main_loop_quit(slq->mds_ctx->gmainloop);
+	alloc = talloc_array_length(slq->cache_paths);
+	if (slq->num_cache_paths == alloc) {
+		alloc = MAX(alloc * 2, MAX_SL_RESULTS);
+		paths = talloc_realloc(slq, slq->cache_paths, char *, alloc);
+		if (paths == NULL) {
+			goto nomem;
+		}
+		slq->cache_paths = paths;
+	}
+
+	slq->cache_paths[slq->num_cache_paths] =
+		talloc_strdup(slq->cache_paths, path);
+	if (slq->cache_paths[slq->num_cache_paths] == NULL) {
+		goto nomem;
+	}
+	slq->num_cache_paths++;
+	return;
+
+nomem:
+	DEBUG(1, ("out of memory, not caching results\n"));
+	TALLOC_FREE(slq->cache_paths);
+	slq->num_cache_paths = 0;
+	slq->cache_overflow = true;
+}
+
+/**
+ * The backend delivered all results of a query, cache them
+ **/
+static void slq_cache_store(struct sl_query *slq)
+{
+	struct mds_ctx *mds_ctx = slq->mds_ctx;
+	struct mds_result_cache *entry = NULL;
+
+	if (slq->cache_overflow || slq->cache_entry != NULL) {
 		return;
 	}
 
-	if (slq->state == SLQ_STATE_DONE) {
-		SLQ_DEBUG(10, slq, "done");
-		g_main_loop_quit(slq->mds_ctx->gmainloop);
-		talloc_free(slq);
+	entry = mds_result_cache_lookup(mds_ctx, slq);
+	if (entry != NULL) {
+		mds_result_cache_remove(mds_ctx, entry);
+	}
+
+	entry = talloc_zero(mds_ctx, struct mds_result_cache);
+	if (entry == NULL) {
+		return;
+	}
+	entry->query_string = talloc_strdup(entry, slq->query_string);
+	if (entry->query_string == NULL) {
+		TALLOC_FREE(entry);
+		return;
+	}
+	entry->path_scope = talloc_strdup(entry, slq->path_scope);
+	if (entry->path_scope == NULL) {
+		TALLOC_FREE(entry);
 		return;
 	}
+	entry->paths = talloc_move(entry, &slq->cache_paths);
+	entry->num_paths = slq->num_cache_paths;
+	entry->expire_time = timeval_current_ofs(MDS_RESULT_CACHE_TIME, 0);
+	slq->num_cache_paths = 0;
+
+	DLIST_ADD(mds_ctx->result_cache, entry);
+	mds_ctx->num_result_cache++;
 
-	slq->state = SLQ_STATE_RESULTS;
+	while (mds_ctx->num_result_cache > MAX_SL_CACHED_QUERIES) {
+		mds_result_cache_remove(mds_ctx,
+					DLIST_TAIL(mds_ctx->result_cache));
+	}
+
+	SLQ_DEBUG(10, slq, "cached");
+}
 
-	tracker_sparql_cursor_next_async(slq->tracker_cursor,
-					 slq->gcancellable,
-					 tracker_cursor_cb,
-					 slq);
+/**
+ * Fill the current batch from the result cache, in place of the backend.
+ * Don't check more than a few batches worth of paths per request, in
+ * case most are not accessible.
+ **/
+static bool slq_replay_cache(struct sl_query *slq)
+{
+	struct mds_result_cache *entry = slq->cache_entry;
+	size_t max_paths = MAX_SL_RESULTS * MAX_SL_PENDING_RESULTS;
+	size_t checked;
+	bool ok;
+
+	for (checked = 0;
+	     checked < max_paths &&
+		     slq->cache_next < entry->num_paths &&
+		     slq->query_results->num_results < MAX_SL_RESULTS;
+	     checked++)
+	{
+		ok = slq_add_result(slq, entry->paths[slq->cache_next]);
+		if (!ok) {
+			slq->state = SLQ_STATE_ERROR;
+			return false;
+		}
+		slq->cache_next++;
+	}
+
+	if (slq->cache_next == entry->num_paths) {
+		slq->state = SLQ_STATE_DONE;
+	}
+	return true;
+}
+
+/************************************************
+ * Functions used by the search backends
+ ************************************************/
+
+/**
+ * Add a path found by the backend to the results of a query
+ *
+ * When the client falls too far behind fetching results the
+ * query state is set to SLQ_STATE_FULL, the backend must then stop
+ * delivering results until backend->search_cont() is called.
+ **/
+bool mds_add_result(struct sl_query *slq, const char *path)
+{
+	bool ok;
+
+	slq_cache_path(slq, path);
+
+	ok = slq_add_result(slq, path);
+	if (!ok) {
+		return false;
+	}
+
+	if (slq->query_results->num_results < MAX_SL_RESULTS) {
+		return true;
+	}
+
+	/*
+	 * Queue the batch and keep going, the client fetches one batch
+	 * per request. Only pause the backend when the client falls
+	 * too far behind.
+	 */
+	ok = queue_results(slq);
+	if (!ok) {
+		return false;
+	}
+	if (slq->num_pending_results >= MAX_SL_PENDING_RESULTS) {
+		slq->state = SLQ_STATE_FULL;
+	}
+
+	return true;
+}
+
+/**
+ * The backend delivered all results of a query
+ **/
+void mds_query_done(struct sl_query *slq)
+{
+	slq->state = SLQ_STATE_DONE;
+	slq_cache_store(slq);
 }
 
 /***********************************************************
@@ -1134,6 +1156,7 @@ static bool slrpc_open_query(struct mds_ctx *mds_ctx,
 	sl_array_t *array, *path_scope;
 	sl_cnids_t *cnids;
 	struct sl_query *slq = NULL;
+	struct mds_result_cache *cache_entry = NULL;
 	int result;
 	char *querystring;
 	char *scope = NULL;
@@ -1144,11 +1167,6 @@ static bool slrpc_open_query(struct mds_ctx *mds_ctx,
 		return false;
 	}
 
-	if (mds_ctx->tracker_con == NULL) {
-		DEBUG(1, ("no connection to Tracker\n"));
-		goto error;
-	}
-
 	/* Allocate and initialize query object */
 	slq = talloc_zero(mds_ctx, struct sl_query);
 	if (slq == NULL) {
@@ -1173,12 +1191,6 @@ static bool slrpc_open_query(struct mds_ctx *mds_ctx,
 		goto error;
 	}
 
-	slq->gcancellable = g_cancellable_new();
-	if (slq->gcancellable == NULL) {
-		DEBUG(1,("error from g_cancellable_new\n"));
-		goto error;
-	}
-
 	querystring = dalloc_value_for_key(query, "DALLOC_CTX", 0,
 					   "DALLOC_CTX", 1,
 					   "kMDQueryString");
@@ -1264,7 +1276,7 @@ static bool slrpc_open_query(struct mds_ctx *mds_ctx,
 
 	DLIST_ADD(mds_ctx->query_list, slq);
 
-	ok = map_spotlight_to_sparql_query(slq);
+	ok = mds_ctx->backend->search_map(slq);
 	if (!ok) {
 		/*
 		 * Two cases:
@@ -1281,16 +1293,25 @@ static bool slrpc_open_query(struct mds_ctx *mds_ctx,
 		goto error;
 	}
 
-	DEBUG(10, ("SPARQL query: \"%s\"\n", slq->sparql_query));
-
-	g_main_context_push_thread_default(mds_ctx->gcontext);
-	tracker_sparql_connection_query_async(mds_ctx->tracker_con,
-					      slq->sparql_query,
-					      slq->gcancellable,
-					      tracker_query_cb,
-					      slq);
-	g_main_context_pop_thread_default(mds_ctx->gcontext);
-	slq->state = SLQ_STATE_RUNNING;
+	cache_entry = mds_result_cache_lookup(mds_ctx, slq);
+	if (cache_entry != NULL) {
+		/*
+		 * Same search on this share recently, results are
+		 * replayed in slrpc_fetch_query_results()
+		 */
+		slq->cache_entry = talloc_reference(slq, cache_entry);
+		if (slq->cache_entry == NULL) {
+			goto error;
+		}
+		slq->state = SLQ_STATE_RESULTS;
+		SLQ_DEBUG(10, slq, "from cache");
+	} else {
+		ok = mds_ctx->backend->search_start(slq);
+		if (!ok) {
+			SLQ_DEBUG(10, slq, "search failed");
+			goto error;
+		}
+	}
 
 	sl_result = 0;
 	result = dalloc_add_copy(array, &sl_result, uint64_t);
@@ -1375,20 +1396,28 @@ static bool slrpc_fetch_query_results(struct mds_ctx *mds_ctx,
 	case SLQ_STATE_RESULTS:
 	case SLQ_STATE_FULL:
 	case SLQ_STATE_DONE:
+		if (slq->cache_entry != NULL &&
+		    slq->state == SLQ_STATE_RESULTS)
+		{
+			ok = slq_replay_cache(slq);
+			if (!ok) {
+				DEBUG(1, ("error replaying cached results\n"));
+				goto error;
+			}
+		}
 		ok = add_results(array, slq);
 		if (!ok) {
 			DEBUG(1, ("error adding results\n"));
 			goto error;
 		}
-		if (slq->state == SLQ_STATE_FULL) {
-			slq->state = SLQ_STATE_RESULTS;
-			g_main_context_push_thread_default(mds_ctx->gcontext);
-			tracker_sparql_cursor_next_async(
-				slq->tracker_cursor,
-				slq->gcancellable,
-				tracker_cursor_cb,
-				slq);
-			g_main_context_pop_thread_default(mds_ctx->gcontext);
+		if (slq->state == SLQ_STATE_FULL &&
+		    slq->num_pending_results < MAX_SL_PENDING_RESULTS)
+		{
+			ok = mds_ctx->backend->search_cont(slq);
+			if (!ok) {
+				DEBUG(1, ("error continuing search\n"));
+				goto error;
+			}
 		}
 		break;
 
@@ -1749,6 +1778,15 @@ static bool slrpc_close_query(struct mds_ctx *mds_ctx,
 		goto done;
 	}
 
+	if (slq->cache_entry != NULL) {
+		/*
+		 * Replaying from the cache, no backend calls in flight
+		 */
+		DEBUG(10, ("close: cached query\n"));
+		TALLOC_FREE(slq);
+		goto done;
+	}
+
 	switch (slq->state) {
 	case SLQ_STATE_RUNNING:
 	case SLQ_STATE_RESULTS:
@@ -1767,7 +1805,7 @@ static bool slrpc_close_query(struct mds_ctx *mds_ctx,
 		DEBUG(10, ("close: query was done or result queue was full\n"));
 		/*
 		 * We can directly deallocate the query because there
-		 * are no pending Tracker async calls in flight in
+		 * are no pending backend async calls in flight in
 		 * these query states.
 		 */
 		TALLOC_FREE(slq);
@@ -1808,14 +1846,25 @@ bool mds_shutdown(void)
 	return true;
 }
 
-static gboolean gmainloop_timer(gpointer user_data)
+static const struct {
+	const char *name;
+	const struct mdssvc_backend *backend;
+} mdssvc_backends[] = {
+	{ "tracker", &mdssvc_backend_tracker },
+	{ "noindex", &mdssvc_backend_noindex },
+};
+
+static const struct mdssvc_backend *mds_backend_by_name(const char *name)
 {
-	struct mds_ctx *ctx = talloc_get_type_abort(user_data, struct mds_ctx);
+	size_t i;
 
-	DEBUG(10,("%s\n", __func__));
-	g_main_loop_quit(ctx->gmainloop);
+	for (i = 0; i < ARRAY_SIZE(mdssvc_backends); i++) {
+		if (strequal(mdssvc_backends[i].name, name)) {
+			return mdssvc_backends[i].backend;
+		}
+	}
 
-	return G_SOURCE_CONTINUE;
+	return NULL;
 }
 
 /**
@@ -1823,9 +1872,12 @@ static gboolean gmainloop_timer(gpointer user_data)
  **/
 struct mds_ctx *mds_init_ctx(TALLOC_CTX *mem_ctx,
 			     const struct auth_session_info *session_info,
+			     int snum,
 			     const char *path)
 {
 	struct mds_ctx *mds_ctx;
+	const char *backend = NULL;
+	bool ok;
 
 	mds_ctx = talloc_zero(mem_ctx, struct mds_ctx);
 	if (mds_ctx == NULL) {
@@ -1850,23 +1902,19 @@ struct mds_ctx *mds_init_ctx(TALLOC_CTX *mem_ctx,
 		goto error;
 	}
 
-	mds_ctx->gcontext = g_main_context_new();
-	if (mds_ctx->gcontext == NULL) {
-		DEBUG(1,("error from g_main_context_new\n"));
+	backend = lp_parm_const_string(snum, "spotlight", "backend", "tracker");
+	mds_ctx->backend = mds_backend_by_name(backend);
+	if (mds_ctx->backend == NULL) {
+		DEBUG(1, ("unknown Spotlight backend: %s\n", backend));
 		goto error;
 	}
 
-	mds_ctx->gmainloop = g_main_loop_new(mds_ctx->gcontext, false);
-	if (mds_ctx->gmainloop == NULL) {
-		DEBUG(1,("error from g_main_loop_new\n"));
+	ok = mds_ctx->backend->connect(mds_ctx);
+	if (!ok) {
+		DEBUG(1, ("backend %s connect failed\n", backend));
 		goto error;
 	}
 
-	g_main_context_push_thread_default(mds_ctx->gcontext);
-	tracker_sparql_connection_get_async(mds_ctx->gcancellable,
-					    tracker_con_cb, mds_ctx);
-	g_main_context_pop_thread_default(mds_ctx->gcontext);
-
 	return mds_ctx;
 
 error:
@@ -1890,84 +1938,13 @@ int mds_ctx_destructor_cb(struct mds_ctx *mds_ctx)
 		talloc_free(mds_ctx->query_list);
 	}
 	TALLOC_FREE(mds_ctx->ino_path_map);
-
-	if (mds_ctx->tracker_con != NULL) {
-		g_object_unref(mds_ctx->tracker_con);
-	}
-	if (mds_ctx->gcancellable != NULL) {
-		g_cancellable_cancel(mds_ctx->gcancellable);
-		g_object_unref(mds_ctx->gcancellable);
-	}
-	if (mds_ctx->gmainloop != NULL) {
-		g_main_loop_unref(mds_ctx->gmainloop);
-	}
-	if (mds_ctx->gcontext != NULL) {
-		g_main_context_unref(mds_ctx->gcontext);
-	}
+	TALLOC_FREE(mds_ctx->backend_private);
 
 	ZERO_STRUCTP(mds_ctx);
 
 	return 0;
 }
 
-static bool mds_run_gmainloop(struct mds_ctx *mds_ctx, guint timeout)
-{
-	guint timer_id;
-	GSource *timer;
-
-	/*
-	 * It seems the event processing of the libtracker-sparql
-	 * async subsystem defers callbacks until *all* events are
-	 * processes by the async subsystem main processing loop.
-	 *
-	 * g_main_context_iteration(may_block=FALSE) can't be used,
-	 * because a search that produces a few thousand matches
-	 * generates as many events that must be processed in either
-	 * g_main_context_iteration() or g_main_loop_run() before
-	 * callbacks are called.
-	 *
-	 * Unfortunately g_main_context_iteration() only processes a
-	 * small subset of these event (1-30) at a time when run in
-	 * mds_dispatch(), which happens once a second while the
-	 * client polls for results.
-	 *
-	 * Carefully using the blocking g_main_loop_run() fixes
-	 * this. It processes events until we exit from the loop at
-	 * defined exit points. By adding a 1 ms timeout we at least
-	 * try to get as close as possible to non-blocking behaviour.
-	 */
-
-	if (!g_main_context_pending(mds_ctx->gcontext)) {
-		return true;
-	}
-
-	g_main_context_push_thread_default(mds_ctx->gcontext);
-
-	timer = g_timeout_source_new(timeout);
-	if (timer == NULL) {
-		DEBUG(1,("g_timeout_source_new_seconds\n"));
-		g_main_context_pop_thread_default(mds_ctx->gcontext);
-		return false;
-	}
-
-	timer_id = g_source_attach(timer, mds_ctx->gcontext);
-	if (timer_id == 0) {
-		DEBUG(1,("g_timeout_add failed\n"));
-		g_source_destroy(timer);
-		g_main_context_pop_thread_default(mds_ctx->gcontext);
-		return false;
-	}
-
-	g_source_set_callback(timer, gmainloop_timer, mds_ctx, NULL);
-
-	g_main_loop_run(mds_ctx->gmainloop);
-
-	g_source_destroy(timer);
-
-	g_main_context_pop_thread_default(mds_ctx->gcontext);
-	return true;
-}
-
 /**
  * Dispatch a Spotlight RPC command
  **/
@@ -1993,7 +1970,7 @@ bool mds_dispatch(struct mds_ctx *mds_ctx,
 	response_blob->length = 0;
 
 	/*
-	 * Process finished glib events.
+	 * Process finished backend events.
 	 *
 	 * FIXME: integrate with tevent instead of piggy packing it
 	 * onto the processing of new requests.
@@ -2004,18 +1981,19 @@ bool mds_dispatch(struct mds_ctx *mds_ctx,
 	 *
 	 * - later in order to fetch results asynchronously, typically
 	 *   once a second. If no results have been retrieved from the
-	 *   search store (Tracker) yet, we return no results.
+	 *   search backend yet, we return no results.
 	 *   The client asks for more results every second as long
 	 *   as the "Search Window" in the client gui is open.
 	 *
 	 * - at some point the query is closed
 	 *
-	 * This means we try to iterate through the glib event loop
-	 * before processing the request in order to get result
-	 * from tracker which can be returned to the client.
+	 * This means we try to let the backend process its events
+	 * before processing the request in order to get results
+	 * which can be returned to the client.
 	 */
 
-	ok = mds_run_gmainloop(mds_ctx, MDS_TRACKER_ASYNC_TIMEOUT_MS);
+	ok = mds_ctx->backend->process_events(mds_ctx,
+					      MDS_BACKEND_ASYNC_TIMEOUT_MS);
 	if (!ok) {
 		goto cleanup;
 	}
@@ -2081,12 +2059,14 @@ bool mds_dispatch(struct mds_ctx *mds_ctx,
 	}
 
 	/*
-	 * Run g_main_loop a second time in order to dispatch events
-	 * that may have been queued at the libtracker-sparql level.
-	 * As we only want to dispatch (write out requests) but not
-	 * wait for anything, we use a much shorter timeout here.
+	 * Process backend events a second time in order to dispatch
+	 * events that may have been queued by the requests, eg at the
+	 * libtracker-sparql level. As we only want to dispatch (write
+	 * out requests) but not wait for anything, we use a much
+	 * shorter timeout here.
 	 */
-	ok = mds_run_gmainloop(mds_ctx, MDS_TRACKER_ASYNC_TIMEOUT_MS / 10);
+	ok = mds_ctx->backend->process_events(mds_ctx,
+					      MDS_BACKEND_ASYNC_TIMEOUT_MS / 10);
 	if (!ok) {
 		goto cleanup;
 	}
@@ -24,6 +24,7 @@
 #include "dalloc.h"
 #include "marshalling.h"
 #include "lib/util/dlinklist.h"
+#include "lib/util/time_basic.h"
 #include "librpc/gen_ndr/mdssvc.h"
 
 /*
@@ -37,13 +38,16 @@
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wcast-qual"
 #include <gio/gio.h>
-#include <tracker-sparql.h>
 #pragma GCC diagnostic pop
 
 #define MAX_SL_FRAGMENT_SIZE 0xFFFFF
 #define MAX_SL_RESULTS 100
+#define MAX_SL_PENDING_RESULTS 10 /* full batches queued per query */
+#define MAX_SL_CACHED_QUERIES 16
+#define MAX_SL_CACHED_PATHS 100000
+#define MDS_RESULT_CACHE_TIME 60
 #define MAX_SL_RUNTIME 30
-#define MDS_TRACKER_ASYNC_TIMEOUT_MS 250
+#define MDS_BACKEND_ASYNC_TIMEOUT_MS 250
 
 /******************************************************************************
  * Some helper stuff dealing with queries
@@ -52,10 +56,10 @@
 /* query state */
 typedef enum {
 	SLQ_STATE_NEW,       /* Query received from client         */
-	SLQ_STATE_RUNNING,   /* Query dispatched to Tracker        */
-	SLQ_STATE_RESULTS,   /* Async Tracker query read           */
-	SLQ_STATE_FULL,	     /* the max amount of result has beed queued */
-	SLQ_STATE_DONE,      /* Got all results from Tracker       */
+	SLQ_STATE_RUNNING,   /* Query dispatched to the backend    */
+	SLQ_STATE_RESULTS,   /* Async backend query read           */
+	SLQ_STATE_FULL,	     /* the max amount of result batches have been queued */
+	SLQ_STATE_DONE,      /* Got all results from the backend   */
 	SLQ_STATE_END,       /* Query results returned to client   */
 	SLQ_STATE_ERROR	     /* an error happended somewhere       */
 } slq_state_t;
@@ -74,17 +78,24 @@ struct sl_query {
 	uint64_t         ctx2;           /* client context 2 */
 	sl_array_t      *reqinfo;        /* array with requested metadata */
 	const char      *query_string;   /* the Spotlight query string */
-	const char      *sparql_query;   /* the SPARQL query string */
+	const char      *sparql_query;   /* the SPARQL query string (Tracker) */
 	uint64_t        *cnids;          /* restrict query to these CNIDs */
 	size_t           cnids_num;      /* Size of slq_cnids array */
 	const char      *path_scope;	 /* path to directory to search */
-	GCancellable    *gcancellable;
-	TrackerSparqlCursor *tracker_cursor; /* Tracker SPARQL query result cursor */
+	void            *backend_private; /* backend specific query state */
 	struct sl_rslts *query_results;  /* query results */
+	struct sl_rslts *pending_results; /* full batches not fetched yet */
+	size_t           num_pending_results;
 	TALLOC_CTX      *entries_ctx;    /* talloc parent of the search results */
+	struct mds_result_cache *cache_entry; /* replaying cached results */
+	size_t           cache_next;     /* next cached path to replay */
+	char           **cache_paths;    /* backend results for the cache */
+	size_t           num_cache_paths;
+	bool             cache_overflow; /* too many results to cache */
 };
 
 struct sl_rslts {
+	struct sl_rslts   *prev, *next;
 	int                num_results;
 	sl_cnids_t        *cnids;
 	sl_array_t        *fm_array;
@@ -96,18 +107,70 @@ struct sl_inode_path_map {
 	char              *path;
 };
 
+/*
+ * Paths the backend returned for a finished query, so that repeated
+ * searches on the share don't have to go through the backend again.
+ * Access checks and metadata are still done per result when replaying.
+ */
+struct mds_result_cache {
+	struct mds_result_cache *prev, *next;
+	const char        *query_string;
+	const char        *path_scope;
+	struct timeval     expire_time;
+	char             **paths;
+	size_t             num_paths;
+};
+
 struct mds_ctx {
 	struct dom_sid sid;
 	uid_t uid;
 	const char *spath;
-	GCancellable *gcancellable;
-	TrackerSparqlConnection *tracker_con;
-	GMainContext *gcontext;
-	GMainLoop *gmainloop;
+	const struct mdssvc_backend *backend;
+	void *backend_private;           /* backend specific share state */
 	struct sl_query *query_list;     /* list of active queries */
 	struct db_context *ino_path_map; /* dbwrap rbt for storing inode->path mappings */
+	struct mds_result_cache *result_cache; /* most recently used first */
+	size_t num_result_cache;
 };
 
+/*
+ * A search backend
+ *
+ * search_start() starts the search for a query that was translated with
+ * search_map(). Results are added with mds_add_result() and the end of
+ * the search is signalled with mds_query_done(). The backend must stop
+ * adding results when mds_add_result() sets the query state to
+ * SLQ_STATE_FULL, search_cont() is called once the client fetched
+ * results.
+ */
+struct mdssvc_backend {
+	bool (*connect)(struct mds_ctx *mds_ctx);
+	bool (*search_map)(struct sl_query *slq);
+	bool (*search_start)(struct sl_query *slq);
+	bool (*search_cont)(struct sl_query *slq);
+	bool (*process_events)(struct mds_ctx *mds_ctx, unsigned int timeout_ms);
+};
+
+#define SLQ_DEBUG(lvl, _slq, state) do { if (CHECK_DEBUGLVL(lvl)) {	\
+	const struct sl_query *__slq = _slq;				\
+	struct timeval_buf start_buf;					\
+	const char *start;						\
+	struct timeval_buf last_used_buf;				\
+	const char *last_used;						\
+	struct timeval_buf expire_buf;					\
+	const char *expire;						\
+	start = timeval_str_buf(&__slq->start_time, false,		\
+				true, &start_buf);			\
+	last_used = timeval_str_buf(&__slq->last_used, false,		\
+				    true, &last_used_buf);		\
+	expire = timeval_str_buf(&__slq->expire_time, false,		\
+				 true, &expire_buf);			\
+	DEBUG(lvl,("%s slq[0x%jx,0x%jx], start: %s, last_used: %s, "	\
+		   "expires: %s, query: '%s'\n", state,			\
+		   (uintmax_t)__slq->ctx1, (uintmax_t)__slq->ctx2,	\
+		   start, last_used, expire, __slq->query_string));	\
+}} while(0)
+
 /******************************************************************************
  * Function declarations
  ******************************************************************************/
@@ -119,11 +182,14 @@ extern bool mds_init(struct messaging_context *msg_ctx);
 extern bool mds_shutdown(void);
 extern struct mds_ctx *mds_init_ctx(TALLOC_CTX *mem_ctx,
 				    const struct auth_session_info *session_info,
+				    int snum,
 				    const char *path);
 extern int mds_ctx_destructor_cb(struct mds_ctx *mds_ctx);
 extern bool mds_dispatch(struct mds_ctx *query_ctx,
 			 struct mdssvc_blob *request_blob,
 			 struct mdssvc_blob *response_blob);
 extern char *mds_dalloc_dump(DALLOC_CTX *dd, int nestinglevel);
+extern bool mds_add_result(struct sl_query *slq, const char *path);
+extern void mds_query_done(struct sl_query *slq);
 
 #endif /* _MDSSVC_H */
@@ -0,0 +1,70 @@
+/*
+   Unix SMB/CIFS implementation.
+   Main metadata server / Spotlight routines / noindex backend
+
+   Copyright (C) Samba Team 2026
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "includes.h"
+#include "libcli/security/dom_sid.h"
+#include "mdssvc.h"
+#include "mdssvc_noindex.h"
+
+#undef DBGC_CLASS
+#define DBGC_CLASS DBGC_RPC_SRV
+
+/*
+ * A backend without a search index: every query succeeds and
+ * immediately finishes without results. This lets clients browse
+ * Spotlight enabled shares without a running indexer and without
+ * paying for failed Tracker connection attempts.
+ */
+
+static bool mds_noindex_connect(struct mds_ctx *mds_ctx)
+{
+	return true;
+}
+
+static bool mds_noindex_search_map(struct sl_query *slq)
+{
+	return true;
+}
+
+static bool mds_noindex_search_start(struct sl_query *slq)
+{
+	mds_query_done(slq);
+	return true;
+}
+
+static bool mds_noindex_search_cont(struct sl_query *slq)
+{
+	mds_query_done(slq);
+	return true;
+}
+
+static bool mds_noindex_process_events(struct mds_ctx *mds_ctx,
+				       unsigned int timeout_ms)
+{
+	return true;
+}
+
+struct mdssvc_backend mdssvc_backend_noindex = {
+	.connect = mds_noindex_connect,
+	.search_map = mds_noindex_search_map,
+	.search_start = mds_noindex_search_start,
+	.search_cont = mds_noindex_search_cont,
+	.process_events = mds_noindex_process_events,
+};
@@ -0,0 +1,481 @@
+/*
+   Unix SMB/CIFS implementation.
+   Main metadata server / Spotlight routines / Tracker backend
+
+   Copyright (C) Ralph Boehme 2012-2014
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "includes.h"
+#include "libcli/security/dom_sid.h"
+#include "mdssvc.h"
+#include "mdssvc_tracker.h"
+#include "rpc_server/mdssvc/sparql_parser.tab.h"
+
+#undef DBGC_CLASS
+#define DBGC_CLASS DBGC_RPC_SRV
+
+struct slq_destroy_state {
+	struct tevent_context *ev;
+	struct sl_query *slq;
+};
+
+static struct tevent_req *slq_destroy_send(TALLOC_CTX *mem_ctx,
+					   struct tevent_context *ev,
+					   struct sl_query **slq)
+{
+	struct tevent_req *req;
+	struct slq_destroy_state *state;
+
+	req = tevent_req_create(mem_ctx, &state,
+				struct slq_destroy_state);
+	if (req == NULL) {
+		return NULL;
+	}
+	state->slq = talloc_move(state, slq);
+	tevent_req_done(req);
+
+	return tevent_req_post(req, ev);
+}
+
+static void slq_destroy_recv(struct tevent_req *req)
+{
+	tevent_req_received(req);
+}
+
+static struct mds_tracker_ctx *slq_tracker_ctx(struct sl_query *slq)
+{
+	return talloc_get_type_abort(slq->mds_ctx->backend_private,
+				     struct mds_tracker_ctx);
+}
+
+static struct sl_tracker_query *slq_tracker_query(struct sl_query *slq)
+{
+	return talloc_get_type_abort(slq->backend_private,
+				     struct sl_tracker_query);
+}
+
+static char *tracker_to_unix_path(TALLOC_CTX *mem_ctx, const char *uri)
+{
+	GFile *f;
+	char *path;
+	char *talloc_path;
+
+	f = g_file_new_for_uri(uri);
+	if (f == NULL) {
+		return NULL;
+	}
+
+	path = g_file_get_path(f);
+	g_object_unref(f);
+
+	if (path == NULL) {
+		return NULL;
+	}
+
+	talloc_path = talloc_strdup(mem_ctx, path);
+	g_free(path);
+	if (talloc_path == NULL) {
+		return NULL;
+	}
+
+	return talloc_path;
+}
+
+/************************************************
+ * Tracker async callbacks
+ ************************************************/
+
+static void tracker_con_cb(GObject *object,
+			   GAsyncResult *res,
+			   gpointer user_data)
+{
+	struct mds_tracker_ctx *ctx = talloc_get_type_abort(
+		user_data, struct mds_tracker_ctx);
+	GError *error = NULL;
+
+	ctx->tracker_con = tracker_sparql_connection_get_finish(res,
+								&error);
+	if (error) {
+		DEBUG(1, ("Could not connect to Tracker: %s\n",
+			  error->message));
+		g_error_free(error);
+	}
+
+	DEBUG(10, ("connected to Tracker\n"));
+	g_main_loop_quit(ctx->gmainloop);
+}
+
+static void tracker_cursor_cb_destroy_done(struct tevent_req *subreq);
+
+static void tracker_cursor_cb(GObject *object,
+			      GAsyncResult *res,
+			      gpointer user_data)
+{
+	GError *error = NULL;
+	struct sl_query *slq = talloc_get_type_abort(user_data, struct sl_query);
+	struct sl_tracker_query *tq = slq_tracker_query(slq);
+	struct mds_tracker_ctx *ctx = slq_tracker_ctx(slq);
+	gboolean more_results;
+	const gchar *uri;
+	char *path;
+	bool ok;
+	struct tevent_req *req;
+
+	SLQ_DEBUG(10, slq, "tracker_cursor_cb");
+
+	more_results = tracker_sparql_cursor_next_finish(tq->tracker_cursor,
+							 res,
+							 &error);
+
+	if (slq->state == SLQ_STATE_DONE) {
+		/*
+		 * The query was closed in slrpc_close_query(), so we
+		 * don't care for results or errors from
+		 * tracker_sparql_cursor_next_finish(), we just go
+		 * ahead and schedule deallocation of the slq handle.
+		 *
+		 * We have to shedule the deallocation via tevent,
+		 * because we have to unref the cursor glib object and
+		 * we can't do it here, because it's still used after
+		 * we return.
+		 */
+		SLQ_DEBUG(10, slq, "closed");
+		g_main_loop_quit(ctx->gmainloop);
+
+		req = slq_destroy_send(slq, global_event_context(), &slq);
+		if (req == NULL) {
+			slq->state = SLQ_STATE_ERROR;
+			return;
+		}
+		tevent_req_set_callback(req, tracker_cursor_cb_destroy_done, NULL);
+		return;
+	}
+
+	if (error) {
+		DEBUG(1, ("Tracker cursor: %s\n", error->message));
+		g_error_free(error);
+		slq->state = SLQ_STATE_ERROR;
+		g_main_loop_quit(ctx->gmainloop);
+		return;
+	}
+
+	if (!more_results) {
+		mds_query_done(slq);
+		g_main_loop_quit(ctx->gmainloop);
+		return;
+	}
+
+	uri = tracker_sparql_cursor_get_string(tq->tracker_cursor, 0, NULL);
+	if (uri == NULL) {
+		DEBUG(1, ("error fetching Tracker URI\n"));
+		slq->state = SLQ_STATE_ERROR;
+		g_main_loop_quit(ctx->gmainloop);
+		return;
+	}
+	path = tracker_to_unix_path(slq->query_results, uri);
+	if (path == NULL) {
+		DEBUG(1, ("error converting Tracker URI to path: %s\n", uri));
+		slq->state = SLQ_STATE_ERROR;
+		g_main_loop_quit(ctx->gmainloop);
+		return;
+	}
+
+	ok = mds_add_result(slq, path);
+	if (!ok) {
+		slq->state = SLQ_STATE_ERROR;
+		g_main_loop_quit(ctx->gmainloop);
+		return;
+	}
+
+	if (slq->state == SLQ_STATE_FULL) {
+		SLQ_DEBUG(10, slq, "full");
+		g_main_loop_quit(ctx->gmainloop);
+		return;
+	}
+
+	slq->state = SLQ_STATE_RESULTS;
+	SLQ_DEBUG(10, slq, "cursor next");
+	tracker_sparql_cursor_next_async(tq->tracker_cursor,
+					 tq->gcancellable,
+					 tracker_cursor_cb,
+					 slq);
+}
+
+static void tracker_cursor_cb_destroy_done(struct tevent_req *req)
+{
+	slq_destroy_recv(req);
+	TALLOC_FREE(req);
+
+	DEBUG(10, ("%s\n", __func__));
+}
+
+static void tracker_query_cb(GObject *object,
+			     GAsyncResult *res,
+			     gpointer user_data)
+{
+	GError *error = NULL;
+	struct sl_query *slq = talloc_get_type_abort(user_data, struct sl_query);
+	struct sl_tracker_query *tq = slq_tracker_query(slq);
+	struct mds_tracker_ctx *ctx = slq_tracker_ctx(slq);
+
+	SLQ_DEBUG(10, slq, "tracker_query_cb");
+
+	tq->tracker_cursor = tracker_sparql_connection_query_finish(
+		TRACKER_SPARQL_CONNECTION(object),
+		res,
+		&error);
+	if (error) {
+		slq->state = SLQ_STATE_ERROR;
+		DEBUG(1, ("Tracker query error: %s\n", error->message));
+		g_error_free(error);
+		g_main_loop_quit(ctx->gmainloop);
+		return;
+	}
+
+	if (slq->state == SLQ_STATE_DONE) {
+		SLQ_DEBUG(10, slq, "done");
+		g_main_loop_quit(ctx->gmainloop);
+		talloc_free(slq);
+		return;
+	}
+
+	slq->state = SLQ_STATE_RESULTS;
+
+	tracker_sparql_cursor_next_async(tq->tracker_cursor,
+					 tq->gcancellable,
+					 tracker_cursor_cb,
+					 slq);
+}
+
+/************************************************
+ * Backend functions
+ ************************************************/
+
+static int mds_tracker_ctx_destructor(struct mds_tracker_ctx *ctx)
+{
+	if (ctx->tracker_con != NULL) {
+		g_object_unref(ctx->tracker_con);
+	}
+	if (ctx->gcancellable != NULL) {
+		g_cancellable_cancel(ctx->gcancellable);
+		g_object_unref(ctx->gcancellable);
+	}
+	if (ctx->gmainloop != NULL) {
+		g_main_loop_unref(ctx->gmainloop);
+	}
+	if (ctx->gcontext != NULL) {
+		g_main_context_unref(ctx->gcontext);
+	}
+
+	return 0;
+}
+
+static bool mds_tracker_connect(struct mds_ctx *mds_ctx)
+{
+	struct mds_tracker_ctx *ctx = NULL;
+
+	ctx = talloc_zero(mds_ctx, struct mds_tracker_ctx);
+	if (ctx == NULL) {
+		return false;
+	}
+	talloc_set_destructor(ctx, mds_tracker_ctx_destructor);
+	ctx->mds_ctx = mds_ctx;
+
+	ctx->gcontext = g_main_context_new();
+	if (ctx->gcontext == NULL) {
+		DEBUG(1,("error from g_main_context_new\n"));
+		TALLOC_FREE(ctx);
+		return false;
+	}
+
+	ctx->gmainloop = g_main_loop_new(ctx->gcontext, false);
+	if (ctx->gmainloop == NULL) {
+		DEBUG(1,("error from g_main_loop_new\n"));
+		TALLOC_FREE(ctx);
+		return false;
+	}
+
+	g_main_context_push_thread_default(ctx->gcontext);
+	tracker_sparql_connection_get_async(ctx->gcancellable,
+					    tracker_con_cb, ctx);
+	g_main_context_pop_thread_default(ctx->gcontext);
+
+	mds_ctx->backend_private = ctx;
+	return true;
+}
+
+static int sl_tracker_query_destructor(struct sl_tracker_query *tq)
+{
+	if (tq->tracker_cursor != NULL) {
+		g_object_unref(tq->tracker_cursor);
+		tq->tracker_cursor = NULL;
+	}
+
+	if (tq->gcancellable != NULL) {
+		g_cancellable_cancel(tq->gcancellable);
+		g_object_unref(tq->gcancellable);
+		tq->gcancellable = NULL;
+	}
+
+	return 0;
+}
+
+static bool mds_tracker_search_map(struct sl_query *slq)
+{
+	bool ok;
+
+	ok = map_spotlight_to_sparql_query(slq);
+	if (!ok) {
+		return false;
+	}
+
+	DEBUG(10, ("SPARQL query: \"%s\"\n", slq->sparql_query));
+	return true;
+}
+
+static bool mds_tracker_search_start(struct sl_query *slq)
+{
+	struct mds_tracker_ctx *ctx = slq_tracker_ctx(slq);
+	struct sl_tracker_query *tq = NULL;
+
+	if (ctx->tracker_con == NULL) {
+		DEBUG(1, ("no connection to Tracker\n"));
+		return false;
+	}
+
+	tq = talloc_zero(slq, struct sl_tracker_query);
+	if (tq == NULL) {
+		return false;
+	}
+	tq->slq = slq;
+	talloc_set_destructor(tq, sl_tracker_query_destructor);
+
+	tq->gcancellable = g_cancellable_new();
+	if (tq->gcancellable == NULL) {
+		DEBUG(1,("error from g_cancellable_new\n"));
+		TALLOC_FREE(tq);
+		return false;
+	}
+	slq->backend_private = tq;
+
+	g_main_context_push_thread_default(ctx->gcontext);
+	tracker_sparql_connection_query_async(ctx->tracker_con,
+					      slq->sparql_query,
+					      tq->gcancellable,
+					      tracker_query_cb,
+					      slq);
+	g_main_context_pop_thread_default(ctx->gcontext);
+	slq->state = SLQ_STATE_RUNNING;
+
+	return true;
+}
+
+static bool mds_tracker_search_cont(struct sl_query *slq)
+{
+	struct mds_tracker_ctx *ctx = slq_tracker_ctx(slq);
+	struct sl_tracker_query *tq = slq_tracker_query(slq);
+
+	slq->state = SLQ_STATE_RESULTS;
+
+	g_main_context_push_thread_default(ctx->gcontext);
+	tracker_sparql_cursor_next_async(tq->tracker_cursor,
+					 tq->gcancellable,
+					 tracker_cursor_cb,
+					 slq);
+	g_main_context_pop_thread_default(ctx->gcontext);
+
+	return true;
+}
+
+static gboolean gmainloop_timer(gpointer user_data)
+{
+	struct mds_tracker_ctx *ctx = talloc_get_type_abort(
+		user_data, struct mds_tracker_ctx);
+
+	DEBUG(10,("%s\n", __func__));
+	g_main_loop_quit(ctx->gmainloop);
+
+	return G_SOURCE_CONTINUE;
+}
+
+static bool mds_tracker_process_events(struct mds_ctx *mds_ctx,
+				       unsigned int timeout)
+{
+	struct mds_tracker_ctx *ctx = talloc_get_type_abort(
+		mds_ctx->backend_private, struct mds_tracker_ctx);
+	guint timer_id;
+	GSource *timer;
+
+	/*
+	 * It seems the event processing of the libtracker-sparql
+	 * async subsystem defers callbacks until *all* events are
+	 * processes by the async subsystem main processing loop.
+	 *
+	 * g_main_context_iteration(may_block=FALSE) can't be used,
+	 * because a search that produces a few thousand matches
+	 * generates as many events that must be processed in either
+	 * g_main_context_iteration() or g_main_loop_run() before
+	 * callbacks are called.
+	 *
+	 * Unfortunately g_main_context_iteration() only processes a
+	 * small subset of these event (1-30) at a time when run in
+	 * mds_dispatch(), which happens once a second while the
+	 * client polls for results.
+	 *
+	 * Carefully using the blocking g_main_loop_run() fixes
+	 * this. It processes events until we exit from the loop at
+	 * defined exit points. By adding a 1 ms timeout we at least
+	 * try to get as close as possible to non-blocking behaviour.
+	 */
+
+	if (!g_main_context_pending(ctx->gcontext)) {
+		return true;
+	}
+
+	g_main_context_push_thread_default(ctx->gcontext);
+
+	timer = g_timeout_source_new(timeout);
+	if (timer == NULL) {
+		DEBUG(1,("g_timeout_source_new_seconds\n"));
+		g_main_context_pop_thread_default(ctx->gcontext);
+		return false;
+	}
+
+	timer_id = g_source_attach(timer, ctx->gcontext);
+	if (timer_id == 0) {
+		DEBUG(1,("g_timeout_add failed\n"));
+		g_source_destroy(timer);
+		g_main_context_pop_thread_default(ctx->gcontext);
+		return false;
+	}
+
+	g_source_set_callback(timer, gmainloop_timer, ctx, NULL);
+
+	g_main_loop_run(ctx->gmainloop);
+
+	g_source_destroy(timer);
+
+	g_main_context_pop_thread_default(ctx->gcontext);
+	return true;
+}
+
+struct mdssvc_backend mdssvc_backend_tracker = {
+	.connect = mds_tracker_connect,
+	.search_map = mds_tracker_search_map,
+	.search_start = mds_tracker_search_start,
+	.search_cont = mds_tracker_search_cont,
+	.process_events = mds_tracker_process_events,
+};
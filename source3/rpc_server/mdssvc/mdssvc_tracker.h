@@ -0,0 +1,48 @@
+/*
+   Unix SMB/CIFS implementation.
+   Main metadata server / Spotlight routines / Tracker backend
+
+   Copyright (C) Ralph Boehme 2012-2014
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _MDSSVC_TRACKER_H
+#define _MDSSVC_TRACKER_H
+
+/* allow building with --picky-developer */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wcast-qual"
+#include <tracker-sparql.h>
+#pragma GCC diagnostic pop
+
+/* Per share handle */
+struct mds_tracker_ctx {
+	struct mds_ctx *mds_ctx;
+	GCancellable *gcancellable;
+	TrackerSparqlConnection *tracker_con;
+	GMainContext *gcontext;
+	GMainLoop *gmainloop;
+};
+
+/* Per query */
+struct sl_tracker_query {
+	struct sl_query *slq;
+	GCancellable *gcancellable;
+	TrackerSparqlCursor *tracker_cursor; /* Tracker SPARQL query result cursor */
+};
+
+extern struct mdssvc_backend mdssvc_backend_tracker;
+
+#endif /* _MDSSVC_TRACKER_H */
@@ -107,6 +107,7 @@ bool shutdown_service_mdssvc(void)
 
 static NTSTATUS create_mdssvc_policy_handle(TALLOC_CTX *mem_ctx,
 					    struct pipes_struct *p,
+					    int snum,
 					    const char *path,
 					    struct policy_handle *handle)
 {
@@ -114,7 +115,7 @@ static NTSTATUS create_mdssvc_policy_handle(TALLOC_CTX *mem_ctx,
 
 	ZERO_STRUCTP(handle);
 
-	mds_ctx = mds_init_ctx(mem_ctx, p->session_info, path);
+	mds_ctx = mds_init_ctx(mem_ctx, p->session_info, snum, path);
 	if (mds_ctx == NULL) {
 		DEBUG(1, ("error in mds_init_ctx for: %s\n", path));
 		return NT_STATUS_UNSUCCESSFUL;
@@ -154,7 +155,7 @@ void _mdssvc_open(struct pipes_struct *p, struct mdssvc_open *r)
 			return;
 		}
 
-		status = create_mdssvc_policy_handle(p->mem_ctx, p, path,
+		status = create_mdssvc_policy_handle(p->mem_ctx, p, snum, path,
 						     r->out.handle);
 		if (!NT_STATUS_IS_OK(status)) {
 			DEBUG(1, ("Couldn't create policy handle for %s\n",
@@ -4425,22 +4425,6 @@ static WERROR enum_all_printers_info_level(TALLOC_CTX *mem_ctx,
 		DEBUG(4,("Found a printer in smb.conf: %s[%x]\n",
 			printer, snum));
 
-		if (b == NULL) {
-			result = winreg_printer_binding_handle(tmp_ctx,
-							       session_info,
-							       msg_ctx,
-							       &b);
-			if (!W_ERROR_IS_OK(result)) {
-				goto out;
-			}
-		}
-
-		result = winreg_create_printer(tmp_ctx, b,
-					       printer);
-		if (!W_ERROR_IS_OK(result)) {
-			goto out;
-		}
-
 		info = talloc_realloc(tmp_ctx, info,
 					    union spoolss_PrinterInfo,
 					    count + 1);
@@ -4449,10 +4433,36 @@ static WERROR enum_all_printers_info_level(TALLOC_CTX *mem_ctx,
 			goto out;
 		}
 
-		result = winreg_get_printer(tmp_ctx, b,
-					    printer, &info2);
-		if (!W_ERROR_IS_OK(result)) {
-			goto out;
+		/*
+		 * A cached printer has been created in the registry
+		 * before, skip both registry round trips for it.
+		 */
+		if (!printer_info_cache_fetch(tmp_ctx, printer, &info2)) {
+			int seqnum;
+
+			if (b == NULL) {
+				result = winreg_printer_binding_handle(
+					tmp_ctx, session_info, msg_ctx, &b);
+				if (!W_ERROR_IS_OK(result)) {
+					goto out;
+				}
+			}
+
+			result = winreg_create_printer(tmp_ctx, b,
+						       printer);
+			if (!W_ERROR_IS_OK(result)) {
+				goto out;
+			}
+
+			seqnum = printer_info_cache_seqnum();
+
+			result = winreg_get_printer(tmp_ctx, b,
+						    printer, &info2);
+			if (!W_ERROR_IS_OK(result)) {
+				goto out;
+			}
+
+			printer_info_cache_store(printer, seqnum, info2);
 		}
 
 		switch (level) {
@@ -26,6 +26,8 @@
 #include "../librpc/gen_ndr/ndr_winreg.h"
 #include "srv_spoolss_util.h"
 #include "rpc_client/cli_winreg_spoolss.h"
+#include "registry/reg_backend_db.h"
+#include "lib/util/memcache.h"
 
 WERROR winreg_printer_binding_handle(TALLOC_CTX *mem_ctx,
 				     const struct auth_session_info *session_info,
@@ -150,6 +152,170 @@ WERROR winreg_printer_get_changeid_internal(TALLOC_CTX *mem_ctx,
 	return result;
 }
 
+/*
+ * Printer info as winreg_get_printer() read it from the registry, NDR
+ * encoded. Entries are only valid as long as the sequence number of
+ * registry.tdb did not move, so every change of any printer throws away
+ * the whole cache in all processes.
+ */
+
+#define PRINTER_INFO_CACHE_SIZE (8*1024*1024)
+
+static struct memcache *printer_info_cache;
+static bool printer_info_cache_initialized;
+
+struct printer_info_cache_hdr {
+	int seqnum;
+	bool default_devmode;
+};
+
+static struct memcache *printer_info_cache_get(void)
+{
+	WERROR werr;
+
+	if (printer_info_cache_initialized) {
+		return printer_info_cache;
+	}
+	printer_info_cache_initialized = true;
+
+	/*
+	 * Keep the registry open, we need its sequence number
+	 */
+	werr = regdb_open();
+	if (!W_ERROR_IS_OK(werr)) {
+		DBG_WARNING("regdb_open failed: %s\n", win_errstr(werr));
+		return NULL;
+	}
+
+	printer_info_cache = memcache_init(NULL, PRINTER_INFO_CACHE_SIZE);
+	if (printer_info_cache == NULL) {
+		DBG_ERR("memcache_init failed\n");
+	}
+	return printer_info_cache;
+}
+
+int printer_info_cache_seqnum(void)
+{
+	if (printer_info_cache_get() == NULL) {
+		return -1;
+	}
+	return regdb_get_seqnum();
+}
+
+bool printer_info_cache_fetch(TALLOC_CTX *mem_ctx,
+			      const char *printer,
+			      struct spoolss_PrinterInfo2 **pinfo2)
+{
+	struct printer_info_cache_hdr hdr;
+	struct spoolss_PrinterInfo2 *info2;
+	enum ndr_err_code ndr_err;
+	DATA_BLOB value;
+	DATA_BLOB blob;
+	int snum;
+	bool ok;
+
+	if (printer_info_cache_get() == NULL) {
+		return false;
+	}
+	if (get_remote_arch() == RA_OS2) {
+		/* winreg_get_printer() maps the driver name for OS/2 */
+		return false;
+	}
+
+	ok = memcache_lookup(printer_info_cache,
+			     PRINTER_INFO_CACHE,
+			     data_blob_string_const_null(printer),
+			     &value);
+	if (!ok || value.length < sizeof(hdr)) {
+		return false;
+	}
+	memcpy(&hdr, value.data, sizeof(hdr));
+
+	snum = lp_servicenumber(printer);
+
+	if ((hdr.seqnum != regdb_get_seqnum()) ||
+	    (hdr.default_devmode != lp_default_devmode(snum))) {
+		memcache_delete(printer_info_cache,
+				PRINTER_INFO_CACHE,
+				data_blob_string_const_null(printer));
+		return false;
+	}
+
+	info2 = talloc_zero(mem_ctx, struct spoolss_PrinterInfo2);
+	if (info2 == NULL) {
+		return false;
+	}
+
+	blob = data_blob_const(value.data + sizeof(hdr),
+			       value.length - sizeof(hdr));
+	ndr_err = ndr_pull_struct_blob(
+		&blob, info2, info2,
+		(ndr_pull_flags_fn_t)ndr_pull_spoolss_PrinterInfo2);
+	if (!NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
+		DBG_WARNING("ndr_pull_spoolss_PrinterInfo2 failed: %s\n",
+			    ndr_errstr(ndr_err));
+		TALLOC_FREE(info2);
+		return false;
+	}
+
+	*pinfo2 = info2;
+	return true;
+}
+
+/*
+ * seqnum is the registry sequence number from before the printer was read,
+ * don't store anything that might have been modified meanwhile.
+ */
+void printer_info_cache_store(const char *printer,
+			      int seqnum,
+			      const struct spoolss_PrinterInfo2 *info2)
+{
+	struct printer_info_cache_hdr hdr;
+	enum ndr_err_code ndr_err;
+	DATA_BLOB blob;
+	DATA_BLOB value;
+
+	if ((seqnum == -1) || (printer_info_cache_get() == NULL)) {
+		return;
+	}
+	if (get_remote_arch() == RA_OS2) {
+		return;
+	}
+	if (seqnum != regdb_get_seqnum()) {
+		return;
+	}
+
+	ndr_err = ndr_push_struct_blob(
+		&blob, talloc_tos(), info2,
+		(ndr_push_flags_fn_t)ndr_push_spoolss_PrinterInfo2);
+	if (!NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
+		DBG_WARNING("ndr_push_spoolss_PrinterInfo2 failed: %s\n",
+			    ndr_errstr(ndr_err));
+		return;
+	}
+
+	value = data_blob_talloc(talloc_tos(), NULL, sizeof(hdr) + blob.length);
+	if (value.data == NULL) {
+		data_blob_free(&blob);
+		return;
+	}
+
+	ZERO_STRUCT(hdr);
+	hdr.seqnum = seqnum;
+	hdr.default_devmode = lp_default_devmode(lp_servicenumber(printer));
+
+	memcpy(value.data, &hdr, sizeof(hdr));
+	memcpy(value.data + sizeof(hdr), blob.data, blob.length);
+
+	memcache_add(printer_info_cache,
+		     PRINTER_INFO_CACHE,
+		     data_blob_string_const_null(printer),
+		     value);
+
+	data_blob_free(&value);
+	data_blob_free(&blob);
+}
+
 WERROR winreg_get_printer_internal(TALLOC_CTX *mem_ctx,
 				   const struct auth_session_info *session_info,
 				   struct messaging_context *msg_ctx,
@@ -159,6 +325,11 @@ WERROR winreg_get_printer_internal(TALLOC_CTX *mem_ctx,
 	WERROR result;
 	struct dcerpc_binding_handle *b;
 	TALLOC_CTX *tmp_ctx;
+	int seqnum;
+
+	if (printer_info_cache_fetch(mem_ctx, printer, pinfo2)) {
+		return WERR_OK;
+	}
 
 	tmp_ctx = talloc_stackframe();
 	if (tmp_ctx == NULL) {
@@ -171,10 +342,15 @@ WERROR winreg_get_printer_internal(TALLOC_CTX *mem_ctx,
 		return result;
 	}
 
+	seqnum = printer_info_cache_seqnum();
+
 	result = winreg_get_printer(mem_ctx,
 				    b,
 				    printer,
 				    pinfo2);
+	if (W_ERROR_IS_OK(result)) {
+		printer_info_cache_store(printer, seqnum, *pinfo2);
+	}
 
 	talloc_free(tmp_ctx);
 	return result;
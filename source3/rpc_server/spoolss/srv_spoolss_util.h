@@ -44,6 +44,13 @@ WERROR winreg_printer_get_changeid_internal(TALLOC_CTX *mem_ctx,
 					    struct messaging_context *msg_ctx,
 					    const char *printer,
 					    uint32_t *pchangeid);
+int printer_info_cache_seqnum(void);
+bool printer_info_cache_fetch(TALLOC_CTX *mem_ctx,
+			      const char *printer,
+			      struct spoolss_PrinterInfo2 **pinfo2);
+void printer_info_cache_store(const char *printer,
+			      int seqnum,
+			      const struct spoolss_PrinterInfo2 *info2);
 WERROR winreg_get_printer_internal(TALLOC_CTX *mem_ctx,
 				   const struct auth_session_info *session_info,
 				   struct messaging_context *msg_ctx,
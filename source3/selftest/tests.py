@@ -108,6 +108,11 @@ for t in tests:
 t = "TLDAP"
 plantestsuite("samba3.smbtorture_s3.plain.%s" % t, "ad_dc", [os.path.join(samba3srcdir, "script/tests/test_smbtorture_s3.sh"), t, '//$SERVER/tmp', '$DC_USERNAME', '$DC_PASSWORD', smbtorture3, "", "-l $LOCAL_PATH"])
 
+#
+# SMB2-DURABLE-RECONNECT needs a share without kernel share modes and oplocks
+#
+plantestsuite("samba3.smbtorture_s3.plain.%s" % "SMB2-DURABLE-RECONNECT", "fileserver", [os.path.join(samba3srcdir, "script/tests/test_smbtorture_s3.sh"), "SMB2-DURABLE-RECONNECT", '//$SERVER_IP/durable', '$USERNAME', '$PASSWORD', smbtorture3, "", "-l $LOCAL_PATH"])
+
 #
 # RENAME-ACCESS needs to run against a special share - acl_xattr_ign_sysacl_windows
 #
@@ -193,13 +198,17 @@ local_tests = [
     "LOCAL-DBWRAP-WATCH1",
     "LOCAL-DBWRAP-WATCH2",
     "LOCAL-DBWRAP-DO-LOCKED1",
+    "LOCAL-DBWRAP-SHM1",
+    "LOCAL-BRLOCK-INDEX",
     "LOCAL-G-LOCK1",
     "LOCAL-G-LOCK2",
     "LOCAL-G-LOCK3",
     "LOCAL-G-LOCK4",
     "LOCAL-G-LOCK5",
     "LOCAL-G-LOCK6",
+    "LOCAL-G-LOCK7",
     "LOCAL-NAMEMAP-CACHE1",
+    "LOCAL-LP-RELOAD1",
     "LOCAL-hex_encode_buf",
     "LOCAL-remove_duplicate_addrs2"]
 
@@ -683,7 +683,8 @@ NTSTATUS schedule_smb2_aio_read(connection_struct *conn,
 	}
 
 	/* Create the out buffer. */
-	*preadbuf = data_blob_talloc(ctx, NULL, smb_maxcnt);
+	preadbuf->data = smbd_smb2_buffer_alloc(ctx, smb_maxcnt);
+	preadbuf->length = smb_maxcnt;
 	if (preadbuf->data == NULL) {
 		return NT_STATUS_NO_MEMORY;
 	}
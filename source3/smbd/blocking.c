@@ -30,6 +30,7 @@ static void received_unlock_msg(struct messaging_context *msg,
 				uint32_t msg_type,
 				struct server_id server_id,
 				DATA_BLOB *data);
+static void blocking_lock_wakeup_done(struct tevent_req *subreq);
 
 void brl_timeout_fn(struct tevent_context *event_ctx,
 			   struct tevent_timer *te,
@@ -78,7 +79,11 @@ static bool recalc_brl_timeout(struct smbd_server_connection *sconn)
 {
 	struct blocking_lock_record *blr;
 	struct timeval next_timeout;
-	int max_brl_timeout = lp_parm_int(-1, "brl", "recalctime", 5);
+	int poll_time = lp_parm_int(-1, "brl", "recalctime", 5);
+
+	if (poll_time <= 0) {
+		poll_time = 10;
+	}
 
 	TALLOC_FREE(sconn->smb1.locks.brl_timeout);
 
@@ -88,13 +93,16 @@ static bool recalc_brl_timeout(struct smbd_server_connection *sconn)
 		if (timeval_is_zero(&blr->expire_time)) {
 			/*
 			 * If we're blocked on pid 0xFFFFFFFFFFFFFFFFLL this is
-			 * a POSIX lock, so calculate a timeout of
-			 * 10 seconds into the future.
+			 * a POSIX lock taken outside smbd, its unlock does
+			 * not touch brlock.tdb. The same if we could not
+			 * watch brlock.tdb. Retry every brl:recalctime
+			 * seconds (default 5 seconds).
 			 */
-                        if (blr->blocking_smblctx == 0xFFFFFFFFFFFFFFFFLL) {
-				struct timeval psx_to = timeval_current_ofs(10, 0);
+			if (blr->blocking_smblctx == 0xFFFFFFFFFFFFFFFFLL ||
+			    blr->watch_req == NULL) {
+				struct timeval psx_to = timeval_current_ofs(poll_time, 0);
 				next_timeout = timeval_brl_min(&next_timeout, &psx_to);
-                        }
+			}
 
 			continue;
 		}
@@ -107,25 +115,6 @@ static bool recalc_brl_timeout(struct smbd_server_connection *sconn)
 		return True;
 	}
 
-	/*
-	 to account for unclean shutdowns by clients we need a
-	 maximum timeout that we use for checking pending locks. If
-	 we have any pending locks at all, then check if the pending
-	 lock can continue at least every brl:recalctime seconds
-	 (default 5 seconds).
-
-	 This saves us needing to do a message_send_all() in the
-	 SIGCHLD handler in the parent daemon. That
-	 message_send_all() caused O(n^2) work to be done when IP
-	 failovers happened in clustered Samba, which could make the
-	 entire system unusable for many minutes.
-	*/
-
-	if (max_brl_timeout > 0) {
-		struct timeval min_to = timeval_current_ofs(max_brl_timeout, 0);
-		next_timeout = timeval_min(&next_timeout, &min_to);
-	}
-
 	if (DEBUGLVL(10)) {
 		struct timeval cur, from_now;
 
@@ -217,6 +206,21 @@ bool push_blocking_lock_request( struct byte_range_lock *br_lck,
 	/* Specific brl_lock() implementations can fill this in. */
 	blr->blr_private = NULL;
 
+	/*
+	 * We hold the brlock.tdb record, so we can only start
+	 * watching it from the next event loop run, see
+	 * blocking_lock_retry().
+	 */
+	blr->watch_req = tevent_wakeup_send(blr, sconn->ev_ctx,
+					    timeval_zero());
+	if (blr->watch_req == NULL) {
+		DEBUG(0,("push_blocking_lock_request: Malloc fail !\n" ));
+		TALLOC_FREE(blr);
+		return False;
+	}
+	tevent_req_set_callback(blr->watch_req, blocking_lock_wakeup_done,
+				blr);
+
 	/* Add a pending lock record for this. */
 	status = brl_lock(req->sconn->msg_ctx,
 			br_lck,
@@ -442,6 +446,70 @@ static bool lock_timed_out(const struct blocking_lock_record *blr)
 	return false;
 }
 
+/****************************************************************************
+ Add or remove the pending lock entry of a blocking lock we retried.
+ The entry stays in brlock.tdb while we retry, so that a retry that
+ fails again does not change the record and wake up all other waiters
+ on the file.
+*****************************************************************************/
+
+static void blocking_lock_update_pending(struct blocking_lock_record *blr,
+					 struct byte_range_lock *br_lck,
+					 bool have_pending,
+					 bool want_pending)
+{
+	struct messaging_context *msg_ctx = blr->fsp->conn->sconn->msg_ctx;
+	struct byte_range_lock *br_lck_cancel = NULL;
+
+	if (have_pending == want_pending) {
+		return;
+	}
+
+	if (want_pending) {
+		NTSTATUS status;
+
+		if (br_lck == NULL) {
+			DEBUG(0,("no brlock record to add PENDING_LOCK "
+				 "record.\n"));
+			return;
+		}
+
+		status = brl_lock(msg_ctx,
+				br_lck,
+				blr->smblctx,
+				messaging_server_id(msg_ctx),
+				blr->offset,
+				blr->count,
+				blr->lock_type == READ_LOCK ?
+					PENDING_READ_LOCK :
+					PENDING_WRITE_LOCK,
+				blr->lock_flav,
+				true, /* Blocking lock. */
+				NULL);
+		if (!NT_STATUS_IS_OK(status)) {
+			DEBUG(0,("failed to add PENDING_LOCK record.\n"));
+		}
+		return;
+	}
+
+	if (br_lck == NULL) {
+		br_lck_cancel = brl_get_locks(talloc_tos(), blr->fsp);
+		if (br_lck_cancel == NULL) {
+			return;
+		}
+		br_lck = br_lck_cancel;
+	}
+
+	brl_lock_cancel(br_lck,
+			blr->smblctx,
+			messaging_server_id(msg_ctx),
+			blr->offset,
+			blr->count,
+			blr->lock_flav);
+
+	TALLOC_FREE(br_lck_cancel);
+}
+
 /****************************************************************************
  Attempt to finish off getting all pending blocking locks for a lockingX call.
  Returns True if we want to be removed from the list.
@@ -457,6 +525,7 @@ static bool process_lockingX(struct blocking_lock_record *blr)
 	uint8_t *data;
 	NTSTATUS status = NT_STATUS_OK;
 	bool lock_timeout = lock_timed_out(blr);
+	int pending_num = blr->lock_num;
 
 	data = discard_const_p(uint8_t, blr->req->buf)
 		+ ((large_file_format ? 20 : 10)*num_ulocks);
@@ -468,6 +537,7 @@ static bool process_lockingX(struct blocking_lock_record *blr)
 
 	for(; blr->lock_num < num_locks; blr->lock_num++) {
 		struct byte_range_lock *br_lck = NULL;
+		bool wait;
 
 		/*
 		 * Ensure the blr record gets updated with
@@ -495,32 +565,15 @@ static bool process_lockingX(struct blocking_lock_record *blr)
 				&status,
 				&blr->blocking_smblctx);
 
-		if (ERROR_WAS_LOCK_DENIED(status) && !lock_timeout) {
-			/*
-			 * If we didn't timeout, but still need to wait,
-			 * re-add the pending lock entry whilst holding
-			 * the brlock db lock.
-			 */
-			NTSTATUS status1 =
-				brl_lock(blr->fsp->conn->sconn->msg_ctx,
-					br_lck,
-					blr->smblctx,
-					messaging_server_id(
-						blr->fsp->conn->sconn->msg_ctx),
-					blr->offset,
-					blr->count,
-					blr->lock_type == READ_LOCK ?
-						PENDING_READ_LOCK :
-						PENDING_WRITE_LOCK,
-						blr->lock_flav,
-					true, /* Blocking lock. */
-					NULL);
-
-			if (!NT_STATUS_IS_OK(status1)) {
-				DEBUG(0,("failed to add PENDING_LOCK "
-					"record.\n"));
-			}
-		}
+		/*
+		 * If we didn't timeout, but still need to wait, have
+		 * a pending lock entry for the lock we wait for,
+		 * whilst holding the brlock db lock.
+		 */
+		wait = ERROR_WAS_LOCK_DENIED(status) && !lock_timeout;
+		blocking_lock_update_pending(blr, br_lck,
+					     blr->lock_num == pending_num,
+					     wait);
 
 		TALLOC_FREE(br_lck);
 
@@ -594,31 +647,14 @@ static bool process_trans2(struct blocking_lock_record *blr)
 						True,
 						&status,
 						&blr->blocking_smblctx);
-	if (ERROR_WAS_LOCK_DENIED(status) && !lock_timeout) {
-		/*
-		 * If we didn't timeout, but still need to wait,
-		 * re-add the pending lock entry whilst holding
-		 * the brlock db lock.
-		 */
-		NTSTATUS status1 =
-			brl_lock(blr->fsp->conn->sconn->msg_ctx,
-				br_lck,
-				blr->smblctx,
-				messaging_server_id(
-					blr->fsp->conn->sconn->msg_ctx),
-				blr->offset,
-				blr->count,
-				blr->lock_type == READ_LOCK ?
-					PENDING_READ_LOCK :
-					PENDING_WRITE_LOCK,
-				blr->lock_flav,
-				true, /* Blocking lock. */
-				NULL);
 
-		if (!NT_STATUS_IS_OK(status1)) {
-			DEBUG(0,("failed to add PENDING_LOCK record.\n"));
-		}
-	}
+	/*
+	 * Keep the pending lock entry if we didn't timeout, but
+	 * still need to wait.
+	 */
+	blocking_lock_update_pending(blr, br_lck, true,
+				     ERROR_WAS_LOCK_DENIED(status) &&
+				     !lock_timeout);
 
 	TALLOC_FREE(br_lck);
 
@@ -794,6 +830,116 @@ bool blocking_lock_was_deferred_smb1(
 	return False;
 }
 
+/****************************************************************************
+ Retry a blocking lock request, removing it from the queue when done.
+
+ Watch the brlock.tdb record of the file before we retry, so that we
+ can't miss an unlock that happens right after our attempt. If we're
+ blocked by someone else now, watch again for their death.
+*****************************************************************************/
+
+static void blocking_lock_watch_done(struct tevent_req *subreq);
+
+static void blocking_lock_retry(struct blocking_lock_record *blr)
+{
+	struct smbd_server_connection *sconn = blr->fsp->conn->sconn;
+	uint64_t blocking_smblctx;
+
+	do {
+		blocking_smblctx = blr->blocking_smblctx;
+
+		TALLOC_FREE(blr->watch_req);
+		blr->watch_req = brl_watch_send(blr, sconn->ev_ctx, blr->fsp,
+						blocking_smblctx);
+		if (blr->watch_req != NULL) {
+			tevent_req_set_callback(blr->watch_req,
+						blocking_lock_watch_done,
+						blr);
+		}
+
+		/*
+		 * Go through the remaining locks and try and obtain them.
+		 * The call returns True if all locks were obtained successfully
+		 * and False if we still need to wait.
+		 */
+
+		DEBUG(10, ("Processing BLR = %p\n", blr));
+
+		/*
+		 * Connections with pending locks are not marked as idle.
+		 */
+		blr->fsp->conn->lastused_count++;
+
+		if (blocking_lock_record_process(blr)) {
+			DEBUG(10, ("BLR_process returned true: "
+				   "removing BLR = %p\n", blr));
+
+			DLIST_REMOVE(sconn->smb1.locks.blocking_lock_queue,
+				     blr);
+			TALLOC_FREE(blr);
+			return;
+		}
+
+		DEBUG(10, ("still waiting for lock. BLR = %p\n", blr));
+
+	} while (blr->blocking_smblctx != blocking_smblctx);
+}
+
+static void blocking_lock_wakeup_done(struct tevent_req *subreq)
+{
+	struct blocking_lock_record *blr = tevent_req_callback_data(
+		subreq, struct blocking_lock_record);
+	struct smbd_server_connection *sconn = blr->fsp->conn->sconn;
+
+	SMB_ASSERT(blr->watch_req == subreq);
+
+	tevent_wakeup_recv(subreq);
+	TALLOC_FREE(blr->watch_req);
+
+	change_to_root_user();
+
+	blocking_lock_retry(blr);
+	recalc_brl_timeout(sconn);
+}
+
+static void blocking_lock_watch_done(struct tevent_req *subreq)
+{
+	struct blocking_lock_record *blr = tevent_req_callback_data(
+		subreq, struct blocking_lock_record);
+	struct smbd_server_connection *sconn = blr->fsp->conn->sconn;
+	bool blockerdead = false;
+	NTSTATUS status;
+
+	SMB_ASSERT(blr->watch_req == subreq);
+
+	status = brl_watch_recv(subreq, &blockerdead);
+	TALLOC_FREE(blr->watch_req);
+
+	DEBUG(10, ("brl_watch_recv returned %s, blockerdead=%d, BLR = %p\n",
+		   nt_errstr(status), (int)blockerdead, blr));
+
+	change_to_root_user();
+
+	blocking_lock_retry(blr);
+	recalc_brl_timeout(sconn);
+}
+
+/****************************************************************************
+ Stop watching brlock.tdb for a blocking lock request. Called with the
+ brlock.tdb record of the file locked: Freeing the watch has to lock the
+ record again, so leave that to the talloc stackframe.
+*****************************************************************************/
+
+void blocking_lock_stop_watch(struct blocking_lock_record *blr)
+{
+	if (blr->watch_req == NULL) {
+		return;
+	}
+	tevent_req_set_callback(blr->watch_req, NULL, NULL);
+	talloc_steal(talloc_tos(), blr->watch_req);
+	blr->watch_req = NULL;
+}
+
 /****************************************************************************
   Set a flag as an unlock request affects one of our pending locks.
 *****************************************************************************/
@@ -830,50 +976,8 @@ void process_blocking_lock_queue(struct smbd_server_connection *sconn)
 	 */
 
 	for (blr = sconn->smb1.locks.blocking_lock_queue; blr; blr = next) {
-		struct byte_range_lock *br_lck = NULL;
-
 		next = blr->next;
-
-		/*
-		 * Go through the remaining locks and try and obtain them.
-		 * The call returns True if all locks were obtained successfully
-		 * and False if we still need to wait.
-		 */
-
-		DEBUG(10, ("Processing BLR = %p\n", blr));
-
-		/*
-		 * Connections with pending locks are not marked as idle.
-		 */
-		blr->fsp->conn->lastused_count++;
-
-		/*
-		 * Remove the pending lock we're waiting on.
-		 * If we need to keep waiting blocking_lock_record_process()
-		 * will re-add it.
-		 */
-
-		br_lck = brl_get_locks(talloc_tos(), blr->fsp);
-		if (br_lck) {
-			brl_lock_cancel(br_lck,
-				blr->smblctx,
-				messaging_server_id(sconn->msg_ctx),
-				blr->offset,
-				blr->count,
-				blr->lock_flav);
-		}
-		TALLOC_FREE(br_lck);
-
-		if(!blocking_lock_record_process(blr)) {
-			DEBUG(10, ("still waiting for lock. BLR = %p\n", blr));
-			continue;
-		}
-
-		DEBUG(10, ("BLR_process returned true: removing BLR = %p\n",
-			blr));
-
-		DLIST_REMOVE(sconn->smb1.locks.blocking_lock_queue, blr);
-		TALLOC_FREE(blr);
+		blocking_lock_retry(blr);
 	}
 
 	recalc_brl_timeout(sconn);
@@ -967,7 +1071,8 @@ struct blocking_lock_record *blocking_lock_cancel_smb1(files_struct *fsp,
 		return NULL;
 	}
 
-	/* Move to cancelled queue. */
+	/* Move to cancelled queue, we're done retrying. */
+	blocking_lock_stop_watch(blr);
 	DLIST_REMOVE(sconn->smb1.locks.blocking_lock_queue, blr);
 	DLIST_ADD(sconn->smb1.locks.blocking_lock_cancelled_queue, blr);
 
@@ -233,37 +233,140 @@ NTSTATUS delete_all_streams(connection_struct *conn,
 	return status;
 }
 
+struct has_other_nonposix_opens_state {
+	files_struct *fsp;
+	struct server_id self;
+	bool found_another;
+};
+
+static bool has_other_nonposix_opens_fn(
+	struct share_mode_entry *e,
+	bool *modified,
+	void *private_data)
+{
+	struct has_other_nonposix_opens_state *state = private_data;
+	struct files_struct *fsp = state->fsp;
+
+	if (!is_valid_share_mode_entry(e)) {
+		return false;
+	}
+	if (e->name_hash != fsp->name_hash) {
+		return false;
+	}
+	if ((fsp->posix_flags & FSP_POSIX_FLAGS_OPEN) &&
+	    (e->flags & SHARE_MODE_FLAG_POSIX_OPEN)) {
+		return false;
+	}
+	if (serverid_equal(&state->self, &e->pid) &&
+	    (e->share_file_id == fsp->fh->gen_id)) {
+		return false;
+	}
+	if (share_entry_stale_pid(e)) {
+		return false;
+	}
+
+	state->found_another = true;
+	return true;
+}
+
 bool has_other_nonposix_opens(struct share_mode_lock *lck,
 			      struct files_struct *fsp,
 			      struct server_id self)
 {
-	struct share_mode_data *data = lck->data;
-	uint32_t i;
+	struct has_other_nonposix_opens_state state = {
+		.fsp = fsp,
+		.self = self,
+	};
+	bool ok;
+
+	ok = share_mode_forall_entries(
+		lck, has_other_nonposix_opens_fn, &state);
+	if (!ok) {
+		return false;
+	}
+	return state.found_another;
+}
 
-	for (i=0; i<data->num_share_modes; i++) {
-		struct share_mode_entry *e = &data->share_modes[i];
+/****************************************************************************
+ Decide whether closing fsp will delete the file, before actually closing it.
+ If so, the delete on close flag is set in the share mode record, so that
+ new opens fail with NT_STATUS_DELETE_PENDING, and the token of the user who
+ asked for the delete is returned. The caller can then remove the file
+ itself, close_remove_share_mode() copes with a file that is already gone.
+****************************************************************************/
 
-		if (!is_valid_share_mode_entry(e)) {
-			continue;
-		}
-		if (e->name_hash != fsp->name_hash) {
-			continue;
-		}
-		if ((fsp->posix_flags & FSP_POSIX_FLAGS_OPEN) &&
-		    (e->flags & SHARE_MODE_FLAG_POSIX_OPEN)) {
-			continue;
+bool close_prepare_delete_on_close(TALLOC_CTX *mem_ctx,
+				   files_struct *fsp,
+				   struct security_unix_token **pdel_token)
+{
+	connection_struct *conn = fsp->conn;
+	struct server_id self = messaging_server_id(conn->sconn->msg_ctx);
+	struct share_mode_lock *lck = NULL;
+	const struct security_unix_token *del_token = NULL;
+	const struct security_token *del_nt_token = NULL;
+	struct file_id id;
+	NTSTATUS status;
+	bool delete_file;
+
+	if (!fsp->initial_delete_on_close && !fsp->delete_on_close) {
+		return false;
+	}
+
+	/* We can only delete the file if the name is still valid. */
+
+	status = vfs_stat_fsp(fsp);
+	if (!NT_STATUS_IS_OK(status)) {
+		return false;
+	}
+
+	id = vfs_file_id_from_sbuf(conn, &fsp->fsp_name->st);
+	if (!file_id_equal(&fsp->file_id, &id)) {
+		return false;
+	}
+
+	lck = get_existing_share_mode_lock(talloc_tos(), fsp->file_id);
+	if (lck == NULL) {
+		return false;
+	}
+
+	if (fsp->initial_delete_on_close &&
+			!is_delete_on_close_set(lck, fsp->name_hash)) {
+		bool became_user = False;
+
+		if (get_current_vuid(conn) != fsp->vuid) {
+			become_user(conn, fsp->vuid);
+			became_user = True;
 		}
-		if (serverid_equal(&self, &e->pid) &&
-		    (e->share_file_id == fsp->fh->gen_id)) {
-			continue;
+		fsp->delete_on_close = true;
+		set_delete_on_close_lck(fsp, lck,
+				get_current_nttok(conn),
+				get_current_utok(conn));
+		if (became_user) {
+			unbecome_user();
 		}
-		if (share_mode_stale_pid(data, i)) {
-			continue;
+	}
+
+	delete_file = is_delete_on_close_set(lck, fsp->name_hash);
+
+	delete_file &= !has_other_nonposix_opens(lck, fsp, self);
+
+	if (delete_file) {
+		bool got_tokens;
+
+		got_tokens = get_delete_on_close_token(lck, fsp->name_hash,
+						       &del_nt_token,
+						       &del_token);
+		SMB_ASSERT(got_tokens);
+
+		*pdel_token = copy_unix_token(mem_ctx, del_token);
+		if (*pdel_token == NULL) {
+			delete_file = false;
 		}
-		return true;
 	}
 
-	return false;
+	TALLOC_FREE(lck);
+
+	return delete_file;
 }
 
 /****************************************************************************
@@ -22,6 +22,8 @@
 #include "smbd/globals.h"
 #include "lib/util_file.h"
 #include "lib/util/memcache.h"
+#include "lib/gencache.h"
+#include "lib/util/dlinklist.h"
 
 /****************************************************************************
  Normalise for DOS usage.
@@ -47,6 +49,58 @@ static void disk_norm(uint64_t *bsize, uint64_t *dfree, uint64_t *dsize)
 
 
 
+/****************************************************************************
+ Parse the first line of the output of a "dfree command".
+****************************************************************************/
+
+static void dfree_parse_command_output(const char *line,
+				       uint64_t *bsize,
+				       uint64_t *dfree,
+				       uint64_t *dsize)
+{
+	const char *p;
+
+	DEBUG (3, ("Read input from dfree, \"%s\"\n", line));
+
+	*dsize = STR_TO_SMB_BIG_UINT(line, &p);
+	while (p && *p && isspace(*p))
+		p++;
+	if (p && *p)
+		*dfree = STR_TO_SMB_BIG_UINT(p, &p);
+	while (p && *p && isspace(*p))
+		p++;
+	if (p && *p)
+		*bsize = STR_TO_SMB_BIG_UINT(p, NULL);
+	else
+		*bsize = 1024;
+	DEBUG (3, ("Parsed output of dfree, dsize=%u, dfree=%u, bsize=%u\n",
+		(unsigned int)*dsize, (unsigned int)*dfree, (unsigned int)*bsize));
+
+	if (!*dsize)
+		*dsize = 2048;
+	if (!*dfree)
+		*dfree = 1024;
+}
+
+/****************************************************************************
+ Normalise the result and return the number of free 1K blocks.
+****************************************************************************/
+
+static uint64_t dfree_finish(uint64_t *bsize, uint64_t *dfree, uint64_t *dsize)
+{
+	uint64_t dfree_retval;
+
+	disk_norm(bsize, dfree, dsize);
+
+	if ((*bsize) < 1024) {
+		dfree_retval = (*dfree)/(1024/(*bsize));
+	} else {
+		dfree_retval = ((*bsize)/1024)*(*dfree);
+	}
+
+	return(dfree_retval);
+}
+
 /****************************************************************************
  Return number of 1K blocks available on a path and total number.
 ****************************************************************************/
@@ -54,7 +108,6 @@ static void disk_norm(uint64_t *bsize, uint64_t *dfree, uint64_t *dsize)
 uint64_t sys_disk_free(connection_struct *conn, struct smb_filename *fname,
 		       uint64_t *bsize, uint64_t *dfree, uint64_t *dsize)
 {
-	uint64_t dfree_retval;
 	uint64_t dfree_q = 0;
 	uint64_t bsize_q = 0;
 	uint64_t dsize_q = 0;
@@ -71,7 +124,6 @@ uint64_t sys_disk_free(connection_struct *conn, struct smb_filename *fname,
 
 	dfree_command = lp_dfree_command(talloc_tos(), SNUM(conn));
 	if (dfree_command && *dfree_command) {
-		const char *p;
 		char **lines = NULL;
 		char *syscmd = NULL;
 
@@ -88,30 +140,8 @@ uint64_t sys_disk_free(connection_struct *conn, struct smb_filename *fname,
 
 		lines = file_lines_pload(talloc_tos(), syscmd, NULL);
 		if (lines != NULL) {
-			char *line = lines[0];
-
-			DEBUG (3, ("Read input from dfree, \"%s\"\n", line));
-
-			*dsize = STR_TO_SMB_BIG_UINT(line, &p);
-			while (p && *p && isspace(*p))
-				p++;
-			if (p && *p)
-				*dfree = STR_TO_SMB_BIG_UINT(p, &p);
-			while (p && *p && isspace(*p))
-				p++;
-			if (p && *p)
-				*bsize = STR_TO_SMB_BIG_UINT(p, NULL);
-			else
-				*bsize = 1024;
+			dfree_parse_command_output(lines[0], bsize, dfree, dsize);
 			TALLOC_FREE(lines);
-			DEBUG (3, ("Parsed output of dfree, dsize=%u, dfree=%u, bsize=%u\n",
-				(unsigned int)*dsize, (unsigned int)*dfree, (unsigned int)*bsize));
-
-			if (!*dsize)
-				*dsize = 2048;
-			if (!*dfree)
-				*dfree = 1024;
-
 			goto dfree_done;
 		}
 		DEBUG (0, ("disk_free: file_lines_load() failed for "
@@ -155,15 +185,7 @@ uint64_t sys_disk_free(connection_struct *conn, struct smb_filename *fname,
 	}
 
 dfree_done:
-	disk_norm(bsize, dfree, dsize);
-
-	if ((*bsize) < 1024) {
-		dfree_retval = (*dfree)/(1024/(*bsize));
-	} else {
-		dfree_retval = ((*bsize)/1024)*(*dfree);
-	}
-
-	return(dfree_retval);
+	return dfree_finish(bsize, dfree, dsize);
 }
 
 /****************************************************************************
@@ -173,8 +195,17 @@ dfree_done:
  information can be different for different sub directories underneath a SMB
  share. Store the cache information in memcache using the query path as the
  key to accomodate this.
+
+ The results are also stored in gencache, keyed by the uid and the query
+ path, so that other smbd processes of the same user don't have to run the
+ "dfree command" or the quota queries again. An entry with a "dfree
+ command" result that is older than "dfree cache time" is still returned
+ for up to DFREE_CACHE_STALE_FACTOR times as long, while the command runs
+ again in the background.
 ****************************************************************************/
 
+#define DFREE_CACHE_STALE_FACTOR 10
+
 struct dfree_cached_info {
 	time_t last_dfree_time;
 	uint64_t dfree_ret;
@@ -183,6 +214,168 @@ struct dfree_cached_info {
 	uint64_t dsize;
 };
 
+static char *dfree_shared_key(TALLOC_CTX *mem_ctx,
+			      connection_struct *conn,
+			      const char *key_path)
+{
+	return talloc_asprintf(mem_ctx,
+			       "DFREE/%u/%s",
+			       (unsigned int)get_current_uid(conn),
+			       key_path);
+}
+
+static bool dfree_shared_fetch(const char *shared_key,
+			       struct dfree_cached_info *dfc)
+{
+	DATA_BLOB blob = { .data = NULL };
+	bool ok;
+
+	ok = gencache_get_data_blob(shared_key, talloc_tos(), &blob,
+				    NULL, NULL);
+	if (!ok) {
+		return false;
+	}
+	if (blob.length != sizeof(*dfc)) {
+		data_blob_free(&blob);
+		return false;
+	}
+	memcpy(dfc, blob.data, sizeof(*dfc));
+	data_blob_free(&blob);
+	return true;
+}
+
+static void dfree_cache_store(const char *key_path,
+			      const char *shared_key,
+			      int dfree_cache_time,
+			      const struct dfree_cached_info *dfc)
+{
+	DATA_BLOB value = data_blob_const(dfc, sizeof(*dfc));
+
+	memcache_add(smbd_memcache(),
+		     DFREE_CACHE,
+		     data_blob_const(key_path, strlen(key_path)),
+		     value);
+	gencache_set_data_blob(shared_key,
+			       value,
+			       dfc->last_dfree_time +
+			       dfree_cache_time * DFREE_CACHE_STALE_FACTOR);
+}
+
+static void dfree_cache_delete(const char *key_path, const char *shared_key)
+{
+	memcache_delete(smbd_memcache(),
+			DFREE_CACHE,
+			data_blob_const(key_path, strlen(key_path)));
+	gencache_del(shared_key);
+}
+
+/*
+ * A "dfree command" running in the background to refresh a stale entry
+ */
+struct dfree_refresh {
+	struct dfree_refresh *prev, *next;
+	char *key_path;
+	char *shared_key;
+	int dfree_cache_time;
+};
+
+static struct dfree_refresh *dfree_refreshes;
+
+static int dfree_refresh_destructor(struct dfree_refresh *r)
+{
+	DLIST_REMOVE(dfree_refreshes, r);
+	return 0;
+}
+
+static void dfree_refresh_done(struct tevent_req *req);
+
+static bool dfree_refresh_start(connection_struct *conn,
+				struct smb_filename *fname,
+				const char *key_path,
+				const char *shared_key)
+{
+	struct dfree_refresh *r = NULL;
+	struct tevent_req *req = NULL;
+	const char *dfree_command = NULL;
+	char *syscmd = NULL;
+
+	for (r = dfree_refreshes; r != NULL; r = r->next) {
+		if (strcmp(r->shared_key, shared_key) == 0) {
+			return true;
+		}
+	}
+
+	dfree_command = lp_dfree_command(talloc_tos(), SNUM(conn));
+	if (dfree_command == NULL || *dfree_command == '\0') {
+		return false;
+	}
+
+	r = talloc_zero(NULL, struct dfree_refresh);
+	if (r == NULL) {
+		return false;
+	}
+	r->key_path = talloc_strdup(r, key_path);
+	r->shared_key = talloc_strdup(r, shared_key);
+	r->dfree_cache_time = lp_dfree_cache_time(SNUM(conn));
+	syscmd = talloc_asprintf(r, "%s %s", dfree_command, fname->base_name);
+	if (r->key_path == NULL || r->shared_key == NULL || syscmd == NULL) {
+		TALLOC_FREE(r);
+		return false;
+	}
+
+	DBG_DEBUG("Refreshing dfree cache entry for %s: running '%s'\n",
+		  key_path, syscmd);
+
+	req = file_pload_send(r, conn->sconn->ev_ctx, syscmd, 0);
+	if (req == NULL) {
+		TALLOC_FREE(r);
+		return false;
+	}
+	tevent_req_set_callback(req, dfree_refresh_done, r);
+
+	DLIST_ADD(dfree_refreshes, r);
+	talloc_set_destructor(r, dfree_refresh_destructor);
+
+	return true;
+}
+
+static void dfree_refresh_done(struct tevent_req *req)
+{
+	struct dfree_refresh *r = tevent_req_callback_data(
+		req, struct dfree_refresh);
+	struct dfree_cached_info dfc = { 0 };
+	uint8_t *buf = NULL;
+	char *line = NULL;
+	int ret;
+
+	ret = file_pload_recv(req, r, &buf);
+	TALLOC_FREE(req);
+	if (ret != 0 || buf == NULL) {
+		/*
+		 * Let the next query run the command synchronously
+		 * with all the error handling and fallbacks.
+		 */
+		DBG_NOTICE("dfree command for %s failed: %s\n",
+			   r->key_path,
+			   ret != 0 ? strerror(ret) : "no output");
+		dfree_cache_delete(r->key_path, r->shared_key);
+		TALLOC_FREE(r);
+		return;
+	}
+
+	line = (char *)buf;
+	line[strcspn(line, "\n")] = '\0';
+
+	dfree_parse_command_output(line, &dfc.bsize, &dfc.dfree, &dfc.dsize);
+	dfc.dfree_ret = dfree_finish(&dfc.bsize, &dfc.dfree, &dfc.dsize);
+	dfc.last_dfree_time = time(NULL);
+
+	DBG_DEBUG("Refreshed dfree cache entry for %s\n", r->key_path);
+	dfree_cache_store(r->key_path, r->shared_key, r->dfree_cache_time, &dfc);
+
+	TALLOC_FREE(r);
+}
+
 uint64_t get_dfree_info(connection_struct *conn, struct smb_filename *fname,
 			uint64_t *bsize, uint64_t *dfree, uint64_t *dsize)
 {
@@ -194,8 +387,10 @@ uint64_t get_dfree_info(connection_struct *conn, struct smb_filename *fname,
 	char *full_path = NULL;
 	char *to_free = NULL;
 	char *key_path = NULL;
+	char *shared_key = NULL;
 	size_t len;
 	DATA_BLOB key, value;
+	time_t now;
 	bool found;
 
 	if (!dfree_cache_time) {
@@ -243,20 +438,52 @@ uint64_t get_dfree_info(connection_struct *conn, struct smb_filename *fname,
 		key_path = full_path;
 	}
 
+	shared_key = dfree_shared_key(talloc_tos(), conn, key_path);
+	if (shared_key == NULL) {
+		TALLOC_FREE(to_free);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	now = time(NULL);
+
 	key = data_blob_const(key_path, strlen(key_path));
 	found = memcache_lookup(smbd_memcache(),
 				DFREE_CACHE,
 				key,
 				&value);
-	dfc = found ? (struct dfree_cached_info *)value.data : NULL;
+	if (found && value.length == sizeof(dfc_new)) {
+		memcpy(&dfc_new, value.data, sizeof(dfc_new));
+		dfc = &dfc_new;
+	}
+
+	if ((dfc == NULL || now - dfc->last_dfree_time >= dfree_cache_time) &&
+	    dfree_shared_fetch(shared_key, &dfc_new))
+	{
+		/*
+		 * Another smbd of the same user might have a more
+		 * recent result.
+		 */
+		memcache_add(smbd_memcache(),
+			     DFREE_CACHE,
+			     key,
+			     data_blob_const(&dfc_new, sizeof(dfc_new)));
+		dfc = &dfc_new;
+	}
 
-	if (dfc && (conn->lastused - dfc->last_dfree_time < dfree_cache_time)) {
+	if (dfc != NULL && (now - dfc->last_dfree_time < dfree_cache_time)) {
 		DBG_DEBUG("Returning dfree cache entry for %s\n", key_path);
-		*bsize = dfc->bsize;
-		*dfree = dfc->dfree;
-		*dsize = dfc->dsize;
-		dfree_ret = dfc->dfree_ret;
-		goto out;
+		goto cached;
+	}
+
+	if (dfc != NULL &&
+	    (now - dfc->last_dfree_time <
+	     dfree_cache_time * DFREE_CACHE_STALE_FACTOR) &&
+	    dfree_refresh_start(conn, fname, key_path, shared_key))
+	{
+		DBG_DEBUG("Returning stale dfree cache entry for %s\n",
+			  key_path);
+		goto cached;
 	}
 
 	dfree_ret = sys_disk_free(conn, fname, bsize, dfree, dsize);
@@ -271,13 +498,18 @@ uint64_t get_dfree_info(connection_struct *conn, struct smb_filename *fname,
 	dfc_new.dfree = *dfree;
 	dfc_new.dsize = *dsize;
 	dfc_new.dfree_ret = dfree_ret;
-	dfc_new.last_dfree_time = conn->lastused;
-	memcache_add(smbd_memcache(),
-		     DFREE_CACHE,
-		     key,
-		     data_blob_const(&dfc_new, sizeof(dfc_new)));
+	dfc_new.last_dfree_time = now;
+	dfree_cache_store(key_path, shared_key, dfree_cache_time, &dfc_new);
+	goto out;
+
+cached:
+	*bsize = dfc->bsize;
+	*dfree = dfc->dfree;
+	*dsize = dfc->dsize;
+	dfree_ret = dfc->dfree_ret;
 
 out:
+	TALLOC_FREE(shared_key);
 	TALLOC_FREE(to_free);
 	return dfree_ret;
 }
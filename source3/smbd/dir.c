@@ -41,6 +41,9 @@
 #define WIRE_START_OF_DIRECTORY_OFFSET ((uint32_t)0)
 #define WIRE_DOT_DOT_DIRECTORY_OFFSET ((uint32_t)0x80000000)
 
+/* Number of entries we ask SMB_VFS_READDIRPLUS() for at a time. */
+#define DIR_READDIRPLUS_BATCH 128
+
 /* Make directory handle internals available. */
 
 struct name_cache_entry {
@@ -59,6 +62,15 @@ struct smb_Dir {
 	unsigned int file_number;
 	files_struct *fsp; /* Back pointer to containing fsp, only
 			      set from OpenDir_fsp(). */
+	/*
+	 * Entries SMB_VFS_READDIRPLUS() returned that we did not hand
+	 * out yet. The underlying DIR is positioned after the last one,
+	 * offset is the position of the last one handed out.
+	 */
+	struct vfs_readdirplus_entry *plus_entries;
+	size_t num_plus_entries;
+	size_t next_plus_entry;
+	bool plus_not_supported;
 };
 
 struct dptr_struct {
@@ -74,8 +86,13 @@ struct dptr_struct {
 	bool has_wild; /* Set to true if the wcard entry has MS wildcard characters in it. */
 	bool did_stat; /* Optimisation for non-wcard searches. */
 	bool priv;     /* Directory handle opened with privilege. */
+	bool prefetched; /* Metadata prefetch was started. */
+	bool listing_cache_watched; /* Registered with dir_listing_cache. */
 	uint32_t counter;
 	struct memcache *dptr_cache;
+	struct ms_fnmatch_pattern *mask_pattern; /* compiled mask_pattern_str */
+	char *mask_pattern_str;
+	bool mask_pattern_case_sensitive;
 };
 
 static struct smb_Dir *OpenDir_fsp(TALLOC_CTX *mem_ctx, connection_struct *conn,
@@ -699,6 +716,42 @@ bool dptr_has_wild(struct dptr_struct *dptr)
 	return dptr->has_wild;
 }
 
+/****************************************************************************
+ mask_match() for all entries of a directory listing. The mask is only
+ translated and analysed once and not for every name.
+****************************************************************************/
+
+bool dptr_mask_match(struct dptr_struct *dptr,
+		     const char *string,
+		     const char *pattern,
+		     bool is_case_sensitive)
+{
+	if (ISDOT(pattern)) {
+		return false;
+	}
+
+	if ((dptr->mask_pattern == NULL) ||
+	    (dptr->mask_pattern_case_sensitive != is_case_sensitive) ||
+	    (strcmp(dptr->mask_pattern_str, pattern) != 0)) {
+		TALLOC_FREE(dptr->mask_pattern);
+		TALLOC_FREE(dptr->mask_pattern_str);
+
+		dptr->mask_pattern_str = talloc_strdup(dptr, pattern);
+		if (dptr->mask_pattern_str != NULL) {
+			dptr->mask_pattern = ms_fnmatch_compile(
+				dptr, pattern, get_Protocol(),
+				is_case_sensitive);
+		}
+		if (dptr->mask_pattern == NULL) {
+			TALLOC_FREE(dptr->mask_pattern_str);
+			return mask_match(string, pattern, is_case_sensitive);
+		}
+		dptr->mask_pattern_case_sensitive = is_case_sensitive;
+	}
+
+	return ms_fnmatch_compiled(dptr->mask_pattern, string) == 0;
+}
+
 int dptr_dnum(struct dptr_struct *dptr)
 {
 	return dptr->dnum;
@@ -714,19 +767,46 @@ void dptr_set_priv(struct dptr_struct *dptr)
 	dptr->priv = true;
 }
 
+/****************************************************************************
+ Returns true once for a directory scan that is past its first batch
+ of entries, i.e. for directories that don't fit into one reply.
+****************************************************************************/
+
+bool dptr_start_prefetch(struct dptr_struct *dptr)
+{
+	long offset;
+
+	if (dptr->prefetched) {
+		return false;
+	}
+
+	offset = TellDir(dptr->dir_hnd);
+	if ((offset == START_OF_DIRECTORY_OFFSET) ||
+	    (offset == END_OF_DIRECTORY_OFFSET)) {
+		return false;
+	}
+
+	dptr->prefetched = true;
+	return true;
+}
+
 /****************************************************************************
  Return the next visible file name, skipping veto'd and invisible files.
 ****************************************************************************/
 
-static const char *dptr_normal_ReadDirName(struct dptr_struct *dptr,
-					   long *poffset, SMB_STRUCT_STAT *pst,
-					   char **ptalloced)
+static const char *dptr_normal_ReadDirName(
+	struct dptr_struct *dptr,
+	long *poffset,
+	SMB_STRUCT_STAT *pst,
+	const struct vfs_readdirplus_entry **pplus,
+	char **ptalloced)
 {
 	/* Normal search for the next file. */
 	const char *name;
 	char *talloced = NULL;
 
-	while ((name = ReadDirName(dptr->dir_hnd, poffset, pst, &talloced))
+	while ((name = ReadDirNamePlus(dptr->dir_hnd, poffset, pst, pplus,
+				       &talloced))
 	       != NULL) {
 		if (is_visible_file(dptr->conn,
 				dptr->smb_dname->base_name,
@@ -748,7 +828,8 @@ static const char *dptr_normal_ReadDirName(struct dptr_struct *dptr,
 static char *dptr_ReadDirName(TALLOC_CTX *ctx,
 			      struct dptr_struct *dptr,
 			      long *poffset,
-			      SMB_STRUCT_STAT *pst)
+			      SMB_STRUCT_STAT *pst,
+			      const struct vfs_readdirplus_entry **pplus)
 {
 	struct smb_filename smb_fname_base;
 	char *name = NULL;
@@ -759,9 +840,10 @@ static char *dptr_ReadDirName(TALLOC_CTX *ctx,
 	int ret;
 
 	SET_STAT_INVALID(*pst);
+	*pplus = NULL;
 
 	if (dptr->has_wild || dptr->did_stat) {
-		name_temp = dptr_normal_ReadDirName(dptr, poffset, pst,
+		name_temp = dptr_normal_ReadDirName(dptr, poffset, pst, pplus,
 						    &talloced);
 		if (name_temp == NULL) {
 			return NULL;
@@ -855,7 +937,8 @@ static char *dptr_ReadDirName(TALLOC_CTX *ctx,
 
 	TALLOC_FREE(pathreal);
 
-	name_temp = dptr_normal_ReadDirName(dptr, poffset, pst, &talloced);
+	name_temp = dptr_normal_ReadDirName(dptr, poffset, pst, pplus,
+					    &talloced);
 	if (name_temp == NULL) {
 		return NULL;
 	}
@@ -1097,22 +1180,40 @@ bool smbd_dirptr_get_entry(TALLOC_CTX *ctx,
 					   void *private_data,
 					   struct smb_filename *smb_fname,
 					   bool get_dosmode,
+					   const uint32_t *vfs_dosmode,
 					   uint32_t *_mode),
 			   void *private_data,
 			   char **_fname,
 			   struct smb_filename **_smb_fname,
 			   uint32_t *_mode,
-			   long *_prev_offset)
+			   long *_prev_offset,
+			   struct file_id *_file_id)
 {
 	connection_struct *conn = dirptr->conn;
 	size_t slashlen;
 	size_t pathlen;
 	const char *dpath = dirptr->smb_dname->base_name;
 	bool dirptr_path_is_dot = ISDOT(dpath);
+	bool use_listing_cache = false;
 
 	*_smb_fname = NULL;
 	*_mode = 0;
 
+	/*
+	 * Only cache complete results, with async
+	 * dosmode the DOS attributes come later.
+	 */
+	if (get_dosmode &&
+	    VALID_STAT(dirptr->smb_dname->st) &&
+	    dir_listing_cache_enabled(conn))
+	{
+		use_listing_cache = true;
+		if (!dirptr->listing_cache_watched) {
+			dir_listing_cache_watch(conn, dpath);
+			dirptr->listing_cache_watched = true;
+		}
+	}
+
 	pathlen = strlen(dpath);
 	slashlen = ( dpath[pathlen-1] != '/') ? 1 : 0;
 
@@ -1120,6 +1221,11 @@ bool smbd_dirptr_get_entry(TALLOC_CTX *ctx,
 		long cur_offset;
 		long prev_offset;
 		SMB_STRUCT_STAT sbuf = { 0 };
+		const struct vfs_readdirplus_entry *plus = NULL;
+		bool have_vfs_dosmode = false;
+		uint32_t vfs_dosmode = 0;
+		bool have_file_id = false;
+		struct file_id file_id = { 0 };
 		char *dname = NULL;
 		bool isdots;
 		char *fname = NULL;
@@ -1130,7 +1236,7 @@ bool smbd_dirptr_get_entry(TALLOC_CTX *ctx,
 
 		cur_offset = dptr_TellDir(dirptr);
 		prev_offset = cur_offset;
-		dname = dptr_ReadDirName(ctx, dirptr, &cur_offset, &sbuf);
+		dname = dptr_ReadDirName(ctx, dirptr, &cur_offset, &sbuf, &plus);
 
 		DEBUG(6,("smbd_dirptr_get_entry: dirptr 0x%lx now at offset %ld\n",
 			(long)dirptr, cur_offset));
@@ -1139,6 +1245,18 @@ bool smbd_dirptr_get_entry(TALLOC_CTX *ctx,
 			return false;
 		}
 
+		/*
+		 * What the backend returned along with the name is only
+		 * good for the stat it came with. plus is only valid
+		 * until the next read, so take a copy.
+		 */
+		if (plus != NULL && VALID_STAT(plus->st)) {
+			have_vfs_dosmode = plus->have_dosmode;
+			vfs_dosmode = plus->dosmode;
+			have_file_id = plus->have_file_id;
+			file_id = plus->file_id;
+		}
+
 		isdots = (ISDOT(dname) || ISDOTDOT(dname));
 		if (dont_descend && !isdots) {
 			TALLOC_FREE(dname);
@@ -1191,7 +1309,27 @@ bool smbd_dirptr_get_entry(TALLOC_CTX *ctx,
 			.base_name = pathreal, .st = sbuf
 		};
 
-		ok = mode_fn(ctx, private_data, &smb_fname, get_dosmode, &mode);
+		ok = false;
+		if (use_listing_cache && !isdots) {
+			ok = dir_listing_cache_fetch(conn,
+						     &dirptr->smb_dname->st,
+						     pathreal,
+						     &smb_fname.st,
+						     &mode);
+		}
+		if (!ok) {
+			ok = mode_fn(ctx, private_data, &smb_fname,
+				     get_dosmode,
+				     have_vfs_dosmode ? &vfs_dosmode : NULL,
+				     &mode);
+			if (ok && use_listing_cache && !isdots) {
+				dir_listing_cache_store(conn,
+							&dirptr->smb_dname->st,
+							pathreal,
+							&smb_fname.st,
+							mode);
+			}
+		}
 		if (!ok) {
 			TALLOC_FREE(dname);
 			TALLOC_FREE(fname);
@@ -1208,13 +1346,21 @@ bool smbd_dirptr_get_entry(TALLOC_CTX *ctx,
 			continue;
 		}
 
+		/*
+		 * mode_fn might have re-stat'ed, only use the backend's
+		 * file_id if the stat is still the one it came with.
+		 */
+		if ((ask_sharemode || _file_id != NULL) &&
+		    (!have_file_id ||
+		     smb_fname.st.st_ex_dev != sbuf.st_ex_dev ||
+		     smb_fname.st.st_ex_ino != sbuf.st_ex_ino)) {
+			file_id = vfs_file_id_from_sbuf(conn, &smb_fname.st);
+		}
+
 		if (ask_sharemode) {
 			struct timespec write_time_ts;
-			struct file_id fileid;
 
-			fileid = vfs_file_id_from_sbuf(conn,
-						       &smb_fname.st);
-			get_file_infos(fileid, 0, NULL, &write_time_ts);
+			get_file_infos(file_id, 0, NULL, &write_time_ts);
 			if (!null_timespec(write_time_ts)) {
 				update_stat_ex_mtime(&smb_fname.st,
 						     write_time_ts);
@@ -1246,6 +1392,9 @@ bool smbd_dirptr_get_entry(TALLOC_CTX *ctx,
 		*_fname = fname;
 		*_mode = mode;
 		*_prev_offset = prev_offset;
+		if (_file_id != NULL) {
+			*_file_id = file_id;
+		}
 
 		return true;
 	}
@@ -1321,10 +1470,16 @@ static bool smbd_dirptr_8_3_mode_fn(TALLOC_CTX *ctx,
 				    void *private_data,
 				    struct smb_filename *smb_fname,
 				    bool get_dosmode,
+				    const uint32_t *vfs_dosmode,
 				    uint32_t *_mode)
 {
 	connection_struct *conn = (connection_struct *)private_data;
 
+	if (vfs_dosmode != NULL) {
+		*_mode = dos_mode_readdirplus(conn, smb_fname, *vfs_dosmode);
+		return true;
+	}
+
 	if (!VALID_STAT(smb_fname->st)) {
 		if ((SMB_VFS_STAT(conn, smb_fname)) != 0) {
 			DEBUG(5,("smbd_dirptr_8_3_mode_fn: "
@@ -1371,7 +1526,8 @@ bool get_dir_entry(TALLOC_CTX *ctx,
 				   &fname,
 				   &smb_fname,
 				   &mode,
-				   &prev_offset);
+				   &prev_offset,
+				   NULL);
 	if (!ok) {
 		return false;
 	}
@@ -1863,6 +2019,69 @@ static struct smb_Dir *OpenDir_fsp(TALLOC_CTX *mem_ctx, connection_struct *conn,
 }
 
 
+/*******************************************************************
+ Forget the entries SMB_VFS_READDIRPLUS() returned, needed whenever
+ the underlying DIR is repositioned.
+********************************************************************/
+
+static void DirDropPlusEntries(struct smb_Dir *dirp)
+{
+	TALLOC_FREE(dirp->plus_entries);
+	dirp->num_plus_entries = 0;
+	dirp->next_plus_entry = 0;
+}
+
+/*******************************************************************
+ Return the next entry from SMB_VFS_READDIRPLUS(), fetching a new
+ batch only if asked to. Returns NULL with *pend_of_dir == false if
+ the caller has to fall back to SMB_VFS_READDIR().
+********************************************************************/
+
+static const struct vfs_readdirplus_entry *DirNextPlusEntry(
+	struct smb_Dir *dirp, bool refill, bool *pend_of_dir)
+{
+	NTSTATUS status;
+
+	*pend_of_dir = false;
+
+	if (dirp->next_plus_entry < dirp->num_plus_entries) {
+		return &dirp->plus_entries[dirp->next_plus_entry++];
+	}
+
+	DirDropPlusEntries(dirp);
+
+	if (!refill || dirp->plus_not_supported) {
+		return NULL;
+	}
+
+	status = SMB_VFS_READDIRPLUS(dirp->conn,
+				     dirp->dir,
+				     dirp,
+				     DIR_READDIRPLUS_BATCH,
+				     &dirp->plus_entries,
+				     &dirp->num_plus_entries);
+	if (NT_STATUS_EQUAL(status, NT_STATUS_NOT_IMPLEMENTED) ||
+	    NT_STATUS_EQUAL(status, NT_STATUS_NOT_SUPPORTED)) {
+		dirp->plus_not_supported = true;
+		DirDropPlusEntries(dirp);
+		return NULL;
+	}
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_DEBUG("SMB_VFS_READDIRPLUS failed: %s\n",
+			  nt_errstr(status));
+		DirDropPlusEntries(dirp);
+		*pend_of_dir = true;
+		return NULL;
+	}
+	if (dirp->num_plus_entries == 0) {
+		DirDropPlusEntries(dirp);
+		*pend_of_dir = true;
+		return NULL;
+	}
+
+	return &dirp->plus_entries[dirp->next_plus_entry++];
+}
+
 /*******************************************************************
  Read from a directory.
  Return directory entry, current offset, and optional stat information.
@@ -1871,11 +2090,30 @@ static struct smb_Dir *OpenDir_fsp(TALLOC_CTX *mem_ctx, connection_struct *conn,
 
 const char *ReadDirName(struct smb_Dir *dirp, long *poffset,
 			SMB_STRUCT_STAT *sbuf, char **ptalloced)
+{
+	return ReadDirNamePlus(dirp, poffset, sbuf, NULL, ptalloced);
+}
+
+/*******************************************************************
+ Like ReadDirName(), but read the directory in batches via
+ SMB_VFS_READDIRPLUS() if pplus is given. *pplus is set to the entry
+ the backend returned, or NULL if there is none. It is only valid
+ until the next call.
+********************************************************************/
+
+const char *ReadDirNamePlus(struct smb_Dir *dirp, long *poffset,
+			    SMB_STRUCT_STAT *sbuf,
+			    const struct vfs_readdirplus_entry **pplus,
+			    char **ptalloced)
 {
 	const char *n;
 	char *talloced = NULL;
 	connection_struct *conn = dirp->conn;
 
+	if (pplus != NULL) {
+		*pplus = NULL;
+	}
+
 	/* Cheat to allow . and .. to be the first entries returned. */
 	if (((*poffset == START_OF_DIRECTORY_OFFSET) ||
 	     (*poffset == DOT_DOT_DIRECTORY_OFFSET)) && (dirp->file_number < 2))
@@ -1900,7 +2138,30 @@ const char *ReadDirName(struct smb_Dir *dirp, long *poffset,
 	/* A real offset, seek to it. */
 	SeekDir(dirp, *poffset);
 
-	while ((n = vfs_readdirname(conn, dirp->dir, sbuf, &talloced))) {
+	while (true) {
+		const struct vfs_readdirplus_entry *plus = NULL;
+		bool end_of_dir = false;
+
+		/*
+		 * Hand out what's left of a batch even if we're not
+		 * asked for it, the DIR is already positioned after it.
+		 */
+		plus = DirNextPlusEntry(dirp, pplus != NULL, &end_of_dir);
+		if (plus != NULL) {
+			n = vfs_readdirname_translate(conn, plus->name,
+						      &talloced);
+			if (sbuf != NULL) {
+				*sbuf = plus->st;
+			}
+		} else if (end_of_dir) {
+			n = NULL;
+		} else {
+			n = vfs_readdirname(conn, dirp->dir, sbuf, &talloced);
+		}
+		if (n == NULL) {
+			break;
+		}
+
 		/* Ignore . and .. - we've already returned them. */
 		if (*n == '.') {
 			if ((n[1] == '\0') || (n[1] == '.' && n[2] == '\0')) {
@@ -1908,7 +2169,15 @@ const char *ReadDirName(struct smb_Dir *dirp, long *poffset,
 				continue;
 			}
 		}
-		*poffset = dirp->offset = SMB_VFS_TELLDIR(conn, dirp->dir);
+		if (plus != NULL) {
+			*poffset = dirp->offset = plus->offset;
+		} else {
+			*poffset = dirp->offset = SMB_VFS_TELLDIR(conn,
+								  dirp->dir);
+		}
+		if (pplus != NULL) {
+			*pplus = plus;
+		}
 		*ptalloced = talloced;
 		dirp->file_number++;
 		return n;
@@ -1924,6 +2193,7 @@ const char *ReadDirName(struct smb_Dir *dirp, long *poffset,
 
 void RewindDir(struct smb_Dir *dirp, long *poffset)
 {
+	DirDropPlusEntries(dirp);
 	SMB_VFS_REWINDDIR(dirp->conn, dirp->dir);
 	dirp->file_number = 0;
 	dirp->offset = START_OF_DIRECTORY_OFFSET;
@@ -1955,8 +2225,10 @@ void SeekDir(struct smb_Dir *dirp, long offset)
 			 */
 			dirp->file_number = 2;
 		} else if (offset == END_OF_DIRECTORY_OFFSET) {
-			; /* Don't seek in this case. */
+			/* Don't seek in this case. */
+			DirDropPlusEntries(dirp);
 		} else {
+			DirDropPlusEntries(dirp);
 			SMB_VFS_SEEKDIR(dirp->conn, dirp->dir, offset);
 		}
 		dirp->offset = offset;
@@ -2034,6 +2306,7 @@ bool SearchDir(struct smb_Dir *dirp, const char *name, long *poffset)
 	}
 
 	/* Not found in the name cache. Rewind directory and start from scratch. */
+	DirDropPlusEntries(dirp);
 	SMB_VFS_REWINDDIR(conn, dirp->dir);
 	dirp->file_number = 0;
 	*poffset = START_OF_DIRECTORY_OFFSET;
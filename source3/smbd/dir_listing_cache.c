@@ -0,0 +1,402 @@
+/*
+   Unix SMB/CIFS implementation.
+   Node wide cache of directory listing metadata
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "includes.h"
+#include "system/filesys.h"
+#include "smbd/smbd.h"
+#include "smbd/globals.h"
+#include "dbwrap/dbwrap.h"
+#include "dbwrap/dbwrap_open.h"
+#include "util_tdb.h"
+#include "librpc/gen_ndr/notify.h"
+
+/*
+ * With "smbd dir cache timeout" set, the stat information and DOS
+ * attributes that SMB2 directory listings compute for every entry
+ * are kept in dir_listing_cache.tdb in the lock directory. Listings
+ * of the same directory by any smbd on the node then don't have to
+ * ask the filesystem again.
+ *
+ * The keys are the share name and the absolute path of the entry.
+ * The values carry the identity of the directory they were listed
+ * in, so a replaced directory never sees the entries of its
+ * predecessor, and the time they were added.
+ *
+ * Entries are removed
+ *
+ * - synchronously by notify_fname() for changes done by this smbd,
+ *
+ * - by every smbd that listed a directory from the cache, through a
+ *   watch registered with notifyd, for changes done by other smbds
+ *   and, with "kernel change notify", by local processes,
+ *
+ * - after "smbd dir cache timeout" seconds in any case, this bounds
+ *   the time changes that nobody notices (other cluster nodes,
+ *   writes to files that are still open) might be hidden.
+ */
+
+#define DIR_LISTING_CACHE_ENTRIES_KEY "ENTRIES"
+#define DIR_LISTING_CACHE_MAX_ENTRIES (256*1024)
+#define DIR_LISTING_CACHE_MAX_WATCHES 64
+#define DIR_LISTING_CACHE_HASH_SIZE 100003
+#define DIR_LISTING_CACHE_COUNT_BATCH 64
+
+struct dir_listing_cache_value {
+	uint64_t dir_dev;
+	uint64_t dir_ino;
+	struct timespec added;
+	uint32_t mode;
+	SMB_STRUCT_STAT st;
+};
+
+struct dir_listing_watch {
+	struct dir_listing_watch *prev, *next;
+	struct notify_context *notify_ctx;
+	char *service;
+	char *path;
+};
+
+static struct db_context *dir_listing_cache_db;
+static struct dir_listing_watch *dir_listing_watches;
+static size_t dir_listing_num_watches;
+static uint32_t dir_listing_cache_uncounted;
+
+bool dir_listing_cache_init(void)
+{
+	char *db_path = NULL;
+
+	if (dir_listing_cache_db != NULL) {
+		return true;
+	}
+
+	db_path = lock_path(talloc_tos(), "dir_listing_cache.tdb");
+	if (db_path == NULL) {
+		return false;
+	}
+
+	dir_listing_cache_db = db_open(NULL, db_path,
+				       DIR_LISTING_CACHE_HASH_SIZE,
+				       TDB_DEFAULT|TDB_VOLATILE|
+				       TDB_CLEAR_IF_FIRST|
+				       TDB_INCOMPATIBLE_HASH,
+				       O_RDWR|O_CREAT, 0644,
+				       DBWRAP_LOCK_ORDER_3, DBWRAP_FLAG_NONE);
+	TALLOC_FREE(db_path);
+	if (dir_listing_cache_db == NULL) {
+		DBG_ERR("Failed to open the directory listing cache\n");
+		return false;
+	}
+
+	return true;
+}
+
+bool dir_listing_cache_enabled(connection_struct *conn)
+{
+	if (dir_listing_cache_db == NULL) {
+		return false;
+	}
+	if (!conn->sconn->using_smb2) {
+		/*
+		 * The SMB1 UNIX info levels lstat()
+		 * instead of stat()ing the entries.
+		 */
+		return false;
+	}
+	if (lp_map_readonly(SNUM(conn)) == MAP_READONLY_PERMISSIONS) {
+		/* The DOS attributes depend on the user */
+		return false;
+	}
+	return true;
+}
+
+static char *dir_listing_cache_key(TALLOC_CTX *mem_ctx,
+				   const char *service,
+				   const char *dir,
+				   const char *name)
+{
+	return talloc_asprintf(mem_ctx, "%s:%s/%s", service, dir, name);
+}
+
+static char *dir_listing_cache_conn_key(TALLOC_CTX *mem_ctx,
+					connection_struct *conn,
+					const char *name)
+{
+	return dir_listing_cache_key(mem_ctx,
+				     lp_const_servicename(SNUM(conn)),
+				     conn->connectpath,
+				     name);
+}
+
+/*
+ * Make sure changes in dirpath (relative to the share) done by other
+ * processes remove the cached entries.
+ */
+void dir_listing_cache_watch(connection_struct *conn, const char *dirpath)
+{
+	struct notify_context *notify_ctx = conn->sconn->notify_ctx;
+	const char *service = lp_const_servicename(SNUM(conn));
+	struct dir_listing_watch *w = NULL;
+	char *path = NULL;
+	NTSTATUS status;
+
+	if (notify_ctx == NULL) {
+		return;
+	}
+
+	if (ISDOT(dirpath)) {
+		path = talloc_strdup(talloc_tos(), conn->connectpath);
+	} else {
+		path = talloc_asprintf(talloc_tos(), "%s/%s",
+				       conn->connectpath, dirpath);
+	}
+	if (path == NULL) {
+		return;
+	}
+
+	for (w = dir_listing_watches; w != NULL; w = w->next) {
+		if ((strcmp(w->path, path) == 0) &&
+		    (strcmp(w->service, service) == 0)) {
+			DLIST_PROMOTE(dir_listing_watches, w);
+			TALLOC_FREE(path);
+			return;
+		}
+	}
+
+	w = talloc_zero(NULL, struct dir_listing_watch);
+	if (w == NULL) {
+		TALLOC_FREE(path);
+		return;
+	}
+	w->notify_ctx = notify_ctx;
+	w->path = talloc_move(w, &path);
+	w->service = talloc_strdup(w, service);
+	if (w->service == NULL) {
+		TALLOC_FREE(w);
+		return;
+	}
+
+	status = notify_add(notify_ctx, w->path, FILE_NOTIFY_CHANGE_ALL, 0, w);
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_DEBUG("notify_add for %s failed: %s\n",
+			  w->path, nt_errstr(status));
+		TALLOC_FREE(w);
+		return;
+	}
+
+	DLIST_ADD(dir_listing_watches, w);
+	dir_listing_num_watches += 1;
+
+	if (dir_listing_num_watches > DIR_LISTING_CACHE_MAX_WATCHES) {
+		struct dir_listing_watch *last = DLIST_TAIL(
+			dir_listing_watches);
+
+		(void)notify_remove(last->notify_ctx, last, last->path);
+		DLIST_REMOVE(dir_listing_watches, last);
+		dir_listing_num_watches -= 1;
+		TALLOC_FREE(last);
+	}
+}
+
+/*
+ * Called for every notify event, returns true if it was meant for
+ * one of our watches.
+ */
+bool dir_listing_cache_notify(void *private_data,
+			      const struct notify_event *e)
+{
+	struct dir_listing_watch *w = NULL;
+	char *key = NULL;
+
+	for (w = dir_listing_watches; w != NULL; w = w->next) {
+		if (w == private_data) {
+			break;
+		}
+	}
+	if (w == NULL) {
+		return false;
+	}
+
+	if (dir_listing_cache_db == NULL) {
+		return true;
+	}
+
+	/*
+	 * e->path is relative to the watched directory
+	 */
+	key = dir_listing_cache_key(talloc_tos(), w->service, w->path, e->path);
+	if (key == NULL) {
+		return true;
+	}
+	DBG_DEBUG("Dropping %s\n", key);
+	dbwrap_delete(dir_listing_cache_db, string_tdb_data(key));
+	TALLOC_FREE(key);
+	return true;
+}
+
+/*
+ * path is relative to the share, called from notify_fname()
+ */
+void dir_listing_cache_delete(connection_struct *conn, const char *path)
+{
+	char *key = NULL;
+
+	if (dir_listing_cache_db == NULL) {
+		return;
+	}
+
+	key = dir_listing_cache_conn_key(talloc_tos(), conn, path);
+	if (key == NULL) {
+		return;
+	}
+	dbwrap_delete(dir_listing_cache_db, string_tdb_data(key));
+	TALLOC_FREE(key);
+}
+
+struct dir_listing_cache_fetch_state {
+	const SMB_STRUCT_STAT *dir_st;
+	SMB_STRUCT_STAT *st;
+	uint32_t *mode;
+	bool found;
+};
+
+static void dir_listing_cache_fetch_parser(TDB_DATA key, TDB_DATA data,
+					   void *private_data)
+{
+	struct dir_listing_cache_fetch_state *state = private_data;
+	struct dir_listing_cache_value v;
+	struct timespec now;
+	int timeout = lp_smbd_dir_cache_timeout();
+
+	if (data.dsize != sizeof(v)) {
+		return;
+	}
+	memcpy(&v, data.dptr, sizeof(v));
+
+	if ((v.dir_dev != state->dir_st->st_ex_dev) ||
+	    (v.dir_ino != state->dir_st->st_ex_ino)) {
+		return;
+	}
+
+	clock_gettime_mono(&now);
+	if (timespec_elapsed2(&v.added, &now) >= timeout) {
+		return;
+	}
+
+	*state->st = v.st;
+	*state->mode = v.mode;
+	state->found = true;
+}
+
+/*
+ * name is relative to the share, dir_st is the stat of the directory
+ * being listed.
+ */
+bool dir_listing_cache_fetch(connection_struct *conn,
+			     const SMB_STRUCT_STAT *dir_st,
+			     const char *name,
+			     SMB_STRUCT_STAT *st,
+			     uint32_t *mode)
+{
+	struct dir_listing_cache_fetch_state state = {
+		.dir_st = dir_st, .st = st, .mode = mode,
+	};
+	char *key = NULL;
+	NTSTATUS status;
+
+	key = dir_listing_cache_conn_key(talloc_tos(), conn, name);
+	if (key == NULL) {
+		return false;
+	}
+
+	status = dbwrap_parse_record(dir_listing_cache_db,
+				     string_tdb_data(key),
+				     dir_listing_cache_fetch_parser,
+				     &state);
+	TALLOC_FREE(key);
+	if (!NT_STATUS_IS_OK(status)) {
+		return false;
+	}
+
+	return state.found;
+}
+
+void dir_listing_cache_store(connection_struct *conn,
+			     const SMB_STRUCT_STAT *dir_st,
+			     const char *name,
+			     const SMB_STRUCT_STAT *st,
+			     uint32_t mode)
+{
+	struct dir_listing_cache_value v = {
+		.dir_dev = dir_st->st_ex_dev,
+		.dir_ino = dir_st->st_ex_ino,
+		.mode = mode,
+		.st = *st,
+	};
+	char *key = NULL;
+	uint32_t entries = 0;
+	NTSTATUS status;
+
+	key = dir_listing_cache_conn_key(talloc_tos(), conn, name);
+	if (key == NULL) {
+		return;
+	}
+	clock_gettime_mono(&v.added);
+
+	status = dbwrap_store(dir_listing_cache_db, string_tdb_data(key),
+			      make_tdb_data((uint8_t *)&v, sizeof(v)),
+			      TDB_INSERT);
+	if (NT_STATUS_EQUAL(status, NT_STATUS_OBJECT_NAME_COLLISION)) {
+		status = dbwrap_store(dir_listing_cache_db,
+				      string_tdb_data(key),
+				      make_tdb_data((uint8_t *)&v, sizeof(v)),
+				      TDB_REPLACE);
+		TALLOC_FREE(key);
+		return;
+	}
+	TALLOC_FREE(key);
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_DEBUG("Could not store %s: %s\n", name, nt_errstr(status));
+		return;
+	}
+
+	/*
+	 * Like the shared stat cache, the entry count only needs
+	 * to be roughly right, it's not locked and only updated
+	 * every DIR_LISTING_CACHE_COUNT_BATCH new entries.
+	 */
+	dir_listing_cache_uncounted += 1;
+	if (dir_listing_cache_uncounted < DIR_LISTING_CACHE_COUNT_BATCH) {
+		return;
+	}
+
+	(void)dbwrap_fetch_uint32_bystring(dir_listing_cache_db,
+					   DIR_LISTING_CACHE_ENTRIES_KEY,
+					   &entries);
+	entries += dir_listing_cache_uncounted;
+	dir_listing_cache_uncounted = 0;
+
+	if (entries > DIR_LISTING_CACHE_MAX_ENTRIES) {
+		DBG_INFO("Directory listing cache full, wiping it\n");
+		dbwrap_wipe(dir_listing_cache_db);
+	} else {
+		(void)dbwrap_store_uint32_bystring(
+			dir_listing_cache_db,
+			DIR_LISTING_CACHE_ENTRIES_KEY,
+			entries);
+	}
+}
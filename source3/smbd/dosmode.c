@@ -27,6 +27,7 @@
 #include "smbd/smbd.h"
 #include "lib/param/loadparm.h"
 #include "lib/util/tevent_ntstatus.h"
+#include "lib/util/memcache.h"
 
 static NTSTATUS get_file_handle_for_metadata(connection_struct *conn,
 				const struct smb_filename *smb_fname,
@@ -344,6 +345,167 @@ NTSTATUS parse_dos_attribute_blob(struct smb_filename *smb_fname,
 	return NT_STATUS_OK;
 }
 
+/*
+ * Cache of parsed DOS attribute xattrs
+ *
+ * Entries are keyed by file_id and ctime. Writing the DOSATTRIB xattr
+ * moves the ctime of a file, so a changed xattr is simply not found
+ * anymore. This requires xattrs being stored in the file system, with
+ * vfs_xattr_tdb and friends the cache must not be enabled.
+ */
+
+static struct memcache *dos_attribute_cache;
+static bool dos_attribute_cache_initialized;
+
+struct dos_attribute_cache_key {
+	struct file_id id;
+	struct timespec ctime;
+};
+
+struct dos_attribute_cache_value {
+	uint32_t attr;
+	bool have_btime;
+	struct timespec btime;
+};
+
+/* Rough per entry overhead of memcache, see memcache_element_size() */
+#define DOS_ATTRIBUTE_CACHE_ENTRY_OVERHEAD 64
+
+static struct memcache *dos_attribute_cache_get(void)
+{
+	int max_entries;
+
+	if (dos_attribute_cache_initialized) {
+		return dos_attribute_cache;
+	}
+	dos_attribute_cache_initialized = true;
+
+	max_entries = lp_smbd_dosmode_cache_entries();
+	if (max_entries <= 0) {
+		return NULL;
+	}
+
+	dos_attribute_cache = memcache_init(
+		NULL,
+		(size_t)max_entries *
+		(sizeof(struct dos_attribute_cache_key) +
+		 sizeof(struct dos_attribute_cache_value) +
+		 DOS_ATTRIBUTE_CACHE_ENTRY_OVERHEAD));
+	if (dos_attribute_cache == NULL) {
+		DBG_ERR("memcache_init failed\n");
+	}
+
+	return dos_attribute_cache;
+}
+
+static bool dos_attribute_cache_key(connection_struct *conn,
+				    const struct smb_filename *smb_fname,
+				    struct dos_attribute_cache_key *key)
+{
+	const SMB_STRUCT_STAT *st = &smb_fname->st;
+	struct timespec now;
+
+	if (dos_attribute_cache_get() == NULL || !VALID_STAT(*st)) {
+		return false;
+	}
+
+	now = timespec_current();
+	if (timespec_too_recent(&st->st_ex_ctime, &now)) {
+		return false;
+	}
+
+	ZERO_STRUCTP(key);
+	key->id = vfs_file_id_from_sbuf(conn, st);
+	key->ctime = st->st_ex_ctime;
+
+	return true;
+}
+
+/****************************************************************************
+ Look up the DOS attributes of a file in the cache. On a hit, the attributes
+ are added to *pattr and the stored create time is pulled into smb_fname.
+****************************************************************************/
+
+bool dos_attribute_cache_fetch(connection_struct *conn,
+			       struct smb_filename *smb_fname,
+			       uint32_t *pattr)
+{
+	struct dos_attribute_cache_key key;
+	struct dos_attribute_cache_value v;
+	DATA_BLOB value;
+	bool ok;
+
+	ok = dos_attribute_cache_key(conn, smb_fname, &key);
+	if (!ok) {
+		return false;
+	}
+
+	ok = memcache_lookup(dos_attribute_cache,
+			     DOS_ATTRIBUTE_CACHE,
+			     data_blob_const(&key, sizeof(key)),
+			     &value);
+	if (!ok || value.length != sizeof(v)) {
+		return false;
+	}
+	memcpy(&v, value.data, sizeof(v));
+
+	if (v.have_btime) {
+		update_stat_ex_create_time(&smb_fname->st, v.btime);
+	}
+	*pattr |= v.attr;
+
+	dos_mode_debug_print(__func__, *pattr);
+
+	return true;
+}
+
+/****************************************************************************
+ Remember the attributes parse_dos_attribute_blob() returned for a file
+ together with its create time.
+****************************************************************************/
+
+void dos_attribute_cache_store(connection_struct *conn,
+			       const struct smb_filename *smb_fname,
+			       uint32_t attr)
+{
+	struct dos_attribute_cache_key key;
+	struct dos_attribute_cache_value v;
+	bool ok;
+
+	ok = dos_attribute_cache_key(conn, smb_fname, &key);
+	if (!ok) {
+		return;
+	}
+
+	ZERO_STRUCT(v);
+	v.attr = attr;
+	if (!smb_fname->st.st_ex_calculated_birthtime) {
+		v.have_btime = true;
+		v.btime = smb_fname->st.st_ex_btime;
+	}
+
+	memcache_add(dos_attribute_cache,
+		     DOS_ATTRIBUTE_CACHE,
+		     data_blob_const(&key, sizeof(key)),
+		     data_blob_const(&v, sizeof(v)));
+}
+
+static void dos_attribute_cache_delete(connection_struct *conn,
+				       const struct smb_filename *smb_fname)
+{
+	struct dos_attribute_cache_key key;
+	bool ok;
+
+	ok = dos_attribute_cache_key(conn, smb_fname, &key);
+	if (!ok) {
+		return;
+	}
+
+	memcache_delete(dos_attribute_cache,
+			DOS_ATTRIBUTE_CACHE,
+			data_blob_const(&key, sizeof(key)));
+}
+
 NTSTATUS get_ea_dos_attribute(connection_struct *conn,
 			      struct smb_filename *smb_fname,
 			      uint32_t *pattr)
@@ -351,6 +513,7 @@ NTSTATUS get_ea_dos_attribute(connection_struct *conn,
 	DATA_BLOB blob;
 	ssize_t sizeret;
 	fstring attrstr;
+	uint32_t attr = 0;
 	NTSTATUS status;
 
 	if (!lp_store_dos_attributes(SNUM(conn))) {
@@ -360,6 +523,10 @@ NTSTATUS get_ea_dos_attribute(connection_struct *conn,
 	/* Don't reset pattr to zero as we may already have filename-based attributes we
 	   need to preserve. */
 
+	if (dos_attribute_cache_fetch(conn, smb_fname, pattr)) {
+		return NT_STATUS_OK;
+	}
+
 	sizeret = SMB_VFS_GETXATTR(conn, smb_fname,
 				   SAMBA_XATTR_DOS_ATTRIB, attrstr,
 				   sizeof(attrstr));
@@ -409,11 +576,14 @@ NTSTATUS get_ea_dos_attribute(connection_struct *conn,
 	blob.data = (uint8_t *)attrstr;
 	blob.length = sizeret;
 
-	status = parse_dos_attribute_blob(smb_fname, blob, pattr);
+	status = parse_dos_attribute_blob(smb_fname, blob, &attr);
 	if (!NT_STATUS_IS_OK(status)) {
 		return status;
 	}
 
+	dos_attribute_cache_store(conn, smb_fname, attr);
+	*pattr |= attr;
+
 	return NT_STATUS_OK;
 }
 
@@ -441,6 +611,12 @@ NTSTATUS set_ea_dos_attribute(connection_struct *conn,
 	 */
 	dosmode &= ~FILE_ATTRIBUTE_OFFLINE;
 
+	/*
+	 * The new xattr moves the ctime, there's no point in keeping
+	 * the entry for the old one around.
+	 */
+	dos_attribute_cache_delete(conn, smb_fname);
+
 	ZERO_STRUCT(dosattrib);
 	ZERO_STRUCT(blob);
 
@@ -752,6 +928,24 @@ uint32_t dos_mode(connection_struct *conn, struct smb_filename *smb_fname)
 	return result;
 }
 
+/****************************************************************************
+ Like dos_mode(), but with the DOS attributes SMB_VFS_READDIRPLUS()
+ already returned for this directory entry.
+****************************************************************************/
+
+uint32_t dos_mode_readdirplus(connection_struct *conn,
+			      struct smb_filename *smb_fname,
+			      uint32_t dosmode)
+{
+	DEBUG(8,("dos_mode_readdirplus: %s\n", smb_fname_str_dbg(smb_fname)));
+
+	if (!VALID_STAT(smb_fname->st)) {
+		return 0;
+	}
+
+	return dos_mode_post(dosmode, conn, smb_fname, __func__);
+}
+
 struct dos_mode_at_state {
 	files_struct *dir_fsp;
 	struct smb_filename *smb_fname;
@@ -511,6 +511,42 @@ static bool vfs_default_durable_reconnect_check_stat(
 	return true;
 }
 
+struct durable_reconnect_state {
+	struct share_mode_entry e;
+	bool found;
+};
+
+static bool durable_reconnect_fn(
+	struct share_mode_entry *e,
+	bool *modified,
+	void *private_data)
+{
+	struct durable_reconnect_state *state = private_data;
+
+	state->e = *e;
+	state->found = true;
+	return true;
+}
+
+struct durable_reconnect_entry_state {
+	struct server_id pid;
+	uint64_t mid;
+	uint64_t share_file_id;
+};
+
+static void durable_reconnect_entry_fn(struct share_mode_entry *e,
+				       size_t num_share_modes,
+				       bool *modified,
+				       void *private_data)
+{
+	struct durable_reconnect_entry_state *state = private_data;
+
+	e->pid = state->pid;
+	e->op_mid = state->mid;
+	e->share_file_id = state->share_file_id;
+	*modified = true;
+}
+
 NTSTATUS vfs_default_durable_reconnect(struct connection_struct *conn,
 				       struct smb_request *smb1req,
 				       struct smbXsrv_open *op,
@@ -520,7 +556,9 @@ NTSTATUS vfs_default_durable_reconnect(struct connection_struct *conn,
 				       DATA_BLOB *new_cookie)
 {
 	struct share_mode_lock *lck;
-	struct share_mode_entry *e;
+	struct durable_reconnect_state rstate = { .found = false };
+	struct durable_reconnect_entry_state estate;
+	struct share_mode_entry *e = &rstate.e;
 	struct files_struct *fsp = NULL;
 	NTSTATUS status;
 	bool ok;
@@ -629,7 +667,12 @@ NTSTATUS vfs_default_durable_reconnect(struct connection_struct *conn,
 		return NT_STATUS_OBJECT_NAME_NOT_FOUND;
 	}
 
-	e = &lck->data->share_modes[0];
+	ok = share_mode_forall_entries(lck, durable_reconnect_fn, &rstate);
+	if (!ok || !rstate.found) {
+		DBG_WARNING("share_mode_forall_entries failed\n");
+		TALLOC_FREE(lck);
+		return NT_STATUS_INTERNAL_DB_ERROR;
+	}
 
 	if (!server_id_is_disconnected(&e->pid)) {
 		DEBUG(5, ("vfs_default_durable_reconnect: denying durable "
@@ -673,7 +716,7 @@ NTSTATUS vfs_default_durable_reconnect(struct connection_struct *conn,
 
 	fsp->fh->private_options = e->private_options;
 	fsp->fh->gen_id = smbXsrv_open_hash(op);
-	fsp->file_id = file_id;
+	fsp_set_file_id(fsp, file_id);
 	fsp->file_pid = smb1req->smbpid;
 	fsp->vuid = smb1req->vuid;
 	fsp->open_time = e->time;
@@ -748,9 +791,23 @@ NTSTATUS vfs_default_durable_reconnect(struct connection_struct *conn,
 	op->compat = fsp;
 	fsp->op = op;
 
-	e->pid = messaging_server_id(conn->sconn->msg_ctx);
-	e->op_mid = smb1req->mid;
-	e->share_file_id = fsp->fh->gen_id;
+	estate = (struct durable_reconnect_entry_state) {
+		.pid = messaging_server_id(conn->sconn->msg_ctx),
+		.mid = smb1req->mid,
+		.share_file_id = fsp->fh->gen_id,
+	};
+	ok = share_mode_entry_do(lck,
+				 e->pid,
+				 e->share_file_id,
+				 durable_reconnect_entry_fn,
+				 &estate);
+	if (!ok) {
+		DBG_WARNING("share_mode_entry_do failed\n");
+		TALLOC_FREE(lck);
+		op->compat = NULL;
+		fsp_free(fsp);
+		return NT_STATUS_INTERNAL_ERROR;
+	}
 
 	ok = brl_reconnect_disconnected(fsp);
 	if (!ok) {
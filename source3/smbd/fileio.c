@@ -305,6 +305,26 @@ void mark_file_modified(files_struct *fsp)
 			 dosmode | FILE_ATTRIBUTE_ARCHIVE, NULL, false);
 }
 
+/****************************************************************************
+ The write cache belongs to a single fsp. It can only be used while no other
+ handle sees the file data: with an exclusive oplock, or a lease with write
+ caching that no other handle in this smbd shares.
+****************************************************************************/
+
+static bool write_cache_allowed(files_struct *fsp)
+{
+	if (EXCLUSIVE_OPLOCK_TYPE(fsp->oplock_type)) {
+		return true;
+	}
+	if (fsp->oplock_type != LEASE_OPLOCK) {
+		return false;
+	}
+	if (fsp->lease->ref_count != 1) {
+		return false;
+	}
+	return (fsp->lease->lease.lease_state & SMB2_LEASE_WRITE) != 0;
+}
+
 /****************************************************************************
  Write to a file.
 ****************************************************************************/
@@ -338,16 +358,17 @@ ssize_t write_file(struct smb_request *req,
 
 	/*
 	 * If this is the first write and we have an exclusive oplock
-	 * then setup the write cache.
+	 * or an unshared write lease then setup the write cache.
 	 */
 
 	if (!fsp->modified &&
-	    EXCLUSIVE_OPLOCK_TYPE(fsp->oplock_type) &&
+	    write_cache_allowed(fsp) &&
 	    (wcp == NULL)) {
 		/*
-		 * Note: no write cache with leases!
-		 * as the handles would have to share the write cache
-		 * that's possible but an improvement for another day...
+		 * Note: handles sharing a lease would have to share
+		 * the write cache. That's possible but an improvement
+		 * for another day, find_fsp_lease() flushes the cache
+		 * when a second handle joins the lease.
 		 */
 		setup_write_cache(fsp, fsp->fsp_name->st.st_ex_size);
 		wcp = fsp->wcp;
@@ -1066,6 +1087,15 @@ NTSTATUS sync_file(connection_struct *conn, files_struct *fsp, bool write_throug
 		if (ret == -1) {
 			return map_nt_error_from_unix(errno);
 		}
+	} else if (write_through) {
+		/*
+		 * Without strict sync we don't fsync, but write through
+		 * data must at least not stay in our write cache.
+		 */
+		int ret = flush_write_cache(fsp, SAMBA_SYNC_FLUSH);
+		if (ret == -1) {
+			return map_nt_error_from_unix(errno);
+		}
 	}
 	return NT_STATUS_OK;
 }
@@ -699,7 +699,7 @@ NTSTATUS unix_convert(TALLOC_CTX *ctx,
 				goto fail;
 			}
 			/* Add the path (not including the stream) to the cache. */
-			stat_cache_add(orig_path, smb_fname->base_name,
+			stat_cache_add(conn, orig_path, smb_fname->base_name,
 				       conn->case_sensitive);
 			DEBUG(5,("conversion of base_name finished %s -> %s\n",
 				 orig_path, smb_fname->base_name));
@@ -1207,7 +1207,7 @@ NTSTATUS unix_convert(TALLOC_CTX *ctx,
 		 * or wildcard components as this can change the size.
 		 */
 		if(!component_was_mangled && !name_has_wildcard) {
-			stat_cache_add(orig_path, dirpath,
+			stat_cache_add(conn, orig_path, dirpath,
 					conn->case_sensitive);
 		}
 
@@ -1225,7 +1225,7 @@ NTSTATUS unix_convert(TALLOC_CTX *ctx,
 	 */
 
 	if(!component_was_mangled && !name_has_wildcard) {
-		stat_cache_add(orig_path, smb_fname->base_name,
+		stat_cache_add(conn, orig_path, smb_fname->base_name,
 			       conn->case_sensitive);
 	}
 
@@ -1356,6 +1356,69 @@ static bool fname_equal(const char *name1, const char *name2,
 	return(strequal(name1,name2));
 }
 
+/****************************************************************************
+ Look up a mangled name another smbd already resolved in this directory.
+****************************************************************************/
+
+static int get_real_filename_shared_mangled(connection_struct *conn,
+					    const char *path,
+					    const char *name,
+					    const struct file_id *dir_id,
+					    TALLOC_CTX *mem_ctx,
+					    char **found_name)
+{
+	struct smb_filename *smb_fname = NULL;
+	char *long_name = NULL;
+	char *full_name = NULL;
+	int ret;
+
+	long_name = mangled_name_shared_fetch(talloc_tos(), dir_id, name);
+	if (long_name == NULL) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	if (!mangled_equal(name, long_name, conn->params)) {
+		TALLOC_FREE(long_name);
+		errno = ENOENT;
+		return -1;
+	}
+
+	if (ISDOT(path)) {
+		full_name = talloc_strdup(talloc_tos(), long_name);
+	} else {
+		full_name = talloc_asprintf(talloc_tos(), "%s/%s",
+					    path, long_name);
+	}
+	if (full_name == NULL) {
+		TALLOC_FREE(long_name);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	smb_fname = synthetic_smb_fname(talloc_tos(), full_name, NULL, NULL, 0);
+	TALLOC_FREE(full_name);
+	if (smb_fname == NULL) {
+		TALLOC_FREE(long_name);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	ret = SMB_VFS_LSTAT(conn, smb_fname);
+	TALLOC_FREE(smb_fname);
+	if (ret == -1) {
+		DBG_DEBUG("%s -> %s is gone\n", name, long_name);
+		TALLOC_FREE(long_name);
+		errno = ENOENT;
+		return -1;
+	}
+
+	DBG_DEBUG("Found %s -> %s in the shared stat cache\n",
+		  name, long_name);
+	*found_name = talloc_move(mem_ctx, &long_name);
+	return 0;
+}
+
 /****************************************************************************
  Scan a directory to find a filename, matching without case sensitivity.
  If the name looks like a mangled name then try via the mangling functions
@@ -1372,6 +1435,8 @@ static int get_real_filename_full_scan(connection_struct *conn,
 	char *unmangled_name = NULL;
 	long curpos;
 	struct smb_filename *smb_fname = NULL;
+	struct file_id dir_id;
+	bool have_dir_id = false;
 
 	/* handle null paths */
 	if ((path == NULL) || (*path == 0)) {
@@ -1412,6 +1477,32 @@ static int get_real_filename_full_scan(connection_struct *conn,
 		}
 	}
 
+	if (mangled) {
+		have_dir_id = mangled_name_shared_dir_id(conn, path, &dir_id);
+	}
+	if (have_dir_id) {
+		int ret;
+
+		ret = get_real_filename_shared_mangled(conn, path, name,
+						       &dir_id, mem_ctx,
+						       found_name);
+		if (ret == 0) {
+			TALLOC_FREE(unmangled_name);
+			return 0;
+		}
+	}
+
+	if (!mangled && !conn->case_sensitive && lp_stat_cache()) {
+		int ret;
+
+		ret = name_index_get_real_filename(conn, path, name,
+						   mem_ctx, found_name);
+		if ((ret == 0) || (errno != EOPNOTSUPP)) {
+			TALLOC_FREE(unmangled_name);
+			return ret;
+		}
+	}
+
 	smb_fname = synthetic_smb_fname(talloc_tos(),
 					path,
 					NULL,
@@ -1456,6 +1547,10 @@ static int get_real_filename_full_scan(connection_struct *conn,
 		if ((mangled && mangled_equal(name,dname,conn->params)) ||
 			fname_equal(name, dname, conn->case_sensitive)) {
 			/* we've found the file, change it's name and return */
+			if (mangled && have_dir_id) {
+				mangled_name_shared_store(&dir_id, name,
+							  dname);
+			}
 			*found_name = talloc_strdup(mem_ctx, dname);
 			TALLOC_FREE(unmangled_name);
 			TALLOC_FREE(cur_dir);
@@ -23,9 +23,106 @@
 #include "libcli/security/security.h"
 #include "util_tdb.h"
 #include "lib/util/bitmap.h"
+#include "live_stats.h"
 
 #define FILE_HANDLE_OFFSET 0x1000
 
+/*
+ * All fsps of a sconn are also kept in a hash table indexed by
+ * fsp->file_id, so that file_find_dif() and file_find_di_first()
+ * don't have to walk all open files. The table doubles its size
+ * whenever there are more than two files per bucket on average.
+ */
+
+#define FILE_ID_HASH_MIN_BUCKETS 64
+
+struct fsp_file_id_entry {
+	struct fsp_file_id_entry *prev, *next;
+	struct files_struct *fsp;
+	size_t bucket;
+};
+
+static size_t file_id_hash(const struct file_id *id, size_t num_buckets)
+{
+	uint64_t h;
+
+	h = id->inode * 0x9e3779b97f4a7c15ULL;
+	h ^= id->devid + (h << 6) + (h >> 2);
+	h ^= id->extid + (h << 6) + (h >> 2);
+	h ^= h >> 32;
+
+	return h & (num_buckets - 1);
+}
+
+static void file_id_index_add(struct smbd_server_connection *sconn,
+			      struct fsp_file_id_entry *e)
+{
+	e->bucket = file_id_hash(&e->fsp->file_id,
+				 sconn->files_by_id.num_buckets);
+	DLIST_ADD(sconn->files_by_id.buckets[e->bucket], e);
+}
+
+static void file_id_index_remove(struct smbd_server_connection *sconn,
+				 struct fsp_file_id_entry *e)
+{
+	DLIST_REMOVE(sconn->files_by_id.buckets[e->bucket], e);
+}
+
+static bool file_id_index_grow(struct smbd_server_connection *sconn)
+{
+	struct fsp_file_id_entry **old_buckets = sconn->files_by_id.buckets;
+	size_t old_num_buckets = sconn->files_by_id.num_buckets;
+	size_t num_buckets = FILE_ID_HASH_MIN_BUCKETS;
+	size_t i;
+
+	if (old_buckets != NULL) {
+		if (sconn->num_files <= old_num_buckets * 2) {
+			return true;
+		}
+		num_buckets = old_num_buckets * 2;
+	}
+
+	sconn->files_by_id.buckets = talloc_zero_array(
+		sconn, struct fsp_file_id_entry *, num_buckets);
+	if (sconn->files_by_id.buckets == NULL) {
+		sconn->files_by_id.buckets = old_buckets;
+		return (old_buckets != NULL);
+	}
+	sconn->files_by_id.num_buckets = num_buckets;
+
+	for (i=0; i<old_num_buckets; i++) {
+		struct fsp_file_id_entry *e = NULL;
+
+		while ((e = old_buckets[i]) != NULL) {
+			DLIST_REMOVE(old_buckets[i], e);
+			file_id_index_add(sconn, e);
+		}
+	}
+	TALLOC_FREE(old_buckets);
+
+	return true;
+}
+
+/**
+ * Change fsp->file_id, keeping the file_id index up to date
+ */
+void fsp_set_file_id(struct files_struct *fsp, struct file_id id)
+{
+	struct smbd_server_connection *sconn = fsp->conn->sconn;
+
+	if (fsp->file_id_entry == NULL) {
+		/*
+		 * Not in sconn->files
+		 */
+		fsp->file_id = id;
+		return;
+	}
+
+	file_id_index_remove(sconn, fsp->file_id_entry);
+	fsp->file_id = id;
+	file_id_index_add(sconn, fsp->file_id_entry);
+}
+
 /**
  * create new fsp to be used for file_new or a durable handle reconnect
  */
@@ -66,9 +163,23 @@ NTSTATUS fsp_new(struct connection_struct *conn, TALLOC_CTX *mem_ctx,
 	fsp->fnum = FNUM_FIELD_INVALID;
 	fsp->conn = conn;
 
+	fsp->file_id_entry = talloc_zero(fsp, struct fsp_file_id_entry);
+	if (fsp->file_id_entry == NULL) {
+		goto fail;
+	}
+	fsp->file_id_entry->fsp = fsp;
+
 	DLIST_ADD(sconn->files, fsp);
 	sconn->num_files += 1;
 
+	if (!file_id_index_grow(sconn)) {
+		DLIST_REMOVE(sconn->files, fsp);
+		sconn->num_files -= 1;
+		goto fail;
+	}
+	file_id_index_add(sconn, fsp->file_id_entry);
+	LIVE_STATS_SET(open_files, sconn->num_files);
+
 	conn->num_files_open++;
 
 	*result = fsp;
@@ -141,13 +252,6 @@ NTSTATUS file_new(struct smb_request *req, connection_struct *conn,
 		req->chain_fsp = fsp;
 	}
 
-	/* A new fsp invalidates the positive and
-	  negative fsp_fi_cache as the new fsp is pushed
-	  at the start of the list and we search from
-	  a cache hit to the *end* of the list. */
-
-	ZERO_STRUCT(sconn->fsp_fi_cache);
-
 	*result = fsp;
 	return NT_STATUS_OK;
 }
@@ -314,20 +418,25 @@ files_struct *file_find_fd(struct smbd_server_connection *sconn, int fd)
 files_struct *file_find_dif(struct smbd_server_connection *sconn,
 			    struct file_id id, unsigned long gen_id)
 {
-	int count=0;
-	files_struct *fsp;
+	struct fsp_file_id_entry *e;
+	size_t bucket;
 
 	if (gen_id == 0) {
 		return NULL;
 	}
 
-	for (fsp=sconn->files; fsp; fsp=fsp->next,count++) {
+	if (sconn->files_by_id.buckets == NULL) {
+		return NULL;
+	}
+
+	bucket = file_id_hash(&id, sconn->files_by_id.num_buckets);
+
+	for (e = sconn->files_by_id.buckets[bucket]; e; e = e->next) {
+		files_struct *fsp = e->fsp;
+
 		/* We can have a fsp->fh->fd == -1 here as it could be a stat open. */
 		if (file_id_equal(&fsp->file_id, &id) &&
 		    fsp->fh->gen_id == gen_id ) {
-			if (count > 10) {
-				DLIST_PROMOTE(sconn->files, fsp);
-			}
 			/* Paranoia check. */
 			if ((fsp->fh->fd == -1) &&
 			    (fsp->oplock_type != NO_OPLOCK &&
@@ -350,32 +459,26 @@ files_struct *file_find_dif(struct smbd_server_connection *sconn,
 
 /****************************************************************************
  Find the first fsp given a device and inode.
- We use a singleton cache here to speed up searching from getfilepathinfo
- calls.
 ****************************************************************************/
 
 files_struct *file_find_di_first(struct smbd_server_connection *sconn,
 				 struct file_id id)
 {
-	files_struct *fsp;
+	struct fsp_file_id_entry *e;
+	size_t bucket;
 
-	if (file_id_equal(&sconn->fsp_fi_cache.id, &id)) {
-		/* Positive or negative cache hit. */
-		return sconn->fsp_fi_cache.fsp;
+	if (sconn->files_by_id.buckets == NULL) {
+		return NULL;
 	}
 
-	sconn->fsp_fi_cache.id = id;
+	bucket = file_id_hash(&id, sconn->files_by_id.num_buckets);
 
-	for (fsp=sconn->files;fsp;fsp=fsp->next) {
-		if (file_id_equal(&fsp->file_id, &id)) {
-			/* Setup positive cache. */
-			sconn->fsp_fi_cache.fsp = fsp;
-			return fsp;
+	for (e = sconn->files_by_id.buckets[bucket]; e; e = e->next) {
+		if (file_id_equal(&e->fsp->file_id, &id)) {
+			return e->fsp;
 		}
 	}
 
-	/* Setup negative cache. */
-	sconn->fsp_fi_cache.fsp = NULL;
 	return NULL;
 }
 
@@ -385,11 +488,15 @@ files_struct *file_find_di_first(struct smbd_server_connection *sconn,
 
 files_struct *file_find_di_next(files_struct *start_fsp)
 {
-	files_struct *fsp;
+	struct fsp_file_id_entry *e;
 
-	for (fsp = start_fsp->next;fsp;fsp=fsp->next) {
-		if (file_id_equal(&fsp->file_id, &start_fsp->file_id)) {
-			return fsp;
+	if (start_fsp->file_id_entry == NULL) {
+		return NULL;
+	}
+
+	for (e = start_fsp->file_id_entry->next; e; e = e->next) {
+		if (file_id_equal(&e->fsp->file_id, &start_fsp->file_id)) {
+			return e->fsp;
 		}
 	}
 
@@ -471,13 +578,13 @@ void fsp_free(files_struct *fsp)
 {
 	struct smbd_server_connection *sconn = fsp->conn->sconn;
 
-	if (fsp == sconn->fsp_fi_cache.fsp) {
-		ZERO_STRUCT(sconn->fsp_fi_cache);
-	}
+	file_id_index_remove(sconn, fsp->file_id_entry);
+	TALLOC_FREE(fsp->file_id_entry);
 
 	DLIST_REMOVE(sconn->files, fsp);
 	SMB_ASSERT(sconn->num_files > 0);
 	sconn->num_files--;
+	LIVE_STATS_SET(open_files, sconn->num_files);
 
 	TALLOC_FREE(fsp->fake_file_handle);
 
@@ -700,7 +807,7 @@ NTSTATUS dup_file_fsp(struct smb_request *req, files_struct *from,
 	to->fh = from->fh;
 	to->fh->ref_count++;
 
-	to->file_id = from->file_id;
+	fsp_set_file_id(to, from->file_id);
 	to->initial_allocation_size = from->initial_allocation_size;
 	to->file_pid = from->file_pid;
 	to->vuid = from->vuid;
@@ -30,12 +30,6 @@ extern struct smbd_dmapi_context *dmapi_ctx;
 /* how many write cache buffers have been allocated */
 extern unsigned int allocated_write_caches;
 
-/* A singleton cache to speed up searching by dev/inode. */
-struct fsp_singleton_cache {
-	files_struct *fsp;
-	struct file_id id;
-};
-
 extern const struct mangle_fns *mangle_fns;
 
 extern unsigned char *chartest;
@@ -186,12 +180,14 @@ bool smbd_dirptr_get_entry(TALLOC_CTX *ctx,
 					   void *private_data,
 					   struct smb_filename *smb_fname,
 					   bool get_dosmode,
+					   const uint32_t *vfs_dosmode,
 					   uint32_t *_mode),
 			   void *private_data,
 			   char **_fname,
 			   struct smb_filename **_smb_fname,
 			   uint32_t *_mode,
-			   long *_prev_offset);
+			   long *_prev_offset,
+			   struct file_id *_file_id);
 
 NTSTATUS smbd_dirptr_lanman2_entry(TALLOC_CTX *ctx,
 			       connection_struct *conn,
@@ -244,6 +240,8 @@ void smbd_smb2_process_negprot(struct smbXsrv_connection *xconn,
 			       const uint8_t *inpdu, size_t size);
 
 DATA_BLOB smbd_smb2_generate_outbody(struct smbd_smb2_request *req, size_t size);
+uint8_t *smbd_smb2_buffer_alloc(TALLOC_CTX *mem_ctx, size_t size);
+void smbd_smb2_buffer_cache_flush(void);
 
 NTSTATUS smbd_smb2_request_error_ex(struct smbd_smb2_request *req,
 				    NTSTATUS status,
@@ -505,6 +503,18 @@ struct smbXsrv_connection {
 			 * This is the "server max credits" parameter.
 			 */
 			uint16_t max;
+			/*
+			 * The number of credits we currently grant in
+			 * total, max/16 unless "smb2 credits target latency"
+			 * is set, see smb2_credits_adapt().
+			 */
+			uint16_t window;
+			/*
+			 * Moving average of the backend latency of
+			 * IO requests, and the number of samples.
+			 */
+			uint64_t latency_usec;
+			uint32_t num_samples;
 			/*
 			 * a bitmap of size max_credits
 			 */
@@ -530,6 +540,7 @@ struct smbXsrv_connection {
 			uint32_t max_read;
 			uint32_t max_write;
 			uint16_t cipher;
+			uint16_t compression;
 		} server;
 
 		struct smbXsrv_preauth preauth;
@@ -686,9 +697,21 @@ struct smbd_smb2_send_queue {
 	struct iovec *vector;
 	int count;
 
+	/*
+	 * The response is still being signed or encrypted
+	 * by a worker thread, see "smb2 crypto offload size".
+	 */
+	bool pending;
+
 	TALLOC_CTX *mem_ctx;
 };
 
+/*
+ * The maximum number of iovec's smbd_smb2_flush_send_queue()
+ * gathers from the send queue into a single writev() call.
+ */
+#define SMBD_SMB2_SEND_QUEUE_MAX_IOV 64
+
 struct smbd_smb2_request {
 	struct smbd_smb2_request *prev, *next;
 
@@ -713,6 +736,11 @@ struct smbd_smb2_request {
 	bool do_encryption;
 	struct tevent_timer *async_te;
 	bool compound_related;
+	/*
+	 * Used to process the next element of a compound
+	 * chain, allocated once per request.
+	 */
+	struct tevent_immediate *compound_im;
 
 	/*
 	 * Give the implementation of an SMB2 req a way to tell the SMB2 request
@@ -755,6 +783,20 @@ struct smbd_smb2_request {
 	 */
 	struct tevent_req *subreq;
 
+	/*
+	 * The signing/encryption job running in
+	 * a worker thread, maybe NULL.
+	 */
+	struct smbd_smb2_request_crypto_state *crypto_state;
+
+	/*
+	 * The transform of the incoming PDU was decrypted, or the
+	 * signature of the current request was checked, by a worker
+	 * thread already.
+	 */
+	bool in_decrypted;
+	bool in_signature_checked;
+
 #define SMBD_SMB2_TF_IOV_OFS 0
 #define SMBD_SMB2_HDR_IOV_OFS 1
 #define SMBD_SMB2_BODY_IOV_OFS 2
@@ -893,7 +935,11 @@ struct smbd_server_connection {
 	struct files_struct *files;
 
 	int real_max_open_files;
-	struct fsp_singleton_cache fsp_fi_cache;
+	/* sconn->files indexed by file_id, see files.c */
+	struct {
+		struct fsp_file_id_entry **buckets;
+		size_t num_buckets;
+	} files_by_id;
 
 	struct pending_message_list *deferred_open_queue;
 
@@ -907,6 +953,11 @@ struct smbd_server_connection {
 
 	uint64_t num_requests;
 
+	/* to find out in housekeeping_fn() if the client was idle */
+	uint64_t num_keepalives;
+	uint64_t housekeeping_num_requests;
+	bool idle_memory_released;
+
 	/* Current number of oplocks we have outstanding. */
 	struct {
 		int32_t exclusive_open;
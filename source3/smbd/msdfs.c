@@ -33,6 +33,7 @@
 #include "libcli/security/security.h"
 #include "librpc/gen_ndr/ndr_dfsblobs.h"
 #include "lib/tsocket/tsocket.h"
+#include "lib/util/memcache.h"
 
 /**********************************************************************
  Parse a DFS pathname of the form \hostname\service\reqpath
@@ -613,6 +614,78 @@ static bool parse_msdfs_symlink(TALLOC_CTX *ctx,
 	return True;
 }
 
+/**********************************************************************
+ Cache of symlink targets, keyed by file_id and ctime of the symlink.
+
+ A symlink can't be changed in place, replacing it creates a new inode
+ and moves the ctime. An empty value means the symlink is not an msdfs
+ link.
+**********************************************************************/
+
+struct msdfs_link_cache_key {
+	struct file_id id;
+	struct timespec ctime;
+};
+
+static bool msdfs_link_cache_key(connection_struct *conn,
+				 const SMB_STRUCT_STAT *st,
+				 struct msdfs_link_cache_key *key)
+{
+	struct timespec now = timespec_current();
+
+	if (timespec_too_recent(&st->st_ex_ctime, &now)) {
+		return false;
+	}
+
+	ZERO_STRUCTP(key);
+	key->id = vfs_file_id_from_sbuf(conn, st);
+	key->ctime = st->st_ex_ctime;
+
+	return true;
+}
+
+static bool msdfs_link_cache_fetch(connection_struct *conn,
+				   const SMB_STRUCT_STAT *st,
+				   DATA_BLOB *target)
+{
+	struct msdfs_link_cache_key key;
+	bool ok;
+
+	ok = msdfs_link_cache_key(conn, st, &key);
+	if (!ok) {
+		return false;
+	}
+
+	ok = memcache_lookup(smbd_memcache(),
+			     MSDFS_LINK_CACHE,
+			     data_blob_const(&key, sizeof(key)),
+			     target);
+	if (!ok || target->length == 0 ||
+	    target->data[target->length-1] != '\0') {
+		return false;
+	}
+
+	return true;
+}
+
+static void msdfs_link_cache_store(connection_struct *conn,
+				   const SMB_STRUCT_STAT *st,
+				   const char *target)
+{
+	struct msdfs_link_cache_key key;
+	bool ok;
+
+	ok = msdfs_link_cache_key(conn, st, &key);
+	if (!ok) {
+		return;
+	}
+
+	memcache_add(smbd_memcache(),
+		     MSDFS_LINK_CACHE,
+		     data_blob_const(&key, sizeof(key)),
+		     data_blob_const(target, strlen(target) + 1));
+}
+
 /**********************************************************************
  Returns true if the unix path is a valid msdfs symlink and also
  returns the target string from inside the link.
@@ -631,6 +704,7 @@ static bool is_msdfs_link_internal(TALLOC_CTX *ctx,
 #endif
 	size_t bufsize = 0;
 	char *link_target = NULL;
+	DATA_BLOB cached;
 
 	if (pp_link_target) {
 		bufsize = 1024;
@@ -655,6 +729,24 @@ static bool is_msdfs_link_internal(TALLOC_CTX *ctx,
 		goto err;
 	}
 
+	if (msdfs_link_cache_fetch(conn, &smb_fname->st, &cached)) {
+		if (cached.length == 1) {
+			DEBUG(5,("is_msdfs_link_read_target: %s is not an "
+				 "msdfs link (cached).\n",
+				 smb_fname->base_name));
+			goto err;
+		}
+		if (pp_link_target == NULL) {
+			return True;
+		}
+		if (cached.length <= bufsize) {
+			memcpy(link_target, cached.data, cached.length);
+			DEBUG(5,("is_msdfs_link_internal: %s -> %s (cached)\n",
+				 smb_fname->base_name, link_target));
+			return True;
+		}
+	}
+
 	referral_len = SMB_VFS_READLINK(conn, smb_fname,
 				link_target, bufsize - 1);
 	if (referral_len == -1) {
@@ -669,8 +761,13 @@ static bool is_msdfs_link_internal(TALLOC_CTX *ctx,
 				link_target));
 
 	if (!strnequal(link_target, "msdfs:", 6)) {
+		msdfs_link_cache_store(conn, &smb_fname->st, "");
 		goto err;
 	}
+	if (pp_link_target) {
+		/* Only the full target is worth caching. */
+		msdfs_link_cache_store(conn, &smb_fname->st, link_target);
+	}
 	return True;
 
   err:
@@ -724,6 +821,7 @@ static NTSTATUS dfs_path_lookup(TALLOC_CTX *ctx,
 	struct smb_filename *smb_fname = NULL;
 	char *canon_dfspath = NULL; /* Canonicalized dfs path. (only '/'
 				  components). */
+	bool path_exists;
 
 	DEBUG(10,("dfs_path_lookup: Conn path = %s reqpath = %s\n",
 		conn->connectpath, pdp->reqpath));
@@ -748,6 +846,8 @@ static NTSTATUS dfs_path_lookup(TALLOC_CTX *ctx,
 		}
 	}
 
+	path_exists = NT_STATUS_IS_OK(status) && VALID_STAT(smb_fname->st);
+
 	/* Optimization - check if we can redirect the whole path. */
 
 	if (is_msdfs_link_internal(ctx, conn, smb_fname, pp_targetpath)) {
@@ -772,6 +872,15 @@ static NTSTATUS dfs_path_lookup(TALLOC_CTX *ctx,
 		goto out;
 	}
 
+	if (path_exists) {
+		/*
+		 * The kernel resolved all parent directories of the path.
+		 * An msdfs link is a dangling symlink that can't have been
+		 * traversed, so there's no need to check every component.
+		 */
+		goto out;
+	}
+
 	/* Prepare to test only for '/' components in the given path,
 	 * so if a Windows path replace all '\\' characters with '/'.
 	 * For a POSIX DFS path we know all separators are already '/'. */
@@ -50,6 +50,14 @@ struct notify_change_buf {
 	int num_changes;
 	struct notify_change_event *changes;
 
+	/*
+	 * Rough size of the marshalled changes and the timer that
+	 * replies to the first pending request with "smbd notify
+	 * coalesce msec" set.
+	 */
+	size_t changes_size;
+	struct tevent_timer *coalesce_timer;
+
 	/*
 	 * If no changes are around requests are queued here. Using a linked
 	 * list, because we have to append at the end and delete from the top.
@@ -244,6 +252,7 @@ void change_notify_reply(struct smb_request *req,
 
 	TALLOC_FREE(notify_buf->changes);
 	notify_buf->num_changes = 0;
+	notify_buf->changes_size = 0;
 }
 
 struct notify_fsp_state {
@@ -273,6 +282,11 @@ void notify_callback(struct smbd_server_connection *sconn,
 	struct notify_fsp_state state = {
 		.notified_fsp = private_data, .when = when, .e = e
 	};
+
+	if (dir_listing_cache_notify(private_data, e)) {
+		return;
+	}
+
 	files_forall(sconn, notify_fsp_cb, &state);
 }
 
@@ -578,13 +592,51 @@ void notify_fname(connection_struct *conn, uint32_t action, uint32_t filter,
 		path += 2;
 	}
 
+	name_index_notify(conn, action, path);
+	dir_listing_cache_delete(conn, path);
+
 	notify_trigger(notify_ctx, action, filter, conn->connectpath, path);
 }
 
+static void notify_fsp_reply(files_struct *fsp)
+{
+	TALLOC_FREE(fsp->notify->coalesce_timer);
+
+	change_notify_reply(fsp->notify->requests->req,
+			    NT_STATUS_OK,
+			    fsp->notify->requests->max_param,
+			    fsp->notify,
+			    fsp->notify->requests->reply_fn);
+
+	change_notify_remove_request(fsp->conn->sconn, fsp->notify->requests);
+}
+
+static void notify_fsp_coalesce_done(struct tevent_context *ev,
+				     struct tevent_timer *te,
+				     struct timeval current_time,
+				     void *private_data)
+{
+	files_struct *fsp = talloc_get_type_abort(
+		private_data, struct files_struct);
+
+	fsp->notify->coalesce_timer = NULL;
+
+	if ((fsp->notify->requests == NULL) ||
+	    (fsp->notify->num_changes == 0)) {
+		/*
+		 * The request was cancelled or answered on its own
+		 */
+		return;
+	}
+
+	notify_fsp_reply(fsp);
+}
+
 static void notify_fsp(files_struct *fsp, struct timespec when,
 		       uint32_t action, const char *name)
 {
 	struct notify_change_event *change, *changes;
+	int coalesce_msec;
 	char *tmp;
 
 	if (fsp->notify == NULL) {
@@ -609,14 +661,9 @@ static void notify_fsp(files_struct *fsp, struct timespec when,
 		 */
 		TALLOC_FREE(fsp->notify->changes);
 		fsp->notify->num_changes = -1;
+		fsp->notify->changes_size = 0;
 		if (fsp->notify->requests != NULL) {
-			change_notify_reply(fsp->notify->requests->req,
-					    NT_STATUS_OK,
-					    fsp->notify->requests->max_param,
-					    fsp->notify,
-					    fsp->notify->requests->reply_fn);
-			change_notify_remove_request(fsp->conn->sconn,
-						     fsp->notify->requests);
+			notify_fsp_reply(fsp);
 		}
 		return;
 	}
@@ -652,6 +699,9 @@ static void notify_fsp(files_struct *fsp, struct timespec when,
 	change->action = action;
 	fsp->notify->num_changes += 1;
 
+	/* FILE_NOTIFY_INFORMATION header, UTF16 name and padding */
+	fsp->notify->changes_size += 12 + strlen(tmp) * 2 + 2;
+
 	if (fsp->notify->requests == NULL) {
 		/*
 		 * Nobody is waiting, so don't send anything. The ot
@@ -667,19 +717,36 @@ static void notify_fsp(files_struct *fsp, struct timespec when,
 		return;
 	}
 
+	coalesce_msec = lp_smbd_notify_coalesce_msec();
+
+	if ((coalesce_msec > 0) &&
+	    (fsp->notify->changes_size < fsp->notify->requests->max_param)) {
+		/*
+		 * Changes tend to come in bursts. Collect them for a
+		 * while so that they go out in one response instead
+		 * of one response per change. Once the client buffer
+		 * is full there's no point in waiting any longer.
+		 */
+		if (fsp->notify->coalesce_timer == NULL) {
+			fsp->notify->coalesce_timer = tevent_add_timer(
+				fsp->conn->sconn->ev_ctx,
+				fsp->notify,
+				timeval_current_ofs_msec(coalesce_msec),
+				notify_fsp_coalesce_done,
+				fsp);
+		}
+		if (fsp->notify->coalesce_timer != NULL) {
+			return;
+		}
+	}
+
 	/*
 	 * Someone is waiting for the change, trigger the reply immediately.
 	 *
 	 * TODO: do we have to walk the lists of requests pending?
 	 */
 
-	change_notify_reply(fsp->notify->requests->req,
-			    NT_STATUS_OK,
-			    fsp->notify->requests->max_param,
-			    fsp->notify,
-			    fsp->notify->requests->reply_fn);
-
-	change_notify_remove_request(fsp->conn->sconn, fsp->notify->requests);
+	notify_fsp_reply(fsp);
 }
 
 char *notify_filter_string(TALLOC_CTX *mem_ctx, uint32_t filter)
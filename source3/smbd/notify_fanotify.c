@@ -0,0 +1,852 @@
+/*
+   Unix SMB/CIFS implementation.
+   notify implementation using fanotify filesystem marks
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * inotify needs a kernel watch per directory, so it can't serve
+ * recursive requests and large trees run into the per user watch
+ * limit. fanotify can watch a whole file system with a single mark
+ * and reports the directory of every change as a file handle plus the
+ * name of the changed entry.
+ *
+ * Watches in the same directory are recognized by comparing the file
+ * handle, for recursive watches the directory handle is resolved to a
+ * path with open_by_handle_at(). This needs CAP_SYS_ADMIN and
+ * CAP_DAC_READ_SEARCH, so the backend is only usable in notifyd.
+ */
+
+#include "includes.h"
+#include "system/filesys.h"
+#include "../librpc/gen_ndr/notify.h"
+#include "smbd/smbd.h"
+#include "lib/util/dlinklist.h"
+
+#include <sys/fanotify.h>
+#include <sys/vfs.h>
+
+struct fanotify_fs;
+struct fanotify_watch_context;
+
+struct fanotify_private {
+	struct sys_notify_context *ctx;
+	int fd;
+	uint64_t rename_mask;
+	struct fanotify_fs *filesystems;
+	struct fanotify_watch_context *watches;
+};
+
+/*
+ * A file system we have a mark on
+ */
+struct fanotify_fs {
+	struct fanotify_fs *prev, *next;
+	struct fanotify_private *fan;
+	fsid_t fsid;
+	int mount_fd;		/* for open_by_handle_at() */
+	uint64_t mask;
+	size_t num_watches;
+};
+
+struct fanotify_watch_context {
+	struct fanotify_watch_context *prev, *next;
+	struct fanotify_private *fan;
+	struct fanotify_fs *fs;
+	void (*callback)(struct sys_notify_context *ctx,
+			 void *private_data,
+			 struct notify_event *ev,
+			 uint32_t filter);
+	void *private_data;
+	uint32_t filter;	/* the windows completion filter */
+	uint32_t subdir_filter;
+	const char *path;
+	const char *realpath;
+	size_t realpathlen;
+	struct file_handle *fh;	/* of the watched directory */
+};
+
+/*
+ * Same mapping as in notify_inotify.c
+ */
+static const struct {
+	uint32_t notify_mask;
+	uint64_t fanotify_mask;
+} fanotify_mapping[] = {
+	{FILE_NOTIFY_CHANGE_FILE_NAME,
+	 FAN_CREATE|FAN_DELETE|FAN_MOVED_FROM|FAN_MOVED_TO},
+	{FILE_NOTIFY_CHANGE_DIR_NAME,
+	 FAN_CREATE|FAN_DELETE|FAN_MOVED_FROM|FAN_MOVED_TO},
+	{FILE_NOTIFY_CHANGE_ATTRIBUTES,
+	 FAN_ATTRIB|FAN_MOVED_TO|FAN_MOVED_FROM|FAN_MODIFY},
+	{FILE_NOTIFY_CHANGE_LAST_WRITE,  FAN_ATTRIB},
+	{FILE_NOTIFY_CHANGE_LAST_ACCESS, FAN_ATTRIB},
+	{FILE_NOTIFY_CHANGE_EA,          FAN_ATTRIB},
+	{FILE_NOTIFY_CHANGE_SECURITY,    FAN_ATTRIB}
+};
+
+static uint64_t fanotify_map(uint32_t *filter)
+{
+	size_t i;
+	uint64_t out = 0;
+
+	for (i=0; i<ARRAY_SIZE(fanotify_mapping); i++) {
+		if (fanotify_mapping[i].notify_mask & *filter) {
+			out |= fanotify_mapping[i].fanotify_mask;
+			*filter &= ~fanotify_mapping[i].notify_mask;
+		}
+	}
+	return out;
+}
+
+static uint32_t fanotify_map_mask_to_filter(uint64_t mask)
+{
+	size_t i;
+	uint32_t filter = 0;
+
+	for (i=0; i<ARRAY_SIZE(fanotify_mapping); i++) {
+		if (fanotify_mapping[i].fanotify_mask & mask) {
+			filter |= fanotify_mapping[i].notify_mask;
+		}
+	}
+
+	if (mask & FAN_ONDIR) {
+		filter &= ~FILE_NOTIFY_CHANGE_FILE_NAME;
+	} else {
+		filter &= ~FILE_NOTIFY_CHANGE_DIR_NAME;
+	}
+
+	return filter;
+}
+
+static int fanotify_private_destructor(struct fanotify_private *fan)
+{
+	close(fan->fd);
+	return 0;
+}
+
+static int fanotify_fs_destructor(struct fanotify_fs *fs)
+{
+	struct fanotify_private *fan = fs->fan;
+	int ret;
+
+	DLIST_REMOVE(fan->filesystems, fs);
+
+	ret = fanotify_mark(fan->fd, FAN_MARK_REMOVE|FAN_MARK_FILESYSTEM,
+			    fs->mask, fs->mount_fd, NULL);
+	if (ret == -1) {
+		DBG_NOTICE("fanotify_mark(FAN_MARK_REMOVE) failed: %s\n",
+			   strerror(errno));
+	}
+	close(fs->mount_fd);
+	return 0;
+}
+
+static bool fanotify_fh_equal(const struct file_handle *fh1,
+			      const struct file_handle *fh2)
+{
+	if ((fh1->handle_type != fh2->handle_type) ||
+	    (fh1->handle_bytes != fh2->handle_bytes)) {
+		return false;
+	}
+	return (memcmp(fh1->f_handle, fh2->f_handle, fh1->handle_bytes) == 0);
+}
+
+/*
+ * One directory entry an event is about
+ */
+struct fanotify_event_dir {
+	struct fanotify_fs *fs;
+	struct file_handle *fh;
+	const char *name;
+	char *path;		/* resolved lazily */
+	bool path_failed;
+};
+
+static bool fanotify_parse_dfid_name(struct fanotify_private *fan,
+				     struct fanotify_event_info_fid *fid,
+				     size_t len,
+				     struct fanotify_event_dir *dir)
+{
+	struct fanotify_fs *fs;
+	struct file_handle *fh;
+	size_t ofs;
+	const char *name;
+
+	ofs = offsetof(struct fanotify_event_info_fid, handle);
+	if (len < ofs + sizeof(struct file_handle)) {
+		return false;
+	}
+	fh = (struct file_handle *)fid->handle;
+	ofs += sizeof(struct file_handle) + fh->handle_bytes;
+	if (len <= ofs) {
+		return false;
+	}
+	name = (const char *)fid + ofs;
+	if (strnlen(name, len - ofs) == len - ofs) {
+		return false;
+	}
+
+	for (fs = fan->filesystems; fs != NULL; fs = fs->next) {
+		if (memcmp(&fs->fsid, &fid->fsid, sizeof(fs->fsid)) == 0) {
+			break;
+		}
+	}
+	if (fs == NULL) {
+		/* Mark that is being removed */
+		return false;
+	}
+
+	*dir = (struct fanotify_event_dir) {
+		.fs = fs, .fh = fh, .name = name,
+	};
+	return true;
+}
+
+static char *fanotify_fd_path(TALLOC_CTX *mem_ctx, int fd)
+{
+	char proc_path[64];
+	char buf[PATH_MAX];
+	ssize_t len;
+
+	snprintf(proc_path, sizeof(proc_path), "/proc/self/fd/%d", fd);
+
+	len = readlink(proc_path, buf, sizeof(buf)-1);
+	if (len <= 0) {
+		return NULL;
+	}
+	buf[len] = '\0';
+
+	return talloc_strdup(mem_ctx, buf);
+}
+
+static const char *fanotify_event_dir_path(TALLOC_CTX *mem_ctx,
+					   struct fanotify_event_dir *dir)
+{
+	int fd;
+
+	if ((dir->path != NULL) || dir->path_failed) {
+		return dir->path;
+	}
+
+	fd = open_by_handle_at(dir->fs->mount_fd, dir->fh,
+			       O_PATH|O_DIRECTORY);
+	if (fd == -1) {
+		DBG_DEBUG("open_by_handle_at failed: %s\n", strerror(errno));
+		dir->path_failed = true;
+		return NULL;
+	}
+
+	dir->path = fanotify_fd_path(mem_ctx, fd);
+	close(fd);
+
+	dir->path_failed = (dir->path == NULL);
+	return dir->path;
+}
+
+/*
+ * Does the watch cover changes in dir? Returns the filter that applies.
+ * Resolved paths are compared against the real path of the watched
+ * directory, the callback gets them relative to the path the watch was
+ * created with.
+ */
+static uint32_t fanotify_watch_filter(TALLOC_CTX *mem_ctx,
+				      struct fanotify_watch_context *w,
+				      struct fanotify_event_dir *dir)
+{
+	const char *path;
+
+	if (w->fs != dir->fs) {
+		return 0;
+	}
+	if (fanotify_fh_equal(w->fh, dir->fh)) {
+		return w->filter;
+	}
+	if (w->subdir_filter == 0) {
+		return 0;
+	}
+
+	path = fanotify_event_dir_path(mem_ctx, dir);
+	if (path == NULL) {
+		return 0;
+	}
+	if ((strncmp(path, w->realpath, w->realpathlen) != 0) ||
+	    (path[w->realpathlen] != '/')) {
+		return 0;
+	}
+	return w->subdir_filter;
+}
+
+static const char *fanotify_watch_dir(TALLOC_CTX *mem_ctx,
+				      struct fanotify_watch_context *w,
+				      struct fanotify_event_dir *dir)
+{
+	const char *path;
+
+	if (fanotify_fh_equal(w->fh, dir->fh)) {
+		return w->path;
+	}
+
+	path = fanotify_event_dir_path(mem_ctx, dir);
+	if (path == NULL) {
+		return NULL;
+	}
+	return talloc_asprintf(mem_ctx, "%s%s",
+			       w->path, path + w->realpathlen);
+}
+
+static bool fanotify_filter_match(uint32_t w_filter, uint64_t mask)
+{
+	/* SMB separates the filters for files and directories */
+	if ((mask & FAN_ONDIR) &&
+	    (mask & (FAN_CREATE|FAN_DELETE|FAN_MOVED_FROM|FAN_MOVED_TO))) {
+		return ((w_filter & FILE_NOTIFY_CHANGE_DIR_NAME) != 0);
+	}
+
+	if ((mask & FAN_ATTRIB) &&
+	    (w_filter & (FILE_NOTIFY_CHANGE_ATTRIBUTES|
+			 FILE_NOTIFY_CHANGE_LAST_WRITE|
+			 FILE_NOTIFY_CHANGE_LAST_ACCESS|
+			 FILE_NOTIFY_CHANGE_EA|
+			 FILE_NOTIFY_CHANGE_SECURITY))) {
+		return true;
+	}
+	if ((mask & FAN_MODIFY) &&
+	    (w_filter & FILE_NOTIFY_CHANGE_ATTRIBUTES)) {
+		return true;
+	}
+	if (mask & (FAN_ATTRIB|FAN_MODIFY)) {
+		return false;
+	}
+
+	return ((w_filter & FILE_NOTIFY_CHANGE_FILE_NAME) != 0);
+}
+
+/*
+ * Report one change to the watches covering dir. The consumers of the
+ * callback look up their listeners by path, so every callback is
+ * invoked at most once per change, not once per watch.
+ */
+static void fanotify_dispatch_one(struct fanotify_private *fan,
+				  TALLOC_CTX *mem_ctx,
+				  struct fanotify_event_dir *dir,
+				  uint64_t mask,
+				  uint32_t action)
+{
+	struct fanotify_watch_context *w, *next;
+	struct fanotify_watch_context **called = NULL;
+	size_t num_called = 0;
+	struct notify_event ne = { .action = action, .path = dir->name };
+	uint32_t filter = fanotify_map_mask_to_filter(mask);
+	bool modified = false;
+
+	for (w = fan->watches; w != NULL; w = next) {
+		struct fanotify_watch_context **tmp;
+		uint32_t w_filter;
+		size_t i;
+
+		next = w->next;
+
+		w_filter = fanotify_watch_filter(mem_ctx, w, dir);
+		if (!fanotify_filter_match(w_filter, mask)) {
+			continue;
+		}
+
+		/*
+		 * SMB expects a file rename to generate a modify
+		 * of the destination as well, see notify_inotify.c
+		 */
+		if ((action == NOTIFY_ACTION_NEW_NAME) &&
+		    ((mask & FAN_ONDIR) == 0) &&
+		    !(w_filter & FILE_NOTIFY_CHANGE_CREATION)) {
+			modified = true;
+		}
+
+		for (i=0; i<num_called; i++) {
+			if ((called[i]->callback == w->callback) &&
+			    (called[i]->private_data == w->private_data)) {
+				break;
+			}
+		}
+		if (i < num_called) {
+			continue;
+		}
+
+		ne.dir = fanotify_watch_dir(mem_ctx, w, dir);
+		if (ne.dir == NULL) {
+			continue;
+		}
+
+		tmp = talloc_realloc(mem_ctx, called,
+				     struct fanotify_watch_context *,
+				     num_called + 1);
+		if (tmp == NULL) {
+			break;
+		}
+		called = tmp;
+		called[num_called++] = w;
+
+		DBG_DEBUG("action=%"PRIu32", dir=%s, path=%s, "
+			  "filter=%"PRIu32"\n",
+			  action, ne.dir, ne.path, filter);
+
+		w->callback(fan->ctx, w->private_data, &ne, filter);
+	}
+
+	TALLOC_FREE(called);
+
+	if (modified) {
+		fanotify_dispatch_one(fan, mem_ctx, dir, FAN_ATTRIB,
+				      NOTIFY_ACTION_MODIFIED);
+	}
+}
+
+static void fanotify_dispatch(struct fanotify_private *fan,
+			      struct fanotify_event_metadata *m)
+{
+	TALLOC_CTX *frame = talloc_stackframe();
+	struct fanotify_event_dir dirs[2];
+	struct fanotify_event_dir *old_dir = NULL;
+	struct fanotify_event_dir *new_dir = NULL;
+	size_t num_dirs = 0;
+	size_t ofs = m->metadata_len;
+	uint64_t mask = m->mask;
+
+	while ((ofs + sizeof(struct fanotify_event_info_header)) <=
+	       m->event_len) {
+		struct fanotify_event_info_header *hdr =
+			(struct fanotify_event_info_header *)
+			((char *)m + ofs);
+		bool ok;
+
+		if ((hdr->len < sizeof(*hdr)) ||
+		    (hdr->len > (m->event_len - ofs))) {
+			break;
+		}
+		ofs += hdr->len;
+
+		switch (hdr->info_type) {
+		case FAN_EVENT_INFO_TYPE_DFID_NAME:
+#ifdef FAN_RENAME
+		case FAN_EVENT_INFO_TYPE_OLD_DFID_NAME:
+		case FAN_EVENT_INFO_TYPE_NEW_DFID_NAME:
+#endif
+			break;
+		default:
+			continue;
+		}
+
+		if (num_dirs == ARRAY_SIZE(dirs)) {
+			break;
+		}
+		ok = fanotify_parse_dfid_name(
+			fan, (struct fanotify_event_info_fid *)hdr,
+			hdr->len, &dirs[num_dirs]);
+		if (!ok) {
+			continue;
+		}
+		if (ISDOT(dirs[num_dirs].name)) {
+			/* Change of the file system root itself */
+			continue;
+		}
+#ifdef FAN_RENAME
+		if (hdr->info_type == FAN_EVENT_INFO_TYPE_OLD_DFID_NAME) {
+			old_dir = &dirs[num_dirs];
+		}
+		if (hdr->info_type == FAN_EVENT_INFO_TYPE_NEW_DFID_NAME) {
+			new_dir = &dirs[num_dirs];
+		}
+#endif
+		num_dirs += 1;
+	}
+
+	if (num_dirs == 0) {
+		TALLOC_FREE(frame);
+		return;
+	}
+
+#ifdef FAN_RENAME
+	if (mask & FAN_RENAME) {
+		uint64_t ondir = mask & FAN_ONDIR;
+
+		/*
+		 * Renames within a watched tree get the OLD_NAME/NEW_NAME
+		 * pair. If only one side is watched, the entry just
+		 * vanished or appeared.
+		 */
+		if (old_dir != NULL && new_dir != NULL) {
+			fanotify_dispatch_one(fan, frame, old_dir,
+					      FAN_MOVED_FROM|ondir,
+					      NOTIFY_ACTION_OLD_NAME);
+			fanotify_dispatch_one(fan, frame, new_dir,
+					      FAN_MOVED_TO|ondir,
+					      NOTIFY_ACTION_NEW_NAME);
+		} else if (old_dir != NULL) {
+			fanotify_dispatch_one(fan, frame, old_dir,
+					      FAN_MOVED_FROM|ondir,
+					      NOTIFY_ACTION_REMOVED);
+		} else if (new_dir != NULL) {
+			fanotify_dispatch_one(fan, frame, new_dir,
+					      FAN_MOVED_TO|ondir,
+					      NOTIFY_ACTION_ADDED);
+		}
+		TALLOC_FREE(frame);
+		return;
+	}
+#endif
+
+	/*
+	 * The kernel merges queued events for the same entry, so one
+	 * event can carry several of them.
+	 */
+	if (mask & (FAN_CREATE|FAN_MOVED_TO)) {
+		fanotify_dispatch_one(
+			fan, frame, &dirs[0],
+			mask & (FAN_CREATE|FAN_MOVED_TO|FAN_ONDIR),
+			NOTIFY_ACTION_ADDED);
+	}
+	if (mask & (FAN_ATTRIB|FAN_MODIFY)) {
+		fanotify_dispatch_one(
+			fan, frame, &dirs[0],
+			mask & (FAN_ATTRIB|FAN_MODIFY|FAN_ONDIR),
+			NOTIFY_ACTION_MODIFIED);
+	}
+	if (mask & (FAN_DELETE|FAN_MOVED_FROM)) {
+		fanotify_dispatch_one(
+			fan, frame, &dirs[0],
+			mask & (FAN_DELETE|FAN_MOVED_FROM|FAN_ONDIR),
+			NOTIFY_ACTION_REMOVED);
+	}
+
+	TALLOC_FREE(frame);
+}
+
+static void fanotify_handler(struct tevent_context *ev,
+			     struct tevent_fd *fde,
+			     uint16_t flags,
+			     void *private_data)
+{
+	struct fanotify_private *fan = talloc_get_type_abort(
+		private_data, struct fanotify_private);
+	uint8_t buf[65536] __attribute__((aligned(8)));
+	struct fanotify_event_metadata *m;
+	ssize_t len;
+
+	len = read(fan->fd, buf, sizeof(buf));
+	if (len == -1) {
+		if ((errno == EAGAIN) || (errno == EINTR)) {
+			return;
+		}
+		DBG_ERR("read from fanotify fd failed: %s\n",
+			strerror(errno));
+		TALLOC_FREE(fde);
+		return;
+	}
+
+	for (m = (struct fanotify_event_metadata *)buf;
+	     FAN_EVENT_OK(m, len);
+	     m = FAN_EVENT_NEXT(m, len)) {
+
+		if (m->vers != FANOTIFY_METADATA_VERSION) {
+			DBG_ERR("fanotify metadata version %u, expected %u\n",
+				(unsigned)m->vers,
+				(unsigned)FANOTIFY_METADATA_VERSION);
+			TALLOC_FREE(fde);
+			return;
+		}
+		if (m->mask & FAN_Q_OVERFLOW) {
+			DBG_WARNING("fanotify queue overflow, "
+				    "changes have been lost\n");
+			continue;
+		}
+		if (m->fd >= 0) {
+			close(m->fd);
+		}
+		fanotify_dispatch(fan, m);
+	}
+}
+
+static int fanotify_setup(struct sys_notify_context *ctx)
+{
+	struct fanotify_private *fan;
+	struct tevent_fd *fde;
+
+	fan = talloc_zero(ctx, struct fanotify_private);
+	if (fan == NULL) {
+		return ENOMEM;
+	}
+
+	fan->fd = fanotify_init(FAN_CLASS_NOTIF|FAN_REPORT_DFID_NAME|
+				FAN_CLOEXEC|FAN_NONBLOCK,
+				O_RDONLY);
+	if (fan->fd == -1) {
+		int ret = errno;
+		DBG_NOTICE("fanotify_init failed: %s\n", strerror(ret));
+		TALLOC_FREE(fan);
+		return ret;
+	}
+	fan->ctx = ctx;
+#ifdef FAN_RENAME
+	fan->rename_mask = FAN_RENAME;
+#endif
+
+	ctx->private_data = fan;
+	talloc_set_destructor(fan, fanotify_private_destructor);
+
+	fde = tevent_add_fd(ctx->ev, fan, fan->fd, TEVENT_FD_READ,
+			    fanotify_handler, fan);
+	if (fde == NULL) {
+		ctx->private_data = NULL;
+		TALLOC_FREE(fan);
+		return ENOMEM;
+	}
+	return 0;
+}
+
+/*
+ * Check whether the kernel can give us what we need: file system marks
+ * with directory handles and names. Used by notifyd to fall back to
+ * inotify.
+ */
+bool fanotify_available(void)
+{
+	int fd;
+
+	fd = fanotify_init(FAN_CLASS_NOTIF|FAN_REPORT_DFID_NAME|FAN_CLOEXEC,
+			   O_RDONLY);
+	if (fd == -1) {
+		DBG_NOTICE("fanotify_init failed: %s\n", strerror(errno));
+		return false;
+	}
+	close(fd);
+	return true;
+}
+
+static int fanotify_fs_add_mask(struct fanotify_fs *fs, uint64_t mask)
+{
+	struct fanotify_private *fan = fs->fan;
+	int ret;
+
+	mask |= FAN_ONDIR;
+
+	if (mask & (FAN_MOVED_FROM|FAN_MOVED_TO)) {
+		mask |= fan->rename_mask;
+	}
+	if (fan->rename_mask != 0) {
+		mask &= ~(FAN_MOVED_FROM|FAN_MOVED_TO);
+	}
+
+	if ((fs->mask & mask) == mask) {
+		return 0;
+	}
+
+	ret = fanotify_mark(fan->fd, FAN_MARK_ADD|FAN_MARK_FILESYSTEM,
+			    mask, fs->mount_fd, NULL);
+	if ((ret == -1) && (errno == EINVAL) && (fan->rename_mask != 0)) {
+		/*
+		 * Kernel without FAN_RENAME, the pairs of move events
+		 * will be reported as removes and adds.
+		 */
+		uint64_t rename_mask = fan->rename_mask;
+
+		fan->rename_mask = 0;
+		if (mask & rename_mask) {
+			mask &= ~rename_mask;
+			mask |= FAN_MOVED_FROM|FAN_MOVED_TO;
+		}
+		ret = fanotify_mark(fan->fd,
+				    FAN_MARK_ADD|FAN_MARK_FILESYSTEM,
+				    mask, fs->mount_fd, NULL);
+	}
+	if (ret == -1) {
+		return errno;
+	}
+
+	fs->mask |= mask;
+	return 0;
+}
+
+static int fanotify_fs_get(struct fanotify_private *fan,
+			   int dir_fd,
+			   uint64_t mask,
+			   struct fanotify_fs **pfs)
+{
+	struct fanotify_fs *fs;
+	struct statfs sbuf;
+	int ret;
+
+	ret = fstatfs(dir_fd, &sbuf);
+	if (ret == -1) {
+		return errno;
+	}
+
+	for (fs = fan->filesystems; fs != NULL; fs = fs->next) {
+		if (memcmp(&fs->fsid, &sbuf.f_fsid, sizeof(fs->fsid)) == 0) {
+			break;
+		}
+	}
+
+	if (fs == NULL) {
+		fs = talloc_zero(fan, struct fanotify_fs);
+		if (fs == NULL) {
+			return ENOMEM;
+		}
+		fs->fan = fan;
+		fs->fsid = sbuf.f_fsid;
+		fs->mount_fd = dup(dir_fd);
+		if (fs->mount_fd == -1) {
+			ret = errno;
+			TALLOC_FREE(fs);
+			return ret;
+		}
+		DLIST_ADD(fan->filesystems, fs);
+		talloc_set_destructor(fs, fanotify_fs_destructor);
+	}
+
+	ret = fanotify_fs_add_mask(fs, mask);
+	if (ret != 0) {
+		if (fs->num_watches == 0) {
+			TALLOC_FREE(fs);
+		}
+		return ret;
+	}
+
+	*pfs = fs;
+	return 0;
+}
+
+static int fanotify_watch_destructor(struct fanotify_watch_context *w)
+{
+	struct fanotify_fs *fs = w->fs;
+
+	DLIST_REMOVE(w->fan->watches, w);
+
+	fs->num_watches -= 1;
+	if (fs->num_watches == 0) {
+		TALLOC_FREE(fs);
+	}
+	return 0;
+}
+
+int fanotify_watch(TALLOC_CTX *mem_ctx,
+		   struct sys_notify_context *ctx,
+		   const char *path,
+		   uint32_t *filter,
+		   uint32_t *subdir_filter,
+		   void (*callback)(struct sys_notify_context *ctx,
+				    void *private_data,
+				    struct notify_event *ev,
+				    uint32_t filter),
+		   void *private_data,
+		   void *handle_p)
+{
+	struct fanotify_private *fan;
+	struct fanotify_watch_context *w;
+	uint32_t orig_filter = *filter;
+	uint32_t orig_subdir_filter = *subdir_filter;
+	void **handle = (void **)handle_p;
+	uint64_t mask;
+	int mount_id;
+	int dir_fd;
+	int ret;
+
+	if (ctx->private_data == NULL) {
+		ret = fanotify_setup(ctx);
+		if (ret != 0) {
+			return ret;
+		}
+	}
+
+	fan = talloc_get_type_abort(ctx->private_data,
+				    struct fanotify_private);
+
+	mask = fanotify_map(filter);
+	mask |= fanotify_map(subdir_filter);
+	if (mask == 0) {
+		/* this filter can't be handled by fanotify */
+		return EINVAL;
+	}
+
+	w = talloc_zero(mem_ctx, struct fanotify_watch_context);
+	if (w == NULL) {
+		ret = ENOMEM;
+		goto fail;
+	}
+	w->fan = fan;
+	w->callback = callback;
+	w->private_data = private_data;
+	w->filter = orig_filter;
+	w->subdir_filter = orig_subdir_filter;
+	w->path = talloc_strdup(w, path);
+	if (w->path == NULL) {
+		ret = ENOMEM;
+		goto fail;
+	}
+
+	w->fh = talloc_size(w, sizeof(struct file_handle) + MAX_HANDLE_SZ);
+	if (w->fh == NULL) {
+		ret = ENOMEM;
+		goto fail;
+	}
+	w->fh->handle_bytes = MAX_HANDLE_SZ;
+
+	dir_fd = open(path, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	if (dir_fd == -1) {
+		ret = errno;
+		goto fail;
+	}
+
+	ret = name_to_handle_at(dir_fd, "", w->fh, &mount_id, AT_EMPTY_PATH);
+	if (ret == -1) {
+		ret = errno;
+		close(dir_fd);
+		DBG_NOTICE("name_to_handle_at(%s) failed: %s\n",
+			   path, strerror(ret));
+		goto fail;
+	}
+
+	w->realpath = fanotify_fd_path(w, dir_fd);
+	if (w->realpath == NULL) {
+		ret = ENOMEM;
+		close(dir_fd);
+		goto fail;
+	}
+	w->realpathlen = strlen(w->realpath);
+
+	ret = fanotify_fs_get(fan, dir_fd, mask, &w->fs);
+	close(dir_fd);
+	if (ret != 0) {
+		DBG_NOTICE("fanotify_mark for %s failed: %s\n",
+			   path, strerror(ret));
+		goto fail;
+	}
+
+	w->fs->num_watches += 1;
+
+	DBG_DEBUG("watching %s, filter=%"PRIu32", subdir_filter=%"PRIu32"\n",
+		  path, orig_filter, orig_subdir_filter);
+
+	DLIST_ADD(fan->watches, w);
+	talloc_set_destructor(w, fanotify_watch_destructor);
+
+	*handle = w;
+	return 0;
+
+fail:
+	*filter = orig_filter;
+	*subdir_filter = orig_subdir_filter;
+	TALLOC_FREE(w);
+	return ret;
+}
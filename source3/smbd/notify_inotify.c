@@ -164,6 +164,35 @@ static bool filter_match(struct inotify_watch_context *w,
 
 
 
+/*
+  see if the callback of w already got this event from another watch on
+  the same directory. The callbacks look up their listeners by path, so
+  calling them once per watch would multiply the event.
+*/
+static bool inotify_already_called(struct inotify_watch_context *w,
+				   struct inotify_watch_context ***called,
+				   size_t *num_called)
+{
+	struct inotify_watch_context **tmp;
+	size_t i;
+
+	for (i=0; i<*num_called; i++) {
+		if (((*called)[i]->callback == w->callback) &&
+		    ((*called)[i]->private_data == w->private_data)) {
+			return true;
+		}
+	}
+
+	tmp = talloc_realloc(w->in, *called, struct inotify_watch_context *,
+			     *num_called + 1);
+	if (tmp != NULL) {
+		tmp[*num_called] = w;
+		*called = tmp;
+		*num_called += 1;
+	}
+	return false;
+}
+
 /*
   dispatch one inotify event
 
@@ -176,6 +205,8 @@ static void inotify_dispatch(struct inotify_private *in,
 			     struct inotify_event *e2)
 {
 	struct inotify_watch_context *w, *next;
+	struct inotify_watch_context **called = NULL;
+	size_t num_called = 0;
 	struct notify_event ne;
 	uint32_t filter;
 
@@ -220,11 +251,14 @@ static void inotify_dispatch(struct inotify_private *in,
 	/* find any watches that have this watch descriptor */
 	for (w=in->watches;w;w=next) {
 		next = w->next;
-		if (w->wd == e->wd && filter_match(w, e)) {
+		if (w->wd == e->wd && filter_match(w, e) &&
+		    !inotify_already_called(w, &called, &num_called)) {
 			ne.dir = w->path;
 			w->callback(in->ctx, w->private_data, &ne, filter);
 		}
 	}
+	TALLOC_FREE(called);
+	num_called = 0;
 
 	if ((ne.action == NOTIFY_ACTION_NEW_NAME) &&
 	    ((e->mask & IN_ISDIR) == 0)) {
@@ -241,12 +275,15 @@ static void inotify_dispatch(struct inotify_private *in,
 		for (w=in->watches;w;w=next) {
 			next = w->next;
 			if (w->wd == e->wd && filter_match(w, e) &&
-			    !(w->filter & FILE_NOTIFY_CHANGE_CREATION)) {
+			    !(w->filter & FILE_NOTIFY_CHANGE_CREATION) &&
+			    !inotify_already_called(w, &called,
+						    &num_called)) {
 				ne.dir = w->path;
 				w->callback(in->ctx, w->private_data, &ne,
 					    filter);
 			}
 		}
+		TALLOC_FREE(called);
 	}
 }
 
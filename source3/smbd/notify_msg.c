@@ -29,12 +29,26 @@
 #include "tdb.h"
 #include "util_tdb.h"
 #include "lib/util/server_id_db.h"
+#include "lib/util/iov_buf.h"
 #include "smbd/notifyd/notifyd.h"
 
+/*
+ * Triggers are collected for NOTIFY_TRIGGERS_DELAY_USEC and sent to
+ * notifyd as a single MSG_SMB_NOTIFY_TRIGGERS message, or earlier
+ * when NOTIFY_TRIGGERS_MAX_LEN bytes have piled up. This saves a
+ * sendmsg/recvmsg pair per file system change on busy servers.
+ */
+#define NOTIFY_TRIGGERS_DELAY_USEC 1000
+#define NOTIFY_TRIGGERS_MAX_LEN 8192
+
 struct notify_context {
 	struct server_id notifyd;
 	struct messaging_context *msg_ctx;
 
+	uint8_t *triggers;
+	size_t triggers_len;
+	struct tevent_timer *triggers_timer;
+
 	struct smbd_server_connection *sconn;
 	void (*callback)(struct smbd_server_connection *sconn,
 			 void *private_data, struct timespec when,
@@ -44,7 +58,11 @@ struct notify_context {
 static void notify_handler(struct messaging_context *msg, void *private_data,
 			   uint32_t msg_type, struct server_id src,
 			   DATA_BLOB *data);
+static void notify_events_handler(struct messaging_context *msg,
+				  void *private_data, uint32_t msg_type,
+				  struct server_id src, DATA_BLOB *data);
 static int notify_context_destructor(struct notify_context *ctx);
+static void notify_flush_triggers(struct notify_context *ctx);
 
 struct notify_context *notify_init(
 	TALLOC_CTX *mem_ctx, struct messaging_context *msg,
@@ -63,6 +81,10 @@ struct notify_context *notify_init(
 	}
 	ctx->msg_ctx = msg;
 
+	ctx->triggers = NULL;
+	ctx->triggers_len = 0;
+	ctx->triggers_timer = NULL;
+
 	ctx->sconn = sconn;
 	ctx->callback = callback;
 
@@ -89,6 +111,15 @@ struct notify_context *notify_init(
 			TALLOC_FREE(ctx);
 			return NULL;
 		}
+		status = messaging_register(msg, ctx, MSG_SMB_NOTIFY_EVENTS,
+					    notify_events_handler);
+		if (!NT_STATUS_IS_OK(status)) {
+			DEBUG(1, ("messaging_register failed: %s\n",
+				  nt_errstr(status)));
+			messaging_deregister(msg, MSG_PVFS_NOTIFY, ctx);
+			TALLOC_FREE(ctx);
+			return NULL;
+		}
 	}
 
 	talloc_set_destructor(ctx, notify_context_destructor);
@@ -98,8 +129,11 @@ struct notify_context *notify_init(
 
 static int notify_context_destructor(struct notify_context *ctx)
 {
+	notify_flush_triggers(ctx);
+
 	if (ctx->callback != NULL) {
 		messaging_deregister(ctx->msg_ctx, MSG_PVFS_NOTIFY, ctx);
+		messaging_deregister(ctx->msg_ctx, MSG_SMB_NOTIFY_EVENTS, ctx);
 	}
 
 	return 0;
@@ -136,6 +170,57 @@ static void notify_handler(struct messaging_context *msg, void *private_data,
 	ctx->callback(ctx->sconn, event.private_data, event_msg->when, &event);
 }
 
+/*
+ * One event for several watches of ours, see notifyd_trigger_parser
+ */
+
+static void notify_events_handler(struct messaging_context *msg,
+				  void *private_data, uint32_t msg_type,
+				  struct server_id src, DATA_BLOB *data)
+{
+	struct notify_context *ctx = talloc_get_type_abort(
+		private_data, struct notify_context);
+	struct notify_events_msg events_msg;
+	struct notify_event event;
+	size_t hdr_len = offsetof(struct notify_events_msg, private_data);
+	size_t array_len;
+	uint32_t i;
+
+	if (data->length < hdr_len) {
+		DEBUG(1, ("message too short: %zu\n", data->length));
+		return;
+	}
+	memcpy(&events_msg, data->data, hdr_len);
+
+	array_len = (size_t)events_msg.num_private_data * sizeof(void *);
+
+	if ((data->length - hdr_len) < array_len + 1) {
+		DEBUG(1, ("message too short for %"PRIu32" watches: %zu\n",
+			  events_msg.num_private_data, data->length));
+		return;
+	}
+	if (data->data[data->length-1] != 0) {
+		DEBUG(1, ("%s: path not 0-terminated\n", __func__));
+		return;
+	}
+
+	event.action = events_msg.action;
+	event.path = (const char *)data->data + hdr_len + array_len;
+
+	for (i=0; i<events_msg.num_private_data; i++) {
+		memcpy(&event.private_data,
+		       data->data + hdr_len + i * sizeof(void *),
+		       sizeof(void *));
+
+		DEBUG(10, ("%s: Got notify_event action=%u, private_data=%p, "
+			   "path=%s\n", __func__, (unsigned)event.action,
+			   event.private_data, event.path));
+
+		ctx->callback(ctx->sconn, event.private_data, events_msg.when,
+			      &event);
+	}
+}
+
 NTSTATUS notify_add(struct notify_context *ctx,
 		    const char *path, uint32_t filter, uint32_t subdir_filter,
 		    void *private_data)
@@ -149,6 +234,11 @@ NTSTATUS notify_add(struct notify_context *ctx,
 		return NT_STATUS_NOT_IMPLEMENTED;
 	}
 
+	/*
+	 * Changes made before the watch was added must not show up
+	 */
+	notify_flush_triggers(ctx);
+
 	DEBUG(10, ("%s: path=[%s], filter=%u, subdir_filter=%u, "
 		   "private_data=%p\n", __func__, path, (unsigned)filter,
 		   (unsigned)subdir_filter, private_data));
@@ -190,6 +280,8 @@ NTSTATUS notify_remove(struct notify_context *ctx, void *private_data,
 		return NT_STATUS_NOT_IMPLEMENTED;
 	}
 
+	notify_flush_triggers(ctx);
+
 	msg.instance.private_data = private_data;
 
 	iov[0].iov_base = &msg;
@@ -204,6 +296,87 @@ NTSTATUS notify_remove(struct notify_context *ctx, void *private_data,
 	return status;
 }
 
+static void notify_flush_triggers(struct notify_context *ctx)
+{
+	struct iovec iov;
+
+	TALLOC_FREE(ctx->triggers_timer);
+
+	if (ctx->triggers_len == 0) {
+		return;
+	}
+
+	iov = (struct iovec) {
+		.iov_base = ctx->triggers, .iov_len = ctx->triggers_len
+	};
+
+	messaging_send_iov(
+		ctx->msg_ctx, ctx->notifyd, MSG_SMB_NOTIFY_TRIGGERS,
+		&iov, 1, NULL, 0);
+
+	ctx->triggers_len = 0;
+}
+
+static void notify_triggers_timer_handler(struct tevent_context *ev,
+					  struct tevent_timer *te,
+					  struct timeval current_time,
+					  void *private_data)
+{
+	struct notify_context *ctx = talloc_get_type_abort(
+		private_data, struct notify_context);
+
+	ctx->triggers_timer = NULL;
+	notify_flush_triggers(ctx);
+}
+
+static bool notify_queue_trigger(struct notify_context *ctx,
+				 const struct iovec *iov, int iovlen)
+{
+	uint64_t len = iov_buflen(iov, iovlen);
+	size_t needed, padded;
+
+	padded = (len + NOTIFY_TRIGGERS_ALIGN - 1) &
+		~(NOTIFY_TRIGGERS_ALIGN - 1);
+	needed = ctx->triggers_len + sizeof(len) + padded;
+
+	if (needed > talloc_get_size(ctx->triggers)) {
+		uint8_t *tmp;
+
+		tmp = talloc_realloc(ctx, ctx->triggers, uint8_t,
+				     MAX(needed, NOTIFY_TRIGGERS_MAX_LEN));
+		if (tmp == NULL) {
+			return false;
+		}
+		ctx->triggers = tmp;
+	}
+
+	if (ctx->triggers_timer == NULL) {
+		struct tevent_context *ev = messaging_tevent_context(
+			ctx->msg_ctx);
+
+		ctx->triggers_timer = tevent_add_timer(
+			ev, ctx,
+			timeval_current_ofs_usec(NOTIFY_TRIGGERS_DELAY_USEC),
+			notify_triggers_timer_handler, ctx);
+		if (ctx->triggers_timer == NULL) {
+			return false;
+		}
+	}
+
+	memcpy(ctx->triggers + ctx->triggers_len, &len, sizeof(len));
+	iov_buf(iov, iovlen, ctx->triggers + ctx->triggers_len + sizeof(len),
+		len);
+	memset(ctx->triggers + ctx->triggers_len + sizeof(len) + len, 0,
+	       padded - len);
+	ctx->triggers_len = needed;
+
+	if (ctx->triggers_len >= NOTIFY_TRIGGERS_MAX_LEN) {
+		notify_flush_triggers(ctx);
+	}
+
+	return true;
+}
+
 void notify_trigger(struct notify_context *ctx,
 		    uint32_t action, uint32_t filter,
 		    const char *dir, const char *name)
@@ -211,6 +384,7 @@ void notify_trigger(struct notify_context *ctx,
 	struct notify_trigger_msg msg;
 	struct iovec iov[4];
 	char slash = '/';
+	bool ok;
 
 	DEBUG(10, ("notify_trigger called action=0x%x, filter=0x%x, "
 		   "dir=%s, name=%s\n", (unsigned)action, (unsigned)filter,
@@ -233,6 +407,13 @@ void notify_trigger(struct notify_context *ctx,
 	iov[3].iov_base = discard_const_p(char, name);
 	iov[3].iov_len = strlen(name)+1;
 
+	ok = notify_queue_trigger(ctx, iov, ARRAY_SIZE(iov));
+	if (ok) {
+		return;
+	}
+
+	notify_flush_triggers(ctx);
+
 	messaging_send_iov(
 		ctx->msg_ctx, ctx->notifyd, MSG_SMB_NOTIFY_TRIGGER,
 		iov, ARRAY_SIZE(iov), NULL, 0);
@@ -129,6 +129,9 @@ static void notifyd_rec_change(struct messaging_context *msg_ctx,
 static void notifyd_trigger(struct messaging_context *msg_ctx,
 			    void *private_data, uint32_t msg_type,
 			    struct server_id src, DATA_BLOB *data);
+static void notifyd_triggers(struct messaging_context *msg_ctx,
+			     void *private_data, uint32_t msg_type,
+			     struct server_id src, DATA_BLOB *data);
 static void notifyd_get_db(struct messaging_context *msg_ctx,
 			   void *private_data, uint32_t msg_type,
 			   struct server_id src, DATA_BLOB *data);
@@ -233,10 +236,16 @@ struct tevent_req *notifyd_send(TALLOC_CTX *mem_ctx, struct tevent_context *ev,
 		goto deregister_rec_change;
 	}
 
+	status = messaging_register(msg_ctx, state, MSG_SMB_NOTIFY_TRIGGERS,
+				    notifyd_triggers);
+	if (tevent_req_nterror(req, status)) {
+		goto deregister_trigger;
+	}
+
 	status = messaging_register(msg_ctx, state, MSG_SMB_NOTIFY_GET_DB,
 				    notifyd_get_db);
 	if (tevent_req_nterror(req, status)) {
-		goto deregister_trigger;
+		goto deregister_triggers;
 	}
 
 	names_db = messaging_names_db(msg_ctx);
@@ -304,6 +313,8 @@ deregister_db:
 #endif
 deregister_get_db:
 	messaging_deregister(msg_ctx, MSG_SMB_NOTIFY_GET_DB, state);
+deregister_triggers:
+	messaging_deregister(msg_ctx, MSG_SMB_NOTIFY_TRIGGERS, state);
 deregister_trigger:
 	messaging_deregister(msg_ctx, MSG_SMB_NOTIFY_TRIGGER, state);
 deregister_rec_change:
@@ -729,21 +740,129 @@ static void notifyd_trigger(struct messaging_context *msg_ctx,
 	}
 }
 
+/*
+ * Unpack a batch of triggers from smbd, see NOTIFY_TRIGGERS_ALIGN
+ */
+
+static void notifyd_triggers(struct messaging_context *msg_ctx,
+			     void *private_data, uint32_t msg_type,
+			     struct server_id src, DATA_BLOB *data)
+{
+	size_t ofs = 0;
+
+	while (ofs < data->length) {
+		DATA_BLOB trigger;
+		uint64_t len;
+		size_t padded;
+
+		if ((data->length - ofs) < sizeof(len)) {
+			DBG_WARNING("truncated length at %zu\n", ofs);
+			return;
+		}
+		memcpy(&len, data->data + ofs, sizeof(len));
+		ofs += sizeof(len);
+
+		if (len > (data->length - ofs)) {
+			DBG_WARNING("invalid length %"PRIu64" at %zu\n",
+				    len, ofs);
+			return;
+		}
+
+		trigger = data_blob_const(data->data + ofs, len);
+		notifyd_trigger(msg_ctx, private_data,
+				MSG_SMB_NOTIFY_TRIGGER, src, &trigger);
+
+		padded = (len + NOTIFY_TRIGGERS_ALIGN - 1) &
+			~(NOTIFY_TRIGGERS_ALIGN - 1);
+		ofs += MIN(padded, data->length - ofs);
+	}
+}
+
 static void notifyd_send_delete(struct messaging_context *msg_ctx,
 				TDB_DATA key,
 				struct notifyd_instance *instance);
 
+static bool notifyd_instance_wants(struct notifyd_trigger_state *tstate,
+				   struct notifyd_instance *instance)
+{
+	uint32_t i_filter;
+
+	if (tstate->covered_by_sys_notify) {
+		if (tstate->recursive) {
+			i_filter = instance->internal_subdir_filter;
+		} else {
+			i_filter = instance->internal_filter;
+		}
+	} else {
+		if (tstate->recursive) {
+			i_filter = instance->instance.subdir_filter;
+		} else {
+			i_filter = instance->instance.filter;
+		}
+	}
+
+	return ((i_filter & tstate->msg->filter) != 0);
+}
+
+/*
+ * Send the event to one client. If it has more than one matching
+ * watch, all of them are served by a single MSG_SMB_NOTIFY_EVENTS.
+ */
+
+static NTSTATUS notifyd_send_event(struct notifyd_trigger_state *tstate,
+				   struct server_id client,
+				   void **private_datas,
+				   uint32_t num_private_datas,
+				   const char *path)
+{
+	struct iovec iov[3];
+
+	if (num_private_datas == 1) {
+		struct notify_event_msg msg = {
+			.when = tstate->msg->when,
+			.private_data = private_datas[0],
+			.action = tstate->msg->action
+		};
+
+		iov[0].iov_base = &msg;
+		iov[0].iov_len = offsetof(struct notify_event_msg, path);
+		iov[1].iov_base = discard_const_p(char, path);
+		iov[1].iov_len = strlen(path) + 1;
+
+		return messaging_send_iov(tstate->msg_ctx, client,
+					  MSG_PVFS_NOTIFY, iov, 2, NULL, 0);
+	} else {
+		struct notify_events_msg msg = {
+			.when = tstate->msg->when,
+			.action = tstate->msg->action,
+			.num_private_data = num_private_datas
+		};
+
+		iov[0].iov_base = &msg;
+		iov[0].iov_len = offsetof(struct notify_events_msg,
+					  private_data);
+		iov[1].iov_base = private_datas;
+		iov[1].iov_len = num_private_datas * sizeof(void *);
+		iov[2].iov_base = discard_const_p(char, path);
+		iov[2].iov_len = strlen(path) + 1;
+
+		return messaging_send_iov(tstate->msg_ctx, client,
+					  MSG_SMB_NOTIFY_EVENTS, iov, 3,
+					  NULL, 0);
+	}
+}
+
 static void notifyd_trigger_parser(TDB_DATA key, TDB_DATA data,
 				   void *private_data)
 
 {
 	struct notifyd_trigger_state *tstate = private_data;
-	struct notify_event_msg msg = { .action = tstate->msg->action,
-					.when = tstate->msg->when };
-	struct iovec iov[2];
-	size_t path_len = key.dsize;
+	const char *path = tstate->msg->path + key.dsize + 1;
 	struct notifyd_instance *instances = NULL;
 	size_t num_instances = 0;
+	bool *done;
+	uint32_t *client_idx;
+	void **private_datas;
 	size_t i;
 
 	if (!notifyd_parse_entry(data.dptr, data.dsize, &instances,
@@ -756,52 +875,68 @@ static void notifyd_trigger_parser(TDB_DATA key, TDB_DATA data,
 		   (unsigned)num_instances, (int)key.dsize,
 		   (char *)key.dptr));
 
-	iov[0].iov_base = &msg;
-	iov[0].iov_len = offsetof(struct notify_event_msg, path);
-	iov[1].iov_base = tstate->msg->path + path_len + 1;
-	iov[1].iov_len = strlen((char *)(iov[1].iov_base)) + 1;
+	if (num_instances == 0) {
+		return;
+	}
+
+	done = talloc_zero_array(talloc_tos(), bool, num_instances);
+	client_idx = talloc_array(done, uint32_t, num_instances);
+	private_datas = talloc_array(done, void *, num_instances);
+	if ((done == NULL) || (client_idx == NULL) ||
+	    (private_datas == NULL)) {
+		DEBUG(1, ("%s: talloc failed\n", __func__));
+		TALLOC_FREE(done);
+		return;
+	}
 
 	for (i=0; i<num_instances; i++) {
 		struct notifyd_instance *instance = &instances[i];
 		struct server_id_buf idbuf;
-		uint32_t i_filter;
+		uint32_t j, num_client;
 		NTSTATUS status;
 
-		if (tstate->covered_by_sys_notify) {
-			if (tstate->recursive) {
-				i_filter = instance->internal_subdir_filter;
-			} else {
-				i_filter = instance->internal_filter;
-			}
-		} else {
-			if (tstate->recursive) {
-				i_filter = instance->instance.subdir_filter;
-			} else {
-				i_filter = instance->instance.filter;
-			}
-		}
-
-		if ((i_filter & tstate->msg->filter) == 0) {
+		if (done[i] || !notifyd_instance_wants(tstate, instance)) {
 			continue;
 		}
 
-		msg.private_data = instance->instance.private_data;
+		/*
+		 * Collect all watches of this client on this path
+		 */
+		num_client = 0;
+
+		for (j=i; j<num_instances; j++) {
+			struct notifyd_instance *other = &instances[j];
+
+			if (done[j] ||
+			    !server_id_equal(&other->client,
+					     &instance->client) ||
+			    !notifyd_instance_wants(tstate, other)) {
+				continue;
+			}
+			done[j] = true;
+			client_idx[num_client] = j;
+			private_datas[num_client] =
+				other->instance.private_data;
+			num_client += 1;
+		}
 
-		status = messaging_send_iov(
-			tstate->msg_ctx, instance->client,
-			MSG_PVFS_NOTIFY, iov, ARRAY_SIZE(iov), NULL, 0);
+		status = notifyd_send_event(tstate, instance->client,
+					    private_datas, num_client, path);
 
-		DEBUG(10, ("%s: messaging_send_iov to %s returned %s\n",
-			   __func__,
+		DEBUG(10, ("%s: messaging_send_iov to %s for %"PRIu32" "
+			   "watches returned %s\n", __func__,
 			   server_id_str_buf(instance->client, &idbuf),
-			   nt_errstr(status)));
+			   num_client, nt_errstr(status)));
 
 		if (NT_STATUS_EQUAL(status, NT_STATUS_OBJECT_NAME_NOT_FOUND) &&
 		    procid_is_local(&instance->client)) {
 			/*
 			 * That process has died
 			 */
-			notifyd_send_delete(tstate->msg_ctx, key, instance);
+			for (j=0; j<num_client; j++) {
+				notifyd_send_delete(tstate->msg_ctx, key,
+						    &instances[client_idx[j]]);
+			}
 			continue;
 		}
 
@@ -810,6 +945,8 @@ static void notifyd_trigger_parser(TDB_DATA key, TDB_DATA data,
 				  __func__, nt_errstr(status)));
 		}
 	}
+
+	TALLOC_FREE(done);
 }
 
 /*
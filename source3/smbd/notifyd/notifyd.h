@@ -107,6 +107,14 @@ struct notify_trigger_msg {
 	char path[];
 };
 
+/*
+ * smbd collects triggers for a short while and sends them as one
+ * MSG_SMB_NOTIFY_TRIGGERS message. Its payload is a sequence of
+ * MSG_SMB_NOTIFY_TRIGGER payloads, each prefixed by its length as a
+ * uint64_t and padded to NOTIFY_TRIGGERS_ALIGN bytes.
+ */
+#define NOTIFY_TRIGGERS_ALIGN 8
+
 /*
  * In response to a MSG_SMB_NOTIFY_TRIGGER message notifyd walks its database
  * and sends out the following message to all interested clients
@@ -120,6 +128,21 @@ struct notify_event_msg {
 	char path[];
 };
 
+/*
+ * If a client has several watches matching an event, it gets a single
+ * MSG_SMB_NOTIFY_EVENTS message listing the private_data of all of
+ * them instead of one MSG_PVFS_NOTIFY per watch.
+ */
+
+/* MSG_SMB_NOTIFY_EVENTS payload */
+struct notify_events_msg {
+	struct timespec when;
+	uint32_t action;
+	uint32_t num_private_data;
+	void *private_data[];
+	/* followed by the path */
+};
+
 struct sys_notify_context;
 struct ctdbd_connection;
 
@@ -1420,7 +1420,7 @@ static NTSTATUS open_file(files_struct *fsp,
 		return NT_STATUS_FILE_IS_A_DIRECTORY;
 	}
 
-	fsp->file_id = vfs_file_id_from_sbuf(conn, &smb_fname->st);
+	fsp_set_file_id(fsp, vfs_file_id_from_sbuf(conn, &smb_fname->st));
 	fsp->vuid = req ? req->vuid : UID_FIELD_INVALID;
 	fsp->file_pid = req ? req->smbpid : 0;
 	fsp->can_lock = True;
@@ -1607,11 +1607,25 @@ bool is_stat_open(uint32_t access_mask)
 		((access_mask & ~stat_open_bits) == 0));
 }
 
+static bool has_delete_on_close_fn(struct share_mode_entry *e,
+				   bool *modified,
+				   void *private_data)
+{
+	bool *has_delete_on_close = private_data;
+
+	if (share_entry_stale_pid(e)) {
+		return false;
+	}
+	*has_delete_on_close = true;
+	return true;
+}
+
 static bool has_delete_on_close(struct share_mode_lock *lck,
 				uint32_t name_hash)
 {
 	struct share_mode_data *d = lck->data;
-	uint32_t i;
+	bool ret = false;
+	bool ok;
 
 	if (d->num_share_modes == 0) {
 		return false;
@@ -1619,12 +1633,12 @@ static bool has_delete_on_close(struct share_mode_lock *lck,
 	if (!is_delete_on_close_set(lck, name_hash)) {
 		return false;
 	}
-	for (i=0; i<d->num_share_modes; i++) {
-		if (!share_mode_stale_pid(d, i)) {
-			return true;
-		}
+	ok = share_mode_forall_entries(lck, has_delete_on_close_fn, &ret);
+	if (!ok) {
+		DBG_DEBUG("share_mode_forall_entries failed\n");
+		return false;
 	}
-	return false;
+	return ret;
 }
 
 /****************************************************************************
@@ -1633,12 +1647,54 @@ static bool has_delete_on_close(struct share_mode_lock *lck,
  Returns -1 on error, or number of share modes on success (may be zero).
 ****************************************************************************/
 
+struct open_mode_check_state {
+	struct smbd_server_connection *sconn;
+	struct file_id fid;
+	uint32_t access_mask;
+	uint32_t share_access;
+	bool conflict;
+};
+
+static bool open_mode_check_fn(struct share_mode_entry *e,
+			       bool *modified,
+			       void *private_data)
+{
+	struct open_mode_check_state *state = private_data;
+
+#if defined(DEVELOPER)
+	validate_my_share_entries(state->sconn, state->fid, -1, e);
+#endif
+
+	if (!is_valid_share_mode_entry(e)) {
+		return false;
+	}
+
+	/* someone else has a share lock on it, check to see if we can
+	 * too */
+	if (!share_conflict(e, state->access_mask, state->share_access)) {
+		return false;
+	}
+
+	if (share_entry_stale_pid(e)) {
+		return false;
+	}
+
+	state->conflict = true;
+	return true;
+}
+
 static NTSTATUS open_mode_check(connection_struct *conn,
 				struct share_mode_lock *lck,
 				uint32_t access_mask,
 				uint32_t share_access)
 {
-	uint32_t i;
+	struct open_mode_check_state state = {
+		.sconn = conn->sconn,
+		.fid = lck->data->id,
+		.access_mask = access_mask,
+		.share_access = share_access,
+	};
+	bool ok;
 
 	if(lck->data->num_share_modes == 0) {
 		return NT_STATUS_OK;
@@ -1652,33 +1708,16 @@ static NTSTATUS open_mode_check(connection_struct *conn,
 
 	/*
 	 * Check if the share modes will give us access.
+	 * Now we check the share modes, after any oplock breaks.
 	 */
 
-#if defined(DEVELOPER)
-	for(i = 0; i < lck->data->num_share_modes; i++) {
-		validate_my_share_entries(conn->sconn, lck->data->id, i,
-					  &lck->data->share_modes[i]);
+	ok = share_mode_forall_entries(lck, open_mode_check_fn, &state);
+	if (!ok) {
+		DBG_DEBUG("share_mode_forall_entries failed\n");
+		return NT_STATUS_INTERNAL_ERROR;
 	}
-#endif
-
-	/* Now we check the share modes, after any oplock breaks. */
-	for(i = 0; i < lck->data->num_share_modes; i++) {
-
-		if (!is_valid_share_mode_entry(&lck->data->share_modes[i])) {
-			continue;
-		}
-
-		/* someone else has a share lock on it, check to see if we can
-		 * too */
-		if (share_conflict(&lck->data->share_modes[i],
-				   access_mask, share_access)) {
-
-			if (share_mode_stale_pid(lck->data, i)) {
-				continue;
-			}
-
-			return NT_STATUS_SHARING_VIOLATION;
-		}
+	if (state.conflict) {
+		return NT_STATUS_SHARING_VIOLATION;
 	}
 
 	return NT_STATUS_OK;
@@ -1722,110 +1761,259 @@ NTSTATUS send_break_message(struct messaging_context *msg_ctx,
 	return status;
 }
 
-/*
- * Do internal consistency checks on the share mode for a file.
- */
+struct validate_oplock_types_state {
+	bool valid;
+	bool batch;
+	bool ex_or_batch;
+	bool level2;
+	bool no_oplock;
+	uint32_t num_non_stat_opens;
+};
 
-static bool validate_oplock_types(struct share_mode_lock *lck)
+static bool validate_oplock_types_fn(
+	struct share_mode_entry *e,
+	bool *modified,
+	void *private_data)
 {
-	struct share_mode_data *d = lck->data;
-	bool batch = false;
-	bool ex_or_batch = false;
-	bool level2 = false;
-	bool no_oplock = false;
-	uint32_t num_non_stat_opens = 0;
-	uint32_t i;
-
-	for (i=0; i<d->num_share_modes; i++) {
-		struct share_mode_entry *e = &d->share_modes[i];
+	struct validate_oplock_types_state *state = private_data;
 
-		if (!is_valid_share_mode_entry(e)) {
-			continue;
-		}
+	if (!is_valid_share_mode_entry(e)) {
+		return false;
+	}
 
-		if (e->op_mid == 0) {
-			/* INTERNAL_OPEN_ONLY */
-			continue;
-		}
+	if (e->op_mid == 0) {
+		/* INTERNAL_OPEN_ONLY */
+		return false;
+	}
 
-		if (e->op_type == NO_OPLOCK && is_stat_open(e->access_mask)) {
-			/* We ignore stat opens in the table - they
-			   always have NO_OPLOCK and never get or
-			   cause breaks. JRA. */
-			continue;
-		}
+	if (e->op_type == NO_OPLOCK && is_stat_open(e->access_mask)) {
+		/* We ignore stat opens in the table - they
+		   always have NO_OPLOCK and never get or
+		   cause breaks. JRA. */
+		return false;
+	}
 
-		num_non_stat_opens += 1;
+	state->num_non_stat_opens += 1;
 
-		if (BATCH_OPLOCK_TYPE(e->op_type)) {
-			/* batch - can only be one. */
-			if (share_mode_stale_pid(d, i)) {
-				DEBUG(10, ("Found stale batch oplock\n"));
-				continue;
-			}
-			if (ex_or_batch || batch || level2 || no_oplock) {
-				DEBUG(0, ("Bad batch oplock entry %u.",
-					  (unsigned)i));
-				return false;
-			}
-			batch = true;
+	if (BATCH_OPLOCK_TYPE(e->op_type)) {
+		/* batch - can only be one. */
+		if (share_entry_stale_pid(e)) {
+			DBG_DEBUG("Found stale batch oplock\n");
+			return false;
 		}
+		if (state->ex_or_batch ||
+		    state->batch ||
+		    state->level2 ||
+		    state->no_oplock) {
+			DBG_ERR("Bad batch oplock entry\n");
+			state->valid = false;
+			return true;
+		}
+		state->batch = true;
+	}
 
-		if (EXCLUSIVE_OPLOCK_TYPE(e->op_type)) {
-			if (share_mode_stale_pid(d, i)) {
-				DEBUG(10, ("Found stale duplicate oplock\n"));
-				continue;
-			}
-			/* Exclusive or batch - can only be one. */
-			if (ex_or_batch || level2 || no_oplock) {
-				DEBUG(0, ("Bad exclusive or batch oplock "
-					  "entry %u.", (unsigned)i));
-				return false;
-			}
-			ex_or_batch = true;
+	if (EXCLUSIVE_OPLOCK_TYPE(e->op_type)) {
+		if (share_entry_stale_pid(e)) {
+			DBG_DEBUG("Found stale duplicate oplock\n");
+			return false;
 		}
+		/* Exclusive or batch - can only be one. */
+		if (state->ex_or_batch ||
+		    state->level2 ||
+		    state->no_oplock) {
+			DBG_ERR("Bad exclusive or batch oplock entry\n");
+			state->valid = false;
+			return true;
+		}
+		state->ex_or_batch = true;
+	}
 
-		if (LEVEL_II_OPLOCK_TYPE(e->op_type)) {
-			if (batch || ex_or_batch) {
-				if (share_mode_stale_pid(d, i)) {
-					DEBUG(10, ("Found stale LevelII "
-						   "oplock\n"));
-					continue;
-				}
-				DEBUG(0, ("Bad levelII oplock entry %u.",
-					  (unsigned)i));
+	if (LEVEL_II_OPLOCK_TYPE(e->op_type)) {
+		if (state->batch || state->ex_or_batch) {
+			if (share_entry_stale_pid(e)) {
+				DBG_DEBUG("Found stale LevelII oplock\n");
 				return false;
 			}
-			level2 = true;
+			DBG_ERR("Bad levelII oplock entry\n");
+			state->valid = false;
+			return true;
 		}
+		state->level2 = true;
+	}
 
-		if (e->op_type == NO_OPLOCK) {
-			if (batch || ex_or_batch) {
-				if (share_mode_stale_pid(d, i)) {
-					DEBUG(10, ("Found stale NO_OPLOCK "
-						   "entry\n"));
-					continue;
-				}
-				DEBUG(0, ("Bad no oplock entry %u.",
-					  (unsigned)i));
+	if (e->op_type == NO_OPLOCK) {
+		if (state->batch || state->ex_or_batch) {
+			if (share_entry_stale_pid(e)) {
+				DBG_DEBUG("Found stale NO_OPLOCK entry\n");
 				return false;
 			}
-			no_oplock = true;
+			DBG_ERR("Bad no oplock entry\n");
+			state->valid = false;
+			return true;
 		}
+		state->no_oplock = true;
 	}
 
-	remove_stale_share_mode_entries(d);
+	return false;
+}
 
-	if ((batch || ex_or_batch) && (num_non_stat_opens != 1)) {
-		DEBUG(1, ("got batch (%d) or ex (%d) non-exclusively (%d)\n",
-			  (int)batch, (int)ex_or_batch,
-			  (int)d->num_share_modes));
+/*
+ * Do internal consistency checks on the share mode for a file.
+ */
+
+static bool validate_oplock_types(struct share_mode_lock *lck)
+{
+	struct validate_oplock_types_state state = { .valid = true };
+	bool ok;
+
+	ok = share_mode_forall_entries(lck, validate_oplock_types_fn, &state);
+	if (!ok) {
+		DBG_DEBUG("share_mode_forall_entries failed\n");
+		return false;
+	}
+	if (!state.valid) {
+		DBG_DEBUG("Got invalid oplock configuration\n");
+		return false;
+	}
+
+	if ((state.batch || state.ex_or_batch) &&
+	    (state.num_non_stat_opens != 1)) {
+		DBG_WARNING("got batch (%d) or ex (%d) non-exclusively "
+			    "(%"PRIu32")\n",
+			    (int)state.batch,
+			    (int)state.ex_or_batch,
+			    state.num_non_stat_opens);
 		return false;
 	}
 
 	return true;
 }
 
+struct delay_for_oplock_state {
+	struct files_struct *fsp;
+	struct share_mode_data *d;
+	const struct smb2_lease *lease;
+	bool will_overwrite;
+	uint32_t delay_mask;
+	bool first_open_attempt;
+	bool *lease_broken;
+	bool delay;
+};
+
+static bool delay_for_oplock_fn(
+	struct share_mode_entry *e,
+	bool *modified,
+	void *private_data)
+{
+	struct delay_for_oplock_state *state = private_data;
+	struct files_struct *fsp = state->fsp;
+	const struct smb2_lease *lease = state->lease;
+	struct share_mode_data *d = state->d;
+	struct share_mode_lease *l = NULL;
+	uint32_t e_lease_type = get_lease_type(d, e);
+	uint32_t break_to;
+
+	if (e->op_type == LEASE_OPLOCK) {
+		l = &d->leases[e->lease_idx];
+	}
+
+	break_to = e_lease_type & ~state->delay_mask;
+
+	if (state->will_overwrite) {
+		/*
+		 * we'll decide about SMB2_LEASE_READ later.
+		 *
+		 * Maybe the break will be deferred
+		 */
+		break_to &= ~SMB2_LEASE_HANDLE;
+	}
+
+	DBG_DEBUG("e_lease_type %u, will_overwrite: %u\n",
+		  (unsigned)e_lease_type,
+		  (unsigned)state->will_overwrite);
+
+	if ((lease != NULL) && (l != NULL)) {
+		bool ign;
+
+		ign = smb2_lease_equal(fsp_client_guid(fsp),
+				       &lease->lease_key,
+				       &l->client_guid,
+				       &l->lease_key);
+		if (ign) {
+			return false;
+		}
+	}
+
+	if ((e_lease_type & ~break_to) == 0) {
+		if ((l != NULL) && l->breaking) {
+			state->delay = true;
+		}
+		return false;
+	}
+
+	if (share_entry_stale_pid(e)) {
+		return false;
+	}
+
+	if (state->will_overwrite) {
+		/*
+		 * If we break anyway break to NONE directly.
+		 * Otherwise vfs_set_filelen() will trigger the
+		 * break.
+		 */
+		break_to &= ~(SMB2_LEASE_READ|SMB2_LEASE_WRITE);
+	}
+
+	if (e->op_type != LEASE_OPLOCK) {
+		/*
+		 * Oplocks only support breaking to R or NONE.
+		 */
+		break_to &= ~(SMB2_LEASE_HANDLE|SMB2_LEASE_WRITE);
+	}
+
+	if ((l != NULL) && l->breaking &&
+	    ((l->breaking_to_required & ~break_to) == 0)) {
+		/*
+		 * The lease is already breaking at least as far as we
+		 * need, another message would not change anything for
+		 * the holder. This is the common case when a deferred
+		 * open is retried.
+		 */
+		DBG_DEBUG("lease# %"PRIu32" already breaking to %"PRIu32"\n",
+			  e->lease_idx,
+			  l->breaking_to_required);
+	} else if ((l != NULL) && (state->lease_broken != NULL)) {
+		/*
+		 * All share mode entries of a lease get the same
+		 * break, the lease holder breaks all its opens with
+		 * the first message.
+		 */
+		if (!state->lease_broken[e->lease_idx]) {
+			state->lease_broken[e->lease_idx] = true;
+			DBG_DEBUG("breaking lease# %"PRIu32" from %d to %d\n",
+				  e->lease_idx,
+				  (int)e_lease_type,
+				  (int)break_to);
+			send_break_message(fsp->conn->sconn->msg_ctx,
+					   &fsp->file_id, e, break_to);
+		}
+	} else {
+		DBG_DEBUG("breaking from %d to %d\n",
+			  (int)e_lease_type,
+			  (int)break_to);
+		send_break_message(fsp->conn->sconn->msg_ctx, &fsp->file_id,
+				   e, break_to);
+	}
+	if (e_lease_type & state->delay_mask) {
+		state->delay = true;
+	}
+	if ((l != NULL) && l->breaking && !state->first_open_attempt) {
+		state->delay = true;
+	}
+
+	return false;
+}
+
 static bool delay_for_oplock(files_struct *fsp,
 			     int oplock_request,
 			     const struct smb2_lease *lease,
@@ -1834,112 +2022,49 @@ static bool delay_for_oplock(files_struct *fsp,
 			     uint32_t create_disposition,
 			     bool first_open_attempt)
 {
-	struct share_mode_data *d = lck->data;
-	uint32_t i;
-	bool delay = false;
-	bool will_overwrite;
+	struct delay_for_oplock_state state = {
+		.fsp = fsp,
+		.d = lck->data,
+		.lease = lease,
+		.first_open_attempt = first_open_attempt,
+	};
+	bool ok;
 
 	if ((oplock_request & INTERNAL_OPEN_ONLY) ||
 	    is_stat_open(fsp->access_mask)) {
 		return false;
 	}
 
+	state.delay_mask = have_sharing_violation ?
+		SMB2_LEASE_HANDLE : SMB2_LEASE_WRITE;
+
 	switch (create_disposition) {
 	case FILE_SUPERSEDE:
 	case FILE_OVERWRITE:
 	case FILE_OVERWRITE_IF:
-		will_overwrite = true;
+		state.will_overwrite = true;
 		break;
 	default:
-		will_overwrite = false;
+		state.will_overwrite = false;
 		break;
 	}
 
-	for (i=0; i<d->num_share_modes; i++) {
-		struct share_mode_entry *e = &d->share_modes[i];
-		struct share_mode_lease *l = NULL;
-		uint32_t e_lease_type = get_lease_type(d, e);
-		uint32_t break_to;
-		uint32_t delay_mask = 0;
-
-		if (e->op_type == LEASE_OPLOCK) {
-			l = &d->leases[e->lease_idx];
-		}
-
-		if (have_sharing_violation) {
-			delay_mask = SMB2_LEASE_HANDLE;
-		} else {
-			delay_mask = SMB2_LEASE_WRITE;
-		}
-
-		break_to = e_lease_type & ~delay_mask;
-
-		if (will_overwrite) {
-			/*
-			 * we'll decide about SMB2_LEASE_READ later.
-			 *
-			 * Maybe the break will be deferred
-			 */
-			break_to &= ~SMB2_LEASE_HANDLE;
-		}
-
-		DEBUG(10, ("entry %u: e_lease_type %u, will_overwrite: %u\n",
-			   (unsigned)i, (unsigned)e_lease_type,
-			   (unsigned)will_overwrite));
-
-		if (lease != NULL && l != NULL) {
-			bool ign;
-
-			ign = smb2_lease_equal(fsp_client_guid(fsp),
-					       &lease->lease_key,
-					       &l->client_guid,
-					       &l->lease_key);
-			if (ign) {
-				continue;
-			}
-		}
-
-		if ((e_lease_type & ~break_to) == 0) {
-			if (l != NULL && l->breaking) {
-				delay = true;
-			}
-			continue;
-		}
-
-		if (share_mode_stale_pid(d, i)) {
-			continue;
-		}
-
-		if (will_overwrite) {
-			/*
-			 * If we break anyway break to NONE directly.
-			 * Otherwise vfs_set_filelen() will trigger the
-			 * break.
-			 */
-			break_to &= ~(SMB2_LEASE_READ|SMB2_LEASE_WRITE);
-		}
-
-		if (e->op_type != LEASE_OPLOCK) {
-			/*
-			 * Oplocks only support breaking to R or NONE.
-			 */
-			break_to &= ~(SMB2_LEASE_HANDLE|SMB2_LEASE_WRITE);
-		}
+	if (state.d->num_leases != 0) {
+		/*
+		 * Without this we fall back to one break per share
+		 * mode entry, the receivers cope with duplicates.
+		 */
+		state.lease_broken = talloc_zero_array(
+			talloc_tos(), bool, state.d->num_leases);
+	}
 
-		DEBUG(10, ("breaking from %d to %d\n",
-			   (int)e_lease_type, (int)break_to));
-		send_break_message(fsp->conn->sconn->msg_ctx, &fsp->file_id,
-				   e, break_to);
-		if (e_lease_type & delay_mask) {
-			delay = true;
-		}
-		if (l != NULL && l->breaking && !first_open_attempt) {
-			delay = true;
-		}
-		continue;
+	ok = share_mode_forall_entries(lck, delay_for_oplock_fn, &state);
+	TALLOC_FREE(state.lease_broken);
+	if (!ok) {
+		return false;
 	}
 
-	return delay;
+	return state.delay;
 }
 
 static bool file_has_brlocks(files_struct *fsp)
@@ -1995,6 +2120,12 @@ struct fsp_lease *find_fsp_lease(struct files_struct *new_fsp,
 			continue;
 		}
 		if (smb2_lease_key_equal(&fsp->lease->lease.lease_key, key)) {
+			/*
+			 * The write cache is only used by a lease
+			 * with a single handle, see write_file().
+			 */
+			flush_write_cache(fsp, SAMBA_OPLOCK_RELEASE_FLUSH);
+			delete_write_cache(fsp);
 			fsp->lease->ref_count += 1;
 			return fsp->lease;
 		}
@@ -2161,6 +2292,48 @@ static bool is_same_lease(const files_struct *fsp,
 				&d->leases[e->lease_idx].lease_key);
 }
 
+struct grant_fsp_oplock_state {
+	struct files_struct *fsp;
+	struct share_mode_data *d;
+	const struct smb2_lease *lease;
+	uint32_t granted;
+	bool got_handle_lease;
+	bool got_oplock;
+};
+
+static bool grant_fsp_oplock_fn(
+	struct share_mode_entry *e,
+	bool *modified,
+	void *private_data)
+{
+	struct grant_fsp_oplock_state *state = private_data;
+	struct share_mode_data *d = state->d;
+	uint32_t e_lease_type = get_lease_type(d, e);
+
+	if ((state->granted & SMB2_LEASE_WRITE) &&
+	    !is_same_lease(state->fsp, d, e, state->lease) &&
+	    !share_entry_stale_pid(e)) {
+		/*
+		 * Can grant only one writer
+		 */
+		state->granted &= ~SMB2_LEASE_WRITE;
+	}
+
+	if ((e_lease_type & SMB2_LEASE_HANDLE) &&
+	    !state->got_handle_lease &&
+	    !share_entry_stale_pid(e)) {
+		state->got_handle_lease = true;
+	}
+
+	if ((e->op_type != LEASE_OPLOCK) &&
+	    !state->got_oplock &&
+	    !share_entry_stale_pid(e)) {
+		state->got_oplock = true;
+	}
+
+	return false;
+}
+
 static NTSTATUS grant_fsp_oplock_type(struct smb_request *req,
 				      struct files_struct *fsp,
 				      struct share_mode_lock *lck,
@@ -2168,9 +2341,13 @@ static NTSTATUS grant_fsp_oplock_type(struct smb_request *req,
 				      struct smb2_lease *lease)
 {
 	struct share_mode_data *d = lck->data;
+	struct grant_fsp_oplock_state state = {
+		.fsp = fsp,
+		.d = d,
+		.lease = lease,
+	};
 	bool got_handle_lease = false;
 	bool got_oplock = false;
-	uint32_t i;
 	uint32_t granted;
 	uint32_t lease_idx = UINT32_MAX;
 	bool ok;
@@ -2220,32 +2397,17 @@ static NTSTATUS grant_fsp_oplock_type(struct smb_request *req,
 		granted &= ~SMB2_LEASE_READ;
 	}
 
-	for (i=0; i<d->num_share_modes; i++) {
-		struct share_mode_entry *e = &d->share_modes[i];
-		uint32_t e_lease_type;
+	state.granted = granted;
 
-		e_lease_type = get_lease_type(d, e);
-
-		if ((granted & SMB2_LEASE_WRITE) &&
-		    !is_same_lease(fsp, d, e, lease) &&
-		    !share_mode_stale_pid(d, i)) {
-			/*
-			 * Can grant only one writer
-			 */
-			granted &= ~SMB2_LEASE_WRITE;
-		}
-
-		if ((e_lease_type & SMB2_LEASE_HANDLE) && !got_handle_lease &&
-		    !share_mode_stale_pid(d, i)) {
-			got_handle_lease = true;
-		}
-
-		if ((e->op_type != LEASE_OPLOCK) && !got_oplock &&
-		    !share_mode_stale_pid(d, i)) {
-			got_oplock = true;
-		}
+	ok = share_mode_forall_entries(lck, grant_fsp_oplock_fn, &state);
+	if (!ok) {
+		return NT_STATUS_INTERNAL_ERROR;
 	}
 
+	granted = state.granted;
+	got_handle_lease = state.got_handle_lease;
+	got_oplock = state.got_oplock;
+
 	if ((granted & SMB2_LEASE_READ) && !(granted & SMB2_LEASE_WRITE)) {
 		bool allow_level2 =
 			(global_client_caps & CAP_LEVEL_II_OPLOCKS) &&
@@ -2354,6 +2516,13 @@ static struct deferred_open_record *deferred_open_record_create(
 struct defer_open_state {
 	struct smbXsrv_connection *xconn;
 	uint64_t mid;
+	struct tevent_context *ev;
+	struct file_id id;
+	struct timeval abs_timeout;
+	bool delayed_for_oplocks;
+	bool have_lease;
+	struct GUID client_guid;
+	struct smb2_lease_key lease_key;
 };
 
 static void defer_open_done(struct tevent_req *req);
@@ -2372,6 +2541,7 @@ static void defer_open(struct share_mode_lock *lck,
 		       struct timeval timeout,
 		       struct smb_request *req,
 		       bool delayed_for_oplocks,
+		       const struct smb2_lease *lease,
 		       struct file_id id)
 {
 	struct deferred_open_record *open_rec = NULL;
@@ -2402,8 +2572,20 @@ static void defer_open(struct share_mode_lock *lck,
 	if (watch_state == NULL) {
 		exit_server("talloc failed");
 	}
-	watch_state->xconn = req->xconn;
-	watch_state->mid = req->mid;
+	*watch_state = (struct defer_open_state) {
+		.xconn = req->xconn,
+		.mid = req->mid,
+		.ev = req->sconn->ev_ctx,
+		.id = id,
+		.abs_timeout = abs_timeout,
+		.delayed_for_oplocks = delayed_for_oplocks,
+	};
+	if (lease != NULL) {
+		watch_state->have_lease = true;
+		watch_state->client_guid =
+			req->sconn->client->connections->smb2.client.guid;
+		watch_state->lease_key = lease->lease_key;
+	}
 
 	DBG_DEBUG("defering mid %" PRIu64 "\n", req->mid);
 
@@ -2429,6 +2611,104 @@ static void defer_open(struct share_mode_lock *lck,
 	}
 }
 
+struct defer_open_breaking_state {
+	const struct defer_open_state *state;
+	const struct share_mode_data *d;
+	bool breaking;
+};
+
+static bool defer_open_breaking_fn(
+	struct share_mode_entry *e,
+	bool *modified,
+	void *private_data)
+{
+	struct defer_open_breaking_state *b = private_data;
+	const struct defer_open_state *state = b->state;
+	const struct share_mode_lease *l = NULL;
+
+	if (e->op_type != LEASE_OPLOCK) {
+		return false;
+	}
+	if (e->lease_idx >= b->d->num_leases) {
+		return false;
+	}
+	l = &b->d->leases[e->lease_idx];
+
+	if (!l->breaking) {
+		return false;
+	}
+	if (state->have_lease &&
+	    smb2_lease_equal(&state->client_guid,
+			     &state->lease_key,
+			     &l->client_guid,
+			     &l->lease_key)) {
+		return false;
+	}
+	if (!serverid_exists(&e->pid)) {
+		/*
+		 * Let the retried open clean up behind the dead
+		 * holder.
+		 */
+		b->breaking = false;
+		return true;
+	}
+
+	b->breaking = true;
+	return false;
+}
+
+/*
+ * Every lease holder acking its break modifies the share mode
+ * record and triggers our watch. As long as any other lease on the
+ * file is still breaking, delay_for_oplock() would just defer the
+ * open again, so keep waiting on the record instead of walking the
+ * whole open path once per holder. Returns true if the watch was
+ * re-armed.
+ */
+
+static bool defer_open_rewatch(struct defer_open_state *state)
+{
+	struct share_mode_lock *lck = NULL;
+	struct defer_open_breaking_state b = { .state = state };
+	struct tevent_req *watch_req = NULL;
+	bool ok;
+
+	if (!state->delayed_for_oplocks) {
+		return false;
+	}
+
+	lck = get_existing_share_mode_lock(talloc_tos(), state->id);
+	if (lck == NULL) {
+		return false;
+	}
+	b.d = lck->data;
+
+	ok = share_mode_forall_entries(lck, defer_open_breaking_fn, &b);
+	if (!ok || !b.breaking) {
+		TALLOC_FREE(lck);
+		return false;
+	}
+
+	watch_req = dbwrap_watched_watch_send(state,
+					      state->ev,
+					      lck->data->record,
+					      (struct server_id){0});
+	TALLOC_FREE(lck);
+	if (watch_req == NULL) {
+		return false;
+	}
+	tevent_req_set_callback(watch_req, defer_open_done, state);
+
+	ok = tevent_req_set_endtime(watch_req, state->ev, state->abs_timeout);
+	if (!ok) {
+		exit_server("tevent_req_set_endtime failed");
+	}
+
+	DBG_DEBUG("leases still breaking, mid %"PRIu64" keeps waiting\n",
+		  state->mid);
+	return true;
+}
+
 static void defer_open_done(struct tevent_req *req)
 {
 	struct defer_open_state *state = tevent_req_callback_data(
@@ -2445,6 +2725,8 @@ static void defer_open_done(struct tevent_req *req)
 		 * Even if it failed, retry anyway. TODO: We need a way to
 		 * tell a re-scheduled open about that error.
 		 */
+	} else if (defer_open_rewatch(state)) {
+		return;
 	}
 
 	DEBUG(10, ("scheduling mid %llu\n", (unsigned long long)state->mid));
@@ -2633,6 +2915,7 @@ static NTSTATUS fcb_or_dos_open(struct smb_request *req,
 
 static void schedule_defer_open(struct share_mode_lock *lck,
 				struct file_id id,
+				const struct smb2_lease *lease,
 				struct timeval request_time,
 				struct smb_request *req)
 {
@@ -2658,7 +2941,7 @@ static void schedule_defer_open(struct share_mode_lock *lck,
 		return;
 	}
 
-	defer_open(lck, request_time, timeout, req, true, id);
+	defer_open(lck, request_time, timeout, req, true, lease, id);
 }
 
 /****************************************************************************
@@ -3266,7 +3549,7 @@ static NTSTATUS open_file_ntcreate(connection_struct *conn,
 		return NT_STATUS_ACCESS_DENIED;
 	}
 
-	fsp->file_id = vfs_file_id_from_sbuf(conn, &smb_fname->st);
+	fsp_set_file_id(fsp, vfs_file_id_from_sbuf(conn, &smb_fname->st));
 	fsp->share_access = share_access;
 	fsp->fh->private_options = private_flags;
 	fsp->access_mask = open_access_mask; /* We change this to the
@@ -3359,8 +3642,8 @@ static NTSTATUS open_file_ntcreate(connection_struct *conn,
 					 create_disposition,
 					 first_open_attempt);
 		if (delay) {
-			schedule_defer_open(lck, fsp->file_id, request_time,
-					    req);
+			schedule_defer_open(lck, fsp->file_id, lease,
+					    request_time, req);
 			TALLOC_FREE(lck);
 			DEBUG(10, ("Sent oplock break request to kernel "
 				   "oplock holder\n"));
@@ -3493,7 +3776,7 @@ static NTSTATUS open_file_ntcreate(connection_struct *conn,
 					 create_disposition,
 					 first_open_attempt);
 		if (delay) {
-			schedule_defer_open(lck, fsp->file_id,
+			schedule_defer_open(lck, fsp->file_id, lease,
 					    request_time, req);
 			TALLOC_FREE(lck);
 			fd_close(fsp);
@@ -3598,7 +3881,7 @@ static NTSTATUS open_file_ntcreate(connection_struct *conn,
 
 			if (!request_timed_out(request_time, timeout)) {
 				defer_open(lck, request_time, timeout, req,
-					   false, id);
+					   false, NULL, id);
 			}
 		}
 
@@ -4151,7 +4434,7 @@ static NTSTATUS open_directory(connection_struct *conn,
 	 * Setup the files_struct for it.
 	 */
 
-	fsp->file_id = vfs_file_id_from_sbuf(conn, &smb_dname->st);
+	fsp_set_file_id(fsp, vfs_file_id_from_sbuf(conn, &smb_dname->st));
 	fsp->vuid = req ? req->vuid : UID_FIELD_INVALID;
 	fsp->file_pid = req ? req->smbpid : 0;
 	fsp->can_lock = False;
@@ -4563,6 +4846,100 @@ static NTSTATUS open_streams_for_delete(connection_struct *conn,
 	return status;
 }
 
+/*
+ * Remember the last few descriptors computed by se_create_child_secdesc().
+ * Creating many files in one directory (unpacking an archive, a build)
+ * asks for the same inheritance over and over. The result only depends
+ * on the arguments, so entries never go stale, they just fall off the
+ * end of the list.
+ */
+
+#define INHERITED_ACL_CACHE_SIZE 8
+
+struct inherited_acl_cache_entry {
+	struct inherited_acl_cache_entry *prev, *next;
+	struct security_descriptor *parent_desc;
+	struct dom_sid owner_sid;
+	struct dom_sid group_sid;
+	bool is_directory;
+	struct security_descriptor *child_desc;
+};
+
+static struct inherited_acl_cache_entry *inherited_acl_cache;
+static size_t inherited_acl_cache_count;
+
+static NTSTATUS create_child_secdesc_cached(
+	TALLOC_CTX *mem_ctx,
+	struct security_descriptor **ppsd,
+	const struct security_descriptor *parent_desc,
+	const struct dom_sid *owner_sid,
+	const struct dom_sid *group_sid,
+	bool is_directory)
+{
+	struct inherited_acl_cache_entry *e = NULL;
+	struct security_descriptor *psd = NULL;
+	size_t size = 0;
+	NTSTATUS status;
+
+	for (e = inherited_acl_cache; e != NULL; e = e->next) {
+		if (e->is_directory == is_directory &&
+		    dom_sid_equal(&e->owner_sid, owner_sid) &&
+		    dom_sid_equal(&e->group_sid, group_sid) &&
+		    security_descriptor_equal(e->parent_desc, parent_desc)) {
+			break;
+		}
+	}
+
+	if (e != NULL) {
+		DLIST_PROMOTE(inherited_acl_cache, e);
+		psd = security_descriptor_copy(mem_ctx, e->child_desc);
+		if (psd == NULL) {
+			return NT_STATUS_NO_MEMORY;
+		}
+		*ppsd = psd;
+		return NT_STATUS_OK;
+	}
+
+	status = se_create_child_secdesc(mem_ctx,
+					 &psd,
+					 &size,
+					 parent_desc,
+					 owner_sid,
+					 group_sid,
+					 is_directory);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	if (inherited_acl_cache_count >= INHERITED_ACL_CACHE_SIZE) {
+		e = DLIST_TAIL(inherited_acl_cache);
+		DLIST_REMOVE(inherited_acl_cache, e);
+		TALLOC_FREE(e);
+		inherited_acl_cache_count -= 1;
+	}
+
+	e = talloc_zero(NULL, struct inherited_acl_cache_entry);
+	if (e == NULL) {
+		goto done;
+	}
+	e->parent_desc = security_descriptor_copy(e, parent_desc);
+	e->child_desc = security_descriptor_copy(e, psd);
+	if (e->parent_desc == NULL || e->child_desc == NULL) {
+		TALLOC_FREE(e);
+		goto done;
+	}
+	sid_copy(&e->owner_sid, owner_sid);
+	sid_copy(&e->group_sid, group_sid);
+	e->is_directory = is_directory;
+
+	DLIST_ADD(inherited_acl_cache, e);
+	inherited_acl_cache_count += 1;
+
+done:
+	*ppsd = psd;
+	return NT_STATUS_OK;
+}
+
 /*********************************************************************
  Create a default ACL by inheriting from the parent. If no inheritance
  from the parent available, don't set anything. This will leave the actual
@@ -4590,7 +4967,6 @@ static NTSTATUS inherit_new_acl(files_struct *fsp)
 	bool try_system = false;
 	const struct dom_sid *SY_U_sid = NULL;
 	const struct dom_sid *SY_G_sid = NULL;
-	size_t size = 0;
 	struct smb_filename *parent_smb_fname = NULL;
 
 	if (!parent_dirname(frame, fsp->fsp_name->base_name, &parent_name, NULL)) {
@@ -4734,9 +5110,8 @@ static NTSTATUS inherit_new_acl(files_struct *fsp)
 		}
 	}
 
-	status = se_create_child_secdesc(frame,
+	status = create_child_secdesc_cached(frame,
 			&psd,
-			&size,
 			parent_desc,
 			owner_sid,
 			group_sid,
@@ -4916,6 +5291,69 @@ static void lease_match_parser(
 	return;
 }
 
+struct lease_match_break_state {
+	struct messaging_context *msg_ctx;
+	struct share_mode_data *d;
+	const struct smb2_lease_key *lease_key;
+	uint16_t version;
+	uint16_t epoch;
+};
+
+static bool lease_match_break_fn(
+	struct share_mode_entry *e,
+	bool *modified,
+	void *private_data)
+{
+	struct lease_match_break_state *state = private_data;
+	struct share_mode_data *d = state->d;
+	uint32_t e_lease_type = get_lease_type(d, e);
+
+	if (share_entry_stale_pid(e)) {
+		return false;
+	}
+
+	if (e->op_type == LEASE_OPLOCK) {
+		struct share_mode_lease *l = &d->leases[e->lease_idx];
+
+		if (!smb2_lease_key_equal(&l->lease_key, state->lease_key)) {
+			return false;
+		}
+		state->epoch = l->epoch;
+		state->version = l->lease_version;
+	}
+
+	if (e_lease_type == SMB2_LEASE_NONE) {
+		return false;
+	}
+
+	send_break_message(state->msg_ctx, &d->id, e, SMB2_LEASE_NONE);
+
+	/*
+	 * Windows 7 and 8 lease clients
+	 * are broken in that they will not
+	 * respond to lease break requests
+	 * whilst waiting for an outstanding
+	 * open request on that lease handle
+	 * on the same TCP connection, due
+	 * to holding an internal inode lock.
+	 *
+	 * This means we can't reschedule
+	 * ourselves here, but must return
+	 * from the create.
+	 *
+	 * Work around:
+	 *
+	 * Send the breaks and then return
+	 * SMB2_LEASE_NONE in the lease handle
+	 * to cause them to acknowledge the
+	 * lease break. Consultation with
+	 * Microsoft engineering confirmed
+	 * this approach is safe.
+	 */
+
+	return false;
+}
+
 static NTSTATUS lease_match(connection_struct *conn,
 			    struct smb_request *req,
 			    struct smb2_lease_key *lease_key,
@@ -4932,6 +5370,12 @@ static NTSTATUS lease_match(connection_struct *conn,
 		.fname = fname,
 		.match_status = NT_STATUS_OK
 	};
+	struct lease_match_break_state break_state = {
+		.msg_ctx = conn->sconn->msg_ctx,
+		.lease_key = lease_key,
+		.version = *p_version,
+		.epoch = *p_epoch,
+	};
 	uint32_t i;
 	NTSTATUS status;
 
@@ -4959,8 +5403,7 @@ static NTSTATUS lease_match(connection_struct *conn,
 	/* We have to break all existing leases. */
 	for (i = 0; i < state.num_file_ids; i++) {
 		struct share_mode_lock *lck;
-		struct share_mode_data *d;
-		uint32_t j;
+		bool ok;
 
 		if (file_id_equal(&state.ids[i], &state.id)) {
 			/* Don't need to break our own file. */
@@ -4972,59 +5415,19 @@ static NTSTATUS lease_match(connection_struct *conn,
 			/* Race condition - file already closed. */
 			continue;
 		}
-		d = lck->data;
-		for (j=0; j<d->num_share_modes; j++) {
-			struct share_mode_entry *e = &d->share_modes[j];
-			uint32_t e_lease_type = get_lease_type(d, e);
-
-			if (share_mode_stale_pid(d, j)) {
-				continue;
-			}
-
-			if (e->op_type == LEASE_OPLOCK) {
-				struct share_mode_lease *l = NULL;
-				l = &lck->data->leases[e->lease_idx];
-				if (!smb2_lease_key_equal(&l->lease_key,
-							  lease_key)) {
-					continue;
-				}
-				*p_epoch = l->epoch;
-				*p_version = l->lease_version;
-			}
-
-			if (e_lease_type == SMB2_LEASE_NONE) {
-				continue;
-			}
-
-			send_break_message(conn->sconn->msg_ctx, &d->id, e,
-					   SMB2_LEASE_NONE);
-
-			/*
-			 * Windows 7 and 8 lease clients
-			 * are broken in that they will not
-			 * respond to lease break requests
-			 * whilst waiting for an outstanding
-			 * open request on that lease handle
-			 * on the same TCP connection, due
-			 * to holding an internal inode lock.
-			 *
-			 * This means we can't reschedule
-			 * ourselves here, but must return
-			 * from the create.
-			 *
-			 * Work around:
-			 *
-			 * Send the breaks and then return
-			 * SMB2_LEASE_NONE in the lease handle
-			 * to cause them to acknowledge the
-			 * lease break. Consultation with
-			 * Microsoft engineering confirmed
-			 * this approach is safe.
-			 */
+		break_state.d = lck->data;
 
+		ok = share_mode_forall_entries(
+			lck, lease_match_break_fn, &break_state);
+		if (!ok) {
+			DBG_DEBUG("share_mode_forall_entries failed\n");
 		}
 		TALLOC_FREE(lck);
 	}
+
+	*p_version = break_state.version;
+	*p_epoch = break_state.epoch;
+
 	/*
 	 * Ensure we don't grant anything more so we
 	 * never upgrade.
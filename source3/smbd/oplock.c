@@ -180,25 +180,58 @@ uint32_t get_lease_type(const struct share_mode_data *d,
 	return map_oplock_to_lease_type(e->op_type);
 }
 
+struct update_num_read_oplocks_state {
+	const struct share_mode_data *d;
+	uint32_t num_read_oplocks;
+	uint32_t e_lease_type;
+};
+
+static void get_own_lease_type_fn(struct share_mode_entry *e,
+				  size_t num_share_modes,
+				  bool *modified,
+				  void *private_data)
+{
+	struct update_num_read_oplocks_state *state = private_data;
+	state->e_lease_type = get_lease_type(state->d, e);
+}
+
+static bool update_num_read_oplocks_fn(
+	struct share_mode_entry *e,
+	bool *modified,
+	void *private_data)
+{
+	struct update_num_read_oplocks_state *state = private_data;
+	uint32_t e_lease_type = get_lease_type(state->d, e);
+
+	if (e_lease_type & SMB2_LEASE_READ) {
+		state->num_read_oplocks += 1;
+	}
+	return false;
+}
+
 bool update_num_read_oplocks(files_struct *fsp, struct share_mode_lock *lck)
 {
 	struct share_mode_data *d = lck->data;
+	struct update_num_read_oplocks_state state = { .d = d };
 	struct byte_range_lock *br_lck;
 	uint32_t num_read_oplocks = 0;
-	uint32_t i;
+	bool ok;
 
 	if (fsp_lease_type_is_exclusive(fsp)) {
-		const struct share_mode_entry *e = NULL;
+		struct server_id self = messaging_server_id(
+			fsp->conn->sconn->msg_ctx);
 		uint32_t e_lease_type = 0;
 
 		/*
 		 * If we're fully exclusive, we don't need a brlock entry
 		 */
-		remove_stale_share_mode_entries(d);
-
-		e = find_share_mode_entry(lck, fsp);
-		if (e != NULL) {
-			e_lease_type = get_lease_type(d, e);
+		ok = share_mode_entry_do(lck,
+					 self,
+					 fsp->fh->gen_id,
+					 get_own_lease_type_fn,
+					 &state);
+		if (ok) {
+			e_lease_type = state.e_lease_type;
 		}
 
 		if (!lease_type_is_exclusive(e_lease_type)) {
@@ -223,14 +256,13 @@ bool update_num_read_oplocks(files_struct *fsp, struct share_mode_lock *lck)
 		return true;
 	}
 
-	for (i=0; i<d->num_share_modes; i++) {
-		struct share_mode_entry *e = &d->share_modes[i];
-		uint32_t e_lease_type = get_lease_type(d, e);
-
-		if (e_lease_type & SMB2_LEASE_READ) {
-			num_read_oplocks += 1;
-		}
+	ok = share_mode_forall_entries(
+		lck, update_num_read_oplocks_fn, &state);
+	if (!ok) {
+		DBG_DEBUG("share_mode_forall_entries failed\n");
+		return false;
 	}
+	num_read_oplocks = state.num_read_oplocks;
 
 	br_lck = brl_get_locks_readonly(fsp);
 	if (br_lck == NULL) {
@@ -524,6 +556,11 @@ static struct files_struct *downgrade_lease_fsps(struct files_struct *fsp,
 
 	fsp_lease_update(state->lck, fsp_client_guid(fsp), fsp->lease);
 
+	if ((fsp->lease->lease.lease_state & SMB2_LEASE_WRITE) == 0) {
+		flush_write_cache(fsp, SAMBA_OPLOCK_RELEASE_FLUSH);
+		delete_write_cache(fsp);
+	}
+
 	return NULL;
 }
 
@@ -911,6 +948,8 @@ static void process_oplock_break_message(struct messaging_context *msg_ctx,
 		return;
 	}
 
+	TALLOC_FREE(fsp->qinfo_cache);
+
 	break_from = fsp_lease_type(fsp);
 
 	if (fsp->oplock_type != LEASE_OPLOCK) {
@@ -1105,6 +1144,8 @@ static void process_kernel_oplock_break(struct messaging_context *msg_ctx,
 		return;
 	}
 
+	TALLOC_FREE(fsp->qinfo_cache);
+
 	if (fsp->sent_oplock_break != NO_BREAK_SENT) {
 		/* This is ok, kernel oplocks come in completely async */
 		DEBUG(3, ("Got a kernel oplock request while waiting for a "
@@ -1231,15 +1272,97 @@ static void send_break_to_none(struct messaging_context *msg_ctx,
 			   (uint8_t *)msg, sizeof(msg));
 }
 
+struct do_break_to_none_state {
+	struct break_to_none_state *state;
+	struct share_mode_data *d;
+	bool *lease_broken;
+};
+
+static bool do_break_lease_to_none(struct share_mode_entry *e,
+				   struct do_break_to_none_state *b)
+{
+	struct break_to_none_state *state = b->state;
+	struct share_mode_lease *l = NULL;
+
+	if (e->lease_idx >= b->d->num_leases) {
+		DBG_ERR("Invalid lease_idx %"PRIu32"\n", e->lease_idx);
+		return false;
+	}
+	if (b->lease_broken[e->lease_idx]) {
+		/*
+		 * Only one break per lease, even with multiple
+		 * share mode entries for it.
+		 */
+		return false;
+	}
+	l = &b->d->leases[e->lease_idx];
+
+	if ((l->current_state & SMB2_LEASE_READ) == 0) {
+		return false;
+	}
+	if (smb2_lease_equal(&state->client_guid,
+			     &state->lease_key,
+			     &l->client_guid,
+			     &l->lease_key)) {
+		DBG_DEBUG("Don't break our own lease\n");
+		return false;
+	}
+
+	DBG_DEBUG("Breaking lease# %"PRIu32"\n", e->lease_idx);
+
+	b->lease_broken[e->lease_idx] = true;
+	send_break_to_none(state->sconn->msg_ctx, &state->id, e);
+	return false;
+}
+
+static bool do_break_to_none_fn(
+	struct share_mode_entry *e,
+	bool *modified,
+	void *private_data)
+{
+	struct do_break_to_none_state *b = private_data;
+	struct break_to_none_state *state = b->state;
+
+	if (!is_valid_share_mode_entry(e)) {
+		return false;
+	}
+	if (e->op_type == LEASE_OPLOCK) {
+		return do_break_lease_to_none(e, b);
+	}
+
+	/*
+	 * As there could have been multiple writes waiting at the
+	 * lock_share_entry gate we may not be the first to
+	 * enter. Hence the state of the op_types in the share mode
+	 * entries may be partly NO_OPLOCK and partly LEVEL_II
+	 * oplock. It will do no harm to re-send break messages to
+	 * those smbd's that are still waiting their turn to remove
+	 * their LEVEL_II state, and also no harm to ignore existing
+	 * NO_OPLOCK states. JRA.
+	 */
+
+	DBG_DEBUG("e->op_type == %d\n", e->op_type);
+
+	if (e->op_type == NO_OPLOCK) {
+		return false;
+	}
+
+	/* Paranoia .... */
+	SMB_ASSERT(!EXCLUSIVE_OPLOCK_TYPE(e->op_type));
+
+	send_break_to_none(state->sconn->msg_ctx, &state->id, e);
+	return false;
+}
+
 static void do_break_to_none(struct tevent_context *ctx,
 			     struct tevent_immediate *im,
 			     void *private_data)
 {
 	struct break_to_none_state *state = talloc_get_type_abort(
 		private_data, struct break_to_none_state);
-	uint32_t i;
+	struct do_break_to_none_state b = { .state = state };
 	struct share_mode_lock *lck;
-	struct share_mode_data *d;
+	bool ok;
 
 	lck = get_existing_share_mode_lock(talloc_tos(), state->id);
 	if (lck == NULL) {
@@ -1247,94 +1370,24 @@ static void do_break_to_none(struct tevent_context *ctx,
 			  __func__, file_id_string_tos(&state->id)));
 		goto done;
 	}
-	d = lck->data;
+	b.d = lck->data;
 
 	/*
-	 * Walk leases and oplocks separately: We have to send one break per
-	 * lease. If we have multiple share_mode_entry having a common lease,
-	 * we would break the lease twice if we don't walk the leases list
-	 * separately.
+	 * Walk the share mode entries once, but send only one break
+	 * per lease: If we have multiple share_mode_entry having a
+	 * common lease, we would break the lease twice otherwise.
 	 */
-
-	for (i=0; i<d->num_leases; i++) {
-		struct share_mode_lease *l = &d->leases[i];
-		struct share_mode_entry *e = NULL;
-		uint32_t j;
-
-		if ((l->current_state & SMB2_LEASE_READ) == 0) {
-			continue;
-		}
-		if (smb2_lease_equal(&state->client_guid,
-				     &state->lease_key,
-				     &l->client_guid,
-				     &l->lease_key)) {
-			DEBUG(10, ("Don't break our own lease\n"));
-			continue;
-		}
-
-		for (j=0; j<d->num_share_modes; j++) {
-			e = &d->share_modes[j];
-
-			if (!is_valid_share_mode_entry(e)) {
-				continue;
-			}
-			if (e->lease_idx == i) {
-				break;
-			}
-		}
-		if (j == d->num_share_modes) {
-			DEBUG(0, ("leases[%"PRIu32"] has no share mode\n",
-				  i));
-			continue;
-		}
-
-		DEBUG(10, ("Breaking lease# %"PRIu32" with share_entry# "
-			   "%"PRIu32"\n", i, j));
-
-		send_break_to_none(state->sconn->msg_ctx, &state->id, e);
+	b.lease_broken = talloc_zero_array(
+		lck, bool, MAX(b.d->num_leases, 1));
+	if (b.lease_broken == NULL) {
+		DBG_WARNING("talloc_zero_array failed\n");
+		TALLOC_FREE(lck);
+		goto done;
 	}
 
-	for(i = 0; i < d->num_share_modes; i++) {
-		struct share_mode_entry *e = &d->share_modes[i];
-
-		if (!is_valid_share_mode_entry(e)) {
-			continue;
-		}
-		if (e->op_type == LEASE_OPLOCK) {
-			/*
-			 * Took care of those in the loop above
-			 */
-			continue;
-		}
-
-		/*
-		 * As there could have been multiple writes waiting at the
-		 * lock_share_entry gate we may not be the first to
-		 * enter. Hence the state of the op_types in the share mode
-		 * entries may be partly NO_OPLOCK and partly LEVEL_II
-		 * oplock. It will do no harm to re-send break messages to
-		 * those smbd's that are still waiting their turn to remove
-		 * their LEVEL_II state, and also no harm to ignore existing
-		 * NO_OPLOCK states. JRA.
-		 */
-
-		DEBUG(10, ("%s: share_entry[%i]->op_type == %d\n", __func__,
-			   i, e->op_type ));
-
-		if (e->op_type == NO_OPLOCK) {
-			continue;
-		}
-
-		/* Paranoia .... */
-		if (EXCLUSIVE_OPLOCK_TYPE(e->op_type)) {
-			DEBUG(0,("%s: PANIC. "
-				 "share mode entry %d is an exclusive "
-				 "oplock !\n", __func__, i ));
-			TALLOC_FREE(lck);
-			abort();
-		}
-
-		send_break_to_none(state->sconn->msg_ctx, &state->id, e);
+	ok = share_mode_forall_entries(lck, do_break_to_none_fn, &b);
+	if (!ok) {
+		DBG_DEBUG("share_mode_forall_entries failed\n");
 	}
 
 	/* We let the message receivers handle removing the oplock state
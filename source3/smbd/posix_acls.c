@@ -29,6 +29,8 @@
 #include "../librpc/gen_ndr/idmap.h"
 #include "../librpc/gen_ndr/ndr_smb_acl.h"
 #include "lib/param/loadparm.h"
+#include "lib/crypto/sha256.h"
+#include "lib/util/memcache.h"
 
 extern const struct generic_mapping file_generic_mapping;
 
@@ -3275,6 +3277,203 @@ static size_t merge_default_aces( struct security_ace *nt_ace_list, size_t num_a
 }
 
 
+/****************************************************************************
+ Per process cache of security descriptors mapped from POSIX ACLs.
+
+ Mapping the ACL entries to SIDs and building the canonical ACE lists is
+ expensive, but the result only depends on the POSIX ACLs, the inheritance
+ information, owner, group and mode of the file and the share options. The
+ key hashes exactly that, so entries can't go stale when a file changes and
+ files with the same ACL, typically an inherited one, share an entry.
+ Changed id mappings are only picked up when the cache is flushed on a
+ configuration reload.
+****************************************************************************/
+
+static struct memcache *posix_acl_sd_cache;
+static bool posix_acl_sd_cache_initialized;
+
+struct posix_acl_sd_cache_key {
+	int snum;
+	uint32_t security_info;
+	uid_t uid;
+	gid_t gid;
+	mode_t mode;
+	uint8_t hash[SHA256_DIGEST_LENGTH];
+};
+
+/*
+ * Rough per entry memcache overhead, used to turn the entry limit into
+ * a memcache size. The descriptors themselves are talloc objects and
+ * not accounted for by memcache.
+ */
+#define POSIX_ACL_SD_CACHE_ENTRY_OVERHEAD 64
+
+static struct memcache *posix_acl_sd_cache_get(void)
+{
+	int max_entries;
+
+	if (posix_acl_sd_cache_initialized) {
+		return posix_acl_sd_cache;
+	}
+	posix_acl_sd_cache_initialized = true;
+
+	max_entries = lp_smbd_posix_acl_cache_entries();
+	if (max_entries <= 0) {
+		return NULL;
+	}
+
+	posix_acl_sd_cache = memcache_init(
+		NULL,
+		(size_t)max_entries *
+		(sizeof(struct posix_acl_sd_cache_key) +
+		 sizeof(void *) +
+		 POSIX_ACL_SD_CACHE_ENTRY_OVERHEAD));
+	if (posix_acl_sd_cache == NULL) {
+		DBG_ERR("memcache_init failed\n");
+	}
+
+	return posix_acl_sd_cache;
+}
+
+static bool posix_acl_sd_hash_acl(SHA256_CTX *ctx, SMB_ACL_T acl)
+{
+	enum ndr_err_code ndr_err;
+	DATA_BLOB blob;
+	uint8_t present = (acl != NULL);
+
+	samba_SHA256_Update(ctx, &present, sizeof(present));
+	if (acl == NULL) {
+		return true;
+	}
+
+	ndr_err = ndr_push_struct_blob(
+		&blob, talloc_tos(), acl,
+		(ndr_push_flags_fn_t)ndr_push_smb_acl_t);
+	if (!NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
+		DBG_DEBUG("ndr_push_smb_acl_t failed: %s\n",
+			  ndr_errstr(ndr_err));
+		return false;
+	}
+
+	samba_SHA256_Update(ctx, (uint8_t *)&blob.length, sizeof(blob.length));
+	samba_SHA256_Update(ctx, blob.data, blob.length);
+	data_blob_free(&blob);
+	return true;
+}
+
+static void posix_acl_sd_hash_pai(SHA256_CTX *ctx,
+				  const struct pai_entry *entry_list)
+{
+	const struct pai_entry *paie = NULL;
+
+	for (paie = entry_list; paie != NULL; paie = paie->next) {
+		struct {
+			uint32_t owner_type;
+			uint32_t id;
+			uint32_t type;
+			uint8_t ace_flags;
+		} e;
+
+		ZERO_STRUCT(e);
+		e.owner_type = paie->owner_type;
+		e.id = paie->unix_ug.id;
+		e.type = paie->unix_ug.type;
+		e.ace_flags = paie->ace_flags;
+		samba_SHA256_Update(ctx, (uint8_t *)&e, sizeof(e));
+	}
+}
+
+static bool posix_acl_sd_cache_key(struct connection_struct *conn,
+				   const SMB_STRUCT_STAT *sbuf,
+				   const struct pai_val *pal,
+				   SMB_ACL_T posix_acl,
+				   SMB_ACL_T def_acl,
+				   uint32_t security_info,
+				   struct posix_acl_sd_cache_key *key)
+{
+	SHA256_CTX ctx;
+	bool ok;
+
+	if (posix_acl_sd_cache_get() == NULL) {
+		return false;
+	}
+
+	ZERO_STRUCTP(key);
+	key->snum = SNUM(conn);
+	key->security_info = security_info &
+		(SECINFO_OWNER|SECINFO_GROUP|SECINFO_DACL);
+	key->uid = sbuf->st_ex_uid;
+	key->gid = sbuf->st_ex_gid;
+	key->mode = sbuf->st_ex_mode;
+
+	samba_SHA256_Init(&ctx);
+
+	ok = posix_acl_sd_hash_acl(&ctx, posix_acl);
+	if (!ok) {
+		return false;
+	}
+	ok = posix_acl_sd_hash_acl(&ctx, def_acl);
+	if (!ok) {
+		return false;
+	}
+
+	if (pal != NULL) {
+		uint16_t sd_type = pal->sd_type;
+		uint8_t marker = 1;
+
+		samba_SHA256_Update(&ctx, &marker, sizeof(marker));
+		samba_SHA256_Update(&ctx, (uint8_t *)&sd_type, sizeof(sd_type));
+		posix_acl_sd_hash_pai(&ctx, pal->entry_list);
+		marker = 2;
+		samba_SHA256_Update(&ctx, &marker, sizeof(marker));
+		posix_acl_sd_hash_pai(&ctx, pal->def_entry_list);
+	}
+
+	samba_SHA256_Final(key->hash, &ctx);
+
+	return true;
+}
+
+static struct security_descriptor *posix_acl_sd_cache_fetch(
+	TALLOC_CTX *mem_ctx,
+	const struct posix_acl_sd_cache_key *key)
+{
+	struct security_descriptor *cached = NULL;
+
+	cached = memcache_lookup_talloc(posix_acl_sd_cache,
+					POSIX_ACL_SD_CACHE_TALLOC,
+					data_blob_const(key, sizeof(*key)));
+	if (cached == NULL) {
+		return NULL;
+	}
+
+	return security_descriptor_copy(mem_ctx, cached);
+}
+
+static void posix_acl_sd_cache_store(const struct posix_acl_sd_cache_key *key,
+				     const struct security_descriptor *psd)
+{
+	struct security_descriptor *cached = NULL;
+
+	cached = security_descriptor_copy(NULL, psd);
+	if (cached == NULL) {
+		return;
+	}
+
+	memcache_add_talloc(posix_acl_sd_cache,
+			    POSIX_ACL_SD_CACHE_TALLOC,
+			    data_blob_const(key, sizeof(*key)),
+			    &cached);
+}
+
+void flush_posix_acl_sd_cache(void)
+{
+	if (posix_acl_sd_cache == NULL) {
+		return;
+	}
+	memcache_flush(posix_acl_sd_cache, POSIX_ACL_SD_CACHE_TALLOC);
+}
+
 /****************************************************************************
  Reply to query a security descriptor from an fsp. If it succeeds it allocates
  the space for the return elements and returns the size needed to return the
@@ -3303,6 +3502,20 @@ static NTSTATUS posix_get_nt_acl_common(struct connection_struct *conn,
 	canon_ace *dir_ace = NULL;
 	struct security_ace *nt_ace_list = NULL;
 	struct security_descriptor *psd = NULL;
+	struct posix_acl_sd_cache_key key;
+	bool use_cache;
+
+	use_cache = posix_acl_sd_cache_key(conn, sbuf, pal, posix_acl, def_acl,
+					   security_info, &key);
+	if (use_cache) {
+		psd = posix_acl_sd_cache_fetch(mem_ctx, &key);
+		if (psd != NULL) {
+			DBG_DEBUG("Using cached security descriptor for %s\n",
+				  name);
+			*ppdesc = psd;
+			goto done;
+		}
+	}
 
 	/*
 	 * Get the owner, group and world SIDs.
@@ -3441,6 +3654,10 @@ static NTSTATUS posix_get_nt_acl_common(struct connection_struct *conn,
 		dacl_sort_into_canonical_order(psd->dacl->aces, (unsigned int)psd->dacl->num_aces);
 	}
 
+	if (use_cache) {
+		posix_acl_sd_cache_store(&key, psd);
+	}
+
 	*ppdesc = psd;
 
  done:
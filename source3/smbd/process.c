@@ -44,6 +44,7 @@
 #include "system/threads.h"
 #include "lib/pthreadpool/pthreadpool_tevent.h"
 #include "util_event.h"
+#include "live_stats.h"
 
 /* Internal message queue for deferred opens. */
 struct pending_message_list {
@@ -2878,6 +2879,35 @@ static bool deadtime_fn(const struct timeval *now, void *private_data)
 	return True;
 }
 
+/*
+ * With thousands of mostly idle clients per node, the memory each
+ * idle smbd keeps in caches and in the free parts of its heap adds
+ * up. Give it back once no request came in for a full housekeeping
+ * interval.
+ */
+static void smbd_release_idle_memory(struct smbd_server_connection *sconn)
+{
+	uint64_t num_requests = sconn->num_requests - sconn->num_keepalives;
+
+	if (num_requests != sconn->housekeeping_num_requests) {
+		sconn->housekeeping_num_requests = num_requests;
+		sconn->idle_memory_released = false;
+		return;
+	}
+
+	if (sconn->idle_memory_released) {
+		return;
+	}
+	sconn->idle_memory_released = true;
+
+	DBG_DEBUG("Releasing cached memory of idle client\n");
+
+	smbd_smb2_buffer_cache_flush();
+#ifdef HAVE_MALLOC_TRIM
+	malloc_trim(0);
+#endif
+}
+
 /*
  * Do the recurring log file and smb.conf reload checks.
  */
@@ -2902,6 +2932,8 @@ static bool housekeeping_fn(const struct timeval *now, void *private_data)
 	 */
 	force_check_log_size();
 	check_log_size();
+
+	smbd_release_idle_memory(sconn);
 	return true;
 }
 
@@ -3707,6 +3739,9 @@ NTSTATUS smbd_add_connection(struct smbXsrv_client *client, int sock_fd,
 		TALLOC_FREE(frame);
 		return NT_STATUS_NO_MEMORY;
 	}
+	if (lp_smbd_live_statistics()) {
+		(void)talloc_set_accounting(xconn);
+	}
 	talloc_steal(frame, xconn);
 
 	xconn->transport.sock = sock_fd;
@@ -3871,6 +3906,7 @@ NTSTATUS smbd_add_connection(struct smbXsrv_client *client, int sock_fd,
 
 	/* for now we only have one connection */
 	DLIST_ADD_END(client->connections, xconn);
+	LIVE_STATS_ADD(connections, 1);
 	xconn->client = client;
 	talloc_steal(client, xconn);
 
@@ -3879,6 +3915,24 @@ NTSTATUS smbd_add_connection(struct smbXsrv_client *client, int sock_fd,
 	return NT_STATUS_OK;
 }
 
+/****************************************************************************
+ Drop the message handlers the parent smbd registered in open_sockets_smbd().
+ They act on the parent context, which a forked child has freed.
+****************************************************************************/
+
+void smbd_deregister_parent_msgs(struct messaging_context *msg_ctx,
+				 struct tevent_context *ev_ctx)
+{
+	messaging_deregister(msg_ctx, MSG_SMB_CONF_UPDATED, ev_ctx);
+	messaging_deregister(msg_ctx, MSG_SMB_FORCE_TDIS, NULL);
+	messaging_deregister(msg_ctx, MSG_SMB_KILL_CLIENT_IP, NULL);
+	messaging_deregister(msg_ctx, MSG_SMB_TELL_NUM_CHILDREN, NULL);
+	messaging_deregister(msg_ctx, MSG_SMB_NOTIFY_STARTED, NULL);
+	messaging_deregister(msg_ctx, ID_CACHE_DELETE, NULL);
+	messaging_deregister(msg_ctx, ID_CACHE_KILL, NULL);
+	messaging_deregister(msg_ctx, MSG_DEBUG, NULL);
+}
+
 /****************************************************************************
  Process commands from the client
 ****************************************************************************/
@@ -3948,6 +4002,15 @@ void smbd_process(struct tevent_context *ev_ctx,
 		smbd_setup_sig_hup_handler(sconn);
 	}
 
+	if (lp_smbd_live_statistics()) {
+		(void)live_stats_setup();
+		/*
+		 * Keep track of the memory used by the client and
+		 * its connections, see smbd_smb2_live_stats_memory().
+		 */
+		(void)talloc_set_accounting(client);
+	}
+
 	status = smbd_add_connection(client, sock_fd, &xconn);
 	if (NT_STATUS_EQUAL(status, NT_STATUS_NETWORK_ACCESS_DENIED)) {
 		/*
@@ -4049,6 +4112,8 @@ void smbd_process(struct tevent_context *ev_ctx,
 		exit_server("Failed to init oplocks");
 
 	/* register our message handlers */
+	smbd_deregister_parent_msgs(sconn->msg_ctx, sconn->ev_ctx);
+
 	messaging_register(sconn->msg_ctx, sconn,
 			   MSG_SMB_FORCE_TDIS, msg_force_tdis);
 	messaging_register(sconn->msg_ctx, sconn,
@@ -4061,25 +4126,17 @@ void smbd_process(struct tevent_context *ev_ctx,
 	messaging_register(sconn->msg_ctx, sconn,
 			   ID_CACHE_KILL, smbd_id_cache_kill);
 
-	messaging_deregister(sconn->msg_ctx,
-			     MSG_SMB_CONF_UPDATED, sconn->ev_ctx);
 	messaging_register(sconn->msg_ctx, sconn,
 			   MSG_SMB_CONF_UPDATED, smbd_conf_updated);
 
-	messaging_deregister(sconn->msg_ctx, MSG_SMB_KILL_CLIENT_IP,
-			     NULL);
 	messaging_register(sconn->msg_ctx, sconn,
 			   MSG_SMB_KILL_CLIENT_IP,
 			   msg_kill_client_ip);
 
-	messaging_deregister(sconn->msg_ctx, MSG_SMB_TELL_NUM_CHILDREN, NULL);
-
 	/*
 	 * Use the default MSG_DEBUG handler to avoid rebroadcasting
 	 * MSGs to all child processes
 	 */
-	messaging_deregister(sconn->msg_ctx,
-			     MSG_DEBUG, NULL);
 	messaging_register(sconn->msg_ctx, NULL,
 			   MSG_DEBUG, debug_message);
 
@@ -130,10 +130,14 @@ struct blocking_lock_record *blocking_lock_cancel_smb1(files_struct *fsp,
 			enum brl_flavour lock_flav,
 			unsigned char locktype,
                         NTSTATUS err);
+void blocking_lock_stop_watch(struct blocking_lock_record *blr);
 
 /* The following definitions come from smbd/close.c  */
 
 void set_close_write_time(struct files_struct *fsp, struct timespec ts);
+bool close_prepare_delete_on_close(TALLOC_CTX *mem_ctx,
+				   files_struct *fsp,
+				   struct security_unix_token **pdel_token);
 NTSTATUS close_file(struct smb_request *req, files_struct *fsp,
 		    enum file_close_type close_type);
 void msg_close_file(struct messaging_context *msg_ctx,
@@ -170,6 +174,26 @@ void msg_force_tdis(struct messaging_context *msg,
 int count_current_connections(const char *sharename, bool verify);
 bool connections_snum_used(struct smbd_server_connection *unused, int snum);
 
+/* The following definitions come from smbd/dir_listing_cache.c  */
+
+bool dir_listing_cache_init(void);
+bool dir_listing_cache_enabled(connection_struct *conn);
+void dir_listing_cache_watch(connection_struct *conn, const char *dirpath);
+struct notify_event;
+bool dir_listing_cache_notify(void *private_data,
+			      const struct notify_event *e);
+void dir_listing_cache_delete(connection_struct *conn, const char *path);
+bool dir_listing_cache_fetch(connection_struct *conn,
+			     const SMB_STRUCT_STAT *dir_st,
+			     const char *name,
+			     SMB_STRUCT_STAT *st,
+			     uint32_t *mode);
+void dir_listing_cache_store(connection_struct *conn,
+			     const SMB_STRUCT_STAT *dir_st,
+			     const char *name,
+			     const SMB_STRUCT_STAT *st,
+			     uint32_t mode);
+
 /* The following definitions come from smbd/dfree.c  */
 
 uint64_t sys_disk_free(connection_struct *conn, struct smb_filename *fname,
@@ -204,9 +228,14 @@ void dptr_CloseDir(files_struct *fsp);
 void dptr_SeekDir(struct dptr_struct *dptr, long offset);
 long dptr_TellDir(struct dptr_struct *dptr);
 bool dptr_has_wild(struct dptr_struct *dptr);
+bool dptr_mask_match(struct dptr_struct *dptr,
+		     const char *string,
+		     const char *pattern,
+		     bool is_case_sensitive);
 int dptr_dnum(struct dptr_struct *dptr);
 bool dptr_get_priv(struct dptr_struct *dptr);
 void dptr_set_priv(struct dptr_struct *dptr);
+bool dptr_start_prefetch(struct dptr_struct *dptr);
 bool dptr_SearchDir(struct dptr_struct *dptr, const char *name, long *poffset, SMB_STRUCT_STAT *pst);
 bool dptr_fill(struct smbd_server_connection *sconn,
 	       char *buf1,unsigned int key);
@@ -232,6 +261,10 @@ struct smb_Dir *OpenDir(TALLOC_CTX *mem_ctx,
 			uint32_t attr);
 const char *ReadDirName(struct smb_Dir *dirp, long *poffset,
 			SMB_STRUCT_STAT *sbuf, char **talloced);
+const char *ReadDirNamePlus(struct smb_Dir *dirp, long *poffset,
+			    SMB_STRUCT_STAT *sbuf,
+			    const struct vfs_readdirplus_entry **pplus,
+			    char **talloced);
 void RewindDir(struct smb_Dir *dirp, long *poffset);
 void SeekDir(struct smb_Dir *dirp, long offset);
 long TellDir(struct smb_Dir *dirp);
@@ -263,6 +296,9 @@ mode_t unix_mode(connection_struct *conn, int dosmode,
 uint32_t dos_mode_msdfs(connection_struct *conn,
 		      const struct smb_filename *smb_fname);
 uint32_t dos_mode(connection_struct *conn, struct smb_filename *smb_fname);
+uint32_t dos_mode_readdirplus(connection_struct *conn,
+			      struct smb_filename *smb_fname,
+			      uint32_t dosmode);
 struct tevent_req *dos_mode_at_send(TALLOC_CTX *mem_ctx,
 				    struct tevent_context *ev,
 				    files_struct *dir_fsp,
@@ -301,6 +337,12 @@ struct timespec get_change_timespec(connection_struct *conn,
 NTSTATUS parse_dos_attribute_blob(struct smb_filename *smb_fname,
 				  DATA_BLOB blob,
 				  uint32_t *pattr);
+bool dos_attribute_cache_fetch(connection_struct *conn,
+			       struct smb_filename *smb_fname,
+			       uint32_t *pattr);
+void dos_attribute_cache_store(connection_struct *conn,
+			       const struct smb_filename *smb_fname,
+			       uint32_t attr);
 
 /* The following definitions come from smbd/error.c  */
 
@@ -399,6 +441,7 @@ files_struct *file_find_dif(struct smbd_server_connection *sconn,
 files_struct *file_find_di_first(struct smbd_server_connection *sconn,
 				 struct file_id id);
 files_struct *file_find_di_next(files_struct *start_fsp);
+void fsp_set_file_id(struct files_struct *fsp, struct file_id id);
 struct files_struct *file_find_one_fsp_from_lease_key(
 	struct smbd_server_connection *sconn,
 	const struct smb2_lease_key *lease_key);
@@ -581,6 +624,21 @@ int inotify_watch(TALLOC_CTX *mem_ctx,
 		  void *private_data,
 		  void *handle_p);
 
+/* The following definitions come from smbd/notify_fanotify.c  */
+
+bool fanotify_available(void);
+int fanotify_watch(TALLOC_CTX *mem_ctx,
+		   struct sys_notify_context *ctx,
+		   const char *path,
+		   uint32_t *filter,
+		   uint32_t *subdir_filter,
+		   void (*callback)(struct sys_notify_context *ctx,
+				    void *private_data,
+				    struct notify_event *ev,
+				    uint32_t filter),
+		   void *private_data,
+		   void *handle_p);
+
 int fam_watch(TALLOC_CTX *mem_ctx,
 	      struct sys_notify_context *ctx,
 	      const char *path,
@@ -794,6 +852,7 @@ SMB_ACL_T free_empty_sys_acl(connection_struct *conn, SMB_ACL_T the_acl);
 NTSTATUS posix_fget_nt_acl(struct files_struct *fsp, uint32_t security_info,
 			   TALLOC_CTX *mem_ctx,
 			   struct security_descriptor **ppdesc);
+void flush_posix_acl_sd_cache(void);
 NTSTATUS posix_get_nt_acl(struct connection_struct *conn,
 			const struct smb_filename *smb_fname_in,
 			uint32_t security_info,
@@ -883,6 +942,8 @@ bool smb1_parse_chain(TALLOC_CTX *mem_ctx, const uint8_t *buf,
 		      bool encrypted, uint32_t seqnum,
 		      struct smb_request ***reqs, unsigned *num_reqs);
 bool req_is_in_chain(const struct smb_request *req);
+void smbd_deregister_parent_msgs(struct messaging_context *msg_ctx,
+				 struct tevent_context *ev_ctx);
 void smbd_process(struct tevent_context *ev_ctx,
 		  struct messaging_context *msg_ctx,
 		  int sock_fd,
@@ -1136,9 +1197,11 @@ ssize_t message_push_string(uint8_t **outbuf, const char *str, int flags);
 
 /* The following definitions come from smbd/statcache.c  */
 
-void stat_cache_add( const char *full_orig_name,
-		char *translated_path,
-		bool case_sensitive);
+bool stat_cache_shared_init(void);
+void stat_cache_add(connection_struct *conn,
+		    const char *full_orig_name,
+		    char *translated_path,
+		    bool case_sensitive);
 bool stat_cache_lookup(connection_struct *conn,
 			bool posix_paths,
 			char **pp_name,
@@ -1153,6 +1216,24 @@ void stat_cache_delete(const char *name);
 struct TDB_DATA;
 unsigned int fast_string_hash(struct TDB_DATA *key);
 bool reset_stat_cache( void );
+bool mangled_name_shared_dir_id(connection_struct *conn,
+				const char *dirpath,
+				struct file_id *dir_id);
+char *mangled_name_shared_fetch(TALLOC_CTX *mem_ctx,
+				const struct file_id *dir_id,
+				const char *name);
+void mangled_name_shared_store(const struct file_id *dir_id,
+			       const char *name,
+			       const char *long_name);
+void name_index_flush(void);
+int name_index_get_real_filename(connection_struct *conn,
+				 const char *dirpath,
+				 const char *name,
+				 TALLOC_CTX *mem_ctx,
+				 char **found_name);
+void name_index_notify(connection_struct *conn,
+		       uint32_t action,
+		       const char *path);
 
 /* The following definitions come from smbd/statvfs.c  */
 
@@ -1260,6 +1341,9 @@ int vfs_fill_sparse(files_struct *fsp, off_t len);
 off_t vfs_transfer_file(files_struct *in, files_struct *out, off_t n);
 const char *vfs_readdirname(connection_struct *conn, void *p,
 			    SMB_STRUCT_STAT *sbuf, char **talloced);
+const char *vfs_readdirname_translate(connection_struct *conn,
+				      const char *dname,
+				      char **talloced);
 int vfs_ChDir(connection_struct *conn,
 			const struct smb_filename *smb_fname);
 struct smb_filename *vfs_GetWd(TALLOC_CTX *ctx, connection_struct *conn);
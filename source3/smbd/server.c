@@ -55,6 +55,10 @@
 #include "cleanupdb.h"
 #include "g_lock.h"
 
+#if defined(HAVE_SCHED_SETAFFINITY) && defined(HAVE_DECL_SO_INCOMING_CPU)
+#include <sched.h>
+#endif
+
 #ifdef CLUSTER_SUPPORT
 #include "ctdb_protocol.h"
 #endif
@@ -79,6 +83,10 @@ struct smbd_parent_context {
 	struct server_id notifyd;
 
 	struct tevent_timer *cleanup_te;
+
+	/* pre-forked children waiting for a connection */
+	size_t num_warm_children;
+	struct tevent_timer *warm_te;
 };
 
 struct smbd_open_socket {
@@ -91,8 +99,12 @@ struct smbd_open_socket {
 struct smbd_child_pid {
 	struct smbd_child_pid *prev, *next;
 	pid_t pid;
+	bool warm;
 };
 
+static void smbd_warm_children_schedule(struct smbd_parent_context *parent,
+					struct timeval when);
+
 extern void start_epmd(struct tevent_context *ev_ctx,
 		       struct messaging_context *msg_ctx);
 
@@ -123,6 +135,10 @@ static void smbd_parent_conf_updated(struct messaging_context *msg,
 	change_to_root_user();
 	reload_services(NULL, NULL, false);
 	printing_subsystem_update(ev_ctx, msg, false);
+
+	if (am_parent != NULL) {
+		smbd_warm_children_schedule(am_parent, timeval_zero());
+	}
 }
 
 /*******************************************************************
@@ -328,19 +344,20 @@ static int smbd_parent_ctdb_reconfigured(
 }
 #endif
 
-static void add_child_pid(struct smbd_parent_context *parent,
-			  pid_t pid)
+static struct smbd_child_pid *add_child_pid(struct smbd_parent_context *parent,
+					    pid_t pid)
 {
 	struct smbd_child_pid *child;
 
 	child = talloc_zero(parent, struct smbd_child_pid);
 	if (child == NULL) {
 		DEBUG(0, ("Could not add child struct -- malloc failed\n"));
-		return;
+		return NULL;
 	}
 	child->pid = pid;
 	DLIST_ADD(parent->children, child);
 	parent->num_children += 1;
+	return child;
 }
 
 static void smb_tell_num_children(struct messaging_context *ctx, void *data,
@@ -350,7 +367,8 @@ static void smb_tell_num_children(struct messaging_context *ctx, void *data,
 	uint8_t buf[sizeof(uint32_t)];
 
 	if (am_parent) {
-		SIVAL(buf, 0, am_parent->num_children);
+		SIVAL(buf, 0, am_parent->num_children -
+		      am_parent->num_warm_children);
 		messaging_send_buf(ctx, srv_id, MSG_SMB_NUM_CHILDREN,
 				   buf, sizeof(buf));
 	}
@@ -368,8 +386,16 @@ static struct tevent_req *notifyd_req(struct messaging_context *msg_ctx,
 
 	if (lp_kernel_change_notify()) {
 
+#ifdef HAVE_FANOTIFY
+		if (lp_parm_bool(-1, "notify", "fanotify", false) &&
+		    fanotify_available()) {
+			sys_notify_watch = fanotify_watch;
+		}
+#endif
+
 #ifdef HAVE_INOTIFY
-		if (lp_parm_bool(-1, "notify", "inotify", true)) {
+		if ((sys_notify_watch == NULL) &&
+		    lp_parm_bool(-1, "notify", "inotify", true)) {
 			sys_notify_watch = inotify_watch;
 		}
 #endif
@@ -826,8 +852,17 @@ static void remove_child_pid(struct smbd_parent_context *parent,
 		if (child->pid == pid) {
 			struct smbd_child_pid *tmp = child;
 			DLIST_REMOVE(parent->children, child);
-			TALLOC_FREE(tmp);
 			parent->num_children -= 1;
+			if (tmp->warm) {
+				/*
+				 * Don't fork in a loop if warm
+				 * children can't initialize.
+				 */
+				parent->num_warm_children -= 1;
+				smbd_warm_children_schedule(
+					parent, timeval_current_ofs(1, 0));
+			}
+			TALLOC_FREE(tmp);
 			break;
 		}
 	}
@@ -838,6 +873,9 @@ static void remove_child_pid(struct smbd_parent_context *parent,
 		return;
 	}
 
+	/* a slot below "max smbd processes" might have become free */
+	smbd_warm_children_schedule(parent, timeval_zero());
+
 	if (pid == procid_to_pid(&parent->cleanupd)) {
 		struct tevent_req *req;
 
@@ -983,6 +1021,445 @@ static void smbd_open_socket_close_fn(struct tevent_context *ev,
 	close(fd);
 }
 
+#if defined(HAVE_SCHED_SETAFFINITY) && defined(HAVE_DECL_SO_INCOMING_CPU)
+
+/*
+ * The cpuN directory in sysfs has a nodeM link
+ * for the NUMA node the CPU belongs to.
+ */
+static int smbd_cpu_numa_node(int cpu)
+{
+	char path[64];
+	DIR *d = NULL;
+	struct dirent *de = NULL;
+	int node = -1;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+
+	d = opendir(path);
+	if (d == NULL) {
+		return -1;
+	}
+
+	while ((de = readdir(d)) != NULL) {
+		unsigned int n;
+		char c;
+
+		if (sscanf(de->d_name, "node%u%c", &n, &c) == 1) {
+			node = n;
+			break;
+		}
+	}
+
+	closedir(d);
+	return node;
+}
+
+/*
+ * Parse a sysfs cpulist like "0-7,16-23"
+ */
+static bool smbd_parse_cpulist(const char *list, cpu_set_t *set)
+{
+	const char *p = list;
+
+	CPU_ZERO(set);
+
+	while ((*p != '\0') && (*p != '\n')) {
+		char *end = NULL;
+		unsigned long first, last;
+
+		first = strtoul(p, &end, 10);
+		if (end == p) {
+			return false;
+		}
+		last = first;
+		p = end;
+
+		if (*p == '-') {
+			p += 1;
+			last = strtoul(p, &end, 10);
+			if (end == p) {
+				return false;
+			}
+			p = end;
+		}
+
+		if ((last < first) || (last >= CPU_SETSIZE)) {
+			return false;
+		}
+		for (; first <= last; first++) {
+			CPU_SET(first, set);
+		}
+
+		if (*p == ',') {
+			p += 1;
+		}
+	}
+
+	return (CPU_COUNT(set) > 0);
+}
+
+/*
+ * Bind a new child to the CPUs of the NUMA node whose NIC queue
+ * accepted the connection. The aio threads are created later and
+ * inherit the affinity, and as memory is allocated on the node of
+ * the CPU touching it first, socket buffers and the data we copy
+ * stay node local.
+ */
+static void smbd_set_numa_affinity(int fd)
+{
+	char path[64];
+	char cpulist[4096];
+	cpu_set_t set;
+	socklen_t len = sizeof(int);
+	int cpu = -1;
+	int node;
+	int cfd;
+	ssize_t nread;
+	int ret;
+	bool ok;
+
+	ret = getsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len);
+	if ((ret == -1) || (cpu < 0)) {
+		DBG_DEBUG("No incoming CPU for the connection: %s\n",
+			  (ret == -1) ? strerror(errno) : "unknown");
+		return;
+	}
+
+	node = smbd_cpu_numa_node(cpu);
+	if (node == -1) {
+		DBG_DEBUG("No NUMA node for CPU %d\n", cpu);
+		return;
+	}
+
+	snprintf(path, sizeof(path),
+		 "/sys/devices/system/node/node%d/cpulist", node);
+
+	cfd = open(path, O_RDONLY);
+	if (cfd == -1) {
+		DBG_DEBUG("open(%s) failed: %s\n", path, strerror(errno));
+		return;
+	}
+	nread = sys_read(cfd, cpulist, sizeof(cpulist) - 1);
+	close(cfd);
+	if (nread <= 0) {
+		DBG_DEBUG("read(%s) failed: %s\n", path,
+			  (nread == -1) ? strerror(errno) : "empty");
+		return;
+	}
+	cpulist[nread] = '\0';
+
+	ok = smbd_parse_cpulist(cpulist, &set);
+	if (!ok) {
+		DBG_WARNING("Invalid cpulist for NUMA node %d: %s\n",
+			    node, cpulist);
+		return;
+	}
+
+	ret = sched_setaffinity(0, sizeof(set), &set);
+	if (ret == -1) {
+		DBG_WARNING("sched_setaffinity() for NUMA node %d failed: "
+			    "%s\n", node, strerror(errno));
+		return;
+	}
+
+	DBG_INFO("Connection arrived on CPU %d, bound to NUMA node %d\n",
+		 cpu, node);
+}
+
+#else
+
+static void smbd_set_numa_affinity(int fd)
+{
+	DBG_DEBUG("NUMA affinity is not supported on this platform\n");
+}
+
+#endif
+
+/*
+ * Initialize a freshly forked child. Returns false if it should just
+ * exit, panics if something is really wrong.
+ */
+
+static bool smbd_child_reinit(struct messaging_context *msg_ctx,
+			      struct tevent_context *ev)
+{
+	NTSTATUS status;
+
+	status = smbd_reinit_after_fork(msg_ctx, ev, true, NULL);
+	if (NT_STATUS_IS_OK(status)) {
+		return true;
+	}
+
+	if (NT_STATUS_EQUAL(status, NT_STATUS_TOO_MANY_OPENED_FILES)) {
+		DEBUG(0,("child process cannot initialize "
+			 "because too many files are open\n"));
+		return false;
+	}
+	if (lp_clustering() &&
+	    (NT_STATUS_EQUAL(status, NT_STATUS_INTERNAL_DB_ERROR) ||
+	     NT_STATUS_EQUAL(status, NT_STATUS_CONNECTION_REFUSED))) {
+		DEBUG(1, ("child process cannot initialize "
+			  "because connection to CTDB "
+			  "has failed: %s\n",
+			  nt_errstr(status)));
+		return false;
+	}
+
+	DEBUG(0,("reinit_after_fork() failed\n"));
+	smb_panic("reinit_after_fork() failed");
+	return false;
+}
+
+/*
+ * "smbd warm children": the parent keeps a number of children forked
+ * and initialized in advance. They wait for a MSG_SMB_WARM_CONNECTION
+ * message from the parent carrying the accepted socket, so the fork
+ * and the reinit are not on the path of a client waiting for its
+ * negprot response. Warm children are in the list of children like
+ * all others and count against "max smbd processes".
+ */
+
+static bool smbd_warm_child_filter(struct messaging_rec *rec,
+				   void *private_data)
+{
+	if (rec->msg_type != MSG_SMB_WARM_CONNECTION) {
+		return false;
+	}
+	if (rec->num_fds != 1) {
+		return false;
+	}
+	if (procid_to_pid(&rec->src) != getppid()) {
+		return false;
+	}
+	return true;
+}
+
+static void smbd_warm_child_sig_term_handler(struct tevent_context *ev,
+					     struct tevent_signal *se,
+					     int signum,
+					     int count,
+					     void *siginfo,
+					     void *private_data)
+{
+	exit_server_cleanly("termination signal");
+}
+
+static void smbd_warm_child_wait(struct tevent_context *ev,
+				 struct messaging_context *msg_ctx)
+{
+	TALLOC_CTX *frame = talloc_stackframe();
+	struct tevent_signal *se = NULL;
+	struct tevent_req *req = NULL;
+	struct messaging_rec *rec = NULL;
+	int fd;
+	int ret;
+
+	/*
+	 * The parent's handler is gone with the parent context. We
+	 * also get SIGTERM from reinit_after_fork_pipe_handler() if
+	 * the parent exits.
+	 */
+	se = tevent_add_signal(ev,
+			       frame,
+			       SIGTERM, 0,
+			       smbd_warm_child_sig_term_handler,
+			       NULL);
+	if (se == NULL) {
+		DBG_ERR("failed to setup SIGTERM handler\n");
+		TALLOC_FREE(frame);
+		return;
+	}
+
+	req = messaging_filtered_read_send(frame, ev, msg_ctx,
+					   smbd_warm_child_filter, NULL);
+	if (req == NULL) {
+		DBG_ERR("messaging_filtered_read_send failed\n");
+		TALLOC_FREE(frame);
+		return;
+	}
+
+	if (!tevent_req_poll(req, ev)) {
+		DBG_ERR("tevent_req_poll failed: %s\n", strerror(errno));
+		TALLOC_FREE(frame);
+		return;
+	}
+
+	ret = messaging_filtered_read_recv(req, frame, &rec);
+	if (ret != 0) {
+		DBG_ERR("messaging_filtered_read_recv failed: %s\n",
+			strerror(ret));
+		TALLOC_FREE(frame);
+		return;
+	}
+
+	fd = rec->fds[0];
+	TALLOC_FREE(frame);
+
+	smb_set_close_on_exec(fd);
+
+	if (lp_smbd_numa_affinity()) {
+		smbd_set_numa_affinity(fd);
+	}
+
+	smbd_process(ev, msg_ctx, fd, false);
+}
+
+static bool smbd_fork_warm_child(struct smbd_parent_context *parent)
+{
+	struct tevent_context *ev = parent->ev_ctx;
+	struct messaging_context *msg_ctx = parent->msg_ctx;
+	struct smbd_child_pid *child = NULL;
+	pid_t pid;
+
+	pid = fork();
+	if (pid == 0) {
+		talloc_free(parent);
+		parent = NULL;
+		am_parent = NULL;
+
+		CatchChild();
+
+		/*
+		 * We can sit here idle for a long time, don't let the
+		 * parent's handlers run against the freed parent
+		 * context in the meantime.
+		 */
+		smbd_deregister_parent_msgs(msg_ctx, ev);
+
+		if (smbd_child_reinit(msg_ctx, ev)) {
+			smbd_warm_child_wait(ev, msg_ctx);
+		}
+		exit_server_cleanly("end of child");
+		return false;
+	}
+
+	if (pid < 0) {
+		DBG_ERR("fork() failed: %s\n", strerror(errno));
+		return false;
+	}
+
+	child = add_child_pid(parent, pid);
+	if (child == NULL) {
+		kill(pid, SIGTERM);
+		return false;
+	}
+	child->warm = true;
+	parent->num_warm_children += 1;
+
+	return true;
+}
+
+static void smbd_warm_children_fill(struct tevent_context *ev,
+				    struct tevent_timer *te,
+				    struct timeval now,
+				    void *private_data)
+{
+	struct smbd_parent_context *parent = talloc_get_type_abort(
+		private_data, struct smbd_parent_context);
+	size_t wanted = MAX(lp_smbd_warm_children(), 0);
+	struct smbd_child_pid *child = NULL;
+
+	parent->warm_te = NULL;
+
+	if (parent->num_warm_children > wanted) {
+		/*
+		 * "smbd warm children" was lowered, the
+		 * surplus exits via msg_exit_server().
+		 */
+		for (child = parent->children;
+		     child != NULL && parent->num_warm_children > wanted;
+		     child = child->next) {
+			if (!child->warm) {
+				continue;
+			}
+			child->warm = false;
+			parent->num_warm_children -= 1;
+			messaging_send(parent->msg_ctx,
+				       pid_to_procid(child->pid),
+				       MSG_SHUTDOWN, &data_blob_null);
+		}
+		return;
+	}
+
+	if (parent->num_warm_children == wanted) {
+		return;
+	}
+
+	if (!allowable_number_of_smbd_processes(parent)) {
+		/* retried from remove_child_pid() */
+		return;
+	}
+
+	if (!smbd_fork_warm_child(parent)) {
+		smbd_warm_children_schedule(parent,
+					    timeval_current_ofs(1, 0));
+		return;
+	}
+
+	/*
+	 * Fork one child per event loop iteration, incoming
+	 * connections are not held up by a refill of the pool.
+	 */
+	smbd_warm_children_schedule(parent, timeval_zero());
+}
+
+static void smbd_warm_children_schedule(struct smbd_parent_context *parent,
+					struct timeval when)
+{
+	if (parent->interactive) {
+		return;
+	}
+	if (parent->warm_te != NULL) {
+		return;
+	}
+	if (parent->num_warm_children == MAX(lp_smbd_warm_children(), 0)) {
+		return;
+	}
+
+	parent->warm_te = tevent_add_timer(parent->ev_ctx,
+					   parent,
+					   when,
+					   smbd_warm_children_fill,
+					   parent);
+	if (parent->warm_te == NULL) {
+		DBG_ERR("tevent_add_timer failed\n");
+	}
+}
+
+static bool smbd_pass_to_warm_child(struct smbd_parent_context *parent,
+				    int fd)
+{
+	struct smbd_child_pid *child = NULL;
+	NTSTATUS status;
+
+	for (child = parent->children; child != NULL; child = child->next) {
+		if (!child->warm) {
+			continue;
+		}
+
+		child->warm = false;
+		parent->num_warm_children -= 1;
+
+		smbd_warm_children_schedule(parent, timeval_zero());
+
+		status = messaging_send_iov(parent->msg_ctx,
+					    pid_to_procid(child->pid),
+					    MSG_SMB_WARM_CONNECTION,
+					    NULL, 0,
+					    &fd, 1);
+		if (NT_STATUS_IS_OK(status)) {
+			return true;
+		}
+
+		DBG_WARNING("Could not pass connection to pid %d: %s\n",
+			    (int)child->pid, nt_errstr(status));
+		kill(child->pid, SIGTERM);
+	}
+
+	return false;
+}
+
 static void smbd_accept_connection(struct tevent_context *ev,
 				   struct tevent_fd *fde,
 				   uint16_t flags,
@@ -1014,6 +1491,13 @@ static void smbd_accept_connection(struct tevent_context *ev,
 		return;
 	}
 
+	if (s->parent->num_warm_children > 0 &&
+	    smbd_pass_to_warm_child(s->parent, fd)) {
+		close(fd);
+		force_check_log_size();
+		return;
+	}
+
 	if (!allowable_number_of_smbd_processes(s->parent)) {
 		close(fd);
 		return;
@@ -1021,8 +1505,6 @@ static void smbd_accept_connection(struct tevent_context *ev,
 
 	pid = fork();
 	if (pid == 0) {
-		NTSTATUS status = NT_STATUS_OK;
-
 		/*
 		 * Can't use TALLOC_FREE here. Nulling out the argument to it
 		 * would overwrite memory we've just freed.
@@ -1034,28 +1516,12 @@ static void smbd_accept_connection(struct tevent_context *ev,
 		 * them, counting worker smbds. */
 		CatchChild();
 
-		status = smbd_reinit_after_fork(msg_ctx, ev, true, NULL);
-		if (!NT_STATUS_IS_OK(status)) {
-			if (NT_STATUS_EQUAL(status,
-					    NT_STATUS_TOO_MANY_OPENED_FILES)) {
-				DEBUG(0,("child process cannot initialize "
-					 "because too many files are open\n"));
-				goto exit;
-			}
-			if (lp_clustering() &&
-			    (NT_STATUS_EQUAL(
-				    status, NT_STATUS_INTERNAL_DB_ERROR) ||
-			     NT_STATUS_EQUAL(
-				    status, NT_STATUS_CONNECTION_REFUSED))) {
-				DEBUG(1, ("child process cannot initialize "
-					  "because connection to CTDB "
-					  "has failed: %s\n",
-					  nt_errstr(status)));
-				goto exit;
-			}
+		if (lp_smbd_numa_affinity()) {
+			smbd_set_numa_affinity(fd);
+		}
 
-			DEBUG(0,("reinit_after_fork() failed\n"));
-			smb_panic("reinit_after_fork() failed");
+		if (!smbd_child_reinit(msg_ctx, ev)) {
+			goto exit;
 		}
 
 		smbd_process(ev, msg_ctx, fd, false);
@@ -1315,6 +1781,8 @@ static bool open_sockets_smbd(struct smbd_parent_context *parent,
 	messaging_register(msg_ctx, NULL, MSG_SMB_NOTIFY_STARTED,
 			   smb_parent_send_to_children);
 
+	smbd_warm_children_schedule(parent, timeval_zero());
+
 #ifdef CLUSTER_SUPPORT
 	if (lp_clustering()) {
 		struct ctdbd_connection *conn = messaging_ctdb_connection();
@@ -1472,6 +1940,8 @@ static void smbd_parent_sig_hup_handler(struct tevent_context *ev,
 	reload_services(NULL, NULL, false);
 
 	printing_subsystem_update(parent->ev_ctx, parent->msg_ctx, true);
+
+	smbd_warm_children_schedule(parent, timeval_zero());
 }
 
 struct smbd_claim_version_state {
@@ -2055,10 +2525,30 @@ extern void build_options(bool screen);
 	if (!locking_init())
 		exit_daemon("Samba cannot init locking", EACCES);
 
+	if (!share_mode_presence_init()) {
+		DBG_NOTICE("Share mode lookups always use locking.tdb\n");
+	}
+
+	if (!brl_presence_init()) {
+		DBG_NOTICE("Strict locking checks always use brlock.tdb\n");
+	}
+
 	if (!leases_db_init(false)) {
 		exit_daemon("Samba cannot init leases", EACCES);
 	}
 
+	if (lp_stat_cache() && lp_shared_stat_cache()) {
+		if (!stat_cache_shared_init()) {
+			DBG_WARNING("Using a per process stat cache\n");
+		}
+	}
+
+	if (lp_smbd_dir_cache_timeout() > 0) {
+		if (!dir_listing_cache_init()) {
+			DBG_WARNING("Not caching directory listings\n");
+		}
+	}
+
 	if (!smbd_notifyd_init(msg_ctx, interactive, &parent->notifyd)) {
 		exit_daemon("Samba cannot init notification", EACCES);
 	}
@@ -136,9 +136,7 @@ bool reload_services(struct smbd_server_connection *sconn,
 	if (test && !lp_file_list_changed())
 		return(True);
 
-	lp_killunused(sconn, snumused);
-
-	ret = lp_load_with_shares(get_dyn_CONFIGFILE());
+	ret = lp_reload_with_shares(get_dyn_CONFIGFILE(), sconn, snumused);
 
 	/* perhaps the config filename is now set */
 	if (!test) {
@@ -160,6 +158,7 @@ bool reload_services(struct smbd_server_connection *sconn,
 	mangle_reset_cache();
 	reset_stat_cache();
 	flush_dfree_cache();
+	flush_posix_acl_sd_cache();
 
 	return(ret);
 }
@@ -24,6 +24,7 @@
 #include "../libcli/smb/smb_common.h"
 #include "../lib/util/tevent_ntstatus.h"
 #include "lib/tevent_wait.h"
+#include "lib/pthreadpool/pthreadpool_tevent.h"
 
 #undef DBGC_CLASS
 #define DBGC_CLASS DBGC_SMB2
@@ -289,10 +290,14 @@ static NTSTATUS smbd_smb2_close(struct smbd_smb2_request *req,
 	return NT_STATUS_OK;
 }
 
+struct smbd_smb2_close_unlink_job;
+
 struct smbd_smb2_close_state {
+	struct tevent_context *ev;
 	struct smbd_smb2_request *smb2req;
 	struct files_struct *in_fsp;
 	uint16_t in_flags;
+	struct smbd_smb2_close_unlink_job *job;
 	uint16_t out_flags;
 	struct timespec out_creation_ts;
 	struct timespec out_last_access_ts;
@@ -304,6 +309,7 @@ struct smbd_smb2_close_state {
 };
 
 static void smbd_smb2_close_do(struct tevent_req *subreq);
+static bool smbd_smb2_close_unlink_send(struct tevent_req *req);
 
 static struct tevent_req *smbd_smb2_close_send(TALLOC_CTX *mem_ctx,
 					       struct tevent_context *ev,
@@ -320,6 +326,7 @@ static struct tevent_req *smbd_smb2_close_send(TALLOC_CTX *mem_ctx,
 	if (req == NULL) {
 		return NULL;
 	}
+	state->ev = ev;
 	state->smb2req = smb2req;
 	state->in_fsp = in_fsp;
 	state->in_flags = in_flags;
@@ -334,6 +341,10 @@ static struct tevent_req *smbd_smb2_close_send(TALLOC_CTX *mem_ctx,
 		return req;
 	}
 
+	if (smbd_smb2_close_unlink_send(req)) {
+		return req;
+	}
+
 	status = smbd_smb2_close(smb2req,
 				 state->in_fsp,
 				 state->in_flags,
@@ -372,6 +383,221 @@ static void smbd_smb2_close_do(struct tevent_req *subreq)
 		 */
 	}
 
+	if (smbd_smb2_close_unlink_send(req)) {
+		return;
+	}
+
+	status = smbd_smb2_close(state->smb2req,
+				 state->in_fsp,
+				 state->in_flags,
+				 &state->out_flags,
+				 &state->out_creation_ts,
+				 &state->out_last_access_ts,
+				 &state->out_last_write_ts,
+				 &state->out_change_ts,
+				 &state->out_allocation_size,
+				 &state->out_end_of_file,
+				 &state->out_file_attributes);
+	if (tevent_req_nterror(req, status)) {
+		return;
+	}
+	tevent_req_done(req);
+}
+
+/*
+ * With "smbd async delete on close" the unlink of a file that is
+ * deleted on close runs in the thread pool, so that a slow unlink
+ * doesn't block the other requests of the client. The share mode
+ * record is marked delete pending before, new opens fail until
+ * close_file() below has removed our share mode entry.
+ *
+ * The job lives independently of the request, a request going away
+ * just detaches from it.
+ */
+struct smbd_smb2_close_unlink_job {
+	struct tevent_req *req;
+	char *path;
+	struct security_unix_token *token;
+	int err;
+};
+
+static void smbd_smb2_close_unlink_do(void *private_data);
+static void smbd_smb2_close_unlink_done(struct tevent_req *subreq);
+
+static int smbd_smb2_close_state_destructor(
+	struct smbd_smb2_close_state *state)
+{
+	if (state->job != NULL) {
+		state->job->req = NULL;
+		state->job = NULL;
+	}
+	return 0;
+}
+
+/*
+ * Only the default VFS module may be bypassed by a plain unlink()
+ */
+static bool smbd_smb2_close_unlink_is_default(connection_struct *conn)
+{
+	struct vfs_handle_struct *handle;
+
+	for (handle = conn->vfs_handles;
+	     handle != NULL && handle->next != NULL;
+	     handle = handle->next) {
+		if (handle->fns->unlink_fn != NULL) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static bool smbd_smb2_close_unlink_send(struct tevent_req *req)
+{
+	struct smbd_smb2_close_state *state = tevent_req_data(
+		req, struct smbd_smb2_close_state);
+	struct files_struct *fsp = state->in_fsp;
+	connection_struct *conn = fsp->conn;
+	struct smbd_smb2_close_unlink_job *job = NULL;
+	struct tevent_req *subreq = NULL;
+	const char *base_name = fsp->fsp_name->base_name;
+	bool delete_file;
+
+	if (!fsp->initial_delete_on_close && !fsp->delete_on_close) {
+		return false;
+	}
+
+	if (!lp_smbd_async_delete_on_close(SNUM(conn))) {
+		return false;
+	}
+
+#ifndef HAVE_LINUX_THREAD_CREDENTIALS
+	return false;
+#endif
+
+	if (pthreadpool_tevent_max_threads(conn->sconn->pool) == 0) {
+		return false;
+	}
+
+	/*
+	 * The full information has to be collected before the file is
+	 * gone, leave that to smbd_smb2_close(). Streams, directories
+	 * and file system share modes need the VFS.
+	 */
+	if ((state->in_flags & SMB2_CLOSE_FLAGS_FULL_INFORMATION) ||
+	    fsp->is_directory ||
+	    fsp->base_fsp != NULL ||
+	    (fsp->posix_flags & FSP_POSIX_FLAGS_OPEN) ||
+	    fsp->kernel_share_modes_taken ||
+	    (conn->fs_capabilities & FILE_NAMED_STREAMS) ||
+	    !smbd_smb2_close_unlink_is_default(conn)) {
+		return false;
+	}
+
+	job = talloc_zero(conn->sconn, struct smbd_smb2_close_unlink_job);
+	if (job == NULL) {
+		return false;
+	}
+
+	if (base_name[0] == '/') {
+		job->path = talloc_strdup(job, base_name);
+	} else {
+		job->path = talloc_asprintf(job, "%s/%s",
+					    conn->cwd_fname->base_name,
+					    base_name);
+	}
+	if (job->path == NULL) {
+		TALLOC_FREE(job);
+		return false;
+	}
+
+	delete_file = close_prepare_delete_on_close(job, fsp, &job->token);
+	if (!delete_file) {
+		TALLOC_FREE(job);
+		return false;
+	}
+
+	subreq = pthreadpool_tevent_job_send(job, state->ev, conn->sconn->pool,
+					     smbd_smb2_close_unlink_do, job);
+	if (subreq == NULL) {
+		/* close_file() will do the unlink */
+		TALLOC_FREE(job);
+		return false;
+	}
+	tevent_req_set_callback(subreq, smbd_smb2_close_unlink_done, job);
+
+	DBG_DEBUG("unlinking %s in the thread pool\n", fsp_str_dbg(fsp));
+
+	job->req = req;
+	state->job = job;
+	talloc_set_destructor(state, smbd_smb2_close_state_destructor);
+
+	return true;
+}
+
+static void smbd_smb2_close_unlink_do(void *private_data)
+{
+	struct smbd_smb2_close_unlink_job *job = talloc_get_type_abort(
+		private_data, struct smbd_smb2_close_unlink_job);
+	int ret;
+
+	/* Become the user who requested the delete on this thread. */
+	ret = set_thread_credentials(job->token->uid,
+				     job->token->gid,
+				     (size_t)job->token->ngroups,
+				     job->token->groups);
+	if (ret != 0) {
+		job->err = errno;
+		return;
+	}
+
+	ret = unlink(job->path);
+	if (ret == -1) {
+		job->err = errno;
+	}
+}
+
+static void smbd_smb2_close_unlink_done(struct tevent_req *subreq)
+{
+	struct smbd_smb2_close_unlink_job *job = tevent_req_callback_data(
+		subreq, struct smbd_smb2_close_unlink_job);
+	struct tevent_req *req = job->req;
+	struct smbd_smb2_close_state *state = NULL;
+	NTSTATUS status;
+	bool ok;
+	int ret;
+
+	ret = pthreadpool_tevent_job_recv(subreq);
+	TALLOC_FREE(subreq);
+
+	if (req == NULL) {
+		/* The request is gone */
+		TALLOC_FREE(job);
+		return;
+	}
+	state = tevent_req_data(req, struct smbd_smb2_close_state);
+
+	if (ret == 0) {
+		ret = job->err;
+	}
+	if (ret != 0) {
+		/*
+		 * close_file() stats the file again and retries the
+		 * unlink if it's still there.
+		 */
+		DBG_DEBUG("unlink of %s failed: %s\n",
+			  job->path, strerror(ret));
+	}
+
+	state->job = NULL;
+	TALLOC_FREE(job);
+
+	/*
+	 * Make sure we run as the user again
+	 */
+	ok = change_to_user_by_fsp(state->in_fsp);
+	SMB_ASSERT(ok);
+
 	status = smbd_smb2_close(state->smb2req,
 				 state->in_fsp,
 				 state->in_flags,
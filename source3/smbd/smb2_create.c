@@ -20,6 +20,7 @@
 */
 
 #include "includes.h"
+#include "system/filesys.h"
 #include "printing.h"
 #include "smbd/smbd.h"
 #include "smbd/globals.h"
@@ -27,7 +28,10 @@
 #include "../librpc/gen_ndr/ndr_security.h"
 #include "../librpc/gen_ndr/ndr_smb2_lease_struct.h"
 #include "../lib/util/tevent_ntstatus.h"
+#include "../lib/util/tevent_unix.h"
 #include "messages.h"
+#include "lib/pthreadpool/pthreadpool_tevent.h"
+#include "librpc/gen_ndr/xattr.h"
 
 #undef DBGC_CLASS
 #define DBGC_CLASS DBGC_SMB2
@@ -456,7 +460,15 @@ struct smbd_smb2_create_state {
 	files_struct *result;
 	bool replay_operation;
 	uint8_t in_oplock_level;
+	uint32_t in_impersonation_level;
+	uint32_t in_desired_access;
+	uint32_t in_file_attributes;
+	uint32_t in_share_access;
 	uint32_t in_create_disposition;
+	uint32_t in_create_options;
+	struct smb2_create_blobs in_context_blobs;
+	const char *in_name;
+	struct tevent_req *prefetch_req;
 	int requested_oplock_level;
 	int info;
 	char *fname;
@@ -623,9 +635,207 @@ static NTSTATUS smbd_smb2_create_fetch_create_ctx(
 }
 
 static void smbd_smb2_create_before_exec(struct tevent_req *req);
+static void smbd_smb2_create_prefetch_done(struct tevent_req *subreq);
+static void smbd_smb2_create_open(struct tevent_req *req);
 static void smbd_smb2_create_after_exec(struct tevent_req *req);
 static void smbd_smb2_create_finish(struct tevent_req *req);
 
+/*
+ * Look up the metadata of a path in a helper thread, just to get it
+ * into the kernel and filesystem caches before the real open runs on
+ * the main thread. The results are thrown away, so this can't
+ * change the outcome of the open.
+ */
+struct smbd_smb2_create_prefetch_state {
+	char *path;
+	bool nt_acl;
+	const struct security_unix_token *token;
+	struct timespec start_time;
+	uint64_t duration;
+};
+
+static void smbd_smb2_create_prefetch_do(void *private_data);
+static void smbd_smb2_create_prefetch_job_done(struct tevent_req *subreq);
+static int smbd_smb2_create_prefetch_state_destructor(
+	struct smbd_smb2_create_prefetch_state *state);
+
+static bool smbd_smb2_create_prefetch_supported(connection_struct *conn)
+{
+	size_t max_threads;
+
+	if (!lp_smbd_async_create_prefetch(SNUM(conn))) {
+		return false;
+	}
+
+	max_threads = pthreadpool_tevent_max_threads(conn->sconn->pool);
+	if (max_threads == 0) {
+		return false;
+	}
+
+#ifdef HAVE_LINUX_THREAD_CREDENTIALS
+	return true;
+#else
+	return false;
+#endif
+}
+
+static struct tevent_req *smbd_smb2_create_prefetch_send(
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	connection_struct *conn,
+	const char *fname)
+{
+	struct tevent_req *req = NULL;
+	struct tevent_req *subreq = NULL;
+	struct smbd_smb2_create_prefetch_state *state = NULL;
+	char *p = NULL;
+
+	req = tevent_req_create(mem_ctx, &state,
+				struct smbd_smb2_create_prefetch_state);
+	if (req == NULL) {
+		return NULL;
+	}
+
+	/*
+	 * All parameters are hanging off the state, the job can't be
+	 * cancelled once it is running, so the destructor keeps the
+	 * state alive until the thread is done.
+	 */
+	state->path = talloc_asprintf(state, "%s/%s",
+				      conn->connectpath, fname);
+	if (tevent_req_nomem(state->path, req)) {
+		return tevent_req_post(req, ev);
+	}
+
+	/* Streams live in the base file */
+	p = strchr_m(state->path + strlen(conn->connectpath), ':');
+	if (p != NULL) {
+		*p = '\0';
+	}
+
+	state->nt_acl = lp_nt_acl_support(SNUM(conn));
+
+	if (geteuid() == sec_initial_uid()) {
+		state->token = root_unix_token(state);
+	} else {
+		state->token = copy_unix_token(
+					state,
+					conn->session_info->unix_token);
+	}
+	if (tevent_req_nomem(state->token, req)) {
+		return tevent_req_post(req, ev);
+	}
+
+	subreq = pthreadpool_tevent_job_send_prio(state,
+					     ev,
+					     conn->sconn->pool,
+					     PTHREADPOOL_PRIO_HIGH,
+					     smbd_smb2_create_prefetch_do,
+					     state);
+	if (tevent_req_nomem(subreq, req)) {
+		return tevent_req_post(req, ev);
+	}
+	tevent_req_set_callback(subreq,
+				smbd_smb2_create_prefetch_job_done,
+				req);
+
+	talloc_set_destructor(state,
+			      smbd_smb2_create_prefetch_state_destructor);
+
+	return req;
+}
+
+static int smbd_smb2_create_prefetch_state_destructor(
+	struct smbd_smb2_create_prefetch_state *state)
+{
+	return -1;
+}
+
+static void smbd_smb2_create_prefetch_do(void *private_data)
+{
+	struct smbd_smb2_create_prefetch_state *state = talloc_get_type_abort(
+		private_data, struct smbd_smb2_create_prefetch_state);
+	struct timespec end_time;
+	struct stat st;
+	char *p = NULL;
+	int ret;
+
+	PROFILE_TIMESTAMP(&state->start_time);
+
+	/* Become the correct credential on this thread. */
+	ret = set_thread_credentials(state->token->uid,
+				     state->token->gid,
+				     (size_t)state->token->ngroups,
+				     state->token->groups);
+	if (ret != 0) {
+		goto done;
+	}
+
+	/*
+	 * Walk down the path like filename_convert() does, the first
+	 * component that does not exist ends the walk. The path is
+	 * modified in place and restored after every component.
+	 */
+	p = state->path + 1;
+	while ((p = strchr(p, '/')) != NULL) {
+		*p = '\0';
+		ret = lstat(state->path, &st);
+		*p = '/';
+		if (ret == -1) {
+			goto done;
+		}
+		p += 1;
+	}
+
+	ret = stat(state->path, &st);
+	if (ret == -1) {
+		goto done;
+	}
+
+	if (state->nt_acl) {
+		/*
+		 * Just the size, a parallel getxattr() on the main
+		 * thread is served from the cache then.
+		 */
+		getxattr(state->path, XATTR_NTACL_NAME, NULL, 0);
+	}
+
+done:
+	PROFILE_TIMESTAMP(&end_time);
+	state->duration = nsec_time_diff(&end_time, &state->start_time);
+}
+
+static void smbd_smb2_create_prefetch_job_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	struct smbd_smb2_create_prefetch_state *state = tevent_req_data(
+		req, struct smbd_smb2_create_prefetch_state);
+	int ret;
+
+	ret = pthreadpool_tevent_job_recv(subreq);
+	TALLOC_FREE(subreq);
+	talloc_set_destructor(state, NULL);
+	if (ret != 0) {
+		/*
+		 * EAGAIN means the pthreadpool failed to create a
+		 * new thread, the open just runs without the prefetch.
+		 */
+		tevent_req_error(req, ret);
+		return;
+	}
+
+	DBG_DEBUG("prefetch of [%s] took %"PRIu64" nsec\n",
+		  state->path, state->duration);
+
+	tevent_req_done(req);
+}
+
+static int smbd_smb2_create_prefetch_recv(struct tevent_req *req)
+{
+	return tevent_req_simple_recv_unix(req);
+}
+
 static struct tevent_req *smbd_smb2_create_send(TALLOC_CTX *mem_ctx,
 			struct tevent_context *ev,
 			struct smbd_smb2_request *smb2req,
@@ -643,8 +853,6 @@ static struct tevent_req *smbd_smb2_create_send(TALLOC_CTX *mem_ctx,
 	struct smbd_smb2_create_state *state = NULL;
 	NTSTATUS status;
 	struct smb_request *smb1req = NULL;
-	struct smb_filename *smb_fname = NULL;
-	uint32_t ucf_flags;
 
 	req = tevent_req_create(mem_ctx, &state,
 				struct smbd_smb2_create_state);
@@ -655,7 +863,14 @@ static struct tevent_req *smbd_smb2_create_send(TALLOC_CTX *mem_ctx,
 		.ev = ev,
 		.smb2req = smb2req,
 		.in_oplock_level = in_oplock_level,
+		.in_impersonation_level = in_impersonation_level,
+		.in_desired_access = in_desired_access,
+		.in_file_attributes = in_file_attributes,
+		.in_share_access = in_share_access,
 		.in_create_disposition = in_create_disposition,
+		.in_create_options = in_create_options,
+		.in_context_blobs = in_context_blobs,
+		.in_name = in_name,
 	};
 
 	smb1req = smbd_smb2_fake_smb_request(smb2req);
@@ -693,6 +908,9 @@ static struct tevent_req *smbd_smb2_create_send(TALLOC_CTX *mem_ctx,
 
 	in_file_attributes &= ~FILE_FLAG_POSIX_SEMANTICS;
 
+	state->in_create_options = in_create_options;
+	state->in_file_attributes = in_file_attributes;
+
 	state->fname = talloc_strdup(state, in_name);
 	if (tevent_req_nomem(state->fname, req)) {
 		return tevent_req_post(req, state->ev);
@@ -885,8 +1103,80 @@ static struct tevent_req *smbd_smb2_create_send(TALLOC_CTX *mem_ctx,
 			tevent_req_nterror(req, status);
 			return tevent_req_post(req, state->ev);
 		}
+
+		/*
+		 * Retries of deferred opens already
+		 * had their prefetch.
+		 */
+		if (!state->open_was_deferred &&
+		    smbd_smb2_create_prefetch_supported(smb1req->conn))
+		{
+			state->prefetch_req = smbd_smb2_create_prefetch_send(
+				state, state->ev, smb1req->conn, state->fname);
+			if (tevent_req_nomem(state->prefetch_req, req)) {
+				return tevent_req_post(req, state->ev);
+			}
+			tevent_req_set_callback(state->prefetch_req,
+						smbd_smb2_create_prefetch_done,
+						req);
+			SMBPROFILE_IOBYTES_ASYNC_SET_IDLE(smb2req->profile);
+			return req;
+		}
+	}
+
+	smbd_smb2_create_open(req);
+	return req;
+}
+
+static void smbd_smb2_create_prefetch_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	struct smbd_smb2_create_state *state = tevent_req_data(
+		req, struct smbd_smb2_create_state);
+	struct smbd_smb2_request *smb2req = state->smb2req;
+	int ret;
+	bool ok;
+
+	SMBPROFILE_IOBYTES_ASYNC_SET_BUSY(smb2req->profile);
+
+	ret = smbd_smb2_create_prefetch_recv(subreq);
+	TALLOC_FREE(subreq);
+	state->prefetch_req = NULL;
+	if (ret != 0) {
+		DBG_DEBUG("prefetch failed: %s\n", strerror(ret));
+	}
+
+	/*
+	 * smbd_smb2_create_finish() still touches
+	 * the state after tevent_req_done().
+	 */
+	tevent_req_defer_callback(req, state->ev);
+
+	/*
+	 * Other requests may have run in between,
+	 * become the user of this request again.
+	 */
+	ok = change_to_user(state->smb1req->conn,
+			    smb2req->session->compat->vuid);
+	if (!ok) {
+		tevent_req_nterror(req, NT_STATUS_ACCESS_DENIED);
+		return;
 	}
 
+	smbd_smb2_create_open(req);
+}
+
+static void smbd_smb2_create_open(struct tevent_req *req)
+{
+	struct smbd_smb2_create_state *state = tevent_req_data(
+		req, struct smbd_smb2_create_state);
+	struct smbd_smb2_request *smb2req = state->smb2req;
+	struct smb_request *smb1req = state->smb1req;
+	struct smb_filename *smb_fname = NULL;
+	uint32_t ucf_flags;
+	NTSTATUS status;
+
 	ucf_flags = filename_create_ucf_flags(
 		smb1req, state->in_create_disposition);
 	status = filename_convert(req,
@@ -898,7 +1188,7 @@ static struct tevent_req *smbd_smb2_create_send(TALLOC_CTX *mem_ctx,
 				  &smb_fname);
 	if (!NT_STATUS_IS_OK(status)) {
 		tevent_req_nterror(req, status);
-		return tevent_req_post(req, state->ev);
+		return;
 	}
 
 	/*
@@ -912,11 +1202,11 @@ static struct tevent_req *smbd_smb2_create_send(TALLOC_CTX *mem_ctx,
 	 * on durable handle-reopens.
 	 */
 
-	if (in_impersonation_level >
+	if (state->in_impersonation_level >
 	    SMB2_IMPERSONATION_DELEGATE) {
 		tevent_req_nterror(req,
 				   NT_STATUS_BAD_IMPERSONATION_LEVEL);
-		return tevent_req_post(req, state->ev);
+		return;
 	}
 
 	/*
@@ -929,21 +1219,21 @@ static struct tevent_req *smbd_smb2_create_send(TALLOC_CTX *mem_ctx,
 	 * server MUST fail the request with
 	 * STATUS_INVALID_PARAMETER.
 	 */
-	if (in_name[0] == '\\' || in_name[0] == '/') {
+	if (state->in_name[0] == '\\' || state->in_name[0] == '/') {
 		tevent_req_nterror(req,
 				   NT_STATUS_INVALID_PARAMETER);
-		return tevent_req_post(req, state->ev);
+		return;
 	}
 
 	status = SMB_VFS_CREATE_FILE(smb1req->conn,
 				     smb1req,
 				     0, /* root_dir_fid */
 				     smb_fname,
-				     in_desired_access,
-				     in_share_access,
+				     state->in_desired_access,
+				     state->in_share_access,
 				     state->in_create_disposition,
-				     in_create_options,
-				     in_file_attributes,
+				     state->in_create_options,
+				     state->in_file_attributes,
 				     map_smb2_oplock_levels_to_samba(
 					     state->requested_oplock_level),
 				     state->lease_ptr,
@@ -953,25 +1243,24 @@ static struct tevent_req *smbd_smb2_create_send(TALLOC_CTX *mem_ctx,
 				     state->ea_list,
 				     &state->result,
 				     &state->info,
-				     &in_context_blobs,
+				     &state->in_context_blobs,
 				     state->out_context_blobs);
 	if (!NT_STATUS_IS_OK(status)) {
 		if (open_was_deferred(smb1req->xconn, smb1req->mid)) {
 			SMBPROFILE_IOBYTES_ASYNC_SET_IDLE(smb2req->profile);
-			return req;
+			return;
 		}
 		tevent_req_nterror(req, status);
-		return tevent_req_post(req, state->ev);
+		return;
 	}
 	state->op = state->result->op;
 
 	smbd_smb2_create_after_exec(req);
 	if (!tevent_req_is_in_progress(req)) {
-		return req;
+		return;
 	}
 
 	smbd_smb2_create_finish(req);
-	return req;
 }
 
 static void smbd_smb2_create_before_exec(struct tevent_req *req)
@@ -1067,6 +1356,7 @@ static void smbd_smb2_create_before_exec(struct tevent_req *req)
 	if (state->dh2q != NULL) {
 		const uint8_t *p = state->dh2q->data.data;
 		uint32_t durable_v2_timeout = 0;
+		uint32_t durable_v2_flags = 0;
 		DATA_BLOB create_guid_blob;
 		const uint8_t *hdr;
 		uint32_t flags;
@@ -1082,8 +1372,23 @@ static void smbd_smb2_create_before_exec(struct tevent_req *req)
 		}
 
 		durable_v2_timeout = IVAL(p, 0);
+		durable_v2_flags = IVAL(p, 4);
 		create_guid_blob = data_blob_const(p + 16, 16);
 
+		if (durable_v2_flags & SMB2_DHANDLE_FLAG_PERSISTENT) {
+			/*
+			 * We never announce SMB2_CAP_PERSISTENT_HANDLES
+			 * nor SMB2_SHARE_CAP_CONTINUOUS_AVAILABILITY: the
+			 * open, lease and byte range lock state only lives
+			 * in volatile databases and would not survive the
+			 * failure of all nodes. Treat this as a durable v2
+			 * request, the response flags tell the client that
+			 * the handle is not persistent.
+			 */
+			DBG_DEBUG("persistent handle requested, "
+				  "granting durable v2 semantics only\n");
+		}
+
 		status = GUID_from_ndr_blob(&create_guid_blob,
 					    &state->_create_guid);
 		if (tevent_req_nterror(req, status)) {
@@ -1784,6 +2089,14 @@ static bool smbd_smb2_create_cancel(struct tevent_req *req)
 	smb2req = state->smb2req;
 	mid = get_mid_from_smb2req(smb2req);
 
+	if (state->prefetch_req != NULL) {
+		/*
+		 * The prefetch job can't be stopped, the
+		 * open starts right after it anyway.
+		 */
+		return false;
+	}
+
 	if (is_deferred_open_async(state->open_rec)) {
 		/* Can't cancel an async create. */
 		return false;
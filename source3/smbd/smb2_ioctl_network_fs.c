@@ -29,6 +29,7 @@
 #include "../librpc/ndr/libndr.h"
 #include "librpc/gen_ndr/ndr_ioctl.h"
 #include "smb2_ioctl_private.h"
+#include "lib/util/tsort.h"
 #include "../lib/tsocket/tsocket.h"
 
 #undef DBGC_CLASS
@@ -78,11 +79,63 @@ static NTSTATUS copychunk_check_limits(struct srv_copychunk_copy *cc_copy)
 	return NT_STATUS_OK;
 }
 
+/*
+ * Maximum number of chunks of a request that are copied in parallel
+ */
+#define COPYCHUNK_MAX_PARALLEL 16
+
+static bool copychunk_ranges_overlap(off_t off1, uint32_t len1,
+				     off_t off2, uint32_t len2)
+{
+	return (off1 < off2 + len2) && (off2 < off1 + len1);
+}
+
+/*
+ * The chunks can only be copied in parallel if none of them
+ * depends on the result of another one. We don't know whether
+ * source and target are the same file here, assume they are.
+ */
+static bool copychunk_chunks_independent(struct srv_copychunk_copy *cc_copy)
+{
+	uint32_t i, j;
+
+	for (i = 0; i < cc_copy->chunk_count; i++) {
+		struct srv_copychunk *c1 = &cc_copy->chunks[i];
+
+		for (j = i + 1; j < cc_copy->chunk_count; j++) {
+			struct srv_copychunk *c2 = &cc_copy->chunks[j];
+
+			if (copychunk_ranges_overlap(c1->target_off,
+						     c1->length,
+						     c2->target_off,
+						     c2->length) ||
+			    copychunk_ranges_overlap(c1->target_off,
+						     c1->length,
+						     c2->source_off,
+						     c2->length) ||
+			    copychunk_ranges_overlap(c1->source_off,
+						     c1->length,
+						     c2->target_off,
+						     c2->length))
+			{
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
 struct fsctl_srv_copychunk_state {
 	struct tevent_context *ev;
 	struct connection_struct *conn;
 	struct srv_copychunk_copy cc_copy;
 	uint32_t current_chunk;
+	uint32_t next_chunk;
+	uint32_t num_pending;
+	uint32_t max_pending;
+	off_t *chunk_written;
+	uint32_t failed_chunk;
 	NTSTATUS status;
 	off_t total_written;
 	uint32_t ctl_code;
@@ -96,9 +149,18 @@ struct fsctl_srv_copychunk_state {
 	} out_data;
 	bool aapl_copyfile;
 };
+
+struct fsctl_srv_copychunk_vfs_state {
+	struct tevent_req *req;
+	uint32_t chunk;
+};
+
 static void fsctl_srv_copychunk_vfs_done(struct tevent_req *subreq);
 
 static NTSTATUS fsctl_srv_copychunk_loop(struct tevent_req *req);
+static void fsctl_srv_copychunk_failed(struct fsctl_srv_copychunk_state *state,
+				       uint32_t chunk,
+				       NTSTATUS status);
 
 static struct tevent_req *fsctl_srv_copychunk_send(TALLOC_CTX *mem_ctx,
 						   struct tevent_context *ev,
@@ -161,11 +223,31 @@ static struct tevent_req *fsctl_srv_copychunk_send(TALLOC_CTX *mem_ctx,
 	/* any errors from here onwards should carry copychunk response data */
 	state->out_data = COPYCHUNK_OUT_RSP;
 
-	status = fsctl_srv_copychunk_loop(req);
-	if (tevent_req_nterror(req, status)) {
+	/*
+	 * A chunk_count of 0 still results in one call into the VFS,
+	 * see fsctl_srv_copychunk_loop().
+	 */
+	state->chunk_written = talloc_zero_array(
+		state, off_t, MAX(state->cc_copy.chunk_count, 1));
+	if (tevent_req_nomem(state->chunk_written, req)) {
 		return tevent_req_post(req, ev);
 	}
 
+	state->max_pending = 1;
+	if (copychunk_chunks_independent(&state->cc_copy)) {
+		state->max_pending = COPYCHUNK_MAX_PARALLEL;
+	}
+
+	status = fsctl_srv_copychunk_loop(req);
+	if (!NT_STATUS_IS_OK(status)) {
+		if (state->num_pending == 0) {
+			tevent_req_nterror(req, status);
+			return tevent_req_post(req, ev);
+		}
+		/* wait for the chunks in flight */
+		fsctl_srv_copychunk_failed(state, state->next_chunk, status);
+	}
+
 	return req;
 }
 
@@ -173,90 +255,148 @@ static NTSTATUS fsctl_srv_copychunk_loop(struct tevent_req *req)
 {
 	struct fsctl_srv_copychunk_state *state = tevent_req_data(
 		req, struct fsctl_srv_copychunk_state);
-	struct tevent_req *subreq = NULL;
-	uint32_t length = 0;
-	off_t source_off = 0;
-	off_t target_off = 0;
+	uint32_t num_chunks = MAX(state->cc_copy.chunk_count, 1);
 
-	/*
-	 * chunk_count can be 0 which must either just do nothing returning
-	 * success saying number of copied chunks is 0 (verified against
-	 * Windows).
-	 *
-	 * Or it can be a special macOS copyfile request, so we send this into
-	 * the VFS, vfs_fruit if loaded implements the macOS copyile semantics.
-	 */
-	if (state->cc_copy.chunk_count > 0) {
-		struct srv_copychunk *chunk = NULL;
-
-		chunk = &state->cc_copy.chunks[state->current_chunk];
-		length = chunk->length;
-		source_off = chunk->source_off;
-		target_off = chunk->target_off;
-	}
-
-	subreq = SMB_VFS_OFFLOAD_WRITE_SEND(state->dst_fsp->conn,
-					 state,
-					 state->ev,
-					 state->ctl_code,
-					 &state->token,
-					 source_off,
-					 state->dst_fsp,
-					 target_off,
-					 length);
-	if (tevent_req_nomem(subreq, req)) {
-		return NT_STATUS_NO_MEMORY;
+	while ((state->next_chunk < num_chunks) &&
+	       (state->num_pending < state->max_pending))
+	{
+		struct fsctl_srv_copychunk_vfs_state *vfs_state = NULL;
+		struct tevent_req *subreq = NULL;
+		uint32_t length = 0;
+		off_t source_off = 0;
+		off_t target_off = 0;
+
+		/*
+		 * chunk_count can be 0 which must either just do nothing
+		 * returning success saying number of copied chunks is 0
+		 * (verified against Windows).
+		 *
+		 * Or it can be a special macOS copyfile request, so we send
+		 * this into the VFS, vfs_fruit if loaded implements the macOS
+		 * copyile semantics.
+		 */
+		if (state->cc_copy.chunk_count > 0) {
+			struct srv_copychunk *chunk = NULL;
+
+			chunk = &state->cc_copy.chunks[state->next_chunk];
+			length = chunk->length;
+			source_off = chunk->source_off;
+			target_off = chunk->target_off;
+		}
+
+		vfs_state = talloc(state, struct fsctl_srv_copychunk_vfs_state);
+		if (vfs_state == NULL) {
+			return NT_STATUS_NO_MEMORY;
+		}
+		*vfs_state = (struct fsctl_srv_copychunk_vfs_state) {
+			.req = req,
+			.chunk = state->next_chunk,
+		};
+
+		subreq = SMB_VFS_OFFLOAD_WRITE_SEND(state->dst_fsp->conn,
+						 vfs_state,
+						 state->ev,
+						 state->ctl_code,
+						 &state->token,
+						 source_off,
+						 state->dst_fsp,
+						 target_off,
+						 length);
+		if (subreq == NULL) {
+			TALLOC_FREE(vfs_state);
+			return NT_STATUS_NO_MEMORY;
+		}
+		tevent_req_set_callback(subreq,
+					fsctl_srv_copychunk_vfs_done,
+					vfs_state);
+
+		state->next_chunk += 1;
+		state->num_pending += 1;
 	}
-	tevent_req_set_callback(subreq,	fsctl_srv_copychunk_vfs_done, req);
 
 	return NT_STATUS_OK;
 }
 
+/*
+ * Chunks are reported as written up to the first one that failed,
+ * chunks after it might have been written as well, but the client
+ * will retry them.
+ */
+static void fsctl_srv_copychunk_failed(struct fsctl_srv_copychunk_state *state,
+				       uint32_t chunk,
+				       NTSTATUS status)
+{
+	if (NT_STATUS_IS_OK(state->status) || (chunk < state->failed_chunk)) {
+		state->status = status;
+		state->failed_chunk = chunk;
+	}
+}
+
 static void fsctl_srv_copychunk_vfs_done(struct tevent_req *subreq)
 {
-	struct tevent_req *req = tevent_req_callback_data(
-		subreq, struct tevent_req);
+	struct fsctl_srv_copychunk_vfs_state *vfs_state =
+		tevent_req_callback_data(subreq,
+		struct fsctl_srv_copychunk_vfs_state);
+	struct tevent_req *req = vfs_state->req;
 	struct fsctl_srv_copychunk_state *state = tevent_req_data(
 		req, struct fsctl_srv_copychunk_state);
+	uint32_t chunk = vfs_state->chunk;
+	uint32_t num_ok;
+	uint32_t i;
 	off_t chunk_nwritten;
 	NTSTATUS status;
 
 	status = SMB_VFS_OFFLOAD_WRITE_RECV(state->conn, subreq,
 					 &chunk_nwritten);
-	TALLOC_FREE(subreq);
+	TALLOC_FREE(vfs_state);
+	state->num_pending -= 1;
+
 	if (!NT_STATUS_IS_OK(status)) {
 		DBG_ERR("copy chunk failed [%s] chunk [%u] of [%u]\n",
 			nt_errstr(status),
-			(unsigned int)state->current_chunk,
+			(unsigned int)chunk,
 			(unsigned int)state->cc_copy.chunk_count);
-		tevent_req_nterror(req, status);
-		return;
+		fsctl_srv_copychunk_failed(state, chunk, status);
+	} else {
+		DBG_DEBUG("good copy chunk [%u] of [%u]\n",
+			  (unsigned int)chunk,
+			  (unsigned int)state->cc_copy.chunk_count);
+		state->chunk_written[chunk] = chunk_nwritten;
+	}
+
+	if (NT_STATUS_IS_OK(state->status)) {
+		status = fsctl_srv_copychunk_loop(req);
+		if (!NT_STATUS_IS_OK(status)) {
+			fsctl_srv_copychunk_failed(state,
+						   state->next_chunk,
+						   status);
+		}
 	}
 
-	DBG_DEBUG("good copy chunk [%u] of [%u]\n",
-		  (unsigned int)state->current_chunk,
-		  (unsigned int)state->cc_copy.chunk_count);
-	state->total_written += chunk_nwritten;
-
-	if (state->cc_copy.chunk_count == 0) {
-		/*
-		 * This must not produce an error but just return a chunk count
-		 * of 0 in the response.
-		 */
-		tevent_req_done(req);
+	if (state->num_pending > 0) {
 		return;
 	}
 
-	state->current_chunk++;
-	if (state->current_chunk == state->cc_copy.chunk_count) {
-		tevent_req_done(req);
-		return;
+	num_ok = state->next_chunk;
+	if (!NT_STATUS_IS_OK(state->status)) {
+		num_ok = state->failed_chunk;
+	}
+	for (i = 0; i < num_ok; i++) {
+		state->total_written += state->chunk_written[i];
 	}
 
-	status = fsctl_srv_copychunk_loop(req);
-	if (tevent_req_nterror(req, status)) {
+	/*
+	 * A chunk_count of 0 must not produce an error but just return
+	 * a chunk count of 0 in the response.
+	 */
+	if (state->cc_copy.chunk_count > 0) {
+		state->current_chunk = num_ok;
+	}
+
+	if (tevent_req_nterror(req, state->status)) {
 		return;
 	}
+	tevent_req_done(req);
 }
 
 static NTSTATUS fsctl_srv_copychunk_recv(struct tevent_req *req,
@@ -290,6 +430,29 @@ static NTSTATUS fsctl_srv_copychunk_recv(struct tevent_req *req,
 	return status;
 }
 
+/*
+ * Windows clients use the first interfaces of the list when
+ * they set up additional channels, so list the RSS capable and
+ * fastest interfaces first.
+ */
+static int fsctl_net_iface_info_cmp(const struct fsctl_net_iface_info *i1,
+				    const struct fsctl_net_iface_info *i2)
+{
+	bool rss1 = (i1->capability & FSCTL_NET_IFACE_RSS_CAPABLE);
+	bool rss2 = (i2->capability & FSCTL_NET_IFACE_RSS_CAPABLE);
+
+	if (rss1 != rss2) {
+		return rss1 ? -1 : 1;
+	}
+	if (i1->linkspeed != i2->linkspeed) {
+		return (i1->linkspeed > i2->linkspeed) ? -1 : 1;
+	}
+	if (i1->ifindex != i2->ifindex) {
+		return (i1->ifindex < i2->ifindex) ? -1 : 1;
+	}
+	return 0;
+}
+
 static NTSTATUS fsctl_network_iface_info(TALLOC_CTX *mem_ctx,
 					 struct tevent_context *ev,
 					 struct smbXsrv_connection *xconn,
@@ -299,9 +462,9 @@ static NTSTATUS fsctl_network_iface_info(TALLOC_CTX *mem_ctx,
 {
 	struct fsctl_net_iface_info *array = NULL;
 	struct fsctl_net_iface_info *first = NULL;
-	struct fsctl_net_iface_info *last = NULL;
 	size_t i;
 	size_t num_ifaces = iface_count();
+	size_t num_valid = 0;
 	enum ndr_err_code ndr_err;
 
 	if (in_input->length != 0) {
@@ -318,7 +481,7 @@ static NTSTATUS fsctl_network_iface_info(TALLOC_CTX *mem_ctx,
 	}
 
 	for (i=0; i < num_ifaces; i++) {
-		struct fsctl_net_iface_info *cur = &array[i];
+		struct fsctl_net_iface_info *cur = &array[num_valid];
 		const struct interface *iface = get_interface(i);
 		const struct sockaddr_storage *ifss = &iface->ip;
 		const void *ifptr = ifss;
@@ -374,20 +537,21 @@ static NTSTATUS fsctl_network_iface_info(TALLOC_CTX *mem_ctx,
 			cur->sockaddr.saddr.saddr_in6.ipv6 = addr;
 		}
 
-		if (first == NULL) {
-			first = cur;
-		}
-		if (last != NULL) {
-			last->next = cur;
-		}
-		last = cur;
+		num_valid++;
 	}
 
-	if (first == NULL) {
+	if (num_valid == 0) {
 		TALLOC_FREE(array);
 		return NT_STATUS_OK;
 	}
 
+	TYPESAFE_QSORT(array, num_valid, fsctl_net_iface_info_cmp);
+
+	for (i=0; i + 1 < num_valid; i++) {
+		array[i].next = &array[i+1];
+	}
+	first = &array[0];
+
 	if (DEBUGLEVEL >= 10) {
 		NDR_PRINT_DEBUG(fsctl_net_iface_info, first);
 	}
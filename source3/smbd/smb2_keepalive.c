@@ -38,6 +38,9 @@ NTSTATUS smbd_smb2_request_process_keepalive(struct smbd_smb2_request *req)
 
 	/* TODO: update some time stamps */
 
+	/* Keepalives don't make an idle client busy */
+	req->sconn->num_keepalives += 1;
+
 	outbody = smbd_smb2_generate_outbody(req, 0x04);
 	if (outbody.data == NULL) {
 		return smbd_smb2_request_error(req, NT_STATUS_NO_MEMORY);
@@ -45,6 +45,7 @@ struct smbd_smb2_lock_state {
 
 static void remove_pending_lock(struct smbd_smb2_lock_state *state,
 				struct blocking_lock_record *blr);
+static void smbd_smb2_lock_wakeup_done(struct tevent_req *subreq);
 
 static struct tevent_req *smbd_smb2_lock_send(TALLOC_CTX *mem_ctx,
 						 struct tevent_context *ev,
@@ -491,7 +492,11 @@ static bool recalc_smb2_brl_timeout(struct smbd_server_connection *sconn)
 {
 	struct smbXsrv_connection *xconn = NULL;
 	struct timeval next_timeout = timeval_zero();
-	int max_brl_timeout = lp_parm_int(-1, "brl", "recalctime", 5);
+	int poll_time = lp_parm_int(-1, "brl", "recalctime", 5);
+
+	if (poll_time <= 0) {
+		poll_time = 10;
+	}
 
 	TALLOC_FREE(sconn->smb2.locks.brl_timeout);
 
@@ -520,13 +525,16 @@ static bool recalc_smb2_brl_timeout(struct smbd_server_connection *sconn)
 
 			/*
 			 * If we're blocked on pid 0xFFFFFFFFFFFFFFFFLL this is
-			 * a POSIX lock, so calculate a timeout of
-			 * 10 seconds into the future.
+			 * a POSIX lock taken outside smbd, its unlock does
+			 * not touch brlock.tdb. The same if we could not
+			 * watch brlock.tdb. Retry every brl:recalctime
+			 * seconds (default 5 seconds).
 			 */
-			if (blr->blocking_smblctx == 0xFFFFFFFFFFFFFFFFLL) {
+			if (blr->blocking_smblctx == 0xFFFFFFFFFFFFFFFFLL ||
+			    blr->watch_req == NULL) {
 				struct timeval psx_to;
 
-				psx_to = timeval_current_ofs(10, 0);
+				psx_to = timeval_current_ofs(poll_time, 0);
 				next_timeout = timeval_brl_min(&next_timeout,
 							       &psx_to);
 			}
@@ -539,25 +547,6 @@ static bool recalc_smb2_brl_timeout(struct smbd_server_connection *sconn)
 		return true;
 	}
 
-        /*
-	 * To account for unclean shutdowns by clients we need a
-	 * maximum timeout that we use for checking pending locks. If
-	 * we have any pending locks at all, then check if the pending
-	 * lock can continue at least every brl:recalctime seconds
-	 * (default 5 seconds).
-	 *
-	 * This saves us needing to do a message_send_all() in the
-	 * SIGCHLD handler in the parent daemon. That
-	 * message_send_all() caused O(n^2) work to be done when IP
-	 * failovers happened in clustered Samba, which could make the
-	 * entire system unusable for many minutes.
-	 */
-
-	if (max_brl_timeout > 0) {
-		struct timeval min_to = timeval_current_ofs(max_brl_timeout, 0);
-		next_timeout = timeval_brl_min(&next_timeout, &min_to);
-	}
-
 	if (DEBUGLVL(10)) {
 		struct timeval cur, from_now;
 
@@ -643,6 +632,20 @@ bool push_blocking_lock_request_smb2( struct byte_range_lock *br_lck,
 	/* Specific brl_lock() implementations can fill this in. */
 	blr->blr_private = NULL;
 
+	/*
+	 * We hold the brlock.tdb record, so we can only start
+	 * watching it from the next event loop run, see
+	 * smbd_smb2_lock_retry().
+	 */
+	blr->watch_req = tevent_wakeup_send(blr, sconn->ev_ctx,
+					    timeval_zero());
+	if (blr->watch_req == NULL) {
+		TALLOC_FREE(blr);
+		return false;
+	}
+	tevent_req_set_callback(blr->watch_req, smbd_smb2_lock_wakeup_done,
+				smb2req);
+
 	/* Add a pending lock record for this. */
 	status = brl_lock(sconn->msg_ctx,
 			br_lck,
@@ -708,9 +711,10 @@ static void remove_pending_lock(struct smbd_smb2_lock_state *state,
 /****************************************************************
  Re-proccess a blocking lock request.
  This is equivalent to process_lockingX() inside smbd/blocking.c
+ Returns true if the request is finished.
 *****************************************************************/
 
-static void reprocess_blocked_smb2_lock(struct smbd_smb2_request *smb2req,
+static bool reprocess_blocked_smb2_lock(struct smbd_smb2_request *smb2req,
 				struct timeval tv_curr)
 {
 	NTSTATUS status = NT_STATUS_UNSUCCESSFUL;
@@ -721,13 +725,13 @@ static void reprocess_blocked_smb2_lock(struct smbd_smb2_request *smb2req,
 	files_struct *fsp = NULL;
 
 	if (!smb2req->subreq) {
-		return;
+		return true;
 	}
 	SMBPROFILE_IOBYTES_ASYNC_SET_BUSY(smb2req->profile);
 
 	state = tevent_req_data(smb2req->subreq, struct smbd_smb2_lock_state);
 	if (!state) {
-		return;
+		return true;
 	}
 
 	blr = state->blr;
@@ -766,7 +770,7 @@ static void reprocess_blocked_smb2_lock(struct smbd_smb2_request *smb2req,
 
 		remove_pending_lock(state, blr);
 		tevent_req_done(smb2req->subreq);
-		return;
+		return true;
 	}
 
 	if (!NT_STATUS_EQUAL(status,NT_STATUS_LOCK_NOT_GRANTED) &&
@@ -777,7 +781,7 @@ static void reprocess_blocked_smb2_lock(struct smbd_smb2_request *smb2req,
 		 */
 		remove_pending_lock(state, blr);
 		tevent_req_nterror(smb2req->subreq, status);
-		return;
+		return true;
         }
 
 	/*
@@ -789,7 +793,7 @@ static void reprocess_blocked_smb2_lock(struct smbd_smb2_request *smb2req,
 			timeval_compare(&blr->expire_time, &tv_curr) <= 0) {
 		remove_pending_lock(state, blr);
 		tevent_req_nterror(smb2req->subreq, NT_STATUS_LOCK_NOT_GRANTED);
-		return;
+		return true;
 	}
 
 	/*
@@ -802,7 +806,89 @@ static void reprocess_blocked_smb2_lock(struct smbd_smb2_request *smb2req,
 		fsp_fnum_dbg(fsp)));
 
 	SMBPROFILE_IOBYTES_ASYNC_SET_IDLE(smb2req->profile);
-        return;
+	return false;
+}
+
+/****************************************************************
+ Retry a blocking lock request after watching the brlock.tdb record
+ of the file, so that we can't miss an unlock that happens right
+ after our attempt. If we're blocked by someone else now, watch
+ again for their death.
+*****************************************************************/
+
+static void smbd_smb2_lock_watch_done(struct tevent_req *subreq);
+
+static void smbd_smb2_lock_retry(struct smbd_smb2_request *smb2req,
+				 struct timeval tv_curr)
+{
+	struct blocking_lock_record *blr = get_pending_smb2req_blr(smb2req);
+	uint64_t blocking_smblctx;
+	bool done;
+
+	if (blr == NULL) {
+		return;
+	}
+
+	do {
+		blocking_smblctx = blr->blocking_smblctx;
+
+		TALLOC_FREE(blr->watch_req);
+		blr->watch_req = brl_watch_send(blr, smb2req->sconn->ev_ctx,
+						blr->fsp, blocking_smblctx);
+		if (blr->watch_req != NULL) {
+			tevent_req_set_callback(blr->watch_req,
+						smbd_smb2_lock_watch_done,
+						smb2req);
+		}
+
+		done = reprocess_blocked_smb2_lock(smb2req, tv_curr);
+		if (done) {
+			return;
+		}
+	} while (blr->blocking_smblctx != blocking_smblctx);
+}
+
+static void smbd_smb2_lock_wakeup_done(struct tevent_req *subreq)
+{
+	struct smbd_smb2_request *smb2req = tevent_req_callback_data(
+		subreq, struct smbd_smb2_request);
+	struct smbd_server_connection *sconn = smb2req->sconn;
+	struct blocking_lock_record *blr = get_pending_smb2req_blr(smb2req);
+
+	SMB_ASSERT(blr != NULL);
+	SMB_ASSERT(blr->watch_req == subreq);
+
+	tevent_wakeup_recv(subreq);
+	TALLOC_FREE(blr->watch_req);
+
+	change_to_root_user();
+
+	smbd_smb2_lock_retry(smb2req, timeval_current());
+	recalc_smb2_brl_timeout(sconn);
+}
+
+static void smbd_smb2_lock_watch_done(struct tevent_req *subreq)
+{
+	struct smbd_smb2_request *smb2req = tevent_req_callback_data(
+		subreq, struct smbd_smb2_request);
+	struct smbd_server_connection *sconn = smb2req->sconn;
+	struct blocking_lock_record *blr = get_pending_smb2req_blr(smb2req);
+	bool blockerdead = false;
+	NTSTATUS status;
+
+	SMB_ASSERT(blr != NULL);
+	SMB_ASSERT(blr->watch_req == subreq);
+
+	status = brl_watch_recv(subreq, &blockerdead);
+	TALLOC_FREE(blr->watch_req);
+
+	DEBUG(10, ("brl_watch_recv returned %s, blockerdead=%d\n",
+		   nt_errstr(status), (int)blockerdead));
+
+	change_to_root_user();
+
+	smbd_smb2_lock_retry(smb2req, timeval_current());
+	recalc_smb2_brl_timeout(sconn);
 }
 
 /****************************************************************
@@ -838,7 +924,7 @@ void process_blocking_lock_queue_smb2(
 
 			inhdr = SMBD_SMB2_IN_HDR_PTR(smb2req);
 			if (SVAL(inhdr, SMB2_HDR_OPCODE) == SMB2_OP_LOCK) {
-				reprocess_blocked_smb2_lock(smb2req, tv_curr);
+				smbd_smb2_lock_retry(smb2req, tv_curr);
 			}
 		}
 	}
@@ -907,6 +993,9 @@ void cancel_pending_lock_requests_by_fid_smb2(files_struct *fsp,
 
 			blr = state->blr;
 
+			/* We hold the record, can't free the watch here. */
+			blocking_lock_stop_watch(blr);
+
 			/* Remove the entries from the lock db. */
 			brl_lock_cancel(br_lck,
 					blr->smblctx,
@@ -248,6 +248,8 @@ static bool smb2_query_directory_next_entry(struct tevent_req *req);
 static void smb2_query_directory_fetch_write_time_done(struct tevent_req *subreq);
 static void smb2_query_directory_dos_mode_done(struct tevent_req *subreq);
 static void smb2_query_directory_waited(struct tevent_req *subreq);
+static void smb2_query_directory_prefetch(struct files_struct *fsp,
+					  uint32_t info_level);
 
 static struct tevent_req *smbd_smb2_query_directory_send(TALLOC_CTX *mem_ctx,
 					      struct tevent_context *ev,
@@ -461,6 +463,11 @@ static struct tevent_req *smbd_smb2_query_directory_send(TALLOC_CTX *mem_ctx,
 
 	if (in_flags & SMB2_CONTINUE_FLAG_RESTART) {
 		dptr_SeekDir(fsp->dptr, 0);
+	} else if ((lp_smbd_dir_prefetch_jobs(SNUM(conn)) > 0) &&
+		   (strcmp(state->in_file_name, "*") == 0) &&
+		   dptr_start_prefetch(fsp->dptr))
+	{
+		smb2_query_directory_prefetch(fsp, state->info_level);
 	}
 
 	if (in_flags & SMB2_CONTINUE_FLAG_SINGLE) {
@@ -1090,3 +1097,235 @@ static NTSTATUS fetch_dos_mode_recv(struct tevent_req *req)
 	tevent_req_received(req);
 	return NT_STATUS_OK;
 }
+
+/*
+ * Large directory scans: look up the metadata of all entries in the
+ * thread pool, so that the stat and DOS attribute calls done for every
+ * entry on the main thread are served from the kernel caches.
+ *
+ * The directory is split between several jobs, each reads all names
+ * (cheap after the first job made the kernel cache them) but only
+ * looks at every n-th entry. The jobs are not bound to the request,
+ * the results are thrown away.
+ */
+struct smb2_query_directory_prefetch_state {
+	int dirfd;
+	uint32_t idx;
+	uint32_t num_jobs;
+	bool dos_attributes;
+	const struct security_unix_token *token;
+	size_t num_entries;
+	struct timespec start_time;
+	uint64_t duration;
+};
+
+static void smb2_query_directory_prefetch_do(void *private_data);
+static void smb2_query_directory_prefetch_done(struct tevent_req *subreq);
+static int smb2_query_directory_prefetch_state_destructor(
+	struct smb2_query_directory_prefetch_state *state);
+
+static void smb2_query_directory_prefetch(struct files_struct *fsp,
+					  uint32_t info_level)
+{
+	connection_struct *conn = fsp->conn;
+	bool have_per_thread_creds = false;
+	size_t max_threads;
+	uint32_t num_jobs;
+	uint32_t i;
+
+	if (info_level == SMB_FIND_FILE_NAMES_INFO) {
+		return;
+	}
+
+	if (fsp->fh->fd == -1) {
+		return;
+	}
+
+#ifdef HAVE_LINUX_THREAD_CREDENTIALS
+	have_per_thread_creds = true;
+#endif
+	if (!have_per_thread_creds) {
+		return;
+	}
+
+	max_threads = pthreadpool_tevent_max_threads(conn->sconn->pool);
+	if (max_threads == 0 || !per_thread_cwd_supported()) {
+		return;
+	}
+
+	num_jobs = MIN(lp_smbd_dir_prefetch_jobs(SNUM(conn)), max_threads);
+
+	DBG_DEBUG("Starting %"PRIu32" prefetch jobs for %s\n",
+		  num_jobs, fsp_str_dbg(fsp));
+
+	for (i = 0; i < num_jobs; i++) {
+		struct smb2_query_directory_prefetch_state *state = NULL;
+		struct tevent_req *subreq = NULL;
+
+		state = talloc_zero(conn->sconn,
+				    struct smb2_query_directory_prefetch_state);
+		if (state == NULL) {
+			return;
+		}
+		state->idx = i;
+		state->num_jobs = num_jobs;
+		state->dos_attributes = lp_store_dos_attributes(SNUM(conn));
+
+		if (geteuid() == sec_initial_uid()) {
+			state->token = root_unix_token(state);
+		} else {
+			state->token = copy_unix_token(
+					state,
+					conn->session_info->unix_token);
+		}
+		if (state->token == NULL) {
+			TALLOC_FREE(state);
+			return;
+		}
+
+		/*
+		 * Every job needs its own directory position,
+		 * a dup() would share it.
+		 */
+		state->dirfd = openat(fsp->fh->fd,
+				      ".",
+				      O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+		if (state->dirfd == -1) {
+			DBG_DEBUG("openat failed: %s\n", strerror(errno));
+			TALLOC_FREE(state);
+			return;
+		}
+
+		subreq = pthreadpool_tevent_job_send_prio(state,
+						     conn->sconn->ev_ctx,
+						     conn->sconn->pool,
+						     PTHREADPOOL_PRIO_HIGH,
+						     smb2_query_directory_prefetch_do,
+						     state);
+		if (subreq == NULL) {
+			close(state->dirfd);
+			TALLOC_FREE(state);
+			return;
+		}
+		tevent_req_set_callback(subreq,
+					smb2_query_directory_prefetch_done,
+					state);
+
+		/*
+		 * The thread owns dirfd and closes it, the state must
+		 * not go away before the job is done.
+		 */
+		talloc_set_destructor(
+			state, smb2_query_directory_prefetch_state_destructor);
+	}
+}
+
+static int smb2_query_directory_prefetch_state_destructor(
+	struct smb2_query_directory_prefetch_state *state)
+{
+	return -1;
+}
+
+static void smb2_query_directory_prefetch_do(void *private_data)
+{
+	struct smb2_query_directory_prefetch_state *state =
+		talloc_get_type_abort(
+			private_data,
+			struct smb2_query_directory_prefetch_state);
+	struct timespec end_time;
+	struct dirent *de = NULL;
+	DIR *dir = NULL;
+	size_t n = 0;
+	int ret;
+
+	PROFILE_TIMESTAMP(&state->start_time);
+
+	/*
+	 * getxattr() only takes a path,
+	 * so the job works below the directory.
+	 */
+	per_thread_cwd_activate();
+
+	/* Become the correct credential on this thread. */
+	ret = set_thread_credentials(state->token->uid,
+				     state->token->gid,
+				     (size_t)state->token->ngroups,
+				     state->token->groups);
+	if (ret != 0) {
+		goto done;
+	}
+
+	ret = fchdir(state->dirfd);
+	if (ret == -1) {
+		goto done;
+	}
+
+	dir = fdopendir(state->dirfd);
+	if (dir == NULL) {
+		goto done;
+	}
+	state->dirfd = -1;
+
+	while ((de = readdir(dir)) != NULL) {
+		struct stat st;
+		char buf[256];
+
+		if (ISDOT(de->d_name) || ISDOTDOT(de->d_name)) {
+			continue;
+		}
+		if ((n++ % state->num_jobs) != state->idx) {
+			continue;
+		}
+
+		ret = fstatat(dirfd(dir), de->d_name, &st, 0);
+		if (ret == -1) {
+			continue;
+		}
+		state->num_entries += 1;
+
+		if (state->dos_attributes) {
+			getxattr(de->d_name,
+				 SAMBA_XATTR_DOS_ATTRIB,
+				 buf,
+				 sizeof(buf));
+		}
+	}
+
+	closedir(dir);
+
+done:
+	if (state->dirfd != -1) {
+		close(state->dirfd);
+		state->dirfd = -1;
+	}
+	PROFILE_TIMESTAMP(&end_time);
+	state->duration = nsec_time_diff(&end_time, &state->start_time);
+}
+
+static void smb2_query_directory_prefetch_done(struct tevent_req *subreq)
+{
+	struct smb2_query_directory_prefetch_state *state =
+		tevent_req_callback_data(
+			subreq,
+			struct smb2_query_directory_prefetch_state);
+	int ret;
+
+	ret = pthreadpool_tevent_job_recv(subreq);
+	TALLOC_FREE(subreq);
+	if (ret != 0) {
+		/*
+		 * The thread never ran, so we still own the directory.
+		 */
+		DBG_DEBUG("prefetch job failed: %s\n", strerror(ret));
+		if (state->dirfd != -1) {
+			close(state->dirfd);
+		}
+	} else {
+		DBG_DEBUG("prefetch job %"PRIu32" looked at %zu entries "
+			  "in %"PRIu64" nsec\n",
+			  state->idx, state->num_entries, state->duration);
+	}
+
+	talloc_set_destructor(state, NULL);
+	TALLOC_FREE(state);
+}
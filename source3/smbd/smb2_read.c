@@ -564,7 +564,8 @@ static struct tevent_req *smbd_smb2_read_send(TALLOC_CTX *mem_ctx,
 	}
 
 	/* Ok, read into memory. Allocate the out buffer. */
-	state->out_data = data_blob_talloc(state, NULL, in_length);
+	state->out_data.data = smbd_smb2_buffer_alloc(state, in_length);
+	state->out_data.length = in_length;
 	if (in_length > 0 && tevent_req_nomem(state->out_data.data, req)) {
 		return tevent_req_post(req, ev);
 	}
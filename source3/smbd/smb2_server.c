@@ -26,11 +26,15 @@
 #include "../lib/tsocket/tsocket.h"
 #include "../lib/util/tevent_ntstatus.h"
 #include "smbprofile.h"
+#include "live_stats.h"
 #include "../lib/util/bitmap.h"
 #include "../librpc/gen_ndr/krb5pac.h"
 #include "lib/util/iov_buf.h"
 #include "auth.h"
 #include "lib/crypto/sha512.h"
+#include "lib/compression/lzxpress.h"
+#include "lib/pthreadpool/pthreadpool_tevent.h"
+#include "lib/util/usdt.h"
 
 #undef DBGC_CLASS
 #define DBGC_CLASS DBGC_SMB2
@@ -221,6 +225,7 @@ static NTSTATUS smbd_initialize_smb2(struct smbXsrv_connection *xconn,
 	xconn->smb2.credits.seq_range = 1;
 	xconn->smb2.credits.granted = 1;
 	xconn->smb2.credits.max = lp_smb2_max_credits();
+	xconn->smb2.credits.window = MAX(xconn->smb2.credits.max / 16, 1);
 	xconn->smb2.credits.bitmap = bitmap_talloc(xconn,
 						   xconn->smb2.credits.max);
 	if (xconn->smb2.credits.bitmap == NULL) {
@@ -270,8 +275,43 @@ static bool smb2_setup_nbt_length(struct iovec *vector, int count)
 	return true;
 }
 
+struct smbd_smb2_request_crypto_state {
+	struct smbd_smb2_request *req;
+	bool orphaned;
+
+	bool encrypt;
+	DATA_BLOB key;
+	uint16_t cipher;
+	enum protocol_types protocol;
+	struct iovec *vector;
+	int count;
+
+	/*
+	 * Checking the signature of, or decrypting,
+	 * an incoming request.
+	 */
+	bool incoming;
+	uint8_t in_hdr[SMB2_HDR_BODY];
+	struct iovec in_vector[SMBD_SMB2_NUM_IOV_PER_REQ];
+	uint8_t *inbuf;
+	size_t inbuf_len;
+	NTTIME now;
+
+	NTSTATUS status;
+};
+
 static int smbd_smb2_request_destructor(struct smbd_smb2_request *req)
 {
+	if (req->crypto_state != NULL) {
+		/*
+		 * A worker thread is still working on our
+		 * buffers, smbd_smb2_request_crypto_done()
+		 * will free us once it's finished.
+		 */
+		req->crypto_state->orphaned = true;
+		return -1;
+	}
+	LIVE_STATS_SUB(requests_inflight, 1);
 	if (req->first_key.length > 0) {
 		data_blob_clear_free(&req->first_key);
 	}
@@ -287,6 +327,185 @@ void smb2_request_set_async_internal(struct smbd_smb2_request *req,
 	req->async_internal = async_internal;
 }
 
+/*
+ * Large payload buffers (read responses and write requests) are
+ * recycled through a small per process cache, instead of going
+ * through malloc/free for every request. glibc serves these sizes
+ * via mmap, so a fresh buffer costs a page fault per page touched.
+ *
+ * The buffers are normal talloc chunks of a multiple of
+ * SMBD_SMB2_BUFFER_MIN_SIZE: a destructor moves them back to the
+ * cache once the owning request goes away.
+ */
+#define SMBD_SMB2_BUFFER_MIN_SIZE (64*1024)
+#define SMBD_SMB2_BUFFER_CACHE_ENTRIES 16
+#define SMBD_SMB2_BUFFER_CACHE_MAX_BYTES (64*1024*1024)
+
+static struct {
+	TALLOC_CTX *mem_ctx;
+	uint8_t *bufs[SMBD_SMB2_BUFFER_CACHE_ENTRIES];
+	size_t num_bufs;
+	size_t num_bytes;
+} smbd_smb2_buffer_cache;
+
+static void smbd_smb2_buffer_cache_remove(size_t idx)
+{
+	size_t size = talloc_get_size(smbd_smb2_buffer_cache.bufs[idx]);
+
+	smbd_smb2_buffer_cache.num_bufs -= 1;
+	smbd_smb2_buffer_cache.num_bytes -= size;
+
+	memmove(&smbd_smb2_buffer_cache.bufs[idx],
+		&smbd_smb2_buffer_cache.bufs[idx+1],
+		sizeof(smbd_smb2_buffer_cache.bufs[0]) *
+		(smbd_smb2_buffer_cache.num_bufs - idx));
+}
+
+static int smbd_smb2_buffer_destructor(uint8_t *buf)
+{
+	size_t size = talloc_get_size(buf);
+
+	if (size > SMBD_SMB2_BUFFER_CACHE_MAX_BYTES) {
+		return 0;
+	}
+
+	/*
+	 * Make room by dropping the oldest buffers,
+	 * the size the client uses may have changed.
+	 */
+	while ((smbd_smb2_buffer_cache.num_bufs ==
+		SMBD_SMB2_BUFFER_CACHE_ENTRIES) ||
+	       (smbd_smb2_buffer_cache.num_bytes + size >
+		SMBD_SMB2_BUFFER_CACHE_MAX_BYTES))
+	{
+		uint8_t *old = smbd_smb2_buffer_cache.bufs[0];
+
+		smbd_smb2_buffer_cache_remove(0);
+		talloc_set_destructor(old, NULL);
+		TALLOC_FREE(old);
+	}
+
+	talloc_free_children(buf);
+	talloc_steal(smbd_smb2_buffer_cache.mem_ctx, buf);
+
+	smbd_smb2_buffer_cache.bufs[smbd_smb2_buffer_cache.num_bufs] = buf;
+	smbd_smb2_buffer_cache.num_bufs += 1;
+	smbd_smb2_buffer_cache.num_bytes += size;
+
+	/*
+	 * Keep the buffer, talloc knows
+	 * we have reparented it.
+	 */
+	return -1;
+}
+
+/*
+ * Free all cached buffers, e.g. when the client is idle.
+ */
+void smbd_smb2_buffer_cache_flush(void)
+{
+	while (smbd_smb2_buffer_cache.num_bufs > 0) {
+		size_t idx = smbd_smb2_buffer_cache.num_bufs - 1;
+		uint8_t *old = smbd_smb2_buffer_cache.bufs[idx];
+
+		smbd_smb2_buffer_cache_remove(idx);
+		talloc_set_destructor(old, NULL);
+		TALLOC_FREE(old);
+	}
+}
+
+/*
+ * Allocate a buffer of at least size bytes for an
+ * SMB2 payload. Note that talloc_get_size() of the
+ * result might be larger than size.
+ */
+uint8_t *smbd_smb2_buffer_alloc(TALLOC_CTX *mem_ctx, size_t size)
+{
+	size_t alloc_size;
+	uint8_t *buf = NULL;
+	size_t i;
+
+	if (size < SMBD_SMB2_BUFFER_MIN_SIZE) {
+		return talloc_array(mem_ctx, uint8_t, size);
+	}
+
+	alloc_size = size + SMBD_SMB2_BUFFER_MIN_SIZE - 1;
+	if (alloc_size < size) {
+		return NULL;
+	}
+	alloc_size &= ~((size_t)SMBD_SMB2_BUFFER_MIN_SIZE - 1);
+
+	for (i = smbd_smb2_buffer_cache.num_bufs; i > 0; i--) {
+		buf = smbd_smb2_buffer_cache.bufs[i-1];
+
+		if (talloc_get_size(buf) != alloc_size) {
+			continue;
+		}
+
+		smbd_smb2_buffer_cache_remove(i-1);
+		talloc_steal(mem_ctx, buf);
+		return buf;
+	}
+
+	if (smbd_smb2_buffer_cache.mem_ctx == NULL) {
+		smbd_smb2_buffer_cache.mem_ctx = talloc_named_const(
+			NULL, 0, "smbd_smb2_buffer_cache");
+		if (smbd_smb2_buffer_cache.mem_ctx == NULL) {
+			return NULL;
+		}
+	}
+
+	/*
+	 * Allocate on the cache context, mem_ctx might be
+	 * part of a talloc pool and we don't want to pin it.
+	 */
+	buf = talloc_array(smbd_smb2_buffer_cache.mem_ctx, uint8_t, alloc_size);
+	if (buf == NULL) {
+		return NULL;
+	}
+	talloc_steal(mem_ctx, buf);
+	talloc_set_destructor(buf, smbd_smb2_buffer_destructor);
+
+	return buf;
+}
+
+#ifdef HAVE_ATOMIC_THREAD_FENCE_SUPPORT
+/*
+ * Reading the talloc accounting of the client and the
+ * connections is cheap, so we can do it for every request.
+ */
+static void smbd_smb2_live_stats_memory(struct smbXsrv_client *client)
+{
+	struct smbXsrv_connection *xconn = NULL;
+	uint64_t connection_bytes = 0;
+
+	if (live_stats_segment == NULL) {
+		return;
+	}
+
+	for (xconn = client->connections; xconn != NULL; xconn = xconn->next) {
+		connection_bytes += talloc_accounted_size(xconn);
+	}
+
+	LIVE_STATS_SET(client_bytes, talloc_accounted_size(client));
+	LIVE_STATS_SET(connection_bytes, connection_bytes);
+}
+#else
+static void smbd_smb2_live_stats_memory(struct smbXsrv_client *client)
+{
+	return;
+}
+#endif
+
+/*
+ * Requests are allocated and freed all the time, take them from a
+ * slab that is reused for the lifetime of the process. This also
+ * avoids pinning the talloc_tos() pool while a request is pending.
+ */
+#define SMBD_SMB2_REQUEST_SLAB_ENTRIES 64
+
+static void *smbd_smb2_request_slab;
+
 static struct smbd_smb2_request *smbd_smb2_request_allocate(TALLOC_CTX *mem_ctx)
 {
 	TALLOC_CTX *mem_pool;
@@ -296,7 +515,15 @@ static struct smbd_smb2_request *smbd_smb2_request_allocate(TALLOC_CTX *mem_ctx)
 	/* Enable this to find subtle valgrind errors. */
 	mem_pool = talloc_init("smbd_smb2_request_allocate");
 #else
-	mem_pool = talloc_tos();
+	if (smbd_smb2_request_slab == NULL) {
+		smbd_smb2_request_slab = talloc_slab(
+			NULL, sizeof(struct smbd_smb2_request),
+			SMBD_SMB2_REQUEST_SLAB_ENTRIES);
+	}
+	mem_pool = smbd_smb2_request_slab;
+	if (mem_pool == NULL) {
+		mem_pool = talloc_tos();
+	}
 #endif
 	if (mem_pool == NULL) {
 		return NULL;
@@ -304,7 +531,6 @@ static struct smbd_smb2_request *smbd_smb2_request_allocate(TALLOC_CTX *mem_ctx)
 
 	req = talloc_zero(mem_pool, struct smbd_smb2_request);
 	if (req == NULL) {
-		talloc_free(mem_pool);
 		return NULL;
 	}
 	talloc_reparent(mem_pool, mem_ctx, req);
@@ -316,10 +542,106 @@ static struct smbd_smb2_request *smbd_smb2_request_allocate(TALLOC_CTX *mem_ctx)
 	req->last_tid = UINT32_MAX;
 
 	talloc_set_destructor(req, smbd_smb2_request_destructor);
+	LIVE_STATS_ADD(requests_inflight, 1);
 
 	return req;
 }
 
+/*
+ * Responses smaller than this are not worth compressing.
+ */
+#define SMBD_SMB2_COMPRESSION_MIN_SIZE 4096
+
+/*
+ * Reverts an unchained SMB2_COMPRESSION_TRANSFORM
+ * header, the result is allocated on mem_ctx.
+ */
+static NTSTATUS smbd_smb2_decompress(struct smbXsrv_connection *xconn,
+				     TALLOC_CTX *mem_ctx,
+				     const uint8_t *buf,
+				     size_t buflen,
+				     uint8_t **_out,
+				     size_t *_outlen)
+{
+	uint32_t original_size;
+	uint16_t algorithm;
+	uint16_t flags;
+	uint32_t offset;
+	const uint8_t *comp = NULL;
+	size_t comp_len;
+	uint8_t *out = NULL;
+	size_t out_len;
+	ssize_t ret;
+
+	if (xconn->smb2.server.compression == SMB2_COMPRESSION_NONE) {
+		DEBUG(10, ("Got SMB2_COMPRESSION_TRANSFORM header, "
+			   "but compression was not negotiated\n"));
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	if (buflen < SMB2_COMP_TF_HDR_SIZE) {
+		DEBUG(1, ("%d bytes left, expected at least %d\n",
+			  (int)buflen, SMB2_COMP_TF_HDR_SIZE));
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	original_size = IVAL(buf, SMB2_COMP_TF_ORIGINAL_SIZE);
+	algorithm = SVAL(buf, SMB2_COMP_TF_ALGORITHM);
+	flags = SVAL(buf, SMB2_COMP_TF_FLAGS);
+	offset = IVAL(buf, SMB2_COMP_TF_OFFSET);
+
+	if (flags != SMB2_COMP_TF_FLAGS_NONE) {
+		DEBUG(1, ("chained compression (flags=0x%04x) "
+			  "not supported\n", flags));
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	if (algorithm != xconn->smb2.server.compression) {
+		DEBUG(1, ("compression algorithm 0x%04x "
+			  "not negotiated\n", algorithm));
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	comp = buf + SMB2_COMP_TF_HDR_SIZE;
+	comp_len = buflen - SMB2_COMP_TF_HDR_SIZE;
+
+	if (offset > comp_len) {
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	/*
+	 * The result needs to fit into a single
+	 * NBT frame (0xFFFFFF).
+	 */
+	out_len = (size_t)offset + original_size;
+	if (out_len > 0xFFFFFF || out_len < (SMB2_HDR_BODY + 2)) {
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	out = smbd_smb2_buffer_alloc(mem_ctx, out_len);
+	if (out == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	/* The first 'offset' bytes are not compressed */
+	memcpy(out, comp, offset);
+
+	ret = lzxpress_decompress(comp + offset,
+				  comp_len - offset,
+				  out + offset,
+				  original_size);
+	if (ret != original_size) {
+		DEBUG(1, ("lzxpress_decompress returned %d, expected %u\n",
+			  (int)ret, (unsigned)original_size));
+		TALLOC_FREE(out);
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	*_out = out;
+	*_outlen = out_len;
+	return NT_STATUS_OK;
+}
+
 static NTSTATUS smbd_smb2_inbuf_parse_compound(struct smbXsrv_connection *xconn,
 					       NTTIME now,
 					       uint8_t *buf,
@@ -336,6 +658,7 @@ static NTSTATUS smbd_smb2_inbuf_parse_compound(struct smbXsrv_connection *xconn,
 	size_t verified_buflen = 0;
 	uint8_t *tf = NULL;
 	size_t tf_len = 0;
+	bool decompressed = false;
 
 	/*
 	 * Note: index '0' is reserved for the transport protocol
@@ -428,9 +751,18 @@ static NTSTATUS smbd_smb2_inbuf_parse_compound(struct smbXsrv_connection *xconn,
 			tf_iov[1].iov_base = (void *)hdr;
 			tf_iov[1].iov_len = enc_len;
 
-			status = smb2_signing_decrypt_pdu(s->global->decryption_key,
-							  xconn->smb2.server.cipher,
-							  tf_iov, 2);
+			if (req->in_decrypted && (tf == buf)) {
+				/*
+				 * Already done by a worker thread, see
+				 * smbd_smb2_request_in_crypto_offload()
+				 */
+				status = NT_STATUS_OK;
+			} else {
+				status = smb2_signing_decrypt_pdu(
+					s->global->decryption_key,
+					xconn->smb2.server.cipher,
+					tf_iov, 2);
+			}
 			if (!NT_STATUS_IS_OK(status)) {
 				TALLOC_FREE(iov_alloc);
 				return status;
@@ -440,6 +772,45 @@ static NTSTATUS smbd_smb2_inbuf_parse_compound(struct smbXsrv_connection *xconn,
 			len = enc_len;
 		}
 
+		if ((len >= 4) && (IVAL(hdr, 0) == SMB2_COMP_TF_MAGIC)) {
+			uint8_t *dbuf = NULL;
+			size_t dlen = 0;
+			NTSTATUS status;
+
+			/*
+			 * A compressed message always covers
+			 * the whole (decrypted) PDU.
+			 */
+			if (decompressed || (taken + len != buflen)) {
+				DEBUG(1, ("SMB2_COMPRESSION_TRANSFORM header "
+					  "at unexpected position\n"));
+				goto inval;
+			}
+
+			status = smbd_smb2_decompress(xconn, mem_ctx,
+						      hdr, len,
+						      &dbuf, &dlen);
+			if (!NT_STATUS_IS_OK(status)) {
+				TALLOC_FREE(iov_alloc);
+				return status;
+			}
+			decompressed = true;
+
+			/*
+			 * Continue parsing the uncompressed
+			 * message, the transform header (if any)
+			 * still applies to all of it.
+			 */
+			first_hdr = dbuf;
+			buflen = dlen;
+			taken = 0;
+			hdr = dbuf;
+			len = dlen;
+			if (tf != NULL) {
+				verified_buflen = dlen;
+			}
+		}
+
 		/*
 		 * We need the header plus the body length field
 		 */
@@ -823,15 +1194,10 @@ static void smb2_set_operation_credit(struct smbXsrv_connection *xconn,
 	 * more later. I was only able to trigger higher
 	 * values, when using a very high credit charge.
 	 *
-	 * TODO: scale up depending on load, free memory
-	 *       or other stuff.
-	 *       Maybe also on the relationship between number
-	 *       of requests and the used sequence number.
-	 *       Which means we would grant more credits
-	 *       for client which use multi credit requests.
+	 * With "smb2 credits target latency" the window
+	 * is scaled up and down by smb2_credits_adapt().
 	 */
-	current_max_credits = xconn->smb2.credits.max / 16;
-	current_max_credits = MAX(current_max_credits, 1);
+	current_max_credits = xconn->smb2.credits.window;
 
 	if (xconn->smb2.credits.multicredit) {
 		credit_charge = SVAL(inhdr, SMB2_HDR_CREDIT_CHARGE);
@@ -914,7 +1280,15 @@ static void smb2_set_operation_credit(struct smbXsrv_connection *xconn,
 		credits_possible -= 1;
 	}
 	credits_possible = MIN(credits_possible, current_max_credits);
-	credits_possible -= xconn->smb2.credits.seq_range;
+	if (credits_possible > xconn->smb2.credits.seq_range) {
+		credits_possible -= xconn->smb2.credits.seq_range;
+	} else {
+		/*
+		 * The window shrank below what the
+		 * client already has.
+		 */
+		credits_possible = 0;
+	}
 
 	credits_granted = MIN(credits_granted, credits_possible);
 
@@ -937,6 +1311,107 @@ static void smb2_set_operation_credit(struct smbXsrv_connection *xconn,
 		(unsigned int)xconn->smb2.credits.seq_range);
 }
 
+/*
+ * Scale the credit window with the load: if IO requests take
+ * longer than "smb2 credits target latency" or the thread pool
+ * has more jobs queued than it has threads, granting more
+ * credits only makes the queues longer, so shrink the window.
+ * Otherwise grow it, if the client actually uses most of it.
+ */
+static void smb2_credits_adapt(struct smbd_smb2_request *req)
+{
+	struct smbXsrv_connection *xconn = req->xconn;
+	struct smbd_server_connection *sconn = req->sconn;
+	const uint8_t *inhdr = SMBD_SMB2_IN_HDR_PTR(req);
+	struct timeval now = timeval_current();
+	int target_msec = lp_smb2_credits_target_latency();
+	uint16_t max_window = xconn->smb2.credits.max;
+	uint16_t min_window;
+	uint16_t old_window = xconn->smb2.credits.window;
+	uint16_t window = old_window;
+	int64_t latency;
+	size_t max_threads;
+	size_t queued_jobs = 0;
+	bool pressure = false;
+
+	if (target_msec <= 0) {
+		return;
+	}
+
+	/*
+	 * Only requests that go to the filesystem, the time of
+	 * blocking locks or notifies says nothing about the backend.
+	 */
+	switch (SVAL(inhdr, SMB2_HDR_OPCODE)) {
+	case SMB2_OP_READ:
+	case SMB2_OP_WRITE:
+	case SMB2_OP_FLUSH:
+	case SMB2_OP_QUERY_DIRECTORY:
+	case SMB2_OP_GETINFO:
+	case SMB2_OP_SETINFO:
+		break;
+	default:
+		return;
+	}
+
+	latency = usec_time_diff(&now, &req->request_time);
+	latency = MAX(latency, 0);
+	if (xconn->smb2.credits.num_samples == 0) {
+		xconn->smb2.credits.latency_usec = latency;
+	} else {
+		xconn->smb2.credits.latency_usec =
+			(xconn->smb2.credits.latency_usec * 7 + latency) / 8;
+	}
+	xconn->smb2.credits.num_samples += 1;
+
+	if ((xconn->smb2.credits.num_samples % 16) != 0) {
+		return;
+	}
+
+	max_threads = pthreadpool_tevent_max_threads(sconn->pool);
+	if (max_threads > 0) {
+		queued_jobs = pthreadpool_tevent_queued_jobs(sconn->pool);
+		if (queued_jobs > max_threads) {
+			pressure = true;
+		}
+	}
+	if (xconn->smb2.credits.latency_usec > (uint64_t)target_msec * 1000) {
+		pressure = true;
+	}
+
+	min_window = MIN(32, max_window / 16);
+	min_window = MAX(min_window, 1);
+
+	if (pressure) {
+		window -= window / 4;
+		window = MAX(window, min_window);
+	} else if (xconn->smb2.credits.seq_range >= window / 4 * 3) {
+		window += MAX(window / 8, 32);
+		window = MIN(window, max_window);
+	}
+
+	if (window == old_window) {
+		return;
+	}
+
+	if (window > old_window) {
+		DO_PROFILE_INC(smb2_credits_grow);
+	} else {
+		DO_PROFILE_INC(smb2_credits_shrink);
+	}
+
+	DBGC_DEBUG(DBGC_SMB2_CREDITS,
+		   "window %u -> %u, latency %llu usec, queued jobs %zu, "
+		   "range %u\n",
+		   (unsigned int)old_window,
+		   (unsigned int)window,
+		   (unsigned long long)xconn->smb2.credits.latency_usec,
+		   queued_jobs,
+		   (unsigned int)xconn->smb2.credits.seq_range);
+
+	xconn->smb2.credits.window = window;
+}
+
 static void smb2_calculate_credits(const struct smbd_smb2_request *inreq,
 				struct smbd_smb2_request *outreq)
 {
@@ -1096,6 +1571,7 @@ void smbd_server_connection_terminate_ex(struct smbXsrv_connection *xconn,
 	if (client->connections->next != NULL) {
 		/* TODO: cancel pending requests */
 		DLIST_REMOVE(client->connections, xconn);
+		LIVE_STATS_SUB(connections, 1);
 		TALLOC_FREE(xconn);
 		DO_PROFILE_INC(disconnect);
 		return;
@@ -1336,6 +1812,7 @@ static NTSTATUS smb2_send_async_interim_response(const struct smbd_smb2_request
 	nreq->queue_entry.count = nreq->out.vector_count;
 	DLIST_ADD_END(xconn->smb2.send_queue, &nreq->queue_entry);
 	xconn->smb2.send_queue_len++;
+	LIVE_STATS_ADD(send_queue_len, 1);
 
 	status = smbd_smb2_flush_send_queue(xconn);
 	if (!NT_STATUS_IS_OK(status)) {
@@ -1740,6 +2217,7 @@ static void smbd_smb2_request_pending_timer(struct tevent_context *ev,
 	state->queue_entry.count = ARRAY_SIZE(state->vector);
 	DLIST_ADD_END(xconn->smb2.send_queue, &state->queue_entry);
 	xconn->smb2.send_queue_len++;
+	LIVE_STATS_ADD(send_queue_len, 1);
 
 	status = smbd_smb2_flush_send_queue(xconn);
 	if (!NT_STATUS_IS_OK(status)) {
@@ -1816,6 +2294,69 @@ static NTSTATUS smbd_smb2_request_process_cancel(struct smbd_smb2_request *req)
 	return NT_STATUS_OK;
 }
 
+static bool smbd_smb2_opcode_changes_context(uint16_t opcode)
+{
+	switch (opcode) {
+	case SMB2_OP_NEGPROT:
+	case SMB2_OP_SESSSETUP:
+	case SMB2_OP_LOGOFF:
+	case SMB2_OP_TCON:
+	case SMB2_OP_TDIS:
+		return true;
+	default:
+		break;
+	}
+
+	return false;
+}
+
+/*************************************************************
+ A related compound element operates on the session and tcon
+ of the previous element. If the previous element didn't
+ change them, the lookups done for it are still valid and
+ don't need to be repeated for every element of typical
+ CREATE/GETINFO/CLOSE chains.
+*************************************************************/
+
+static bool smbd_smb2_request_compound_reuse(struct smbd_smb2_request *req)
+{
+	const uint8_t *inhdr = SMBD_SMB2_IN_HDR_PTR(req);
+	const struct iovec *prevhdr_v = NULL;
+	const uint8_t *prevhdr = NULL;
+	uint32_t in_flags;
+	uint16_t in_opcode;
+	uint16_t prev_opcode;
+
+	in_flags = IVAL(inhdr, SMB2_HDR_FLAGS);
+	in_opcode = SVAL(inhdr, SMB2_HDR_OPCODE);
+
+	if (!(in_flags & SMB2_HDR_FLAG_CHAINED)) {
+		return false;
+	}
+
+	/*
+	 * After an interim response the previous
+	 * elements are gone.
+	 */
+	if (req->current_idx <= 1) {
+		return false;
+	}
+
+	prevhdr_v = SMBD_SMB2_IDX_HDR_IOV(req, in,
+			req->current_idx - SMBD_SMB2_NUM_IOV_PER_REQ);
+	prevhdr = (const uint8_t *)prevhdr_v->iov_base;
+	prev_opcode = SVAL(prevhdr, SMB2_HDR_OPCODE);
+
+	if (smbd_smb2_opcode_changes_context(in_opcode)) {
+		return false;
+	}
+	if (smbd_smb2_opcode_changes_context(prev_opcode)) {
+		return false;
+	}
+
+	return true;
+}
+
 /*************************************************************
  Ensure an incoming tid is a valid one for us to access.
  Change to the associated uid credentials and chdir to the
@@ -1831,8 +2372,6 @@ static NTSTATUS smbd_smb2_request_check_tcon(struct smbd_smb2_request *req)
 	NTSTATUS status;
 	NTTIME now = timeval_to_nttime(&req->request_time);
 
-	req->tcon = NULL;
-
 	inhdr = SMBD_SMB2_IN_HDR_PTR(req);
 
 	in_flags = IVAL(inhdr, SMB2_HDR_FLAGS);
@@ -1842,12 +2381,26 @@ static NTSTATUS smbd_smb2_request_check_tcon(struct smbd_smb2_request *req)
 		in_tid = req->last_tid;
 	}
 
-	req->last_tid = 0;
+	/*
+	 * req->tcon is only still set here if
+	 * smbd_smb2_request_check_session() reused
+	 * the session of the previous compound element.
+	 */
+	tcon = req->tcon;
+	if (tcon != NULL &&
+	    tcon->global->tcon_wire_id == in_tid &&
+	    NT_STATUS_IS_OK(tcon->status))
+	{
+		tcon->idle_time = now;
+	} else {
+		req->tcon = NULL;
+		req->last_tid = 0;
 
-	status = smb2srv_tcon_lookup(req->session,
-				     in_tid, now, &tcon);
-	if (!NT_STATUS_IS_OK(status)) {
-		return status;
+		status = smb2srv_tcon_lookup(req->session,
+					     in_tid, now, &tcon);
+		if (!NT_STATUS_IS_OK(status)) {
+			return status;
+		}
 	}
 
 	if (!change_to_user(tcon->compat, req->session->compat->vuid)) {
@@ -1875,9 +2428,6 @@ static NTSTATUS smbd_smb2_request_check_session(struct smbd_smb2_request *req)
 	NTSTATUS status;
 	NTTIME now = timeval_to_nttime(&req->request_time);
 
-	req->session = NULL;
-	req->tcon = NULL;
-
 	inhdr = SMBD_SMB2_IN_HDR_PTR(req);
 
 	in_flags = IVAL(inhdr, SMB2_HDR_FLAGS);
@@ -1888,7 +2438,27 @@ static NTSTATUS smbd_smb2_request_check_session(struct smbd_smb2_request *req)
 		in_session_id = req->last_session_id;
 	}
 
+	session = req->session;
+	if (session != NULL &&
+	    session->global->session_wire_id == in_session_id &&
+	    NT_STATUS_IS_OK(session->status) &&
+	    now <= session->global->expiration_time &&
+	    session->global->auth_session_info != NULL &&
+	    smbd_smb2_request_compound_reuse(req))
+	{
+		/*
+		 * This is what smb2srv_session_lookup_conn()
+		 * would return, keep req->tcon for
+		 * smbd_smb2_request_check_tcon().
+		 */
+		session->idle_time = now;
+		return NT_STATUS_OK;
+	}
+
+	req->session = NULL;
+	req->tcon = NULL;
 	req->last_session_id = 0;
+	session = NULL;
 
 	/* look an existing session up */
 	switch (in_opcode) {
@@ -2290,6 +2860,16 @@ static NTSTATUS smbd_smb2_request_dispatch_update_counts(
 	return status;
 }
 
+static bool smbd_smb2_request_in_crypto_offload_wanted(
+	const struct iovec *vector,
+	int count);
+static NTSTATUS smbd_smb2_request_in_crypto_offload(
+	struct smbd_smb2_request *req,
+	DATA_BLOB key,
+	bool decrypt,
+	const struct iovec *vector,
+	int count);
+
 NTSTATUS smbd_smb2_request_dispatch(struct smbd_smb2_request *req)
 {
 	struct smbXsrv_connection *xconn = req->xconn;
@@ -2307,10 +2887,25 @@ NTSTATUS smbd_smb2_request_dispatch(struct smbd_smb2_request *req)
 	bool signing_required = false;
 	bool encryption_desired = false;
 	bool encryption_required = false;
+	bool signature_checked = req->in_signature_checked;
+
+	/*
+	 * Only valid for this call, not for the
+	 * next request of a compound chain.
+	 */
+	req->in_signature_checked = false;
 
 	inhdr = SMBD_SMB2_IN_HDR_PTR(req);
 
-	DO_PROFILE_INC(request);
+	if (!signature_checked) {
+		/*
+		 * Not counted again once the signature
+		 * was checked by a worker thread.
+		 */
+		DO_PROFILE_INC(request);
+		LIVE_STATS_ADD(requests_total, 1);
+		smbd_smb2_live_stats_memory(req->xconn->client);
+	}
 
 	SMB_ASSERT(!req->request_counters_updated);
 
@@ -2322,6 +2917,7 @@ NTSTATUS smbd_smb2_request_dispatch(struct smbd_smb2_request *req)
 	DEBUG(10,("smbd_smb2_request_dispatch: opcode[%s] mid = %llu\n",
 		smb2_opcode_name(opcode),
 		(unsigned long long)mid));
+	SAMBA_USDT2(smb2_request, opcode, mid);
 
 	if (xconn->protocol >= PROTOCOL_SMB2_02) {
 		/*
@@ -2469,10 +3065,31 @@ NTSTATUS smbd_smb2_request_dispatch(struct smbd_smb2_request *req)
 			req->do_signing = true;
 		}
 
-		status = smb2_signing_check_pdu(signing_key,
-						xconn->protocol,
-						SMBD_SMB2_IN_HDR_IOV(req),
-						SMBD_SMB2_NUM_IOV_PER_REQ - 1);
+		if (signature_checked) {
+			status = NT_STATUS_OK;
+		} else if ((flags & SMB2_HDR_FLAG_SIGNED) &&
+			   (signing_key.length > 0) &&
+			   smbd_smb2_request_in_crypto_offload_wanted(
+				SMBD_SMB2_IN_HDR_IOV(req),
+				SMBD_SMB2_NUM_IOV_PER_REQ - 1))
+		{
+			/*
+			 * smbd_smb2_request_in_crypto_done()
+			 * calls us again.
+			 */
+			return smbd_smb2_request_in_crypto_offload(
+				req,
+				signing_key,
+				false,
+				SMBD_SMB2_IN_HDR_IOV(req),
+				SMBD_SMB2_NUM_IOV_PER_REQ - 1);
+		} else {
+			status = smb2_signing_check_pdu(
+				signing_key,
+				xconn->protocol,
+				SMBD_SMB2_IN_HDR_IOV(req),
+				SMBD_SMB2_NUM_IOV_PER_REQ - 1);
+		}
 		if (!NT_STATUS_IS_OK(status)) {
 			return smbd_smb2_request_error(req, status);
 		}
@@ -2624,6 +3241,13 @@ NTSTATUS smbd_smb2_request_dispatch(struct smbd_smb2_request *req)
 		SMB_ASSERT(call->need_tcon);
 	}
 
+	if (call->need_tcon) {
+		SMBPROFILE_IOBYTES_ASYNC_SET_SHARE(req->profile,
+			lp_const_servicename(SNUM(req->tcon->compat)));
+	} else {
+		SMBPROFILE_IOBYTES_ASYNC_SET_SHARE(req->profile, NULL);
+	}
+
 #define _INBYTES(_r) \
 	iov_buflen(SMBD_SMB2_IN_HDR_IOV(_r), SMBD_SMB2_NUM_IOV_PER_REQ-1)
 
@@ -2803,6 +3427,504 @@ static void smbd_smb2_request_reply_update_counts(struct smbd_smb2_request *req)
 	}
 }
 
+/*
+ * Replace the queued vector of a (signed) response by
+ * an unchained SMB2_COMPRESSION_TRANSFORM message, if that
+ * is smaller than the original.
+ *
+ * Encrypted responses are not compressed, as the
+ * compression would need to happen before the encryption.
+ */
+static NTSTATUS smbd_smb2_request_compress(struct smbd_smb2_request *req)
+{
+	struct smbXsrv_connection *xconn = req->xconn;
+	struct smbd_smb2_send_queue *e = &req->queue_entry;
+	struct iovec *vector = NULL;
+	uint8_t *plain = NULL;
+	uint8_t *comp = NULL;
+	size_t plain_len;
+	size_t max_comp_len;
+	ssize_t ret;
+	bool ok;
+
+	if (e->count != 1 + SMBD_SMB2_NUM_IOV_PER_REQ) {
+		/* compound or sendfile response */
+		return NT_STATUS_OK;
+	}
+
+	plain_len = iov_buflen(&e->vector[1], e->count - 1);
+	if (plain_len < SMBD_SMB2_COMPRESSION_MIN_SIZE) {
+		return NT_STATUS_OK;
+	}
+
+	plain = iov_concat(req, &e->vector[1], e->count - 1);
+	if (plain == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	/*
+	 * Worst case lzxpress_compress() emits every byte as
+	 * literal plus one 32-bit indicator word per 32 bytes.
+	 */
+	max_comp_len = plain_len + (plain_len / 32 + 2) * sizeof(uint32_t);
+
+	comp = talloc_array(req, uint8_t,
+			    SMB2_COMP_TF_HDR_SIZE + max_comp_len);
+	if (comp == NULL) {
+		TALLOC_FREE(plain);
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	ret = lzxpress_compress(plain, plain_len,
+				comp + SMB2_COMP_TF_HDR_SIZE,
+				max_comp_len);
+	TALLOC_FREE(plain);
+	if (ret < 0 || (SMB2_COMP_TF_HDR_SIZE + ret) >= plain_len) {
+		/* not worth it, send it uncompressed */
+		TALLOC_FREE(comp);
+		return NT_STATUS_OK;
+	}
+
+	SIVAL(comp, SMB2_COMP_TF_PROTOCOL_ID, SMB2_COMP_TF_MAGIC);
+	SIVAL(comp, SMB2_COMP_TF_ORIGINAL_SIZE, plain_len);
+	SSVAL(comp, SMB2_COMP_TF_ALGORITHM, xconn->smb2.server.compression);
+	SSVAL(comp, SMB2_COMP_TF_FLAGS, SMB2_COMP_TF_FLAGS_NONE);
+	SIVAL(comp, SMB2_COMP_TF_OFFSET, 0);
+
+	vector = talloc_array(req, struct iovec, 2);
+	if (vector == NULL) {
+		TALLOC_FREE(comp);
+		return NT_STATUS_NO_MEMORY;
+	}
+	vector[0] = e->vector[0];
+	vector[1].iov_base = (void *)comp;
+	vector[1].iov_len = SMB2_COMP_TF_HDR_SIZE + ret;
+
+	ok = smb2_setup_nbt_length(vector, 2);
+	if (!ok) {
+		return NT_STATUS_INVALID_PARAMETER_MIX;
+	}
+
+	e->vector = vector;
+	e->count = 2;
+
+	return NT_STATUS_OK;
+}
+
+static bool smbd_smb2_request_crypto_offload_wanted(
+	struct smbd_smb2_request *req,
+	const struct iovec *vector,
+	int count,
+	bool encrypt)
+{
+	struct smbXsrv_connection *xconn = req->xconn;
+	size_t offload_size = lp_smb2_crypto_offload_size();
+	ssize_t len;
+
+	if (offload_size == 0) {
+		return false;
+	}
+
+	/*
+	 * smb2_signing_{sign,encrypt}_pdu() log at level 5,
+	 * but our debug code is not thread safe.
+	 */
+	if (CHECK_DEBUGLVL(5)) {
+		return false;
+	}
+
+	if (req->preauth != NULL) {
+		return false;
+	}
+
+	if (!encrypt &&
+	    xconn->smb2.server.compression != SMB2_COMPRESSION_NONE)
+	{
+		/*
+		 * smbd_smb2_request_compress() needs
+		 * the signed response.
+		 */
+		return false;
+	}
+
+	len = iov_buflen(vector, count);
+	if (len == -1) {
+		return false;
+	}
+
+	return (size_t)len >= offload_size;
+}
+
+static void smbd_smb2_request_crypto_do(void *private_data);
+static void smbd_smb2_request_crypto_done(struct tevent_req *subreq);
+
+static NTSTATUS smbd_smb2_request_crypto_offload(struct smbd_smb2_request *req,
+						 DATA_BLOB key,
+						 struct iovec *vector,
+						 int count,
+						 bool encrypt)
+{
+	struct smbXsrv_connection *xconn = req->xconn;
+	struct smbd_smb2_request_crypto_state *state = NULL;
+	struct tevent_req *subreq = NULL;
+
+	state = talloc_zero(req, struct smbd_smb2_request_crypto_state);
+	if (state == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+	state->req = req;
+	state->encrypt = encrypt;
+	state->cipher = xconn->smb2.server.cipher;
+	state->protocol = xconn->protocol;
+	state->vector = vector;
+	state->count = count;
+	state->status = NT_STATUS_INTERNAL_ERROR;
+
+	/*
+	 * The session might go away while the
+	 * job is running, so keep our own copy
+	 * of the key.
+	 */
+	state->key = data_blob_dup_talloc(state, key);
+	if (state->key.data == NULL) {
+		TALLOC_FREE(state);
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	subreq = pthreadpool_tevent_job_send(state,
+					     xconn->client->raw_ev_ctx,
+					     req->sconn->pool,
+					     smbd_smb2_request_crypto_do,
+					     state);
+	if (subreq == NULL) {
+		data_blob_clear_free(&state->key);
+		TALLOC_FREE(state);
+		return NT_STATUS_NO_MEMORY;
+	}
+	tevent_req_set_callback(subreq, smbd_smb2_request_crypto_done, state);
+
+	req->crypto_state = state;
+	req->queue_entry.pending = true;
+
+	return NT_STATUS_OK;
+}
+
+static void smbd_smb2_request_crypto_do(void *private_data)
+{
+	struct smbd_smb2_request_crypto_state *state =
+		talloc_get_type_abort(private_data,
+		struct smbd_smb2_request_crypto_state);
+
+	if (state->incoming && state->encrypt) {
+		state->status = smb2_signing_decrypt_pdu(state->key,
+							 state->cipher,
+							 state->vector,
+							 state->count);
+		return;
+	}
+
+	if (state->incoming) {
+		/*
+		 * smb2_signing_check_pdu() logs failures at level 0,
+		 * so we calculate the signature into our copy of the
+		 * header and compare it on the main thread.
+		 */
+		state->status = smb2_signing_sign_pdu(state->key,
+						      state->protocol,
+						      state->vector,
+						      state->count);
+		return;
+	}
+
+	if (state->encrypt) {
+		state->status = smb2_signing_encrypt_pdu(state->key,
+							 state->cipher,
+							 state->vector,
+							 state->count);
+		return;
+	}
+
+	state->status = smb2_signing_sign_pdu(state->key,
+					      state->protocol,
+					      state->vector,
+					      state->count);
+}
+
+static void smbd_smb2_request_crypto_done(struct tevent_req *subreq)
+{
+	struct smbd_smb2_request_crypto_state *state =
+		tevent_req_callback_data(subreq,
+		struct smbd_smb2_request_crypto_state);
+	struct smbd_smb2_request *req = state->req;
+	struct smbXsrv_connection *xconn = req->xconn;
+	NTSTATUS status;
+	int ret;
+
+	ret = pthreadpool_tevent_job_recv(subreq);
+	TALLOC_FREE(subreq);
+	if (ret == EAGAIN) {
+		/*
+		 * The pool failed to create a new thread,
+		 * do the work synchronously to make progress.
+		 */
+		smbd_smb2_request_crypto_do(state);
+	} else if (ret != 0) {
+		state->status = map_nt_error_from_unix_common(ret);
+	}
+
+	req->crypto_state = NULL;
+	if (state->orphaned) {
+		/*
+		 * The connection is gone,
+		 * see smbd_smb2_request_destructor().
+		 */
+		TALLOC_FREE(req);
+		return;
+	}
+
+	status = state->status;
+	data_blob_clear_free(&state->key);
+	TALLOC_FREE(state);
+
+	req->queue_entry.pending = false;
+
+	if (!NT_STATUS_IS_OK(status)) {
+		smbd_server_connection_terminate(xconn, nt_errstr(status));
+		return;
+	}
+
+	status = smbd_smb2_flush_send_queue(xconn);
+	if (!NT_STATUS_IS_OK(status)) {
+		smbd_server_connection_terminate(xconn, nt_errstr(status));
+		return;
+	}
+}
+
+/*
+ * Checking the signature of a large request, or decrypting it,
+ * is offloaded in the same way. The request is processed once
+ * the job is done, the connection goes on reading the next
+ * requests in the meantime.
+ */
+static bool smbd_smb2_request_in_crypto_offload_wanted(
+	const struct iovec *vector,
+	int count)
+{
+	size_t offload_size = lp_smb2_crypto_offload_size();
+	ssize_t len;
+
+	if (offload_size == 0) {
+		return false;
+	}
+
+	if (CHECK_DEBUGLVL(5)) {
+		return false;
+	}
+
+	len = iov_buflen(vector, count);
+	if (len == -1) {
+		return false;
+	}
+
+	return (size_t)len >= offload_size;
+}
+
+static bool smbd_smb2_request_in_decrypt_offload_wanted(
+	struct smbXsrv_connection *xconn,
+	uint8_t *buf,
+	size_t buflen,
+	NTTIME now,
+	DATA_BLOB *decryption_key)
+{
+	struct smbXsrv_session *s = NULL;
+	struct iovec v = {
+		.iov_base = buf,
+		.iov_len = buflen,
+	};
+	size_t enc_len;
+	uint64_t uid;
+
+	if (!smbd_smb2_request_in_crypto_offload_wanted(&v, 1)) {
+		return false;
+	}
+
+	/*
+	 * Only a single transform covering the whole PDU, all other
+	 * cases are left to smbd_smb2_inbuf_parse_compound().
+	 */
+	if (buflen < SMB2_TF_HDR_SIZE) {
+		return false;
+	}
+	if (IVAL(buf, 0) != SMB2_TF_MAGIC) {
+		return false;
+	}
+	if (xconn->protocol < PROTOCOL_SMB2_24) {
+		return false;
+	}
+	if (xconn->smb2.server.cipher == 0) {
+		return false;
+	}
+
+	enc_len = IVAL(buf, SMB2_TF_MSG_SIZE);
+	if (buflen != SMB2_TF_HDR_SIZE + enc_len) {
+		return false;
+	}
+
+	uid = BVAL(buf, SMB2_TF_SESSION_ID);
+	(void)smb2srv_session_lookup_conn(xconn, uid, now, &s);
+	if (s == NULL) {
+		return false;
+	}
+	if (s->global->decryption_key.length == 0) {
+		return false;
+	}
+
+	*decryption_key = s->global->decryption_key;
+	return true;
+}
+
+static void smbd_smb2_request_in_crypto_done(struct tevent_req *subreq);
+
+static NTSTATUS smbd_smb2_request_in_crypto_offload(
+	struct smbd_smb2_request *req,
+	DATA_BLOB key,
+	bool decrypt,
+	const struct iovec *vector,
+	int count)
+{
+	struct smbXsrv_connection *xconn = req->xconn;
+	struct smbd_smb2_request_crypto_state *state = NULL;
+	struct tevent_req *subreq = NULL;
+	int i;
+
+	SMB_ASSERT(count <= ARRAY_SIZE(state->in_vector));
+
+	state = talloc_zero(req, struct smbd_smb2_request_crypto_state);
+	if (state == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+	state->req = req;
+	state->incoming = true;
+	state->encrypt = decrypt;
+	state->cipher = xconn->smb2.server.cipher;
+	state->protocol = xconn->protocol;
+	state->status = NT_STATUS_INTERNAL_ERROR;
+
+	for (i = 0; i < count; i++) {
+		state->in_vector[i] = vector[i];
+	}
+	if (!decrypt) {
+		/*
+		 * The signature is calculated into a
+		 * copy of the header.
+		 */
+		SMB_ASSERT(vector[0].iov_len == sizeof(state->in_hdr));
+		memcpy(state->in_hdr, vector[0].iov_base,
+		       sizeof(state->in_hdr));
+		state->in_vector[0].iov_base = state->in_hdr;
+	}
+	state->vector = state->in_vector;
+	state->count = count;
+
+	state->key = data_blob_dup_talloc(state, key);
+	if (state->key.data == NULL) {
+		TALLOC_FREE(state);
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	subreq = pthreadpool_tevent_job_send(state,
+					     xconn->client->raw_ev_ctx,
+					     req->sconn->pool,
+					     smbd_smb2_request_crypto_do,
+					     state);
+	if (subreq == NULL) {
+		data_blob_clear_free(&state->key);
+		TALLOC_FREE(state);
+		return NT_STATUS_NO_MEMORY;
+	}
+	tevent_req_set_callback(subreq,
+				smbd_smb2_request_in_crypto_done,
+				state);
+
+	req->crypto_state = state;
+
+	return NT_STATUS_OK;
+}
+
+static NTSTATUS smbd_smb2_request_process_inbuf(
+	struct smbXsrv_connection *xconn,
+	struct smbd_smb2_request *req,
+	uint8_t *buf,
+	size_t buflen,
+	NTTIME now);
+
+static void smbd_smb2_request_in_crypto_done(struct tevent_req *subreq)
+{
+	struct smbd_smb2_request_crypto_state *state =
+		tevent_req_callback_data(subreq,
+		struct smbd_smb2_request_crypto_state);
+	struct smbd_smb2_request *req = state->req;
+	struct smbXsrv_connection *xconn = req->xconn;
+	bool decrypt = state->encrypt;
+	uint8_t *inbuf = state->inbuf;
+	size_t inbuf_len = state->inbuf_len;
+	NTTIME now = state->now;
+	NTSTATUS status;
+	int ret;
+
+	ret = pthreadpool_tevent_job_recv(subreq);
+	TALLOC_FREE(subreq);
+	if (ret == EAGAIN) {
+		smbd_smb2_request_crypto_do(state);
+	} else if (ret != 0) {
+		state->status = map_nt_error_from_unix_common(ret);
+	}
+
+	req->crypto_state = NULL;
+	if (state->orphaned) {
+		TALLOC_FREE(req);
+		return;
+	}
+
+	status = state->status;
+
+	if (NT_STATUS_IS_OK(status) && !decrypt) {
+		const uint8_t *inhdr = SMBD_SMB2_IN_HDR_PTR(req);
+		const uint8_t *sig = inhdr + SMB2_HDR_SIGNATURE;
+		const uint8_t *res = state->in_hdr + SMB2_HDR_SIGNATURE;
+
+		if (memcmp_const_time(res, sig, 16) != 0) {
+			DEBUG(0,("Bad SMB2 signature for message\n"));
+			dump_data(0, sig, 16);
+			dump_data(0, res, 16);
+			status = NT_STATUS_ACCESS_DENIED;
+		}
+	}
+
+	data_blob_clear_free(&state->key);
+	TALLOC_FREE(state);
+
+	if (decrypt) {
+		if (NT_STATUS_IS_OK(status)) {
+			req->in_decrypted = true;
+			status = smbd_smb2_request_process_inbuf(xconn,
+								 req,
+								 inbuf,
+								 inbuf_len,
+								 now);
+		}
+	} else if (NT_STATUS_IS_OK(status)) {
+		req->in_signature_checked = true;
+		status = smbd_smb2_request_dispatch(req);
+	} else {
+		status = smbd_smb2_request_error(req, status);
+	}
+	if (!NT_STATUS_IS_OK(status)) {
+		smbd_server_connection_terminate(xconn, nt_errstr(status));
+		return;
+	}
+}
+
 static NTSTATUS smbd_smb2_request_reply(struct smbd_smb2_request *req)
 {
 	struct smbXsrv_connection *xconn = req->xconn;
@@ -2896,6 +4018,13 @@ static NTSTATUS smbd_smb2_request_reply(struct smbd_smb2_request *req)
 	SMBPROFILE_IOBYTES_ASYNC_END(req->profile,
 		iov_buflen(outhdr, SMBD_SMB2_NUM_IOV_PER_REQ-1));
 
+	SAMBA_USDT3(smb2_reply,
+		    SVAL(SMBD_SMB2_OUT_HDR_PTR(req), SMB2_HDR_OPCODE),
+		    BVAL(SMBD_SMB2_OUT_HDR_PTR(req), SMB2_HDR_MESSAGE_ID),
+		    IVAL(SMBD_SMB2_OUT_HDR_PTR(req), SMB2_HDR_STATUS));
+
+	smb2_credits_adapt(req);
+
 	req->current_idx += SMBD_SMB2_NUM_IOV_PER_REQ;
 
 	if (req->current_idx < req->out.vector_count) {
@@ -2907,9 +4036,11 @@ static NTSTATUS smbd_smb2_request_reply(struct smbd_smb2_request *req)
 		 * compound request we haven't processed
 		 * yet.
 		 */
-		struct tevent_immediate *im = tevent_create_immediate(req);
-		if (!im) {
-			return NT_STATUS_NO_MEMORY;
+		if (req->compound_im == NULL) {
+			req->compound_im = tevent_create_immediate(req);
+			if (req->compound_im == NULL) {
+				return NT_STATUS_NO_MEMORY;
+			}
 		}
 
 		if (req->do_signing && firsttf->iov_len == 0) {
@@ -2933,7 +4064,7 @@ static NTSTATUS smbd_smb2_request_reply(struct smbd_smb2_request *req)
 		 * So we use req->xconn->client->raw_ev_ctx instead
 		 * of req->ev_ctx here.
 		 */
-		tevent_schedule_immediate(im,
+		tevent_schedule_immediate(req->compound_im,
 					req->xconn->client->raw_ev_ctx,
 					smbd_smb2_request_dispatch_immediate,
 					req);
@@ -2957,10 +4088,32 @@ static NTSTATUS smbd_smb2_request_reply(struct smbd_smb2_request *req)
 	 * now check if we need to sign the current response
 	 */
 	if (firsttf->iov_len == SMB2_TF_HDR_SIZE) {
-		status = smb2_signing_encrypt_pdu(req->first_key,
+		int count = req->out.vector_count - first_idx;
+
+		if (smbd_smb2_request_crypto_offload_wanted(req, firsttf,
+							    count, true)) {
+			status = smbd_smb2_request_crypto_offload(
+					req, req->first_key,
+					firsttf, count, true);
+		} else {
+			status = smb2_signing_encrypt_pdu(req->first_key,
 					xconn->smb2.server.cipher,
-					firsttf,
-					req->out.vector_count - first_idx);
+					firsttf, count);
+		}
+		if (!NT_STATUS_IS_OK(status)) {
+			return status;
+		}
+	} else if (req->do_signing &&
+		   smbd_smb2_request_crypto_offload_wanted(req, outhdr,
+						SMBD_SMB2_NUM_IOV_PER_REQ - 1,
+						false)) {
+		struct smbXsrv_session *x = req->session;
+		DATA_BLOB signing_key = smbd_smb2_signing_key(x, xconn);
+
+		status = smbd_smb2_request_crypto_offload(req, signing_key,
+						outhdr,
+						SMBD_SMB2_NUM_IOV_PER_REQ - 1,
+						false);
 		if (!NT_STATUS_IS_OK(status)) {
 			return status;
 		}
@@ -3024,8 +4177,19 @@ static NTSTATUS smbd_smb2_request_reply(struct smbd_smb2_request *req)
 	req->queue_entry.mem_ctx = req;
 	req->queue_entry.vector = req->out.vector;
 	req->queue_entry.count = req->out.vector_count;
+
+	if (xconn->smb2.server.compression != SMB2_COMPRESSION_NONE &&
+	    firsttf->iov_len == 0)
+	{
+		status = smbd_smb2_request_compress(req);
+		if (!NT_STATUS_IS_OK(status)) {
+			return status;
+		}
+	}
+
 	DLIST_ADD_END(xconn->smb2.send_queue, &req->queue_entry);
 	xconn->smb2.send_queue_len++;
+	LIVE_STATS_ADD(send_queue_len, 1);
 
 	status = smbd_smb2_flush_send_queue(xconn);
 	if (!NT_STATUS_IS_OK(status)) {
@@ -3046,7 +4210,9 @@ void smbd_smb2_request_dispatch_immediate(struct tevent_context *ctx,
 	struct smbXsrv_connection *xconn = req->xconn;
 	NTSTATUS status;
 
-	TALLOC_FREE(im);
+	if (im != req->compound_im) {
+		TALLOC_FREE(im);
+	}
 
 	if (DEBUGLEVEL >= 10) {
 		DEBUG(10,("smbd_smb2_request_dispatch_immediate: idx[%d] of %d vectors\n",
@@ -3368,6 +4534,7 @@ static NTSTATUS smbd_smb2_send_break(struct smbXsrv_connection *xconn,
 	state->queue_entry.count = ARRAY_SIZE(state->vector);
 	DLIST_ADD_END(xconn->smb2.send_queue, &state->queue_entry);
 	xconn->smb2.send_queue_len++;
+	LIVE_STATS_ADD(send_queue_len, 1);
 
 	status = smbd_smb2_flush_send_queue(xconn);
 	if (!NT_STATUS_IS_OK(status)) {
@@ -3672,7 +4839,20 @@ static NTSTATUS smbd_smb2_flush_send_queue(struct smbXsrv_connection *xconn)
 
 	while (xconn->smb2.send_queue != NULL) {
 		struct smbd_smb2_send_queue *e = xconn->smb2.send_queue;
-		bool ok;
+		struct iovec iov[SMBD_SMB2_SEND_QUEUE_MAX_IOV];
+		struct iovec *vector = iov;
+		int count = 0;
+		size_t left;
+
+		if (e->pending) {
+			/*
+			 * The response isn't signed/encrypted yet,
+			 * smbd_smb2_request_crypto_done() will
+			 * call us again.
+			 */
+			TEVENT_FD_NOT_WRITEABLE(xconn->transport.fde);
+			return NT_STATUS_OK;
+		}
 
 		if (e->sendfile_header != NULL) {
 			size_t size = 0;
@@ -3708,6 +4888,7 @@ static NTSTATUS smbd_smb2_flush_send_queue(struct smbXsrv_connection *xconn)
 			e->count = 0;
 
 			xconn->smb2.send_queue_len--;
+			LIVE_STATS_SUB(send_queue_len, 1);
 			DLIST_REMOVE(xconn->smb2.send_queue, e);
 			/*
 			 * This triggers the sendfile path via
@@ -3721,7 +4902,35 @@ static NTSTATUS smbd_smb2_flush_send_queue(struct smbXsrv_connection *xconn)
 			continue;
 		}
 
-		ret = writev(xconn->transport.sock, e->vector, e->count);
+		/*
+		 * Gather the pending vectors of as many queued
+		 * responses as fit into a single writev(), so that
+		 * a burst of small responses (or a large read
+		 * response queued behind them) doesn't cost one
+		 * syscall per response. We stop at the first
+		 * sendfile entry, it needs to go out on its own.
+		 */
+		for (; e != NULL; e = e->next) {
+			if (e->pending) {
+				break;
+			}
+			if (e->sendfile_header != NULL) {
+				break;
+			}
+			if (count + e->count > ARRAY_SIZE(iov)) {
+				break;
+			}
+			memcpy(&iov[count], e->vector,
+			       sizeof(struct iovec) * e->count);
+			count += e->count;
+		}
+		if (count == 0) {
+			e = xconn->smb2.send_queue;
+			vector = e->vector;
+			count = e->count;
+		}
+
+		ret = writev(xconn->transport.sock, vector, count);
 		if (ret == 0) {
 			/* propagate end of file */
 			return NT_STATUS_INTERNAL_ERROR;
@@ -3735,21 +4944,57 @@ static NTSTATUS smbd_smb2_flush_send_queue(struct smbXsrv_connection *xconn)
 		if (err != 0) {
 			return map_nt_error_from_unix_common(err);
 		}
+		LIVE_STATS_ADD(bytes_sent, ret);
 
-		ok = iov_advance(&e->vector, &e->count, ret);
-		if (!ok) {
-			return NT_STATUS_INTERNAL_ERROR;
-		}
+		/*
+		 * Now account the written bytes to the queued
+		 * responses, in order.
+		 */
+		left = ret;
+		while (xconn->smb2.send_queue != NULL) {
+			ssize_t len;
+			size_t n;
+			bool ok;
+
+			e = xconn->smb2.send_queue;
+			if (e->pending) {
+				break;
+			}
+			if (e->sendfile_header != NULL) {
+				break;
+			}
 
-		if (e->count > 0) {
-			/* we have more to write */
-			TEVENT_FD_WRITEABLE(xconn->transport.fde);
-			return NT_STATUS_OK;
+			len = iov_buflen(e->vector, e->count);
+			if (len == -1) {
+				return NT_STATUS_INTERNAL_ERROR;
+			}
+			n = MIN(left, (size_t)len);
+
+			ok = iov_advance(&e->vector, &e->count, n);
+			if (!ok) {
+				return NT_STATUS_INTERNAL_ERROR;
+			}
+			left -= n;
+
+			if (e->count > 0) {
+				/* we have more to write */
+				TEVENT_FD_WRITEABLE(xconn->transport.fde);
+				return NT_STATUS_OK;
+			}
+
+			xconn->smb2.send_queue_len--;
+			LIVE_STATS_SUB(send_queue_len, 1);
+			DLIST_REMOVE(xconn->smb2.send_queue, e);
+			talloc_free(e->mem_ctx);
+
+			if (left == 0) {
+				break;
+			}
 		}
 
-		xconn->smb2.send_queue_len--;
-		DLIST_REMOVE(xconn->smb2.send_queue, e);
-		talloc_free(e->mem_ctx);
+		if (left != 0) {
+			return NT_STATUS_INTERNAL_ERROR;
+		}
 	}
 
 	/*
@@ -3765,6 +5010,44 @@ static NTSTATUS smbd_smb2_flush_send_queue(struct smbXsrv_connection *xconn)
 	return NT_STATUS_OK;
 }
 
+static NTSTATUS smbd_smb2_request_process_inbuf(
+	struct smbXsrv_connection *xconn,
+	struct smbd_smb2_request *req,
+	uint8_t *buf,
+	size_t buflen,
+	NTTIME now)
+{
+	NTSTATUS status;
+
+	status = smbd_smb2_inbuf_parse_compound(xconn,
+						now,
+						buf,
+						buflen,
+						req,
+						&req->in.vector,
+						&req->in.vector_count);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	req->current_idx = 1;
+
+	DEBUG(10,("smbd_smb2_request idx[%d] of %d vectors\n",
+		 req->current_idx, req->in.vector_count));
+
+	status = smbd_smb2_request_validate(req);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	status = smbd_smb2_request_setup_out(req);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	return smbd_smb2_request_dispatch(req);
+}
+
 static NTSTATUS smbd_smb2_io_handler(struct smbXsrv_connection *xconn,
 				     uint16_t fde_flags)
 {
@@ -3772,9 +5055,13 @@ static NTSTATUS smbd_smb2_io_handler(struct smbXsrv_connection *xconn,
 	struct smbd_smb2_request_read_state *state = &xconn->smb2.request_read_state;
 	struct smbd_smb2_request *req = NULL;
 	size_t min_recvfile_size = UINT32_MAX;
+	uint8_t *inbuf = NULL;
+	size_t inbuf_len;
+	DATA_BLOB decryption_key = data_blob_null;
 	int ret;
 	int err;
 	bool retry;
+	bool ok;
 	NTSTATUS status;
 	NTTIME now;
 
@@ -3825,6 +5112,7 @@ again:
 	if (err != 0) {
 		return map_nt_error_from_unix_common(err);
 	}
+	LIVE_STATS_ADD(bytes_received, ret);
 
 	if (ret < state->vector.iov_len) {
 		uint8_t *base;
@@ -3843,15 +5131,18 @@ again:
 			 * Not a possible receivefile write.
 			 * Read the rest of the data.
 			 */
+			uint8_t *pktbuf = NULL;
+
 			state->doing_receivefile = false;
 
-			state->pktbuf = talloc_realloc(state->req,
-						       state->pktbuf,
-						       uint8_t,
-						       state->pktfull);
-			if (state->pktbuf == NULL) {
+			pktbuf = smbd_smb2_buffer_alloc(state->req,
+							state->pktfull);
+			if (pktbuf == NULL) {
 				return NT_STATUS_NO_MEMORY;
 			}
+			memcpy(pktbuf, state->pktbuf, state->pktlen);
+			TALLOC_FREE(state->pktbuf);
+			state->pktbuf = pktbuf;
 
 			state->vector.iov_base = (void *)(state->pktbuf +
 				state->pktlen);
@@ -3900,7 +5191,7 @@ again:
 		state->pktlen = state->pktfull;
 	}
 
-	state->pktbuf = talloc_array(state->req, uint8_t, state->pktlen);
+	state->pktbuf = smbd_smb2_buffer_alloc(state->req, state->pktlen);
 	if (state->pktbuf == NULL) {
 		return NT_STATUS_NO_MEMORY;
 	}
@@ -3930,17 +5221,6 @@ got_full:
 	req->request_time = timeval_current();
 	now = timeval_to_nttime(&req->request_time);
 
-	status = smbd_smb2_inbuf_parse_compound(xconn,
-						now,
-						state->pktbuf,
-						state->pktlen,
-						req,
-						&req->in.vector,
-						&req->in.vector_count);
-	if (!NT_STATUS_IS_OK(status)) {
-		return status;
-	}
-
 	if (state->doing_receivefile) {
 		req->smb1req = talloc_zero(req, struct smb_request);
 		if (req->smb1req == NULL) {
@@ -3949,26 +5229,52 @@ got_full:
 		req->smb1req->unread_bytes = state->pktfull - state->pktlen;
 	}
 
-	ZERO_STRUCTP(state);
-
-	req->current_idx = 1;
-
-	DEBUG(10,("smbd_smb2_request idx[%d] of %d vectors\n",
-		 req->current_idx, req->in.vector_count));
+	inbuf = state->pktbuf;
+	inbuf_len = state->pktlen;
 
-	status = smbd_smb2_request_validate(req);
-	if (!NT_STATUS_IS_OK(status)) {
-		return status;
-	}
+	ZERO_STRUCTP(state);
 
-	status = smbd_smb2_request_setup_out(req);
-	if (!NT_STATUS_IS_OK(status)) {
-		return status;
-	}
+	ok = smbd_smb2_request_in_decrypt_offload_wanted(xconn,
+							 inbuf,
+							 inbuf_len,
+							 now,
+							 &decryption_key);
+	if (ok) {
+		struct iovec tf_iov[2] = {
+			{
+				.iov_base = inbuf,
+				.iov_len = SMB2_TF_HDR_SIZE,
+			},
+			{
+				.iov_base = inbuf + SMB2_TF_HDR_SIZE,
+				.iov_len = inbuf_len - SMB2_TF_HDR_SIZE,
+			},
+		};
 
-	status = smbd_smb2_request_dispatch(req);
-	if (!NT_STATUS_IS_OK(status)) {
-		return status;
+		/*
+		 * The request is processed once the job is done,
+		 * in the meantime we read the next requests.
+		 */
+		status = smbd_smb2_request_in_crypto_offload(req,
+							     decryption_key,
+							     true,
+							     tf_iov,
+							     ARRAY_SIZE(tf_iov));
+		if (!NT_STATUS_IS_OK(status)) {
+			return status;
+		}
+		req->crypto_state->inbuf = inbuf;
+		req->crypto_state->inbuf_len = inbuf_len;
+		req->crypto_state->now = now;
+	} else {
+		status = smbd_smb2_request_process_inbuf(xconn,
+							 req,
+							 inbuf,
+							 inbuf_len,
+							 now);
+		if (!NT_STATUS_IS_OK(status)) {
+			return status;
+		}
 	}
 
 	sconn->num_requests++;
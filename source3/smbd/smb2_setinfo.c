@@ -180,6 +180,64 @@ static int defer_rename_state_destructor(struct defer_rename_state *rename_state
 
 static void defer_rename_done(struct tevent_req *subreq);
 
+struct delay_rename_lease_break_state {
+	files_struct *fsp;
+	struct share_mode_data *d;
+	bool *lease_broken;
+	bool delay;
+};
+
+static bool delay_rename_lease_break_fn(
+	struct share_mode_entry *e,
+	bool *modified,
+	void *private_data)
+{
+	struct delay_rename_lease_break_state *state = private_data;
+	struct files_struct *fsp = state->fsp;
+	struct share_mode_lease *l = NULL;
+	uint32_t e_lease_type;
+	uint32_t break_to;
+
+	if (e->op_type != LEASE_OPLOCK) {
+		return false;
+	}
+
+	e_lease_type = get_lease_type(state->d, e);
+
+	if (!(e_lease_type & SMB2_LEASE_HANDLE)) {
+		return false;
+	}
+
+	l = &state->d->leases[e->lease_idx];
+
+	if (smb2_lease_equal(fsp_client_guid(fsp),
+			     &fsp->lease->lease.lease_key,
+			     &l->client_guid,
+			     &l->lease_key)) {
+		return false;
+	}
+
+	if (share_entry_stale_pid(e)) {
+		return false;
+	}
+
+	state->delay = true;
+
+	if (state->lease_broken != NULL) {
+		if (state->lease_broken[e->lease_idx]) {
+			/* Only one break per lease */
+			return false;
+		}
+		state->lease_broken[e->lease_idx] = true;
+	}
+
+	break_to = (e_lease_type & ~SMB2_LEASE_HANDLE);
+
+	send_break_message(fsp->conn->sconn->msg_ctx, &fsp->file_id,
+			   e, break_to);
+	return false;
+}
+
 static struct tevent_req *delay_rename_for_lease_break(struct tevent_req *req,
 				struct smbd_smb2_request *smb2req,
 				struct tevent_context *ev,
@@ -190,53 +248,32 @@ static struct tevent_req *delay_rename_for_lease_break(struct tevent_req *req,
 
 {
 	struct tevent_req *subreq;
-	uint32_t i;
-	struct share_mode_data *d = lck->data;
+	struct delay_rename_lease_break_state state = {
+		.fsp = fsp,
+		.d = lck->data,
+	};
 	struct defer_rename_state *rename_state;
-	bool delay = false;
 	struct timeval timeout;
+	bool ok;
 
 	if (fsp->oplock_type != LEASE_OPLOCK) {
 		return NULL;
 	}
 
-	for (i=0; i<d->num_share_modes; i++) {
-		struct share_mode_entry *e = &d->share_modes[i];
-		struct share_mode_lease *l = NULL;
-		uint32_t e_lease_type;
-		uint32_t break_to;
-
-		if (e->op_type != LEASE_OPLOCK) {
-			continue;
-		}
-
-		e_lease_type = get_lease_type(d, e);
-
-		if (!(e_lease_type & SMB2_LEASE_HANDLE)) {
-			continue;
-		}
-
-		l = &d->leases[e->lease_idx];
-
-		if (smb2_lease_equal(fsp_client_guid(fsp),
-				&fsp->lease->lease.lease_key,
-				&l->client_guid,
-				&l->lease_key)) {
-			continue;
-		}
-
-		if (share_mode_stale_pid(d, i)) {
-			continue;
-		}
-
-		delay = true;
-		break_to = (e_lease_type & ~SMB2_LEASE_HANDLE);
+	/*
+	 * If this fails we send one break per share mode entry
+	 */
+	state.lease_broken = talloc_zero_array(
+		talloc_tos(), bool, MAX(state.d->num_leases, 1));
 
-		send_break_message(fsp->conn->sconn->msg_ctx, &fsp->file_id,
-				   e, break_to);
+	ok = share_mode_forall_entries(
+		lck, delay_rename_lease_break_fn, &state);
+	TALLOC_FREE(state.lease_broken);
+	if (!ok) {
+		return NULL;
 	}
 
-	if (!delay) {
+	if (!state.delay) {
 		return NULL;
 	}
 
@@ -26,6 +26,7 @@
 #include "auth.h"
 #include "lib/param/loadparm.h"
 #include "../lib/util/tevent_ntstatus.h"
+#include "lib/pthreadpool/pthreadpool_tevent.h"
 
 #undef DBGC_CLASS
 #define DBGC_CLASS DBGC_SMB2
@@ -178,26 +179,22 @@ static void smbd_smb2_request_tcon_done(struct tevent_req *subreq)
 	}
 }
 
-static NTSTATUS smbd_smb2_tree_connect(struct smbd_smb2_request *req,
-				       const char *in_path,
-				       uint8_t *out_share_type,
-				       uint32_t *out_share_flags,
-				       uint32_t *out_capabilities,
-				       uint32_t *out_maximal_access,
-				       uint32_t *out_tree_id,
-				       bool *disconnect)
+/*
+ * Find the share the client asked for. This only looks at the loaded
+ * configuration, the share itself is not touched yet.
+ */
+static NTSTATUS smbd_smb2_tree_connect_find_share(TALLOC_CTX *mem_ctx,
+						  struct smbd_smb2_request *req,
+						  const char *in_path,
+						  int *psnum,
+						  char **pservice,
+						  bool *disconnect)
 {
 	struct smbXsrv_connection *conn = req->xconn;
 	const char *share = in_path;
 	char *service = NULL;
 	int snum = -1;
-	struct smbXsrv_tcon *tcon;
-	NTTIME now = timeval_to_nttime(&req->request_time);
-	connection_struct *compat_conn = NULL;
 	struct user_struct *compat_vuser = req->session->compat;
-	NTSTATUS status;
-	bool encryption_desired = req->session->global->encryption_flags & SMBXSRV_ENCRYPTION_DESIRED;
-	bool encryption_required = req->session->global->encryption_flags & SMBXSRV_ENCRYPTION_REQUIRED;
 	bool guest_session = false;
 	bool require_signed_tcon = false;
 
@@ -232,7 +229,7 @@ static NTSTATUS smbd_smb2_tree_connect(struct smbd_smb2_request *req,
 		return NT_STATUS_ACCESS_DENIED;
 	}
 
-	service = talloc_strdup(talloc_tos(), share);
+	service = talloc_strdup(mem_ctx, share);
 	if(!service) {
 		return NT_STATUS_NO_MEMORY;
 	}
@@ -258,7 +255,7 @@ static NTSTATUS smbd_smb2_tree_connect(struct smbd_smb2_request *req,
 			lp_servicename(talloc_tos(), compat_vuser->homes_snum))) {
 		snum = compat_vuser->homes_snum;
 	} else {
-		snum = find_service(talloc_tos(), service, &service);
+		snum = find_service(mem_ctx, service, &service);
 		if (!service) {
 			return NT_STATUS_NO_MEMORY;
 		}
@@ -285,6 +282,34 @@ static NTSTATUS smbd_smb2_tree_connect(struct smbd_smb2_request *req,
 		TALLOC_FREE(proxy);
 	}
 
+	*psnum = snum;
+	*pservice = service;
+	return NT_STATUS_OK;
+}
+
+static NTSTATUS smbd_smb2_tree_connect(struct smbd_smb2_request *req,
+				       int snum,
+				       const char *service,
+				       uint8_t *out_share_type,
+				       uint32_t *out_share_flags,
+				       uint32_t *out_capabilities,
+				       uint32_t *out_maximal_access,
+				       uint32_t *out_tree_id)
+{
+	struct smbXsrv_connection *conn = req->xconn;
+	struct smbXsrv_tcon *tcon;
+	NTTIME now = timeval_to_nttime(&req->request_time);
+	connection_struct *compat_conn = NULL;
+	struct user_struct *compat_vuser = req->session->compat;
+	NTSTATUS status;
+	bool encryption_desired = req->session->global->encryption_flags & SMBXSRV_ENCRYPTION_DESIRED;
+	bool encryption_required = req->session->global->encryption_flags & SMBXSRV_ENCRYPTION_REQUIRED;
+	bool guest_session = false;
+
+	if (security_session_user_level(compat_vuser->session_info, NULL) < SECURITY_USER) {
+		guest_session = true;
+	}
+
 	if ((lp_smb_encrypt(snum) >= SMB_SIGNING_DESIRED) &&
 	    (conn->smb2.server.cipher != 0))
 	{
@@ -405,7 +430,19 @@ static NTSTATUS smbd_smb2_tree_connect(struct smbd_smb2_request *req,
 }
 
 struct smbd_smb2_tree_connect_state {
+	struct smbd_smb2_request *smb2req;
 	const char *in_path;
+	int snum;
+	char *service;
+
+	/*
+	 * The following variables are talloced off "state" which is protected
+	 * by a destructor and thus are guaranteed to be safe to be used in the
+	 * job function in the worker thread.
+	 */
+	char *share_path;
+	struct security_unix_token *token;
+
 	uint8_t out_share_type;
 	uint32_t out_share_flags;
 	uint32_t out_capabilities;
@@ -414,13 +451,71 @@ struct smbd_smb2_tree_connect_state {
 	bool disconnect;
 };
 
+static int smbd_smb2_tree_connect_state_destructor(
+		struct smbd_smb2_tree_connect_state *state)
+{
+	return -1;
+}
+
+static void smbd_smb2_tree_connect_do(struct tevent_req *req);
+static void smbd_smb2_tree_connect_stat_job(void *private_data);
+static void smbd_smb2_tree_connect_stat_done(struct tevent_req *subreq);
+
+/*
+ * Return the root directory of the share if it is worth looking at it
+ * in a helper thread before the tree connect: make_connection_smb2()
+ * does a chdir() and stat() on it, which can stall the whole connection
+ * for a long time on an automounted or network file system.
+ */
+static char *smbd_smb2_tree_connect_share_path(TALLOC_CTX *mem_ctx,
+					       struct smbd_smb2_request *req,
+					       int snum)
+{
+	size_t max_threads;
+	bool have_per_thread_creds = false;
+	char *path = NULL;
+
+#ifdef HAVE_LINUX_THREAD_CREDENTIALS
+	have_per_thread_creds = true;
+#endif
+	if (!have_per_thread_creds) {
+		return NULL;
+	}
+
+	max_threads = pthreadpool_tevent_max_threads(req->sconn->pool);
+	if (max_threads == 0) {
+		/*
+		 * We need a non sync threadpool!
+		 */
+		return NULL;
+	}
+
+	if (lp_printable(snum)) {
+		return NULL;
+	}
+
+	path = lp_path(mem_ctx, snum);
+	if (path == NULL || path[0] != '/' || strchr(path, '%') != NULL) {
+		/*
+		 * Not a local path, or one that still depends on the
+		 * user, leave it to make_connection_smb2().
+		 */
+		TALLOC_FREE(path);
+		return NULL;
+	}
+
+	return path;
+}
+
 static struct tevent_req *smbd_smb2_tree_connect_send(TALLOC_CTX *mem_ctx,
 					struct tevent_context *ev,
 					struct smbd_smb2_request *smb2req,
 					const char *in_path)
 {
 	struct tevent_req *req;
+	struct tevent_req *subreq;
 	struct smbd_smb2_tree_connect_state *state;
+	struct security_unix_token *unix_token;
 	NTSTATUS status;
 
 	req = tevent_req_create(mem_ctx, &state,
@@ -428,22 +523,127 @@ static struct tevent_req *smbd_smb2_tree_connect_send(TALLOC_CTX *mem_ctx,
 	if (req == NULL) {
 		return NULL;
 	}
+	state->smb2req = smb2req;
 	state->in_path = in_path;
 
-	status = smbd_smb2_tree_connect(smb2req,
-					state->in_path,
+	status = smbd_smb2_tree_connect_find_share(state,
+						   smb2req,
+						   state->in_path,
+						   &state->snum,
+						   &state->service,
+						   &state->disconnect);
+	if (tevent_req_nterror(req, status)) {
+		return tevent_req_post(req, ev);
+	}
+
+	state->share_path = smbd_smb2_tree_connect_share_path(
+		state, smb2req, state->snum);
+	if (state->share_path == NULL) {
+		smbd_smb2_tree_connect_do(req);
+		return tevent_req_post(req, ev);
+	}
+
+	unix_token = smb2req->session->compat->session_info->unix_token;
+	state->token = copy_unix_token(state, unix_token);
+	if (tevent_req_nomem(state->token, req)) {
+		return tevent_req_post(req, ev);
+	}
+
+	subreq = pthreadpool_tevent_job_send(state,
+					     ev,
+					     smb2req->sconn->pool,
+					     smbd_smb2_tree_connect_stat_job,
+					     state);
+	if (tevent_req_nomem(subreq, req)) {
+		return tevent_req_post(req, ev);
+	}
+	tevent_req_set_callback(subreq, smbd_smb2_tree_connect_stat_done, req);
+
+	talloc_set_destructor(state, smbd_smb2_tree_connect_state_destructor);
+
+	return req;
+}
+
+static void smbd_smb2_tree_connect_stat_job(void *private_data)
+{
+	struct smbd_smb2_tree_connect_state *state = talloc_get_type_abort(
+		private_data, struct smbd_smb2_tree_connect_state);
+	struct stat st;
+	int ret;
+
+	/* Become the correct credential on this thread. */
+	ret = set_thread_credentials(state->token->uid,
+				     state->token->gid,
+				     (size_t)state->token->ngroups,
+				     state->token->groups);
+	if (ret != 0) {
+		return;
+	}
+
+	/*
+	 * The result does not matter, the tree connect checks the share
+	 * again. This only makes sure any automount or slow lookup of the
+	 * share root is done before the main thread gets there.
+	 */
+	ret = stat(state->share_path, &st);
+	if (ret == -1) {
+		return;
+	}
+}
+
+static void smbd_smb2_tree_connect_stat_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	struct smbd_smb2_tree_connect_state *state = tevent_req_data(
+		req, struct smbd_smb2_tree_connect_state);
+	struct auth_session_info *session_info =
+		state->smb2req->session->global->auth_session_info;
+	int ret;
+
+	ret = pthreadpool_tevent_job_recv(subreq);
+	TALLOC_FREE(subreq);
+	talloc_set_destructor(state, NULL);
+	if (ret != 0) {
+		/*
+		 * We only lose the head start, make_connection_smb2() still
+		 * does the real work.
+		 */
+		DBG_DEBUG("stat job for %s failed: %s\n",
+			  state->share_path, strerror(ret));
+	}
+
+	/*
+	 * Other requests may have run in the meantime, restore what
+	 * smbd_smb2_request_dispatch() had set up for us.
+	 */
+	set_current_user_info(session_info->unix_info->sanitized_username,
+			      session_info->unix_info->unix_name,
+			      session_info->info->domain_name);
+	change_to_root_user();
+
+	smbd_smb2_tree_connect_do(req);
+}
+
+static void smbd_smb2_tree_connect_do(struct tevent_req *req)
+{
+	struct smbd_smb2_tree_connect_state *state = tevent_req_data(
+		req, struct smbd_smb2_tree_connect_state);
+	NTSTATUS status;
+
+	status = smbd_smb2_tree_connect(state->smb2req,
+					state->snum,
+					state->service,
 					&state->out_share_type,
 					&state->out_share_flags,
 					&state->out_capabilities,
 					&state->out_maximal_access,
-					&state->out_tree_id,
-					&state->disconnect);
+					&state->out_tree_id);
 	if (tevent_req_nterror(req, status)) {
-		return tevent_req_post(req, ev);
+		return;
 	}
 
 	tevent_req_done(req);
-	return tevent_req_post(req, ev);
 }
 
 static NTSTATUS smbd_smb2_tree_connect_recv(struct tevent_req *req,
@@ -1430,11 +1430,16 @@ NTSTATUS smb2srv_open_recreate(struct smbXsrv_connection *conn,
 
 	talloc_set_destructor(op, smbXsrv_open_destructor);
 
-	status = smbXsrv_open_global_store(op->global);
-	if (!NT_STATUS_IS_OK(status)) {
-		TALLOC_FREE(op);
-		return status;
-	}
+	/*
+	 * Don't store the global record yet. The caller reconnects the
+	 * file and then calls smbXsrv_open_update() with the new backend
+	 * cookie, which writes the record anyway. Storing it here as well
+	 * doubles the writes and, in a cluster, the record migrations for
+	 * every reclaimed handle. A reclaim storm after a node failover
+	 * pays for that once per handle. If the reconnect fails,
+	 * smbXsrv_open_close() stores the disconnected state again.
+	 */
+	TALLOC_FREE(op->global->db_rec);
 
 	if (CHECK_DEBUGLVL(10)) {
 		struct smbXsrv_openB open_blob;
@@ -1443,8 +1448,8 @@ NTSTATUS smb2srv_open_recreate(struct smbXsrv_connection *conn,
 		open_blob.version = 0;
 		open_blob.info.info0 = op;
 
-		DEBUG(10,("smbXsrv_open_recreate: global_id (0x%08x) stored\n",
-			 op->global->open_global_id));
+		DEBUG(10,("smbXsrv_open_recreate: global_id (0x%08x) "
+			  "recreated\n", op->global->open_global_id));
 		NDR_PRINT_DEBUG(smbXsrv_openB, &open_blob);
 	}
 
@@ -23,12 +23,24 @@
 #include "lib/util/tevent_ntstatus.h"
 #include "lib/util/debug.h"
 #include "smbprofile.h"
+#include "live_stats.h"
 #include "serverid.h"
 #include "locking/proto.h"
 #include "cleanupdb.h"
 
+/*
+ * After a network outage many children exit at once and the parent
+ * sends us a MSG_SMB_NOTIFY_CLEANUP for each of them. Wait this long
+ * after the first one so that a single cleanupdb traverse picks up
+ * the whole batch.
+ */
+#define SMBD_CLEANUPD_BATCH_MSEC 100
+
 struct smbd_cleanupd_state {
+	struct tevent_context *ev;
+	struct messaging_context *msg;
 	pid_t parent_pid;
+	struct tevent_timer *cleanup_te;
 };
 
 static void smbd_cleanupd_shutdown(struct messaging_context *msg,
@@ -43,6 +55,7 @@ static void smbd_cleanupd_unlock(struct messaging_context *msg,
 				 void *private_data, uint32_t msg_type,
 				 struct server_id server_id,
 				 DATA_BLOB *data);
+static void smbd_cleanupd_cleanup(struct tevent_req *req);
 
 struct tevent_req *smbd_cleanupd_send(TALLOC_CTX *mem_ctx,
 				      struct tevent_context *ev,
@@ -57,6 +70,8 @@ struct tevent_req *smbd_cleanupd_send(TALLOC_CTX *mem_ctx,
 	if (req == NULL) {
 		return NULL;
 	}
+	state->ev = ev;
+	state->msg = msg;
 	state->parent_pid = parent_pid;
 
 	status = messaging_register(msg, req, MSG_SHUTDOWN,
@@ -134,6 +149,20 @@ static int cleanupdb_traverse_fn(const pid_t pid,
 	return 0;
 }
 
+static void smbd_cleanupd_cleanup_timer(struct tevent_context *ev,
+					struct tevent_timer *te,
+					struct timeval current_time,
+					void *private_data)
+{
+	struct tevent_req *req = talloc_get_type_abort(
+		private_data, struct tevent_req);
+	struct smbd_cleanupd_state *state = tevent_req_data(
+		req, struct smbd_cleanupd_state);
+
+	state->cleanup_te = NULL;
+	smbd_cleanupd_cleanup(req);
+}
+
 static void smbd_cleanupd_process_exited(struct messaging_context *msg,
 					 void *private_data, uint32_t msg_type,
 					 struct server_id server_id,
@@ -143,6 +172,28 @@ static void smbd_cleanupd_process_exited(struct messaging_context *msg,
 		private_data, struct tevent_req);
 	struct smbd_cleanupd_state *state = tevent_req_data(
 		req, struct smbd_cleanupd_state);
+
+	if (state->cleanup_te != NULL) {
+		/* The pending run will also see this child */
+		return;
+	}
+
+	state->cleanup_te = tevent_add_timer(
+		state->ev,
+		state,
+		timeval_current_ofs_msec(SMBD_CLEANUPD_BATCH_MSEC),
+		smbd_cleanupd_cleanup_timer,
+		req);
+	if (state->cleanup_te == NULL) {
+		DBG_ERR("tevent_add_timer failed\n");
+		smbd_cleanupd_cleanup(req);
+	}
+}
+
+static void smbd_cleanupd_cleanup(struct tevent_req *req)
+{
+	struct smbd_cleanupd_state *state = tevent_req_data(
+		req, struct smbd_cleanupd_state);
 	int ret;
 	struct cleanupdb_traverse_state cleanup_state;
 	TALLOC_CTX *frame = talloc_stackframe();
@@ -183,8 +234,9 @@ static void smbd_cleanupd_process_exited(struct messaging_context *msg,
 		}
 
 		smbprofile_cleanup(child->pid, state->parent_pid);
+		live_stats_cleanup(child->pid);
 
-		ret = messaging_cleanup(msg, child->pid);
+		ret = messaging_cleanup(state->msg, child->pid);
 
 		if ((ret != 0) && (ret != ENOENT)) {
 			DBG_DEBUG("messaging_cleanup returned %s\n",
@@ -21,20 +21,236 @@
 */
 
 #include "includes.h"
+#include "system/filesys.h"
 #include "../lib/util/memcache.h"
 #include "smbd/smbd.h"
 #include "messages.h"
 #include "serverid.h"
 #include "smbprofile.h"
+#include "dbwrap/dbwrap.h"
+#include "dbwrap/dbwrap_open.h"
+#include "dbwrap/dbwrap_rbt.h"
+#include "util_tdb.h"
 #include <tdb.h>
 
 /****************************************************************************
  Stat cache code used in unix_convert.
 *****************************************************************************/
 
+/*
+ * With "shared stat cache = yes" the cache lives in stat_cache.tdb
+ * in the lock directory instead of the per process memcache, so a
+ * newly forked smbd starts with a warm cache and the entries exist
+ * once per node instead of once per process. The tdb uses per hash
+ * chain (mutex) locks, and lookups and adds only touch the chain of
+ * their own key, so different processes only contend on the same
+ * names.
+ *
+ * The keys are prefixed with the share path and the case sensitivity
+ * of the lookup. Every hit is verified with a stat() as before, a
+ * flush of the cache wipes the tdb instead of telling every smbd to
+ * flush its own copy.
+ */
+
+static struct db_context *stat_cache_db;
+static pid_t stat_cache_db_owner;
+
+/*
+ * Bytes this process added since it last looked at the size of the
+ * whole cache.
+ */
+static size_t stat_cache_shared_added;
+
+bool stat_cache_shared_init(void)
+{
+	char *db_path = NULL;
+
+	if (stat_cache_db != NULL) {
+		return true;
+	}
+
+	db_path = lock_path(talloc_tos(), "stat_cache.tdb");
+	if (db_path == NULL) {
+		return false;
+	}
+
+	stat_cache_db = db_open(NULL, db_path, 0,
+				TDB_DEFAULT|TDB_VOLATILE|TDB_CLEAR_IF_FIRST|
+				TDB_INCOMPATIBLE_HASH,
+				O_RDWR|O_CREAT, 0644,
+				DBWRAP_LOCK_ORDER_3, DBWRAP_FLAG_NONE);
+	TALLOC_FREE(db_path);
+	if (stat_cache_db == NULL) {
+		DBG_ERR("Failed to open the shared stat cache\n");
+		return false;
+	}
+	stat_cache_db_owner = getpid();
+
+	return true;
+}
+
+static void stat_cache_shared_invalidate(void)
+{
+	if (dbwrap_wipe(stat_cache_db) != 0) {
+		DBG_WARNING("Could not wipe the shared stat cache\n");
+	}
+}
+
+static char *stat_cache_shared_key(TALLOC_CTX *mem_ctx,
+				   connection_struct *conn,
+				   const char *name,
+				   bool case_sensitive)
+{
+	return talloc_asprintf(mem_ctx, "%c%s/%s",
+			       case_sensitive ? 'S' : 'I',
+			       conn->connectpath, name);
+}
+
+static int stat_cache_shared_size_fn(struct db_record *rec,
+				     void *private_data)
+{
+	size_t *size = private_data;
+	TDB_DATA key = dbwrap_record_get_key(rec);
+	TDB_DATA value = dbwrap_record_get_value(rec);
+
+	*size += key.dsize + value.dsize;
+	return 0;
+}
+
+/*
+ * Wipe the cache once it grows beyond "max stat cache size". Every
+ * process adds up what it stored itself and only looks at the real
+ * size of the cache after it added a sixteenth of the maximum, so
+ * the traverse is cheap compared to the adds that made it necessary.
+ */
+static void stat_cache_shared_check_size(size_t added)
+{
+	size_t max_bytes = (size_t)lp_max_stat_cache_size() * 1024;
+	size_t bytes = 0;
+	NTSTATUS status;
+
+	if (max_bytes == 0) {
+		return;
+	}
+
+	stat_cache_shared_added += added;
+	if (stat_cache_shared_added < max_bytes / 16) {
+		return;
+	}
+	stat_cache_shared_added = 0;
+
+	status = dbwrap_traverse_read(stat_cache_db,
+				      stat_cache_shared_size_fn,
+				      &bytes, NULL);
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_DEBUG("Could not traverse the shared stat cache: %s\n",
+			  nt_errstr(status));
+		return;
+	}
+
+	if (bytes > max_bytes) {
+		DBG_INFO("Shared stat cache full, wiping it\n");
+		stat_cache_shared_invalidate();
+	}
+}
+
+/*
+ * value must be NUL terminated at value_length, the terminator is
+ * stored along with it.
+ */
+static void stat_cache_shared_store(const char *key,
+				    const char *value,
+				    size_t value_length)
+{
+	TDB_DATA val = make_tdb_data((const uint8_t *)value,
+				     value_length + 1);
+	NTSTATUS status;
+
+	status = dbwrap_store(stat_cache_db, string_tdb_data(key), val,
+			      TDB_REPLACE);
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_DEBUG("Could not store %s: %s\n", key, nt_errstr(status));
+		return;
+	}
+
+	stat_cache_shared_check_size(strlen(key) + val.dsize);
+}
+
+static char *stat_cache_shared_fetch_key(TALLOC_CTX *mem_ctx,
+					 const char *key)
+{
+	TDB_DATA val;
+	NTSTATUS status;
+
+	status = dbwrap_fetch(stat_cache_db, mem_ctx,
+			      string_tdb_data(key), &val);
+	if (!NT_STATUS_IS_OK(status)) {
+		return NULL;
+	}
+
+	if ((val.dsize == 0) || (val.dptr[val.dsize - 1] != '\0')) {
+		dbwrap_delete(stat_cache_db, string_tdb_data(key));
+		TALLOC_FREE(val.dptr);
+		return NULL;
+	}
+
+	return (char *)val.dptr;
+}
+
+static void stat_cache_shared_add(connection_struct *conn,
+				  const char *original_path,
+				  const char *translated_path,
+				  size_t translated_path_length,
+				  bool case_sensitive)
+{
+	char *key = NULL;
+
+	key = stat_cache_shared_key(talloc_tos(), conn, original_path,
+				    case_sensitive);
+	if (key == NULL) {
+		return;
+	}
+
+	stat_cache_shared_store(key, translated_path, translated_path_length);
+	TALLOC_FREE(key);
+}
+
+static char *stat_cache_shared_fetch(TALLOC_CTX *mem_ctx,
+				     connection_struct *conn,
+				     const char *name)
+{
+	char *key = NULL;
+	char *translated_path = NULL;
+
+	key = stat_cache_shared_key(mem_ctx, conn, name,
+				    conn->case_sensitive);
+	if (key == NULL) {
+		return NULL;
+	}
+
+	translated_path = stat_cache_shared_fetch_key(mem_ctx, key);
+	TALLOC_FREE(key);
+	return translated_path;
+}
+
+static void stat_cache_shared_delete(connection_struct *conn,
+				     const char *name)
+{
+	char *key = NULL;
+
+	key = stat_cache_shared_key(talloc_tos(), conn, name,
+				    conn->case_sensitive);
+	if (key == NULL) {
+		return;
+	}
+	dbwrap_delete(stat_cache_db, string_tdb_data(key));
+	TALLOC_FREE(key);
+}
+
 /**
  * Add an entry into the stat cache.
  *
+ * @param conn                 The connection the name was looked up in
  * @param full_orig_name       The original name as specified by the client
  * @param orig_translated_path The name on our filesystem.
  *
@@ -44,9 +260,10 @@
  *
  */
 
-void stat_cache_add( const char *full_orig_name,
-		char *translated_path,
-		bool case_sensitive)
+void stat_cache_add(connection_struct *conn,
+		    const char *full_orig_name,
+		    char *translated_path,
+		    bool case_sensitive)
 {
 	size_t translated_path_length;
 	char *original_path;
@@ -132,10 +349,16 @@ void stat_cache_add( const char *full_orig_name,
 	 * New entry or replace old entry.
 	 */
 
-	memcache_add(
-		smbd_memcache(), STAT_CACHE,
-		data_blob_const(original_path, original_path_length),
-		data_blob_const(translated_path, translated_path_length + 1));
+	if (stat_cache_db != NULL) {
+		stat_cache_shared_add(conn, original_path, translated_path,
+				      translated_path_length, case_sensitive);
+	} else {
+		memcache_add(
+			smbd_memcache(), STAT_CACHE,
+			data_blob_const(original_path, original_path_length),
+			data_blob_const(translated_path,
+					translated_path_length + 1));
+	}
 
 	DEBUG(5,("stat_cache_add: Added entry (%lx:size %x) %s -> %s\n",
 		 (unsigned long)translated_path,
@@ -232,12 +455,21 @@ bool stat_cache_lookup(connection_struct *conn,
 	while (1) {
 		char *sp;
 
-		data_val = data_blob_null;
-
-		if (memcache_lookup(
-			    smbd_memcache(), STAT_CACHE,
-			    data_blob_const(chk_name, strlen(chk_name)),
-			    &data_val)) {
+		if (stat_cache_db != NULL) {
+			translated_path = stat_cache_shared_fetch(
+				ctx, conn, chk_name);
+			if (translated_path != NULL) {
+				break;
+			}
+		} else if (memcache_lookup(
+				   smbd_memcache(), STAT_CACHE,
+				   data_blob_const(chk_name, strlen(chk_name)),
+				   &data_val)) {
+			translated_path = talloc_strdup(
+				ctx, (char *)data_val.data);
+			if (!translated_path) {
+				smb_panic("talloc failed");
+			}
 			break;
 		}
 
@@ -271,11 +503,7 @@ bool stat_cache_lookup(connection_struct *conn,
 		}
 	}
 
-	translated_path = talloc_strdup(ctx,(char *)data_val.data);
-	if (!translated_path) {
-		smb_panic("talloc failed");
-	}
-	translated_path_length = data_val.length - 1;
+	translated_path_length = strlen(translated_path);
 
 	DEBUG(10,("stat_cache_lookup: lookup succeeded for name [%s] "
 		  "-> [%s]\n", chk_name, translated_path ));
@@ -292,8 +520,13 @@ bool stat_cache_lookup(connection_struct *conn,
 
 	if (ret != 0) {
 		/* Discard this entry - it doesn't exist in the filesystem. */
-		memcache_delete(smbd_memcache(), STAT_CACHE,
+		if (stat_cache_db != NULL) {
+			stat_cache_shared_delete(conn, chk_name);
+		} else {
+			memcache_delete(
+				smbd_memcache(), STAT_CACHE,
 				data_blob_const(chk_name, strlen(chk_name)));
+		}
 		TALLOC_FREE(chk_name);
 		TALLOC_FREE(translated_path);
 		return False;
@@ -356,6 +589,10 @@ void smbd_send_stat_cache_delete_message(struct messaging_context *msg_ctx,
 					 const char *name)
 {
 #ifdef DEVELOPER
+	if (stat_cache_db != NULL) {
+		stat_cache_shared_invalidate();
+		return;
+	}
 	messaging_send_all(msg_ctx,
 			   MSG_SMB_STAT_CACHE_DELETE,
 			   name,
@@ -404,10 +641,542 @@ unsigned int fast_string_hash(TDB_DATA *key)
 
 bool reset_stat_cache( void )
 {
+	name_index_flush();
+
 	if (!lp_stat_cache())
 		return True;
 
+	if (stat_cache_db != NULL) {
+		/*
+		 * All smbds reload their config, the one
+		 * that opened the cache flushes it for all.
+		 */
+		if (getpid() == stat_cache_db_owner) {
+			stat_cache_shared_invalidate();
+		}
+		return True;
+	}
+
 	memcache_flush(smbd_memcache(), STAT_CACHE);
 
 	return True;
 }
+
+/****************************************************************************
+ Long names of mangled 8.3 names, shared by all smbds.
+
+ A new smbd has not seen the long names behind the mangled names its
+ client got from a previous connection, so resolving them costs a full
+ scan of the directory, mangling every entry. With the shared stat
+ cache, the name found by such a scan is stored under the file_id of
+ the directory and the upper cased 8.3 name. The caller has to verify
+ that the long name still exists and mangles to the 8.3 name.
+*****************************************************************************/
+
+bool mangled_name_shared_dir_id(connection_struct *conn,
+				const char *dirpath,
+				struct file_id *dir_id)
+{
+	struct smb_filename *smb_dname = NULL;
+	int ret;
+
+	if (stat_cache_db == NULL) {
+		return false;
+	}
+
+	smb_dname = synthetic_smb_fname(talloc_tos(), dirpath, NULL, NULL, 0);
+	if (smb_dname == NULL) {
+		return false;
+	}
+
+	ret = SMB_VFS_STAT(conn, smb_dname);
+	if (ret == -1) {
+		TALLOC_FREE(smb_dname);
+		return false;
+	}
+
+	*dir_id = vfs_file_id_from_sbuf(conn, &smb_dname->st);
+	TALLOC_FREE(smb_dname);
+	return true;
+}
+
+static char *mangled_name_shared_key(TALLOC_CTX *mem_ctx,
+				     const struct file_id *dir_id,
+				     const char *name)
+{
+	return talloc_asprintf_strupper_m(mem_ctx, "M%jx:%jx:%jx/%s",
+					  (uintmax_t)dir_id->devid,
+					  (uintmax_t)dir_id->inode,
+					  (uintmax_t)dir_id->extid,
+					  name);
+}
+
+char *mangled_name_shared_fetch(TALLOC_CTX *mem_ctx,
+				const struct file_id *dir_id,
+				const char *name)
+{
+	char *key = NULL;
+	char *long_name = NULL;
+
+	key = mangled_name_shared_key(mem_ctx, dir_id, name);
+	if (key == NULL) {
+		return NULL;
+	}
+
+	long_name = stat_cache_shared_fetch_key(mem_ctx, key);
+	TALLOC_FREE(key);
+	return long_name;
+}
+
+void mangled_name_shared_store(const struct file_id *dir_id,
+			       const char *name,
+			       const char *long_name)
+{
+	char *key = NULL;
+
+	key = mangled_name_shared_key(talloc_tos(), dir_id, name);
+	if (key == NULL) {
+		return;
+	}
+
+	stat_cache_shared_store(key, long_name, strlen(long_name));
+	TALLOC_FREE(key);
+}
+
+/****************************************************************************
+ Case insensitive name index used by get_real_filename().
+
+ Without it every name in a case insensitive share that does not exist
+ in exactly the case the client sent, including every new file, costs
+ a full scan of the directory. Instead, directories with at least
+ NAME_INDEX_MIN_ENTRIES entries get an index from upper cased name to
+ real name, built with a single scan.
+
+ An index is valid as long as device, inode and mtime of the directory
+ are unchanged, a change by anybody else makes us rescan. Changes done
+ by ourselves are reported by notify_fname() and applied to the index
+ directly, so creating many files in a large directory does not need
+ a rescan for every file.
+*****************************************************************************/
+
+#define NAME_INDEX_MIN_ENTRIES 256
+#define NAME_INDEX_MAX_ENTRIES (1024*1024)
+#define NAME_INDEX_MAX_DIRS 64
+
+struct name_index {
+	struct name_index *prev, *next;
+	char *path;
+	struct db_context *names;
+	size_t num_entries;
+	bool collisions;
+	SMB_DEV_T dev;
+	SMB_INO_T ino;
+	struct timespec mtime;
+};
+
+static struct name_index *name_indexes;
+static size_t name_index_num_dirs;
+static size_t name_index_num_entries;
+
+static void name_index_free(struct name_index *idx)
+{
+	DLIST_REMOVE(name_indexes, idx);
+	name_index_num_dirs -= 1;
+	name_index_num_entries -= idx->num_entries;
+	TALLOC_FREE(idx);
+}
+
+void name_index_flush(void)
+{
+	while (name_indexes != NULL) {
+		name_index_free(name_indexes);
+	}
+}
+
+static char *name_index_path(TALLOC_CTX *mem_ctx,
+			     connection_struct *conn,
+			     const char *dirpath)
+{
+	if ((dirpath == NULL) || (dirpath[0] == '\0') || ISDOT(dirpath)) {
+		return talloc_strdup(mem_ctx, conn->connectpath);
+	}
+	return talloc_asprintf(mem_ctx, "%s/%s", conn->connectpath, dirpath);
+}
+
+static struct name_index *name_index_find(const char *path)
+{
+	struct name_index *idx;
+
+	for (idx = name_indexes; idx != NULL; idx = idx->next) {
+		if (strcmp(idx->path, path) == 0) {
+			return idx;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * With a timestamp granularity of a second we can't tell a change
+ * in the same second as the last one from the state we've seen.
+ */
+static bool name_index_racy_mtime(const SMB_STRUCT_STAT *st)
+{
+	struct timespec now = timespec_current();
+	time_t min_age = (st->st_ex_mtime.tv_nsec == 0) ? 2 : 1;
+
+	return ((now.tv_sec - st->st_ex_mtime.tv_sec) < min_age);
+}
+
+/*
+ * strequal() falls back to a byte wise compare for invalid multibyte
+ * sequences, we can't get that from upper cased keys.
+ */
+static char *name_index_key(TALLOC_CTX *mem_ctx, const char *name)
+{
+	const char *p = name;
+
+	while (*p != '\0') {
+		size_t size;
+		codepoint_t c = next_codepoint(p, &size);
+
+		if (c == INVALID_CODEPOINT) {
+			return NULL;
+		}
+		p += size;
+	}
+
+	return talloc_strdup_upper(mem_ctx, name);
+}
+
+static NTSTATUS name_index_add(struct name_index *idx, const char *name)
+{
+	char *key = NULL;
+	NTSTATUS status;
+
+	key = name_index_key(talloc_tos(), name);
+	if (key == NULL) {
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	status = dbwrap_store(idx->names,
+			      string_term_tdb_data(key),
+			      string_term_tdb_data(name),
+			      TDB_INSERT);
+	TALLOC_FREE(key);
+
+	if (NT_STATUS_EQUAL(status, NT_STATUS_OBJECT_NAME_COLLISION)) {
+		/*
+		 * A second name only differing in case, the
+		 * directory scan also finds the first one.
+		 */
+		idx->collisions = true;
+		return NT_STATUS_OK;
+	}
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	idx->num_entries += 1;
+	return NT_STATUS_OK;
+}
+
+static struct name_index *name_index_build(connection_struct *conn,
+					   const struct smb_filename *smb_dname,
+					   const char *path,
+					   const SMB_STRUCT_STAT *st)
+{
+	struct name_index *idx = NULL;
+	struct smb_Dir *dir_hnd = NULL;
+	const char *dname = NULL;
+	char *talloced = NULL;
+	long curpos = 0;
+	NTSTATUS status;
+
+	idx = talloc_zero(NULL, struct name_index);
+	if (idx == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	idx->path = talloc_strdup(idx, path);
+	idx->names = db_open_rbt(idx);
+	if ((idx->path == NULL) || (idx->names == NULL)) {
+		TALLOC_FREE(idx);
+		errno = ENOMEM;
+		return NULL;
+	}
+	idx->dev = st->st_ex_dev;
+	idx->ino = st->st_ex_ino;
+	idx->mtime = st->st_ex_mtime;
+
+	dir_hnd = OpenDir(talloc_tos(), conn, smb_dname, NULL, 0);
+	if (dir_hnd == NULL) {
+		int saved_errno = errno;
+		DBG_INFO("OpenDir(%s) failed: %s\n", path, strerror(errno));
+		TALLOC_FREE(idx);
+		errno = saved_errno;
+		return NULL;
+	}
+
+	while ((dname = ReadDirName(dir_hnd, &curpos, NULL, &talloced))) {
+		if (ISDOT(dname) || ISDOTDOT(dname)) {
+			TALLOC_FREE(talloced);
+			continue;
+		}
+
+		status = name_index_add(idx, dname);
+		TALLOC_FREE(talloced);
+		if (!NT_STATUS_IS_OK(status)) {
+			DBG_DEBUG("Can't index %s: %s\n",
+				  path, nt_errstr(status));
+			TALLOC_FREE(dir_hnd);
+			TALLOC_FREE(idx);
+			errno = EOPNOTSUPP;
+			return NULL;
+		}
+	}
+
+	TALLOC_FREE(dir_hnd);
+	return idx;
+}
+
+static void name_index_keep(struct name_index *idx)
+{
+	while ((name_indexes != NULL) &&
+	       ((name_index_num_dirs >= NAME_INDEX_MAX_DIRS) ||
+		(name_index_num_entries + idx->num_entries >
+		 NAME_INDEX_MAX_ENTRIES))) {
+		name_index_free(DLIST_TAIL(name_indexes));
+	}
+
+	DLIST_ADD(name_indexes, idx);
+	name_index_num_dirs += 1;
+	name_index_num_entries += idx->num_entries;
+}
+
+/**
+ * Case insensitive lookup of name in the directory dirpath
+ *
+ * @return 0 with *found_name set if it exists, -1 with errno set
+ *         otherwise. Like SMB_VFS_GET_REAL_FILENAME() EOPNOTSUPP means
+ *         the caller has to fall back to scanning the directory.
+ */
+
+int name_index_get_real_filename(connection_struct *conn,
+				 const char *dirpath,
+				 const char *name,
+				 TALLOC_CTX *mem_ctx,
+				 char **found_name)
+{
+	TALLOC_CTX *frame = talloc_stackframe();
+	struct smb_filename *smb_dname = NULL;
+	struct name_index *idx = NULL;
+	char *path = NULL;
+	char *key = NULL;
+	TDB_DATA val;
+	bool keep = false;
+	NTSTATUS status;
+	int ret;
+
+	path = name_index_path(frame, conn, dirpath);
+	key = name_index_key(frame, name);
+	if ((path == NULL) || (key == NULL)) {
+		TALLOC_FREE(frame);
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+
+	smb_dname = synthetic_smb_fname(frame, dirpath, NULL, NULL, 0);
+	if (smb_dname == NULL) {
+		TALLOC_FREE(frame);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	idx = name_index_find(path);
+
+	ret = SMB_VFS_STAT(conn, smb_dname);
+	if (ret == -1) {
+		if (idx != NULL) {
+			name_index_free(idx);
+		}
+		TALLOC_FREE(frame);
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+
+	if ((idx != NULL) &&
+	    ((idx->dev != smb_dname->st.st_ex_dev) ||
+	     (idx->ino != smb_dname->st.st_ex_ino) ||
+	     (timespec_compare(&idx->mtime,
+			       &smb_dname->st.st_ex_mtime) != 0))) {
+		DBG_DEBUG("Directory %s changed, dropping name index\n",
+			  path);
+		name_index_free(idx);
+		idx = NULL;
+	}
+
+	if (idx != NULL) {
+		DLIST_PROMOTE(name_indexes, idx);
+	} else {
+		idx = name_index_build(conn, smb_dname, path,
+				       &smb_dname->st);
+		if (idx == NULL) {
+			int saved_errno = errno;
+			TALLOC_FREE(frame);
+			errno = saved_errno;
+			return -1;
+		}
+		talloc_steal(frame, idx);
+
+		keep = ((idx->num_entries >= NAME_INDEX_MIN_ENTRIES) &&
+			(idx->num_entries <= NAME_INDEX_MAX_ENTRIES) &&
+			!name_index_racy_mtime(&smb_dname->st));
+	}
+
+	status = dbwrap_fetch(idx->names, mem_ctx,
+			      string_term_tdb_data(key), &val);
+
+	if (keep) {
+		DBG_DEBUG("Keeping name index for %s with %zu entries\n",
+			  path, idx->num_entries);
+		talloc_steal(NULL, idx);
+		name_index_keep(idx);
+	}
+
+	TALLOC_FREE(frame);
+
+	if (NT_STATUS_EQUAL(status, NT_STATUS_NOT_FOUND)) {
+		errno = ENOENT;
+		return -1;
+	}
+	if (!NT_STATUS_IS_OK(status)) {
+		errno = map_errno_from_nt_status(status);
+		return -1;
+	}
+
+	*found_name = (char *)val.dptr;
+	return 0;
+}
+
+/**
+ * Apply our own change to the directory of path, as reported to
+ * notify_fname(), to the name index of that directory.
+ */
+
+void name_index_notify(connection_struct *conn,
+		       uint32_t action,
+		       const char *path)
+{
+	TALLOC_CTX *frame = NULL;
+	struct smb_filename *smb_dname = NULL;
+	struct name_index *idx = NULL;
+	char *dirpath = NULL;
+	const char *name = NULL;
+	char *index_path = NULL;
+	NTSTATUS status;
+	bool ok;
+	int ret;
+
+	if (name_indexes == NULL) {
+		return;
+	}
+
+	switch (action) {
+	case NOTIFY_ACTION_ADDED:
+	case NOTIFY_ACTION_NEW_NAME:
+	case NOTIFY_ACTION_REMOVED:
+	case NOTIFY_ACTION_OLD_NAME:
+		break;
+	default:
+		return;
+	}
+
+	frame = talloc_stackframe();
+
+	ok = parent_dirname(frame, path, &dirpath, &name);
+	if (!ok) {
+		TALLOC_FREE(frame);
+		return;
+	}
+
+	index_path = name_index_path(frame, conn, dirpath);
+	if (index_path == NULL) {
+		TALLOC_FREE(frame);
+		return;
+	}
+
+	idx = name_index_find(index_path);
+	if (idx == NULL) {
+		TALLOC_FREE(frame);
+		return;
+	}
+
+	smb_dname = synthetic_smb_fname(frame, dirpath, NULL, NULL, 0);
+	if (smb_dname == NULL) {
+		name_index_free(idx);
+		TALLOC_FREE(frame);
+		return;
+	}
+
+	ret = SMB_VFS_STAT(conn, smb_dname);
+	if ((ret == -1) ||
+	    (idx->dev != smb_dname->st.st_ex_dev) ||
+	    (idx->ino != smb_dname->st.st_ex_ino) ||
+	    ((smb_dname->st.st_ex_mtime.tv_nsec == 0) &&
+	     name_index_racy_mtime(&smb_dname->st))) {
+		name_index_free(idx);
+		TALLOC_FREE(frame);
+		return;
+	}
+
+	if ((action == NOTIFY_ACTION_ADDED) ||
+	    (action == NOTIFY_ACTION_NEW_NAME)) {
+		size_t num_entries = idx->num_entries;
+
+		status = name_index_add(idx, name);
+		if (!NT_STATUS_IS_OK(status)) {
+			name_index_free(idx);
+			TALLOC_FREE(frame);
+			return;
+		}
+		name_index_num_entries += idx->num_entries - num_entries;
+	} else {
+		char *key = NULL;
+		TDB_DATA val;
+
+		key = name_index_key(frame, name);
+		if (key == NULL) {
+			name_index_free(idx);
+			TALLOC_FREE(frame);
+			return;
+		}
+
+		status = dbwrap_fetch(idx->names, frame,
+				      string_term_tdb_data(key), &val);
+		if (NT_STATUS_IS_OK(status) &&
+		    (strcmp((const char *)val.dptr, name) == 0)) {
+			if (idx->collisions) {
+				/*
+				 * Another name with the same key
+				 * might exist, we can't tell.
+				 */
+				name_index_free(idx);
+				TALLOC_FREE(frame);
+				return;
+			}
+			status = dbwrap_delete(idx->names,
+					       string_term_tdb_data(key));
+			if (!NT_STATUS_IS_OK(status)) {
+				name_index_free(idx);
+				TALLOC_FREE(frame);
+				return;
+			}
+			idx->num_entries -= 1;
+			name_index_num_entries -= 1;
+		}
+	}
+
+	idx->mtime = smb_dname->st.st_ex_mtime;
+
+	TALLOC_FREE(frame);
+}
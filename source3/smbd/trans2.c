@@ -649,15 +649,97 @@ static NTSTATUS fill_ea_chained_buffer(TALLOC_CTX *mem_ctx,
 	return NT_STATUS_OK;
 }
 
+/****************************************************************************
+ Per open cache of the parts of QUERY_INFO answers that have to be read from
+ xattrs. It is only used while the handle has read caching granted, every
+ break of the oplock or lease throws it away. Modifications through handles
+ of the same lease don't break it, so entries are also tied to the change
+ time of the file.
+****************************************************************************/
+
+struct fsp_qinfo_cache {
+	struct timespec ctime;
+	uint16_t lease_epoch;
+	bool have_ea_size;
+	unsigned int ea_size;
+	bool have_streams;
+	unsigned int num_streams;
+	struct stream_struct *streams;
+};
+
+static struct fsp_qinfo_cache *fsp_qinfo_cache(
+	files_struct *fsp, const struct smb_filename *smb_fname)
+{
+	struct fsp_qinfo_cache *cache = NULL;
+	const SMB_STRUCT_STAT *st = &smb_fname->st;
+	uint16_t lease_epoch = 0;
+	struct timespec now;
+
+	if (fsp == NULL || !lp_smbd_getinfo_cache(SNUM(fsp->conn))) {
+		return NULL;
+	}
+	if (is_ntfs_stream_smb_fname(smb_fname) || !VALID_STAT(*st)) {
+		return NULL;
+	}
+	if ((fsp_lease_type(fsp) & SMB2_LEASE_READ) == 0 ||
+	    fsp->sent_oplock_break != NO_BREAK_SENT) {
+		TALLOC_FREE(fsp->qinfo_cache);
+		return NULL;
+	}
+	if (fsp->oplock_type == LEASE_OPLOCK) {
+		if (fsp->lease->lease.lease_flags &
+		    SMB2_LEASE_FLAG_BREAK_IN_PROGRESS) {
+			TALLOC_FREE(fsp->qinfo_cache);
+			return NULL;
+		}
+		/*
+		 * The lease is shared with other opens, which don't
+		 * see our cache. Every break or upgrade moves the epoch.
+		 */
+		lease_epoch = fsp->lease->lease.lease_epoch;
+	}
+
+	cache = fsp->qinfo_cache;
+	if (cache != NULL) {
+		if (cache->lease_epoch == lease_epoch &&
+		    timespec_compare(&cache->ctime, &st->st_ex_ctime) == 0) {
+			return cache;
+		}
+		TALLOC_FREE(fsp->qinfo_cache);
+	}
+
+	now = timespec_current();
+	if (timespec_too_recent(&st->st_ex_ctime, &now)) {
+		return NULL;
+	}
+
+	cache = talloc_zero(fsp, struct fsp_qinfo_cache);
+	if (cache == NULL) {
+		return NULL;
+	}
+	cache->ctime = st->st_ex_ctime;
+	cache->lease_epoch = lease_epoch;
+	fsp->qinfo_cache = cache;
+
+	return cache;
+}
+
 static unsigned int estimate_ea_size(connection_struct *conn, files_struct *fsp, const struct smb_filename *smb_fname)
 {
 	size_t total_ea_len = 0;
 	TALLOC_CTX *mem_ctx;
 	struct ea_list *ea_list = NULL;
+	struct fsp_qinfo_cache *cache = NULL;
 
 	if (!lp_ea_support(SNUM(conn))) {
 		return 0;
 	}
+
+	cache = fsp_qinfo_cache(fsp, smb_fname);
+	if (cache != NULL && cache->have_ea_size) {
+		return cache->ea_size;
+	}
+
 	mem_ctx = talloc_stackframe();
 
 	/* If this is a stream fsp, then we need to instead find the
@@ -694,6 +776,12 @@ static unsigned int estimate_ea_size(connection_struct *conn, files_struct *fsp,
 		total_ea_len = ret_data_size;
 	}
 	TALLOC_FREE(mem_ctx);
+
+	if (cache != NULL) {
+		cache->ea_size = total_ea_len;
+		cache->have_ea_size = true;
+	}
+
 	return total_ea_len;
 }
 
@@ -1587,6 +1675,7 @@ static bool check_msdfs_link(connection_struct *conn,
 
 struct smbd_dirptr_lanman2_state {
 	connection_struct *conn;
+	struct dptr_struct *dirptr;
 	uint32_t info_level;
 	bool check_mangled_names;
 	bool has_wild;
@@ -1648,8 +1737,8 @@ static bool smbd_dirptr_lanman2_match_fn(TALLOC_CTX *ctx,
 				fname, mask);
 	state->got_exact_match = got_match;
 	if (!got_match) {
-		got_match = mask_match(fname, mask,
-				       state->conn->case_sensitive);
+		got_match = dptr_mask_match(state->dirptr, fname, mask,
+					    state->conn->case_sensitive);
 	}
 
 	if(!got_match && state->check_mangled_names &&
@@ -1672,8 +1761,9 @@ static bool smbd_dirptr_lanman2_match_fn(TALLOC_CTX *ctx,
 					mangled_name, mask);
 		state->got_exact_match = got_match;
 		if (!got_match) {
-			got_match = mask_match(mangled_name, mask,
-					       state->conn->case_sensitive);
+			got_match = dptr_mask_match(state->dirptr,
+						    mangled_name, mask,
+						    state->conn->case_sensitive);
 		}
 	}
 
@@ -1693,6 +1783,7 @@ static bool smbd_dirptr_lanman2_mode_fn(TALLOC_CTX *ctx,
 					void *private_data,
 					struct smb_filename *smb_fname,
 					bool get_dosmode,
+					const uint32_t *vfs_dosmode,
 					uint32_t *_mode)
 {
 	struct smbd_dirptr_lanman2_state *state =
@@ -1701,6 +1792,8 @@ static bool smbd_dirptr_lanman2_mode_fn(TALLOC_CTX *ctx,
 	uint32_t mode = 0;
 
 	if (INFO_LEVEL_IS_UNIX(state->info_level)) {
+		/* The backend's attributes are not for the lstat. */
+		vfs_dosmode = NULL;
 		if (SMB_VFS_LSTAT(state->conn, smb_fname) != 0) {
 			DEBUG(5,("smbd_dirptr_lanman2_mode_fn: "
 				 "Couldn't lstat [%s] (%s)\n",
@@ -1726,6 +1819,9 @@ static bool smbd_dirptr_lanman2_mode_fn(TALLOC_CTX *ctx,
 
 	if (ms_dfs_link) {
 		mode = dos_mode_msdfs(state->conn, smb_fname);
+	} else if (get_dosmode && vfs_dosmode != NULL) {
+		mode = dos_mode_readdirplus(state->conn, smb_fname,
+					    *vfs_dosmode);
 	} else if (get_dosmode) {
 		mode = dos_mode(state->conn, smb_fname);
 	}
@@ -2469,6 +2565,7 @@ NTSTATUS smbd_dirptr_lanman2_entry(TALLOC_CTX *ctx,
 	if (mangled_names != MANGLED_NAMES_NO) {
 		state.check_mangled_names = true;
 	}
+	state.dirptr = dirptr;
 	state.has_wild = dptr_has_wild(dirptr);
 	state.got_exact_match = false;
 
@@ -2498,7 +2595,8 @@ NTSTATUS smbd_dirptr_lanman2_entry(TALLOC_CTX *ctx,
 				   &fname,
 				   &smb_fname,
 				   &mode,
-				   &prev_dirpos);
+				   &prev_dirpos,
+				   file_id);
 	if (!ok) {
 		return NT_STATUS_END_OF_FILE;
 	}
@@ -2529,10 +2627,6 @@ NTSTATUS smbd_dirptr_lanman2_entry(TALLOC_CTX *ctx,
 			 smb_fname_str_dbg(smb_fname)));
 	}
 
-	if (file_id != NULL) {
-		*file_id = vfs_file_id_from_sbuf(conn, &smb_fname->st);
-	}
-
 	if (!NT_STATUS_IS_OK(status) &&
 	    !NT_STATUS_EQUAL(status, STATUS_MORE_ENTRIES))
 	{
@@ -5367,6 +5461,7 @@ NTSTATUS smbd_do_qfilepathinfo(connection_struct *conn,
 		case SMB_FILE_STREAM_INFORMATION: {
 			unsigned int num_streams = 0;
 			struct stream_struct *streams = NULL;
+			struct fsp_qinfo_cache *cache = NULL;
 
 			DEBUG(10,("smbd_do_qfilepathinfo: "
 				  "SMB_FILE_STREAM_INFORMATION\n"));
@@ -5375,10 +5470,27 @@ NTSTATUS smbd_do_qfilepathinfo(connection_struct *conn,
 				return NT_STATUS_INVALID_PARAMETER;
 			}
 
+			cache = fsp_qinfo_cache(fsp, smb_fname);
+			if (cache != NULL && cache->have_streams) {
+				status = marshall_stream_info(cache->num_streams,
+							      cache->streams,
+							      pdata,
+							      max_data_bytes,
+							      &data_size);
+				if (!NT_STATUS_IS_OK(status)) {
+					DEBUG(10, ("marshall_stream_info "
+						   "failed: %s\n",
+						   nt_errstr(status)));
+					return status;
+				}
+				*fixed_portion = 32;
+				break;
+			}
+
 			status = vfs_streaminfo(conn,
 						fsp,
 						smb_fname,
-						talloc_tos(),
+						cache != NULL ? cache : talloc_tos(),
 						&num_streams,
 						&streams);
 
@@ -5399,7 +5511,13 @@ NTSTATUS smbd_do_qfilepathinfo(connection_struct *conn,
 				return status;
 			}
 
-			TALLOC_FREE(streams);
+			if (cache != NULL) {
+				cache->num_streams = num_streams;
+				cache->streams = streams;
+				cache->have_streams = true;
+			} else {
+				TALLOC_FREE(streams);
+			}
 
 			*fixed_portion = 32;
 
@@ -744,8 +744,6 @@ const char *vfs_readdirname(connection_struct *conn, void *p,
 {
 	struct dirent *ptr= NULL;
 	const char *dname;
-	char *translated;
-	NTSTATUS status;
 
 	if (!p)
 		return(NULL);
@@ -767,6 +765,21 @@ const char *vfs_readdirname(connection_struct *conn, void *p,
 	dname = dname - 2;
 #endif
 
+	return vfs_readdirname_translate(conn, dname, talloced);
+}
+
+/*******************************************************************
+ Translate a name read from a directory into what we return to the
+ client. *talloced is set if the result was allocated.
+********************************************************************/
+
+const char *vfs_readdirname_translate(connection_struct *conn,
+				      const char *dname,
+				      char **talloced)
+{
+	char *translated;
+	NTSTATUS status;
+
 	status = SMB_VFS_TRANSLATE_NAME(conn, dname, vfs_translate_to_windows,
 					talloc_tos(), &translated);
 	if (NT_STATUS_EQUAL(status, NT_STATUS_NONE_MAPPED)) {
@@ -1552,6 +1565,18 @@ struct dirent *smb_vfs_call_readdir(struct vfs_handle_struct *handle,
 	return handle->fns->readdir_fn(handle, dirp, sbuf);
 }
 
+NTSTATUS smb_vfs_call_readdirplus(struct vfs_handle_struct *handle,
+				  DIR *dirp,
+				  TALLOC_CTX *mem_ctx,
+				  size_t max_entries,
+				  struct vfs_readdirplus_entry **pentries,
+				  size_t *pnum_entries)
+{
+	VFS_FIND(readdirplus);
+	return handle->fns->readdirplus_fn(handle, dirp, mem_ctx, max_entries,
+					   pentries, pnum_entries);
+}
+
 void smb_vfs_call_seekdir(struct vfs_handle_struct *handle,
 			  DIR *dirp, long offset)
 {
@@ -0,0 +1,376 @@
+/*
+ * Unix SMB/CIFS implementation.
+ * Benchmark dbwrap_do_locked under multi-process contention
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "includes.h"
+#include "torture/proto.h"
+#include "system/filesys.h"
+#include "system/shmem.h"
+#include "system/wait.h"
+#include "lib/dbwrap/dbwrap.h"
+#include "lib/dbwrap/dbwrap_open.h"
+#include "lib/util/sys_rw.h"
+#include "lib/util/time.h"
+
+extern int torture_numops;
+extern int torture_nprocs;
+
+/*
+ * torture_nprocs processes do torture_numops read-modify-write cycles
+ * each on a locking.tdb lookalike, the way smbd updates share modes:
+ * dbwrap_do_locked() on a file_id key, parse the value, store it back.
+ * On a local tdb that is the tdb_chainlock() path.  Most operations go
+ * to a few hot keys, the rest is spread over many cold ones.  This is
+ * repeated for fcntl and mutex locking and a few hash sizes, printing
+ * throughput and a latency distribution for each.
+ */
+
+#define BENCH_LOCKED_HOT_KEYS 16
+#define BENCH_LOCKED_COLD_KEYS 100000
+#define BENCH_LOCKED_HOT_PERCENT 90
+#define BENCH_LOCKED_VALUE_SIZE 256
+
+/*
+ * Log-linear latency histogram: 8 buckets per power of two of
+ * nanoseconds, good enough for percentiles within 12.5%.
+ */
+#define BENCH_LOCKED_SUB_BUCKETS 8
+#define BENCH_LOCKED_BUCKETS (64 * BENCH_LOCKED_SUB_BUCKETS)
+
+struct bench_locked_hist {
+	uint64_t count;
+	uint64_t max_ns;
+	uint64_t buckets[BENCH_LOCKED_BUCKETS];
+};
+
+struct bench_locked_key {
+	uint64_t devid;
+	uint64_t inode;
+	uint64_t extid;
+};
+
+struct bench_locked_state {
+	uint64_t counter;
+	NTSTATUS status;
+};
+
+static unsigned bench_locked_bucket(uint64_t ns)
+{
+	unsigned msb = 0;
+
+	if (ns < BENCH_LOCKED_SUB_BUCKETS) {
+		return ns;
+	}
+	while ((ns >> (msb + 1)) != 0) {
+		msb += 1;
+	}
+	return msb * BENCH_LOCKED_SUB_BUCKETS +
+		((ns >> (msb - 3)) & (BENCH_LOCKED_SUB_BUCKETS - 1));
+}
+
+static uint64_t bench_locked_bucket_limit(unsigned bucket)
+{
+	unsigned msb = bucket / BENCH_LOCKED_SUB_BUCKETS;
+	unsigned sub = bucket % BENCH_LOCKED_SUB_BUCKETS;
+
+	if (bucket < BENCH_LOCKED_SUB_BUCKETS) {
+		return bucket + 1;
+	}
+	return (uint64_t)(BENCH_LOCKED_SUB_BUCKETS + sub + 1) << (msb - 3);
+}
+
+static uint64_t bench_locked_percentile(const struct bench_locked_hist *h,
+					unsigned permille)
+{
+	uint64_t wanted = (h->count * permille + 999) / 1000;
+	uint64_t seen = 0;
+	unsigned i;
+
+	for (i = 0; i < BENCH_LOCKED_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen >= wanted && seen != 0) {
+			return MIN(bench_locked_bucket_limit(i), h->max_ns);
+		}
+	}
+	return h->max_ns;
+}
+
+static void bench_locked_fn(struct db_record *rec, void *private_data)
+{
+	struct bench_locked_state *state = private_data;
+	TDB_DATA value = dbwrap_record_get_value(rec);
+	uint8_t buf[BENCH_LOCKED_VALUE_SIZE] = { 0 };
+	uint64_t counter = 0;
+
+	if (value.dsize == sizeof(buf)) {
+		memcpy(buf, value.dptr, sizeof(buf));
+		memcpy(&counter, buf, sizeof(counter));
+	}
+	counter += 1;
+	memcpy(buf, &counter, sizeof(counter));
+
+	state->counter = counter;
+	state->status = dbwrap_record_store(
+		rec, (TDB_DATA) { .dptr = buf, .dsize = sizeof(buf) }, 0);
+}
+
+static bool bench_locked_child(const char *dbname, int hash_size,
+			       struct bench_locked_hist *hist,
+			       int ready_fd, int go_fd)
+{
+	struct db_context *db = NULL;
+	struct bench_locked_state state = { .counter = 0 };
+	bool ok = false;
+	ssize_t nread;
+	char c;
+	int i;
+
+	db = db_open(talloc_tos(), dbname, hash_size,
+		     TDB_CLEAR_IF_FIRST|TDB_INCOMPATIBLE_HASH,
+		     O_RDWR|O_CREAT, 0644,
+		     DBWRAP_LOCK_ORDER_1, DBWRAP_FLAG_NONE);
+	if (db == NULL) {
+		fprintf(stderr, "db_open failed: %s\n", strerror(errno));
+	}
+	ok = (db != NULL);
+
+	srandom(getpid());
+
+	if (sys_write(ready_fd, &ok, sizeof(ok)) != sizeof(ok) || !ok) {
+		goto done;
+	}
+	nread = sys_read(go_fd, &c, sizeof(c));
+	if (nread != 0) {
+		ok = false;
+		goto done;
+	}
+
+	for (i = 0; i < torture_numops; i++) {
+		struct bench_locked_key k = {
+			.devid = 0xfd00, .extid = 0,
+		};
+		TDB_DATA key = { .dptr = (uint8_t *)&k, .dsize = sizeof(k) };
+		struct timespec start, end;
+		uint64_t ns;
+		NTSTATUS status;
+
+		if ((random() % 100) < BENCH_LOCKED_HOT_PERCENT) {
+			k.inode = random() % BENCH_LOCKED_HOT_KEYS;
+		} else {
+			k.inode = BENCH_LOCKED_HOT_KEYS +
+				random() % BENCH_LOCKED_COLD_KEYS;
+		}
+
+		clock_gettime_mono(&start);
+		status = dbwrap_do_locked(db, key, bench_locked_fn, &state);
+		clock_gettime_mono(&end);
+
+		if (!NT_STATUS_IS_OK(status) ||
+		    !NT_STATUS_IS_OK(state.status)) {
+			fprintf(stderr, "dbwrap_do_locked failed: %s/%s\n",
+				nt_errstr(status), nt_errstr(state.status));
+			ok = false;
+			goto done;
+		}
+
+		ns = nsec_time_diff(&end, &start);
+		hist->count += 1;
+		hist->max_ns = MAX(hist->max_ns, ns);
+		hist->buckets[bench_locked_bucket(ns)] += 1;
+	}
+
+done:
+	TALLOC_FREE(db);
+	return ok;
+}
+
+static bool bench_locked_run(const char *locking, int hash_size)
+{
+	const char *dbname = "bench_do_locked.tdb";
+	struct db_context *db = NULL;
+	struct bench_locked_hist *hists = NULL;
+	struct bench_locked_hist total = { .count = 0 };
+	size_t hists_size = sizeof(*hists) * torture_nprocs;
+	pid_t *children = NULL;
+	int ready_pipe[2] = { -1, -1 };
+	int go_pipe[2] = { -1, -1 };
+	struct timeval start;
+	double secs;
+	bool ret = false;
+	bool ok;
+	int i, j;
+
+	lp_set_cmdline("dbwrap_tdb_mutexes:*",
+		       strequal(locking, "mutex") ? "yes" : "no");
+	lp_set_cmdline("dbwrap_tdb_require_mutexes:*",
+		       strequal(locking, "mutex") ? "yes" : "no");
+	lp_set_cmdline("dbwrap_tdb_auto_hash_size:*", "no");
+
+	unlink(dbname);
+
+	/*
+	 * Keep it open, so that the children's TDB_CLEAR_IF_FIRST
+	 * does not wipe the database
+	 */
+	db = db_open(talloc_tos(), dbname, hash_size,
+		     TDB_CLEAR_IF_FIRST|TDB_INCOMPATIBLE_HASH,
+		     O_RDWR|O_CREAT, 0644,
+		     DBWRAP_LOCK_ORDER_1, DBWRAP_FLAG_NONE);
+	if (db == NULL) {
+		fprintf(stderr, "db_open failed: %s\n", strerror(errno));
+		return false;
+	}
+
+	hists = mmap(NULL, hists_size, PROT_READ|PROT_WRITE,
+		     MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if (hists == MAP_FAILED) {
+		perror("mmap failed");
+		hists = NULL;
+		goto fail;
+	}
+	memset(hists, 0, hists_size);
+
+	children = talloc_zero_array(talloc_tos(), pid_t, torture_nprocs);
+	if (children == NULL) {
+		fprintf(stderr, "talloc failed\n");
+		goto fail;
+	}
+
+	if ((pipe(ready_pipe) != 0) || (pipe(go_pipe) != 0)) {
+		perror("pipe failed");
+		goto fail;
+	}
+
+	for (i = 0; i < torture_nprocs; i++) {
+		children[i] = fork();
+		if (children[i] == -1) {
+			perror("fork failed");
+			goto fail;
+		}
+		if (children[i] == 0) {
+			TALLOC_FREE(db);
+			close(ready_pipe[0]);
+			close(go_pipe[1]);
+			ok = bench_locked_child(dbname, hash_size, &hists[i],
+						ready_pipe[1], go_pipe[0]);
+			_exit(ok ? 0 : 1);
+		}
+	}
+	close(ready_pipe[1]);
+	ready_pipe[1] = -1;
+	close(go_pipe[0]);
+	go_pipe[0] = -1;
+
+	for (i = 0; i < torture_nprocs; i++) {
+		ssize_t n = sys_read(ready_pipe[0], &ok, sizeof(ok));
+		if ((n != sizeof(ok)) || !ok) {
+			fprintf(stderr, "child failed to open %s\n", dbname);
+			goto fail;
+		}
+	}
+
+	/*
+	 * Closing the go pipe starts all children at once
+	 */
+	start = timeval_current();
+	close(go_pipe[1]);
+	go_pipe[1] = -1;
+
+	ret = true;
+	for (i = 0; i < torture_nprocs; i++) {
+		int status;
+		pid_t pid = waitpid(children[i], &status, 0);
+		if ((pid != children[i]) || !WIFEXITED(status) ||
+		    (WEXITSTATUS(status) != 0)) {
+			ret = false;
+		}
+		children[i] = 0;
+	}
+	secs = timeval_elapsed(&start);
+
+	if (!ret) {
+		fprintf(stderr, "a child failed\n");
+		goto fail;
+	}
+
+	for (i = 0; i < torture_nprocs; i++) {
+		total.count += hists[i].count;
+		total.max_ns = MAX(total.max_ns, hists[i].max_ns);
+		for (j = 0; j < BENCH_LOCKED_BUCKETS; j++) {
+			total.buckets[j] += hists[i].buckets[j];
+		}
+	}
+
+	printf("%-5s hash_size=%-6d nprocs=%d: %10.0f ops/sec, "
+	       "latency usec p50=%.1f p99=%.1f p99.9=%.1f max=%.1f\n",
+	       locking, hash_size, torture_nprocs,
+	       secs > 0 ? total.count / secs : 0.0,
+	       bench_locked_percentile(&total, 500) / 1000.0,
+	       bench_locked_percentile(&total, 990) / 1000.0,
+	       bench_locked_percentile(&total, 999) / 1000.0,
+	       total.max_ns / 1000.0);
+
+fail:
+	if (children != NULL) {
+		for (i = 0; i < torture_nprocs; i++) {
+			if (children[i] > 0) {
+				kill(children[i], SIGKILL);
+				waitpid(children[i], NULL, 0);
+			}
+		}
+		TALLOC_FREE(children);
+	}
+	for (i = 0; i < 2; i++) {
+		if (ready_pipe[i] != -1) {
+			close(ready_pipe[i]);
+		}
+		if (go_pipe[i] != -1) {
+			close(go_pipe[i]);
+		}
+	}
+	if (hists != NULL) {
+		munmap(hists, hists_size);
+	}
+	TALLOC_FREE(db);
+	unlink(dbname);
+	return ret;
+}
+
+bool run_bench_dbwrap_do_locked(int dummy)
+{
+	const char *lockings[] = { "fcntl", "mutex" };
+	int hash_sizes[] = { 131, 10007 };
+	size_t i, j;
+
+	for (i = 0; i < ARRAY_SIZE(lockings); i++) {
+		if (strequal(lockings[i], "mutex") &&
+		    !tdb_runtime_check_for_robust_mutexes()) {
+			printf("robust mutexes not available, "
+			       "skipping mutex locking\n");
+			continue;
+		}
+		for (j = 0; j < ARRAY_SIZE(hash_sizes); j++) {
+			bool ok = bench_locked_run(lockings[i],
+						   hash_sizes[j]);
+			if (!ok) {
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
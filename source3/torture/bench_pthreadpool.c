@@ -20,9 +20,12 @@
 
 #include "includes.h"
 #include "../lib/pthreadpool/pthreadpool_pipe.h"
+#include "../lib/pthreadpool/pthreadpool.h"
+#include "system/threads.h"
 #include "proto.h"
 
 extern int torture_numops;
+extern int torture_nprocs;
 
 static void null_job(void *private_data)
 {
@@ -66,3 +69,123 @@ bool run_bench_pthreadpool(int dummy)
 
 	return (ret == 0);
 }
+
+/*
+ * Queue torture_numops slow "bulk" jobs into a pool of torture_nprocs
+ * threads, then as many quick "metadata" jobs. Measure how long it
+ * takes until all metadata jobs are done, once with normal and once
+ * with high priority metadata jobs.
+ */
+
+struct bench_prio_state {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	unsigned num_done;
+	unsigned num_meta_done;
+	struct timeval meta_done;
+};
+
+static void bench_prio_bulk_job(void *private_data)
+{
+	smb_msleep(1);
+}
+
+static void bench_prio_meta_job(void *private_data)
+{
+	return;
+}
+
+static int bench_prio_signal(int jobid, void (*job_fn)(void *private_data),
+			     void *job_private_data, void *private_data)
+{
+	struct bench_prio_state *state = private_data;
+	int ret;
+
+	ret = pthread_mutex_lock(&state->mutex);
+	if (ret != 0) {
+		return ret;
+	}
+	state->num_done += 1;
+	if (job_fn == bench_prio_meta_job) {
+		state->num_meta_done += 1;
+		if (state->num_meta_done == (unsigned)torture_numops) {
+			state->meta_done = timeval_current();
+		}
+	}
+	pthread_cond_signal(&state->cond);
+	pthread_mutex_unlock(&state->mutex);
+	return 0;
+}
+
+static bool bench_prio_run(enum pthreadpool_prio meta_prio)
+{
+	struct bench_prio_state state = { .num_done = 0 };
+	struct pthreadpool *pool;
+	struct timeval start;
+	int i, ret;
+
+	ret = pthread_mutex_init(&state.mutex, NULL);
+	if (ret != 0) {
+		return false;
+	}
+	ret = pthread_cond_init(&state.cond, NULL);
+	if (ret != 0) {
+		pthread_mutex_destroy(&state.mutex);
+		return false;
+	}
+
+	ret = pthreadpool_init(torture_nprocs, &pool, bench_prio_signal,
+			       &state);
+	if (ret != 0) {
+		d_fprintf(stderr, "pthreadpool_init failed: %s\n",
+			  strerror(ret));
+		goto fail;
+	}
+
+	start = timeval_current();
+
+	for (i=0; i<torture_numops; i++) {
+		ret = pthreadpool_add_job(pool, 0, bench_prio_bulk_job, NULL);
+		if (ret != 0) {
+			d_fprintf(stderr, "pthreadpool_add_job failed: %s\n",
+				  strerror(ret));
+			goto fail;
+		}
+	}
+	for (i=0; i<torture_numops; i++) {
+		ret = pthreadpool_add_job_prio(pool, 0, meta_prio,
+					       bench_prio_meta_job, NULL);
+		if (ret != 0) {
+			d_fprintf(stderr, "pthreadpool_add_job_prio failed: "
+				  "%s\n", strerror(ret));
+			goto fail;
+		}
+	}
+
+	pthread_mutex_lock(&state.mutex);
+	while (state.num_done < (unsigned)torture_numops * 2) {
+		pthread_cond_wait(&state.cond, &state.mutex);
+	}
+	pthread_mutex_unlock(&state.mutex);
+
+	printf("%s priority metadata jobs: done after %f secs, "
+	       "all jobs done after %f secs\n",
+	       (meta_prio == PTHREADPOOL_PRIO_HIGH) ? "high" : "normal",
+	       timeval_elapsed2(&start, &state.meta_done),
+	       timeval_elapsed(&start));
+
+	pthreadpool_destroy(pool);
+	ret = 0;
+fail:
+	pthread_cond_destroy(&state.cond);
+	pthread_mutex_destroy(&state.mutex);
+	return (ret == 0);
+}
+
+bool run_bench_pthreadpool_prio(int dummy)
+{
+	if (!bench_prio_run(PTHREADPOOL_PRIO_NORMAL)) {
+		return false;
+	}
+	return bench_prio_run(PTHREADPOOL_PRIO_HIGH);
+}
@@ -22,6 +22,9 @@
 #include "libsmb/libsmb.h"
 #include "libsmb/clirap.h"
 #include "../lib/util/tevent_ntstatus.h"
+#include "lib/util/time.h"
+
+extern int torture_nprocs;
 
 static long long int ival(const char *str)
 {
@@ -34,6 +37,7 @@ struct nbench_state {
 	const char *cliname;
 	FILE *loadfile;
 	struct ftable *ftable;
+	struct timeval start;
 	void (*bw_report)(size_t nread,
 			  size_t nwritten,
 			  void *private_data);
@@ -87,6 +91,12 @@ struct nbench_cmd_struct {
 	int num_params;
 	NTSTATUS status;
 	enum nbench_cmd cmd;
+	/*
+	 * Loadfiles with timestamps say when, relative to the start of the
+	 * run, each command was originally sent
+	 */
+	bool have_time;
+	struct timeval time;
 };
 
 static struct nbench_cmd_struct *nbench_parse(TALLOC_CTX *mem_ctx,
@@ -105,6 +115,21 @@ static struct nbench_cmd_struct *nbench_parse(TALLOC_CTX *mem_ctx,
 		goto fail;
 	}
 	result->num_params = talloc_array_length(result->params) - 1;
+	result->have_time = false;
+
+	if ((result->num_params > 0) && isdigit(result->params[0][0])) {
+		double t = strtod(result->params[0], NULL);
+
+		result->time = timeval_set(
+			(uint32_t)t, (uint32_t)((t - (uint32_t)t) * 1000000));
+		result->have_time = true;
+
+		/* shift the NULL terminator as well */
+		memmove(&result->params[0], &result->params[1],
+			result->num_params * sizeof(char *));
+		result->num_params -= 1;
+	}
+
 	if (result->num_params < 2) {
 		goto fail;
 	}
@@ -185,9 +210,12 @@ struct nbench_cmd_state {
 	struct nbench_state *state;
 	struct nbench_cmd_struct *cmd;
 	struct ftable *ft;
+	uint8_t *buf;
 	bool eof;
 };
 
+static bool nbench_cmd_issue(struct tevent_req *req);
+static void nbench_cmd_waited(struct tevent_req *subreq);
 static void nbench_cmd_done(struct tevent_req *subreq);
 
 static struct tevent_req *nbench_cmd_send(TALLOC_CTX *mem_ctx,
@@ -225,6 +253,56 @@ static struct tevent_req *nbench_cmd_send(TALLOC_CTX *mem_ctx,
 		return tevent_req_post(req, ev);
 	}
 
+	if (state->cmd->have_time) {
+		struct timeval when, now;
+
+		when = timeval_sum(&nb_state->start, &state->cmd->time);
+		now = timeval_current();
+
+		if (timeval_compare(&when, &now) > 0) {
+			subreq = tevent_wakeup_send(state, ev, when);
+			if (tevent_req_nomem(subreq, req)) {
+				return tevent_req_post(req, ev);
+			}
+			tevent_req_set_callback(subreq, nbench_cmd_waited,
+						req);
+			return req;
+		}
+	}
+
+	if (!nbench_cmd_issue(req)) {
+		return tevent_req_post(req, ev);
+	}
+	return req;
+}
+
+static void nbench_cmd_waited(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	bool ok;
+
+	ok = tevent_wakeup_recv(subreq);
+	TALLOC_FREE(subreq);
+	if (!ok) {
+		tevent_req_oom(req);
+		return;
+	}
+	nbench_cmd_issue(req);
+}
+
+/*
+ * Send the command parsed by nbench_cmd_send(), returns false with req
+ * already failed or done if there's nothing to wait for.
+ */
+static bool nbench_cmd_issue(struct tevent_req *req)
+{
+	struct nbench_cmd_state *state = tevent_req_data(
+		req, struct nbench_cmd_state);
+	struct tevent_context *ev = state->ev;
+	struct nbench_state *nb_state = state->state;
+	struct tevent_req *subreq = NULL;
+
 	switch (state->cmd->cmd) {
 	case NBENCH_CMD_NTCREATEX: {
 		uint32_t desired_access;
@@ -233,14 +311,14 @@ static struct tevent_req *nbench_cmd_send(TALLOC_CTX *mem_ctx,
 
 		state->ft = talloc(state, struct ftable);
 		if (tevent_req_nomem(state->ft, req)) {
-			return tevent_req_post(req, ev);
+			return false;
 		}
 
 		state->ft->cp.fname = talloc_all_string_sub(
 			state->ft, state->cmd->params[1], "client1",
 			nb_state->cliname);
 		if (tevent_req_nomem(state->ft->cp.fname, req)) {
-			return tevent_req_post(req, ev);
+			return false;
 		}
 		state->ft->cp.cr_options = ival(state->cmd->params[2]);
 		state->ft->cp.cr_disposition = ival(state->cmd->params[3]);
@@ -272,7 +350,7 @@ static struct tevent_req *nbench_cmd_send(TALLOC_CTX *mem_ctx,
 				    ival(state->cmd->params[1]));
 		if (state->ft == NULL) {
 			tevent_req_nterror(req, NT_STATUS_INVALID_PARAMETER);
-			return tevent_req_post(req, ev);
+			return false;
 		}
 		subreq = cli_close_send(
 			state, ev, nb_state->cli, state->ft->fnum);
@@ -283,8 +361,8 @@ static struct tevent_req *nbench_cmd_send(TALLOC_CTX *mem_ctx,
 		fname = talloc_all_string_sub(
 			state, state->cmd->params[1], "client1",
 			nb_state->cliname);
-		if (tevent_req_nomem(state->ft->cp.fname, req)) {
-			return tevent_req_post(req, ev);
+		if (tevent_req_nomem(fname, req)) {
+			return false;
 		}
 		subreq = cli_mkdir_send(state, ev, nb_state->cli, fname);
 		break;
@@ -294,24 +372,65 @@ static struct tevent_req *nbench_cmd_send(TALLOC_CTX *mem_ctx,
 		fname = talloc_all_string_sub(
 			state, state->cmd->params[1], "client1",
 			nb_state->cliname);
-		if (tevent_req_nomem(state->ft->cp.fname, req)) {
-			return tevent_req_post(req, ev);
+		if (tevent_req_nomem(fname, req)) {
+			return false;
 		}
 		subreq = cli_qpathinfo_send(state, ev, nb_state->cli, fname,
 					    ival(state->cmd->params[2]),
 					    0, CLI_BUFFER_SIZE);
 		break;
 	}
+	case NBENCH_CMD_READX: {
+		size_t size = ival(state->cmd->params[3]);
+
+		state->ft = ft_find(state->state->ftable,
+				    ival(state->cmd->params[1]));
+		if (state->ft == NULL) {
+			tevent_req_nterror(req, NT_STATUS_INVALID_PARAMETER);
+			return false;
+		}
+		state->buf = talloc_array(state, uint8_t, size);
+		if (tevent_req_nomem(state->buf, req)) {
+			return false;
+		}
+		subreq = cli_read_send(
+			state, ev, nb_state->cli, state->ft->fnum,
+			(char *)state->buf, ival(state->cmd->params[2]), size);
+		break;
+	}
+	case NBENCH_CMD_WRITEX: {
+		size_t size = ival(state->cmd->params[3]);
+
+		state->ft = ft_find(state->state->ftable,
+				    ival(state->cmd->params[1]));
+		if (state->ft == NULL) {
+			tevent_req_nterror(req, NT_STATUS_INVALID_PARAMETER);
+			return false;
+		}
+		state->buf = talloc_zero_array(state, uint8_t, size);
+		if (tevent_req_nomem(state->buf, req)) {
+			return false;
+		}
+		subreq = cli_writeall_send(
+			state, ev, nb_state->cli, state->ft->fnum, 0,
+			state->buf, ival(state->cmd->params[2]), size);
+		break;
+	}
 	default:
-		tevent_req_nterror(req, NT_STATUS_NOT_IMPLEMENTED);
-		return tevent_req_post(req, ev);
+		/*
+		 * Converted captures contain commands we can't replay,
+		 * just skip them
+		 */
+		DBG_DEBUG("Skipping %s\n", state->cmd->params[0]);
+		tevent_req_done(req);
+		return false;
 	}
 
 	if (tevent_req_nomem(subreq, req)) {
-		return tevent_req_post(req, ev);
+		return false;
 	}
 	tevent_req_set_callback(subreq, nbench_cmd_done, req);
-	return req;
+	return true;
 }
 
 static bool status_wrong(struct tevent_req *req, NTSTATUS expected,
@@ -378,6 +497,34 @@ static void nbench_cmd_done(struct tevent_req *subreq)
 		}
 		break;
 	}
+	case NBENCH_CMD_READX: {
+		size_t nread = 0;
+
+		status = cli_read_recv(subreq, &nread);
+		TALLOC_FREE(subreq);
+		if (status_wrong(req, state->cmd->status, status)) {
+			return;
+		}
+		if (nbstate->bw_report != NULL) {
+			nbstate->bw_report(nread, 0,
+					   nbstate->bw_report_private);
+		}
+		break;
+	}
+	case NBENCH_CMD_WRITEX: {
+		size_t nwritten = 0;
+
+		status = cli_writeall_recv(subreq, &nwritten);
+		TALLOC_FREE(subreq);
+		if (status_wrong(req, state->cmd->status, status)) {
+			return;
+		}
+		if (nbstate->bw_report != NULL) {
+			nbstate->bw_report(0, nwritten,
+					   nbstate->bw_report_private);
+		}
+		break;
+	}
 	default:
 		break;
 	}
@@ -410,6 +557,7 @@ static struct tevent_req *nbench_send(
 	state->loadfile = loadfile;
 	state->bw_report = bw_report;
 	state->bw_report_private = bw_report_private;
+	state->start = timeval_current();
 
 	subreq = nbench_cmd_send(state, ev, state);
 	if (tevent_req_nomem(subreq, req)) {
@@ -450,51 +598,93 @@ static NTSTATUS nbench_recv(struct tevent_req *req)
 	return tevent_req_simple_recv_ntstatus(req);
 }
 
+/*
+ * Run torture_nprocs clients at the same time, each on its own
+ * connection. Client N replays clientN.txt if it exists, so per-connection
+ * loadfiles converted from a capture keep their concurrency. Otherwise
+ * all clients replay client.txt.
+ */
 bool run_nbench2(int dummy)
 {
 	TALLOC_CTX *frame = talloc_stackframe();
 	struct tevent_context *ev;
-	struct cli_state *cli = NULL;
-	FILE *loadfile;
+	struct cli_state **clis = NULL;
+	FILE **loadfiles = NULL;
+	struct tevent_req **reqs = NULL;
 	bool ret = false;
-	struct tevent_req *req;
 	NTSTATUS status;
+	int i;
 
-	loadfile = fopen("client.txt", "r");
-	if (loadfile == NULL) {
-		fprintf(stderr, "Could not open \"client.txt\": %s\n",
-			strerror(errno));
+	clis = talloc_zero_array(frame, struct cli_state *, torture_nprocs);
+	loadfiles = talloc_zero_array(frame, FILE *, torture_nprocs);
+	reqs = talloc_zero_array(frame, struct tevent_req *, torture_nprocs);
+	if ((clis == NULL) || (loadfiles == NULL) || (reqs == NULL)) {
+		TALLOC_FREE(frame);
 		return false;
 	}
-	ev = samba_tevent_context_init(talloc_tos());
+
+	ev = samba_tevent_context_init(frame);
 	if (ev == NULL) {
 		goto fail;
 	}
-	if (!torture_open_connection(&cli, 0)) {
-		goto fail;
-	}
 
-	req = nbench_send(talloc_tos(), ev, cli, "client1", loadfile,
-			  NULL, NULL);
-	if (req == NULL) {
-		goto fail;
-	}
-	if (!tevent_req_poll(req, ev)) {
-		goto fail;
+	for (i=0; i<torture_nprocs; i++) {
+		char *cliname = NULL;
+		char *fname = NULL;
+
+		cliname = talloc_asprintf(frame, "client%d", i+1);
+		fname = talloc_asprintf(frame, "%s.txt", cliname);
+		if ((cliname == NULL) || (fname == NULL)) {
+			goto fail;
+		}
+
+		loadfiles[i] = fopen(fname, "r");
+		if (loadfiles[i] == NULL) {
+			fname = talloc_strdup(frame, "client.txt");
+			if (fname == NULL) {
+				goto fail;
+			}
+			loadfiles[i] = fopen(fname, "r");
+		}
+		if (loadfiles[i] == NULL) {
+			fprintf(stderr, "Could not open \"%s\": %s\n",
+				fname, strerror(errno));
+			goto fail;
+		}
+
+		if (!torture_open_connection(&clis[i], i)) {
+			goto fail;
+		}
+
+		reqs[i] = nbench_send(frame, ev, clis[i], cliname,
+				      loadfiles[i], NULL, NULL);
+		if (reqs[i] == NULL) {
+			goto fail;
+		}
 	}
-	status = nbench_recv(req);
-	TALLOC_FREE(req);
-	printf("nbench returned %s\n", nt_errstr(status));
 
 	ret = true;
-fail:
-	if (cli != NULL) {
-		torture_close_connection(cli);
+
+	for (i=0; i<torture_nprocs; i++) {
+		if (!tevent_req_poll(reqs[i], ev)) {
+			ret = false;
+			goto fail;
+		}
+		status = nbench_recv(reqs[i]);
+		TALLOC_FREE(reqs[i]);
+		printf("client%d: nbench returned %s\n", i+1,
+		       nt_errstr(status));
 	}
-	TALLOC_FREE(ev);
-	if (loadfile != NULL) {
-		fclose(loadfile);
-		loadfile = NULL;
+
+fail:
+	for (i=0; i<torture_nprocs; i++) {
+		TALLOC_FREE(reqs[i]);
+		if (clis[i] != NULL) {
+			torture_close_connection(clis[i]);
+		}
+		if (loadfiles[i] != NULL) {
+			fclose(loadfiles[i]);
+		}
 	}
 	TALLOC_FREE(frame);
 	return ret;
@@ -102,6 +102,7 @@ bool run_smb2_multi_channel(int dummy);
 bool run_smb2_session_reauth(int dummy);
 bool run_smb2_ftruncate(int dummy);
 bool run_smb2_dir_fsync(int dummy);
+bool run_smb2_durable_reconnect(int dummy);
 bool run_chain3(int dummy);
 bool run_local_conv_auth_info(int dummy);
 bool run_local_sprintf_append(int dummy);
@@ -114,10 +115,14 @@ bool run_notify_bench3(int dummy);
 bool run_dbwrap_watch1(int dummy);
 bool run_dbwrap_watch2(int dummy);
 bool run_dbwrap_do_locked1(int dummy);
+bool run_dbwrap_shm1(int dummy);
+bool run_brlock_index(int dummy);
 bool run_idmap_tdb_common_test(int dummy);
 bool run_local_dbwrap_ctdb(int dummy);
 bool run_qpathinfo_bufsize(int dummy);
 bool run_bench_pthreadpool(int dummy);
+bool run_bench_pthreadpool_prio(int dummy);
+bool run_bench_dbwrap_do_locked(int dummy);
 bool run_messaging_read1(int dummy);
 bool run_messaging_read2(int dummy);
 bool run_messaging_read3(int dummy);
@@ -135,8 +140,10 @@ bool run_g_lock3(int dummy);
 bool run_g_lock4(int dummy);
 bool run_g_lock5(int dummy);
 bool run_g_lock6(int dummy);
+bool run_g_lock7(int dummy);
 bool run_g_lock_ping_pong(int dummy);
 bool run_local_namemap_cache1(int dummy);
 bool run_hidenewfiles(int dummy);
+bool run_lp_reload1(int dummy);
 
 #endif /* __TORTURE_H__ */
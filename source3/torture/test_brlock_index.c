@@ -0,0 +1,519 @@
+/*
+ * Unix SMB/CIFS implementation.
+ * Test the byte range lock index
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "includes.h"
+#include "torture/proto.h"
+#include "locking/proto.h"
+#include "messages.h"
+
+/*
+ * Every lock and unlock below is followed by brl_index_check() for all
+ * combinations of these, comparing the index against a linear scan.
+ */
+
+static const br_off brlock_index_starts[] = {
+	0, 1, 9, 10, 11, 39, 40, 45, 49, 50, 51, 59, 60, 99, 100, 101,
+	104, 105, 109, 110, 119, 120, 125, 150, 159, 160,
+	0xEF000000,
+	UINT64_MAX-99, UINT64_MAX-20, UINT64_MAX-10, UINT64_MAX-9,
+	UINT64_MAX-5, UINT64_MAX-4, UINT64_MAX-1, UINT64_MAX,
+};
+
+static const br_off brlock_index_sizes[] = {
+	0, 1, 2, 5, 10, 15, 20, 50, 100, UINT64_MAX-10, UINT64_MAX,
+};
+
+struct brlock_index_state {
+	struct messaging_context *msg;
+	struct server_id self;
+	struct files_struct *fsp;
+	struct byte_range_lock *br_lck;
+};
+
+static bool brlock_index_verify(struct brlock_index_state *state,
+				const char *step)
+{
+	static const enum brl_type types[] = { READ_LOCK, WRITE_LOCK };
+	static const enum brl_flavour flavs[] = { WINDOWS_LOCK, POSIX_LOCK };
+	size_t s, z, t, f;
+	uint64_t smblctx;
+
+	for (s = 0; s < ARRAY_SIZE(brlock_index_starts); s++) {
+	for (z = 0; z < ARRAY_SIZE(brlock_index_sizes); z++) {
+	for (t = 0; t < ARRAY_SIZE(types); t++) {
+	for (f = 0; f < ARRAY_SIZE(flavs); f++) {
+	for (smblctx = 1; smblctx <= 3; smblctx++) {
+		struct lock_struct probe = {
+			.context.smblctx = smblctx,
+			.context.pid = state->self,
+			.context.tid = state->fsp->conn->cnum,
+			.start = brlock_index_starts[s],
+			.size = brlock_index_sizes[z],
+			.fnum = state->fsp->fnum,
+			.lock_type = types[t],
+			.lock_flav = flavs[f],
+		};
+		bool ok;
+
+		ok = brl_index_check(state->br_lck, &probe);
+		if (!ok) {
+			fprintf(stderr, "%s: index check failed for "
+				"%ju/%ju %s %s\n", step,
+				(uintmax_t)probe.start,
+				(uintmax_t)probe.size,
+				lock_type_name(probe.lock_type),
+				lock_flav_name(probe.lock_flav));
+			return false;
+		}
+	}
+	}
+	}
+	}
+	}
+
+	return true;
+}
+
+/*
+ * brl_lock() sends Windows locks through the VFS, we don't have one
+ * here. Call the default implementation directly.
+ */
+
+static NTSTATUS brlock_index_lock(struct brlock_index_state *state,
+				  uint64_t smblctx,
+				  br_off start,
+				  br_off size,
+				  enum brl_type lock_type,
+				  enum brl_flavour lock_flav)
+{
+	struct lock_struct lock = {
+		.context.smblctx = smblctx,
+		.context.pid = state->self,
+		.context.tid = state->fsp->conn->cnum,
+		.start = start,
+		.size = size,
+		.fnum = state->fsp->fnum,
+		.lock_type = lock_type,
+		.lock_flav = lock_flav,
+	};
+	NTSTATUS status;
+
+	if (lock_flav == WINDOWS_LOCK) {
+		status = brl_lock_windows_default(state->br_lck, &lock, false);
+	} else {
+		status = brl_lock(state->msg, state->br_lck, smblctx,
+				  state->self, start, size, lock_type,
+				  lock_flav, false, NULL);
+	}
+	return status;
+}
+
+static bool brlock_index_unlock(struct brlock_index_state *state,
+				uint64_t smblctx,
+				br_off start,
+				br_off size,
+				enum brl_flavour lock_flav)
+{
+	struct lock_struct lock = {
+		.context.smblctx = smblctx,
+		.context.pid = state->self,
+		.context.tid = state->fsp->conn->cnum,
+		.start = start,
+		.size = size,
+		.fnum = state->fsp->fnum,
+		.lock_type = UNLOCK_LOCK,
+		.lock_flav = lock_flav,
+	};
+	bool ok;
+
+	if (lock_flav == WINDOWS_LOCK) {
+		ok = brl_unlock_windows_default(state->msg, state->br_lck,
+						&lock);
+	} else {
+		ok = brl_unlock(state->msg, state->br_lck, smblctx,
+				state->self, start, size, lock_flav);
+	}
+	return ok;
+}
+
+struct brlock_index_op {
+	bool unlock;
+	uint64_t smblctx;
+	br_off start;
+	br_off size;
+	enum brl_type lock_type;
+	enum brl_flavour lock_flav;
+	bool granted;
+	unsigned num_locks;
+};
+
+static bool brlock_index_run(struct brlock_index_state *state,
+			     const char *name,
+			     const struct brlock_index_op *ops,
+			     size_t num_ops)
+{
+	size_t i;
+	bool ok;
+
+	for (i = 0; i < num_ops; i++) {
+		const struct brlock_index_op *op = &ops[i];
+		char step[64];
+		unsigned num_locks;
+
+		snprintf(step, sizeof(step), "%s step %zu", name, i);
+
+		if (op->unlock) {
+			ok = brlock_index_unlock(state, op->smblctx,
+						 op->start, op->size,
+						 op->lock_flav);
+		} else {
+			NTSTATUS status = brlock_index_lock(
+				state, op->smblctx, op->start, op->size,
+				op->lock_type, op->lock_flav);
+			ok = NT_STATUS_IS_OK(status);
+		}
+		if (ok != op->granted) {
+			fprintf(stderr, "%s: %s %ju/%ju returned %d, "
+				"expected %d\n", step,
+				op->unlock ? "unlock" : "lock",
+				(uintmax_t)op->start, (uintmax_t)op->size,
+				(int)ok, (int)op->granted);
+			return false;
+		}
+
+		num_locks = brl_num_locks(state->br_lck);
+		if (num_locks != op->num_locks) {
+			fprintf(stderr, "%s: %u locks, expected %u\n",
+				step, num_locks, op->num_locks);
+			return false;
+		}
+
+		ok = brlock_index_verify(state, step);
+		if (!ok) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+#define LOCK(ctx, start, size, type, flav, granted, num) \
+	{ false, ctx, start, size, type, flav, granted, num }
+#define UNLOCK(ctx, start, size, flav, granted, num) \
+	{ true, ctx, start, size, UNLOCK_LOCK, flav, granted, num }
+
+/*
+ * A zero sized lock only conflicts with ranges strictly containing its
+ * start.
+ */
+static const struct brlock_index_op brlock_index_zero[] = {
+	LOCK(2, 50, 0, WRITE_LOCK, WINDOWS_LOCK, true, 1),
+	LOCK(2, 100, 0, READ_LOCK, WINDOWS_LOCK, true, 2),
+	LOCK(1, 45, 10, WRITE_LOCK, WINDOWS_LOCK, false, 2),
+	LOCK(1, 49, 2, READ_LOCK, WINDOWS_LOCK, false, 2),
+	LOCK(1, 50, 10, WRITE_LOCK, WINDOWS_LOCK, true, 3),
+	LOCK(1, 40, 10, WRITE_LOCK, WINDOWS_LOCK, true, 4),
+	LOCK(3, 50, 0, WRITE_LOCK, WINDOWS_LOCK, true, 5),
+	LOCK(3, 99, 2, READ_LOCK, WINDOWS_LOCK, true, 6),
+	LOCK(3, 99, 2, WRITE_LOCK, WINDOWS_LOCK, false, 6),
+	LOCK(1, 102, 1, WRITE_LOCK, POSIX_LOCK, true, 7),
+	LOCK(1, 99, 3, WRITE_LOCK, POSIX_LOCK, false, 7),
+	UNLOCK(2, 50, 0, WINDOWS_LOCK, true, 6),
+	LOCK(1, 45, 10, WRITE_LOCK, WINDOWS_LOCK, false, 6),
+	UNLOCK(3, 50, 0, WINDOWS_LOCK, true, 5),
+	LOCK(3, 45, 5, WRITE_LOCK, WINDOWS_LOCK, false, 5),
+	UNLOCK(1, 40, 10, WINDOWS_LOCK, true, 4),
+	UNLOCK(1, 50, 10, WINDOWS_LOCK, true, 3),
+	UNLOCK(1, 102, 1, POSIX_LOCK, true, 2),
+	UNLOCK(3, 99, 2, WINDOWS_LOCK, true, 1),
+	UNLOCK(2, 100, 0, WINDOWS_LOCK, true, 0),
+};
+
+/*
+ * Ranges up to the very last byte make "start + size" wrap to 0,
+ * brl_overlap() special cases identical ranges for this. Ranges really
+ * wrapping past 2^64 are rejected.
+ */
+static const struct brlock_index_op brlock_index_wrap[] = {
+	LOCK(2, UINT64_MAX-9, 10, WRITE_LOCK, WINDOWS_LOCK, true, 1),
+	LOCK(1, UINT64_MAX-9, 10, READ_LOCK, WINDOWS_LOCK, false, 1),
+	LOCK(1, UINT64_MAX-5, 100, WRITE_LOCK, WINDOWS_LOCK, false, 1),
+	LOCK(1, UINT64_MAX-5, 100, WRITE_LOCK, POSIX_LOCK, false, 1),
+	LOCK(2, UINT64_MAX-9, 10, READ_LOCK, WINDOWS_LOCK, true, 2),
+	LOCK(3, UINT64_MAX-20, 5, READ_LOCK, WINDOWS_LOCK, true, 3),
+	LOCK(3, 0, 1, WRITE_LOCK, WINDOWS_LOCK, true, 4),
+	LOCK(1, UINT64_MAX-99, 50, WRITE_LOCK, POSIX_LOCK, true, 5),
+	LOCK(1, UINT64_MAX-49, 29, WRITE_LOCK, POSIX_LOCK, true, 5),
+	LOCK(3, UINT64_MAX-60, 5, READ_LOCK, WINDOWS_LOCK, false, 5),
+	LOCK(1, 0, 2, READ_LOCK, WINDOWS_LOCK, false, 5),
+	UNLOCK(1, UINT64_MAX-99, 79, POSIX_LOCK, true, 4),
+	UNLOCK(3, 0, 1, WINDOWS_LOCK, true, 3),
+	UNLOCK(3, UINT64_MAX-20, 5, WINDOWS_LOCK, true, 2),
+	UNLOCK(2, UINT64_MAX-9, 10, WINDOWS_LOCK, true, 1),
+	UNLOCK(2, UINT64_MAX-9, 10, WINDOWS_LOCK, true, 0),
+	UNLOCK(2, UINT64_MAX-9, 10, WINDOWS_LOCK, false, 0),
+};
+
+/*
+ * Locks with the same start stay in insertion order, so an unlock
+ * removes the oldest matching one: The WRITE lock goes first.
+ */
+static const struct brlock_index_op brlock_index_stacked[] = {
+	LOCK(1, 100, 10, WRITE_LOCK, WINDOWS_LOCK, true, 1),
+	LOCK(1, 100, 10, READ_LOCK, WINDOWS_LOCK, true, 2),
+	LOCK(1, 100, 10, READ_LOCK, WINDOWS_LOCK, true, 3),
+	LOCK(1, 100, 5, READ_LOCK, WINDOWS_LOCK, true, 4),
+	LOCK(3, 100, 0, READ_LOCK, WINDOWS_LOCK, true, 5),
+	LOCK(2, 100, 10, READ_LOCK, WINDOWS_LOCK, false, 5),
+	UNLOCK(1, 100, 10, WINDOWS_LOCK, true, 4),
+	LOCK(2, 100, 10, READ_LOCK, WINDOWS_LOCK, true, 5),
+	LOCK(2, 100, 10, WRITE_LOCK, WINDOWS_LOCK, false, 5),
+	UNLOCK(2, 100, 10, WINDOWS_LOCK, true, 4),
+	UNLOCK(1, 100, 5, WINDOWS_LOCK, true, 3),
+	UNLOCK(1, 100, 10, WINDOWS_LOCK, true, 2),
+	UNLOCK(1, 100, 10, WINDOWS_LOCK, true, 1),
+	UNLOCK(1, 100, 10, WINDOWS_LOCK, false, 1),
+	LOCK(2, 100, 10, WRITE_LOCK, WINDOWS_LOCK, true, 2),
+	UNLOCK(2, 100, 10, WINDOWS_LOCK, true, 1),
+	UNLOCK(3, 100, 0, WINDOWS_LOCK, true, 0),
+};
+
+/*
+ * POSIX locks of one context are split and merged, the pieces have to
+ * end up sorted between the other context's locks.
+ */
+static const struct brlock_index_op brlock_index_posix[] = {
+	LOCK(2, 150, 10, WRITE_LOCK, WINDOWS_LOCK, true, 1),
+	LOCK(2, 45, 0, READ_LOCK, WINDOWS_LOCK, true, 2),
+	LOCK(1, 0, 100, WRITE_LOCK, POSIX_LOCK, false, 2),
+	UNLOCK(2, 45, 0, WINDOWS_LOCK, true, 1),
+	LOCK(1, 0, 100, WRITE_LOCK, POSIX_LOCK, true, 2),
+	LOCK(1, 40, 20, READ_LOCK, POSIX_LOCK, true, 4),
+	UNLOCK(1, 10, 10, POSIX_LOCK, true, 5),
+	UNLOCK(1, 50, 20, POSIX_LOCK, true, 5),
+	LOCK(3, 55, 10, WRITE_LOCK, POSIX_LOCK, true, 6),
+	LOCK(3, 45, 10, WRITE_LOCK, POSIX_LOCK, false, 6),
+	LOCK(3, 10, 10, READ_LOCK, POSIX_LOCK, true, 7),
+	LOCK(1, 0, 50, WRITE_LOCK, POSIX_LOCK, false, 7),
+	UNLOCK(3, 0, 200, POSIX_LOCK, true, 5),
+	LOCK(1, 0, 120, WRITE_LOCK, POSIX_LOCK, true, 2),
+	LOCK(1, 120, 10, WRITE_LOCK, POSIX_LOCK, true, 2),
+	LOCK(3, 125, 10, READ_LOCK, POSIX_LOCK, false, 2),
+	LOCK(1, 125, 30, WRITE_LOCK, POSIX_LOCK, false, 2),
+	LOCK(1, 20, 80, READ_LOCK, POSIX_LOCK, true, 4),
+	UNLOCK(1, 0, 200, POSIX_LOCK, true, 1),
+	UNLOCK(1, 0, 200, POSIX_LOCK, true, 1),
+	UNLOCK(2, 150, 10, WINDOWS_LOCK, true, 0),
+};
+
+#undef LOCK
+#undef UNLOCK
+
+/*
+ * Random operations on a small range, cleaned up at the end via the
+ * Windows locks we remember and a full POSIX unlock per context.
+ */
+static bool brlock_index_random(struct brlock_index_state *state)
+{
+	struct lock_struct held[200];
+	size_t num_held = 0;
+	unsigned i;
+	uint64_t smblctx;
+	bool ok;
+
+	for (i = 0; i < 1000; i++) {
+		uint64_t ctx = 1 + random() % 3;
+		br_off start = random() % 200;
+		br_off size = random() % 30;
+		enum brl_type type = (random() % 2) ? READ_LOCK : WRITE_LOCK;
+		char step[64];
+
+		snprintf(step, sizeof(step), "random step %u", i);
+
+		if (random() % 2) {
+			if (size == 0) {
+				size = 1;
+			}
+			if (random() % 3 == 0) {
+				brlock_index_unlock(state, ctx, start, size,
+						    POSIX_LOCK);
+			} else {
+				brlock_index_lock(state, ctx, start, size,
+						  type, POSIX_LOCK);
+			}
+		} else if ((num_held > 0) && (random() % 3 == 0)) {
+			size_t idx = random() % num_held;
+			struct lock_struct *h = &held[idx];
+
+			ok = brlock_index_unlock(state, h->context.smblctx,
+						 h->start, h->size,
+						 WINDOWS_LOCK);
+			if (!ok) {
+				fprintf(stderr, "%s: unlock of %ju/%ju "
+					"failed\n", step,
+					(uintmax_t)h->start,
+					(uintmax_t)h->size);
+				return false;
+			}
+			held[idx] = held[--num_held];
+		} else if (num_held < ARRAY_SIZE(held)) {
+			NTSTATUS status = brlock_index_lock(
+				state, ctx, start, size, type, WINDOWS_LOCK);
+			if (NT_STATUS_IS_OK(status)) {
+				held[num_held++] = (struct lock_struct) {
+					.context.smblctx = ctx,
+					.start = start,
+					.size = size,
+				};
+			}
+		}
+
+		ok = brlock_index_verify(state, step);
+		if (!ok) {
+			return false;
+		}
+	}
+
+	for (i = 0; i < num_held; i++) {
+		ok = brlock_index_unlock(state, held[i].context.smblctx,
+					 held[i].start, held[i].size,
+					 WINDOWS_LOCK);
+		if (!ok) {
+			fprintf(stderr, "final unlock of %ju/%ju failed\n",
+				(uintmax_t)held[i].start,
+				(uintmax_t)held[i].size);
+			return false;
+		}
+	}
+	for (smblctx = 1; smblctx <= 3; smblctx++) {
+		brlock_index_unlock(state, smblctx, 0, 1000, POSIX_LOCK);
+	}
+
+	if (brl_num_locks(state->br_lck) != 0) {
+		fprintf(stderr, "%u locks left after random test\n",
+			brl_num_locks(state->br_lck));
+		return false;
+	}
+
+	return true;
+}
+
+bool run_brlock_index(int dummy)
+{
+	struct brlock_index_state state = { .msg = NULL };
+	struct connection_struct *conn = NULL;
+	NTSTATUS status;
+	bool ret = false;
+	bool ok;
+
+	state.msg = global_messaging_context();
+	if (state.msg == NULL) {
+		fprintf(stderr, "messaging_init failed\n");
+		return false;
+	}
+	state.self = messaging_server_id(state.msg);
+
+	/* Only test brlock.tdb, don't touch real fcntl locks */
+	lp_set_cmdline("posix locking", "no");
+
+	brl_init(false);
+
+	conn = talloc_zero(talloc_tos(), struct connection_struct);
+	if (conn == NULL) {
+		goto fail;
+	}
+	conn->cnum = 1;
+	conn->params = talloc_zero(conn, struct share_params);
+	if (conn->params == NULL) {
+		goto fail;
+	}
+	conn->params->service = -1;
+
+	state.fsp = talloc_zero(conn, struct files_struct);
+	if (state.fsp == NULL) {
+		goto fail;
+	}
+	state.fsp->conn = conn;
+	state.fsp->fnum = 1;
+	state.fsp->file_id = (struct file_id) {
+		.devid = UINT64_MAX, .inode = getpid(),
+	};
+
+	/*
+	 * Dropping the last lock deletes the record in brlock.tdb, so
+	 * make sure there is one. Then run everything on one
+	 * byte_range_lock without flushing.
+	 */
+	state.br_lck = brl_get_locks(conn, state.fsp);
+	if (state.br_lck == NULL) {
+		fprintf(stderr, "brl_get_locks failed\n");
+		goto fail;
+	}
+	status = brlock_index_lock(&state, 1, 0, 1, READ_LOCK, WINDOWS_LOCK);
+	if (!NT_STATUS_IS_OK(status)) {
+		fprintf(stderr, "brlock_index_lock failed: %s\n",
+			nt_errstr(status));
+		goto fail;
+	}
+	TALLOC_FREE(state.br_lck);
+
+	state.br_lck = brl_get_locks(conn, state.fsp);
+	if (state.br_lck == NULL) {
+		fprintf(stderr, "brl_get_locks failed\n");
+		goto fail;
+	}
+	ok = brlock_index_unlock(&state, 1, 0, 1, WINDOWS_LOCK);
+	if (!ok) {
+		fprintf(stderr, "brlock_index_unlock failed\n");
+		goto fail;
+	}
+
+	ok = brlock_index_run(&state, "zero",
+			      brlock_index_zero,
+			      ARRAY_SIZE(brlock_index_zero));
+	if (!ok) {
+		goto fail;
+	}
+	ok = brlock_index_run(&state, "wrap",
+			      brlock_index_wrap,
+			      ARRAY_SIZE(brlock_index_wrap));
+	if (!ok) {
+		goto fail;
+	}
+	ok = brlock_index_run(&state, "stacked",
+			      brlock_index_stacked,
+			      ARRAY_SIZE(brlock_index_stacked));
+	if (!ok) {
+		goto fail;
+	}
+	ok = brlock_index_run(&state, "posix",
+			      brlock_index_posix,
+			      ARRAY_SIZE(brlock_index_posix));
+	if (!ok) {
+		goto fail;
+	}
+	ok = brlock_index_random(&state);
+	if (!ok) {
+		goto fail;
+	}
+
+	ret = true;
+fail:
+	TALLOC_FREE(conn);
+	return ret;
+}
@@ -215,53 +215,68 @@ static bool create_stale_share_mode_entry(const char *fname,
 	return true;
 }
 
-static bool corrupt_dummy(struct share_mode_data *d)
+static bool corrupt_dummy(struct share_mode_lock *lck)
 {
 	return true;
 }
 
-static bool invalidate_sharemode(struct share_mode_data *d)
+static bool set_op_type_fn(struct share_mode_entry *e,
+			   bool *modified,
+			   void *private_data)
 {
-	d->share_modes[0].op_type =
-		OPLOCK_EXCLUSIVE|OPLOCK_BATCH|OPLOCK_LEVEL_II;
-	d->modified = true;
-	return true;
+	uint16_t *op_type = private_data;
+
+	e->op_type = *op_type;
+	*modified = true;
+	return false;
 }
 
-static bool duplicate_entry(struct share_mode_data *d, int i)
+static bool invalidate_sharemode(struct share_mode_lock *lck)
 {
-	struct share_mode_entry *tmp;
+	uint16_t op_type = OPLOCK_EXCLUSIVE|OPLOCK_BATCH|OPLOCK_LEVEL_II;
 
-	if (i >= d->num_share_modes) {
-		return false;
-	}
+	return share_mode_forall_entries(lck, set_op_type_fn, &op_type);
+}
 
-	tmp = talloc_realloc(d, d->share_modes, struct share_mode_entry,
-			     d->num_share_modes + 1);
-	if (tmp == NULL) {
-		return false;
-	}
-	d->share_modes = tmp;
-	d->num_share_modes += 1;
-	d->share_modes[d->num_share_modes-1] = d->share_modes[i];
-	d->modified = true;
+static bool copy_entry_fn(struct share_mode_entry *e,
+			  bool *modified,
+			  void *private_data)
+{
+	struct share_mode_entry *copy = private_data;
+
+	*copy = *e;
 	return true;
 }
 
-static bool create_duplicate_batch(struct share_mode_data *d)
+static bool create_duplicate_batch(struct share_mode_lock *lck)
 {
-	if (d->num_share_modes != 1) {
+	struct share_mode_entry e;
+	uint16_t op_type = OPLOCK_BATCH;
+	bool ok;
+
+	if (lck->data->num_share_modes != 1) {
 		return false;
 	}
-	d->share_modes[0].op_type = OPLOCK_BATCH;
-	if (!duplicate_entry(d, 0)) {
+	ok = share_mode_forall_entries(lck, set_op_type_fn, &op_type);
+	if (!ok) {
 		return false;
 	}
-	return true;
+	ok = share_mode_forall_entries(lck, copy_entry_fn, &e);
+	if (!ok) {
+		return false;
+	}
+
+	/*
+	 * Entries are keyed by pid and share_file_id, a second batch
+	 * oplock needs a different share_file_id.
+	 */
+	e.share_file_id += 1;
+
+	return share_mode_entry_add(lck, &e);
 }
 
 struct corruption_fns {
-	bool (*fn)(struct share_mode_data *d);
+	bool (*fn)(struct share_mode_lock *lck);
 	const char *descr;
 };
 
@@ -310,7 +325,7 @@ bool run_cleanup3(int dummy)
 			return false;
 		}
 
-		fns[i].fn(lck->data);
+		fns[i].fn(lck);
 
 		TALLOC_FREE(lck);
 
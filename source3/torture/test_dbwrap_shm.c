@@ -0,0 +1,466 @@
+/*
+ * Unix SMB/CIFS implementation.
+ * Test dbwrap_shm backend
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "includes.h"
+#include "torture/proto.h"
+#include "system/filesys.h"
+#include "lib/dbwrap/dbwrap.h"
+#include "lib/dbwrap/dbwrap_shm.h"
+#include "lib/util/sys_rw.h"
+#include "lib/util/util_tdb.h"
+#include "source3/include/util_tdb.h"
+
+/*
+ * Pull in the implementation to reach the bucket locking internals
+ */
+#include "lib/dbwrap/dbwrap_shm.c"
+
+static int dbwrap_shm1_count_fn(struct db_record *rec, void *private_data)
+{
+	return 0;
+}
+
+static bool dbwrap_shm1_check(struct db_context *db, TDB_DATA key,
+			      TDB_DATA value)
+{
+	TDB_DATA data;
+	NTSTATUS status;
+	int ret;
+
+	status = dbwrap_fetch(db, talloc_tos(), key, &data);
+	if (!NT_STATUS_IS_OK(status)) {
+		fprintf(stderr, "dbwrap_fetch failed: %s\n",
+			nt_errstr(status));
+		return false;
+	}
+	ret = tdb_data_cmp(data, value);
+	TALLOC_FREE(data.dptr);
+	if (ret != 0) {
+		fprintf(stderr, "value mismatch\n");
+		return false;
+	}
+	return true;
+}
+
+static pid_t dbwrap_shm1_fork_locker(struct db_context *db, TDB_DATA key,
+				     int ready_fd, int cmd_fd)
+{
+	struct db_record *rec;
+	char c = 0;
+	pid_t child;
+
+	child = fork();
+	if (child != 0) {
+		return child;
+	}
+
+	rec = dbwrap_fetch_locked(db, db, key);
+	if (rec == NULL) {
+		_exit(1);
+	}
+	sys_write_v(ready_fd, &c, 1);
+	if (sys_read(cmd_fd, &c, 1) != 1) {
+		_exit(2);
+	}
+	TALLOC_FREE(rec);
+	sys_write_v(ready_fd, &c, 1);
+	if (sys_read(cmd_fd, &c, 1) != 1) {
+		_exit(3);
+	}
+	_exit(0);
+}
+
+/*
+ * A waiter samples seq and owner while P1 holds the lock. P1 unlocks,
+ * P2 locks and P1 exits. The waiter must not take over the lock from
+ * P2 just because the owner it sampled is dead now.
+ */
+static bool dbwrap_shm1_stale_take_over(struct db_context *db)
+{
+	struct db_shm_ctx *ctx = talloc_get_type_abort(
+		db->private_data, struct db_shm_ctx);
+	TDB_DATA key = string_term_tdb_data("stale");
+	uint32_t home = db_shm_hash(key) & ctx->mask;
+	struct db_shm_bucket *b = &ctx->buckets[home];
+	int ready[2] = { -1, -1 };
+	int cmd1[2] = { -1, -1 };
+	int cmd2[2] = { -1, -1 };
+	pid_t p1 = -1, p2 = -1;
+	uint64_t seq;
+	uint32_t owner;
+	bool ret = false;
+	char c = 0;
+
+	if ((pipe(ready) == -1) || (pipe(cmd1) == -1) || (pipe(cmd2) == -1)) {
+		perror("pipe");
+		goto fail;
+	}
+
+	p1 = dbwrap_shm1_fork_locker(db, key, ready[1], cmd1[0]);
+	if (p1 == -1) {
+		perror("fork");
+		goto fail;
+	}
+	if (sys_read(ready[0], &c, 1) != 1) {
+		fprintf(stderr, "p1 did not lock\n");
+		goto fail;
+	}
+
+	seq = db_shm_load(&b->seq);
+	owner = b->owner;
+	if (((seq & DB_SHM_LOCKED) == 0) || (owner != (uint32_t)p1)) {
+		fprintf(stderr, "bucket not locked by p1: %"PRIu64"/%"PRIu32
+			"\n", seq, owner);
+		goto fail;
+	}
+
+	sys_write_v(cmd1[1], &c, 1);
+	if (sys_read(ready[0], &c, 1) != 1) {
+		fprintf(stderr, "p1 did not unlock\n");
+		goto fail;
+	}
+
+	p2 = dbwrap_shm1_fork_locker(db, key, ready[1], cmd2[0]);
+	if (p2 == -1) {
+		perror("fork");
+		goto fail;
+	}
+	if (sys_read(ready[0], &c, 1) != 1) {
+		fprintf(stderr, "p2 did not lock\n");
+		goto fail;
+	}
+
+	if (db_shm_load(&b->seq) == seq) {
+		fprintf(stderr, "unlock and lock left seq unchanged\n");
+		goto fail;
+	}
+
+	sys_write_v(cmd1[1], &c, 1);
+	if (waitpid(p1, NULL, 0) != p1) {
+		perror("waitpid");
+		goto fail;
+	}
+	p1 = -1;
+
+	if (db_shm_bucket_take_over(ctx, home, seq, owner)) {
+		fprintf(stderr, "took over the lock held by p2\n");
+		goto fail;
+	}
+	if (b->owner != (uint32_t)p2) {
+		fprintf(stderr, "owner is %"PRIu32", expected p2\n",
+			b->owner);
+		goto fail;
+	}
+
+	ret = true;
+fail:
+	if (p1 != -1) {
+		kill(p1, SIGKILL);
+		waitpid(p1, NULL, 0);
+	}
+	if (p2 != -1) {
+		sys_write_v(cmd2[1], &c, 1);
+		sys_write_v(cmd2[1], &c, 1);
+		waitpid(p2, NULL, 0);
+	}
+	if (ready[0] != -1) {
+		close(ready[0]);
+		close(ready[1]);
+	}
+	if (cmd1[0] != -1) {
+		close(cmd1[0]);
+		close(cmd1[1]);
+	}
+	if (cmd2[0] != -1) {
+		close(cmd2[0]);
+		close(cmd2[1]);
+	}
+	return ret;
+}
+
+/*
+ * Children increment a counter under the record lock and exit right
+ * after unlocking, every fifth one exits while holding the lock. Dead
+ * lock holders are taken over by the waiters, that must never let two
+ * processes own the lock at the same time. A lost increment shows they
+ * did.
+ */
+static bool dbwrap_shm1_lock_handover(struct db_context *db)
+{
+	TDB_DATA key = string_term_tdb_data("counter");
+	const int num_lanes = 4;
+	const int num_children = 1000;
+	uint32_t counter;
+	int started = 0, running = 0, stored = 0;
+	NTSTATUS status;
+
+	status = dbwrap_store_uint32_bystring(db, "counter", 0);
+	if (!NT_STATUS_IS_OK(status)) {
+		fprintf(stderr, "storing counter failed: %s\n",
+			nt_errstr(status));
+		return false;
+	}
+
+	while ((started < num_children) || (running > 0)) {
+		int wstatus;
+		pid_t child;
+
+		if ((started < num_children) && (running < num_lanes)) {
+			child = fork();
+			if (child == -1) {
+				perror("fork");
+				return false;
+			}
+			if (child == 0) {
+				struct db_record *rec;
+				TDB_DATA value;
+				uint8_t buf[4];
+
+				rec = dbwrap_fetch_locked(db, db, key);
+				if (rec == NULL) {
+					_exit(1);
+				}
+				if ((started % 5) == 4) {
+					_exit(10);
+				}
+				value = dbwrap_record_get_value(rec);
+				if (value.dsize != sizeof(buf)) {
+					_exit(2);
+				}
+				SIVAL(buf, 0, IVAL(value.dptr, 0) + 1);
+				status = dbwrap_record_store(
+					rec, make_tdb_data(buf, sizeof(buf)),
+					0);
+				if (!NT_STATUS_IS_OK(status)) {
+					_exit(3);
+				}
+				TALLOC_FREE(rec);
+				_exit(0);
+			}
+			started += 1;
+			running += 1;
+			continue;
+		}
+
+		child = waitpid(-1, &wstatus, 0);
+		if (child == -1) {
+			perror("waitpid");
+			return false;
+		}
+		running -= 1;
+
+		if (!WIFEXITED(wstatus)) {
+			fprintf(stderr, "child failed: %d\n", wstatus);
+			return false;
+		}
+		switch (WEXITSTATUS(wstatus)) {
+		case 0:
+			stored += 1;
+			break;
+		case 10:
+			break;
+		default:
+			fprintf(stderr, "child failed: %d\n",
+				WEXITSTATUS(wstatus));
+			return false;
+		}
+	}
+
+	status = dbwrap_fetch_uint32_bystring(db, "counter", &counter);
+	if (!NT_STATUS_IS_OK(status)) {
+		fprintf(stderr, "fetching counter failed: %s\n",
+			nt_errstr(status));
+		return false;
+	}
+	if (counter != stored) {
+		fprintf(stderr, "counter is %"PRIu32", %d increments\n",
+			counter, stored);
+		return false;
+	}
+	return true;
+}
+
+bool run_dbwrap_shm1(int dummy)
+{
+	struct db_context *db = NULL;
+	const char *dbname = "test_dbwrap_shm.shm";
+	const uint32_t num_buckets = 16;
+	TDB_DATA key = string_term_tdb_data("key");
+	TDB_DATA value = string_term_tdb_data("value");
+	TDB_DATA child_key = string_term_tdb_data("child");
+	uint8_t buf[200];
+	bool ret = false;
+	NTSTATUS status;
+	int i, count;
+	pid_t child;
+
+	db = db_open_shm(talloc_tos(), dbname, num_buckets, 4, 4096,
+			 O_CREAT|O_RDWR, 0644, DBWRAP_LOCK_ORDER_1,
+			 DBWRAP_FLAG_NONE);
+	if (db == NULL) {
+		fprintf(stderr, "db_open_shm failed: %s\n", strerror(errno));
+		return false;
+	}
+
+	status = dbwrap_store(db, key, value, 0);
+	if (!NT_STATUS_IS_OK(status)) {
+		fprintf(stderr, "dbwrap_store failed: %s\n",
+			nt_errstr(status));
+		goto fail;
+	}
+	if (!dbwrap_shm1_check(db, key, value)) {
+		goto fail;
+	}
+
+	status = dbwrap_store(db, key, value, TDB_INSERT);
+	if (!NT_STATUS_EQUAL(status, NT_STATUS_OBJECT_NAME_COLLISION)) {
+		fprintf(stderr, "TDB_INSERT returned %s\n",
+			nt_errstr(status));
+		goto fail;
+	}
+
+	/*
+	 * Overwriting one record many times needs far more than the
+	 * 4096 bytes of heap, so this only works if replaced records
+	 * are garbage collected.
+	 */
+	memset(buf, 0, sizeof(buf));
+	for (i=0; i<1000; i++) {
+		TDB_DATA data = { .dptr = buf, .dsize = sizeof(buf) };
+
+		buf[0] = i;
+		status = dbwrap_store(db, key, data, 0);
+		if (!NT_STATUS_IS_OK(status)) {
+			fprintf(stderr, "store %d failed: %s\n", i,
+				nt_errstr(status));
+			goto fail;
+		}
+		if (!dbwrap_shm1_check(db, key, data)) {
+			goto fail;
+		}
+	}
+
+	child = fork();
+	if (child == -1) {
+		perror("fork");
+		goto fail;
+	}
+	if (child == 0) {
+		struct db_context *child_db;
+
+		/*
+		 * We are not the first to open it, so the parent's
+		 * record must survive.
+		 */
+		child_db = db_open_shm(talloc_tos(), dbname, num_buckets,
+				       4, 4096, O_RDWR, 0644,
+				       DBWRAP_LOCK_ORDER_1, DBWRAP_FLAG_NONE);
+		if (child_db == NULL) {
+			_exit(1);
+		}
+		if (!dbwrap_exists(child_db, key)) {
+			_exit(2);
+		}
+		status = dbwrap_store(child_db, child_key, value, 0);
+		if (!NT_STATUS_IS_OK(status)) {
+			_exit(3);
+		}
+		_exit(0);
+	}
+
+	{
+		int wstatus;
+
+		if (waitpid(child, &wstatus, 0) != child) {
+			perror("waitpid");
+			goto fail;
+		}
+		if (!WIFEXITED(wstatus) || (WEXITSTATUS(wstatus) != 0)) {
+			fprintf(stderr, "child failed: %d\n", wstatus);
+			goto fail;
+		}
+	}
+
+	if (!dbwrap_shm1_check(db, child_key, value)) {
+		goto fail;
+	}
+
+	if (!dbwrap_shm1_stale_take_over(db)) {
+		goto fail;
+	}
+
+	if (!dbwrap_shm1_lock_handover(db)) {
+		goto fail;
+	}
+
+	status = dbwrap_traverse_read(db, dbwrap_shm1_count_fn, NULL, &count);
+	if (!NT_STATUS_IS_OK(status) || (count != 3)) {
+		fprintf(stderr, "traverse_read returned %s, count %d\n",
+			nt_errstr(status), count);
+		goto fail;
+	}
+
+	status = dbwrap_delete(db, key);
+	if (!NT_STATUS_IS_OK(status)) {
+		fprintf(stderr, "dbwrap_delete failed: %s\n",
+			nt_errstr(status));
+		goto fail;
+	}
+	if (dbwrap_exists(db, key)) {
+		fprintf(stderr, "deleted record still exists\n");
+		goto fail;
+	}
+
+	if (dbwrap_wipe(db) != 0) {
+		fprintf(stderr, "dbwrap_wipe failed\n");
+		goto fail;
+	}
+
+	/*
+	 * All buckets can be used, including the tombstones left by
+	 * deletes, one more key does not fit.
+	 */
+	for (i=0; i<=num_buckets; i++) {
+		TDB_DATA k = { .dptr = (uint8_t *)&i, .dsize = sizeof(i) };
+
+		status = dbwrap_store(db, k, value, 0);
+		if ((i < num_buckets) && !NT_STATUS_IS_OK(status)) {
+			fprintf(stderr, "store %d failed: %s\n", i,
+				nt_errstr(status));
+			goto fail;
+		}
+	}
+	if (!NT_STATUS_EQUAL(status, NT_STATUS_INSUFFICIENT_RESOURCES)) {
+		fprintf(stderr, "store into full table returned %s\n",
+			nt_errstr(status));
+		goto fail;
+	}
+
+	status = dbwrap_traverse(db, dbwrap_shm1_count_fn, NULL, &count);
+	if (!NT_STATUS_IS_OK(status) || (count != num_buckets)) {
+		fprintf(stderr, "traverse returned %s, count %d\n",
+			nt_errstr(status), count);
+		goto fail;
+	}
+
+	ret = true;
+fail:
+	TALLOC_FREE(db);
+	unlink(dbname);
+	return ret;
+}
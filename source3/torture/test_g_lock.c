@@ -900,6 +900,251 @@ bool run_g_lock6(int dummy)
 extern int torture_numops;
 extern int torture_nprocs;
 
+/*
+ * Test that a queued writer is not overtaken by a new reader and
+ * that it gets the lock handed over directly on unlock instead of
+ * waiting for its retry timer.
+ */
+
+static bool lock7_child(struct tevent_context *ev,
+			struct messaging_context *msg,
+			TDB_DATA lockname,
+			enum g_lock_type type,
+			int ready_pipe, int go_pipe)
+{
+	struct g_lock_ctx *ctx = NULL;
+	NTSTATUS status;
+	ssize_t n;
+	bool ok;
+	char c;
+
+	status = reinit_after_fork(msg, ev, false, "");
+	if (!NT_STATUS_IS_OK(status)) {
+		fprintf(stderr, "reinit_after_fork failed: %s\n",
+			nt_errstr(status));
+		return false;
+	}
+
+	ok = get_g_lock_ctx(talloc_tos(), &ev, &msg, &ctx);
+	if (!ok) {
+		fprintf(stderr, "get_g_lock_ctx failed");
+		return false;
+	}
+
+	if (type == G_LOCK_READ) {
+		/*
+		 * The holder
+		 */
+		status = g_lock_lock(ctx, lockname, G_LOCK_READ,
+				     (struct timeval) { .tv_sec = 1 });
+		ok = NT_STATUS_IS_OK(status);
+		if (!ok) {
+			fprintf(stderr, "child: g_lock_lock returned %s\n",
+				nt_errstr(status));
+		}
+		n = sys_write(ready_pipe, &ok, sizeof(ok));
+		if ((n != sizeof(ok)) || !ok) {
+			return false;
+		}
+		n = sys_read(go_pipe, &c, sizeof(c));
+		if (n != sizeof(c)) {
+			fprintf(stderr, "child: read failed\n");
+			return false;
+		}
+		status = g_lock_unlock(ctx, lockname);
+		if (!NT_STATUS_IS_OK(status)) {
+			fprintf(stderr, "child: g_lock_unlock returned %s\n",
+				nt_errstr(status));
+			return false;
+		}
+	} else {
+		/*
+		 * The late reader, must queue behind the writer
+		 */
+		n = sys_read(go_pipe, &c, sizeof(c));
+		if (n != sizeof(c)) {
+			fprintf(stderr, "child: read failed\n");
+			return false;
+		}
+		status = g_lock_lock(ctx, lockname, G_LOCK_READ,
+				     (struct timeval) { .tv_usec = 500000 });
+		ok = NT_STATUS_EQUAL(status, NT_STATUS_IO_TIMEOUT);
+		if (!ok) {
+			fprintf(stderr, "child: g_lock_lock returned %s\n",
+				nt_errstr(status));
+		}
+		n = sys_write(ready_pipe, &ok, sizeof(ok));
+		if ((n != sizeof(ok)) || !ok) {
+			return false;
+		}
+	}
+
+	/*
+	 * Wait for the parent to close the pipe
+	 */
+	n = sys_read(go_pipe, &c, sizeof(c));
+	if (n != 0) {
+		fprintf(stderr, "child: read failed\n");
+		return false;
+	}
+
+	TALLOC_FREE(ctx);
+	return true;
+}
+
+bool run_g_lock7(int dummy)
+{
+	struct tevent_context *ev = NULL;
+	struct messaging_context *msg = NULL;
+	struct g_lock_ctx *ctx = NULL;
+	TDB_DATA lockname = string_term_tdb_data("lock7");
+	struct tevent_req *req = NULL;
+	int ready_pipe[2][2], go_pipe[2][2];
+	pid_t children[2];
+	struct timeval start;
+	NTSTATUS status;
+	size_t i;
+	ssize_t n;
+	int done;
+	bool ret = false;
+	bool ok;
+	char c = 0;
+
+	ok = get_g_lock_ctx(talloc_tos(), &ev, &msg, &ctx);
+	if (!ok) {
+		fprintf(stderr, "get_g_lock_ctx failed");
+		return false;
+	}
+
+	for (i=0; i<2; i++) {
+		if ((pipe(ready_pipe[i]) != 0) || (pipe(go_pipe[i]) != 0)) {
+			perror("pipe failed");
+			return false;
+		}
+
+		children[i] = fork();
+
+		if (children[i] == -1) {
+			perror("fork failed");
+			return false;
+		}
+
+		if (children[i] == 0) {
+			size_t j;
+
+			TALLOC_FREE(ctx);
+			close(ready_pipe[i][0]);
+			close(go_pipe[i][1]);
+
+			/*
+			 * Don't keep the other child's pipes open
+			 */
+			for (j=0; j<i; j++) {
+				close(ready_pipe[j][0]);
+				close(go_pipe[j][1]);
+			}
+			ok = lock7_child(ev, msg, lockname,
+					 i == 0 ? G_LOCK_READ : G_LOCK_WRITE,
+					 ready_pipe[i][1], go_pipe[i][0]);
+			exit(ok ? 0 : 1);
+		}
+		close(ready_pipe[i][1]);
+		close(go_pipe[i][0]);
+	}
+
+	n = sys_read(ready_pipe[0][0], &ok, sizeof(ok));
+	if ((n != sizeof(ok)) || !ok) {
+		fprintf(stderr, "holder failed\n");
+		goto fail;
+	}
+
+	/*
+	 * Queue up as a writer behind the reader
+	 */
+	req = g_lock_lock_send(ev, ev, ctx, lockname, G_LOCK_WRITE);
+	if (req == NULL) {
+		fprintf(stderr, "g_lock_lock_send failed\n");
+		goto fail;
+	}
+	if (!tevent_req_set_endtime(req, ev, timeval_current_ofs(20, 0))) {
+		fprintf(stderr, "tevent_req_set_endtime failed\n");
+		goto fail;
+	}
+	done = 0;
+	tevent_req_set_callback(req, lock4_done, &done);
+
+	n = sys_write(go_pipe[1][1], &c, sizeof(c));
+	if (n != sizeof(c)) {
+		perror("write failed");
+		goto fail;
+	}
+	n = sys_read(ready_pipe[1][0], &ok, sizeof(ok));
+	if ((n != sizeof(ok)) || !ok) {
+		fprintf(stderr, "late reader overtook the writer\n");
+		goto fail;
+	}
+
+	start = timeval_current();
+
+	n = sys_write(go_pipe[0][1], &c, sizeof(c));
+	if (n != sizeof(c)) {
+		perror("write failed");
+		goto fail;
+	}
+
+	while (done == 0) {
+		int tevent_ret = tevent_loop_once(ev);
+		if (tevent_ret != 0) {
+			perror("tevent_loop_once failed");
+			goto fail;
+		}
+	}
+	if (done != 1) {
+		goto fail;
+	}
+
+	/*
+	 * The retry timer fires after 5 seconds at the
+	 * earliest. Getting the lock earlier means we were
+	 * handed it by the unlock.
+	 */
+	if (timeval_elapsed(&start) > 2.0) {
+		fprintf(stderr, "No direct handoff: %f seconds\n",
+			timeval_elapsed(&start));
+		goto fail;
+	}
+
+	status = g_lock_unlock(ctx, lockname);
+	if (!NT_STATUS_IS_OK(status)) {
+		fprintf(stderr, "g_lock_unlock failed: %s\n",
+			nt_errstr(status));
+		goto fail;
+	}
+
+	ret = true;
+fail:
+	for (i=0; i<2; i++) {
+		close(go_pipe[i][1]);
+		close(ready_pipe[i][0]);
+	}
+	for (i=0; i<2; i++) {
+		int child_status;
+
+		if (waitpid(children[i], &child_status, 0) != children[i]) {
+			perror("waitpid failed");
+			ret = false;
+			continue;
+		}
+		if (!WIFEXITED(child_status) ||
+		    (WEXITSTATUS(child_status) != 0)) {
+			fprintf(stderr, "child %zu failed\n", i);
+			ret = false;
+		}
+	}
+	TALLOC_FREE(ctx);
+	return ret;
+}
+
 static struct timeval tp1, tp2;
 
 static void start_timer(void)
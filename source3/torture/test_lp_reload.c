@@ -0,0 +1,199 @@
+/*
+ * Unix SMB/CIFS implementation.
+ * Test incremental reloads of smb.conf
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "includes.h"
+#include "torture/proto.h"
+#include "lib/param/loadparm.h"
+
+static bool lp_reload_write(const char *fname, const char *contents)
+{
+	FILE *f;
+	int ret;
+
+	f = fopen(fname, "w");
+	if (f == NULL) {
+		fprintf(stderr, "fopen(%s) failed: %s\n", fname,
+			strerror(errno));
+		return false;
+	}
+	fputs(contents, f);
+	ret = fclose(f);
+	if (ret != 0) {
+		fprintf(stderr, "fclose failed: %s\n", strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+static bool lp_reload_check_comment(const char *name, const char *comment)
+{
+	const struct loadparm_service *service = lp_service(name);
+
+	if (service == NULL) {
+		if (comment == NULL) {
+			return true;
+		}
+		fprintf(stderr, "service [%s] not found\n", name);
+		return false;
+	}
+	if (comment == NULL) {
+		fprintf(stderr, "service [%s] should be gone\n", name);
+		return false;
+	}
+	if (strcmp(service->comment, comment) != 0) {
+		fprintf(stderr, "service [%s]: comment \"%s\", expected "
+			"\"%s\"\n", name, service->comment, comment);
+		return false;
+	}
+	return true;
+}
+
+bool run_lp_reload1(int dummy)
+{
+	char fname[] = "/tmp/lp_reload1.XXXXXX";
+	int fd;
+	int snum;
+	bool ok;
+	bool ret = false;
+
+	fd = mkstemp(fname);
+	if (fd == -1) {
+		fprintf(stderr, "mkstemp failed: %s\n", strerror(errno));
+		return false;
+	}
+	close(fd);
+
+	ok = lp_reload_write(fname,
+			     "[global]\n"
+			     "\tserver string = one\n"
+			     "[a]\n\tpath = /tmp\n\tcomment = a\n"
+			     "[b]\n\tpath = /tmp\n\tcomment = b\n"
+			     "[c]\n\tpath = /tmp\n\tcomment = c\n");
+	if (!ok) {
+		goto done;
+	}
+
+	ok = lp_reload_with_shares(fname, NULL, NULL);
+	if (!ok) {
+		fprintf(stderr, "initial lp_reload_with_shares failed\n");
+		goto done;
+	}
+
+	/*
+	 * Mark [a] and [c], they are unchanged in the config file
+	 * and must keep the marker in the reload.
+	 */
+	snum = lp_servicenumber("a");
+	lp_do_parameter(snum, "comment", "marker");
+	snum = lp_servicenumber("c");
+	lp_do_parameter(snum, "comment", "marker");
+
+	ok = lp_reload_write(fname,
+			     "[global]\n"
+			     "\tserver string = one\n"
+			     "[a]\n\tpath = /tmp\n\tcomment = a\n"
+			     "[b]\n\tpath = /tmp\n\tcomment = b2\n"
+			     "[d]\n\tpath = /tmp\n\tcomment = d\n"
+			     "[c]\n\tpath = /tmp\n\tcomment = c\n");
+	if (!ok) {
+		goto done;
+	}
+
+	ok = lp_reload_with_shares(fname, NULL, NULL);
+	if (!ok) {
+		fprintf(stderr, "lp_reload_with_shares failed\n");
+		goto done;
+	}
+
+	/*
+	 * [c] follows the new [d], but that does not change its
+	 * defaults
+	 */
+	ok = lp_reload_check_comment("a", "marker");
+	ok &= lp_reload_check_comment("b", "b2");
+	ok &= lp_reload_check_comment("c", "marker");
+	ok &= lp_reload_check_comment("d", "d");
+	if (!ok) {
+		goto done;
+	}
+
+	/*
+	 * A change in [global] can change the defaults of all
+	 * services, so everything is loaded again.
+	 */
+	ok = lp_reload_write(fname,
+			     "[global]\n"
+			     "\tserver string = two\n"
+			     "[a]\n\tpath = /tmp\n\tcomment = a\n"
+			     "[d]\n\tpath = /tmp\n\tcomment = d\n"
+			     "[c]\n\tpath = /tmp\n\tcomment = c\n");
+	if (!ok) {
+		goto done;
+	}
+
+	ok = lp_reload_with_shares(fname, NULL, NULL);
+	if (!ok) {
+		fprintf(stderr, "lp_reload_with_shares failed\n");
+		goto done;
+	}
+
+	ok = lp_reload_check_comment("a", "a");
+	ok &= lp_reload_check_comment("b", NULL);
+	ok &= lp_reload_check_comment("c", "c");
+	ok &= lp_reload_check_comment("d", "d");
+	if (!ok) {
+		goto done;
+	}
+
+	/*
+	 * An include always reloads the service
+	 */
+	ok = lp_reload_write(fname,
+			     "[global]\n"
+			     "\tserver string = two\n"
+			     "[a]\n\tpath = /tmp\n\tcomment = a\n"
+			     "\tinclude = /nonexistent/lp_reload1.conf\n");
+	if (!ok) {
+		goto done;
+	}
+	ok = lp_reload_with_shares(fname, NULL, NULL);
+	if (!ok) {
+		fprintf(stderr, "lp_reload_with_shares failed\n");
+		goto done;
+	}
+	snum = lp_servicenumber("a");
+	lp_do_parameter(snum, "comment", "marker");
+
+	ok = lp_reload_with_shares(fname, NULL, NULL);
+	if (!ok) {
+		fprintf(stderr, "lp_reload_with_shares failed\n");
+		goto done;
+	}
+	ok = lp_reload_check_comment("a", "a");
+	ok &= lp_reload_check_comment("c", NULL);
+	if (!ok) {
+		goto done;
+	}
+
+	ret = true;
+done:
+	unlink(fname);
+	lp_kill_all_services();
+	lp_load_global(get_dyn_CONFIGFILE());
+	return ret;
+}
@@ -29,6 +29,7 @@
 #include "auth_generic.h"
 #include "../librpc/ndr/libndr.h"
 #include "libsmb/clirap.h"
+#include "../libcli/smb/smb2_create_blob.h"
 
 extern fstring host, workgroup, share, password, username, myname;
 extern struct cli_credentials *torture_creds;
@@ -2335,3 +2336,212 @@ bool run_smb2_dir_fsync(int dummy)
 	}
 	return true;
 }
+
+static bool smb2_durable_connect(struct cli_state **pcli)
+{
+	struct cli_state *cli = NULL;
+	NTSTATUS status;
+
+	if (!torture_init_connection(&cli)) {
+		return false;
+	}
+
+	status = smbXcli_negprot(cli->conn, cli->timeout,
+				 PROTOCOL_SMB2_02, PROTOCOL_LATEST);
+	if (!NT_STATUS_IS_OK(status)) {
+		printf("smbXcli_negprot returned %s\n", nt_errstr(status));
+		return false;
+	}
+
+	status = cli_session_setup_creds(cli, torture_creds);
+	if (!NT_STATUS_IS_OK(status)) {
+		printf("cli_session_setup returned %s\n", nt_errstr(status));
+		return false;
+	}
+
+	status = cli_tree_connect(cli, share, "?????", NULL);
+	if (!NT_STATUS_IS_OK(status)) {
+		printf("cli_tree_connect returned %s\n", nt_errstr(status));
+		return false;
+	}
+
+	*pcli = cli;
+	return true;
+}
+
+/*
+ * Open a couple of durable handles, drop the connection and reclaim
+ * all of them on a new connection. Needs a share with
+ * "kernel share modes", "kernel oplocks" and "posix locking" off.
+ */
+
+bool run_smb2_durable_reconnect(int dummy)
+{
+	struct cli_state *cli1 = NULL;
+	struct cli_state *cli2 = NULL;
+	const char *hello = "Hello, world\n";
+	uint64_t fid_persistent[10];
+	uint64_t fid_volatile[10];
+	uint64_t new_persistent;
+	uint64_t new_volatile;
+	struct smb2_create_blobs blobs;
+	uint8_t dhnc[16];
+	char fname[64];
+	uint8_t *result;
+	uint32_t nread;
+	unsigned i, j;
+	NTSTATUS status;
+	bool ok;
+
+	printf("Starting SMB2-DURABLE-RECONNECT\n");
+
+	ok = smb2_durable_connect(&cli1);
+	if (!ok) {
+		return false;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(fid_persistent); i++) {
+		uint8_t dhnq[16] = { 0, };
+
+		snprintf(fname, sizeof(fname), "durable-reconnect-%u.txt", i);
+
+		ZERO_STRUCT(blobs);
+		status = smb2_create_blob_add(
+			talloc_tos(), &blobs, SMB2_CREATE_TAG_DHNQ,
+			data_blob_const(dhnq, sizeof(dhnq)));
+		if (!NT_STATUS_IS_OK(status)) {
+			printf("smb2_create_blob_add returned %s\n",
+			       nt_errstr(status));
+			return false;
+		}
+
+		status = smb2cli_create(cli1->conn, cli1->timeout,
+				cli1->smb2.session, cli1->smb2.tcon, fname,
+				SMB2_OPLOCK_LEVEL_BATCH, /* oplock_level, */
+				SMB2_IMPERSONATION_IMPERSONATION, /* impersonation_level, */
+				SEC_STD_ALL | SEC_FILE_ALL, /* desired_access, */
+				FILE_ATTRIBUTE_NORMAL, /* file_attributes, */
+				FILE_SHARE_READ|FILE_SHARE_WRITE, /* share_access, */
+				FILE_OVERWRITE_IF, /* create_disposition, */
+				0, /* create_options, */
+				&blobs, /* smb2_create_blobs *blobs */
+				&fid_persistent[i],
+				&fid_volatile[i],
+				NULL, NULL, NULL);
+		if (!NT_STATUS_IS_OK(status)) {
+			printf("smb2cli_create on cli1 %s\n",
+			       nt_errstr(status));
+			return false;
+		}
+
+		status = smb2cli_write(cli1->conn, cli1->timeout,
+				       cli1->smb2.session, cli1->smb2.tcon,
+				       strlen(hello), 0, fid_persistent[i],
+				       fid_volatile[i], 0, 0,
+				       (const uint8_t *)hello, NULL);
+		if (!NT_STATUS_IS_OK(status)) {
+			printf("smb2cli_write returned %s\n",
+			       nt_errstr(status));
+			return false;
+		}
+	}
+
+	/* Drop the connection without closing the files */
+	smbXcli_conn_disconnect(cli1->conn, NT_STATUS_LOCAL_DISCONNECT);
+
+	ok = smb2_durable_connect(&cli2);
+	if (!ok) {
+		return false;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(fid_persistent); i++) {
+		snprintf(fname, sizeof(fname), "durable-reconnect-%u.txt", i);
+
+		SBVAL(dhnc, 0, fid_persistent[i]);
+		SBVAL(dhnc, 8, fid_volatile[i]);
+
+		ZERO_STRUCT(blobs);
+		status = smb2_create_blob_add(
+			talloc_tos(), &blobs, SMB2_CREATE_TAG_DHNC,
+			data_blob_const(dhnc, sizeof(dhnc)));
+		if (!NT_STATUS_IS_OK(status)) {
+			printf("smb2_create_blob_add returned %s\n",
+			       nt_errstr(status));
+			return false;
+		}
+
+		/*
+		 * The old smbd might not have noticed the disconnect
+		 * yet, give it a few seconds.
+		 */
+		for (j = 0; j < 50; j++) {
+			status = smb2cli_create(cli2->conn, cli2->timeout,
+					cli2->smb2.session, cli2->smb2.tcon,
+					fname,
+					SMB2_OPLOCK_LEVEL_BATCH, /* oplock_level, */
+					SMB2_IMPERSONATION_IMPERSONATION, /* impersonation_level, */
+					SEC_STD_ALL | SEC_FILE_ALL, /* desired_access, */
+					FILE_ATTRIBUTE_NORMAL, /* file_attributes, */
+					FILE_SHARE_READ|FILE_SHARE_WRITE, /* share_access, */
+					FILE_OPEN, /* create_disposition, */
+					0, /* create_options, */
+					&blobs, /* smb2_create_blobs *blobs */
+					&new_persistent,
+					&new_volatile,
+					NULL, NULL, NULL);
+			if (!NT_STATUS_EQUAL(status,
+					     NT_STATUS_OBJECT_NAME_NOT_FOUND)) {
+				break;
+			}
+			smb_msleep(100);
+		}
+		if (!NT_STATUS_IS_OK(status)) {
+			printf("durable reconnect of %s returned %s\n",
+			       fname, nt_errstr(status));
+			return false;
+		}
+
+		if (new_persistent != fid_persistent[i]) {
+			printf("durable reconnect of %s got persistent id "
+			       "%llu, expected %llu\n", fname,
+			       (unsigned long long)new_persistent,
+			       (unsigned long long)fid_persistent[i]);
+			return false;
+		}
+
+		status = smb2cli_read(cli2->conn, cli2->timeout,
+				      cli2->smb2.session, cli2->smb2.tcon,
+				      0x10000, 0, new_persistent,
+				      new_volatile, 2, 0,
+				      talloc_tos(), &result, &nread);
+		if (!NT_STATUS_IS_OK(status)) {
+			printf("smb2cli_read returned %s\n",
+			       nt_errstr(status));
+			return false;
+		}
+
+		if ((nread != strlen(hello)) ||
+		    (memcmp(hello, result, nread) != 0)) {
+			printf("smb2cli_read returned wrong data\n");
+			return false;
+		}
+
+		status = smb2cli_close(cli2->conn, cli2->timeout,
+				       cli2->smb2.session, cli2->smb2.tcon,
+				       0, new_persistent, new_volatile);
+		if (!NT_STATUS_IS_OK(status)) {
+			printf("smb2cli_close returned %s\n",
+			       nt_errstr(status));
+			return false;
+		}
+
+		cli_unlink(cli2, fname,
+			   FILE_ATTRIBUTE_SYSTEM | FILE_ATTRIBUTE_HIDDEN);
+	}
+
+	if (!torture_close_connection(cli2)) {
+		return false;
+	}
+
+	return true;
+}
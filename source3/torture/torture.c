@@ -12236,6 +12236,10 @@ static struct {
 		.name  = "SMB2-DIR-FSYNC",
 		.fn    = run_smb2_dir_fsync,
 	},
+	{
+		.name  = "SMB2-DURABLE-RECONNECT",
+		.fn    = run_smb2_durable_reconnect,
+	},
 	{
 		.name  = "CLEANUP1",
 		.fn    = run_cleanup1,
@@ -12280,6 +12284,14 @@ static struct {
 		.name  = "LOCAL-DBWRAP-DO-LOCKED1",
 		.fn    = run_dbwrap_do_locked1,
 	},
+	{
+		.name  = "LOCAL-DBWRAP-SHM1",
+		.fn    = run_dbwrap_shm1,
+	},
+	{
+		.name  = "LOCAL-BRLOCK-INDEX",
+		.fn    = run_brlock_index,
+	},
 	{
 		.name  = "LOCAL-MESSAGING-READ1",
 		.fn    = run_messaging_read1,
@@ -12392,6 +12404,14 @@ static struct {
 		.name  = "LOCAL-BENCH-PTHREADPOOL",
 		.fn    = run_bench_pthreadpool,
 	},
+	{
+		.name  = "LOCAL-BENCH-PTHREADPOOL-PRIO",
+		.fn    = run_bench_pthreadpool_prio,
+	},
+	{
+		.name  = "LOCAL-BENCH-DBWRAP-DO-LOCKED",
+		.fn    = run_bench_dbwrap_do_locked,
+	},
 	{
 		.name  = "LOCAL-PTHREADPOOL-TEVENT",
 		.fn    = run_pthreadpool_tevent,
@@ -12420,6 +12440,10 @@ static struct {
 		.name  = "LOCAL-G-LOCK6",
 		.fn    = run_g_lock6,
 	},
+	{
+		.name  = "LOCAL-G-LOCK7",
+		.fn    = run_g_lock7,
+	},
 	{
 		.name  = "LOCAL-G-LOCK-PING-PONG",
 		.fn    = run_g_lock_ping_pong,
@@ -12432,6 +12456,10 @@ static struct {
 		.name  = "LOCAL-NAMEMAP-CACHE1",
 		.fn    = run_local_namemap_cache1,
 	},
+	{
+		.name  = "LOCAL-LP-RELOAD1",
+		.fn    = run_lp_reload1,
+	},
 	{
 		.name  = "qpathinfo-bufsize",
 		.fn    = run_qpathinfo_bufsize,
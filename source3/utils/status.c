@@ -49,6 +49,7 @@
 #include "status_profile.h"
 #include "smbd/notifyd/notifyd.h"
 #include "cmdline_contexts.h"
+#include "live_stats.h"
 
 #define SMB_MAXPIDS		2048
 static uid_t 		Ucrit_uid = 0;               /* added by OH */
@@ -502,6 +503,82 @@ static bool print_notify_rec(const char *path, struct server_id server,
 	return true;
 }
 
+static int print_live_stats(pid_t pid,
+			    const struct live_stats_values *values,
+			    void *private_data)
+{
+	struct live_stats_values *totals = private_data;
+
+	if (do_checks && !process_exists_by_pid(pid)) {
+		return 0;
+	}
+
+	d_printf("%-7d %11"PRIu64" %10"PRIu64" %9"PRIu64" %10"PRIu64" "
+		 "%14"PRIu64" %16"PRIu64" %16"PRIu64" %14"PRIu64" "
+		 "%14"PRIu64"\n",
+		 (int)pid,
+		 values->connections,
+		 values->open_files,
+		 values->requests_inflight,
+		 values->send_queue_len,
+		 values->requests_total,
+		 values->bytes_received,
+		 values->bytes_sent,
+		 values->client_bytes,
+		 values->connection_bytes);
+
+	totals->connections += values->connections;
+	totals->open_files += values->open_files;
+	totals->requests_inflight += values->requests_inflight;
+	totals->send_queue_len += values->send_queue_len;
+	totals->requests_total += values->requests_total;
+	totals->bytes_received += values->bytes_received;
+	totals->bytes_sent += values->bytes_sent;
+	totals->client_bytes += values->client_bytes;
+	totals->connection_bytes += values->connection_bytes;
+
+	return 0;
+}
+
+static bool show_live_stats(void)
+{
+	struct live_stats_values totals = { 0 };
+	int count;
+
+	d_printf("%-7s %11s %10s %9s %10s %14s %16s %16s %14s %14s\n",
+		 "PID", "Connections", "Open files", "In flight",
+		 "Send queue", "Requests", "Bytes received", "Bytes sent",
+		 "Client memory", "Conn memory");
+	d_printf("----------------------------------------------------------"
+		 "--------------------------------------------------"
+		 "------------------------------\n");
+
+	count = live_stats_traverse(print_live_stats, &totals);
+	if (count == -1) {
+		fprintf(stderr, "Could not read live statistics\n");
+		return false;
+	}
+
+	d_printf("----------------------------------------------------------"
+		 "--------------------------------------------------"
+		 "------------------------------\n");
+	d_printf("%-7s %11"PRIu64" %10"PRIu64" %9"PRIu64" %10"PRIu64" "
+		 "%14"PRIu64" %16"PRIu64" %16"PRIu64" %14"PRIu64" "
+		 "%14"PRIu64"\n",
+		 "Total",
+		 totals.connections,
+		 totals.open_files,
+		 totals.requests_inflight,
+		 totals.send_queue_len,
+		 totals.requests_total,
+		 totals.bytes_received,
+		 totals.bytes_sent,
+		 totals.client_bytes,
+		 totals.connection_bytes);
+
+	return true;
+}
+
 int main(int argc, const char *argv[])
 {
 	int c;
@@ -583,6 +660,22 @@ int main(int argc, const char *argv[])
 			.val        = 'R',
 			.descrip    = "Show call rates",
 		},
+		{
+			.longName   = "profile-json",
+			.shortName  = 0,
+			.argInfo    = POPT_ARG_NONE,
+			.arg        = NULL,
+			.val        = 'J',
+			.descrip    = "Dump profile data as JSON",
+		},
+		{
+			.longName   = "live-stats",
+			.shortName  = 0,
+			.argInfo    = POPT_ARG_NONE,
+			.arg        = NULL,
+			.val        = 'T',
+			.descrip    = "Show live smbd statistics",
+		},
 		{
 			.longName   = "byterange",
 			.shortName  = 'B',
@@ -663,6 +756,8 @@ int main(int argc, const char *argv[])
 			break;
 		case 'P':
 		case 'R':
+		case 'J':
+		case 'T':
 			profile_only = c;
 			break;
 		case 'B':
@@ -713,6 +808,14 @@ int main(int argc, const char *argv[])
 			/* Continuously display rate-converted data */
 			ok = status_profile_rates(verbose);
 			return ok ? 0 : 1;
+		case 'J':
+			/* Dump profile data as JSON */
+			ok = status_profile_json(verbose);
+			return ok ? 0 : 1;
+		case 'T':
+			/* Show the live statistics segments */
+			ok = show_live_stats();
+			return ok ? 0 : 1;
 		default:
 			break;
 	}
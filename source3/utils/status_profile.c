@@ -37,6 +37,90 @@ static void profile_separator(const char * title)
     d_printf("%s\n", line);
 }
 
+/*
+ * The upper limit in usec of a latency histogram bucket,
+ * for the last bucket, which has no upper limit, the
+ * lower limit.
+ */
+static uint64_t histogram_bucket_limit(size_t b)
+{
+	if (b == SMBPROFILE_STATS_HISTOGRAM_BUCKETS - 1) {
+		return (uint64_t)1 << b;
+	}
+	return (uint64_t)1 << (b + 1);
+}
+
+/*
+ * Returns the limit of the bucket containing the
+ * num/denom percentile of the events, 0 without events.
+ */
+static uint64_t histogram_percentile(const struct smbprofile_stats_histogram *h,
+				     uint64_t num, uint64_t denom)
+{
+	uint64_t total = 0;
+	uint64_t sum = 0;
+	uint64_t threshold;
+	size_t b;
+
+	for (b = 0; b < SMBPROFILE_STATS_HISTOGRAM_BUCKETS; b++) {
+		total += h->buckets[b];
+	}
+	if (total == 0) {
+		return 0;
+	}
+
+	threshold = (total * num + denom - 1) / denom;
+
+	for (b = 0; b < SMBPROFILE_STATS_HISTOGRAM_BUCKETS; b++) {
+		sum += h->buckets[b];
+		if (sum >= threshold) {
+			break;
+		}
+	}
+
+	return histogram_bucket_limit(MIN(b, SMBPROFILE_STATS_HISTOGRAM_BUCKETS - 1));
+}
+
+static void print_latency_lines(const char *name,
+				const struct smbprofile_stats_histogram *h,
+				bool verbose)
+{
+	char field[60];
+	size_t b;
+
+	snprintf(field, sizeof(field), "%s_latency_p50:", name);
+	d_printf("%-59s%20ju\n", field,
+		 (uintmax_t)histogram_percentile(h, 50, 100));
+	snprintf(field, sizeof(field), "%s_latency_p99:", name);
+	d_printf("%-59s%20ju\n", field,
+		 (uintmax_t)histogram_percentile(h, 99, 100));
+	snprintf(field, sizeof(field), "%s_latency_p999:", name);
+	d_printf("%-59s%20ju\n", field,
+		 (uintmax_t)histogram_percentile(h, 999, 1000));
+
+	if (!verbose) {
+		return;
+	}
+
+	for (b = 0; b < SMBPROFILE_STATS_HISTOGRAM_BUCKETS; b++) {
+		bool last = (b == SMBPROFILE_STATS_HISTOGRAM_BUCKETS - 1);
+
+		snprintf(field, sizeof(field), "%s_latency_%s_%ju:",
+			 name, last ? "ge" : "lt",
+			 (uintmax_t)histogram_bucket_limit(b));
+		d_printf("%-59s%20ju\n", field, (uintmax_t)h->buckets[b]);
+	}
+}
+
+static void print_named_latency(const char *name,
+				const struct smbprofile_stats_histogram *latency,
+				void *private_data)
+{
+	bool *verbose = (bool *)private_data;
+
+	print_latency_lines(name, latency, *verbose);
+}
+
 /*******************************************************************
  dump the elements of the profile structure
   ******************************************************************/
@@ -80,6 +164,8 @@ bool status_profile_dump(bool verbose)
 	__PRINT_FIELD_LINE(#name, name##_stats,  idle); \
 	__PRINT_FIELD_LINE(#name, name##_stats,  inbytes); \
 	__PRINT_FIELD_LINE(#name, name##_stats,  outbytes); \
+	print_latency_lines(#name, &stats.values.name##_stats.latency, \
+			    verbose); \
 } while(0);
 #define SMBPROFILE_STATS_SECTION_END
 #define SMBPROFILE_STATS_END
@@ -95,6 +181,182 @@ bool status_profile_dump(bool verbose)
 #undef SMBPROFILE_STATS_SECTION_END
 #undef SMBPROFILE_STATS_END
 
+	profile_separator("SMB2 Latency per Share");
+	smbprofile_collect_shares(print_named_latency, &verbose);
+
+	profile_separator("VFS Latency (time_audit)");
+	smbprofile_collect_vfs(print_named_latency, &verbose);
+
+	return True;
+}
+
+struct json_state {
+	bool first_section;
+	bool first_value;
+	bool first_field;
+};
+
+static void json_print_string(const char *str)
+{
+	const unsigned char *p = (const unsigned char *)str;
+
+	putchar('"');
+	for (; *p != '\0'; p++) {
+		if (*p == '"' || *p == '\\') {
+			printf("\\%c", *p);
+		} else if (*p < 0x20) {
+			printf("\\u%04x", *p);
+		} else {
+			putchar(*p);
+		}
+	}
+	putchar('"');
+}
+
+static void json_section_start(struct json_state *s, const char *name)
+{
+	printf("%s\n  ", s->first_section ? "" : ",");
+	json_print_string(name);
+	printf(": {");
+	s->first_section = false;
+	s->first_value = true;
+}
+
+static void json_section_end(struct json_state *s)
+{
+	printf("\n  }");
+}
+
+static void json_value_start(struct json_state *s, const char *name)
+{
+	printf("%s\n    ", s->first_value ? "" : ",");
+	json_print_string(name);
+	printf(": {");
+	s->first_value = false;
+	s->first_field = true;
+}
+
+static void json_value_end(struct json_state *s)
+{
+	printf("}");
+}
+
+static void json_field(struct json_state *s, const char *name, uint64_t v)
+{
+	printf("%s\"%s\": %ju", s->first_field ? "" : ", ", name, (uintmax_t)v);
+	s->first_field = false;
+}
+
+static void json_latency(struct json_state *s,
+			 const struct smbprofile_stats_histogram *h)
+{
+	size_t b;
+
+	printf("%s\"latency_usec\": {", s->first_field ? "" : ", ");
+	for (b = 0; b < SMBPROFILE_STATS_HISTOGRAM_BUCKETS; b++) {
+		bool last = (b == SMBPROFILE_STATS_HISTOGRAM_BUCKETS - 1);
+
+		printf("%s\"%s_%ju\": %ju",
+		       b == 0 ? "" : ", ",
+		       last ? "ge" : "lt",
+		       (uintmax_t)histogram_bucket_limit(b),
+		       (uintmax_t)h->buckets[b]);
+	}
+	printf("}");
+	s->first_field = false;
+}
+
+static void json_named_latency(const char *name,
+			       const struct smbprofile_stats_histogram *latency,
+			       void *private_data)
+{
+	struct json_state *s = (struct json_state *)private_data;
+
+	json_value_start(s, name);
+	json_latency(s, latency);
+	json_value_end(s);
+}
+
+/*******************************************************************
+ dump the profile structure as JSON
+  ******************************************************************/
+bool status_profile_json(bool verbose)
+{
+	struct profile_stats stats = {};
+	struct json_state s = { .first_section = true, };
+
+	if (!profile_setup(NULL, True)) {
+		fprintf(stderr,"Failed to initialise profile memory\n");
+		return False;
+	}
+
+	smbprofile_collect(&stats);
+
+	printf("{");
+
+#define __JSON_FIELD(_stats, field) \
+	json_field(&s, #field, stats.values._stats.field)
+#define SMBPROFILE_STATS_START
+#define SMBPROFILE_STATS_SECTION_START(name, display) \
+	json_section_start(&s, #name);
+#define SMBPROFILE_STATS_COUNT(name) do { \
+	json_value_start(&s, #name); \
+	__JSON_FIELD(name##_stats, count); \
+	json_value_end(&s); \
+} while(0);
+#define SMBPROFILE_STATS_TIME(name) do { \
+	json_value_start(&s, #name); \
+	__JSON_FIELD(name##_stats, time); \
+	json_value_end(&s); \
+} while(0);
+#define SMBPROFILE_STATS_BASIC(name) do { \
+	json_value_start(&s, #name); \
+	__JSON_FIELD(name##_stats, count); \
+	__JSON_FIELD(name##_stats, time); \
+	json_value_end(&s); \
+} while(0);
+#define SMBPROFILE_STATS_BYTES(name) do { \
+	json_value_start(&s, #name); \
+	__JSON_FIELD(name##_stats, count); \
+	__JSON_FIELD(name##_stats, time); \
+	__JSON_FIELD(name##_stats, idle); \
+	__JSON_FIELD(name##_stats, bytes); \
+	json_value_end(&s); \
+} while(0);
+#define SMBPROFILE_STATS_IOBYTES(name) do { \
+	json_value_start(&s, #name); \
+	__JSON_FIELD(name##_stats, count); \
+	__JSON_FIELD(name##_stats, time); \
+	__JSON_FIELD(name##_stats, idle); \
+	__JSON_FIELD(name##_stats, inbytes); \
+	__JSON_FIELD(name##_stats, outbytes); \
+	json_latency(&s, &stats.values.name##_stats.latency); \
+	json_value_end(&s); \
+} while(0);
+#define SMBPROFILE_STATS_SECTION_END json_section_end(&s);
+#define SMBPROFILE_STATS_END
+	SMBPROFILE_STATS_ALL_SECTIONS
+#undef __JSON_FIELD
+#undef SMBPROFILE_STATS_START
+#undef SMBPROFILE_STATS_SECTION_START
+#undef SMBPROFILE_STATS_COUNT
+#undef SMBPROFILE_STATS_TIME
+#undef SMBPROFILE_STATS_BASIC
+#undef SMBPROFILE_STATS_BYTES
+#undef SMBPROFILE_STATS_IOBYTES
+#undef SMBPROFILE_STATS_SECTION_END
+#undef SMBPROFILE_STATS_END
+
+	json_section_start(&s, "shares");
+	smbprofile_collect_shares(json_named_latency, &s);
+	json_section_end(&s);
+
+	json_section_start(&s, "vfs");
+	smbprofile_collect_vfs(json_named_latency, &s);
+	json_section_end(&s);
+
+	printf("\n}\n");
+
 	return True;
 }
 
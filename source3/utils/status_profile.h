@@ -23,6 +23,7 @@
 #include "replace.h"
 
 bool status_profile_dump(bool be_verbose);
+bool status_profile_json(bool be_verbose);
 bool status_profile_rates(bool be_verbose);
 
 #endif
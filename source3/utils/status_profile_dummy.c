@@ -27,6 +27,12 @@ bool status_profile_dump(bool be_verbose)
 	return true;
 }
 
+bool status_profile_json(bool be_verbose)
+{
+	fprintf(stderr, "Profile data unavailable\n");
+	return true;
+}
+
 bool status_profile_rates(bool be_verbose)
 {
 	fprintf(stderr, "Profile data unavailable\n");
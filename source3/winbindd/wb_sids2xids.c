@@ -37,6 +37,13 @@ struct wb_sids2xids_state {
 	struct dom_sid *non_cached;
 	uint32_t num_non_cached;
 
+	/*
+	 * For each sid not found in the cache, the index into
+	 * non_cached. A SID listed more than once is only looked up
+	 * once, ACLs tend to repeat the same few SIDs.
+	 */
+	uint32_t *non_cached_idx;
+
 	/*
 	 * Domain array to use for the idmap call. The output from
 	 * lookupsids cannot be used directly since for migrated
@@ -102,20 +109,40 @@ struct tevent_req *wb_sids2xids_send(TALLOC_CTX *mem_ctx,
 		return tevent_req_post(req, ev);
 	}
 
+	state->non_cached_idx = talloc_array(state, uint32_t, num_sids);
+	if (tevent_req_nomem(state->non_cached_idx, req)) {
+		return tevent_req_post(req, ev);
+	}
+
 	/*
 	 * Extract those sids that can not be resolved from cache
-	 * into a separate list to be handed to id mapping, keeping
-	 * the same index.
+	 * into a separate list to be handed to id mapping, without
+	 * duplicates.
 	 */
 	for (i=0; i<state->num_sids; i++) {
 		struct dom_sid_buf buf;
+		uint32_t j;
 
 		DEBUG(10, ("SID %d: %s\n", (int)i,
 			   dom_sid_str_buf(&state->sids[i], &buf)));
 
+		state->non_cached_idx[i] = UINT32_MAX;
+
 		if (wb_sids2xids_in_cache(&state->sids[i], &state->cached[i])) {
 			continue;
 		}
+
+		for (j=0; j<state->num_non_cached; j++) {
+			if (dom_sid_equal(&state->non_cached[j],
+					  &state->sids[i])) {
+				break;
+			}
+		}
+		state->non_cached_idx[i] = j;
+
+		if (j < state->num_non_cached) {
+			continue;
+		}
 		sid_copy(&state->non_cached[state->num_non_cached],
 			 &state->sids[i]);
 		state->num_non_cached += 1;
@@ -420,7 +447,7 @@ NTSTATUS wb_sids2xids_recv(struct tevent_req *req,
 	struct wb_sids2xids_state *state = tevent_req_data(
 		req, struct wb_sids2xids_state);
 	NTSTATUS status;
-	uint32_t i, num_non_cached;
+	uint32_t i;
 
 	if (tevent_req_is_nterror(req, &status)) {
 		DEBUG(5, ("wb_sids_to_xids failed: %s\n", nt_errstr(status)));
@@ -433,7 +460,10 @@ NTSTATUS wb_sids2xids_recv(struct tevent_req *req,
 		return NT_STATUS_INTERNAL_ERROR;
 	}
 
-	num_non_cached = 0;
+	for (i=0; i<state->num_non_cached; i++) {
+		idmap_cache_set_sid2unixid(&state->non_cached[i],
+					   &state->ids.ids[i].xid);
+	}
 
 	for (i=0; i<state->num_sids; i++) {
 		struct unixid xid;
@@ -443,13 +473,7 @@ NTSTATUS wb_sids2xids_recv(struct tevent_req *req,
 		if (state->cached[i].sid != NULL) {
 			xid = state->cached[i].xid;
 		} else {
-			xid = state->ids.ids[num_non_cached].xid;
-
-			idmap_cache_set_sid2unixid(
-				&state->non_cached[num_non_cached],
-				&xid);
-
-			num_non_cached += 1;
+			xid = state->ids.ids[state->non_cached_idx[i]].xid;
 		}
 
 		xids[i] = xid;
@@ -157,6 +157,8 @@ static void flush_caches(void)
            otherwise cached access denied errors due to restrict anonymous
            hang around until the sequence number changes. */
 
+	winbindd_nss_cache_flush();
+
 	if (!wcache_invalidate_cache()) {
 		DEBUG(0, ("invalidating the cache failed; revalidate the cache\n"));
 		if (!winbindd_cache_validate_and_initialize()) {
@@ -180,6 +182,8 @@ static void flush_caches_noinit(void)
 	 * are many domains..
 	 */
 
+	winbindd_nss_cache_flush();
+
 	if (!wcache_invalidate_cache_noinit()) {
 		DEBUG(0, ("invalidating the cache failed; revalidate the cache\n"));
 		if (!winbindd_cache_validate_and_initialize()) {
@@ -812,6 +816,8 @@ static void process_request_done(struct tevent_req *subreq)
 	ok = NT_STATUS_IS_OK(status);
 	cli_state->response->result = ok ? WINBINDD_OK : WINBINDD_ERROR;
 
+	winbindd_nss_cache_store(cli_state->request, cli_state->response);
+
 	TALLOC_FREE(cli_state->io_req);
 	TALLOC_FREE(cli_state->request);
 
@@ -1937,6 +1943,11 @@ int main(int argc, const char **argv)
 		exit_daemon("Winbindd failed to setup listeners", EPIPE);
 	}
 
+	if (!winbindd_nss_cache_init()) {
+		DBG_WARNING("Could not publish the NSS cache, "
+			    "clients will always ask winbindd\n");
+	}
+
 	irpc_add_name(winbind_imessaging_context(), "winbind_server");
 
 	TALLOC_FREE(frame);
@@ -3020,6 +3020,9 @@ void wcache_invalidate_samlogon(struct winbindd_domain *domain,
 	struct dom_sid_buf sid_string;
 	struct winbind_cache *cache;
 
+	/* The logon brought fresh group memberships */
+	winbindd_getgroups_cache_flush(sid);
+
 	/* don't clear cached U/SID and UG/SID entries when we want to logon
 	 * offline - gd */
 
@@ -4724,11 +4727,63 @@ static bool wcache_opnum_cacheable(uint32_t opnum)
 	return true;
 }
 
+struct wcache_fetch_ndr_state {
+	TALLOC_CTX *mem_ctx;
+	bool check_seqnum;
+	uint32_t dom_seqnum;
+	DATA_BLOB *resp;
+};
+
+/*
+ * Check the record while tdb still has it mapped and copy out only
+ * the NDR payload, so a cache hit costs a single allocation.
+ */
+static int wcache_fetch_ndr_parser(TDB_DATA key, TDB_DATA data,
+				   void *private_data)
+{
+	struct wcache_fetch_ndr_state *state = private_data;
+
+	if (data.dsize < 12) {
+		return -1;
+	}
+
+	if (state->check_seqnum) {
+		uint32_t entry_seqnum;
+		uint64_t entry_timeout;
+
+		entry_seqnum = IVAL(data.dptr, 0);
+		if (entry_seqnum != state->dom_seqnum) {
+			DEBUG(10, ("Entry has wrong sequence number: %d\n",
+				   (int)entry_seqnum));
+			return -1;
+		}
+		entry_timeout = BVAL(data.dptr, 4);
+		if (time(NULL) > (time_t)entry_timeout) {
+			DEBUG(10, ("Entry has timed out\n"));
+			return -1;
+		}
+	}
+
+	state->resp->data = (uint8_t *)talloc_memdup(state->mem_ctx,
+						     data.dptr + 12,
+						     data.dsize - 12);
+	if (state->resp->data == NULL) {
+		DEBUG(10, ("talloc failed\n"));
+		return -1;
+	}
+	state->resp->length = data.dsize - 12;
+
+	return 0;
+}
+
 bool wcache_fetch_ndr(TALLOC_CTX *mem_ctx, struct winbindd_domain *domain,
 		      uint32_t opnum, const DATA_BLOB *req, DATA_BLOB *resp)
 {
-	TDB_DATA key, data;
-	bool ret = false;
+	struct wcache_fetch_ndr_state state = {
+		.mem_ctx = mem_ctx, .resp = resp,
+	};
+	TDB_DATA key;
+	int ret;
 
 	if (!wcache_opnum_cacheable(opnum) ||
 	    is_my_own_sam_domain(domain) ||
@@ -4740,52 +4795,28 @@ bool wcache_fetch_ndr(TALLOC_CTX *mem_ctx, struct winbindd_domain *domain,
 		return false;
 	}
 
-	if (!wcache_ndr_key(talloc_tos(), domain->name, opnum, req, &key)) {
-		return false;
-	}
-	data = tdb_fetch(wcache->tdb, key);
-	TALLOC_FREE(key.dptr);
-
-	if (data.dptr == NULL) {
-		return false;
-	}
-	if (data.dsize < 12) {
-		goto fail;
-	}
-
 	if (is_domain_online(domain)) {
-		uint32_t entry_seqnum, dom_seqnum, last_check;
-		uint64_t entry_timeout;
+		uint32_t last_check;
 
-		if (!wcache_fetch_seqnum(domain->name, &dom_seqnum,
+		/*
+		 * Fetched up front so that we don't nest a second record
+		 * lookup inside tdb_parse_record()
+		 */
+		if (!wcache_fetch_seqnum(domain->name, &state.dom_seqnum,
 					 &last_check)) {
-			goto fail;
-		}
-		entry_seqnum = IVAL(data.dptr, 0);
-		if (entry_seqnum != dom_seqnum) {
-			DEBUG(10, ("Entry has wrong sequence number: %d\n",
-				   (int)entry_seqnum));
-			goto fail;
-		}
-		entry_timeout = BVAL(data.dptr, 4);
-		if (time(NULL) > (time_t)entry_timeout) {
-			DEBUG(10, ("Entry has timed out\n"));
-			goto fail;
+			return false;
 		}
+		state.check_seqnum = true;
 	}
 
-	resp->data = (uint8_t *)talloc_memdup(mem_ctx, data.dptr + 12,
-					      data.dsize - 12);
-	if (resp->data == NULL) {
-		DEBUG(10, ("talloc failed\n"));
-		goto fail;
+	if (!wcache_ndr_key(talloc_tos(), domain->name, opnum, req, &key)) {
+		return false;
 	}
-	resp->length = data.dsize - 12;
+	ret = tdb_parse_record(wcache->tdb, key, wcache_fetch_ndr_parser,
+			       &state);
+	TALLOC_FREE(key.dptr);
 
-	ret = true;
-fail:
-	SAFE_FREE(data.dptr);
-	return ret;
+	return (ret == 0);
 }
 
 void wcache_store_ndr(struct winbindd_domain *domain, uint32_t opnum,
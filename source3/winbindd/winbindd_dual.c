@@ -394,9 +394,17 @@ static void child_socket_readable(struct tevent_context *ev,
 	child->sock = -1;
 }
 
+/*
+ * Pick the child of a domain a request should go to. An idle child
+ * that is already running is best, it has its DC connection set up.
+ * Only if all running children are busy we start another one, up to
+ * "winbind max domain connections". If all are busy the one with the
+ * shortest queue is returned and the caller waits for it.
+ */
 static struct winbindd_child *choose_domain_child(struct winbindd_domain *domain)
 {
 	struct winbindd_child *shortest = &domain->children[0];
+	struct winbindd_child *unstarted = NULL;
 	struct winbindd_child *current;
 	int i;
 
@@ -407,8 +415,14 @@ static struct winbindd_child *choose_domain_child(struct winbindd_domain *domain
 		current_len = tevent_queue_length(current->queue);
 
 		if (current_len == 0) {
-			/* idle child */
-			return current;
+			if (current->pid != 0) {
+				/* idle running child */
+				return current;
+			}
+			if (unstarted == NULL) {
+				unstarted = current;
+			}
+			continue;
 		}
 
 		shortest_len = tevent_queue_length(shortest->queue);
@@ -418,6 +432,13 @@ static struct winbindd_child *choose_domain_child(struct winbindd_domain *domain
 		}
 	}
 
+	if (unstarted != NULL) {
+		return unstarted;
+	}
+
+	DBG_DEBUG("All %d children of domain %s are busy\n",
+		  lp_winbind_max_domain_connections(), domain->name);
+
 	return shortest;
 }
 
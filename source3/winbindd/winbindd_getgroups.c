@@ -21,6 +21,7 @@
 #include "winbindd.h"
 #include "passdb/lookup_sid.h" /* only for LOOKUP_NAME_NO_NSS flag */
 #include "libcli/security/dom_sid.h"
+#include "lib/gencache.h"
 
 struct winbindd_getgroups_state {
 	struct tevent_context *ev;
@@ -39,6 +40,121 @@ static void winbindd_getgroups_lookupname_done(struct tevent_req *subreq);
 static void winbindd_getgroups_gettoken_done(struct tevent_req *subreq);
 static void winbindd_getgroups_sid2gid_done(struct tevent_req *subreq);
 
+/*
+ * The complete gid list of a user is kept in gencache for "winbind
+ * cache time" seconds, so repeated initgroups calls for the same user
+ * don't have to expand and map the token again. Logons refresh the
+ * cached group memberships and drop the entry via
+ * winbindd_getgroups_cache_flush().
+ *
+ * On a DC the memberships come straight from our own SAM, which the
+ * winbindd cache doesn't cache either, so don't cache them here.
+ */
+
+static char *winbindd_getgroups_cache_key(TALLOC_CTX *mem_ctx,
+					  const struct dom_sid *sid)
+{
+	struct dom_sid_buf buf;
+
+	return talloc_asprintf(mem_ctx, "WB_GETGROUPS/%s",
+			       dom_sid_str_buf(sid, &buf));
+}
+
+struct winbindd_getgroups_cache_state {
+	TALLOC_CTX *mem_ctx;
+	gid_t *gids;
+	int num_gids;
+	bool found;
+};
+
+static void winbindd_getgroups_cache_parser(
+	const struct gencache_timeout *timeout,
+	DATA_BLOB blob,
+	void *private_data)
+{
+	struct winbindd_getgroups_cache_state *state = private_data;
+	size_t num_gids;
+
+	if (gencache_timeout_expired(timeout)) {
+		return;
+	}
+	if ((blob.length == 0) || (blob.length % sizeof(gid_t) != 0)) {
+		return;
+	}
+	num_gids = blob.length / sizeof(gid_t);
+
+	state->gids = talloc_array(state->mem_ctx, gid_t, num_gids);
+	if (state->gids == NULL) {
+		return;
+	}
+	memcpy(state->gids, blob.data, blob.length);
+	state->num_gids = num_gids;
+	state->found = true;
+}
+
+static bool winbindd_getgroups_cache_get(TALLOC_CTX *mem_ctx,
+					 const struct dom_sid *sid,
+					 gid_t **pgids, int *pnum_gids)
+{
+	struct winbindd_getgroups_cache_state state = {
+		.mem_ctx = mem_ctx,
+	};
+	char *key;
+
+	if (!winbindd_use_cache() || IS_DC) {
+		return false;
+	}
+
+	key = winbindd_getgroups_cache_key(talloc_tos(), sid);
+	if (key == NULL) {
+		return false;
+	}
+	gencache_parse(key, winbindd_getgroups_cache_parser, &state);
+	TALLOC_FREE(key);
+
+	if (!state.found) {
+		return false;
+	}
+
+	*pgids = state.gids;
+	*pnum_gids = state.num_gids;
+	return true;
+}
+
+static void winbindd_getgroups_cache_set(const struct dom_sid *sid,
+					 const gid_t *gids, int num_gids)
+{
+	DATA_BLOB blob;
+	char *key;
+
+	if (!winbindd_use_cache() || IS_DC || (num_gids <= 0)) {
+		return;
+	}
+
+	key = winbindd_getgroups_cache_key(talloc_tos(), sid);
+	if (key == NULL) {
+		return;
+	}
+	blob = data_blob_const(gids, num_gids * sizeof(gid_t));
+	if (!gencache_set_data_blob(key, blob,
+				    time(NULL) + lp_winbind_cache_time())) {
+		DBG_DEBUG("gencache_set_data_blob for key %s failed\n", key);
+	}
+	TALLOC_FREE(key);
+}
+
+void winbindd_getgroups_cache_flush(const struct dom_sid *user_sid)
+{
+	char *key;
+
+	key = winbindd_getgroups_cache_key(talloc_tos(), user_sid);
+	if (key == NULL) {
+		return;
+	}
+	gencache_del(key);
+	TALLOC_FREE(key);
+}
+
 struct tevent_req *winbindd_getgroups_send(TALLOC_CTX *mem_ctx,
 					   struct tevent_context *ev,
 					   struct winbindd_cli_state *cli,
@@ -112,6 +228,16 @@ static void winbindd_getgroups_lookupname_done(struct tevent_req *subreq)
 		return;
 	}
 
+	if (winbindd_getgroups_cache_get(state, &state->sid,
+					 &state->gids, &state->num_gids)) {
+		struct dom_sid_buf buf;
+
+		DBG_DEBUG("Got groups of %s from cache\n",
+			  dom_sid_str_buf(&state->sid, &buf));
+		tevent_req_done(req);
+		return;
+	}
+
 	subreq = wb_gettoken_send(state, state->ev, &state->sid, true);
 	if (tevent_req_nomem(subreq, req)) {
 		return;
@@ -235,6 +361,9 @@ static void winbindd_getgroups_sid2gid_done(struct tevent_req *subreq)
 		return;
 	}
 
+	winbindd_getgroups_cache_set(&state->sid, state->gids,
+				     state->num_gids);
+
 	tevent_req_done(req);
 }
 
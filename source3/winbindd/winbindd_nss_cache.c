@@ -0,0 +1,266 @@
+/*
+ * Unix SMB/CIFS implementation.
+ * Publish passwd/group lookups to the winbind NSS module
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "includes.h"
+#include "winbindd.h"
+#include "system/filesys.h"
+#include "system/shmem.h"
+#include "system/threads.h"
+#include "nsswitch/winbind_nss_cache.h"
+
+#undef DBGC_CLASS
+#define DBGC_CLASS DBGC_WINBIND
+
+#ifdef HAVE_ATOMIC_THREAD_FENCE_SUPPORT
+
+static struct winbind_nss_cache_header *nss_cache;
+
+static int winbindd_nss_cache_time(void)
+{
+	return lp_parm_int(-1, "winbind", "nss cache time", 0);
+}
+
+/*
+ * Map the cache file next to the winbindd socket. The file is never
+ * unlinked, NSS clients that already mapped it keep seeing updates
+ * across winbindd restarts.
+ */
+bool winbindd_nss_cache_init(void)
+{
+	struct winbind_nss_cache_header *cache = NULL;
+	char *path = NULL;
+	void *ptr = NULL;
+	int fd;
+	int ret;
+
+	if (nss_cache != NULL) {
+		return true;
+	}
+
+	if (winbindd_nss_cache_time() <= 0) {
+		return true;
+	}
+
+	path = talloc_asprintf(talloc_tos(), "%s/%s",
+			       lp_winbindd_socket_directory(),
+			       WINBIND_NSS_CACHE_FILE);
+	if (path == NULL) {
+		return false;
+	}
+
+	fd = open(path, O_RDWR|O_CREAT|O_CLOEXEC, 0644);
+	if (fd == -1) {
+		DBG_WARNING("Could not open %s: %s\n", path, strerror(errno));
+		TALLOC_FREE(path);
+		return false;
+	}
+
+	ret = fchmod(fd, 0644);
+	if (ret == 0) {
+		ret = ftruncate(fd, WINBIND_NSS_CACHE_SIZE);
+	}
+	if (ret == -1) {
+		DBG_WARNING("Could not set up %s: %s\n", path, strerror(errno));
+		close(fd);
+		TALLOC_FREE(path);
+		return false;
+	}
+
+	ptr = mmap(NULL, WINBIND_NSS_CACHE_SIZE, PROT_READ|PROT_WRITE,
+		   MAP_SHARED, fd, 0);
+	close(fd);
+	if (ptr == MAP_FAILED) {
+		DBG_WARNING("Could not map %s: %s\n", path, strerror(errno));
+		TALLOC_FREE(path);
+		return false;
+	}
+	TALLOC_FREE(path);
+
+	cache = (struct winbind_nss_cache_header *)ptr;
+	nss_cache = cache;
+
+	/*
+	 * Anything left over from a previous winbindd might be stale,
+	 * and clients only look at slots with an even sequence number.
+	 */
+	winbindd_nss_cache_flush();
+
+	cache->num_slots = WINBIND_NSS_CACHE_NUM_SLOTS;
+	cache->slot_size = sizeof(struct winbind_nss_cache_slot);
+	cache->version = WINBIND_NSS_CACHE_VERSION;
+	atomic_thread_fence(memory_order_seq_cst);
+	cache->magic = WINBIND_NSS_CACHE_MAGIC;
+
+	return true;
+}
+
+static void winbindd_nss_cache_slot_begin(struct winbind_nss_cache_slot *slot)
+{
+	volatile uint32_t *seqnum = &slot->seqnum;
+
+	*seqnum += 1;
+	if ((*seqnum & 1) == 0) {
+		/* A previous winbindd died in the middle of an update */
+		*seqnum += 1;
+	}
+	atomic_thread_fence(memory_order_seq_cst);
+}
+
+static void winbindd_nss_cache_slot_end(struct winbind_nss_cache_slot *slot)
+{
+	volatile uint32_t *seqnum = &slot->seqnum;
+
+	atomic_thread_fence(memory_order_seq_cst);
+	*seqnum += 1;
+}
+
+/*
+ * Remember a successful passwd or group lookup done for the NSS
+ * module. Called before the request is freed.
+ */
+void winbindd_nss_cache_store(const struct winbindd_request *request,
+			      const struct winbindd_response *response)
+{
+	struct winbind_nss_cache_slot *slot = NULL;
+	const char *name = NULL;
+	const char *gr_mem = NULL;
+	size_t gr_mem_len = 0;
+	uint32_t id = 0;
+	uint32_t hash;
+	int cache_time;
+
+	if (nss_cache == NULL) {
+		return;
+	}
+	if (response->result != WINBINDD_OK) {
+		return;
+	}
+	if ((request->wb_flags & WBFLAG_FROM_NSS) == 0) {
+		return;
+	}
+
+	switch (request->cmd) {
+	case WINBINDD_GETPWNAM:
+		name = request->data.username;
+		break;
+	case WINBINDD_GETPWUID:
+		id = request->data.uid;
+		break;
+	case WINBINDD_GETGRNAM:
+		name = request->data.groupname;
+		break;
+	case WINBINDD_GETGRGID:
+		id = request->data.gid;
+		break;
+	default:
+		return;
+	}
+
+	cache_time = winbindd_nss_cache_time();
+	if (cache_time <= 0) {
+		return;
+	}
+
+	if (name != NULL &&
+	    strnlen(name, sizeof(slot->name)) >= sizeof(slot->name)) {
+		return;
+	}
+
+	if (request->cmd == WINBINDD_GETGRNAM ||
+	    request->cmd == WINBINDD_GETGRGID) {
+		if (response->data.gr.num_gr_mem != 0) {
+			gr_mem = (const char *)response->extra_data.data;
+			if (gr_mem == NULL) {
+				return;
+			}
+			gr_mem_len = strnlen(gr_mem, sizeof(slot->gr_mem));
+			if (gr_mem_len >= sizeof(slot->gr_mem)) {
+				/* Too many members, let clients ask */
+				return;
+			}
+		}
+	}
+
+	hash = winbind_nss_cache_hash(request->cmd, name, id);
+	slot = &nss_cache->slots[hash % WINBIND_NSS_CACHE_NUM_SLOTS];
+
+	winbindd_nss_cache_slot_begin(slot);
+
+	slot->cmd = request->cmd;
+	slot->expires = (uint64_t)time(NULL) + cache_time;
+	slot->id = id;
+	strlcpy(slot->name, name != NULL ? name : "", sizeof(slot->name));
+
+	if (request->cmd == WINBINDD_GETPWNAM ||
+	    request->cmd == WINBINDD_GETPWUID) {
+		slot->data.pw = response->data.pw;
+	} else {
+		slot->data.gr = response->data.gr;
+	}
+	if (gr_mem_len != 0) {
+		memcpy(slot->gr_mem, gr_mem, gr_mem_len);
+	}
+	slot->gr_mem[gr_mem_len] = '\0';
+
+	winbindd_nss_cache_slot_end(slot);
+}
+
+/*
+ * Forget everything, for example after a SIGHUP or an idmap change
+ */
+void winbindd_nss_cache_flush(void)
+{
+	uint32_t i;
+
+	if (nss_cache == NULL) {
+		return;
+	}
+
+	for (i = 0; i < WINBIND_NSS_CACHE_NUM_SLOTS; i++) {
+		struct winbind_nss_cache_slot *slot = &nss_cache->slots[i];
+
+		if (slot->cmd == 0 && (slot->seqnum & 1) == 0) {
+			continue;
+		}
+
+		winbindd_nss_cache_slot_begin(slot);
+		slot->cmd = 0;
+		slot->expires = 0;
+		winbindd_nss_cache_slot_end(slot);
+	}
+}
+
+#else /* HAVE_ATOMIC_THREAD_FENCE_SUPPORT */
+
+bool winbindd_nss_cache_init(void)
+{
+	return true;
+}
+
+void winbindd_nss_cache_store(const struct winbindd_request *request,
+			      const struct winbindd_response *response)
+{
+	return;
+}
+
+void winbindd_nss_cache_flush(void)
+{
+	return;
+}
+
+#endif /* HAVE_ATOMIC_THREAD_FENCE_SUPPORT */
@@ -3259,9 +3259,15 @@ NTSTATUS winbindd_pam_auth_pac_verify(struct winbindd_cli_state *state,
 		 * code path.
 		 */
 		struct winbindd_domain *domain = NULL;
+		struct dom_sid pac_user_sid;
 
 		netsamlogon_cache_store(NULL, info3_copy);
 
+		sid_compose(&pac_user_sid,
+			    info3_copy->base.domain_sid,
+			    info3_copy->base.rid);
+		winbindd_getgroups_cache_flush(&pac_user_sid);
+
 		/*
 		 * We're in the parent here, so find the child
 		 * pointer from the PAC domain name.
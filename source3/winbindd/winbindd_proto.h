@@ -663,6 +663,7 @@ struct tevent_req *winbindd_getgroups_send(TALLOC_CTX *mem_ctx,
 					   struct winbindd_request *request);
 NTSTATUS winbindd_getgroups_recv(struct tevent_req *req,
 				 struct winbindd_response *response);
+void winbindd_getgroups_cache_flush(const struct dom_sid *user_sid);
 
 struct tevent_req *wb_seqnum_send(TALLOC_CTX *mem_ctx,
 				  struct tevent_context *ev,
@@ -968,6 +969,12 @@ bool reconnect_need_retry(NTSTATUS status, struct winbindd_domain *domain);
 /* The following definitions come from winbindd/winbindd_gpupdate.c  */
 void gpupdate_init(void);
 
+/* The following definitions come from winbindd/winbindd_nss_cache.c  */
+bool winbindd_nss_cache_init(void);
+void winbindd_nss_cache_store(const struct winbindd_request *request,
+			      const struct winbindd_response *response);
+void winbindd_nss_cache_flush(void);
+
 /* The following comes from winbindd/winbindd_dual_srv.c */
 bool reset_cm_connection_on_error(struct winbindd_domain *domain,
 				  struct dcerpc_binding_handle *b,
@@ -31,6 +31,7 @@
 #include "libcli/ldap/ldap_ndr.h"
 #include "param/param.h"
 #include "librpc/gen_ndr/ndr_winbind_c.h"
+#include "lib/util/dlinklist.h"
 
 #undef DBGC_CLASS
 #define DBGC_CLASS DBGC_AUTH
@@ -995,6 +996,137 @@ static NTSTATUS authsam_update_lastlogon_timestamp(struct ldb_context *sam_ctx,
 	return NT_STATUS_OK;
 }
 
+/*
+ * Cache of the accounts looked up by authsam_search_account(), so that
+ * repeated logons of the same (service) account don't search for it
+ * and construct the msDS-* attributes every time. The group expansion
+ * in authsam_make_user_info_dc() is cached by dsdb_expand_nested_groups().
+ *
+ * Like the group expansion cache, everything is thrown away when the
+ * database sequence number changes, so changes to the account, its
+ * group memberships or the password settings are seen at once.
+ * Entries also expire after AUTHSAM_ACCOUNT_CACHE_TIME seconds, or
+ * when the password expires, because msDS-User-Account-Control-Computed
+ * depends on the current time. Locked out accounts are never cached.
+ */
+#define AUTHSAM_ACCOUNT_CACHE_SIZE 64
+#define AUTHSAM_ACCOUNT_CACHE_TIME 30
+
+struct authsam_account_cache_entry {
+	char *account_name;
+	struct ldb_dn *domain_dn;
+	time_t expires;
+	struct ldb_message *msg;
+};
+
+struct authsam_account_cache {
+	uint64_t seq_num;
+	const void *session_info;
+	struct authsam_account_cache_entry *entries[AUTHSAM_ACCOUNT_CACHE_SIZE];
+};
+
+static struct authsam_account_cache *authsam_account_cache_get(
+	struct ldb_context *sam_ctx)
+{
+	struct authsam_account_cache *cache = NULL;
+	const void *session_info = NULL;
+	uint64_t seq_num;
+	int ret;
+
+	ret = ldb_sequence_number(sam_ctx, LDB_SEQ_HIGHEST_SEQ, &seq_num);
+	if (ret != LDB_SUCCESS) {
+		return NULL;
+	}
+	session_info = ldb_get_opaque(sam_ctx, DSDB_SESSION_INFO);
+
+	cache = talloc_get_type(ldb_get_opaque(sam_ctx,
+					       DSDB_AUTHSAM_ACCOUNT_CACHE),
+				struct authsam_account_cache);
+	if (cache != NULL &&
+	    (cache->seq_num != seq_num ||
+	     cache->session_info != session_info)) {
+		TALLOC_FREE(cache);
+	}
+
+	if (cache == NULL) {
+		cache = talloc_zero(sam_ctx, struct authsam_account_cache);
+		if (cache == NULL) {
+			ldb_set_opaque(sam_ctx, DSDB_AUTHSAM_ACCOUNT_CACHE, NULL);
+			return NULL;
+		}
+		cache->seq_num = seq_num;
+		cache->session_info = session_info;
+	}
+
+	ret = ldb_set_opaque(sam_ctx, DSDB_AUTHSAM_ACCOUNT_CACHE, cache);
+	if (ret != LDB_SUCCESS) {
+		TALLOC_FREE(cache);
+		return NULL;
+	}
+
+	return cache;
+}
+
+static struct authsam_account_cache_entry **authsam_account_cache_slot(
+	struct authsam_account_cache *cache,
+	const char *account_name)
+{
+	uint32_t h = 5381;
+	const char *p;
+
+	for (p = account_name; *p != '\0'; p++) {
+		h = h * 33 + (unsigned char)*p;
+	}
+
+	return &cache->entries[h % ARRAY_SIZE(cache->entries)];
+}
+
+static void authsam_account_cache_add(struct authsam_account_cache *cache,
+				      const char *account_name,
+				      struct ldb_dn *domain_dn,
+				      const struct ldb_message *msg)
+{
+	struct authsam_account_cache_entry **slot = NULL;
+	struct authsam_account_cache_entry *entry = NULL;
+	time_t now = time(NULL);
+	time_t expires = now + AUTHSAM_ACCOUNT_CACHE_TIME;
+	NTTIME pwd_expiry;
+
+	if (ldb_msg_find_attr_as_int64(msg, "lockoutTime", 0) != 0) {
+		return;
+	}
+
+	pwd_expiry = samdb_result_nttime(msg,
+					 "msDS-UserPasswordExpiryTimeComputed",
+					 0);
+	if (pwd_expiry != 0 && pwd_expiry != 0x7FFFFFFFFFFFFFFFULL) {
+		time_t t = nt_time_to_unix(pwd_expiry);
+		if (t > now && t < expires) {
+			expires = t;
+		}
+	}
+
+	entry = talloc_zero(cache, struct authsam_account_cache_entry);
+	if (entry == NULL) {
+		return;
+	}
+
+	entry->account_name = talloc_strdup(entry, account_name);
+	entry->domain_dn = ldb_dn_copy(entry, domain_dn);
+	entry->msg = ldb_msg_copy(entry, msg);
+	entry->expires = expires;
+	if (entry->account_name == NULL ||
+	    entry->domain_dn == NULL ||
+	    entry->msg == NULL) {
+		TALLOC_FREE(entry);
+		return;
+	}
+
+	slot = authsam_account_cache_slot(cache, account_name);
+	TALLOC_FREE(*slot);
+	*slot = entry;
+}
+
 /****************************************************************************
  Look for the specified user in the sam, return ldb result structures
 ****************************************************************************/
@@ -1004,8 +1136,35 @@ NTSTATUS authsam_search_account(TALLOC_CTX *mem_ctx, struct ldb_context *sam_ctx
 					 struct ldb_dn *domain_dn,
 					 struct ldb_message **ret_msg)
 {
+	struct authsam_account_cache *cache = NULL;
+	char *lower_name = NULL;
 	int ret;
 
+	cache = authsam_account_cache_get(sam_ctx);
+	if (cache != NULL) {
+		lower_name = strlower_talloc(mem_ctx, account_name);
+	}
+	if (lower_name != NULL) {
+		struct authsam_account_cache_entry *entry =
+			*authsam_account_cache_slot(cache, lower_name);
+
+		if (entry != NULL &&
+		    entry->expires > time(NULL) &&
+		    strcmp(entry->account_name, lower_name) == 0 &&
+		    ldb_dn_compare(entry->domain_dn, domain_dn) == 0) {
+			/*
+			 * Callers steal strings out of the message, so
+			 * they get their own copy
+			 */
+			*ret_msg = ldb_msg_copy(mem_ctx, entry->msg);
+			TALLOC_FREE(lower_name);
+			if (*ret_msg == NULL) {
+				return NT_STATUS_NO_MEMORY;
+			}
+			return NT_STATUS_OK;
+		}
+	}
+
 	/* pull the user attributes */
 	ret = dsdb_search_one(sam_ctx, mem_ctx, ret_msg, domain_dn, LDB_SCOPE_SUBTREE,
 			      user_attrs,
@@ -1015,16 +1174,326 @@ NTSTATUS authsam_search_account(TALLOC_CTX *mem_ctx, struct ldb_context *sam_ctx
 	if (ret == LDB_ERR_NO_SUCH_OBJECT) {
 		DEBUG(3,("sam_search_user: Couldn't find user [%s] in samdb, under %s\n",
 			 account_name, ldb_dn_get_linearized(domain_dn)));
+		TALLOC_FREE(lower_name);
 		return NT_STATUS_NO_SUCH_USER;
 	}
 	if (ret != LDB_SUCCESS) {
+		TALLOC_FREE(lower_name);
 		return NT_STATUS_INTERNAL_DB_CORRUPTION;
 	}
 
+	if (lower_name != NULL) {
+		authsam_account_cache_add(cache, lower_name, domain_dn,
+					  *ret_msg);
+		TALLOC_FREE(lower_name);
+	}
+
 	return NT_STATUS_OK;
 }
 
 
+/*
+ * Queue of the logon accounting updates (lastLogon, logonCount and
+ * lastLogonTimestamp) made by authsam_logon_success_accounting().
+ *
+ * Without this every successful interactive or Kerberos logon opens a
+ * write transaction on the sam.ldb, so a storm of logons queues up
+ * behind the transaction lock. These attributes don't take part in the
+ * lockout decisions, so they are collected per user and written out in
+ * one transaction after "auth:logon accounting delay" milliseconds, or
+ * as soon as AUTHSAM_ACCOUNTING_QUEUE_SIZE users are pending.
+ *
+ * Anything touching badPwdCount or lockoutTime is still written at once
+ * (together with what is pending for that user), so the lockout
+ * behaviour is unchanged. Setting the delay to 0 writes everything
+ * synchronously as before.
+ */
+#define AUTHSAM_ACCOUNTING_QUEUE "cache.authsam_accounting_queue"
+#define AUTHSAM_ACCOUNTING_QUEUE_SIZE 100
+#define AUTHSAM_ACCOUNTING_DELAY_MS 1000
+
+struct authsam_accounting_entry {
+	struct authsam_accounting_entry *prev, *next;
+	struct ldb_message *msg;
+};
+
+struct authsam_accounting_queue {
+	struct ldb_context *sam_ctx;
+	struct authsam_accounting_entry *entries;
+	unsigned int num_entries;
+	struct tevent_timer *te;
+};
+
+static int authsam_accounting_delay(struct ldb_context *sam_ctx)
+{
+	struct loadparm_context *lp_ctx = NULL;
+
+	lp_ctx = talloc_get_type(ldb_get_opaque(sam_ctx, "loadparm"),
+				 struct loadparm_context);
+	if (lp_ctx == NULL) {
+		return 0;
+	}
+
+	return lpcfg_parm_int(lp_ctx, NULL, "auth", "logon accounting delay",
+			      AUTHSAM_ACCOUNTING_DELAY_MS);
+}
+
+static struct authsam_accounting_queue *authsam_accounting_queue_get(
+	struct ldb_context *sam_ctx, bool create)
+{
+	struct authsam_accounting_queue *queue = NULL;
+	int ret;
+
+	queue = talloc_get_type(ldb_get_opaque(sam_ctx,
+					       AUTHSAM_ACCOUNTING_QUEUE),
+				struct authsam_accounting_queue);
+	if (queue != NULL || !create) {
+		return queue;
+	}
+
+	queue = talloc_zero(sam_ctx, struct authsam_accounting_queue);
+	if (queue == NULL) {
+		return NULL;
+	}
+	queue->sam_ctx = sam_ctx;
+
+	ret = ldb_set_opaque(sam_ctx, AUTHSAM_ACCOUNTING_QUEUE, queue);
+	if (ret != LDB_SUCCESS) {
+		TALLOC_FREE(queue);
+		return NULL;
+	}
+
+	return queue;
+}
+
+static struct authsam_accounting_entry *authsam_accounting_find(
+	struct authsam_accounting_queue *queue,
+	struct ldb_dn *dn)
+{
+	struct authsam_accounting_entry *entry = NULL;
+
+	if (queue == NULL) {
+		return NULL;
+	}
+
+	for (entry = queue->entries; entry != NULL; entry = entry->next) {
+		if (ldb_dn_compare(entry->msg->dn, dn) == 0) {
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Copy the elements of src into dst, replacing the values of any
+ * attribute dst already has.
+ */
+static int authsam_accounting_merge(struct ldb_message *dst,
+				    const struct ldb_message *src)
+{
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < src->num_elements; i++) {
+		const struct ldb_message_element *el = &src->elements[i];
+		struct ldb_message_element *old = NULL;
+		unsigned int j;
+
+		old = ldb_msg_find_element(dst, el->name);
+		if (old != NULL) {
+			ldb_msg_remove_element(dst, old);
+		}
+
+		ret = ldb_msg_add_empty(dst, el->name, LDB_FLAG_MOD_REPLACE,
+					&old);
+		if (ret != LDB_SUCCESS) {
+			return ret;
+		}
+		for (j = 0; j < el->num_values; j++) {
+			ret = ldb_msg_add_value(dst, el->name,
+						&el->values[j], NULL);
+			if (ret != LDB_SUCCESS) {
+				return ret;
+			}
+		}
+	}
+
+	return LDB_SUCCESS;
+}
+
+static int authsam_accounting_modify(struct ldb_context *sam_ctx,
+				     struct ldb_message *msg_mod)
+{
+	struct ldb_request *req = NULL;
+	int ret;
+
+	ret = ldb_build_mod_req(&req, sam_ctx, sam_ctx,
+				msg_mod,
+				NULL,
+				NULL,
+				ldb_op_default_callback,
+				NULL);
+	if (ret != LDB_SUCCESS) {
+		return ret;
+	}
+
+	ret = ldb_request_add_control(req,
+				      DSDB_CONTROL_FORCE_RODC_LOCAL_CHANGE,
+				      false, NULL);
+	if (ret != LDB_SUCCESS) {
+		talloc_free(req);
+		return ret;
+	}
+
+	ret = ldb_request(sam_ctx, req);
+	if (ret == LDB_SUCCESS) {
+		ret = ldb_wait(req->handle, LDB_WAIT_ALL);
+	}
+	talloc_free(req);
+
+	return ret;
+}
+
+static void authsam_accounting_flush(struct authsam_accounting_queue *queue)
+{
+	struct ldb_context *sam_ctx = queue->sam_ctx;
+	struct authsam_accounting_entry *entry = NULL;
+	unsigned int num_entries = queue->num_entries;
+	int ret;
+
+	TALLOC_FREE(queue->te);
+
+	if (queue->entries == NULL) {
+		return;
+	}
+
+	ret = ldb_transaction_start(sam_ctx);
+	if (ret != LDB_SUCCESS) {
+		DBG_ERR("Failed to start a transaction to write the logon "
+			"accounting of %u users: %s\n",
+			num_entries, ldb_errstring(sam_ctx));
+		goto done;
+	}
+
+	for (entry = queue->entries; entry != NULL; entry = entry->next) {
+		ret = authsam_accounting_modify(sam_ctx, entry->msg);
+		if (ret == LDB_ERR_NO_SUCH_OBJECT) {
+			/* deleted or renamed since the logon */
+			continue;
+		}
+		if (ret != LDB_SUCCESS) {
+			DBG_ERR("Failed to set lastLogon and logonCount "
+				"on %s: %s\n",
+				ldb_dn_get_linearized(entry->msg->dn),
+				ldb_errstring(sam_ctx));
+		}
+	}
+
+	ret = ldb_transaction_commit(sam_ctx);
+	if (ret != LDB_SUCCESS) {
+		DBG_ERR("Failed to commit the logon accounting of "
+			"%u users: %s\n",
+			num_entries, ldb_errstring(sam_ctx));
+		goto done;
+	}
+
+	DBG_DEBUG("Wrote the logon accounting of %u users\n", num_entries);
+
+done:
+	while ((entry = queue->entries) != NULL) {
+		DLIST_REMOVE(queue->entries, entry);
+		TALLOC_FREE(entry);
+	}
+	queue->num_entries = 0;
+}
+
+static void authsam_accounting_timer(struct tevent_context *ev,
+				     struct tevent_timer *te,
+				     struct timeval current_time,
+				     void *private_data)
+{
+	struct authsam_accounting_queue *queue = talloc_get_type_abort(
+		private_data, struct authsam_accounting_queue);
+
+	queue->te = NULL;
+	authsam_accounting_flush(queue);
+}
+
+/*
+ * Queue msg_mod to be written later. Returns false if it has to be
+ * written by the caller, because the queue is disabled or there is no
+ * event loop to flush it.
+ */
+static bool authsam_accounting_defer(struct ldb_context *sam_ctx,
+				     const struct ldb_message *msg_mod)
+{
+	struct authsam_accounting_queue *queue = NULL;
+	struct authsam_accounting_entry *entry = NULL;
+	struct tevent_context *ev = NULL;
+	int delay;
+	int ret;
+
+	delay = authsam_accounting_delay(sam_ctx);
+	if (delay <= 0) {
+		return false;
+	}
+
+	ev = ldb_get_event_context(sam_ctx);
+	if (ev == NULL) {
+		return false;
+	}
+
+	queue = authsam_accounting_queue_get(sam_ctx, true);
+	if (queue == NULL) {
+		return false;
+	}
+
+	entry = authsam_accounting_find(queue, msg_mod->dn);
+	if (entry == NULL) {
+		entry = talloc_zero(queue, struct authsam_accounting_entry);
+		if (entry == NULL) {
+			return false;
+		}
+		entry->msg = ldb_msg_new(entry);
+		if (entry->msg == NULL) {
+			TALLOC_FREE(entry);
+			return false;
+		}
+		entry->msg->dn = ldb_dn_copy(entry->msg, msg_mod->dn);
+		if (entry->msg->dn == NULL) {
+			TALLOC_FREE(entry);
+			return false;
+		}
+		DLIST_ADD_END(queue->entries, entry);
+		queue->num_entries++;
+	}
+
+	ret = authsam_accounting_merge(entry->msg, msg_mod);
+	if (ret != LDB_SUCCESS) {
+		/* the entry still holds what was merged before */
+		return false;
+	}
+
+	if (queue->num_entries >= AUTHSAM_ACCOUNTING_QUEUE_SIZE) {
+		authsam_accounting_flush(queue);
+		return true;
+	}
+
+	if (queue->te == NULL) {
+		queue->te = tevent_add_timer(ev, queue,
+					     timeval_current_ofs_msec(delay),
+					     authsam_accounting_timer,
+					     queue);
+		if (queue->te == NULL) {
+			authsam_accounting_flush(queue);
+		}
+	}
+
+	return true;
+}
+
+
 /* Reset the badPwdCount to zero and update the lastLogon time. */
 NTSTATUS authsam_logon_success_accounting(struct ldb_context *sam_ctx,
 					  const struct ldb_message *msg,
@@ -1043,6 +1512,7 @@ NTSTATUS authsam_logon_success_accounting(struct ldb_context *sam_ctx,
 	NTTIME now;
 	NTTIME lastLogonTimestamp;
 	bool am_rodc = false;
+	struct authsam_accounting_entry *pending = NULL;
 
 	mem_ctx = talloc_new(msg);
 	if (mem_ctx == NULL) {
@@ -1060,6 +1530,17 @@ NTSTATUS authsam_logon_success_accounting(struct ldb_context *sam_ctx,
 	lastLogonTimestamp =
 		ldb_msg_find_attr_as_int64(msg, "lastLogonTimestamp", 0);
 
+	/*
+	 * The database doesn't have what is still queued for this user
+	 * yet, carry on from there.
+	 */
+	pending = authsam_accounting_find(
+		authsam_accounting_queue_get(sam_ctx, false), msg->dn);
+	if (pending != NULL) {
+		lastLogonTimestamp = ldb_msg_find_attr_as_int64(
+			pending->msg, "lastLogonTimestamp", lastLogonTimestamp);
+	}
+
 	DEBUG(5, ("lastLogonTimestamp is %lld\n",
 		  (long long int)lastLogonTimestamp));
 
@@ -1104,6 +1585,11 @@ NTSTATUS authsam_logon_success_accounting(struct ldb_context *sam_ctx,
 		int logonCount;
 
 		logonCount = ldb_msg_find_attr_as_int(msg, "logonCount", 0);
+		if (pending != NULL) {
+			logonCount = ldb_msg_find_attr_as_int(pending->msg,
+							      "logonCount",
+							      logonCount);
+		}
 
 		logonCount += 1;
 
@@ -1115,7 +1601,9 @@ NTSTATUS authsam_logon_success_accounting(struct ldb_context *sam_ctx,
 		}
 	} else {
 		/* Set an unset logonCount to 0 on first successful login */
-		if (ldb_msg_find_ldb_val(msg, "logonCount") == NULL) {
+		if (ldb_msg_find_ldb_val(msg, "logonCount") == NULL &&
+		    (pending == NULL ||
+		     ldb_msg_find_ldb_val(pending->msg, "logonCount") == NULL)) {
 			ret = samdb_msg_add_int(sam_ctx, msg_mod, msg_mod,
 						"logonCount", 0);
 			if (ret != LDB_SUCCESS) {
@@ -1161,6 +1649,34 @@ NTSTATUS authsam_logon_success_accounting(struct ldb_context *sam_ctx,
 			msg_mod->elements[i].flags = LDB_FLAG_MOD_REPLACE;
 		}
 
+		if (ldb_msg_find_element(msg_mod, "lockoutTime") == NULL &&
+		    ldb_msg_find_element(msg_mod, "badPwdCount") == NULL &&
+		    authsam_accounting_defer(sam_ctx, msg_mod)) {
+			TALLOC_FREE(mem_ctx);
+			return NT_STATUS_OK;
+		}
+
+		if (pending != NULL) {
+			/*
+			 * Write what is queued for this user together
+			 * with the reset of the lockout
+			 */
+			struct authsam_accounting_queue *queue =
+				talloc_get_type_abort(
+					talloc_parent(pending),
+					struct authsam_accounting_queue);
+
+			ret = authsam_accounting_merge(pending->msg, msg_mod);
+			if (ret != LDB_SUCCESS) {
+				TALLOC_FREE(mem_ctx);
+				return NT_STATUS_NO_MEMORY;
+			}
+			msg_mod = talloc_steal(mem_ctx, pending->msg);
+			DLIST_REMOVE(queue->entries, pending);
+			queue->num_entries--;
+			TALLOC_FREE(pending);
+		}
+
 		ret = ldb_build_mod_req(&req, sam_ctx, sam_ctx,
 					msg_mod,
 					NULL,
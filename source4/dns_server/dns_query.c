@@ -270,51 +270,405 @@ static WERROR add_dns_res_rec(struct dns_res_rec **pdst,
 	return WERR_OK;
 }
 
+/*
+ * Cache of the replies from the forwarders.
+ *
+ * A reply is kept for the smallest TTL of its answers, or for negative
+ * replies (NXDOMAIN or no data) for the negative TTL from the SOA in
+ * the authority section, see RFC 2308. Both are capped. Replies that
+ * were truncated or carry another error are not cached.
+ *
+ * While a query is being forwarded, further questions for the same
+ * name and type wait for its reply instead of being sent upstream as
+ * well. The replies are kept as NDR blobs, so that every request gets
+ * its own copy of the records to hand to its caller.
+ */
+#define DNS_FORWARDER_CACHE_BUCKETS 256
+#define DNS_FORWARDER_CACHE_MAX_ENTRIES 4096
+#define DNS_FORWARDER_CACHE_MAX_TTL 3600
+#define DNS_FORWARDER_CACHE_MAX_NEGATIVE_TTL 300
+
+struct ask_forwarder_state;
+
+struct dns_forwarder_cache_entry {
+	struct dns_forwarder_cache_entry *prev, *next;
+	struct dns_forwarder_cache *cache;
+	struct tevent_context *ev;
+	char *forwarder;
+	char *name;
+	enum dns_qclass question_class;
+	enum dns_qtype question_type;
+	uint32_t hash;
+
+	/* the query in flight and the requests waiting for it */
+	struct tevent_req *subreq;
+	struct ask_forwarder_state *waiters;
+
+	DATA_BLOB reply;
+	time_t stored;
+	time_t expires;
+};
+
+struct dns_forwarder_cache {
+	struct dns_forwarder_cache_entry *buckets[DNS_FORWARDER_CACHE_BUCKETS];
+	size_t num_entries;
+};
+
+static uint32_t dns_forwarder_cache_hash(const char *forwarder,
+					 const struct dns_name_question *question)
+{
+	uint32_t hash = question->question_type;
+	const char *p;
+
+	for (p = question->name; *p != '\0'; p++) {
+		hash = hash * 31 + tolower((unsigned char)*p);
+	}
+	for (p = forwarder; *p != '\0'; p++) {
+		hash = hash * 31 + (unsigned char)*p;
+	}
+
+	return hash;
+}
+
+static int dns_forwarder_cache_entry_destructor(
+	struct dns_forwarder_cache_entry *entry)
+{
+	struct dns_forwarder_cache *cache = entry->cache;
+
+	DLIST_REMOVE(cache->buckets[entry->hash % DNS_FORWARDER_CACHE_BUCKETS],
+		     entry);
+	cache->num_entries -= 1;
+	return 0;
+}
+
+static struct dns_forwarder_cache_entry *dns_forwarder_cache_find(
+	struct dns_forwarder_cache *cache,
+	const char *forwarder,
+	const struct dns_name_question *question,
+	uint32_t hash)
+{
+	struct dns_forwarder_cache_entry *entry = NULL;
+
+	entry = cache->buckets[hash % DNS_FORWARDER_CACHE_BUCKETS];
+
+	for (; entry != NULL; entry = entry->next) {
+		if (entry->hash == hash &&
+		    entry->question_type == question->question_type &&
+		    entry->question_class == question->question_class &&
+		    strcasecmp(entry->name, question->name) == 0 &&
+		    strcmp(entry->forwarder, forwarder) == 0) {
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+/* Make room for a new entry, throwing out expired ones first */
+static void dns_forwarder_cache_prune(struct dns_forwarder_cache *cache,
+				      uint32_t hash)
+{
+	struct dns_forwarder_cache_entry *entry = NULL;
+	struct dns_forwarder_cache_entry *next = NULL;
+	time_t now = time(NULL);
+	size_t i;
+
+	if (cache->num_entries < DNS_FORWARDER_CACHE_MAX_ENTRIES) {
+		return;
+	}
+
+	for (i = 0; i < DNS_FORWARDER_CACHE_BUCKETS; i++) {
+		for (entry = cache->buckets[i]; entry != NULL; entry = next) {
+			next = entry->next;
+			if (entry->subreq == NULL && entry->expires <= now) {
+				TALLOC_FREE(entry);
+			}
+		}
+	}
+
+	if (cache->num_entries < DNS_FORWARDER_CACHE_MAX_ENTRIES) {
+		return;
+	}
+
+	/* the oldest entry of the bucket we are about to add to */
+	entry = DLIST_TAIL(cache->buckets[hash % DNS_FORWARDER_CACHE_BUCKETS]);
+	for (; entry != NULL; entry = DLIST_PREV(entry)) {
+		if (entry->subreq == NULL) {
+			TALLOC_FREE(entry);
+			return;
+		}
+	}
+}
+
+static uint32_t dns_forwarder_cache_ttl(const struct dns_name_packet *packet)
+{
+	uint16_t rcode = packet->operation & DNS_RCODE;
+	uint32_t ttl = UINT32_MAX;
+	uint16_t i;
+
+	if (packet->operation & DNS_FLAG_TRUNCATION) {
+		return 0;
+	}
+
+	if (rcode == DNS_RCODE_OK && packet->ancount > 0) {
+		for (i = 0; i < packet->ancount; i++) {
+			ttl = MIN(ttl, packet->answers[i].ttl);
+		}
+		return MIN(ttl, DNS_FORWARDER_CACHE_MAX_TTL);
+	}
+
+	if (rcode != DNS_RCODE_OK && rcode != DNS_RCODE_NXDOMAIN) {
+		return 0;
+	}
+
+	/* a negative reply without a SOA is not cached, RFC 2308 */
+	for (i = 0; i < packet->nscount; i++) {
+		const struct dns_res_rec *rr = &packet->nsrecs[i];
+
+		if (rr->rr_type != DNS_QTYPE_SOA) {
+			continue;
+		}
+		ttl = MIN(rr->ttl, rr->rdata.soa_record.minimum);
+		return MIN(ttl, DNS_FORWARDER_CACHE_MAX_NEGATIVE_TTL);
+	}
+
+	return 0;
+}
+
+static void dns_forwarder_cache_age(struct dns_res_rec *recs, uint16_t count,
+				    uint32_t age)
+{
+	uint16_t i;
+
+	for (i = 0; i < count; i++) {
+		if (recs[i].rr_type == DNS_QTYPE_OPT) {
+			/* the ttl holds the extended rcode and flags */
+			continue;
+		}
+		recs[i].ttl = (recs[i].ttl > age) ? recs[i].ttl - age : 0;
+	}
+}
+
+/* Hand out a copy of the reply an entry holds */
+static WERROR dns_forwarder_cache_reply(struct dns_forwarder_cache_entry *entry,
+					TALLOC_CTX *mem_ctx,
+					struct dns_name_packet **preply)
+{
+	struct dns_name_packet *reply = NULL;
+	enum ndr_err_code ndr_err;
+	time_t now = time(NULL);
+	uint32_t age = 0;
+
+	reply = talloc_zero(mem_ctx, struct dns_name_packet);
+	if (reply == NULL) {
+		return WERR_NOT_ENOUGH_MEMORY;
+	}
+
+	ndr_err = ndr_pull_struct_blob(&entry->reply, reply, reply,
+			(ndr_pull_flags_fn_t)ndr_pull_dns_name_packet);
+	if (!NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
+		TALLOC_FREE(reply);
+		return DNS_ERR(SERVER_FAILURE);
+	}
+
+	if (now > entry->stored) {
+		age = now - entry->stored;
+	}
+	dns_forwarder_cache_age(reply->answers, reply->ancount, age);
+	dns_forwarder_cache_age(reply->nsrecs, reply->nscount, age);
+	dns_forwarder_cache_age(reply->additional, reply->arcount, age);
+
+	*preply = reply;
+	return WERR_OK;
+}
+
 struct ask_forwarder_state {
+	struct ask_forwarder_state *prev, *next;
+	struct tevent_req *req;
+	struct dns_forwarder_cache_entry *entry;
 	struct dns_name_packet *reply;
 };
 
+static void ask_forwarder_cleanup(struct tevent_req *req,
+				  enum tevent_req_state req_state)
+{
+	struct ask_forwarder_state *state = tevent_req_data(
+		req, struct ask_forwarder_state);
+
+	if (state->entry != NULL) {
+		DLIST_REMOVE(state->entry->waiters, state);
+		state->entry = NULL;
+	}
+}
+
 static void ask_forwarder_done(struct tevent_req *subreq);
 
 static struct tevent_req *ask_forwarder_send(
 	TALLOC_CTX *mem_ctx, struct tevent_context *ev,
+	struct dns_server *dns,
 	const char *forwarder, struct dns_name_question *question)
 {
-	struct tevent_req *req, *subreq;
+	struct tevent_req *req;
 	struct ask_forwarder_state *state;
+	struct dns_forwarder_cache *cache = NULL;
+	struct dns_forwarder_cache_entry *entry = NULL;
+	uint32_t hash;
+	WERROR werr;
 
 	req = tevent_req_create(mem_ctx, &state, struct ask_forwarder_state);
 	if (req == NULL) {
 		return NULL;
 	}
+	state->req = req;
 
-	subreq = dns_cli_request_send(state, ev, forwarder,
-				      question->name, question->question_class,
-				      question->question_type);
-	if (tevent_req_nomem(subreq, req)) {
+	/* the waiters are all completed from one reply */
+	tevent_req_defer_callback(req, ev);
+	tevent_req_set_cleanup_fn(req, ask_forwarder_cleanup);
+
+	if (forwarder == NULL) {
+		tevent_req_werror(req, DNS_ERR(SERVER_FAILURE));
 		return tevent_req_post(req, ev);
 	}
-	tevent_req_set_callback(subreq, ask_forwarder_done, req);
+
+	if (dns->forwarder_cache == NULL) {
+		dns->forwarder_cache = talloc_zero(dns,
+						   struct dns_forwarder_cache);
+		if (tevent_req_nomem(dns->forwarder_cache, req)) {
+			return tevent_req_post(req, ev);
+		}
+	}
+	cache = dns->forwarder_cache;
+
+	hash = dns_forwarder_cache_hash(forwarder, question);
+	entry = dns_forwarder_cache_find(cache, forwarder, question, hash);
+
+	if (entry != NULL && entry->subreq == NULL) {
+		if (entry->expires > time(NULL)) {
+			werr = dns_forwarder_cache_reply(entry, state,
+							 &state->reply);
+			if (W_ERROR_IS_OK(werr)) {
+				DBG_DEBUG("Using cached reply for %s\n",
+					  question->name);
+				tevent_req_done(req);
+				return tevent_req_post(req, ev);
+			}
+		}
+		TALLOC_FREE(entry);
+	}
+
+	if (entry == NULL) {
+		dns_forwarder_cache_prune(cache, hash);
+
+		entry = talloc_zero(cache, struct dns_forwarder_cache_entry);
+		if (tevent_req_nomem(entry, req)) {
+			return tevent_req_post(req, ev);
+		}
+		entry->cache = cache;
+		entry->ev = ev;
+		entry->hash = hash;
+		entry->question_class = question->question_class;
+		entry->question_type = question->question_type;
+		entry->forwarder = talloc_strdup(entry, forwarder);
+		entry->name = talloc_strdup(entry, question->name);
+		if (entry->forwarder == NULL || entry->name == NULL) {
+			TALLOC_FREE(entry);
+			tevent_req_oom(req);
+			return tevent_req_post(req, ev);
+		}
+		DLIST_ADD(cache->buckets[hash % DNS_FORWARDER_CACHE_BUCKETS],
+			  entry);
+		cache->num_entries += 1;
+		talloc_set_destructor(entry,
+				      dns_forwarder_cache_entry_destructor);
+
+		entry->subreq = dns_cli_request_send(entry, ev, forwarder,
+						     question->name,
+						     question->question_class,
+						     question->question_type);
+		if (entry->subreq == NULL) {
+			TALLOC_FREE(entry);
+			tevent_req_oom(req);
+			return tevent_req_post(req, ev);
+		}
+		tevent_req_set_callback(entry->subreq, ask_forwarder_done,
+					entry);
+	} else {
+		DBG_DEBUG("Waiting for the forwarded query for %s\n",
+			  question->name);
+	}
+
+	state->entry = entry;
+	DLIST_ADD_END(entry->waiters, state);
+
 	return req;
 }
 
 static void ask_forwarder_done(struct tevent_req *subreq)
 {
-	struct tevent_req *req = tevent_req_callback_data(
-		subreq, struct tevent_req);
-	struct ask_forwarder_state *state = tevent_req_data(
-		req, struct ask_forwarder_state);
+	struct dns_forwarder_cache_entry *entry = tevent_req_callback_data(
+		subreq, struct dns_forwarder_cache_entry);
+	struct ask_forwarder_state *state = NULL;
+	struct dns_name_packet *reply = NULL;
+	enum ndr_err_code ndr_err;
+	uint32_t ttl;
 	int ret;
 
-	ret = dns_cli_request_recv(subreq, state, &state->reply);
+	ret = dns_cli_request_recv(subreq, entry, &reply);
 	TALLOC_FREE(subreq);
+	entry->subreq = NULL;
 
 	if (ret != 0) {
-		tevent_req_werror(req, unix_to_werror(ret));
+		while ((state = entry->waiters) != NULL) {
+			DLIST_REMOVE(entry->waiters, state);
+			state->entry = NULL;
+			tevent_req_werror(state->req, unix_to_werror(ret));
+		}
+		TALLOC_FREE(entry);
 		return;
 	}
 
-	tevent_req_done(req);
+	ttl = dns_forwarder_cache_ttl(reply);
+
+	ndr_err = ndr_push_struct_blob(&entry->reply, entry, reply,
+			(ndr_push_flags_fn_t)ndr_push_dns_name_packet);
+	if (!NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
+		/* can't copy it, so only the first waiter gets it */
+		state = entry->waiters;
+		if (state != NULL) {
+			DLIST_REMOVE(entry->waiters, state);
+			state->entry = NULL;
+			state->reply = talloc_move(state, &reply);
+			tevent_req_done(state->req);
+		}
+		while ((state = entry->waiters) != NULL) {
+			DLIST_REMOVE(entry->waiters, state);
+			state->entry = NULL;
+			tevent_req_werror(state->req, DNS_ERR(SERVER_FAILURE));
+		}
+		TALLOC_FREE(entry);
+		return;
+	}
+	TALLOC_FREE(reply);
+
+	entry->stored = time(NULL);
+	entry->expires = entry->stored + ttl;
+
+	while ((state = entry->waiters) != NULL) {
+		WERROR werr;
+
+		DLIST_REMOVE(entry->waiters, state);
+		state->entry = NULL;
+
+		werr = dns_forwarder_cache_reply(entry, state, &state->reply);
+		if (tevent_req_werror(state->req, werr)) {
+			continue;
+		}
+		tevent_req_done(state->req);
+	}
+
+	if (ttl == 0) {
+		TALLOC_FREE(entry);
+	}
 }
 
 static WERROR ask_forwarder_recv(
@@ -476,7 +830,7 @@ static struct tevent_req *handle_dnsrpcrec_send(
 		return req;
 	}
 
-	subreq = ask_forwarder_send(state, ev, forwarder, new_q);
+	subreq = ask_forwarder_send(state, ev, dns, forwarder, new_q);
 	if (tevent_req_nomem(subreq, req)) {
 		return tevent_req_post(req, ev);
 	}
@@ -1024,7 +1378,7 @@ struct tevent_req *dns_server_process_query_send(
 		DEBUG(5, ("Not authoritative for '%s', forwarding\n",
 			  in->questions[0].name));
 
-		subreq = ask_forwarder_send(state, ev,
+		subreq = ask_forwarder_send(state, ev, dns,
 					    (forwarders == NULL ? NULL : forwarders[0]),
 					    &in->questions[0]);
 		if (tevent_req_nomem(subreq, req)) {
@@ -1067,7 +1421,7 @@ static void dns_server_process_query_got_response(struct tevent_req *subreq)
 
 		DEBUG(5, ("DNS query returned %s, trying another forwarder.\n",
 			  win_errstr(werr)));
-		subreq = ask_forwarder_send(state, state->ev,
+		subreq = ask_forwarder_send(state, state->ev, state->dns,
 					    state->forwarders->forwarder,
 					    state->question);
 
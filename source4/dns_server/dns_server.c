@@ -831,6 +831,7 @@ static NTSTATUS dns_task_init(struct task_server *task)
 	}
 
 	dns->task = task;
+	task->private_data = dns;
 
 	dns->server_credentials = cli_credentials_init(dns);
 	if (!dns->server_credentials) {
@@ -906,29 +907,59 @@ static NTSTATUS dns_task_init(struct task_server *task)
 		return status;
 	}
 
+	return NT_STATUS_OK;
+}
+
+/*
+  initialise the dns task after a fork
+
+  With the prefork process model the sockets opened by dns_task_init() are
+  shared by all the workers, so the kernel hands each datagram or connection
+  to whichever worker is idle. The IRPC name needs to be registered here, in
+  the worker, as the prefork master does not serve any requests.
+
+  Each worker has its own TKEY store, so a GSS-TSIG key negotiated with one
+  worker is unknown to the others. This is why only a single worker is
+  started unless "prefork children:dns" asks for more.
+*/
+static void dns_post_fork(struct task_server *task, struct process_details *pd)
+{
+	struct dns_server *dns = NULL;
+	NTSTATUS status;
+
+	if (task == NULL) {
+		task_server_terminate(task, "dns: Null task", true);
+		return;
+	}
+	if (task->private_data == NULL) {
+		task_server_terminate(task, "dns: No dns_server info", true);
+		return;
+	}
+	dns = talloc_get_type_abort(task->private_data, struct dns_server);
+
 	/* Setup the IRPC interface and register handlers */
 	status = irpc_add_name(task->msg_ctx, "dnssrv");
 	if (!NT_STATUS_IS_OK(status)) {
 		task_server_terminate(task, "dns: failed to register IRPC name", true);
-		return status;
+		return;
 	}
 
 	status = IRPC_REGISTER(task->msg_ctx, irpc, DNSSRV_RELOAD_DNS_ZONES,
 			       dns_reload_zones, dns);
 	if (!NT_STATUS_IS_OK(status)) {
 		task_server_terminate(task, "dns: failed to setup reload handler", true);
-		return status;
+		return;
 	}
-	return NT_STATUS_OK;
 }
 
 NTSTATUS server_service_dns_init(TALLOC_CTX *ctx)
 {
 	static const struct service_details details = {
 		.inhibit_fork_on_accept = true,
-		.inhibit_pre_fork = true,
+		.inhibit_pre_fork = false,
+		.pre_fork_children = 1,
 		.task_init = dns_task_init,
-		.post_fork = NULL
+		.post_fork = dns_post_fork
 	};
 	return register_server_service(ctx, "dns", &details);
 }
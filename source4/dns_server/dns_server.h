@@ -44,12 +44,17 @@ struct dns_server_tkey_store {
 	uint16_t size;
 };
 
+struct dns_record_cache;
+struct dns_forwarder_cache;
+
 struct dns_server {
 	struct task_server *task;
 	struct ldb_context *samdb;
 	struct dns_server_zone *zones;
 	struct dns_server_tkey_store *tkeys;
 	struct cli_credentials *server_credentials;
+	struct dns_record_cache *record_cache;
+	struct dns_forwarder_cache *forwarder_cache;
 };
 
 struct dns_request_state {
@@ -107,6 +107,185 @@ bool dns_records_match(struct dnsp_DnssrvRpcRecord *rec1,
 	return false;
 }
 
+/*
+ * Cache of the records found by dns_lookup_records() and
+ * dns_lookup_records_wildcard(), including the names that don't exist,
+ * so that the same names asked for by many clients don't mean an ldb
+ * search and an NDR parse of the dnsRecord values every time.
+ *
+ * Everything is thrown away when the database sequence number changes,
+ * which covers dynamic updates and replicated changes. A missing name
+ * is only remembered for DNS_RECORD_CACHE_NEGATIVE_TIME seconds, as
+ * the lookups can't tell it from some ldb failures. Callers get
+ * their own copy of the record array, which keeps the cached strings
+ * it points to alive with a talloc reference.
+ */
+#define DNS_RECORD_CACHE_SIZE 1024
+#define DNS_RECORD_CACHE_NEGATIVE_TIME 10
+
+struct dns_record_cache_entry {
+	char *dn;
+	bool wildcard;
+	time_t expires;
+	WERROR werr;
+	struct dnsp_DnssrvRpcRecord *records;
+	uint16_t rec_count;
+};
+
+struct dns_record_cache {
+	uint64_t seq_num;
+	struct dns_record_cache_entry *entries[DNS_RECORD_CACHE_SIZE];
+};
+
+static struct dns_record_cache *dns_record_cache_get(struct dns_server *dns)
+{
+	struct dns_record_cache *cache = dns->record_cache;
+	uint64_t seq_num;
+	int ret;
+
+	ret = ldb_sequence_number(dns->samdb, LDB_SEQ_HIGHEST_SEQ, &seq_num);
+	if (ret != LDB_SUCCESS) {
+		return NULL;
+	}
+
+	if (cache != NULL && cache->seq_num != seq_num) {
+		TALLOC_FREE(dns->record_cache);
+		cache = NULL;
+	}
+
+	if (cache == NULL) {
+		cache = talloc_zero(dns, struct dns_record_cache);
+		if (cache == NULL) {
+			return NULL;
+		}
+		cache->seq_num = seq_num;
+		dns->record_cache = cache;
+	}
+
+	return cache;
+}
+
+static struct dns_record_cache_entry **dns_record_cache_slot(
+	struct dns_record_cache *cache, const char *dn, bool wildcard)
+{
+	uint32_t hash = wildcard ? 1 : 0;
+	const char *p;
+
+	for (p = dn; *p != '\0'; p++) {
+		hash = hash * 31 + (uint8_t)*p;
+	}
+
+	return &cache->entries[hash % DNS_RECORD_CACHE_SIZE];
+}
+
+static WERROR dns_record_cache_copy(struct dns_record_cache_entry *entry,
+				    TALLOC_CTX *mem_ctx,
+				    struct dnsp_DnssrvRpcRecord **records,
+				    uint16_t *rec_count)
+{
+	struct dnsp_DnssrvRpcRecord *recs = NULL;
+
+	*records = NULL;
+	*rec_count = 0;
+
+	if (!W_ERROR_IS_OK(entry->werr) || entry->rec_count == 0) {
+		return entry->werr;
+	}
+
+	recs = talloc_memdup(mem_ctx, entry->records,
+			     sizeof(*recs) * entry->rec_count);
+	if (recs == NULL) {
+		return WERR_NOT_ENOUGH_MEMORY;
+	}
+	talloc_set_type(recs, struct dnsp_DnssrvRpcRecord);
+
+	if (talloc_reference(recs, entry) == NULL) {
+		TALLOC_FREE(recs);
+		return WERR_NOT_ENOUGH_MEMORY;
+	}
+
+	*records = recs;
+	*rec_count = entry->rec_count;
+	return WERR_OK;
+}
+
+static WERROR dns_lookup_records_cached(struct dns_server *dns,
+					TALLOC_CTX *mem_ctx,
+					struct ldb_dn *dn,
+					bool wildcard,
+					struct dnsp_DnssrvRpcRecord **records,
+					uint16_t *rec_count)
+{
+	struct dns_record_cache *cache = NULL;
+	struct dns_record_cache_entry **slot = NULL;
+	struct dns_record_cache_entry *entry = NULL;
+	const char *dn_str = NULL;
+	WERROR werr;
+
+	cache = dns_record_cache_get(dns);
+	if (cache != NULL) {
+		dn_str = ldb_dn_get_casefold(dn);
+	}
+	if (dn_str == NULL) {
+		goto uncached;
+	}
+
+	slot = dns_record_cache_slot(cache, dn_str, wildcard);
+	entry = *slot;
+	if (entry != NULL &&
+	    entry->wildcard == wildcard &&
+	    (entry->expires == 0 || entry->expires > time(NULL)) &&
+	    strcmp(entry->dn, dn_str) == 0) {
+		return dns_record_cache_copy(entry, mem_ctx,
+					     records, rec_count);
+	}
+
+	entry = talloc_zero(cache, struct dns_record_cache_entry);
+	if (entry == NULL) {
+		goto uncached;
+	}
+	entry->dn = talloc_strdup(entry, dn_str);
+	if (entry->dn == NULL) {
+		TALLOC_FREE(entry);
+		goto uncached;
+	}
+	entry->wildcard = wildcard;
+
+	if (wildcard) {
+		werr = dns_common_wildcard_lookup(dns->samdb, entry, dn,
+						  &entry->records,
+						  &entry->rec_count);
+	} else {
+		werr = dns_common_lookup(dns->samdb, entry, dn,
+					 &entry->records,
+					 &entry->rec_count, NULL);
+	}
+	entry->werr = werr;
+
+	if (W_ERROR_EQUAL(werr, WERR_DNS_ERROR_NAME_DOES_NOT_EXIST) ||
+	    W_ERROR_EQUAL(werr, DNS_ERR(NAME_ERROR))) {
+		entry->expires = time(NULL) + DNS_RECORD_CACHE_NEGATIVE_TIME;
+	} else if (!W_ERROR_IS_OK(werr)) {
+		TALLOC_FREE(entry);
+		return werr;
+	}
+
+	if (*slot != NULL) {
+		talloc_unlink(cache, *slot);
+	}
+	*slot = entry;
+
+	return dns_record_cache_copy(entry, mem_ctx, records, rec_count);
+
+uncached:
+	if (wildcard) {
+		return dns_common_wildcard_lookup(dns->samdb, mem_ctx, dn,
+						  records, rec_count);
+	}
+	return dns_common_lookup(dns->samdb, mem_ctx, dn,
+				 records, rec_count, NULL);
+}
+
 /*
  * Lookup a DNS record, performing an exact match.
  * i.e. DNS wild card records are not considered.
@@ -117,8 +296,8 @@ WERROR dns_lookup_records(struct dns_server *dns,
 			  struct dnsp_DnssrvRpcRecord **records,
 			  uint16_t *rec_count)
 {
-	return dns_common_lookup(dns->samdb, mem_ctx, dn,
-				 records, rec_count, NULL);
+	return dns_lookup_records_cached(dns, mem_ctx, dn, false,
+					 records, rec_count);
 }
 
 /*
@@ -131,8 +310,8 @@ WERROR dns_lookup_records_wildcard(struct dns_server *dns,
 			  struct dnsp_DnssrvRpcRecord **records,
 			  uint16_t *rec_count)
 {
-	return dns_common_wildcard_lookup(dns->samdb, mem_ctx, dn,
-				 records, rec_count);
+	return dns_lookup_records_cached(dns, mem_ctx, dn, true,
+					 records, rec_count);
 }
 
 WERROR dns_replace_records(struct dns_server *dns,
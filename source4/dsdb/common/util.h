@@ -77,6 +77,12 @@ bool is_attr_in_list(const char * const * attrs, const char *attr);
 #define DSDB_SESSION_INFO "sessionInfo"
 #define DSDB_NETWORK_SESSION_INFO "networkSessionInfo"
 
+/*
+ * ldb opaque holding the accounts cached by authsam_search_account(),
+ * thrown away by the partition module when a transaction is cancelled
+ */
+#define DSDB_AUTHSAM_ACCOUNT_CACHE "cache.authsam_accounts"
+
 struct GUID;
 
 char *NS_GUID_string(TALLOC_CTX *mem_ctx, const struct GUID *guid);
@@ -40,6 +40,232 @@ static bool sids_contains_sid(const struct dom_sid *sids,
 	return false;
 }
 
+/*
+ * Cache of expanded group memberships, hung off the ldb context so that
+ * the KDC, auth_sam and tokenGroups in the operational module all share
+ * it for a given SAM handle.
+ *
+ * Each entry holds the full nested expansion of one group for one
+ * filter. The whole cache is thrown away when the database sequence
+ * number (bumped on every write, in any process) changes, when the
+ * session on the ldb changes, or when a transaction is cancelled.
+ */
+#define DSDB_GROUP_EXPANSION_CACHE "cache.group_expansion"
+#define DSDB_GROUP_EXPANSION_CACHE_SIZE 512
+
+struct dsdb_group_expansion {
+	struct dom_sid sid;
+	char *filter;
+	struct dom_sid *sids;
+	unsigned int num_sids;
+};
+
+struct dsdb_group_expansion_cache {
+	uint64_t seq_num;
+	const void *session_info;
+	struct dsdb_group_expansion *entries[DSDB_GROUP_EXPANSION_CACHE_SIZE];
+};
+
+/*
+ * Forget all cached group expansions on this ldb context.
+ */
+void dsdb_group_expansion_cache_flush(struct ldb_context *sam_ctx)
+{
+	struct dsdb_group_expansion_cache *cache = NULL;
+	unsigned int i;
+
+	cache = talloc_get_type(ldb_get_opaque(sam_ctx,
+					       DSDB_GROUP_EXPANSION_CACHE),
+				struct dsdb_group_expansion_cache);
+	if (cache == NULL) {
+		return;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(cache->entries); i++) {
+		TALLOC_FREE(cache->entries[i]);
+	}
+}
+
+/*
+ * Return the group expansion cache for sam_ctx, emptied if the
+ * database has changed since it was filled, or NULL if we can't tell
+ * (in which case we don't cache at all).
+ */
+static struct dsdb_group_expansion_cache *dsdb_group_expansion_cache_get(
+	struct ldb_context *sam_ctx)
+{
+	struct dsdb_group_expansion_cache *cache = NULL;
+	const void *session_info = NULL;
+	uint64_t seq_num;
+	int ret;
+
+	ret = ldb_sequence_number(sam_ctx, LDB_SEQ_HIGHEST_SEQ, &seq_num);
+	if (ret != LDB_SUCCESS) {
+		return NULL;
+	}
+	session_info = ldb_get_opaque(sam_ctx, DSDB_SESSION_INFO);
+
+	cache = talloc_get_type(ldb_get_opaque(sam_ctx,
+					       DSDB_GROUP_EXPANSION_CACHE),
+				struct dsdb_group_expansion_cache);
+	if (cache == NULL) {
+		cache = talloc_zero(sam_ctx, struct dsdb_group_expansion_cache);
+		if (cache == NULL) {
+			return NULL;
+		}
+		ret = ldb_set_opaque(sam_ctx, DSDB_GROUP_EXPANSION_CACHE, cache);
+		if (ret != LDB_SUCCESS) {
+			TALLOC_FREE(cache);
+			return NULL;
+		}
+	} else if (cache->seq_num != seq_num ||
+		   cache->session_info != session_info) {
+		dsdb_group_expansion_cache_flush(sam_ctx);
+	}
+
+	cache->seq_num = seq_num;
+	cache->session_info = session_info;
+
+	return cache;
+}
+
+static struct dsdb_group_expansion **dsdb_group_expansion_slot(
+	struct dsdb_group_expansion_cache *cache,
+	const struct dom_sid *sid)
+{
+	uint32_t h = sid->num_auths;
+	int i;
+
+	for (i = 0; i < sid->num_auths; i++) {
+		h = h * 31 + sid->sub_auths[i];
+	}
+
+	return &cache->entries[h % ARRAY_SIZE(cache->entries)];
+}
+
+static NTSTATUS dsdb_expand_nested_groups_internal(struct ldb_context *sam_ctx,
+						   struct ldb_val *dn_val,
+						   const bool only_childs,
+						   const char *filter,
+						   TALLOC_CTX *res_sids_ctx,
+						   struct dom_sid **res_sids,
+						   unsigned int *num_res_sids,
+						   bool cache_childs);
+
+/*
+ * Add the expansion of the group in "dn_val" to res_sids, using (and
+ * filling) the group expansion cache.
+ */
+static NTSTATUS dsdb_expand_nested_groups_cached(struct ldb_context *sam_ctx,
+						 struct ldb_val *dn_val,
+						 const char *filter,
+						 TALLOC_CTX *res_sids_ctx,
+						 struct dom_sid **res_sids,
+						 unsigned int *num_res_sids)
+{
+	struct dsdb_group_expansion_cache *cache = NULL;
+	struct dsdb_group_expansion **slot = NULL;
+	struct dsdb_group_expansion *entry = NULL;
+	struct dom_sid *sids = NULL;
+	struct ldb_dn *dn;
+	struct dom_sid sid;
+	TALLOC_CTX *tmp_ctx;
+	NTSTATUS status;
+	unsigned int i, n;
+
+	tmp_ctx = talloc_new(res_sids_ctx);
+	if (tmp_ctx == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	if (filter == NULL) {
+		goto uncached;
+	}
+
+	dn = ldb_dn_from_ldb_val(tmp_ctx, sam_ctx, dn_val);
+	if (dn == NULL) {
+		goto uncached;
+	}
+	status = dsdb_get_extended_dn_sid(dn, &sid, "SID");
+	if (!NT_STATUS_IS_OK(status)) {
+		/* let the uncached path sort out what this means */
+		goto uncached;
+	}
+
+	if (sids_contains_sid(*res_sids, *num_res_sids, &sid)) {
+		talloc_free(tmp_ctx);
+		return NT_STATUS_OK;
+	}
+
+	cache = dsdb_group_expansion_cache_get(sam_ctx);
+	if (cache == NULL) {
+		goto uncached;
+	}
+
+	slot = dsdb_group_expansion_slot(cache, &sid);
+	entry = *slot;
+	if (entry == NULL ||
+	    !dom_sid_equal(&entry->sid, &sid) ||
+	    strcmp(entry->filter, filter) != 0) {
+		entry = talloc_zero(cache, struct dsdb_group_expansion);
+		if (entry == NULL) {
+			goto uncached;
+		}
+		entry->sid = sid;
+		entry->filter = talloc_strdup(entry, filter);
+		if (entry->filter == NULL) {
+			TALLOC_FREE(entry);
+			goto uncached;
+		}
+
+		status = dsdb_expand_nested_groups_internal(sam_ctx, dn_val,
+							    false, filter,
+							    entry,
+							    &entry->sids,
+							    &entry->num_sids,
+							    false);
+		if (!NT_STATUS_IS_OK(status)) {
+			TALLOC_FREE(entry);
+			talloc_free(tmp_ctx);
+			return status;
+		}
+
+		TALLOC_FREE(*slot);
+		*slot = entry;
+	}
+	talloc_free(tmp_ctx);
+
+	if (entry->num_sids == 0) {
+		return NT_STATUS_OK;
+	}
+
+	sids = talloc_realloc(res_sids_ctx, *res_sids, struct dom_sid,
+			      *num_res_sids + entry->num_sids);
+	if (sids == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+	*res_sids = sids;
+
+	n = *num_res_sids;
+	for (i = 0; i < entry->num_sids; i++) {
+		/* This is an O(n^2) linear search */
+		if (sids_contains_sid(sids, n, &entry->sids[i])) {
+			continue;
+		}
+		sids[n++] = entry->sids[i];
+	}
+	*num_res_sids = n;
+
+	return NT_STATUS_OK;
+
+uncached:
+	talloc_free(tmp_ctx);
+	return dsdb_expand_nested_groups_internal(sam_ctx, dn_val, false,
+						  filter, res_sids_ctx,
+						  res_sids, num_res_sids,
+						  false);
+}
+
 /*
  * This function generates the transitive closure of a given SAM object "dn_val"
  * (it basically expands nested memberships).
@@ -58,6 +284,45 @@ NTSTATUS dsdb_expand_nested_groups(struct ldb_context *sam_ctx,
 				   struct ldb_val *dn_val, const bool only_childs, const char *filter,
 				   TALLOC_CTX *res_sids_ctx, struct dom_sid **res_sids,
 				   unsigned int *num_res_sids)
+{
+	if (*res_sids == NULL) {
+		*num_res_sids = 0;
+	}
+
+	if (!sam_ctx) {
+		DEBUG(0, ("No SAM available, cannot determine local groups\n"));
+		return NT_STATUS_INVALID_SYSTEM_SERVICE;
+	}
+
+	if (!only_childs) {
+		return dsdb_expand_nested_groups_cached(sam_ctx, dn_val, filter,
+							res_sids_ctx, res_sids,
+							num_res_sids);
+	}
+
+	/*
+	 * The object itself is not cached (it is usually a user), but
+	 * the groups it is a member of are.
+	 */
+	return dsdb_expand_nested_groups_internal(sam_ctx, dn_val, true,
+						  filter, res_sids_ctx,
+						  res_sids, num_res_sids,
+						  true);
+}
+
+/*
+ * The uncached expansion behind dsdb_expand_nested_groups(). With
+ * "cache_childs" the groups found in the memberOf of this object are
+ * expanded through the cache, otherwise the recursion stays here.
+ */
+static NTSTATUS dsdb_expand_nested_groups_internal(struct ldb_context *sam_ctx,
+						   struct ldb_val *dn_val,
+						   const bool only_childs,
+						   const char *filter,
+						   TALLOC_CTX *res_sids_ctx,
+						   struct dom_sid **res_sids,
+						   unsigned int *num_res_sids,
+						   bool cache_childs)
 {
 	const char * const attrs[] = { "memberOf", NULL };
 	unsigned int i;
@@ -185,8 +450,23 @@ NTSTATUS dsdb_expand_nested_groups(struct ldb_context *sam_ctx,
 	el = ldb_msg_find_element(res->msgs[0], "memberOf");
 
 	for (i = 0; el && i < el->num_values; i++) {
-		status = dsdb_expand_nested_groups(sam_ctx, &el->values[i],
-						   false, filter, res_sids_ctx, res_sids, num_res_sids);
+		if (cache_childs) {
+			status = dsdb_expand_nested_groups_cached(sam_ctx,
+								  &el->values[i],
+								  filter,
+								  res_sids_ctx,
+								  res_sids,
+								  num_res_sids);
+		} else {
+			status = dsdb_expand_nested_groups_internal(sam_ctx,
+								    &el->values[i],
+								    false,
+								    filter,
+								    res_sids_ctx,
+								    res_sids,
+								    num_res_sids,
+								    false);
+		}
 		if (!NT_STATUS_IS_OK(status)) {
 			talloc_free(tmp_ctx);
 			return status;
@@ -35,6 +35,138 @@
 #include "lib/ldb-samba/ldb_matching_rules.h"
 #include "lib/util/time.h"
 
+/*
+ * One pending expunge: either a whole tombstone (msg == NULL) or the
+ * expired link values in msg that need to vanish from dn.
+ */
+struct gc_tombstones_op {
+	struct ldb_dn *dn;
+	struct ldb_message *msg;
+	unsigned int num_links;
+};
+
+static int garbage_collect_tombstones_op(struct ldb_context *samdb,
+					 struct gc_tombstones_op *op)
+{
+	int ret;
+
+	if (op->msg == NULL) {
+		ret = dsdb_delete(samdb, op->dn,
+				  DSDB_SEARCH_SHOW_RECYCLED
+				  |DSDB_MODIFY_RELAX);
+		if (ret != LDB_SUCCESS) {
+			DEBUG(1,(__location__ ": Failed to remove "
+				 "deleted object %s\n",
+				 ldb_dn_get_linearized(op->dn)));
+		} else {
+			DEBUG(4,("Removed deleted object %s\n",
+				 ldb_dn_get_linearized(op->dn)));
+		}
+		return ret;
+	}
+
+	ret = dsdb_modify(samdb, op->msg, DSDB_REPLMD_VANISH_LINKS);
+	if (ret != LDB_SUCCESS) {
+		DEBUG(1,(__location__ ": Failed to remove deleted object %s\n",
+			 ldb_dn_get_linearized(op->dn)));
+	} else {
+		DEBUG(4,("Removed deleted object %s\n",
+			 ldb_dn_get_linearized(op->dn)));
+	}
+	return ret;
+}
+
+/*
+ * Apply the expunges in transactions of at most batch_size operations,
+ * so the write lock is dropped regularly and other writers (the drepl
+ * server, LDAP clients) get their turn in between, while we still avoid
+ * a commit for every single object.
+ *
+ * If anything in a batch fails, the batch is cancelled and redone with
+ * one transaction per operation, so that a single bad object does not
+ * hold back the others.
+ */
+static NTSTATUS garbage_collect_tombstones_apply(TALLOC_CTX *mem_ctx,
+						 struct ldb_context *samdb,
+						 struct gc_tombstones_op *ops,
+						 unsigned int num_ops,
+						 unsigned int batch_size,
+						 unsigned int *num_links_removed,
+						 unsigned int *num_objects_removed,
+						 unsigned int *num_batches,
+						 char **error_string)
+{
+	unsigned int i, j;
+	int ret;
+
+	if (batch_size == 0) {
+		batch_size = 1;
+	}
+
+	for (i = 0; i < num_ops; i += batch_size) {
+		unsigned int n = MIN(batch_size, num_ops - i);
+
+		ret = ldb_transaction_start(samdb);
+		if (ret != LDB_SUCCESS) {
+			*error_string = talloc_asprintf(mem_ctx,
+							"Failed to start transaction: %s",
+							ldb_errstring(samdb));
+			return NT_STATUS_INTERNAL_ERROR;
+		}
+
+		for (j = 0; j < n; j++) {
+			ret = garbage_collect_tombstones_op(samdb, &ops[i+j]);
+			if (ret != LDB_SUCCESS) {
+				break;
+			}
+		}
+
+		if (ret == LDB_SUCCESS) {
+			ret = ldb_transaction_commit(samdb);
+			if (ret != LDB_SUCCESS) {
+				*error_string = talloc_asprintf(mem_ctx,
+								"Failed to commit transaction: %s",
+								ldb_errstring(samdb));
+				return NT_STATUS_INTERNAL_ERROR;
+			}
+			(*num_batches)++;
+
+			for (j = 0; j < n; j++) {
+				if (ops[i+j].msg == NULL) {
+					(*num_objects_removed)++;
+				} else {
+					*num_links_removed += ops[i+j].num_links;
+				}
+			}
+			continue;
+		}
+
+		ldb_transaction_cancel(samdb);
+
+		if (n == 1) {
+			continue;
+		}
+
+		DEBUG(3, ("Retrying batch of %u expunges one by one\n", n));
+
+		for (j = 0; j < n; j++) {
+			ret = garbage_collect_tombstones_op(samdb, &ops[i+j]);
+			if (ret != LDB_SUCCESS) {
+				continue;
+			}
+			(*num_batches)++;
+
+			if (ops[i+j].msg == NULL) {
+				(*num_objects_removed)++;
+			} else {
+				*num_links_removed += ops[i+j].num_links;
+			}
+		}
+	}
+
+	return NT_STATUS_OK;
+}
+
 static NTSTATUS garbage_collect_tombstones_part(TALLOC_CTX *mem_ctx,
 						struct ldb_context *samdb,
 						struct dsdb_ldb_dn_list_node *part,
@@ -44,13 +176,22 @@ static NTSTATUS garbage_collect_tombstones_part(TALLOC_CTX *mem_ctx,
 						struct dsdb_schema *schema,
 						const char **attrs,
 						char **error_string,
-						NTTIME expunge_time_nttime)
+						NTTIME expunge_time_nttime,
+						unsigned int batch_size)
 {
 	int ret;
 	struct ldb_dn *do_dn;
 	struct ldb_result *res;
 	unsigned int i, j, k;
 	uint32_t flags;
+	struct gc_tombstones_op *ops;
+	unsigned int num_ops = 0;
+	unsigned int num_batches = 0;
+	unsigned int objects_before = *num_objects_removed;
+	unsigned int links_before = *num_links_removed;
+	struct timeval start = timeval_current();
+	double search_time;
+	NTSTATUS status;
 	TALLOC_CTX *tmp_ctx = talloc_new(mem_ctx);
 	if (!tmp_ctx) {
 		return NT_STATUS_NO_MEMORY;
@@ -83,6 +224,18 @@ static NTSTATUS garbage_collect_tombstones_part(TALLOC_CTX *mem_ctx,
 		return NT_STATUS_INTERNAL_ERROR;
 	}
 
+	search_time = timeval_elapsed(&start);
+
+	/*
+	 * First only collect what needs to be done: the search is finished
+	 * and the read lock dropped before we start to modify anything.
+	 */
+	ops = talloc_array(tmp_ctx, struct gc_tombstones_op, res->count);
+	if (ops == NULL) {
+		TALLOC_FREE(tmp_ctx);
+		return NT_STATUS_NO_MEMORY;
+	}
+
 	for (i=0; i<res->count; i++) {
 		struct ldb_message *cleanup_msg = NULL;
 		unsigned int num_modified = 0;
@@ -95,20 +248,9 @@ static NTSTATUS garbage_collect_tombstones_part(TALLOC_CTX *mem_ctx,
 				continue;
 			}
 
-			ret = dsdb_delete(samdb, res->msgs[i]->dn,
-					  DSDB_SEARCH_SHOW_RECYCLED
-					  |DSDB_MODIFY_RELAX);
-			if (ret != LDB_SUCCESS) {
-				DEBUG(1,(__location__ ": Failed to remove "
-					 "deleted object %s\n",
-					 ldb_dn_get_linearized(res->
-							       msgs[i]->dn)));
-			} else {
-				DEBUG(4,("Removed deleted object %s\n",
-					 ldb_dn_get_linearized(res->
-							       msgs[i]->dn)));
-				(*num_objects_removed)++;
-			}
+			ops[num_ops++] = (struct gc_tombstones_op) {
+				.dn = res->msgs[i]->dn,
+			};
 			continue;
 		}
 
@@ -146,7 +288,6 @@ static NTSTATUS garbage_collect_tombstones_part(TALLOC_CTX *mem_ctx,
 			for (k = 0; k < element->num_values; k++) {
 				struct ldb_val *value = &element->values[k];
 				uint64_t whenChanged = 0;
-				NTSTATUS status;
 				struct dsdb_dn *dn;
 				struct ldb_message_element *cleanup_elem = NULL;
 				char *guid_search_str = NULL;
@@ -194,17 +335,18 @@ static NTSTATUS garbage_collect_tombstones_part(TALLOC_CTX *mem_ctx,
 				}
 
 				guid_buf_str = GUID_buf_string(&guid, &buf_guid);
-				guid_search_str = talloc_asprintf(mem_ctx,
+				guid_search_str = talloc_asprintf(tmp_ctx,
 								  "<GUID=%s>;%s",
 								  guid_buf_str,
-								  dsdb_dn_get_linearized(mem_ctx, dn));
+								  dsdb_dn_get_linearized(tmp_ctx, dn));
 				cleanup_val = data_blob_string_const(guid_search_str);
 
 				talloc_free(dn);
 
 				if (cleanup_msg == NULL) {
-					cleanup_msg = ldb_msg_new(mem_ctx);
+					cleanup_msg = ldb_msg_new(tmp_ctx);
 					if (cleanup_msg == NULL) {
+						TALLOC_FREE(tmp_ctx);
 						return NT_STATUS_NO_MEMORY;
 					}
 					cleanup_msg->dn = res->msgs[i]->dn;
@@ -215,6 +357,7 @@ static NTSTATUS garbage_collect_tombstones_part(TALLOC_CTX *mem_ctx,
 							&cleanup_val,
 							&cleanup_elem);
 				if (ret != LDB_SUCCESS) {
+					TALLOC_FREE(tmp_ctx);
 					return NT_STATUS_NO_MEMORY;
 				}
 				cleanup_elem->flags = LDB_FLAG_MOD_DELETE;
@@ -223,22 +366,32 @@ static NTSTATUS garbage_collect_tombstones_part(TALLOC_CTX *mem_ctx,
 		}
 
 		if (num_modified > 0) {
-			ret = dsdb_modify(samdb, cleanup_msg,
-					  DSDB_REPLMD_VANISH_LINKS);
-			if (ret != LDB_SUCCESS) {
-				DEBUG(1,(__location__ ": Failed to remove deleted object %s\n",
-					 ldb_dn_get_linearized(res->msgs[i]->dn)));
-			} else {
-				DEBUG(4,("Removed deleted object %s\n",
-					 ldb_dn_get_linearized(res->msgs[i]->dn)));
-				*num_links_removed = *num_links_removed + num_modified;
-			}
-
+			ops[num_ops++] = (struct gc_tombstones_op) {
+				.dn = res->msgs[i]->dn,
+				.msg = cleanup_msg,
+				.num_links = num_modified,
+			};
 		}
 	}
 
+	status = garbage_collect_tombstones_apply(mem_ctx, samdb,
+						  ops, num_ops, batch_size,
+						  num_links_removed,
+						  num_objects_removed,
+						  &num_batches,
+						  error_string);
+
+	DEBUG(2, ("Expunged %u objects and %u links from %s: "
+		  "search took %.3f seconds, %u transactions took "
+		  "%.3f seconds\n",
+		  *num_objects_removed - objects_before,
+		  *num_links_removed - links_before,
+		  ldb_dn_get_linearized(part->dn),
+		  search_time, num_batches,
+		  timeval_elapsed(&start) - search_time));
+
 	TALLOC_FREE(tmp_ctx);
-	return NT_STATUS_OK;
+	return status;
 }
 
 /*
@@ -276,8 +429,18 @@ NTSTATUS dsdb_garbage_collect_tombstones(TALLOC_CTX *mem_ctx,
 	unsigned long long expunge_time = current_time - tombstoneLifetime*60*60*24;
 	char *expunge_time_string = ldb_timestring_utc(mem_ctx, expunge_time);
 	NTTIME expunge_time_nttime;
+	struct loadparm_context *lp_ctx =
+		talloc_get_type(ldb_get_opaque(samdb, "loadparm"),
+				struct loadparm_context);
+	unsigned int batch_size = 100;
 	unix_to_nt_time(&expunge_time_nttime, expunge_time);
 
+	if (lp_ctx != NULL) {
+		batch_size = lpcfg_parm_int(lp_ctx, NULL, "dsdb",
+					    "tombstone expunge batch size",
+					    batch_size);
+	}
+
 	*num_objects_removed = 0;
 	*num_links_removed = 0;
 	*error_string = NULL;
@@ -337,7 +500,8 @@ NTSTATUS dsdb_garbage_collect_tombstones(TALLOC_CTX *mem_ctx,
 							 num_objects_removed,
 							 schema, attrs,
 							 error_string,
-							 expunge_time_nttime);
+							 expunge_time_nttime,
+							 batch_size);
 		if (!NT_STATUS_IS_OK(status)) {
 			return status;
 		}
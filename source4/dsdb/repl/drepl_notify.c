@@ -431,16 +431,11 @@ static void dreplsrv_notify_handler_te(struct tevent_context *ev, struct tevent_
 	}
 }
 
-WERROR dreplsrv_notify_schedule(struct dreplsrv_service *service, uint32_t next_interval)
+static WERROR dreplsrv_notify_schedule_at(struct dreplsrv_service *service,
+					  struct timeval next_time)
 {
 	TALLOC_CTX *tmp_mem;
 	struct tevent_timer *new_te;
-	struct timeval next_time;
-
-	/* prevent looping */
-	if (next_interval == 0) next_interval = 1;
-
-	next_time = timeval_current_ofs(next_interval, 50);
 
 	if (service->notify.te) {
 		/*
@@ -461,8 +456,7 @@ WERROR dreplsrv_notify_schedule(struct dreplsrv_service *service, uint32_t next_
 	W_ERROR_HAVE_NO_MEMORY(new_te);
 
 	tmp_mem = talloc_new(service);
-	DBG_DEBUG("dreplsrv_notify_schedule(%u) %sscheduled for: %s\n",
-		  next_interval,
+	DBG_DEBUG("dreplsrv_notify_schedule %sscheduled for: %s\n",
 		  (service->notify.te?"re":""),
 		  nt_time_string(tmp_mem, timeval_to_nttime(&next_time)));
 	talloc_free(tmp_mem);
@@ -473,6 +467,61 @@ WERROR dreplsrv_notify_schedule(struct dreplsrv_service *service, uint32_t next_
 	return WERR_OK;
 }
 
+WERROR dreplsrv_notify_schedule(struct dreplsrv_service *service, uint32_t next_interval)
+{
+	/* prevent looping */
+	if (next_interval == 0) next_interval = 1;
+
+	return dreplsrv_notify_schedule_at(service,
+					   timeval_current_ofs(next_interval, 50));
+}
+
+/*
+  called by repl_meta_data (MSG_DREPL_NOTIFY_CHANGES) after a
+  transaction that changed replicated data has been committed.
+
+  Instead of waiting up to "notify_interval" seconds for the next
+  run, we look at the partitions after a short delay.  While changes
+  keep arriving within that delay we double it, up to the normal
+  notify interval, so a burst of writes still ends up as a single
+  DsReplicaSync per partner. Once it got quiet again, we fall back to
+  the minimal delay.
+ */
+void dreplsrv_notify_changes(struct imessaging_context *msg,
+			     void *private_data,
+			     uint32_t msg_type,
+			     struct server_id server_id,
+			     DATA_BLOB *data)
+{
+	struct dreplsrv_service *service =
+		talloc_get_type(private_data, struct dreplsrv_service);
+	struct timeval now = timeval_current();
+	uint32_t max_delay = service->notify.interval * 1000;
+	WERROR status;
+
+	if (service->am_rodc) {
+		/* we do not send DsReplicaSync as RODC */
+		return;
+	}
+
+	if (!timeval_is_zero(&service->notify.last_change) &&
+	    timeval_elapsed2(&service->notify.last_change, &now) * 1000 <
+	    service->notify.delay) {
+		service->notify.delay = MIN(service->notify.delay * 2,
+					    max_delay);
+	} else {
+		service->notify.delay = service->notify.min_delay;
+	}
+	service->notify.last_change = now;
+
+	status = dreplsrv_notify_schedule_at(service,
+			timeval_current_ofs_msec(service->notify.delay));
+	if (!W_ERROR_IS_OK(status)) {
+		DBG_ERR("Failed to schedule notify run: %s\n",
+			win_errstr(status));
+	}
+}
+
 static void dreplsrv_notify_run(struct dreplsrv_service *service)
 {
 	TALLOC_CTX *mem_ctx;
@@ -507,6 +507,9 @@ static NTSTATUS dreplsrv_task_init(struct task_server *task)
 	if (!service->am_rodc) {
 		service->notify.interval = lpcfg_parm_int(task->lp_ctx, NULL, "dreplsrv",
 							   "notify_interval", 5); /* in seconds */
+		service->notify.min_delay = lpcfg_parm_int(task->lp_ctx, NULL, "dreplsrv",
+							    "notify_delay", 100); /* in milliseconds */
+		service->notify.delay = service->notify.min_delay;
 		status = dreplsrv_notify_schedule(service, service->notify.interval);
 		if (!W_ERROR_IS_OK(status)) {
 			task_server_terminate(task, talloc_asprintf(task,
@@ -526,6 +529,7 @@ static NTSTATUS dreplsrv_task_init(struct task_server *task)
 	IRPC_REGISTER(task->msg_ctx, irpc, DREPL_TAKEFSMOROLE, drepl_take_FSMO_role, service);
 	IRPC_REGISTER(task->msg_ctx, irpc, DREPL_TRIGGER_REPL_SECRET, drepl_trigger_repl_secret, service);
 	imessaging_register(task->msg_ctx, service, MSG_DREPL_ALLOCATE_RID, dreplsrv_allocate_rid);
+	imessaging_register(task->msg_ctx, service, MSG_DREPL_NOTIFY_CHANGES, dreplsrv_notify_changes);
 
 	return NT_STATUS_OK;
 }
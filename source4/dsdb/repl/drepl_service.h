@@ -213,6 +213,17 @@ struct dreplsrv_service {
 
 		/* here we have a reference to the timed event the schedules the notifies */
 		struct tevent_timer *te;
+
+		/*
+		 * the delay (in msec) used to coalesce changes announced
+		 * via MSG_DREPL_NOTIFY_CHANGES, it adapts between
+		 * min_delay and interval
+		 */
+		uint32_t min_delay;
+		uint32_t delay;
+
+		/* when we got the last MSG_DREPL_NOTIFY_CHANGES */
+		struct timeval last_change;
 	} notify;
 
 	/*
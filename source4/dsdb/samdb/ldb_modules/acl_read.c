@@ -53,6 +53,29 @@ struct aclread_context {
 	/* cache on the last parent we checked in this search */
 	struct ldb_dn *last_parent_dn;
 	int last_parent_check_ret;
+
+	/*
+	 * Access check results for the attributes of the objects in
+	 * this search sharing one SD, structural class and (if the SD
+	 * grants anything to PRINCIPAL_SELF) objectSid.
+	 * The token is constant during a search, so these are only
+	 * dropped when one of the others changes.
+	 */
+	struct aclread_access_cache {
+		uint64_t sd_generation;
+		const struct dsdb_class *objectclass;
+		/* only ACEs for PRINCIPAL_SELF depend on the objectSid */
+		bool sid_matters;
+		bool has_sid;
+		struct dom_sid sid;
+		struct aclread_access_entry {
+			const struct dsdb_attribute *attr;
+			uint32_t access_mask;
+			int ret;
+		} *entries;
+		size_t num_entries;
+		size_t next_entry;
+	} access_cache;
 };
 
 struct aclread_private {
@@ -61,6 +84,9 @@ struct aclread_private {
 	/* cache of the last SD we read during any search */
 	struct security_descriptor *sd_cached;
 	struct ldb_val sd_cached_blob;
+
+	/* incremented every time sd_cached is replaced */
+	uint64_t sd_generation;
 };
 
 static void aclread_mark_inaccesslible(struct ldb_message_element *el) {
@@ -222,10 +248,130 @@ static int aclread_get_sd_from_ldb_message(struct aclread_context *ac,
 
 	talloc_unlink(private_data, private_data->sd_cached);
 	private_data->sd_cached = *sd;
+	private_data->sd_generation++;
 
 	return LDB_SUCCESS;
 }
 
+/*
+ * Does the answer of sec_access_check_ds() on this SD depend on the
+ * sid to replace PRINCIPAL_SELF with?
+ */
+static bool aclread_sd_has_self_ace(const struct security_descriptor *sd)
+{
+	struct dom_sid self_sid;
+	uint32_t i;
+
+	if (sd->dacl == NULL) {
+		return false;
+	}
+
+	dom_sid_parse(SID_NT_SELF, &self_sid);
+
+	for (i = 0; i < sd->dacl->num_aces; i++) {
+		if (dom_sid_equal(&sd->dacl->aces[i].trustee, &self_sid)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Check access on an attribute of an object whose SD was just returned
+ * by aclread_get_sd_from_ldb_message().
+ *
+ * Objects in a domain share few distinct security descriptors, so
+ * search results tend to ask the same questions about the same SD
+ * for object after object.  Remember the answers for as long as the
+ * SD, structural class and, where it matters, objectSid stay the
+ * same, rather than walking the ACEs again for every attribute of
+ * every object.
+ */
+static int aclread_check_access_on_attribute(
+	struct aclread_context *ac,
+	TALLOC_CTX *mem_ctx,
+	struct security_descriptor *sd,
+	struct dom_sid *sid,
+	uint32_t access_mask,
+	const struct dsdb_attribute *attr,
+	const struct dsdb_class *objectclass)
+{
+	struct aclread_private *private_data
+		= talloc_get_type(ldb_module_get_private(ac->module),
+				  struct aclread_private);
+	struct aclread_access_cache *cache = &ac->access_cache;
+	struct aclread_access_entry *entries = NULL;
+	size_t i;
+	int ret;
+
+	if (sd != private_data->sd_cached) {
+		/* don't trust the cache for any other SD */
+		return acl_check_access_on_attribute(ac->module, mem_ctx,
+						     sd, sid, access_mask,
+						     attr, objectclass);
+	}
+
+	if (cache->sd_generation != private_data->sd_generation ||
+	    cache->objectclass != objectclass ||
+	    (cache->sid_matters &&
+	     (cache->has_sid != (sid != NULL) ||
+	      (sid != NULL && !dom_sid_equal(&cache->sid, sid))))) {
+		if (cache->sd_generation != private_data->sd_generation) {
+			cache->sid_matters = aclread_sd_has_self_ace(sd);
+		}
+		cache->sd_generation = private_data->sd_generation;
+		cache->objectclass = objectclass;
+		cache->has_sid = (sid != NULL);
+		cache->sid = (sid != NULL) ? *sid : (struct dom_sid) {0};
+		cache->num_entries = 0;
+		cache->next_entry = 0;
+	}
+
+	/*
+	 * Objects of one class usually come with their attributes in
+	 * the same order, so try the entry after the last one used
+	 * first.
+	 */
+	i = cache->next_entry;
+	if (i < cache->num_entries &&
+	    cache->entries[i].attr == attr &&
+	    cache->entries[i].access_mask == access_mask) {
+		cache->next_entry = i + 1;
+		return cache->entries[i].ret;
+	}
+	for (i = 0; i < cache->num_entries; i++) {
+		if (cache->entries[i].attr == attr &&
+		    cache->entries[i].access_mask == access_mask) {
+			cache->next_entry = i + 1;
+			return cache->entries[i].ret;
+		}
+	}
+
+	ret = acl_check_access_on_attribute(ac->module, mem_ctx, sd, sid,
+					    access_mask, attr, objectclass);
+	if (ret != LDB_SUCCESS && ret != LDB_ERR_INSUFFICIENT_ACCESS_RIGHTS) {
+		return ret;
+	}
+
+	entries = talloc_realloc(ac, cache->entries,
+				 struct aclread_access_entry,
+				 cache->num_entries + 1);
+	if (entries == NULL) {
+		/* just don't remember this one */
+		return ret;
+	}
+	entries[cache->num_entries] = (struct aclread_access_entry) {
+		.attr = attr,
+		.access_mask = access_mask,
+		.ret = ret,
+	};
+	cache->entries = entries;
+	cache->num_entries++;
+	cache->next_entry = cache->num_entries;
+
+	return ret;
+}
+
 /*
  * Returns the access mask required to read a given attribute
  */
@@ -305,8 +451,8 @@ static int check_attr_access_rights(TALLOC_CTX *mem_ctx, const char *attr_name,
 		return LDB_SUCCESS;
 	}
 
-	ret = acl_check_access_on_attribute(ac->module, mem_ctx, sd, sid,
-					    access_mask, attr, objectclass);
+	ret = aclread_check_access_on_attribute(ac, mem_ctx, sd, sid,
+						access_mask, attr, objectclass);
 
 	if (ret == LDB_ERR_INSUFFICIENT_ACCESS_RIGHTS) {
 		return ret;
@@ -576,13 +722,13 @@ static int aclread_callback(struct ldb_request *req, struct ldb_reply *ares)
 				continue;
 			}
 
-			ret = acl_check_access_on_attribute(ac->module,
-							    tmp_ctx,
-							    sd,
-							    sid,
-							    access_mask,
-							    attr,
-							    objectclass);
+			ret = aclread_check_access_on_attribute(ac,
+								tmp_ctx,
+								sd,
+								sid,
+								access_mask,
+								attr,
+								objectclass);
 
 			/*
 			 * Dirsync control needs the replpropertymetadata attribute
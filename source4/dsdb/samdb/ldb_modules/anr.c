@@ -322,6 +322,16 @@ static int anr_search(struct ldb_module *module, struct ldb_request *req)
 	struct anr_context *ac;
 	int ret;
 
+	/*
+	 * Nearly every search (including all the simple base DN reads
+	 * the rest of the dsdb stack makes) has no anr term at all,
+	 * let those through without allocating a context or walking
+	 * the tree a second time.
+	 */
+	if (!dsdb_attr_in_parse_tree(req->op.search.tree, "anr")) {
+		return ldb_next_request(module, req);
+	}
+
 	ldb = ldb_module_get_ctx(module);
 
 	ac = talloc(req, struct anr_context);
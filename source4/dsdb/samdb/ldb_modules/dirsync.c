@@ -28,6 +28,7 @@
 #include "librpc/ndr/libndr.h"
 #include "dsdb/samdb/samdb.h"
 #include "dsdb/samdb/ldb_modules/util.h"
+#include "lib/util/binsearch.h"
 
 #define LDAP_DIRSYNC_OBJECT_SECURITY		0x01
 #define LDAP_DIRSYNC_ANCESTORS_FIRST_ORDER	0x800
@@ -62,6 +63,35 @@ struct dirsync_context {
 	struct drsuapi_DsReplicaCursor *cursors;
 };
 
+static int dirsync_cursor_cmp(const struct GUID *invocation_id,
+			      const struct GUID cursor_invocation_id)
+{
+	return GUID_compare(invocation_id, &cursor_invocation_id);
+}
+
+/*
+ * If we have in the uptodateness vector an entry with the same
+ * invocation id as the originating invocation and if the usn in the
+ * vector is greater or equal to the one in originating_usn, then it
+ * means that this change has already been sent (from another DC) to
+ * the client, no need to resend it one more time.
+ *
+ * dsc->cursors is sorted by invocation id without duplicates.
+ */
+static bool dirsync_already_sent(const struct dirsync_context *dsc,
+				 const struct GUID *invocation_id,
+				 uint64_t originating_usn)
+{
+	const struct drsuapi_DsReplicaCursor *cursor = NULL;
+
+	BINARY_ARRAY_SEARCH(dsc->cursors, dsc->cursor_size,
+			    source_dsa_invocation_id, invocation_id,
+			    dirsync_cursor_cmp, cursor);
+	if (cursor == NULL) {
+		return false;
+	}
+	return cursor->highest_usn >= originating_usn;
+}
 
 static int dirsync_filter_entry(struct ldb_request *req,
 					struct ldb_message *msg,
@@ -167,7 +197,7 @@ static int dirsync_filter_entry(struct ldb_request *req,
 
 		if (ldb_attr_cmp(msg->elements[i].name,
 						"replPropertyMetaData") == 0) {
-			replMetaData = (talloc_steal(dsc, &msg->elements[i].values[0]));
+			replMetaData = &msg->elements[i].values[0];
 			continue;
 		}
 	}
@@ -244,12 +274,6 @@ static int dirsync_filter_entry(struct ldb_request *req,
 		return ldb_module_send_entry(dsc->req, msg, controls);
 	}
 
-	ndr_err = ndr_pull_struct_blob(replMetaData, dsc, &rmd,
-		(ndr_pull_flags_fn_t)ndr_pull_replPropertyMetaDataBlob);
-	if (!NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
-		ldb_set_errstring(ldb, "Unable to unmarshall replPropertyMetaData");
-		return ldb_module_done(dsc->req, NULL, NULL, LDB_ERR_OPERATIONS_ERROR);
-	}
 	if (ldb_attr_in_list(req->op.search.attrs, "name") ||
 			ldb_attr_in_list(req->op.search.attrs, "*")) {
 		nameasked = true;
@@ -271,6 +295,18 @@ static int dirsync_filter_entry(struct ldb_request *req,
 	}
 
 	if (dsc->fromreqUSN > 0 || dsc->cursors != NULL) {
+		/*
+		 * The metadata is only needed to find the attributes
+		 * changed since the cookie, it is decoded on the entry
+		 * so it goes away with it.
+		 */
+		ndr_err = ndr_pull_struct_blob(replMetaData, msg, &rmd,
+			(ndr_pull_flags_fn_t)ndr_pull_replPropertyMetaDataBlob);
+		if (!NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
+			ldb_set_errstring(ldb, "Unable to unmarshall replPropertyMetaData");
+			return ldb_module_done(dsc->req, NULL, NULL, LDB_ERR_OPERATIONS_ERROR);
+		}
+
 		j = 0;
 		/*
 		* Allocate an array of size(replMetaData) of char*
@@ -285,24 +321,11 @@ static int dirsync_filter_entry(struct ldb_request *req,
 			if (omd->local_usn > dsc->fromreqUSN) {
 				const struct dsdb_attribute *a = dsdb_attribute_by_attributeID_id(dsc->schema,
 										omd->attid);
-				if (!dsc->localonly) {
-					struct drsuapi_DsReplicaCursor *tab = dsc->cursors;
-					uint32_t l;
-					for (l=0; l < dsc->cursor_size; l++) {
-						if (GUID_equal(&tab[l].source_dsa_invocation_id, &omd->originating_invocation_id) &&
-								tab[l].highest_usn >= omd->originating_usn) {
-							/*
-							 * If we have in the uptodateness vector an entry
-							 * with the same invocation id as the originating invocation
-							 * and if the usn in the vector is greater or equal to
-							 * the one in originating_usn, then it means that this entry
-							 * has already been sent (from another DC) to the client
-							 * no need to resend it one more time.
-							 */
-							goto skip;
-						}
-					}
-					/* If we are here it's because we have a usn > (max(usn of vectors))*/
+				if (!dsc->localonly &&
+				    dirsync_already_sent(dsc,
+						&omd->originating_invocation_id,
+						omd->originating_usn)) {
+					goto skip;
 				}
 				if (namereturned == false &&
 						nameasked == true &&
@@ -319,6 +342,7 @@ skip:
 			}
 		}
 		size = j;
+		TALLOC_FREE(rmd.ctr.ctr1.array);
 	} else {
 		size = 0;
 		if (ldb_attr_in_list(req->op.search.attrs, "*") ||
@@ -482,29 +506,13 @@ skip:
 
 
 				if (tmp_usn > dsc->fromreqUSN) {
-					if (!dsc->localonly) {
-						struct drsuapi_DsReplicaCursor *tab = dsc->cursors;
-						uint32_t l;
-
-						for (l=0; l < dsc->cursor_size; l++) {
-							if (GUID_equal(&tab[l].source_dsa_invocation_id, &invocation_id) &&
-									tab[l].highest_usn >= tmp_usn2) {
-								/*
-								* If we have in the uptodateness vector an entry
-								* with the same invocation id as the originating invocation
-								* and if the usn in the vector is greater or equal to
-								* the one in originating_usn, then it means that this entry
-								* has already been sent (from another DC) to the client
-								* no need to resend it one more time.
-								*/
-								goto skip_link;
-							}
-						}
-						/* If we are here it's because we have a usn > (max(usn of vectors))*/
-						keep = true;
-					} else {
-						keep = true;
+					if (!dsc->localonly &&
+					    dirsync_already_sent(dsc,
+							&invocation_id,
+							tmp_usn2)) {
+						goto skip_link;
 					}
+					keep = true;
 				/* If we are here it's because the link is more recent than either any
 				 * originating usn or local usn
 				 */
@@ -1285,7 +1293,7 @@ static int dirsync_ldb_search(struct ldb_module *module, struct ldb_request *req
 		if (cookie.blob.extra_length > 0 &&
 				cookie.blob.extra.uptodateness_vector.ctr.ctr1.count > 0) {
 			struct drsuapi_DsReplicaCursor cursor;
-			uint32_t p;
+			uint32_t p, i;
 			for (p=0; p < cookie.blob.extra.uptodateness_vector.ctr.ctr1.count; p++) {
 				cursor = cookie.blob.extra.uptodateness_vector.ctr.ctr1.cursors[p];
 				if (GUID_equal( &(cursor.source_dsa_invocation_id), dsc->our_invocation_id)) {
@@ -1300,6 +1308,28 @@ static int dirsync_ldb_search(struct ldb_module *module, struct ldb_request *req
 				return ldb_oom(ldb);
 			}
 			dsc->cursor_size = p;
+
+			/*
+			 * Sort the cursors once so that each replicated
+			 * attribute of each entry can be checked with a
+			 * binary search, if an invocation id is listed more
+			 * than once only the highest usn matters.
+			 */
+			TYPESAFE_QSORT(dsc->cursors, dsc->cursor_size,
+				       drsuapi_DsReplicaCursor_compare);
+			for (p = 1, i = 1; i < dsc->cursor_size; i++) {
+				struct drsuapi_DsReplicaCursor *last =
+					&dsc->cursors[p - 1];
+
+				if (GUID_equal(&last->source_dsa_invocation_id,
+					&dsc->cursors[i].source_dsa_invocation_id)) {
+					last->highest_usn = MAX(last->highest_usn,
+						dsc->cursors[i].highest_usn);
+					continue;
+				}
+				dsc->cursors[p++] = dsc->cursors[i];
+			}
+			dsc->cursor_size = p;
 		}
 	}
 
@@ -76,6 +76,8 @@ struct results_store {
 	struct GUID *results;
 	size_t num_entries;
 	size_t result_array_size;
+	/* index of results[0], entries before it have been sent */
+	size_t results_offset;
 
 	struct ldb_control **down_controls;
 	const char * const *attrs;
@@ -237,6 +239,39 @@ static int paged_search_by_dn_guid(struct ldb_module *module,
 	return ret;
 }
 
+/*
+ * The GUIDs of entries already sent are not needed any more. Give their
+ * memory back once they make up at least half of the array, so a
+ * store shrinks while the client pages through a large result.
+ */
+static int paged_results_trim(struct results_store *store)
+{
+	size_t sent = store->last_i - store->results_offset;
+	size_t remaining = store->num_entries - store->last_i;
+
+	if (sent == 0 || sent < remaining) {
+		return LDB_SUCCESS;
+	}
+
+	if (remaining == 0) {
+		TALLOC_FREE(store->results);
+	} else {
+		memmove(store->results,
+			&store->results[sent],
+			sizeof(struct GUID) * remaining);
+		store->results = talloc_realloc(store, store->results,
+						struct GUID,
+						remaining);
+		if (store->results == NULL) {
+			return LDB_ERR_OPERATIONS_ERROR;
+		}
+	}
+	store->result_array_size = remaining;
+	store->results_offset = store->last_i;
+
+	return LDB_SUCCESS;
+}
+
 static int paged_results(struct paged_context *ac)
 {
 	struct ldb_paged_control *paged;
@@ -248,7 +283,8 @@ static int paged_results(struct paged_context *ac)
 	}
 
 	while (ac->store->last_i < ac->store->num_entries && ac->size > 0) {
-		struct GUID *guid = &ac->store->results[ac->store->last_i++];
+		struct GUID *guid = &ac->store->results[ac->store->last_i++ -
+							ac->store->results_offset];
 		struct ldb_result *result = NULL;
 
 		ac->size--;
@@ -282,6 +318,11 @@ static int paged_results(struct paged_context *ac)
 		}
 	}
 
+	ret = paged_results_trim(ac->store);
+	if (ret != LDB_SUCCESS) {
+		return ret;
+	}
+
 	if (ac->store->first_ref) {
 		/* There is no right place to put references in the sorted
 		   results, so we send them as soon as possible.
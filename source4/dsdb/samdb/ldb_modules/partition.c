@@ -41,6 +41,7 @@ struct partition_context {
 	struct ldb_request *req;
 
 	struct part_request *part_req;
+	unsigned int num_part_req_allocated;
 	unsigned int num_requests;
 	unsigned int finished_requests;
 
@@ -63,6 +64,32 @@ static struct partition_context *partition_init_ctx(struct ldb_module *module, s
 	return ac;
 }
 
+/*
+ * Make room for num_requests sub-requests in one go, so fanning a
+ * search out over all the partitions does not realloc the array once
+ * per partition.
+ */
+static int partition_alloc_requests(struct partition_context *ac,
+				    unsigned int num_requests)
+{
+	struct part_request *part_req = NULL;
+
+	if (num_requests <= ac->num_part_req_allocated) {
+		return LDB_SUCCESS;
+	}
+
+	part_req = talloc_realloc(ac, ac->part_req,
+				  struct part_request,
+				  num_requests);
+	if (part_req == NULL) {
+		return ldb_oom(ldb_module_get_ctx(ac->module));
+	}
+	ac->part_req = part_req;
+	ac->num_part_req_allocated = num_requests;
+
+	return LDB_SUCCESS;
+}
+
 /*
  * helper functions to call the next module in chain
  */
@@ -239,11 +266,9 @@ static int partition_prep_request(struct partition_context *ac,
 	struct ldb_request *req;
 	struct ldb_control *partition_ctrl = NULL;
 
-	ac->part_req = talloc_realloc(ac, ac->part_req,
-					struct part_request,
-					ac->num_requests + 1);
-	if (ac->part_req == NULL) {
-		return ldb_oom(ldb_module_get_ctx(ac->module));
+	ret = partition_alloc_requests(ac, ac->num_requests + 1);
+	if (ret != LDB_SUCCESS) {
+		return ret;
 	}
 
 	switch (ac->req->operation) {
@@ -383,6 +408,13 @@ static int partition_send_all(struct ldb_module *module,
 							      struct partition_private_data);
 	int ret;
 
+	for (i=0; data && data->partitions && data->partitions[i]; i++) ;
+
+	ret = partition_alloc_requests(ac, i);
+	if (ret != LDB_SUCCESS) {
+		return ret;
+	}
+
 	for (i=0; data && data->partitions && data->partitions[i]; i++) {
 		ret = partition_prep_request(ac, data->partitions[i]);
 		if (ret != LDB_SUCCESS) {
@@ -834,6 +866,15 @@ static int partition_search(struct ldb_module *module, struct ldb_request *req)
 		return partition_send_all(module, ac, req);
 	}
 
+	if (phantom_root) {
+		/* a phantom root search may match many partitions */
+		for (i=0; data->partitions[i]; i++) ;
+		ret = partition_alloc_requests(ac, i);
+		if (ret != LDB_SUCCESS) {
+			return ret;
+		}
+	}
+
 	for (i=0; data->partitions[i]; i++) {
 		bool match = false, stop = false;
 
@@ -1213,6 +1254,17 @@ int partition_del_trans(struct ldb_module *module)
 		final_ret = ret;
 	}
 
+	/*
+	 * Group expansions and accounts cached inside this transaction
+	 * may have seen changes that are now gone, while the sequence
+	 * number they were cached against can come round again.
+	 */
+	dsdb_group_expansion_cache_flush(ldb_module_get_ctx(module));
+	talloc_free(ldb_get_opaque(ldb_module_get_ctx(module),
+				   DSDB_AUTHSAM_ACCOUNT_CACHE));
+	ldb_set_opaque(ldb_module_get_ctx(module),
+		       DSDB_AUTHSAM_ACCOUNT_CACHE, NULL);
+
 	return final_ret;
 }
 
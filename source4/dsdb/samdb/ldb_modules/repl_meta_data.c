@@ -50,6 +50,7 @@
 #include "lib/util/dlinklist.h"
 #include "dsdb/samdb/ldb_modules/util.h"
 #include "lib/util/tsort.h"
+#include "lib/messaging/irpc.h"
 
 #undef DBGC_CLASS
 #define DBGC_CLASS            DBGC_DRS_REPL
@@ -78,6 +79,14 @@ struct replmd_private {
 	uint32_t total_links;
 	uint32_t num_processed;
 	bool recyclebin_enabled;
+	/*
+	 * tell the drepl server about committed changes, so it can
+	 * notify our replication partners without waiting for the
+	 * next "dreplsrv:notify_interval"
+	 */
+	bool notify_on_commit;
+	bool notify_pending;
+	struct imessaging_context *msg_ctx;
 	bool recyclebin_state_known;
 };
 
@@ -328,6 +337,7 @@ static int replmd_init(struct ldb_module *module)
 	static const char *samba_dsdb_attrs[] = { SAMBA_COMPATIBLE_FEATURES_ATTR, NULL };
 	struct ldb_dn *samba_dsdb_dn;
 	struct ldb_result *res;
+	struct loadparm_context *lp_ctx;
 	int ret;
 	TALLOC_CTX *frame = talloc_stackframe();
 	replmd_private = talloc_zero(module, struct replmd_private);
@@ -340,6 +350,14 @@ static int replmd_init(struct ldb_module *module)
 
 	replmd_private->schema_dn = ldb_get_schema_basedn(ldb);
 
+	lp_ctx = talloc_get_type(ldb_get_opaque(ldb, "loadparm"),
+				 struct loadparm_context);
+	if (lp_ctx != NULL) {
+		replmd_private->notify_on_commit =
+			lpcfg_parm_bool(lp_ctx, NULL, "dreplsrv",
+					"notify_on_commit", true);
+	}
+
 	samba_dsdb_dn = ldb_dn_new(frame, ldb, "@SAMBA_DSDB");
 	if (!samba_dsdb_dn) {
 		TALLOC_FREE(frame);
@@ -797,6 +815,8 @@ static int replmd_notify_store(struct ldb_module *module, struct ldb_request *pa
 
 		DLIST_REMOVE(replmd_private->ncs, modified_partition);
 		talloc_free(modified_partition);
+
+		replmd_private->notify_pending = replmd_private->notify_on_commit;
 	}
 
 	return LDB_SUCCESS;
@@ -3263,11 +3283,12 @@ static int replmd_modify_handle_linked_attribs(struct ldb_module *module,
 					       time_t t,
 					       struct ldb_request *parent)
 {
-	struct ldb_result *res;
-	unsigned int i;
-	int ret;
+	struct ldb_result *res = NULL;
+	unsigned int i, num_attrs = 0;
+	int ret = LDB_SUCCESS;
 	struct ldb_context *ldb = ldb_module_get_ctx(module);
-	struct ldb_message *old_msg;
+	struct ldb_message *old_msg = NULL;
+	const char **attrs = NULL;
 
 	if (dsdb_functional_level(ldb) == DS_DOMAIN_FUNCTION_2000) {
 		/*
@@ -3284,26 +3305,43 @@ static int replmd_modify_handle_linked_attribs(struct ldb_module *module,
 	}
 
 	/*
-	 * TODO:
-	 *
-	 * We should restrict this to the intersection of the list of
-	 * linked attributes in the schema and the list of attributes
-	 * being modified.
-	 *
-	 * This will help performance a little, as otherwise we have
-	 * to allocate the entire object value-by-value.
+	 * Only fetch the forward links being modified, rather than the
+	 * entire object, which for a large group means not pulling in
+	 * every other linked attribute value-by-value as well.
 	 */
-	ret = dsdb_module_search_dn(module, msg, &res, msg->dn, NULL,
-	                            DSDB_FLAG_NEXT_MODULE |
-	                            DSDB_SEARCH_SHOW_RECYCLED |
-				    DSDB_SEARCH_REVEAL_INTERNALS |
-				    DSDB_SEARCH_SHOW_DN_IN_STORAGE_FORMAT,
-				    parent);
-	if (ret != LDB_SUCCESS) {
-		return ret;
+	attrs = talloc_array(msg, const char *, msg->num_elements + 1);
+	if (attrs == NULL) {
+		return ldb_module_oom(module);
 	}
+	for (i=0; i<msg->num_elements; i++) {
+		const struct dsdb_attribute *schema_attr
+			= dsdb_attribute_by_lDAPDisplayName(ac->schema,
+							    msg->elements[i].name);
+		if (schema_attr == NULL ||
+		    schema_attr->linkID == 0 ||
+		    (schema_attr->linkID & 1) == 1) {
+			/* the loop below deals with these */
+			continue;
+		}
+		attrs[num_attrs++] = schema_attr->lDAPDisplayName;
+	}
+	attrs[num_attrs] = NULL;
 
-	old_msg = res->msgs[0];
+	if (num_attrs > 0) {
+		ret = dsdb_module_search_dn(module, msg, &res, msg->dn, attrs,
+					    DSDB_FLAG_NEXT_MODULE |
+					    DSDB_SEARCH_SHOW_RECYCLED |
+					    DSDB_SEARCH_REVEAL_INTERNALS |
+					    DSDB_SEARCH_SHOW_DN_IN_STORAGE_FORMAT,
+					    parent);
+		if (ret != LDB_SUCCESS) {
+			talloc_free(attrs);
+			return ret;
+		}
+
+		old_msg = res->msgs[0];
+	}
+	talloc_free(attrs);
 
 	for (i=0; i<msg->num_elements; i++) {
 		struct ldb_message_element *el = &msg->elements[i];
@@ -8222,6 +8260,7 @@ static int replmd_start_transaction(struct ldb_module *module)
 	}
 
 	replmd_private->originating_updates = false;
+	replmd_private->notify_pending = false;
 
 	return ldb_next_start_trans(module);
 }
@@ -8475,11 +8514,81 @@ static int replmd_prepare_commit(struct ldb_module *module)
 	return ldb_next_prepare_commit(module);
 }
 
+/*
+  poke the drepl server, it will look at the partition uSNs and send
+  DsReplicaSync to the partners that are behind
+ */
+static void replmd_notify_drepl(struct ldb_module *module,
+				struct replmd_private *replmd_private)
+{
+	struct ldb_context *ldb = ldb_module_get_ctx(module);
+	unsigned num_servers;
+	struct server_id *servers;
+	TALLOC_CTX *tmp_ctx;
+	NTSTATUS status;
+
+	if (replmd_private->msg_ctx == NULL) {
+		struct loadparm_context *lp_ctx =
+			talloc_get_type(ldb_get_opaque(ldb, "loadparm"),
+					struct loadparm_context);
+
+		replmd_private->msg_ctx =
+			imessaging_client_init(replmd_private, lp_ctx,
+					       ldb_get_event_context(ldb));
+		if (replmd_private->msg_ctx == NULL) {
+			DBG_NOTICE("Failed to create messaging context, "
+				   "not notifying dreplsrv of changes\n");
+			replmd_private->notify_on_commit = false;
+			return;
+		}
+	}
+
+	tmp_ctx = talloc_new(replmd_private);
+	if (tmp_ctx == NULL) {
+		return;
+	}
+
+	status = irpc_servers_byname(replmd_private->msg_ctx, tmp_ctx,
+				     "dreplsrv", &num_servers, &servers);
+	if (!NT_STATUS_IS_OK(status)) {
+		/* this means the drepl service is not running */
+		talloc_free(tmp_ctx);
+		return;
+	}
+
+	status = imessaging_send(replmd_private->msg_ctx, servers[0],
+				 MSG_DREPL_NOTIFY_CHANGES, NULL);
+	if (NT_STATUS_IS_ERR(status)) {
+		DBG_INFO("Failed to send MSG_DREPL_NOTIFY_CHANGES: %s\n",
+			 nt_errstr(status));
+	}
+
+	talloc_free(tmp_ctx);
+}
+
+static int replmd_end_transaction(struct ldb_module *module)
+{
+	struct replmd_private *replmd_private =
+		talloc_get_type(ldb_module_get_private(module), struct replmd_private);
+	bool notify = replmd_private->notify_pending;
+	int ret;
+
+	replmd_private->notify_pending = false;
+
+	ret = ldb_next_end_trans(module);
+	if (ret == LDB_SUCCESS && notify) {
+		replmd_notify_drepl(module, replmd_private);
+	}
+
+	return ret;
+}
+
 static int replmd_del_transaction(struct ldb_module *module)
 {
 	struct replmd_private *replmd_private =
 		talloc_get_type(ldb_module_get_private(module), struct replmd_private);
 	replmd_txn_cleanup(replmd_private);
+	replmd_private->notify_pending = false;
 
 	return ldb_next_del_trans(module);
 }
@@ -8495,6 +8604,7 @@ static const struct ldb_module_ops ldb_repl_meta_data_module_ops = {
 	.extended          = replmd_extended,
 	.start_transaction = replmd_start_transaction,
 	.prepare_commit    = replmd_prepare_commit,
+	.end_transaction   = replmd_end_transaction,
 	.del_transaction   = replmd_del_transaction,
 };
 
@@ -41,12 +41,29 @@ struct dsdb_schema_prefixmap_oid {
 	DATA_BLOB bin_oid; /* partial binary-oid prefix */
 };
 
+/**
+ * remote ATTID -> local ATTID translations already made
+ * against a (remote) prefixMap, see dsdb_schema_pfm_attid_cache_find()
+ */
+#define DSDB_PFM_ATTID_CACHE_SIZE 256
+
+struct dsdb_schema_prefixmap_attid_cache {
+	const struct dsdb_schema_prefixmap *pfm_local;
+	struct {
+		bool valid;
+		uint32_t attid_remote;
+		uint32_t attid_local;
+	} entries[DSDB_PFM_ATTID_CACHE_SIZE];
+};
+
 /**
  * DSDB prefixMap internal presentation
  */
 struct dsdb_schema_prefixmap {
 	uint32_t length;
 	struct dsdb_schema_prefixmap_oid *prefixes;
+	/* only allocated for prefixMaps received over DRS */
+	struct dsdb_schema_prefixmap_attid_cache *attid_cache;
 };
 
 
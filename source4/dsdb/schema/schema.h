@@ -245,6 +245,16 @@ struct dsdb_schema {
 	uint32_t num_int_id_attr;
 	struct dsdb_attribute **attributes_by_msDS_IntId;
 
+	/*
+	 * open addressing hash tables over the same attributes, with
+	 * attributes_hash_mask + 1 slots each, for the lookups done
+	 * for every attribute of every message
+	 */
+	uint32_t attributes_hash_mask;
+	struct dsdb_attribute **attributes_hash_lDAPDisplayName;
+	struct dsdb_attribute **attributes_hash_attributeID_id;
+	struct dsdb_attribute **attributes_hash_linkID;
+
 	struct {
 		bool we_are_master;
 		bool update_allowed;
@@ -387,6 +387,60 @@ WERROR dsdb_schema_pfm_attid_from_oid(struct dsdb_schema_prefixmap *pfm,
 	return dsdb_schema_pfm_make_attid_impl(pfm, oid, false, attid);
 }
 
+/**
+ * Look up a remote ATTID in the translation cache of a remote prefixMap.
+ * The cache only holds translations made against pfm_local, it is
+ * emptied when used with another one.
+ */
+bool dsdb_schema_pfm_attid_cache_find(const struct dsdb_schema_prefixmap *pfm_remote,
+				      const struct dsdb_schema_prefixmap *pfm_local,
+				      uint32_t attid_remote,
+				      uint32_t *attid_local)
+{
+	struct dsdb_schema_prefixmap_attid_cache *cache = pfm_remote->attid_cache;
+	uint32_t slot;
+
+	if (cache == NULL) {
+		return false;
+	}
+
+	if (cache->pfm_local != pfm_local) {
+		ZERO_STRUCTP(cache);
+		cache->pfm_local = pfm_local;
+		return false;
+	}
+
+	slot = (attid_remote ^ (attid_remote >> 16)) % DSDB_PFM_ATTID_CACHE_SIZE;
+	if (!cache->entries[slot].valid ||
+	    cache->entries[slot].attid_remote != attid_remote) {
+		return false;
+	}
+
+	*attid_local = cache->entries[slot].attid_local;
+	return true;
+}
+
+/**
+ * Remember a remote -> local ATTID translation made against pfm_local
+ */
+void dsdb_schema_pfm_attid_cache_add(const struct dsdb_schema_prefixmap *pfm_remote,
+				     const struct dsdb_schema_prefixmap *pfm_local,
+				     uint32_t attid_remote,
+				     uint32_t attid_local)
+{
+	struct dsdb_schema_prefixmap_attid_cache *cache = pfm_remote->attid_cache;
+	uint32_t slot;
+
+	if (cache == NULL || cache->pfm_local != pfm_local) {
+		return;
+	}
+
+	slot = (attid_remote ^ (attid_remote >> 16)) % DSDB_PFM_ATTID_CACHE_SIZE;
+	cache->entries[slot].valid = true;
+	cache->entries[slot].attid_remote = attid_remote;
+	cache->entries[slot].attid_local = attid_local;
+}
+
 /**
  * Make OID for given ATTID.
  * Reference: [MS-DRSR] section 5.12.2
@@ -577,6 +631,14 @@ WERROR dsdb_schema_pfm_from_drsuapi_pfm(const struct drsuapi_DsReplicaOIDMapping
 		pfm->prefixes[i].bin_oid = blob;
 	}
 
+	/*
+	 * Every object replicated with this prefixMap maps the same few
+	 * ATTIDs to local ones, going via the OID string each time.
+	 * Without the cache this still works, just slower.
+	 */
+	pfm->attid_cache = talloc_zero(pfm,
+				       struct dsdb_schema_prefixmap_attid_cache);
+
 	/* fetch schema_info if requested */
 	if (_schema_info) {
 		/* by this time, i should have this value,
@@ -54,6 +54,51 @@ static int strcasecmp_with_ldb_val(const struct ldb_val *target, const char *str
 	return ret;
 }
 
+/*
+ * Hash functions for the attributes_hash_* tables built by
+ * dsdb_setup_sorted_accessors().  Names are hashed case-insensitively,
+ * up to len bytes or the first NUL.
+ */
+uint32_t dsdb_schema_name_hash(const char *name, size_t len)
+{
+	uint32_t h = 2166136261U;
+	size_t i;
+
+	for (i = 0; i < len && name[i] != '\0'; i++) {
+		h ^= (uint8_t)tolower((unsigned char)name[i]);
+		h *= 16777619U;
+	}
+	return h;
+}
+
+uint32_t dsdb_schema_id_hash(uint32_t id)
+{
+	return id * 2654435761U;
+}
+
+static struct dsdb_attribute *dsdb_attribute_hash_by_name(
+	const struct dsdb_schema *schema,
+	const char *name,
+	size_t len)
+{
+	uint32_t mask = schema->attributes_hash_mask;
+	uint32_t h;
+	struct dsdb_attribute *a;
+
+	/* like strcasecmp_with_ldb_val(), a NUL ends the name */
+	len = strnlen(name, len);
+	h = dsdb_schema_name_hash(name, len);
+
+	while ((a = schema->attributes_hash_lDAPDisplayName[h & mask]) != NULL) {
+		if (strncasecmp(a->lDAPDisplayName, name, len) == 0 &&
+		    a->lDAPDisplayName[len] == '\0') {
+			return a;
+		}
+		h++;
+	}
+	return NULL;
+}
+
 const struct dsdb_attribute *dsdb_attribute_by_attributeID_id(const struct dsdb_schema *schema,
 							      uint32_t id)
 {
@@ -72,6 +117,19 @@ const struct dsdb_attribute *dsdb_attribute_by_attributeID_id(const struct dsdb_
 		return c;
 	}
 
+	if (schema->attributes_hash_attributeID_id != NULL) {
+		uint32_t mask = schema->attributes_hash_mask;
+		uint32_t h = dsdb_schema_id_hash(id);
+
+		while ((c = schema->attributes_hash_attributeID_id[h & mask]) != NULL) {
+			if (c->attributeID_id == id) {
+				return c;
+			}
+			h++;
+		}
+		return NULL;
+	}
+
 	BINARY_ARRAY_SEARCH_P(schema->attributes_by_attributeID_id,
 			      schema->num_attributes, attributeID_id, id, uint32_cmp, c);
 	return c;
@@ -96,6 +154,10 @@ const struct dsdb_attribute *dsdb_attribute_by_lDAPDisplayName(const struct dsdb
 
 	if (!name) return NULL;
 
+	if (schema->attributes_hash_lDAPDisplayName != NULL) {
+		return dsdb_attribute_hash_by_name(schema, name, SIZE_MAX);
+	}
+
 	BINARY_ARRAY_SEARCH_P(schema->attributes_by_lDAPDisplayName,
 			      schema->num_attributes, lDAPDisplayName, name, strcasecmp, c);
 	return c;
@@ -108,6 +170,12 @@ const struct dsdb_attribute *dsdb_attribute_by_lDAPDisplayName_ldb_val(const str
 
 	if (!name) return NULL;
 
+	if (schema->attributes_hash_lDAPDisplayName != NULL) {
+		return dsdb_attribute_hash_by_name(schema,
+						   (const char *)name->data,
+						   name->length);
+	}
+
 	BINARY_ARRAY_SEARCH_P(schema->attributes_by_lDAPDisplayName,
 			      schema->num_attributes, lDAPDisplayName, name, strcasecmp_with_ldb_val, a);
 	return a;
@@ -118,6 +186,20 @@ const struct dsdb_attribute *dsdb_attribute_by_linkID(const struct dsdb_schema *
 {
 	struct dsdb_attribute *c;
 
+	/* many attributes share linkID 0, those are not hashed */
+	if (linkID != 0 && schema->attributes_hash_linkID != NULL) {
+		uint32_t mask = schema->attributes_hash_mask;
+		uint32_t h = dsdb_schema_id_hash((uint32_t)linkID);
+
+		while ((c = schema->attributes_hash_linkID[h & mask]) != NULL) {
+			if (c->linkID == (uint32_t)linkID) {
+				return c;
+			}
+			h++;
+		}
+		return NULL;
+	}
+
 	BINARY_ARRAY_SEARCH_P(schema->attributes_by_linkID,
 			      schema->num_attributes, linkID, linkID, uint32_cmp, c);
 	return c;
@@ -410,6 +410,75 @@ static void dsdb_sorted_accessors_free(struct dsdb_schema *schema)
 	TALLOC_FREE(schema->attributes_by_msDS_IntId);
 	TALLOC_FREE(schema->attributes_by_attributeID_oid);
 	TALLOC_FREE(schema->attributes_by_linkID);
+	TALLOC_FREE(schema->attributes_hash_lDAPDisplayName);
+	TALLOC_FREE(schema->attributes_hash_attributeID_id);
+	TALLOC_FREE(schema->attributes_hash_linkID);
+	schema->attributes_hash_mask = 0;
+}
+
+static void dsdb_attribute_hash_insert(struct dsdb_attribute **table,
+				       uint32_t mask,
+				       uint32_t h,
+				       struct dsdb_attribute *a)
+{
+	while (table[h & mask] != NULL) {
+		h++;
+	}
+	table[h & mask] = a;
+}
+
+/*
+  build the attributes_hash_* tables, at most half full so probe
+  sequences stay short
+ */
+static bool dsdb_setup_attribute_hashes(struct dsdb_schema *schema)
+{
+	struct dsdb_attribute *a;
+	uint32_t size = 16;
+	uint32_t mask;
+
+	while (size < schema->num_attributes * 2) {
+		size *= 2;
+	}
+	mask = size - 1;
+
+	schema->attributes_hash_lDAPDisplayName
+		= talloc_zero_array(schema, struct dsdb_attribute *, size);
+	schema->attributes_hash_attributeID_id
+		= talloc_zero_array(schema, struct dsdb_attribute *, size);
+	schema->attributes_hash_linkID
+		= talloc_zero_array(schema, struct dsdb_attribute *, size);
+	if (schema->attributes_hash_lDAPDisplayName == NULL ||
+	    schema->attributes_hash_attributeID_id == NULL ||
+	    schema->attributes_hash_linkID == NULL) {
+		return false;
+	}
+	schema->attributes_hash_mask = mask;
+
+	for (a = schema->attributes; a != NULL; a = a->next) {
+		if (a->lDAPDisplayName != NULL) {
+			dsdb_attribute_hash_insert(
+				schema->attributes_hash_lDAPDisplayName,
+				mask,
+				dsdb_schema_name_hash(a->lDAPDisplayName,
+						      SIZE_MAX),
+				a);
+		}
+		dsdb_attribute_hash_insert(
+			schema->attributes_hash_attributeID_id,
+			mask,
+			dsdb_schema_id_hash(a->attributeID_id),
+			a);
+		if (a->linkID != 0) {
+			dsdb_attribute_hash_insert(
+				schema->attributes_hash_linkID,
+				mask,
+				dsdb_schema_id_hash(a->linkID),
+				a);
+		}
+	}
+
+	return true;
 }
 
 /*
@@ -519,6 +588,10 @@ int dsdb_setup_sorted_accessors(struct ldb_context *ldb,
 	TYPESAFE_QSORT(schema->attributes_by_attributeID_oid, schema->num_attributes, dsdb_compare_attribute_by_attributeID_oid);
 	TYPESAFE_QSORT(schema->attributes_by_linkID, schema->num_attributes, dsdb_compare_attribute_by_linkID);
 
+	if (!dsdb_setup_attribute_hashes(schema)) {
+		goto failed;
+	}
+
 	dsdb_setup_attribute_shortcuts(ldb, schema);
 
 	ret = schema_fill_constructed(schema);
@@ -91,6 +91,12 @@ static bool dsdb_syntax_attid_from_remote_attid(const struct dsdb_syntax_ctx *ct
 		return true;
 	}
 
+	if (dsdb_schema_pfm_attid_cache_find(ctx->pfm_remote,
+					     ctx->schema->prefixmap,
+					     id_remote, id_local)) {
+		return true;
+	}
+
 	werr = dsdb_schema_pfm_oid_from_attid(ctx->pfm_remote, id_remote, mem_ctx, &oid);
 	if (!W_ERROR_IS_OK(werr)) {
 		DEBUG(0,("ATTID->OID failed (%s) for: 0x%08X\n", win_errstr(werr), id_remote));
@@ -103,6 +109,10 @@ static bool dsdb_syntax_attid_from_remote_attid(const struct dsdb_syntax_ctx *ct
 		return false;
 	}
 
+	dsdb_schema_pfm_attid_cache_add(ctx->pfm_remote,
+					ctx->schema->prefixmap,
+					id_remote, *id_local);
+
 	return true;
 }
 
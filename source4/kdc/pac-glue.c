@@ -633,16 +633,150 @@ int samba_krbtgt_is_in_db(struct samba_kdc_entry *p,
 	return 0;
 }
 
+/*
+ * Cache of the LOGON_INFO and UPN_DNS_INFO PAC buffers built by
+ * samba_kdc_get_pac_blobs(). Building them means a group expansion and
+ * two NDR pushes, for every AS-REQ and every TGS-REQ that needs a new
+ * PAC, while the result only changes with the account.
+ *
+ * Entries are keyed by the objectGUID. Everything is thrown away when
+ * the database sequence number changes, which covers changes to the
+ * account and to its group memberships. The constructed account flags
+ * and password expiry time are compared as well, as they change with
+ * the time rather than with the database.
+ */
+#define SAMBA_KDC_PAC_CACHE_SIZE 256
+
+struct samba_kdc_pac_cache_entry {
+	struct GUID guid;
+	struct ldb_dn *realm_dn;
+	uint32_t uac_computed;
+	int64_t pwd_expiry;
+	DATA_BLOB logon_blob;
+	DATA_BLOB upn_blob;
+};
+
+struct samba_kdc_pac_cache {
+	uint64_t seq_num;
+	struct samba_kdc_pac_cache_entry *entries[SAMBA_KDC_PAC_CACHE_SIZE];
+};
+
+static struct samba_kdc_pac_cache *samba_kdc_pac_cache_get(
+	struct samba_kdc_db_context *kdc_db_ctx)
+{
+	struct samba_kdc_pac_cache *cache = kdc_db_ctx->pac_cache;
+	uint64_t seq_num;
+	int ret;
+
+	ret = ldb_sequence_number(kdc_db_ctx->samdb,
+				  LDB_SEQ_HIGHEST_SEQ, &seq_num);
+	if (ret != LDB_SUCCESS) {
+		return NULL;
+	}
+
+	if (cache != NULL && cache->seq_num != seq_num) {
+		TALLOC_FREE(kdc_db_ctx->pac_cache);
+		cache = NULL;
+	}
+
+	if (cache == NULL) {
+		cache = talloc_zero(kdc_db_ctx, struct samba_kdc_pac_cache);
+		if (cache == NULL) {
+			return NULL;
+		}
+		cache->seq_num = seq_num;
+		kdc_db_ctx->pac_cache = cache;
+	}
+
+	return cache;
+}
+
+static struct samba_kdc_pac_cache_entry **samba_kdc_pac_cache_slot(
+	struct samba_kdc_pac_cache *cache,
+	const struct GUID *guid)
+{
+	uint32_t hash = guid->time_low ^ guid->time_mid ^
+		(guid->node[4] << 8 | guid->node[5]);
+
+	return &cache->entries[hash % SAMBA_KDC_PAC_CACHE_SIZE];
+}
+
+static bool samba_kdc_pac_cache_match(
+	const struct samba_kdc_pac_cache_entry *entry,
+	const struct samba_kdc_entry *p,
+	const struct GUID *guid)
+{
+	if (entry == NULL) {
+		return false;
+	}
+	if (!GUID_equal(&entry->guid, guid)) {
+		return false;
+	}
+	if (ldb_dn_compare(entry->realm_dn, p->realm_dn) != 0) {
+		return false;
+	}
+	if (entry->uac_computed != ldb_msg_find_attr_as_uint(
+		    p->msg, "msDS-User-Account-Control-Computed", 0)) {
+		return false;
+	}
+	if (entry->pwd_expiry != ldb_msg_find_attr_as_int64(
+		    p->msg, "msDS-UserPasswordExpiryTimeComputed", 0)) {
+		return false;
+	}
+	return true;
+}
+
+static void samba_kdc_pac_cache_add(struct samba_kdc_pac_cache *cache,
+				    const struct samba_kdc_entry *p,
+				    const struct GUID *guid,
+				    const DATA_BLOB *logon_blob,
+				    const DATA_BLOB *upn_blob)
+{
+	struct samba_kdc_pac_cache_entry **slot = NULL;
+	struct samba_kdc_pac_cache_entry *entry = NULL;
+
+	entry = talloc_zero(cache, struct samba_kdc_pac_cache_entry);
+	if (entry == NULL) {
+		return;
+	}
+
+	entry->guid = *guid;
+	entry->uac_computed = ldb_msg_find_attr_as_uint(
+		p->msg, "msDS-User-Account-Control-Computed", 0);
+	entry->pwd_expiry = ldb_msg_find_attr_as_int64(
+		p->msg, "msDS-UserPasswordExpiryTimeComputed", 0);
+	entry->realm_dn = ldb_dn_copy(entry, p->realm_dn);
+	entry->logon_blob = data_blob_talloc(entry,
+					     logon_blob->data,
+					     logon_blob->length);
+	entry->upn_blob = data_blob_talloc(entry,
+					   upn_blob->data,
+					   upn_blob->length);
+	if (entry->realm_dn == NULL ||
+	    entry->logon_blob.data == NULL ||
+	    entry->upn_blob.data == NULL) {
+		TALLOC_FREE(entry);
+		return;
+	}
+
+	slot = samba_kdc_pac_cache_slot(cache, guid);
+	TALLOC_FREE(*slot);
+	*slot = entry;
+}
+
 NTSTATUS samba_kdc_get_pac_blobs(TALLOC_CTX *mem_ctx,
 				 struct samba_kdc_entry *p,
 				 DATA_BLOB **_logon_info_blob,
 				 DATA_BLOB **_cred_ndr_blob,
 				 DATA_BLOB **_upn_info_blob)
 {
-	struct auth_user_info_dc *user_info_dc;
+	struct auth_user_info_dc *user_info_dc = NULL;
 	DATA_BLOB *logon_blob = NULL;
 	DATA_BLOB *cred_blob = NULL;
 	DATA_BLOB *upn_blob = NULL;
+	struct samba_kdc_pac_cache *cache = NULL;
+	struct samba_kdc_pac_cache_entry *entry = NULL;
+	struct GUID guid;
 	NTSTATUS nt_status;
 
 	*_logon_info_blob = NULL;
@@ -673,6 +807,26 @@ NTSTATUS samba_kdc_get_pac_blobs(TALLOC_CTX *mem_ctx,
 		return NT_STATUS_NO_MEMORY;
 	}
 
+	guid = samdb_result_guid(p->msg, "objectGUID");
+	if (!GUID_all_zero(&guid)) {
+		cache = samba_kdc_pac_cache_get(p->kdc_db_ctx);
+	}
+	if (cache != NULL) {
+		entry = *samba_kdc_pac_cache_slot(cache, &guid);
+	}
+	if (cache != NULL && samba_kdc_pac_cache_match(entry, p, &guid)) {
+		*logon_blob = data_blob_talloc(logon_blob,
+					       entry->logon_blob.data,
+					       entry->logon_blob.length);
+		*upn_blob = data_blob_talloc(upn_blob,
+					     entry->upn_blob.data,
+					     entry->upn_blob.length);
+		if (logon_blob->data == NULL || upn_blob->data == NULL) {
+			return NT_STATUS_NO_MEMORY;
+		}
+		goto cred_info;
+	}
+
 	nt_status = authsam_make_user_info_dc(mem_ctx, p->kdc_db_ctx->samdb,
 					     lpcfg_netbios_name(p->kdc_db_ctx->lp_ctx),
 					     lpcfg_sam_name(p->kdc_db_ctx->lp_ctx),
@@ -697,6 +851,20 @@ NTSTATUS samba_kdc_get_pac_blobs(TALLOC_CTX *mem_ctx,
 		return nt_status;
 	}
 
+	nt_status = samba_get_upn_info_pac_blob(upn_blob,
+						user_info_dc,
+						upn_blob);
+	if (!NT_STATUS_IS_OK(nt_status)) {
+		DEBUG(0, ("Building PAC UPN INFO failed: %s\n",
+			  nt_errstr(nt_status)));
+		return nt_status;
+	}
+
+	if (cache != NULL) {
+		samba_kdc_pac_cache_add(cache, p, &guid, logon_blob, upn_blob);
+	}
+
+cred_info:
 	if (cred_blob != NULL) {
 		nt_status = samba_get_cred_info_ndr_blob(cred_blob,
 							 p->msg,
@@ -708,15 +876,6 @@ NTSTATUS samba_kdc_get_pac_blobs(TALLOC_CTX *mem_ctx,
 		}
 	}
 
-	nt_status = samba_get_upn_info_pac_blob(upn_blob,
-						user_info_dc,
-						upn_blob);
-	if (!NT_STATUS_IS_OK(nt_status)) {
-		DEBUG(0, ("Building PAC UPN INFO failed: %s\n",
-			  nt_errstr(nt_status)));
-		return nt_status;
-	}
-
 	TALLOC_FREE(user_info_dc);
 	*_logon_info_blob = logon_blob;
 	if (_cred_ndr_blob != NULL) {
@@ -37,6 +37,7 @@ struct samba_kdc_base_context {
 };
 
 struct samba_kdc_seq;
+struct samba_kdc_pac_cache;
 
 struct samba_kdc_db_context {
 	struct tevent_context *ev_ctx;
@@ -44,6 +45,7 @@ struct samba_kdc_db_context {
 	struct imessaging_context *msg_ctx;
 	struct ldb_context *samdb;
 	struct samba_kdc_seq *seq_ctx;
+	struct samba_kdc_pac_cache *pac_cache;
 	bool rodc;
 	unsigned int my_krbtgt_number;
 	struct ldb_dn *krbtgt_dn;
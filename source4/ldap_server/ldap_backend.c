@@ -32,6 +32,7 @@
 #include <ldb_module.h>
 #include "ldb_wrap.h"
 #include "lib/tsocket/tsocket.h"
+#include "libcli/ldap/ldap_proto.h"
 
 static int map_ldb_error(TALLOC_CTX *mem_ctx, int ldb_err,
 	const char *add_err_string, const char **errstring)
@@ -502,12 +503,135 @@ static int ldapsrv_rename_with_controls(struct ldapsrv_call *call,
 	return ret;
 }
 
-static NTSTATUS ldapsrv_SearchRequest(struct ldapsrv_call *call)
+struct ldapsrv_search_state {
+	struct ldapsrv_call *call;
+	struct ldb_result *res;
+	int extended_type;
+};
+
+/*
+ * Turn a search result entry into an LDAP reply and encode it straight
+ * away, so that we only hold the encoded entries and not the ldb
+ * messages as well until the search has finished.
+ */
+static int ldapsrv_search_entry(struct ldapsrv_search_state *state,
+				struct ldb_message *msg)
 {
+	struct ldapsrv_call *call = state->call;
 	struct ldap_SearchRequest *req = &call->request->r.SearchRequest;
 	struct ldap_SearchResEntry *ent;
+	struct ldapsrv_reply *ent_r;
+	unsigned int j;
+	bool ok;
+
+	ent_r = ldapsrv_init_reply(call, LDAP_TAG_SearchResultEntry);
+	if (ent_r == NULL) {
+		return LDB_ERR_OPERATIONS_ERROR;
+	}
+
+	ent = &ent_r->msg->r.SearchResultEntry;
+	ent->dn = ldb_dn_get_extended_linearized(ent_r, msg->dn,
+						 state->extended_type);
+	ent->num_attributes = 0;
+	ent->attributes = NULL;
+	if (msg->num_elements == 0) {
+		goto queue_reply;
+	}
+	ent->num_attributes = msg->num_elements;
+	ent->attributes = talloc_array(ent_r, struct ldb_message_element,
+				       ent->num_attributes);
+	if (ent->attributes == NULL) {
+		talloc_free(ent_r);
+		return LDB_ERR_OPERATIONS_ERROR;
+	}
+	for (j=0; j < ent->num_attributes; j++) {
+		ent->attributes[j].name = msg->elements[j].name;
+		ent->attributes[j].num_values = 0;
+		ent->attributes[j].values = NULL;
+		if (req->attributesonly && (msg->elements[j].num_values == 0)) {
+			continue;
+		}
+		ent->attributes[j].num_values = msg->elements[j].num_values;
+		ent->attributes[j].values = msg->elements[j].values;
+	}
+queue_reply:
+	ok = ldap_encode(ent_r->msg, samba_ldap_control_handlers(),
+			 &ent_r->blob, ent_r);
+	if (!ok) {
+		DEBUG(0,("Failed to encode search result entry %s\n",
+			 ldb_dn_get_linearized(msg->dn)));
+		talloc_free(ent_r);
+		return LDB_ERR_OPERATIONS_ERROR;
+	}
+	talloc_set_name_const(ent_r->blob.data,
+			      "Outgoing, encoded LDAP packet");
+	TALLOC_FREE(ent_r->msg);
+
+	ldapsrv_queue_reply(call, ent_r);
+	return LDB_SUCCESS;
+}
+
+static int ldapsrv_search_callback(struct ldb_request *req,
+				   struct ldb_reply *ares)
+{
+	struct ldapsrv_search_state *state =
+		talloc_get_type_abort(req->context,
+		struct ldapsrv_search_state);
+	struct ldb_result *res = state->res;
+	unsigned int n;
+	int ret;
+
+	if (ares == NULL) {
+		return ldb_request_done(req, LDB_ERR_OPERATIONS_ERROR);
+	}
+	if (ares->error != LDB_SUCCESS) {
+		return ldb_request_done(req, ares->error);
+	}
+
+	switch (ares->type) {
+	case LDB_REPLY_ENTRY:
+		ret = ldapsrv_search_entry(state, ares->message);
+		if (ret != LDB_SUCCESS) {
+			talloc_free(ares);
+			return ldb_request_done(req, ret);
+		}
+		res->count++;
+		break;
+
+	case LDB_REPLY_REFERRAL:
+		if (res->refs) {
+			for (n = 0; res->refs[n]; n++) /*noop*/ ;
+		} else {
+			n = 0;
+		}
+
+		res->refs = talloc_realloc(res, res->refs, char *, n + 2);
+		if (! res->refs) {
+			talloc_free(ares);
+			return ldb_request_done(req, LDB_ERR_OPERATIONS_ERROR);
+		}
+
+		res->refs[n] = talloc_move(res->refs, &ares->referral);
+		res->refs[n + 1] = NULL;
+		break;
+
+	case LDB_REPLY_DONE:
+		res->controls = talloc_move(res, &ares->controls);
+		talloc_free(ares);
+		return ldb_request_done(req, LDB_SUCCESS);
+	}
+
+	talloc_free(ares);
+	return LDB_SUCCESS;
+}
+
+static NTSTATUS ldapsrv_SearchRequest(struct ldapsrv_call *call)
+{
+	struct ldap_SearchRequest *req = &call->request->r.SearchRequest;
+	struct ldapsrv_search_state *state;
 	struct ldap_Result *done;
 	struct ldapsrv_reply *ent_r, *done_r;
+	struct ldapsrv_reply *last_reply = NULL;
 	TALLOC_CTX *local_ctx;
 	struct ldb_context *samdb = talloc_get_type(call->conn->ldb, struct ldb_context);
 	struct ldb_dn *basedn;
@@ -524,7 +648,7 @@ static NTSTATUS ldapsrv_SearchRequest(struct ldapsrv_call *call)
 	int success_limit = 1;
 	int result = -1;
 	int ldb_ret = -1;
-	unsigned int i, j;
+	unsigned int i;
 	int extended_type = 1;
 
 	DEBUG(10, ("SearchRequest"));
@@ -583,11 +707,16 @@ static NTSTATUS ldapsrv_SearchRequest(struct ldapsrv_call *call)
 	res = talloc_zero(local_ctx, struct ldb_result);
 	NT_STATUS_HAVE_NO_MEMORY(res);
 
+	state = talloc_zero(local_ctx, struct ldapsrv_search_state);
+	NT_STATUS_HAVE_NO_MEMORY(state);
+	state->call = call;
+	state->res = res;
+
 	ldb_ret = ldb_build_search_req_ex(&lreq, samdb, local_ctx,
 					  basedn, scope,
 					  req->tree, attrs,
 					  call->request->controls,
-					  res, ldb_search_default_callback,
+					  state, ldapsrv_search_callback,
 					  NULL);
 
 	if (ldb_ret != LDB_SUCCESS) {
@@ -621,6 +750,7 @@ static NTSTATUS ldapsrv_SearchRequest(struct ldapsrv_call *call)
 			extended_type = 0;
 		}
 	}
+	state->extended_type = extended_type;
 
 	notification_control = ldb_request_get_control(lreq, LDB_CONTROL_NOTIFICATION_OID);
 	if (notification_control != NULL) {
@@ -655,48 +785,24 @@ static NTSTATUS ldapsrv_SearchRequest(struct ldapsrv_call *call)
 
 	LDB_REQ_SET_LOCATION(lreq);
 
+	last_reply = DLIST_TAIL(call->replies);
+
 	ldb_ret = ldb_request(samdb, lreq);
+	if (ldb_ret == LDB_SUCCESS) {
+		ldb_ret = ldb_wait(lreq->handle, LDB_WAIT_ALL);
+	}
 
 	if (ldb_ret != LDB_SUCCESS) {
-		goto reply;
+		/* only a successful search returns its entries */
+		while (call->replies != NULL &&
+		       DLIST_TAIL(call->replies) != last_reply) {
+			ent_r = DLIST_TAIL(call->replies);
+			DLIST_REMOVE(call->replies, ent_r);
+			talloc_free(ent_r);
+		}
 	}
 
-	ldb_ret = ldb_wait(lreq->handle, LDB_WAIT_ALL);
-
 	if (ldb_ret == LDB_SUCCESS) {
-		for (i = 0; i < res->count; i++) {
-			ent_r = ldapsrv_init_reply(call, LDAP_TAG_SearchResultEntry);
-			NT_STATUS_HAVE_NO_MEMORY(ent_r);
-
-			/* Better to have the whole message kept here,
-			 * than to find someone further up didn't put
-			 * a value in the right spot in the talloc tree */
-			talloc_steal(ent_r, res->msgs[i]);
-			
-			ent = &ent_r->msg->r.SearchResultEntry;
-			ent->dn = ldb_dn_get_extended_linearized(ent_r, res->msgs[i]->dn, extended_type);
-			ent->num_attributes = 0;
-			ent->attributes = NULL;
-			if (res->msgs[i]->num_elements == 0) {
-				goto queue_reply;
-			}
-			ent->num_attributes = res->msgs[i]->num_elements;
-			ent->attributes = talloc_array(ent_r, struct ldb_message_element, ent->num_attributes);
-			NT_STATUS_HAVE_NO_MEMORY(ent->attributes);
-			for (j=0; j < ent->num_attributes; j++) {
-				ent->attributes[j].name = res->msgs[i]->elements[j].name;
-				ent->attributes[j].num_values = 0;
-				ent->attributes[j].values = NULL;
-				if (req->attributesonly && (res->msgs[i]->elements[j].num_values == 0)) {
-					continue;
-				}
-				ent->attributes[j].num_values = res->msgs[i]->elements[j].num_values;
-				ent->attributes[j].values = res->msgs[i]->elements[j].values;
-			}
-queue_reply:
-			ldapsrv_queue_reply(call, ent_r);
-		}
-
 		if (call->notification.busy) {
 			/* Move/Add it to the end */
 			DLIST_DEMOTE(call->conn->pending_calls, call);
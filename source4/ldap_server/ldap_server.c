@@ -178,7 +178,9 @@ static int ldapsrv_load_limits(struct ldapsrv_connection *conn)
 	conn->limits.max_page_size = 1000;
 	conn->limits.max_notifications = 5;
 	conn->limits.search_timeout = 120;
-
+	conn->limits.max_pipelined_writes = lpcfg_parm_int(conn->lp_ctx, NULL,
+						"ldap server",
+						"max pipelined writes", 8);
 
 	tmp_ctx = talloc_new(conn);
 	if (tmp_ctx == NULL) {
@@ -669,59 +671,117 @@ static void ldapsrv_call_wait_done(struct tevent_req *subreq)
 	ldapsrv_call_writev_start(call);
 }
 
+static void ldapsrv_call_writev_next(struct ldapsrv_call *call);
+
 static void ldapsrv_call_writev_start(struct ldapsrv_call *call)
 {
 	struct ldapsrv_connection *conn = call->conn;
-	DATA_BLOB blob = data_blob_null;
-	struct tevent_req *subreq = NULL;
 
-	/* build all the replies into a single blob */
-	while (call->replies) {
-		DATA_BLOB b;
-		bool ret;
+	/* notification calls come here again for each change */
+	call->pipelined = false;
 
-		if (!ldap_encode(call->replies->msg, samba_ldap_control_handlers(), &b, call)) {
-			DEBUG(0,("Failed to encode ldap reply of type %d\n",
-				 call->replies->msg->type));
-			ldapsrv_terminate_connection(conn, "ldap_encode failed");
-			return;
+	if (call->replies == NULL) {
+		if (!call->notification.busy) {
+			TALLOC_FREE(call);
 		}
 
-		ret = data_blob_append(call, &blob, b.data, b.length);
-		data_blob_free(&b);
+		ldapsrv_call_read_next(conn);
+		return;
+	}
 
-		if (!ret) {
-			ldapsrv_terminate_connection(conn, "data_blob_append failed");
-			return;
-		}
+	ldapsrv_call_writev_next(call);
+}
 
-		talloc_set_name_const(blob.data, "Outgoing, encoded LDAP packet");
+/*
+ * A large search result goes out in several writes of at most
+ * LDAPSRV_MAX_WRITE_SIZE bytes, each reply is freed as soon as it is
+ * written, rather than being copied into one big buffer first.
+ */
+#define LDAPSRV_MAX_WRITE_SIZE (256 * 1024)
+#define LDAPSRV_MAX_WRITE_IOV 64
+
+static void ldapsrv_call_writev_next(struct ldapsrv_call *call)
+{
+	struct ldapsrv_connection *conn = call->conn;
+	TALLOC_CTX *out_ctx = NULL;
+	struct iovec *out_iov = NULL;
+	struct tevent_req *subreq = NULL;
+	size_t length = 0;
+	size_t count = 0;
 
-		DLIST_REMOVE(call->replies, call->replies);
+	out_ctx = talloc_new(call);
+	if (out_ctx == NULL) {
+		ldapsrv_terminate_connection(conn, "no memory");
+		return;
 	}
 
-	if (blob.length == 0) {
-		if (!call->notification.busy) {
-			TALLOC_FREE(call);
-		}
-
-		ldapsrv_call_read_next(conn);
+	out_iov = talloc_array(out_ctx, struct iovec, LDAPSRV_MAX_WRITE_IOV);
+	if (out_iov == NULL) {
+		ldapsrv_terminate_connection(conn, "no memory");
 		return;
 	}
 
-	call->out_iov.iov_base = blob.data;
-	call->out_iov.iov_len = blob.length;
+	while (call->replies != NULL &&
+	       count < LDAPSRV_MAX_WRITE_IOV &&
+	       length < LDAPSRV_MAX_WRITE_SIZE) {
+		struct ldapsrv_reply *reply = call->replies;
+
+		/* search result entries are encoded as they are found */
+		if (reply->blob.data == NULL) {
+			if (!ldap_encode(reply->msg, samba_ldap_control_handlers(),
+					 &reply->blob, reply)) {
+				DEBUG(0,("Failed to encode ldap reply of type %d\n",
+					 reply->msg->type));
+				ldapsrv_terminate_connection(conn, "ldap_encode failed");
+				return;
+			}
+
+			talloc_set_name_const(reply->blob.data,
+					      "Outgoing, encoded LDAP packet");
+		}
+
+		DLIST_REMOVE(call->replies, reply);
+		talloc_steal(out_ctx, reply);
+
+		out_iov[count].iov_base = reply->blob.data;
+		out_iov[count].iov_len = reply->blob.length;
+		length += reply->blob.length;
+		count += 1;
+	}
 
 	subreq = tstream_writev_queue_send(call,
 					   conn->connection->event.ctx,
 					   conn->sockets.active,
 					   conn->sockets.send_queue,
-					   &call->out_iov, 1);
+					   out_iov, count);
 	if (subreq == NULL) {
 		ldapsrv_terminate_connection(conn, "stream_writev_queue_send failed");
 		return;
 	}
 	tevent_req_set_callback(subreq, ldapsrv_call_writev_done, call);
+
+	/* the replies are freed once they are written */
+	talloc_steal(subreq, out_ctx);
+
+	if (call->replies != NULL) {
+		/* ldapsrv_call_writev_done() sends the rest */
+		return;
+	}
+
+	/*
+	 * The replies go out through the send queue in order, so we can
+	 * already read and process the next request while they are being
+	 * written, instead of waiting for a slow client to take all of a
+	 * large search result. Calls with a postprocess step change the
+	 * connection (StartTLS, SASL wrapping) once their reply is out,
+	 * so we have to wait for those.
+	 */
+	if (call->postprocess_send == NULL &&
+	    conn->pipelined_writes < conn->limits.max_pipelined_writes) {
+		call->pipelined = true;
+		conn->pipelined_writes += 1;
+		ldapsrv_call_read_next(conn);
+	}
 }
 
 static void ldapsrv_call_postprocess_done(struct tevent_req *subreq);
@@ -752,6 +812,20 @@ static void ldapsrv_call_writev_done(struct tevent_req *subreq)
 		return;
 	}
 
+	if (call->replies != NULL) {
+		ldapsrv_call_writev_next(call);
+		return;
+	}
+
+	if (call->pipelined) {
+		/* we are already reading the next request */
+		conn->pipelined_writes -= 1;
+		if (!call->notification.busy) {
+			TALLOC_FREE(call);
+		}
+		return;
+	}
+
 	if (call->postprocess_send) {
 		subreq = call->postprocess_send(call,
 						conn->connection->event.ctx,
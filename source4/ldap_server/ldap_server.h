@@ -54,11 +54,13 @@ struct ldapsrv_connection {
 		int max_page_size;
 		int max_notifications;
 		int search_timeout;
+		int max_pipelined_writes;
 		struct timeval endtime;
 		const char *reason;
 	} limits;
 
 	struct tevent_req *active_call;
+	int pipelined_writes;
 
 	struct ldapsrv_call *pending_calls;
 };
@@ -70,8 +72,9 @@ struct ldapsrv_call {
 	struct ldapsrv_reply {
 		struct ldapsrv_reply *prev, *next;
 		struct ldap_message *msg;
+		DATA_BLOB blob;
 	} *replies;
-	struct iovec out_iov;
+	bool pipelined;
 
 	struct tevent_req *(*wait_send)(TALLOC_CTX *mem_ctx,
 					struct tevent_context *ev,
@@ -184,6 +184,31 @@ static WERROR dcesrv_drsuapi_DsBind(struct dcesrv_call_state *dce_call, TALLOC_C
 	 */
 	if (r->in.bind_info) {
 		b_state->remote_info = r->in.bind_info;
+
+		switch (r->in.bind_info->length) {
+		case 24:
+			b_state->remote_supported_extensions =
+				r->in.bind_info->info.info24.supported_extensions;
+			break;
+		case 28:
+			b_state->remote_supported_extensions =
+				r->in.bind_info->info.info28.supported_extensions;
+			break;
+		case 32:
+			b_state->remote_supported_extensions =
+				r->in.bind_info->info.info32.supported_extensions;
+			break;
+		case 48:
+			b_state->remote_supported_extensions =
+				r->in.bind_info->info.info48.supported_extensions;
+			break;
+		case 52:
+			b_state->remote_supported_extensions =
+				r->in.bind_info->info.info52.supported_extensions;
+			break;
+		default:
+			break;
+		}
 	}
 
 	/*
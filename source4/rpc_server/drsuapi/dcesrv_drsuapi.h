@@ -34,6 +34,7 @@ struct drsuapi_bind_state {
 	struct ldb_context *sam_ctx_system;
 	struct GUID remote_bind_guid;
 	struct drsuapi_DsBindInfoCtr *remote_info;
+	uint32_t remote_supported_extensions;
 	struct drsuapi_DsBindInfoCtr *local_info;
 	struct drsuapi_getncchanges_state *getncchanges_state;
 };
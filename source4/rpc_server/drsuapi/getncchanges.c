@@ -2264,6 +2264,48 @@ static void getncchanges_chunk_add_objects(struct getncchanges_repl_chunk *repl_
 	}
 }
 
+/**
+ * Re-fetches an object we collected earlier, by GUID.
+ *
+ * A <GUID=...> base DN first has to be resolved by extended_dn_in with a
+ * search over every partition, so try an (objectGUID=) search under the
+ * NC root first: that is a single indexed lookup in the partition being
+ * replicated. Objects not found there (e.g. an extended operation on an
+ * object outside the NC root, or one that has just vanished) are looked
+ * up by their <GUID=...> DN as before.
+ */
+static int getncchanges_fetch_object(struct ldb_context *sam_ctx,
+				     TALLOC_CTX *mem_ctx,
+				     struct drsuapi_getncchanges_state *getnc_state,
+				     struct ldb_dn *msg_dn,
+				     const struct GUID *guid,
+				     const char * const *attrs,
+				     struct ldb_result **res)
+{
+	struct GUID_txt_buf guid_str;
+	char *filter = NULL;
+	int ret;
+
+	filter = talloc_asprintf(mem_ctx, "(objectGUID=%s)",
+				 GUID_buf_string(guid, &guid_str));
+	if (filter == NULL) {
+		return LDB_ERR_OPERATIONS_ERROR;
+	}
+
+	ret = drsuapi_search_with_extended_dn(sam_ctx, mem_ctx, res,
+					      getnc_state->ncRoot_dn,
+					      LDB_SCOPE_SUBTREE, attrs, filter);
+	TALLOC_FREE(filter);
+	if (ret == LDB_SUCCESS && (*res)->count == 1) {
+		return LDB_SUCCESS;
+	}
+	TALLOC_FREE(*res);
+
+	return drsuapi_search_with_extended_dn(sam_ctx, mem_ctx, res,
+					       msg_dn, LDB_SCOPE_BASE,
+					       attrs, NULL);
+}
+
 /**
  * Gets the object to send, packed into an RPC struct ready to send. This also
  * adds the object to the object cache, and adds any ancestors (if needed).
@@ -2667,6 +2709,52 @@ static struct getncchanges_repl_chunk * getncchanges_chunk_new(TALLOC_CTX *mem_c
 	return repl_chunk;
 }
 
+/*
+  switch the reply over to a MSZIP compressed ctr7 if the client asked for
+  compression (DRSUAPI_DRS_USE_COMPRESSION, set by the KCC for inter-site
+  connections) and told us at bind time that it understands ctr7.
+
+  The actual compression happens while marshalling the reply, see
+  ndr_push_drsuapi_DsGetNCChangesMSZIPCtr6()
+*/
+static WERROR getncchanges_compress_reply(struct dcesrv_call_state *dce_call,
+					  struct drsuapi_bind_state *b_state,
+					  TALLOC_CTX *mem_ctx,
+					  struct drsuapi_DsGetNCChangesRequest10 *req10,
+					  struct drsuapi_DsGetNCChanges *r)
+{
+	struct drsuapi_DsGetNCChangesCtr6TS *ts;
+
+	if (!(req10->replica_flags & DRSUAPI_DRS_USE_COMPRESSION)) {
+		return WERR_OK;
+	}
+
+	if (!(b_state->remote_supported_extensions &
+	      DRSUAPI_SUPPORTED_EXTENSION_GETCHGREPLY_V7)) {
+		return WERR_OK;
+	}
+
+	if (!lpcfg_parm_bool(dce_call->conn->dce_ctx->lp_ctx, NULL,
+			     "drs", "compression", true)) {
+		return WERR_OK;
+	}
+
+	ts = talloc(mem_ctx, struct drsuapi_DsGetNCChangesCtr6TS);
+	W_ERROR_HAVE_NO_MEMORY(ts);
+
+	/* ctr6 and ctr7 share the same memory, so copy it away first */
+	ts->ctr6 = r->out.ctr->ctr6;
+
+	*r->out.level_out = 7;
+	r->out.ctr->ctr7.level = 6;
+	r->out.ctr->ctr7.type = DRSUAPI_COMPRESSION_TYPE_MSZIP;
+	r->out.ctr->ctr7.ctr.mszip6.decompressed_length = 0;
+	r->out.ctr->ctr7.ctr.mszip6.compressed_length = 0;
+	r->out.ctr->ctr7.ctr.mszip6.ts = ts;
+
+	return WERR_OK;
+}
+
 /*
   drsuapi_DsGetNCChanges
 
@@ -3300,9 +3388,9 @@ allowed:
 		 * (tombstone expunge) between the first and second
 		 * check.
 		 */
-		ret = drsuapi_search_with_extended_dn(sam_ctx, tmp_ctx, &msg_res,
-						      msg_dn,
-						      LDB_SCOPE_BASE, msg_attrs, NULL);
+		ret = getncchanges_fetch_object(sam_ctx, tmp_ctx, getnc_state,
+						msg_dn, &getnc_state->guids[i],
+						msg_attrs, &msg_res);
 		if (ret != LDB_SUCCESS) {
 			if (ret != LDB_ERR_NO_SUCH_OBJECT) {
 				DEBUG(1,("getncchanges: failed to fetch DN %s - %s\n",
@@ -3601,6 +3689,7 @@ allowed:
 	}
 #endif
 
-	return WERR_OK;
+	return getncchanges_compress_reply(dce_call, b_state, mem_ctx,
+					   req10, r);
 }
 
@@ -61,6 +61,14 @@ struct dcesrv_lsa_Lookup_view_table {
 	const struct dcesrv_lsa_Lookup_view **array;
 };
 
+/*
+ * The number of local lookups a LookupSids or LookupNames call does before
+ * it goes back to the event loop, if the call may be async. This stops
+ * a large batch from blocking other calls on the association (with
+ * DCERPC_PFC_FLAG_CONC_MPX) and on the other connections of the process.
+ */
+#define DCESRV_LSA_LOOKUP_BATCH 100
+
 static const struct dcesrv_lsa_Lookup_view_table *dcesrv_lsa_view_table(
 	enum lsa_LookupNamesLevel level);
 
@@ -283,6 +291,12 @@ struct dcesrv_lsa_LookupSids_base_state {
 
 	struct dsdb_trust_routing_table *routing_table;
 
+	struct {
+		uint32_t view;
+		uint32_t idx;
+		struct tevent_immediate *im;
+	} local;
+
 	struct {
 		struct dcerpc_binding_handle *irpc_handle;
 		struct lsa_SidArray sids;
@@ -304,12 +318,13 @@ static NTSTATUS dcesrv_lsa_LookupSids_base_finish(
 static void dcesrv_lsa_LookupSids_base_map(
 	struct dcesrv_lsa_LookupSids_base_state *state);
 static void dcesrv_lsa_LookupSids_base_done(struct tevent_req *subreq);
+static NTSTATUS dcesrv_lsa_LookupSids_base_next(
+	struct dcesrv_lsa_LookupSids_base_state *state);
 
 static NTSTATUS dcesrv_lsa_LookupSids_base_call(struct dcesrv_lsa_LookupSids_base_state *state)
 {
 	struct lsa_LookupSids3 *r = &state->r;
-	struct tevent_req *subreq = NULL;
-	uint32_t v;
+	NTSTATUS status;
 	uint32_t i;
 
 	*r->out.domains = NULL;
@@ -365,18 +380,64 @@ static NTSTATUS dcesrv_lsa_LookupSids_base_call(struct dcesrv_lsa_LookupSids_bas
 		}
 	}
 
-	for (v=0; v < state->view_table->count; v++) {
+	status = dcesrv_lsa_LookupSids_base_next(state);
+	if (NT_STATUS_EQUAL(status, NT_STATUS_MORE_PROCESSING_REQUIRED)) {
+		state->dce_call->state_flags |= DCESRV_CALL_STATE_FLAG_ASYNC;
+		return NT_STATUS_OK;
+	}
+
+	return status;
+}
+
+static void dcesrv_lsa_LookupSids_base_resume(struct tevent_context *ev,
+					      struct tevent_immediate *im,
+					      void *private_data);
+
+/*
+  run the local views over the SIDs not yet translated, returning
+  NT_STATUS_MORE_PROCESSING_REQUIRED if the remaining ones will be
+  looked up from the event loop
+ */
+static NTSTATUS dcesrv_lsa_LookupSids_base_local(
+	struct dcesrv_lsa_LookupSids_base_state *state)
+{
+	struct lsa_LookupSids3 *r = &state->r;
+	uint32_t lookups = 0;
+
+	for (; state->local.view < state->view_table->count;
+	     state->local.view++, state->local.idx = 0) {
 		const struct dcesrv_lsa_Lookup_view *view =
-			state->view_table->array[v];
+			state->view_table->array[state->local.view];
 
-		for (i=0; i < r->in.sids->num_sids; i++) {
-			struct dcesrv_lsa_TranslatedItem *item = &state->items[i];
+		for (; state->local.idx < r->in.sids->num_sids;
+		     state->local.idx++) {
+			struct dcesrv_lsa_TranslatedItem *item =
+				&state->items[state->local.idx];
 			NTSTATUS status;
 
 			if (item->done) {
 				continue;
 			}
 
+			if (lookups >= DCESRV_LSA_LOOKUP_BATCH &&
+			    (state->dce_call->state_flags &
+			     DCESRV_CALL_STATE_FLAG_MAY_ASYNC)) {
+				if (state->local.im == NULL) {
+					state->local.im =
+						tevent_create_immediate(state);
+					if (state->local.im == NULL) {
+						return NT_STATUS_NO_MEMORY;
+					}
+				}
+				tevent_schedule_immediate(
+					state->local.im,
+					state->dce_call->event_ctx,
+					dcesrv_lsa_LookupSids_base_resume,
+					state);
+				return NT_STATUS_MORE_PROCESSING_REQUIRED;
+			}
+			lookups++;
+
 			status = view->lookup_sid(state, item);
 			if (NT_STATUS_IS_OK(status)) {
 				item->done = true;
@@ -391,6 +452,26 @@ static NTSTATUS dcesrv_lsa_LookupSids_base_call(struct dcesrv_lsa_LookupSids_bas
 		}
 	}
 
+	return NT_STATUS_OK;
+}
+
+/*
+  continue the lookup, returning NT_STATUS_MORE_PROCESSING_REQUIRED if
+  the reply will be sent from the event loop
+ */
+static NTSTATUS dcesrv_lsa_LookupSids_base_next(
+	struct dcesrv_lsa_LookupSids_base_state *state)
+{
+	struct lsa_LookupSids3 *r = &state->r;
+	struct tevent_req *subreq = NULL;
+	NTSTATUS status;
+	uint32_t i;
+
+	status = dcesrv_lsa_LookupSids_base_local(state);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
 	if (state->wb.irpc_handle == NULL) {
 		return dcesrv_lsa_LookupSids_base_finish(state);
 	}
@@ -426,12 +507,35 @@ static NTSTATUS dcesrv_lsa_LookupSids_base_call(struct dcesrv_lsa_LookupSids_bas
 	if (subreq == NULL) {
 		return NT_STATUS_NO_MEMORY;;
 	}
-	state->dce_call->state_flags |= DCESRV_CALL_STATE_FLAG_ASYNC;
 	tevent_req_set_callback(subreq,
 				dcesrv_lsa_LookupSids_base_done,
 				state);
 
-	return NT_STATUS_OK;
+	return NT_STATUS_MORE_PROCESSING_REQUIRED;
+}
+
+static void dcesrv_lsa_LookupSids_base_resume(struct tevent_context *ev,
+					      struct tevent_immediate *im,
+					      void *private_data)
+{
+	struct dcesrv_lsa_LookupSids_base_state *state =
+		talloc_get_type_abort(private_data,
+		struct dcesrv_lsa_LookupSids_base_state);
+	struct dcesrv_call_state *dce_call = state->dce_call;
+	NTSTATUS status;
+
+	status = dcesrv_lsa_LookupSids_base_next(state);
+	if (NT_STATUS_EQUAL(status, NT_STATUS_MORE_PROCESSING_REQUIRED)) {
+		return;
+	}
+
+	state->r.out.result = status;
+	dcesrv_lsa_LookupSids_base_map(state);
+
+	status = dcesrv_reply(dce_call);
+	if (!NT_STATUS_IS_OK(status)) {
+		DEBUG(0,(__location__ ": dcesrv_reply() failed - %s\n", nt_errstr(status)));
+	}
 }
 
 static NTSTATUS dcesrv_lsa_LookupSids_base_finish(
@@ -823,6 +927,12 @@ struct dcesrv_lsa_LookupNames_base_state {
 
 	struct dsdb_trust_routing_table *routing_table;
 
+	struct {
+		uint32_t view;
+		uint32_t idx;
+		struct tevent_immediate *im;
+	} local;
+
 	struct {
 		struct dcerpc_binding_handle *irpc_handle;
 		uint32_t num_names;
@@ -846,13 +956,14 @@ static NTSTATUS dcesrv_lsa_LookupNames_base_finish(
 static void dcesrv_lsa_LookupNames_base_map(
 	struct dcesrv_lsa_LookupNames_base_state *state);
 static void dcesrv_lsa_LookupNames_base_done(struct tevent_req *subreq);
+static NTSTATUS dcesrv_lsa_LookupNames_base_next(
+	struct dcesrv_lsa_LookupNames_base_state *state);
 
 static NTSTATUS dcesrv_lsa_LookupNames_base_call(struct dcesrv_lsa_LookupNames_base_state *state)
 {
 	struct lsa_LookupNames4 *r = &state->r;
 	enum lsa_LookupOptions invalid_lookup_options = 0;
-	struct tevent_req *subreq = NULL;
-	uint32_t v;
+	NTSTATUS status;
 	uint32_t i;
 
 	*r->out.domains = NULL;
@@ -942,18 +1053,64 @@ static NTSTATUS dcesrv_lsa_LookupNames_base_call(struct dcesrv_lsa_LookupNames_b
 		}
 	}
 
-	for (v=0; v < state->view_table->count; v++) {
+	status = dcesrv_lsa_LookupNames_base_next(state);
+	if (NT_STATUS_EQUAL(status, NT_STATUS_MORE_PROCESSING_REQUIRED)) {
+		state->dce_call->state_flags |= DCESRV_CALL_STATE_FLAG_ASYNC;
+		return NT_STATUS_OK;
+	}
+
+	return status;
+}
+
+static void dcesrv_lsa_LookupNames_base_resume(struct tevent_context *ev,
+					       struct tevent_immediate *im,
+					       void *private_data);
+
+/*
+  run the local views over the names not yet translated, returning
+  NT_STATUS_MORE_PROCESSING_REQUIRED if the remaining ones will be
+  looked up from the event loop
+ */
+static NTSTATUS dcesrv_lsa_LookupNames_base_local(
+	struct dcesrv_lsa_LookupNames_base_state *state)
+{
+	struct lsa_LookupNames4 *r = &state->r;
+	uint32_t lookups = 0;
+
+	for (; state->local.view < state->view_table->count;
+	     state->local.view++, state->local.idx = 0) {
 		const struct dcesrv_lsa_Lookup_view *view =
-			state->view_table->array[v];
+			state->view_table->array[state->local.view];
 
-		for (i=0; i < r->in.num_names; i++) {
-			struct dcesrv_lsa_TranslatedItem *item = &state->items[i];
+		for (; state->local.idx < r->in.num_names;
+		     state->local.idx++) {
+			struct dcesrv_lsa_TranslatedItem *item =
+				&state->items[state->local.idx];
 			NTSTATUS status;
 
 			if (item->done) {
 				continue;
 			}
 
+			if (lookups >= DCESRV_LSA_LOOKUP_BATCH &&
+			    (state->dce_call->state_flags &
+			     DCESRV_CALL_STATE_FLAG_MAY_ASYNC)) {
+				if (state->local.im == NULL) {
+					state->local.im =
+						tevent_create_immediate(state);
+					if (state->local.im == NULL) {
+						return NT_STATUS_NO_MEMORY;
+					}
+				}
+				tevent_schedule_immediate(
+					state->local.im,
+					state->dce_call->event_ctx,
+					dcesrv_lsa_LookupNames_base_resume,
+					state);
+				return NT_STATUS_MORE_PROCESSING_REQUIRED;
+			}
+			lookups++;
+
 			status = view->lookup_name(state, item);
 			if (NT_STATUS_IS_OK(status)) {
 				item->done = true;
@@ -968,6 +1125,26 @@ static NTSTATUS dcesrv_lsa_LookupNames_base_call(struct dcesrv_lsa_LookupNames_b
 		}
 	}
 
+	return NT_STATUS_OK;
+}
+
+/*
+  continue the lookup, returning NT_STATUS_MORE_PROCESSING_REQUIRED if
+  the reply will be sent from the event loop
+ */
+static NTSTATUS dcesrv_lsa_LookupNames_base_next(
+	struct dcesrv_lsa_LookupNames_base_state *state)
+{
+	struct lsa_LookupNames4 *r = &state->r;
+	struct tevent_req *subreq = NULL;
+	NTSTATUS status;
+	uint32_t i;
+
+	status = dcesrv_lsa_LookupNames_base_local(state);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
 	if (state->wb.irpc_handle == NULL) {
 		return dcesrv_lsa_LookupNames_base_finish(state);
 	}
@@ -1004,12 +1181,35 @@ static NTSTATUS dcesrv_lsa_LookupNames_base_call(struct dcesrv_lsa_LookupNames_b
 	if (subreq == NULL) {
 		return NT_STATUS_NO_MEMORY;
 	}
-	state->dce_call->state_flags |= DCESRV_CALL_STATE_FLAG_ASYNC;
 	tevent_req_set_callback(subreq,
 				dcesrv_lsa_LookupNames_base_done,
 				state);
 
-	return NT_STATUS_OK;
+	return NT_STATUS_MORE_PROCESSING_REQUIRED;
+}
+
+static void dcesrv_lsa_LookupNames_base_resume(struct tevent_context *ev,
+					       struct tevent_immediate *im,
+					       void *private_data)
+{
+	struct dcesrv_lsa_LookupNames_base_state *state =
+		talloc_get_type_abort(private_data,
+		struct dcesrv_lsa_LookupNames_base_state);
+	struct dcesrv_call_state *dce_call = state->dce_call;
+	NTSTATUS status;
+
+	status = dcesrv_lsa_LookupNames_base_next(state);
+	if (NT_STATUS_EQUAL(status, NT_STATUS_MORE_PROCESSING_REQUIRED)) {
+		return;
+	}
+
+	state->r.out.result = status;
+	dcesrv_lsa_LookupNames_base_map(state);
+
+	status = dcesrv_reply(dce_call);
+	if (!NT_STATUS_IS_OK(status)) {
+		DEBUG(0,(__location__ ": dcesrv_reply() failed - %s\n", nt_errstr(status)));
+	}
 }
 
 static NTSTATUS dcesrv_lsa_LookupNames_base_finish(
@@ -47,6 +47,20 @@
 
 #define min(a, b) (((a) < (b)) ? (a) : (b))
 
+/*
+ * Number of connections each worker of this service is handling, in
+ * memory shared by the prefork master and its workers. Each worker
+ * only writes its own slot, they all read the other slots to decide
+ * if they should leave a new connection to a less loaded worker.
+ */
+struct prefork_load {
+	uint32_t *connections;
+	int num_workers;
+	int instance;		/* -1 in the prefork master */
+	bool deferred;		/* left the last connection to the others */
+};
+static struct prefork_load prefork_load = { .instance = -1 };
+
 NTSTATUS process_model_prefork_init(void);
 static void prefork_new_task(
     struct tevent_context *ev,
@@ -354,7 +368,10 @@ static void prefork_fork_master(
 
 	{
 		int default_children;
-		default_children = lpcfg_prefork_children(lp_ctx);
+		default_children = service_details->pre_fork_children;
+		if (default_children == 0) {
+			default_children = lpcfg_prefork_children(lp_ctx);
+		}
 		num_children = lpcfg_parm_int(lp_ctx, NULL, "prefork children",
 			                      service_name, default_children);
 	}
@@ -382,6 +399,18 @@ static void prefork_fork_master(
 		smb_set_close_on_exec(control_pipe[1]);
 	}
 
+	if (num_children > 1 && lpcfg_prefork_balance_connections(lp_ctx)) {
+		prefork_load.connections = anonymous_shared_allocate(
+			sizeof(uint32_t) * num_children);
+		if (prefork_load.connections == NULL) {
+			DBG_WARNING("Unable to allocate the connection "
+				    "counters, not balancing %s connections\n",
+				    service_name);
+		} else {
+			prefork_load.num_workers = num_children;
+		}
+	}
+
 	/*
 	 * We are now free to spawn some worker processes
 	 */
@@ -530,6 +559,35 @@ static void prefork_child_pipe_handler(struct tevent_context *ev,
 	return;
 }
 
+/*
+ * All workers are woken when a connection arrives, whoever calls accept
+ * first gets it. Give the other workers a head start if we are handling
+ * more connections than the least loaded one, but only once, so that a
+ * connection isn't left waiting when the other workers are all busy.
+ */
+static bool prefork_defer_accept(void)
+{
+	uint32_t mine;
+	int i;
+
+	if (prefork_load.connections == NULL || prefork_load.instance < 0) {
+		return false;
+	}
+	if (prefork_load.deferred) {
+		prefork_load.deferred = false;
+		return false;
+	}
+
+	mine = prefork_load.connections[prefork_load.instance];
+	for (i = 0; i < prefork_load.num_workers; i++) {
+		if (prefork_load.connections[i] < mine) {
+			prefork_load.deferred = true;
+			return true;
+		}
+	}
+	return false;
+}
+
 /*
   called when a listening socket becomes readable.
 */
@@ -550,6 +608,10 @@ static void prefork_accept_connection(
 	struct socket_context *connected_socket;
 	pid_t pid = getpid();
 
+	if (prefork_defer_accept()) {
+		return;
+	}
+
 	/* accept an incoming connection. */
 	status = socket_accept(listen_socket, &connected_socket);
 	if (!NT_STATUS_IS_OK(status)) {
@@ -572,6 +634,10 @@ static void prefork_accept_connection(
 
 	talloc_steal(private_data, connected_socket);
 
+	if (prefork_load.connections != NULL) {
+		prefork_load.connections[prefork_load.instance] += 1;
+	}
+
 	new_conn(ev, lp_ctx, connected_socket,
 		 cluster_id(pid, socket_get_fd(connected_socket)),
 		 private_data, process_context);
@@ -680,6 +746,18 @@ static void prefork_fork_worker(struct task_server *task,
 		close(control_pipe[1]);
 		setup_handlers(ev2, lp_ctx, control_pipe[0]);
 
+		if (prefork_load.connections != NULL &&
+		    pd->instances < prefork_load.num_workers) {
+			/*
+			 * A restarted worker starts without the connections
+			 * of its predecessor
+			 */
+			prefork_load.instance = pd->instances;
+			prefork_load.connections[pd->instances] = 0;
+		} else {
+			prefork_load.connections = NULL;
+		}
+
 		/*
 		 * tfork uses malloc
 		 */
@@ -762,6 +840,11 @@ static void prefork_terminate_connection(struct tevent_context *ev,
 					 const char *reason,
 					 void *process_context)
 {
+	if (prefork_load.connections != NULL &&
+	    prefork_load.instance >= 0 &&
+	    prefork_load.connections[prefork_load.instance] > 0) {
+		prefork_load.connections[prefork_load.instance] -= 1;
+	}
 }
 
 /* called to set a title of a task or connection */
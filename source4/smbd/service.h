@@ -49,6 +49,14 @@ struct service_details {
 	 * inhibit_fork_on_accept set.
 	 */
 	bool inhibit_pre_fork;
+	/*
+	 * The number of pre-fork worker processes to start when
+	 * "prefork children:<service name>" is not set, zero means use
+	 * "prefork children". Services holding per process state that
+	 * clients expect to find on their next request use this to default
+	 * to a single worker.
+	 */
+	unsigned int pre_fork_children;
 	/*
 	 * Initialise the server task.
 	 */
@@ -378,11 +378,12 @@ NTSTATUS stream_setup_socket(TALLOC_CTX *mem_ctx,
 
 	/* Add the FD from the newly created socket into the event
 	 * subsystem.  it will call the accept handler whenever we get
-	 * new connections */
+	 * new connections. With the prefork process model all workers
+	 * wait for the socket, wake up only one of them. */
 
 	fde = tevent_add_fd(event_context, stream_socket->sock,
 			    socket_get_fd(stream_socket->sock),
-			    TEVENT_FD_READ,
+			    TEVENT_FD_READ|TEVENT_FD_EXCLUSIVE,
 			    stream_accept_handler, stream_socket);
 	if (!fde) {
 		DBG_ERR("Failed to setup fd event\n");
@@ -0,0 +1,871 @@
+/*
+   Unix SMB/CIFS implementation.
+
+   SMB2 benchmarks
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Each test opens "nprocs" connections and keeps "bench_queue_depth"
+ * requests outstanding on each of them for "timelimit" seconds. At the
+ * end a single line starting with "BENCH" is printed, with key=value
+ * pairs for the request rate, the throughput and the latency
+ * percentiles, so runs can be compared by scripts.
+ *
+ * Options (--option=torture:<name>=<value>):
+ *
+ *   nprocs              number of connections (4)
+ *   timelimit           seconds to run (10)
+ *   bench_queue_depth   outstanding requests per connection (4)
+ *   bench_io_size       bytes per read or write (65536)
+ *   bench_file_size     bytes per file for read and write (16 MiB)
+ *   bench_random        random instead of sequential offsets (false)
+ *   bench_num_files     directory entries for the querydir test (100)
+ */
+
+#include "includes.h"
+#include "libcli/smb2/smb2.h"
+#include "libcli/smb2/smb2_calls.h"
+#include "../libcli/smb/smbXcli_base.h"
+#include "torture/torture.h"
+#include "torture/smb2/proto.h"
+#include "system/time.h"
+#include "lib/util/tsort.h"
+#include <tevent.h>
+
+#define BASEDIR "bench"
+
+struct bench_client {
+	struct smb2_tree *tree;
+	struct smb2_handle h;
+	bool have_handle;
+	uint64_t offset;
+	uint64_t lease_key;
+};
+
+struct bench_state {
+	struct torture_context *tctx;
+	const char *name;
+	int num_clients;
+	int queue_depth;
+	uint32_t io_size;
+	uint64_t file_size;
+	bool random;
+	const uint8_t *buf;
+
+	struct timeval start;
+	struct timeval end;
+	size_t pending;
+	NTSTATUS error;
+
+	uint64_t num_ops;
+	uint64_t num_bytes;
+	uint32_t *lat_us;
+	size_t num_lat;
+	size_t alloc_lat;
+};
+
+struct bench_op {
+	struct bench_state *state;
+	struct bench_client *client;
+	TALLOC_CTX *mem_ctx;
+	struct smb2_handle h;
+	struct timeval issued;
+	bool (*send_fn)(struct bench_op *op);
+	union {
+		struct smb2_read r;
+		struct smb2_write w;
+		struct smb2_create c;
+		struct smb2_close cl;
+		struct smb2_find f;
+	} io;
+};
+
+static void bench_state_init(struct torture_context *tctx,
+			     struct bench_state *state,
+			     const char *name)
+{
+	*state = (struct bench_state) {
+		.tctx = tctx,
+		.name = name,
+		.num_clients = torture_setting_int(tctx, "nprocs", 4),
+		.queue_depth = torture_setting_int(tctx, "bench_queue_depth", 4),
+		.io_size = torture_setting_int(tctx, "bench_io_size", 64*1024),
+		.file_size = torture_setting_int(tctx, "bench_file_size",
+						 16*1024*1024),
+		.random = torture_setting_bool(tctx, "bench_random", false),
+		.error = NT_STATUS_OK,
+	};
+
+	state->num_clients = MAX(state->num_clients, 1);
+	state->queue_depth = MAX(state->queue_depth, 1);
+	state->io_size = MAX(state->io_size, 1);
+	state->file_size = MAX(state->file_size, state->io_size);
+}
+
+/*
+ * The tree we got from the torture framework is client 0, open the other
+ * connections.
+ */
+static bool bench_connect(struct bench_state *state,
+			  struct smb2_tree *tree,
+			  struct bench_client **pclients)
+{
+	struct torture_context *tctx = state->tctx;
+	struct bench_client *clients = NULL;
+	int i;
+
+	clients = talloc_zero_array(tctx, struct bench_client,
+				    state->num_clients);
+	torture_assert(tctx, clients != NULL, "talloc failed");
+
+	torture_comment(tctx, "Opening %d connections\n", state->num_clients);
+
+	clients[0].tree = tree;
+	for (i = 1; i < state->num_clients; i++) {
+		bool ok = torture_smb2_connection(tctx, &clients[i].tree);
+		torture_assert(tctx, ok, "torture_smb2_connection failed");
+		talloc_steal(clients, clients[i].tree);
+	}
+
+	*pclients = clients;
+	return true;
+}
+
+static void bench_close_handles(struct bench_client *clients,
+				int num_clients)
+{
+	int i;
+
+	for (i = 0; i < num_clients; i++) {
+		if (clients[i].have_handle) {
+			smb2_util_close(clients[i].tree, clients[i].h);
+			clients[i].have_handle = false;
+		}
+	}
+}
+
+/*
+ * Account for one completed operation that was sent at "issued"
+ */
+static bool bench_record(struct bench_state *state,
+			 const struct timeval *issued,
+			 uint64_t bytes)
+{
+	struct timeval now = timeval_current();
+	uint64_t usec;
+
+	if (state->num_lat == state->alloc_lat) {
+		size_t alloc = MAX(state->alloc_lat * 2, 1024);
+		uint32_t *tmp = talloc_realloc(state->tctx, state->lat_us,
+					       uint32_t, alloc);
+		if (tmp == NULL) {
+			return false;
+		}
+		state->lat_us = tmp;
+		state->alloc_lat = alloc;
+	}
+
+	usec = usec_time_diff(&now, issued);
+	state->lat_us[state->num_lat++] = MIN(usec, UINT32_MAX);
+	state->num_ops += 1;
+	state->num_bytes += bytes;
+
+	return true;
+}
+
+static void bench_op_next(struct bench_op *op);
+
+static void bench_op_done(struct bench_op *op, NTSTATUS status,
+			  uint64_t bytes)
+{
+	struct bench_state *state = op->state;
+
+	talloc_free_children(op->mem_ctx);
+
+	if (NT_STATUS_IS_OK(status) &&
+	    !bench_record(state, &op->issued, bytes)) {
+		status = NT_STATUS_NO_MEMORY;
+	}
+	if (!NT_STATUS_IS_OK(status)) {
+		if (NT_STATUS_IS_OK(state->error)) {
+			state->error = status;
+		}
+		state->pending -= 1;
+		return;
+	}
+
+	bench_op_next(op);
+}
+
+static void bench_op_next(struct bench_op *op)
+{
+	struct bench_state *state = op->state;
+	bool ok;
+
+	if (!NT_STATUS_IS_OK(state->error) || timeval_expired(&state->end)) {
+		state->pending -= 1;
+		return;
+	}
+
+	op->issued = timeval_current();
+	ok = op->send_fn(op);
+	if (!ok) {
+		state->error = NT_STATUS_NO_MEMORY;
+		state->pending -= 1;
+	}
+}
+
+static int bench_lat_cmp(const uint32_t *a, const uint32_t *b)
+{
+	if (*a == *b) {
+		return 0;
+	}
+	return (*a < *b) ? -1 : 1;
+}
+
+static uint32_t bench_percentile(const struct bench_state *state,
+				 unsigned per_mille)
+{
+	size_t idx;
+
+	if (state->num_lat == 0) {
+		return 0;
+	}
+	idx = ((state->num_lat - 1) * per_mille) / 1000;
+	return state->lat_us[idx];
+}
+
+static void bench_report(struct bench_state *state)
+{
+	struct torture_context *tctx = state->tctx;
+	double secs = timeval_elapsed(&state->start);
+
+	TYPESAFE_QSORT(state->lat_us, state->num_lat, bench_lat_cmp);
+
+	torture_comment(tctx,
+			"BENCH test=%s clients=%d queue_depth=%d "
+			"io_size=%"PRIu32" random=%d "
+			"secs=%.3f ops=%"PRIu64" ops_per_sec=%.1f "
+			"mb_per_sec=%.2f "
+			"lat_us_min=%"PRIu32" lat_us_p50=%"PRIu32" "
+			"lat_us_p90=%"PRIu32" lat_us_p99=%"PRIu32" "
+			"lat_us_p999=%"PRIu32" lat_us_max=%"PRIu32"\n",
+			state->name,
+			state->num_clients,
+			state->queue_depth,
+			state->io_size,
+			state->random ? 1 : 0,
+			secs,
+			state->num_ops,
+			state->num_ops / secs,
+			state->num_bytes / secs / (1024 * 1024),
+			bench_percentile(state, 0),
+			bench_percentile(state, 500),
+			bench_percentile(state, 900),
+			bench_percentile(state, 990),
+			bench_percentile(state, 999),
+			bench_percentile(state, 1000));
+}
+
+/*
+ * Run send_fn with queue_depth requests outstanding on every client
+ * until the time limit is up, then print the results.
+ */
+static bool bench_run(struct bench_state *state,
+		      struct bench_client *clients,
+		      bool (*send_fn)(struct bench_op *op),
+		      bool (*setup_fn)(struct bench_op *op),
+		      void (*cleanup_fn)(struct bench_op *op))
+{
+	struct torture_context *tctx = state->tctx;
+	int timelimit = torture_setting_int(tctx, "timelimit", 10);
+	size_t num_ops = state->num_clients * state->queue_depth;
+	struct bench_op *ops = NULL;
+	size_t i;
+
+	ops = talloc_zero_array(tctx, struct bench_op, num_ops);
+	torture_assert(tctx, ops != NULL, "talloc failed");
+
+	for (i = 0; i < num_ops; i++) {
+		ops[i].state = state;
+		ops[i].client = &clients[i % state->num_clients];
+		ops[i].send_fn = send_fn;
+		ops[i].mem_ctx = talloc_new(ops);
+		if (ops[i].mem_ctx == NULL) {
+			num_ops = i;
+			state->error = NT_STATUS_NO_MEMORY;
+			goto cleanup;
+		}
+
+		if (setup_fn != NULL && !setup_fn(&ops[i])) {
+			num_ops = i;
+			goto cleanup;
+		}
+	}
+
+	torture_comment(tctx, "Running %s for %d seconds\n",
+			state->name, timelimit);
+
+	state->start = timeval_current();
+	state->end = timeval_add(&state->start, timelimit, 0);
+
+	for (i = 0; i < num_ops; i++) {
+		state->pending += 1;
+		bench_op_next(&ops[i]);
+	}
+
+	while (state->pending > 0) {
+		int ret = tevent_loop_once(tctx->ev);
+		if (ret != 0) {
+			state->error = map_nt_error_from_unix_common(errno);
+			break;
+		}
+	}
+
+	if (NT_STATUS_IS_OK(state->error)) {
+		bench_report(state);
+	}
+
+cleanup:
+	if (cleanup_fn != NULL) {
+		for (i = 0; i < num_ops; i++) {
+			cleanup_fn(&ops[i]);
+		}
+	}
+	TALLOC_FREE(ops);
+
+	torture_assert_ntstatus_ok(tctx, state->error, state->name);
+	return true;
+}
+
+/*
+ * Each client gets its own file of bench_file_size bytes
+ */
+static bool bench_open_files(struct bench_state *state,
+			     struct bench_client *clients,
+			     bool fill)
+{
+	struct torture_context *tctx = state->tctx;
+	int i;
+
+	for (i = 0; i < state->num_clients; i++) {
+		struct bench_client *c = &clients[i];
+		char *fname = NULL;
+		uint64_t ofs;
+		NTSTATUS status;
+
+		fname = talloc_asprintf(tctx, BASEDIR "\\file-%d.dat", i);
+		torture_assert(tctx, fname != NULL, "talloc failed");
+
+		status = torture_smb2_testfile(c->tree, fname, &c->h);
+		TALLOC_FREE(fname);
+		torture_assert_ntstatus_ok(tctx, status, "create failed");
+		c->have_handle = true;
+
+		for (ofs = 0; fill && ofs < state->file_size;
+		     ofs += state->io_size) {
+			size_t len = MIN(state->io_size, state->file_size - ofs);
+
+			status = smb2_util_write(c->tree, c->h, state->buf,
+						 ofs, len);
+			torture_assert_ntstatus_ok(tctx, status,
+						   "write failed");
+		}
+	}
+
+	return true;
+}
+
+static uint64_t bench_next_offset(struct bench_op *op)
+{
+	struct bench_state *state = op->state;
+	struct bench_client *c = op->client;
+	uint64_t num_blocks = state->file_size / state->io_size;
+	uint64_t ofs;
+
+	if (state->random) {
+		return (random() % num_blocks) * state->io_size;
+	}
+
+	ofs = c->offset;
+	c->offset += state->io_size;
+	if (c->offset + state->io_size > state->file_size) {
+		c->offset = 0;
+	}
+	return ofs;
+}
+
+static void bench_read_done(struct smb2_request *req)
+{
+	struct bench_op *op = req->async.private_data;
+	NTSTATUS status;
+	uint64_t bytes;
+
+	status = smb2_read_recv(req, op->mem_ctx, &op->io.r);
+	bytes = op->io.r.out.data.length;
+
+	bench_op_done(op, status, bytes);
+}
+
+static bool bench_read_send(struct bench_op *op)
+{
+	struct smb2_request *req = NULL;
+
+	op->io.r = (struct smb2_read) {
+		.in.file.handle = op->client->h,
+		.in.length = op->state->io_size,
+		.in.offset = bench_next_offset(op),
+	};
+
+	req = smb2_read_send(op->client->tree, &op->io.r);
+	if (req == NULL) {
+		return false;
+	}
+	req->async.fn = bench_read_done;
+	req->async.private_data = op;
+	return true;
+}
+
+static void bench_write_done(struct smb2_request *req)
+{
+	struct bench_op *op = req->async.private_data;
+	NTSTATUS status;
+
+	status = smb2_write_recv(req, &op->io.w);
+	bench_op_done(op, status, op->io.w.out.nwritten);
+}
+
+static bool bench_write_send(struct bench_op *op)
+{
+	struct smb2_request *req = NULL;
+
+	op->io.w = (struct smb2_write) {
+		.in.file.handle = op->client->h,
+		.in.offset = bench_next_offset(op),
+		.in.data = data_blob_const(op->state->buf, op->state->io_size),
+	};
+
+	req = smb2_write_send(op->client->tree, &op->io.w);
+	if (req == NULL) {
+		return false;
+	}
+	req->async.fn = bench_write_done;
+	req->async.private_data = op;
+	return true;
+}
+
+static bool bench_rw(struct torture_context *tctx,
+		     struct smb2_tree *tree,
+		     const char *name,
+		     bool (*send_fn)(struct bench_op *op))
+{
+	struct bench_state state;
+	struct bench_client *clients = NULL;
+	struct smb2_handle h;
+	uint32_t max_io;
+	uint8_t *buf = NULL;
+	NTSTATUS status;
+	bool ret = false;
+
+	bench_state_init(tctx, &state, name);
+
+	if (send_fn == bench_read_send) {
+		max_io = smb2cli_conn_max_read_size(tree->session->transport->conn);
+	} else {
+		max_io = smb2cli_conn_max_write_size(tree->session->transport->conn);
+	}
+	if (state.io_size > max_io) {
+		torture_comment(tctx, "Reducing bench_io_size to the "
+				"negotiated maximum of %"PRIu32"\n", max_io);
+		state.io_size = max_io;
+	}
+
+	buf = talloc_zero_array(tctx, uint8_t, state.io_size);
+	torture_assert(tctx, buf != NULL, "talloc failed");
+	state.buf = buf;
+
+	smb2_deltree(tree, BASEDIR);
+	status = torture_smb2_testdir(tree, BASEDIR, &h);
+	torture_assert_ntstatus_ok(tctx, status, "Error creating directory");
+	smb2_util_close(tree, h);
+
+	if (!bench_connect(&state, tree, &clients)) {
+		goto done;
+	}
+	if (!bench_open_files(&state, clients, send_fn == bench_read_send)) {
+		goto done;
+	}
+
+	ret = bench_run(&state, clients, send_fn, NULL, NULL);
+
+done:
+	if (clients != NULL) {
+		bench_close_handles(clients, state.num_clients);
+	}
+	smb2_deltree(tree, BASEDIR);
+	TALLOC_FREE(clients);
+	TALLOC_FREE(buf);
+	TALLOC_FREE(state.lat_us);
+	return ret;
+}
+
+static bool test_bench_read(struct torture_context *tctx,
+			    struct smb2_tree *tree)
+{
+	return bench_rw(tctx, tree, "read", bench_read_send);
+}
+
+static bool test_bench_write(struct torture_context *tctx,
+			     struct smb2_tree *tree)
+{
+	return bench_rw(tctx, tree, "write", bench_write_send);
+}
+
+/*
+ * One operation is a create of an existing file followed by a close, the
+ * latency covers both round trips.
+ */
+static void bench_open_close_closed(struct smb2_request *req)
+{
+	struct bench_op *op = req->async.private_data;
+	NTSTATUS status;
+
+	status = smb2_close_recv(req, &op->io.cl);
+	bench_op_done(op, status, 0);
+}
+
+static void bench_open_close_opened(struct smb2_request *req)
+{
+	struct bench_op *op = req->async.private_data;
+	struct smb2_handle h;
+	NTSTATUS status;
+
+	status = smb2_create_recv(req, op->mem_ctx, &op->io.c);
+	if (!NT_STATUS_IS_OK(status)) {
+		bench_op_done(op, status, 0);
+		return;
+	}
+	h = op->io.c.out.file.handle;
+
+	op->io.cl = (struct smb2_close) {
+		.in.file.handle = h,
+	};
+
+	req = smb2_close_send(op->client->tree, &op->io.cl);
+	if (req == NULL) {
+		bench_op_done(op, NT_STATUS_NO_MEMORY, 0);
+		return;
+	}
+	req->async.fn = bench_open_close_closed;
+	req->async.private_data = op;
+}
+
+static bool bench_open_close_send(struct bench_op *op)
+{
+	struct smb2_request *req = NULL;
+
+	op->io.c = (struct smb2_create) {
+		.in.fname = BASEDIR "\\open-close.dat",
+		.in.desired_access = SEC_FILE_READ_ATTRIBUTE,
+		.in.file_attributes = FILE_ATTRIBUTE_NORMAL,
+		.in.share_access = NTCREATEX_SHARE_ACCESS_MASK,
+		.in.create_disposition = NTCREATEX_DISP_OPEN,
+		.in.impersonation_level = SMB2_IMPERSONATION_IMPERSONATION,
+	};
+
+	req = smb2_create_send(op->client->tree, &op->io.c);
+	if (req == NULL) {
+		return false;
+	}
+	req->async.fn = bench_open_close_opened;
+	req->async.private_data = op;
+	return true;
+}
+
+static bool test_bench_open_close(struct torture_context *tctx,
+				  struct smb2_tree *tree)
+{
+	struct bench_state state;
+	struct bench_client *clients = NULL;
+	struct smb2_handle h;
+	NTSTATUS status;
+	bool ret = false;
+
+	bench_state_init(tctx, &state, "open-close");
+	state.io_size = 0;
+
+	smb2_deltree(tree, BASEDIR);
+	status = torture_smb2_testdir(tree, BASEDIR, &h);
+	torture_assert_ntstatus_ok(tctx, status, "Error creating directory");
+	smb2_util_close(tree, h);
+
+	status = torture_smb2_testfile(tree, BASEDIR "\\open-close.dat", &h);
+	torture_assert_ntstatus_ok(tctx, status, "Error creating file");
+	smb2_util_close(tree, h);
+
+	if (bench_connect(&state, tree, &clients)) {
+		ret = bench_run(&state, clients, bench_open_close_send,
+				NULL, NULL);
+	}
+
+	smb2_deltree(tree, BASEDIR);
+	TALLOC_FREE(clients);
+	TALLOC_FREE(state.lat_us);
+	return ret;
+}
+
+/*
+ * Every outstanding request lists the directory from the start on its
+ * own handle, so concurrent requests don't step on each other's
+ * enumeration state.
+ */
+static bool bench_querydir_setup(struct bench_op *op)
+{
+	struct torture_context *tctx = op->state->tctx;
+	NTSTATUS status;
+
+	status = torture_smb2_testdir(op->client->tree, BASEDIR, &op->h);
+	torture_assert_ntstatus_ok(tctx, status, "Error opening directory");
+	return true;
+}
+
+static void bench_querydir_cleanup(struct bench_op *op)
+{
+	smb2_util_close(op->client->tree, op->h);
+}
+
+static void bench_querydir_done(struct smb2_request *req)
+{
+	struct bench_op *op = req->async.private_data;
+	NTSTATUS status;
+	uint64_t bytes;
+
+	status = smb2_find_recv(req, op->mem_ctx, &op->io.f);
+	bytes = op->io.f.out.blob.length;
+
+	bench_op_done(op, status, bytes);
+}
+
+static bool bench_querydir_send(struct bench_op *op)
+{
+	struct smb2_request *req = NULL;
+
+	op->io.f = (struct smb2_find) {
+		.in.file.handle = op->h,
+		.in.pattern = "*",
+		.in.continue_flags = SMB2_CONTINUE_FLAG_RESTART,
+		.in.max_response_size = 0x10000,
+		.in.level = SMB2_FIND_ID_BOTH_DIRECTORY_INFO,
+	};
+
+	req = smb2_find_send(op->client->tree, &op->io.f);
+	if (req == NULL) {
+		return false;
+	}
+	req->async.fn = bench_querydir_done;
+	req->async.private_data = op;
+	return true;
+}
+
+static bool test_bench_querydir(struct torture_context *tctx,
+				struct smb2_tree *tree)
+{
+	struct bench_state state;
+	struct bench_client *clients = NULL;
+	int num_files = torture_setting_int(tctx, "bench_num_files", 100);
+	struct smb2_handle h;
+	NTSTATUS status;
+	bool ret = false;
+	int i;
+
+	bench_state_init(tctx, &state, "querydir");
+	state.io_size = 0;
+
+	smb2_deltree(tree, BASEDIR);
+	status = torture_smb2_testdir(tree, BASEDIR, &h);
+	torture_assert_ntstatus_ok(tctx, status, "Error creating directory");
+	smb2_util_close(tree, h);
+
+	torture_comment(tctx, "Creating %d files\n", num_files);
+	for (i = 0; i < num_files; i++) {
+		char *fname = talloc_asprintf(tctx, BASEDIR "\\file-%d.dat", i);
+		torture_assert_goto(tctx, fname != NULL, ret, done,
+				    "talloc failed");
+
+		status = torture_smb2_testfile(tree, fname, &h);
+		TALLOC_FREE(fname);
+		torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+						"Error creating file");
+		smb2_util_close(tree, h);
+	}
+
+	if (bench_connect(&state, tree, &clients)) {
+		ret = bench_run(&state, clients, bench_querydir_send,
+				bench_querydir_setup, bench_querydir_cleanup);
+	}
+
+done:
+	smb2_deltree(tree, BASEDIR);
+	TALLOC_FREE(clients);
+	TALLOC_FREE(state.lat_us);
+	return ret;
+}
+
+static void bench_lease_break_closed(struct smb2_request *req)
+{
+	smb2_request_receive(req);
+	smb2_request_destroy(req);
+}
+
+/*
+ * Give the lease up by closing the handle, that lets the open that
+ * caused the break go ahead.
+ */
+static bool bench_lease_break_handler(struct smb2_transport *transport,
+				      const struct smb2_lease_break *lb,
+				      void *private_data)
+{
+	struct bench_client *c = private_data;
+	struct smb2_close cl = {
+		.in.file.handle = c->h,
+	};
+	struct smb2_request *req = NULL;
+
+	if (!c->have_handle) {
+		return true;
+	}
+	c->have_handle = false;
+
+	req = smb2_close_send(c->tree, &cl);
+	if (req == NULL) {
+		return false;
+	}
+	req->async.fn = bench_lease_break_closed;
+	req->async.private_data = NULL;
+	return true;
+}
+
+/*
+ * The clients take turns opening the same file without sharing and with
+ * an RWH lease, so every open has to break the lease of the previous
+ * client first. This measures how fast lease breaks go round.
+ */
+static bool test_bench_lease_break(struct torture_context *tctx,
+				   struct smb2_tree *tree)
+{
+	struct bench_state state;
+	struct bench_client *clients = NULL;
+	struct smb2_handle h;
+	NTSTATUS status;
+	bool ret = false;
+	int timelimit = torture_setting_int(tctx, "timelimit", 10);
+	uint32_t caps;
+	int i;
+
+	caps = smb2cli_conn_server_capabilities(
+		tree->session->transport->conn);
+	if (!(caps & SMB2_CAP_LEASING)) {
+		torture_skip(tctx, "leases are not supported");
+	}
+
+	bench_state_init(tctx, &state, "lease-break");
+	state.io_size = 0;
+	state.queue_depth = 1;
+	state.num_clients = MAX(state.num_clients, 2);
+
+	smb2_deltree(tree, BASEDIR);
+	status = torture_smb2_testdir(tree, BASEDIR, &h);
+	torture_assert_ntstatus_ok(tctx, status, "Error creating directory");
+	smb2_util_close(tree, h);
+
+	if (!bench_connect(&state, tree, &clients)) {
+		goto done;
+	}
+	for (i = 0; i < state.num_clients; i++) {
+		struct smb2_transport *t = clients[i].tree->session->transport;
+
+		clients[i].lease_key = 0xBE0C000000000000ULL + i;
+		t->lease.handler = bench_lease_break_handler;
+		t->lease.private_data = &clients[i];
+	}
+
+	torture_comment(tctx, "Running %s for %d seconds\n",
+			state.name, timelimit);
+
+	state.start = timeval_current();
+	state.end = timeval_add(&state.start, timelimit, 0);
+
+	while (!timeval_expired(&state.end)) {
+		for (i = 0; i < state.num_clients; i++) {
+			struct bench_client *c = &clients[i];
+			struct timeval issued;
+			struct smb2_create io;
+			struct smb2_lease ls;
+			bool ok;
+
+			smb2_lease_create_share(&io, &ls, false,
+						BASEDIR "\\lease.dat",
+						smb2_util_share_access(""),
+						c->lease_key,
+						smb2_util_lease_state("RHW"));
+
+			issued = timeval_current();
+			status = smb2_create(c->tree, tctx, &io);
+			torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+							"create failed");
+			c->h = io.out.file.handle;
+			c->have_handle = true;
+
+			ok = bench_record(&state, &issued, 0);
+			torture_assert_goto(tctx, ok, ret, done,
+					    "talloc failed");
+		}
+	}
+
+	bench_report(&state);
+	ret = true;
+
+done:
+	if (clients != NULL) {
+		for (i = 0; i < state.num_clients; i++) {
+			struct smb2_transport *t =
+				clients[i].tree->session->transport;
+			t->lease.handler = NULL;
+		}
+		bench_close_handles(clients, state.num_clients);
+	}
+	smb2_deltree(tree, BASEDIR);
+	TALLOC_FREE(clients);
+	TALLOC_FREE(state.lat_us);
+	return ret;
+}
+
+struct torture_suite *torture_smb2_bench_init(TALLOC_CTX *ctx)
+{
+	struct torture_suite *suite = torture_suite_create(ctx, "bench");
+
+	torture_suite_add_1smb2_test(suite, "read", test_bench_read);
+	torture_suite_add_1smb2_test(suite, "write", test_bench_write);
+	torture_suite_add_1smb2_test(suite, "open-close",
+				     test_bench_open_close);
+	torture_suite_add_1smb2_test(suite, "querydir", test_bench_querydir);
+	torture_suite_add_1smb2_test(suite, "lease-break",
+				     test_bench_lease_break);
+
+	suite->description = talloc_strdup(suite, "SMB2 benchmarks");
+
+	return suite;
+}
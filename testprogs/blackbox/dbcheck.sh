@@ -52,6 +52,52 @@ force_modules() {
 	$PYTHON $BINDIR/samba-tool dbcheck --force-modules $ARGS
 }
 
+highest_usn() {
+	sed -n 's/^Highest committed USN before the check was \([0-9]*\),.*/\1/p'
+}
+
+# A run from the reported USN checks nothing, until an object changes
+changed_since_usn() {
+	out=`$PYTHON $BINDIR/samba-tool dbcheck --cross-ncs --changed-since-usn=0 $ARGS`
+	if [ $? -ne 0 ]; then
+		echo "$out"
+		return 1
+	fi
+	usn=`echo "$out" | highest_usn`
+	if [ -z "$usn" ]; then
+		echo "$out"
+		echo "no highest committed USN reported"
+		return 1
+	fi
+
+	out=`$PYTHON $BINDIR/samba-tool dbcheck --cross-ncs --changed-since-usn=$usn $ARGS`
+	if [ $? -ne 0 ]; then
+		echo "$out"
+		return 1
+	fi
+	echo "$out" | grep -q "^Checking 0 objects$"
+	if [ $? -ne 0 ]; then
+		echo "$out"
+		echo "expected no objects changed after USN $usn"
+		return 1
+	fi
+
+	$PYTHON $BINDIR/samba-tool user setexpiry Administrator --noexpiry $ARGS || return 1
+
+	out=`$PYTHON $BINDIR/samba-tool dbcheck --cross-ncs --changed-since-usn=$usn $ARGS`
+	if [ $? -ne 0 ]; then
+		echo "$out"
+		return 1
+	fi
+	echo "$out" | grep -q "^Checking 0 objects$"
+	if [ $? -eq 0 ]; then
+		echo "$out"
+		echo "modified object after USN $usn not checked"
+		return 1
+	fi
+	return 0
+}
+
 dbcheck_fix_one_way_links
 dbcheck_fix_stale_links
 dbcheck_fix_crosspartition_backlinks
@@ -59,5 +105,6 @@ testit "dbcheck" dbcheck
 testit "reindex" reindex
 testit "fixed_attrs" fixed_attrs
 testit "force_modules" force_modules
+testit "changed_since_usn" changed_since_usn
 
 exit $failed